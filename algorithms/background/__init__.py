@@ -1,3 +1,8 @@
 from dials_algorithms_background_ext import *  # noqa: F403; lgtm
 
-__all__ = ("RadialAverage", "set_shoebox_background_value")  # noqa: F405
+__all__ = (  # noqa: F405
+    "BackgroundValidation",
+    "RadialAverage",
+    "overlap_clusters",
+    "set_shoebox_background_value",
+)
@@ -10,8 +10,10 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <dials/algorithms/background/cluster.h>
 #include <dials/algorithms/background/helpers.h>
 #include <dials/algorithms/background/radial_average.h>
+#include <dials/algorithms/background/validation.h>
 
 namespace dials { namespace algorithms { namespace background { namespace boost_python {
 
@@ -22,16 +24,41 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
         &set_shoebox_background_value<float>,
         (arg("reflections"), arg("value")));
 
+    af::shared<std::size_t> (*overlap_clusters_bbox)(
+      const af::const_ref<int6>&, const af::const_ref<std::size_t>&, std::size_t) =
+      &overlap_clusters;
+    def("overlap_clusters",
+        overlap_clusters_bbox,
+        (arg("bbox"), arg("panel"), arg("max_size")));
+
     class_<RadialAverage>("RadialAverage", no_init)
       .def(init<boost::shared_ptr<BeamBase>,
                 const Detector&,
                 double,
                 double,
-                std::size_t>())
+                std::size_t,
+                std::size_t>((arg("beam"),
+                              arg("detector"),
+                              arg("vmin"),
+                              arg("vmax"),
+                              arg("num_bins"),
+                              arg("nthreads") = 1)))
       .def("add", &RadialAverage::add)
+      .def("__iadd__", &RadialAverage::operator+=)
       .def("mean", &RadialAverage::mean)
       .def("weight", &RadialAverage::weight)
       .def("inv_d2", &RadialAverage::inv_d2);
+
+    class_<BackgroundValidation>("BackgroundValidation", no_init)
+      .def(init<const af::const_ref<Shoebox<> >&, std::size_t>(
+        (arg("shoeboxes"), arg("nthreads") = 1)))
+      .def("num_pixels", &BackgroundValidation::num_pixels)
+      .def("max_counts", &BackgroundValidation::max_counts)
+      .def("mean_background", &BackgroundValidation::mean_background)
+      .def("expected_max_counts", &BackgroundValidation::expected_max_counts)
+      .def("ks_d", &BackgroundValidation::ks_d)
+      .def("ks_p", &BackgroundValidation::ks_p)
+      .def("is_poisson", &BackgroundValidation::is_poisson);
   }
 
 }}}}  // namespace dials::algorithms::background::boost_python
@@ -18,7 +18,8 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_modeller_ext) {
     class_<BackgroundStatistics>("BackgroundStatistics", no_init)
-      .def(init<const ImageVolume<>&>())
+      .def(init<const ImageVolume<>&, std::size_t>(
+        (arg("volume"), arg("nthreads") = 1)))
       .def("sum", &BackgroundStatistics::sum)
       .def("sum_sq", &BackgroundStatistics::sum_sq)
       .def("num", &BackgroundStatistics::num)
@@ -31,7 +32,8 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .def("mask", &BackgroundStatistics::mask);
 
     class_<MultiPanelBackgroundStatistics>("MultiPanelBackgroundStatistics", no_init)
-      .def(init<const MultiPanelImageVolume<>&>())
+      .def(init<const MultiPanelImageVolume<>&, std::size_t>(
+        (arg("volume"), arg("nthreads") = 1)))
       .def("get", &MultiPanelBackgroundStatistics::get)
       .def("__len__", &MultiPanelBackgroundStatistics::size)
       .def("__iadd__", &MultiPanelBackgroundStatistics::operator+=);
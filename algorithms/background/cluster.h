@@ -0,0 +1,266 @@
+/*
+ * cluster.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_BACKGROUND_CLUSTER_H
+#define DIALS_ALGORITHMS_BACKGROUND_CLUSTER_H
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <dials/algorithms/shoebox/find_overlapping.h>
+#include <dials/model/data/adjacency_list.h>
+#include <dials/model/data/mask_code.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::AdjacencyList;
+  using dials::model::Background;
+  using dials::model::BackgroundUsed;
+  using dials::model::Shoebox;
+  using dials::model::Valid;
+  using scitbx::af::int3;
+  using scitbx::af::int6;
+
+  /**
+   * Group overlapping shoeboxes into clusters which share a background. Each
+   * cluster is grown breadth first from the lowest unassigned shoebox through
+   * the overlaps until it has max_size members, so a large group of
+   * overlapping shoeboxes is split into several local clusters rather than
+   * fitting one background over a large area of the detector.
+   * @param overlaps The adjacency list of overlapping shoeboxes
+   * @param max_size The maximum number of shoeboxes in a cluster
+   * @returns The cluster of each shoebox
+   */
+  inline af::shared<std::size_t> overlap_clusters(const AdjacencyList &overlaps,
+                                                  std::size_t max_size) {
+    DIALS_ASSERT(max_size > 0);
+    std::size_t n = overlaps.num_vertices();
+    std::size_t unassigned = n;
+    af::shared<std::size_t> cluster(n, unassigned);
+    std::size_t num_clusters = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (cluster[i] != unassigned) {
+        continue;
+      }
+      std::size_t size = 1;
+      std::deque<std::size_t> queue(1, i);
+      cluster[i] = num_clusters;
+      while (!queue.empty() && size < max_size) {
+        std::size_t j = queue.front();
+        queue.pop_front();
+        AdjacencyList::edge_iterator_range edges = overlaps.edges(j);
+        for (AdjacencyList::edge_iterator it = edges.first;
+             it != edges.second && size < max_size;
+             ++it) {
+          if (cluster[it->second] == unassigned) {
+            cluster[it->second] = num_clusters;
+            queue.push_back(it->second);
+            size++;
+          }
+        }
+      }
+      num_clusters++;
+    }
+    return cluster;
+  }
+
+  /**
+   * Group overlapping shoeboxes into clusters which share a background
+   * @param bbox The bounding boxes
+   * @param panel The panel of each bounding box
+   * @param max_size The maximum number of shoeboxes in a cluster
+   * @returns The cluster of each shoebox
+   */
+  inline af::shared<std::size_t> overlap_clusters(
+    const af::const_ref<int6> &bbox,
+    const af::const_ref<std::size_t> &panel,
+    std::size_t max_size) {
+    DIALS_ASSERT(bbox.size() == panel.size());
+    if (bbox.size() == 0) {
+      return af::shared<std::size_t>();
+    }
+    return overlap_clusters(shoebox::find_overlapping_multi_panel(bbox, panel),
+                            max_size);
+  }
+
+  namespace detail {
+
+    /**
+     * @returns The offset of a shoebox within another
+     */
+    template <typename FloatType>
+    int3 relative_offset(const Shoebox<FloatType> &inner,
+                         const Shoebox<FloatType> &outer) {
+      return int3(inner.zoffset() - outer.zoffset(),
+                  inner.yoffset() - outer.yoffset(),
+                  inner.xoffset() - outer.xoffset());
+    }
+
+    /**
+     * Merge the shoeboxes of a cluster into a single shoebox covering the
+     * union of their bounding boxes. Overlapping shoeboxes were extracted
+     * from the same images so their data agree. A pixel is only valid
+     * background in the merged shoebox if it is valid background in every
+     * member that contains it; pixels not in any member are masked out.
+     */
+    template <typename FloatType>
+    Shoebox<FloatType> merge_cluster(const af::const_ref<Shoebox<FloatType> > &sbox,
+                                     const std::vector<std::size_t> &members) {
+      DIALS_ASSERT(members.size() > 0);
+      int6 bbox = sbox[members[0]].bbox;
+      for (std::size_t m = 1; m < members.size(); ++m) {
+        const int6 &b = sbox[members[m]].bbox;
+        DIALS_ASSERT(sbox[members[m]].panel == sbox[members[0]].panel);
+        for (std::size_t d = 0; d < 6; d += 2) {
+          bbox[d] = std::min(bbox[d], b[d]);
+          bbox[d + 1] = std::max(bbox[d + 1], b[d + 1]);
+        }
+      }
+      Shoebox<FloatType> result(sbox[members[0]].panel, bbox);
+      result.allocate();
+      std::vector<bool> covered(result.mask.size(), false);
+      const int code = Valid | Background;
+      for (std::size_t m = 0; m < members.size(); ++m) {
+        const Shoebox<FloatType> &s = sbox[members[m]];
+        DIALS_ASSERT(s.is_consistent());
+        int3 size = s.size();
+        int3 offset = relative_offset(s, result);
+        for (int k = 0; k < size[0]; ++k) {
+          for (int j = 0; j < size[1]; ++j) {
+            for (int i = 0; i < size[2]; ++i) {
+              std::size_t index =
+                result.mask.accessor()(k + offset[0], j + offset[1], i + offset[2]);
+              int mask = s.mask(k, j, i) & ~BackgroundUsed;
+              if (!covered[index]) {
+                result.data[index] = s.data(k, j, i);
+                result.mask[index] = mask;
+                covered[index] = true;
+              } else {
+                int current = result.mask[index];
+                result.mask[index] =
+                  (current & mask & code) | ((current | mask) & ~code);
+              }
+            }
+          }
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Copy the background of the merged shoebox to the members of the
+     * cluster and mark the pixels that were used
+     */
+    template <typename FloatType>
+    void split_cluster(const Shoebox<FloatType> &merged,
+                       af::ref<Shoebox<FloatType> > sbox,
+                       const std::vector<std::size_t> &members) {
+      const int code = Valid | Background;
+      for (std::size_t m = 0; m < members.size(); ++m) {
+        Shoebox<FloatType> &s = sbox[members[m]];
+        int3 size = s.size();
+        int3 offset = relative_offset(s, merged);
+        for (int k = 0; k < size[0]; ++k) {
+          for (int j = 0; j < size[1]; ++j) {
+            for (int i = 0; i < size[2]; ++i) {
+              std::size_t index =
+                merged.mask.accessor()(k + offset[0], j + offset[1], i + offset[2]);
+              s.background(k, j, i) = merged.background[index];
+              if ((merged.mask[index] & BackgroundUsed)
+                  && (s.mask(k, j, i) & code) == code) {
+                s.mask(k, j, i) |= BackgroundUsed;
+              }
+            }
+          }
+        }
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute one background for each cluster of shoeboxes and share it between
+   * the members. Shoeboxes alone in their cluster are computed as normal. A
+   * cluster is also computed shoebox by shoebox if any member is flat or if
+   * the union of the bounding boxes is more than twice the total size of the
+   * members, in which case most of the merged shoebox would be empty.
+   *
+   * The compute function is called with a shoebox and the indices of the
+   * shoeboxes which will share its background. It returns True/False the
+   * background was computed.
+   * @param sbox The shoeboxes
+   * @param cluster The cluster of each shoebox
+   * @param compute The function to compute the background of a shoebox
+   * @returns Success True/False for each shoebox
+   */
+  template <typename FloatType, typename Function>
+  af::shared<bool> create_by_cluster(af::ref<Shoebox<FloatType> > sbox,
+                                     const af::const_ref<std::size_t> &cluster,
+                                     Function compute) {
+    DIALS_ASSERT(sbox.size() == cluster.size());
+
+    // Group the shoeboxes by cluster
+    std::size_t num_clusters = 0;
+    for (std::size_t i = 0; i < cluster.size(); ++i) {
+      num_clusters = std::max(num_clusters, cluster[i] + 1);
+    }
+    std::vector<std::vector<std::size_t> > members(num_clusters);
+    for (std::size_t i = 0; i < cluster.size(); ++i) {
+      members[cluster[i]].push_back(i);
+    }
+
+    af::shared<bool> success(sbox.size(), false);
+    for (std::size_t c = 0; c < members.size(); ++c) {
+      const std::vector<std::size_t> &m = members[c];
+      if (m.empty()) {
+        continue;
+      }
+
+      // Check if the cluster is compact enough to share a background
+      bool share = m.size() > 1;
+      std::size_t volume = 0;
+      int6 bbox = sbox[m[0]].bbox;
+      for (std::size_t i = 0; i < m.size() && share; ++i) {
+        const Shoebox<FloatType> &s = sbox[m[i]];
+        share = !s.flat && s.panel == sbox[m[0]].panel && s.is_consistent();
+        volume += s.data.size();
+        for (std::size_t d = 0; d < 6; d += 2) {
+          bbox[d] = std::min(bbox[d], s.bbox[d]);
+          bbox[d + 1] = std::max(bbox[d + 1], s.bbox[d + 1]);
+        }
+      }
+      if (share) {
+        std::size_t union_volume = (std::size_t)(bbox[1] - bbox[0])
+                                   * (bbox[3] - bbox[2]) * (bbox[5] - bbox[4]);
+        share = union_volume <= 2 * volume;
+      }
+
+      // Compute the shared background or each background separately
+      if (share) {
+        Shoebox<FloatType> merged = detail::merge_cluster(sbox, m);
+        if (compute(merged, m)) {
+          detail::split_cluster(merged, sbox, m);
+          for (std::size_t i = 0; i < m.size(); ++i) {
+            success[m[i]] = true;
+          }
+        }
+      } else {
+        for (std::size_t i = 0; i < m.size(); ++i) {
+          success[m[i]] = compute(sbox[m[i]], std::vector<std::size_t>(1, m[i]));
+        }
+      }
+    }
+    return success;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_BACKGROUND_CLUSTER_H
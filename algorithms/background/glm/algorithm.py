@@ -2,7 +2,14 @@ class BackgroundAlgorithm:
     """Class to do background subtraction."""
 
     def __init__(
-        self, experiments, model="constant3d", tuning_constant=1.345, min_pixels=10
+        self,
+        experiments,
+        model="constant3d",
+        tuning_constant=1.345,
+        min_pixels=10,
+        nthreads=1,
+        share_overlaps=False,
+        max_cluster_size=8,
     ):
         """
         Initialise the algorithm.
@@ -10,6 +17,9 @@ def __init__(
         :param experiments: The list of experiments
         :param model: The background model
         :param tuning_constant: The robust tuning constant
+        :param nthreads: The number of threads used for a list of shoeboxes
+        :param share_overlaps: Share one background between overlapping shoeboxes
+        :param max_cluster_size: The most shoeboxes sharing a background
         """
         from dials.algorithms.background.glm import Creator
 
@@ -29,6 +39,9 @@ def __init__(
             max_iter=100,
             min_pixels=min_pixels,
         )
+        self._nthreads = nthreads
+        self._share_overlaps = share_overlaps
+        self._max_cluster_size = max_cluster_size
 
     def compute_background(self, reflections, image_volume=None):
         """
@@ -37,8 +50,18 @@ def compute_background(self, reflections, image_volume=None):
         :param reflections: The list of reflections
         """
         # Do the background subtraction
-        if image_volume is None:
-            success = self._create(reflections["shoebox"])
+        if image_volume is None and self._share_overlaps:
+            from dials.algorithms.background import overlap_clusters
+
+            cluster = overlap_clusters(
+                reflections["bbox"], reflections["panel"], self._max_cluster_size
+            )
+            success = self._create.by_cluster(reflections["shoebox"], cluster)
+            reflections["background.mean"] = reflections[
+                "shoebox"
+            ].mean_modelled_background()
+        elif image_volume is None:
+            success = self._create(reflections["shoebox"], nthreads=self._nthreads)
             reflections["background.mean"] = reflections[
                 "shoebox"
             ].mean_modelled_background()
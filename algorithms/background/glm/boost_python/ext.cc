@@ -34,8 +34,16 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
     creator
       .def(init<GLMBackgroundCreator::Model, double, std::size_t, std::size_t>((
         arg("model"), arg("tuning_constant"), arg("max_iter"), arg("min_pixels") = 10)))
-      .def("__call__", &GLMBackgroundCreator::shoebox)
-      .def("__call__", &GLMBackgroundCreator::volume);
+      .def("__call__",
+           &GLMBackgroundCreator::shoebox,
+           (arg("shoeboxes"), arg("nthreads") = 1))
+      .def("__call__", &GLMBackgroundCreator::volume)
+      .def("shoebox_status",
+           &GLMBackgroundCreator::shoebox_status,
+           (arg("shoeboxes"), arg("nthreads") = 1))
+      .def("by_cluster",
+           &GLMBackgroundCreator::by_cluster,
+           (arg("shoeboxes"), arg("cluster")));
 
     scope in_creator = creator;
 
@@ -44,6 +52,16 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .value("constant3d", GLMBackgroundCreator::Constant3d)
       .value("loglinear2d", GLMBackgroundCreator::LogLinear2d)
       .value("loglinear3d", GLMBackgroundCreator::LogLinear3d);
+
+    enum_<GLMBackgroundCreator::Status>("status")
+      .value("success", GLMBackgroundCreator::Success)
+      .value("inconsistent_shoebox", GLMBackgroundCreator::InconsistentShoebox)
+      .value("too_few_pixels", GLMBackgroundCreator::TooFewPixels)
+      .value("negative_pixels", GLMBackgroundCreator::NegativePixels)
+      .value("no_spread", GLMBackgroundCreator::NoSpread)
+      .value("not_converged", GLMBackgroundCreator::NotConverged)
+      .value("out_of_range", GLMBackgroundCreator::OutOfRange)
+      .value("failed", GLMBackgroundCreator::Failed);
   }
 
 }}}}  // namespace dials::algorithms::background::boost_python
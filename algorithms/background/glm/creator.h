@@ -13,11 +13,13 @@
 #define DIALS_ALGORITHMS_BACKGROUND_GLM_CREATOR_H
 
 #include <scitbx/glmtbx/robust_glm.h>
+#include <dials/algorithms/background/cluster.h>
 #include <dials/algorithms/background/glm/robust_poisson_mean.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/image_volume.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -39,6 +41,20 @@ namespace dials { namespace algorithms {
       return temp[temp.size() / 2];
     }
 
+    /**
+     * Compute the median using a scratch array
+     * @param x The values
+     * @param temp The scratch array
+     * @returns The median
+     */
+    template <typename T>
+    T median(const af::const_ref<T> &x, af::shared<T> &temp) {
+      temp.resize(x.size());
+      std::copy(x.begin(), x.end(), temp.begin());
+      std::nth_element(temp.begin(), temp.begin() + temp.size() / 2, temp.end());
+      return temp[temp.size() / 2];
+    }
+
   }  // namespace detail
 
   /**
@@ -51,6 +67,29 @@ namespace dials { namespace algorithms {
      */
     enum Model { Constant2d, Constant3d, LogLinear2d, LogLinear3d };
 
+    /**
+     * Enumeration of the result of computing a single background
+     */
+    enum Status {
+      Success,
+      InconsistentShoebox,
+      TooFewPixels,
+      NegativePixels,
+      NoSpread,
+      NotConverged,
+      OutOfRange,
+      Failed
+    };
+
+    /**
+     * Scratch arrays reused between shoeboxes
+     */
+    struct Workspace {
+      af::shared<double> Y;
+      af::shared<double> temp;
+      af::versa<double, af::c_grid<2> > X;
+    };
+
     /**
      * Initialise the creator
      * @param tuning_constant The robust tuning constant
@@ -68,27 +107,54 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(tuning_constant > 0);
       DIALS_ASSERT(max_iter > 0);
       DIALS_ASSERT(min_pixels > 0);
+      if (model == Constant2d || model == Constant3d) {
+        table_ = PoissonExpectationTable::shared(tuning_constant);
+      }
     }
 
     /**
      * Compute the background values
      * @param sbox The shoeboxes
+     * @param nthreads The number of threads
      * @returns Success True/False
      */
-    af::shared<bool> shoebox(af::ref<Shoebox<> > sbox) const {
+    af::shared<bool> shoebox(af::ref<Shoebox<> > sbox, std::size_t nthreads = 1) const {
+      af::shared<int> status = shoebox_status(sbox, nthreads);
       af::shared<bool> success(sbox.size(), true);
-      for (std::size_t i = 0; i < sbox.size(); ++i) {
-        try {
-          single(sbox[i]);
-        } catch (scitbx::error const &) {
-          success[i] = false;
-        } catch (dials::error const &) {
-          success[i] = false;
-        }
+      for (std::size_t i = 0; i < status.size(); ++i) {
+        success[i] = status[i] == Success;
       }
       return success;
     }
 
+    /**
+     * Compute the background values, sharing the shoeboxes between a number
+     * of threads. Failures are reported by the status of each shoebox.
+     * @param sbox The shoeboxes
+     * @param nthreads The number of threads
+     * @returns The status of each shoebox
+     */
+    af::shared<int> shoebox_status(af::ref<Shoebox<> > sbox,
+                                   std::size_t nthreads = 1) const {
+      af::shared<int> status(sbox.size(), Success);
+      dials::util::parallel_for(
+        sbox.size(), nthreads, ShoeboxJob(this, sbox, status.ref()));
+      return status;
+    }
+
+    /**
+     * Compute one background for each cluster of overlapping shoeboxes and
+     * share it between the shoeboxes in the cluster.
+     * @param sbox The shoeboxes
+     * @param cluster The cluster of each shoebox
+     * @returns Success True/False
+     */
+    af::shared<bool> by_cluster(af::ref<Shoebox<> > sbox,
+                                const af::const_ref<std::size_t> &cluster) const {
+      Workspace workspace;
+      return create_by_cluster(sbox, cluster, ClusterFunction(this, workspace));
+    }
+
     /**
      * Compute the background values
      * @param sbox The shoeboxes
@@ -96,7 +162,56 @@ namespace dials { namespace algorithms {
      */
     void single(Shoebox<> &sbox) const {
       DIALS_ASSERT(sbox.is_consistent());
-      compute(sbox.data.const_ref(), sbox.background.ref(), sbox.mask.ref());
+      Workspace workspace;
+      Status status = compute(
+        sbox.data.const_ref(), sbox.background.ref(), sbox.mask.ref(), workspace);
+      if (status != Success) {
+        throw DIALS_ERROR(status_message(status));
+      }
+    }
+
+    /**
+     * Compute the background values for a single shoebox
+     * @param sbox The shoebox
+     * @param workspace The scratch arrays
+     * @returns The status
+     */
+    Status single(Shoebox<> &sbox, Workspace &workspace) const {
+      if (!sbox.is_consistent()) {
+        return InconsistentShoebox;
+      }
+      try {
+        return compute(
+          sbox.data.const_ref(), sbox.background.ref(), sbox.mask.ref(), workspace);
+      } catch (scitbx::error const &) {
+        return Failed;
+      } catch (dials::error const &) {
+        return Failed;
+      }
+    }
+
+    /**
+     * @returns A description of the status
+     */
+    static const char *status_message(Status status) {
+      switch (status) {
+      case Success:
+        return "Success";
+      case InconsistentShoebox:
+        return "Inconsistent shoebox";
+      case TooFewPixels:
+        return "Too few background pixels";
+      case NegativePixels:
+        return "Negative background pixel values";
+      case NoSpread:
+        return "No spread of background pixels";
+      case NotConverged:
+        return "Background fit did not converge";
+      case OutOfRange:
+        return "Background parameters out of range";
+      default:
+        return "Background fit failed";
+      };
     }
 
     /**
@@ -114,6 +229,7 @@ namespace dials { namespace algorithms {
       af::const_ref<int6> bbox = reflections["bbox"];
       af::const_ref<std::size_t> panel = reflections["panel"];
       af::shared<bool> success(bbox.size(), true);
+      Workspace workspace;
       for (std::size_t i = 0; i < bbox.size(); ++i) {
         // Get the image volume
         ImageVolume<> v = volume.get(panel[i]);
@@ -128,7 +244,11 @@ namespace dials { namespace algorithms {
 
         // Compute the background
         try {
-          compute(data.const_ref(), bgrd.ref(), mask.ref());
+          Status status = compute(data.const_ref(), bgrd.ref(), mask.ref(), workspace);
+          if (status != Success) {
+            success[i] = false;
+            continue;
+          }
 
           // Need to set the background in volume
           v.set_background(b, bgrd.const_ref());
@@ -142,27 +262,65 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Compute the backgrounds of a contiguous range of shoeboxes. Each job
+     * has its own scratch arrays and each shoebox is only touched by one job.
+     */
+    class ShoeboxJob {
+    public:
+      ShoeboxJob(const GLMBackgroundCreator *creator,
+                 af::ref<Shoebox<> > sbox,
+                 af::ref<int> status)
+          : creator_(creator), sbox_(sbox), status_(status) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        Workspace workspace;
+        for (std::size_t i = first; i < last; ++i) {
+          status_[i] = creator_->single(sbox_[i], workspace);
+        }
+      }
+
+    private:
+      const GLMBackgroundCreator *creator_;
+      af::ref<Shoebox<> > sbox_;
+      af::ref<int> status_;
+    };
+
+    /**
+     * Compute the background of a shoebox shared by a cluster
+     */
+    class ClusterFunction {
+    public:
+      ClusterFunction(const GLMBackgroundCreator *creator, Workspace &workspace)
+          : creator_(creator), workspace_(&workspace) {}
+
+      bool operator()(Shoebox<> &sbox, const std::vector<std::size_t> &) const {
+        return creator_->single(sbox, *workspace_) == Success;
+      }
+
+    private:
+      const GLMBackgroundCreator *creator_;
+      Workspace *workspace_;
+    };
+
     /**
      * Compute the background values for a single shoebox
      * @param sbox The shoebox
      */
     template <typename T>
-    void compute(const af::const_ref<T, af::c_grid<3> > &data,
-                 af::ref<T, af::c_grid<3> > background,
-                 af::ref<int, af::c_grid<3> > mask) const {
+    Status compute(const af::const_ref<T, af::c_grid<3> > &data,
+                   af::ref<T, af::c_grid<3> > background,
+                   af::ref<int, af::c_grid<3> > mask,
+                   Workspace &workspace) const {
       switch (model_) {
       case Constant2d:
-        compute_constant_2d(data, background, mask);
-        break;
+        return compute_constant_2d(data, background, mask, workspace);
       case Constant3d:
-        compute_constant_3d(data, background, mask);
-        break;
+        return compute_constant_3d(data, background, mask, workspace);
       case LogLinear2d:
-        compute_loglinear_2d(data, background, mask);
-        break;
+        return compute_loglinear_2d(data, background, mask, workspace);
       case LogLinear3d:
-        compute_loglinear_3d(data, background, mask);
-        break;
+        return compute_loglinear_3d(data, background, mask, workspace);
       default:
         throw DIALS_ERROR("Unknown Model");
       };
@@ -173,9 +331,10 @@ namespace dials { namespace algorithms {
      * @param sbox The shoebox
      */
     template <typename T>
-    void compute_constant_2d(const af::const_ref<T, af::c_grid<3> > &data,
-                             af::ref<T, af::c_grid<3> > background,
-                             af::ref<int, af::c_grid<3> > mask) const {
+    Status compute_constant_2d(const af::const_ref<T, af::c_grid<3> > &data,
+                               af::ref<T, af::c_grid<3> > background,
+                               af::ref<int, af::c_grid<3> > mask,
+                               Workspace &workspace) const {
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
         // Compute number of background pixels
         std::size_t num_background = 0;
@@ -188,17 +347,22 @@ namespace dials { namespace algorithms {
             }
           }
         }
-        DIALS_ASSERT(num_background >= min_pixels_);
+        if (num_background < min_pixels_) {
+          return TooFewPixels;
+        }
 
         // Allocate some arrays
-        af::shared<double> Y(num_background, 0);
+        af::shared<double> &Y = workspace.Y;
+        Y.resize(num_background);
         std::size_t l = 0;
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
             if ((mask(k, j, i) & mask_code) == mask_code
                 && ((mask(k, j, i) & Overlapped) == 0)) {
               DIALS_ASSERT(l < Y.size());
-              DIALS_ASSERT(data(k, j, i) >= 0);
+              if (data(k, j, i) < 0) {
+                return NegativePixels;
+              }
               Y[l++] = data(k, j, i);
             }
           }
@@ -206,15 +370,16 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(l == Y.size());
 
         // Compute the median value for the starting value
-        double median = detail::median(Y.const_ref());
+        double median = detail::median(Y.const_ref(), workspace.temp);
         if (median == 0) {
           median = 1.0;
         }
 
         // Compute the result
-        RobustPoissonMean result(
-          Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
-        DIALS_ASSERT(result.converged());
+        RobustPoissonMean result(Y.const_ref(), median, *table_, 1e-3, max_iter_);
+        if (!result.converged()) {
+          return NotConverged;
+        }
 
         // Compute the background
         double mean_background = result.mean();
@@ -230,6 +395,7 @@ namespace dials { namespace algorithms {
           }
         }
       }
+      return Success;
     }
 
     /**
@@ -237,9 +403,10 @@ namespace dials { namespace algorithms {
      * @param sbox The shoebox
      */
     template <typename T>
-    void compute_constant_3d(const af::const_ref<T, af::c_grid<3> > &data,
-                             af::ref<T, af::c_grid<3> > background,
-                             af::ref<int, af::c_grid<3> > mask) const {
+    Status compute_constant_3d(const af::const_ref<T, af::c_grid<3> > &data,
+                               af::ref<T, af::c_grid<3> > background,
+                               af::ref<int, af::c_grid<3> > mask,
+                               Workspace &workspace) const {
       // Compute number of background pixels
       std::size_t num_background = 0;
       int mask_code = Valid | Background;
@@ -248,30 +415,36 @@ namespace dials { namespace algorithms {
           num_background++;
         }
       }
-      DIALS_ASSERT(num_background >= min_pixels_);
+      if (num_background < min_pixels_) {
+        return TooFewPixels;
+      }
 
       // Allocate some arrays
-      af::shared<double> Y(num_background, 0);
+      af::shared<double> &Y = workspace.Y;
+      Y.resize(num_background);
       std::size_t j = 0;
       for (std::size_t i = 0; i < mask.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code && ((mask[i] & Overlapped) == 0)) {
           DIALS_ASSERT(j < Y.size());
-          DIALS_ASSERT(data[i] >= 0);
+          if (data[i] < 0) {
+            return NegativePixels;
+          }
           Y[j++] = data[i];
         }
       }
       DIALS_ASSERT(j == Y.size());
 
       // Compute the median value for the starting value
-      double median = detail::median(Y.const_ref());
+      double median = detail::median(Y.const_ref(), workspace.temp);
       if (median == 0) {
         median = 1.0;
       }
 
       // Compute the result
-      RobustPoissonMean result(
-        Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
-      DIALS_ASSERT(result.converged());
+      RobustPoissonMean result(Y.const_ref(), median, *table_, 1e-3, max_iter_);
+      if (!result.converged()) {
+        return NotConverged;
+      }
 
       // Compute the background
       double mean_background = result.mean();
@@ -283,6 +456,7 @@ namespace dials { namespace algorithms {
           mask[i] |= BackgroundUsed;
         }
       }
+      return Success;
     }
 
     /**
@@ -290,9 +464,10 @@ namespace dials { namespace algorithms {
      * @param sbox The shoebox
      */
     template <typename T>
-    void compute_loglinear_2d(const af::const_ref<T, af::c_grid<3> > &data,
-                              af::ref<T, af::c_grid<3> > background,
-                              af::ref<int, af::c_grid<3> > mask) const {
+    Status compute_loglinear_2d(const af::const_ref<T, af::c_grid<3> > &data,
+                                af::ref<T, af::c_grid<3> > background,
+                                af::ref<int, af::c_grid<3> > mask,
+                                Workspace &workspace) const {
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
         // Compute number of background pixels
         std::size_t num_background = 0;
@@ -305,18 +480,24 @@ namespace dials { namespace algorithms {
             }
           }
         }
-        DIALS_ASSERT(num_background >= min_pixels_);
+        if (num_background < min_pixels_) {
+          return TooFewPixels;
+        }
 
         // Allocate some arrays
-        af::versa<double, af::c_grid<2> > X(af::c_grid<2>(num_background, 3), 0);
-        af::shared<double> Y(num_background, 0);
+        af::versa<double, af::c_grid<2> > &X = workspace.X;
+        X.resize(af::c_grid<2>(num_background, 3), 0);
+        af::shared<double> &Y = workspace.Y;
+        Y.resize(num_background);
         std::size_t l = 0;
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
             if ((mask(k, j, i) & mask_code) == mask_code
                 && ((mask(k, j, i) & Overlapped) == 0)) {
               DIALS_ASSERT(l < Y.size());
-              DIALS_ASSERT(data(k, j, i) >= 0);
+              if (data(k, j, i) < 0) {
+                return NegativePixels;
+              }
               Y[l] = data(k, j, i);
               X(l, 0) = 1.0;
               X(l, 1) = j + 0.5;
@@ -338,10 +519,12 @@ namespace dials { namespace algorithms {
             county++;
           }
         }
-        DIALS_ASSERT(countx > 0 && county > 0);
+        if (countx == 0 || county == 0) {
+          return NoSpread;
+        }
 
         // Compute the median value for the starting value
-        double median = detail::median(Y.const_ref());
+        double median = detail::median(Y.const_ref(), workspace.temp);
         if (median == 0) {
           median = 1.0;
         }
@@ -359,7 +542,9 @@ namespace dials { namespace algorithms {
                                                                    tuning_constant_,
                                                                    1e-3,
                                                                    max_iter_);
-        DIALS_ASSERT(result.converged());
+        if (!result.converged()) {
+          return NotConverged;
+        }
 
         // Compute the background
         B = result.parameters();
@@ -367,9 +552,10 @@ namespace dials { namespace algorithms {
         double b0 = B[0];
         double b1 = B[1];
         double b2 = B[2];
-        DIALS_ASSERT(b0 > -300 && b0 < 300);
-        DIALS_ASSERT(b1 > -300 && b1 < 300);
-        DIALS_ASSERT(b2 > -300 && b2 < 300);
+        if (!(b0 > -300 && b0 < 300) || !(b1 > -300 && b1 < 300)
+            || !(b2 > -300 && b2 < 300)) {
+          return OutOfRange;
+        }
 
         // Fill in the background shoebox values
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
@@ -384,6 +570,7 @@ namespace dials { namespace algorithms {
           }
         }
       }
+      return Success;
     }
 
     /**
@@ -391,9 +578,10 @@ namespace dials { namespace algorithms {
      * @param sbox The shoebox
      */
     template <typename T>
-    void compute_loglinear_3d(const af::const_ref<T, af::c_grid<3> > &data,
-                              af::ref<T, af::c_grid<3> > background,
-                              af::ref<int, af::c_grid<3> > mask) const {
+    Status compute_loglinear_3d(const af::const_ref<T, af::c_grid<3> > &data,
+                                af::ref<T, af::c_grid<3> > background,
+                                af::ref<int, af::c_grid<3> > mask,
+                                Workspace &workspace) const {
       // Compute number of background pixels
       std::size_t num_background = 0;
       int mask_code = Valid | Background;
@@ -407,11 +595,15 @@ namespace dials { namespace algorithms {
           }
         }
       }
-      DIALS_ASSERT(num_background >= min_pixels_);
+      if (num_background < min_pixels_) {
+        return TooFewPixels;
+      }
 
       // Allocate some arrays
-      af::versa<double, af::c_grid<2> > X(af::c_grid<2>(num_background, 4), 0);
-      af::shared<double> Y(num_background, 0);
+      af::versa<double, af::c_grid<2> > &X = workspace.X;
+      X.resize(af::c_grid<2>(num_background, 4), 0);
+      af::shared<double> &Y = workspace.Y;
+      Y.resize(num_background);
       std::size_t l = 0;
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
@@ -419,7 +611,9 @@ namespace dials { namespace algorithms {
             if ((mask(k, j, i) & mask_code) == mask_code
                 && ((mask(k, j, i) & Overlapped) == 0)) {
               DIALS_ASSERT(l < Y.size());
-              DIALS_ASSERT(data(k, j, i) >= 0);
+              if (data(k, j, i) < 0) {
+                return NegativePixels;
+              }
               Y[l] = data(k, j, i);
               X(l, 0) = 1.0;
               X(l, 1) = k;
@@ -447,10 +641,12 @@ namespace dials { namespace algorithms {
           county++;
         }
       }
-      DIALS_ASSERT(countx > 0 && county > 0 && countz > 0);
+      if (countx == 0 || county == 0 || countz == 0) {
+        return NoSpread;
+      }
 
       // Compute the median value for the starting value
-      double median = detail::median(Y.const_ref());
+      double median = detail::median(Y.const_ref(), workspace.temp);
       if (median == 0) {
         median = 1.0;
       }
@@ -465,7 +661,9 @@ namespace dials { namespace algorithms {
       // Compute the result
       scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(
         X.const_ref(), Y.const_ref(), B.const_ref(), tuning_constant_, 1e-3, max_iter_);
-      DIALS_ASSERT(result.converged());
+      if (!result.converged()) {
+        return NotConverged;
+      }
 
       // Compute the background
       B = result.parameters();
@@ -474,10 +672,10 @@ namespace dials { namespace algorithms {
       double b1 = B[1];
       double b2 = B[2];
       double b3 = B[3];
-      DIALS_ASSERT(b0 > -300 && b0 < 300);
-      DIALS_ASSERT(b1 > -300 && b1 < 300);
-      DIALS_ASSERT(b2 > -300 && b2 < 300);
-      DIALS_ASSERT(b3 > -300 && b3 < 300);
+      if (!(b0 > -300 && b0 < 300) || !(b1 > -300 && b1 < 300)
+          || !(b2 > -300 && b2 < 300) || !(b3 > -300 && b3 < 300)) {
+        return OutOfRange;
+      }
 
       // Fill in the background shoebox values
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
@@ -492,12 +690,14 @@ namespace dials { namespace algorithms {
           }
         }
       }
+      return Success;
     }
 
     Model model_;
     double tuning_constant_;
     std::size_t max_iter_;
     std::size_t min_pixels_;
+    boost::shared_ptr<const PoissonExpectationTable> table_;
   };
 
 }}  // namespace dials::algorithms
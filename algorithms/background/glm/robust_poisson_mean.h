@@ -11,6 +11,13 @@
 #ifndef SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 #define SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/vec2.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/matrix/inversion.h>
 #include <scitbx/matrix/multiply.h>
@@ -20,6 +27,95 @@
 
 namespace dials { namespace algorithms {
 
+  using scitbx::vec2;
+
+  /**
+   * A table of the expected values of the huber function and its square for
+   * a poisson distribution with a given tuning constant, used by both the GLM
+   * and the gmodel robust background estimates. The values are tabulated on a grid which
+   * is uniform in the square root of the mean, so the grid is finer at the
+   * small means where the values change fastest, and are linearly
+   * interpolated. Above the maximum mean they are computed directly.
+   */
+  class PoissonExpectationTable {
+  public:
+    /**
+     * Tabulate the expectation values
+     * @param c The huber tuning constant
+     * @param max The maximum tabulated mean
+     * @param div The number of entries per unit square root of the mean
+     */
+    PoissonExpectationTable(double c, double max = 1000, std::size_t div = 500)
+        : c_(c), div_(div) {
+      DIALS_ASSERT(c > 0);
+      DIALS_ASSERT(max > 0);
+      DIALS_ASSERT(div > 0);
+      std::size_t size = (std::size_t)std::ceil(std::sqrt(max) * div) + 1;
+      min_ = 1.0 / (div_ * div_);
+      max_ = ((size - 1) / div_) * ((size - 1) / div_);
+      epsi_table_.resize(size);
+      for (std::size_t i = 1; i < size; ++i) {
+        double x = i / div_;
+        epsi_table_[i] = calculate(x * x);
+      }
+    }
+
+    /**
+     * Get a table shared between all callers with the same tuning constant.
+     * The table is computed the first time it is needed.
+     * @param c The huber tuning constant
+     * @returns The table
+     */
+    static boost::shared_ptr<const PoissonExpectationTable> shared(double c) {
+      typedef boost::shared_ptr<const PoissonExpectationTable> pointer;
+      static boost::mutex mutex;
+      static std::vector<pointer> tables;
+      boost::lock_guard<boost::mutex> guard(mutex);
+      for (std::size_t i = 0; i < tables.size(); ++i) {
+        if (tables[i]->c() == c) {
+          return tables[i];
+        }
+      }
+      tables.push_back(boost::make_shared<PoissonExpectationTable>(c));
+      return tables.back();
+    }
+
+    /**
+     * @returns The huber tuning constant
+     */
+    double c() const {
+      return c_;
+    }
+
+    /**
+     * @param mu The poisson mean
+     * @returns The expected value of the huber function and of its square
+     */
+    vec2<double> get(double mu) const {
+      if (mu < min_ || mu >= max_) {
+        return calculate(mu);
+      }
+      double x = std::sqrt(mu) * div_;
+      std::size_t index = (std::size_t)x;
+      DIALS_ASSERT(index + 1 < epsi_table_.size());
+      double t = x - index;
+      return epsi_table_[index] * (1.0 - t) + epsi_table_[index + 1] * t;
+    }
+
+  private:
+    vec2<double> calculate(double mu) const {
+      DIALS_ASSERT(mu > 0);
+      scitbx::glmtbx::expectation<scitbx::glmtbx::poisson> e(mu, std::sqrt(mu), c_);
+      return vec2<double>(e.epsi1, e.epsi2);
+    }
+
+    double c_;
+    double min_;
+    double max_;
+    double div_;
+    af::shared<vec2<double> > epsi_table_;
+  };
+
   /**
    * An algorithm to do robust generalized linear model as described in
    * Cantoni and Rochetti (2001) "Robust Inference for Generalized Linear
@@ -53,7 +149,33 @@ namespace dials { namespace algorithms {
       SCITBX_ASSERT(tolerance > 0);
       SCITBX_ASSERT(max_iter > 0);
       beta_ = std::log(mean0);
-      compute(Y);
+      compute(Y, ExactExpectation(c));
+    }
+
+    /**
+     * Compute the mean using tabulated expectation values
+     * @param Y The observations
+     * @param mean0 The initial estimate
+     * @param table The expectation table for the huber tuning constant
+     * @param tolerance The stopping criteria
+     * @param max_iter The maximum number of iterations
+     */
+    RobustPoissonMean(const af::const_ref<double> &Y,
+                      double mean0,
+                      const PoissonExpectationTable &table,
+                      double tolerance,
+                      std::size_t max_iter)
+        : niter_(0),
+          error_(0),
+          c_(table.c()),
+          tolerance_(tolerance),
+          max_iter_(max_iter) {
+      SCITBX_ASSERT(Y.size() > 0);
+      SCITBX_ASSERT(mean0 > 0);
+      SCITBX_ASSERT(tolerance > 0);
+      SCITBX_ASSERT(max_iter > 0);
+      beta_ = std::log(mean0);
+      compute(Y, TableExpectation(table));
     }
 
     /**
@@ -86,15 +208,62 @@ namespace dials { namespace algorithms {
     }
 
   private:
-    void compute(const af::const_ref<double> &Y) {
+    /**
+     * Compute the expectation values directly
+     */
+    struct ExactExpectation {
+      double c;
+      ExactExpectation(double c) : c(c) {}
+      vec2<double> operator()(double mu, double svar) const {
+        scitbx::glmtbx::expectation<family> e(mu, svar, c);
+        return vec2<double>(e.epsi1, e.epsi2);
+      }
+    };
+
+    /**
+     * Look up the expectation values in a table
+     */
+    struct TableExpectation {
+      const PoissonExpectationTable &table;
+      TableExpectation(const PoissonExpectationTable &table) : table(table) {}
+      vec2<double> operator()(double mu, double) const {
+        return table.get(mu);
+      }
+    };
+
+    /**
+     * Compute the sum of the huber function of the residuals. The sum is split
+     * over several accumulators so the loop can be vectorized.
+     */
+    double sum_psi(const af::const_ref<double> &Y, double mu, double svar) const {
+      double inv_svar = 1.0 / svar;
+      double sum[4] = {0, 0, 0, 0};
+      std::size_t n = Y.size();
+      std::size_t n4 = n - n % 4;
+      for (std::size_t i = 0; i < n4; i += 4) {
+        for (std::size_t j = 0; j < 4; ++j) {
+          double res = (Y[i + j] - mu) * inv_svar;
+          sum[j] += std::max(-c_, std::min(c_, res));
+        }
+      }
+      for (std::size_t i = n4; i < n; ++i) {
+        double res = (Y[i] - mu) * inv_svar;
+        sum[0] += std::max(-c_, std::min(c_, res));
+      }
+      return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    }
+
+    /**
+     * Every observation has the same weight so rather than summing over the
+     * observations U and H are computed from the sum of the huber function.
+     */
+    template <typename Expectation>
+    void compute(const af::const_ref<double> &Y, const Expectation &expectation) {
       // Number of observations and coefficients
-      std::size_t n_obs = Y.size();
+      double n_obs = (double)Y.size();
 
       // Loop until we reach the maximum number of iterations
       for (niter_ = 0; niter_ < max_iter_; ++niter_) {
-        // Initialize the sum to zero
-        double U = 0;
-        double H = 0;
         double w = 1.0;
         double eta = beta_;
         double mu = family::linkinv(eta);
@@ -106,27 +275,14 @@ namespace dials { namespace algorithms {
         double svar = std::sqrt(phi * var);
 
         // Compute expectation values
-        scitbx::glmtbx::expectation<family> epsi(mu, svar, c_);
+        vec2<double> epsi = expectation(mu, svar);
 
         // The value of the b diagonal parts
-        double b = epsi.epsi2 * w * dmu * dmu / svar;
+        double b = epsi[1] * w * dmu * dmu / svar;
 
-        // Build the matrices from the observations
-        for (std::size_t i = 0; i < n_obs; ++i) {
-          // Compute some required values
-          double res = (Y[i] - mu) / svar;
-
-          // Compute the difference between psi and its expected value
-          double psi = scitbx::glmtbx::huber(res, c_);
-          double psi_m_epsi = psi - epsi.epsi1;
-
-          // Compute the value of Psi and B_diag for this observation
-          double q = psi_m_epsi * w * dmu / svar;
-
-          // Update the BX = B * X and U matrices
-          U += q;
-          H += b;
-        }
+        // Compute the sums over the observations
+        double U = (sum_psi(Y, mu, svar) - n_obs * epsi[0]) * w * dmu / svar;
+        double H = n_obs * b;
 
         // Compute delta = H^-1 U
         U = U / H;
@@ -14,16 +14,23 @@ def __init__(self):
 
     def get(self, name):
         """
-        Get the model
+        Get the model. Model files written by StaticBackgroundModel.save are
+        memory mapped read-only, so all processes share a single copy;
+        otherwise the model is read from a pickle file.
         """
+        from dials.algorithms.background.gmodel import StaticBackgroundModel
+
         if name is None:
             raise RuntimeError("Model is not specified")
         try:
             model = self.model[name]
         except KeyError:
-            with open(name, "rb") as infile:
-                model = pickle.load(infile)
-                self.model[name] = model
+            if StaticBackgroundModel.is_model_file(name):
+                model = StaticBackgroundModel(name)
+            else:
+                with open(name, "rb") as infile:
+                    model = pickle.load(infile)
+            self.model[name] = model
         return model
 
 
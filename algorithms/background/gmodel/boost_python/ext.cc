@@ -56,9 +56,14 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .def("extract", pure_virtual(&BackgroundModel::extract));
 
     class_<StaticBackgroundModel, bases<BackgroundModel> >("StaticBackgroundModel")
+      .def(init<const std::string &>((arg("filename"))))
       .def("add", &StaticBackgroundModel::add)
       .def("__len__", &StaticBackgroundModel::size)
       .def("data", &StaticBackgroundModel::data)
+      .def("is_mapped", &StaticBackgroundModel::is_mapped)
+      .def("save", &StaticBackgroundModel::save, (arg("filename")))
+      .def("is_model_file", &StaticBackgroundModel::is_model_file, (arg("filename")))
+      .staticmethod("is_model_file")
       .def_pickle(StaticBackgroundModelPickleSuite());
 
     class_<GModelBackgroundCreator> creator("Creator", no_init);
@@ -12,6 +12,15 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 #define DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -29,12 +38,48 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A simple static background model
+   * A simple static background model. The model is either held in memory or
+   * memory mapped read-only from a model file written by save(), in which
+   * case processes reading the same file share a single copy of the model.
+   *
+   * The model file contains an 8 byte magic string, the number of panels,
+   * the height and width of each panel as 64 bit integers and then the data
+   * for each panel in turn as doubles in the native byte order.
    */
   class StaticBackgroundModel : public BackgroundModel {
   public:
+    typedef af::const_ref<double, af::c_grid<2> > const_ref_type;
+
     StaticBackgroundModel() {}
 
+    /**
+     * Memory map a model file
+     * @param filename The model file
+     */
+    StaticBackgroundModel(const std::string &filename) {
+      using boost::interprocess::file_mapping;
+      using boost::interprocess::mapped_region;
+      using boost::interprocess::read_only;
+      DIALS_ASSERT(is_model_file(filename));
+      file_mapping file(filename.c_str(), read_only);
+      region_ = boost::make_shared<mapped_region>(file, read_only);
+      const char *begin = static_cast<const char *>(region_->get_address());
+      std::size_t size = region_->get_size();
+      std::size_t num_panels = header(begin, size, 0);
+      std::size_t offset = header_size(num_panels);
+      DIALS_ASSERT(size >= offset);
+      for (std::size_t i = 0; i < num_panels; ++i) {
+        std::size_t height = header(begin, size, 1 + 2 * i);
+        std::size_t width = header(begin, size, 2 + 2 * i);
+        std::size_t nbytes = height * width * sizeof(double);
+        DIALS_ASSERT(offset + nbytes <= size);
+        const double *data = reinterpret_cast<const double *>(begin + offset);
+        panels_.push_back(const_ref_type(data, af::c_grid<2>(height, width)));
+        offset += nbytes;
+      }
+      DIALS_ASSERT(offset == size);
+    }
+
     /**
      * Extract a shoebox
      * @param bbox The bounding box
@@ -42,13 +87,13 @@ namespace dials { namespace algorithms {
      */
     virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
                                                       int6 bbox) const {
-      DIALS_ASSERT(panel < data_.size());
+      DIALS_ASSERT(panel < size());
       DIALS_ASSERT(bbox[1] > bbox[0]);
       DIALS_ASSERT(bbox[3] > bbox[2]);
       DIALS_ASSERT(bbox[5] > bbox[4]);
       af::c_grid<3> grid(bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]);
       af::versa<double, af::c_grid<3> > result(grid, 0);
-      af::const_ref<double, af::c_grid<2> > data = data_[panel].const_ref();
+      const_ref_type data = panels_[panel];
       for (std::size_t j = 0; j < result.accessor()[1]; ++j) {
         for (std::size_t i = 0; i < result.accessor()[2]; ++i) {
           int ii = bbox[0] + i;
@@ -70,16 +115,18 @@ namespace dials { namespace algorithms {
      * @param data The model data
      */
     void add(const af::const_ref<double, af::c_grid<2> > &data) {
+      DIALS_ASSERT(!is_mapped());
       af::versa<double, af::c_grid<2> > temp(data.accessor());
       std::copy(data.begin(), data.end(), temp.begin());
       data_.push_back(temp);
+      panels_.push_back(temp.const_ref());
     }
 
     /**
      * The number of panels
      */
     std::size_t size() const {
-      return data_.size();
+      return panels_.size();
     }
 
     /**
@@ -88,11 +135,78 @@ namespace dials { namespace algorithms {
      */
     af::versa<double, af::c_grid<2> > data(std::size_t panel) const {
       DIALS_ASSERT(panel < size());
-      return data_[panel];
+      if (!is_mapped()) {
+        return data_[panel];
+      }
+      af::versa<double, af::c_grid<2> > result(panels_[panel].accessor());
+      std::copy(panels_[panel].begin(), panels_[panel].end(), result.begin());
+      return result;
+    }
+
+    /**
+     * @returns Is the model memory mapped from a file
+     */
+    bool is_mapped() const {
+      return region_ != NULL;
+    }
+
+    /**
+     * Write the model to a file which can be memory mapped. The panels are
+     * written one at a time.
+     * @param filename The model file
+     */
+    void save(const std::string &filename) const {
+      std::ofstream outfile(filename.c_str(), std::ios::binary);
+      DIALS_ASSERT(outfile);
+      outfile.write(magic(), 8);
+      std::vector<boost::uint64_t> values(1, size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        values.push_back(panels_[i].accessor()[0]);
+        values.push_back(panels_[i].accessor()[1]);
+      }
+      outfile.write(reinterpret_cast<const char *>(&values[0]),
+                    values.size() * sizeof(boost::uint64_t));
+      for (std::size_t i = 0; i < size(); ++i) {
+        outfile.write(reinterpret_cast<const char *>(panels_[i].begin()),
+                      panels_[i].size() * sizeof(double));
+      }
+      DIALS_ASSERT(outfile);
+    }
+
+    /**
+     * Check if a file is a model file written by save()
+     * @param filename The file name
+     * @returns True/False the file starts with the model file magic string
+     */
+    static bool is_model_file(const std::string &filename) {
+      std::ifstream infile(filename.c_str(), std::ios::binary);
+      char buffer[8];
+      return infile.read(buffer, 8) && std::memcmp(buffer, magic(), 8) == 0;
     }
 
   protected:
+    static const char *magic() {
+      return "DIALSBGM";
+    }
+
+    static std::size_t header_size(std::size_t num_panels) {
+      return 8 + (1 + 2 * num_panels) * sizeof(boost::uint64_t);
+    }
+
+    /**
+     * Read a value from the header of a mapped file
+     */
+    static std::size_t header(const char *begin, std::size_t size, std::size_t index) {
+      std::size_t offset = 8 + index * sizeof(boost::uint64_t);
+      DIALS_ASSERT(offset + sizeof(boost::uint64_t) <= size);
+      boost::uint64_t value = 0;
+      std::memcpy(&value, begin + offset, sizeof(value));
+      return (std::size_t)value;
+    }
+
     af::shared<af::versa<double, af::c_grid<2> > > data_;
+    std::vector<const_ref_type> panels_;
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
   };
 
 }}  // namespace dials::algorithms
@@ -15,57 +15,11 @@
 #include <scitbx/matrix/multiply.h>
 #include <scitbx/glmtbx/family.h>
 #include <scitbx/glmtbx/robust_glm.h>
+#include <dials/algorithms/background/glm/robust_poisson_mean.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
-  class ExpectationTable {
-  public:
-    ExpectationTable()
-        : c_(-1), max_(1000), div_(100), size_(max_ * div_), epsi_table_(size_) {}
-
-    void set_c(double c) {
-      DIALS_ASSERT(c > 0);
-      if (c_ <= 0 || std::abs(c - c_) > 1e-3) {
-        c_ = c;
-        for (std::size_t i = 0; i < size_; ++i) {
-          epsi_table_[i] = calculate((double)i / (double)div_);
-        }
-      }
-    }
-
-    vec2<double> get(double mu) {
-      return mu < max_ ? interpolate(mu) : calculate(mu);
-    }
-
-  private:
-    vec2<double> interpolate(double mu) const {
-      DIALS_ASSERT(mu >= 0);
-      std::size_t index = (std::size_t)std::floor(mu * div_);
-      DIALS_ASSERT(index < epsi_table_.size());
-      return epsi_table_[index];
-    }
-
-    vec2<double> calculate(double mu) const {
-      DIALS_ASSERT(mu > 0);
-      DIALS_ASSERT(c_ > 0);
-      scitbx::glmtbx::expectation<scitbx::glmtbx::poisson> e(mu, std::sqrt(mu), c_);
-      return vec2<double>(e.epsi1, e.epsi2);
-    }
-
-    double c_;
-    int max_;
-    int div_;
-    std::size_t size_;
-    af::shared<vec2<double> > epsi_table_;
-  };
-
-  inline ExpectationTable get_expectation_table(double c) {
-    static ExpectationTable table;
-    table.set_c(c);
-    return table;
-  }
-
   /**
    * An algorithm to do robust generalized linear model as described in
    * Cantoni and Rochetti (2001) "Robust Inference for Generalized Linear
@@ -103,7 +57,35 @@ namespace dials { namespace algorithms {
       SCITBX_ASSERT(c > 0);
       SCITBX_ASSERT(tolerance > 0);
       SCITBX_ASSERT(max_iter > 0);
-      compute(X, Y);
+      compute(X, Y, *PoissonExpectationTable::shared(c));
+    }
+
+    /**
+     * Compute the scale parameter using an expectation table the caller
+     * already holds
+     * @param X The background profile
+     * @param Y The background observations
+     * @param B The initial estimate
+     * @param table The expectation table for the huber tuning constant
+     * @param tolerance The stopping criteria
+     * @param max_iter The maximum number of iterations
+     */
+    robust_estimator(const af::const_ref<double> &X,
+                     const af::const_ref<double> &Y,
+                     double B,
+                     const PoissonExpectationTable &table,
+                     double tolerance,
+                     std::size_t max_iter)
+        : beta_(B),
+          niter_(0),
+          error_(0),
+          c_(table.c()),
+          tolerance_(tolerance),
+          max_iter_(max_iter) {
+      SCITBX_ASSERT(X.size() == Y.size());
+      SCITBX_ASSERT(tolerance > 0);
+      SCITBX_ASSERT(max_iter > 0);
+      compute(X, Y, table);
     }
 
     /**
@@ -149,7 +131,9 @@ namespace dials { namespace algorithms {
     }
 
   private:
-    void compute(const af::const_ref<double> &X, const af::const_ref<double> &Y) {
+    void compute(const af::const_ref<double> &X,
+                 const af::const_ref<double> &Y,
+                 const PoissonExpectationTable &expectation) {
       // Number of observations and coefficients
       std::size_t n_obs = X.size();
 
@@ -157,13 +141,11 @@ namespace dials { namespace algorithms {
       double U = 0;
       double H = 0;
 
-      // Get the expectation table
-      ExpectationTable expectation = get_expectation_table(c_);
-
       // Loop until we reach the maximum number of iterations
       for (niter_ = 0; niter_ < max_iter_; ++niter_) {
-        // Initialize the sum to zero
+        // Initialize the sums to zero
         U = 0.0;
+        H = 0.0;
 
         // Build the matrices from the observations
         for (std::size_t i = 0; i < n_obs; ++i) {
@@ -12,6 +12,7 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_MEDIAN_CREATOR_H
 #define DIALS_ALGORITHMS_BACKGROUND_MEDIAN_CREATOR_H
 
+#include <algorithm>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
@@ -64,8 +65,9 @@ namespace dials { namespace algorithms {
     }
     DIALS_ASSERT(j == Y.size());
 
-    // Compute the median value for the starting value
-    double median = detail::median(Y.const_ref());
+    // Compute the median value. Y is a copy already so select in place.
+    std::nth_element(Y.begin(), Y.begin() + Y.size() / 2, Y.end());
+    double median = Y[Y.size() / 2];
 
     // Fill in the background shoebox values
     for (std::size_t i = 0; i < data.size(); ++i) {
@@ -116,6 +118,11 @@ namespace dials { namespace algorithms {
       // Get the image volume
       ImageVolume<> v = volume.get(panel[i]);
 
+      // In a windowed volume, wait until the reflection's last frame is added
+      if (!v.is_finalised(bbox[i])) {
+        continue;
+      }
+
       // Trim the bbox
       int6 b = v.trim_bbox(bbox[i]);
 
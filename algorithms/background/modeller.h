@@ -12,12 +12,14 @@
 #define DIALS_ALGORITHMS_BACKGROUND_MODELLER_H
 
 #include <dials/model/data/image_volume.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace algorithms {
 
   using dials::model::Foreground;
   using dials::model::ImageVolume;
   using dials::model::MultiPanelImageVolume;
+  using dials::model::PackedMaskType;
   using dials::model::Valid;
 
   /**
@@ -26,10 +28,13 @@ namespace dials { namespace algorithms {
   class BackgroundStatistics {
   public:
     /**
-     * Initialize from an image volume
+     * Initialize from an image volume. The rows of the image are split
+     * between the threads. Only the frames whose mask can still be set are
+     * used, so adding each frame of a windowed volume counts it once.
      * @param volume The image volume
+     * @param nthreads The number of threads
      */
-    BackgroundStatistics(const ImageVolume<> &volume)
+    BackgroundStatistics(const ImageVolume<> &volume, std::size_t nthreads = 1)
         : accessor_(volume.accessor()[1], volume.accessor()[2]),
           sum_(accessor_, 0.0),
           sum_sq_(accessor_, 0.0),
@@ -37,23 +42,15 @@ namespace dials { namespace algorithms {
           min_(accessor_, -1),
           max_(accessor_, -1) {
       DIALS_ASSERT(volume.is_consistent());
-      typedef ImageVolume<>::float_type FloatType;
-      af::const_ref<FloatType, af::c_grid<3> > data = volume.data().const_ref();
-      af::const_ref<int, af::c_grid<3> > mask = volume.mask().const_ref();
-      for (std::size_t j = 0; j < accessor_[0]; ++j) {
-        for (std::size_t i = 0; i < accessor_[1]; ++i) {
-          for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-            double d = data(k, j, i);
-            int m = mask(k, j, i);
-            if ((m & Valid) && !(m & Foreground)) {
-              sum_(j, i) += d;
-              sum_sq_(j, i) += d * d;
-              num_(j, i) += 1;
-              if (min_(j, i) == -1 || min_(j, i) > d) min_(j, i) = d;
-              if (max_(j, i) == -1 || max_(j, i) < d) max_(j, i) = d;
-            }
-          }
-        }
+      af::versa<FloatType, af::c_grid<3> > data = volume.data();
+      af::versa<PackedMaskType, af::c_grid<3> > mask = volume.packed_mask();
+      if (volume.mask_frame1() > volume.mask_frame0()) {
+        std::size_t k0 = volume.frame_index(volume.mask_frame0());
+        std::size_t k1 = k0 + (volume.mask_frame1() - volume.mask_frame0());
+        dials::util::parallel_for(
+          accessor_[0],
+          nthreads,
+          RowJob(this, data.const_ref(), mask.const_ref(), k0, k1));
       }
     }
 
@@ -180,6 +177,64 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    typedef ImageVolume<>::float_type FloatType;
+
+    /**
+     * Accumulate the statistics for a range of rows
+     */
+    class RowJob {
+    public:
+      RowJob(BackgroundStatistics *statistics,
+             af::const_ref<FloatType, af::c_grid<3> > data,
+             af::const_ref<PackedMaskType, af::c_grid<3> > mask,
+             std::size_t k0,
+             std::size_t k1)
+          : statistics_(statistics), data_(data), mask_(mask), k0_(k0), k1_(k1) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        statistics_->accumulate(data_, mask_, k0_, k1_, first, last);
+      }
+
+    private:
+      BackgroundStatistics *statistics_;
+      af::const_ref<FloatType, af::c_grid<3> > data_;
+      af::const_ref<PackedMaskType, af::c_grid<3> > mask_;
+      std::size_t k0_;
+      std::size_t k1_;
+    };
+
+    /**
+     * Accumulate the statistics for the rows from first to last
+     * @param data The image data
+     * @param mask The image mask
+     * @param k0 The first frame index
+     * @param k1 The last frame index (exclusive)
+     * @param first The first row
+     * @param last The last row (exclusive)
+     */
+    void accumulate(const af::const_ref<FloatType, af::c_grid<3> > &data,
+                    const af::const_ref<PackedMaskType, af::c_grid<3> > &mask,
+                    std::size_t k0,
+                    std::size_t k1,
+                    std::size_t first,
+                    std::size_t last) {
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t i = 0; i < accessor_[1]; ++i) {
+          for (std::size_t k = k0; k < k1; ++k) {
+            double d = data(k, j, i);
+            int m = mask(k, j, i);
+            if ((m & Valid) && !(m & Foreground)) {
+              sum_(j, i) += d;
+              sum_sq_(j, i) += d * d;
+              num_(j, i) += 1;
+              if (min_(j, i) == -1 || min_(j, i) > d) min_(j, i) = d;
+              if (max_(j, i) == -1 || max_(j, i) < d) max_(j, i) = d;
+            }
+          }
+        }
+      }
+    }
+
     af::c_grid<2> accessor_;
     af::versa<double, af::c_grid<2> > sum_;
     af::versa<double, af::c_grid<2> > sum_sq_;
@@ -196,10 +251,12 @@ namespace dials { namespace algorithms {
     /**
      * Initialize with multipanel image volume
      * @param volume The multi panel image volume
+     * @param nthreads The number of threads
      */
-    MultiPanelBackgroundStatistics(const MultiPanelImageVolume<> &volume) {
+    MultiPanelBackgroundStatistics(const MultiPanelImageVolume<> &volume,
+                                   std::size_t nthreads = 1) {
       for (std::size_t i = 0; i < volume.size(); ++i) {
-        statistics_.push_back(BackgroundStatistics(volume.get(i)));
+        statistics_.push_back(BackgroundStatistics(volume.get(i), nthreads));
       }
     }
 
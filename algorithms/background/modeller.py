@@ -22,13 +22,16 @@ class FinalizeModel:
     A class to finalize the background model
     """
 
-    def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100):
+    def __init__(
+        self, experiments, filter_type="median", kernel_size=10, niter=100, nthreads=1
+    ):
         """
         Initialize the finalizer
 
         :param experiments: The experiment list
         :param kernel_size: The median filter kernel size
         :param niter: The number of iterations for filling holes
+        :param nthreads: The number of threads to use for filling holes
         """
         from dials.algorithms.background.gmodel import PolarTransform
 
@@ -36,6 +39,7 @@ def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100)
         self.filter_type = filter_type
         self.kernel_size = kernel_size
         self.niter = niter
+        self.nthreads = nthreads
 
         # Check the input
         assert len(experiments) == 1
@@ -109,7 +113,7 @@ def finalize(self, data, mask):
         # Fill any remaining holes
         logger.info("Filling holes")
         data = simple_fill(data, mask)
-        data = diffusion_fill(data, mask, self.niter)
+        data = diffusion_fill(data, mask, self.niter, self.nthreads)
         mask = flex.bool(data.accessor(), True)
         sub_data = data.as_1d().select(mask.as_1d())
         logger.info("Filled polar image statistics:")
@@ -132,7 +136,7 @@ def finalize(self, data, mask):
 
         # Fill in any discontinuities
         mask = ~self.transform.discontinuity()[:-1, :-1]
-        data = diffusion_fill(data, mask, self.niter)
+        data = diffusion_fill(data, mask, self.niter, self.nthreads)
 
         # Get and apply the mask
         mask = self.experiment.imageset.get_mask(0)[0]
@@ -180,32 +184,36 @@ def __init__(self, experiments, params):
         if self.min_images > len(experiments[0].imageset):
             self.min_images = len(experiments[0].imageset)
         self.image_type = params.modeller.image_type
+        self.nthreads = params.modeller.nthreads
 
         self.finalizer = FinalizeModel(
             experiments=experiments,
             filter_type=params.modeller.filter_type,
             kernel_size=params.modeller.kernel_size,
             niter=params.modeller.niter,
+            nthreads=params.modeller.nthreads,
         )
         self.result = None
 
     def process(self, image_volume, experiments, reflections):
         from dials.algorithms.integration.processor import job
 
-        # Write some output
-        logger.info(
-            " Background modelling; job: %d; frames: %d -> %d; # Reflections: %d",
-            job.index,
-            image_volume.frame0(),
-            image_volume.frame1(),
-            len(reflections),
-        )
+        # Write some output. A windowed volume is processed after each frame is
+        # added, so only write it for the first frame
+        if image_volume.mask_frame0() == image_volume.frame0():
+            logger.info(
+                " Background modelling; job: %d; frames: %d -> %d; # Reflections: %d",
+                job.index,
+                image_volume.frame0(),
+                image_volume.frame1(),
+                len(reflections),
+            )
 
         # Compute the shoebox mask
         reflections.compute_mask(experiments=experiments, image_volume=image_volume)
 
         # Compute the sum, sum^2 and the number of contributing pixels
-        return MultiPanelBackgroundStatistics(image_volume)
+        return MultiPanelBackgroundStatistics(image_volume, self.nthreads)
 
     def accumulate(self, index, data):
         if self.result is None:
@@ -11,8 +11,14 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 #define DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 
+#include <cmath>
+#include <map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -21,13 +27,34 @@ namespace dials { namespace algorithms {
   using dxtbx::model::Detector;
   using dxtbx::model::Panel;
 
+  /**
+   * Compute the average of the pixel values in bins of resolution (1/d^2). The
+   * images are added one panel at a time in order, and after the last panel
+   * the next image starts again with the first, so a whole sweep can be
+   * streamed through the same object.
+   *
+   * The resolution bin of each pixel is computed once for each panel when the
+   * object is created, so the beam and detector are assumed not to change.
+   * The rows of each image are split between the threads; each chunk of rows
+   * sums into its own partial arrays which are then added in order of row,
+   * so the result does not depend on the number of threads.
+   */
   class RadialAverage {
   public:
+    /**
+     * @param beam The beam model
+     * @param detector The detector model
+     * @param vmin The minimum 1/d^2
+     * @param vmax The maximum 1/d^2
+     * @param num_bins The number of bins
+     * @param nthreads The number of threads
+     */
     RadialAverage(boost::shared_ptr<BeamBase> beam,
                   const Detector &detector,
                   double vmin,
                   double vmax,
-                  std::size_t num_bins)
+                  std::size_t num_bins,
+                  std::size_t nthreads = 1)
         : beam_(beam),
           detector_(detector),
           sum_(num_bins, 0),
@@ -36,41 +63,67 @@ namespace dials { namespace algorithms {
           vmin_(vmin),
           vmax_(vmax),
           num_bins_(num_bins),
+          nthreads_(nthreads),
           current_(0) {
       DIALS_ASSERT(vmax > vmin);
       DIALS_ASSERT(num_bins > 0);
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(detector.size() > 0);
       for (std::size_t i = 0; i < inv_d2_.size(); ++i) {
         inv_d2_[i] = vmin + i * (vmax - vmin) / num_bins_;
       }
+      vec3<double> s0 = beam_->get_s0();
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        const Panel &panel = detector_[i];
+        std::size_t height = panel.get_image_size()[1];
+        std::size_t width = panel.get_image_size()[0];
+        af::versa<int, af::c_grid<2> > index(af::c_grid<2>(height, width), -1);
+        dials::util::parallel_for(
+          height, nthreads_, IndexJob(this, panel, s0, index.ref()));
+        index_.push_back(index);
+      }
     }
 
+    /**
+     * Add the data from the next panel
+     * @param data The panel data
+     * @param mask The panel mask
+     */
     void add(const af::const_ref<double, af::c_grid<2> > &data,
              const af::const_ref<bool, af::c_grid<2> > &mask) {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      vec3<double> s0 = beam_->get_s0();
-      const Panel &panel = detector_[current_++];
-      std::size_t height = panel.get_image_size()[1];
-      std::size_t width = panel.get_image_size()[0];
-      DIALS_ASSERT(data.accessor()[0] == height);
-      DIALS_ASSERT(data.accessor()[1] == width);
-      for (std::size_t j = 0; j < height; ++j) {
-        for (std::size_t i = 0; i < width; ++i) {
-          if (mask(j, i)) {
-            double d = panel.get_resolution_at_pixel(s0, vec2<double>(i, j));
-            double d2 = (1.0 / (d * d));
-            if (d2 >= vmin_ && d2 < vmax_) {
-              double b = vmin_;
-              double a = (vmax_ - vmin_) / num_bins_;
-              int index = std::floor((d2 - b) / a);
-              DIALS_ASSERT(index >= 0 && index < num_bins_);
-              sum_[index] += data(j, i);
-              weight_[index] += 1.0;
-            }
-          }
+      af::const_ref<int, af::c_grid<2> > index = index_[current_].const_ref();
+      DIALS_ASSERT(data.accessor().all_eq(index.accessor()));
+      current_ = (current_ + 1) % detector_.size();
+      std::map<std::size_t, Partial> partials;
+      boost::mutex mutex;
+      dials::util::parallel_for(data.accessor()[0],
+                                nthreads_,
+                                SumJob(this, data, mask, index, partials, mutex));
+      for (std::map<std::size_t, Partial>::const_iterator it = partials.begin();
+           it != partials.end();
+           ++it) {
+        for (std::size_t i = 0; i < num_bins_; ++i) {
+          sum_[i] += it->second.sum[i];
+          weight_[i] += it->second.weight[i];
         }
       }
     }
 
+    /**
+     * Add the sums from another radial average with the same bins
+     * @param other The other radial average
+     */
+    RadialAverage operator+=(const RadialAverage &other) {
+      DIALS_ASSERT(num_bins_ == other.num_bins_);
+      DIALS_ASSERT(vmin_ == other.vmin_ && vmax_ == other.vmax_);
+      for (std::size_t i = 0; i < num_bins_; ++i) {
+        sum_[i] += other.sum_[i];
+        weight_[i] += other.weight_[i];
+      }
+      return *this;
+    }
+
     af::shared<double> mean() const {
       af::shared<double> result(sum_.size());
       for (std::size_t i = 0; i < sum_.size(); ++i) {
@@ -92,14 +145,110 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The sums for a chunk of rows
+     */
+    struct Partial {
+      std::vector<double> sum;
+      std::vector<double> weight;
+    };
+
+    /**
+     * Compute the bin index of the pixels in a range of rows
+     */
+    class IndexJob {
+    public:
+      IndexJob(const RadialAverage *average,
+               const Panel &panel,
+               vec3<double> s0,
+               af::ref<int, af::c_grid<2> > index)
+          : average_(average), panel_(&panel), s0_(s0), index_(index) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t j = first; j < last; ++j) {
+          for (std::size_t i = 0; i < index_.accessor()[1]; ++i) {
+            double d = panel_->get_resolution_at_pixel(s0_, vec2<double>(i, j));
+            index_(j, i) = average_->bin(1.0 / (d * d));
+          }
+        }
+      }
+
+    private:
+      const RadialAverage *average_;
+      const Panel *panel_;
+      vec3<double> s0_;
+      af::ref<int, af::c_grid<2> > index_;
+    };
+
+    /**
+     * Sum the pixels in a range of rows into a partial
+     */
+    class SumJob {
+    public:
+      SumJob(const RadialAverage *average,
+             af::const_ref<double, af::c_grid<2> > data,
+             af::const_ref<bool, af::c_grid<2> > mask,
+             af::const_ref<int, af::c_grid<2> > index,
+             std::map<std::size_t, Partial> &partials,
+             boost::mutex &mutex)
+          : average_(average),
+            data_(data),
+            mask_(mask),
+            index_(index),
+            partials_(&partials),
+            mutex_(&mutex) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        Partial partial;
+        partial.sum.resize(average_->num_bins_, 0);
+        partial.weight.resize(average_->num_bins_, 0);
+        for (std::size_t j = first; j < last; ++j) {
+          for (std::size_t i = 0; i < data_.accessor()[1]; ++i) {
+            int k = index_(j, i);
+            if (k >= 0 && mask_(j, i)) {
+              partial.sum[k] += data_(j, i);
+              partial.weight[k] += 1.0;
+            }
+          }
+        }
+        boost::lock_guard<boost::mutex> guard(*mutex_);
+        (*partials_)[first].sum.swap(partial.sum);
+        (*partials_)[first].weight.swap(partial.weight);
+      }
+
+    private:
+      const RadialAverage *average_;
+      af::const_ref<double, af::c_grid<2> > data_;
+      af::const_ref<bool, af::c_grid<2> > mask_;
+      af::const_ref<int, af::c_grid<2> > index_;
+      std::map<std::size_t, Partial> *partials_;
+      boost::mutex *mutex_;
+    };
+
+    /**
+     * @returns The bin of a resolution or -1 if it is out of range
+     */
+    int bin(double d2) const {
+      if (!(d2 >= vmin_ && d2 < vmax_)) {
+        return -1;
+      }
+      double b = vmin_;
+      double a = (vmax_ - vmin_) / num_bins_;
+      int index = std::floor((d2 - b) / a);
+      DIALS_ASSERT(index >= 0 && index < num_bins_);
+      return index;
+    }
+
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
     af::shared<double> sum_;
     af::shared<double> weight_;
     af::shared<double> inv_d2_;
+    af::shared<af::versa<int, af::c_grid<2> > > index_;
     double vmin_;
     double vmax_;
     std::size_t num_bins_;
+    std::size_t nthreads_;
     std::size_t current_;
   };
 
@@ -8,6 +8,8 @@ def __init__(self, experiments, outlier="nsigma", model="constant3d", **kwargs):
         :param experiments: The list of experiments
         :param outlier: The outlier rejection algorithm
         :param model: The background model algorithm
+        :param share_overlaps: Share one background between overlapping shoeboxes
+        :param max_cluster_size: The most shoeboxes sharing a background
         """
         from dials.algorithms.background.simple import (
             Constant2dModeller,
@@ -62,6 +64,8 @@ def select_rejector():
         modeller = select_modeller()
         rejector = select_rejector()
         self._creator = Creator(modeller, rejector, min_pixels=min_pixels)
+        self._share_overlaps = kwargs.get("share_overlaps", False)
+        self._max_cluster_size = kwargs.get("max_cluster_size", 8)
 
     def compute_background(self, reflections, image_volume=None):
         """
@@ -75,11 +79,24 @@ def compute_background(self, reflections, image_volume=None):
         if image_volume is None:
             reflections["background.mse"] = flex.double(len(reflections))
             reflections["background.dispersion"] = flex.double(len(reflections))
-            success = self._creator(
-                reflections["shoebox"],
-                reflections["background.mse"],
-                reflections["background.dispersion"],
-            )
+            if self._share_overlaps:
+                from dials.algorithms.background import overlap_clusters
+
+                cluster = overlap_clusters(
+                    reflections["bbox"], reflections["panel"], self._max_cluster_size
+                )
+                success = self._creator.by_cluster(
+                    reflections["shoebox"],
+                    cluster,
+                    reflections["background.mse"],
+                    reflections["background.dispersion"],
+                )
+            else:
+                success = self._creator(
+                    reflections["shoebox"],
+                    reflections["background.mse"],
+                    reflections["background.dispersion"],
+                )
             reflections["background.mean"] = reflections["shoebox"].mean_background()
         else:
             success = self._creator(reflections, image_volume)
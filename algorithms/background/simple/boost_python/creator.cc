@@ -53,6 +53,15 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
     return self(reflections, image_volume);
   }
 
+  template <typename FloatType>
+  af::shared<bool> by_cluster(const SimpleBackgroundCreator &self,
+                              af::ref<Shoebox<FloatType> > sbox,
+                              const af::const_ref<std::size_t> &cluster,
+                              af::ref<double> mse,
+                              af::ref<double> dispersion) {
+    return self.by_cluster(sbox, cluster, mse, dispersion);
+  }
+
   void creator_wrapper() {
     class_<SimpleBackgroundCreator>("Creator", no_init)
       .def(init<boost::shared_ptr<Modeller>, std::size_t>(
@@ -65,7 +74,10 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .def("__call__", &call_2<float>)
       .def("__call__", &call_3<float>)
       .def("__call__", &call_4<float>)
-      .def("__call__", &call_5<float>);
+      .def("__call__", &call_5<float>)
+      .def("by_cluster",
+           &by_cluster<float>,
+           (arg("shoeboxes"), arg("cluster"), arg("mse"), arg("dispersion")));
   }
 
   void export_creator() {
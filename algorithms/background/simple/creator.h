@@ -16,6 +16,7 @@
 #include <boost/shared_ptr.hpp>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/background/cluster.h>
 #include <dials/algorithms/background/simple/outlier_rejector.h>
 #include <dials/algorithms/background/simple/modeller.h>
 #include <dials/model/data/shoebox.h>
@@ -89,6 +90,24 @@ namespace dials { namespace algorithms { namespace background {
       return result;
     }
 
+    /**
+     * Create one background for each cluster of overlapping shoeboxes and
+     * share it between the shoeboxes in the cluster.
+     * @param shoeboxes The list of shoeboxes
+     * @param cluster The cluster of each shoebox
+     * @return Success True/False per shoebox
+     */
+    template <typename FloatType>
+    af::shared<bool> by_cluster(af::ref<Shoebox<FloatType> > shoeboxes,
+                                const af::const_ref<std::size_t> &cluster,
+                                af::ref<double> mse,
+                                af::ref<double> dispersion) const {
+      DIALS_ASSERT(mse.size() == shoeboxes.size());
+      DIALS_ASSERT(dispersion.size() == shoeboxes.size());
+      return create_by_cluster(
+        shoeboxes, cluster, ClusterFunction<FloatType>(this, mse, dispersion));
+    }
+
     /**
      * Compute the background values
      * @param reflections The reflection table
@@ -217,6 +236,42 @@ namespace dials { namespace algorithms { namespace background {
     }
 
   private:
+    /**
+     * Compute the background of a shoebox and record the statistics for the
+     * shoeboxes which share it
+     */
+    template <typename FloatType>
+    class ClusterFunction {
+    public:
+      ClusterFunction(const SimpleBackgroundCreator *creator,
+                      af::ref<double> mse,
+                      af::ref<double> dispersion)
+          : creator_(creator), mse_(mse), dispersion_(dispersion) {}
+
+      bool operator()(Shoebox<FloatType> &shoebox,
+                      const std::vector<std::size_t> &members) const {
+        af::tiny<FloatType, 2> r(0, 0);
+        bool success = true;
+        try {
+          r = (*creator_)(shoebox);
+        } catch (dials::error const &) {
+          success = false;
+        } catch (std::runtime_error const &) {
+          success = false;
+        }
+        for (std::size_t i = 0; i < members.size(); ++i) {
+          mse_[members[i]] = r[0];
+          dispersion_[members[i]] = r[1];
+        }
+        return success;
+      }
+
+    private:
+      const SimpleBackgroundCreator *creator_;
+      af::ref<double> mse_;
+      af::ref<double> dispersion_;
+    };
+
     boost::shared_ptr<Modeller> modeller_;
     boost::shared_ptr<OutlierRejector> rejector_;
     std::size_t min_pixels_;
@@ -12,6 +12,7 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_MODELLER_H
 #define DIALS_ALGORITHMS_BACKGROUND_MODELLER_H
 
+#include <algorithm>
 #include <cmath>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
@@ -171,6 +172,80 @@ namespace dials { namespace algorithms { namespace background {
     }
   };
 
+  /**
+   * Accumulate the normal equations of a linear least squares fit to the pixel
+   * values in a single pass over the pixels. The parameters are the constant
+   * term followed by the coefficients of the N - 1 coordinates.
+   *
+   * The residual sum of squares is computed from the moment sums rather than
+   * with a second pass over the pixels. To limit the cancellation this
+   * involves, the pixel values are offset by the first value added, which
+   * only changes the constant term.
+   */
+  template <std::size_t N>
+  class LinearLeastSquares {
+  public:
+    LinearLeastSquares() : count_(0), offset_(0), sum_sq_(0) {
+      std::fill(A_, A_ + N * N, 0.0);
+      std::fill(B_, B_ + N, 0.0);
+    }
+
+    /**
+     * Add a pixel
+     * @param x The coordinates with x[0] = 1
+     * @param p The pixel value
+     */
+    void add(const double *x, double p) {
+      if (count_ == 0) {
+        offset_ = p;
+      }
+      p -= offset_;
+      for (std::size_t r = 0; r < N; ++r) {
+        for (std::size_t c = r; c < N; ++c) {
+          A_[r * N + c] += x[r] * x[c];
+        }
+        B_[r] += x[r] * p;
+      }
+      sum_sq_ += p * p;
+      count_++;
+    }
+
+    /**
+     * Solve the normal equations
+     * @param params The fitted parameters
+     * @param variances The variances of the parameters
+     */
+    void solve(double *params, double *variances) const {
+      double A[N * N];
+      double B[N];
+      for (std::size_t r = 0; r < N; ++r) {
+        for (std::size_t c = 0; c < N; ++c) {
+          A[r * N + c] = r <= c ? A_[r * N + c] : A_[c * N + r];
+        }
+        B[r] = B_[r];
+      }
+      inversion_in_place(A, N, B, 1);
+      double S = sum_sq_;
+      for (std::size_t r = 0; r < N; ++r) {
+        S -= B[r] * B_[r];
+      }
+      S = std::max(S, 0.0);
+      DIALS_ASSERT(count_ > N);
+      for (std::size_t r = 0; r < N; ++r) {
+        params[r] = B[r];
+        variances[r] = S * A[r * N + r] / (count_ - N);
+      }
+      params[0] += offset_;
+    }
+
+  private:
+    std::size_t count_;
+    double offset_;
+    double sum_sq_;
+    double A_[N * N];
+    double B_[N];
+  };
+
   /**
    * A background model that is a plane per image.
    */
@@ -237,51 +312,24 @@ namespace dials { namespace algorithms { namespace background {
       af::shared<double> vb(mask.accessor()[0], 0);
       af::shared<double> vc(mask.accessor()[0], 0);
       for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
-        af::shared<double> A(3 * 3, 0);
-        af::shared<double> B(3, 0);
+        LinearLeastSquares<3> fit;
         for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
             if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double p = data(k, j, i);
-              A[0] += 1;
-              A[1] += x;
-              A[2] += y;
-              A[4] += x * x;
-              A[5] += x * y;
-              A[8] += y * y;
-              B[0] += p;
-              B[1] += x * p;
-              B[2] += y * p;
+              double x[3] = {1.0, i + 0.5, j + 0.5};
+              fit.add(x, data(k, j, i));
             }
           }
         }
-        A[3] = A[1];
-        A[6] = A[2];
-        A[7] = A[5];
-        inversion_in_place(A.begin(), 3, B.begin(), 1);
-        a[k] = B[0];
-        b[k] = B[1];
-        c[k] = B[2];
-        double S = 0.0;
-        int count = 0;
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double p = data(k, j, i);
-              double s = (p - a[k] - b[k] * x - c[k] * y);
-              S += s * s;
-              count++;
-            }
-          }
-        }
-        DIALS_ASSERT(count > 3);
-        va[k] = S * A[0] / (count - 3);
-        vb[k] = S * A[4] / (count - 3);
-        vc[k] = S * A[8] / (count - 3);
+        double params[3];
+        double variances[3];
+        fit.solve(params, variances);
+        a[k] = params[0];
+        b[k] = params[1];
+        c[k] = params[2];
+        va[k] = variances[0];
+        vb[k] = variances[1];
+        vc[k] = variances[2];
       }
       return boost::make_shared<Linear2dModel>(a, b, c, va, vb, vc);
     }
@@ -338,64 +386,22 @@ namespace dials { namespace algorithms { namespace background {
       const af::const_ref<double, af::c_grid<3> > &data,
       const af::const_ref<bool, af::c_grid<3> > &mask) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      af::shared<double> A(4 * 4, 0);
-      af::shared<double> B(4, 0);
+      LinearLeastSquares<4> fit;
       for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
         for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
             if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double z = (k + 0.5);
-              double p = data(k, j, i);
-              A[0] += 1;
-              A[1] += x;
-              A[2] += y;
-              A[3] += z;
-              A[5] += x * x;
-              A[6] += x * y;
-              A[7] += x * z;
-              A[10] += y * y;
-              A[11] += y * z;
-              A[15] += z * z;
-              B[0] += p;
-              B[1] += x * p;
-              B[2] += y * p;
-              B[3] += z * p;
-            }
-          }
-        }
-      }
-      A[4] = A[1];
-      A[8] = A[2];
-      A[9] = A[6];
-      A[12] = A[3];
-      A[13] = A[7];
-      A[14] = A[11];
-      inversion_in_place(A.begin(), 4, B.begin(), 1);
-      double S = 0.0;
-      int count = 0;
-      for (std::size_t k = 0; k < mask.accessor()[0]; ++k) {
-        for (std::size_t j = 0; j < mask.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < mask.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              double x = (i + 0.5);
-              double y = (j + 0.5);
-              double z = (k + 0.5);
-              double p = data(k, j, i);
-              double s = (p - B[0] - B[1] * x - B[2] * y - B[3] * z);
-              S += s * s;
-              count++;
+              double x[4] = {1.0, i + 0.5, j + 0.5, k + 0.5};
+              fit.add(x, data(k, j, i));
             }
           }
         }
       }
-      DIALS_ASSERT(count > 4);
-      double va = S * A[0] / (count - 4);
-      double vb = S * A[5] / (count - 4);
-      double vc = S * A[10] / (count - 4);
-      double vd = S * A[15] / (count - 4);
-      return boost::make_shared<Linear3dModel>(B[0], B[1], B[2], B[3], va, vb, vc, vd);
+      double p[4];
+      double v[4];
+      fit.solve(p, v);
+      return boost::make_shared<Linear3dModel>(
+        p[0], p[1], p[2], p[3], v[0], v[1], v[2], v[3]);
     }
   };
 
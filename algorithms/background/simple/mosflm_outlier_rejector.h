@@ -95,7 +95,8 @@ namespace dials { namespace algorithms { namespace background {
 
     /**
      * Calculate the initial mask. Select the fraction of pixels with the lowest
-     * intensity and then update the mask for those pixels.
+     * intensity and then update the mask for those pixels. The pixels are
+     * partitioned rather than sorted since their order does not matter.
      */
     void compute_initial_mask(const af::const_ref<double, af::c_grid<2> > &data,
                               af::ref<int, af::c_grid<2> > mask) const {
@@ -110,9 +111,12 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
       DIALS_ASSERT(index.size() > 0);
-      std::sort(index.begin(), index.end(), compare_pixel_value(data.as_1d()));
       std::size_t nactive = (std::size_t)std::floor(fraction_ * index.size() + 0.5);
       DIALS_ASSERT(nactive > 0 && nactive <= index.size());
+      std::nth_element(index.begin(),
+                       index.begin() + (nactive - 1),
+                       index.end(),
+                       compare_pixel_value(data.as_1d()));
       for (std::size_t i = 0; i < nactive; ++i) {
         mask[index[i]] |= BackgroundUsed;
       }
@@ -194,12 +194,27 @@ namespace dials { namespace algorithms { namespace background {
 
       // Check if the data is normally distributed. If it is not, then remove
       // a value of high intensity and keep looping until it is. If the number
-      // of iterations exceeds the maximum then exit the loop.
+      // of iterations exceeds the maximum then exit the loop. Since the pixels
+      // are sorted the highest value is always the last one, so the mean and
+      // variance are updated as each pixel is removed rather than computed
+      // again from all the remaining pixels. The values are offset by the
+      // median to keep the sums small.
       std::size_t num_data = pixels.size();
+      double offset = pixels[num_data / 2];
+      double sum = 0;
+      double sum_sq = 0;
+      for (std::size_t i = 0; i < num_data; ++i) {
+        double x = pixels[i] - offset;
+        sum += x;
+        sum_sq += x * x;
+      }
       for (; num_data > min_data_; --num_data) {
-        if (is_normally_distributed(af::const_ref<double>(pixels.begin(), num_data))) {
+        if (is_normal_prefix(pixels.const_ref(), num_data, sum, sum_sq, offset)) {
           break;
         }
+        double x = pixels[num_data - 1] - offset;
+        sum -= x;
+        sum_sq -= x * x;
       }
 
       // Set rejected pixels as 'not background'
@@ -209,6 +224,33 @@ namespace dials { namespace algorithms { namespace background {
     }
 
   private:
+    /**
+     * Check if the first n of the sorted pixels are normally distributed
+     * @param pixels The sorted pixel values
+     * @param n The number of pixels to check
+     * @param sum The sum of the offset pixel values
+     * @param sum_sq The sum of the squares of the offset pixel values
+     * @param offset The offset subtracted from the pixel values
+     * @returns True/False
+     */
+    static bool is_normal_prefix(const af::const_ref<double> &pixels,
+                                 std::size_t n,
+                                 double sum,
+                                 double sum_sq,
+                                 double offset) {
+      DIALS_ASSERT(n > 1 && n <= pixels.size());
+      double max_value = pixels[n - 1] - offset;
+      if (pixels[0] == pixels[n - 1]) {
+        return true;
+      }
+      double mean = sum / n;
+      double var = (sum_sq - sum * mean) / (n - 1);
+      if (var <= 0) {
+        return true;
+      }
+      return (max_value - mean) / std::sqrt(var) < normal_expected_n_sigma(n);
+    }
+
     std::size_t min_data_;
   };
 }}}  // namespace dials::algorithms::background
@@ -21,7 +21,7 @@
 
 namespace dials { namespace algorithms { namespace background {
 
-  using dials::af::sort_index;
+  using dials::af::index_less;
 
   /**
    * Remove top and bottom n% of pixels to use in background
@@ -58,17 +58,23 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
 
-      // Sort the pixels into ascending intensity order
-      sort_index(indices.begin(), indices.end(), shoebox.begin());
-      af::shared<double> pixels(indices.size(), af::init_functor_null<double>());
-      for (std::size_t i = 0; i < indices.size(); ++i) {
-        pixels[i] = (double)shoebox[indices[i]];
-      }
-
-      // Set rejected pixels as 'not background'
+      // Partition the pixels so those from i0 to i1 in ascending intensity
+      // order are in the middle. Their order within the partition does not
+      // matter so there is no need to sort them.
+      const double *values = shoebox.begin();
+      index_less<const double *> compare(values);
       std::size_t num_data = indices.size();
       std::size_t i0 = (std::size_t)(lower_ * num_data / 2.0);
       std::size_t i1 = num_data - (std::size_t)(upper_ * num_data / 2.0);
+      if (i0 > 0) {
+        std::nth_element(indices.begin(), indices.begin() + i0, indices.end(), compare);
+      }
+      if (i1 < num_data) {
+        std::nth_element(
+          indices.begin() + i0, indices.begin() + i1, indices.end(), compare);
+      }
+
+      // Set rejected pixels as 'not background'
       for (std::size_t i = i0; i < i1; ++i) {
         mask[indices[i]] |= shoebox::BackgroundUsed;
       }
@@ -56,13 +56,16 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
 
-      // Compute interquartile range
-      std::sort(data.begin(), data.end());
+      // Compute interquartile range. Only the quartiles are needed so select
+      // them rather than sorting all the data; every value before the upper
+      // quartile is <= it, so the lower quartile is selected from those.
       DIALS_ASSERT(data.size() > 2);
       std::size_t mid = data.size() / 2;
       std::size_t q1i = mid / 2;
       std::size_t q3i = mid + (data.size() - mid) / 2;
       DIALS_ASSERT(q1i < mid && mid < q3i && q3i < data.size());
+      std::nth_element(data.begin(), data.begin() + q3i, data.end());
+      std::nth_element(data.begin(), data.begin() + q1i, data.begin() + q3i);
       double q1 = data[q1i];
       double q3 = data[q3i];
       DIALS_ASSERT(q3 >= q1);
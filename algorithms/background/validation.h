@@ -0,0 +1,159 @@
+/*
+ * validation.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_BACKGROUND_VALIDATION_H
+#define DIALS_ALGORITHMS_BACKGROUND_VALIDATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/math/distributions/normal.hpp>
+#include <dials/model/data/mask_code.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/algorithms/statistics/kolmogorov_smirnov_test.h>
+#include <dials/algorithms/statistics/poisson_test.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::BackgroundUsed;
+  using dials::model::Shoebox;
+  using dials::model::Valid;
+
+  /**
+   * Check the background model of many shoeboxes at once. For each shoebox
+   * the pixels used in the background calculation are tested in two ways:
+   *
+   *  - their residuals (counts - background) / sqrt(background) are compared
+   *    with the standard normal distribution with the two sided kolmogorov
+   *    smirnov test.
+   *  - their maximum count is compared with the maximum expected for that
+   *    number of pixels from a poisson distribution with the mean background.
+   *
+   * The shoeboxes are tested on a pool of threads. Pixels with no background
+   * are not used, and shoeboxes with no pixels have a p-value of 1 and an
+   * expected maximum count of 0.
+   */
+  class BackgroundValidation {
+  public:
+    /**
+     * @param shoeboxes The shoeboxes with their background
+     * @param nthreads The number of threads
+     */
+    BackgroundValidation(const af::const_ref<Shoebox<> > &shoeboxes,
+                         std::size_t nthreads = 1)
+        : num_pixels_(shoeboxes.size(), 0),
+          max_counts_(shoeboxes.size(), 0),
+          mean_background_(shoeboxes.size(), 0),
+          expected_max_counts_(shoeboxes.size(), 0),
+          ks_d_(shoeboxes.size(), 0),
+          ks_p_(shoeboxes.size(), 1) {
+      Job job = {&shoeboxes, this};
+      dials::util::parallel_for(shoeboxes.size(), nthreads, job);
+    }
+
+    /** @returns The number of background pixels in each shoebox */
+    af::shared<std::size_t> num_pixels() const {
+      return num_pixels_;
+    }
+
+    /** @returns The maximum count of the background pixels of each shoebox */
+    af::shared<double> max_counts() const {
+      return max_counts_;
+    }
+
+    /** @returns The mean background of each shoebox */
+    af::shared<double> mean_background() const {
+      return mean_background_;
+    }
+
+    /** @returns The expected maximum count of each shoebox */
+    af::shared<double> expected_max_counts() const {
+      return expected_max_counts_;
+    }
+
+    /** @returns The kolmogorov smirnov D statistic of each shoebox */
+    af::shared<double> ks_d() const {
+      return ks_d_;
+    }
+
+    /** @returns The kolmogorov smirnov p-value of each shoebox */
+    af::shared<double> ks_p() const {
+      return ks_p_;
+    }
+
+    /**
+     * @returns Is the maximum count of each shoebox consistent with poisson
+     * counts about the mean background
+     */
+    af::shared<bool> is_poisson() const {
+      af::shared<bool> result(max_counts_.size());
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = max_counts_[i] <= expected_max_counts_[i];
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Test a range of shoeboxes
+     */
+    struct Job {
+      const af::const_ref<Shoebox<> > *shoeboxes;
+      BackgroundValidation *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        boost::math::normal_distribution<double> normal(0, 1);
+        std::vector<double> residuals;
+        for (std::size_t i = first; i < last; ++i) {
+          const Shoebox<> &sbox = (*shoeboxes)[i];
+          DIALS_ASSERT(sbox.is_consistent());
+          residuals.clear();
+          double max_count = 0;
+          double sum_background = 0;
+          int code = Valid | BackgroundUsed;
+          for (std::size_t j = 0; j < sbox.mask.size(); ++j) {
+            double b = sbox.background[j];
+            if ((sbox.mask[j] & code) == code && b > 0) {
+              double c = sbox.data[j];
+              residuals.push_back((c - b) / std::sqrt(b));
+              max_count = residuals.size() == 1 ? c : std::max(max_count, c);
+              sum_background += b;
+            }
+          }
+          std::size_t n = residuals.size();
+          result->num_pixels_[i] = n;
+          if (n == 0) {
+            continue;
+          }
+          double mean = sum_background / n;
+          result->max_counts_[i] = max_count;
+          result->mean_background_[i] = mean;
+          result->expected_max_counts_[i] = poisson_expected_max_counts(mean, n);
+          std::pair<double, double> ks = kolmogorov_smirnov_test(
+            normal, residuals.begin(), residuals.end(), TwoSided);
+          result->ks_d_[i] = ks.first;
+          result->ks_p_[i] = ks.second;
+        }
+      }
+    };
+
+    friend struct Job;
+
+    af::shared<std::size_t> num_pixels_;
+    af::shared<double> max_counts_;
+    af::shared<double> mean_background_;
+    af::shared<double> expected_max_counts_;
+    af::shared<double> ks_d_;
+    af::shared<double> ks_p_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_BACKGROUND_VALIDATION_H
@@ -0,0 +1,193 @@
+/*
+ * batch_centroid.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_CENTROID_BATCH_CENTROID_H
+#define DIALS_ALGORITHMS_CENTROID_BATCH_CENTROID_H
+
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/algorithms/image/centroid/centroid_moments.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/model/data/shoebox_arena.h>
+#include <dials/model/data/observation.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using model::Centroid;
+  using model::Overlapped;
+  using model::Shoebox;
+  using model::ShoeboxArena;
+  using scitbx::af::int6;
+
+  /**
+   * Compute the centroid of the masked pixels of a shoebox in one pass over
+   * its arrays. This gives the same result as Shoebox::centroid_masked or,
+   * if a background is given, Shoebox::centroid_masked_minus_background.
+   * @param data The shoebox data
+   * @param background The shoebox background or NULL
+   * @param mask The shoebox mask
+   * @param grid The shape of the arrays
+   * @param bbox The bounding box
+   * @param flat Is the shoebox flat
+   * @param code The mask code of the pixels to use
+   * @returns The centroid
+   */
+  template <typename FloatType>
+  Centroid centroid_shoebox_pixels(const FloatType *data,
+                                   const FloatType *background,
+                                   const int *mask,
+                                   af::c_grid<3> grid,
+                                   int6 bbox,
+                                   bool flat,
+                                   int code) {
+    // Accumulate the moments of the selected pixels
+    CentroidMoments3d moments;
+    for (std::size_t k = 0, l = 0; k < grid[0]; ++k) {
+      for (std::size_t j = 0; j < grid[1]; ++j) {
+        for (std::size_t i = 0; i < grid[2]; ++i, ++l) {
+          int m = mask[l];
+          if ((m & code) != code || (m & Overlapped)) {
+            continue;
+          }
+          double value = data[l];
+          if (background != NULL) {
+            value -= background[l];
+            if (!(value > 0)) {
+              continue;
+            }
+          }
+          moments.add(value, vec3<double>(i + 0.5, j + 0.5, k + 0.5));
+        }
+      }
+    }
+
+    // Set the result or, if there are no pixels, the middle of the bbox
+    Centroid result;
+    if (moments.is_valid()) {
+      int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
+      result.px.position = moments.mean() + vec3<double>(bbox[0], bbox[2], zoff);
+      try {
+        result.px.variance = moments.unbiased_variance();
+        result.px.std_err_sq = moments.mean_sq_error();
+      } catch (dials::error const &) {
+        result.px.variance = vec3<double>(0.0, 0.0, 0.0);
+        result.px.std_err_sq = vec3<double>(1.0 / 12.0, 1.0 / 12.0, 1.0 / 12.0);
+      }
+      if (background == NULL && bbox[5] == bbox[4] + 1) {
+        result.px.position[2] = bbox[4] + 0.5;
+      }
+    } else {
+      result.px.position = vec3<double>((bbox[1] + bbox[0]) / 2.0,
+                                        (bbox[3] + bbox[2]) / 2.0,
+                                        (bbox[5] + bbox[4]) / 2.0);
+    }
+    return result;
+  }
+
+  namespace detail {
+
+    template <typename FloatType>
+    struct BatchCentroidShoeboxJob {
+      const af::const_ref<Shoebox<FloatType> > *shoeboxes;
+      int code;
+      bool minus_background;
+      Centroid *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          const Shoebox<FloatType> &s = (*shoeboxes)[i];
+          DIALS_ASSERT(s.data.size() == s.mask.size());
+          const FloatType *background = NULL;
+          if (minus_background) {
+            DIALS_ASSERT(s.data.size() == s.background.size());
+            background = s.background.begin();
+          }
+          result[i] = centroid_shoebox_pixels(s.data.begin(),
+                                              background,
+                                              s.mask.begin(),
+                                              s.data.accessor(),
+                                              s.bbox,
+                                              s.flat,
+                                              code);
+        }
+      }
+    };
+
+    template <typename FloatType>
+    struct BatchCentroidArenaJob {
+      const ShoeboxArena<FloatType> *arena;
+      int code;
+      bool minus_background;
+      Centroid *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        af::shared<int6> bbox = arena->bounding_boxes();
+        af::shared<bool> flat = arena->flat();
+        for (std::size_t i = first; i < last; ++i) {
+          const FloatType *background =
+            minus_background ? arena->background(i).begin() : NULL;
+          result[i] = centroid_shoebox_pixels(arena->data(i).begin(),
+                                              background,
+                                              arena->mask(i).begin(),
+                                              arena->accessor(i),
+                                              bbox[i],
+                                              flat[i],
+                                              code);
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the centroids of an array of shoeboxes, splitting the shoeboxes
+   * between threads.
+   * @param shoeboxes The shoeboxes
+   * @param code The mask code of the pixels to use
+   * @param minus_background Subtract the background from the pixels
+   * @param nthreads The number of threads
+   * @returns The centroids
+   */
+  template <typename FloatType>
+  af::shared<Centroid> batch_centroid(
+    const af::const_ref<Shoebox<FloatType> > &shoeboxes,
+    int code,
+    bool minus_background,
+    std::size_t nthreads = 1) {
+    af::shared<Centroid> result(shoeboxes.size());
+    detail::BatchCentroidShoeboxJob<FloatType> job = {
+      &shoeboxes, code, minus_background, result.begin()};
+    dials::util::parallel_for(shoeboxes.size(), nthreads, job);
+    return result;
+  }
+
+  /**
+   * Compute the centroids of the shoeboxes in an arena, splitting the
+   * shoeboxes between threads.
+   * @param arena The shoebox arena
+   * @param code The mask code of the pixels to use
+   * @param minus_background Subtract the background from the pixels
+   * @param nthreads The number of threads
+   * @returns The centroids
+   */
+  template <typename FloatType>
+  af::shared<Centroid> batch_centroid(const ShoeboxArena<FloatType> &arena,
+                                      int code,
+                                      bool minus_background,
+                                      std::size_t nthreads = 1) {
+    af::shared<Centroid> result(arena.size());
+    detail::BatchCentroidArenaJob<FloatType> job = {
+      &arena, code, minus_background, result.begin()};
+    dials::util::parallel_for(arena.size(), nthreads, job);
+    return result;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_CENTROID_BATCH_CENTROID_H
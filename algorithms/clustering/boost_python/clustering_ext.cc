@@ -0,0 +1,31 @@
+/*
+ * clustering_ext.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/clustering/unit_cell_clustering.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  BOOST_PYTHON_MODULE(dials_algorithms_clustering_ext) {
+    class_<IncrementalUnitCellClustering>("IncrementalUnitCellClustering", no_init)
+      .def(init<double, bool, std::size_t>(
+        (arg("threshold"), arg("euclidean") = false, arg("nthreads") = 1)))
+      .def("add", &IncrementalUnitCellClustering::add, (arg("g6")))
+      .def("threshold", &IncrementalUnitCellClustering::threshold)
+      .def("size", &IncrementalUnitCellClustering::size)
+      .def("__len__", &IncrementalUnitCellClustering::size)
+      .def("num_leaders", &IncrementalUnitCellClustering::num_leaders)
+      .def("num_distances", &IncrementalUnitCellClustering::num_distances)
+      .def("num_clusters", &IncrementalUnitCellClustering::num_clusters)
+      .def("cluster_ids", &IncrementalUnitCellClustering::cluster_ids);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
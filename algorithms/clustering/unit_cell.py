@@ -3,6 +3,9 @@
 # modified version of the ab_cluster function so we can access the scipy dendrogram object
 from xfel.clustering.cluster import Cluster
 
+from dials.array_family import flex
+from dials_algorithms_clustering_ext import IncrementalUnitCellClustering
+
 logger = logging.getLogger(__name__)
 
 
@@ -150,3 +153,52 @@ def ab_cluster(
                 plt.show()
 
         return sub_clusters, dendrogram, ax
+
+    def incremental_cluster(self, threshold=10000, schnell=False, nproc=1):
+        """
+        Single linkage clustering using the unit cell dimensions, without
+        computing all the pairwise distances.
+
+        The clusters are the same as those from ab_cluster with
+        linkage_method="single" and method="distance", but no dendrogram is made.
+        The unit cells are added to an IncrementalUnitCellClustering, to which
+        more unit cells can be added later as they arrive.
+
+        :param threshold: the distance threshold between clusters.
+        :param schnell: if True, use simple euclidean distance, otherwise, use
+                        Andrews-Bernstein distance on the Niggli cells.
+        :param nproc: the number of threads used to compute the distances.
+        :return: A list of Clusters ordered by smallest Cluster to largest, and
+                 the IncrementalUnitCellClustering
+        """
+        from xfel.clustering.singleframe import SingleFrame
+
+        logger.info("Incremental single linkage clustering of unit cells")
+        g6_cells = flex.double(
+            [x for image in self.members for x in SingleFrame.make_g6(image.uc)]
+        )
+        g6_cells.reshape(flex.grid(len(self.members), 6))
+        clustering = IncrementalUnitCellClustering(
+            threshold, euclidean=schnell, nthreads=nproc
+        )
+        clustering.add(g6_cells)
+        logger.debug(
+            "%d distances were calculated for %d unit cells",
+            clustering.num_distances(),
+            len(clustering),
+        )
+        members = [[] for _ in range(clustering.num_clusters())]
+        for image, cluster in zip(self.members, clustering.cluster_ids()):
+            members[cluster].append(image)
+
+        info_string = f"Made using incremental_cluster with t={threshold}"
+        sub_clusters = [
+            self.make_sub_cluster(m, f"cluster_{cluster + 1}", info_string)
+            for cluster, m in enumerate(members)
+        ]
+
+        sub_clusters = sorted(sub_clusters, key=lambda x: len(x.members))
+        # Rename to order by size
+        for num, cluster in enumerate(sub_clusters):
+            cluster.cname = f"cluster_{num + 1}"
+        return sub_clusters, clustering
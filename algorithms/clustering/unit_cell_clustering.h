@@ -0,0 +1,399 @@
+/*
+ * unit_cell_clustering.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_CLUSTERING_H
+#define DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_CLUSTERING_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <scitbx/array_family/tiny_types.h>
+#include <cctbx/uctbx/determine_unit_cell/NCDist.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * Single linkage clustering of unit cells which can be extended as more
+   * lattices arrive. The clusters are the same as those found by cutting a
+   * single linkage dendrogram of the G6 distances at the threshold, i.e. two
+   * lattices are in the same cluster if they are joined by a chain of
+   * lattices each within the threshold distance of the next.
+   *
+   * Rather than computing the full matrix of distances, the lattices are held
+   * in a two level metric tree. Each lattice is either a leader, or is a
+   * member of the group of the nearest leader within half the threshold, so
+   * all the lattices of a group are in the same cluster. A new lattice is
+   * compared with every leader, and only with the members of the groups of
+   * other clusters whose distance from their leader could be within the
+   * threshold of the new lattice. The pruning relies on the triangle
+   * inequality, which the Andrews-Bernstein distance is designed to satisfy.
+   *
+   * The lattices are added in chunks, and the distances for the lattices of
+   * a chunk are evaluated on a pool of threads before the chunk is added to
+   * the tree.
+   */
+  class IncrementalUnitCellClustering {
+  public:
+    typedef scitbx::af::tiny<double, 6> g6_type;
+
+    enum { chunk_size = 256, min_chunk_size = 16, max_leader_distances = 1 << 22 };
+
+    /**
+     * @param threshold The distance threshold of the clusters
+     * @param euclidean Use the Euclidean distance rather than the
+     *        Andrews-Bernstein distance between the G6 vectors
+     * @param nthreads The number of threads
+     */
+    IncrementalUnitCellClustering(double threshold,
+                                  bool euclidean = false,
+                                  std::size_t nthreads = 1)
+        : threshold_(threshold),
+          radius_(threshold / 2),
+          euclidean_(euclidean),
+          nthreads_(nthreads),
+          num_distances_(0) {
+      DIALS_ASSERT(threshold >= 0);
+      DIALS_ASSERT(nthreads > 0);
+      // Evaluate a distance on this thread so that anything the distance
+      // function initialises on first use is set up before using the threads
+      g6_type a(1, 1, 1, 0, 0, 0);
+      distance(a, a);
+    }
+
+    /**
+     * Add lattices and cluster them with the lattices already added
+     * @param g6 The G6 vectors of the lattices, one per row
+     */
+    void add(const af::const_ref<double, af::c_grid<2> > &g6) {
+      DIALS_ASSERT(g6.accessor()[1] == 6);
+      std::size_t num = g6.accessor()[0];
+      for (std::size_t first = 0; first < num;) {
+        // Limit the memory used to keep the distances to the leaders
+        std::size_t size = chunk_size;
+        if (!leaders_.empty()) {
+          size = std::min(size, max_leader_distances / leaders_.size());
+          size = std::max(size, (std::size_t)min_chunk_size);
+        }
+        std::size_t last = std::min(num, first + size);
+        std::vector<g6_type> chunk;
+        for (std::size_t i = first; i < last; ++i) {
+          g6_type v;
+          for (std::size_t j = 0; j < 6; ++j) {
+            v[j] = g6(i, j);
+          }
+          chunk.push_back(v);
+        }
+        add_chunk(chunk);
+        first = last;
+      }
+    }
+
+    /** @returns The distance threshold */
+    double threshold() const {
+      return threshold_;
+    }
+
+    /** @returns The number of lattices */
+    std::size_t size() const {
+      return cells_.size();
+    }
+
+    /** @returns The number of leaders in the tree */
+    std::size_t num_leaders() const {
+      return leaders_.size();
+    }
+
+    /** @returns The number of distances evaluated so far */
+    std::size_t num_distances() const {
+      return num_distances_;
+    }
+
+    /** @returns The number of clusters */
+    std::size_t num_clusters() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        if (parent_[i] == i) {
+          result++;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @returns The cluster of each lattice, numbered in order of the first
+     *          lattice of each cluster
+     */
+    af::shared<std::size_t> cluster_ids() const {
+      std::size_t none = parent_.size();
+      std::vector<std::size_t> label(parent_.size(), none);
+      af::shared<std::size_t> result(parent_.size());
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        std::size_t root = find(i);
+        if (label[root] == none) {
+          label[root] = n++;
+        }
+        result[i] = label[root];
+      }
+      return result;
+    }
+
+    /**
+     * @param a A G6 vector
+     * @param b A G6 vector
+     * @returns The distance between the vectors
+     */
+    double distance(const g6_type &a, const g6_type &b) const {
+      if (euclidean_) {
+        double sum = 0;
+        for (std::size_t j = 0; j < 6; ++j) {
+          sum += (a[j] - b[j]) * (a[j] - b[j]);
+        }
+        return std::sqrt(sum);
+      }
+      double ga[6], gb[6];
+      std::copy(a.begin(), a.end(), ga);
+      std::copy(b.begin(), b.end(), gb);
+      return NCDist(ga, gb);
+    }
+
+  private:
+    /**
+     * The result of comparing a new lattice with the tree
+     */
+    struct Query {
+      std::vector<std::size_t> roots;
+      std::vector<double> leader_distances;
+      std::size_t nearest;
+      std::size_t leader;
+      double leader_distance;
+      std::size_t num_distances;
+
+      Query() : nearest(0), leader(0), leader_distance(-1), num_distances(0) {}
+
+      bool connected(std::size_t root) const {
+        return std::find(roots.begin(), roots.end(), root) != roots.end();
+      }
+    };
+
+    /**
+     * Compare the new lattices of a chunk with the tree
+     */
+    struct QueryJob {
+      const IncrementalUnitCellClustering *self;
+      const std::vector<g6_type> *chunk;
+      std::vector<Query> *queries;
+
+      QueryJob(const IncrementalUnitCellClustering *self_,
+               const std::vector<g6_type> *chunk_,
+               std::vector<Query> *queries_)
+          : self(self_), chunk(chunk_), queries(queries_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          self->query((*chunk)[i], (*queries)[i]);
+        }
+      }
+    };
+
+    /**
+     * Compute the distances between the new lattices of a chunk which are
+     * needed to add them to the tree. The distance between two lattices is
+     * not needed if they are already joined through the tree, unless the
+     * later lattice has no leader and may have to join the group of the
+     * earlier one. Nor is it needed if their distances from the leader
+     * nearest to either of them show that they are further apart than the
+     * threshold.
+     */
+    struct ChunkJob {
+      const IncrementalUnitCellClustering *self;
+      const std::vector<g6_type> *chunk;
+      const std::vector<Query> *queries;
+      std::vector<double> *distances;
+
+      ChunkJob(const IncrementalUnitCellClustering *self_,
+               const std::vector<g6_type> *chunk_,
+               const std::vector<Query> *queries_,
+               std::vector<double> *distances_)
+          : self(self_), chunk(chunk_), queries(queries_), distances(distances_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t n = chunk->size();
+        for (std::size_t i = first; i < last; ++i) {
+          const Query &qi = (*queries)[i];
+          for (std::size_t j = 0; j < i; ++j) {
+            const Query &qj = (*queries)[j];
+            bool joined = false;
+            for (std::size_t k = 0; k < qi.roots.size() && !joined; ++k) {
+              joined = qj.connected(qi.roots[k]);
+            }
+            if (joined && qi.leader_distance >= 0) {
+              continue;
+            }
+            if (!qi.leader_distances.empty()) {
+              double lower = std::max(
+                std::abs(qi.leader_distances[qi.nearest]
+                         - qj.leader_distances[qi.nearest]),
+                std::abs(qi.leader_distances[qj.nearest]
+                         - qj.leader_distances[qj.nearest]));
+              if (lower > self->threshold_) {
+                continue;
+              }
+            }
+            (*distances)[i * n + j] = self->distance((*chunk)[i], (*chunk)[j]);
+          }
+        }
+      }
+    };
+
+    std::size_t find(std::size_t i) const {
+      while (parent_[i] != i) {
+        i = parent_[i];
+      }
+      return i;
+    }
+
+    void join(std::size_t a, std::size_t b) {
+      a = find(a);
+      b = find(b);
+      if (a != b) {
+        parent_[std::max(a, b)] = std::min(a, b);
+      }
+    }
+
+    /**
+     * Find the clusters within the threshold of a new lattice, and the
+     * nearest leader within the group radius.
+     */
+    void query(const g6_type &cell, Query &result) const {
+      result.leader_distances.resize(leaders_.size());
+      for (std::size_t g = 0; g < leaders_.size(); ++g) {
+        double d = distance(cell, cells_[leaders_[g]]);
+        result.leader_distances[g] = d;
+        result.num_distances++;
+        if (d < result.leader_distances[result.nearest]) {
+          result.nearest = g;
+        }
+        bool nearer = result.leader_distance < 0 || d < result.leader_distance;
+        if (d <= radius_ && nearer) {
+          result.leader = g;
+          result.leader_distance = d;
+        }
+        std::size_t root = find(leaders_[g]);
+        if (result.connected(root) || d > radius_ + threshold_) {
+          continue;
+        }
+        if (d <= threshold_) {
+          result.roots.push_back(root);
+          continue;
+        }
+        const std::vector<std::pair<double, std::size_t> > &group = groups_[g];
+        std::vector<std::pair<double, std::size_t> >::const_iterator it =
+          std::lower_bound(
+            group.begin(), group.end(), std::make_pair(d - threshold_, std::size_t(0)));
+        for (; it != group.end() && it->first <= d + threshold_; ++it) {
+          result.num_distances++;
+          if (distance(cell, cells_[it->second]) <= threshold_) {
+            result.roots.push_back(root);
+            break;
+          }
+        }
+      }
+    }
+
+    void add_chunk(const std::vector<g6_type> &chunk) {
+      std::size_t n = chunk.size();
+      std::vector<Query> queries(n);
+      dials::util::parallel_for(n, nthreads_, QueryJob(this, &chunk, &queries));
+      std::vector<double> distances(n * n, -1);
+      dials::util::parallel_for(
+        n, nthreads_, ChunkJob(this, &chunk, &queries, &distances));
+
+      // Add the lattices to the tree
+      std::size_t offset = cells_.size();
+      std::vector<std::size_t> touched;
+      for (std::size_t i = 0; i < n; ++i) {
+        const Query &q = queries[i];
+        std::size_t index = offset + i;
+        cells_.push_back(chunk[i]);
+        parent_.push_back(index);
+        num_distances_ += q.num_distances;
+        for (std::size_t k = 0; k < q.roots.size(); ++k) {
+          join(index, q.roots[k]);
+        }
+        std::size_t leader = q.leader;
+        double leader_distance = q.leader_distance;
+        for (std::size_t j = 0; j < i; ++j) {
+          double d = distances[i * n + j];
+          if (d < 0) {
+            continue;
+          }
+          num_distances_++;
+          if (d <= threshold_) {
+            join(index, offset + j);
+          }
+          // Without an existing leader, join the nearest new leader
+          if (q.leader_distance < 0 && d <= radius_ && is_leader(offset + j)
+              && (leader_distance < 0 || d < leader_distance)) {
+            leader = leader_of_[offset + j];
+            leader_distance = d;
+          }
+        }
+        if (leader_distance < 0) {
+          leader = leaders_.size();
+          leader_distance = 0;
+          leaders_.push_back(index);
+          groups_.push_back(std::vector<std::pair<double, std::size_t> >());
+        }
+        leader_of_.push_back(leader);
+        groups_[leader].push_back(std::make_pair(leader_distance, index));
+        touched.push_back(leader);
+      }
+
+      // Keep the members of each group sorted by distance from the leader
+      std::sort(touched.begin(), touched.end());
+      touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+      for (std::size_t k = 0; k < touched.size(); ++k) {
+        std::vector<std::pair<double, std::size_t> > &group = groups_[touched[k]];
+        std::size_t old = group.size();
+        while (old > 0 && group[old - 1].second >= offset) {
+          old--;
+        }
+        std::sort(group.begin() + old, group.end());
+        std::inplace_merge(group.begin(), group.begin() + old, group.end());
+      }
+
+      // Point every lattice straight at its root for the next chunk
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        parent_[i] = find(i);
+      }
+    }
+
+    bool is_leader(std::size_t index) const {
+      return leaders_[leader_of_[index]] == index;
+    }
+
+    double threshold_;
+    double radius_;
+    bool euclidean_;
+    std::size_t nthreads_;
+    std::size_t num_distances_;
+    std::vector<g6_type> cells_;
+    std::vector<std::size_t> parent_;
+    std::vector<std::size_t> leader_of_;
+    std::vector<std::size_t> leaders_;
+    std::vector<std::vector<std::pair<double, std::size_t> > > groups_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_CLUSTERING_H
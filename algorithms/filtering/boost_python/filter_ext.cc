@@ -77,11 +77,77 @@ namespace dials { namespace algorithms { namespace filter { namespace boost_pyth
   }
 
   void export_filter_list() {
-    def("by_zeta", &by_zeta, (arg("g"), arg("b"), arg("r"), arg("min_zeta")));
+    typedef af::const_ref<vec3<double> > vec3_ref;
+    typedef af::const_ref<int> int_ref;
+
+    def("by_zeta",
+        (af::shared<bool>(*)(
+          const Goniometer &, const BeamBase &, const vec3_ref &, double, std::size_t))
+          & by_zeta,
+        (arg("g"), arg("b"), arg("r"), arg("min_zeta"), arg("nthreads") = 1));
+    def("by_zeta",
+        (af::shared<bool>(*)(const vec3_ref &,
+                             const vec3_ref &,
+                             const int_ref &,
+                             const vec3_ref &,
+                             double,
+                             std::size_t))
+          & by_zeta,
+        (arg("m2"),
+         arg("s0"),
+         arg("id"),
+         arg("s1"),
+         arg("min_zeta"),
+         arg("nthreads") = 1));
+    def("by_xds_small_angle",
+        (af::shared<bool>(*)(
+          const Goniometer &, const BeamBase &, const vec3_ref, double, std::size_t))
+          & by_xds_small_angle,
+        (arg("g"), arg("b"), arg("r"), arg("delta_m"), arg("nthreads") = 1));
+    def("by_xds_small_angle",
+        (af::shared<bool>(*)(const vec3_ref &,
+                             const vec3_ref &,
+                             const int_ref &,
+                             const vec3_ref &,
+                             double,
+                             std::size_t))
+          & by_xds_small_angle,
+        (arg("m2"),
+         arg("s0"),
+         arg("id"),
+         arg("s1"),
+         arg("delta_m"),
+         arg("nthreads") = 1));
+    def("by_xds_angle",
+        (af::shared<bool>(*)(
+          const Goniometer &, const BeamBase &, const vec3_ref, double, std::size_t))
+          & by_xds_angle,
+        (arg("g"), arg("b"), arg("r"), arg("delta_m"), arg("nthreads") = 1));
+    def("by_xds_angle",
+        (af::shared<bool>(*)(const vec3_ref &,
+                             const vec3_ref &,
+                             const int_ref &,
+                             const vec3_ref &,
+                             double,
+                             std::size_t))
+          & by_xds_angle,
+        (arg("m2"),
+         arg("s0"),
+         arg("id"),
+         arg("s1"),
+         arg("delta_m"),
+         arg("nthreads") = 1));
+    def("by_zeta",
+        (af::shared<bool>(*)(const CoordinateSystemBatch &, double)) & by_zeta,
+        (arg("cs"), arg("min_zeta")));
     def("by_xds_small_angle",
-        &by_xds_small_angle,
-        (arg("g"), arg("b"), arg("r"), arg("delta_m")));
-    def("by_xds_angle", &by_xds_angle, (arg("g"), arg("b"), arg("r"), arg("delta_m")));
+        (af::shared<bool>(*)(const CoordinateSystemBatch &, double, std::size_t))
+          & by_xds_small_angle,
+        (arg("cs"), arg("delta_m"), arg("nthreads") = 1));
+    def("by_xds_angle",
+        (af::shared<bool>(*)(const CoordinateSystemBatch &, double, std::size_t))
+          & by_xds_angle,
+        (arg("cs"), arg("delta_m"), arg("nthreads") = 1));
     def(
       "by_bbox_volume",
       (af::shared<bool>(*)(const af::const_ref<int6> &, std::size_t)) & by_bbox_volume,
@@ -23,10 +23,12 @@
 #include <dials/model/data/shoebox.h>
 #include <dials/algorithms/image/threshold/unimodal.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace algorithms { namespace filter {
 
   using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
+  using dials::algorithms::profile_model::gaussian_rs::CoordinateSystemBatch;
   using dials::algorithms::profile_model::gaussian_rs::zeta_factor;
   using dials::model::Foreground;
   using dials::model::Shoebox;
@@ -235,6 +237,295 @@ namespace dials { namespace algorithms { namespace filter {
     return is_xds_angle_valid(g.get_rotation_axis(), b.get_s0(), s1, delta_m);
   }
 
+  namespace detail {
+
+    /**
+     * The vectors needed by the filters, with the rotation axis and beam
+     * vector of each experiment and the experiment index of each reflection
+     * as flat arrays. With no experiment indices every reflection uses the
+     * first experiment.
+     */
+    struct FilterVectors {
+      const vec3<double> *m2;
+      const vec3<double> *s0;
+      const int *id;
+      std::size_t num_experiments;
+      const vec3<double> *s1;
+
+      FilterVectors(const af::const_ref<vec3<double> > &m2_,
+                    const af::const_ref<vec3<double> > &s0_,
+                    const af::const_ref<int> &id_,
+                    const af::const_ref<vec3<double> > &s1_)
+          : m2(m2_.begin()),
+            s0(s0_.begin()),
+            id(id_.size() > 0 ? id_.begin() : NULL),
+            num_experiments(m2_.size()),
+            s1(s1_.begin()) {
+        DIALS_ASSERT(m2_.size() > 0);
+        DIALS_ASSERT(m2_.size() == s0_.size());
+        DIALS_ASSERT(id_.size() == 0 || id_.size() == s1_.size());
+      }
+
+      std::size_t experiment(std::size_t i) const {
+        if (id == NULL) {
+          return 0;
+        }
+        DIALS_ASSERT(id[i] >= 0 && (std::size_t)id[i] < num_experiments);
+        return id[i];
+      }
+
+      void terms(std::size_t i, double &m2e1, double &m2e3, double &m2ps) const;
+    };
+
+    /**
+     * The axes needed by the filters, read from the coordinate systems of the
+     * reflections rather than computed again
+     */
+    struct CoordinateSystemVectors {
+      af::shared<vec3<double> > m2;
+      af::shared<vec3<double> > e1;
+      af::shared<vec3<double> > e3;
+      af::shared<vec3<double> > s0;
+      af::shared<vec3<double> > s1;
+
+      CoordinateSystemVectors(const CoordinateSystemBatch &cs)
+          : m2(cs.m2()),
+            e1(cs.e1_axis()),
+            e3(cs.e3_axis()),
+            s0(cs.s0()),
+            s1(cs.s1()) {}
+
+      void terms(std::size_t i, double &m2e1, double &m2e3, double &m2ps) const {
+        m2e1 = m2[i] * e1[i];
+        m2e3 = m2[i] * e3[i];
+        m2ps = m2[i] * (s1[i] - s0[i]).normalize();
+      }
+    };
+
+    /**
+     * Check |zeta| >= min_zeta, comparing the squares so that the axis
+     * (s1 x s0) need not be normalized.
+     */
+    struct ZetaFilterJob {
+      FilterVectors v;
+      double min_zeta_sq;
+      bool *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t j = v.experiment(i);
+          vec3<double> e1 = v.s1[i].cross(v.s0[j]);
+          double e1_sq = e1.length_sq();
+          DIALS_ASSERT(e1_sq > 0);
+          double m2e1 = v.m2[j] * e1;
+          result[i] = m2e1 * m2e1 >= min_zeta_sq * e1_sq;
+        }
+      }
+    };
+
+    /**
+     * Compute m2.e1, m2.e3 and m2.p* for a reflection
+     */
+    inline void xds_angle_terms(const vec3<double> &m2,
+                                const vec3<double> &s0,
+                                const vec3<double> &s1,
+                                double &m2e1,
+                                double &m2e3,
+                                double &m2ps) {
+      vec3<double> e1 = s1.cross(s0);
+      m2e1 = (m2 * e1) / e1.length();
+      m2e3 = (m2 * (s1 + s0)) / (s1 + s0).length();
+      m2ps = (m2 * (s1 - s0)) / (s1 - s0).length();
+    }
+
+    inline void FilterVectors::terms(std::size_t i,
+                                     double &m2e1,
+                                     double &m2e3,
+                                     double &m2ps) const {
+      std::size_t j = experiment(i);
+      xds_angle_terms(m2[j], s0[j], s1[i], m2e1, m2e3, m2ps);
+    }
+
+    /**
+     * Check the XDS small angle approximation
+     */
+    template <typename Vectors>
+    struct XdsSmallAngleFilterJob {
+      Vectors v;
+      double c3;
+      bool *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          double m2e1, m2e3, m2ps;
+          v.terms(i, m2e1, m2e3, m2ps);
+          result[i] = (m2e1 * m2e1 + 2.0 * c3 * m2e3 * m2ps - c3 * c3) >= 0.0;
+        }
+      }
+    };
+
+    /**
+     * Check the XDS angle. The angles 2 atan(t) are only compared with
+     * +/- delta_m, so the roots t are compared with tan(delta_m / 2) instead,
+     * which gives the same result for delta_m < pi without evaluating any
+     * arc tangents. For larger delta_m no angle is valid.
+     */
+    template <typename Vectors>
+    struct XdsAngleFilterJob {
+      Vectors v;
+      double delta_m;
+      bool *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const double pi = 3.14159265358979323846;
+        double tan_half = delta_m < pi ? std::tan(delta_m / 2.0) : 0.0;
+        for (std::size_t i = first; i < last; ++i) {
+          double m2e1, m2e3, m2ps;
+          v.terms(i, m2e1, m2e3, m2ps);
+          double m2e3_m2ps = m2e3 * m2ps;
+          if (m2e1 == 0 || delta_m >= pi) {
+            result[i] = false;
+            continue;
+          }
+          double rt = std::sqrt(m2e1 * m2e1 + m2e3_m2ps * m2e3_m2ps);
+          double t0 = (m2e3_m2ps + rt) / m2e1;
+          double t1 = (m2e3_m2ps - rt) / m2e1;
+          if (t0 > t1) {
+            std::swap(t0, t1);
+          }
+          result[i] = t0 <= -tan_half && t1 >= tan_half;
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Filter the reflections by the value of zeta. The reflections are split
+   * between threads.
+   * @param m2 The rotation axis of each experiment
+   * @param s0 The beam vector of each experiment
+   * @param id The experiment of each reflection (empty for all the first)
+   * @param s1 The diffracted beam vectors
+   * @param min_zeta The minimum zeta value
+   * @param nthreads The number of threads
+   * @returns True/False zeta is valid
+   */
+  inline af::shared<bool> by_zeta(const af::const_ref<vec3<double> > &m2,
+                                  const af::const_ref<vec3<double> > &s0,
+                                  const af::const_ref<int> &id,
+                                  const af::const_ref<vec3<double> > &s1,
+                                  double min_zeta,
+                                  std::size_t nthreads = 1) {
+    af::shared<bool> result(s1.size(), true);
+    detail::ZetaFilterJob job = {
+      detail::FilterVectors(m2, s0, id, s1), min_zeta * min_zeta, result.begin()};
+    if (min_zeta > 0) {
+      dials::util::parallel_for(s1.size(), nthreads, job);
+    }
+    return result;
+  }
+
+  /**
+   * Filter the reflections by the validity of the xds small angle approx.
+   * The reflections are split between threads.
+   * @param m2 The rotation axis of each experiment
+   * @param s0 The beam vector of each experiment
+   * @param id The experiment of each reflection (empty for all the first)
+   * @param s1 The diffracted beam vectors
+   * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
+   * @returns True/False the approximation is valid
+   */
+  inline af::shared<bool> by_xds_small_angle(const af::const_ref<vec3<double> > &m2,
+                                             const af::const_ref<vec3<double> > &s0,
+                                             const af::const_ref<int> &id,
+                                             const af::const_ref<vec3<double> > &s1,
+                                             double delta_m,
+                                             std::size_t nthreads = 1) {
+    af::shared<bool> result(s1.size(), true);
+    detail::XdsSmallAngleFilterJob<detail::FilterVectors> job = {
+      detail::FilterVectors(m2, s0, id, s1), -std::abs(delta_m), result.begin()};
+    dials::util::parallel_for(s1.size(), nthreads, job);
+    return result;
+  }
+
+  /**
+   * Filter the reflections by the validity of the xds angle. The reflections
+   * are split between threads.
+   * @param m2 The rotation axis of each experiment
+   * @param s0 The beam vector of each experiment
+   * @param id The experiment of each reflection (empty for all the first)
+   * @param s1 The diffracted beam vectors
+   * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
+   * @returns True/False the angle is valid
+   */
+  inline af::shared<bool> by_xds_angle(const af::const_ref<vec3<double> > &m2,
+                                       const af::const_ref<vec3<double> > &s0,
+                                       const af::const_ref<int> &id,
+                                       const af::const_ref<vec3<double> > &s1,
+                                       double delta_m,
+                                       std::size_t nthreads = 1) {
+    af::shared<bool> result(s1.size(), true);
+    detail::XdsAngleFilterJob<detail::FilterVectors> job = {
+      detail::FilterVectors(m2, s0, id, s1), std::abs(delta_m), result.begin()};
+    dials::util::parallel_for(s1.size(), nthreads, job);
+    return result;
+  }
+
+  /**
+   * Filter the reflections by the value of zeta from their coordinate
+   * systems
+   * @param cs The coordinate systems of the reflections
+   * @param min_zeta The minimum zeta value
+   * @returns True/False zeta is valid
+   */
+  inline af::shared<bool> by_zeta(const CoordinateSystemBatch &cs, double min_zeta) {
+    af::shared<double> zeta = cs.zeta();
+    af::shared<bool> result(zeta.size(), true);
+    for (std::size_t i = 0; i < zeta.size(); ++i) {
+      result[i] = std::abs(zeta[i]) >= min_zeta;
+    }
+    return result;
+  }
+
+  /**
+   * Filter the reflections by the validity of the xds small angle approx.
+   * from their coordinate systems
+   * @param cs The coordinate systems of the reflections
+   * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
+   * @returns True/False the approximation is valid
+   */
+  inline af::shared<bool> by_xds_small_angle(const CoordinateSystemBatch &cs,
+                                             double delta_m,
+                                             std::size_t nthreads = 1) {
+    af::shared<bool> result(cs.size(), true);
+    detail::XdsSmallAngleFilterJob<detail::CoordinateSystemVectors> job = {
+      detail::CoordinateSystemVectors(cs), -std::abs(delta_m), result.begin()};
+    dials::util::parallel_for(cs.size(), nthreads, job);
+    return result;
+  }
+
+  /**
+   * Filter the reflections by the validity of the xds angle from their
+   * coordinate systems
+   * @param cs The coordinate systems of the reflections
+   * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
+   * @returns True/False the angle is valid
+   */
+  inline af::shared<bool> by_xds_angle(const CoordinateSystemBatch &cs,
+                                       double delta_m,
+                                       std::size_t nthreads = 1) {
+    af::shared<bool> result(cs.size(), true);
+    detail::XdsAngleFilterJob<detail::CoordinateSystemVectors> job = {
+      detail::CoordinateSystemVectors(cs), std::abs(delta_m), result.begin()};
+    dials::util::parallel_for(cs.size(), nthreads, job);
+    return result;
+  }
+
   /**
    * Filter the reflection list by the value of zeta. Set any reflections
    * below the value to invalid.
@@ -242,18 +533,21 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vectors
    * @param min_zeta The minimum zeta value
+   * @param nthreads The number of threads
    */
   inline af::shared<bool> by_zeta(const Goniometer &g,
                                   const BeamBase &b,
                                   const af::const_ref<vec3<double> > &s1,
-                                  double min_zeta) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_zeta_valid(g, b, s1[i], min_zeta)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                  double min_zeta,
+                                  std::size_t nthreads = 1) {
+    vec3<double> m2 = g.get_rotation_axis();
+    vec3<double> s0 = b.get_s0();
+    return by_zeta(af::const_ref<vec3<double> >(&m2, 1),
+                   af::const_ref<vec3<double> >(&s0, 1),
+                   af::const_ref<int>(NULL, 0),
+                   s1,
+                   min_zeta,
+                   nthreads);
   }
 
   /**
@@ -263,18 +557,21 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vector
    * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
    */
   inline af::shared<bool> by_xds_small_angle(const Goniometer &g,
                                              const BeamBase &b,
                                              const af::const_ref<vec3<double> > s1,
-                                             double delta_m) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_xds_small_angle_valid(g, b, s1[i], delta_m)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                             double delta_m,
+                                             std::size_t nthreads = 1) {
+    vec3<double> m2 = g.get_rotation_axis();
+    vec3<double> s0 = b.get_s0();
+    return by_xds_small_angle(af::const_ref<vec3<double> >(&m2, 1),
+                              af::const_ref<vec3<double> >(&s0, 1),
+                              af::const_ref<int>(NULL, 0),
+                              s1,
+                              delta_m,
+                              nthreads);
   }
 
   /**
@@ -284,18 +581,21 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vectors
    * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads
    */
   inline af::shared<bool> by_xds_angle(const Goniometer &g,
                                        const BeamBase &b,
                                        const af::const_ref<vec3<double> > s1,
-                                       double delta_m) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_xds_angle_valid(g, b, s1[i], delta_m)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                       double delta_m,
+                                       std::size_t nthreads = 1) {
+    vec3<double> m2 = g.get_rotation_axis();
+    vec3<double> s0 = b.get_s0();
+    return by_xds_angle(af::const_ref<vec3<double> >(&m2, 1),
+                        af::const_ref<vec3<double> >(&s0, 1),
+                        af::const_ref<int>(NULL, 0),
+                        s1,
+                        delta_m,
+                        nthreads);
   }
 
   /**
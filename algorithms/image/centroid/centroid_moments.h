@@ -0,0 +1,123 @@
+/*
+ * centroid_moments.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_CENTROID_CENTROID_MOMENTS_H
+#define DIALS_ALGORITHMS_IMAGE_CENTROID_CENTROID_MOMENTS_H
+
+#include <cmath>
+#include <scitbx/vec3.h>
+#include <dials/algorithms/statistics/compensated_sum.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::vec3;
+
+  /**
+   * Accumulate the weighted first and second moments of a set of 3D points
+   * in a single pass. This gives the same quantities as CentroidPoints
+   * without first copying the pixels and coordinates into arrays. The sums
+   * are compensated and the coordinates should be relative to a nearby
+   * origin (e.g. the corner of a shoebox), so that the second moments about
+   * the mean computed from the raw moments do not lose precision.
+   */
+  class CentroidMoments3d {
+  public:
+    CentroidMoments3d() : count_(0) {}
+
+    /**
+     * Add a point
+     * @param w The weight (the pixel value)
+     * @param x The point
+     */
+    void add(double w, const vec3<double> &x) {
+      count_++;
+      sum_w_.add(w);
+      sum_w_sq_.add(w * w);
+      for (std::size_t j = 0; j < 3; ++j) {
+        double wx = w * x[j];
+        sum_wx_[j].add(wx);
+        sum_wxx_[j].add(wx * x[j]);
+      }
+    }
+
+    /** @returns The number of points */
+    std::size_t count() const {
+      return count_;
+    }
+
+    /** @returns The sum of the pixel counts */
+    double sum_pixels() const {
+      return sum_w_.value();
+    }
+
+    /** @returns The sum of the pixels squared */
+    double sum_pixels_sq() const {
+      return sum_w_sq_.value();
+    }
+
+    /** @returns Are there points with a positive total weight */
+    bool is_valid() const {
+      return count_ > 0 && sum_pixels() > 0;
+    }
+
+    /** @returns The centroid position */
+    vec3<double> mean() const {
+      DIALS_ASSERT(is_valid());
+      double sw = sum_pixels();
+      return vec3<double>(
+        sum_wx_[0].value() / sw, sum_wx_[1].value() / sw, sum_wx_[2].value() / sw);
+    }
+
+    /** @returns The sum of the pixels x (coords - mean)**2 */
+    vec3<double> sum_pixels_delta_sq() const {
+      DIALS_ASSERT(is_valid());
+      double sw = sum_pixels();
+      vec3<double> result;
+      for (std::size_t j = 0; j < 3; ++j) {
+        double sx = sum_wx_[j].value();
+        result[j] = sum_wxx_[j].value() - sx * sx / sw;
+      }
+      return result;
+    }
+
+    /** @returns The biased variance */
+    vec3<double> variance() const {
+      return sum_pixels_delta_sq() / sum_pixels();
+    }
+
+    /** @returns The unbiased variance */
+    vec3<double> unbiased_variance() const {
+      double sw = sum_pixels();
+      DIALS_ASSERT(sw * sw > sum_pixels_sq());
+      return sum_pixels_delta_sq() * sw / (sw * sw - sum_pixels_sq());
+    }
+
+    /** @returns The unbiased standard error on the mean squared */
+    vec3<double> unbiased_standard_error_sq() const {
+      return unbiased_variance() / sum_pixels();
+    }
+
+    /**
+     * @returns The standard error squared plus 1/12, as in CentroidPoints
+     */
+    vec3<double> mean_sq_error() const {
+      return unbiased_standard_error_sq() + vec3<double>(1.0, 1.0, 1.0) / 12.0;
+    }
+
+  private:
+    std::size_t count_;
+    CompensatedSum sum_w_;
+    CompensatedSum sum_w_sq_;
+    CompensatedSum sum_wx_[3];
+    CompensatedSum sum_wxx_[3];
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_CENTROID_CENTROID_MOMENTS_H
@@ -1,3 +1,8 @@
 from dials_algorithms_image_connected_components_ext import *  # noqa: F403; lgtm
 
-__all__ = ("LabelImageStack2d", "LabelImageStack3d", "LabelPixels3d")  # noqa: F405
+__all__ = (  # noqa: F405
+    "LabelImageStack2d",
+    "LabelImageStack3d",
+    "LabelPixels3d",
+    "StreamingLabelImageStack3d",
+)
@@ -19,11 +19,35 @@ namespace dials { namespace algorithms { namespace boost_python {
   template <std::size_t DIM>
   void label_image_stack_wrapper(const char *name) {
     typedef LabelImageStack<DIM> label_type;
+    void (label_type::*add_image_mask)(const af::const_ref<int, af::c_grid<2> > &,
+                                       const af::const_ref<bool, af::c_grid<2> > &) =
+      &label_type::add_image;
+    void (label_type::*add_image_runs)(const af::const_ref<int, af::c_grid<2> > &,
+                                       const model::StrongPixelRuns &) =
+      &label_type::add_image;
     class_<label_type>(name, no_init)
       .def(init<int2>((arg("size"))))
       .def("size", &label_type::size)
       .def("num_images", &label_type::num_images)
-      .def("add_image", &label_type::add_image, (arg("image"), arg("mask")))
+      .def("add_image", add_image_mask, (arg("image"), arg("mask")))
+      .def("add_image", add_image_runs, (arg("image"), arg("runs")))
+      .def("labels", &label_type::labels)
+      .def("coords", &label_type::coords)
+      .def("values", &label_type::values);
+  }
+
+  inline void streaming_label_image_stack_wrapper(const char *name) {
+    typedef StreamingLabelImageStack label_type;
+    class_<label_type>(name, no_init)
+      .def(init<int2>((arg("size"))))
+      .def("size", &label_type::size)
+      .def("num_images", &label_type::num_images)
+      .def("num_open", &label_type::num_open)
+      .def("num_finished", &label_type::num_finished)
+      .def("add_image", &label_type::add_image<int>, (arg("image"), arg("mask")))
+      .def("add_image", &label_type::add_image<double>, (arg("image"), arg("mask")))
+      .def("finish", &label_type::finish)
+      .def("clear", &label_type::clear)
       .def("labels", &label_type::labels)
       .def("coords", &label_type::coords)
       .def("values", &label_type::values);
@@ -43,6 +67,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_connected_components() {
     label_image_stack_wrapper<2>("LabelImageStack2d");
     label_image_stack_wrapper<3>("LabelImageStack3d");
+    streaming_label_image_stack_wrapper("StreamingLabelImageStack3d");
     label_pixels_wrapper("LabelPixels3d");
   }
 
@@ -13,12 +13,14 @@
 
 #include <ctime>
 #include <algorithm>
+#include <vector>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/connected_components.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/strong_pixel_runs.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -46,7 +48,7 @@ namespace dials { namespace algorithms {
      * @param size The size of the images
      */
     LabelImageStack(int2 size)
-        : buffer_(size[1], af::init_functor_null<std::size_t>()), size_(size), k_(0) {}
+        : buffer_(size[1], 0), size_(size), k_(0) {}
 
     /**
      * @returns The image size
@@ -102,6 +104,55 @@ namespace dials { namespace algorithms {
       k_++;
     }
 
+    /**
+     * Add another image to be labelled using the runs of strong pixels
+     * rather than the dense mask. Only the strong pixels are visited. The
+     * vertices are added in the same order as for the dense mask so the
+     * labels are identical.
+     * @param image The image to use
+     * @param runs The strong pixel runs
+     */
+    void add_image(const af::const_ref<int, af::c_grid<2> > &image,
+                   const model::StrongPixelRuns &runs) {
+      // Check the input
+      DIALS_ASSERT(image.accessor().all_eq(size_));
+      DIALS_ASSERT(runs.size().all_eq(size_));
+
+      // The buffer is not cleared so an entry is only used if it refers to a
+      // vertex in the previous row, i.e. in [prev_begin, row_begin).
+      std::size_t row_begin = num_vertices(graph_);
+      std::size_t prev_begin = row_begin;
+      int current = -1;
+      for (std::size_t r = 0; r < runs.num_runs(); ++r) {
+        int j = runs.row(r);
+        if (j != current) {
+          prev_begin = (j == current + 1) ? row_begin : num_vertices(graph_);
+          row_begin = num_vertices(graph_);
+          current = j;
+        }
+        for (int i = runs.x0(r); i < runs.x1(r); ++i) {
+          // Add the vertex
+          std::size_t vertex_a = add_vertex(graph_);
+          coords_.push_back(vec3<int>(k_, j, i));
+          values_.push_back(image(j, i));
+
+          // Add edges to this vertex. Adjacent runs are always merged so the
+          // pixel to the left is strong only within a run.
+          if (i > runs.x0(r)) {
+            boost::add_edge(vertex_a, vertex_a - 1, graph_);
+          }
+          std::size_t vertex_b = buffer_[i];
+          if (vertex_b > prev_begin && vertex_b <= row_begin) {
+            boost::add_edge(vertex_a, vertex_b - 1, graph_);
+          }
+          buffer_[i] = vertex_a + 1;
+        }
+      }
+
+      // Increment image number
+      k_++;
+    }
+
     /**
      * @returns The list of valid point coordinates
      */
@@ -152,9 +203,10 @@ namespace dials { namespace algorithms {
      * @param size The size of the images
      */
     LabelImageStack(int2 size)
-        : buffer_(af::c_grid<2>(size), af::init_functor_null<std::size_t>()),
+        : buffer_(af::c_grid<2>(size), 0),
           size_(size),
-          k_(0) {}
+          k_(0),
+          frame_begin_(0) {}
 
     /**
      * @returns The image size
@@ -181,6 +233,8 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(image.accessor().all_eq(size_));
 
+      std::size_t frame_prev = begin_frame();
+
       // Loop through all the pixels and assign the edges
       std::size_t vertex_a = 0;
       for (std::size_t j = 0; j < size_[0]; ++j) {
@@ -199,7 +253,7 @@ namespace dials { namespace algorithms {
               std::size_t vertex_b = buffer_(j - 1, i);
               boost::add_edge(vertex_a, vertex_b - 1, graph_);
             }
-            if (k_ > 0 && buffer_(j, i)) {
+            if (buffer_(j, i) > frame_prev && buffer_(j, i) <= frame_begin_) {
               std::size_t vertex_b = buffer_(j, i);
               boost::add_edge(vertex_a, vertex_b - 1, graph_);
             }
@@ -214,6 +268,62 @@ namespace dials { namespace algorithms {
       k_++;
     }
 
+    /**
+     * Add another image to be labelled using the runs of strong pixels
+     * rather than the dense mask. Only the strong pixels are visited. The
+     * vertices are added in the same order as for the dense mask so the
+     * labels are identical.
+     * @param image The image to use
+     * @param runs The strong pixel runs
+     */
+    void add_image(const af::const_ref<int, af::c_grid<2> > &image,
+                   const model::StrongPixelRuns &runs) {
+      // Check the input
+      DIALS_ASSERT(image.accessor().all_eq(size_));
+      DIALS_ASSERT(runs.size().all_eq(size_));
+      std::size_t frame_prev = begin_frame();
+
+      // The buffer is not cleared so an entry is only used if it refers to a
+      // vertex in the previous row or the previous frame.
+      std::size_t row_begin = frame_begin_;
+      std::size_t prev_begin = row_begin;
+      int current = -1;
+      for (std::size_t r = 0; r < runs.num_runs(); ++r) {
+        int j = runs.row(r);
+        if (j != current) {
+          prev_begin = (j == current + 1) ? row_begin : num_vertices(graph_);
+          row_begin = num_vertices(graph_);
+          current = j;
+        }
+        for (int i = runs.x0(r); i < runs.x1(r); ++i) {
+          // Add the vertex
+          std::size_t vertex_a = add_vertex(graph_);
+          coords_.push_back(vec3<int>(k_, j, i));
+          values_.push_back(image(j, i));
+
+          // Add edges to this vertex. Adjacent runs are always merged so the
+          // pixel to the left is strong only within a run.
+          if (i > runs.x0(r)) {
+            boost::add_edge(vertex_a, vertex_a - 1, graph_);
+          }
+          if (j > 0) {
+            std::size_t vertex_b = buffer_(j - 1, i);
+            if (vertex_b > prev_begin && vertex_b <= row_begin) {
+              boost::add_edge(vertex_a, vertex_b - 1, graph_);
+            }
+          }
+          std::size_t vertex_c = buffer_(j, i);
+          if (vertex_c > frame_prev && vertex_c <= frame_begin_) {
+            boost::add_edge(vertex_a, vertex_c - 1, graph_);
+          }
+          buffer_(j, i) = vertex_a + 1;
+        }
+      }
+
+      // Increment image number
+      k_++;
+    }
+
     /**
      * @returns The list of valid point coordinates
      */
@@ -241,12 +351,272 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Start a new frame. Entries in the buffer which refer to vertices before
+     * the previous frame are stale, so the vertex range of the previous frame
+     * is tracked rather than clearing the buffer for every frame.
+     * @returns The first vertex of the previous frame
+     */
+    std::size_t begin_frame() {
+      std::size_t frame_prev = frame_begin_;
+      frame_begin_ = num_vertices(graph_);
+      return frame_prev;
+    }
+
     AdjacencyList graph_;
     af::shared<vec3<int> > coords_;
     af::shared<int> values_;
     af::versa<std::size_t, af::c_grid<2> > buffer_;
     int2 size_;
     std::size_t k_;
+    std::size_t frame_begin_;
+  };
+
+  /**
+   * A class to do connected component labelling on a stack of images as the
+   * images come in. Only the labels of the previous image and the pixels of
+   * components which are still open are kept. A component is finished as
+   * soon as an image is added which contains none of its pixels, since it
+   * can then no longer grow. The pixels of finished components are moved to
+   * a separate list which can be read and cleared by the caller, so memory
+   * stays bounded by the number of open components rather than growing with
+   * the number of images.
+   */
+  class StreamingLabelImageStack {
+  public:
+    /**
+     * Initialise the class with the size of the desired image.
+     * @param size The size of the images
+     */
+    StreamingLabelImageStack(int2 size)
+        : previous_(af::c_grid<2>(size), -1),
+          current_(af::c_grid<2>(size), -1),
+          size_(size),
+          k_(0),
+          num_labels_(0) {
+      DIALS_ASSERT(size.all_gt(0));
+    }
+
+    /**
+     * @returns The image size
+     */
+    int2 size() const {
+      return size_;
+    }
+
+    /**
+     * @returns The number of images processed
+     */
+    int num_images() const {
+      return k_;
+    }
+
+    /**
+     * @returns The number of components which are still open
+     */
+    std::size_t num_open() const {
+      return open_.size();
+    }
+
+    /**
+     * @returns The total number of finished components
+     */
+    std::size_t num_finished() const {
+      return num_labels_;
+    }
+
+    /**
+     * Add another image to be labelled
+     * @param image The image to use
+     * @param mask The mask to use
+     */
+    template <typename T>
+    void add_image(const af::const_ref<T, af::c_grid<2> > &image,
+                   const af::const_ref<bool, af::c_grid<2> > &mask) {
+      // Check the input
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(image.accessor().all_eq(size_));
+
+      // Assign each pixel to a component, merging the components of the
+      // neighbouring pixels in this image and the previous one
+      for (std::size_t j = 0, k = 0; j < size_[0]; ++j) {
+        for (std::size_t i = 0; i < size_[1]; ++i, ++k) {
+          if (!mask[k]) {
+            current_[k] = -1;
+            continue;
+          }
+          int label = -1;
+          if (i > 0 && current_[k - 1] >= 0) {
+            label = merge(label, current_[k - 1]);
+          }
+          if (j > 0 && current_[k - size_[1]] >= 0) {
+            label = merge(label, current_[k - size_[1]]);
+          }
+          if (previous_[k] >= 0) {
+            label = merge(label, previous_[k]);
+          }
+          if (label < 0) {
+            label = parent_.size();
+            parent_.push_back(label);
+            open_.push_back(Component());
+          }
+          Component &component = open_[label];
+          component.coords.push_back(vec3<int>(k_, j, i));
+          component.values.push_back(image[k]);
+          component.frame = k_;
+          current_[k] = label;
+        }
+      }
+
+      // Finish any components with no pixels on this image and renumber the
+      // remaining components so that the union-find never grows beyond the
+      // number of open components
+      std::vector<int> remap(parent_.size(), -1);
+      std::vector<Component> open;
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        if (parent_[i] != i) {
+          continue;
+        }
+        if (open_[i].frame == k_) {
+          remap[i] = open.size();
+          open.push_back(Component());
+          open.back().swap(open_[i]);
+        } else {
+          add_finished(open_[i]);
+        }
+      }
+      for (std::size_t k = 0; k < current_.size(); ++k) {
+        previous_[k] = current_[k] >= 0 ? remap[find(current_[k])] : -1;
+      }
+      open_.swap(open);
+      parent_.resize(open_.size());
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        parent_[i] = i;
+      }
+
+      // Increment image number
+      k_++;
+    }
+
+    /**
+     * Finish all the open components. This should be called once the last
+     * image has been added.
+     */
+    void finish() {
+      for (std::size_t i = 0; i < open_.size(); ++i) {
+        add_finished(open_[i]);
+      }
+      open_.clear();
+      parent_.clear();
+      std::fill(previous_.begin(), previous_.end(), -1);
+    }
+
+    /**
+     * @returns The coordinates of the pixels in finished components
+     */
+    af::shared<vec3<int> > coords() const {
+      return coords_;
+    }
+
+    /**
+     * @returns The values of the pixels in finished components
+     */
+    af::shared<double> values() const {
+      return values_;
+    }
+
+    /**
+     * @returns The labels of the pixels in finished components
+     */
+    af::shared<int> labels() const {
+      return labels_;
+    }
+
+    /**
+     * Clear the list of finished pixels once they have been read. Labels
+     * continue to increase so they stay unique over the whole stack.
+     */
+    void clear() {
+      coords_ = af::shared<vec3<int> >();
+      values_ = af::shared<double>();
+      labels_ = af::shared<int>();
+    }
+
+  private:
+    /**
+     * The pixels of an open component and the last image it was seen on
+     */
+    struct Component {
+      af::shared<vec3<int> > coords;
+      af::shared<double> values;
+      int frame;
+
+      Component() : frame(-1) {}
+
+      void swap(Component &other) {
+        coords.swap(other.coords);
+        values.swap(other.values);
+        std::swap(frame, other.frame);
+      }
+    };
+
+    /**
+     * Find the root of the component with path halving
+     */
+    int find(int a) {
+      while (parent_[a] != a) {
+        parent_[a] = parent_[parent_[a]];
+        a = parent_[a];
+      }
+      return a;
+    }
+
+    /**
+     * Merge two components, moving the pixels of the smaller into the larger
+     * @returns The root of the merged component
+     */
+    int merge(int a, int b) {
+      b = find(b);
+      if (a < 0) {
+        return b;
+      }
+      a = find(a);
+      if (a == b) {
+        return a;
+      }
+      if (open_[a].coords.size() < open_[b].coords.size()) {
+        std::swap(a, b);
+      }
+      Component &ca = open_[a];
+      Component &cb = open_[b];
+      ca.coords.extend(cb.coords.begin(), cb.coords.end());
+      ca.values.extend(cb.values.begin(), cb.values.end());
+      ca.frame = std::max(ca.frame, cb.frame);
+      cb = Component();
+      parent_[b] = a;
+      return a;
+    }
+
+    /**
+     * Move a component to the finished list
+     */
+    void add_finished(const Component &component) {
+      coords_.extend(component.coords.begin(), component.coords.end());
+      values_.extend(component.values.begin(), component.values.end());
+      labels_.resize(coords_.size(), num_labels_);
+      num_labels_++;
+    }
+
+    af::versa<int, af::c_grid<2> > previous_;
+    af::versa<int, af::c_grid<2> > current_;
+    std::vector<int> parent_;
+    std::vector<Component> open_;
+    af::shared<vec3<int> > coords_;
+    af::shared<double> values_;
+    af::shared<int> labels_;
+    int2 size_;
+    int k_;
+    int num_labels_;
   };
 
   /**
@@ -19,8 +19,9 @@ namespace dials { namespace algorithms { namespace boost_python {
   BOOST_PYTHON_MODULE(dials_algorithms_image_fill_holes_ext) {
     def("simple_fill", &simple_fill, (arg("data"), arg("mask")));
 
-    def(
-      "diffusion_fill", &diffusion_fill, (arg("data"), arg("mask"), arg("niter") = 10));
+    def("diffusion_fill",
+        &diffusion_fill,
+        (arg("data"), arg("mask"), arg("niter") = 10, arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -11,9 +11,11 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 #define DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 
+#include <algorithm>
 #include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/image/filter/distance.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -107,57 +109,103 @@ namespace dials { namespace algorithms {
     return result;
   }
 
+  namespace detail {
+
+    /**
+     * Replace a list of pixels of an image padded by a border of zeros with
+     * the mean of their neighbours. The list holds pixels of one colour of a
+     * checkerboard, so that no pixel in the list is a neighbour of another
+     * and the pixels can be updated in place in any order.
+     */
+    struct DiffusionFillJob {
+      double *image;
+      const std::size_t *index;
+      const double *weight;
+      std::size_t stride;
+
+      DiffusionFillJob(double *image_,
+                       const std::size_t *index_,
+                       const double *weight_,
+                       std::size_t stride_)
+          : image(image_), index(index_), weight(weight_), stride(stride_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t k = first; k < last; ++k) {
+          double *p = image + index[k];
+          p[0] = (p[-1] + p[1] + p[-(long)stride] + p[stride]) * weight[k];
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
-   * A simple function to fill holes in images
+   * A simple function to fill holes in images. Each iteration replaces every
+   * masked pixel by the mean of its neighbours, first for the pixels with
+   * j + i even and then for the pixels with j + i odd (a red-black
+   * Gauss-Seidel sweep), so each half of the sweep can be split between
+   * threads and only the masked pixels are visited.
    * @param data The data array
    * @param mask The mask array
+   * @param niter The number of iterations
+   * @param nthreads The number of threads to use
    * @returns The filled image
    */
   inline af::versa<double, af::c_grid<2> > diffusion_fill(
     const af::const_ref<double, af::c_grid<2> > &data,
     const af::const_ref<bool, af::c_grid<2> > &mask,
-    std::size_t niter) {
+    std::size_t niter,
+    std::size_t nthreads = 1) {
     // Check input
     DIALS_ASSERT(niter > 0);
+    DIALS_ASSERT(nthreads > 0);
     DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
     std::size_t height = data.accessor()[0];
     std::size_t width = data.accessor()[1];
 
-    // Copy initial values
-    af::versa<double, af::c_grid<2> > result(data.accessor());
-    for (std::size_t i = 0; i < data.size(); ++i) {
-      result[i] = data[i];
+    // Copy initial values into an image with a border of zeros, so that the
+    // pixels at the edge need no special treatment
+    std::size_t stride = width + 2;
+    std::vector<double> image((height + 2) * stride, 0.0);
+    for (std::size_t j = 0; j < height; ++j) {
+      const double *row = data.begin() + j * width;
+      std::copy(row, row + width, image.begin() + (j + 1) * stride + 1);
+    }
+
+    // Get the pixels to fill of each colour and the inverse of the number of
+    // neighbours they have inside the image
+    std::vector<std::size_t> index[2];
+    std::vector<double> weight[2];
+    for (std::size_t j = 0; j < height; ++j) {
+      for (std::size_t i = 0; i < width; ++i) {
+        if (!mask(j, i)) {
+          int cnt = (i > 0) + (j > 0) + (i < width - 1) + (j < height - 1);
+          if (cnt > 0) {
+            index[(j + i) % 2].push_back((j + 1) * stride + i + 1);
+            weight[(j + i) % 2].push_back(1.0 / cnt);
+          }
+        }
+      }
     }
 
     // Fill missing values
     for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 0; j < height; ++j) {
-        for (std::size_t i = 0; i < width; ++i) {
-          if (!mask(j, i)) {
-            double sum = 0;
-            int cnt = 0;
-            if (i > 0) {
-              sum += result(j, i - 1);
-              cnt += 1;
-            }
-            if (j > 0) {
-              sum += result(j - 1, i);
-              cnt += 1;
-            }
-            if (i < width - 1) {
-              sum += result(j, i + 1);
-              cnt += 1;
-            }
-            if (j < height - 1) {
-              sum += result(j + 1, i);
-              cnt += 1;
-            }
-            result(j, i) = sum / (double)cnt;
-          }
+      for (std::size_t c = 0; c < 2; ++c) {
+        if (index[c].size() > 0) {
+          util::parallel_for(
+            index[c].size(),
+            nthreads,
+            detail::DiffusionFillJob(&image[0], &index[c][0], &weight[c][0], stride));
         }
       }
     }
 
+    // Copy the values out of the padded image
+    af::versa<double, af::c_grid<2> > result(data.accessor());
+    for (std::size_t j = 0; j < height; ++j) {
+      std::vector<double>::const_iterator row = image.begin() + (j + 1) * stride + 1;
+      std::copy(row, row + width, result.begin() + j * width);
+    }
     return result;
   }
 
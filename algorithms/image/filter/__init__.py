@@ -1,6 +1,7 @@
 from dials_algorithms_image_filter_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "GainEstimator",
     "IndexOfDispersionFilterDouble",
     "IndexOfDispersionFilterFloat",
     "IndexOfDispersionFilterMaskedDouble",
@@ -14,6 +15,7 @@
     "convolve",
     "convolve_col",
     "convolve_row",
+    "euclidean_distance",
     "index_of_dispersion_filter",
     "manhattan_distance",
     "mean_and_variance_filter",
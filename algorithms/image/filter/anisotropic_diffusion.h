@@ -11,78 +11,164 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 
+#include <algorithm>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
+  namespace detail {
+
+    /**
+     * One iteration of anisotropic diffusion over a range of the interior
+     * rows of an image. The result is written to a second buffer so that the
+     * rows can be done in any order (and by several threads); the edge pixels
+     * of the output buffer are not written. Masked pixels are not changed and
+     * are treated as having the value of the centre pixel by their neighbours.
+     */
+    struct AnisotropicDiffusionJob {
+      const double *src;
+      double *dst;
+      const bool *mask;
+      std::size_t width;
+      double kappa_inv2;
+      double gamma;
+
+      AnisotropicDiffusionJob(const double *src_,
+                              double *dst_,
+                              const bool *mask_,
+                              std::size_t width_,
+                              double kappa_inv2_,
+                              double gamma_)
+          : src(src_),
+            dst(dst_),
+            mask(mask_),
+            width(width_),
+            kappa_inv2(kappa_inv2_),
+            gamma(gamma_) {}
+
+      /**
+       * @returns The change in a pixel given its value and its neighbours
+       */
+      double delta(double AP, double AN, double AS, double AE, double AW) const {
+        // Gradients
+        double DN = AP - AN;
+        double DE = AP - AE;
+        double DS = AS - AP;
+        double DW = AW - AP;
+
+        // Diffusion stuff
+        double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
+        double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
+        double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
+        double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
+
+        // Components
+        double N = CN * DN;
+        double E = CE * DE;
+        double S = CS * DS;
+        double W = CW * DW;
+        return gamma * (S - N + W - E);
+      }
+
+      /**
+       * Update rows first + 1 to last + 1 of the image
+       */
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t j = first + 1; j < last + 1; ++j) {
+          const double *a = src + j * width;
+          const double *an = a - width;
+          const double *as = a + width;
+          double *b = dst + j * width;
+          if (mask == NULL) {
+            for (std::size_t i = 1; i < width - 1; ++i) {
+              b[i] = a[i] + delta(a[i], an[i], as[i], a[i - 1], a[i + 1]);
+            }
+          } else {
+            const bool *m = mask + j * width;
+            const bool *mn = m - width;
+            const bool *ms = m + width;
+            for (std::size_t i = 1; i < width - 1; ++i) {
+              double AP = a[i];
+              double AN = mn[i] ? an[i] : AP;
+              double AS = ms[i] ? as[i] : AP;
+              double AE = m[i - 1] ? a[i - 1] : AP;
+              double AW = m[i + 1] ? a[i + 1] : AP;
+              double D = delta(AP, AN, AS, AE, AW);
+              b[i] = AP + (m[i] ? D : 0.0);
+            }
+          }
+        }
+      }
+    };
+
+    /**
+     * Do the iterations of anisotropic diffusion, swapping between two
+     * buffers which both start as a copy of the image.
+     * @returns The filtered image
+     */
+    inline af::versa<double, af::c_grid<2> > anisotropic_diffusion_iterate(
+      const af::const_ref<double, af::c_grid<2> > &data,
+      const bool *mask,
+      std::size_t niter,
+      double kappa,
+      double gamma,
+      std::size_t nthreads) {
+      // Check input
+      DIALS_ASSERT(niter > 0);
+      DIALS_ASSERT(kappa > 0);
+      DIALS_ASSERT(gamma > 0);
+      DIALS_ASSERT(nthreads > 0);
+
+      // Initialise the buffers
+      std::size_t height = data.accessor()[0];
+      std::size_t width = data.accessor()[1];
+      af::versa<double, af::c_grid<2> > AA(data.accessor());
+      af::versa<double, af::c_grid<2> > BB(data.accessor());
+      std::copy(data.begin(), data.end(), AA.begin());
+      std::copy(data.begin(), data.end(), BB.begin());
+      if (height < 3 || width < 3) {
+        return AA;
+      }
+
+      // Compute inv of kappa
+      double kappa_inv2 = 1.0 / (kappa * kappa);
+
+      // Iterate
+      double *src = AA.begin();
+      double *dst = BB.begin();
+      for (std::size_t iter = 0; iter < niter; ++iter) {
+        util::parallel_for(
+          height - 2,
+          nthreads,
+          AnisotropicDiffusionJob(src, dst, mask, width, kappa_inv2, gamma));
+        std::swap(src, dst);
+      }
+
+      // Return filtered image
+      return src == AA.begin() ? AA : BB;
+    }
+
+  }  // namespace detail
+
   /**
    * Do anisotropic filtering on an image
    * @param data The image
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads to use
    * @return The filtered image
    */
   inline af::versa<double, af::c_grid<2> > anisotropic_diffusion(
     const af::const_ref<double, af::c_grid<2> > &data,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          // Gradients
-          double DN = A(j, i) - A(j - 1, i);
-          double DE = A(j, i) - A(j, i - 1);
-          double DS = A(j + 1, i) - A(j, i);
-          double DW = A(j, i + 1) - A(j, i);
-
-          // Diffusion stuff
-          // double CN = std::exp(-(DN*DN*kappa_inv2));
-          // double CE = std::exp(-(DE*DE*kappa_inv2));
-          // double CS = std::exp(-(DS*DS*kappa_inv2));
-          // double CW = std::exp(-(DW*DW*kappa_inv2));
-          double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-          double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-          double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-          double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-          // Components
-          double N = CN * DN;
-          double E = CE * DE;
-          double S = CS * DS;
-          double W = CW * DW;
-
-          // Update image
-          B(j, i) = gamma * (S - N + W - E);
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
-
-    // Return filtered image
-    return AA;
+    double gamma,
+    std::size_t nthreads = 1) {
+    return detail::anisotropic_diffusion_iterate(
+      data, NULL, niter, kappa, gamma, nthreads);
   }
 
   /**
@@ -92,6 +178,7 @@ namespace dials { namespace algorithms {
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads to use
    * @return The filtered image
    */
   inline af::versa<double, af::c_grid<2> > masked_anisotropic_diffusion(
@@ -99,72 +186,11 @@ namespace dials { namespace algorithms {
     const af::const_ref<bool, af::c_grid<2> > &mask,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          if (mask(j, i)) {
-            // Points
-            double AP = A(j, i);
-            double AN = mask(j - 1, i) ? A(j - 1, i) : AP;
-            double AS = mask(j + 1, i) ? A(j + 1, i) : AP;
-            double AE = mask(j, i - 1) ? A(j, i - 1) : AP;
-            double AW = mask(j, i + 1) ? A(j, i + 1) : AP;
-
-            // Gradients
-            double DN = AP - AN;
-            double DE = AP - AE;
-            double DS = AS - AP;
-            double DW = AW - AP;
-
-            // Diffusion stuff
-            // double CN = std::exp(-(DN*DN*kappa_inv2));
-            // double CE = std::exp(-(DE*DE*kappa_inv2));
-            // double CS = std::exp(-(DS*DS*kappa_inv2));
-            // double CW = std::exp(-(DW*DW*kappa_inv2));
-            double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-            double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-            double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-            double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-            // Components
-            double N = CN * DN;
-            double E = CE * DE;
-            double S = CS * DS;
-            double W = CW * DW;
-
-            // Update image
-            B(j, i) = gamma * (S - N + W - E);
-          } else {
-            B(j, i) = 0;
-          }
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
-
-    // Return filtered image
-    return AA;
+    double gamma,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+    return detail::anisotropic_diffusion_iterate(
+      data, mask.begin(), niter, kappa, gamma, nthreads);
   }
 
 }}  // namespace dials::algorithms
@@ -18,9 +18,10 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   af::versa<int, af::c_grid<2> > manhattan_distance_wrapper(
     const af::const_ref<bool, af::c_grid<2> > &src,
-    bool value) {
+    bool value,
+    std::size_t nthreads) {
     af::versa<int, af::c_grid<2> > dst(src.accessor());
-    manhattan_distance(src, value, dst.ref());
+    manhattan_distance(src, value, dst.ref(), nthreads);
     return dst;
   }
 
@@ -32,9 +33,23 @@ namespace dials { namespace algorithms { namespace boost_python {
     return dst;
   }
 
+  af::versa<double, af::c_grid<2> > euclidean_distance_wrapper(
+    const af::const_ref<bool, af::c_grid<2> > &src,
+    bool value,
+    std::size_t nthreads) {
+    af::versa<double, af::c_grid<2> > dst(src.accessor());
+    euclidean_distance(src, value, dst.ref(), nthreads);
+    return dst;
+  }
+
   void export_distance() {
-    def("manhattan_distance", &manhattan_distance_wrapper, (arg("data"), arg("value")));
+    def("manhattan_distance",
+        &manhattan_distance_wrapper,
+        (arg("data"), arg("value"), arg("nthreads") = 1));
     def("chebyshev_distance", &chebyshev_distance_wrapper, (arg("data"), arg("value")));
+    def("euclidean_distance",
+        &euclidean_distance_wrapper,
+        (arg("data"), arg("value"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
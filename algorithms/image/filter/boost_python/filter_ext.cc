@@ -22,6 +22,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   void export_median();
   void export_distance();
   void export_anisotropic_diffusion();
+  void export_gain_estimator();
 
   BOOST_PYTHON_MODULE(dials_algorithms_image_filter_ext) {
     export_summed_area();
@@ -31,6 +32,7 @@ namespace dials { namespace algorithms { namespace boost_python {
     export_median();
     export_distance();
     export_anisotropic_diffusion();
+    export_gain_estimator();
   }
 
 }}}  // namespace dials::algorithms::boost_python
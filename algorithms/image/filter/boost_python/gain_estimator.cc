@@ -0,0 +1,31 @@
+/*
+ * gain_estimator.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/image/filter/gain_estimator.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_gain_estimator() {
+    class_<GainEstimator>("GainEstimator", no_init)
+      .def(init<int2>((arg("kernel_size"))))
+      .def("add_frame", &GainEstimator::add_frame)
+      .def("add_panel", &GainEstimator::add_panel, (arg("image"), arg("mask")))
+      .def("estimate", &GainEstimator::estimate, (arg("nthreads") = 1))
+      .def("clear", &GainEstimator::clear)
+      .def("num_frames", &GainEstimator::num_frames)
+      .def("q1", &GainEstimator::q1)
+      .def("q2", &GainEstimator::q2)
+      .def("q3", &GainEstimator::q3)
+      .def("gain", &GainEstimator::gain);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
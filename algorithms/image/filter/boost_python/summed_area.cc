@@ -20,7 +20,9 @@ namespace dials { namespace algorithms { namespace boost_python {
   void summed_area_suite() {
     def("summed_area_table", &summed_area_table<T>, (arg("image")));
 
-    def("summed_area", &summed_area<T>, (arg("image"), arg("size")));
+    def("summed_area",
+        &summed_area<T>,
+        (arg("image"), arg("size"), arg("nthreads") = 1));
   }
 
   void export_summed_area() {
@@ -15,6 +15,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -24,48 +25,132 @@ namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * Copy a row of an image into a buffer padded by n0 values on the left
+     * and n1 values on the right, repeating the edge values.
+     * @param row The row
+     * @param size The length of the row
+     * @param n0 The padding on the left
+     * @param n1 The padding on the right
+     * @param buffer The buffer of length n0 + size + n1
+     */
+    template <typename FloatType>
+    void pad_row(const FloatType *row,
+                 std::size_t size,
+                 std::size_t n0,
+                 std::size_t n1,
+                 FloatType *buffer) {
+      std::fill(buffer, buffer + n0, row[0]);
+      std::copy(row, row + size, buffer + n0);
+      std::fill(buffer + n0 + size, buffer + n0 + size + n1, row[size - 1]);
+    }
+
+    /**
+     * Add a weighted row to an output row. The loop has no boundary checks so
+     * that it can be vectorised.
+     * @param weight The weight
+     * @param row The row to add
+     * @param size The length of the row
+     * @param result The output row
+     */
+    template <typename FloatType>
+    void add_weighted_row(FloatType weight,
+                          const FloatType *row,
+                          std::size_t size,
+                          FloatType *result) {
+      for (std::size_t i = 0; i < size; ++i) {
+        result[i] += row[i] * weight;
+      }
+    }
+
+    /**
+     * Try to write a 2D kernel as the outer product of a column and a row
+     * kernel.
+     * @param kernel The kernel
+     * @param col The column kernel
+     * @param row The row kernel
+     * @returns True if the kernel is separable
+     */
+    template <typename FloatType>
+    bool separate_kernel(const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+                         af::shared<FloatType> &col,
+                         af::shared<FloatType> &row) {
+      std::size_t ny = kernel.accessor()[0];
+      std::size_t nx = kernel.accessor()[1];
+
+      // Use the largest element as the pivot
+      std::size_t pivot = 0;
+      for (std::size_t k = 1; k < kernel.size(); ++k) {
+        if (std::abs(kernel[k]) > std::abs(kernel[pivot])) {
+          pivot = k;
+        }
+      }
+      double kmax = std::abs(kernel[pivot]);
+      if (kmax == 0) {
+        return false;
+      }
+      std::size_t py = pivot / nx;
+      std::size_t px = pivot % nx;
+      col = af::shared<FloatType>(ny);
+      row = af::shared<FloatType>(nx);
+      for (std::size_t j = 0; j < ny; ++j) {
+        col[j] = kernel(j, px);
+      }
+      for (std::size_t i = 0; i < nx; ++i) {
+        row[i] = kernel(py, i) / kernel(py, px);
+      }
+
+      // Check the kernel is the outer product to within rounding
+      double tolerance = 1e-6 * kmax;
+      for (std::size_t j = 0; j < ny; ++j) {
+        for (std::size_t i = 0; i < nx; ++i) {
+          if (std::abs(kernel(j, i) - col[j] * row[i]) > tolerance) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+  }  // namespace detail
+
   /**
-   * Perform a simple convolution between an image and kernel
+   * Perform a separable row convolution between an image and kernel. The
+   * pixels beyond the edge of the image take the value of the edge pixel.
+   * Each row is copied into a padded buffer so that the inner loop over the
+   * pixels of the row has no boundary checks.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve(
+  af::versa<FloatType, af::c_grid<2> > convolve_row(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
+    const af::const_ref<FloatType> &kernel) {
     // Only allow odd-sized kernel sizes
-    DIALS_ASSERT(kernel.accessor()[0] & 1);
-    DIALS_ASSERT(kernel.accessor()[1] & 1);
+    DIALS_ASSERT(kernel.size() & 1);
 
     // The image sizes and mid-point
-    int2 isz = image.accessor();
-    int2 ksz = kernel.accessor();
-    int2 mid(ksz[0] / 2, ksz[1] / 2);
+    std::size_t ny = image.accessor()[0];
+    std::size_t nx = image.accessor()[1];
+    std::size_t ksz = kernel.size();
+    std::size_t mid = ksz / 2;
 
     // Create the output
-    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
-                                                af::init_functor_null<FloatType>());
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(), 0);
+    if (nx == 0) {
+      return result;
+    }
 
-    // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz[0]; ++jj) {
-          for (int ii = 0; ii < ksz[1]; ++ii) {
-            int jjj = j + jj - mid[0];
-            int iii = i + ii - mid[1];
-            if (jjj < 0)
-              jjj = 0;
-            else if (jjj >= isz[0])
-              jjj = isz[0] - 1;
-            if (iii < 0)
-              iii = 0;
-            else if (iii >= isz[1])
-              iii = isz[1] - 1;
-            result(j, i) += image(jjj, iii) * kernel(jj, ii);
-          }
-        }
+    // Convolve each row with the kernel
+    std::vector<FloatType> buffer(nx + ksz - 1);
+    for (std::size_t j = 0; j < ny; ++j) {
+      detail::pad_row(&image(j, 0), nx, mid, mid, &buffer[0]);
+      FloatType *output = &result(j, 0);
+      for (std::size_t k = 0; k < ksz; ++k) {
+        detail::add_weighted_row(kernel[k], &buffer[k], nx, output);
       }
     }
 
@@ -74,39 +159,36 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * Perform a separable row convolution between an image and kernel
+   * Perform a separable column convolution between an image and kernel. The
+   * pixels beyond the edge of the image take the value of the edge pixel.
+   * Each output row is the weighted sum of whole input rows, so the image is
+   * read along its rows and the edges are handled once per row.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve_row(
+  af::versa<FloatType, af::c_grid<2> > convolve_col(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
     const af::const_ref<FloatType> &kernel) {
     // Only allow odd-sized kernel sizes
     DIALS_ASSERT(kernel.size() & 1);
 
     // The image sizes and mid-point
-    int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
+    int ny = image.accessor()[0];
+    int nx = image.accessor()[1];
+    int ksz = kernel.size();
+    int mid = ksz / 2;
 
     // Create the output
-    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
-                                                af::init_functor_null<FloatType>());
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(), 0);
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int ii = 0; ii < ksz; ++ii) {
-          int iii = i + ii - mid;
-          if (iii < 0)
-            iii = 0;
-          else if (iii >= isz[1])
-            iii = isz[1] - 1;
-          result(j, i) += image(j, iii) * kernel[ii];
-        }
+    for (int j = 0; j < ny; ++j) {
+      FloatType *output = &result(j, 0);
+      for (int k = 0; k < ksz; ++k) {
+        int jj = std::min(std::max(j + k - mid, 0), ny - 1);
+        detail::add_weighted_row(kernel[k], &image(jj, 0), nx, output);
       }
     }
 
@@ -115,38 +197,63 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * Perform a separable column convolution between an image and kernel
+   * Perform a simple convolution between an image and kernel. The pixels
+   * beyond the edge of the image take the value of the edge pixel. If the
+   * kernel is the outer product of a column and a row kernel (e.g. a
+   * Gaussian) the convolution is done as a row and a column convolution,
+   * which costs the sum rather than the product of the kernel sizes per
+   * pixel. Otherwise the image is padded once and each output row is built
+   * from whole rows of the padded image.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve_col(
+  af::versa<FloatType, af::c_grid<2> > convolve(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType> &kernel) {
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
     // Only allow odd-sized kernel sizes
-    DIALS_ASSERT(kernel.size() & 1);
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
+
+    // Use the separable convolution if possible
+    af::shared<FloatType> col, row;
+    if (kernel.accessor()[0] > 1 && kernel.accessor()[1] > 1
+        && detail::separate_kernel(kernel, col, row)) {
+      af::versa<FloatType, af::c_grid<2> > temp =
+        convolve_row(image, row.const_ref());
+      return convolve_col(temp.const_ref(), col.const_ref());
+    }
 
     // The image sizes and mid-point
-    int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
+    int ny = image.accessor()[0];
+    int nx = image.accessor()[1];
+    int ky = kernel.accessor()[0];
+    int kx = kernel.accessor()[1];
+    int midy = ky / 2;
+    int midx = kx / 2;
 
     // Create the output
-    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
-                                                af::init_functor_null<FloatType>());
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(), 0);
+    if (nx == 0) {
+      return result;
+    }
+
+    // Pad the rows of the image
+    int width = nx + kx - 1;
+    std::vector<FloatType> padded(ny * width);
+    for (int j = 0; j < ny; ++j) {
+      detail::pad_row(&image(j, 0), nx, midx, midx, &padded[j * width]);
+    }
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz; ++jj) {
-          int jjj = j + jj - mid;
-          if (jjj < 0)
-            jjj = 0;
-          else if (jjj >= isz[0])
-            jjj = isz[0] - 1;
-          result(j, i) += image(jjj, i) * kernel[jj];
+    for (int j = 0; j < ny; ++j) {
+      FloatType *output = &result(j, 0);
+      for (int jj = 0; jj < ky; ++jj) {
+        int jjj = std::min(std::max(j + jj - midy, 0), ny - 1);
+        const FloatType *input = &padded[jjj * width];
+        for (int ii = 0; ii < kx; ++ii) {
+          detail::add_weighted_row(kernel(jj, ii), input + ii, nx, output);
         }
       }
     }
@@ -11,54 +11,224 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/cstdint.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
-  /**
-   * Compute the manhattan distance transform of a binary image
-   * @param data The image
-   * @return The distance transform
-   */
-  template <typename InputType, typename OutputType>
-  void manhattan_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
-                          InputType value,
-                          af::ref<OutputType, af::c_grid<2> > dst) {
-    // Initialise stuff
-    std::size_t height = src.accessor()[0];
-    std::size_t width = src.accessor()[1];
-    OutputType max_distance = height + width;
-    DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+  namespace detail {
 
-    // Go north and east
-    for (std::size_t j = 0; j < height; ++j) {
-      for (std::size_t i = 1; i < width; ++i) {
-        OutputType N = (j > 0) ? dst(j - 1, i) : max_distance;
-        OutputType E = (i > 0) ? dst(j, i - 1) : max_distance;
-        if (src(j, i) == value) {
-          dst(j, i) = 0;
-        } else {
-          dst(j, i) = 1 + std::min(N, E);
+    /**
+     * Compute the distance of each pixel to the nearest pixel with the given
+     * value in the same column, for a block of columns. The image is scanned
+     * a row at a time, down and then up, so the inner loops run along the
+     * rows. Columns with no such pixel are given the distance infinity.
+     */
+    template <typename InputType, typename OutputType>
+    struct ColumnDistanceJob {
+      const InputType *src;
+      InputType value;
+      OutputType *dst;
+      std::size_t height;
+      std::size_t width;
+      OutputType infinity;
+
+      ColumnDistanceJob(const InputType *src_,
+                        InputType value_,
+                        OutputType *dst_,
+                        std::size_t height_,
+                        std::size_t width_,
+                        OutputType infinity_)
+          : src(src_),
+            value(value_),
+            dst(dst_),
+            height(height_),
+            width(width_),
+            infinity(infinity_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        // Go south
+        for (std::size_t i = first; i < last; ++i) {
+          dst[i] = src[i] == value ? 0 : infinity;
+        }
+        for (std::size_t j = 1; j < height; ++j) {
+          const InputType *s = src + j * width;
+          const OutputType *prev = dst + (j - 1) * width;
+          OutputType *d = dst + j * width;
+          for (std::size_t i = first; i < last; ++i) {
+            OutputType other = std::min(OutputType(prev[i] + 1), infinity);
+            d[i] = s[i] == value ? 0 : other;
+          }
+        }
+
+        // Go north
+        for (std::size_t j = height - 1; j > 0; --j) {
+          const OutputType *next = dst + j * width;
+          OutputType *d = dst + (j - 1) * width;
+          for (std::size_t i = first; i < last; ++i) {
+            d[i] = std::min(d[i], OutputType(next[i] + 1));
+          }
+        }
+      }
+    };
+
+    /**
+     * Finish the manhattan distance transform of a block of rows, given the
+     * distance to the nearest pixel in each column, by scanning each row east
+     * and then west.
+     */
+    template <typename OutputType>
+    struct ManhattanRowJob {
+      OutputType *dst;
+      std::size_t width;
+
+      ManhattanRowJob(OutputType *dst_, std::size_t width_)
+          : dst(dst_), width(width_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t j = first; j < last; ++j) {
+          OutputType *d = dst + j * width;
+          for (std::size_t i = 1; i < width; ++i) {
+            d[i] = std::min(d[i], OutputType(d[i - 1] + 1));
+          }
+          for (std::size_t i = width - 1; i > 0; --i) {
+            d[i - 1] = std::min(d[i - 1], OutputType(d[i] + 1));
+          }
         }
       }
+    };
+
+    /** @returns a / b rounded down, for b > 0 */
+    inline boost::int64_t floor_div(boost::int64_t a, boost::int64_t b) {
+      boost::int64_t q = a / b;
+      return (q * b > a) ? q - 1 : q;
     }
 
-    // Go south and west
-    for (std::size_t j = height; j > 0; --j) {
-      for (std::size_t i = width; i > 0; --i) {
-        OutputType S = (j < height) ? dst(j, i - 1) : max_distance;
-        OutputType W = (i < width) ? dst(j - 1, i) : max_distance;
-        OutputType other = std::min(S, W);
-        if (other < dst(j - 1, i - 1)) {
-          dst(j - 1, i - 1) = 1 + other;
+    /**
+     * Finish the euclidean distance transform of a block of rows, given the
+     * distance g to the nearest pixel in each column. The squared distance at
+     * x is the minimum over columns i of (x - i)^2 + g[i]^2, the lower
+     * envelope of a set of parabolas, which is found in linear time by the
+     * method of Felzenszwalb and Huttenlocher. The intersections of the
+     * parabolas are rounded down to integers (as in Meijster et al.) so the
+     * result is exact.
+     */
+    template <typename OutputType>
+    struct EuclideanRowJob {
+      OutputType *dst;
+      std::size_t width;
+
+      EuclideanRowJob(OutputType *dst_, std::size_t width_)
+          : dst(dst_), width(width_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        typedef boost::int64_t int_type;
+        std::vector<int_type> g2(width);
+        std::vector<int_type> v(width);
+        std::vector<int_type> z(width);
+        int_type n = width;
+        for (std::size_t j = first; j < last; ++j) {
+          OutputType *d = dst + j * width;
+          for (std::size_t i = 0; i < width; ++i) {
+            int_type g = (int_type)d[i];
+            g2[i] = g * g;
+          }
+
+          // Find the parabolas which make up the lower envelope. Parabola v[k]
+          // is the lowest from z[k] to z[k+1] - 1
+          int_type k = 0;
+          v[0] = 0;
+          z[0] = 0;
+          for (int_type u = 1; u < n; ++u) {
+            int_type s = 0;
+            while (k >= 0) {
+              int_type i = v[k];
+              s = 1 + floor_div(u * u - i * i + g2[u] - g2[i], 2 * (u - i));
+              if (s > z[k]) {
+                break;
+              }
+              k--;
+            }
+            if (k < 0) {
+              k = 0;
+              v[0] = u;
+            } else if (s < n) {
+              k++;
+              v[k] = u;
+              z[k] = s;
+            }
+          }
+
+          // Compute the distances from the envelope
+          for (int_type x = n - 1; x >= 0; --x) {
+            while (z[k] > x) {
+              k--;
+            }
+            int_type i = v[k];
+            d[x] = (OutputType)std::sqrt((double)((x - i) * (x - i) + g2[i]));
+          }
         }
       }
+    };
+
+    /**
+     * Compute a distance transform: first the distance to the nearest pixel
+     * in each column, with the columns split into blocks between threads, and
+     * then the rows, split between threads.
+     */
+    template <typename RowJob, typename InputType, typename OutputType>
+    void distance_transform(const af::const_ref<InputType, af::c_grid<2> > &src,
+                            InputType value,
+                            af::ref<OutputType, af::c_grid<2> > dst,
+                            std::size_t nthreads) {
+      std::size_t height = src.accessor()[0];
+      std::size_t width = src.accessor()[1];
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      DIALS_ASSERT(nthreads > 0);
+      if (height == 0 || width == 0) {
+        return;
+      }
+      OutputType infinity = height + width;
+      util::parallel_for(width,
+                         nthreads,
+                         ColumnDistanceJob<InputType, OutputType>(
+                           src.begin(), value, dst.begin(), height, width, infinity));
+      util::parallel_for(height, nthreads, RowJob(dst.begin(), width));
     }
+
+  }  // namespace detail
+
+  /**
+   * Compute the manhattan distance to the given value. Pixels with no such
+   * pixel in the image are given the distance height + width.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads: The number of threads to use
+   */
+  template <typename InputType, typename OutputType>
+  void manhattan_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                          InputType value,
+                          af::ref<OutputType, af::c_grid<2> > dst,
+                          std::size_t nthreads = 1) {
+    detail::distance_transform<detail::ManhattanRowJob<OutputType> >(
+      src, value, dst, nthreads);
   }
 
   /**
-   * Compute the chebyshev distance to the given value
+   * Compute the chebyshev distance to the given value. Pixels with no such
+   * pixel in the image are given the distance height + width.
+   *
+   * Unlike the manhattan and euclidean distances, the row part of the
+   * separable chebyshev transform has no cheap linear scan, so this is done
+   * as the usual two raster scans. The part of each step which depends on
+   * the previous row is done for the whole row first, so only the scan along
+   * the row is serial.
    * @param src: The src array
    * @param value: The value to compute the distance to
    * @param dst: The destination array
@@ -70,38 +240,67 @@ namespace dials { namespace algorithms {
     // Initialise stuff
     std::size_t height = src.accessor()[0];
     std::size_t width = src.accessor()[1];
-    OutputType max_distance = height + width;
     DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+    if (height == 0 || width == 0) {
+      return;
+    }
+    OutputType max_distance = height + width;
+
+    // The previous row, padded with the maximum distance at either end
+    std::vector<OutputType> prev(width + 2, max_distance);
 
-    // Go north and east
+    // Go south and east
     for (std::size_t j = 0; j < height; ++j) {
+      const InputType *s = src.begin() + j * width;
+      OutputType *d = dst.begin() + j * width;
+      if (j > 0) {
+        std::copy(d - width, d, prev.begin() + 1);
+      }
       for (std::size_t i = 0; i < width; ++i) {
-        OutputType N = (j > 0) ? dst(j - 1, i) : max_distance;
-        OutputType W = (i > 0) ? dst(j, i - 1) : max_distance;
-        OutputType NW = (j > 0 && i > 0) ? dst(j - 1, i - 1) : max_distance;
-        OutputType NE = (j > 0 && i < width - 1) ? dst(j - 1, i + 1) : max_distance;
-        if (src(j, i) == value) {
-          dst(j, i) = 0;
-        } else {
-          dst(j, i) = 1 + std::min(std::min(N, W), std::min(NE, NW));
-        }
+        OutputType N = std::min(std::min(prev[i], prev[i + 1]), prev[i + 2]);
+        N = std::min(N, OutputType(max_distance - 1));
+        d[i] = s[i] == value ? 0 : OutputType(N + 1);
+      }
+      for (std::size_t i = 1; i < width; ++i) {
+        d[i] = std::min(d[i], OutputType(d[i - 1] + 1));
       }
     }
 
-    // Go south and west
+    // Go north and west
+    std::fill(prev.begin(), prev.end(), max_distance);
     for (std::size_t j = height; j > 0; --j) {
-      for (std::size_t i = width; i > 0; --i) {
-        OutputType S = (j < height) ? dst(j, i - 1) : max_distance;
-        OutputType E = (i < width) ? dst(j - 1, i) : max_distance;
-        OutputType SW = (j < height && i > 1) ? dst(j, i - 2) : max_distance;
-        OutputType SE = (j < height && i < width) ? dst(j, i) : max_distance;
-        OutputType other = std::min(std::min(S, E), std::min(SE, SW));
-        if (other < dst(j - 1, i - 1)) {
-          dst(j - 1, i - 1) = 1 + other;
+      OutputType *d = dst.begin() + (j - 1) * width;
+      if (j < height) {
+        std::copy(d + width, d + 2 * width, prev.begin() + 1);
+        for (std::size_t i = 0; i < width; ++i) {
+          OutputType S = std::min(std::min(prev[i], prev[i + 1]), prev[i + 2]);
+          d[i] = std::min(d[i], OutputType(S + 1));
         }
       }
+      for (std::size_t i = width - 1; i > 0; --i) {
+        d[i - 1] = std::min(d[i - 1], OutputType(d[i] + 1));
+      }
     }
   }
+
+  /**
+   * Compute the exact euclidean distance to the given value. Pixels with no
+   * such pixel in the image are given a distance of at least height + width.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads: The number of threads to use
+   */
+  template <typename InputType, typename OutputType>
+  void euclidean_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                          InputType value,
+                          af::ref<OutputType, af::c_grid<2> > dst,
+                          std::size_t nthreads = 1) {
+    detail::distance_transform<
+      detail::EuclideanRowJob<OutputType> >(
+      src, value, dst, nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
@@ -0,0 +1,296 @@
+/*
+ * gain_estimator.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_FILTER_GAIN_ESTIMATOR_H
+#define DIALS_ALGORITHMS_IMAGE_FILTER_GAIN_ESTIMATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/summed_area.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * Estimate the gain of a batch of frames from the index of dispersion of
+   * their pixels, as dials.estimate_gain does.
+   *
+   * For each frame the index of dispersion of every pixel of every panel is
+   * computed as by IndexOfDispersionFilterMasked with the default minimum
+   * count, i.e. the pixels whose kernel isn't wholly inside the mask get a
+   * value of 1. The box sums are taken straight from the summed area tables
+   * as each value is computed, so the mean and variance maps aren't made.
+   * The quartiles of the values, the values within 1.5 times the
+   * interquartile range of them and the median of those are then found by
+   * selection rather than by sorting. The frames are processed in parallel,
+   * and the threads left over when there are fewer frames than threads are
+   * used within each frame.
+   */
+  class GainEstimator {
+  public:
+    /**
+     * @param kernel_size The half size of the kernel
+     */
+    GainEstimator(int2 kernel_size) : kernel_size_(kernel_size) {
+      DIALS_ASSERT(kernel_size.all_gt(0));
+    }
+
+    /**
+     * Start a new frame
+     */
+    void add_frame() {
+      frames_.push_back(Frame());
+    }
+
+    /**
+     * Add the next panel of the last frame
+     * @param image The image data
+     * @param mask The mask
+     */
+    void add_panel(const af::const_ref<double, af::c_grid<2> > &image,
+                   const af::const_ref<bool, af::c_grid<2> > &mask) {
+      DIALS_ASSERT(frames_.size() > 0);
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(image.accessor().all_gt(0));
+      af::versa<double, af::c_grid<2> > image_copy(image.accessor());
+      af::versa<bool, af::c_grid<2> > mask_copy(mask.accessor());
+      std::copy(image.begin(), image.end(), image_copy.begin());
+      std::copy(mask.begin(), mask.end(), mask_copy.begin());
+      frames_.back().images.push_back(image_copy);
+      frames_.back().masks.push_back(mask_copy);
+    }
+
+    /**
+     * Estimate the gain of all the frames
+     * @param nthreads The number of threads
+     */
+    void estimate(std::size_t nthreads = 1) {
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t n = frames_.size();
+      q1_.assign(n, 0);
+      q2_.assign(n, 0);
+      q3_.assign(n, 0);
+      gain_.assign(n, 0);
+      if (n == 0) {
+        return;
+      }
+      std::size_t inner = n < nthreads ? nthreads / n : 1;
+      dials::util::parallel_for(n, std::min(n, nthreads), FrameJob(*this, inner));
+    }
+
+    /**
+     * Remove all the frames
+     */
+    void clear() {
+      frames_.clear();
+      q1_.clear();
+      q2_.clear();
+      q3_.clear();
+      gain_.clear();
+    }
+
+    /** @returns The number of frames */
+    std::size_t num_frames() const {
+      return frames_.size();
+    }
+
+    /** @returns The first quartile of the index of dispersion of each frame */
+    af::shared<double> q1() const {
+      return af::shared<double>(q1_.begin(), q1_.end());
+    }
+
+    /** @returns The median of the index of dispersion of each frame */
+    af::shared<double> q2() const {
+      return af::shared<double>(q2_.begin(), q2_.end());
+    }
+
+    /** @returns The third quartile of the index of dispersion of each frame */
+    af::shared<double> q3() const {
+      return af::shared<double>(q3_.begin(), q3_.end());
+    }
+
+    /**
+     * @returns The estimated gain of each frame, or zero if the interquartile
+     * range of the frame is zero
+     */
+    af::shared<double> gain() const {
+      return af::shared<double>(gain_.begin(), gain_.end());
+    }
+
+  private:
+    struct Frame {
+      std::vector<af::versa<double, af::c_grid<2> > > images;
+      std::vector<af::versa<bool, af::c_grid<2> > > masks;
+    };
+
+    /**
+     * Estimate the gain of a range of the frames
+     */
+    class FrameJob {
+    public:
+      FrameJob(GainEstimator &self, std::size_t nthreads)
+          : self_(&self), nthreads_(nthreads) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          self_->estimate_frame(i, nthreads_);
+        }
+      }
+
+    private:
+      GainEstimator *self_;
+      std::size_t nthreads_;
+    };
+
+    /**
+     * Compute the index of dispersion of a range of rows of a panel
+     */
+    class DispersionJob {
+    public:
+      DispersionJob(const SummedAreaTable<boost::int64_t> &summed_mask,
+                    const SummedAreaTable<double> &summed_image,
+                    const SummedAreaTable<double> &summed_image_sq,
+                    const double *image,
+                    const bool *mask,
+                    int2 size,
+                    double *result)
+          : summed_mask_(&summed_mask),
+            summed_image_(&summed_image),
+            summed_image_sq_(&summed_image_sq),
+            image_(image),
+            mask_(mask),
+            size_(size),
+            result_(result) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const double BIG = (1 << 24);
+        const int min_count = (2 * size_[0] + 1) * (2 * size_[1] + 1);
+        int ysize = summed_mask_->accessor()[0];
+        int xsize = summed_mask_->accessor()[1];
+        for (int j = first; j < (int)last; ++j) {
+          std::size_t j0 = std::max(j - size_[0], 0);
+          std::size_t j1 = std::min(j + size_[0] + 1, ysize);
+          for (int i = 0; i < xsize; ++i) {
+            std::size_t k = j * xsize + i;
+            std::size_t i0 = std::max(i - size_[1], 0);
+            std::size_t i1 = std::min(i + size_[1] + 1, xsize);
+            int c = (int)summed_mask_->sum(j0, j1, i0, i1);
+            double value = 1.0;
+            if (mask_[k] && image_[k] < BIG && c >= min_count) {
+              double s = summed_image_->sum(j0, j1, i0, i1);
+              double s2 = summed_image_sq_->sum(j0, j1, i0, i1);
+              double mean = s / c;
+              if (mean > 0) {
+                value = ((s2 - (s * s / c)) / (c - 1)) / mean;
+              }
+            }
+            result_[k] = value;
+          }
+        }
+      }
+
+    private:
+      const SummedAreaTable<boost::int64_t> *summed_mask_;
+      const SummedAreaTable<double> *summed_image_;
+      const SummedAreaTable<double> *summed_image_sq_;
+      const double *image_;
+      const bool *mask_;
+      int2 size_;
+      double *result_;
+    };
+
+    /**
+     * Select the value at a fractional position of the sorted values, rounded
+     * to the nearest index as by libtbx nearest_integer
+     */
+    static double select(std::vector<double>::iterator first,
+                         std::vector<double>::iterator last,
+                         double position) {
+      std::size_t index = (std::size_t)std::floor(position + 0.5);
+      DIALS_ASSERT(index < (std::size_t)(last - first));
+      std::nth_element(first, first + index, last);
+      return first[index];
+    }
+
+    void estimate_frame(std::size_t index, std::size_t nthreads) {
+      const Frame &frame = frames_[index];
+      DIALS_ASSERT(frame.images.size() > 0);
+
+      // Compute the index of dispersion of all the panels
+      std::size_t num_pixels = 0;
+      for (std::size_t p = 0; p < frame.images.size(); ++p) {
+        num_pixels += frame.images[p].size();
+      }
+      std::vector<double> values(num_pixels);
+      for (std::size_t p = 0, offset = 0; p < frame.images.size(); ++p) {
+        const af::versa<double, af::c_grid<2> > &image = frame.images[p];
+        const af::versa<bool, af::c_grid<2> > &mask = frame.masks[p];
+        af::versa<int, af::c_grid<2> > mask_int(mask.accessor());
+        af::versa<double, af::c_grid<2> > masked(image.accessor());
+        af::versa<double, af::c_grid<2> > masked_sq(image.accessor());
+        for (std::size_t k = 0; k < image.size(); ++k) {
+          mask_int[k] = mask[k] ? 1 : 0;
+          masked[k] = image[k] * (mask_int[k] != 0);
+          masked_sq[k] = masked[k] * masked[k];
+        }
+        SummedAreaTable<boost::int64_t> summed_mask(mask_int.const_ref(), nthreads);
+        SummedAreaTable<double> summed_image(masked.const_ref(), nthreads);
+        SummedAreaTable<double> summed_image_sq(masked_sq.const_ref(), nthreads);
+        dials::util::parallel_for(image.accessor()[0],
+                                  nthreads,
+                                  DispersionJob(summed_mask,
+                                                summed_image,
+                                                summed_image_sq,
+                                                image.begin(),
+                                                mask.begin(),
+                                                kernel_size_,
+                                                &values[offset]));
+        offset += image.size();
+      }
+
+      // Find the quartiles and the median of the inliers
+      double n = values.size();
+      double q1 = select(values.begin(), values.end(), n / 4);
+      double q2 = select(values.begin(), values.end(), n / 2);
+      double q3 = select(values.begin(), values.end(), n * 3 / 4);
+      double iqr = q3 - q1;
+      double gain = 0;
+      if (iqr != 0.0) {
+        double lower = q1 - 1.5 * iqr;
+        double upper = q3 + 1.5 * iqr;
+        std::vector<double>::iterator end = values.begin();
+        for (std::vector<double>::iterator it = values.begin(); it != values.end();
+             ++it) {
+          if (*it > lower && *it < upper) {
+            *end++ = *it;
+          }
+        }
+        double m = end - values.begin();
+        gain = select(values.begin(), end, m / 2);
+      }
+      q1_[index] = q1;
+      q2_[index] = q2;
+      q3_[index] = q3;
+      gain_[index] = gain;
+    }
+
+    int2 kernel_size_;
+    std::vector<Frame> frames_;
+    std::vector<double> q1_;
+    std::vector<double> q2_;
+    std::vector<double> q3_;
+    std::vector<double> gain_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_FILTER_GAIN_ESTIMATOR_H
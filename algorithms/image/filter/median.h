@@ -12,6 +12,8 @@
 #define DIALS_ALGORITHMS_IMAGE_FILTER_MEDIAN_H
 
 #include <algorithm>
+#include <cmath>
+#include <vector>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
@@ -20,6 +22,213 @@ namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * A histogram of the integer pixel values in a sliding window which
+     * keeps track of the median as values are added and removed, as
+     * described in Huang, Yang and Tang (1979) "A fast two-dimensional median
+     * filtering algorithm". The median only moves a little as the window
+     * slides, so finding it again is cheap.
+     */
+    class SlidingHistogramMedian {
+    public:
+      /**
+       * @param min_value The minimum pixel value
+       * @param num_bins The number of histogram bins
+       */
+      SlidingHistogramMedian(int min_value, std::size_t num_bins)
+          : offset_(min_value), hist_(num_bins, 0), count_(0), bin_(0), below_(0) {}
+
+      /**
+       * Add a value to the window
+       */
+      void add(int value) {
+        std::size_t bin = value - offset_;
+        hist_[bin]++;
+        count_++;
+        if (bin < bin_) {
+          below_++;
+        }
+      }
+
+      /**
+       * Remove a value from the window
+       */
+      void remove(int value) {
+        std::size_t bin = value - offset_;
+        DIALS_ASSERT(hist_[bin] > 0);
+        hist_[bin]--;
+        count_--;
+        if (bin < bin_) {
+          below_--;
+        }
+      }
+
+      /**
+       * @returns The number of values in the window
+       */
+      std::size_t size() const {
+        return count_;
+      }
+
+      /**
+       * @returns The value at index size() / 2 of the sorted window
+       */
+      int median() {
+        DIALS_ASSERT(count_ > 0);
+        std::size_t n = count_ / 2;
+        while (below_ > n) {
+          bin_--;
+          below_ -= hist_[bin_];
+        }
+        while (below_ + hist_[bin_] <= n) {
+          below_ += hist_[bin_];
+          bin_++;
+        }
+        return (int)bin_ + offset_;
+      }
+
+    private:
+      int offset_;
+      std::vector<std::size_t> hist_;
+      std::size_t count_;
+      std::size_t bin_;
+      std::size_t below_;
+    };
+
+    /**
+     * The maximum range of pixel values for the histogram median filter
+     */
+    const std::size_t max_histogram_bins = 1 << 16;
+
+    /**
+     * Check if the (unmasked) pixels are all integers in a small enough range
+     * to use the histogram median filter
+     * @param image The image
+     * @param mask The mask (or NULL)
+     * @param min_value The minimum value
+     * @param num_bins The number of histogram bins needed
+     * @returns True/False the histogram filter can be used
+     */
+    template <typename T>
+    bool histogram_range(const af::const_ref<T, af::c_grid<2> > &image,
+                         const bool *mask,
+                         int &min_value,
+                         std::size_t &num_bins) {
+      double vmin = 0;
+      double vmax = 0;
+      bool first = true;
+      for (std::size_t i = 0; i < image.size(); ++i) {
+        if (mask != NULL && !mask[i]) {
+          continue;
+        }
+        double v = image[i];
+        if (!(std::floor(v) == v && std::abs(v) < 1e9)) {
+          return false;
+        }
+        if (first || v < vmin) vmin = v;
+        if (first || v > vmax) vmax = v;
+        first = false;
+      }
+      if (first || vmax - vmin + 1 > max_histogram_bins) {
+        return false;
+      }
+      min_value = (int)vmin;
+      num_bins = (std::size_t)(vmax - vmin + 1);
+      return true;
+    }
+
+    /**
+     * Add or remove a column of the window around row j to the histogram
+     */
+    template <typename T>
+    void update_column(SlidingHistogramMedian &window,
+                       const af::const_ref<T, af::c_grid<2> > &image,
+                       const bool *mask,
+                       int2 size,
+                       bool periodic,
+                       int j,
+                       int i,
+                       bool add) {
+      // Wrap the indices the same way as median_filter_masked
+      std::size_t ysize = image.accessor()[0];
+      std::size_t xsize = image.accessor()[1];
+      std::size_t iii = i;
+      if (periodic) {
+        iii = (i % xsize + xsize) % xsize;
+      } else if (i < 0 || i >= (int)xsize) {
+        return;
+      }
+      for (int jj = j - size[0]; jj <= j + size[0]; ++jj) {
+        std::size_t jjj = jj;
+        if (periodic) {
+          jjj = (jj % ysize + ysize) % ysize;
+        } else if (jj < 0 || jj >= (int)ysize) {
+          continue;
+        }
+        std::size_t index = jjj * xsize + iii;
+        if (mask == NULL || mask[index]) {
+          int value = (int)image[index];
+          if (add) {
+            window.add(value);
+          } else {
+            window.remove(value);
+          }
+        }
+      }
+    }
+
+    /**
+     * Apply a median filter to an image with integer pixel values by
+     * sliding a histogram of the window along each row. Each step only adds
+     * and removes a column of the window so the cost per pixel does not
+     * depend on the width of the kernel. The result is the same as taking
+     * the median of each window in turn.
+     * @param image The image to filter
+     * @param mask The image mask (or NULL)
+     * @param size The size of the filter kernel
+     * @param periodic Wrap the filter
+     * @param min_value The minimum pixel value
+     * @param num_bins The number of histogram bins
+     * @param median The filtered image
+     */
+    template <typename T>
+    void histogram_median_filter(const af::const_ref<T, af::c_grid<2> > &image,
+                                 const bool *mask,
+                                 int2 size,
+                                 bool periodic,
+                                 int min_value,
+                                 std::size_t num_bins,
+                                 af::ref<T, af::c_grid<2> > median) {
+      int ysize = (int)image.accessor()[0];
+      int xsize = (int)image.accessor()[1];
+      SlidingHistogramMedian window(min_value, num_bins);
+
+      for (int j = 0; j < ysize; ++j) {
+        for (int ii = -size[1]; ii <= size[1]; ++ii) {
+          update_column(window, image, mask, size, periodic, j, ii, true);
+        }
+        for (int i = 0; i < xsize; ++i) {
+          if (i > 0) {
+            int i0 = i - size[1] - 1;
+            int i1 = i + size[1];
+            update_column(window, image, mask, size, periodic, j, i0, false);
+            update_column(window, image, mask, size, periodic, j, i1, true);
+          }
+          if (window.size() > 0) {
+            median(j, i) = (T)window.median();
+          }
+        }
+        for (int ii = xsize - 1 - size[1]; ii <= xsize - 1 + size[1]; ++ii) {
+          update_column(window, image, mask, size, periodic, j, ii, false);
+        }
+        DIALS_ASSERT(window.size() == 0);
+      }
+    }
+
+  }  // namespace detail
+
   /**
    * Apply a median filter to an image
    * @param image The image to filter
@@ -37,6 +246,15 @@ namespace dials { namespace algorithms {
     // The array for output
     af::versa<T, af::c_grid<2> > median(image.accessor(), T(0));
 
+    // Use the sliding histogram if the pixels are integer counts
+    int min_value = 0;
+    std::size_t num_bins = 0;
+    if (detail::histogram_range(image, NULL, min_value, num_bins)) {
+      detail::histogram_median_filter(
+        image, NULL, size, false, min_value, num_bins, median.ref());
+      return median;
+    }
+
     // Create the array to sort to get the median
     std::size_t ysize = image.accessor()[0];
     std::size_t xsize = image.accessor()[1];
@@ -86,6 +304,15 @@ namespace dials { namespace algorithms {
     // The array for output
     af::versa<T, af::c_grid<2> > median(image.accessor(), T(0));
 
+    // Use the sliding histogram if the pixels are integer counts
+    int min_value = 0;
+    std::size_t num_bins = 0;
+    if (detail::histogram_range(image, mask.begin(), min_value, num_bins)) {
+      detail::histogram_median_filter(
+        image, mask.begin(), size, periodic, min_value, num_bins, median.ref());
+      return median;
+    }
+
     // Create the array to sort to get the median
     std::size_t ysize = image.accessor()[0];
     std::size_t xsize = image.accessor()[1];
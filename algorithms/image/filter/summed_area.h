@@ -13,15 +13,206 @@
 
 #include <algorithm>
 #include <cmath>
+#include <boost/cstdint.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  /**
+   * The type used to accumulate the summed area table of an image. Integer
+   * images are summed exactly in 64 bit integers and floating point images in
+   * double precision.
+   */
+  template <typename T>
+  struct summed_area_traits {
+    typedef double accumulator_type;
+  };
+
+  template <>
+  struct summed_area_traits<int> {
+    typedef boost::int64_t accumulator_type;
+  };
+
+  /**
+   * A summed area table, which can be built once and then used for the box
+   * sums of any size. The table has an extra first row and column of zeros,
+   * so the sum over a box is four lookups without any special cases at the
+   * edges of the image. The rows and then the columns are scanned in parallel.
+   */
+  template <typename AccumType>
+  class SummedAreaTable {
+  public:
+    typedef AccumType accumulator_type;
+
+    /**
+     * Build the table
+     * @param image The image
+     * @param nthreads The number of threads
+     */
+    template <typename T>
+    SummedAreaTable(const af::const_ref<T, af::c_grid<2> > &image,
+                    std::size_t nthreads = 1)
+        : ysize_(image.accessor()[0]),
+          xsize_(image.accessor()[1]),
+          table_((ysize_ + 1) * (xsize_ + 1), 0) {
+      dials::util::parallel_for(ysize_, nthreads, RowScanJob<T>(image, table_.begin()));
+      dials::util::parallel_for(xsize_, nthreads, ColumnScanJob(*this));
+    }
+
+    /** @returns The image size */
+    int2 accessor() const {
+      return int2(ysize_, xsize_);
+    }
+
+    /**
+     * @param j The row
+     * @param i The column
+     * @returns The sum of the pixels in rows < j and columns < i
+     */
+    AccumType operator()(std::size_t j, std::size_t i) const {
+      DIALS_ASSERT(j <= ysize_ && i <= xsize_);
+      return table_[j * (xsize_ + 1) + i];
+    }
+
+    /**
+     * @param j0 The first row
+     * @param j1 The last row (exclusive)
+     * @param i0 The first column
+     * @param i1 The last column (exclusive)
+     * @returns The sum of the pixels in the box
+     */
+    AccumType sum(std::size_t j0,
+                  std::size_t j1,
+                  std::size_t i0,
+                  std::size_t i1) const {
+      DIALS_ASSERT(j0 <= j1 && j1 <= ysize_);
+      DIALS_ASSERT(i0 <= i1 && i1 <= xsize_);
+      std::size_t w = xsize_ + 1;
+      return table_[j1 * w + i1] - table_[j0 * w + i1] - table_[j1 * w + i0]
+             + table_[j0 * w + i0];
+    }
+
+    /**
+     * Calculate the sum of the pixels in the box of size (2 * size + 1)
+     * around each pixel, clipped to the image.
+     * @param size The half size of the box
+     * @param nthreads The number of threads
+     * @returns The box sums
+     */
+    template <typename T>
+    af::versa<T, af::c_grid<2> > box_sum(int2 size, std::size_t nthreads = 1) const {
+      DIALS_ASSERT(size.all_ge(0));
+      af::versa<T, af::c_grid<2> > result(af::c_grid<2>(ysize_, xsize_),
+                                          af::init_functor_null<T>());
+      dials::util::parallel_for(
+        ysize_, nthreads, BoxSumJob<T>(*this, size, result.begin()));
+      return result;
+    }
+
+    /**
+     * @returns The table without the first row and column of zeros
+     */
+    template <typename T>
+    af::versa<T, af::c_grid<2> > table() const {
+      af::versa<T, af::c_grid<2> > result(af::c_grid<2>(ysize_, xsize_),
+                                          af::init_functor_null<T>());
+      for (std::size_t j = 0; j < ysize_; ++j) {
+        for (std::size_t i = 0; i < xsize_; ++i) {
+          result(j, i) = (T)table_[(j + 1) * (xsize_ + 1) + i + 1];
+        }
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Compute the prefix sums along a range of rows
+     */
+    template <typename T>
+    struct RowScanJob {
+      af::const_ref<T, af::c_grid<2> > image;
+      AccumType *table;
+
+      RowScanJob(const af::const_ref<T, af::c_grid<2> > &image_, AccumType *table_)
+          : image(image_), table(table_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t xsize = image.accessor()[1];
+        for (std::size_t j = first; j < last; ++j) {
+          const T *src = image.begin() + j * xsize;
+          AccumType *dst = table + (j + 1) * (xsize + 1);
+          AccumType sum = 0;
+          dst[0] = 0;
+          for (std::size_t i = 0; i < xsize; ++i) {
+            sum += (AccumType)src[i];
+            dst[i + 1] = sum;
+          }
+        }
+      }
+    };
+
+    /**
+     * Add each row to the row below along a range of columns
+     */
+    struct ColumnScanJob {
+      SummedAreaTable *self;
+
+      ColumnScanJob(SummedAreaTable &self_) : self(&self_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t w = self->xsize_ + 1;
+        AccumType *table = self->table_.begin();
+        for (std::size_t j = 2; j <= self->ysize_; ++j) {
+          AccumType *dst = table + j * w + 1;
+          const AccumType *src = dst - w;
+          for (std::size_t i = first; i < last; ++i) {
+            dst[i] += src[i];
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the box sums for a range of rows
+     */
+    template <typename T>
+    struct BoxSumJob {
+      const SummedAreaTable *self;
+      int2 size;
+      T *result;
+
+      BoxSumJob(const SummedAreaTable &self_, int2 size_, T *result_)
+          : self(&self_), size(size_), result(result_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        int ysize = self->ysize_;
+        int xsize = self->xsize_;
+        std::size_t w = xsize + 1;
+        const AccumType *table = self->table_.begin();
+        for (int j = first; j < (int)last; ++j) {
+          const AccumType *t0 = table + std::max(j - size[0], 0) * w;
+          const AccumType *t1 = table + std::min(j + size[0] + 1, ysize) * w;
+          T *dst = result + j * xsize;
+          for (int i = 0; i < xsize; ++i) {
+            int i0 = std::max(i - size[1], 0);
+            int i1 = std::min(i + size[1] + 1, xsize);
+            dst[i] = (T)(t1[i1] - t0[i1] - t1[i0] + t0[i0]);
+          }
+        }
+      }
+    };
+
+    std::size_t ysize_;
+    std::size_t xsize_;
+    af::shared<AccumType> table_;
+  };
+
   /**
    * Calculate the summed area table from the image.
    * @param image The image array
@@ -30,80 +221,26 @@ namespace dials { namespace algorithms {
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area_table(
     const af::const_ref<T, af::c_grid<2> > &image) {
-    // Allocate the table
-    af::versa<T, af::c_grid<2> > table_arr(image.accessor(),
-                                           af::init_functor_null<T>());
-    af::ref<T, af::c_grid<2> > table = table_arr.ref();
-
-    // Get the size of the image
-    std::size_t ysize = image.accessor()[0];
-    std::size_t xsize = image.accessor()[1];
-
-    // Create the summed area table
-    for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i, ++k) {
-        T I10 = j > 0 ? table[k - xsize] : 0;
-        T I01 = i > 0 ? table[k - 1] : 0;
-        T I11 = j > 0 && i > 0 ? table[k - xsize - 1] : 0;
-        table[k] = image[k] + I10 + I01 - I11;
-      }
-    }
-
-    // Return the summed area table
-    return table_arr;
+    typedef typename summed_area_traits<T>::accumulator_type accumulator_type;
+    return SummedAreaTable<accumulator_type>(image).template table<T>();
   }
 
   /**
    * Calculate the summed area under each point of the image
    * @param image The image array
    * @param size The size of the rectangle (2 * size + 1)
+   * @param nthreads The number of threads
    * @returns The summed area
    */
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area(
     const af::const_ref<T, af::c_grid<2> > &image,
-    int2 size) {
-    // Check the sizes are valid
+    int2 size,
+    std::size_t nthreads = 1) {
+    typedef typename summed_area_traits<T>::accumulator_type accumulator_type;
     DIALS_ASSERT(size.all_ge(0));
-
-    // Calculate the summed area table
-    af::versa<T, af::c_grid<2> > I_arr = summed_area_table<T>(image);
-    af::const_ref<T, af::c_grid<2> > I = I_arr.const_ref();
-
-    // Allocate the filtered image
-    af::versa<T, af::c_grid<2> > sum_arr(image.accessor(), af::init_functor_null<T>());
-    af::ref<T, af::c_grid<2> > sum = sum_arr.ref();
-
-    // Get the size of the image
-    std::size_t ysize = image.accessor()[0];
-    std::size_t xsize = image.accessor()[1];
-
-    // Calculate the local mean at every point
-    for (std::size_t j = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i) {
-        int i0 = i - size[1] - 1, i1 = i + size[1];
-        int j0 = j - size[0] - 1, j1 = j + size[0];
-        i1 = i1 < xsize ? i1 : xsize - 1;
-        j1 = j1 < ysize ? j1 : ysize - 1;
-
-        double I00 = 0, I10 = 0, I01 = 0, I11 = 0;
-        if (i0 >= 0 && j0 >= 0) {
-          I00 = I(j0, i0);
-          I10 = I(j1, i0);
-          I01 = I(j0, i1);
-        } else if (i0 >= 0) {
-          I10 = I(j1, i0);
-        } else if (j0 >= 0) {
-          I01 = I(j0, i1);
-        }
-        I11 = I(j1, i1);
-
-        sum(j, i) = (I11 + I00 - I01 - I10);
-      }
-    }
-
-    // Return the summed area image
-    return sum_arr;
+    SummedAreaTable<accumulator_type> table(image, nthreads);
+    return table.template box_sum<T>(size, nthreads);
   }
 
 }}  // namespace dials::algorithms
@@ -1,10 +1,15 @@
 from dials_algorithms_image_threshold_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "BatchDispersionExtendedThreshold",
+    "BatchDispersionThreshold",
     "DispersionExtendedThreshold",
     "DispersionExtendedThresholdDebug",
     "DispersionThreshold",
     "DispersionThresholdDebug",
+    "TiledDispersionExtendedThreshold",
+    "TiledDispersionThreshold",
+    "UnimodalHistogram",
     "dispersion",
     "dispersion_w_gain",
     "gain",
@@ -0,0 +1,205 @@
+/*
+ * batch.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_BATCH_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_BATCH_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::af::int2;
+
+  /**
+   * Apply a local threshold algorithm to a batch of frames at once. The
+   * frames are passed as a single contiguous stack so they can be handed
+   * over in one call, and each worker owns an instance of the algorithm whose
+   * buffers are allocated once and reused for every frame it processes. The
+   * frames are shared between the workers in a fixed order so no locking is
+   * needed and the results are identical to thresholding each frame on its
+   * own.
+   */
+  template <typename Algorithm>
+  class BatchThreshold {
+  public:
+    /**
+     * Initialise the workers
+     * @param image_size The size of each frame
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels under the kernel
+     * @param nthreads The number of threads to use
+     */
+    BatchThreshold(int2 image_size,
+                   int2 kernel_size,
+                   double nsig_b,
+                   double nsig_s,
+                   double threshold,
+                   int min_count,
+                   std::size_t nthreads)
+        : image_size_(image_size), nthreads_(nthreads) {
+      DIALS_ASSERT(image_size.all_gt(0));
+      DIALS_ASSERT(nthreads > 0);
+      for (std::size_t i = 0; i < nthreads; ++i) {
+        workers_.push_back(boost::make_shared<Algorithm>(
+          image_size, kernel_size, nsig_b, nsig_s, threshold, min_count));
+      }
+
+      // Only start threads if they will be used
+      if (nthreads_ > 1) {
+        pool_ =
+          boost::make_shared<dials::util::WorkStealingThreadPool>(nthreads_);
+      }
+    }
+
+    /**
+     * @returns The size of each frame
+     */
+    int2 image_size() const {
+      return image_size_;
+    }
+
+    /**
+     * @returns The number of threads
+     */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
+    /**
+     * Compute the threshold for a stack of frames.
+     * @param src - The stack of frames
+     * @param mask - The mask for each frame
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold(const af::const_ref<T, af::c_grid<3> > &src,
+                   const af::const_ref<bool, af::c_grid<3> > &mask,
+                   af::ref<bool, af::c_grid<3> > dst) {
+      check_size(src.accessor());
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      run(src, mask, NULL, dst);
+    }
+
+    /**
+     * Compute the threshold for a stack of frames.
+     * @param src - The stack of frames
+     * @param mask - The mask for each frame
+     * @param gain - The gain map, which is the same for every frame
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain(const af::const_ref<T, af::c_grid<3> > &src,
+                          const af::const_ref<bool, af::c_grid<3> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<3> > dst) {
+      check_size(src.accessor());
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      DIALS_ASSERT(gain.accessor().all_eq(image_size_));
+      run(src, mask, &gain, dst);
+    }
+
+  private:
+    /**
+     * Check the frames in the stack are the expected size
+     */
+    void check_size(const af::c_grid<3> &grid) const {
+      DIALS_ASSERT(grid[1] == image_size_[0]);
+      DIALS_ASSERT(grid[2] == image_size_[1]);
+    }
+
+    /**
+     * The job to process every nth frame of the stack with one worker. The
+     * frames are referenced in place since they are already contiguous.
+     */
+    template <typename T>
+    class BatchJob {
+    public:
+      BatchJob(Algorithm &algorithm,
+               std::size_t first,
+               std::size_t step,
+               const af::const_ref<T, af::c_grid<3> > &src,
+               const af::const_ref<bool, af::c_grid<3> > &mask,
+               const af::const_ref<double, af::c_grid<2> > *gain,
+               af::ref<bool, af::c_grid<3> > dst)
+          : algorithm_(algorithm),
+            first_(first),
+            step_(step),
+            src_(src),
+            mask_(mask),
+            gain_(gain),
+            dst_(dst) {}
+
+      void operator()() {
+        af::c_grid<2> grid(src_.accessor()[1], src_.accessor()[2]);
+        std::size_t frame_size = grid.size_1d();
+        for (std::size_t k = first_; k < src_.accessor()[0]; k += step_) {
+          std::size_t offset = k * frame_size;
+          af::const_ref<T, af::c_grid<2> > src(&src_[offset], grid);
+          af::const_ref<bool, af::c_grid<2> > mask(&mask_[offset], grid);
+          af::ref<bool, af::c_grid<2> > dst(&dst_[offset], grid);
+          if (gain_ == NULL) {
+            algorithm_.threshold(src, mask, dst);
+          } else {
+            algorithm_.threshold_w_gain(src, mask, *gain_, dst);
+          }
+        }
+      }
+
+    private:
+      Algorithm &algorithm_;
+      std::size_t first_;
+      std::size_t step_;
+      af::const_ref<T, af::c_grid<3> > src_;
+      af::const_ref<bool, af::c_grid<3> > mask_;
+      const af::const_ref<double, af::c_grid<2> > *gain_;
+      af::ref<bool, af::c_grid<3> > dst_;
+    };
+
+    /**
+     * Process all the frames, in parallel if requested. Each worker writes a
+     * disjoint set of frames so no synchronisation is needed.
+     */
+    template <typename T>
+    void run(const af::const_ref<T, af::c_grid<3> > &src,
+             const af::const_ref<bool, af::c_grid<3> > &mask,
+             const af::const_ref<double, af::c_grid<2> > *gain,
+             af::ref<bool, af::c_grid<3> > dst) {
+      std::size_t nframes = src.accessor()[0];
+      std::size_t njobs = std::min(workers_.size(), nframes);
+      if (pool_ == NULL || njobs <= 1) {
+        BatchJob<T>(*workers_[0], 0, 1, src, mask, gain, dst)();
+      } else {
+        for (std::size_t i = 0; i < njobs; ++i) {
+          pool_->post(BatchJob<T>(*workers_[i], i, njobs, src, mask, gain, dst));
+        }
+        pool_->wait();
+      }
+    }
+
+    int2 image_size_;
+    std::size_t nthreads_;
+    std::vector<boost::shared_ptr<Algorithm> > workers_;
+    boost::shared_ptr<dials::util::WorkStealingThreadPool> pool_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_BATCH_H
@@ -11,6 +11,8 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/image/threshold/tiled.h>
+#include <dials/algorithms/image/threshold/batch.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -60,6 +62,46 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("min_count")));
   }
 
+  template <typename Algorithm>
+  class_<TiledThreshold<Algorithm>, boost::noncopyable> tiled_threshold_wrapper(
+    const char *name) {
+    typedef TiledThreshold<Algorithm> tiled_type;
+    return class_<tiled_type, boost::noncopyable>(name, no_init)
+      .def(init<int2, int2, double, double, double, int, int2, std::size_t>(
+        (arg("image_size"),
+         arg("kernel_size"),
+         arg("nsig_b"),
+         arg("nsig_s"),
+         arg("threshold"),
+         arg("min_count"),
+         arg("tile_size"),
+         arg("nthreads") = 1)))
+      .def("num_tiles", &tiled_type::num_tiles)
+      .def("nthreads", &tiled_type::nthreads)
+      .def("tile_size", &tiled_type::tile_size)
+      .def("__call__", &tiled_type::template threshold<double>)
+      .def("__call__", &tiled_type::template threshold_w_gain<double>);
+  }
+
+  template <typename Algorithm>
+  class_<BatchThreshold<Algorithm>, boost::noncopyable> batch_threshold_wrapper(
+    const char *name) {
+    typedef BatchThreshold<Algorithm> batch_type;
+    return class_<batch_type, boost::noncopyable>(name, no_init)
+      .def(init<int2, int2, double, double, double, int, std::size_t>(
+        (arg("image_size"),
+         arg("kernel_size"),
+         arg("nsig_b"),
+         arg("nsig_s"),
+         arg("threshold"),
+         arg("min_count"),
+         arg("nthreads") = 1)))
+      .def("image_size", &batch_type::image_size)
+      .def("nthreads", &batch_type::nthreads)
+      .def("__call__", &batch_type::template threshold<double>)
+      .def("__call__", &batch_type::template threshold_w_gain<double>);
+  }
+
   void export_local() {
     local_threshold_suite<float>();
     local_threshold_suite<double>();
@@ -69,7 +111,18 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__call__", &DispersionThreshold::threshold<int>)
       .def("__call__", &DispersionThreshold::threshold<double>)
       .def("__call__", &DispersionThreshold::threshold_w_gain<int>)
-      .def("__call__", &DispersionThreshold::threshold_w_gain<double>);
+      .def("__call__", &DispersionThreshold::threshold_w_gain<double>)
+      .def("threshold_w_gain_and_pedestal",
+           &DispersionThreshold::threshold_w_gain_and_pedestal<int>)
+      .def("threshold_w_gain_and_pedestal",
+           &DispersionThreshold::threshold_w_gain_and_pedestal<double>)
+      .def("threshold_runs", &DispersionThreshold::threshold_runs<int>)
+      .def("threshold_runs", &DispersionThreshold::threshold_runs<double>)
+      .def("threshold_runs", &DispersionThreshold::threshold_runs_w_gain<int>)
+      .def("threshold_runs", &DispersionThreshold::threshold_runs_w_gain<double>)
+      .add_property("simd_level",
+                    &DispersionThreshold::simd_level,
+                    &DispersionThreshold::set_simd_level);
 
     class_<DispersionThresholdDebug>("DispersionThresholdDebug", no_init)
       .def(init<const af::const_ref<double, af::c_grid<2> > &,
@@ -153,6 +206,18 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__call__", &DispersionExtendedThreshold::threshold<double>)
       /* .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<int>) */
       .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<double>);
+
+    tiled_threshold_wrapper<DispersionThreshold>("TiledDispersionThreshold")
+      .def("__call__", &TiledThreshold<DispersionThreshold>::threshold<int>)
+      .def("__call__", &TiledThreshold<DispersionThreshold>::threshold_w_gain<int>);
+    tiled_threshold_wrapper<DispersionExtendedThreshold>(
+      "TiledDispersionExtendedThreshold");
+
+    batch_threshold_wrapper<DispersionThreshold>("BatchDispersionThreshold")
+      .def("__call__", &BatchThreshold<DispersionThreshold>::threshold<int>)
+      .def("__call__", &BatchThreshold<DispersionThreshold>::threshold_w_gain<int>);
+    batch_threshold_wrapper<DispersionExtendedThreshold>(
+      "BatchDispersionExtendedThreshold");
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -21,6 +21,24 @@ namespace dials { namespace algorithms { namespace boost_python {
     def("probability_distribution",
         &probability_distribution,
         (arg("image"), arg("range")));
+
+    void (UnimodalHistogram::*add_image)(
+      const af::const_ref<int, af::c_grid<2> > &, std::size_t) =
+      &UnimodalHistogram::add;
+    void (UnimodalHistogram::*add_masked_image)(
+      const af::const_ref<int, af::c_grid<2> > &,
+      const af::const_ref<bool, af::c_grid<2> > &,
+      std::size_t) = &UnimodalHistogram::add;
+
+    class_<UnimodalHistogram>("UnimodalHistogram", no_init)
+      .def(init<int2>((arg("range"))))
+      .def("add", add_image, (arg("image"), arg("nthreads") = 1))
+      .def("add", add_masked_image, (arg("image"), arg("mask"), arg("nthreads") = 1))
+      .def("merge", &UnimodalHistogram::merge)
+      .def("count", &UnimodalHistogram::count)
+      .def("histogram", &UnimodalHistogram::histogram)
+      .def("probability_distribution", &UnimodalHistogram::probability_distribution)
+      .def("threshold", &UnimodalHistogram::threshold);
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,514 @@
+/*
+ * dispersion_simd.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_DISPERSION_SIMD_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_DISPERSION_SIMD_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+  && defined(__x86_64__) && !defined(DIALS_NO_SIMD)
+#define DIALS_DISPERSION_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace dials { namespace algorithms { namespace detail {
+
+  /**
+   * The instruction set used by the vectorized dispersion kernels
+   */
+  enum DispersionSimdLevel {
+    DispersionSimdNone = 0,
+    DispersionSimdAVX2 = 1,
+    DispersionSimdAVX512 = 2,
+  };
+
+  /**
+   * Check the CPU at runtime for the best supported instruction set
+   * @returns The simd level
+   */
+  inline DispersionSimdLevel dispersion_simd_level() {
+#ifdef DIALS_DISPERSION_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return DispersionSimdAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return DispersionSimdAVX2;
+    }
+#endif
+    return DispersionSimdNone;
+  }
+
+  /**
+   * The summed area table stored as structure of arrays. The memory is owned
+   * by the caller; the table just points into it.
+   */
+  struct DispersionSATView {
+    int *m;
+    double *x;
+    double *y;
+
+    /**
+     * @returns The number of bytes needed for a table of n elements
+     */
+    static std::size_t required_bytes(std::size_t n) {
+      return n * (sizeof(int) + 2 * sizeof(double)) + 2 * sizeof(double);
+    }
+
+    /**
+     * Point the table at a buffer with at least required_bytes(n) bytes
+     */
+    DispersionSATView(char *buffer, std::size_t n) {
+      // Put the doubles first so they stay naturally aligned
+      std::size_t offset = reinterpret_cast<std::size_t>(buffer) % sizeof(double);
+      char *base = buffer + (offset ? sizeof(double) - offset : 0);
+      x = reinterpret_cast<double *>(base);
+      y = x + n;
+      m = reinterpret_cast<int *>(y + n);
+    }
+  };
+
+  /**
+   * Compute the summed area table in structure of arrays form. The row
+   * prefix sums are accumulated in the same order as the scalar code so the
+   * floating point results are identical; the vertical accumulation is then
+   * done as a separate, vectorizable pass.
+   */
+  inline void dispersion_sat_soa(DispersionSATView table,
+                                 const double *src,
+                                 const bool *mask,
+                                 std::size_t ysize,
+                                 std::size_t xsize) {
+    const double BIG = (1 << 24);
+    for (std::size_t j = 0, k = 0; j < ysize; ++j) {
+      int m = 0;
+      double x = 0;
+      double y = 0;
+      std::size_t k0 = k;
+      for (std::size_t i = 0; i < xsize; ++i, ++k) {
+        int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
+        m += mm;
+        x += mm * src[k];
+        y += mm * src[k] * src[k];
+        table.m[k] = m;
+        table.x[k] = x;
+        table.y[k] = y;
+      }
+      if (j > 0) {
+        int *cm = table.m + k0;
+        double *cx = table.x + k0;
+        double *cy = table.y + k0;
+        const int *pm = cm - xsize;
+        const double *px = cx - xsize;
+        const double *py = cy - xsize;
+        for (std::size_t i = 0; i < xsize; ++i) {
+          cm[i] = pm[i] + cm[i];
+          cx[i] = px[i] + cx[i];
+          cy[i] = py[i] + cy[i];
+        }
+      }
+    }
+  }
+
+  /**
+   * Compute the summed area table from a raw image in the same pass as the
+   * conversion to double and the pedestal correction. The corrected image is
+   * written to dst so that it can be used by the threshold pass; the table is
+   * identical to that from dispersion_sat_soa on the corrected image.
+   * @param pedestal The pedestal map (or null for no pedestal)
+   */
+  template <typename T>
+  void dispersion_sat_soa_corrected(DispersionSATView table,
+                                    const T *raw,
+                                    const double *pedestal,
+                                    const bool *mask,
+                                    double *dst,
+                                    std::size_t ysize,
+                                    std::size_t xsize) {
+    const double BIG = (1 << 24);
+    for (std::size_t j = 0, k = 0; j < ysize; ++j) {
+      int m = 0;
+      double x = 0;
+      double y = 0;
+      std::size_t k0 = k;
+      for (std::size_t i = 0; i < xsize; ++i, ++k) {
+        double s = pedestal == 0 ? (double)raw[k] : (double)raw[k] - pedestal[k];
+        int mm = (mask[k] && s < BIG) ? 1 : 0;
+        dst[k] = s;
+        m += mm;
+        x += mm * s;
+        y += mm * s * s;
+        table.m[k] = m;
+        table.x[k] = x;
+        table.y[k] = y;
+      }
+      if (j > 0) {
+        int *cm = table.m + k0;
+        double *cx = table.x + k0;
+        double *cy = table.y + k0;
+        const int *pm = cm - xsize;
+        const double *px = cx - xsize;
+        const double *py = cy - xsize;
+        for (std::size_t i = 0; i < xsize; ++i) {
+          cm[i] = pm[i] + cm[i];
+          cx[i] = px[i] + cx[i];
+          cy[i] = py[i] + cy[i];
+        }
+      }
+    }
+  }
+
+  /**
+   * Per-pixel scalar evaluation used for the borders of the image and as the
+   * fallback when no vector unit is available. This mirrors the arithmetic
+   * of DispersionThreshold::compute_threshold exactly.
+   */
+  struct DispersionScalarKernel {
+    int kxsize;
+    int kysize;
+    int min_count;
+    double nsig_b;
+    double nsig_s;
+    double threshold;
+
+    void sums(const DispersionSATView &table,
+              std::size_t xsize,
+              std::size_t ysize,
+              std::size_t j,
+              std::size_t i,
+              double &m,
+              double &x,
+              double &y) const {
+      int i0 = i - kxsize - 1, i1 = i + kxsize;
+      int j0 = j - kysize - 1, j1 = j + kysize;
+      i1 = i1 < xsize ? i1 : xsize - 1;
+      j1 = j1 < ysize ? j1 : ysize - 1;
+      int k0 = j0 * xsize;
+      int k1 = j1 * xsize;
+      m = 0;
+      x = 0;
+      y = 0;
+      if (i0 >= 0 && j0 >= 0) {
+        m += table.m[k0 + i0] - (table.m[k1 + i0] + table.m[k0 + i1]);
+        x += table.x[k0 + i0] - (table.x[k1 + i0] + table.x[k0 + i1]);
+        y += table.y[k0 + i0] - (table.y[k1 + i0] + table.y[k0 + i1]);
+      } else if (i0 >= 0) {
+        m -= table.m[k1 + i0];
+        x -= table.x[k1 + i0];
+        y -= table.y[k1 + i0];
+      } else if (j0 >= 0) {
+        m -= table.m[k0 + i1];
+        x -= table.x[k0 + i1];
+        y -= table.y[k0 + i1];
+      }
+      m += table.m[k1 + i1];
+      x += table.x[k1 + i1];
+      y += table.y[k1 + i1];
+    }
+
+    bool pixel(double m, double x, double y, double s, bool mask) const {
+      if (mask && m >= min_count && x >= 0 && s > threshold) {
+        double a = m * y - x * x - x * (m - 1);
+        double b = m * s - x;
+        double c = x * nsig_b * std::sqrt(2 * (m - 1));
+        double d = nsig_s * std::sqrt(x * m);
+        return a > c && b > d;
+      }
+      return false;
+    }
+
+    bool pixel(double m, double x, double y, double s, double g, bool mask) const {
+      if (mask && m >= min_count && x >= 0 && s > threshold) {
+        double a = m * y - x * x;
+        double b = m * s - x;
+        double c = g * x * (m - 1 + nsig_b * std::sqrt(2 * (m - 1)));
+        double d = nsig_s * std::sqrt(g * x * m);
+        return a > c && b > d;
+      }
+      return false;
+    }
+
+    void row(const DispersionSATView &table,
+             const double *src,
+             const bool *mask,
+             const double *gain,
+             bool *dst_row,
+             std::size_t xsize,
+             std::size_t ysize,
+             std::size_t j,
+             std::size_t ibegin,
+             std::size_t iend) const {
+      for (std::size_t i = ibegin; i < iend; ++i) {
+        std::size_t k = j * xsize + i;
+        double m, x, y;
+        sums(table, xsize, ysize, j, i, m, x, y);
+        dst_row[i] = gain == 0 ? pixel(m, x, y, src[k], mask[k])
+                               : pixel(m, x, y, src[k], gain[k], mask[k]);
+      }
+    }
+  };
+
+#ifdef DIALS_DISPERSION_SIMD
+
+  /**
+   * Evaluate the interior of a row with AVX2. In the interior all four
+   * corners of the kernel are inside the table so the computation is branch
+   * free; the test results are combined as bit masks.
+   * @returns The first index not processed
+   */
+  __attribute__((target("avx2"))) inline std::size_t dispersion_row_avx2(
+    const DispersionScalarKernel &kernel,
+    const DispersionSATView &table,
+    const double *src,
+    const bool *mask,
+    const double *gain,
+    bool *dst_row,
+    std::size_t xsize,
+    std::size_t k0,
+    std::size_t k1,
+    std::size_t k,
+    std::size_t ibegin,
+    std::size_t iend) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d min_count = _mm256_set1_pd(kernel.min_count);
+    const __m256d threshold = _mm256_set1_pd(kernel.threshold);
+    const __m256d nsig_b = _mm256_set1_pd(kernel.nsig_b);
+    const __m256d nsig_s = _mm256_set1_pd(kernel.nsig_s);
+    const std::size_t dlo = kernel.kxsize + 1;
+    const std::size_t dhi = kernel.kxsize;
+    std::size_t i = ibegin;
+    for (; i + 4 <= iend; i += 4) {
+      std::size_t a0 = i - dlo;
+      std::size_t a1 = i + dhi;
+
+      // Corner sums of the mask count, computed in integer arithmetic
+      __m128i m00 = _mm_loadu_si128((const __m128i *)(table.m + k0 + a0));
+      __m128i m10 = _mm_loadu_si128((const __m128i *)(table.m + k1 + a0));
+      __m128i m01 = _mm_loadu_si128((const __m128i *)(table.m + k0 + a1));
+      __m128i m11 = _mm_loadu_si128((const __m128i *)(table.m + k1 + a1));
+      __m256d m = _mm256_cvtepi32_pd(_mm_sub_epi32(m00, _mm_add_epi32(m10, m01)));
+      m = _mm256_add_pd(m, _mm256_cvtepi32_pd(m11));
+
+      // Corner sums of the values and the squared values
+      __m256d x = _mm256_sub_pd(_mm256_loadu_pd(table.x + k0 + a0),
+                                _mm256_add_pd(_mm256_loadu_pd(table.x + k1 + a0),
+                                              _mm256_loadu_pd(table.x + k0 + a1)));
+      x = _mm256_add_pd(_mm256_add_pd(zero, x), _mm256_loadu_pd(table.x + k1 + a1));
+      __m256d y = _mm256_sub_pd(_mm256_loadu_pd(table.y + k0 + a0),
+                                _mm256_add_pd(_mm256_loadu_pd(table.y + k1 + a0),
+                                              _mm256_loadu_pd(table.y + k0 + a1)));
+      y = _mm256_add_pd(_mm256_add_pd(zero, y), _mm256_loadu_pd(table.y + k1 + a1));
+
+      // The mask as a lane mask
+      int mbytes = 0;
+      std::memcpy(&mbytes, mask + k + i, 4);
+      __m256i mi = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(mbytes));
+      __m256d valid = _mm256_castsi256_pd(_mm256_cmpgt_epi64(mi, _mm256_setzero_si256()));
+
+      // Prefilter
+      __m256d s = _mm256_loadu_pd(src + k + i);
+      valid = _mm256_and_pd(valid, _mm256_cmp_pd(m, min_count, _CMP_GE_OQ));
+      valid = _mm256_and_pd(valid, _mm256_cmp_pd(x, zero, _CMP_GE_OQ));
+      valid = _mm256_and_pd(valid, _mm256_cmp_pd(s, threshold, _CMP_GT_OQ));
+
+      // The dispersion and strong pixel tests
+      __m256d m1 = _mm256_sub_pd(m, one);
+      __m256d sq = _mm256_sqrt_pd(_mm256_mul_pd(two, m1));
+      __m256d a, b, c, d;
+      if (gain == 0) {
+        a = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(m, y), _mm256_mul_pd(x, x)),
+                          _mm256_mul_pd(x, m1));
+        b = _mm256_sub_pd(_mm256_mul_pd(m, s), x);
+        c = _mm256_mul_pd(_mm256_mul_pd(x, nsig_b), sq);
+        d = _mm256_mul_pd(nsig_s, _mm256_sqrt_pd(_mm256_mul_pd(x, m)));
+      } else {
+        __m256d g = _mm256_loadu_pd(gain + k + i);
+        __m256d gx = _mm256_mul_pd(g, x);
+        a = _mm256_sub_pd(_mm256_mul_pd(m, y), _mm256_mul_pd(x, x));
+        b = _mm256_sub_pd(_mm256_mul_pd(m, s), x);
+        c = _mm256_mul_pd(gx, _mm256_add_pd(m1, _mm256_mul_pd(nsig_b, sq)));
+        d = _mm256_mul_pd(nsig_s, _mm256_sqrt_pd(_mm256_mul_pd(gx, m)));
+      }
+      valid = _mm256_and_pd(valid, _mm256_cmp_pd(a, c, _CMP_GT_OQ));
+      valid = _mm256_and_pd(valid, _mm256_cmp_pd(b, d, _CMP_GT_OQ));
+      int bits = _mm256_movemask_pd(valid);
+      dst_row[i + 0] = (bits >> 0) & 1;
+      dst_row[i + 1] = (bits >> 1) & 1;
+      dst_row[i + 2] = (bits >> 2) & 1;
+      dst_row[i + 3] = (bits >> 3) & 1;
+    }
+    return i;
+  }
+
+  /**
+   * Evaluate the interior of a row with AVX-512.
+   * @returns The first index not processed
+   */
+  __attribute__((target("avx512f"))) inline std::size_t dispersion_row_avx512(
+    const DispersionScalarKernel &kernel,
+    const DispersionSATView &table,
+    const double *src,
+    const bool *mask,
+    const double *gain,
+    bool *dst_row,
+    std::size_t xsize,
+    std::size_t k0,
+    std::size_t k1,
+    std::size_t k,
+    std::size_t ibegin,
+    std::size_t iend) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d min_count = _mm512_set1_pd(kernel.min_count);
+    const __m512d threshold = _mm512_set1_pd(kernel.threshold);
+    const __m512d nsig_b = _mm512_set1_pd(kernel.nsig_b);
+    const __m512d nsig_s = _mm512_set1_pd(kernel.nsig_s);
+    const std::size_t dlo = kernel.kxsize + 1;
+    const std::size_t dhi = kernel.kxsize;
+    std::size_t i = ibegin;
+    for (; i + 8 <= iend; i += 8) {
+      std::size_t a0 = i - dlo;
+      std::size_t a1 = i + dhi;
+
+      // Corner sums of the mask count, computed in integer arithmetic
+      __m256i m00 = _mm256_loadu_si256((const __m256i *)(table.m + k0 + a0));
+      __m256i m10 = _mm256_loadu_si256((const __m256i *)(table.m + k1 + a0));
+      __m256i m01 = _mm256_loadu_si256((const __m256i *)(table.m + k0 + a1));
+      __m256i m11 = _mm256_loadu_si256((const __m256i *)(table.m + k1 + a1));
+      __m256i msum = _mm256_sub_epi32(m00, _mm256_add_epi32(m10, m01));
+      __m512d m = _mm512_add_pd(_mm512_cvtepi32_pd(msum), _mm512_cvtepi32_pd(m11));
+
+      // Corner sums of the values and the squared values
+      __m512d x = _mm512_sub_pd(_mm512_loadu_pd(table.x + k0 + a0),
+                                _mm512_add_pd(_mm512_loadu_pd(table.x + k1 + a0),
+                                              _mm512_loadu_pd(table.x + k0 + a1)));
+      x = _mm512_add_pd(_mm512_add_pd(zero, x), _mm512_loadu_pd(table.x + k1 + a1));
+      __m512d y = _mm512_sub_pd(_mm512_loadu_pd(table.y + k0 + a0),
+                                _mm512_add_pd(_mm512_loadu_pd(table.y + k1 + a0),
+                                              _mm512_loadu_pd(table.y + k0 + a1)));
+      y = _mm512_add_pd(_mm512_add_pd(zero, y), _mm512_loadu_pd(table.y + k1 + a1));
+
+      // The mask as a lane mask
+      long long mbytes = 0;
+      std::memcpy(&mbytes, mask + k + i, 8);
+      __m512i mi = _mm512_cvtepu8_epi64(_mm_cvtsi64_si128(mbytes));
+      __mmask8 valid = _mm512_test_epi64_mask(mi, mi);
+
+      // Prefilter
+      __m512d s = _mm512_loadu_pd(src + k + i);
+      valid = _mm512_mask_cmp_pd_mask(valid, m, min_count, _CMP_GE_OQ);
+      valid = _mm512_mask_cmp_pd_mask(valid, x, zero, _CMP_GE_OQ);
+      valid = _mm512_mask_cmp_pd_mask(valid, s, threshold, _CMP_GT_OQ);
+
+      // The dispersion and strong pixel tests
+      __m512d m1 = _mm512_sub_pd(m, one);
+      __m512d sq = _mm512_sqrt_pd(_mm512_mul_pd(two, m1));
+      __m512d a, b, c, d;
+      if (gain == 0) {
+        a = _mm512_sub_pd(_mm512_sub_pd(_mm512_mul_pd(m, y), _mm512_mul_pd(x, x)),
+                          _mm512_mul_pd(x, m1));
+        b = _mm512_sub_pd(_mm512_mul_pd(m, s), x);
+        c = _mm512_mul_pd(_mm512_mul_pd(x, nsig_b), sq);
+        d = _mm512_mul_pd(nsig_s, _mm512_sqrt_pd(_mm512_mul_pd(x, m)));
+      } else {
+        __m512d g = _mm512_loadu_pd(gain + k + i);
+        __m512d gx = _mm512_mul_pd(g, x);
+        a = _mm512_sub_pd(_mm512_mul_pd(m, y), _mm512_mul_pd(x, x));
+        b = _mm512_sub_pd(_mm512_mul_pd(m, s), x);
+        c = _mm512_mul_pd(gx, _mm512_add_pd(m1, _mm512_mul_pd(nsig_b, sq)));
+        d = _mm512_mul_pd(nsig_s, _mm512_sqrt_pd(_mm512_mul_pd(gx, m)));
+      }
+      valid = _mm512_mask_cmp_pd_mask(valid, a, c, _CMP_GT_OQ);
+      valid = _mm512_mask_cmp_pd_mask(valid, b, d, _CMP_GT_OQ);
+      for (std::size_t l = 0; l < 8; ++l) {
+        dst_row[i + l] = (valid >> l) & 1;
+      }
+    }
+    return i;
+  }
+
+#endif
+
+  /**
+   * Compute one row of the dispersion threshold from a structure of arrays
+   * summed area table. Columns where the kernel overlaps the edge of the
+   * image, and rows where it overlaps the top of the image, are done with the
+   * scalar kernel; the interior is done with the vector kernel for the
+   * requested instruction set.
+   * @param gain The gain map (or null for unit gain)
+   * @param dst_row The output for row j
+   */
+  inline void dispersion_threshold_soa_row(const DispersionScalarKernel &kernel,
+                                           DispersionSimdLevel level,
+                                           const DispersionSATView &table,
+                                           const double *src,
+                                           const bool *mask,
+                                           const double *gain,
+                                           bool *dst_row,
+                                           std::size_t ysize,
+                                           std::size_t xsize,
+                                           std::size_t j) {
+    // The range of columns where all the kernel corners are in the table
+    std::size_t ibegin = kernel.kxsize + 1;
+    std::size_t iend = xsize > (std::size_t)kernel.kxsize ? xsize - kernel.kxsize : 0;
+    if (iend < ibegin) {
+      ibegin = iend = xsize;
+    }
+    int j0 = j - kernel.kysize - 1;
+    if (j0 < 0 || level == DispersionSimdNone) {
+      kernel.row(table, src, mask, gain, dst_row, xsize, ysize, j, 0, xsize);
+      return;
+    }
+    std::size_t j1 = j + kernel.kysize;
+    j1 = j1 < ysize ? j1 : ysize - 1;
+    std::size_t k0 = j0 * xsize;
+    std::size_t k1 = j1 * xsize;
+    std::size_t k = j * xsize;
+    std::size_t i = ibegin;
+    kernel.row(table, src, mask, gain, dst_row, xsize, ysize, j, 0, ibegin);
+#ifdef DIALS_DISPERSION_SIMD
+    if (level == DispersionSimdAVX512) {
+      i = dispersion_row_avx512(
+        kernel, table, src, mask, gain, dst_row, xsize, k0, k1, k, ibegin, iend);
+    } else {
+      i = dispersion_row_avx2(
+        kernel, table, src, mask, gain, dst_row, xsize, k0, k1, k, ibegin, iend);
+    }
+#endif
+    kernel.row(table, src, mask, gain, dst_row, xsize, ysize, j, i, xsize);
+  }
+
+  /**
+   * Compute the dispersion threshold from a structure of arrays summed area
+   * table for the whole image.
+   * @param gain The gain map (or null for unit gain)
+   */
+  inline void dispersion_threshold_soa(const DispersionScalarKernel &kernel,
+                                       DispersionSimdLevel level,
+                                       const DispersionSATView &table,
+                                       const double *src,
+                                       const bool *mask,
+                                       const double *gain,
+                                       bool *dst,
+                                       std::size_t ysize,
+                                       std::size_t xsize) {
+    for (std::size_t j = 0; j < ysize; ++j) {
+      dispersion_threshold_soa_row(
+        kernel, level, table, src, mask, gain, dst + j * xsize, ysize, xsize, j);
+    }
+  }
+
+}}}  // namespace dials::algorithms::detail
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_DISPERSION_SIMD_H
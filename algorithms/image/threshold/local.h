@@ -11,15 +11,20 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 #define DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include <boost/scoped_array.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/error.h>
+#include <dials/util/profile.h>
+#include <dials/model/data/strong_pixel_runs.h>
 #include <dials/algorithms/image/filter/mean_and_variance.h>
 #include <dials/algorithms/image/filter/index_of_dispersion_filter.h>
 #include <dials/algorithms/image/filter/distance.h>
+#include <dials/algorithms/image/threshold/dispersion_simd.h>
 
 namespace dials { namespace algorithms {
 
@@ -371,7 +376,9 @@ namespace dials { namespace algorithms {
           nsig_b_(nsig_b),
           nsig_s_(nsig_s),
           threshold_(threshold),
-          min_count_(min_count) {
+          min_count_(min_count),
+          max_simd_level_(detail::dispersion_simd_level()),
+          simd_level_(max_simd_level_) {
       // Check the input
       DIALS_ASSERT(threshold_ >= 0);
       DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
@@ -386,9 +393,40 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(min_count_ <= num_kernel && min_count_ > 1);
       }
 
-      // Allocate the buffer
+      // Allocate the buffer. This is shared between the array of structs table
+      // used by the scalar code and the struct of arrays table used by the
+      // vectorized code.
+      std::size_t num_pixels = image_size[0] * image_size[1];
       std::size_t element_size = sizeof(Data<double>);
-      buffer_.resize(element_size * image_size[0] * image_size[1]);
+      buffer_.resize(std::max(element_size * num_pixels,
+                              detail::DispersionSATView::required_bytes(num_pixels)));
+    }
+
+    /**
+     * The threshold at a pixel only depends on the pixels under the kernel.
+     * @param kernel_size The size of the kernel
+     * @returns The width of the halo needed to threshold part of the image
+     */
+    static int2 halo(int2 kernel_size) {
+      return kernel_size;
+    }
+
+    /**
+     * @returns The instruction set level used by the vectorized kernel
+     */
+    int simd_level() const {
+      return simd_level_;
+    }
+
+    /**
+     * Set the instruction set level used by the vectorized kernel. Values
+     * higher than the level supported by the CPU are clamped; zero selects
+     * the scalar code.
+     * @param level The simd level
+     */
+    void set_simd_level(int level) {
+      DIALS_ASSERT(level >= 0);
+      simd_level_ = (detail::DispersionSimdLevel)std::min(level, (int)max_simd_level_);
     }
 
     /**
@@ -584,11 +622,18 @@ namespace dials { namespace algorithms {
     void threshold(const af::const_ref<T, af::c_grid<2> > &src,
                    const af::const_ref<bool, af::c_grid<2> > &mask,
                    af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
+      // Use the vectorized kernel if we can
+      if (threshold_simd(src, mask, NULL, dst)) {
+        return;
+      }
+
       // Get the table
       DIALS_ASSERT(sizeof(T) <= sizeof(double));
 
@@ -614,12 +659,19 @@ namespace dials { namespace algorithms {
                           const af::const_ref<bool, af::c_grid<2> > &mask,
                           const af::const_ref<double, af::c_grid<2> > &gain,
                           af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
+      // Use the vectorized kernel if we can
+      if (threshold_simd(src, mask, &gain[0], dst)) {
+        return;
+      }
+
       // Get the table
       DIALS_ASSERT(sizeof(T) <= sizeof(double));
 
@@ -633,14 +685,201 @@ namespace dials { namespace algorithms {
       compute_threshold(table, src, mask, gain, dst);
     }
 
+    /**
+     * Compute the threshold for a raw detector image. The conversion to
+     * double, the pedestal subtraction and the summed area table are done in
+     * a single pass over the image so no corrected copy of the image needs to
+     * be made by the caller. The result is the same as calling
+     * threshold_w_gain with the pedestal corrected image.
+     * @param src - The raw image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param pedestal - The pedestal array
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain_and_pedestal(
+      const af::const_ref<T, af::c_grid<2> > &src,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      const af::const_ref<double, af::c_grid<2> > &gain,
+      const af::const_ref<double, af::c_grid<2> > &pedestal,
+      af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+
+      // check the input
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(pedestal.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+
+      // The corrected image is kept between calls
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      corrected_.resize(xsize * ysize);
+
+      // Compute the summed area table and the threshold. The scalar kernel is
+      // used for all pixels if the vectorized kernel is disabled.
+      detail::DispersionSATView table(&buffer_[0], xsize * ysize);
+      detail::DispersionScalarKernel kernel = {
+        kernel_size_[1], kernel_size_[0], min_count_, nsig_b_, nsig_s_, threshold_};
+      detail::dispersion_sat_soa_corrected(
+        table, &src[0], &pedestal[0], &mask[0], &corrected_[0], ysize, xsize);
+      detail::dispersion_threshold_soa(kernel,
+                                       simd_level_,
+                                       table,
+                                       &corrected_[0],
+                                       &mask[0],
+                                       &gain[0],
+                                       &dst[0],
+                                       ysize,
+                                       xsize);
+    }
+
+    /**
+     * Compute the threshold for the given image and mask and write the strong
+     * pixels as runs. The threshold is computed a row at a time so the dense
+     * output mask is never created.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param dst - The strong pixel runs.
+     */
+    template <typename T>
+    void threshold_runs(const af::const_ref<T, af::c_grid<2> > &src,
+                        const af::const_ref<bool, af::c_grid<2> > &mask,
+                        model::StrongPixelRuns &dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+      compute_runs(src, mask, NULL, dst);
+    }
+
+    /**
+     * Compute the threshold for the given image and mask and write the strong
+     * pixels as runs.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param dst - The strong pixel runs.
+     */
+    template <typename T>
+    void threshold_runs_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
+                               const af::const_ref<bool, af::c_grid<2> > &mask,
+                               const af::const_ref<double, af::c_grid<2> > &gain,
+                               model::StrongPixelRuns &dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+      compute_runs(src, mask, &gain[0], dst);
+    }
+
   private:
+    /**
+     * Compute the struct of arrays summed area table for an image. Images
+     * which are not double are converted in the same pass.
+     * @returns A pointer to the image as double
+     */
+    template <typename T>
+    const double *compute_sat_soa(detail::DispersionSATView table,
+                                  const af::const_ref<T, af::c_grid<2> > &src,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask) {
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      corrected_.resize(xsize * ysize);
+      detail::dispersion_sat_soa_corrected(
+        table, &src[0], (const double *)0, &mask[0], &corrected_[0], ysize, xsize);
+      return &corrected_[0];
+    }
+
+    /**
+     * Compute the struct of arrays summed area table for a double image.
+     * @returns A pointer to the image
+     */
+    const double *compute_sat_soa(detail::DispersionSATView table,
+                                  const af::const_ref<double, af::c_grid<2> > &src,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask) {
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      detail::dispersion_sat_soa(table, &src[0], &mask[0], ysize, xsize);
+      return &src[0];
+    }
+
+    /**
+     * Compute the threshold a row at a time and encode each row as runs.
+     */
+    template <typename T>
+    void compute_runs(const af::const_ref<T, af::c_grid<2> > &src,
+                      const af::const_ref<bool, af::c_grid<2> > &mask,
+                      const double *gain,
+                      model::StrongPixelRuns &dst) {
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      detail::DispersionSATView table(&buffer_[0], xsize * ysize);
+      detail::DispersionScalarKernel kernel = {
+        kernel_size_[1], kernel_size_[0], min_count_, nsig_b_, nsig_s_, threshold_};
+      const double *values = compute_sat_soa(table, src, mask);
+      boost::scoped_array<bool> row(new bool[xsize]);
+      dst.reset(image_size_);
+      for (std::size_t j = 0; j < ysize; ++j) {
+        detail::dispersion_threshold_soa_row(
+          kernel, simd_level_, table, values, &mask[0], gain, row.get(), ysize, xsize, j);
+        dst.add_row(j, row.get());
+      }
+    }
+
+    /**
+     * The vectorized kernel is only implemented for double images.
+     * @returns False
+     */
+    template <typename T>
+    bool threshold_simd(const af::const_ref<T, af::c_grid<2> > &src,
+                        const af::const_ref<bool, af::c_grid<2> > &mask,
+                        const double *gain,
+                        af::ref<bool, af::c_grid<2> > dst) {
+      return false;
+    }
+
+    /**
+     * Compute the threshold using a struct of arrays summed area table and the
+     * vectorized kernel. The result is identical to the scalar code.
+     * @returns True if the threshold was computed
+     */
+    bool threshold_simd(const af::const_ref<double, af::c_grid<2> > &src,
+                        const af::const_ref<bool, af::c_grid<2> > &mask,
+                        const double *gain,
+                        af::ref<bool, af::c_grid<2> > dst) {
+      if (simd_level_ == detail::DispersionSimdNone) {
+        return false;
+      }
+      std::size_t ysize = src.accessor()[0];
+      std::size_t xsize = src.accessor()[1];
+      detail::DispersionSATView table(&buffer_[0], xsize * ysize);
+      detail::DispersionScalarKernel kernel = {
+        kernel_size_[1], kernel_size_[0], min_count_, nsig_b_, nsig_s_, threshold_};
+      detail::dispersion_sat_soa(table, &src[0], &mask[0], ysize, xsize);
+      detail::dispersion_threshold_soa(kernel,
+                                       simd_level_,
+                                       table,
+                                       &src[0],
+                                       &mask[0],
+                                       gain,
+                                       &dst[0],
+                                       ysize,
+                                       xsize);
+      return true;
+    }
+
     int2 image_size_;
     int2 kernel_size_;
     double nsig_b_;
     double nsig_s_;
     double threshold_;
     int min_count_;
+    detail::DispersionSimdLevel max_simd_level_;
+    detail::DispersionSimdLevel simd_level_;
     std::vector<char> buffer_;
+    std::vector<double> corrected_;
   };
 
   /**
@@ -995,6 +1234,19 @@ namespace dials { namespace algorithms {
       buffer_.resize(element_size * image_size[0] * image_size[1]);
     }
 
+    /**
+     * The final threshold at a pixel depends on the eroded dispersion mask
+     * under the widened kernel, which in turn depends on the dispersion mask
+     * within the erosion distance and the pixels under the kernel.
+     * @param kernel_size The size of the kernel
+     * @returns The width of the halo needed to threshold part of the image
+     */
+    static int2 halo(int2 kernel_size) {
+      int erosion_distance = std::min(kernel_size[0], kernel_size[1]);
+      return int2(2 * kernel_size[0] + 2 + erosion_distance,
+                  2 * kernel_size[1] + 2 + erosion_distance);
+    }
+
     /**
      * Compute the summed area tables for the mask, src and src^2.
      * @param src The input array
@@ -1358,6 +1610,8 @@ namespace dials { namespace algorithms {
     void threshold(const af::const_ref<T, af::c_grid<2> > &src,
                    const af::const_ref<bool, af::c_grid<2> > &mask,
                    af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
@@ -1399,6 +1653,8 @@ namespace dials { namespace algorithms {
                           const af::const_ref<bool, af::c_grid<2> > &mask,
                           const af::const_ref<double, af::c_grid<2> > &gain,
                           af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_PROFILE_SCOPE("spot_finding.threshold");
+
       // check the input
       DIALS_ASSERT(src.accessor().all_eq(image_size_));
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
@@ -0,0 +1,251 @@
+/*
+ * tiled.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::af::int2;
+
+  /**
+   * Apply a local threshold algorithm to an image in tiles. Each tile is
+   * extended by a halo wide enough that the pixels in the core of the tile
+   * see exactly the same neighbourhood as they would in the full image. The
+   * halo is clipped at the edge of the image so the image boundaries are
+   * treated in the same way as the untiled algorithm. The tiles are processed
+   * in parallel on an internal thread pool.
+   *
+   * The algorithm must provide a static function halo(kernel_size) giving the
+   * width of the halo needed for the given kernel size.
+   */
+  template <typename Algorithm>
+  class TiledThreshold {
+  public:
+    /**
+     * Initialise the tiles
+     * @param image_size The size of the image
+     * @param kernel_size The size of the kernel
+     * @param nsig_b The background threshold
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels under the kernel
+     * @param tile_size The size of the core of each tile
+     * @param nthreads The number of threads to use
+     */
+    TiledThreshold(int2 image_size,
+                   int2 kernel_size,
+                   double nsig_b,
+                   double nsig_s,
+                   double threshold,
+                   int min_count,
+                   int2 tile_size,
+                   std::size_t nthreads)
+        : image_size_(image_size), tile_size_(tile_size), nthreads_(nthreads) {
+      DIALS_ASSERT(image_size.all_gt(0));
+      DIALS_ASSERT(tile_size.all_gt(0));
+      DIALS_ASSERT(nthreads > 0);
+
+      // Construct the tiles with the halo clipped to the image
+      int2 halo = Algorithm::halo(kernel_size);
+      for (int y0 = 0; y0 < image_size[0]; y0 += tile_size[0]) {
+        for (int x0 = 0; x0 < image_size[1]; x0 += tile_size[1]) {
+          Tile tile;
+          tile.y0 = y0;
+          tile.x0 = x0;
+          tile.y1 = std::min(y0 + tile_size[0], image_size[0]);
+          tile.x1 = std::min(x0 + tile_size[1], image_size[1]);
+          tile.oy0 = std::max(tile.y0 - halo[0], 0);
+          tile.ox0 = std::max(tile.x0 - halo[1], 0);
+          tile.oy1 = std::min(tile.y1 + halo[0], image_size[0]);
+          tile.ox1 = std::min(tile.x1 + halo[1], image_size[1]);
+          tile.algorithm = boost::make_shared<Algorithm>(
+            int2(tile.oy1 - tile.oy0, tile.ox1 - tile.ox0),
+            kernel_size,
+            nsig_b,
+            nsig_s,
+            threshold,
+            min_count);
+          tiles_.push_back(tile);
+        }
+      }
+
+      // Only start threads if they will be used
+      if (nthreads_ > 1 && tiles_.size() > 1) {
+        pool_ = boost::make_shared<dials::util::WorkStealingThreadPool>(
+          std::min(nthreads_, tiles_.size()));
+      }
+    }
+
+    /**
+     * @returns The number of tiles
+     */
+    std::size_t num_tiles() const {
+      return tiles_.size();
+    }
+
+    /**
+     * @returns The number of threads
+     */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
+    /**
+     * @returns The tile size
+     */
+    int2 tile_size() const {
+      return tile_size_;
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold(const af::const_ref<T, af::c_grid<2> > &src,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      run(src, mask, NULL, dst);
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<2> > dst) {
+      DIALS_ASSERT(src.accessor().all_eq(image_size_));
+      DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      run(src, mask, &gain, dst);
+    }
+
+  private:
+    /**
+     * A tile with its core region and the region including the halo
+     */
+    struct Tile {
+      int y0, y1, x0, x1;
+      int oy0, oy1, ox0, ox1;
+      boost::shared_ptr<Algorithm> algorithm;
+    };
+
+    /**
+     * The job to process a single tile. The tile is copied to contiguous
+     * arrays so the algorithm works on memory that fits in cache.
+     */
+    template <typename T>
+    class TileJob {
+    public:
+      TileJob(const Tile &tile,
+              const af::const_ref<T, af::c_grid<2> > &src,
+              const af::const_ref<bool, af::c_grid<2> > &mask,
+              const af::const_ref<double, af::c_grid<2> > *gain,
+              af::ref<bool, af::c_grid<2> > dst)
+          : tile_(tile), src_(src), mask_(mask), gain_(gain), dst_(dst) {}
+
+      void operator()() {
+        std::size_t xsize = src_.accessor()[1];
+        af::c_grid<2> grid(tile_.oy1 - tile_.oy0, tile_.ox1 - tile_.ox0);
+        af::versa<T, af::c_grid<2> > src(grid);
+        af::versa<bool, af::c_grid<2> > mask(grid);
+        af::versa<bool, af::c_grid<2> > dst(grid, false);
+        for (int j = tile_.oy0, k = 0; j < tile_.oy1; ++j) {
+          std::size_t offset = j * xsize + tile_.ox0;
+          for (int i = tile_.ox0; i < tile_.ox1; ++i, ++k, ++offset) {
+            src[k] = src_[offset];
+            mask[k] = mask_[offset];
+          }
+        }
+        if (gain_ == NULL) {
+          tile_.algorithm->threshold(src.const_ref(), mask.const_ref(), dst.ref());
+        } else {
+          af::versa<double, af::c_grid<2> > gain(grid);
+          for (int j = tile_.oy0, k = 0; j < tile_.oy1; ++j) {
+            std::size_t offset = j * xsize + tile_.ox0;
+            for (int i = tile_.ox0; i < tile_.ox1; ++i, ++k, ++offset) {
+              gain[k] = (*gain_)[offset];
+            }
+          }
+          tile_.algorithm->threshold_w_gain(
+            src.const_ref(), mask.const_ref(), gain.const_ref(), dst.ref());
+        }
+
+        // Only the core of the tile is written back
+        std::size_t txsize = grid[1];
+        for (int j = tile_.y0; j < tile_.y1; ++j) {
+          std::size_t k = (j - tile_.oy0) * txsize + (tile_.x0 - tile_.ox0);
+          std::size_t offset = j * xsize + tile_.x0;
+          for (int i = tile_.x0; i < tile_.x1; ++i, ++k, ++offset) {
+            dst_[offset] = dst[k];
+          }
+        }
+      }
+
+    private:
+      const Tile &tile_;
+      af::const_ref<T, af::c_grid<2> > src_;
+      af::const_ref<bool, af::c_grid<2> > mask_;
+      const af::const_ref<double, af::c_grid<2> > *gain_;
+      af::ref<bool, af::c_grid<2> > dst_;
+    };
+
+    /**
+     * Process all the tiles, in parallel if requested. Each tile writes a
+     * disjoint part of the output so no synchronisation is needed.
+     */
+    template <typename T>
+    void run(const af::const_ref<T, af::c_grid<2> > &src,
+             const af::const_ref<bool, af::c_grid<2> > &mask,
+             const af::const_ref<double, af::c_grid<2> > *gain,
+             af::ref<bool, af::c_grid<2> > dst) {
+      if (pool_ == NULL) {
+        for (std::size_t i = 0; i < tiles_.size(); ++i) {
+          TileJob<T>(tiles_[i], src, mask, gain, dst)();
+        }
+      } else {
+        for (std::size_t i = 0; i < tiles_.size(); ++i) {
+          pool_->post(TileJob<T>(tiles_[i], src, mask, gain, dst));
+        }
+        pool_->wait();
+      }
+    }
+
+    int2 image_size_;
+    int2 tile_size_;
+    std::size_t nthreads_;
+    std::vector<Tile> tiles_;
+    boost::shared_ptr<dials::util::WorkStealingThreadPool> pool_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
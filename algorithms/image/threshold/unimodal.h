@@ -11,11 +11,14 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 #define DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <vector>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -94,6 +97,180 @@ namespace dials { namespace algorithms {
     return p;
   }
 
+  /**
+   * Accumulate the histogram of the values of a series of images for the
+   * unimodal threshold. Each image is histogrammed directly, optionally
+   * within a mask, using a separate histogram for each block of rows on a
+   * pool of threads which are then summed. As images can be added one at a
+   * time, the threshold for a sweep is ready as soon as its last image has
+   * been read, with no separate pass over the data.
+   *
+   * The probability distribution and threshold are the same as from
+   * probability_distribution and maximum_deviation for the values seen.
+   */
+  class UnimodalHistogram {
+  public:
+    /**
+     * @param range The range of values to consider
+     */
+    UnimodalHistogram(int2 range)
+        : range_(range), count_(0), max_value_(0), has_max_(false) {
+      DIALS_ASSERT(range[0] <= range[1]);
+      histogram_.resize(range[1] - range[0] + 1, 0);
+    }
+
+    /**
+     * Add an image
+     * @param image The image
+     * @param nthreads The number of threads
+     */
+    void add(const af::const_ref<int, af::c_grid<2> > &image,
+             std::size_t nthreads = 1) {
+      add_image(image, NULL, nthreads);
+    }
+
+    /**
+     * Add the pixels of an image within a mask
+     * @param image The image
+     * @param mask The mask (true to use the pixel)
+     * @param nthreads The number of threads
+     */
+    void add(const af::const_ref<int, af::c_grid<2> > &image,
+             const af::const_ref<bool, af::c_grid<2> > &mask,
+             std::size_t nthreads = 1) {
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      add_image(image, &mask, nthreads);
+    }
+
+    /**
+     * Add the histogram of another set of images
+     * @param other The other histogram
+     */
+    void merge(const UnimodalHistogram &other) {
+      DIALS_ASSERT(other.range_.all_eq(range_));
+      for (std::size_t i = 0; i < histogram_.size(); ++i) {
+        histogram_[i] += other.histogram_[i];
+      }
+      count_ += other.count_;
+      update_max(other.has_max_, other.max_value_);
+    }
+
+    /** @returns The number of values in the range */
+    std::size_t count() const {
+      return count_;
+    }
+
+    /**
+     * @returns The counts of each value, from the start of the range to the
+     * smaller of the end of the range and the largest value seen
+     */
+    af::shared<std::size_t> histogram() const {
+      return af::shared<std::size_t>(histogram_.begin(),
+                                     histogram_.begin() + num_bins());
+    }
+
+    /** @returns The probability distribution of values */
+    af::shared<double> probability_distribution() const {
+      DIALS_ASSERT(count_ > 0);
+      af::shared<double> p(num_bins());
+      for (std::size_t i = 0; i < p.size(); ++i) {
+        p[i] = (double)histogram_[i] / count_;
+      }
+      return p;
+    }
+
+    /** @returns The maximum deviation threshold as a value */
+    int threshold() const {
+      af::shared<double> p = probability_distribution();
+      return range_[0] + (int)maximum_deviation(p.const_ref());
+    }
+
+  private:
+    /**
+     * Histogram a block of rows
+     */
+    struct Job {
+      const af::const_ref<int, af::c_grid<2> > *image;
+      const af::const_ref<bool, af::c_grid<2> > *mask;
+      int2 range;
+      std::size_t num_blocks;
+      std::vector<std::vector<std::size_t> > *histograms;
+      std::vector<int> *max_values;
+      std::vector<bool> *has_max;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t height = image->accessor()[0];
+        std::size_t width = image->accessor()[1];
+        for (std::size_t b = first; b < last; ++b) {
+          std::vector<std::size_t> &histogram = (*histograms)[b];
+          histogram.assign(range[1] - range[0] + 1, 0);
+          int max_value = 0;
+          bool found = false;
+          std::size_t j0 = (b * height) / num_blocks;
+          std::size_t j1 = ((b + 1) * height) / num_blocks;
+          for (std::size_t k = j0 * width; k < j1 * width; ++k) {
+            if (mask != NULL && !(*mask)[k]) {
+              continue;
+            }
+            int value = (*image)[k];
+            if (!found || value > max_value) {
+              max_value = value;
+              found = true;
+            }
+            if (range[0] <= value && value <= range[1]) {
+              histogram[value - range[0]]++;
+            }
+          }
+          (*max_values)[b] = max_value;
+          (*has_max)[b] = found;
+        }
+      }
+    };
+
+    void add_image(const af::const_ref<int, af::c_grid<2> > &image,
+                   const af::const_ref<bool, af::c_grid<2> > *mask,
+                   std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t num_blocks = std::max((std::size_t)1,
+                                        std::min(nthreads, image.accessor()[0]));
+      std::vector<std::vector<std::size_t> > histograms(num_blocks);
+      std::vector<int> max_values(num_blocks, 0);
+      std::vector<bool> has_max(num_blocks, false);
+      Job job = {
+        &image, mask, range_, num_blocks, &histograms, &max_values, &has_max};
+      dials::util::parallel_for(num_blocks, nthreads, job);
+      for (std::size_t b = 0; b < num_blocks; ++b) {
+        for (std::size_t i = 0; i < histogram_.size(); ++i) {
+          histogram_[i] += histograms[b][i];
+          count_ += histograms[b][i];
+        }
+        update_max(has_max[b], max_values[b]);
+      }
+    }
+
+    void update_max(bool found, int value) {
+      if (found && (!has_max_ || value > max_value_)) {
+        max_value_ = value;
+        has_max_ = true;
+      }
+    }
+
+    /**
+     * The number of bins up to the largest value seen, as in
+     * probability_distribution
+     */
+    std::size_t num_bins() const {
+      DIALS_ASSERT(has_max_ && max_value_ >= range_[0]);
+      return std::min(max_value_, range_[1]) - range_[0] + 1;
+    }
+
+    int2 range_;
+    std::vector<std::size_t> histogram_;
+    std::size_t count_;
+    int max_value_;
+    bool has_max_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H */
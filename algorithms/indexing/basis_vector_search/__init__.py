@@ -1,6 +1,6 @@
 from .fft1d import FFT1D
-from .fft3d import FFT3D
+from .fft3d import FFT3D, ProgressiveFFT3D
 from .real_space_grid_search import RealSpaceGridSearch
 from .strategy import Strategy
 
-__all__ = ["Strategy", "FFT1D", "FFT3D", "RealSpaceGridSearch"]
+__all__ = ["Strategy", "FFT1D", "FFT3D", "ProgressiveFFT3D", "RealSpaceGridSearch"]
@@ -28,6 +28,10 @@
 peak_volume_cutoff = 0.15
     .type = float
     .expert_level = 2
+nthreads = 1
+    .type = int(value_min=1)
+    .help = "The number of threads to use when mapping the spots to the grid"
+    .expert_level = 2
 reciprocal_space_grid {
     n_points = 256
         .type = int(value_min=0)
@@ -36,6 +40,11 @@
         .type = float(value_min=0)
         .help = "The high resolution limit in Angstrom for spots to include in "
                 "the initial indexing."
+    half_complex = False
+        .type = bool
+        .help = "Use a real to complex FFT, which needs about a quarter of the "
+                "memory of the full complex FFT"
+        .expert_level = 2
     }
 """
 
@@ -99,6 +108,7 @@ def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
         )
         self._n_points = self._gridding[0]
         self._min_cell = min_cell
+        self._reciprocal_space_grid = None
 
     def find_basis_vectors(self, reciprocal_lattice_vectors):
         """Find a list of likely basis vectors.
@@ -131,6 +141,19 @@ def find_basis_vectors(self, reciprocal_lattice_vectors):
             d_min = self._params.reciprocal_space_grid.d_min
 
         grid_real, used_in_indexing = self._fft(reciprocal_lattice_vectors, d_min)
+        return self._basis_vectors_from_map(grid_real, d_min), used_in_indexing
+
+    def _basis_vectors_from_map(self, grid_real, d_min):
+        """Find the candidate basis vectors from the peaks of the transformed map.
+
+        Args:
+            grid_real (scitbx.array_family.flex.double): The squared real part of
+                the transform of the reciprocal space grid.
+            d_min (float): The resolution limit of the reciprocal space grid.
+
+        Returns:
+            The list of candidate basis vectors, largest peak first.
+        """
         self.sites, self.volumes = self._find_peaks(grid_real, d_min)
 
         # hijack the xray.structure class to facilitate calculation of distances
@@ -195,7 +218,7 @@ def find_basis_vectors(self, reciprocal_lattice_vectors):
         # re-sort by peak volume
         perm = flex.sort_permutation(unique_volumes, reverse=True)
         self.candidate_basis_vectors = [unique_vectors[i] for i in perm]
-        return self.candidate_basis_vectors, used_in_indexing
+        return self.candidate_basis_vectors
 
     def _fft(self, reciprocal_lattice_vectors, d_min):
 
@@ -219,6 +242,25 @@ def _fft(self, reciprocal_lattice_vectors, d_min):
         # (512**3)*8*2*bytes_to_gb
         # 2.0
 
+        grid_real = self._transform(reciprocal_space_grid)
+        # Only the vectors are kept until the next search
+        self._reciprocal_space_grid.release()
+        return grid_real, used_in_indexing
+
+    def _transform(self, reciprocal_space_grid):
+        """Compute the squared real part of the transform of the grid. The
+        real to complex transform is done in place, overwriting the grid."""
+        if self._params.reciprocal_space_grid.half_complex:
+            # The transform of a real grid is Hermitian, so the real part of the
+            # full transform can be filled in from the half complex transform
+            fft = fftpack.real_to_complex_3d(self._gridding)
+            grid_transformed = fft.forward(reciprocal_space_grid)
+            grid_real = dials_algorithms_indexing_ext.half_complex_real_squared(
+                grid_transformed, fft.n_real()
+            )
+            del grid_transformed
+            return grid_real
+
         fft = fftpack.complex_to_complex_3d(self._gridding)
         grid_complex = flex.complex_double(
             reals=reciprocal_space_grid,
@@ -227,28 +269,38 @@ def _fft(self, reciprocal_lattice_vectors, d_min):
         grid_transformed = fft.forward(grid_complex)
         grid_real = flex.pow2(flex.real(grid_transformed))
         del grid_transformed
-
-        return grid_real, used_in_indexing
+        return grid_real
 
     def _map_centroids_to_reciprocal_space_grid(
         self, reciprocal_lattice_vectors, d_min
     ):
         logger.info("FFT gridding: (%i,%i,%i)" % self._gridding)
 
-        grid = flex.double(flex.grid(self._gridding), 0)
-
         if self._params.b_iso is libtbx.Auto:
             self._params.b_iso = -4 * d_min ** 2 * math.log(0.05)
             logger.debug("Setting b_iso = %.1f", self._params.b_iso)
-        used_in_indexing = flex.bool(reciprocal_lattice_vectors.size(), True)
-        dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
-            grid,
-            reciprocal_lattice_vectors,
-            used_in_indexing,  # do we really need this?
-            d_min,
-            b_iso=self._params.b_iso,
+        grid = self._reciprocal_space_grid
+        if grid is not None and grid.has_points(reciprocal_lattice_vectors):
+            # The same vectors as the last search, e.g. when indexing is retried
+            # with a different d_min, so fill the grid again from those stored
+            grid.set_resolution(d_min, self._params.b_iso)
+        else:
+            grid = self._new_grid(d_min)
+            grid.add(reciprocal_lattice_vectors)
+            self._reciprocal_space_grid = grid
+        return grid.grid(), grid.selection()
+
+    def _new_grid(self, d_min):
+        """Create an empty reciprocal space grid for the chosen transform."""
+        if self._params.reciprocal_space_grid.half_complex:
+            # Pad the grid in place for the real to complex FFT
+            m_real = fftpack.real_to_complex_3d(self._gridding).m_real()
+            accessor = flex.grid(m_real).set_focus(self._gridding)
+        else:
+            accessor = flex.grid(self._gridding)
+        return dials_algorithms_indexing_ext.ReciprocalSpaceGrid(
+            accessor, d_min, b_iso=self._params.b_iso, nthreads=self._params.nthreads
         )
-        return grid, used_in_indexing
 
     def _find_peaks(self, grid_real, d_min):
         grid_real_binary = grid_real.deep_copy()
@@ -300,3 +352,108 @@ def _find_peaks(self, grid_real, d_min):
         sites = flood_fill.centres_of_mass_frac().select(isel)
         volumes = flood_fill.grid_points_per_void().select(isel)
         return sites, volumes
+
+
+class ProgressiveFFT3D(FFT3D):
+    """
+    An FFT3D basis vector search whose reciprocal space grid is kept between
+    searches.
+
+    Spots are added to the grid with add_reciprocal_lattice_vectors as they are
+    found, e.g. while the data are still being collected, so a search only needs
+    the transform of the grid rather than mapping all of the spots again. The
+    resolution limit of the grid is fixed when the search is created, so
+    d_min=Auto is taken to be 5 * max_cell / n_points without limiting it to
+    the resolution of the spots; it can be changed later with set_d_min.
+    """
+
+    def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
+        super().__init__(max_cell, min_cell=min_cell, params=params, *args, **kwargs)
+        self._auto_b_iso = self._params.b_iso is libtbx.Auto
+        d_min = self._params.reciprocal_space_grid.d_min
+        if d_min is libtbx.Auto:
+            d_min = 5 * max_cell / self._n_points
+        self._set_resolution(d_min)
+
+    @property
+    def d_min(self):
+        """The resolution limit of the grid."""
+        return self._d_min
+
+    @property
+    def num_mapped(self):
+        """The number of vectors on the grid."""
+        if self._reciprocal_space_grid is None:
+            return 0
+        return self._reciprocal_space_grid.num_on_grid()
+
+    def _set_resolution(self, d_min):
+        self._d_min = d_min
+        logger.info("Setting d_min: %.2f", d_min)
+        if self._auto_b_iso:
+            self._params.b_iso = -4 * d_min ** 2 * math.log(0.05)
+            logger.debug("Setting b_iso = %.1f", self._params.b_iso)
+
+    def set_d_min(self, d_min):
+        """Change the resolution limit of the grid. The grid is filled again from
+        the vectors added so far, without needing them again.
+
+        Args:
+            d_min (float): The new resolution limit in Angstrom.
+        """
+        self._set_resolution(d_min)
+        if self._reciprocal_space_grid is not None:
+            self._reciprocal_space_grid.set_resolution(d_min, self._params.b_iso)
+
+    def add_reciprocal_lattice_vectors(self, reciprocal_lattice_vectors):
+        """Add more reciprocal lattice vectors to the grid.
+
+        Args:
+            reciprocal_lattice_vectors (scitbx.array_family.flex.vec3_double):
+                The new reciprocal lattice vectors.
+
+        Returns:
+            A flex.bool array identifying which vectors are on the grid.
+        """
+        if self._reciprocal_space_grid is None:
+            logger.info("FFT gridding: (%i,%i,%i)" % self._gridding)
+            self._reciprocal_space_grid = self._new_grid(self._d_min)
+        return self._reciprocal_space_grid.add(reciprocal_lattice_vectors)
+
+    def find_basis_vectors(self, reciprocal_lattice_vectors):
+        """Find a list of likely basis vectors from the vectors added so far.
+
+        Args:
+            reciprocal_lattice_vectors (scitbx.array_family.flex.vec3_double):
+                The reciprocal lattice vectors being indexed. These should
+                have been added to the grid already; they are only used to
+                find which of them are on the grid.
+
+        Returns:
+            A tuple containing the list of basis vectors and a flex.bool array
+            identifying which reflections were used in indexing.
+        """
+        if not self.num_mapped:
+            raise indexing.DialsIndexError(
+                "Indexing failed: no spots have been added to the fft3d grid"
+            )
+        grid = self._reciprocal_space_grid
+        if grid.has_points(reciprocal_lattice_vectors):
+            used_in_indexing = grid.selection()
+        else:
+            used_in_indexing = flex.bool(reciprocal_lattice_vectors.size(), True)
+            dials_algorithms_indexing_ext.select_centroids_on_reciprocal_space_grid(
+                reciprocal_lattice_vectors,
+                used_in_indexing,
+                self._d_min,
+                self._n_points,
+                nthreads=self._params.nthreads,
+            )
+        logger.info("Number of centroids used: %i", self.num_mapped)
+
+        grid_real = self._transform(grid.grid())
+        if self._params.reciprocal_space_grid.half_complex:
+            # The real to complex transform overwrote the grid, so it is filled
+            # again from the stored vectors when it is next needed
+            grid.release()
+        return self._basis_vectors_from_map(grid_real, self._d_min), used_in_indexing
@@ -1,3 +1,4 @@
+import functools
 import logging
 import math
 
@@ -8,6 +9,7 @@
 from rstbx.dps_core import SimpleSamplerTool
 from scitbx import matrix
 
+import dials_algorithms_indexing_ext
 from dials.algorithms.indexing import DialsIndexError
 
 from .strategy import Strategy
@@ -22,9 +24,35 @@
 max_vectors = 30
     .help = "The maximum number of unique vectors to find in the grid search."
     .type = int(value_min=3)
+nthreads = 1
+    .help = "The number of threads to use when scoring the search vectors."
+    .type = int(value_min=1)
+    .expert_level = 2
 """
 
 
+@functools.lru_cache(maxsize=4)
+def _hemisphere_grid(characteristic_grid):
+    """The unit vectors of the hemisphere grid, which are the same for every
+    image when indexing many stills with the same parameters."""
+    SST = SimpleSamplerTool(characteristic_grid)
+    SST.construct_hemisphere_grid(SST.incr)
+    return flex.vec3_double([direction.dvec for direction in SST.angles])
+
+
+@functools.lru_cache(maxsize=4)
+def _search_vector_grid(characteristic_grid, cell_dimensions):
+    """The search vectors for each direction of the hemisphere grid and each
+    of the cell dimensions, in the same order as RealSpaceGridSearch.search_vectors
+    """
+    directions = _hemisphere_grid(characteristic_grid)
+    n = len(cell_dimensions)
+    vectors = flex.vec3_double(len(directions) * n)
+    for i, l in enumerate(cell_dimensions):
+        vectors.set_selected(flex.size_t_range(i, len(vectors), n), directions * l)
+    return vectors
+
+
 class RealSpaceGridSearch(Strategy):
     """
     Basis vector search using a real space grid search.
@@ -74,10 +102,8 @@ def __init__(self, max_cell, target_unit_cell, params=None, *args, **kwargs):
     @property
     def search_directions(self):
         """Generator of the search directions (i.e. vectors with length 1)."""
-        SST = SimpleSamplerTool(self._params.characteristic_grid)
-        SST.construct_hemisphere_grid(SST.incr)
-        for direction in SST.angles:
-            yield matrix.col(direction.dvec)
+        for direction in _hemisphere_grid(self._params.characteristic_grid):
+            yield matrix.col(direction)
 
     @property
     def search_vectors(self):
@@ -115,12 +141,15 @@ def score_vectors(self, reciprocal_lattice_vectors):
         Returns:
             A tuple containing the list of search vectors and their scores.
         """
-        vectors = flex.vec3_double()
-        scores = flex.double()
-        for i, v in enumerate(self.search_vectors):
-            f = self.compute_functional(v.elems, reciprocal_lattice_vectors)
-            vectors.append(v.elems)
-            scores.append(f)
+        # The search vectors only depend on the parameters and target cell, so
+        # are reused between calls, e.g. for each image of a serial experiment
+        vectors = _search_vector_grid(
+            self._params.characteristic_grid,
+            tuple(set(self._target_unit_cell.parameters()[:3])),
+        ).deep_copy()
+        scores = dials_algorithms_indexing_ext.real_space_grid_search_scores(
+            vectors, reciprocal_lattice_vectors, nthreads=self._params.nthreads
+        )
         return vectors, scores
 
     def find_basis_vectors(self, reciprocal_lattice_vectors):
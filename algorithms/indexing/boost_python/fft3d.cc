@@ -25,19 +25,60 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("m2"),
          arg("rl_grid_spacing"),
          arg("d_min"),
-         arg("b_iso")));
+         arg("b_iso"),
+         arg("nthreads") = 1));
 
     def("clean_3d",
         &clean_3d,
         (arg("dirty_beam"), arg("dirty_map"), arg("n_peaks"), arg("gamma") = 1));
 
+    def("select_centroids_on_reciprocal_space_grid",
+        &select_centroids_on_reciprocal_space_grid,
+        (arg("reciprocal_space_vectors"),
+         arg("selection"),
+         arg("d_min"),
+         arg("n_points"),
+         arg("nthreads") = 1));
+
     def("map_centroids_to_reciprocal_space_grid",
         &map_centroids_to_reciprocal_space_grid,
         (arg("grid"),
          arg("reciprocal_space_vectors"),
          arg("selection"),
          arg("d_min"),
-         arg("b_iso") = 0));
+         arg("b_iso") = 0,
+         arg("nthreads") = 1));
+
+    def("map_centroids_to_padded_reciprocal_space_grid",
+        &map_centroids_to_padded_reciprocal_space_grid,
+        (arg("grid"),
+         arg("reciprocal_space_vectors"),
+         arg("selection"),
+         arg("d_min"),
+         arg("b_iso") = 0,
+         arg("nthreads") = 1));
+
+    class_<ReciprocalSpaceGrid>("ReciprocalSpaceGrid", no_init)
+      .def(init<af::flex_grid<> const&, double, double, std::size_t>(
+        (arg("accessor"), arg("d_min"), arg("b_iso") = 0, arg("nthreads") = 1)))
+      .def("grid", &ReciprocalSpaceGrid::grid)
+      .def("d_min", &ReciprocalSpaceGrid::d_min)
+      .def("b_iso", &ReciprocalSpaceGrid::b_iso)
+      .def("size", &ReciprocalSpaceGrid::size)
+      .def("__len__", &ReciprocalSpaceGrid::size)
+      .def("num_on_grid", &ReciprocalSpaceGrid::num_on_grid)
+      .def("points", &ReciprocalSpaceGrid::points)
+      .def("selection", &ReciprocalSpaceGrid::selection)
+      .def("has_points", &ReciprocalSpaceGrid::has_points)
+      .def("add", &ReciprocalSpaceGrid::add)
+      .def("set_resolution",
+           &ReciprocalSpaceGrid::set_resolution,
+           (arg("d_min"), arg("b_iso")))
+      .def("release", &ReciprocalSpaceGrid::release);
+
+    def("half_complex_real_squared",
+        &half_complex_real_squared,
+        (arg("half"), arg("n_real")));
   }
 
 }}}  // namespace dials::algorithms::boost_python
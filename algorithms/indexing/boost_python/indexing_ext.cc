@@ -17,6 +17,8 @@ namespace dials { namespace algorithms { namespace boost_python {
   using namespace boost::python;
 
   void export_fft3d();
+  void export_real_space_grid_search();
+  void export_origin_offset_search();
 
   void export_assign_indices() {
     typedef AssignIndices w_t;
@@ -25,10 +27,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<af::const_ref<scitbx::vec3<double> > const &,
                 af::const_ref<double> const &,
                 af::const_ref<scitbx::mat3<double> > const &,
-                double>((arg("reciprocal_space_points"),
-                         arg("phi"),
-                         arg("UB_matrices"),
-                         arg("tolerance") = 0.3)))
+                double,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("tolerance") = 0.3,
+                              arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
   }
@@ -42,21 +46,41 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double,
                 const double,
                 const double,
-                const int>((arg("reciprocal_space_points"),
-                            arg("phi"),
-                            arg("UB_matrices"),
-                            arg("epsilon") = 0.05,
-                            arg("delta") = 8,
-                            arg("l_min") = 0.8,
-                            arg("nearest_neighbours") = 20)))
+                const int,
+                const std::size_t>((arg("reciprocal_space_points"),
+                                    arg("phi"),
+                                    arg("UB_matrices"),
+                                    arg("epsilon") = 0.05,
+                                    arg("delta") = 8,
+                                    arg("l_min") = 0.8,
+                                    arg("nearest_neighbours") = 20,
+                                    arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
   }
 
+  void export_score_candidate_models() {
+    typedef ScoreCandidateModels w_t;
+
+    class_<w_t>("ScoreCandidateModels", no_init)
+      .def(init<af::const_ref<scitbx::vec3<double> > const &,
+                af::const_ref<scitbx::mat3<double> > const &,
+                double,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("UB_matrices"),
+                              arg("tolerance") = 0.3,
+                              arg("nthreads") = 1)))
+      .def("n_indexed", &w_t::n_indexed)
+      .def("rmsd", &w_t::rmsd);
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_indexing_ext) {
     export_fft3d();
+    export_real_space_grid_search();
+    export_origin_offset_search();
     export_assign_indices();
     export_assign_indices_local();
+    export_score_candidate_models();
   }
 
 }}}  // namespace dials::algorithms::boost_python
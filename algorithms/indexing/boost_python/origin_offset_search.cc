@@ -0,0 +1,42 @@
+/*
+ * origin_offset_search.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/indexing/origin_offset_search.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_origin_offset_search() {
+    typedef OriginOffsetScorer w_t;
+
+    class_<w_t>("OriginOffsetScorer")
+      .def("add_experiment",
+           &w_t::add_experiment,
+           (arg("lab_coords"),
+            arg("phi"),
+            arg("s0"),
+            arg("rotation_axis"),
+            arg("setting_rotation"),
+            arg("basis_vectors")))
+      .def("num_experiments", &w_t::num_experiments)
+      .def("score", &w_t::score, (arg("offset")))
+      .def("scores", &w_t::scores, (arg("offsets"), arg("nthreads") = 1))
+      .def("refine",
+           &w_t::refine,
+           (arg("start"),
+            arg("axis1"),
+            arg("axis2"),
+            arg("step") = 0.2,
+            arg("tolerance") = 1e-7,
+            arg("max_iterations") = 500));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,23 @@
+/*
+ * real_space_grid_search.cc
+ *
+ *  Copyright (C) 2014 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/indexing/real_space_grid_search.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_real_space_grid_search() {
+    def("real_space_grid_search_scores",
+        &real_space_grid_search_scores,
+        (arg("vectors"), arg("reciprocal_lattice_vectors"), arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
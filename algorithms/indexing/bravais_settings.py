@@ -21,6 +21,7 @@
     get_symop_correlation_coefficients,
 )
 from dials.util.log import LoggingContext
+from dials.util.shared_store import SharedStore
 
 logger = logging.getLogger(__name__)
 
@@ -249,17 +250,46 @@ def refined_settings_from_refined_triclinic(experiments, reflections, params):
             constrain_orient, space_group
         )
 
-    with concurrent.futures.ProcessPoolExecutor(max_workers=params.nproc) as pool:
-        for i, result in enumerate(
-            pool.map(
-                refine_subgroup,
+    # The settings are refined independently, each with the same random seed,
+    # so the results do not depend on the number of processes
+    nproc = min(params.nproc, len(refined_settings))
+    if nproc > 1:
+        # Write the parameters, experiments and reflections once to a shared
+        # store, rather than pickling them again for every setting
+        with SharedStore() as store, concurrent.futures.ProcessPoolExecutor(
+            max_workers=nproc
+        ) as pool:
+            shared_params = store.put(params)
+            shared_experiments = store.put(experiments)
+            shared_reflections = store.put_reflections(used_reflections)
+            results = list(
+                pool.map(
+                    refine_shared_subgroup,
+                    (
+                        (
+                            shared_params,
+                            subgroup,
+                            shared_reflections,
+                            shared_experiments,
+                        )
+                        for subgroup in refined_settings
+                    ),
+                )
+            )
+    else:
+        results = [
+            refine_subgroup(
                 (
-                    (params, subgroup, used_reflections, experiments)
-                    for subgroup in refined_settings
-                ),
+                    copy.deepcopy(params),
+                    subgroup,
+                    used_reflections,
+                    copy.deepcopy(experiments),
+                )
             )
-        ):
-            refined_settings[i] = result
+            for subgroup in refined_settings
+        ]
+    for i, result in enumerate(results):
+        refined_settings[i] = result
 
     identify_likely_solutions(refined_settings)
     return refined_settings
@@ -296,6 +326,30 @@ def identify_likely_solutions(all_solutions):
         solution.recommended = True
 
 
+def refine_shared_subgroup(args):
+    """Refine a subgroup with the parameters, reflections and experiments loaded
+    from a shared store. The parameters and experiments are cached by each
+    worker process, so they are copied before refine_subgroup changes them.
+
+    Args:
+        args: The handles of the parameters, the subgroup and the handles of
+            the reflections and experiments
+
+    Returns:
+        The refined subgroup
+    """
+    assert len(args) == 4
+    params, subgroup, used_reflections, experiments = args
+    return refine_subgroup(
+        (
+            copy.deepcopy(params.load()),
+            subgroup,
+            used_reflections.load(),
+            copy.deepcopy(experiments.load()),
+        )
+    )
+
+
 def refine_subgroup(args):
     assert len(args) == 4
     params, subgroup, used_reflections, experiments = args
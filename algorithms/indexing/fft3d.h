@@ -17,10 +17,14 @@
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/math/utils.h>
 
+#include <algorithm>
+#include <complex>
 #include <cstdlib>
+#include <vector>
 #include <scitbx/array_family/versa_matrix.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/spot_prediction/rotation_angles.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dxtbx/model/scan_helpers.h>
 
 namespace dials { namespace algorithms {
@@ -41,6 +45,75 @@ namespace dials { namespace algorithms {
     return false;
   }
 
+  /**
+   * Fill a range of the first index of the sampling volume map
+   */
+  class SamplingVolumeMapJob {
+  public:
+    SamplingVolumeMapJob(af::ref<double, af::c_grid<3> > const& data,
+                         af::ref<vec2<double> > const& angle_ranges,
+                         vec3<double> s0,
+                         vec3<double> m2,
+                         double rl_grid_spacing,
+                         double d_min,
+                         double b_iso)
+        : data_(data),
+          angle_ranges_(angle_ranges),
+          calculate_rotation_angles_(s0, m2),
+          rl_grid_spacing_(rl_grid_spacing),
+          one_over_d_sq_min_(1 / (d_min * d_min)),
+          b_iso_(b_iso) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      typedef af::c_grid<3>::index_type index_t;
+      index_t const gridding_n_real = index_t(data_.accessor());
+      for (std::size_t i = first; i < last; i++) {
+        double i_rl = (double(i) - double(gridding_n_real[0] / 2.0)) * rl_grid_spacing_;
+        double i_rl_sq = i_rl * i_rl;
+        for (std::size_t j = 0; j < gridding_n_real[1]; j++) {
+          double j_rl =
+            (double(j) - double(gridding_n_real[1] / 2.0)) * rl_grid_spacing_;
+          double j_rl_sq = j_rl * j_rl;
+          for (std::size_t k = 0; k < gridding_n_real[2]; k++) {
+            double k_rl =
+              (double(k) - double(gridding_n_real[2] / 2.0)) * rl_grid_spacing_;
+            double k_rl_sq = k_rl * k_rl;
+            double reciprocal_length_sq = (i_rl_sq + j_rl_sq + k_rl_sq);
+            if (reciprocal_length_sq > one_over_d_sq_min_) {
+              continue;
+            }
+            vec3<double> pstar0(i_rl, j_rl, k_rl);
+
+            // Try to calculate the diffracting rotation angles
+            vec2<double> phi;
+            if (!calculate_rotation_angles_.calculate(pstar0, phi)) {
+              continue;
+            }
+
+            // Check that the angles are within the rotation range
+            if (are_angles_in_range(angle_ranges_, phi)) {
+              double T;
+              if (b_iso_ != 0) {
+                T = std::exp(-b_iso_ * reciprocal_length_sq / 4);
+              } else {
+                T = 1;
+              }
+              data_(i, j, k) = T;
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    af::ref<double, af::c_grid<3> > data_;
+    af::ref<vec2<double> > angle_ranges_;
+    RotationAngles calculate_rotation_angles_;
+    double rl_grid_spacing_;
+    double one_over_d_sq_min_;
+    double b_iso_;
+  };
+
   // compute a map of the sampling volume of a scan
   void sampling_volume_map(af::ref<double, af::c_grid<3> > const& data,
                            af::ref<vec2<double> > const& angle_ranges,
@@ -48,51 +121,14 @@ namespace dials { namespace algorithms {
                            vec3<double> m2,
                            double const& rl_grid_spacing,
                            double d_min,
-                           double b_iso) {
-    typedef af::c_grid<3>::index_type index_t;
-    index_t const gridding_n_real = index_t(data.accessor());
-
-    RotationAngles calculate_rotation_angles_(s0, m2);
-
-    double one_over_d_sq_min = 1 / (d_min * d_min);
-
-    for (std::size_t i = 0; i < gridding_n_real[0]; i++) {
-      double i_rl = (double(i) - double(gridding_n_real[0] / 2.0)) * rl_grid_spacing;
-      double i_rl_sq = i_rl * i_rl;
-      for (std::size_t j = 0; j < gridding_n_real[1]; j++) {
-        double j_rl = (double(j) - double(gridding_n_real[1] / 2.0)) * rl_grid_spacing;
-        double j_rl_sq = j_rl * j_rl;
-        for (std::size_t k = 0; k < gridding_n_real[2]; k++) {
-          double k_rl =
-            (double(k) - double(gridding_n_real[2] / 2.0)) * rl_grid_spacing;
-          double k_rl_sq = k_rl * k_rl;
-          double reciprocal_length_sq = (i_rl_sq + j_rl_sq + k_rl_sq);
-          if (reciprocal_length_sq > one_over_d_sq_min) {
-            continue;
-          }
-          vec3<double> pstar0(i_rl, j_rl, k_rl);
-
-          // Try to calculate the diffracting rotation angles
-          vec2<double> phi;
-          try {
-            phi = calculate_rotation_angles_(pstar0);
-          } catch (error const&) {
-            continue;
-          }
-
-          // Check that the angles are within the rotation range
-          if (are_angles_in_range(angle_ranges, phi)) {
-            double T;
-            if (b_iso != 0) {
-              T = std::exp(-b_iso * reciprocal_length_sq / 4);
-            } else {
-              T = 1;
-            }
-            data(i, j, k) = T;
-          }
-        }
-      }
-    }
+                           double b_iso,
+                           std::size_t nthreads = 1) {
+    // Each job fills its own planes of the grid
+    dials::util::parallel_for(
+      data.accessor()[0],
+      nthreads,
+      SamplingVolumeMapJob(
+        data, angle_ranges, s0, m2, rl_grid_spacing, d_min, b_iso));
   }
 
   /*
@@ -130,43 +166,59 @@ namespace dials { namespace algorithms {
       // the dirty map
       const double max_value = dirty_map[max_idx];
       const double scale = max_value / max_db * gamma;
+      // Find the maximum of the updated map in the same pass. Each thread
+      // keeps its own maximum, and these are reduced once per thread at the
+      // end, taking the lowest index on a tie as the serial loop would.
       max_idx = 0;  // reset for next cycle
-#pragma omp parallel for
-      for (int i = 0; i < width; i++) {
-        int i_db = i - shift[0];
-        if (i_db < 0) {
-          i_db += width;
-        } else if (i_db >= width) {
-          i_db -= width;
-        }
-        // DIALS_ASSERT(i_db >= 0 && i_db < width);
-        const long ipart_dm = i * height_depth;
-        const long ipart_db = i_db * height_depth;
-        for (int j = 0; j < height; j++) {
-          int j_db = j - shift[1];
-          if (j_db < 0) {
-            j_db += height;
-          } else if (j_db >= height) {
-            j_db -= height;
+#pragma omp parallel
+      {
+        long local_idx = -1;
+        double local_max = 0;
+#pragma omp for
+        for (int i = 0; i < width; i++) {
+          int i_db = i - shift[0];
+          if (i_db < 0) {
+            i_db += width;
+          } else if (i_db >= width) {
+            i_db -= width;
           }
-          // DIALS_ASSERT(j_db >= 0 && j_db < height);
-          const long ijpart_dm = ipart_dm + j * depth;
-          const long ijpart_db = ipart_db + j_db * depth;
-          for (int k = 0; k < depth; k++) {
-            int k_db = k - shift[2];
-            if (k_db < 0) {
-              k_db += depth;
-            } else if (k_db >= depth) {
-              k_db -= depth;
+          // DIALS_ASSERT(i_db >= 0 && i_db < width);
+          const long ipart_dm = i * height_depth;
+          const long ipart_db = i_db * height_depth;
+          for (int j = 0; j < height; j++) {
+            int j_db = j - shift[1];
+            if (j_db < 0) {
+              j_db += height;
+            } else if (j_db >= height) {
+              j_db -= height;
+            }
+            // DIALS_ASSERT(j_db >= 0 && j_db < height);
+            const long ijpart_dm = ipart_dm + j * depth;
+            const long ijpart_db = ipart_db + j_db * depth;
+            for (int k = 0; k < depth; k++) {
+              int k_db = k - shift[2];
+              if (k_db < 0) {
+                k_db += depth;
+              } else if (k_db >= depth) {
+                k_db -= depth;
+              }
+              // DIALS_ASSERT(k_db >= 0 && k_db < depth);
+              const long idx_dm = ijpart_dm + k;
+              const long idx_db = ijpart_db + k_db;
+              dirty_map[idx_dm] -= dirty_beam[idx_db] * scale;
+              if (local_idx < 0 || local_max < dirty_map[idx_dm]) {
+                local_idx = idx_dm;
+                local_max = dirty_map[idx_dm];
+              }
             }
-            // DIALS_ASSERT(k_db >= 0 && k_db < depth);
-            const long idx_dm = ijpart_dm + k;
-            const long idx_db = ijpart_db + k_db;
-            dirty_map[idx_dm] -= dirty_beam[idx_db] * scale;
-            if (dirty_map[max_idx] < dirty_map[idx_dm])
+          }
+        }
 #pragma omp critical(max_idx)
-            {
-              max_idx = idx_dm;
+        {
+          if (local_idx >= 0) {
+            if (dirty_map[max_idx] < local_max
+                || (dirty_map[max_idx] == local_max && local_idx < max_idx)) {
+              max_idx = local_idx;
             }
           }
         }
@@ -175,50 +227,432 @@ namespace dials { namespace algorithms {
     return peaks;
   }
 
+  /**
+   * Compute the grid points and values of the reciprocal space vectors for a
+   * range of the vectors. Each job writes only to its own elements, so the
+   * vectors can be split between threads.
+   */
+  class CentroidGridPointJob {
+  public:
+    CentroidGridPointJob(af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+                         af::ref<bool> const& selection,
+                         double d_min,
+                         double b_iso,
+                         int n_points,
+                         std::vector<vec3<int> >& coords,
+                         std::vector<double>& values)
+        : reciprocal_space_vectors_(reciprocal_space_vectors),
+          selection_(selection),
+          d_min_(d_min),
+          b_iso_(b_iso),
+          n_points_(n_points),
+          one_over_rlgrid_(1 / (2 / (d_min * n_points))),
+          coords_(&coords),
+          values_(&values) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      const int half_n_points = n_points_ / 2;
+      for (std::size_t i = first; i < last; i++) {
+        if (!selection_[i]) {
+          continue;
+        }
+        const vec3<double> v = reciprocal_space_vectors_[i];
+        const double v_length = v.length();
+        const double d_spacing = 1 / v_length;
+        if (d_spacing < d_min_) {
+          selection_[i] = false;
+          continue;
+        }
+        vec3<int> coord;
+        for (int j = 0; j < 3; j++) {
+          coord[j] = scitbx::math::iround(v[j] * one_over_rlgrid_) + half_n_points;
+        }
+        if ((coord.max() >= n_points_) || coord.min() < 0) {
+          selection_[i] = false;
+          continue;
+        }
+        double T;
+        if (b_iso_ != 0) {
+          T = std::exp(-b_iso_ * v_length * v_length / 4.0);
+        } else {
+          T = 1;
+        }
+        (*coords_)[i] = coord;
+        (*values_)[i] = T;
+      }
+    }
+
+  private:
+    af::const_ref<vec3<double> > reciprocal_space_vectors_;
+    af::ref<bool> selection_;
+    double d_min_;
+    double b_iso_;
+    int n_points_;
+    double one_over_rlgrid_;
+    std::vector<vec3<int> >* coords_;
+    std::vector<double>* values_;
+  };
+
+  /**
+   * Compute the grid points and values of the selected reciprocal space
+   * vectors, deselecting those outside the grid or resolution limit.
+   */
+  void centroid_grid_points(
+    af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    double b_iso,
+    int n_points,
+    std::size_t nthreads,
+    std::vector<vec3<int> >& coords,
+    std::vector<double>& values) {
+    DIALS_ASSERT(d_min >= 0);
+    DIALS_ASSERT(selection.size() == reciprocal_space_vectors.size());
+    coords.resize(reciprocal_space_vectors.size());
+    values.resize(reciprocal_space_vectors.size());
+    dials::util::parallel_for(
+      reciprocal_space_vectors.size(),
+      nthreads,
+      CentroidGridPointJob(
+        reciprocal_space_vectors, selection, d_min, b_iso, n_points, coords, values));
+  }
+
+  /**
+   * Deselect the reciprocal space vectors which are outside a grid or the
+   * resolution limit, without writing to the grid. This gives the vectors
+   * which were used in a grid that was mapped earlier.
+   * @param reciprocal_space_vectors The reciprocal space vectors
+   * @param selection The vectors to use, updated with those on the grid
+   * @param d_min The resolution limit
+   * @param n_points The size of the n x n x n grid
+   * @param nthreads The number of threads
+   */
+  void select_centroids_on_reciprocal_space_grid(
+    af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    int n_points,
+    std::size_t nthreads = 1) {
+    std::vector<vec3<int> > coords;
+    std::vector<double> values;
+    centroid_grid_points(reciprocal_space_vectors,
+                         selection,
+                         d_min,
+                         0,
+                         n_points,
+                         nthreads,
+                         coords,
+                         values);
+  }
+
+  /**
+   * Map the reciprocal space vectors onto a grid. The grid isn't cleared
+   * first, so more vectors can be added to a grid as they are found.
+   * @param grid The n x n x n grid
+   * @param reciprocal_space_vectors The reciprocal space vectors
+   * @param selection The vectors to use, updated with those on the grid
+   * @param d_min The resolution limit
+   * @param b_iso The isotropic B factor weight
+   * @param nthreads The number of threads
+   */
   void map_centroids_to_reciprocal_space_grid(
     af::ref<double, af::c_grid<3> > const& grid,
     af::const_ref<vec3<double> > const& reciprocal_space_vectors,
     af::ref<bool> const& selection,
     double d_min,
-    double b_iso = 0) {
+    double b_iso = 0,
+    std::size_t nthreads = 1) {
     typedef af::c_grid<3>::index_type index_t;
     index_t const gridding_n_real = index_t(grid.accessor());
     DIALS_ASSERT(d_min >= 0);
     DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[1]);
     DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[2]);
 
-    const int n_points = gridding_n_real[0];
-    const double rlgrid = 2 / (d_min * n_points);
-    const double one_over_rlgrid = 1 / rlgrid;
-    const int half_n_points = n_points / 2;
+    // Compute the grid points in parallel then write them in order, so that
+    // the last of several vectors on the same grid point wins as before
+    std::vector<vec3<int> > coords;
+    std::vector<double> values;
+    centroid_grid_points(reciprocal_space_vectors,
+                         selection,
+                         d_min,
+                         b_iso,
+                         gridding_n_real[0],
+                         nthreads,
+                         coords,
+                         values);
+    for (std::size_t i = 0; i < coords.size(); i++) {
+      if (selection[i]) {
+        grid(coords[i]) = values[i];
+      }
+    }
+  }
+
+  /**
+   * Map the reciprocal space vectors onto a padded real grid, with the layout
+   * used as the input to a real to complex FFT. As above, the grid isn't
+   * cleared first.
+   * @param grid The padded grid, whose focus is the n x n x n grid
+   * @param reciprocal_space_vectors The reciprocal space vectors
+   * @param selection The vectors to use, updated with those on the grid
+   * @param d_min The resolution limit
+   * @param b_iso The isotropic B factor weight
+   * @param nthreads The number of threads
+   */
+  void map_centroids_to_padded_reciprocal_space_grid(
+    af::ref<double, af::flex_grid<> > const& grid,
+    af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    double b_iso = 0,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(grid.accessor().nd() == 3);
+    af::flex_grid<>::index_type all = grid.accessor().all();
+    af::flex_grid<>::index_type focus = grid.accessor().focus();
+    DIALS_ASSERT(focus[0] == focus[1]);
+    DIALS_ASSERT(focus[0] == focus[2]);
+    DIALS_ASSERT(all[0] == focus[0] && all[1] == focus[1] && all[2] >= focus[2]);
 
-    for (int i = 0; i < reciprocal_space_vectors.size(); i++) {
-      if (!selection[i]) {
-        continue;
+    std::vector<vec3<int> > coords;
+    std::vector<double> values;
+    centroid_grid_points(reciprocal_space_vectors,
+                         selection,
+                         d_min,
+                         b_iso,
+                         focus[0],
+                         nthreads,
+                         coords,
+                         values);
+    for (std::size_t i = 0; i < coords.size(); i++) {
+      if (selection[i]) {
+        const vec3<int>& c = coords[i];
+        grid[(c[0] * all[1] + c[1]) * all[2] + c[2]] = values[i];
       }
-      const vec3<double> v = reciprocal_space_vectors[i];
-      const double v_length = v.length();
-      const double d_spacing = 1 / v_length;
-      if (d_spacing < d_min) {
-        selection[i] = false;
-        continue;
+    }
+  }
+
+  /**
+   * A reciprocal space grid which keeps the vectors mapped to it. More vectors
+   * can be added as they are found, and the grid can be filled again from the
+   * stored vectors with a different resolution limit, e.g. when indexing is
+   * retried, without mapping them again from Python. The grid memory can be
+   * released between searches, keeping only the vectors.
+   */
+  class ReciprocalSpaceGrid {
+  public:
+    /**
+     * @param accessor The grid accessor, whose focus is the n x n x n grid.
+     *                 The last dimension may be padded for a real to complex
+     *                 FFT.
+     * @param d_min The resolution limit
+     * @param b_iso The isotropic B factor weight
+     * @param nthreads The number of threads
+     */
+    ReciprocalSpaceGrid(af::flex_grid<> const& accessor,
+                        double d_min,
+                        double b_iso = 0,
+                        std::size_t nthreads = 1)
+        : accessor_(accessor),
+          grid_(accessor, 0),
+          d_min_(d_min),
+          b_iso_(b_iso),
+          nthreads_(nthreads) {
+      DIALS_ASSERT(accessor.nd() == 3);
+      af::flex_grid<>::index_type all = accessor.all();
+      af::flex_grid<>::index_type focus = accessor.focus();
+      DIALS_ASSERT(focus[0] == focus[1]);
+      DIALS_ASSERT(focus[0] == focus[2]);
+      DIALS_ASSERT(all[0] == focus[0] && all[1] == focus[1] && all[2] >= focus[2]);
+      DIALS_ASSERT(d_min >= 0);
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    /**
+     * @returns The grid, which is filled again if it was released. The memory
+     *          is shared with the grid until it is filled again.
+     */
+    af::versa<double, af::flex_grid<> > grid() {
+      allocate();
+      return grid_;
+    }
+
+    /**
+     * @returns The resolution limit
+     */
+    double d_min() const {
+      return d_min_;
+    }
+
+    /**
+     * @returns The isotropic B factor weight
+     */
+    double b_iso() const {
+      return b_iso_;
+    }
+
+    /**
+     * @returns The number of vectors added
+     */
+    std::size_t size() const {
+      return points_.size();
+    }
+
+    /**
+     * @returns The number of vectors on the grid
+     */
+    std::size_t num_on_grid() const {
+      return std::count(selection_.begin(), selection_.end(), true);
+    }
+
+    /**
+     * @returns The vectors added
+     */
+    af::shared<vec3<double> > points() const {
+      return points_.deep_copy();
+    }
+
+    /**
+     * @returns Which of the vectors added are on the grid
+     */
+    af::shared<bool> selection() const {
+      return selection_.deep_copy();
+    }
+
+    /**
+     * @returns True if the grid holds these vectors, in the same order
+     */
+    bool has_points(
+      af::const_ref<vec3<double> > const& reciprocal_space_vectors) const {
+      if (reciprocal_space_vectors.size() != points_.size()) {
+        return false;
+      }
+      for (std::size_t i = 0; i < points_.size(); i++) {
+        const vec3<double>& a = points_[i];
+        const vec3<double>& b = reciprocal_space_vectors[i];
+        if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2]) {
+          return false;
+        }
       }
-      vec3<int> coord;
-      for (int j = 0; j < 3; j++) {
-        coord[j] = scitbx::math::iround(v[j] * one_over_rlgrid) + half_n_points;
+      return true;
+    }
+
+    /**
+     * Add more vectors to the grid
+     * @param reciprocal_space_vectors The new vectors
+     * @returns Which of the new vectors are on the grid
+     */
+    af::shared<bool> add(
+      af::const_ref<vec3<double> > const& reciprocal_space_vectors) {
+      allocate();
+      af::shared<bool> selection(reciprocal_space_vectors.size(), true);
+      map(reciprocal_space_vectors, selection.ref());
+      points_.extend(reciprocal_space_vectors.begin(), reciprocal_space_vectors.end());
+      selection_.extend(selection.begin(), selection.end());
+      return selection;
+    }
+
+    /**
+     * Clear the grid and map the stored vectors again with a new resolution
+     * limit and B factor weight
+     * @param d_min The resolution limit
+     * @param b_iso The isotropic B factor weight
+     */
+    void set_resolution(double d_min, double b_iso) {
+      DIALS_ASSERT(d_min >= 0);
+      d_min_ = d_min;
+      b_iso_ = b_iso;
+      release();
+      allocate();
+    }
+
+    /**
+     * Free the memory of the grid, keeping the vectors. This should be called
+     * once the grid has been used as the input of an in place transform.
+     */
+    void release() {
+      grid_ = af::versa<double, af::flex_grid<> >();
+    }
+
+  private:
+    /**
+     * Allocate the grid if it was released and map the stored vectors to it
+     */
+    void allocate() {
+      if (grid_.size() != 0) {
+        return;
       }
-      if ((coord.max() >= n_points) || coord.min() < 0) {
-        selection[i] = false;
-        continue;
+      grid_ = af::versa<double, af::flex_grid<> >(accessor_, 0);
+      std::fill(selection_.begin(), selection_.end(), true);
+      map(points_.const_ref(), selection_.ref());
+    }
+
+    /**
+     * Map the selected vectors to the grid, in order, so that the last of
+     * several vectors on the same grid point wins
+     */
+    void map(af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+             af::ref<bool> const& selection) {
+      af::flex_grid<>::index_type all = accessor_.all();
+      std::vector<vec3<int> > coords;
+      std::vector<double> values;
+      centroid_grid_points(reciprocal_space_vectors,
+                           selection,
+                           d_min_,
+                           b_iso_,
+                           accessor_.focus()[0],
+                           nthreads_,
+                           coords,
+                           values);
+      for (std::size_t i = 0; i < coords.size(); i++) {
+        if (selection[i]) {
+          const vec3<int>& c = coords[i];
+          grid_[(c[0] * all[1] + c[1]) * all[2] + c[2]] = values[i];
+        }
       }
-      double T;
-      if (b_iso != 0) {
-        T = std::exp(-b_iso * v_length * v_length / 4.0);
-      } else {
-        T = 1;
+    }
+
+    af::flex_grid<> accessor_;
+    af::versa<double, af::flex_grid<> > grid_;
+    af::shared<vec3<double> > points_;
+    af::shared<bool> selection_;
+    double d_min_;
+    double b_iso_;
+    std::size_t nthreads_;
+  };
+
+  /**
+   * Compute the squared real part of the full transform of a real grid from
+   * the half complex transform. The missing half is given by F(-h) = F*(h),
+   * so the real part at -h is the same as at h.
+   * @param half The half complex transform
+   * @param n_real The size of the real grid
+   * @returns The squared real part of the full transform
+   */
+  af::versa<double, af::c_grid<3> > half_complex_real_squared(
+    af::const_ref<std::complex<double>, af::flex_grid<> > const& half,
+    af::tiny<int, 3> n_real) {
+    DIALS_ASSERT(half.accessor().nd() == 3);
+    af::flex_grid<>::index_type m = half.accessor().all();
+    const int n0 = n_real[0];
+    const int n1 = n_real[1];
+    const int n2 = n_real[2];
+    DIALS_ASSERT(m[0] == n0 && m[1] == n1 && m[2] == n2 / 2 + 1);
+    af::versa<double, af::c_grid<3> > result(af::c_grid<3>(n0, n1, n2));
+    for (int i = 0; i < n0; i++) {
+      const int ii = (n0 - i) % n0;
+      for (int j = 0; j < n1; j++) {
+        const int jj = (n1 - j) % n1;
+        for (int k = 0; k < n2; k++) {
+          double value;
+          if (k < m[2]) {
+            value = half[(i * m[1] + j) * m[2] + k].real();
+          } else {
+            value = half[(ii * m[1] + jj) * m[2] + (n2 - k)].real();
+          }
+          result(i, j, k) = value * value;
+        }
       }
-      grid(coord) = T;
     }
+    return result;
   }
 
 }}  // namespace dials::algorithms
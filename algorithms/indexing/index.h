@@ -10,6 +10,7 @@
  */
 #ifndef DIALS_ALGORITHMS_INDEXING_H
 #define DIALS_ALGORITHMS_INDEXING_H
+#include <cmath>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -21,6 +22,7 @@
 #include <scitbx/constants.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/prim_minimum_spanning_tree.hpp>
 #include <boost/graph/depth_first_search.hpp>
@@ -30,113 +32,106 @@
 
 namespace dials { namespace algorithms {
 
+  /**
+   * Find the nearest miller index of a lattice to a reciprocal lattice point
+   * @param A_inv The inverse of the UB matrix of the lattice
+   * @param rlp The reciprocal lattice point
+   * @param hkl The nearest miller index
+   * @returns The squared distance of the fractional miller index from hkl
+   */
+  inline double nearest_miller_index(scitbx::mat3<double> const& A_inv,
+                                     scitbx::vec3<double> const& rlp,
+                                     cctbx::miller::index<>& hkl) {
+    scitbx::vec3<double> hkl_f = A_inv * rlp;
+    for (std::size_t j = 0; j < 3; j++) {
+      hkl[j] = scitbx::math::iround(hkl_f[j]);
+    }
+    return (hkl_f - scitbx::vec3<double>(hkl)).length_sq();
+  }
+
   class AssignIndices {
   public:
     AssignIndices(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
                   af::const_ref<double> const& phi,
                   af::const_ref<scitbx::mat3<double> > const& UB_matrices,
-                  double tolerance = 0.3)
+                  double tolerance = 0.3,
+                  std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
       DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
 
-      typedef std::pair<const cctbx::miller::index<>, const std::size_t> pair_t;
-      typedef std::multimap<cctbx::miller::index<>, std::size_t> map_t;
-
-      map_t hkl_to_rlp_map;
-
-      std::vector<af::shared<cctbx::miller::index<> > > hkl_ints;
-      std::vector<af::shared<double> > lengths_sq;
+      typedef std::pair<cctbx::miller::index<>, std::size_t> pair_t;
 
       const double pi_4 = scitbx::constants::pi / 4;
 
-      // loop over crystals and assign one hkl per crystal per reflection
-      for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-        scitbx::mat3<double> A = UB_matrices[i_lattice];
-        scitbx::mat3<double> A_inv = A.inverse();
-        af::shared<cctbx::miller::index<> > hkl_ints_(
-          af::reserve(reciprocal_space_points.size()));
-        af::shared<double> lengths_sq_(af::reserve(reciprocal_space_points.size()));
-        for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-          scitbx::vec3<double> rlp = reciprocal_space_points[i_ref];
-          scitbx::vec3<double> hkl_f = A_inv * rlp;
-          cctbx::miller::index<> hkl_i;
-          for (std::size_t j = 0; j < 3; j++) {
-            hkl_i[j] = scitbx::math::iround(hkl_f[j]);
-          }
-          scitbx::vec3<double> diff = hkl_f - scitbx::vec3<double>(hkl_i);
-          hkl_ints_.push_back(hkl_i);
-          lengths_sq_.push_back(diff.length_sq());
-        }
-        hkl_ints.push_back(hkl_ints_);
-        lengths_sq.push_back(lengths_sq_);
+      std::vector<scitbx::mat3<double> > A_inv(UB_matrices.size());
+      for (std::size_t i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
+        A_inv[i_lattice] = UB_matrices[i_lattice].inverse();
       }
 
       // loop over all reflections and choose the best hkl (and consequently
       // crystal) for each reflection
-      double tolerance_sq = tolerance * tolerance;
-      for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-        af::shared<double> n;
-        af::shared<cctbx::miller::index<> > potential_hkls;
-        for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-          n.push_back(lengths_sq[i_lattice][i_ref]);
-          potential_hkls.push_back(hkl_ints[i_lattice][i_ref]);
-        }
-        int i_best_lattice = af::min_index(n.const_ref());
-        if (n[i_best_lattice] > tolerance_sq) {
-          continue;
+      af::shared<double> lengths_sq(reciprocal_space_points.size(), 0);
+      dials::util::parallel_for(reciprocal_space_points.size(),
+                                nthreads,
+                                AssignJob(reciprocal_space_points,
+                                          A_inv,
+                                          tolerance * tolerance,
+                                          miller_indices_.ref(),
+                                          crystal_ids_.ref(),
+                                          lengths_sq.ref()));
+
+      // sort the assigned reflections by miller index, keeping the reflections
+      // with the same miller index in order
+      std::vector<pair_t> hkl_to_rlp;
+      hkl_to_rlp.reserve(reciprocal_space_points.size());
+      for (std::size_t i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
+        if (crystal_ids_[i_ref] >= 0) {
+          hkl_to_rlp.push_back(pair_t(miller_indices_[i_ref], i_ref));
         }
-        cctbx::miller::index<> hkl = potential_hkls[i_best_lattice];
-        if (hkl[0] == 0 && hkl[1] == 0 && hkl[2] == 0) {
-          continue;
-        }
-        miller_indices_[i_ref] = hkl;
-        hkl_to_rlp_map.insert(pair_t(hkl, i_ref));
-        crystal_ids_[i_ref] = i_best_lattice;
       }
+      std::sort(hkl_to_rlp.begin(), hkl_to_rlp.end());
 
-      cctbx::miller::index<> curr_hkl(0, 0, 0);
-      std::vector<std::size_t> i_same_hkl;
       // if more than one spot can be assigned the same miller index then
-      // choose the closest one
-      for (map_t::iterator it = hkl_to_rlp_map.begin(); it != hkl_to_rlp_map.end();
-           it++) {
-        if (it->first == cctbx::miller::index<>(0, 0, 0)) {
-          continue;
+      // choose the closest one. The last miller index is not checked, as it
+      // never was when this used a std::multimap.
+      std::size_t first = 0;
+      while (first < hkl_to_rlp.size()) {
+        std::size_t last = first + 1;
+        while (last < hkl_to_rlp.size()
+               && hkl_to_rlp[last].first == hkl_to_rlp[first].first) {
+          last++;
+        }
+        if (last == hkl_to_rlp.size()) {
+          break;
         }
-        if (it->first != curr_hkl) {
-          if (i_same_hkl.size() > 1) {
-            for (int i = 0; i < i_same_hkl.size(); i++) {
-              const std::size_t i_ref = i_same_hkl[i];
-              for (int j = i + 1; j < i_same_hkl.size(); j++) {
-                const std::size_t j_ref = i_same_hkl[j];
-                int crystal_i = crystal_ids_[i_ref];
-                int crystal_j = crystal_ids_[j_ref];
-                if (crystal_i != crystal_j) {
-                  continue;
-                } else if (crystal_i == -1) {
-                  continue;
-                }
-                double phi_i = phi[i_ref];
-                double phi_j = phi[j_ref];
-                if (std::abs(phi_i - phi_j) > pi_4) {
-                  continue;
-                }
-                if (lengths_sq[crystal_j][j_ref] < lengths_sq[crystal_i][i_ref]) {
-                  miller_indices_[i_ref] = cctbx::miller::index<>(0, 0, 0);
-                  crystal_ids_[i_ref] = -1;
-                } else {
-                  miller_indices_[j_ref] = cctbx::miller::index<>(0, 0, 0);
-                  crystal_ids_[j_ref] = -1;
-                }
-              }
+        for (std::size_t i = first; i < last; i++) {
+          const std::size_t i_ref = hkl_to_rlp[i].second;
+          for (std::size_t j = i + 1; j < last; j++) {
+            const std::size_t j_ref = hkl_to_rlp[j].second;
+            int crystal_i = crystal_ids_[i_ref];
+            int crystal_j = crystal_ids_[j_ref];
+            if (crystal_i != crystal_j) {
+              continue;
+            } else if (crystal_i == -1) {
+              continue;
+            }
+            double phi_i = phi[i_ref];
+            double phi_j = phi[j_ref];
+            if (std::abs(phi_i - phi_j) > pi_4) {
+              continue;
+            }
+            if (lengths_sq[j_ref] < lengths_sq[i_ref]) {
+              miller_indices_[i_ref] = cctbx::miller::index<>(0, 0, 0);
+              crystal_ids_[i_ref] = -1;
+            } else {
+              miller_indices_[j_ref] = cctbx::miller::index<>(0, 0, 0);
+              crystal_ids_[j_ref] = -1;
             }
           }
-          curr_hkl = it->first;
-          i_same_hkl.clear();
         }
-        i_same_hkl.push_back(it->second);
+        first = last;
       }
     }
 
@@ -149,10 +144,165 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Assign the closest miller index of any lattice to a range of reflections
+     */
+    class AssignJob {
+    public:
+      AssignJob(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+                std::vector<scitbx::mat3<double> > const& A_inv,
+                double tolerance_sq,
+                af::ref<cctbx::miller::index<> > const& miller_indices,
+                af::ref<int> const& crystal_ids,
+                af::ref<double> const& lengths_sq)
+          : reciprocal_space_points_(reciprocal_space_points),
+            A_inv_(&A_inv),
+            tolerance_sq_(tolerance_sq),
+            miller_indices_(miller_indices),
+            crystal_ids_(crystal_ids),
+            lengths_sq_(lengths_sq) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::vector<scitbx::mat3<double> > const& A_inv = *A_inv_;
+        for (std::size_t i_ref = first; i_ref < last; i_ref++) {
+          scitbx::vec3<double> rlp = reciprocal_space_points_[i_ref];
+          int i_best_lattice = -1;
+          double best_length_sq = 0;
+          cctbx::miller::index<> best_hkl(0, 0, 0);
+          for (std::size_t i_lattice = 0; i_lattice < A_inv.size(); i_lattice++) {
+            cctbx::miller::index<> hkl_i;
+            double length_sq = nearest_miller_index(A_inv[i_lattice], rlp, hkl_i);
+            if (i_best_lattice < 0 || length_sq < best_length_sq) {
+              i_best_lattice = i_lattice;
+              best_length_sq = length_sq;
+              best_hkl = hkl_i;
+            }
+          }
+          if (i_best_lattice < 0 || best_length_sq > tolerance_sq_) {
+            continue;
+          }
+          if (best_hkl[0] == 0 && best_hkl[1] == 0 && best_hkl[2] == 0) {
+            continue;
+          }
+          miller_indices_[i_ref] = best_hkl;
+          crystal_ids_[i_ref] = i_best_lattice;
+          lengths_sq_[i_ref] = best_length_sq;
+        }
+      }
+
+    private:
+      af::const_ref<scitbx::vec3<double> > reciprocal_space_points_;
+      const std::vector<scitbx::mat3<double> >* A_inv_;
+      double tolerance_sq_;
+      af::ref<cctbx::miller::index<> > miller_indices_;
+      af::ref<int> crystal_ids_;
+      af::ref<double> lengths_sq_;
+    };
+
     af::shared<cctbx::miller::index<> > miller_indices_;
     af::shared<int> crystal_ids_;
   };
 
+  /**
+   * Score a set of candidate crystal models together, for choosing which of
+   * them are worth refining. Each candidate is scored on its own, as if it
+   * were the only lattice given to AssignIndices, by the number of points it
+   * indexes within the tolerance and the rmsd of their fractional miller
+   * indices from the integer ones. Unlike AssignIndices, points given the
+   * same miller index are all counted, so the scores can be computed for all
+   * the candidates at once with a thread per block of candidates.
+   */
+  class ScoreCandidateModels {
+  public:
+    /**
+     * @param reciprocal_space_points The reciprocal lattice points
+     * @param UB_matrices The UB matrix of each candidate
+     * @param tolerance The maximum distance of an indexed point from its hkl
+     * @param nthreads The number of threads
+     */
+    ScoreCandidateModels(
+      af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+      af::const_ref<scitbx::mat3<double> > const& UB_matrices,
+      double tolerance = 0.3,
+      std::size_t nthreads = 1)
+        : n_indexed_(UB_matrices.size(), 0), rmsd_(UB_matrices.size(), 0) {
+      DIALS_ASSERT(tolerance > 0);
+      dials::util::parallel_for(UB_matrices.size(),
+                                nthreads,
+                                ScoreJob(reciprocal_space_points,
+                                         UB_matrices,
+                                         tolerance * tolerance,
+                                         n_indexed_.ref(),
+                                         rmsd_.ref()));
+    }
+
+    /**
+     * @returns The number of points indexed by each candidate
+     */
+    af::shared<std::size_t> n_indexed() const {
+      return n_indexed_;
+    }
+
+    /**
+     * @returns The rmsd of the fractional miller indices of each candidate
+     */
+    af::shared<double> rmsd() const {
+      return rmsd_;
+    }
+
+  private:
+    /**
+     * Score a range of candidates
+     */
+    class ScoreJob {
+    public:
+      ScoreJob(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+               af::const_ref<scitbx::mat3<double> > const& UB_matrices,
+               double tolerance_sq,
+               af::ref<std::size_t> const& n_indexed,
+               af::ref<double> const& rmsd)
+          : reciprocal_space_points_(reciprocal_space_points),
+            UB_matrices_(UB_matrices),
+            tolerance_sq_(tolerance_sq),
+            n_indexed_(n_indexed),
+            rmsd_(rmsd) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i_lattice = first; i_lattice < last; i_lattice++) {
+          scitbx::mat3<double> A_inv = UB_matrices_[i_lattice].inverse();
+          std::size_t count = 0;
+          double sum_sq = 0;
+          for (std::size_t i_ref = 0; i_ref < reciprocal_space_points_.size();
+               i_ref++) {
+            cctbx::miller::index<> hkl;
+            double length_sq =
+              nearest_miller_index(A_inv, reciprocal_space_points_[i_ref], hkl);
+            if (length_sq > tolerance_sq_) {
+              continue;
+            }
+            if (hkl[0] == 0 && hkl[1] == 0 && hkl[2] == 0) {
+              continue;
+            }
+            count++;
+            sum_sq += length_sq;
+          }
+          n_indexed_[i_lattice] = count;
+          rmsd_[i_lattice] = count > 0 ? std::sqrt(sum_sq / count) : 0.0;
+        }
+      }
+
+    private:
+      af::const_ref<scitbx::vec3<double> > reciprocal_space_points_;
+      af::const_ref<scitbx::mat3<double> > UB_matrices_;
+      double tolerance_sq_;
+      af::ref<std::size_t> n_indexed_;
+      af::ref<double> rmsd_;
+    };
+
+    af::shared<std::size_t> n_indexed_;
+    af::shared<double> rmsd_;
+  };
+
   typedef struct edge_ {
     std::size_t i;
     std::size_t j;
@@ -180,7 +330,8 @@ namespace dials { namespace algorithms {
       const double epsilon = 0.05,
       const double delta = 5,
       const double l_min = 0.8,
-      const int nearest_neighbours = 20)
+      const int nearest_neighbours = 20,
+      const std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
@@ -210,13 +361,26 @@ namespace dials { namespace algorithms {
       AnnAdaptor ann = AnnAdaptor(rlps_double, 4, nearest_neighbours);
       ann.query(rlps_double);
 
-      const double one_over_epsilon = 1.0 / epsilon;
-
       // loop over crystals and assign one hkl per crystal per reflection
       for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
         scitbx::mat3<double> const& A = UB_matrices[i_lattice];
         scitbx::mat3<double> const& A_inv = A.inverse();
 
+        // the edge weights for each reflection and its nearest neighbours
+        // don't depend on each other, so are computed in parallel
+        std::vector<scitbx::vec3<double> > h_ij_all(ann.nn.size());
+        std::vector<double> l_ij_all(ann.nn.size());
+        dials::util::parallel_for(reciprocal_space_points.size(),
+                                  nthreads,
+                                  EdgeJob(reciprocal_space_points,
+                                          ann.nn.const_ref(),
+                                          A_inv,
+                                          epsilon,
+                                          delta,
+                                          nearest_neighbours,
+                                          h_ij_all,
+                                          l_ij_all));
+
         Graph G(reciprocal_space_points.size());
 
         for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
@@ -227,24 +391,6 @@ namespace dials { namespace algorithms {
             if (boost::edge(i, j, G).second) {
               continue;
             }
-            scitbx::vec3<double> d_r =
-              reciprocal_space_points[i] - reciprocal_space_points[j];
-            scitbx::vec3<double> h_f = A_inv * d_r;
-            scitbx::vec3<double> h_ij;
-            for (std::size_t ii = 0; ii < 3; ii++) {
-              h_ij[ii] = scitbx::math::nearest_integer(h_f[ii]);
-            }
-            scitbx::vec3<double> d_h = h_f - h_ij;
-
-            // calculate l_ij
-            double exponent = 0;
-            for (std::size_t ii = 0; ii < 3; ii++) {
-              exponent += std::pow(
-                std::max(std::abs(d_h[ii]) - epsilon, 0.) * one_over_epsilon, 2);
-              exponent += std::pow(std::max(std::abs(h_ij[ii]) - delta, 0.), 2);
-            }
-            exponent *= -2;
-            double l_ij = 1 - std::exp(exponent);
 
             // add the edge
             Edge e1;
@@ -252,8 +398,8 @@ namespace dials { namespace algorithms {
             boost::tie(e1, b1) = add_edge(i, j, G);
 
             // set the edge properties
-            G[e1].h_ij = h_ij;
-            G[e1].l_ij = l_ij;
+            G[e1].h_ij = h_ij_all[i_k_plus_i_ann];
+            G[e1].l_ij = l_ij_all[i_k_plus_i_ann];
             G[e1].i = i;
             G[e1].j = j;
           }
@@ -334,17 +480,19 @@ namespace dials { namespace algorithms {
           }
         }
 
-        std::set<std::size_t> unique_subtree_ids(subtree_ids_.begin(),
-                                                 subtree_ids_.end());
+        // count the size of each subtree in one pass, choosing the lowest
+        // subtree id of the largest size
+        std::vector<std::size_t> subtree_sizes(next_subtree + 1, 0);
+        for (std::size_t i = 0; i < subtree_ids_.size(); i++) {
+          DIALS_ASSERT(subtree_ids_[i] < subtree_sizes.size());
+          subtree_sizes[subtree_ids_[i]]++;
+        }
         std::size_t largest_subtree_id = 0;
         std::size_t largest_subtree_size = 0;
-        for (std::set<std::size_t>::iterator it = unique_subtree_ids.begin();
-             it != unique_subtree_ids.end();
-             ++it) {
-          std::size_t size = std::count(subtree_ids_.begin(), subtree_ids_.end(), *it);
-          if (size > largest_subtree_size) {
-            largest_subtree_size = size;
-            largest_subtree_id = *it;
+        for (std::size_t id = 0; id < subtree_sizes.size(); id++) {
+          if (subtree_sizes[id] > largest_subtree_size) {
+            largest_subtree_size = subtree_sizes[id];
+            largest_subtree_id = id;
           }
         }
 
@@ -373,6 +521,71 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Compute the edge weights between a range of reflections and their
+     * nearest neighbours
+     */
+    class EdgeJob {
+    public:
+      EdgeJob(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
+              af::const_ref<int> const& nn,
+              scitbx::mat3<double> const& A_inv,
+              double epsilon,
+              double delta,
+              std::size_t nearest_neighbours,
+              std::vector<scitbx::vec3<double> >& h_ij,
+              std::vector<double>& l_ij)
+          : reciprocal_space_points_(reciprocal_space_points),
+            nn_(nn),
+            A_inv_(A_inv),
+            epsilon_(epsilon),
+            one_over_epsilon_(1.0 / epsilon),
+            delta_(delta),
+            nearest_neighbours_(nearest_neighbours),
+            h_ij_(&h_ij),
+            l_ij_(&l_ij) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; i++) {
+          std::size_t i_k = i * nearest_neighbours_;
+          for (std::size_t i_ann = 0; i_ann < nearest_neighbours_; i_ann++) {
+            std::size_t i_k_plus_i_ann = i_k + i_ann;
+            std::size_t j = nn_[i_k_plus_i_ann];
+            scitbx::vec3<double> d_r =
+              reciprocal_space_points_[i] - reciprocal_space_points_[j];
+            scitbx::vec3<double> h_f = A_inv_ * d_r;
+            scitbx::vec3<double> h_ij;
+            for (std::size_t ii = 0; ii < 3; ii++) {
+              h_ij[ii] = scitbx::math::nearest_integer(h_f[ii]);
+            }
+            scitbx::vec3<double> d_h = h_f - h_ij;
+
+            // calculate l_ij
+            double exponent = 0;
+            for (std::size_t ii = 0; ii < 3; ii++) {
+              exponent += std::pow(
+                std::max(std::abs(d_h[ii]) - epsilon_, 0.) * one_over_epsilon_, 2);
+              exponent += std::pow(std::max(std::abs(h_ij[ii]) - delta_, 0.), 2);
+            }
+            exponent *= -2;
+            (*h_ij_)[i_k_plus_i_ann] = h_ij;
+            (*l_ij_)[i_k_plus_i_ann] = 1 - std::exp(exponent);
+          }
+        }
+      }
+
+    private:
+      af::const_ref<scitbx::vec3<double> > reciprocal_space_points_;
+      af::const_ref<int> nn_;
+      scitbx::mat3<double> A_inv_;
+      double epsilon_;
+      double one_over_epsilon_;
+      double delta_;
+      std::size_t nearest_neighbours_;
+      std::vector<scitbx::vec3<double> >* h_ij_;
+      std::vector<double>* l_ij_;
+    };
+
     af::shared<cctbx::miller::index<> > miller_indices_;
     af::shared<std::size_t> subtree_ids_;
     af::shared<int> crystal_ids_;
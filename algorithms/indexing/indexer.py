@@ -312,10 +312,12 @@ def __init__(self, reflections, experiments, params):
                 delta=self.params.index_assignment.local.delta,
                 l_min=self.params.index_assignment.local.l_min,
                 nearest_neighbours=self.params.index_assignment.local.nearest_neighbours,
+                nthreads=self.params.nproc,
             )
         else:
             self._assign_indices = assign_indices.AssignIndicesGlobal(
-                tolerance=self.params.index_assignment.simple.hkl_tolerance
+                tolerance=self.params.index_assignment.simple.hkl_tolerance,
+                nthreads=self.params.nproc,
             )
 
         if self.all_params.refinement.reflections.outlier.algorithm in (
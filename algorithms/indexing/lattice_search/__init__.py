@@ -10,7 +10,7 @@
 from dxtbx.model.experiment_list import Experiment, ExperimentList
 from scitbx.array_family import flex
 
-from dials.algorithms.indexing import indexer
+from dials.algorithms.indexing import ext, indexer
 from dials.algorithms.indexing.basis_vector_search import combinations, optimise
 
 from .low_res_spot_match import LowResSpotMatch
@@ -35,6 +35,13 @@
         .help = "Maximum number of putative crystal models to test. Default"
                 "for rotation sequences: 50, for still images: 5"
         .expert_level = 1
+    max_quick_score = None
+        .type = int(value_min=1)
+        .help = "If set, score all the candidate models together by the number of"
+                "reflections each indexes and the rmsd of their fractional Miller"
+                "indices, and only consider the best max_quick_score candidates"
+                "for refinement."
+        .expert_level = 2
     sys_absent_threshold = 0.9
         .type = float(value_min=0.0, value_max=1.0)
     solution_scorer = filter *weighted
@@ -180,26 +187,36 @@ def choose_best_orientation_matrix(self, candidate_orientation_matrices):
                 n_indexed_cutoff=filter_params.n_indexed_cutoff,
             )
 
+        sel = self.reflections["id"] == -1
+        if self.d_min is not None:
+            sel &= 1 / self.reflections["rlp"].norms() > self.d_min
+        xo, yo, zo = self.reflections["xyzobs.mm.value"].parts()
+        imageset_id = self.reflections["imageset_id"]
+        for i_expt, expt in enumerate(self.experiments):
+            # XXX Not sure if we still need this loop over self.experiments
+            if expt.scan is not None:
+                start, end = expt.scan.get_oscillation_range()
+                if (end - start) > 360:
+                    # only use reflections from the first 360 degrees of the scan
+                    sel.set_selected(
+                        (imageset_id == i_expt)
+                        & (zo > ((start * math.pi / 180) + 2 * math.pi)),
+                        False,
+                    )
+
+        max_quick_score = self.params.basis_vector_combinations.max_quick_score
+        if max_quick_score is not None:
+            candidate_orientation_matrices = self._quick_score_candidates(
+                candidate_orientation_matrices,
+                self.reflections["rlp"].select(sel),
+                max_quick_score,
+            )
+
         args = []
 
         for cm in candidate_orientation_matrices:
-            sel = self.reflections["id"] == -1
-            if self.d_min is not None:
-                sel &= 1 / self.reflections["rlp"].norms() > self.d_min
-            xo, yo, zo = self.reflections["xyzobs.mm.value"].parts()
-            imageset_id = self.reflections["imageset_id"]
             experiments = ExperimentList()
-            for i_expt, expt in enumerate(self.experiments):
-                # XXX Not sure if we still need this loop over self.experiments
-                if expt.scan is not None:
-                    start, end = expt.scan.get_oscillation_range()
-                    if (end - start) > 360:
-                        # only use reflections from the first 360 degrees of the scan
-                        sel.set_selected(
-                            (imageset_id == i_expt)
-                            & (zo > ((start * math.pi / 180) + 2 * math.pi)),
-                            False,
-                        )
+            for expt in self.experiments:
                 experiments.append(
                     Experiment(
                         imageset=expt.imageset,
@@ -289,6 +306,40 @@ def choose_best_orientation_matrix(self, candidate_orientation_matrices):
         else:
             return None, None
 
+    def _quick_score_candidates(self, candidates, rlps, max_candidates):
+        """
+        Score all the candidate models in one threaded pass, without refining
+        them, and keep the best for the full evaluation.
+
+        The candidates are ranked by the number of reflections each indexes,
+        then by the rmsd of their fractional Miller indices, and those indexing
+        no reflections are dropped. The candidates kept are returned in their
+        original order, so the order of the search still breaks the ties of
+        the full evaluation.
+        """
+        candidates = list(candidates)
+        if not candidates:
+            return candidates
+        scores = ext.ScoreCandidateModels(
+            rlps,
+            flex.mat3_double([cm.get_A() for cm in candidates]),
+            tolerance=self.params.index_assignment.simple.hkl_tolerance,
+            nthreads=self.params.nproc,
+        )
+        n_indexed = scores.n_indexed()
+        rmsd = scores.rmsd()
+        ranked = sorted(
+            (i for i in range(len(candidates)) if n_indexed[i] > 0),
+            key=lambda i: (-n_indexed[i], rmsd[i]),
+        )
+        keep = sorted(ranked[:max_candidates])
+        logger.debug(
+            "Keeping %d of %d candidate models after quick scoring",
+            len(keep),
+            len(candidates),
+        )
+        return [candidates[i] for i in keep]
+
 
 class BasisVectorSearch(LatticeSearch):
     def __init__(self, reflections, experiments, params):
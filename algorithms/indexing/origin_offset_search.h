@@ -0,0 +1,281 @@
+/*
+ * origin_offset_search.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INDEXING_ORIGIN_OFFSET_SEARCH_H
+#define DIALS_ALGORITHMS_INDEXING_ORIGIN_OFFSET_SEARCH_H
+#include <cmath>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::mat3;
+  using scitbx::vec3;
+
+  /**
+   * Score trial offsets of the detector origin for the beam centre search.
+   *
+   * The spots of each experiment are given by their lab coordinates on the
+   * current detector, and a trial offset moves the whole detector, so the
+   * spots are mapped to reciprocal space for each offset without going back
+   * to the detector model. Each experiment also has the real space basis
+   * vectors of its DPS solutions. If the beam centre is right then the
+   * origin of reciprocal space lies on the lattice planes of each basis
+   * vector t, so the score of an offset is the sum over the basis vectors of
+   * the cosine of the phase of sum(exp(2 pi i t.S)), as for the directional
+   * FFTs of the Python scoring, skipping the vectors whose transform has a
+   * modulus of less than a quarter of the number of spots.
+   */
+  class OriginOffsetScorer {
+  public:
+    OriginOffsetScorer() {}
+
+    /**
+     * Add the spots and basis vectors of an experiment
+     * @param lab_coords The lab coordinates of the spots
+     * @param phi The rotation angles of the spots
+     * @param s0 The beam vector
+     * @param rotation_axis The rotation axis datum
+     * @param setting_rotation The setting rotation of the goniometer
+     * @param basis_vectors The real space basis vectors of the solutions
+     */
+    void add_experiment(af::const_ref<vec3<double> > const& lab_coords,
+                        af::const_ref<double> const& phi,
+                        vec3<double> const& s0,
+                        vec3<double> const& rotation_axis,
+                        mat3<double> const& setting_rotation,
+                        af::const_ref<vec3<double> > const& basis_vectors) {
+      DIALS_ASSERT(lab_coords.size() == phi.size());
+      DIALS_ASSERT(s0.length() > 0);
+      DIALS_ASSERT(rotation_axis.length() > 0);
+      experiments_.push_back(ExperimentData());
+      ExperimentData& data = experiments_.back();
+      data.s0 = s0;
+      data.lab_coords.assign(lab_coords.begin(), lab_coords.end());
+      data.basis_vectors.assign(basis_vectors.begin(), basis_vectors.end());
+
+      // Map the diffracted beam vectors back to the reciprocal lattice points
+      // at phi = 0, as in map_centroids_to_reciprocal_space with an identity
+      // fixed rotation
+      mat3<double> setting_inv = setting_rotation.inverse();
+      vec3<double> k = rotation_axis.normalize();
+      data.rotations.reserve(phi.size());
+      for (std::size_t j = 0; j < phi.size(); ++j) {
+        double c = std::cos(-phi[j]);
+        double s = std::sin(-phi[j]);
+        mat3<double> R(c + k[0] * k[0] * (1 - c),
+                       k[0] * k[1] * (1 - c) - k[2] * s,
+                       k[0] * k[2] * (1 - c) + k[1] * s,
+                       k[1] * k[0] * (1 - c) + k[2] * s,
+                       c + k[1] * k[1] * (1 - c),
+                       k[1] * k[2] * (1 - c) - k[0] * s,
+                       k[2] * k[0] * (1 - c) - k[1] * s,
+                       k[2] * k[1] * (1 - c) + k[0] * s,
+                       c + k[2] * k[2] * (1 - c));
+        data.rotations.push_back(R * setting_inv);
+      }
+    }
+
+    /**
+     * @returns The number of experiments
+     */
+    std::size_t num_experiments() const {
+      return experiments_.size();
+    }
+
+    /**
+     * Score a trial origin offset
+     * @param offset The offset of the detector origin
+     * @returns The sum of the scores of all the experiments
+     */
+    double score(vec3<double> const& offset) const {
+      std::vector<vec3<double> > rlp;
+      double result = 0;
+      for (std::size_t i = 0; i < experiments_.size(); ++i) {
+        result += score_experiment(experiments_[i], offset, rlp);
+      }
+      return result;
+    }
+
+    /**
+     * Score a set of trial origin offsets in parallel
+     * @param offsets The offsets of the detector origin
+     * @param nthreads The number of threads
+     * @returns The score of each offset
+     */
+    af::shared<double> scores(af::const_ref<vec3<double> > const& offsets,
+                              std::size_t nthreads = 1) const {
+      DIALS_ASSERT(nthreads > 0);
+      af::shared<double> result(offsets.size(), 0);
+      dials::util::parallel_for(
+        offsets.size(), nthreads, ScoreJob(*this, offsets, result.ref()));
+      return result;
+    }
+
+    /**
+     * Find the offset with the best score near a starting offset, with a
+     * Nelder-Mead simplex in the plane of two search axes
+     * @param start The starting offset
+     * @param axis1 The first search axis
+     * @param axis2 The second search axis
+     * @param step The size of the initial simplex along each axis
+     * @param tolerance The spread of the scores of the simplex at convergence
+     * @param max_iterations The maximum number of iterations
+     * @returns The offset with the best score
+     */
+    vec3<double> refine(vec3<double> const& start,
+                        vec3<double> const& axis1,
+                        vec3<double> const& axis2,
+                        double step = 0.2,
+                        double tolerance = 1e-7,
+                        std::size_t max_iterations = 500) const {
+      DIALS_ASSERT(step > 0);
+      DIALS_ASSERT(tolerance >= 0);
+      vec3<double> a1 = axis1 * step;
+      vec3<double> a2 = axis2 * step;
+
+      // The vertices of the simplex in units of the steps along the axes
+      // and the negated scores, so the simplex minimises
+      double x[3][2] = {{0, 0}, {1, 0}, {0, 1}};
+      double f[3];
+      for (std::size_t i = 0; i < 3; ++i) {
+        f[i] = -score(start + x[i][0] * a1 + x[i][1] * a2);
+      }
+      for (std::size_t iter = 0; iter < max_iterations; ++iter) {
+        // Order the vertices from best to worst
+        for (std::size_t i = 1; i < 3; ++i) {
+          for (std::size_t j = i; j > 0 && f[j] < f[j - 1]; --j) {
+            std::swap(f[j], f[j - 1]);
+            std::swap(x[j][0], x[j - 1][0]);
+            std::swap(x[j][1], x[j - 1][1]);
+          }
+        }
+        if (f[2] - f[0] <= tolerance) {
+          break;
+        }
+        double c[2] = {(x[0][0] + x[1][0]) / 2, (x[0][1] + x[1][1]) / 2};
+        double xr[2] = {2 * c[0] - x[2][0], 2 * c[1] - x[2][1]};
+        double fr = -score(start + xr[0] * a1 + xr[1] * a2);
+        if (fr < f[0]) {
+          double xe[2] = {3 * c[0] - 2 * x[2][0], 3 * c[1] - 2 * x[2][1]};
+          double fe = -score(start + xe[0] * a1 + xe[1] * a2);
+          if (fe < fr) {
+            set_vertex(x[2], f[2], xe, fe);
+          } else {
+            set_vertex(x[2], f[2], xr, fr);
+          }
+        } else if (fr < f[1]) {
+          set_vertex(x[2], f[2], xr, fr);
+        } else {
+          // Contract towards the better of the reflected and worst vertices
+          const double* xo = fr < f[2] ? xr : x[2];
+          double fo = fr < f[2] ? fr : f[2];
+          double xc[2] = {(c[0] + xo[0]) / 2, (c[1] + xo[1]) / 2};
+          double fc = -score(start + xc[0] * a1 + xc[1] * a2);
+          if (fc < fo) {
+            set_vertex(x[2], f[2], xc, fc);
+          } else {
+            // Shrink towards the best vertex
+            for (std::size_t i = 1; i < 3; ++i) {
+              x[i][0] = (x[0][0] + x[i][0]) / 2;
+              x[i][1] = (x[0][1] + x[i][1]) / 2;
+              f[i] = -score(start + x[i][0] * a1 + x[i][1] * a2);
+            }
+          }
+        }
+      }
+      std::size_t best = 0;
+      for (std::size_t i = 1; i < 3; ++i) {
+        if (f[i] < f[best]) {
+          best = i;
+        }
+      }
+      return start + x[best][0] * a1 + x[best][1] * a2;
+    }
+
+  private:
+    struct ExperimentData {
+      vec3<double> s0;
+      std::vector<vec3<double> > lab_coords;
+      std::vector<mat3<double> > rotations;
+      std::vector<vec3<double> > basis_vectors;
+    };
+
+    /**
+     * Score a range of the offsets
+     */
+    class ScoreJob {
+    public:
+      ScoreJob(OriginOffsetScorer const& scorer,
+               af::const_ref<vec3<double> > const& offsets,
+               af::ref<double> const& scores)
+          : scorer_(&scorer), offsets_(offsets), scores_(scores) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          scores_[i] = scorer_->score(offsets_[i]);
+        }
+      }
+
+    private:
+      const OriginOffsetScorer* scorer_;
+      af::const_ref<vec3<double> > offsets_;
+      af::ref<double> scores_;
+    };
+
+    static void set_vertex(double* x, double& f, const double* xn, double fn) {
+      x[0] = xn[0];
+      x[1] = xn[1];
+      f = fn;
+    }
+
+    static double score_experiment(ExperimentData const& data,
+                                   vec3<double> const& offset,
+                                   std::vector<vec3<double> >& rlp) {
+      const double two_pi = 2 * scitbx::constants::pi;
+      const std::size_t n = data.lab_coords.size();
+      if (n == 0) {
+        return 0;
+      }
+      const double inv_wavelength = data.s0.length();
+      rlp.resize(n);
+      for (std::size_t j = 0; j < n; ++j) {
+        vec3<double> s1 = data.lab_coords[j] + offset;
+        s1 *= inv_wavelength / s1.length();
+        rlp[j] = data.rotations[j] * (s1 - data.s0);
+      }
+      const double cutoff = n / 4.0;
+      double result = 0;
+      for (std::size_t t = 0; t < data.basis_vectors.size(); ++t) {
+        vec3<double> v = data.basis_vectors[t];
+        double re = 0;
+        double im = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+          double arg = two_pi * (rlp[j] * v);
+          re += std::cos(arg);
+          im += std::sin(arg);
+        }
+        double modulus = std::sqrt(re * re + im * im);
+        if (modulus > cutoff) {
+          result += re / modulus;
+        }
+      }
+      return result;
+    }
+
+    std::vector<ExperimentData> experiments_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INDEXING_ORIGIN_OFFSET_SEARCH_H
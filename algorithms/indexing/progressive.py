@@ -0,0 +1,138 @@
+"""
+Index a rotation sequence while its spots are still being found.
+
+The spots are added as they are found, e.g. from the streaming spot finder,
+and once they cover the first few degrees of the sequence an attempt is made
+to index them, followed by another attempt each time a few more degrees have
+been added. Each attempt is a full run of the indexer on all of the spots so
+far, but with the fft3d method the reciprocal space grid is kept between the
+attempts: the spots are added to the grid as they arrive, so an attempt only
+has to transform the grid and search it for peaks.
+"""
+
+import collections
+import copy
+import logging
+
+from dials.algorithms.indexing import DialsIndexError
+from dials.algorithms.indexing.basis_vector_search import ProgressiveFFT3D
+from dials.algorithms.indexing.indexer import Indexer
+from dials.algorithms.indexing.lattice_search import BasisVectorSearch
+from dials.array_family import flex
+
+logger = logging.getLogger(__name__)
+
+Attempt = collections.namedtuple(
+    "Attempt", ["degrees", "num_spots", "num_indexed", "unit_cell"]
+)
+
+
+class ProgressiveIndexer:
+    """
+    Index the spots of a rotation sequence progressively as they are found.
+    """
+
+    def __init__(self, experiments, params, min_degrees=5, step_degrees=5):
+        """
+        :param experiments: The experiment of the sequence
+        :param params: The indexing parameters, as for dials.index
+        :param min_degrees: The rotation to cover before the first attempt
+        :param step_degrees: The rotation to add before each later attempt
+        """
+        assert len(experiments) == 1, "Only one sequence can be indexed"
+        assert experiments[0].scan is not None, "The experiment has no scan"
+        self.experiments = experiments
+        self.params = copy.deepcopy(params)
+        self.min_degrees = min_degrees
+        self.step_degrees = max(step_degrees, 1e-6)
+        self.reflections = flex.reflection_table()
+        self.degrees = 0
+        self.next_attempt = min_degrees
+        self.attempts = []
+        self.refined_experiments = None
+        self.refined_reflections = None
+        self._strategy = None
+        self._pending = flex.vec3_double()
+
+    def add_spots(self, reflections, index):
+        """
+        Add the spots found so far.
+
+        :param reflections: The new spots
+        :param index: The index in the sequence of the last image read
+        :returns: True if enough rotation has been added for another attempt
+        """
+        experiment = self.experiments[0]
+        reflections["id"] = flex.int(len(reflections), 0)
+        reflections["imageset_id"] = flex.int(len(reflections), 0)
+        if experiment.identifier:
+            reflections.experiment_identifiers()[0] = experiment.identifier
+        if len(reflections):
+            reflections.centroid_px_to_mm(self.experiments)
+            reflections.map_centroids_to_reciprocal_space(self.experiments)
+            if self._strategy is not None:
+                self._strategy.add_reciprocal_lattice_vectors(reflections["rlp"])
+            else:
+                self._pending.extend(reflections["rlp"])
+            self.reflections.extend(reflections)
+        self.degrees = (index + 1) * experiment.scan.get_oscillation()[1]
+        return self.degrees >= self.next_attempt
+
+    def index(self):
+        """
+        Index the spots found so far.
+
+        :returns: The indexed experiments, or None if indexing failed
+        """
+        while self.next_attempt <= self.degrees:
+            self.next_attempt += self.step_degrees
+        logger.info(
+            "Indexing %d spots from %.1f degrees", len(self.reflections), self.degrees
+        )
+        try:
+            idxr = Indexer.from_parameters(
+                copy.deepcopy(self.reflections),
+                copy.deepcopy(self.experiments),
+                params=copy.deepcopy(self.params),
+            )
+            self._use_progressive_grid(idxr)
+            idxr.index()
+        except DialsIndexError as e:
+            logger.info("Indexing %.1f degrees failed: %s", self.degrees, e)
+            self.attempts.append(Attempt(self.degrees, len(self.reflections), 0, None))
+            return None
+
+        self.refined_experiments = idxr.refined_experiments
+        self.refined_reflections = copy.deepcopy(idxr.refined_reflections)
+        self.refined_reflections.extend(idxr.unindexed_reflections)
+        self.attempts.append(
+            Attempt(
+                self.degrees,
+                len(self.reflections),
+                len(idxr.refined_reflections),
+                self.refined_experiments[0].crystal.get_unit_cell(),
+            )
+        )
+        return self.refined_experiments
+
+    def _use_progressive_grid(self, idxr):
+        """
+        Give an fft3d indexer the search with the grid of the spots added so
+        far. The grid is created on the first attempt, with the max_cell found
+        then, and max_cell is kept for the later attempts so the grid stays
+        valid.
+        """
+        if not isinstance(idxr, BasisVectorSearch):
+            return
+        if self.params.indexing.method != "fft3d":
+            return
+        if self._strategy is None:
+            self.params.indexing.max_cell = idxr.params.max_cell
+            self._strategy = ProgressiveFFT3D(
+                max_cell=idxr.params.max_cell,
+                min_cell=idxr.params.min_cell,
+                params=copy.deepcopy(self.params.indexing.fft3d),
+            )
+            self._strategy.add_reciprocal_lattice_vectors(self._pending)
+            self._pending = None
+        idxr._basis_vector_search_strategy = self._strategy
@@ -0,0 +1,95 @@
+/*
+ * real_space_grid_search.h
+ *
+ *  Copyright (C) 2014 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INDEXING_REAL_SPACE_GRID_SEARCH_H
+#define DIALS_ALGORITHMS_INDEXING_REAL_SPACE_GRID_SEARCH_H
+#include <cmath>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::vec3;
+
+  /**
+   * Score a range of the search vectors against all the reciprocal lattice
+   * vectors. The reciprocal lattice vectors are stored as separate x, y and
+   * z arrays so that the inner loop reads contiguous memory.
+   */
+  class RealSpaceGridSearchJob {
+  public:
+    RealSpaceGridSearchJob(af::const_ref<vec3<double> > const& vectors,
+                           std::vector<double> const& x,
+                           std::vector<double> const& y,
+                           std::vector<double> const& z,
+                           af::ref<double> const& scores)
+        : vectors_(vectors), x_(&x), y_(&y), z_(&z), scores_(scores) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      const double two_pi = 2 * scitbx::constants::pi;
+      const double* x = &(*x_)[0];
+      const double* y = &(*y_)[0];
+      const double* z = &(*z_)[0];
+      const std::size_t n = x_->size();
+      for (std::size_t i = first; i < last; i++) {
+        const vec3<double> v = vectors_[i];
+        double sum = 0;
+        for (std::size_t j = 0; j < n; j++) {
+          sum += std::cos(two_pi * (x[j] * v[0] + y[j] * v[1] + z[j] * v[2]));
+        }
+        scores_[i] = sum;
+      }
+    }
+
+  private:
+    af::const_ref<vec3<double> > vectors_;
+    const std::vector<double>* x_;
+    const std::vector<double>* y_;
+    const std::vector<double>* z_;
+    af::ref<double> scores_;
+  };
+
+  /**
+   * Compute the real space grid search functional for each search vector,
+   * the sum over the reciprocal lattice vectors of cos(2 pi S.v)
+   * @param vectors The search vectors
+   * @param reciprocal_lattice_vectors The reciprocal lattice vectors
+   * @param nthreads The number of threads
+   * @returns The score of each search vector
+   */
+  inline af::shared<double> real_space_grid_search_scores(
+    af::const_ref<vec3<double> > const& vectors,
+    af::const_ref<vec3<double> > const& reciprocal_lattice_vectors,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(nthreads > 0);
+    af::shared<double> scores(vectors.size(), 0);
+    if (reciprocal_lattice_vectors.size() == 0) {
+      return scores;
+    }
+    std::vector<double> x(reciprocal_lattice_vectors.size());
+    std::vector<double> y(reciprocal_lattice_vectors.size());
+    std::vector<double> z(reciprocal_lattice_vectors.size());
+    for (std::size_t j = 0; j < reciprocal_lattice_vectors.size(); j++) {
+      x[j] = reciprocal_lattice_vectors[j][0];
+      y[j] = reciprocal_lattice_vectors[j][1];
+      z[j] = reciprocal_lattice_vectors[j][2];
+    }
+    dials::util::parallel_for(
+      vectors.size(),
+      nthreads,
+      RealSpaceGridSearchJob(vectors, x, y, z, scores.ref()));
+    return scores;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif
@@ -7,6 +7,7 @@
 __all__ = (  # noqa: F405
     "Corrections",
     "CorrectionsMulti",
+    "IntegrationPrefilter",
     "lp_correction",
     "qe_correction",
     "Result",
@@ -14,11 +15,14 @@
 
 Result = collections.namedtuple(
     "Result",
-    "index, reflections, data, read_time, extract_time, process_time, total_time",
+    "index, reflections, data, read_time, extract_time, process_time, total_time,"
+    " telemetry",
+    defaults=(None,),
 )
 #        :param index: The processing job index
 #        :param reflections: The processed reflections
 #        :param data: Other processed data
+#        :param telemetry: The telemetry from the threaded integrators, if any
 
 
 class TimingInfo:
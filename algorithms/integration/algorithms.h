@@ -38,7 +38,9 @@
 #include <dials/algorithms/background/gmodel/creator.h>
 
 #include <dials/algorithms/integration/fit/fitting.h>
+#include <dials/algorithms/integration/fit/batch_fitting.h>
 #include <dials/algorithms/integration/interfaces.h>
+#include <dials/algorithms/integration/transformed_profile_cache.h>
 
 namespace dials { namespace algorithms {
 
@@ -396,6 +398,16 @@ namespace dials { namespace algorithms {
       const GaussianRSMultiCrystalReferenceProfileData &data)
         : data_spec_(data) {}
 
+    /**
+     * Initialise the algorithm
+     * @param data The data to do profile fitting
+     * @param transform_cache The shoeboxes transformed by the reference pass
+     */
+    GaussianRSReciprocalSpaceIntensityCalculator(
+      const GaussianRSMultiCrystalReferenceProfileData &data,
+      boost::shared_ptr<TransformedProfileCache> transform_cache)
+        : data_spec_(data), transform_cache_(transform_cache) {}
+
     /**
      * Compute the intensity
      * @param reflection The reflection object
@@ -403,6 +415,44 @@ namespace dials { namespace algorithms {
      */
     virtual void exec(af::Reflection &reflection,
                       const std::vector<af::Reflection> &adjacent_reflections) const {
+      // Transform the shoebox to the reciprocal space grid
+      af::versa<double, af::c_grid<3> > transformed_data;
+      af::versa<double, af::c_grid<3> > transformed_bgrd;
+      af::versa<bool, af::c_grid<3> > final_mask;
+      af::const_ref<double, af::c_grid<3> > reference_data =
+        transform(reflection, transformed_data, transformed_bgrd, final_mask);
+
+      // Do the profile fitting
+      ProfileFitter<double> fit(transformed_data.const_ref(),
+                                transformed_bgrd.const_ref(),
+                                final_mask.const_ref(),
+                                reference_data,
+                                1e-3,
+                                100);
+      DIALS_ASSERT(fit.niter() < 100);
+
+      // Set the integrated data and the integrated flag
+      reflection["intensity.prf.value"] = fit.intensity()[0];
+      reflection["intensity.prf.variance"] = fit.variance()[0];
+      reflection["intensity.prf.correlation"] = fit.correlation();
+      reflection["flags"] = reflection.get<std::size_t>("flags") | af::IntegratedPrf;
+    }
+
+    /**
+     * Transform the shoebox of a reflection to the reciprocal space grid of
+     * its reference profile, or take the transform from the cache, and unset
+     * the profile fitted flag of the reflection.
+     * @param reflection The reflection object
+     * @param transformed_data The transformed pixel values
+     * @param transformed_bgrd The transformed background values
+     * @param final_mask The pixels of both the transform and the reference
+     * @returns The reference profile to fit
+     */
+    af::const_ref<double, af::c_grid<3> > transform(
+      af::Reflection &reflection,
+      af::versa<double, af::c_grid<3> > &transformed_data,
+      af::versa<double, af::c_grid<3> > &transformed_bgrd,
+      af::versa<bool, af::c_grid<3> > &final_mask) const {
       // Typedefs
       typedef af::const_ref<double, af::c_grid<3> > data_const_reference;
       typedef af::const_ref<bool, af::c_grid<3> > mask_const_reference;
@@ -437,32 +487,41 @@ namespace dials { namespace algorithms {
       data_const_reference reference_data = data_spec.reference().data(index);
       mask_const_reference reference_mask = data_spec.reference().mask(index);
 
-      // Create the data array
-      af::versa<double, af::c_grid<3> > data(sbox.data.accessor());
-      std::copy(sbox.data.begin(), sbox.data.end(), data.begin());
+      // Get the transformed shoebox from the cache or compute the transform
+      af::versa<bool, af::c_grid<3> > transformed_mask_arr;
+      if (transform_cache_ == NULL
+          || !transform_cache_->find(
+            TransformedProfileCache::key(experiment_id, sbox, s1, phi),
+            sbox.bbox,
+            transformed_data,
+            transformed_bgrd,
+            transformed_mask_arr)) {
+        // Create the data array
+        af::versa<double, af::c_grid<3> > data(sbox.data.accessor());
+        std::copy(sbox.data.begin(), sbox.data.end(), data.begin());
 
-      // Create the background array
-      af::versa<double, af::c_grid<3> > background(sbox.background.accessor());
-      std::copy(sbox.background.begin(), sbox.background.end(), background.begin());
+        // Create the background array
+        af::versa<double, af::c_grid<3> > background(sbox.background.accessor());
+        std::copy(sbox.background.begin(), sbox.background.end(), background.begin());
 
-      // Create the mask array
-      af::versa<bool, af::c_grid<3> > mask(sbox.mask.accessor());
-      copy_mask(sbox.mask.begin(), sbox.mask.end(), mask.begin());
+        // Create the mask array
+        af::versa<bool, af::c_grid<3> > mask(sbox.mask.accessor());
+        copy_mask(sbox.mask.begin(), sbox.mask.end(), mask.begin());
 
-      // Compute the transform
-      TransformForward<double> transform(data_spec.spec(),
+        // Compute the transform
+        TransformForward<double> forward(data_spec.spec(),
                                          cs,
                                          sbox.bbox,
                                          sbox.panel,
                                          data.const_ref(),
                                          background.const_ref(),
                                          mask.const_ref());
-
-      // Get the transformed shoebox
-      data_const_reference transformed_data = transform.profile().const_ref();
-      data_const_reference transformed_bgrd = transform.background().const_ref();
-      mask_const_reference transformed_mask = transform.mask().const_ref();
-      af::versa<bool, af::c_grid<3> > final_mask(transformed_mask.accessor());
+        transformed_data = forward.profile();
+        transformed_bgrd = forward.background();
+        transformed_mask_arr = forward.mask();
+      }
+      mask_const_reference transformed_mask = transformed_mask_arr.const_ref();
+      final_mask = af::versa<bool, af::c_grid<3> >(transformed_mask.accessor());
       DIALS_ASSERT(reference_mask.size() == transformed_mask.size());
       std::size_t mask_count = 0;
       for (std::size_t j = 0; j < final_mask.size(); ++j) {
@@ -474,21 +533,7 @@ namespace dials { namespace algorithms {
       if (mask_count == 0) {
         throw DIALS_ERROR("No pixels mapped to reciprocal space grid");
       }
-
-      // Do the profile fitting
-      ProfileFitter<double> fit(transformed_data,
-                                transformed_bgrd,
-                                final_mask.const_ref(),
-                                reference_data,
-                                1e-3,
-                                100);
-      DIALS_ASSERT(fit.niter() < 100);
-
-      // Set the integrated data and the integrated flag
-      reflection["intensity.prf.value"] = fit.intensity()[0];
-      reflection["intensity.prf.variance"] = fit.variance()[0];
-      reflection["intensity.prf.correlation"] = fit.correlation();
-      reflection["flags"] = reflection.get<std::size_t>("flags") | af::IntegratedPrf;
+      return reference_data;
     }
 
   protected:
@@ -527,6 +572,7 @@ namespace dials { namespace algorithms {
     }
 
     GaussianRSMultiCrystalReferenceProfileData data_spec_;
+    boost::shared_ptr<TransformedProfileCache> transform_cache_;
   };
 
   /**
@@ -864,6 +910,20 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Initialise the algorithm to fit in reciprocal space, reusing the
+     * shoeboxes transformed by the reference pass
+     * @param data The reference profiles
+     * @param transform_cache The cache of transformed shoeboxes
+     */
+    GaussianRSIntensityCalculator(
+      const GaussianRSMultiCrystalReferenceProfileData &data,
+      boost::shared_ptr<TransformedProfileCache> transform_cache) {
+      typedef GaussianRSReciprocalSpaceIntensityCalculator RSAlgorithm;
+      DIALS_ASSERT(transform_cache != NULL);
+      algorithm_ = boost::make_shared<RSAlgorithm>(data, transform_cache);
+    }
+
     ~GaussianRSIntensityCalculator() {}
 
     /**
@@ -882,12 +942,121 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * Class to wrap the methods to be called in parallel with a mutex.
-   * This just applies to the add_single method. The class has a mutex for each
-   * profile. The add_single method adds the profile information to the
-   * reference profile. In order to ensure that two profiles aren't added at the
-   * same time, the mutex for the reference profile is locked while the
-   * contribution is added.
+   * A class implementing reciprocal space profile fitting for batches of
+   * reflections. The shoeboxes of a batch are transformed to the reciprocal
+   * space grid one at a time, on the calling thread, and then the transformed
+   * pixels of the whole batch are fitted together by the BatchProfileFitter,
+   * which runs on an accelerator if the fitter was built with offload
+   * support. The results are the same as the GaussianRSIntensityCalculator
+   * fitting in reciprocal space.
+   */
+  class GaussianRSBatchIntensityCalculator : public IntensityCalculatorIface {
+  public:
+    /**
+     * Initialise the algorithm
+     * @param data The reference profiles
+     */
+    GaussianRSBatchIntensityCalculator(
+      const GaussianRSMultiCrystalReferenceProfileData &data)
+        : algorithm_(data) {}
+
+    /**
+     * Initialise the algorithm, reusing the shoeboxes transformed by the
+     * reference pass
+     * @param data The reference profiles
+     * @param transform_cache The cache of transformed shoeboxes
+     */
+    GaussianRSBatchIntensityCalculator(
+      const GaussianRSMultiCrystalReferenceProfileData &data,
+      boost::shared_ptr<TransformedProfileCache> transform_cache)
+        : algorithm_(data, transform_cache) {
+      DIALS_ASSERT(transform_cache != NULL);
+    }
+
+    ~GaussianRSBatchIntensityCalculator() {}
+
+    /**
+     * Perform the integration of a single reflection
+     * @param reflection The reflection object
+     * @param adjacent_reflections The adjacent reflections list
+     */
+    virtual void operator()(
+      af::Reflection &reflection,
+      const std::vector<af::Reflection> &adjacent_reflections) const {
+      algorithm_.exec(reflection, adjacent_reflections);
+    }
+
+    /**
+     * @returns True, the calculator fits the reflections of a job together
+     */
+    virtual bool batched() const {
+      return true;
+    }
+
+    /**
+     * Perform the integration of a batch of reflections
+     * @param reflections The reflections
+     * @param adjacent_reflections The adjacent reflections of each reflection
+     * @returns True/False for each reflection if it was fitted
+     */
+    virtual std::vector<bool> batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections) const {
+      DIALS_ASSERT(reflections.size() == adjacent_reflections.size());
+      std::vector<bool> success(reflections.size(), false);
+
+      // Transform the shoeboxes and add them to the batch
+      BatchProfileFitter fitter;
+      std::vector<std::size_t> fitted;
+      fitted.reserve(reflections.size());
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        af::versa<double, af::c_grid<3> > data;
+        af::versa<double, af::c_grid<3> > background;
+        af::versa<bool, af::c_grid<3> > mask;
+        try {
+          af::const_ref<double, af::c_grid<3> > reference =
+            algorithm_.transform(reflections[i], data, background, mask);
+          fitter.add(af::const_ref<double>(data.begin(), data.size()),
+                     af::const_ref<double>(background.begin(), background.size()),
+                     af::const_ref<bool>(mask.begin(), mask.size()),
+                     af::const_ref<double>(reference.begin(), reference.size()));
+          fitted.push_back(i);
+        } catch (dials::error const &) {
+          continue;
+        }
+      }
+
+      // Fit the whole batch
+      fitter.fit(1e-3, 100);
+
+      // Set the integrated data and the integrated flag
+      for (std::size_t j = 0; j < fitted.size(); ++j) {
+        if (!fitter.success(j)) {
+          continue;
+        }
+        af::Reflection &reflection = reflections[fitted[j]];
+        reflection["intensity.prf.value"] = fitter.intensity(j);
+        reflection["intensity.prf.variance"] = fitter.variance(j);
+        reflection["intensity.prf.correlation"] = fitter.correlation(j);
+        reflection["flags"] = reflection.get<std::size_t>("flags") | af::IntegratedPrf;
+        success[fitted[j]] = true;
+      }
+      return success;
+    }
+
+  protected:
+    GaussianRSReciprocalSpaceIntensityCalculator algorithm_;
+  };
+
+  /**
+   * Class to wrap the methods to be called in parallel. The add_single
+   * method adds the profile to a set of reference profiles owned by the
+   * calling thread, so threads never wait for each other while forming the
+   * profiles. The per thread profiles are summed into the reference profiles
+   * by merge, which is called by finalize and accumulate. The merge must not
+   * be called while profiles are still being added. Copies of the modeller
+   * share the per thread profiles, in the same way as they share the
+   * reference profile data.
    */
   class ThreadSafeEmpiricalProfileModeller : public EmpiricalProfileModeller {
   public:
@@ -898,11 +1067,8 @@ namespace dials { namespace algorithms {
      * @param threshold The threshold for counts
      */
     ThreadSafeEmpiricalProfileModeller(std::size_t n, int3 datasize, double threshold)
-        : EmpiricalProfileModeller(n, datasize, threshold) {
-      for (std::size_t i = 0; i < n; ++i) {
-        mutex_.push_back(boost::make_shared<boost::mutex>());
-      }
-    }
+        : EmpiricalProfileModeller(n, datasize, threshold),
+          buffers_(boost::make_shared<ThreadBuffers>()) {}
 
     /**
      * Add a profile with indices and weights
@@ -911,14 +1077,90 @@ namespace dials { namespace algorithms {
      * @param profile The profile data
      */
     void add_single(std::size_t index, double weight, data_const_reference profile) {
-      DIALS_ASSERT(index < mutex_.size());
-      DIALS_ASSERT(mutex_[index] != NULL);
-      boost::lock_guard<boost::mutex> guard(*mutex_[index]);
-      EmpiricalProfileModeller::add_single(index, weight, profile);
+      DIALS_ASSERT(finalized() == false);
+      DIALS_ASSERT(index < size());
+      local_buffer().add_single(index, weight, profile);
+    }
+
+    /**
+     * Sum the profiles added by each thread into the reference profiles and
+     * reset the per thread profiles.
+     */
+    void merge() {
+      DIALS_ASSERT(buffers_ != NULL);
+      if (finalized()) {
+        return;
+      }
+      boost::lock_guard<boost::mutex> guard(buffers_->mutex);
+      for (std::size_t i = 0; i < buffers_->all.size(); ++i) {
+        EmpiricalProfileModeller &buffer = *buffers_->all[i];
+        EmpiricalProfileModeller::accumulate_raw_pointer(&buffer);
+        buffer = EmpiricalProfileModeller(size(), datasize(), threshold());
+      }
+    }
+
+    using EmpiricalProfileModeller::accumulate_raw_pointer;
+
+    /**
+     * Accumulate the results of another modeller
+     * @param other The other modeller
+     */
+    void accumulate_raw_pointer(ThreadSafeEmpiricalProfileModeller *other) {
+      DIALS_ASSERT(other != NULL);
+      merge();
+      other->merge();
+      EmpiricalProfileModeller::accumulate_raw_pointer(other);
+    }
+
+    /**
+     * Finalize the modeller
+     */
+    void finalize() {
+      merge();
+      EmpiricalProfileModeller::finalize();
+    }
+
+    /**
+     * Finalize the modeller, normalising the profiles in parallel
+     * @param nthreads The number of threads to use
+     */
+    void finalize(std::size_t nthreads) {
+      merge();
+      EmpiricalProfileModeller::finalize(nthreads);
     }
 
   protected:
-    af::shared<boost::shared_ptr<boost::mutex> > mutex_;
+    /**
+     * The profiles added by each thread. The thread local pointers refer to
+     * buffers owned by the list so they are not deleted when a thread exits.
+     */
+    struct ThreadBuffers {
+      boost::thread_specific_ptr<EmpiricalProfileModeller> local;
+      std::vector<boost::shared_ptr<EmpiricalProfileModeller> > all;
+      boost::mutex mutex;
+
+      ThreadBuffers() : local(&ThreadBuffers::no_cleanup) {}
+
+      static void no_cleanup(EmpiricalProfileModeller *) {}
+    };
+
+    /**
+     * Get the profiles for the calling thread
+     */
+    EmpiricalProfileModeller &local_buffer() {
+      DIALS_ASSERT(buffers_ != NULL);
+      EmpiricalProfileModeller *buffer = buffers_->local.get();
+      if (buffer == NULL) {
+        boost::lock_guard<boost::mutex> guard(buffers_->mutex);
+        buffers_->all.push_back(boost::make_shared<EmpiricalProfileModeller>(
+          size(), datasize(), threshold()));
+        buffer = buffers_->all.back().get();
+        buffers_->local.reset(buffer);
+      }
+      return *buffer;
+    }
+
+    boost::shared_ptr<ThreadBuffers> buffers_;
   };
 
   /**
@@ -950,8 +1192,32 @@ namespace dials { namespace algorithms {
       return spec_;
     }
 
+    /**
+     * Store the transformed shoeboxes of the reflections used in modelling
+     * so that the integration pass does not need to transform them again
+     * @param transform_cache The cache of transformed shoeboxes
+     */
+    void set_transform_cache(
+      boost::shared_ptr<TransformedProfileCache> transform_cache) {
+      transform_cache_ = transform_cache;
+    }
+
+    /**
+     * @returns The cache of transformed shoeboxes (may be NULL)
+     */
+    boost::shared_ptr<TransformedProfileCache> transform_cache() const {
+      return transform_cache_;
+    }
+
+    /**
+     * @returns The profile modellers with the per thread profiles merged
+     */
     af::shared<ThreadSafeEmpiricalProfileModeller> modeller() const {
-      return modeller_;
+      af::shared<ThreadSafeEmpiricalProfileModeller> result = modeller_;
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i].merge();
+      }
+      return result;
     }
 
     /**
@@ -997,36 +1263,66 @@ namespace dials { namespace algorithms {
         vec3<double> s0 = spec_[experiment_id].beam()->get_s0();
         CoordinateSystem cs(m2, s0, s1, xyzmm[2]);
 
-        // Create the data array
-        af::versa<double, af::c_grid<3> > data(sbox.data.accessor());
-        std::transform(sbox.data.begin(),
-                       sbox.data.end(),
-                       sbox.background.begin(),
-                       data.begin(),
-                       std::minus<double>());
-
         // Create the mask array
         af::versa<bool, af::c_grid<3> > mask(sbox.mask.accessor());
         std::transform(
           sbox.mask.begin(), sbox.mask.end(), mask.begin(), CheckMaskCode());
 
-        // Compute the transform
-        TransformForward<double> transform(spec_[experiment_id],
-                                           cs,
-                                           sbox.bbox,
-                                           sbox.panel,
-                                           data.const_ref(),
-                                           mask.const_ref());
+        // Compute the transform of the background subtracted profile
+        af::versa<double, af::c_grid<3> > profile;
+        if (transform_cache_ == NULL) {
+          af::versa<double, af::c_grid<3> > data(sbox.data.accessor());
+          std::transform(sbox.data.begin(),
+                         sbox.data.end(),
+                         sbox.background.begin(),
+                         data.begin(),
+                         std::minus<double>());
+          TransformForward<double> transform(spec_[experiment_id],
+                                             cs,
+                                             sbox.bbox,
+                                             sbox.panel,
+                                             data.const_ref(),
+                                             mask.const_ref());
+          profile = transform.profile();
+        } else {
+          // Transform the data and background separately and keep them for
+          // the integration pass. The transform is linear so the difference
+          // is the transformed background subtracted profile.
+          af::versa<double, af::c_grid<3> > data(sbox.data.accessor());
+          af::versa<double, af::c_grid<3> > background(sbox.background.accessor());
+          std::copy(sbox.data.begin(), sbox.data.end(), data.begin());
+          std::copy(sbox.background.begin(), sbox.background.end(), background.begin());
+          TransformForward<double> transform(spec_[experiment_id],
+                                             cs,
+                                             sbox.bbox,
+                                             sbox.panel,
+                                             data.const_ref(),
+                                             background.const_ref(),
+                                             mask.const_ref());
+          af::versa<double, af::c_grid<3> > transformed_data = transform.profile();
+          af::versa<double, af::c_grid<3> > transformed_bgrd = transform.background();
+          transform_cache_->insert(
+            TransformedProfileCache::key(experiment_id, sbox, s1, xyzmm[2]),
+            sbox.bbox,
+            transformed_data.const_ref(),
+            transformed_bgrd.const_ref(),
+            transform.mask().const_ref());
+          profile = af::versa<double, af::c_grid<3> >(transformed_data.accessor());
+          std::transform(transformed_data.begin(),
+                         transformed_data.end(),
+                         transformed_bgrd.begin(),
+                         profile.begin(),
+                         std::minus<double>());
+        }
 
         // Get the indices and weights of the profiles
         af::shared<std::size_t> indices = sampler_->nearest_n(sbox.panel, xyzpx);
+        af::shared<double> weights =
+          sampler_->weights(indices.const_ref(), sbox.panel, xyzpx);
         for (std::size_t j = 0; j < indices.size(); ++j) {
-          // Get the weighting
-          double weight = sampler_->weight(indices[j], sbox.panel, xyzpx);
-
           // Add the profile
           modeller_[experiment_id].add_single(
-            indices[j], weight, transform.profile().const_ref());
+            indices[j], weights[j], profile.const_ref());
         }
 
         // Set the flags
@@ -1042,9 +1338,10 @@ namespace dials { namespace algorithms {
      * @param other The other reference calculator
      */
     void accumulate(const GaussianRSReferenceCalculator &other) {
-      DIALS_ASSERT(modeller_.size() == other.modeller_.size());
+      af::shared<ThreadSafeEmpiricalProfileModeller> other_modeller = other.modeller_;
+      DIALS_ASSERT(modeller_.size() == other_modeller.size());
       for (std::size_t i = 0; i < modeller_.size(); ++i) {
-        modeller_[i].accumulate_raw_pointer(&other.modeller_[i]);
+        modeller_[i].accumulate_raw_pointer(&other_modeller[i]);
       }
     }
 
@@ -1133,6 +1430,7 @@ namespace dials { namespace algorithms {
     boost::shared_ptr<SamplerIface> sampler_;
     af::shared<TransformSpec> spec_;
     af::shared<ThreadSafeEmpiricalProfileModeller> modeller_;
+    boost::shared_ptr<TransformedProfileCache> transform_cache_;
   };
 
 }}  // namespace dials::algorithms
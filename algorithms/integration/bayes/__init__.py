@@ -5,5 +5,7 @@
     "BayesianIntegratorDouble",
     "BayesianIntegratorFloat",
     "IntegrationAlgorithm",
+    "PosteriorMomentsTable",
     "integrate_by_bayesian_integrator",
+    "posterior_moments",
 )
@@ -1,8 +1,24 @@
+import functools
+
+
+@functools.lru_cache(maxsize=None)
+def default_posterior_moments_table():
+    """Build the table of posterior moments once per process"""
+    from dials_algorithms_integration_bayes_ext import PosteriorMomentsTable
+
+    return PosteriorMomentsTable()
+
+
 class IntegrationAlgorithm:
     """A class to perform bayesian integration"""
 
-    def __init__(self, **kwargs):
-        pass
+    def __init__(self, nthreads=1, **kwargs):
+        """Initialise the algorithm.
+
+        :param nthreads: The number of threads to use
+        """
+        self.nthreads = nthreads
+        self.table = default_posterior_moments_table()
 
     def __call__(self, reflections, image_volume=None):
         """Process the reflections.
@@ -12,7 +28,9 @@ def __call__(self, reflections, image_volume=None):
         """
         # Integrate and return the reflections
         if image_volume is None:
-            intensity = reflections["shoebox"].bayesian_summation_intensity()
+            intensity = reflections["shoebox"].bayesian_intensity(
+                self.table, nthreads=self.nthreads
+            )
         else:
             raise RuntimeError("Image volume not supported at the moment")
         reflections["intensity.sum.value"] = intensity.observed_value()
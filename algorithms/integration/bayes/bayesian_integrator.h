@@ -12,10 +12,10 @@
 #define DIALS_ALGORITHMS_INTEGRATION_BAYESIAN_INTEGRATOR_H
 
 #include <algorithm>
-#include <boost/math/special_functions/gamma.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/tiny_algebra.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/algorithms/integration/bayes/posterior_moments.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -45,6 +45,23 @@ namespace dials { namespace algorithms {
                        const af::const_ref<FloatType> &background,
                        const af::const_ref<int> &mask) {
       init(signal, background, mask);
+      moments_ = posterior_moments(std::max(sum_p_, 0.0), std::max(sum_b_, 0.0));
+    }
+
+    /**
+     * Perform the summation integration, taking the posterior moments from
+     * a table
+     * @param signal The signal array
+     * @param background The background array
+     * @param mask The mask array
+     * @param table The table of posterior moments
+     */
+    BayesianIntegrator(const af::const_ref<FloatType> &signal,
+                       const af::const_ref<FloatType> &background,
+                       const af::const_ref<int> &mask,
+                       const PosteriorMomentsTable &table) {
+      init(signal, background, mask);
+      moments_ = table(std::max(sum_p_, 0.0), std::max(sum_b_, 0.0));
     }
 
     /**
@@ -57,6 +74,7 @@ namespace dials { namespace algorithms {
                        const af::const_ref<FloatType, af::c_grid<2> > &background,
                        const af::const_ref<int, af::c_grid<2> > &mask) {
       init(signal.as_1d(), background.as_1d(), mask.as_1d());
+      moments_ = posterior_moments(std::max(sum_p_, 0.0), std::max(sum_b_, 0.0));
     }
 
     /**
@@ -69,27 +87,22 @@ namespace dials { namespace algorithms {
                        const af::const_ref<FloatType, af::c_grid<3> > &background,
                        const af::const_ref<int, af::c_grid<3> > &mask) {
       init(signal.as_1d(), background.as_1d(), mask.as_1d());
+      moments_ = posterior_moments(std::max(sum_p_, 0.0), std::max(sum_b_, 0.0));
     }
 
     /**
-     * @returns The reflection intensity
+     * @returns The reflection intensity (the posterior mean)
      */
     FloatType intensity() const {
-      using boost::math::gamma_q;
-      double C = sum_p_;
-      double B = sum_b_;
-      return gamma_q(C + 1, B) * ((C + 1) * gamma_q(C + 1, B) - B * gamma_q(C + 1, B));
+      return moments_.mean;
     }
 
     /**
-     * @returns the variance on the integrated intensity
+     * @returns the variance on the integrated intensity (the posterior
+     * variance)
      */
     FloatType variance() const {
-      FloatType Is = intensity();
-      FloatType Ib = sum_b_;
-      FloatType m_n =
-        n_background_ > 0 ? (FloatType)n_signal_ / (FloatType)n_background_ : 0.0;
-      return std::abs(Is) + std::abs(Ib) * (1.0 + m_n);
+      return moments_.variance;
     }
 
     /**
@@ -165,8 +178,9 @@ namespace dials { namespace algorithms {
       }
     }
 
-    FloatType sum_p_;
-    FloatType sum_b_;
+    double sum_p_;
+    double sum_b_;
+    PosteriorMoments moments_;
     std::size_t n_background_;
     std::size_t n_signal_;
     bool success_;
@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/integration/bayes/bayesian_integrator.h>
+#include <dials/algorithms/integration/bayes/posterior_moments.h>
 #include <dials/algorithms/shoebox/mask_code.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
@@ -26,6 +27,11 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const af::const_ref<FloatType> &,
                 const af::const_ref<int> &>(
         (arg("signal"), arg("background"), arg("mask"))))
+      .def(init<const af::const_ref<FloatType> &,
+                const af::const_ref<FloatType> &,
+                const af::const_ref<int> &,
+                const PosteriorMomentsTable &>(
+        (arg("signal"), arg("background"), arg("mask"), arg("table"))))
       .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
                 const af::const_ref<FloatType, af::c_grid<2> > &,
                 const af::const_ref<int, af::c_grid<2> > &>(
@@ -82,7 +88,44 @@ namespace dials { namespace algorithms { namespace boost_python {
         (arg("image"), arg("background"), arg("mask")));
   }
 
+  boost::python::tuple posterior_moments_as_tuple(double counts, double background) {
+    PosteriorMoments m = posterior_moments(counts, background);
+    return boost::python::make_tuple(m.mean, m.variance);
+  }
+
+  boost::python::tuple call_posterior_moments_table(const PosteriorMomentsTable &self,
+                                                    double counts,
+                                                    double background) {
+    PosteriorMoments m = self(counts, background);
+    return boost::python::make_tuple(m.mean, m.variance);
+  }
+
+  void export_posterior_moments() {
+    def("posterior_moments",
+        &posterior_moments_as_tuple,
+        (arg("counts"), arg("background")));
+
+    class_<PosteriorMomentsTable>("PosteriorMomentsTable", no_init)
+      .def(init<double, std::size_t, double, std::size_t>(
+        (arg("max_counts") = 100.0,
+         arg("num_counts") = 401,
+         arg("max_background") = 100.0,
+         arg("num_background") = 401)))
+      .def("max_counts", &PosteriorMomentsTable::max_counts)
+      .def("num_counts", &PosteriorMomentsTable::num_counts)
+      .def("max_background", &PosteriorMomentsTable::max_background)
+      .def("num_background", &PosteriorMomentsTable::num_background)
+      .def("mean_error", &PosteriorMomentsTable::mean_error)
+      .def("variance_error", &PosteriorMomentsTable::variance_error)
+      .def("contains", &PosteriorMomentsTable::contains)
+      .def("__call__",
+           &call_posterior_moments_table,
+           (arg("counts"), arg("background")));
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_integration_bayes_ext) {
+    export_posterior_moments();
+
     bayesian_integrator_wrapper<float>("BayesianIntegratorFloat");
     bayesian_integrator_wrapper<double>("BayesianIntegratorDouble");
 
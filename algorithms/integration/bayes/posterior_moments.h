@@ -0,0 +1,247 @@
+/*
+ * posterior_moments.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_BAYES_POSTERIOR_MOMENTS_H
+#define DIALS_ALGORITHMS_INTEGRATION_BAYES_POSTERIOR_MOMENTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <boost/math/special_functions/gamma.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The mean and variance of the posterior distribution of an intensity
+   */
+  struct PosteriorMoments {
+    double mean;
+    double variance;
+
+    PosteriorMoments() : mean(0), variance(0) {}
+
+    PosteriorMoments(double mean_, double variance_)
+        : mean(mean_), variance(variance_) {}
+  };
+
+  namespace detail {
+
+    /**
+     * Compute x^a exp(-x) / (Gamma(a + 1) Q(a, x)), which is the relative
+     * step from Q(a, x) to Q(a + 1, x). For x > a + 1, Q(a, x) underflows
+     * long before the ratio loses precision, so it is computed from the
+     * continued fraction for the upper incomplete gamma function instead.
+     * @param a The shape (> 0)
+     * @param x The background (>= 0)
+     * @returns The ratio
+     */
+    inline double upper_gamma_step(double a, double x) {
+      if (x <= a + 1) {
+        return boost::math::gamma_p_derivative(a + 1, x)
+               / boost::math::gamma_q(a, x);
+      }
+
+      // Modified Lentz evaluation of Gamma(a, x) / (x^a exp(-x))
+      const double tiny = 1e-300;
+      double b = x + 1 - a;
+      double c = 1 / tiny;
+      double d = 1 / b;
+      double h = d;
+      for (std::size_t i = 1; i < 1000; ++i) {
+        double an = -(double)i * ((double)i - a);
+        b += 2;
+        d = an * d + b;
+        if (std::abs(d) < tiny) {
+          d = tiny;
+        }
+        c = b + an / c;
+        if (std::abs(c) < tiny) {
+          c = tiny;
+        }
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (std::abs(delta - 1) < std::numeric_limits<double>::epsilon()) {
+          break;
+        }
+      }
+      return 1.0 / (a * h);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the posterior mean and variance of the intensity of a
+   * reflection with a flat prior on intensities >= 0. With C counts in the
+   * foreground and a known background B the posterior of I is proportional
+   * to (I + B)^C exp(-(I + B)), and its moments are ratios of upper
+   * incomplete gamma functions.
+   * @param counts The foreground counts
+   * @param background The background in the foreground
+   * @returns The posterior moments
+   */
+  inline PosteriorMoments posterior_moments(double counts, double background) {
+    DIALS_ASSERT(counts >= 0);
+    DIALS_ASSERT(background >= 0);
+    double a = counts + 1;
+    double r0 = detail::upper_gamma_step(a, background);
+    double r1 = detail::upper_gamma_step(a + 1, background);
+    double mean = a * (1 + r0) - background;
+    double variance = a * (1 + r0) * (1 + (a + 1) * r1 - a * r0);
+    return PosteriorMoments(std::max(mean, 0.0), std::max(variance, 0.0));
+  }
+
+  /**
+   * A table of the posterior moments on a grid of evenly spaced foreground
+   * counts and background values, interpolated bilinearly between the grid
+   * points. This avoids evaluating incomplete gamma functions for
+   * every weak reflection. Values outside the table are computed exactly.
+   * The largest interpolation error at the centres of the grid cells is
+   * measured when the table is built. This is close to the largest error
+   * anywhere in the table, although not a strict bound on it.
+   */
+  class PosteriorMomentsTable {
+  public:
+    /**
+     * Build the table
+     * @param max_counts The largest foreground count in the table
+     * @param num_counts The number of foreground counts in the table
+     * @param max_background The largest background in the table
+     * @param num_background The number of background values in the table
+     */
+    PosteriorMomentsTable(double max_counts = 100.0,
+                          std::size_t num_counts = 401,
+                          double max_background = 100.0,
+                          std::size_t num_background = 401)
+        : max_counts_(max_counts),
+          num_counts_(num_counts),
+          max_background_(max_background),
+          num_background_(num_background),
+          mean_error_(0),
+          variance_error_(0) {
+      DIALS_ASSERT(max_counts > 0);
+      DIALS_ASSERT(num_counts > 1);
+      DIALS_ASSERT(max_background > 0);
+      DIALS_ASSERT(num_background > 1);
+      counts_step_ = max_counts_ / (num_counts_ - 1);
+      background_step_ = max_background_ / (num_background_ - 1);
+      mean_.resize(num_counts_ * num_background_);
+      variance_.resize(num_counts_ * num_background_);
+      for (std::size_t i = 0; i < num_counts_; ++i) {
+        for (std::size_t j = 0; j < num_background_; ++j) {
+          PosteriorMoments m =
+            posterior_moments(i * counts_step_, j * background_step_);
+          mean_[i * num_background_ + j] = m.mean;
+          variance_[i * num_background_ + j] = m.variance;
+        }
+      }
+
+      // Measure the error at the centre of each cell, where it is usually largest
+      for (std::size_t i = 0; i + 1 < num_counts_; ++i) {
+        for (std::size_t j = 0; j + 1 < num_background_; ++j) {
+          double c = (i + 0.5) * counts_step_;
+          double b = (j + 0.5) * background_step_;
+          PosteriorMoments exact = posterior_moments(c, b);
+          PosteriorMoments approx = interpolate(c, b);
+          mean_error_ = std::max(mean_error_, std::abs(approx.mean - exact.mean));
+          variance_error_ =
+            std::max(variance_error_, std::abs(approx.variance - exact.variance));
+        }
+      }
+    }
+
+    /** @returns The largest foreground count in the table */
+    double max_counts() const {
+      return max_counts_;
+    }
+
+    /** @returns The number of foreground counts in the table */
+    std::size_t num_counts() const {
+      return num_counts_;
+    }
+
+    /** @returns The largest background in the table */
+    double max_background() const {
+      return max_background_;
+    }
+
+    /** @returns The number of background values in the table */
+    std::size_t num_background() const {
+      return num_background_;
+    }
+
+    /** @returns The largest error in the mean found in the table */
+    double mean_error() const {
+      return mean_error_;
+    }
+
+    /** @returns The largest error in the variance found in the table */
+    double variance_error() const {
+      return variance_error_;
+    }
+
+    /**
+     * @param counts The foreground counts
+     * @param background The background
+     * @returns Are the values within the table
+     */
+    bool contains(double counts, double background) const {
+      return counts >= 0 && counts <= max_counts_ && background >= 0
+             && background <= max_background_;
+    }
+
+    /**
+     * Get the posterior moments, from the table if possible
+     * @param counts The foreground counts
+     * @param background The background
+     * @returns The posterior moments
+     */
+    PosteriorMoments operator()(double counts, double background) const {
+      if (contains(counts, background)) {
+        return interpolate(counts, background);
+      }
+      return posterior_moments(counts, background);
+    }
+
+  private:
+    PosteriorMoments interpolate(double counts, double background) const {
+      double u = counts / counts_step_;
+      double v = background / background_step_;
+      std::size_t i = std::min((std::size_t)u, num_counts_ - 2);
+      std::size_t j = std::min((std::size_t)v, num_background_ - 2);
+      double fc = u - i;
+      double fb = v - j;
+      std::size_t k = i * num_background_ + j;
+      std::size_t l = k + num_background_;
+      double w00 = (1 - fc) * (1 - fb);
+      double w01 = (1 - fc) * fb;
+      double w10 = fc * (1 - fb);
+      double w11 = fc * fb;
+      return PosteriorMoments(
+        w00 * mean_[k] + w01 * mean_[k + 1] + w10 * mean_[l] + w11 * mean_[l + 1],
+        w00 * variance_[k] + w01 * variance_[k + 1] + w10 * variance_[l]
+          + w11 * variance_[l + 1]);
+    }
+
+    double max_counts_;
+    std::size_t num_counts_;
+    double max_background_;
+    std::size_t num_background_;
+    double counts_step_;
+    double background_step_;
+    double mean_error_;
+    double variance_error_;
+    af::shared<double> mean_;
+    af::shared<double> variance_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_BAYES_POSTERIOR_MOMENTS_H
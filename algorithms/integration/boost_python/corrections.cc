@@ -36,8 +36,10 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<CorrectionsMulti>("CorrectionsMulti")
       .def("append", &CorrectionsMulti::push_back)
       .def("__len__", &CorrectionsMulti::size)
-      .def("lp", &CorrectionsMulti::lp)
-      .def("qe", &CorrectionsMulti::qe);
+      .def("lp", &CorrectionsMulti::lp, (arg("id"), arg("s1"), arg("nthreads") = 1))
+      .def("qe",
+           &CorrectionsMulti::qe,
+           (arg("id"), arg("s1"), arg("panel"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -16,9 +16,11 @@ namespace dials { namespace algorithms { namespace boost_python {
   using namespace boost::python;
 
   void export_corrections();
+  void export_prefilter();
 
   BOOST_PYTHON_MODULE(dials_algorithms_integration_ext) {
     export_corrections();
+    export_prefilter();
   }
 
 }}}  // namespace dials::algorithms::boost_python
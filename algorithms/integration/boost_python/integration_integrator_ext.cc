@@ -317,8 +317,20 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("data", &ReflectionManager::data)
       .def("num_reflections", &ReflectionManager::num_reflections);
 
+    class_<ReflectionBuckets>("ReflectionBuckets", no_init)
+      .def(init<const JobList &>((arg("jobs"))))
+      .def("__len__", &ReflectionBuckets::size)
+      .def("job", &ReflectionBuckets::job, return_internal_reference<>())
+      .def("num_reflections", &ReflectionBuckets::num_reflections)
+      .def("add", &ReflectionBuckets::add)
+      .def("ready", &ReflectionBuckets::ready, (arg("group"), arg("frame")))
+      .def("take", &ReflectionBuckets::take)
+      .def("unassigned", &ReflectionBuckets::unassigned)
+      .def("finished", &ReflectionBuckets::finished);
+
     class_<ReflectionManagerPerImage>("ReflectionManagerPerImage", no_init)
-      .def(init<int2, af::reflection_table>((arg("frames"), arg("data"))))
+      .def(init<int2, af::reflection_table, std::size_t>(
+        (arg("frames"), arg("data"), arg("block_size") = 1)))
       .def("__len__", &ReflectionManagerPerImage::size)
       .def("finished", &ReflectionManagerPerImage::finished)
       .def("accumulate", &ReflectionManagerPerImage::accumulate)
@@ -332,7 +344,13 @@ namespace dials { namespace algorithms { namespace boost_python {
       .enable_pickling();
 
     class_<ShoeboxProcessor>("ShoeboxProcessor", no_init)
-      .def(init<af::reflection_table, std::size_t, int, int, bool>())
+      .def(init<af::reflection_table, std::size_t, int, int, bool, std::size_t>(
+        (arg("data"),
+         arg("npanels"),
+         arg("frame0"),
+         arg("frame1"),
+         arg("save"),
+         arg("nthreads") = 1)))
       .def("next", &ShoeboxProcessor::next<double>)
       .def("next", &ShoeboxProcessor::next<int>)
       .def("frame0", &ShoeboxProcessor::frame0)
@@ -342,7 +360,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("npanels", &ShoeboxProcessor::npanels)
       .def("finished", &ShoeboxProcessor::finished)
       .def("extract_time", &ShoeboxProcessor::extract_time)
-      .def("process_time", &ShoeboxProcessor::process_time);
+      .def("process_time", &ShoeboxProcessor::process_time)
+      .def("nthreads", &ShoeboxProcessor::nthreads);
 
     def("max_memory_needed",
         &max_memory_needed,
@@ -8,80 +8,93 @@
 #include <scitbx/array_family/shared.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/panel.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <math.h>
 #include <vector>
 
 namespace kapton {
 
 using dxtbx::model::Detector;
+using dxtbx::model::Panel;
 using scitbx::vec2;
 using scitbx::vec3;
 
 /**
- * Implementing a c++ version of the get_kapton_path function. Significant speedups
- * observed
+ * Compute the path length through the kapton for a range of s1 vectors
  */
+class KaptonPathJob {
+public:
+  KaptonPathJob(const std::vector<Panel>& faces,
+                scitbx::af::const_ref<vec3<double> > s1,
+                scitbx::af::ref<double> kapton_path_mm)
+      : faces_(&faces), s1_(s1), kapton_path_mm_(kapton_path_mm) {}
 
-scitbx::af::shared<double> get_kapton_path_cpp(
-  boost::python::list kapton_faces,
-  scitbx::af::const_ref<vec3<double> > s1_flex) {
-  scitbx::af::shared<double> kapton_path_mm;
-  int nfaces = boost::python::len(kapton_faces);
-  std::vector<Detector> all_kapton_faces;
-  // Store all the detectors ahead of time to avoid making expensive extract calls every
-  // time
-  for (std::size_t i = 0; i < nfaces; ++i) {
-    all_kapton_faces.push_back(boost::python::extract<Detector>(kapton_faces[i]));
+  void operator()(std::size_t first, std::size_t last) const {
+    for (std::size_t i = first; i < last; ++i) {
+      kapton_path_mm_[i] = path_length(s1_[i]);
+    }
   }
-  for (scitbx::af::const_ref<vec3<double> >::const_iterator it = s1_flex.begin();
-       it != s1_flex.end();
-       ++it) {
-    double max_d2 = -999.9;
-    scitbx::af::shared<vec3<double> > intersection_xy_list;
-    // Find out intersection points of s1 vector with all faces of kapton volume
-    for (std::size_t j = 0; j < nfaces; ++j) {
-      Detector detector = all_kapton_faces.at(j);
+
+private:
+  /**
+   * Find the intersection points of the s1 vector with the first two faces of
+   * kapton volume that it hits. If there is no intersection or it intersects
+   * with only one face then the path length is 0.0
+   */
+  double path_length(const vec3<double>& s1) const {
+    vec3<double> intersection[2];
+    std::size_t n_intersection = 0;
+    for (std::size_t j = 0; j < faces_->size() && n_intersection < 2; ++j) {
+      const Panel& face = (*faces_)[j];
       try {
-        vec2<double> px = detector[0].get_ray_intersection_px(*it);
-        if (px[0] > 0.0 && px[1] > 0.0 && px[0] < detector[0].get_image_size()[0]
-            && px[1] < detector[0].get_image_size()[1]) {
-          intersection_xy_list.push_back(
-            detector[0].get_lab_coord(detector[0].get_ray_intersection(*it)));
+        vec2<double> px = face.get_ray_intersection_px(s1);
+        if (px[0] > 0.0 && px[1] > 0.0 && px[0] < face.get_image_size()[0]
+            && px[1] < face.get_image_size()[1]) {
+          intersection[n_intersection++] =
+            face.get_lab_coord(face.get_ray_intersection(s1));
         }
       } catch (dxtbx::error const&) {
         // Do nothing
       }
-      if (intersection_xy_list.size() == 2) {
-        break;
-      }
-    }  // kapton faces
-    /*
-     * Now find out the maximum path length through the kapton. That is the path
-     * traversed by s1 vector if no intersection or intersects with only one face then
-     * path length is set to 0.0
-     */
-    if (intersection_xy_list.size() == 0) {
-      kapton_path_mm.push_back(0.0);
-    } else if (intersection_xy_list.size() == 1) {
-      kapton_path_mm.push_back(0.0);
-    } else {
-      double d2 = 0.0;
-      for (std::size_t k1 = 0; k1 < intersection_xy_list.size() - 1; ++k1) {
-        for (std::size_t k2 = k1 + 1; k2 < intersection_xy_list.size(); ++k2) {
-          vec3<double> pt1 = intersection_xy_list[k1];
-          vec3<double> pt2 = intersection_xy_list[k2];
-          d2 = (pt1[0] - pt2[0]) * (pt1[0] - pt2[0])
-               + (pt1[1] - pt2[1]) * (pt1[1] - pt2[1])
-               + (pt1[2] - pt2[2]) * (pt1[2] - pt2[2]);
-          if (d2 > max_d2) {
-            max_d2 = d2;
-          }
-        }
-      }
-      double d = sqrt(max_d2);
-      kapton_path_mm.push_back(d);
     }
-  }  // s1
+    if (n_intersection < 2) {
+      return 0.0;
+    }
+    vec3<double> pt1 = intersection[0];
+    vec3<double> pt2 = intersection[1];
+    double d2 = (pt1[0] - pt2[0]) * (pt1[0] - pt2[0])
+                + (pt1[1] - pt2[1]) * (pt1[1] - pt2[1])
+                + (pt1[2] - pt2[2]) * (pt1[2] - pt2[2]);
+    return sqrt(d2);
+  }
+
+  const std::vector<Panel>* faces_;
+  scitbx::af::const_ref<vec3<double> > s1_;
+  scitbx::af::ref<double> kapton_path_mm_;
+};
+
+/**
+ * Implementing a c++ version of the get_kapton_path function. Significant speedups
+ * observed. The s1 vectors can be split between threads.
+ */
+
+scitbx::af::shared<double> get_kapton_path_cpp(
+  boost::python::list kapton_faces,
+  scitbx::af::const_ref<vec3<double> > s1_flex,
+  std::size_t nthreads) {
+  int nfaces = boost::python::len(kapton_faces);
+  std::vector<Panel> all_kapton_faces;
+  // Store all the faces ahead of time to avoid making expensive extract calls every
+  // time. The faces are single panel detectors.
+  for (std::size_t i = 0; i < nfaces; ++i) {
+    Detector detector = boost::python::extract<Detector>(kapton_faces[i]);
+    all_kapton_faces.push_back(detector[0]);
+  }
+  scitbx::af::shared<double> kapton_path_mm(s1_flex.size(), 0.0);
+  dials::util::parallel_for(
+    s1_flex.size(),
+    nthreads,
+    KaptonPathJob(all_kapton_faces, s1_flex, kapton_path_mm.ref()));
   return kapton_path_mm;
 }
 }  // namespace kapton
@@ -92,7 +105,9 @@ namespace kapton { namespace boost_python { namespace {
   void kapton_init_module() {
     using namespace boost::python;
 
-    def("get_kapton_path_cpp", &kapton::get_kapton_path_cpp);
+    def("get_kapton_path_cpp",
+        &kapton::get_kapton_path_cpp,
+        (arg("kapton_faces"), arg("s1_flex"), arg("nthreads") = 1));
   }
 
 }}}  // namespace kapton::boost_python::
@@ -11,8 +11,11 @@
 
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <scitbx/array_family/flex_types.h>
 #include <dials/algorithms/integration/parallel_integrator.h>
 #include <dials/algorithms/integration/parallel_reference_profiler.h>
+#include <dials/algorithms/integration/image_volume_reader.h>
+#include <dials/algorithms/integration/telemetry.h>
 #include <dials/algorithms/integration/algorithms.h>
 
 using namespace boost::python;
@@ -140,9 +143,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       return boost::python::make_tuple(obj.size(), obj.datasize(), obj.threshold());
     }
     static boost::python::tuple getstate(
-      const ThreadSafeEmpiricalProfileModeller &obj) {
+      const ThreadSafeEmpiricalProfileModeller &modeller) {
       typedef ThreadSafeEmpiricalProfileModeller::data_type data_type;
       typedef ThreadSafeEmpiricalProfileModeller::mask_type mask_type;
+      // The copy shares the profile data so merging it merges the original
+      ThreadSafeEmpiricalProfileModeller obj = modeller;
+      obj.merge();
       boost::python::list data_list;
       boost::python::list mask_list;
       boost::python::list nref_list;
@@ -213,6 +219,38 @@ namespace dials { namespace algorithms { namespace boost_python {
     self(reflection, ar);
   }
 
+  /**
+   * Define the batch method of the IntensityCalculatorIface class. The
+   * reflections in the list are replaced by the computed reflections.
+   * @param self The interface object
+   * @param reflections The list of reflections to integrate
+   * @param adjacent_reflections The list of adjacent reflections of each
+   * @returns The list of whether each reflection was integrated
+   */
+  boost::python::list IntensityCalculatorIface_batch(
+    const IntensityCalculatorIface &self,
+    boost::python::list reflections,
+    boost::python::object adjacent_reflections) {
+    std::size_t n = boost::python::len(reflections);
+    DIALS_ASSERT(boost::python::len(adjacent_reflections) == n);
+    std::vector<af::Reflection> rl;
+    std::vector<std::vector<af::Reflection> > al(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      rl.push_back(boost::python::extract<af::Reflection>(reflections[i])());
+      boost::python::object adjacent = adjacent_reflections[i];
+      for (std::size_t j = 0; j < boost::python::len(adjacent); ++j) {
+        al[i].push_back(boost::python::extract<af::Reflection>(adjacent[j])());
+      }
+    }
+    std::vector<bool> success = self.batch(rl, al);
+    boost::python::list result;
+    for (std::size_t i = 0; i < n; ++i) {
+      reflections[i] = rl[i];
+      result.append((bool)success[i]);
+    }
+    return result;
+  }
+
   /**
    * Initialise the reference calculator
    * @param sampler The sampler
@@ -258,7 +296,9 @@ namespace dials { namespace algorithms { namespace boost_python {
 
     class_<IntensityCalculatorIface, boost::noncopyable>("IntensityCalculatorIface",
                                                          no_init)
-      .def("__call__", &IntensityCalculatorIface_call);
+      .def("__call__", &IntensityCalculatorIface_call)
+      .def("batched", &IntensityCalculatorIface::batched)
+      .def("batch", &IntensityCalculatorIface_batch);
 
     class_<ReferenceCalculatorIface, boost::noncopyable>("ReferenceCalculatorIface",
                                                          no_init)
@@ -337,10 +377,32 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<NullIntensityCalculator, bases<IntensityCalculatorIface> >(
       "NullIntensityCalculator");
 
+    // Export TransformedProfileCache
+    class_<TransformedProfileCache,
+           boost::shared_ptr<TransformedProfileCache>,
+           boost::noncopyable>("TransformedProfileCache", no_init)
+      .def(init<std::size_t>((arg("max_memory"))))
+      .def("size", &TransformedProfileCache::size)
+      .def("num_spilled", &TransformedProfileCache::num_spilled)
+      .def("memory", &TransformedProfileCache::memory)
+      .def("max_memory", &TransformedProfileCache::max_memory)
+      .def("hits", &TransformedProfileCache::hits)
+      .def("misses", &TransformedProfileCache::misses)
+      .def("__len__", &TransformedProfileCache::size);
+
     // Export GaussianRSIntensityCalculator
     class_<GaussianRSIntensityCalculator, bases<IntensityCalculatorIface> >(
       "GaussianRSIntensityCalculator", no_init)
-      .def(init<const GaussianRSMultiCrystalReferenceProfileData &, bool, bool>());
+      .def(init<const GaussianRSMultiCrystalReferenceProfileData &, bool, bool>())
+      .def(init<const GaussianRSMultiCrystalReferenceProfileData &,
+                boost::shared_ptr<TransformedProfileCache> >());
+
+    // Export GaussianRSBatchIntensityCalculator
+    class_<GaussianRSBatchIntensityCalculator, bases<IntensityCalculatorIface> >(
+      "GaussianRSBatchIntensityCalculator", no_init)
+      .def(init<const GaussianRSMultiCrystalReferenceProfileData &>())
+      .def(init<const GaussianRSMultiCrystalReferenceProfileData &,
+                boost::shared_ptr<TransformedProfileCache> >());
 
     // Export ThreadSafeEmpiricalProfileModeller
     class_<ThreadSafeEmpiricalProfileModeller, bases<EmpiricalProfileModeller> >(
@@ -360,14 +422,84 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("__init__", make_constructor(&GaussianRSReferenceCalculator_init))
       .def("__init__", make_constructor(&GaussianRSReferenceCalculator_init2))
       .def("accumulate", &GaussianRSReferenceCalculator::accumulate)
+      .def("set_transform_cache", &GaussianRSReferenceCalculator::set_transform_cache)
+      .def("transform_cache", &GaussianRSReferenceCalculator::transform_cache)
       .def("reference_profiles", &GaussianRSReferenceCalculator::reference_profiles)
       .def_pickle(GaussianRSReferenceCalculatorPickleSuite());
   }
 
+  /**
+   * Construct the image volume reader from a tuple of lookup masks
+   * @param imageset The imageset
+   * @param frame0 The frame number of the first image
+   * @param lookup_mask The lookup masks or None
+   * @param prefetch The number of images to read ahead
+   */
+  ImageVolumeReader *make_image_volume_reader(ImageSequence imageset,
+                                              int frame0,
+                                              boost::python::object lookup_mask,
+                                              std::size_t prefetch) {
+    af::shared<ImageVolumeReader::mask_type> mask;
+    if (!lookup_mask.is_none()) {
+      for (std::size_t i = 0; i < boost::python::len(lookup_mask); ++i) {
+        af::flex_bool m = boost::python::extract<af::flex_bool>(lookup_mask[i]);
+        DIALS_ASSERT(m.accessor().all().size() == 2);
+        mask.push_back(ImageVolumeReader::mask_type(m.handle(),
+                                                    af::c_grid<2>(m.accessor())));
+      }
+    }
+    return new ImageVolumeReader(imageset, frame0, mask.const_ref(), prefetch);
+  }
+
+  /**
+   * Export the integration telemetry
+   */
+  void export_telemetry() {
+    class_<TimingHistogram>("TimingHistogram")
+      .def(init<const af::const_ref<std::size_t> &, double>(
+        (arg("counts"), arg("total"))))
+      .def("counts", &TimingHistogram::counts)
+      .def("count", &TimingHistogram::count)
+      .def("total", &TimingHistogram::total)
+      .def("mean", &TimingHistogram::mean)
+      .def("bin_edges", &TimingHistogram::bin_edges)
+      .def("bin_index", &TimingHistogram::bin_index)
+      .staticmethod("bin_edges")
+      .staticmethod("bin_index");
+
+    class_<IntegrationTelemetry>("IntegrationTelemetry")
+      .def_readonly("nthreads", &IntegrationTelemetry::nthreads)
+      .def_readonly("buffer_size", &IntegrationTelemetry::buffer_size)
+      .def_readonly("num_images", &IntegrationTelemetry::num_images)
+      .def_readonly("wall_time", &IntegrationTelemetry::wall_time)
+      .def_readonly("read_time", &IntegrationTelemetry::read_time)
+      .def_readonly("wait_time", &IntegrationTelemetry::wait_time)
+      .def_readonly("copy_time", &IntegrationTelemetry::copy_time)
+      .def_readonly("mean_occupancy", &IntegrationTelemetry::mean_occupancy)
+      .def_readonly("max_occupancy", &IntegrationTelemetry::max_occupancy)
+      .def_readonly("extract", &IntegrationTelemetry::extract)
+      .def_readonly("mask", &IntegrationTelemetry::mask)
+      .def_readonly("background", &IntegrationTelemetry::background)
+      .def_readonly("intensity", &IntegrationTelemetry::intensity)
+      .def_readonly("reflection", &IntegrationTelemetry::reflection)
+      .def("num_reflections", &IntegrationTelemetry::num_reflections)
+      .def("busy_time", &IntegrationTelemetry::busy_time)
+      .def("reflections_per_second", &IntegrationTelemetry::reflections_per_second)
+      .def("utilisation", &IntegrationTelemetry::utilisation);
+  }
+
   /**
    * Export integrator
    */
   void export_integrator() {
+    class_<WorkStealingThreadPool,
+           boost::shared_ptr<WorkStealingThreadPool>,
+           boost::noncopyable>("WorkStealingThreadPool", no_init)
+      .def(init<std::size_t, bool, std::size_t>(
+        (arg("nthreads"), arg("pin_threads") = false, arg("numa_nodes") = 0)))
+      .def("size", &WorkStealingThreadPool::size)
+      .def("num_nodes", &WorkStealingThreadPool::num_nodes);
+
     class_<ParallelIntegrator>("MultiThreadedIntegrator", no_init)
       .def(init<const af::reflection_table &,
                 ImageSequence,
@@ -378,23 +510,37 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
-                bool>((arg("reflections"),
-                       arg("imageset"),
-                       arg("compute_mask"),
-                       arg("compute_background"),
-                       arg("compute_intensity"),
-                       arg("logger"),
-                       arg("nthreads") = 1,
-                       arg("buffer_size") = 0,
-                       arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                bool,
+                std::size_t,
+                bool,
+                std::size_t,
+                std::size_t,
+                boost::shared_ptr<WorkStealingThreadPool> >(
+        (arg("reflections"),
+         arg("imageset"),
+         arg("compute_mask"),
+         arg("compute_background"),
+         arg("compute_intensity"),
+         arg("logger"),
+         arg("nthreads") = 1,
+         arg("buffer_size") = 0,
+         arg("use_dynamic_mask") = true,
+         arg("debug") = false,
+         arg("prefetch") = 2,
+         arg("integer_buffer") = false,
+         arg("batch_size") = 1,
+         arg("numa_nodes") = 0,
+         arg("pool") = object())))
       .def("reflections", &ParallelIntegrator::reflections)
+      .def("telemetry", &ParallelIntegrator::telemetry)
       .def("compute_required_memory",
            &ParallelIntegrator::compute_required_memory,
-           (arg("imageset")))
+           (arg("imageset"), arg("block_size"), arg("integer_buffer") = false))
       .def("compute_max_block_size",
            &ParallelIntegrator::compute_max_block_size,
-           (arg("imageset"), arg("max_memory_usage")))
+           (arg("imageset"),
+            arg("max_memory_usage"),
+            arg("integer_buffer") = false))
       .staticmethod("compute_required_memory")
       .staticmethod("compute_max_block_size");
 
@@ -408,30 +554,58 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
-                bool>((arg("reflections"),
-                       arg("imageset"),
-                       arg("compute_mask"),
-                       arg("compute_background"),
-                       arg("compute_reference"),
-                       arg("logger"),
-                       arg("nthreads") = 1,
-                       arg("buffer_size") = 0,
-                       arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                bool,
+                std::size_t,
+                bool,
+                std::size_t,
+                std::size_t,
+                boost::shared_ptr<WorkStealingThreadPool> >(
+        (arg("reflections"),
+         arg("imageset"),
+         arg("compute_mask"),
+         arg("compute_background"),
+         arg("compute_reference"),
+         arg("logger"),
+         arg("nthreads") = 1,
+         arg("buffer_size") = 0,
+         arg("use_dynamic_mask") = true,
+         arg("debug") = false,
+         arg("prefetch") = 2,
+         arg("integer_buffer") = false,
+         arg("batch_size") = 1,
+         arg("numa_nodes") = 0,
+         arg("pool") = object())))
       .def("reflections", &ParallelReferenceProfiler::reflections)
+      .def("telemetry", &ParallelReferenceProfiler::telemetry)
       .def("compute_required_memory",
            &ParallelReferenceProfiler::compute_required_memory,
-           (arg("imageset")))
+           (arg("imageset"), arg("block_size"), arg("integer_buffer") = false))
       .def("compute_max_block_size",
            &ParallelReferenceProfiler::compute_max_block_size,
-           (arg("imageset"), arg("max_memory_usage")))
+           (arg("imageset"),
+            arg("max_memory_usage"),
+            arg("integer_buffer") = false))
       .staticmethod("compute_required_memory")
       .staticmethod("compute_max_block_size");
 
+    class_<ImageVolumeReader, boost::noncopyable>("ImageVolumeReader", no_init)
+      .def("__init__",
+           make_constructor(&make_image_volume_reader,
+                            default_call_policies(),
+                            (arg("imageset"),
+                             arg("frame0"),
+                             arg("lookup_mask") = boost::python::object(),
+                             arg("prefetch") = 2)))
+      .def("__len__", &ImageVolumeReader::size)
+      .def("frame", &ImageVolumeReader::frame)
+      .def("has_next", &ImageVolumeReader::has_next)
+      .def("next", &ImageVolumeReader::next);
+
     class_<Logger>("Logger", no_init).def(init<boost::python::object>());
 
     class_<SimpleBlockList>("SimpleBlockList", no_init)
       .def(init<tiny<int, 2>, int>())
+      .def(init<tiny<int, 2>, const af::const_ref<int6> &, double, int>())
       .def(init<const af::const_ref<tiny<int, 2> > &>())
       .def("__getitem__", &SimpleBlockList::operator[])
       .def("__len__", &SimpleBlockList::size)
@@ -452,6 +626,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   BOOST_PYTHON_MODULE(dials_algorithms_integration_parallel_integrator_ext) {
     export_algorithm_interfaces();
     export_algorithms();
+    export_telemetry();
     export_integrator();
   }
 
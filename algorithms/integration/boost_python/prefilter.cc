@@ -0,0 +1,35 @@
+/*
+ * prefilter.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/integration/prefilter.h>
+
+using namespace boost::python;
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  void export_prefilter() {
+    class_<IntegrationPrefilter>("IntegrationPrefilter", no_init)
+      .def(init<double, double, double>(
+        (arg("min_zeta") = 0, arg("d_min") = 0, arg("d_max") = 0)))
+      .def("add_ring",
+           &IntegrationPrefilter::add_ring,
+           (arg("d_star_sq_min"), arg("d_star_sq_max")))
+      .def("num_rings", &IntegrationPrefilter::num_rings)
+      .def("in_ring", &IntegrationPrefilter::in_ring, (arg("d")))
+      .def("in_rings", &IntegrationPrefilter::in_rings, (arg("d")))
+      .def("is_integrable",
+           &IntegrationPrefilter::is_integrable,
+           (arg("zeta"), arg("d")))
+      .def("apply",
+           &IntegrationPrefilter::apply,
+           (arg("zeta"), arg("d"), arg("flags")));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
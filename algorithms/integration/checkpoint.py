@@ -0,0 +1,194 @@
+"""
+Save the results of integration jobs as they finish so that an interrupted
+run can be resumed.
+
+Each finished job is saved as a pair of files in the checkpoint directory: a
+reflection file holding its reflections as a row group (see
+flex.reflection_file_writer), and a small pickle holding the other results
+of the job. The files are named after a key computed from the name of the
+processing pass, the job index and frames, and the reflections given to the
+job, so a job is only skipped when it is given exactly the same input again.
+Each file is written under a temporary name and then renamed, and the pickle
+is written last, so a job which was still being saved when the run was
+interrupted is run again.
+
+The saved jobs do not record the processing parameters, so a run should only
+be resumed with the same parameters as the run that saved them.
+"""
+
+import glob
+import hashlib
+import logging
+import os
+import pickle
+
+import dials.algorithms.integration
+from dials.array_family import flex
+
+logger = logging.getLogger(__name__)
+
+# The columns which identify the reflections given to a job
+KEY_COLUMNS = (
+    "id",
+    "panel",
+    "miller_index",
+    "entering",
+    "bbox",
+    "xyzcal.px",
+    "partial_id",
+    "profile.index",
+    "flags",
+)
+
+# The prefix of the names of the checkpoint files
+PREFIX = "checkpoint-"
+
+
+def _replace(path, write):
+    """
+    Write a file under a temporary name and then rename it.
+
+    :param path: The file
+    :param write: A function to write to the temporary file name
+    """
+    tmp = path + ".tmp"
+    write(tmp)
+    os.replace(tmp, path)
+
+
+class JobCheckpoint:
+    """
+    The saved results of the jobs of one processing pass.
+    """
+
+    def __init__(self, directory, name):
+        """
+        :param directory: The checkpoint directory, created if needed
+        :param name: The name of the processing pass
+        """
+        os.makedirs(directory, exist_ok=True)
+        self.directory = directory
+        self.name = name
+        self._pending = {}
+
+    def key(self, task):
+        """
+        Compute the key of a task from its index, frames and reflections.
+
+        :param task: The task
+        :return: The key
+        """
+        reflections = task.reflections
+        columns = flex.reflection_table()
+        for name in KEY_COLUMNS:
+            if name in reflections:
+                columns[name] = reflections[name]
+        digest = hashlib.sha256()
+        digest.update(
+            repr(
+                (
+                    self.name,
+                    task.index,
+                    tuple(getattr(task, "job", ())),
+                    len(reflections),
+                    sorted(dict(reflections.experiment_identifiers()).items()),
+                )
+            ).encode()
+        )
+        digest.update(columns.as_msgpack())
+        return digest.hexdigest()[:32]
+
+    def _path(self, key, extension):
+        return os.path.join(self.directory, f"{PREFIX}{self.name}-{key}{extension}")
+
+    def load(self, index, key):
+        """
+        Load the saved result of a job.
+
+        :param index: The job index
+        :param key: The key of the job
+        :return: The result, or None if the job has not been saved
+        """
+        info_path = self._path(key, ".pickle")
+        reflections_path = self._path(key, ".refl")
+        if not (os.path.exists(info_path) and os.path.exists(reflections_path)):
+            return None
+        try:
+            with open(info_path, "rb") as infile:
+                info = pickle.load(infile)
+            reflections = flex.reflection_table.from_file(reflections_path)
+        except Exception as e:
+            logger.warning("Could not read the saved job %d: %s", index, e)
+            return None
+        return dials.algorithms.integration.Result(
+            index=index, reflections=reflections, **info
+        )
+
+    def save(self, result):
+        """
+        Save the result of a job given out by tasks().
+
+        :param result: The result
+        :return: True if the result was saved
+        """
+        key = self._pending.pop(result.index, None)
+        if key is None:
+            return False
+
+        def write_reflections(path):
+            with flex.reflection_file_writer(path) as writer:
+                writer.append(result.reflections)
+
+        def write_info(path):
+            info = result._asdict()
+            del info["index"]
+            del info["reflections"]
+            with open(path, "wb") as outfile:
+                pickle.dump(info, outfile, protocol=pickle.HIGHEST_PROTOCOL)
+
+        _replace(self._path(key, ".refl"), write_reflections)
+        _replace(self._path(key, ".pickle"), write_info)
+        return True
+
+    def tasks(self, tasks, accumulate):
+        """
+        Restore the saved jobs and give out the others to be run. The results
+        of the jobs which are run should be passed to save().
+
+        :param tasks: An iterable of tasks
+        :param accumulate: A function called with the result of each saved job
+        :return: An iterator over the tasks which have not been saved
+        """
+        restored = 0
+        for task in tasks:
+            key = self.key(task)
+            result = self.load(task.index, key)
+            if result is not None:
+                logger.debug("Restored job %d from checkpoint", task.index)
+                accumulate(result)
+                restored += 1
+                continue
+            self._pending[task.index] = key
+            yield task
+        if restored:
+            logger.info(
+                " Restored %d %s job(s) from the checkpoint in %s\n",
+                restored,
+                self.name,
+                self.directory,
+            )
+
+
+def clear_checkpoints(directory):
+    """
+    Remove the checkpoint files from a directory, and the directory if it is
+    then empty.
+
+    :param directory: The checkpoint directory
+    """
+    for path in glob.glob(os.path.join(glob.escape(directory), PREFIX + "*")):
+        os.remove(path)
+    try:
+        os.rmdir(directory)
+    except OSError:
+        pass
@@ -2,6 +2,7 @@
 from cctbx.miller import index_generator
 from iotbx.phil import parse
 
+from dials.algorithms.integration import IntegrationPrefilter
 from dials.array_family import flex
 
 # The phil scope
@@ -32,6 +33,20 @@
 )
 
 
+def _in_rings(ranges, d):
+    """
+    Check which resolutions are in any of a set of rings
+
+    :param ranges: The (min, max) ranges of the rings in 1/d^2
+    :param d: The resolutions
+    :return: True/False in a ring
+    """
+    prefilter = IntegrationPrefilter()
+    for d_star_sq_min, d_star_sq_max in ranges:
+        prefilter.add_ring(d_star_sq_min, d_star_sq_max)
+    return prefilter.in_rings(flex.double(d))
+
+
 class PowderRingFilter:
     """
     A class to do powder ring filtering.
@@ -62,6 +77,14 @@ def __init__(self, unit_cell, space_group, d_min, width):
         # Compute d spacings and sort by resolution
         self.d_star_sq = flex.sorted(unit_cell.d_star_sq(indices))
 
+    def ranges(self):
+        """
+        :return: The list of (min, max) ranges of the rings in 1/d^2
+        """
+        return [
+            (ds2 - self.half_width, ds2 + self.half_width) for ds2 in self.d_star_sq
+        ]
+
     def __call__(self, d):
         """
         True if within powder ring.
@@ -69,11 +92,7 @@ def __call__(self, d):
         :param d: The resolution
         :return: True/False in powder ring
         """
-        result = flex.bool(len(d), False)
-        d_star_sq = uctbx.d_as_d_star_sq(d)
-        for ds2 in self.d_star_sq:
-            result = result | (flex.abs(d_star_sq - ds2) < self.half_width)
-        return result
+        return _in_rings(self.ranges(), d)
 
 
 class IceRingFilter:
@@ -105,6 +124,12 @@ def __init__(self):
             (0.531, 0.537),
         ]
 
+    def ranges(self):
+        """
+        :return: The list of (min, max) ranges of the rings in 1/d^2
+        """
+        return list(self.ice_rings)
+
     def __call__(self, d):
         """
         True if within powder ring.
@@ -112,8 +137,4 @@ def __call__(self, d):
         :param d: The resolution
         :return: True/False in powder ring
         """
-        result = flex.bool(len(d), False)
-        d2 = 1.0 / flex.pow2(d)
-        for ice_ring in self.ice_rings:
-            result = result | (d2 >= ice_ring[0]) & (d2 <= ice_ring[1])
-        return result
+        return _in_rings(self.ranges(), d)
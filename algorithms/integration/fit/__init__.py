@@ -1,3 +1,10 @@
 from dials_algorithms_integration_fit_ext import *  # noqa: F403; lgtm
 
-__all__ = ("ProfileFitter", "ProfileFitterDouble", "ProfileFitterFloat")  # noqa: F405
+__all__ = (  # noqa: F405
+    "BatchProfileFitter",
+    "BatchProfileFitterDouble",
+    "BatchProfileFitterFloat",
+    "ProfileFitter",
+    "ProfileFitterDouble",
+    "ProfileFitterFloat",
+)
@@ -0,0 +1,322 @@
+/*
+ * batch_fitting.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_FIT_BATCH_FITTING_H
+#define DIALS_ALGORITHMS_INTEGRATION_FIT_BATCH_FITTING_H
+
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+#ifdef DIALS_ENABLE_OFFLOAD
+#pragma omp declare target
+#endif
+
+    /**
+     * Fit the profile of a single reflection of a batch. This does the same
+     * iteration as ProfileFitter but returns false instead of throwing if the
+     * reflection can't be fitted, so it can be run on an accelerator.
+     * @param d The data array
+     * @param b The background array
+     * @param m The mask array
+     * @param p The profile array
+     * @param n The number of pixels
+     * @param eps The tolerance
+     * @param maxiter The maximum number of iterations
+     * @param intensity The fitted intensity
+     * @param variance The variance of the intensity
+     * @param correlation The correlation of the fitted and observed pixels
+     * @param niter The number of iterations
+     * @returns True/False if the reflection was fitted
+     */
+    inline bool fit_batch_item(const double *d,
+                               const double *b,
+                               const unsigned char *m,
+                               const double *p,
+                               std::size_t n,
+                               double eps,
+                               std::size_t maxiter,
+                               double &intensity,
+                               double &variance,
+                               double &correlation,
+                               std::size_t &niter) {
+      // Compute the sums of the background and foreground
+      double sumd = 0;
+      double sumb = 0;
+      double sump = 0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (m[i]) {
+          if (p[i] < 0) {
+            return false;
+          }
+          sumd += d[i];
+          sumb += b[i];
+          sump += p[i];
+          count++;
+        }
+      }
+      if (sumb < 0 || sumd < 0 || !(sump > 0)) {
+        return false;
+      }
+
+      // Iterate to calculate the intensity
+      double I0 = sumd - sumb;
+      double I = 0.0;
+      double V = 0.0;
+      for (niter = 0; niter < maxiter; ++niter) {
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+          if (m[i] && p[i] > 0) {
+            double v = 1e-10 + std::fabs(b[i]) + std::fabs(I0 * p[i]);
+            sum1 += (d[i] - b[i]) * p[i] / v;
+            sum2 += p[i] * p[i] / v;
+          }
+        }
+        if (!(sum2 > 0)) {
+          return false;
+        }
+        I = sum1 / sum2;
+        V = std::fabs(I) + std::fabs(sumb);
+        if (std::fabs(I - I0) < eps) {
+          break;
+        }
+        I0 = I;
+      }
+      if (niter >= maxiter) {
+        return false;
+      }
+
+      // Compute the correlation of the fitted and observed pixels
+      double xb = 0.0, yb = 0.0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (m[i]) {
+          xb += I * p[i] + b[i];
+          yb += d[i];
+        }
+      }
+      xb /= count;
+      yb /= count;
+      double sdxdy = 0.0, sdx2 = 0.0, sdy2 = 0.0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (m[i]) {
+          double dx = (I * p[i] + b[i]) - xb;
+          double dy = d[i] - yb;
+          sdxdy += dx * dy;
+          sdx2 += dx * dx;
+          sdy2 += dy * dy;
+        }
+      }
+      correlation = 0.0;
+      if (sdx2 > 0.0 && sdy2 > 0.0) {
+        correlation = sdxdy / (std::sqrt(sdx2) * std::sqrt(sdy2));
+      }
+      intensity = I;
+      variance = V;
+      return true;
+    }
+
+#ifdef DIALS_ENABLE_OFFLOAD
+#pragma omp end declare target
+#endif
+
+  }  // namespace detail
+
+  /**
+   * A class to fit the profiles of a batch of reflections together.
+   *
+   * The transformed pixels of each reflection are appended to contiguous
+   * arrays and then all the reflections are fitted by a single loop, doing
+   * the same iteration as ProfileFitter does for a single reflection. The
+   * loop has no allocations or exceptions so, when compiled with
+   * DIALS_ENABLE_OFFLOAD by a compiler supporting OpenMP target offload, the
+   * whole batch is copied to the device and fitted by one kernel with a
+   * thread per reflection. Otherwise the batch is fitted on the calling
+   * thread.
+   */
+  class BatchProfileFitter {
+  public:
+    BatchProfileFitter() {
+      offset_.push_back(0);
+    }
+
+    /**
+     * Add a reflection to the batch
+     * @param d The data array
+     * @param b The background array
+     * @param m The mask array
+     * @param p The profile array
+     * @returns The index of the reflection in the batch
+     */
+    std::size_t add(const af::const_ref<double> &d,
+                    const af::const_ref<double> &b,
+                    const af::const_ref<bool> &m,
+                    const af::const_ref<double> &p) {
+      DIALS_ASSERT(d.size() == b.size());
+      DIALS_ASSERT(d.size() == m.size());
+      DIALS_ASSERT(d.size() == p.size());
+      data_.insert(data_.end(), d.begin(), d.end());
+      background_.insert(background_.end(), b.begin(), b.end());
+      mask_.insert(mask_.end(), m.begin(), m.end());
+      profile_.insert(profile_.end(), p.begin(), p.end());
+      offset_.push_back(data_.size());
+      return offset_.size() - 2;
+    }
+
+    /**
+     * Fit all the reflections in the batch
+     * @param eps The tolerance
+     * @param maxiter The maximum number of iterations
+     */
+    void fit(double eps, std::size_t maxiter) {
+      DIALS_ASSERT(eps > 0.0);
+      DIALS_ASSERT(maxiter >= 1);
+      std::size_t n = size();
+      intensity_.assign(n, 0.0);
+      variance_.assign(n, 0.0);
+      correlation_.assign(n, 0.0);
+      niter_.assign(n, 0);
+      success_.assign(n, 0);
+      if (n == 0) {
+        return;
+      }
+
+      // Take pointers to the arrays so they can be mapped to the device
+      std::size_t npixels = data_.size();
+      const double *d = npixels > 0 ? &data_[0] : NULL;
+      const double *b = npixels > 0 ? &background_[0] : NULL;
+      const unsigned char *m = npixels > 0 ? &mask_[0] : NULL;
+      const double *p = npixels > 0 ? &profile_[0] : NULL;
+      const std::size_t *offset = &offset_[0];
+      double *intensity = &intensity_[0];
+      double *variance = &variance_[0];
+      double *correlation = &correlation_[0];
+      std::size_t *niter = &niter_[0];
+      unsigned char *success = &success_[0];
+
+#ifdef DIALS_ENABLE_OFFLOAD
+#pragma omp target teams distribute parallel for map(      \
+  to : d[0 : npixels],                                     \
+  b[0 : npixels],                                          \
+  m[0 : npixels],                                          \
+  p[0 : npixels],                                          \
+  offset[0 : n + 1])                                       \
+  map(from : intensity[0 : n],                             \
+      variance[0 : n],                                     \
+      correlation[0 : n],                                  \
+      niter[0 : n],                                        \
+      success[0 : n])
+#endif
+      for (std::size_t i = 0; i < n; ++i) {
+        std::size_t first = offset[i];
+        success[i] = detail::fit_batch_item(&d[first],
+                                            &b[first],
+                                            &m[first],
+                                            &p[first],
+                                            offset[i + 1] - first,
+                                            eps,
+                                            maxiter,
+                                            intensity[i],
+                                            variance[i],
+                                            correlation[i],
+                                            niter[i]);
+      }
+    }
+
+    /**
+     * Remove all the reflections from the batch, keeping the memory
+     */
+    void clear() {
+      data_.clear();
+      background_.clear();
+      mask_.clear();
+      profile_.clear();
+      offset_.resize(1);
+      intensity_.clear();
+      variance_.clear();
+      correlation_.clear();
+      niter_.clear();
+      success_.clear();
+    }
+
+    /**
+     * @returns The number of reflections in the batch
+     */
+    std::size_t size() const {
+      return offset_.size() - 1;
+    }
+
+    /**
+     * @returns The number of pixels in the batch
+     */
+    std::size_t num_pixels() const {
+      return data_.size();
+    }
+
+    /**
+     * @returns True/False if the reflection was fitted
+     */
+    bool success(std::size_t index) const {
+      DIALS_ASSERT(index < success_.size());
+      return success_[index] != 0;
+    }
+
+    /**
+     * @returns The fitted intensity of the reflection
+     */
+    double intensity(std::size_t index) const {
+      DIALS_ASSERT(index < intensity_.size());
+      return intensity_[index];
+    }
+
+    /**
+     * @returns The variance of the fitted intensity of the reflection
+     */
+    double variance(std::size_t index) const {
+      DIALS_ASSERT(index < variance_.size());
+      return variance_[index];
+    }
+
+    /**
+     * @returns The correlation of the fitted and observed pixels
+     */
+    double correlation(std::size_t index) const {
+      DIALS_ASSERT(index < correlation_.size());
+      return correlation_[index];
+    }
+
+    /**
+     * @returns The number of iterations used to fit the reflection
+     */
+    std::size_t niter(std::size_t index) const {
+      DIALS_ASSERT(index < niter_.size());
+      return niter_[index];
+    }
+
+  protected:
+    std::vector<double> data_;
+    std::vector<double> background_;
+    std::vector<unsigned char> mask_;
+    std::vector<double> profile_;
+    std::vector<std::size_t> offset_;
+    std::vector<double> intensity_;
+    std::vector<double> variance_;
+    std::vector<double> correlation_;
+    std::vector<std::size_t> niter_;
+    std::vector<unsigned char> success_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_FIT_BATCH_FITTING_H
@@ -297,8 +297,40 @@ namespace dials { namespace algorithms {
       std::size_t N = d.size();
       std::size_t M = p.accessor()[0];
 
+      // Only the masked pixels which are covered by at least one profile
+      // contribute to the normal equations, so gather their profile values
+      // once and reuse them on every iteration. The sums are accumulated in
+      // the same order as over the full arrays so the results are the same.
+      // The variance of the other masked pixels is just the background.
+      std::vector<std::size_t> pixel;
+      for (std::size_t i = 0; i < N; ++i) {
+        if (m[i]) {
+          bool covered = false;
+          for (std::size_t k = 0; k < M && !covered; ++k) {
+            covered = p(k, i) != 0;
+          }
+          if (covered) {
+            pixel.push_back(i);
+          } else {
+            DIALS_ASSERT(b[i] > 0);
+          }
+        }
+      }
+      std::size_t L = pixel.size();
+      std::vector<double> pc(std::max(M * L, std::size_t(1)));
+      std::vector<double> bc(L);
+      std::vector<double> dbc(L);
+      for (std::size_t l = 0; l < L; ++l) {
+        std::size_t i = pixel[l];
+        for (std::size_t k = 0; k < M; ++k) {
+          pc[k * L + l] = p(k, i);
+        }
+        bc[l] = b[i];
+        dbc[l] = d[i] - b[i];
+      }
+
       // Allocate some arrays
-      std::vector<double> v(N);
+      std::vector<double> v(L);
       std::vector<double> I(M, 1);
       std::vector<double> I0(M, 1);
       std::vector<double> A(M * M);
@@ -307,38 +339,39 @@ namespace dials { namespace algorithms {
       for (niter_ = 0; niter_ < maxiter; ++niter_) {
         //
         // Compute the variance for the given estimate
-        std::copy(b.begin(), b.end(), v.begin());
+        std::copy(bc.begin(), bc.end(), v.begin());
         for (std::size_t j = 0; j < M; ++j) {
-          for (std::size_t i = 0; i < N; ++i) {
-            v[i] += std::max(1.0 / N, std::abs(I[j])) * p(j, i);
+          double scale = std::max(1.0 / N, std::abs(I[j]));
+          const double *pj = &pc[j * L];
+          for (std::size_t l = 0; l < L; ++l) {
+            v[l] += scale * pj[l];
           }
         }
 
         // Compute the matrices to do the profile fitting
         std::fill(I.begin(), I.end(), 0);
+        for (std::size_t l = 0; l < L; ++l) {
+          DIALS_ASSERT(v[l] > 0);
+        }
         for (std::size_t k = 0; k < M; ++k) {
-          for (std::size_t i = 0; i < N; ++i) {
-            if (m[i]) {
-              DIALS_ASSERT(v[i] > 0);
-              I[k] += p(k, i) * (d[i] - b[i]) / v[i];
-            }
+          const double *pk = &pc[k * L];
+          for (std::size_t l = 0; l < L; ++l) {
+            I[k] += pk[l] * dbc[l] / v[l];
           }
         }
 
         std::fill(A.begin(), A.end(), 0);
         for (std::size_t k = 0; k < M; ++k) {
-          for (std::size_t i = 0; i < N; ++i) {
-            if (m[i]) {
-              A[k + k * M] += p(k, i) * p(k, i) / v[i];
-            }
+          const double *pk = &pc[k * L];
+          for (std::size_t l = 0; l < L; ++l) {
+            A[k + k * M] += pk[l] * pk[l] / v[l];
           }
           for (std::size_t j = k + 1; j < M; ++j) {
-            for (std::size_t i = 0; i < N; ++i) {
-              if (m[i]) {
-                A[j + k * M] += p(k, i) * p(j, i) / v[i];
-                A[k + j * M] = A[j + k * M];
-              }
+            const double *pj = &pc[j * L];
+            for (std::size_t l = 0; l < L; ++l) {
+              A[j + k * M] += pk[l] * pj[l] / v[l];
             }
+            A[k + j * M] = A[j + k * M];
           }
         }
 
@@ -475,6 +508,359 @@ namespace dials { namespace algorithms {
     double error_;
   };
 
+  /**
+   * A class to profile fit a batch of reflections which share the same
+   * reference profile.
+   *
+   * Each reflection is fitted exactly as by the single reflection
+   * ProfileFitter, with the same convergence criteria. The reflections are
+   * processed in groups of lanes; the data for each group is transposed so
+   * that the inner loops run across the reflections with no branches, which
+   * lets the compiler vectorize them, and the reference profile is only read
+   * once per pixel for the whole group. A reflection which the single
+   * reflection fitter would reject is flagged as unsuccessful rather than
+   * failing the whole batch.
+   */
+  template <typename T = double>
+  class BatchProfileFitter {
+  public:
+    typedef T float_type;
+
+    /**
+     * The number of reflections fitted together
+     */
+    static const std::size_t lanes = 8;
+
+    /**
+     * Profile fit a batch of reflections. Each row of the data, background
+     * and mask arrays is a separate reflection.
+     */
+    BatchProfileFitter(const af::const_ref<T, af::c_grid<2> > &d,
+                       const af::const_ref<T, af::c_grid<2> > &b,
+                       const af::const_ref<bool, af::c_grid<2> > &m,
+                       const af::const_ref<T> &p,
+                       double eps = 1e-3,
+                       std::size_t maxiter = 10) {
+      fit(d, b, m, p, eps, maxiter);
+    }
+
+    /**
+     * Profile fit a batch of 3D reflections. The first dimension of the data,
+     * background and mask arrays is the reflection.
+     */
+    BatchProfileFitter(const af::const_ref<T, af::c_grid<4> > &d,
+                       const af::const_ref<T, af::c_grid<4> > &b,
+                       const af::const_ref<bool, af::c_grid<4> > &m,
+                       const af::const_ref<T, af::c_grid<3> > &p,
+                       double eps = 1e-3,
+                       std::size_t maxiter = 10) {
+      fit(detail::as_2d(d), detail::as_2d(b), detail::as_2d(m), p.as_1d(), eps, maxiter);
+    }
+
+    /**
+     * @returns The number of reflections
+     */
+    std::size_t size() const {
+      return intensity_.size();
+    }
+
+    /**
+     * @returns The intensity of each reflection
+     */
+    af::shared<double> intensity() const {
+      return intensity_;
+    }
+
+    /**
+     * @returns The variance of each reflection
+     */
+    af::shared<double> variance() const {
+      return variance_;
+    }
+
+    /**
+     * @returns The correlation of each reflection
+     */
+    af::shared<double> correlation() const {
+      return correlation_;
+    }
+
+    /**
+     * @returns The number of iterations for each reflection
+     */
+    af::shared<std::size_t> niter() const {
+      return niter_;
+    }
+
+    /**
+     * @returns The maximum number of iterations
+     */
+    std::size_t maxiter() const {
+      return maxiter_;
+    }
+
+    /**
+     * @returns The error in the fit of each reflection
+     */
+    af::shared<double> error() const {
+      return error_;
+    }
+
+    /**
+     * @returns Whether each reflection was fitted
+     */
+    af::shared<bool> success() const {
+      return success_;
+    }
+
+  protected:
+    /**
+     * Profile fit the batch of reflections
+     *
+     * @param d The data array
+     * @param b The background array
+     * @param m The mask array
+     * @param p The profile array
+     * @param eps The tolerance
+     * @param maxiter The maximum number of iterations
+     */
+    void fit(const af::const_ref<T, af::c_grid<2> > &d,
+             const af::const_ref<T, af::c_grid<2> > &b,
+             const af::const_ref<bool, af::c_grid<2> > &m,
+             const af::const_ref<T> &p,
+             double eps,
+             std::size_t maxiter) {
+      // Save the max iter
+      maxiter_ = maxiter;
+
+      // Check the input
+      DIALS_ASSERT(d.accessor().all_eq(b.accessor()));
+      DIALS_ASSERT(d.accessor().all_eq(m.accessor()));
+      DIALS_ASSERT(d.accessor()[1] == p.size());
+      DIALS_ASSERT(eps > 0.0);
+      DIALS_ASSERT(maxiter >= 1);
+
+      // Allocate the results
+      std::size_t num = d.accessor()[0];
+      intensity_.resize(num, 0);
+      variance_.resize(num, 0);
+      correlation_.resize(num, 0);
+      niter_.resize(num, 0);
+      error_.resize(num, 0);
+      success_.resize(num, false);
+
+      // Fit each group of reflections
+      std::size_t size = p.size();
+      std::vector<double> dt(size * lanes);
+      std::vector<double> bt(size * lanes);
+      std::vector<double> wt(size * lanes);
+      for (std::size_t first = 0; first < num; first += lanes) {
+        std::size_t count = std::min(lanes, num - first);
+        transpose(d, first, count, dt);
+        transpose(b, first, count, bt);
+        transpose(m, first, count, wt);
+        fit_lanes(p, &dt[0], &bt[0], &wt[0], first, count, eps, maxiter);
+      }
+    }
+
+    /**
+     * Copy a group of reflections into a pixel major array. The values for
+     * unused lanes are set to zero.
+     */
+    template <typename U>
+    static void transpose(const af::const_ref<U, af::c_grid<2> > &src,
+                          std::size_t first,
+                          std::size_t count,
+                          std::vector<double> &dst) {
+      std::size_t size = src.accessor()[1];
+      std::fill(dst.begin(), dst.end(), 0.0);
+      for (std::size_t k = 0; k < count; ++k) {
+        const U *row = &src[(first + k) * size];
+        for (std::size_t i = 0; i < size; ++i) {
+          dst[i * lanes + k] = row[i];
+        }
+      }
+    }
+
+    /**
+     * Profile fit a group of reflections. The masked pixels have a weight of
+     * one and all others a weight of zero so the sums are the same as those
+     * computed by the single reflection fitter.
+     */
+    void fit_lanes(const af::const_ref<T> &p,
+                   const double *d,
+                   const double *b,
+                   const double *w,
+                   std::size_t first,
+                   std::size_t count,
+                   double eps,
+                   std::size_t maxiter) {
+      std::size_t size = p.size();
+
+      // Compute the sums of the background and foreground
+      double sumd[lanes] = {0};
+      double sumb[lanes] = {0};
+      double sump[lanes] = {0};
+      bool valid[lanes];
+      for (std::size_t k = 0; k < lanes; ++k) {
+        valid[k] = k < count;
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        const double *dd = &d[i * lanes];
+        const double *bb = &b[i * lanes];
+        const double *ww = &w[i * lanes];
+        double pp = p[i];
+        for (std::size_t k = 0; k < lanes; ++k) {
+          sumd[k] += ww[k] * dd[k];
+          sumb[k] += ww[k] * bb[k];
+          sump[k] += ww[k] * pp;
+        }
+        if (pp < 0) {
+          for (std::size_t k = 0; k < lanes; ++k) {
+            if (ww[k] > 0) {
+              valid[k] = false;
+            }
+          }
+        }
+      }
+
+      // Iterate to calculate the intensity of all the reflections which are
+      // still active. A reflection stops once the tolerance is reached.
+      double I0[lanes];
+      double I[lanes];
+      double V[lanes];
+      double error[lanes];
+      std::size_t niter[lanes];
+      bool active[lanes];
+      std::size_t num_active = 0;
+      for (std::size_t k = 0; k < lanes; ++k) {
+        valid[k] = valid[k] && sumb[k] >= 0 && sumd[k] >= 0 && sump[k] > 0;
+        I0[k] = sumd[k] - sumb[k];
+        I[k] = 0.0;
+        V[k] = 0.0;
+        error[k] = 0.0;
+        niter[k] = maxiter;
+        active[k] = valid[k];
+        if (active[k]) {
+          num_active++;
+        }
+      }
+      for (std::size_t iter = 0; iter < maxiter && num_active > 0; ++iter) {
+        double sum1[lanes] = {0};
+        double sum2[lanes] = {0};
+        for (std::size_t i = 0; i < size; ++i) {
+          double pp = p[i];
+          if (pp > 0) {
+            const double *dd = &d[i * lanes];
+            const double *bb = &b[i * lanes];
+            const double *ww = &w[i * lanes];
+            for (std::size_t k = 0; k < lanes; ++k) {
+              double v = 1e-10 + std::abs(bb[k]) + std::abs(I0[k] * pp);
+              sum1[k] += ww[k] * (dd[k] - bb[k]) * pp / v;
+              sum2[k] += ww[k] * pp * pp / v;
+            }
+          }
+        }
+        for (std::size_t k = 0; k < lanes; ++k) {
+          if (!active[k]) {
+            continue;
+          }
+          if (!(sum2[k] > 0)) {
+            valid[k] = false;
+            active[k] = false;
+            num_active--;
+            continue;
+          }
+          I[k] = sum1[k] / sum2[k];
+          V[k] = std::abs(I[k]) + std::abs(sumb[k]);
+          if ((error[k] = std::abs(I[k] - I0[k])) < eps) {
+            niter[k] = iter;
+            active[k] = false;
+            num_active--;
+          } else {
+            I0[k] = I[k];
+          }
+        }
+      }
+
+      // Set the results. If niter is too large replace with the summation
+      // results.
+      for (std::size_t k = 0; k < count; ++k) {
+        std::size_t j = first + k;
+        niter_[j] = niter[k];
+        error_[j] = error[k];
+        if (!valid[k]) {
+          continue;
+        }
+        if (niter[k] >= maxiter) {
+          I[k] = sumd[k] - sumb[k];
+          V[k] = std::abs(I[k]) + std::abs(sumb[k]);
+        }
+        DIALS_ASSERT(V[k] >= 0);
+        intensity_[j] = I[k];
+        variance_[j] = V[k];
+        correlation_[j] = compute_correlation(p, d, b, w, k, I[k]);
+        success_[j] = true;
+      }
+    }
+
+    /**
+     * Compute the correlation for a single reflection in the group
+     */
+    double compute_correlation(const af::const_ref<T> &p,
+                               const double *d,
+                               const double *b,
+                               const double *w,
+                               std::size_t k,
+                               double intensity) const {
+      // Compute the mean observed and predicted
+      double xb = 0.0, yb = 0.0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < p.size(); ++i) {
+        std::size_t j = i * lanes + k;
+        if (w[j] > 0) {
+          xb += intensity * p[i] + b[j];
+          yb += d[j];
+          count++;
+        }
+      }
+      DIALS_ASSERT(count > 0);
+      xb /= count;
+      yb /= count;
+
+      // Compute the variance
+      double sdxdy = 0.0, sdx2 = 0.0, sdy2 = 0.0;
+      for (std::size_t i = 0; i < p.size(); ++i) {
+        std::size_t j = i * lanes + k;
+        if (w[j] > 0) {
+          double dx = (intensity * p[i] + b[j]) - xb;
+          double dy = d[j] - yb;
+          sdxdy += dx * dy;
+          sdx2 += dx * dx;
+          sdy2 += dy * dy;
+        }
+      }
+
+      // Compute the correlation
+      double result = 0.0;
+      if (sdx2 > 0.0 && sdy2 > 0.0) {
+        result = sdxdy / (std::sqrt(sdx2) * std::sqrt(sdy2));
+      }
+      return result;
+    }
+
+    af::shared<double> intensity_;
+    af::shared<double> variance_;
+    af::shared<double> correlation_;
+    af::shared<std::size_t> niter_;
+    af::shared<double> error_;
+    af::shared<bool> success_;
+    std::size_t maxiter_;
+  };
+
+  template <typename T>
+  const std::size_t BatchProfileFitter<T>::lanes;
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_INTEGRATION_FIT_FITTING_H */
@@ -2,13 +2,17 @@
 import platform
 from time import time
 
+from dxtbx.imageset import ImageSequence
+
 import dials.algorithms.integration
 from dials.algorithms.integration.processor import job
+from dials.array_family import flex
 from dials.model.data import ImageVolume, MultiPanelImageVolume, make_image
 from dials.util import log
 from dials.util.log import rehandle_cached_records
 from dials.util.mp import multi_node_parallel_map
 from dials_algorithms_integration_integrator_ext import ReflectionManagerPerImage
+from dials_algorithms_integration_parallel_integrator_ext import ImageVolumeReader
 
 logger = logging.getLogger(__name__)
 
@@ -170,40 +174,78 @@ def __call__(self):
         except Exception:
             frame0, frame1 = (0, len(imageset))
 
+        # Only hold as many frames as the largest bbox z-extent. If that is less
+        # than the number of frames, the volume is a circular buffer and the
+        # executor is called after each frame is added
+        window = frame1 - frame0
+        if len(self.reflections) > 0:
+            x0, x1, y0, y1, z0, z1 = self.reflections["bbox"].parts()
+            window = min(window, flex.max(z1 - z0))
+        windowed = window < frame1 - frame0
+
         # Initialise the dataset
         image_volume = MultiPanelImageVolume()
         for panel in self.experiments[0].detector:
-            image_volume.add(
-                ImageVolume(
-                    frame0, frame1, panel.get_image_size()[1], panel.get_image_size()[0]
-                )
-            )
-
-        # Read all the images into a block of data
+            height, width = panel.get_image_size()[1], panel.get_image_size()[0]
+            if windowed:
+                image_volume.add(ImageVolume(frame0, frame1, height, width, window))
+            else:
+                image_volume.add(ImageVolume(frame0, frame1, height, width))
+
+        # Read the images into a block of data. For a sequence the images are
+        # read ahead on a background thread and masked and copied into the
+        # volume without going through python
         read_time = 0.0
+        process_time = 0.0
+        data = None
+        lookup_mask = self.params.integration.lookup.mask
+        reader = None
+        if isinstance(imageset, ImageSequence):
+            reader = ImageVolumeReader(
+                imageset,
+                frame0,
+                lookup_mask=lookup_mask,
+                prefetch=self.params.integration.mp.prefetch,
+            )
         for i in range(len(imageset)):
             st = time()
-            image = imageset.get_corrected_data(i)
-            mask = imageset.get_mask(i)
-            if self.params.integration.lookup.mask is not None:
-                assert len(mask) == len(
-                    self.params.lookup.mask
-                ), "Mask/Image are incorrect size %d %d" % (
-                    len(mask),
-                    len(self.params.integration.lookup.mask),
-                )
-                mask = tuple(
-                    m1 & m2 for m1, m2 in zip(self.params.integration.lookup.mask, mask)
-                )
-            image_volume.set_image(frame0 + i, make_image(image, mask))
+            if reader is not None:
+                reader.next(image_volume)
+            else:
+                image = imageset.get_corrected_data(i)
+                mask = imageset.get_mask(i)
+                if lookup_mask is not None:
+                    assert len(mask) == len(
+                        lookup_mask
+                    ), "Mask/Image are incorrect size %d %d" % (
+                        len(mask),
+                        len(lookup_mask),
+                    )
+                    mask = tuple(m1 & m2 for m1, m2 in zip(lookup_mask, mask))
+                image_volume.set_image(frame0 + i, make_image(image, mask))
+                del image
+                del mask
             read_time += time() - st
-            del image
-            del mask
+
+            # Process the frame, finalising the reflections which end on it
+            if windowed:
+                st = time()
+                result = self.executor.process(
+                    image_volume, self.experiments, self.reflections
+                )
+                if data is None:
+                    data = result
+                else:
+                    data += result
+                process_time += time() - st
 
         # Process the data
-        st = time()
-        data = self.executor.process(image_volume, self.experiments, self.reflections)
-        process_time = time() - st
+        if not windowed:
+            st = time()
+            data = self.executor.process(
+                image_volume, self.experiments, self.reflections
+            )
+            process_time = time() - st
 
         # Set the result values
         return dials.algorithms.integration.Result(
@@ -261,7 +303,11 @@ def initialize(self):
 
         # Create the reflection manager
         frames = self.experiments[0].scan.get_array_range()
-        self.manager = ReflectionManagerPerImage(frames, self.reflections)
+        self.manager = ReflectionManagerPerImage(
+            frames,
+            self.reflections,
+            block_size=self.params.integration.mp.images_per_task,
+        )
 
         # Set the initialization time
         self.time.initialize = time() - start_time
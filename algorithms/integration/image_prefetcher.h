@@ -0,0 +1,263 @@
+/*
+ * image_prefetcher.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
+#define DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
+
+#include <deque>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/python.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dxtbx/imageset.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dxtbx::ImageSequence;
+  using dxtbx::format::Image;
+
+  /**
+   * Release the GIL for the lifetime of the object, if it is held
+   */
+  class ScopedReleaseGIL : public boost::noncopyable {
+  public:
+    ScopedReleaseGIL() : state_(NULL) {
+      if (Py_IsInitialized() && PyGILState_Check()) {
+        state_ = PyEval_SaveThread();
+      }
+    }
+
+    ~ScopedReleaseGIL() {
+      if (state_ != NULL) {
+        PyEval_RestoreThread(state_);
+      }
+    }
+
+  private:
+    PyThreadState *state_;
+  };
+
+  /**
+   * Acquire the GIL for the lifetime of the object
+   */
+  class ScopedAcquireGIL : public boost::noncopyable {
+  public:
+    ScopedAcquireGIL() : acquired_(Py_IsInitialized()) {
+      if (acquired_) {
+        state_ = PyGILState_Ensure();
+      }
+    }
+
+    ~ScopedAcquireGIL() {
+      if (acquired_) {
+        PyGILState_Release(state_);
+      }
+    }
+
+  private:
+    bool acquired_;
+    PyGILState_STATE state_;
+  };
+
+  /**
+   * Read the images of an imageset ahead of the integration. A background
+   * thread reads and decodes the next images into a queue of ready frames,
+   * so that reading the images overlaps with processing the previous ones.
+   * The frames are returned in order by next(). The reader needs the GIL,
+   * so the caller releases it whenever it waits for a frame, and the frames
+   * are only passed between the threads while holding it.
+   *
+   * With a depth of zero the images are read by the calling thread in next()
+   * as before.
+   */
+  class ImagePrefetcher : public boost::noncopyable {
+  public:
+    /**
+     * A single frame of image data
+     */
+    struct Frame {
+      Image<double> data;
+      Image<bool> mask;
+      bool rejected;
+      bool has_mask;
+
+      Frame() : rejected(false), has_mask(false) {}
+    };
+
+    /**
+     * Start reading the images
+     * @param imageset The imageset
+     * @param use_dynamic_mask Read the dynamic mask
+     * @param depth The maximum number of frames to read ahead
+     * @param full_mask Read the full mask of each image rather than the
+     *                  dynamic mask, and do not check for rejected images
+     */
+    ImagePrefetcher(ImageSequence imageset,
+                    bool use_dynamic_mask,
+                    std::size_t depth,
+                    bool full_mask = false)
+        : imageset_(imageset),
+          use_dynamic_mask_(use_dynamic_mask),
+          full_mask_(full_mask),
+          depth_(depth),
+          size_(imageset.size()),
+          next_(0),
+          has_error_(false),
+          stop_(false) {
+      if (depth_ > 0) {
+        thread_.reset(new boost::thread(&ImagePrefetcher::reader, this));
+      }
+    }
+
+    /**
+     * Stop the reader thread
+     */
+    ~ImagePrefetcher() {
+      if (thread_) {
+        {
+          boost::lock_guard<boost::mutex> lock(mutex_);
+          stop_ = true;
+        }
+        not_full_.notify_all();
+
+        // The reader may be waiting for the GIL
+        ScopedReleaseGIL release;
+        thread_->join();
+      }
+    }
+
+    /**
+     * @returns The number of frames
+     */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /**
+     * Get the next frame, waiting for it to be read if needed
+     * @returns The frame
+     */
+    Frame next() {
+      DIALS_ASSERT(next_ < size_);
+      if (!thread_) {
+        return read(next_++);
+      }
+
+      // Wait for the frame without holding the GIL
+      {
+        ScopedReleaseGIL release;
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (ready_.empty() && !has_error_) {
+          not_empty_.wait(lock);
+        }
+      }
+
+      // The image arrays may be shared with python objects so only take the
+      // frame while holding the GIL
+      Frame frame;
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (ready_.empty()) {
+          throw dials::error(error_);
+        }
+        frame = ready_.front();
+        ready_.pop_front();
+      }
+      not_full_.notify_one();
+      next_++;
+      return frame;
+    }
+
+  private:
+    /**
+     * Read a single frame from the imageset. The GIL must be held.
+     */
+    Frame read(std::size_t index) {
+      Frame frame;
+      frame.data = imageset_.get_corrected_data(index);
+      if (full_mask_) {
+        frame.mask = imageset_.get_mask(index);
+        frame.has_mask = true;
+      } else if (imageset_.is_marked_for_rejection(index)) {
+        frame.rejected = true;
+      } else if (use_dynamic_mask_) {
+        frame.mask = imageset_.get_dynamic_mask(index);
+        frame.has_mask = true;
+      }
+      return frame;
+    }
+
+    /**
+     * The reader thread. Read the frames in order, waiting while the queue
+     * of ready frames is full.
+     */
+    void reader() {
+      for (std::size_t i = 0; i < size_; ++i) {
+        {
+          boost::unique_lock<boost::mutex> lock(mutex_);
+          while (!stop_ && ready_.size() >= depth_) {
+            not_full_.wait(lock);
+          }
+          if (stop_) {
+            return;
+          }
+        }
+        try {
+          ScopedAcquireGIL acquire;
+          try {
+            Frame frame = read(i);
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            ready_.push_back(frame);
+          } catch (const boost::python::error_already_set &) {
+            PyErr_Clear();
+            throw dials::error("Error reading image");
+          }
+        } catch (const std::exception &e) {
+          set_error(e.what());
+          return;
+        } catch (...) {
+          set_error("Error reading image");
+          return;
+        }
+        not_empty_.notify_one();
+      }
+    }
+
+    /**
+     * Record an error and wake the caller
+     */
+    void set_error(const std::string &message) {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        has_error_ = true;
+        error_ = message;
+      }
+      not_empty_.notify_all();
+    }
+
+    ImageSequence imageset_;
+    bool use_dynamic_mask_;
+    bool full_mask_;
+    std::size_t depth_;
+    std::size_t size_;
+    std::size_t next_;
+    boost::scoped_ptr<boost::thread> thread_;
+    boost::mutex mutex_;
+    boost::condition_variable not_empty_;
+    boost::condition_variable not_full_;
+    std::deque<Frame> ready_;
+    std::string error_;
+    bool has_error_;
+    bool stop_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
@@ -0,0 +1,137 @@
+/*
+ * image_volume_reader.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_IMAGE_VOLUME_READER_H
+#define DIALS_ALGORITHMS_INTEGRATION_IMAGE_VOLUME_READER_H
+
+#include <boost/noncopyable.hpp>
+#include <dials/algorithms/integration/image_prefetcher.h>
+#include <dials/model/data/image.h>
+#include <dials/model/data/image_volume.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::MultiPanelImageVolume;
+
+  /**
+   * Read the images of an imageset into an image volume one frame at a
+   * time. The images are read ahead on a background thread into a bounded
+   * queue, and each frame is masked with its full image mask and an
+   * optional lookup mask and copied into the volume without holding the
+   * GIL, so copying a frame overlaps with reading the next one.
+   */
+  class ImageVolumeReader : public boost::noncopyable {
+  public:
+    typedef af::versa<bool, af::c_grid<2> > mask_type;
+
+    /**
+     * Start reading the images
+     * @param imageset The imageset
+     * @param frame0 The frame number of the first image
+     * @param lookup_mask The mask to apply to every image (empty for none)
+     * @param prefetch The maximum number of images to read ahead
+     */
+    ImageVolumeReader(ImageSequence imageset,
+                      int frame0,
+                      const af::const_ref<mask_type> &lookup_mask,
+                      std::size_t prefetch)
+        : prefetcher_(imageset, false, prefetch, true),
+          lookup_mask_(lookup_mask.begin(), lookup_mask.end()),
+          frame0_(frame0),
+          index_(0) {}
+
+    /** @returns The number of images */
+    std::size_t size() const {
+      return prefetcher_.size();
+    }
+
+    /** @returns The frame number of the next image */
+    int frame() const {
+      return frame0_ + (int)index_;
+    }
+
+    /** @returns Are there more images to read */
+    bool has_next() const {
+      return index_ < size();
+    }
+
+    /**
+     * Read the next image into the volume
+     * @param volume The image volume
+     * @returns The frame number of the image
+     */
+    int next(MultiPanelImageVolume<> &volume) {
+      DIALS_ASSERT(has_next());
+      ImagePrefetcher::Frame frame = prefetcher_.next();
+      std::size_t npanels = frame.data.n_tiles();
+      DIALS_ASSERT(frame.has_mask);
+      DIALS_ASSERT(frame.mask.n_tiles() == npanels);
+      DIALS_ASSERT(lookup_mask_.size() == 0 || lookup_mask_.size() == npanels);
+
+      // The image arrays may be shared with python objects, so only copy
+      // their handles while holding the GIL. The combined masks are new
+      // arrays which are filled in afterwards.
+      af::shared<af::versa<double, af::c_grid<2> > > data;
+      af::shared<mask_type> image_mask;
+      af::shared<mask_type> mask;
+      for (std::size_t i = 0; i < npanels; ++i) {
+        data.push_back(frame.data.tile(i).data());
+        image_mask.push_back(frame.mask.tile(i).data());
+        if (lookup_mask_.size() > 0) {
+          mask.push_back(mask_type(image_mask[i].accessor()));
+        } else {
+          mask.push_back(image_mask[i]);
+        }
+      }
+      dials::model::Image<double> image(data.const_ref(), mask.const_ref());
+
+      // Mask and copy the image without the GIL
+      int result = frame0_ + (int)index_;
+      {
+        ScopedReleaseGIL release;
+        if (lookup_mask_.size() > 0) {
+          for (std::size_t i = 0; i < npanels; ++i) {
+            combine_mask(image_mask[i].const_ref(),
+                         lookup_mask_[i].const_ref(),
+                         mask[i].ref());
+          }
+        }
+        volume.set_image(result, image);
+      }
+      index_++;
+      return result;
+    }
+
+  private:
+    /**
+     * Set the pixels which are set in both masks
+     * @param a The first mask
+     * @param b The second mask
+     * @param result The combined mask
+     */
+    static void combine_mask(const af::const_ref<bool, af::c_grid<2> > &a,
+                             const af::const_ref<bool, af::c_grid<2> > &b,
+                             af::ref<bool, af::c_grid<2> > result) {
+      DIALS_ASSERT(a.accessor().all_eq(b.accessor()));
+      DIALS_ASSERT(a.accessor().all_eq(result.accessor()));
+      for (std::size_t i = 0; i < a.size(); ++i) {
+        result[i] = a[i] && b[i];
+      }
+    }
+
+    ImagePrefetcher prefetcher_;
+    af::shared<mask_type> lookup_mask_;
+    int frame0_;
+    std::size_t index_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_IMAGE_VOLUME_READER_H
@@ -364,6 +364,53 @@ namespace dials { namespace algorithms {
     std::vector<int> frame0_;
   };
 
+  /**
+   * Find the job to process a reflection in. This is the job whose centre is
+   * closest to the centre of the reflection out of the jobs which contain the
+   * whole of the reflection's bounding box.
+   * @param jobs The job list
+   * @param lookup The job range lookup
+   * @param id The experiment id
+   * @param z0 The first frame of the bounding box
+   * @param z1 The last frame of the bounding box
+   * @returns The job index
+   */
+  inline std::size_t find_job(const JobList &jobs,
+                              const JobRangeLookup &lookup,
+                              std::size_t id,
+                              int z0,
+                              int z1) {
+    std::size_t j0 = lookup.first(id, z0);
+    std::size_t j1 = lookup.last(id, z1 - 1);
+    DIALS_ASSERT(j0 < jobs.size());
+    DIALS_ASSERT(j1 < jobs.size());
+    DIALS_ASSERT(j1 >= j0);
+    DIALS_ASSERT(z0 >= jobs[j0].frames()[0]);
+    DIALS_ASSERT(z1 <= jobs[j1].frames()[1]);
+    std::size_t jmin = 0;
+    double dmin = 0;
+    bool inside = false;
+    for (std::size_t j = j0; j <= j1; ++j) {
+      int jz0 = jobs[j].frames()[0];
+      int jz1 = jobs[j].frames()[1];
+      if (z0 >= jz0 && z1 <= jz1) {
+        double zc = (z1 + z0) / 2.0;
+        double jc = (jz1 + jz0) / 2.0;
+        double d = std::abs(zc - jc);
+        if (!inside || d < dmin) {
+          jmin = j;
+          dmin = d;
+          inside = true;
+        }
+      }
+    }
+    int jz0 = jobs[jmin].frames()[0];
+    int jz1 = jobs[jmin].frames()[1];
+    DIALS_ASSERT(inside == true);
+    DIALS_ASSERT(z0 >= jz0 && z1 <= jz1);
+    return jmin;
+  }
+
   /**
    * A class to managing reflection lookup indices
    */
@@ -397,35 +444,7 @@ namespace dials { namespace algorithms {
         int z1 = bbox[index][5];
         const std::size_t &f = flags[index];
         if (!(f & af::DontIntegrate)) {
-          std::size_t j0 = lookup.first(eid, z0);
-          std::size_t j1 = lookup.last(eid, z1 - 1);
-          DIALS_ASSERT(j0 < jobs_.size());
-          DIALS_ASSERT(j1 < jobs_.size());
-          DIALS_ASSERT(j1 >= j0);
-          DIALS_ASSERT(z0 >= jobs_[j0].frames()[0]);
-          DIALS_ASSERT(z1 <= jobs_[j1].frames()[1]);
-          std::size_t jmin = 0;
-          double dmin = 0;
-          bool inside = false;
-          for (std::size_t j = j0; j <= j1; ++j) {
-            int jz0 = jobs_[j].frames()[0];
-            int jz1 = jobs_[j].frames()[1];
-            if (z0 >= jz0 && z1 <= jz1) {
-              double zc = (z1 + z0) / 2.0;
-              double jc = (jz1 + jz0) / 2.0;
-              double d = std::abs(zc - jc);
-              if (!inside || d < dmin) {
-                jmin = j;
-                dmin = d;
-                inside = true;
-              }
-            }
-          }
-          int jz0 = jobs_[jmin].frames()[0];
-          int jz1 = jobs_[jmin].frames()[1];
-          DIALS_ASSERT(inside == true);
-          DIALS_ASSERT(z0 >= jz0 && z1 <= jz1);
-          indices[jmin].push_back(index);
+          indices[find_job(jobs_, lookup, eid, z0, z1)].push_back(index);
         }
       }
 
@@ -619,6 +638,159 @@ namespace dials { namespace algorithms {
     af::shared<bool> finished_;
   };
 
+  /**
+   * A class to collect the reflections for each job as they are predicted.
+   * Rather than splitting a complete reflection table, tables of reflections
+   * are added in frame order and each reflection goes into the bucket of the
+   * job it would be processed in. Once no more reflections can be added to a
+   * job its bucket can be taken and processed, and is then released, so only
+   * the reflections of the jobs around the current frame are held at once.
+   */
+  class ReflectionBuckets {
+  public:
+    /**
+     * Create the buckets
+     * @param jobs The job list
+     */
+    ReflectionBuckets(const JobList &jobs)
+        : jobs_(jobs),
+          lookup_(jobs),
+          buckets_(jobs.size()),
+          ready_(jobs.size(), false),
+          taken_(jobs.size(), false) {
+      DIALS_ASSERT(jobs.size() > 0);
+    }
+
+    /**
+     * @returns The number of jobs
+     */
+    std::size_t size() const {
+      return jobs_.size();
+    }
+
+    /**
+     * @returns The job
+     */
+    const JobList::Job &job(std::size_t index) const {
+      return jobs_[index];
+    }
+
+    /**
+     * @returns The number of reflections waiting in a job's bucket
+     */
+    std::size_t num_reflections(std::size_t index) const {
+      DIALS_ASSERT(index < buckets_.size());
+      return buckets_[index].size();
+    }
+
+    /**
+     * Add reflections to the buckets of the jobs they belong to. Reflections
+     * flagged as not to be integrated are kept aside.
+     * @param data The reflections
+     */
+    void add(af::reflection_table data) {
+      using namespace af::boost_python::flex_table_suite;
+      DIALS_ASSERT(data.is_consistent());
+      if (data.size() == 0) {
+        return;
+      }
+      DIALS_ASSERT(data.contains("id"));
+      DIALS_ASSERT(data.contains("flags"));
+      DIALS_ASSERT(data.contains("bbox"));
+      af::const_ref<int> id = data["id"];
+      af::const_ref<std::size_t> flags = data["flags"];
+      af::const_ref<int6> bbox = data["bbox"];
+
+      // Get which reflections go into which job
+      std::vector<std::vector<std::size_t> > indices(jobs_.size());
+      std::vector<std::size_t> unassigned;
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        DIALS_ASSERT(id[i] >= 0);
+        DIALS_ASSERT(bbox[i][1] > bbox[i][0]);
+        DIALS_ASSERT(bbox[i][3] > bbox[i][2]);
+        DIALS_ASSERT(bbox[i][5] > bbox[i][4]);
+        if (flags[i] & af::DontIntegrate) {
+          unassigned.push_back(i);
+        } else {
+          indices[find_job(jobs_, lookup_, id[i], bbox[i][4], bbox[i][5])].push_back(i);
+        }
+      }
+
+      // Add the reflections to the buckets. A job which has already been
+      // marked as ready can't take any more reflections.
+      for (std::size_t j = 0; j < indices.size(); ++j) {
+        if (indices[j].size() > 0) {
+          DIALS_ASSERT(!ready_[j]);
+          extend(buckets_[j],
+                 select_rows_index(
+                   data,
+                   af::const_ref<std::size_t>(&indices[j][0], indices[j].size())));
+        }
+      }
+      if (unassigned.size() > 0) {
+        extend(unassigned_,
+               select_rows_index(
+                 data, af::const_ref<std::size_t>(&unassigned[0], unassigned.size())));
+      }
+    }
+
+    /**
+     * Mark the jobs in a group as ready once all the reflections whose bounding
+     * boxes start before the given frame have been added.
+     * @param group The group index
+     * @param frame The frame
+     * @returns The jobs which have become ready
+     */
+    af::shared<std::size_t> ready(std::size_t group, int frame) {
+      DIALS_ASSERT(group < jobs_.groups().size());
+      af::shared<std::size_t> result;
+      for (std::size_t j = 0; j < jobs_.size(); ++j) {
+        if (!ready_[j] && jobs_[j].index() == group && jobs_[j].frames()[1] <= frame) {
+          ready_[j] = true;
+          result.push_back(j);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Take the reflections for a job which is ready and release the bucket.
+     * @param index The job index
+     * @returns The reflections for the job
+     */
+    af::reflection_table take(std::size_t index) {
+      DIALS_ASSERT(index < buckets_.size());
+      DIALS_ASSERT(ready_[index]);
+      DIALS_ASSERT(!taken_[index]);
+      af::reflection_table result = buckets_[index];
+      buckets_[index] = af::reflection_table();
+      taken_[index] = true;
+      return result;
+    }
+
+    /**
+     * @returns The reflections which are not to be integrated
+     */
+    af::reflection_table unassigned() const {
+      return unassigned_;
+    }
+
+    /**
+     * @returns Have all the jobs been taken
+     */
+    bool finished() const {
+      return taken_.all_eq(true);
+    }
+
+  private:
+    JobList jobs_;
+    JobRangeLookup lookup_;
+    std::vector<af::reflection_table> buckets_;
+    af::shared<bool> ready_;
+    af::shared<bool> taken_;
+    af::reflection_table unassigned_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_INTEGRATION_INTEGRATOR_H
@@ -6,11 +6,19 @@
 import random
 
 import dials.extensions
-from dials.algorithms.integration import TimingInfo, processor
+from dials.algorithms.integration import (
+    IntegrationPrefilter,
+    TimingInfo,
+    processor,
+    telemetry,
+)
+from dials.algorithms.integration.checkpoint import clear_checkpoints
 from dials.algorithms.integration.filtering import IceRingFilter
+from dials.algorithms.integration.multi_sweep import MultiSweepIntegrator
 from dials.algorithms.integration.parallel_integrator import (
     IntegratorProcessor,
     ReferenceCalculatorProcessor,
+    create_transform_cache,
 )
 from dials.algorithms.integration.processor import (
     Processor2D,
@@ -109,11 +117,27 @@ def generate_phil_scope():
                   "number of blocks may be set to 1. If force is True then the"
                   "block size is always calculated."
 
+        adaptive = False
+          .type = bool
+          .help = "Choose the size of each block from the frame extents of the"
+                  "reflections in that part of the sweep, so that 100*threshold %"
+                  "of the local reflections are fully contained in 1 block. The"
+                  "block size is used as the maximum size. Wider reflections are"
+                  "split into partials over the block boundaries."
+
         max_memory_usage = 0.90
           .type = float(value_min=0.0,value_max=1.0)
           .help = "The maximum percentage of available memory to use for"
                   "allocating shoebox arrays."
 
+        integer_buffer = False
+          .type = bool
+          .help = "Store the image data in the threaded integrator as 16 bit"
+                  "integer counts with a packed mask, which needs about half"
+                  "the memory. Only for detectors with integer counts and an"
+                  "overload value of at most 65536."
+          .expert_level = 2
+
       }
 
       use_dynamic_mask = True
@@ -173,6 +197,36 @@ def generate_phil_scope():
 
       }
 
+      checkpoint {
+
+        directory = None
+          .type = path
+          .help = "Save the results of each processing job to this directory as"
+                  "it finishes. If integration is interrupted, running it again"
+                  "with the same input and parameters skips the jobs which have"
+                  "already been saved."
+
+        keep = False
+          .type = bool
+          .help = "Keep the saved jobs once integration has finished"
+
+      }
+
+      telemetry {
+
+        json = None
+          .type = path
+          .help = "Write the telemetry from the threaded integrator, such as"
+                  "the time spent waiting for images and the time taken by each"
+                  "calculator, to this file as JSON"
+
+        prometheus = None
+          .type = path
+          .help = "Write the telemetry from the threaded integrator to this file"
+                  "in the Prometheus text format"
+
+      }
+
       integrator = *auto 3d flat3d 2d single2d stills 3d_threaded
         .type = choice
         .help = "The integrator to use."
@@ -221,14 +275,27 @@ def generate_phil_scope():
         ice_rings = False
           .help = "Set the ice ring flags"
           .type = bool
+
+        d_min = None
+          .help = "Do not integrate reflections at a higher resolution than"
+                  "this. The reflections are kept in the output but no"
+                  "shoeboxes are allocated for them."
+          .type = float(value_min=0.0)
+
+        d_max = None
+          .help = "Do not integrate reflections at a lower resolution than"
+                  "this."
+          .type = float(value_min=0.0)
       }
 
       include scope dials.algorithms.integration.overlaps_filter.phil_scope
 
       mp {
-        method = *multiprocessing drmaa sge lsf pbs
+        method = *multiprocessing drmaa sge lsf pbs mpi
           .type = choice
-          .help = "The multiprocessing method to use"
+          .help = "The multiprocessing method to use. For mpi, run the program"
+                  "under mpirun; rank 0 shares the processing blocks between"
+                  "the other ranks and collects the results."
 
         njobs = 1
           .type = int(value_min=1)
@@ -241,6 +308,56 @@ def generate_phil_scope():
         multiprocessing.n_subset_split = None
             .type = int(value_min=1)
             .help = "Number of subsets to split the reflection table for integration."
+
+        share_data = True
+          .type = bool
+          .help = "With the multiprocessing method, write the experiments,"
+                  "the executor and the reflections of each task to a shared"
+                  "memory-mapped store which the worker processes read"
+                  "from, rather than pickling them into every task."
+          .expert_level = 2
+
+        prefetch = 2
+          .type = int(value_min=0)
+          .help = "The number of images to read ahead on a background thread"
+                  "while integrating. If 0 the images are read on the main"
+                  "thread."
+          .expert_level = 2
+
+        images_per_task = 1
+          .type = int(value_min=1)
+          .help = "The number of consecutive images processed by each task of"
+                  "the image-wise processor. The images of a task are read"
+                  "into the image volume natively, reading ahead by prefetch"
+                  "images."
+          .expert_level = 2
+
+        batch_size = 1
+          .type = int(value_min=1)
+          .help = "The number of reflections finishing on the same image to"
+                  "process in each job of the threaded integrator. The"
+                  "reflections are ordered by position on the detector so each"
+                  "batch reads nearby pixels."
+          .expert_level = 2
+
+        numa_nodes = 0
+          .type = int(value_min=0)
+          .help = "The number of NUMA nodes to spread the image buffer and the"
+                  "threads of the threaded integrator over. The rows of each"
+                  "image are split into a band per node, first written by a"
+                  "thread on that node so the memory is local to it, and each"
+                  "reflection is processed by a thread on the node holding its"
+                  "pixels. If 0 the buffer and threads are not placed."
+          .expert_level = 2
+
+        concurrent_sweeps = 2
+          .type = int(value_min=1)
+          .help = "The number of imagesets the threaded integrator processes"
+                  "at once. The sweeps share one pool of nproc threads, so the"
+                  "threads left idle while one sweep starts or finishes are"
+                  "used by the others, and the memory budget is split evenly"
+                  "between them."
+          .expert_level = 2
       }
 
       summation {
@@ -347,8 +464,23 @@ class Filter:
 
         def __init__(self):
             self.min_zeta = 0.05
+            self.d_min = None
+            self.d_max = None
             self.powder_filter = None
 
+        @staticmethod
+        def from_phil(params):
+            """
+            Convert the phil parameters
+            """
+            result = Parameters.Filter()
+            result.min_zeta = params.min_zeta
+            result.d_min = params.d_min
+            result.d_max = params.d_max
+            if params.ice_rings is True:
+                result.powder_filter = IceRingFilter()
+            return result
+
     class Profile:
         """
         Profile parameters
@@ -390,6 +522,7 @@ def from_phil(params):
         mp.nproc = params.mp.nproc
         mp.njobs = params.mp.njobs
         mp.n_subset_split = params.mp.multiprocessing.n_subset_split
+        mp.share_data = params.mp.share_data
 
         # Set the lookup parameters
         lookup = processor.Lookup()
@@ -403,10 +536,16 @@ def from_phil(params):
         block.force = params.block.force
         block.max_memory_usage = params.block.max_memory_usage
 
+        # Set the checkpoint parameters
+        checkpoint = processor.Checkpoint()
+        checkpoint.directory = params.checkpoint.directory
+        checkpoint.keep = params.checkpoint.keep
+
         # Set the modelling processor parameters
         result.modelling.mp = mp
         result.modelling.lookup = lookup
         result.modelling.block = block
+        result.modelling.checkpoint = checkpoint
         if params.debug.during == "modelling":
             result.modelling.debug.output = params.debug.output
         result.modelling.debug.select = params.debug.select
@@ -416,6 +555,7 @@ def from_phil(params):
         result.integration.mp = mp
         result.integration.lookup = lookup
         result.integration.block = block
+        result.integration.checkpoint = checkpoint
         if params.debug.during == "integration":
             result.integration.debug.output = params.debug.output
         result.integration.debug.select = params.debug.select
@@ -432,10 +572,8 @@ def from_phil(params):
             params.profile.valid_foreground_threshold
         )
 
-        # Get the min zeta filter
-        result.filter.min_zeta = params.filter.min_zeta
-        if params.filter.ice_rings is True:
-            result.filter.powder_filter = IceRingFilter()
+        # Get the min zeta, resolution and powder ring filters
+        result.filter = Parameters.Filter.from_phil(params.filter)
 
         # Get post-integration overlap filtering parameters
         result.integration.overlaps_filter = params.overlaps_filter
@@ -453,6 +591,31 @@ def from_phil(params):
         return result
 
 
+def _prefilter(reflections, params, rotation):
+    """
+    Flag the reflections which are not to be integrated, and those in a powder
+    ring, in a single pass before any shoeboxes are allocated.
+
+    :param reflections: The reflections, with the zeta (for rotation data) and
+                        d columns
+    :param params: The filter parameters
+    :param rotation: Filter rotation data by zeta
+    :return: The number of reflections newly flagged as dont_integrate
+    """
+    prefilter = IntegrationPrefilter(
+        min_zeta=params.min_zeta if rotation else 0,
+        d_min=params.d_min or 0,
+        d_max=params.d_max or 0,
+    )
+    if params.powder_filter is not None:
+        for d_star_sq_min, d_star_sq_max in params.powder_filter.ranges():
+            prefilter.add_ring(d_star_sq_min, d_star_sq_max)
+    zeta = reflections["zeta"] if rotation else flex.double()
+    count = prefilter.apply(zeta, reflections["d"], reflections["flags"])
+    logger.debug("Flagged %d reflections as not to be integrated", count)
+    return count
+
+
 def _initialize_rotation(experiments, params, reflections):
     """
     A pre-processing class for oscillation data.
@@ -462,17 +625,13 @@ def _initialize_rotation(experiments, params, reflections):
     reflections.compute_zeta_multi(experiments)
     reflections.compute_d(experiments)
     reflections.compute_bbox(
-        experiments, sigma_b_multiplier=params.profile.sigma_b_multiplier
+        experiments,
+        sigma_b_multiplier=params.profile.sigma_b_multiplier,
+        nthreads=params.integration.mp.nproc,
     )
 
-    # Filter the reflections by zeta
-    mask = flex.abs(reflections["zeta"]) < params.filter.min_zeta
-    reflections.set_flags(mask, reflections.flags.dont_integrate)
-
-    # Filter the reflections by powder ring
-    if params.filter.powder_filter is not None:
-        mask = params.filter.powder_filter(reflections["d"])
-        reflections.set_flags(mask, reflections.flags.in_powder_ring)
+    # Filter the reflections by zeta, resolution and powder ring
+    _prefilter(reflections, params.filter, rotation=True)
 
 
 def _initialize_stills(experiments, params, reflections):
@@ -483,17 +642,17 @@ def _initialize_stills(experiments, params, reflections):
     # Compute some reflection properties
     reflections.compute_d(experiments)
     reflections.compute_bbox(
-        experiments, sigma_b_multiplier=params.profile.sigma_b_multiplier
+        experiments,
+        sigma_b_multiplier=params.profile.sigma_b_multiplier,
+        nthreads=params.integration.mp.nproc,
     )
 
     # Check the bounding boxes are all 1 frame in width
     z0, z1 = reflections["bbox"].parts()[4:6]
     assert (z1 - z0).all_eq(1), "bbox is invalid"
 
-    # Filter the reflections by powder ring
-    if params.filter.powder_filter is not None:
-        mask = params.filter.powder_filter(reflections["d"])
-        reflections.set_flags(mask, reflections.flags.in_powder_ring)
+    # Filter the reflections by resolution and powder ring
+    _prefilter(reflections, params.filter, rotation=False)
 
 
 def _finalize(reflections, experiments, params):
@@ -524,7 +683,7 @@ def _finalize_rotation(reflections, experiments, params):
     reflections, experiments = _finalize(reflections, experiments, params)
 
     # Compute the corrections
-    reflections.compute_corrections(experiments)
+    reflections.compute_corrections(experiments, nthreads=params.integration.mp.nproc)
     return reflections, experiments
 
 
@@ -1070,7 +1229,7 @@ def fit_profiles(self):
                         profile_fitter = pf
                     else:
                         profile_fitter.accumulate(pf)
-                profile_fitter.finalize()
+                profile_fitter.finalize(nthreads=self.params.integration.mp.nproc)
 
                 # Get the finalized modeller
                 finalized_profile_fitter = profile_fitter.finalized_model()
@@ -1318,6 +1477,11 @@ def _run_processor(reflections):
                     time_info += this_time_info
                 self.reflections = reflections
 
+        # The saved jobs are not needed once all the jobs have finished
+        checkpoint = self.params.integration.checkpoint
+        if checkpoint.directory and not checkpoint.keep:
+            clear_checkpoints(checkpoint.directory)
+
         # Finalize the reflections
         self.reflections, self.experiments = self.finalize_reflections(
             self.reflections, self.experiments, self.params
@@ -1455,18 +1619,13 @@ def initialise(self):
         self.reflections.compute_bbox(
             self.experiments,
             sigma_b_multiplier=self.params.integration.profile.sigma_b_multiplier,
+            nthreads=self.params.integration.mp.nproc,
         )
 
-        # Filter the reflections by zeta
-        mask = (
-            flex.abs(self.reflections["zeta"]) < self.params.integration.filter.min_zeta
-        )
-        self.reflections.set_flags(mask, self.reflections.flags.dont_integrate)
-
-        # Filter the reflections by powder ring
-        # if self.params.integration.filter.powder_filter is not None:
-        #   mask = self.params.integration.filter.powder_filter(self.reflections['d'])
-        #   self.reflections.set_flags(mask, self.reflections.flags.in_powder_ring)
+        # Filter the reflections by zeta, resolution and powder ring before
+        # the integrator allocates anything
+        filter_params = Parameters.Filter.from_phil(self.params.integration.filter)
+        _prefilter(self.reflections, filter_params, rotation=True)
 
     def finalise(self):
         """
@@ -1474,7 +1633,9 @@ def finalise(self):
         """
 
         # Compute the corrections
-        self.reflections.compute_corrections(self.experiments)
+        self.reflections.compute_corrections(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
     def integrate(self):
         """
@@ -1518,6 +1679,44 @@ def integrate(self):
         # Do the initialisation
         self.initialise()
 
+        if len(self.experiments.imagesets()) > 1:
+            self._integrate_sweeps()
+        else:
+            self._integrate_sweep()
+
+        # The saved jobs are not needed once all the jobs have finished
+        checkpoint = self.params.integration.checkpoint
+        if checkpoint.directory and not checkpoint.keep:
+            clear_checkpoints(checkpoint.directory)
+
+        # Write the telemetry
+        telemetry.write(
+            self.telemetry,
+            json_filename=self.params.integration.telemetry.json,
+            prometheus_filename=self.params.integration.telemetry.prometheus,
+        )
+
+        # Do the finalisation
+        self.finalise()
+
+        # Create the integration report
+        self.integration_report = IntegrationReport(self.experiments, self.reflections)
+        logger.info("")
+        logger.info(self.integration_report.as_str(prefix=" "))
+
+        # Print the time info
+        # logger.info("Timing information for integration")
+        # logger.info(str(time_info))
+        # logger.info("")
+
+        # Return the reflections
+        return self.reflections
+
+    def _integrate_sweep(self):
+        """
+        Compute the reference profiles and integrate the reflections of a
+        single imageset
+        """
         # Do profile modelling
         if self.params.integration.profile.fitting:
 
@@ -1526,17 +1725,24 @@ def integrate(self):
             logger.info(heading("Modelling reflection profiles"))
             logger.info("")
 
+            # Share the transformed shoeboxes with the integration pass
+            transform_cache = create_transform_cache(self.params)
+
             # Compute the reference profiles
             reference_calculator = ReferenceCalculatorProcessor(
                 experiments=self.experiments,
                 reflections=self.reflections,
                 params=self.params,
+                transform_cache=transform_cache,
             )
 
             # Get the reference profiles
             self.reference_profiles = reference_calculator.profiles()
+            modelling_telemetry = reference_calculator.telemetry()
         else:
             self.reference_profiles = None
+            transform_cache = None
+            modelling_telemetry = None
 
         logger.info("=" * 80)
         logger.info("")
@@ -1548,26 +1754,34 @@ def integrate(self):
             reflections=self.reflections,
             reference=self.reference_profiles,
             params=self.params,
+            transform_cache=transform_cache,
         )
 
         # Process the reflections
         self.reflections = integrator.reflections()
 
-        # Do the finalisation
-        self.finalise()
+        self.telemetry = {
+            "modelling": modelling_telemetry,
+            "integration": integrator.telemetry(),
+        }
 
-        # Create the integration report
-        self.integration_report = IntegrationReport(self.experiments, self.reflections)
+    def _integrate_sweeps(self):
+        """
+        Compute the reference profiles and integrate the reflections of several
+        imagesets at once
+        """
+        logger.info("=" * 80)
+        logger.info("")
+        logger.info(heading("Modelling and integrating reflections"))
         logger.info("")
-        logger.info(self.integration_report.as_str(prefix=" "))
-
-        # Print the time info
-        # logger.info("Timing information for integration")
-        # logger.info(str(time_info))
-        # logger.info("")
 
-        # Return the reflections
-        return self.reflections
+        integrator = MultiSweepIntegrator(
+            self.experiments, self.reflections, self.params
+        )
+        results = integrator.integrate()
+        self.reference_profiles = [r.reference for r in results]
+        self.reflections = integrator.reflections(results)
+        self.telemetry = integrator.telemetry(results)
 
     def report(self):
         """
@@ -12,7 +12,9 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_INTERFACES_H
 #define DIALS_ALGORITHMS_INTEGRATION_INTERFACES_H
 
+#include <vector>
 #include <dials/array_family/reflection.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
@@ -53,6 +55,36 @@ namespace dials { namespace algorithms {
     virtual void operator()(
       af::Reflection &reflection,
       const std::vector<af::Reflection> &adjacent_reflections) const = 0;
+
+    /**
+     * @returns True/False if the calculator gains from being given the
+     * reflections of a job together rather than one at a time
+     */
+    virtual bool batched() const {
+      return false;
+    }
+
+    /**
+     * Compute the intensities of a batch of reflections. By default each
+     * reflection is computed in turn.
+     * @param reflections The reflections
+     * @param adjacent_reflections The adjacent reflections of each reflection
+     * @returns True/False for each reflection if its intensity was computed
+     */
+    virtual std::vector<bool> batch(
+      std::vector<af::Reflection> &reflections,
+      const std::vector<std::vector<af::Reflection> > &adjacent_reflections) const {
+      DIALS_ASSERT(reflections.size() == adjacent_reflections.size());
+      std::vector<bool> success(reflections.size(), true);
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        try {
+          (*this)(reflections[i], adjacent_reflections[i]);
+        } catch (dials::error const &) {
+          success[i] = false;
+        }
+      }
+      return success;
+    }
   };
 
   // Implementation for pure virtual destructor
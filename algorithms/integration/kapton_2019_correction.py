@@ -188,7 +188,7 @@ def abs_correction(self, s1):
             )  # unitless, >=1
         return absorption_correction
 
-    def abs_correction_flex(self, s1_flex):
+    def abs_correction_flex(self, s1_flex, nthreads=1):
         """Compute the absorption correction using beers law. Takes in a flex array of s1 vectors, determines path lengths for each
         and then determines absorption correction for each s1 vector"""
         kapton_faces = self.faces
@@ -196,7 +196,7 @@ def abs_correction_flex(self, s1_flex):
 
         # new style, much faster
         # Note, the last two faces should never be hit by a photon so don't need to check them
-        kapton_path_mm = get_kapton_path_cpp(kapton_faces[:4], s1_flex)
+        kapton_path_mm = get_kapton_path_cpp(kapton_faces[:4], s1_flex, nthreads)
         # old style, really slow
         # for s1 in s1_flex:
         #  kapton_path_mm.append(self.get_kapton_path_mm(s1))
@@ -511,8 +511,11 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
 
             if variance_within_spot:
                 mask_code = MaskCode.Foreground | MaskCode.Valid
+                # Collect the s1 vectors of the foreground pixels of all the
+                # spots so that the corrections are computed in one call
+                s1_pixels = flex.vec3_double()
+                n_pixels = []
                 for iref in range(len(self.reflections_sele)):
-                    kapton_correction_vector = flex.double()
                     # foreground: integration mask
                     shoebox = self.reflections_sele[iref]["shoebox"]
                     foreground = (
@@ -527,10 +530,14 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
                             flex.vec2_double(f_absolute, s_absolute)
                         )
                     )
-                    s1 = lab_coords.each_normalize()
-                    # Real step right here
-                    kapton_correction_vector.extend(absorption.abs_correction_flex(s1))
-                    #
+                    s1_pixels.extend(lab_coords.each_normalize())
+                    n_pixels.append(len(lab_coords))
+                # Real step right here
+                kapton_corrections = absorption.abs_correction_flex(s1_pixels)
+                start = 0
+                for n in n_pixels:
+                    kapton_correction_vector = kapton_corrections[start : start + n]
+                    start += n
                     average_kapton_correction = flex.mean(kapton_correction_vector)
                     absorption_corrections.append(average_kapton_correction)
                     try:
@@ -27,18 +27,22 @@
 namespace dials { namespace algorithms {
 
   /**
-   * A class to managing reflection lookup indices
+   * A class to managing reflection lookup indices. The frames are split into
+   * blocks of block_size frames and each reflection is looked up in every
+   * block its bounding box touches.
    */
   class ReflectionLookup2 {
   public:
     ReflectionLookup2(const af::const_ref<int> &id,
                       const af::const_ref<int6> &bbox,
-                      const int2 &frames) {
+                      const int2 &frames,
+                      std::size_t block_size = 1) {
       DIALS_ASSERT(frames[1] > frames[0]);
+      DIALS_ASSERT(block_size > 0);
 
-      // Make a list of the frames
-      for (int i = frames[0]; i < frames[1]; ++i) {
-        frames_.push_back(int2(i, i + 1));
+      // Make a list of the blocks of frames
+      for (int i = frames[0]; i < frames[1]; i += block_size) {
+        frames_.push_back(int2(i, std::min(i + (int)block_size, frames[1])));
       }
 
       // Check all the reflection bboxes are valid
@@ -51,11 +55,12 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(bbox[i][5] <= frames[1]);
       }
 
-      // Count the number of reflections on each image
+      // Count the number of reflections in each block
       std::vector<int> count(frames_.size(), 0);
       for (std::size_t i = 0; i < bbox.size(); ++i) {
-        for (int j = bbox[i][4]; j < bbox[i][5]; ++j) {
-          int k = j - frames[0];
+        int k0 = (bbox[i][4] - frames[0]) / (int)block_size;
+        int k1 = (bbox[i][5] - 1 - frames[0]) / (int)block_size + 1;
+        for (int k = k0; k < k1; ++k) {
           DIALS_ASSERT(k >= 0);
           DIALS_ASSERT(k < count.size());
           count[k]++;
@@ -71,8 +76,9 @@ namespace dials { namespace algorithms {
       indices_.resize(offset_.back());
       count.assign(count.size(), 0);
       for (std::size_t i = 0; i < bbox.size(); ++i) {
-        for (int j = bbox[i][4]; j < bbox[i][5]; ++j) {
-          int k = j - frames[0];
+        int k0 = (bbox[i][4] - frames[0]) / (int)block_size;
+        int k1 = (bbox[i][5] - 1 - frames[0]) / (int)block_size + 1;
+        for (int k = k0; k < k1; ++k) {
           DIALS_ASSERT(k >= 0);
           DIALS_ASSERT(k < count.size());
           std::size_t l = offset_[k] + count[k]++;
@@ -123,10 +129,18 @@ namespace dials { namespace algorithms {
     af::shared<std::size_t> indices_;
   };
 
+  /**
+   * A class to manage the reflections for image-wise processing. Each task
+   * processes a block of block_size frames.
+   */
   class ReflectionManagerPerImage {
   public:
-    ReflectionManagerPerImage(int2 frames, af::reflection_table data)
-        : lookup_(init(frames, data)), data_(data), finished_(lookup_.size(), false) {
+    ReflectionManagerPerImage(int2 frames,
+                              af::reflection_table data,
+                              std::size_t block_size = 1)
+        : lookup_(init(frames, data, block_size)),
+          data_(data),
+          finished_(lookup_.size(), false) {
       DIALS_ASSERT(finished_.size() > 0);
     }
 
@@ -199,13 +213,15 @@ namespace dials { namespace algorithms {
     /**
      * Initialise the indexer
      */
-    ReflectionLookup2 init(int2 frames, af::reflection_table data) {
+    ReflectionLookup2 init(int2 frames,
+                           af::reflection_table data,
+                           std::size_t block_size) {
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.size() > 0);
       DIALS_ASSERT(data.contains("id"));
       DIALS_ASSERT(data.contains("bbox"));
       DIALS_ASSERT(frames[1] > frames[0]);
-      return ReflectionLookup2(data["id"], data["bbox"], frames);
+      return ReflectionLookup2(data["id"], data["bbox"], frames, block_size);
     }
 
     ReflectionLookup2 lookup_;
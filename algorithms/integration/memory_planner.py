@@ -0,0 +1,337 @@
+"""
+Plan the memory used by the threaded integrator and reference profiler.
+
+The image buffer is only the largest of the allocations made while
+integrating. Each job also holds its share of the reflection table, the
+overlap adjacency list and the shoeboxes being processed by its threads,
+and the main process holds the whole reflection table, the reference
+profiles and the transform cache. The planner estimates each of these from
+the reflection table and the experiment models before the jobs start, and
+then chooses the block size, number of threads and reflection batch size
+so that the total fits in the memory budget.
+"""
+
+import collections
+import logging
+import math
+
+import psutil
+
+from dials.array_family import flex
+from dials.util import tabulate
+
+# Need this import first because loads extension that parallel_integrator_ext
+# relies on - it assumes the binding for EmpiricalProfileModeller exists
+import dials.algorithms.profile_model.modeller  # noqa: F401 # isort: split
+
+from dials_algorithms_integration_parallel_integrator_ext import (
+    MultiThreadedIntegrator,
+)
+
+logger = logging.getLogger(__name__)
+
+# The bytes per element of the reflection table column types
+COLUMN_BYTES = {
+    "bool": 1,
+    "int": 4,
+    "size_t": 8,
+    "std_string": 32,
+    "double": 8,
+    "float": 4,
+    "int6": 24,
+    "miller_index": 12,
+    "vec2_double": 16,
+    "vec3_double": 24,
+    "vec3_int": 12,
+    "mat3_double": 72,
+}
+
+# The bytes of the columns added to each reflection by integration
+OUTPUT_BYTES_PER_REFLECTION = 240
+
+# The bytes per pixel of a shoebox: float data and background and int mask
+SHOEBOX_BYTES_PER_PIXEL = 12
+
+# The shoeboxes kept for reuse by each thread
+SHOEBOXES_CACHED_PER_THREAD = 4
+
+# The bytes of the adjacency list per reflection and per overlap
+ADJACENCY_BYTES_PER_VERTEX = 32
+ADJACENCY_BYTES_PER_EDGE = 48
+
+# The bytes per voxel of a reference profile: double data and bool mask
+PROFILE_BYTES_PER_VOXEL = 9
+
+# The number of reference profiles on each image for each grid method
+PROFILES_PER_SCAN_POINT = {
+    "single": 1,
+    "regular_grid": 9,
+    "circular_grid": 9,
+    "spherical_grid": 9,
+}
+
+MemoryPlan = collections.namedtuple(
+    "MemoryPlan",
+    ["block_size", "max_block_size", "nproc", "batch_size", "budget", "estimate"],
+)
+
+
+def column_bytes(reflections):
+    """
+    :param reflections: The reflection table
+    :returns: The bytes used by the columns of the table, excluding shoeboxes
+    """
+    nbytes = 0
+    for key in reflections.keys():
+        name = type(reflections[key]).__name__
+        if name == "shoebox":
+            continue
+        nbytes += COLUMN_BYTES.get(name, 8) * reflections.size()
+    return nbytes
+
+
+def reference_profile_bytes(experiments, params):
+    """
+    :param experiments: The experiments
+    :param params: The integration parameters
+    :returns: The bytes of the reference profiles of all the experiments
+    """
+    if not params.integration.profile.fitting:
+        return 0
+    if params.profile.algorithm != "gaussian_rs":
+        return 0
+    fitting = params.profile.gaussian_rs.fitting
+    voxels = (2 * fitting.grid_size + 1) ** 3
+    nbytes = 0
+    for experiment in experiments:
+        if experiment.scan is None or experiment.scan.is_still():
+            continue
+        phi0, phi1 = experiment.scan.get_oscillation_range(deg=True)
+        num_scan_points = max(1, int(math.ceil((phi1 - phi0) / fitting.scan_step)))
+        nprofiles = PROFILES_PER_SCAN_POINT.get(fitting.grid_method, 9)
+        nbytes += nprofiles * num_scan_points * voxels * PROFILE_BYTES_PER_VOXEL
+    return nbytes
+
+
+def transform_cache_bytes(params):
+    """
+    :param params: The integration parameters
+    :returns: The maximum bytes held by the transform cache
+    """
+    if params.profile.algorithm != "gaussian_rs":
+        return 0
+    fitting = params.profile.gaussian_rs.fitting
+    if not fitting.transform_cache.enable or params.integration.mp.njobs > 1:
+        return 0
+    return fitting.transform_cache.max_memory
+
+
+class MemoryPlanner:
+    """
+    Estimate the memory of integrating a set of reflections and choose the
+    processing parameters which fit the budget.
+    """
+
+    def __init__(self, experiments, reflections, params, reference_pass=False):
+        """
+        :param experiments: The experiments
+        :param reflections: The reflections, with bounding boxes
+        :param params: The integration parameters
+        :param reference_pass: Plan the pass forming the reference profiles
+        """
+        self.imageset = experiments[0].imageset
+        self.params = params
+        self.integer_buffer = params.integration.block.integer_buffer
+        self.njobs = params.integration.mp.njobs
+
+        self.num_reflections = len(reflections)
+        assert self.num_reflections > 0, "Zero reflections given"
+        x0, x1, y0, y1, z0, z1 = reflections["bbox"].parts()
+        xsize = (x1 - x0).as_double()
+        ysize = (y1 - y0).as_double()
+        zsize = (z1 - z0).as_double()
+        volume = xsize * ysize * zsize
+        self.max_shoebox = flex.max(volume)
+        self.mean_volume = flex.mean(volume)
+        self.mean_extent = (flex.mean(xsize), flex.mean(ysize), flex.mean(zsize))
+        self.bytes_per_reflection = column_bytes(reflections) / self.num_reflections
+        if not reference_pass:
+            self.bytes_per_reflection += OUTPUT_BYTES_PER_REFLECTION
+        self.save_shoeboxes = params.integration.debug.output
+
+        self.num_images = len(self.imageset)
+        self.num_pixels = sum(
+            p.get_image_size()[0] * p.get_image_size()[1]
+            for p in self.imageset.get_detector()
+        )
+
+        # Allocations held by the main process
+        self.table_bytes = 2 * self.bytes_per_reflection * self.num_reflections
+        self.profile_bytes = reference_profile_bytes(experiments, params)
+        self.cache_bytes = transform_cache_bytes(params)
+
+    def estimate(self, block_size, nproc, batch_size):
+        """
+        Estimate the allocations of integrating in blocks.
+
+        :param block_size: The number of images in a block
+        :param nproc: The number of threads of each job
+        :param batch_size: The number of reflections in each job of a thread
+        :returns: An ordered dictionary of the bytes of each allocation
+        """
+        block_size = min(block_size, self.num_images)
+
+        # The reflections recorded on a block, including those on its edges
+        fraction = min(1.0, (block_size + self.mean_extent[2]) / self.num_images)
+        num_block = self.num_reflections * fraction
+
+        # The expected number of overlaps of each reflection
+        block_volume = self.num_pixels * block_size
+        degree = num_block * 8 * self.mean_extent[0] * self.mean_extent[1]
+        degree *= self.mean_extent[2] / max(1, block_volume)
+
+        # All the shoeboxes of the block are kept if they are saved
+        in_flight = nproc * (batch_size + SHOEBOXES_CACHED_PER_THREAD)
+        shoeboxes = in_flight * self.max_shoebox * SHOEBOX_BYTES_PER_PIXEL
+        if self.save_shoeboxes:
+            shoeboxes += num_block * self.mean_volume * SHOEBOX_BYTES_PER_PIXEL
+
+        job = collections.OrderedDict()
+        job["image_buffer"] = MultiThreadedIntegrator.compute_required_memory(
+            self.imageset, block_size, integer_buffer=self.integer_buffer
+        )
+        job["job_reflections"] = 2 * num_block * self.bytes_per_reflection
+        job["overlaps"] = num_block * (
+            ADJACENCY_BYTES_PER_VERTEX + degree * ADJACENCY_BYTES_PER_EDGE
+        )
+        job["shoeboxes"] = shoeboxes
+        if self.njobs > 1:
+            job["job_reference_profiles"] = self.profile_bytes
+
+        result = collections.OrderedDict()
+        for key, value in job.items():
+            result[key] = int(math.ceil(value * self.njobs))
+        result["reflection_table"] = int(self.table_bytes)
+        result["reference_profiles"] = self.profile_bytes
+        result["transform_cache"] = self.cache_bytes
+        return result
+
+    def max_block_size(self, budget, nproc, batch_size):
+        """
+        :returns: The largest block size which fits the budget, or 0 if none
+        """
+        lo, hi = 0, self.num_images
+        while lo < hi:
+            mid = (lo + hi + 1) // 2
+            if sum(self.estimate(mid, nproc, batch_size).values()) <= budget:
+                lo = mid
+            else:
+                hi = mid - 1
+        return lo
+
+    def plan(self, block_size, budget=None):
+        """
+        Choose the processing parameters. The requested block size is kept if
+        it fits with the requested threads and batch size; otherwise reflections
+        are processed one at a time, and then the threads are halved until it
+        fits. If the block still doesn't fit even with one thread, the threads
+        are kept and the largest block size that fits is given.
+
+        :param block_size: The requested number of images in a block
+        :param budget: The budget in bytes, or None for the fraction of the
+                       available memory given by max_memory_usage
+        :returns: The plan
+        """
+        if budget is None:
+            budget = memory_budget(self.params)
+        nproc = self.params.integration.mp.nproc
+        batch_size = self.params.integration.mp.batch_size
+        candidates = [(nproc, batch_size)]
+        if batch_size > 1:
+            candidates.append((nproc, 1))
+        n = nproc
+        while n > 1:
+            n //= 2
+            candidates.append((n, 1))
+        for n, b in candidates:
+            max_block = self.max_block_size(budget, n, b)
+            if max_block >= min(block_size, self.num_images):
+                return MemoryPlan(
+                    block_size, max_block, n, b, budget, self.estimate(block_size, n, b)
+                )
+
+        max_block = self.max_block_size(budget, nproc, 1)
+        if max_block == 0:
+            raise RuntimeError(
+                "Not enough memory to integrate a block of one image:\n"
+                + format_plan(
+                    MemoryPlan(1, 0, 1, 1, budget, self.estimate(1, 1, 1))
+                )
+                + "\nTry storing the image data as integer counts with"
+                " integration.block.integer_buffer=True, or increase"
+                " integration.block.max_memory_usage"
+            )
+        return MemoryPlan(
+            max_block, max_block, nproc, 1, budget, self.estimate(max_block, nproc, 1)
+        )
+
+
+def plan_memory(
+    experiments, reflections, params, block_size, reference_pass=False, budget=None
+):
+    """
+    Plan the memory of the threaded integrator or reference profiler, log the
+    plan and set the number of threads and batch size of the parameters to
+    those chosen.
+
+    :param experiments: The experiments
+    :param reflections: The reflections, with bounding boxes
+    :param params: The integration parameters
+    :param block_size: The requested block size in images
+    :param reference_pass: Plan the pass forming the reference profiles
+    :param budget: The budget in bytes, or None for the fraction of the
+                   available memory given by max_memory_usage
+    :returns: The plan
+    """
+    planner = MemoryPlanner(experiments, reflections, params, reference_pass)
+    plan = planner.plan(block_size, budget=budget)
+    logger.info(format_plan(plan))
+    mp = params.integration.mp
+    if (mp.nproc, mp.batch_size) != (plan.nproc, plan.batch_size):
+        logger.warning(
+            "Using %d threads and batches of %d reflections to fit in memory",
+            plan.nproc,
+            plan.batch_size,
+        )
+        mp.nproc = plan.nproc
+        mp.batch_size = plan.batch_size
+    return plan
+
+
+def memory_budget(params):
+    """
+    :param params: The integration parameters
+    :returns: The bytes of available memory which may be used
+    """
+    max_memory_usage = params.integration.block.max_memory_usage
+    assert max_memory_usage > 0.0, "maximum memory usage must be > 0"
+    assert max_memory_usage <= 1.0, "maximum memory usage must be <= 1"
+    return int(math.floor(psutil.virtual_memory().available * max_memory_usage))
+
+
+def format_plan(plan):
+    """
+    :param plan: The memory plan
+    :returns: A table of the estimated allocations and the chosen parameters
+    """
+    rows = [("Allocation", "Memory (MB)")]
+    for key, value in plan.estimate.items():
+        rows.append((key.replace("_", " "), f"{value / 1e6:.1f}"))
+    rows.append(("total", f"{sum(plan.estimate.values()) / 1e6:.1f}"))
+    rows.append(("budget", f"{plan.budget / 1e6:.1f}"))
+    return (
+        f"Memory plan: block size {plan.block_size} images "
+        f"(maximum {plan.max_block_size}), {plan.nproc} threads, "
+        f"batches of {plan.batch_size} reflections\n"
+        + tabulate(rows, headers="firstrow")
+    )
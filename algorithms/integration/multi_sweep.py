@@ -0,0 +1,201 @@
+"""
+Integrate several sweeps at once with the threaded integrator.
+
+The threaded integrator and reference profiler each process the reflections
+of a single imageset. With several imagesets, as from inverse beam or
+multi-crystal collections, each sweep is split off with its own experiments
+and reflections and up to integration.mp.concurrent_sweeps of them are
+processed at once, each on its own python thread. The jobs of all the sweeps
+are posted to a single work stealing pool of integration.mp.nproc threads, so
+the threads left idle while one sweep reads its first images or waits for its
+last jobs take jobs from the others, and the memory budget is measured once
+and split evenly between the sweeps running at the same time.
+"""
+
+import collections
+import concurrent.futures
+import copy
+import logging
+
+from dxtbx.model import ExperimentList
+
+from dials.algorithms.integration import telemetry
+from dials.algorithms.integration.memory_planner import memory_budget
+from dials.algorithms.integration.parallel_integrator import (
+    IntegratorProcessor,
+    ReferenceCalculatorProcessor,
+    WorkStealingThreadPool,
+    _runs_in_process,
+    create_transform_cache,
+)
+from dials.array_family import flex
+
+logger = logging.getLogger(__name__)
+
+Sweep = collections.namedtuple("Sweep", ["experiments", "reflections", "expt_ids"])
+
+SweepResult = collections.namedtuple(
+    "SweepResult",
+    ["reflections", "reference", "modelling_telemetry", "integration_telemetry"],
+)
+
+
+def _set_identifiers(reflections, experiments, expt_ids):
+    """
+    Replace the experiment identifiers of a table with those of the experiments
+    given by each id.
+    """
+    identifiers = reflections.experiment_identifiers()
+    for key in list(identifiers.keys()):
+        del identifiers[key]
+    for i, expt_id in enumerate(expt_ids):
+        if experiments[expt_id].identifier:
+            identifiers[i] = experiments[expt_id].identifier
+
+
+def split_sweeps(experiments, reflections):
+    """
+    Split the experiments and reflections by imageset.
+
+    :param experiments: The experiments
+    :param reflections: The reflections
+    :returns: A list of sweeps, with the experiment ids of the reflections of
+              each numbered from zero and the original ids in expt_ids
+    """
+    sweeps = []
+    for imageset in experiments.imagesets():
+        expt_ids = [i for i, e in enumerate(experiments) if e.imageset == imageset]
+        selection = flex.bool(len(reflections), False)
+        new_id = flex.int(len(reflections), -1)
+        for i, expt_id in enumerate(expt_ids):
+            mask = reflections["id"] == expt_id
+            selection |= mask
+            new_id.set_selected(mask, i)
+        subset = reflections.select(selection)
+        subset["id"] = new_id.select(selection)
+        _set_identifiers(subset, experiments, expt_ids)
+        sweep_experiments = ExperimentList([experiments[i] for i in expt_ids])
+        sweeps.append(Sweep(sweep_experiments, subset, expt_ids))
+    return sweeps
+
+
+def merge_sweeps(experiments, sweeps, results):
+    """
+    Merge the reflections of the sweeps, restoring the original experiment ids.
+
+    :param experiments: The experiments of all the sweeps
+    :param sweeps: The sweeps, as from split_sweeps
+    :param results: The reflections of each sweep
+    :returns: The reflections of all the sweeps
+    """
+    merged = flex.reflection_table()
+    for sweep, reflections in zip(sweeps, results):
+        old_id = reflections["id"]
+        new_id = flex.int(len(reflections), -1)
+        for i, expt_id in enumerate(sweep.expt_ids):
+            new_id.set_selected(old_id == i, expt_id)
+        reflections["id"] = new_id
+        _set_identifiers(reflections, experiments, [])
+        merged.extend(reflections)
+    _set_identifiers(merged, experiments, list(range(len(experiments))))
+    return merged
+
+
+class MultiSweepIntegrator:
+    """
+    Integrate the sweeps of several imagesets at once on a shared thread pool.
+    """
+
+    def __init__(self, experiments, reflections, params):
+        """
+        :param experiments: The experiments
+        :param reflections: The reflections to integrate
+        :param params: The integration parameters
+        """
+        self.experiments = experiments
+        self.sweeps = split_sweeps(experiments, reflections)
+        self.params = params
+
+    def integrate(self):
+        """
+        Integrate all the sweeps.
+
+        :returns: A list with the result of each sweep
+        """
+        mp = self.params.integration.mp
+        if _runs_in_process(self.params):
+            max_concurrent = min(mp.concurrent_sweeps, len(self.sweeps))
+            pool = WorkStealingThreadPool(mp.nproc, numa_nodes=mp.numa_nodes)
+            budget = memory_budget(self.params) // max_concurrent
+        else:
+            # Jobs run in other processes can't share the pool
+            max_concurrent = 1
+            pool = None
+            budget = None
+        logger.info(
+            "Integrating %d sweeps, %d at a time", len(self.sweeps), max_concurrent
+        )
+        with concurrent.futures.ThreadPoolExecutor(max_concurrent) as executor:
+            futures = [
+                executor.submit(self._integrate_sweep, sweep, pool, budget)
+                for sweep in self.sweeps
+            ]
+            return [future.result() for future in futures]
+
+    def _integrate_sweep(self, sweep, pool, budget):
+        """
+        Compute the reference profiles of a sweep and integrate it.
+        """
+        # The processors change the block parameters to fit the sweep
+        params = copy.deepcopy(self.params)
+        if params.integration.profile.fitting:
+            transform_cache = create_transform_cache(params)
+            reference_calculator = ReferenceCalculatorProcessor(
+                experiments=sweep.experiments,
+                reflections=sweep.reflections,
+                params=params,
+                transform_cache=transform_cache,
+                pool=pool,
+                memory_budget=budget,
+            )
+            reference = reference_calculator.profiles()
+            modelling_telemetry = reference_calculator.telemetry()
+        else:
+            transform_cache = None
+            reference = None
+            modelling_telemetry = None
+        integrator = IntegratorProcessor(
+            experiments=sweep.experiments,
+            reflections=sweep.reflections,
+            reference=reference,
+            params=params,
+            transform_cache=transform_cache,
+            pool=pool,
+            memory_budget=budget,
+        )
+        return SweepResult(
+            integrator.reflections(),
+            reference,
+            modelling_telemetry,
+            integrator.telemetry(),
+        )
+
+    def reflections(self, results):
+        """
+        :param results: The results of integrate
+        :returns: The reflections of all the sweeps
+        """
+        return merge_sweeps(
+            self.experiments, self.sweeps, [r.reflections for r in results]
+        )
+
+    @staticmethod
+    def telemetry(results):
+        """
+        :param results: The results of integrate
+        :returns: The merged modelling and integration telemetry
+        """
+        return {
+            "modelling": telemetry.merge([r.modelling_telemetry for r in results]),
+            "integration": telemetry.merge([r.integration_telemetry for r in results]),
+        }
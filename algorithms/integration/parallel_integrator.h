@@ -21,11 +21,17 @@
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/error.h>
-#include <dials/util/thread_pool.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/algorithms/integration/image_prefetcher.h>
+#include <dials/algorithms/integration/shoebox_pool.h>
+#include <dials/algorithms/integration/telemetry.h>
 #include <dials/algorithms/shoebox/find_overlapping.h>
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/centroid/centroid.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <map>
 
 #include <dials/algorithms/integration/interfaces.h>
@@ -45,6 +51,8 @@ namespace dials { namespace algorithms {
   using dials::model::AdjacencyList;
   using dials::model::Shoebox;
 
+  using dials::util::WorkStealingThreadPool;
+
   /**
    * Class to wrap logging
    */
@@ -66,10 +74,18 @@ namespace dials { namespace algorithms {
 
   /**
    * A class to store the image data buffer
+   *
+   * The buffer either holds the image data as floating point values, with
+   * masked pixels set to the mask value, or, in integer mode, holds the raw
+   * counts as 16 bit integers with the mask stored as a packed bit plane.
+   * Integer mode needs about half of the memory. It requires integer counts;
+   * negative counts or counts which do not fit in 16 bits are masked, so the
+   * overload value must not be greater than 65536.
    */
   class BufferBase {
   public:
     typedef Shoebox<>::float_type float_type;
+    typedef unsigned short count_type;
 
     /**
      * Initialise the the size of the panels
@@ -77,12 +93,18 @@ namespace dials { namespace algorithms {
      * @param num_images The number of images
      * @param mask_value The value of masked pixels in the buffer
      * @param external_mask The external mask
+     * @param integer_data Store the data as integer counts
+     * @param numa_nodes The number of NUMA nodes to spread the buffer over
      */
     BufferBase(const Detector &detector,
                std::size_t num_images,
                float_type mask_value,
-               const Image<bool> &external_mask)
-        : mask_value_(mask_value) {
+               const Image<bool> &external_mask,
+               bool integer_data = false,
+               std::size_t numa_nodes = 0)
+        : mask_value_(mask_value),
+          integer_data_(integer_data),
+          numa_nodes_(numa_nodes) {
       std::size_t zsize = num_images;
       DIALS_ASSERT(zsize > 0);
       for (std::size_t i = 0; i < detector.size(); ++i) {
@@ -91,9 +113,24 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(xsize > 0);
         DIALS_ASSERT(ysize > 0);
 
-        // Allocate all the data buffers
-        data_.push_back(
-          af::versa<float_type, af::c_grid<3> >(af::c_grid<3>(zsize, ysize, xsize)));
+        // Allocate all the data buffers. If the buffer is spread over the
+        // NUMA nodes, the memory is left for the nodes to initialise.
+        af::c_grid<3> grid(zsize, ysize, xsize);
+        af::c_grid<2> valid_grid(zsize, (ysize * xsize + 7) / 8);
+        if (integer_data_ && numa_nodes_ > 0) {
+          counts_.push_back(af::versa<count_type, af::c_grid<3> >(
+            grid, af::init_functor_null<count_type>()));
+          valid_.push_back(af::versa<unsigned char, af::c_grid<2> >(
+            valid_grid, af::init_functor_null<unsigned char>()));
+        } else if (integer_data_) {
+          counts_.push_back(af::versa<count_type, af::c_grid<3> >(grid));
+          valid_.push_back(af::versa<unsigned char, af::c_grid<2> >(valid_grid));
+        } else if (numa_nodes_ > 0) {
+          data_.push_back(af::versa<float_type, af::c_grid<3> >(
+            grid, af::init_functor_null<float_type>()));
+        } else {
+          data_.push_back(af::versa<float_type, af::c_grid<3> >(grid));
+        }
 
         // Allocate the static mask buffer
         static_mask_.push_back(
@@ -108,6 +145,22 @@ namespace dials { namespace algorithms {
                                       static_mask_[i].ref());
         }
       }
+
+      // Each node initialises its band of rows of every image, so the pages
+      // are placed in the memory of that node
+      if (numa_nodes_ > 0) {
+        std::vector<std::vector<int> > node_cpus = dials::util::numa_node_cpus();
+        boost::thread_group threads;
+        for (std::size_t node = 0; node < numa_nodes_; ++node) {
+          std::vector<int> cpus;
+          if (!node_cpus.empty()) {
+            cpus = node_cpus[node % node_cpus.size()];
+          }
+          FirstTouch touch = {this, node, cpus};
+          threads.create_thread(touch);
+        }
+        threads.join_all();
+      }
     }
 
     /**
@@ -116,10 +169,14 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy(const Image<double> &data, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        if (integer_data_) {
+          copy_counts(data.tile(i).data().const_ref(), NULL, i, index);
+        } else {
+          copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
+          apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        }
       }
     }
 
@@ -129,12 +186,16 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy(const Image<double> &data, bool mask, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       if (mask) {
         copy(data, index);
       } else {
         for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-          apply_mask_to_all_pixels(data_[i].ref(), index);
+          if (integer_data_) {
+            mask_all_counts(i, index);
+          } else {
+            apply_mask_to_all_pixels(data_[i].ref(), index);
+          }
         }
       }
     }
@@ -147,23 +208,57 @@ namespace dials { namespace algorithms {
      */
     void copy(const Image<double> &data, const Image<bool> &mask, std::size_t index) {
       DIALS_ASSERT(data.n_tiles() == mask.n_tiles());
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+      DIALS_ASSERT(data.n_tiles() == static_mask_.size());
       for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(mask.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        if (integer_data_) {
+          af::const_ref<bool, af::c_grid<2> > dynamic_mask =
+            mask.tile(i).data().const_ref();
+          copy_counts(data.tile(i).data().const_ref(), &dynamic_mask, i, index);
+        } else {
+          copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
+          apply_mask(mask.tile(i).data().const_ref(), data_[i].ref(), index);
+          apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+        }
       }
     }
 
+    /**
+     * @returns Is the data stored as integer counts
+     */
+    bool integer_data() const {
+      return integer_data_;
+    }
+
     /**
      * @param The panel number
      * @returns The buffer for the panel
      */
     af::const_ref<float_type, af::c_grid<3> > data(std::size_t panel) const {
+      DIALS_ASSERT(!integer_data_);
       DIALS_ASSERT(panel < data_.size());
       return data_[panel].const_ref();
     }
 
+    /**
+     * @param The panel number
+     * @returns The integer count buffer for the panel
+     */
+    af::const_ref<count_type, af::c_grid<3> > counts(std::size_t panel) const {
+      DIALS_ASSERT(integer_data_);
+      DIALS_ASSERT(panel < counts_.size());
+      return counts_[panel].const_ref();
+    }
+
+    /**
+     * @param The panel number
+     * @returns The packed valid pixel bits for the panel
+     */
+    af::const_ref<unsigned char, af::c_grid<2> > valid(std::size_t panel) const {
+      DIALS_ASSERT(integer_data_);
+      DIALS_ASSERT(panel < valid_.size());
+      return valid_[panel].const_ref();
+    }
+
     /**
      * @param The panel number
      * @returns The buffer for the panel
@@ -173,7 +268,96 @@ namespace dials { namespace algorithms {
       return static_mask_[panel].const_ref();
     }
 
+    /**
+     * @returns The value of masked pixels
+     */
+    float_type mask_value() const {
+      return mask_value_;
+    }
+
+    /**
+     * @returns The number of NUMA nodes the buffer is spread over
+     */
+    std::size_t numa_nodes() const {
+      return numa_nodes_;
+    }
+
+    /**
+     * Get the node whose memory holds a row of a panel. The rows of each
+     * panel are split into a band per node.
+     * @param panel The panel number
+     * @param y The row
+     * @returns The node
+     */
+    std::size_t numa_node(std::size_t panel, int y) const {
+      DIALS_ASSERT(panel < static_mask_.size());
+      if (numa_nodes_ == 0 || y <= 0) {
+        return 0;
+      }
+      std::size_t ysize = static_mask_[panel].accessor()[0];
+      return std::min((y * numa_nodes_) / ysize, numa_nodes_ - 1);
+    }
+
+    /**
+     * @returns The number of bytes used per pixel for each image
+     * @param integer_data Is the data stored as integer counts
+     */
+    static double bytes_per_pixel(bool integer_data) {
+      return integer_data ? sizeof(count_type) + 1.0 / 8.0 : sizeof(float_type);
+    }
+
   protected:
+    /**
+     * Initialise the band of rows belonging to a NUMA node from a thread on
+     * that node
+     */
+    struct FirstTouch {
+      BufferBase *buffer;
+      std::size_t node;
+      std::vector<int> cpus;
+
+      void operator()() const {
+        dials::util::pin_to_cpus(cpus);
+        buffer->touch(node);
+      }
+    };
+
+    friend struct FirstTouch;
+
+    /**
+     * Zero the band of rows of each image belonging to a node. The bands
+     * split the pixels of each image exactly, so no two nodes write the same
+     * element.
+     * @param node The node
+     */
+    void touch(std::size_t node) {
+      for (std::size_t i = 0; i < static_mask_.size(); ++i) {
+        std::size_t ysize = static_mask_[i].accessor()[0];
+        std::size_t xsize = static_mask_[i].accessor()[1];
+        std::size_t first = ((node * ysize) / numa_nodes_) * xsize;
+        std::size_t last = (((node + 1) * ysize) / numa_nodes_) * xsize;
+        if (integer_data_) {
+          af::ref<count_type, af::c_grid<3> > counts = counts_[i].ref();
+          af::ref<unsigned char, af::c_grid<2> > valid = valid_[i].ref();
+          std::size_t nbytes = valid.accessor()[1];
+          std::size_t first_byte = first / 8;
+          std::size_t last_byte = node + 1 == numa_nodes_ ? nbytes : last / 8;
+          for (std::size_t z = 0; z < counts.accessor()[0]; ++z) {
+            count_type *frame = &counts[z * ysize * xsize];
+            std::fill(frame + first, frame + last, 0);
+            unsigned char *bits = &valid[z * nbytes];
+            std::fill(bits + first_byte, bits + last_byte, 0);
+          }
+        } else {
+          af::ref<float_type, af::c_grid<3> > data = data_[i].ref();
+          for (std::size_t z = 0; z < data.accessor()[0]; ++z) {
+            float_type *frame = &data[z * ysize * xsize];
+            std::fill(frame + first, frame + last, 0);
+          }
+        }
+      }
+    }
+
     /**
      * Copy the data from 1 panel
      * @param src The source
@@ -194,6 +378,57 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Copy the data from 1 panel as integer counts and set the valid bits
+     * from the static and dynamic masks
+     * @param src The source
+     * @param mask The dynamic mask or NULL
+     * @param panel The panel
+     * @param index The image index
+     */
+    void copy_counts(af::const_ref<double, af::c_grid<2> > src,
+                     const af::const_ref<bool, af::c_grid<2> > *mask,
+                     std::size_t panel,
+                     std::size_t index) {
+      af::const_ref<bool, af::c_grid<2> > static_mask = static_mask_[panel].const_ref();
+      af::ref<count_type, af::c_grid<3> > counts = counts_[panel].ref();
+      af::ref<unsigned char, af::c_grid<2> > valid = valid_[panel].ref();
+      std::size_t npixels = src.size();
+      std::size_t nbytes = valid.accessor()[1];
+      DIALS_ASSERT(index < counts.accessor()[0]);
+      DIALS_ASSERT(src.accessor().all_eq(static_mask.accessor()));
+      DIALS_ASSERT(mask == NULL || mask->accessor().all_eq(src.accessor()));
+      count_type *dst = &counts[index * npixels];
+      unsigned char *bits = &valid[index * nbytes];
+      std::fill(bits, bits + nbytes, 0);
+      for (std::size_t j = 0; j < npixels; ++j) {
+        double v = src[j];
+        bool ok = static_mask[j] && (mask == NULL || (*mask)[j]) && v >= 0
+                  && v <= std::numeric_limits<count_type>::max();
+        if (ok) {
+          if (v != std::floor(v)) {
+            DIALS_ERROR("Non integer pixel value in integer image buffer");
+          }
+          dst[j] = (count_type)v;
+          bits[j >> 3] |= (1 << (j & 7));
+        } else {
+          dst[j] = 0;
+        }
+      }
+    }
+
+    /**
+     * Mask all pixels in integer mode
+     * @param panel The panel
+     * @param index The image index
+     */
+    void mask_all_counts(std::size_t panel, std::size_t index) {
+      af::ref<unsigned char, af::c_grid<2> > valid = valid_[panel].ref();
+      std::size_t nbytes = valid.accessor()[1];
+      DIALS_ASSERT(index < valid.accessor()[0]);
+      std::fill(&valid[index * nbytes], &valid[index * nbytes] + nbytes, 0);
+    }
+
     /**
      * Mask all pixels
      * @param dst The destination
@@ -247,8 +482,12 @@ namespace dials { namespace algorithms {
     }
 
     std::vector<af::versa<float_type, af::c_grid<3> > > data_;
+    std::vector<af::versa<count_type, af::c_grid<3> > > counts_;
+    std::vector<af::versa<unsigned char, af::c_grid<2> > > valid_;
     std::vector<af::versa<bool, af::c_grid<2> > > static_mask_;
     float_type mask_value_;
+    bool integer_data_;
+    std::size_t numa_nodes_;
   };
 
   /**
@@ -264,13 +503,22 @@ namespace dials { namespace algorithms {
      * @param num_images The number of images
      * @param mask_value The value of masked pixels in the buffer
      * @param external_mask The external mask
+     * @param integer_data Store the data as integer counts
+     * @param numa_nodes The number of NUMA nodes to spread the buffer over
      */
     Buffer(const Detector &detector,
            std::size_t num_images,
            std::size_t num_buffer,
            float_type mask_value,
-           const Image<bool> &external_mask)
-        : buffer_base_(detector, num_buffer, mask_value, external_mask),
+           const Image<bool> &external_mask,
+           bool integer_data = false,
+           std::size_t numa_nodes = 0)
+        : buffer_base_(detector,
+                       num_buffer,
+                       mask_value,
+                       external_mask,
+                       integer_data,
+                       numa_nodes),
           num_images_(num_images),
           num_buffer_(num_buffer),
           buffer_range_(0, num_buffer) {
@@ -299,6 +547,22 @@ namespace dials { namespace algorithms {
       return buffer_range_;
     }
 
+    /**
+     * @returns The number of NUMA nodes the buffer is spread over
+     */
+    std::size_t numa_nodes() const {
+      return buffer_base_.numa_nodes();
+    }
+
+    /**
+     * @param panel The panel number
+     * @param bbox The bounding box of a reflection
+     * @returns The node whose memory holds the centre of the bounding box
+     */
+    std::size_t numa_node(std::size_t panel, const int6 &bbox) const {
+      return buffer_base_.numa_node(panel, (bbox[2] + bbox[3]) / 2);
+    }
+
     /**
      * Copy an image to the buffer
      * @param data The image data
@@ -383,6 +647,60 @@ namespace dials { namespace algorithms {
                                                        af::c_grid<2>(ysize, xsize));
     }
 
+    /**
+     * Extract a region of an image into shoebox arrays. Pixels outside the
+     * panel are set to zero and masked. Other pixels are marked as valid if
+     * they lie strictly between the underload and overload values.
+     * @param panel The panel number
+     * @param index The image index
+     * @param y0 The first row of the region
+     * @param x0 The first column of the region
+     * @param data The shoebox data for the image
+     * @param mask The shoebox mask for the image
+     * @param underload The underload value
+     * @param overload The overload value
+     */
+    void extract(std::size_t panel,
+                 std::size_t index,
+                 int y0,
+                 int x0,
+                 af::ref<float, af::c_grid<2> > data,
+                 af::ref<int, af::c_grid<2> > mask,
+                 double underload,
+                 double overload) const {
+      DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+      if (!buffer_base_.integer_data()) {
+        af::const_ref<float_type, af::c_grid<2> > data_buffer = this->data(panel, index);
+        extract_region(data_buffer.accessor(),
+                       y0,
+                       x0,
+                       data,
+                       mask,
+                       underload,
+                       overload,
+                       FloatPixel(data_buffer.begin()));
+      } else {
+        DIALS_ASSERT(index < num_images_);
+        DIALS_ASSERT(index >= buffer_range_[0]);
+        DIALS_ASSERT(index < buffer_range_[1]);
+        af::const_ref<BufferBase::count_type, af::c_grid<3> > counts =
+          buffer_base_.counts(panel);
+        af::const_ref<unsigned char, af::c_grid<2> > valid = buffer_base_.valid(panel);
+        af::c_grid<2> grid(counts.accessor()[1], counts.accessor()[2]);
+        std::size_t k = index % num_buffer_;
+        extract_region(grid,
+                       y0,
+                       x0,
+                       data,
+                       mask,
+                       underload,
+                       overload,
+                       CountPixel(&counts[k * grid.size_1d()],
+                                  &valid(k, 0),
+                                  buffer_base_.mask_value()));
+      }
+    }
+
     /**
      * @param The panel number
      * @returns The buffer for the panel
@@ -392,6 +710,67 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Read a pixel from the floating point buffer
+     */
+    struct FloatPixel {
+      const float_type *data;
+      FloatPixel(const float_type *data_) : data(data_) {}
+      double operator()(std::size_t j) const {
+        return data[j];
+      }
+    };
+
+    /**
+     * Read a pixel from the integer buffer, giving the mask value for pixels
+     * which are not valid
+     */
+    struct CountPixel {
+      const BufferBase::count_type *counts;
+      const unsigned char *valid;
+      double mask_value;
+      CountPixel(const BufferBase::count_type *counts_,
+                 const unsigned char *valid_,
+                 double mask_value_)
+          : counts(counts_), valid(valid_), mask_value(mask_value_) {}
+      double operator()(std::size_t j) const {
+        return (valid[j >> 3] & (1 << (j & 7))) ? (double)counts[j] : mask_value;
+      }
+    };
+
+    /**
+     * Extract the region using the given pixel accessor
+     */
+    template <typename Pixel>
+    static void extract_region(const af::c_grid<2> &grid,
+                               int y0,
+                               int x0,
+                               af::ref<float, af::c_grid<2> > data,
+                               af::ref<int, af::c_grid<2> > mask,
+                               double underload,
+                               double overload,
+                               Pixel pixel) {
+      std::size_t ysize = data.accessor()[0];
+      std::size_t xsize = data.accessor()[1];
+      int height = grid[0];
+      int width = grid[1];
+      for (std::size_t j = 0; j < ysize; ++j) {
+        for (std::size_t i = 0; i < xsize; ++i) {
+          int jj = y0 + j;
+          int ii = x0 + i;
+          if (jj >= 0 && ii >= 0 && jj < height && ii < width) {
+            double d = pixel(jj * width + ii);
+            int m = (d > underload && d < overload) ? Valid : 0;
+            data(j, i) = d;
+            mask(j, i) = m;
+          } else {
+            data(j, i) = 0;
+            mask(j, i) = 0;
+          }
+        }
+      }
+    }
+
     BufferBase buffer_base_;
     std::size_t num_images_;
     std::size_t num_buffer_;
@@ -412,6 +791,8 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
+     * @param debug Keep the shoeboxes
+     * @param telemetry Record the time taken by each stage (optional)
      */
     ReflectionIntegrator(const MaskCalculatorIface &compute_mask,
                          const BackgroundCalculatorIface &compute_background,
@@ -420,7 +801,8 @@ namespace dials { namespace algorithms {
                          int zstart,
                          double underload,
                          double overload,
-                         bool debug)
+                         bool debug,
+                         TelemetryRecorder *telemetry = NULL)
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_intensity_(compute_intensity),
@@ -428,7 +810,8 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          telemetry_(telemetry) {}
 
     /**
      * Integrate a reflection using the following procedure:
@@ -447,17 +830,157 @@ namespace dials { namespace algorithms {
      */
 
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
+                    af::ReflectionTableView &reflection_list,
                     const AdjacencyList &adjacency_list) const {
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
+      Shoebox<> shoebox;
+      double start_time = telemetry_ != NULL ? timestamp() : 0;
+      double stage_time = start_time;
+
+      // Compute everything up to the profile fitted intensity
+      if (!prepare(index,
+                   reflection_list,
+                   adjacency_list,
+                   reflection,
+                   adjacent_reflections,
+                   shoebox,
+                   start_time,
+                   stage_time)) {
+        return;
+      }
+
+      // Compute the profile fitted intensity
+      try {
+        compute_intensity_(reflection, adjacent_reflections);
+      } catch (dials::error const &) {
+        std::size_t flags = reflection.get<std::size_t>("flags");
+        flags |= af::FailedDuringProfileFitting;
+        reflection["flags"] = flags;
+      }
+      record(TelemetryRecorder::Intensity, stage_time);
+
+      // Erase the shoebox and set the reflection data
+      finish(
+        index, reflection_list, reflection, adjacent_reflections, shoebox, start_time);
+    }
+
+    /**
+     * Integrate a batch of reflections. Each reflection is processed as by
+     * the call operator, except that the profile fitted intensities of all the
+     * reflections are computed together by a single call to the intensity
+     * calculator, so the shoeboxes of the whole batch are held until then.
+     * @param indices The reflection indices
+     * @param reflection_list The view of the reflection table
+     * @param adjacency_list The adjacency list
+     */
+    void integrate_batch(const std::vector<std::size_t> &indices,
+                         af::ReflectionTableView &reflection_list,
+                         const AdjacencyList &adjacency_list) const {
+      std::vector<std::size_t> batch_indices;
+      std::vector<af::Reflection> reflections;
+      std::vector<std::vector<af::Reflection> > adjacent_reflections;
+      std::vector<Shoebox<> > shoeboxes;
+      std::vector<double> start_times;
+      batch_indices.reserve(indices.size());
+      reflections.reserve(indices.size());
+      adjacent_reflections.reserve(indices.size());
+      shoeboxes.reserve(indices.size());
+      start_times.reserve(indices.size());
+
+      // Compute everything up to the profile fitted intensity
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        af::Reflection reflection;
+        std::vector<af::Reflection> adjacent;
+        Shoebox<> shoebox;
+        double start_time = telemetry_ != NULL ? timestamp() : 0;
+        double stage_time = start_time;
+        if (prepare(indices[i],
+                    reflection_list,
+                    adjacency_list,
+                    reflection,
+                    adjacent,
+                    shoebox,
+                    start_time,
+                    stage_time)) {
+          batch_indices.push_back(indices[i]);
+          reflections.push_back(reflection);
+          adjacent_reflections.push_back(adjacent);
+          shoeboxes.push_back(shoebox);
+          start_times.push_back(start_time);
+        }
+      }
+      if (reflections.empty()) {
+        return;
+      }
+
+      // Compute the profile fitted intensities of the batch
+      double stage_time = telemetry_ != NULL ? timestamp() : 0;
+      std::vector<bool> success =
+        compute_intensity_.batch(reflections, adjacent_reflections);
+      DIALS_ASSERT(success.size() == reflections.size());
+      if (telemetry_ != NULL) {
+        double duration = (timestamp() - stage_time) / reflections.size();
+        for (std::size_t i = 0; i < reflections.size(); ++i) {
+          telemetry_->add(TelemetryRecorder::Intensity, duration);
+        }
+      }
+
+      // Erase the shoeboxes and set the reflection data
+      for (std::size_t i = 0; i < reflections.size(); ++i) {
+        if (!success[i]) {
+          std::size_t flags = reflections[i].get<std::size_t>("flags");
+          flags |= af::FailedDuringProfileFitting;
+          reflections[i]["flags"] = flags;
+        }
+        finish(batch_indices[i],
+               reflection_list,
+               reflections[i],
+               adjacent_reflections[i],
+               shoeboxes[i],
+               start_times[i]);
+      }
+    }
 
+    /**
+     * @returns True/False if the intensities should be computed in batches
+     */
+    bool batched() const {
+      return compute_intensity_.batched();
+    }
+
+  protected:
+    /**
+     * Extract the shoebox of a reflection and compute its mask, background,
+     * centroid and summed intensity. If the background fails the shoebox is
+     * released and the reflection is not integrated.
+     * @param index The reflection index
+     * @param reflection_list The view of the reflection table
+     * @param adjacency_list The adjacency list
+     * @param reflection The reflection data
+     * @param adjacent_reflections The adjacent reflections
+     * @param shoebox The shoebox of the reflection
+     * @param start_time The time processing the reflection started
+     * @param stage_time The start of the current stage
+     * @returns True/False if the profile fitted intensity should be computed
+     */
+    bool prepare(std::size_t index,
+                 af::ReflectionTableView &reflection_list,
+                 const AdjacencyList &adjacency_list,
+                 af::Reflection &reflection,
+                 std::vector<af::Reflection> &adjacent_reflections,
+                 Shoebox<> &shoebox,
+                 double &start_time,
+                 double &stage_time) const {
       // Get the reflection data
       get_reflection(
         index, reflection_list, adjacency_list, reflection, adjacent_reflections);
 
-      // Extract the shoebox data
+      // Extract the shoebox data. Keep a handle to the shoebox so its arrays
+      // can be recycled once the reflection has finished with them.
       extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
+      shoebox = reflection.get<Shoebox<> >("shoebox");
+      record(TelemetryRecorder::Extract, stage_time);
 
       // Compute the mask
       compute_mask_(reflection);
@@ -469,48 +992,76 @@ namespace dials { namespace algorithms {
         adjacent_reflections[i]["shoebox"] = reflection.get<Shoebox<> >("shoebox");
         compute_mask_(adjacent_reflections[i], true);
       }
+      record(TelemetryRecorder::Mask, stage_time);
 
       // Compute the background
       try {
         compute_background_(reflection);
       } catch (dials::error const &) {
         finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
-        return;
+        shoebox_pool_.release(shoebox);
+        record(TelemetryRecorder::Background, stage_time);
+        record(TelemetryRecorder::Reflection, start_time);
+        return false;
       }
+      record(TelemetryRecorder::Background, stage_time);
 
       // Compute the centroid
       compute_centroid(reflection);
 
       // Compute the summed intensity
       compute_summed_intensity(reflection);
+      return true;
+    }
 
-      // Compute the profile fitted intensity
-      try {
-        compute_intensity_(reflection, adjacent_reflections);
-      } catch (dials::error const &) {
-        std::size_t flags = reflection.get<std::size_t>("flags");
-        flags |= af::FailedDuringProfileFitting;
-        reflection["flags"] = flags;
-      }
-
+    /**
+     * Delete the shoebox of an integrated reflection, unless debug has been
+     * set, and write the reflection back to the table
+     * @param index The reflection index
+     * @param reflection_list The view of the reflection table
+     * @param reflection The reflection data
+     * @param adjacent_reflections The adjacent reflections
+     * @param shoebox The shoebox of the reflection
+     * @param start_time The time processing the reflection started
+     */
+    void finish(std::size_t index,
+                af::ReflectionTableView &reflection_list,
+                af::Reflection &reflection,
+                std::vector<af::Reflection> &adjacent_reflections,
+                Shoebox<> &shoebox,
+                double &start_time) const {
       // Erase the shoebox
       finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+      shoebox_pool_.release(shoebox);
 
       // Set the reflection data
       set_reflection(index, reflection_list, reflection);
+      record(TelemetryRecorder::Reflection, start_time);
+    }
+
+    /**
+     * Record the time taken by a stage, if recording telemetry
+     * @param stage The stage
+     * @param start_time The start of the stage, set to the current time
+     */
+    void record(TelemetryRecorder::Stage stage, double &start_time) const {
+      if (telemetry_ != NULL) {
+        double now = timestamp();
+        telemetry_->add(stage, now - start_time);
+        start_time = now;
+      }
     }
 
-  protected:
     /**
      * Get the reflection data in a thread safe manner
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param reflection_list The view of the reflection table
      * @param adjacency_list The adjacency list
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
+                        const af::ReflectionTableView &reflection_list,
                         const AdjacencyList &adjacency_list,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
@@ -520,30 +1071,31 @@ namespace dials { namespace algorithms {
       boost::lock_guard<boost::mutex> guard(mutex_);
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = reflection_list.get(index);
 
       // Get the adjacent reflections
       adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      AdjacencyList::vertex_iterator_range adjacent =
+        adjacency_list.adjacent_vertices(index);
+      for (AdjacencyList::vertex_iterator it = adjacent.first; it != adjacent.second;
+           ++it) {
+        DIALS_ASSERT(*it < reflection_list.size());
+        adjacent_reflections.push_back(reflection_list.get(*it));
       }
     }
 
     /**
      * Set the reflection data in a thread safe way
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param reflection_list The view of the reflection table
      * @param reflection The reflection data
      */
     void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
+                        af::ReflectionTableView &reflection_list,
                         const af::Reflection &reflection) const {
       DIALS_ASSERT(index < reflection_list.size());
       boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
+      reflection_list.set(index, reflection);
     }
 
     /**
@@ -662,11 +1214,9 @@ namespace dials { namespace algorithms {
                          int zstart,
                          double underload,
                          double overload) const {
-      typedef af::const_ref<Buffer::float_type, af::c_grid<2> > data_buffer_type;
       std::size_t panel = reflection.get<std::size_t>("panel");
       int6 bbox = reflection.get<int6>("bbox");
-      Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      Shoebox<> shoebox = shoebox_pool_.allocate(panel, bbox);
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -690,23 +1240,15 @@ namespace dials { namespace algorithms {
         if (kk < 0 || kk >= buffer.num_images()) {
           continue;
         }
-        data_buffer_type data_buffer = buffer.data(panel, kk);
-        for (std::size_t j = 0; j < ysize; ++j) {
-          for (std::size_t i = 0; i < xsize; ++i) {
-            int jj = y0 + j;
-            int ii = x0 + i;
-            if (jj >= 0 && ii >= 0 && jj < data_buffer.accessor()[0]
-                && ii < data_buffer.accessor()[1]) {
-              double d = data_buffer(jj, ii);
-              int m = (d > underload && d < overload) ? Valid : 0;
-              data(k, j, i) = d;
-              mask(k, j, i) = m;
-            } else {
-              data(k, j, i) = 0;
-              mask(k, j, i) = 0;
-            }
-          }
-        }
+        af::c_grid<2> grid(ysize, xsize);
+        buffer.extract(panel,
+                       kk,
+                       y0,
+                       x0,
+                       af::ref<float, af::c_grid<2> >(&data(k, 0, 0), grid),
+                       af::ref<int, af::c_grid<2> >(&mask(k, 0, 0), grid),
+                       underload,
+                       overload);
       }
       reflection["shoebox"] = shoebox;
     }
@@ -764,7 +1306,9 @@ namespace dials { namespace algorithms {
     double underload_;
     double overload_;
     bool debug_;
+    TelemetryRecorder *telemetry_;
     mutable boost::mutex mutex_;
+    mutable ShoeboxPool shoebox_pool_;
   };
 
   /**
@@ -780,6 +1324,68 @@ namespace dials { namespace algorithms {
      */
     Lookup(af::const_ref<int6> bbox, int zstart, std::size_t n)
         : indices_(bbox.size()) {
+      init(bbox, zstart, n);
+    }
+
+    /**
+     * Create the lookup and order the reflections finishing on each frame by
+     * panel and then by the Morton order of their bounding box centre, so
+     * that reflections which are processed one after the other are close
+     * together on the image.
+     * @param bbox the bounding box
+     * @param panel the panel number
+     * @param zstart the first frame number
+     * @param n the number of frames
+     */
+    Lookup(af::const_ref<int6> bbox,
+           af::const_ref<std::size_t> panel,
+           int zstart,
+           std::size_t n)
+        : indices_(bbox.size()) {
+      DIALS_ASSERT(panel.size() == bbox.size());
+      init(bbox, zstart, n);
+      sort_by_position comparator(bbox, panel);
+      for (std::size_t j = 0; j < n; ++j) {
+        std::sort(
+          indices_.begin() + offset_[j], indices_.begin() + offset_[j + 1], comparator);
+      }
+    }
+
+    /**
+     * @param z the frame number
+     * @returns the indices for a given frame
+     */
+    af::const_ref<std::size_t> indices(std::size_t z) const {
+      DIALS_ASSERT(z < offset_.size() - 1);
+      DIALS_ASSERT(offset_[z + 1] >= offset_[z]);
+      std::size_t i = offset_[z];
+      std::size_t n = offset_[z + 1] - i;
+      return af::const_ref<std::size_t>(&indices_[i], n);
+    }
+
+    /**
+     * Compute the Morton code of a position by interleaving the bits of the
+     * coordinates. Coordinates are clamped to 16 bits.
+     * @param x The x coordinate
+     * @param y The y coordinate
+     * @returns The Morton code
+     */
+    static unsigned int morton_code(int x, int y) {
+      unsigned int result = 0;
+      unsigned int ux = std::min(std::max(x, 0), 0xffff);
+      unsigned int uy = std::min(std::max(y, 0), 0xffff);
+      for (std::size_t b = 0; b < 16; ++b) {
+        result |= ((ux >> b) & 1) << (2 * b);
+        result |= ((uy >> b) & 1) << (2 * b + 1);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Sort the indices by frame and compute the offsets
+     */
+    void init(af::const_ref<int6> bbox, int zstart, std::size_t n) {
       // fill the index array
       for (std::size_t i = 0; i < indices_.size(); ++i) {
         indices_[i] = i;
@@ -803,19 +1409,6 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(offset_.back() == indices_.size());
     }
 
-    /**
-     * @param z the frame number
-     * @returns the indices for a given frame
-     */
-    af::const_ref<std::size_t> indices(std::size_t z) const {
-      DIALS_ASSERT(z < offset_.size() - 1);
-      DIALS_ASSERT(offset_[z + 1] >= offset_[z]);
-      std::size_t i = offset_[z];
-      std::size_t n = offset_[z + 1] - i;
-      return af::const_ref<std::size_t>(&indices_[i], n);
-    }
-
-  private:
     /**
      * helper function to sort by final bbox frame
      */
@@ -827,6 +1420,28 @@ namespace dials { namespace algorithms {
       }
     };
 
+    /**
+     * helper function to sort by panel and bbox centre
+     */
+    struct sort_by_position {
+      af::const_ref<int6> bbox_;
+      af::const_ref<std::size_t> panel_;
+      sort_by_position(af::const_ref<int6> bbox, af::const_ref<std::size_t> panel)
+          : bbox_(bbox), panel_(panel) {}
+      unsigned int code(std::size_t a) const {
+        return morton_code((bbox_[a][0] + bbox_[a][1]) / 2,
+                           (bbox_[a][2] + bbox_[a][3]) / 2);
+      }
+      bool operator()(std::size_t a, std::size_t b) const {
+        if (panel_[a] != panel_[b]) {
+          return panel_[a] < panel_[b];
+        }
+        unsigned int ca = code(a);
+        unsigned int cb = code(b);
+        return ca != cb ? ca < cb : a < b;
+      }
+    };
+
     std::vector<std::size_t> indices_;
     std::vector<std::size_t> offset_;
   };
@@ -844,13 +1459,17 @@ namespace dials { namespace algorithms {
      * Create the buffer manager
      * @param buffer The buffer to manage
      * @param bbox The bounding box
+     * @param panel The panel of each reflection
      * @param first_image The first image
      */
     BufferManager(Buffer &buffer,
                   const af::const_ref<int6> &bbox,
+                  const af::const_ref<std::size_t> &panel,
                   const af::const_ref<std::size_t> &flags,
                   int first_image)
         : buffer_(buffer),
+          bbox_(bbox),
+          panel_(panel),
           notifier_(bbox, flags, first_image, buffer.num_images(), buffer.num_buffer()),
           first_image_(first_image),
           max_images_(buffer.num_buffer()) {}
@@ -899,25 +1518,112 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Post the job to the pool
+     * Sleep until the buffer can accept the image, i.e. until all the jobs
+     * needing the oldest image in the buffer have finished
+     * @param pool The thread pool
+     * @param index The image index
+     */
+    template <typename ThreadPoolType>
+    void wait_until_ready(ThreadPoolType &pool, std::size_t index) {
+      if (index >= max_images_) {
+        pool.wait_until(boost::bind(
+          &Notifier::complete, boost::cref(notifier_), buffer_.buffer_range()[0]));
+      }
+    }
+
+    /**
+     * @param index The index of the last image copied to the buffer
+     * @returns The number of images in the buffer which are the first image
+     *   of a reflection which has not yet been processed
+     */
+    std::size_t occupancy(std::size_t index) const {
+      std::size_t first = buffer_.buffer_range()[0];
+      std::size_t count = 0;
+      for (std::size_t i = first; i <= index; ++i) {
+        if (!notifier_.complete(i)) {
+          count++;
+        }
+      }
+      return count;
+    }
+
+    /**
+     * Post the job for a reflection to the pool. If the buffer is spread over
+     * the NUMA nodes the job goes to the node holding the reflection's pixels.
      * @param pool The thread pool
      * @param function The function to post
-     * @param bbox_first_image The image index
+     * @param index The reflection index
      */
     template <typename ThreadPoolType, typename Function>
-    void post(ThreadPoolType &pool, Function function, int bbox_first_image) {
-      DIALS_ASSERT(bbox_first_image >= first_image_);
+    void post(ThreadPoolType &pool, Function function, std::size_t index) {
+      DIALS_ASSERT(index < bbox_.size());
+      DIALS_ASSERT(bbox_[index][4] >= first_image_);
       pool.post(
-        JobWrapper<Function>(function, notifier_, bbox_first_image - first_image_));
+        JobWrapper<Function>(function, notifier_, bbox_[index][4] - first_image_),
+        node(index));
     }
 
     /**
-     * Wait and check all are complete
+     * Post a job which processes a batch of reflections to the pool. The
+     * function is called with the index of each reflection in turn and the
+     * manager is notified as each one finishes. The job goes to the node
+     * holding the pixels of the first reflection.
+     * @param pool The thread pool
+     * @param function The function to call for each reflection
+     * @param indices The reflection indices
+     * @param bbox The reflection bounding boxes
+     */
+    template <typename ThreadPoolType, typename Function>
+    void post_batch(ThreadPoolType &pool,
+                    Function function,
+                    const std::vector<std::size_t> &indices,
+                    const af::const_ref<int6> &bbox) {
+      DIALS_ASSERT(!indices.empty());
+      std::vector<std::size_t> images(indices.size());
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        DIALS_ASSERT(indices[i] < bbox.size());
+        DIALS_ASSERT(bbox[indices[i]][4] >= first_image_);
+        images[i] = bbox[indices[i]][4] - first_image_;
+      }
+      pool.post(BatchJobWrapper<Function>(function, notifier_, indices, images),
+                node(indices[0]));
+    }
+
+    /**
+     * Post a job which processes a batch of reflections to the pool with a
+     * single call to the function, which is given all the indices. The
+     * manager is notified once the whole batch has finished. The job goes to
+     * the node holding the pixels of the first reflection.
+     * @param pool The thread pool
+     * @param function The function to call for the batch
+     * @param indices The reflection indices
+     * @param bbox The reflection bounding boxes
+     */
+    template <typename ThreadPoolType, typename Function>
+    void post_group(ThreadPoolType &pool,
+                    Function function,
+                    const std::vector<std::size_t> &indices,
+                    const af::const_ref<int6> &bbox) {
+      DIALS_ASSERT(!indices.empty());
+      std::vector<std::size_t> images(indices.size());
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        DIALS_ASSERT(indices[i] < bbox.size());
+        DIALS_ASSERT(bbox[indices[i]][4] >= first_image_);
+        images[i] = bbox[indices[i]][4] - first_image_;
+      }
+      pool.post(GroupJobWrapper<Function>(function, notifier_, indices, images),
+                node(indices[0]));
+    }
+
+    /**
+     * Wait and check all are complete. Only the jobs posted by this manager
+     * are waited for, so the pool may be shared with other integrators.
      * @param pool The thread pool
      */
     template <typename ThreadPoolType>
     void wait(ThreadPoolType &pool) {
-      pool.wait();
+      pool.wait_until(
+        boost::bind(&Notifier::all_complete, boost::cref(notifier_)));
       DIALS_ASSERT(notifier_.all_complete());
     }
 
@@ -1042,7 +1748,102 @@ namespace dials { namespace algorithms {
       std::size_t index_;
     };
 
+    /**
+     * A wrapper to call the job function for a batch of reflections, calling
+     * the notifier function after each one
+     */
+    template <typename Function>
+    class BatchJobWrapper {
+    public:
+      /**
+       * Construct
+       * @param function The function to call
+       * @param notifier The notifier function
+       * @param indices The reflection indices
+       * @param images The first image index of each reflection
+       */
+      BatchJobWrapper(Function function,
+                      Notifier &notifier,
+                      const std::vector<std::size_t> &indices,
+                      const std::vector<std::size_t> &images)
+          : function_(function),
+            notifier_(notifier),
+            indices_(indices),
+            images_(images) {
+        DIALS_ASSERT(indices_.size() == images_.size());
+      }
+
+      /**
+       * Call the function and notify for each reflection
+       */
+      void operator()() {
+        for (std::size_t i = 0; i < indices_.size(); ++i) {
+          function_(indices_[i]);
+          notifier_.notify(images_[i]);
+        }
+      }
+
+      Function function_;
+      Notifier &notifier_;
+      std::vector<std::size_t> indices_;
+      std::vector<std::size_t> images_;
+    };
+
+    /**
+     * A wrapper to call the job function once for a batch of reflections,
+     * calling the notifier function for each one after the batch is done
+     */
+    template <typename Function>
+    class GroupJobWrapper {
+    public:
+      /**
+       * Construct
+       * @param function The function to call
+       * @param notifier The notifier function
+       * @param indices The reflection indices
+       * @param images The first image index of each reflection
+       */
+      GroupJobWrapper(Function function,
+                      Notifier &notifier,
+                      const std::vector<std::size_t> &indices,
+                      const std::vector<std::size_t> &images)
+          : function_(function),
+            notifier_(notifier),
+            indices_(indices),
+            images_(images) {
+        DIALS_ASSERT(indices_.size() == images_.size());
+      }
+
+      /**
+       * Call the function and notify for each reflection
+       */
+      void operator()() {
+        function_(indices_);
+        for (std::size_t i = 0; i < images_.size(); ++i) {
+          notifier_.notify(images_[i]);
+        }
+      }
+
+      Function function_;
+      Notifier &notifier_;
+      std::vector<std::size_t> indices_;
+      std::vector<std::size_t> images_;
+    };
+
+    /**
+     * @returns The node whose memory holds the pixels of a reflection
+     */
+    std::size_t node(std::size_t index) const {
+      if (buffer_.numa_nodes() == 0) {
+        return 0;
+      }
+      DIALS_ASSERT(index < panel_.size());
+      return buffer_.numa_node(panel_[index], bbox_[index]);
+    }
+
     Buffer &buffer_;
+    af::const_ref<int6> bbox_;
+    af::const_ref<std::size_t> panel_;
     Notifier notifier_;
     int first_image_;
     std::size_t max_images_;
@@ -1065,6 +1866,13 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param prefetch The number of images to read ahead
+     * @param integer_buffer Store the image data as integer counts
+     * @param batch_size The number of reflections to process in each job
+     * @param numa_nodes The number of NUMA nodes to spread the image buffer
+     *   and the threads over, or 0 to not place them
+     * @param pool A thread pool shared with other integrators running at the
+     *   same time, or null to create one with nthreads threads
      */
     ParallelIntegrator(af::reflection_table reflections,
                        ImageSequence imageset,
@@ -1075,11 +1883,18 @@ namespace dials { namespace algorithms {
                        std::size_t nthreads,
                        std::size_t buffer_size,
                        bool use_dynamic_mask,
-                       bool debug) {
+                       bool debug,
+                       std::size_t prefetch,
+                       bool integer_buffer,
+                       std::size_t batch_size,
+                       std::size_t numa_nodes,
+                       boost::shared_ptr<WorkStealingThreadPool> pool =
+                         boost::shared_ptr<WorkStealingThreadPool>()) {
       using dials::algorithms::shoebox::find_overlapping_multi_panel;
 
       // Check the input
       DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(batch_size > 0);
 
       // Check the models
       DIALS_ASSERT(imageset.get_detector() != NULL);
@@ -1099,6 +1914,7 @@ namespace dials { namespace algorithms {
       double underload = detector[0].get_trusted_range()[0];
       double overload = detector[0].get_trusted_range()[1];
       DIALS_ASSERT(underload < overload);
+      DIALS_ASSERT(!integer_buffer || overload <= 65536);
       for (std::size_t i = 1; i < detector.size(); ++i) {
         DIALS_ASSERT(underload == detector[i].get_trusted_range()[0]);
         DIALS_ASSERT(overload == detector[i].get_trusted_range()[1]);
@@ -1114,30 +1930,38 @@ namespace dials { namespace algorithms {
       reset_flags(flags);
 
       // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel, nthreads);
 
       // Allocate the array for the image data
-      Buffer buffer(
-        detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      Buffer buffer(detector,
+                    zsize,
+                    buffer_size,
+                    underload,
+                    imageset.get_static_mask(),
+                    integer_buffer,
+                    numa_nodes);
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // Create a view of the reflection table. We want to process each
+      // reflection in parallel, so each job reads its reflection and the
+      // adjacent reflections as reflection objects and writes the result back
+      // into the table columns. The reflection table uses a std::map which is
+      // not thread safe, so the view looks up the columns once and the jobs
+      // only access it while holding a lock. This avoids converting the whole
+      // table to an array of reflection objects and back.
+      af::ReflectionTableView reflection_view(reflections);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
       // integration after each image is processed.
-      Lookup lookup(bbox, zstart, zsize);
+      Lookup lookup(bbox, panel, zstart, zsize);
+
+      // Record the time taken reading the images and by each calculator
+      TelemetryRecorder telemetry(nthreads, buffer_size);
 
       // Create the reflection integrator. This class is called for each
       // reflection to integrate the data
@@ -1148,23 +1972,31 @@ namespace dials { namespace algorithms {
                                       zstart,
                                       underload,
                                       overload,
-                                      debug);
+                                      debug,
+                                      &telemetry);
 
       // Do the integration
       process(lookup,
               integrator,
               buffer,
-              reflection_array.ref(),
+              reflection_view,
               overlaps,
               imageset,
               bbox,
+              panel,
               flags,
               nthreads,
+              numa_nodes,
               use_dynamic_mask,
-              logger);
+              prefetch,
+              batch_size,
+              logger,
+              telemetry,
+              pool);
 
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+      // The results have been written to the reflection table
+      reflections_ = reflection_view.table();
+      telemetry_ = telemetry.telemetry();
     }
 
     /**
@@ -1174,12 +2006,22 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The telemetry from the integration
+     */
+    IntegrationTelemetry telemetry() const {
+      return telemetry_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
+     * @param block_size The number of images in a block
+     * @param integer_buffer Store the image data as integer counts
      */
     static std::size_t compute_required_memory(ImageSequence imageset,
-                                               std::size_t block_size) {
+                                               std::size_t block_size,
+                                               bool integer_buffer = false) {
       DIALS_ASSERT(imageset.get_detector() != NULL);
       DIALS_ASSERT(imageset.get_scan() != NULL);
       Detector detector = *imageset.get_detector();
@@ -1192,7 +2034,8 @@ namespace dials { namespace algorithms {
         nelements += xsize * ysize;
       }
       nelements *= block_size;
-      std::size_t nbytes = nelements * sizeof(Buffer::float_type);
+      std::size_t nbytes = (std::size_t)std::ceil(
+        nelements * BufferBase::bytes_per_pixel(integer_buffer));
       return nbytes;
     }
 
@@ -1200,9 +2043,11 @@ namespace dials { namespace algorithms {
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
      * @param max_memory_usage The maximum memory usage
+     * @param integer_buffer Store the image data as integer counts
      */
     static std::size_t compute_max_block_size(ImageSequence imageset,
-                                              std::size_t max_memory_usage) {
+                                              std::size_t max_memory_usage,
+                                              bool integer_buffer = false) {
       DIALS_ASSERT(max_memory_usage > 0);
       DIALS_ASSERT(imageset.get_detector() != NULL);
       Detector detector = *imageset.get_detector();
@@ -1212,7 +2057,8 @@ namespace dials { namespace algorithms {
         std::size_t ysize = detector[i].get_image_size()[1];
         nelements += xsize * ysize;
       }
-      std::size_t nbytes = nelements * sizeof(Buffer::float_type);
+      std::size_t nbytes = (std::size_t)std::ceil(
+        nelements * BufferBase::bytes_per_pixel(integer_buffer));
       DIALS_ASSERT(nbytes > 0);
       DIALS_ASSERT(max_memory_usage > nbytes);
       return (std::size_t)std::floor((float)max_memory_usage / (float)nbytes);
@@ -1229,6 +2075,45 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Post a batch of reflections as a single job and clear the batch. If the
+     * intensity calculator works in batches the whole batch is given to it
+     * together.
+     */
+    template <typename ThreadPoolType>
+    void post_batch(BufferManager &bm,
+                    ThreadPoolType &pool,
+                    const ReflectionIntegrator &integrator,
+                    af::ReflectionTableView &reflections,
+                    const AdjacencyList &overlaps,
+                    af::const_ref<int6> bbox,
+                    std::vector<std::size_t> &batch) const {
+      if (batch.empty()) {
+        return;
+      }
+      if (integrator.batched()) {
+        bm.post_group(pool,
+                      boost::bind(&ReflectionIntegrator::integrate_batch,
+                                  boost::ref(integrator),
+                                  boost::placeholders::_1,
+                                  boost::ref(reflections),
+                                  boost::ref(overlaps)),
+                      batch,
+                      bbox);
+        batch.clear();
+        return;
+      }
+      bm.post_batch(pool,
+                    boost::bind(&ReflectionIntegrator::operator(),
+                                boost::ref(integrator),
+                                boost::placeholders::_1,
+                                boost::ref(reflections),
+                                boost::ref(overlaps)),
+                    batch,
+                    bbox);
+      batch.clear();
+    }
+
     /**
      * Do the processing by the following procedure.
      *
@@ -1242,45 +2127,74 @@ namespace dials { namespace algorithms {
     void process(const Lookup &lookup,
                  const ReflectionIntegrator &integrator,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
+                 af::ReflectionTableView &reflections,
                  const AdjacencyList &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
+                 af::const_ref<std::size_t> panel,
                  af::const_ref<std::size_t> flags,
                  std::size_t nthreads,
+                 std::size_t numa_nodes,
                  bool use_dynamic_mask,
-                 const Logger &logger) const {
-      using dials::util::ThreadPool;
-
-      // Create the thread pool
-      ThreadPool pool(nthreads);
+                 std::size_t prefetch,
+                 std::size_t batch_size,
+                 const Logger &logger,
+                 TelemetryRecorder &telemetry,
+                 boost::shared_ptr<WorkStealingThreadPool> shared_pool) const {
+      // Create the thread pool, with the workers grouped by node if the
+      // buffer is spread over the nodes, unless the pool is shared
+      boost::shared_ptr<WorkStealingThreadPool> pool_ptr = shared_pool;
+      if (pool_ptr == NULL) {
+        pool_ptr =
+          boost::make_shared<WorkStealingThreadPool>(nthreads, false, numa_nodes);
+      }
+      WorkStealingThreadPool &pool = *pool_ptr;
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
       std::size_t zsize = imageset.size();
 
       // Create the buffer manager
-      BufferManager bm(buffer, bbox, flags, zstart);
+      BufferManager bm(buffer, bbox, panel, flags, zstart);
+
+      // Start reading the images in the background
+      ImagePrefetcher prefetcher(imageset, use_dynamic_mask, prefetch);
 
       // Loop through all the images
       for (std::size_t i = 0; i < zsize; ++i) {
+        // Get the next image, which has usually already been read
+        double t0 = timestamp();
+        ImagePrefetcher::Frame frame = prefetcher.next();
+        double t1 = timestamp();
+
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
-        // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
-        } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
+        // threads to finish so that we don't end up reading the wrong data. The
+        // GIL is released while waiting so the next images can be read.
+        {
+          ScopedReleaseGIL release;
+          bm.wait_until_ready(pool, i);
+        }
+        double t2 = timestamp();
+        if (frame.rejected) {
+          bm.copy_when_ready(frame.data, false, i);
+        } else if (frame.has_mask) {
+          bm.copy_when_ready(frame.data, frame.mask, i);
         } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
+          bm.copy_when_ready(frame.data, i);
         }
+        double t3 = timestamp();
+        telemetry.add_read_time(t1 - t0);
+        telemetry.add_wait_time(t2 - t1);
+        telemetry.add_image(t3 - t2, bm.occupancy(i));
 
         // Get the reflections recorded at this point
         af::const_ref<std::size_t> indices = lookup.indices(i);
 
-        // Iterate through the reflection indices
+        // Iterate through the reflection indices. The reflections are ordered
+        // by position on the image so each batch is close together.
         std::size_t count = 0;
+        std::vector<std::size_t> batch;
         for (std::size_t j = 0; j < indices.size(); ++j) {
           // Get the reflection index
           std::size_t k = indices[j];
@@ -1297,16 +2211,25 @@ namespace dials { namespace algorithms {
           }
 
           // Post the integration job
-          bm.post(
-            pool,
-            boost::bind(&ReflectionIntegrator::operator(),
-                        boost::ref(integrator),
-                        k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
-                        boost::ref(overlaps)),
-            bbox[k][4]);
+          if (batch_size <= 1) {
+            bm.post(pool,
+                    boost::bind(&ReflectionIntegrator::operator(),
+                                boost::ref(integrator),
+                                k,
+                                boost::ref(reflections),
+                                boost::ref(overlaps)),
+                    k);
+          } else {
+            batch.push_back(k);
+            if (batch.size() == batch_size) {
+              post_batch(bm, pool, integrator, reflections, overlaps, bbox, batch);
+            }
+          }
         }
 
+        // Post any remaining jobs for this image
+        post_batch(bm, pool, integrator, reflections, overlaps, bbox, batch);
+
         // Print some output
         std::ostringstream ss;
         ss << "Integrating " << std::setw(5) << count << " reflections on image "
@@ -1315,10 +2238,14 @@ namespace dials { namespace algorithms {
       }
 
       // Wait for all the integration jobs to complete
-      bm.wait(pool);
+      {
+        ScopedReleaseGIL release;
+        bm.wait(pool);
+      }
     }
 
     af::reflection_table reflections_;
+    IntegrationTelemetry telemetry_;
   };
 
   /**
@@ -1336,6 +2263,25 @@ namespace dials { namespace algorithms {
       construct_frame_to_block_lookup();
     }
 
+    /**
+     * Compute variable size blocks from the bounding boxes of the reflections.
+     * Each block is made just large enough to fully contain the given fraction
+     * of the reflections centred in that part of the sweep, so a few wide
+     * reflections only inflate the blocks around them; any reflections which
+     * are wider than their block are split into partials as usual.
+     * @param range The range of frames
+     * @param bbox The bounding boxes of the reflections
+     * @param threshold The fraction of reflections to contain in a block
+     * @param max_block_size The maximum size of the blocks
+     */
+    SimpleBlockList(tiny<int, 2> range,
+                    const af::const_ref<int6> &bbox,
+                    double threshold,
+                    int max_block_size) {
+      construct_adaptive_block_list(range, bbox, threshold, max_block_size);
+      construct_frame_to_block_lookup();
+    }
+
     /**
      * Set the blocks
      * @params blocks The list of blocks
@@ -1464,6 +2410,93 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Construct a list of variable size blocks. The blocks overlap by half as
+     * for the fixed size blocks, with the size of each half block set from the
+     * extents of the reflections centred on the frames which follow it.
+     * @param range The range of frames
+     * @param bbox The bounding boxes of the reflections
+     * @param threshold The fraction of reflections to contain in a block
+     * @param max_block_size The maximum block size
+     */
+    void construct_adaptive_block_list(tiny<int, 2> range,
+                                       const af::const_ref<int6> &bbox,
+                                       double threshold,
+                                       int max_block_size) {
+      // Check some input
+      int frame0 = range[0];
+      int frame1 = range[1];
+      DIALS_ASSERT(frame1 > frame0);
+      DIALS_ASSERT(threshold > 0 && threshold <= 1.0);
+      int nframes = frame1 - frame0;
+
+      // Block size is clamped to number of frames
+      if (max_block_size > nframes) {
+        max_block_size = nframes;
+      }
+      DIALS_ASSERT(max_block_size > 0);
+      if (max_block_size == 1) {
+        construct_block_list(range, 1);
+        return;
+      }
+
+      // Get the frame extent of the reflections centred on each frame
+      std::vector<std::vector<int> > extents(nframes);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        int z0 = std::max(frame0, bbox[i][4]);
+        int z1 = std::min(frame1, bbox[i][5]);
+        if (z0 < z1) {
+          int zc = (int)std::floor((z0 + z1) / 2.0);
+          extents[zc - frame0].push_back(z1 - z0);
+        }
+      }
+
+      // Step through the frames in half blocks. The size of each half block
+      // is set so that a block would contain the threshold fraction of the
+      // reflections centred within the next max_block_size frames. Where
+      // there are no reflections use the maximum size.
+      int max_half_block_size = max_block_size / 2;
+      af::shared<int> indices;
+      indices.push_back(frame0);
+      std::vector<int> local;
+      for (int frame = frame0; frame < frame1;) {
+        local.clear();
+        int last = std::min(frame + max_block_size, frame1);
+        for (int f = frame; f < last; ++f) {
+          const std::vector<int> &e = extents[f - frame0];
+          local.insert(local.end(), e.begin(), e.end());
+        }
+        int block_size = max_block_size;
+        if (local.size() > 0) {
+          std::size_t cutoff =
+            std::min((std::size_t)(threshold * local.size()), local.size() - 1);
+          std::nth_element(local.begin(), local.begin() + cutoff, local.end());
+          block_size = std::min(local[cutoff], max_block_size);
+        }
+        int half_block_size =
+          std::max(1, std::min((block_size + 1) / 2, max_half_block_size));
+        frame = std::min(frame + half_block_size, frame1);
+        indices.push_back(frame);
+      }
+
+      // If the whole range fits in a half block then use a single block,
+      // otherwise add all the blocks to the list
+      DIALS_ASSERT(indices.front() == frame0);
+      DIALS_ASSERT(indices.back() == frame1);
+      DIALS_ASSERT(indices.size() >= 2);
+      if (indices.size() == 2) {
+        blocks_.push_back(tiny<int, 2>(frame0, frame1));
+      } else {
+        for (std::size_t i = 0; i < indices.size() - 2; ++i) {
+          int i1 = indices[i];
+          int i2 = indices[i + 2];
+          DIALS_ASSERT(i2 > i1);
+          blocks_.push_back(tiny<int, 2>(i1, i2));
+        }
+      }
+      DIALS_ASSERT(blocks_.size() > 0);
+    }
+
     /**
      * Construct the frame to block lookup table
      */
@@ -7,16 +7,20 @@
 from libtbx import Auto
 
 import dials.algorithms.integration
+from dials.algorithms.integration import telemetry
+from dials.algorithms.integration.checkpoint import JobCheckpoint
+from dials.algorithms.integration.memory_planner import plan_memory
 from dials.algorithms.integration.processor import NullTask, execute_parallel_task
 from dials.array_family import flex
 from dials.util import tabulate
-from dials.util.mp import multi_node_parallel_map
+from dials.util.mp import mpi_parallel_map, multi_node_parallel_map
 
 # Need this import first because loads extension that parallel_integrator_ext
 # relies on - it assumes the binding for EmpiricalProfileModeller exists
 import dials.algorithms.profile_model.modeller  # noqa: F401 # isort: split
 
 from dials_algorithms_integration_parallel_integrator_ext import (
+    GaussianRSBatchIntensityCalculator,
     GaussianRSIntensityCalculator,
     GaussianRSMaskCalculator,
     GaussianRSMultiCrystalMaskCalculator,
@@ -24,6 +28,7 @@
     GaussianRSReferenceCalculator,
     GaussianRSReferenceProfileData,
     GLMBackgroundCalculator,
+    IntegrationTelemetry,
     Logger,
     MultiThreadedIntegrator,
     MultiThreadedReferenceProfiler,
@@ -31,11 +36,15 @@
     SimpleBackgroundCalculator,
     SimpleBlockList,
     SimpleReflectionManager,
+    TimingHistogram,
+    TransformedProfileCache,
+    WorkStealingThreadPool,
 )
 
 __all__ = [
     "BackgroundCalculatorFactory",
     "GLMBackgroundCalculator",
+    "GaussianRSBatchIntensityCalculator",
     "GaussianRSIntensityCalculator",
     "GaussianRSMaskCalculator",
     "GaussianRSMultiCrystalMaskCalculator",
@@ -44,6 +53,7 @@
     "GaussianRSReferenceProfileData",
     "IntegrationJob",
     "IntegrationManager",
+    "IntegrationTelemetry",
     "IntegratorProcessor",
     "IntensityCalculatorFactory",
     "Logger",
@@ -58,6 +68,10 @@
     "SimpleBackgroundCalculator",
     "SimpleBlockList",
     "SimpleReflectionManager",
+    "TimingHistogram",
+    "TransformedProfileCache",
+    "WorkStealingThreadPool",
+    "create_transform_cache",
 ]
 
 logger = logging.getLogger(__name__)
@@ -194,7 +208,7 @@ class IntensityCalculatorFactory:
     """
 
     @staticmethod
-    def create(experiments, reference_profiles, params=None):
+    def create(experiments, reference_profiles, params=None, transform_cache=None):
         """
         Select the intensity calculator
         """
@@ -228,6 +242,8 @@ def create(experiments, reference_profiles, params=None):
                 reference_profiles,
                 detector_space=detector_space,
                 deconvolution=params.detector_space.deconvolution,
+                transform_cache=transform_cache,
+                batch=params.batch_fit,
             )
 
         else:
@@ -243,7 +259,7 @@ class ReferenceCalculatorFactory:
     """
 
     @staticmethod
-    def create(experiments, params=None):
+    def create(experiments, params=None, transform_cache=None):
         """
         Select the reference calculator
         """
@@ -270,6 +286,8 @@ def create(experiments, params=None):
                 grid_size=params.grid_size,
                 scan_step=params.scan_step,
                 grid_method=params.grid_method,
+                cache_tile_size=params.geometry_cache_tile_size,
+                transform_cache=transform_cache,
             )
 
         else:
@@ -306,12 +324,31 @@ def _assert_enough_memory(required_memory, max_memory_usage):
         logger.info("Allocating %.1f MB memory", required_memory / 1e6)
 
 
+def _runs_in_process(params):
+    """
+    :param params: The integration parameters
+    :returns: True if the jobs are run one after another in this process
+    """
+    mp = params.integration.mp
+    return mp.method != "mpi" and mp.njobs == 1
+
+
 class IntegrationJob:
     """
     A class to represent an integration job
     """
 
-    def __init__(self, index, job, experiments, reflections, reference, params=None):
+    def __init__(
+        self,
+        index,
+        job,
+        experiments,
+        reflections,
+        reference,
+        params=None,
+        transform_cache=None,
+        pool=None,
+    ):
         """
         Initialise the task.
 
@@ -319,6 +356,8 @@ def __init__(self, index, job, experiments, reflections, reference, params=None)
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The processing parameters
+        :param transform_cache: The shoeboxes transformed by the reference pass
+        :param pool: A thread pool shared with other sweeps, or None
         :param job: The frames to integrate
         :param flatten: Flatten the shoeboxes
         :param executor: The executor class
@@ -343,6 +382,9 @@ def __init__(self, index, job, experiments, reflections, reference, params=None)
         self.reflections = reflections
         self.reference = reference
         self.params = params
+        self.transform_cache = transform_cache
+        self.pool = pool
+        self.telemetry = None
 
     def __call__(self):
         """
@@ -401,6 +443,7 @@ def __call__(self):
             extract_time=0,
             process_time=0,
             total_time=0,
+            telemetry=self.telemetry,
         )
 
     def compute_required_memory(self, imageset):
@@ -408,7 +451,9 @@ def compute_required_memory(self, imageset):
         Compute the required memory
         """
         return MultiThreadedIntegrator.compute_required_memory(
-            imageset, self.params.integration.block.size
+            imageset,
+            self.params.integration.block.size,
+            integer_buffer=self.params.integration.block.integer_buffer,
         )
 
     def integrate(self, imageset):
@@ -418,7 +463,9 @@ def integrate(self, imageset):
         from dials.algorithms.integration.integrator import frame_hist
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
         # Get some info
         EPS = 1e-7
@@ -470,7 +517,10 @@ def integrate(self, imageset):
 
         # Construct the intensity algorithm
         compute_intensity = IntensityCalculatorFactory.create(
-            self.experiments, self.reference, self.params
+            self.experiments,
+            self.reference,
+            self.params,
+            transform_cache=self.transform_cache,
         )
 
         # Call the multi threaded integrator
@@ -485,10 +535,16 @@ def integrate(self, imageset):
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
             debug=self.params.integration.debug.output,
+            prefetch=self.params.integration.mp.prefetch,
+            integer_buffer=self.params.integration.block.integer_buffer,
+            batch_size=self.params.integration.mp.batch_size,
+            numa_nodes=self.params.integration.mp.numa_nodes,
+            pool=self.pool,
         )
 
         # Assign the reflections
         self.reflections = integrator.reflections()
+        self.telemetry = telemetry.as_dict(integrator.telemetry())
 
     def write_debug_files(self):
         """
@@ -519,7 +575,19 @@ class IntegrationManager:
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, reference, params):
+    # The name of the jobs in the checkpoint
+    checkpoint_name = "integration"
+
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        reference,
+        params,
+        transform_cache=None,
+        pool=None,
+        memory_budget=None,
+    ):
         """
         Initialise the manager.
 
@@ -527,12 +595,19 @@ def __init__(self, experiments, reflections, reference, params):
         :param reflections: The list of reflections
         :param reference: The reference profiles
         :param params: The phil parameters
+        :param transform_cache: The shoeboxes transformed by the reference pass
+        :param pool: A thread pool shared with other sweeps, or None
+        :param memory_budget: The bytes the jobs may use, or None to use
+                              max_memory_usage of the available memory
         """
 
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
         self.reference = reference
+        self.transform_cache = transform_cache
+        self.pool = pool
+        self.memory_budget = memory_budget
 
         # Save some parameters
         self.params = params
@@ -542,6 +617,7 @@ def __init__(self, experiments, reflections, reference, params):
 
         # Initialise the timing information
         # self.time = TimingInfo()
+        self.telemetry = []
 
         self.initialize()
 
@@ -564,6 +640,13 @@ def initialize(self):
             self.blocks, self.reflections, self.params.integration.mp.njobs
         )
 
+        # Save the results of each job as it finishes
+        self.checkpoint = None
+        if self.params.integration.checkpoint.directory:
+            self.checkpoint = JobCheckpoint(
+                self.params.integration.checkpoint.directory, self.checkpoint_name
+            )
+
     def task(self, index):
         """
         Get a task.
@@ -583,19 +666,27 @@ def task(self, index):
                 reflections=reflections,
                 reference=reference,
                 params=self.params,
+                transform_cache=self.transform_cache,
+                pool=self.pool,
             )
         return task
 
     def tasks(self):
         """
-        Iterate through the tasks.
+        Iterate through the tasks. The jobs which have already been saved to
+        the checkpoint are accumulated instead.
         """
-        for i in range(len(self)):
-            yield self.task(i)
+        tasks = (self.task(i) for i in range(len(self)))
+        if self.checkpoint is not None:
+            tasks = self.checkpoint.tasks(tasks, self.accumulate)
+        yield from tasks
 
     def accumulate(self, result):
         """Accumulate the results."""
+        if self.checkpoint is not None:
+            self.checkpoint.save(result)
         self.manager.accumulate(result.index, result.reflections)
+        self.telemetry.append(result.telemetry)
         # self.time.read += result.read_time
         # self.time.extract += result.extract_time
         # self.time.process += result.process_time
@@ -635,31 +726,36 @@ def __len__(self):
         """
         return len(self.manager)
 
-    def compute_max_block_size(self):
+    def compute_max_block_size(self, block_size):
         """
-        Compute the required memory
+        Plan the memory of the jobs, choosing the number of threads and the
+        batch size so that a block of the requested size fits if possible.
+
+        :param block_size: The requested block size in images
+        :return: The maximum block size
         """
-        total_memory = psutil.virtual_memory().available
-        max_memory_usage = self.params.integration.block.max_memory_usage
-        assert max_memory_usage > 0.0, "maximum memory usage must be > 0"
-        assert max_memory_usage <= 1.0, "maximum memory usage must be <= 1"
-        limit_memory = int(math.floor(total_memory * max_memory_usage))
-        return MultiThreadedIntegrator.compute_max_block_size(
-            self.experiments[0].imageset, max_memory_usage=limit_memory
+        self.memory_plan = plan_memory(
+            self.experiments,
+            self.reflections,
+            self.params,
+            block_size,
+            reference_pass=False,
+            budget=self.memory_budget,
         )
+        return self.memory_plan.max_block_size
 
     def compute_blocks(self):
         """
         Compute the processing block size.
         """
         block = self.params.integration.block
-        max_block_size = self.compute_max_block_size()
         if block.size in [Auto, "auto", "Auto"]:
             assert block.threshold > 0, "Threshold must be > 0"
             assert block.threshold <= 1.0, "Threshold must be < 1"
             nframes = sorted([b[5] - b[4] for b in self.reflections["bbox"]])
             cutoff = int(block.threshold * len(nframes))
             block_size = nframes[cutoff]
+            max_block_size = self.compute_max_block_size(block_size)
             if block_size > max_block_size:
                 logger.warning(
                     "Computed block size (%s) > maximum block size (%s).",
@@ -682,6 +778,7 @@ def compute_blocks(self):
                 block_size = int(math.ceil(block.size))
             else:
                 raise RuntimeError(f"Unknown block_size unit {block.units!r}")
+            max_block_size = self.compute_max_block_size(block_size)
             if block_size > max_block_size:
                 raise RuntimeError(
                     """
@@ -703,7 +800,13 @@ def compute_jobs(self):
         block = self.params.integration.block
         assert block.units == "frames"
         assert block.size > 0
-        self.blocks = SimpleBlockList(array_range, block.size)
+        if block.adaptive:
+            self.blocks = SimpleBlockList(
+                array_range, self.reflections["bbox"], block.threshold, block.size
+            )
+            block.size = max(b[1] - b[0] for b in self.blocks)
+        else:
+            self.blocks = SimpleBlockList(array_range, block.size)
         assert len(self.blocks) > 0, "Invalid number of jobs"
 
     def summary(self):
@@ -763,7 +866,16 @@ class ReferenceCalculatorJob:
     A class to represent an integration job
     """
 
-    def __init__(self, index, job, experiments, reflections, params=None):
+    def __init__(
+        self,
+        index,
+        job,
+        experiments,
+        reflections,
+        params=None,
+        transform_cache=None,
+        pool=None,
+    ):
         """
         Initialise the task.
 
@@ -771,6 +883,8 @@ def __init__(self, index, job, experiments, reflections, params=None):
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The processing parameters
+        :param transform_cache: A cache to keep the transformed shoeboxes in
+        :param pool: A thread pool shared with other sweeps, or None
         :param job: The frames to integrate
         :param flatten: Flatten the shoeboxes
         :param executor: The executor class
@@ -794,6 +908,9 @@ def __init__(self, index, job, experiments, reflections, params=None):
         self.experiments = experiments
         self.reflections = reflections
         self.params = params
+        self.transform_cache = transform_cache
+        self.pool = pool
+        self.telemetry = None
 
     def __call__(self):
         """
@@ -852,11 +969,14 @@ def __call__(self):
             extract_time=0,
             process_time=0,
             total_time=0,
+            telemetry=self.telemetry,
         )
 
     def compute_required_memory(self, imageset):
         return MultiThreadedIntegrator.compute_required_memory(
-            imageset, self.params.integration.block.size
+            imageset,
+            self.params.integration.block.size,
+            integer_buffer=self.params.integration.block.integer_buffer,
         )
 
     def compute_reference_profiles(self, imageset):
@@ -866,7 +986,9 @@ def compute_reference_profiles(self, imageset):
         from dials.algorithms.integration.integrator import frame_hist
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
         # Get some info
         EPS = 1e-7
@@ -918,7 +1040,7 @@ def compute_reference_profiles(self, imageset):
 
         # Construct the intensity algorithm
         compute_reference = ReferenceCalculatorFactory.create(
-            self.experiments, self.params
+            self.experiments, self.params, transform_cache=self.transform_cache
         )
 
         # Call the multi threaded integrator
@@ -933,10 +1055,16 @@ def compute_reference_profiles(self, imageset):
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
             debug=self.params.integration.debug.output,
+            prefetch=self.params.integration.mp.prefetch,
+            integer_buffer=self.params.integration.block.integer_buffer,
+            batch_size=self.params.integration.mp.batch_size,
+            numa_nodes=self.params.integration.mp.numa_nodes,
+            pool=self.pool,
         )
 
         # Assign the reflections
         self.reflections = reference_calculator.reflections()
+        self.telemetry = telemetry.as_dict(reference_calculator.telemetry())
 
         # Assign the reference profiles
         self.reference = compute_reference
@@ -983,19 +1111,37 @@ class ReferenceCalculatorManager:
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, params):
+    # The name of the jobs in the checkpoint
+    checkpoint_name = "reference"
+
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        params,
+        transform_cache=None,
+        pool=None,
+        memory_budget=None,
+    ):
         """
         Initialise the manager.
 
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The phil parameters
+        :param transform_cache: A cache to keep the transformed shoeboxes in
+        :param pool: A thread pool shared with other sweeps, or None
+        :param memory_budget: The bytes the jobs may use, or None to use
+                              max_memory_usage of the available memory
         """
 
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
         self.reference = None
+        self.transform_cache = transform_cache
+        self.pool = pool
+        self.memory_budget = memory_budget
 
         # Save some parameters
         self.params = params
@@ -1005,6 +1151,7 @@ def __init__(self, experiments, reflections, params):
 
         # Initialise the timing information
         # self.time = TimingInfo()
+        self.telemetry = []
 
         self.initialize()
 
@@ -1033,6 +1180,13 @@ def initialize(self):
             self.blocks, self.reflections, self.params.integration.mp.njobs
         )
 
+        # Save the results of each job as it finishes
+        self.checkpoint = None
+        if self.params.integration.checkpoint.directory:
+            self.checkpoint = JobCheckpoint(
+                self.params.integration.checkpoint.directory, self.checkpoint_name
+            )
+
     def task(self, index):
         """
         Get a task.
@@ -1050,19 +1204,27 @@ def task(self, index):
                 experiments=experiments,
                 reflections=reflections,
                 params=self.params,
+                transform_cache=self.transform_cache,
+                pool=self.pool,
             )
         return task
 
     def tasks(self):
         """
-        Iterate through the tasks.
+        Iterate through the tasks. The jobs which have already been saved to
+        the checkpoint are accumulated instead.
         """
-        for i in range(len(self)):
-            yield self.task(i)
+        tasks = (self.task(i) for i in range(len(self)))
+        if self.checkpoint is not None:
+            tasks = self.checkpoint.tasks(tasks, self.accumulate)
+        yield from tasks
 
     def accumulate(self, result):
         """Accumulate the results."""
+        if self.checkpoint is not None:
+            self.checkpoint.save(result)
         self.manager.accumulate(result.index, result.reflections)
+        self.telemetry.append(result.telemetry)
 
         if self.reference is None:
             self.reference = result.data
@@ -1106,31 +1268,36 @@ def __len__(self):
         """
         return len(self.manager)
 
-    def compute_max_block_size(self):
+    def compute_max_block_size(self, block_size):
         """
-        Compute the required memory
+        Plan the memory of the jobs, choosing the number of threads and the
+        batch size so that a block of the requested size fits if possible.
+
+        :param block_size: The requested block size in images
+        :return: The maximum block size
         """
-        total_memory = psutil.virtual_memory().available
-        max_memory_usage = self.params.integration.block.max_memory_usage
-        assert max_memory_usage > 0.0, "maximum memory usage must be > 0"
-        assert max_memory_usage <= 1.0, "maximum memory usage must be <= 1"
-        limit_memory = int(math.floor(total_memory * max_memory_usage))
-        return MultiThreadedReferenceProfiler.compute_max_block_size(
-            self.experiments[0].imageset, max_memory_usage=limit_memory
+        self.memory_plan = plan_memory(
+            self.experiments,
+            self.reflections,
+            self.params,
+            block_size,
+            reference_pass=True,
+            budget=self.memory_budget,
         )
+        return self.memory_plan.max_block_size
 
     def compute_blocks(self):
         """
         Compute the processing block size.
         """
         block = self.params.integration.block
-        max_block_size = self.compute_max_block_size()
         if block.size in [Auto, "auto", "Auto"]:
             assert block.threshold > 0, "Threshold must be > 0"
             assert block.threshold <= 1.0, "Threshold must be < 1"
             nframes = sorted([b[5] - b[4] for b in self.reflections["bbox"]])
             cutoff = int(block.threshold * len(nframes))
             block_size = nframes[cutoff]
+            max_block_size = self.compute_max_block_size(block_size)
             if block_size > max_block_size:
                 logger.warning(
                     "Computed block size (%s) > maximum block size (%s).",
@@ -1153,6 +1320,7 @@ def compute_blocks(self):
                 block_size = int(math.ceil(block.size))
             else:
                 raise RuntimeError(f"Unknown block_size unit {block.units!r}")
+            max_block_size = self.compute_max_block_size(block_size)
             if block_size > max_block_size:
                 raise RuntimeError(
                     """
@@ -1171,7 +1339,13 @@ def compute_jobs(self):
         block = self.params.integration.block
         assert block.units == "frames"
         assert block.size > 0
-        self.blocks = SimpleBlockList(array_range, block.size)
+        if block.adaptive:
+            self.blocks = SimpleBlockList(
+                array_range, self.reflections["bbox"], block.threshold, block.size
+            )
+            block.size = max(b[1] - b[0] for b in self.blocks)
+        else:
+            self.blocks = SimpleBlockList(array_range, block.size)
         assert len(self.blocks) > 0, "Invalid number of jobs"
 
     def summary(self):
@@ -1226,32 +1400,90 @@ def summary(self):
         return fmt % (block_size, self.params.integration.block.units, task_table)
 
 
-def compute_required_memory(imageset, block_size):
+def compute_required_memory(imageset, block_size, integer_buffer=False):
     """
     Compute the required memory
 
     """
-    return MultiThreadedIntegrator.compute_required_memory(imageset, block_size)
+    return MultiThreadedIntegrator.compute_required_memory(
+        imageset, block_size, integer_buffer=integer_buffer
+    )
+
+
+def create_transform_cache(params):
+    """
+    Create a cache to share the transformed shoeboxes between the reference
+    and integration passes, if it is enabled and can be used.
+
+    The cache is only used when the jobs run in this process and the profiles
+    are fitted in reciprocal space.
+
+    :param params: The phil parameters
+    :return: The cache or None
+    """
+    if params.profile.algorithm != "gaussian_rs":
+        return None
+    fitting = params.profile.gaussian_rs.fitting
+    if not fitting.transform_cache.enable:
+        return None
+    if fitting.fit_method != "reciprocal_space":
+        return None
+    if params.integration.mp.method == "mpi" or params.integration.mp.njobs > 1:
+        logger.info(" Transform cache disabled as jobs run in separate processes")
+        return None
+    return TransformedProfileCache(fitting.transform_cache.max_memory)
 
 
 class ReferenceCalculatorProcessor:
-    def __init__(self, experiments, reflections, params=None):
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        params=None,
+        transform_cache=None,
+        pool=None,
+        memory_budget=None,
+    ):
         from dials.util import pprint
 
+        # A shared thread pool can only be used by jobs run in this process
+        assert pool is None or _runs_in_process(params)
+
         # Create the reference manager
-        reference_manager = ReferenceCalculatorManager(experiments, reflections, params)
+        reference_manager = ReferenceCalculatorManager(
+            experiments,
+            reflections,
+            params,
+            transform_cache=transform_cache,
+            pool=pool,
+            memory_budget=memory_budget,
+        )
 
         # Print some output
         logger.info(reference_manager.summary())
 
         # Execute each task
-        if params.integration.mp.njobs > 1:
+        if params.integration.mp.method == "mpi":
+
+            def process_output(result):
+                for message in result[1]:
+                    logger.log(message.levelno, message.msg)
+                reference_manager.accumulate(result[0])
+
+            mpi_parallel_map(
+                func=execute_parallel_task,
+                iterable=reference_manager.tasks(),
+                callback=process_output,
+            )
+        elif params.integration.mp.njobs > 1:
 
             if params.integration.mp.method == "multiprocessing":
                 _assert_enough_memory(
                     params.integration.mp.njobs
                     * compute_required_memory(
-                        experiments[0].imageset, params.integration.block.size
+                        experiments[0].imageset,
+                        params.integration.block.size,
+                        integer_buffer=params.integration.block.integer_buffer,
                     ),
                     params.integration.block.max_memory_usage,
                 )
@@ -1281,6 +1513,10 @@ def process_output(result):
         # Set the reflections and profiles
         self._reflections = reference_manager.result()
         self._profiles = reference_manager.reference
+        self._telemetry = telemetry.merge(reference_manager.telemetry)
+        if self._telemetry is not None:
+            logger.debug("Telemetry from reference profiling")
+            logger.debug(telemetry.summary(self._telemetry))
 
         # Write the profiles to file
         if params.integration.debug.reference.output:
@@ -1307,26 +1543,61 @@ def reflections(self):
     def profiles(self):
         return self._profiles
 
+    def telemetry(self):
+        return self._telemetry
+
 
 class IntegratorProcessor:
-    def __init__(self, experiments, reflections, reference=None, params=None):
+    def __init__(
+        self,
+        experiments,
+        reflections,
+        reference=None,
+        params=None,
+        transform_cache=None,
+        pool=None,
+        memory_budget=None,
+    ):
+
+        # A shared thread pool can only be used by jobs run in this process
+        assert pool is None or _runs_in_process(params)
 
         # Create the reference manager
         integration_manager = IntegrationManager(
-            experiments, reflections, reference, params
+            experiments,
+            reflections,
+            reference,
+            params,
+            transform_cache=transform_cache,
+            pool=pool,
+            memory_budget=memory_budget,
         )
 
         # Print some output
         logger.info(integration_manager.summary())
 
         # Execute each task
-        if params.integration.mp.njobs > 1:
+        if params.integration.mp.method == "mpi":
+
+            def process_output(result):
+                for message in result[1]:
+                    logger.log(message.levelno, message.msg)
+                integration_manager.accumulate(result[0])
+
+            mpi_parallel_map(
+                func=execute_parallel_task,
+                iterable=integration_manager.tasks(),
+                callback=process_output,
+            )
+        elif params.integration.mp.njobs > 1:
 
             if params.integration.mp.method == "multiprocessing":
                 _assert_enough_memory(
                     params.integration.mp.njobs
                     * compute_required_memory(
-                        experiments[0].imageset, params.integration.block.size
+                        experiments[0].imageset,
+                        params.integration.block.size,
+                        integer_buffer=params.integration.block.integer_buffer,
                     ),
                     params.integration.block.max_memory_usage,
                 )
@@ -1353,12 +1624,27 @@ def process_output(result):
         # Finalize the processing
         integration_manager.finalize()
 
+        # Report the use of the transform cache
+        if transform_cache is not None:
+            logger.info(
+                " Reused %d / %d transformed shoeboxes from the reference pass",
+                transform_cache.hits(),
+                transform_cache.hits() + transform_cache.misses(),
+            )
+
         # Set the reflections and profiles
         self._reflections = integration_manager.result()
+        self._telemetry = telemetry.merge(integration_manager.telemetry)
+        if self._telemetry is not None:
+            logger.debug("Telemetry from integration")
+            logger.debug(telemetry.summary(self._telemetry))
 
     def reflections(self):
         return self._reflections
 
+    def telemetry(self):
+        return self._telemetry
+
 
 def split_partials_over_boundaries(reflections, block_size):
     """
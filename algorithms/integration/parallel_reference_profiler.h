@@ -20,7 +20,7 @@
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/error.h>
-#include <dials/util/thread_pool.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/algorithms/shoebox/find_overlapping.h>
 #include <dials/algorithms/integration/parallel_integrator.h>
 #include <dials/algorithms/integration/sum/summation.h>
@@ -45,6 +45,8 @@ namespace dials { namespace algorithms {
   using dials::model::AdjacencyList;
   using dials::model::Shoebox;
 
+  using dials::util::WorkStealingThreadPool;
+
   /**
    * A class to integrate a single reflection
    */
@@ -59,6 +61,8 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
+     * @param debug Keep the shoeboxes
+     * @param telemetry Record the time taken by each stage (optional)
      */
     ReflectionReferenceProfiler(const MaskCalculatorIface &compute_mask,
                                 const BackgroundCalculatorIface &compute_background,
@@ -67,7 +71,8 @@ namespace dials { namespace algorithms {
                                 int zstart,
                                 double underload,
                                 double overload,
-                                bool debug)
+                                bool debug,
+                                TelemetryRecorder *telemetry = NULL)
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_reference_(compute_reference),
@@ -75,7 +80,8 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          telemetry_(telemetry) {}
 
     /**
      * Integrate a reflection using the following procedure:
@@ -93,17 +99,22 @@ namespace dials { namespace algorithms {
      * @param adjacent_reflections The list of adjacent reflections
      */
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
+                    af::ReflectionTableView &reflection_list,
                     const AdjacencyList &adjacency_list) const {
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
+      double start_time = telemetry_ != NULL ? timestamp() : 0;
+      double stage_time = start_time;
 
       // Get the reflection data
       get_reflection(
         index, reflection_list, adjacency_list, reflection, adjacent_reflections);
 
-      // Extract the shoebox data
+      // Extract the shoebox data. Keep a handle to the shoebox so its arrays
+      // can be recycled once the reflection has finished with them.
       extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
+      Shoebox<> shoebox = reflection.get<Shoebox<> >("shoebox");
+      record(TelemetryRecorder::Extract, stage_time);
 
       // Compute the mask
       compute_mask_(reflection);
@@ -115,14 +126,19 @@ namespace dials { namespace algorithms {
         adjacent_reflections[i]["shoebox"] = reflection.get<Shoebox<> >("shoebox");
         compute_mask_(adjacent_reflections[i], true);
       }
+      record(TelemetryRecorder::Mask, stage_time);
 
       // Compute the background
       try {
         compute_background_(reflection);
       } catch (dials::error const &) {
         finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+        shoebox_pool_.release(shoebox);
+        record(TelemetryRecorder::Background, stage_time);
+        record(TelemetryRecorder::Reflection, start_time);
         return;
       }
+      record(TelemetryRecorder::Background, stage_time);
 
       // Compute the centroid
       compute_centroid(reflection);
@@ -136,25 +152,41 @@ namespace dials { namespace algorithms {
       } catch (dials::error const &) {
         // pass
       }
+      record(TelemetryRecorder::Intensity, stage_time);
 
       // Erase the shoebox
       finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+      shoebox_pool_.release(shoebox);
 
       // Set the reflection data
       set_reflection(index, reflection_list, reflection);
+      record(TelemetryRecorder::Reflection, start_time);
     }
 
   protected:
+    /**
+     * Record the time taken by a stage, if recording telemetry
+     * @param stage The stage
+     * @param start_time The start of the stage, set to the current time
+     */
+    void record(TelemetryRecorder::Stage stage, double &start_time) const {
+      if (telemetry_ != NULL) {
+        double now = timestamp();
+        telemetry_->add(stage, now - start_time);
+        start_time = now;
+      }
+    }
+
     /**
      * Get the reflection data in a thread safe manner
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param reflection_list The view of the reflection table
      * @param adjacency_list The adjacency list
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
+                        const af::ReflectionTableView &reflection_list,
                         const AdjacencyList &adjacency_list,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
@@ -164,30 +196,31 @@ namespace dials { namespace algorithms {
       boost::lock_guard<boost::mutex> guard(mutex_);
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = reflection_list.get(index);
 
       // Get the adjacent reflections
       adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      AdjacencyList::vertex_iterator_range adjacent =
+        adjacency_list.adjacent_vertices(index);
+      for (AdjacencyList::vertex_iterator it = adjacent.first; it != adjacent.second;
+           ++it) {
+        DIALS_ASSERT(*it < reflection_list.size());
+        adjacent_reflections.push_back(reflection_list.get(*it));
       }
     }
 
     /**
      * Set the reflection data in a thread safe way
      * @param index The reflection index
-     * @param reflection_list The reflection list
+     * @param reflection_list The view of the reflection table
      * @param reflection The reflection data
      */
     void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
+                        af::ReflectionTableView &reflection_list,
                         const af::Reflection &reflection) const {
       DIALS_ASSERT(index < reflection_list.size());
       boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
+      reflection_list.set(index, reflection);
     }
 
     /**
@@ -306,11 +339,9 @@ namespace dials { namespace algorithms {
                          int zstart,
                          double underload,
                          double overload) const {
-      typedef af::const_ref<Buffer::float_type, af::c_grid<2> > data_buffer_type;
       std::size_t panel = reflection.get<std::size_t>("panel");
       int6 bbox = reflection.get<int6>("bbox");
-      Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      Shoebox<> shoebox = shoebox_pool_.allocate(panel, bbox);
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -334,23 +365,15 @@ namespace dials { namespace algorithms {
         if (kk < 0 || kk >= buffer.num_images()) {
           continue;
         }
-        data_buffer_type data_buffer = buffer.data(panel, kk);
-        for (std::size_t j = 0; j < ysize; ++j) {
-          for (std::size_t i = 0; i < xsize; ++i) {
-            int jj = y0 + j;
-            int ii = x0 + i;
-            if (jj >= 0 && ii >= 0 && jj < data_buffer.accessor()[0]
-                && ii < data_buffer.accessor()[1]) {
-              double d = data_buffer(jj, ii);
-              int m = (d > underload && d < overload) ? Valid : 0;
-              data(k, j, i) = d;
-              mask(k, j, i) = m;
-            } else {
-              data(k, j, i) = 0;
-              mask(k, j, i) = 0;
-            }
-          }
-        }
+        af::c_grid<2> grid(ysize, xsize);
+        buffer.extract(panel,
+                       kk,
+                       y0,
+                       x0,
+                       af::ref<float, af::c_grid<2> >(&data(k, 0, 0), grid),
+                       af::ref<int, af::c_grid<2> >(&mask(k, 0, 0), grid),
+                       underload,
+                       overload);
       }
       reflection["shoebox"] = shoebox;
     }
@@ -408,7 +431,9 @@ namespace dials { namespace algorithms {
     double underload_;
     double overload_;
     bool debug_;
+    TelemetryRecorder *telemetry_;
     mutable boost::mutex mutex_;
+    mutable ShoeboxPool shoebox_pool_;
   };
 
   /**
@@ -428,6 +453,13 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param prefetch The number of images to read ahead
+     * @param integer_buffer Store the image data as integer counts
+     * @param batch_size The number of reflections to process in each job
+     * @param numa_nodes The number of NUMA nodes to spread the image buffer
+     *   and the threads over, or 0 to not place them
+     * @param pool A thread pool shared with other integrators running at the
+     *   same time, or null to create one with nthreads threads
      */
     ParallelReferenceProfiler(af::reflection_table reflections,
                               ImageSequence imageset,
@@ -438,11 +470,18 @@ namespace dials { namespace algorithms {
                               std::size_t nthreads,
                               std::size_t buffer_size,
                               bool use_dynamic_mask,
-                              bool debug) {
+                              bool debug,
+                              std::size_t prefetch,
+                              bool integer_buffer,
+                              std::size_t batch_size,
+                              std::size_t numa_nodes,
+                              boost::shared_ptr<WorkStealingThreadPool> pool =
+                                boost::shared_ptr<WorkStealingThreadPool>()) {
       using dials::algorithms::shoebox::find_overlapping_multi_panel;
 
       // Check the input
       DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(batch_size > 0);
 
       // Check the models
       DIALS_ASSERT(imageset.get_detector() != NULL);
@@ -462,6 +501,7 @@ namespace dials { namespace algorithms {
       double underload = detector[0].get_trusted_range()[0];
       double overload = detector[0].get_trusted_range()[1];
       DIALS_ASSERT(underload < overload);
+      DIALS_ASSERT(!integer_buffer || overload <= 65536);
       for (std::size_t i = 1; i < detector.size(); ++i) {
         DIALS_ASSERT(underload == detector[i].get_trusted_range()[0]);
         DIALS_ASSERT(overload == detector[i].get_trusted_range()[1]);
@@ -477,30 +517,38 @@ namespace dials { namespace algorithms {
       reset_flags(flags);
 
       // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel, nthreads);
 
       // Allocate the array for the image data
-      Buffer buffer(
-        detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      Buffer buffer(detector,
+                    zsize,
+                    buffer_size,
+                    underload,
+                    imageset.get_static_mask(),
+                    integer_buffer,
+                    numa_nodes);
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // Create a view of the reflection table. We want to process each
+      // reflection in parallel, so each job reads its reflection and the
+      // adjacent reflections as reflection objects and writes the result back
+      // into the table columns. The reflection table uses a std::map which is
+      // not thread safe, so the view looks up the columns once and the jobs
+      // only access it while holding a lock. This avoids converting the whole
+      // table to an array of reflection objects and back.
+      af::ReflectionTableView reflection_view(reflections);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
       // integration after each image is processed.
-      Lookup lookup(bbox, zstart, zsize);
+      Lookup lookup(bbox, panel, zstart, zsize);
+
+      // Record the time taken reading the images and by each calculator
+      TelemetryRecorder telemetry(nthreads, buffer_size);
 
       // Create the reflection parallel_reference_profiler. This class is called for
       // each reflection to integrate the data
@@ -511,23 +559,31 @@ namespace dials { namespace algorithms {
                                                               zstart,
                                                               underload,
                                                               overload,
-                                                              debug);
+                                                              debug,
+                                                              &telemetry);
 
       // Do the integration
       process(lookup,
               parallel_reference_profiler,
               buffer,
-              reflection_array.ref(),
+              reflection_view,
               overlaps,
               imageset,
               bbox,
+              panel,
               flags,
               nthreads,
+              numa_nodes,
               use_dynamic_mask,
-              logger);
-
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+              prefetch,
+              batch_size,
+              logger,
+              telemetry,
+              pool);
+
+      // The results have been written to the reflection table
+      reflections_ = reflection_view.table();
+      telemetry_ = telemetry.telemetry();
     }
 
     /**
@@ -537,12 +593,22 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The telemetry from the reference profiling
+     */
+    IntegrationTelemetry telemetry() const {
+      return telemetry_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
+     * @param block_size The number of images in a block
+     * @param integer_buffer Store the image data as integer counts
      */
     static std::size_t compute_required_memory(ImageSequence imageset,
-                                               std::size_t block_size) {
+                                               std::size_t block_size,
+                                               bool integer_buffer = false) {
       DIALS_ASSERT(imageset.get_detector() != NULL);
       DIALS_ASSERT(imageset.get_scan() != NULL);
       Detector detector = *imageset.get_detector();
@@ -555,7 +621,10 @@ namespace dials { namespace algorithms {
         nelements += xsize * ysize;
       }
       nelements *= block_size;
-      std::size_t nbytes = nelements * sizeof(double);
+      std::size_t nbytes =
+        integer_buffer
+          ? (std::size_t)std::ceil(nelements * BufferBase::bytes_per_pixel(true))
+          : nelements * sizeof(double);
       return nbytes;
     }
 
@@ -563,9 +632,11 @@ namespace dials { namespace algorithms {
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
      * @param max_memory_usage The maximum memory usage
+     * @param integer_buffer Store the image data as integer counts
      */
     static std::size_t compute_max_block_size(ImageSequence imageset,
-                                              std::size_t max_memory_usage) {
+                                              std::size_t max_memory_usage,
+                                              bool integer_buffer = false) {
       DIALS_ASSERT(max_memory_usage > 0);
       DIALS_ASSERT(imageset.get_detector() != NULL);
       Detector detector = *imageset.get_detector();
@@ -575,7 +646,10 @@ namespace dials { namespace algorithms {
         std::size_t ysize = detector[i].get_image_size()[1];
         nelements += xsize * ysize;
       }
-      std::size_t nbytes = nelements * sizeof(double);
+      std::size_t nbytes =
+        integer_buffer
+          ? (std::size_t)std::ceil(nelements * BufferBase::bytes_per_pixel(true))
+          : nelements * sizeof(double);
       DIALS_ASSERT(nbytes > 0);
       DIALS_ASSERT(max_memory_usage > nbytes);
       return (std::size_t)std::floor((float)max_memory_usage / (float)nbytes);
@@ -593,6 +667,31 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Post a batch of reflections as a single job and clear the batch
+     */
+    template <typename ThreadPoolType>
+    void post_batch(BufferManager &bm,
+                    ThreadPoolType &pool,
+                    const ReflectionReferenceProfiler &parallel_reference_profiler,
+                    af::ReflectionTableView &reflections,
+                    const AdjacencyList &overlaps,
+                    af::const_ref<int6> bbox,
+                    std::vector<std::size_t> &batch) const {
+      if (batch.empty()) {
+        return;
+      }
+      bm.post_batch(pool,
+                    boost::bind(&ReflectionReferenceProfiler::operator(),
+                                boost::ref(parallel_reference_profiler),
+                                boost::placeholders::_1,
+                                boost::ref(reflections),
+                                boost::ref(overlaps)),
+                    batch,
+                    bbox);
+      batch.clear();
+    }
+
     /**
      * Do the processing by the following procedure.
      *
@@ -606,45 +705,74 @@ namespace dials { namespace algorithms {
     void process(const Lookup &lookup,
                  const ReflectionReferenceProfiler &parallel_reference_profiler,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
+                 af::ReflectionTableView &reflections,
                  const AdjacencyList &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
+                 af::const_ref<std::size_t> panel,
                  af::const_ref<std::size_t> flags,
                  std::size_t nthreads,
+                 std::size_t numa_nodes,
                  bool use_dynamic_mask,
-                 const Logger &logger) const {
-      using dials::util::ThreadPool;
-
-      // Create the thread pool
-      ThreadPool pool(nthreads);
+                 std::size_t prefetch,
+                 std::size_t batch_size,
+                 const Logger &logger,
+                 TelemetryRecorder &telemetry,
+                 boost::shared_ptr<WorkStealingThreadPool> shared_pool) const {
+      // Create the thread pool, with the workers grouped by node if the
+      // buffer is spread over the nodes, unless the pool is shared
+      boost::shared_ptr<WorkStealingThreadPool> pool_ptr = shared_pool;
+      if (pool_ptr == NULL) {
+        pool_ptr =
+          boost::make_shared<WorkStealingThreadPool>(nthreads, false, numa_nodes);
+      }
+      WorkStealingThreadPool &pool = *pool_ptr;
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
       std::size_t zsize = imageset.size();
 
       // Create the buffer manager
-      BufferManager bm(buffer, bbox, flags, zstart);
+      BufferManager bm(buffer, bbox, panel, flags, zstart);
+
+      // Start reading the images in the background
+      ImagePrefetcher prefetcher(imageset, use_dynamic_mask, prefetch);
 
       // Loop through all the images
       for (std::size_t i = 0; i < zsize; ++i) {
+        // Get the next image, which has usually already been read
+        double t0 = timestamp();
+        ImagePrefetcher::Frame frame = prefetcher.next();
+        double t1 = timestamp();
+
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
-        // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
-        } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
+        // threads to finish so that we don't end up reading the wrong data. The
+        // GIL is released while waiting so the next images can be read.
+        {
+          ScopedReleaseGIL release;
+          bm.wait_until_ready(pool, i);
+        }
+        double t2 = timestamp();
+        if (frame.rejected) {
+          bm.copy_when_ready(frame.data, false, i);
+        } else if (frame.has_mask) {
+          bm.copy_when_ready(frame.data, frame.mask, i);
         } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
+          bm.copy_when_ready(frame.data, i);
         }
+        double t3 = timestamp();
+        telemetry.add_read_time(t1 - t0);
+        telemetry.add_wait_time(t2 - t1);
+        telemetry.add_image(t3 - t2, bm.occupancy(i));
 
         // Get the reflections recorded at this point
         af::const_ref<std::size_t> indices = lookup.indices(i);
 
-        // Iterate through the reflection indices
+        // Iterate through the reflection indices. The reflections are ordered
+        // by position on the image so each batch is close together.
         std::size_t count = 0;
+        std::vector<std::size_t> batch;
         for (std::size_t j = 0; j < indices.size(); ++j) {
           // Get the reflection index
           std::size_t k = indices[j];
@@ -661,16 +789,25 @@ namespace dials { namespace algorithms {
           }
 
           // Post the integration job
-          bm.post(
-            pool,
-            boost::bind(&ReflectionReferenceProfiler::operator(),
-                        boost::ref(parallel_reference_profiler),
-                        k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
-                        boost::ref(overlaps)),
-            bbox[k][4]);
+          if (batch_size <= 1) {
+            bm.post(pool,
+                    boost::bind(&ReflectionReferenceProfiler::operator(),
+                                boost::ref(parallel_reference_profiler),
+                                k,
+                                boost::ref(reflections),
+                                boost::ref(overlaps)),
+                    k);
+          } else {
+            batch.push_back(k);
+            if (batch.size() == batch_size) {
+              post_batch(bm, pool, parallel_reference_profiler, reflections, overlaps, bbox, batch);
+            }
+          }
         }
 
+        // Post any remaining jobs for this image
+        post_batch(bm, pool, parallel_reference_profiler, reflections, overlaps, bbox, batch);
+
         // Print some output
         std::ostringstream ss;
         ss << "Modelling " << std::setw(5) << count << " reflections on image "
@@ -679,10 +816,14 @@ namespace dials { namespace algorithms {
       }
 
       // Wait for all the integration jobs to complete
-      bm.wait(pool);
+      {
+        ScopedReleaseGIL release;
+        bm.wait(pool);
+      }
     }
 
     af::reflection_table reflections_;
+    IntegrationTelemetry telemetry_;
   };
 
 }}  // namespace dials::algorithms
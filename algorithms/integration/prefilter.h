@@ -0,0 +1,156 @@
+/*
+ * prefilter.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_PREFILTER_H
+#define DIALS_ALGORITHMS_INTEGRATION_PREFILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * Apply the cuts made to the predicted reflections before integration in
+   * a single pass over the table. Reflections with too small a zeta factor or
+   * outside the resolution limits are flagged as DontIntegrate, so the
+   * integrators never allocate shoeboxes for them, and reflections in any of
+   * the powder rings are flagged as InPowderRing. The rings are merged and
+   * sorted when they are added, so each reflection is checked against them
+   * with a binary search rather than once per ring.
+   */
+  class IntegrationPrefilter {
+  public:
+    typedef std::pair<double, double> range_type;
+
+    /**
+     * @param min_zeta The minimum absolute value of zeta, or 0 for none
+     * @param d_min The highest resolution to integrate, or 0 for none
+     * @param d_max The lowest resolution to integrate, or 0 for none
+     */
+    IntegrationPrefilter(double min_zeta = 0, double d_min = 0, double d_max = 0)
+        : min_zeta_(min_zeta), d_min_(d_min), d_max_(d_max) {
+      DIALS_ASSERT(min_zeta >= 0);
+      DIALS_ASSERT(d_min >= 0);
+      DIALS_ASSERT(d_max >= 0);
+      DIALS_ASSERT(d_max == 0 || d_max > d_min);
+    }
+
+    /**
+     * Add a powder ring
+     * @param d_star_sq_min The inner edge of the ring in 1/d^2
+     * @param d_star_sq_max The outer edge of the ring in 1/d^2
+     */
+    void add_ring(double d_star_sq_min, double d_star_sq_max) {
+      DIALS_ASSERT(d_star_sq_min <= d_star_sq_max);
+      range_type ring(d_star_sq_min, d_star_sq_max);
+      std::vector<range_type>::iterator it =
+        std::lower_bound(rings_.begin(), rings_.end(), ring);
+      it = rings_.insert(it, ring);
+
+      // Merge the ring with any that it overlaps
+      if (it != rings_.begin() && (it - 1)->second >= it->first) {
+        --it;
+        it->second = std::max(it->second, (it + 1)->second);
+        rings_.erase(it + 1);
+      }
+      while (it + 1 != rings_.end() && (it + 1)->first <= it->second) {
+        it->second = std::max(it->second, (it + 1)->second);
+        rings_.erase(it + 1);
+      }
+    }
+
+    /** @returns The number of separate rings */
+    std::size_t num_rings() const {
+      return rings_.size();
+    }
+
+    /**
+     * @param d The resolution
+     * @returns Is the resolution within one of the rings
+     */
+    bool in_ring(double d) const {
+      if (rings_.empty() || !(d > 0)) {
+        return false;
+      }
+      double d_star_sq = 1.0 / (d * d);
+      std::vector<range_type>::const_iterator it = std::upper_bound(
+        rings_.begin(), rings_.end(), range_type(d_star_sq, rings_.back().second));
+      return it != rings_.begin() && d_star_sq <= (it - 1)->second;
+    }
+
+    /**
+     * @param d The resolutions
+     * @returns Is each resolution within one of the rings
+     */
+    af::shared<bool> in_rings(const af::const_ref<double> &d) const {
+      af::shared<bool> result(d.size(), false);
+      for (std::size_t i = 0; i < d.size(); ++i) {
+        result[i] = in_ring(d[i]);
+      }
+      return result;
+    }
+
+    /**
+     * @param zeta The zeta factor
+     * @param d The resolution
+     * @returns Should the reflection be integrated
+     */
+    bool is_integrable(double zeta, double d) const {
+      if (std::abs(zeta) < min_zeta_) {
+        return false;
+      }
+      if (d_min_ > 0 && d < d_min_) {
+        return false;
+      }
+      if (d_max_ > 0 && d > d_max_) {
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * Set the flags of the reflections
+     * @param zeta The zeta factors (empty for stills)
+     * @param d The resolutions
+     * @param flags The reflection flags
+     * @returns The number of reflections newly flagged as DontIntegrate
+     */
+    std::size_t apply(const af::const_ref<double> &zeta,
+                      const af::const_ref<double> &d,
+                      af::ref<std::size_t> flags) const {
+      DIALS_ASSERT(zeta.size() == 0 || zeta.size() == d.size());
+      DIALS_ASSERT(d.size() == flags.size());
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < d.size(); ++i) {
+        double z = zeta.size() > 0 ? zeta[i] : 1.0;
+        if (!is_integrable(z, d[i]) && !(flags[i] & af::DontIntegrate)) {
+          flags[i] |= af::DontIntegrate;
+          count++;
+        }
+        if (in_ring(d[i])) {
+          flags[i] |= af::InPowderRing;
+        }
+      }
+      return count;
+    }
+
+  private:
+    double min_zeta_;
+    double d_min_;
+    double d_max_;
+    std::vector<range_type> rings_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_PREFILTER_H
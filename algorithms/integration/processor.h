@@ -19,11 +19,18 @@
 #include <numeric>
 #include <list>
 #include <vector>
+#ifdef _WIN32
 #include <ctime>
+#else
+#include <time.h>
+#endif
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
+#include <dials/util/profile.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/algorithms/integration/telemetry.h>
 
 namespace dials { namespace algorithms {
 
@@ -31,15 +38,6 @@ namespace dials { namespace algorithms {
   using model::Shoebox;
   using model::Valid;
 
-  /**
-   * The cctbx build system is too messed up to figure out how to build
-   * boost::system need by boost::chrono. Therefore just use system clock
-   * to get a timestamp in ms
-   */
-  double timestamp() {
-    return ((double)clock()) / ((double)CLOCKS_PER_SEC);
-  }
-
   /**
    * A base class for executor callbacks
    */
@@ -62,7 +60,8 @@ namespace dials { namespace algorithms {
                      std::size_t npanels,
                      int frame0,
                      int frame1,
-                     bool save)
+                     bool save,
+                     std::size_t nthreads = 1)
         : data_(data),
           extract_time_(0.0),
           process_time_(0.0),
@@ -71,9 +70,11 @@ namespace dials { namespace algorithms {
           frame0_(frame0),
           frame1_(frame1),
           frame_(frame0),
-          nframes_(frame1 - frame0) {
+          nframes_(frame1 - frame0),
+          nthreads_(nthreads) {
       DIALS_ASSERT(frame0_ < frame1_);
       DIALS_ASSERT(npanels_ > 0);
+      DIALS_ASSERT(nthreads_ > 0);
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.contains("shoebox"));
       DIALS_ASSERT(data.size() > 0);
@@ -112,6 +113,9 @@ namespace dials { namespace algorithms {
 
     /**
      * Extract the pixels from the image and copy to the relevant shoeboxes.
+     * The shoeboxes recorded on the frame are split into blocks which are
+     * extracted on separate threads; each shoebox is on a single panel so
+     * no two threads write to the same shoebox.
      * @param image The image to process
      * @param frame The current image frame
      */
@@ -119,78 +123,30 @@ namespace dials { namespace algorithms {
     void next(const Image<T>& image, Executor& executor) {
       using dials::af::boost_python::flex_table_suite::select_rows_index;
       using dials::af::boost_python::flex_table_suite::set_selected_rows_index;
-      typedef Shoebox<>::float_type float_type;
-      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
-      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
       DIALS_ASSERT(frame_ >= frame0_ && frame_ < frame1_);
       DIALS_ASSERT(image.npanels() == npanels_);
 
       // Get the initial time
+      DIALS_PROFILE_SCOPE("integration.next");
       double start_time = timestamp();
 
       // For each image, extract shoeboxes of reflections recorded.
-      // Allocate data where necessary
+      // Allocate data where necessary. The shoeboxes of all the panels on this
+      // frame are in one contiguous range of the index array.
       af::ref<Shoebox<> > shoebox = data_["shoebox"];
+      std::size_t j0 = (frame_ - frame0_) * npanels_;
+      ExtractJob<T> job = {this, &image, shoebox, j0};
+      dials::util::parallel_for(
+        offset_[j0 + npanels_] - offset_[j0], nthreads_, job);
+
+      // Find the reflections which are complete on this frame
       af::shared<std::size_t> process_indices;
       for (std::size_t p = 0; p < image.npanels(); ++p) {
         af::const_ref<std::size_t> ind = indices(frame_, p);
-        af::const_ref<T, af::c_grid<2> > data = image.data(p);
-        af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+        af::c_grid<2> grid = image.data(p).accessor();
         for (std::size_t i = 0; i < ind.size(); ++i) {
-          DIALS_ASSERT(ind[i] < shoebox.size());
-          Shoebox<>& sbox = shoebox[ind[i]];
-          if (frame_ == sbox.bbox[4]) {
-            DIALS_ASSERT(sbox.is_allocated() == false);
-            sbox.allocate();
-          }
-          int6 b = sbox.bbox;
-          sbox_data_type sdata = sbox.data.ref();
-          sbox_mask_type smask = sbox.mask.ref();
-          DIALS_ASSERT(b[1] > b[0]);
-          DIALS_ASSERT(b[3] > b[2]);
-          DIALS_ASSERT(b[5] > b[4]);
-          DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
-          int x0 = b[0];
-          int x1 = b[1];
-          int y0 = b[2];
-          int y1 = b[3];
-          int z0 = b[4];
-          int xs = x1 - x0;
-          int ys = y1 - y0;
-          int z = frame_ - z0;
-          int yi = (int)data.accessor()[0];
-          int xi = (int)data.accessor()[1];
-          int xb = x0 >= 0 ? 0 : std::abs(x0);
-          int yb = y0 >= 0 ? 0 : std::abs(y0);
-          int xe = x1 <= xi ? xs : xs - (x1 - xi);
-          int ye = y1 <= yi ? ys : ys - (y1 - yi);
-          if (yb >= ye || xb >= xe) {
-            continue;
-          }
-          DIALS_ASSERT(yb >= 0 && ye <= ys);
-          DIALS_ASSERT(xb >= 0 && xe <= xs);
-          DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
-          DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
-          DIALS_ASSERT(sbox.is_consistent());
-          if (flatten_) {
-            for (std::size_t y = yb; y < ye; ++y) {
-              for (std::size_t x = xb; x < xe; ++x) {
-                sdata(0, y, x) += data(y + y0, x + x0);
-                bool sv = smask(0, y, x) & Valid;
-                bool mv = mask(y + y0, x + x0);
-                smask(0, y, x) = (mv && (z == 0 ? true : sv) ? Valid : 0);
-              }
-            }
-          } else {
-            for (std::size_t y = yb; y < ye; ++y) {
-              for (std::size_t x = xb; x < xe; ++x) {
-                sdata(z, y, x) = data(y + y0, x + x0);
-                smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
-              }
-            }
-          }
-          if (frame_ == sbox.bbox[5] - 1) {
+          const Shoebox<>& sbox = shoebox[ind[i]];
+          if (frame_ == sbox.bbox[5] - 1 && overlaps_image(sbox.bbox, grid)) {
             process_indices.push_back(ind[i]);
           }
         }
@@ -202,6 +158,8 @@ namespace dials { namespace algorithms {
 
       // Process all the reflections and set the reflections
       if (process_indices.size() > 0) {
+        DIALS_PROFILE_SCOPE("integration.process");
+        DIALS_PROFILE_COUNT("integration.reflections", process_indices.size());
         double start_time = timestamp();
         af::const_ref<std::size_t> ind = process_indices.const_ref();
         af::reflection_table reflections = select_rows_index(data_, ind);
@@ -266,7 +224,119 @@ namespace dials { namespace algorithms {
       return process_time_;
     }
 
+    /** @returns The number of threads used to extract the pixels */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
   private:
+    /**
+     * Extract the pixels of a block of the shoeboxes recorded on the current
+     * frame. The block is given as positions in the contiguous range of the
+     * index array for the frame, starting at offset_[j0].
+     */
+    template <typename T>
+    struct ExtractJob {
+      ShoeboxProcessor* processor;
+      const Image<T>* image;
+      af::ref<Shoebox<> > shoebox;
+      std::size_t j0;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const std::vector<std::size_t>& offset = processor->offset_;
+        std::size_t base = offset[j0];
+        std::size_t p = std::upper_bound(offset.begin() + j0,
+                                         offset.begin() + j0 + processor->npanels_,
+                                         base + first)
+                        - (offset.begin() + j0) - 1;
+        for (std::size_t i = first; i < last; ++i) {
+          while (base + i >= offset[j0 + p + 1]) {
+            ++p;
+          }
+          std::size_t index = processor->indices_[base + i];
+          DIALS_ASSERT(index < shoebox.size());
+          processor->extract(
+            image->data(p), image->mask(p), shoebox[index], processor->frame_);
+        }
+      }
+    };
+
+    /**
+     * Check if any of the pixels of a bounding box are on the image
+     */
+    static bool overlaps_image(const int6& b, const af::c_grid<2>& grid) {
+      return b[0] < (int)grid[1] && b[1] > 0 && b[2] < (int)grid[0] && b[3] > 0;
+    }
+
+    /**
+     * Copy the pixels of a frame to a shoebox, allocating the shoebox on its
+     * first frame.
+     * @param data The image data
+     * @param mask The image mask
+     * @param sbox The shoebox
+     * @param frame The frame
+     */
+    template <typename T>
+    void extract(const af::const_ref<T, af::c_grid<2> >& data,
+                 const af::const_ref<bool, af::c_grid<2> >& mask,
+                 Shoebox<>& sbox,
+                 int frame) const {
+      typedef Shoebox<>::float_type float_type;
+      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
+      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
+      DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+      if (frame == sbox.bbox[4]) {
+        DIALS_ASSERT(sbox.is_allocated() == false);
+        sbox.allocate();
+      }
+      int6 b = sbox.bbox;
+      sbox_data_type sdata = sbox.data.ref();
+      sbox_mask_type smask = sbox.mask.ref();
+      DIALS_ASSERT(b[1] > b[0]);
+      DIALS_ASSERT(b[3] > b[2]);
+      DIALS_ASSERT(b[5] > b[4]);
+      DIALS_ASSERT(frame >= b[4] && frame < b[5]);
+      int x0 = b[0];
+      int x1 = b[1];
+      int y0 = b[2];
+      int y1 = b[3];
+      int z0 = b[4];
+      int xs = x1 - x0;
+      int ys = y1 - y0;
+      int z = frame - z0;
+      int yi = (int)data.accessor()[0];
+      int xi = (int)data.accessor()[1];
+      int xb = x0 >= 0 ? 0 : std::abs(x0);
+      int yb = y0 >= 0 ? 0 : std::abs(y0);
+      int xe = x1 <= xi ? xs : xs - (x1 - xi);
+      int ye = y1 <= yi ? ys : ys - (y1 - yi);
+      if (yb >= ye || xb >= xe) {
+        return;
+      }
+      DIALS_ASSERT(yb >= 0 && ye <= ys);
+      DIALS_ASSERT(xb >= 0 && xe <= xs);
+      DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
+      DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
+      DIALS_ASSERT(sbox.is_consistent());
+      if (flatten_) {
+        for (std::size_t y = yb; y < ye; ++y) {
+          for (std::size_t x = xb; x < xe; ++x) {
+            sdata(0, y, x) += data(y + y0, x + x0);
+            bool sv = smask(0, y, x) & Valid;
+            bool mv = mask(y + y0, x + x0);
+            smask(0, y, x) = (mv && (z == 0 ? true : sv) ? Valid : 0);
+          }
+        }
+      } else {
+        for (std::size_t y = yb; y < ye; ++y) {
+          for (std::size_t x = xb; x < xe; ++x) {
+            sdata(z, y, x) = data(y + y0, x + x0);
+            smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
+          }
+        }
+      }
+    }
+
     /**
      * Get an index array specifying which reflections are recorded on a given
      * frame and panel.
@@ -297,6 +367,7 @@ namespace dials { namespace algorithms {
     int frame1_;
     int frame_;
     std::size_t nframes_;
+    std::size_t nthreads_;
     std::vector<std::size_t> indices_;
     std::vector<std::size_t> offset_;
   };
@@ -1,3 +1,4 @@
+import contextlib
 import itertools
 import logging
 import math
@@ -13,17 +14,25 @@
 import dials.algorithms.integration
 import dials.util
 import dials.util.log
+from dials.algorithms.integration.checkpoint import JobCheckpoint
 from dials.array_family import flex
 from dials.model.data import make_image
 from dials.util import tabulate
 from dials.util.log import rehandle_cached_records
-from dials.util.mp import available_cores, multi_node_parallel_map
+from dials.util.mp import (
+    available_cores,
+    mpi_parallel_map,
+    mpi_world,
+    multi_node_parallel_map,
+)
+from dials.util.shared_store import SharedReflections, SharedStore
 from dials_algorithms_integration_integrator_ext import (
     Executor,
     Group,
     GroupList,
     Job,
     JobList,
+    ReflectionBuckets,
     ReflectionManager,
     ReflectionManagerPerImage,
     ShoeboxProcessor,
@@ -54,10 +63,12 @@
     "ProcessorFlat3D",
     "ProcessorSingle2D",
     "ProcessorStills",
+    "ReflectionBuckets",
     "ReflectionManager",
     "ReflectionManagerPerImage",
     "Shoebox",
     "ShoeboxProcessor",
+    "stream_job_reflections",
     "Task",
 ]
 
@@ -161,6 +172,79 @@ def _average_bbox_size(reflections):
     return xsize, ysize, zsize
 
 
+def stream_job_reflections(
+    experiments, jobs, prepare, dmin=None, margin=1, padding=0, nthreads=1
+):
+    """
+    Predict the reflections for scan static experiments in frame order and
+    yield the reflections for each job as soon as no more can be added to it.
+
+    For each group of jobs the frames are predicted up to the end of each job
+    in turn and the predictions added to a ReflectionBuckets. A job is ready
+    once the predictions have passed its last frame by more than the job
+    overlap, or the largest distance yet seen between the predicted frame of a
+    reflection and the start of its bounding box if that is larger, so only
+    the reflections of the jobs around the current frame are held in memory.
+
+    :param experiments: The experiment list
+    :param jobs: The job list
+    :param prepare: A function called with each table of predictions, which
+                    must add the bbox column and may set the flags
+    :param dmin: The maximum resolution
+    :param margin: The margin to predict around
+    :param padding: Padding in degrees
+    :param nthreads: The number of threads for prediction
+    :returns: An iterator of (job index, reflections), followed by (None,
+              reflections) with the reflections not to be integrated
+    """
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+
+    buckets = ReflectionBuckets(jobs)
+    groups = jobs.groups()
+    for group_index in range(len(groups)):
+        group = groups[group_index]
+        i0, i1 = group.expr()
+        j0, j1 = group.index()
+        predictors = [
+            ScanStaticReflectionPredictor(
+                experiments[i], dmin=dmin, margin=margin, padding=padding
+            )
+            for i in range(i0, i1)
+        ]
+        frame0 = min(p.frame_range()[0] for p in predictors)
+        frame1 = max(p.frame_range()[1] for p in predictors)
+        ends = sorted({jobs[j].frames()[1] for j in range(j0, j1)})
+        ends = [min(max(e, frame0), frame1) for e in ends[:-1]] + [frame1]
+        lag = max(
+            [jobs[j].frames()[1] - jobs[j + 1].frames()[0] for j in range(j0, j1 - 1)],
+            default=0,
+        )
+        for end in ends:
+            for i, predictor in zip(range(i0, i1), predictors):
+                z0, z1 = predictor.frame_range()
+                first, last = max(frame0, z0), min(end, z1)
+                if last <= first:
+                    continue
+                table = predictor.for_ub_on_frame_range(
+                    experiments[i].crystal.get_A(), first, last, nthreads=nthreads
+                )
+                if len(table) == 0:
+                    continue
+                table["id"] = flex.int(len(table), i)
+                if experiments[i].identifier:
+                    table.experiment_identifiers()[i] = experiments[i].identifier
+                prepare(table)
+                z = flex.floor(table["xyzcal.px"].parts()[2]).iround()
+                lag = max(lag, flex.max(z - table["bbox"].parts()[4]))
+                buckets.add(table)
+            frame0 = end
+            ready_frame = end - lag if end != ends[-1] else group.frames()[1]
+            for index in buckets.ready(group_index, ready_frame):
+                yield index, buckets.take(index)
+    assert buckets.finished(), "Not all the jobs were processed"
+    yield None, buckets.unassigned()
+
+
 @boost_adaptbx.boost.python.inject_into(Executor)
 class _:
     @staticmethod
@@ -188,6 +272,7 @@ def __init__(self):
         self.njobs = 1
         self.nthreads = 1
         self.n_subset_split = None
+        self.share_data = True
 
     def update(self, other):
         self.method = other.method
@@ -195,6 +280,7 @@ def update(self, other):
         self.njobs = other.njobs
         self.nthreads = other.nthreads
         self.n_subset_split = other.n_subset_split
+        self.share_data = other.share_data
 
 
 class Lookup:
@@ -261,6 +347,20 @@ def update(self, other):
         self.separate_files = other.separate_files
 
 
+class Checkpoint:
+    """
+    Checkpoint parameters
+    """
+
+    def __init__(self):
+        self.directory = None
+        self.keep = False
+
+    def update(self, other):
+        self.directory = other.directory
+        self.keep = other.keep
+
+
 class Parameters:
     """
     Class to handle parameters for the processor
@@ -275,6 +375,7 @@ def __init__(self):
         self.block = Block()
         self.shoebox = Shoebox()
         self.debug = Debug()
+        self.checkpoint = Checkpoint()
 
     def update(self, other):
         """
@@ -285,6 +386,7 @@ def update(self, other):
         self.block.update(other.block)
         self.shoebox.update(other.shoebox)
         self.debug.update(other.debug)
+        self.checkpoint.update(other.checkpoint)
 
 
 def execute_parallel_task(task):
@@ -350,7 +452,11 @@ def process(self):
             mp_nproc = min(mp_nproc, len(self.manager))
             mp_njobs = int(math.ceil(len(self.manager) / mp_nproc))
         logger.info(self.manager.summary())
-        if mp_njobs > 1:
+        if mp_method == "mpi":
+            logger.info(
+                " Using MPI with %d worker rank(s)\n", max(mpi_world().Get_size() - 1, 1)
+            )
+        elif mp_njobs > 1:
             assert mp_method != "none" and mp_method is not None
             logger.info(
                 " Using %s with %d parallel job(s) and %d processes per node\n",
@@ -361,24 +467,59 @@ def process(self):
         else:
             logger.info(" Using multiprocessing with %d parallel job(s)\n", mp_nproc)
 
-        if mp_njobs * mp_nproc > 1:
+        if mp_method == "mpi":
 
             def process_output(result):
                 rehandle_cached_records(result[1])
                 self.manager.accumulate(result[0])
 
-            multi_node_parallel_map(
+            # The tasks are created one at a time and the results accumulated
+            # as they arrive from the worker ranks
+            mpi_parallel_map(
                 func=execute_parallel_task,
-                iterable=list(self.manager.tasks()),
-                njobs=mp_njobs,
-                nproc=mp_nproc,
+                iterable=self.manager.tasks(),
                 callback=process_output,
-                cluster_method=mp_method,
-                preserve_order=True,
             )
+        elif mp_njobs * mp_nproc > 1:
+
+            def process_output(result):
+                rehandle_cached_records(result[1])
+                self.manager.accumulate(result[0])
+
+            # The worker processes of a local run read the experiments, the
+            # executor and the reflections of the tasks from a shared store
+            # rather than having them pickled into every task
+            with contextlib.ExitStack() as stack:
+                tasks = list(self.manager.tasks())
+                if mp_method == "multiprocessing" and self.manager.params.mp.share_data:
+                    store = stack.enter_context(SharedStore())
+                    for task in tasks:
+                        task.share(store)
+                    logger.debug(
+                        "Shared %.1f MB of task data in %s",
+                        store.nbytes() / 1e6,
+                        store.directory,
+                    )
+                multi_node_parallel_map(
+                    func=execute_parallel_task,
+                    iterable=tasks,
+                    njobs=mp_njobs,
+                    nproc=mp_nproc,
+                    callback=process_output,
+                    cluster_method=mp_method,
+                    preserve_order=True,
+                )
         else:
-            for task in self.manager.tasks():
-                self.manager.accumulate(task())
+            # With the tasks run one at a time, use the processors for the
+            # threaded extraction of the shoebox pixels
+            mp = self.manager.params.mp
+            nthreads = mp.nthreads
+            mp.nthreads = max(nthreads, mp.nproc)
+            try:
+                for task in self.manager.tasks():
+                    self.manager.accumulate(task())
+            finally:
+                mp.nthreads = nthreads
         self.manager.finalize()
         end_time = time()
         self.manager.time.user_time = end_time - start_time
@@ -428,12 +569,23 @@ def __init__(self, index, reflections):
         self.index = index
         self.reflections = reflections
 
+    def share(self, store):
+        """
+        Move the reflections into a shared store, so that only a handle to
+        them is pickled with the task.
+
+        :param store: The SharedStore
+        """
+        self.reflections = store.put_reflections(self.reflections)
+
     def __call__(self):
         """
         Do the processing.
 
         :return: The processed data
         """
+        if isinstance(self.reflections, SharedReflections):
+            self.reflections = self.reflections.load()
         return dials.algorithms.integration.Result(
             index=self.index,
             reflections=self.reflections,
@@ -470,6 +622,26 @@ def __init__(self, index, job, experiments, reflections, params, executor=None):
         self.reflections = reflections
         self.params = params
         self.executor = executor
+        self.shared = None
+
+    def share(self, store):
+        """
+        Move the experiments, parameters, executor and reflections into a
+        shared store, so that only handles to them are pickled with the task.
+        The experiments and parameters are the same for every task, so each
+        worker process only loads them once. The executor collects the results
+        of a task, so each task loads its own copy of it, with references to
+        the shared experiments.
+
+        :param store: The SharedStore
+        """
+        self.shared = (
+            store.put(self.experiments),
+            store.put(self.params),
+            store.put(self.executor, references=[self.experiments], cached=False),
+        )
+        self.experiments = self.params = self.executor = None
+        self.reflections = store.put_reflections(self.reflections)
 
     def __call__(self):
         """
@@ -480,6 +652,14 @@ def __call__(self):
         # Get the start time
         start_time = time()
 
+        # Load the data of a shared task
+        if self.shared is not None:
+            self.experiments, self.params, self.executor = (
+                handle.load() for handle in self.shared
+            )
+            self.reflections = self.reflections.load()
+            self.shared = None
+
         # Set the global process ID
         job.index = self.index
 
@@ -539,6 +719,7 @@ def __call__(self):
             frame0,
             frame1,
             self.params.debug.output,
+            nthreads=self.params.mp.nthreads,
         )
 
         # Loop through the imageset, extract pixels and process reflections
@@ -616,6 +797,9 @@ def __init__(self, experiments, reflections, params):
         # Initialise the callbacks
         self.executor = None
 
+        # The saved results of finished jobs, if any
+        self.checkpoint = None
+
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
@@ -654,6 +838,12 @@ def initialize(self):
         # Create the reflection manager
         self.manager = ReflectionManager(self.jobs, self.reflections)
 
+        # Save the results of each job as it finishes
+        if self.params.checkpoint.directory:
+            self.checkpoint = JobCheckpoint(
+                self.params.checkpoint.directory, type(self.executor).__name__
+            )
+
         # Set the initialization time
         self.time.initialize = time() - start_time
 
@@ -685,13 +875,18 @@ def task(self, index):
 
     def tasks(self):
         """
-        Iterate through the tasks.
+        Iterate through the tasks. The jobs which have already been saved to
+        the checkpoint are accumulated instead.
         """
-        for i in range(len(self)):
-            yield self.task(i)
+        tasks = (self.task(i) for i in range(len(self)))
+        if self.checkpoint is not None:
+            tasks = self.checkpoint.tasks(tasks, self.accumulate)
+        yield from tasks
 
     def accumulate(self, result):
         """Accumulate the results."""
+        if self.checkpoint is not None:
+            self.checkpoint.save(result)
         self.data[result.index] = result.data
         self.manager.accumulate(result.index, result.reflections)
         self.time.read += result.read_time
@@ -849,7 +1044,9 @@ def split_reflections(self):
                 )
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.mp.nproc
+        )
 
     def compute_processors(self):
         """
@@ -90,67 +90,46 @@ def overall_report(data):
 
     def binned_report(binner, index, data):
 
-        # Create the indexers
-        indexer_all = binner.indexer(index)
-        indexer_sum = binner.indexer(index.select(data["sum"]))
-        indexer_prf = binner.indexer(index.select(data["prf"]))
-        indexer_int = binner.indexer(index.select(data["int"]))
+        # Create the indexer
+        indexer = binner.indexer(index)
 
         # Add some stats by resolution
         report = {
             "bins": list(binner.bins()),
-            "n_full": list(indexer_all.sum(data["full"])),
-            "n_partial": list(indexer_all.sum(~data["full"])),
-            "n_overload": list(indexer_all.sum(data["over"])),
-            "n_ice": list(indexer_all.sum(data["ice"])),
-            "n_summed": list(indexer_all.sum(data["sum"])),
-            "n_fitted": list(indexer_all.sum(data["prf"])),
-            "n_integrated": list(indexer_all.sum(data["int"])),
-            "n_invalid_bg": list(indexer_all.sum(data["ninvbg"])),
-            "n_invalid_fg": list(indexer_all.sum(data["ninvfg"])),
-            "n_failed_background": list(indexer_all.sum(data["fbgd"])),
-            "n_failed_summation": list(indexer_all.sum(data["fsum"])),
-            "n_failed_fitting": list(indexer_all.sum(data["fprf"])),
+            "n_full": list(indexer.sum(data["full"])),
+            "n_partial": list(indexer.sum(~data["full"])),
+            "n_overload": list(indexer.sum(data["over"])),
+            "n_ice": list(indexer.sum(data["ice"])),
+            "n_summed": list(indexer.sum(data["sum"])),
+            "n_fitted": list(indexer.sum(data["prf"])),
+            "n_integrated": list(indexer.sum(data["int"])),
+            "n_invalid_bg": list(indexer.sum(data["ninvbg"])),
+            "n_invalid_fg": list(indexer.sum(data["ninvfg"])),
+            "n_failed_background": list(indexer.sum(data["fbgd"])),
+            "n_failed_summation": list(indexer.sum(data["fsum"])),
+            "n_failed_fitting": list(indexer.sum(data["fprf"])),
         }
 
-        # Compute mean background
-        try:
-            report["mean_background"] = list(
-                indexer_int.mean(data["background.mean"].select(data["int"]))
-            )
-        except Exception:
-            report["mean_background"] = [0.0] * len(binner)
-
-        # Compute mean I/Sigma summation
-        try:
-            report["ios_sum"] = list(
-                indexer_sum.mean(data["intensity.sum.ios"].select(data["sum"]))
-            )
-        except Exception:
-            report["ios_sum"] = [0.0] * len(binner)
-
-        # Compute mean I/Sigma profile fitting
-        try:
-            report["ios_prf"] = list(
-                indexer_prf.mean(data["intensity.prf.ios"].select(data["prf"]))
-            )
-        except Exception:
-            report["ios_prf"] = [0.0] * len(binner)
-
-        # Compute the mean profile correlation
-        try:
-            report["cc_prf"] = list(
-                indexer_prf.mean(data["profile.correlation"].select(data["prf"]))
+        # Compute the mean background, I/Sigma for summation and profile
+        # fitting, profile correlation and rmsd over the reflections they are
+        # defined for, in one pass over the data
+        means = [
+            ("mean_background", "background.mean", "int"),
+            ("ios_sum", "intensity.sum.ios", "sum"),
+            ("ios_prf", "intensity.prf.ios", "prf"),
+            ("cc_prf", "profile.correlation", "prf"),
+            ("rmsd_xy", "xyz.rmsd", "sum"),
+        ]
+        for name, _, _ in means:
+            report[name] = [0.0] * len(binner)
+        means = [m for m in means if m[1] in data]
+        if means:
+            stats = indexer.statistics(
+                [data[column] for _, column, _ in means],
+                mask=[data[selection] for _, _, selection in means],
             )
-        except Exception:
-            report["cc_prf"] = [0.0] * len(binner)
-
-        try:
-            report["rmsd_xy"] = list(
-                indexer_sum.mean(data["xyz.rmsd"].select(data["sum"]))
-            )
-        except Exception:
-            report["rmsd_xy"] = [0.0] * len(binner)
+            for i, (name, _, _) in enumerate(means):
+                report[name] = list(stats.mean(i))
 
         # Return the binned report
         return report
@@ -466,6 +445,7 @@ def __init__(self, experiments, fitter, reflections):
         table.cols.append(("y", "Y (px)"))
         table.cols.append(("z", "Z (im)"))
         table.cols.append(("n_reflections", "# reflections"))
+        table.cols.append(("negative", "Negative (%)"))
 
         # Create the summary for each profile model
         for i in range(len(fitter)):
@@ -480,6 +460,7 @@ def __init__(self, experiments, fitter, reflections):
                         f"{model.coord(j)[1]:.2f}",
                         f"{model.coord(j)[2]:.2f}",
                         "%d" % model.n_reflections(j),
+                        f"{100 * model.negative_fraction(j):.2f}",
                     ]
                 )
 
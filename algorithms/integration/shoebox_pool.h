@@ -0,0 +1,135 @@
+/*
+ * shoebox_pool.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
+#define DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Shoebox;
+  using scitbx::af::int6;
+
+  /**
+   * A cache of shoebox arrays which are recycled between reflections. Each
+   * thread has its own cache so taking and returning arrays needs no locking.
+   * The arrays keep their capacity when resized, so once the cache has warmed
+   * up allocating a shoebox usually needs no heap allocation for the pixel
+   * data. Arrays which are still referenced elsewhere when the shoebox is
+   * released, for example shoeboxes kept for debugging, are not recycled.
+   *
+   * The pool must outlive the threads which use it.
+   */
+  class ShoeboxPool : public boost::noncopyable {
+  public:
+    typedef Shoebox<>::float_type float_type;
+
+    /**
+     * @param max_cached The maximum number of shoeboxes cached per thread
+     */
+    ShoeboxPool(std::size_t max_cached = 4)
+        : max_cached_(max_cached), cache_(&ShoeboxPool::no_cleanup) {}
+
+    /**
+     * Allocate a shoebox with the data, mask and background set to zero
+     * @param panel The panel number
+     * @param bbox The bounding box
+     * @returns The shoebox
+     */
+    Shoebox<> allocate(std::size_t panel, const int6 &bbox) {
+      Shoebox<> shoebox(panel, bbox);
+      Cache &cache = local_cache();
+      if (cache.data.empty()) {
+        shoebox.allocate();
+        return shoebox;
+      }
+      af::c_grid<3> accessor(shoebox.zsize(), shoebox.ysize(), shoebox.xsize());
+      shoebox.data = take(cache.data, accessor);
+      shoebox.mask = take(cache.mask, accessor);
+      shoebox.background = take(cache.background, accessor);
+      return shoebox;
+    }
+
+    /**
+     * Return the arrays of a shoebox to the cache if nothing else holds them.
+     * The shoebox arrays are left empty.
+     * @param shoebox The shoebox
+     */
+    void release(Shoebox<> &shoebox) {
+      Cache &cache = local_cache();
+      if (cache.data.size() < max_cached_ && shoebox.data.use_count() == 1
+          && shoebox.mask.use_count() == 1 && shoebox.background.use_count() == 1) {
+        cache.data.push_back(shoebox.data);
+        cache.mask.push_back(shoebox.mask);
+        cache.background.push_back(shoebox.background);
+      }
+      shoebox.deallocate();
+    }
+
+  private:
+    /**
+     * The cached arrays for a single thread
+     */
+    struct Cache {
+      std::vector<af::versa<float_type, af::c_grid<3> > > data;
+      std::vector<af::versa<int, af::c_grid<3> > > mask;
+      std::vector<af::versa<float_type, af::c_grid<3> > > background;
+    };
+
+    /**
+     * The caches are owned by the pool so they do not need to be cleaned up
+     * when the threads exit
+     */
+    static void no_cleanup(Cache *) {}
+
+    /**
+     * Get the cache for the calling thread
+     */
+    Cache &local_cache() {
+      Cache *cache = cache_.get();
+      if (cache == NULL) {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        caches_.push_back(boost::make_shared<Cache>());
+        cache = caches_.back().get();
+        cache_.reset(cache);
+      }
+      return *cache;
+    }
+
+    /**
+     * Take an array from the cache, resize it and set it to zero
+     */
+    template <typename T>
+    static af::versa<T, af::c_grid<3> > take(
+      std::vector<af::versa<T, af::c_grid<3> > > &cache,
+      const af::c_grid<3> &accessor) {
+      af::versa<T, af::c_grid<3> > result = cache.back();
+      cache.pop_back();
+      result.resize(accessor, T(0));
+      std::fill(result.begin(), result.end(), T(0));
+      return result;
+    }
+
+    std::size_t max_cached_;
+    boost::thread_specific_ptr<Cache> cache_;
+    std::vector<boost::shared_ptr<Cache> > caches_;
+    boost::mutex mutex_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_POOL_H
@@ -13,12 +13,16 @@
 
 
 def sum_integrate_and_update_table(
-    reflections: reflection_table, image_volume: MultiPanelImageVolume = None
+    reflections: reflection_table,
+    image_volume: MultiPanelImageVolume = None,
+    nthreads: int = 1,
 ) -> reflection_table:
     """Perform 3D summation integration and update a reflection table.
 
     Arguments:
         reflections: The reflections to integrate
+        image_volume: The image volume to sum, or None to use the shoeboxes
+        nthreads: The number of threads to use
 
     Returns:
         The integrated reflections
@@ -26,9 +30,9 @@ def sum_integrate_and_update_table(
 
     # Integrate and return the reflections
     if image_volume is None:
-        intensity = reflections["shoebox"].summed_intensity()
+        intensity = reflections["shoebox"].summed_intensity(nthreads=nthreads)
     else:
-        intensity = sum_image_volume(reflections, image_volume)
+        intensity = sum_image_volume(reflections, image_volume, nthreads=nthreads)
     reflections["intensity.sum.value"] = intensity.observed_value()
     reflections["intensity.sum.variance"] = intensity.observed_variance()
     reflections["background.sum.value"] = intensity.background_value()
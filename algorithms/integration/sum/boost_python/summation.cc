@@ -100,7 +100,11 @@ namespace dials { namespace algorithms { namespace boost_python {
     summation_suite<float>();
     summation_suite<double>();
 
-    def("sum_image_volume", &sum_multi_panel_image_volume<float>);
+    def("sum_image_volume",
+        &sum_multi_panel_image_volume<float>,
+        (boost::python::arg("reflections"),
+         boost::python::arg("volume"),
+         boost::python::arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
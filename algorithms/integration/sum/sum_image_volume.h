@@ -11,9 +11,12 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_SUM_SUM_IMAGE_VOLUME_H
 #define DIALS_ALGORITHMS_INTEGRATION_SUM_SUM_IMAGE_VOLUME_H
 
+#include <vector>
 #include <dials/array_family/reflection_table.h>
+#include <dials/algorithms/integration/sum/summation.h>
 #include <dials/model/data/image_volume.h>
 #include <dials/model/data/observation.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace algorithms {
 
@@ -27,7 +30,7 @@ namespace dials { namespace algorithms {
   template <typename FloatType>
   Intensity sum_image_volume(std::size_t index,
                              int6 bbox,
-                             ImageVolume<FloatType> volume,
+                             const ImageVolume<FloatType> &volume,
                              bool success) {
     // Trim the bbox
     int6 trimmed_bbox = volume.trim_bbox(bbox);
@@ -48,13 +51,41 @@ namespace dials { namespace algorithms {
     return result;
   }
 
+  namespace detail {
+
+    template <typename FloatType>
+    struct SumImageVolumeJob {
+      const ImageVolume<FloatType> *volumes;
+      std::size_t num_panels;
+      const int6 *bbox;
+      const std::size_t *panel;
+      const double *fraction;
+      Intensity *intensity;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          DIALS_ASSERT(panel[i] < num_panels);
+          intensity[i] = sum_image_volume(
+            i, bbox[i], volumes[panel[i]], fraction[i] > 1.0 - 1e-6);
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
-   * Compute summation intensities from all reflections
+   * Compute summation intensities from all reflections, splitting the
+   * reflections between threads
+   * @param reflections The reflections
+   * @param volume The image volume
+   * @param nthreads The number of threads
+   * @returns The intensities
    */
   template <typename FloatType>
   af::shared<Intensity> sum_multi_panel_image_volume(
     af::reflection_table reflections,
-    MultiPanelImageVolume<FloatType> volume) {
+    MultiPanelImageVolume<FloatType> volume,
+    std::size_t nthreads = 1) {
     DIALS_ASSERT(reflections.contains("bbox"));
     DIALS_ASSERT(reflections.contains("panel"));
     DIALS_ASSERT(reflections.contains("fraction"));
@@ -62,10 +93,24 @@ namespace dials { namespace algorithms {
     af::const_ref<std::size_t> panel = reflections["panel"];
     af::const_ref<double> fraction = reflections["fraction"];
     af::shared<Intensity> intensity(bbox.size());
-    for (std::size_t i = 0; i < bbox.size(); ++i) {
-      intensity[i] =
-        sum_image_volume(i, bbox[i], volume.get(panel[i]), fraction[i] > 1.0 - 1e-6);
+
+    // Get the panel volumes here so the threads only read them
+    std::vector<ImageVolume<FloatType> > volumes;
+    volumes.reserve(volume.size());
+    for (std::size_t i = 0; i < volume.size(); ++i) {
+      volumes.push_back(volume.get(i));
+    }
+    if (volumes.empty()) {
+      DIALS_ASSERT(bbox.size() == 0);
+      return intensity;
     }
+    detail::SumImageVolumeJob<FloatType> job = {&volumes[0],
+                                                volumes.size(),
+                                                bbox.begin(),
+                                                panel.begin(),
+                                                fraction.begin(),
+                                                intensity.begin()};
+    dials::util::parallel_for(bbox.size(), nthreads, job);
     return intensity;
   }
 
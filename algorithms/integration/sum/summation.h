@@ -15,6 +15,7 @@
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/tiny_algebra.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/algorithms/statistics/compensated_sum.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -140,30 +141,38 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(signal.size() == background.size());
       DIALS_ASSERT(signal.size() == mask.size());
 
-      // Calculate the signal and background intensity
-      int bg_code = Valid | Background | BackgroundUsed;
-      success_ = true;
-      n_background_ = 0;
-      n_signal_ = 0;
-      sum_p_ = 0.0;
-      sum_b_ = 0.0;
+      // Calculate the signal and background intensity. The pixels are
+      // classified with bit tests rather than nested branches, and the sums
+      // are accumulated in double precision with compensation so that
+      // reflections with many high-count pixels keep their precision.
+      const int bg_code = Valid | Background | BackgroundUsed;
+      const int fg_code = Valid | Overlapped;
+      CompensatedSum sum_p;
+      CompensatedSum sum_b;
+      std::size_t n_signal = 0;
+      std::size_t n_background = 0;
+      std::size_t n_failed = 0;
       for (std::size_t i = 0; i < signal.size(); ++i) {
-        if ((mask[i] & Foreground) == Foreground) {
-          if ((mask[i] & Valid) == Valid && (mask[i] & Overlapped) == 0) {
-            sum_p_ += signal[i];
-            sum_b_ += background[i];
-            n_signal_++;
-          } else {
-            success_ = false;
-          }
-        } else if ((mask[i] & bg_code) == bg_code) {
-          n_background_++;
+        int code = mask[i];
+        bool foreground = (code & Foreground) != 0;
+        bool good = (code & fg_code) == Valid;
+        n_signal += foreground && good;
+        n_failed += foreground && !good;
+        n_background += !foreground && (code & bg_code) == bg_code;
+        if (foreground && good) {
+          sum_p.add(signal[i]);
+          sum_b.add(background[i]);
         }
       }
+      success_ = n_failed == 0;
+      n_signal_ = n_signal;
+      n_background_ = n_background;
+      sum_p_ = sum_p.value();
+      sum_b_ = sum_b.value();
     }
 
-    FloatType sum_p_;
-    FloatType sum_b_;
+    double sum_p_;
+    double sum_b_;
     std::size_t n_background_;
     std::size_t n_signal_;
     bool success_;
@@ -0,0 +1,337 @@
+/*
+ * telemetry.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_TELEMETRY_H
+#define DIALS_ALGORITHMS_INTEGRATION_TELEMETRY_H
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <time.h>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The cctbx build system is too messed up to figure out how to build
+   * boost::system need by boost::chrono. Therefore use the monotonic clock
+   * directly to get a wall clock timestamp in seconds. The processor time
+   * from clock() is summed over all threads, so can't be used to time the
+   * threaded extraction. Windows has no monotonic clock in the C library, so
+   * falls back to clock(), which measures wall clock time there.
+   */
+  inline double timestamp() {
+#ifdef _WIN32
+    return ((double)clock()) / ((double)CLOCKS_PER_SEC);
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+#endif
+  }
+
+  /**
+   * A histogram of durations. The bins are spaced logarithmically with four
+   * bins per decade from 1 microsecond to 10 seconds. The first bin holds the
+   * durations shorter than 1 microsecond and the last bin those of 10 seconds
+   * or longer.
+   */
+  class TimingHistogram {
+  public:
+    enum { num_bins = 30, bins_per_decade = 4 };
+
+    TimingHistogram() : counts_(num_bins, 0), total_(0) {}
+
+    /**
+     * @param counts The number of durations in each bin
+     * @param total The sum of the durations in seconds
+     */
+    TimingHistogram(const af::const_ref<std::size_t> &counts, double total)
+        : counts_(counts.begin(), counts.end()), total_(total) {
+      DIALS_ASSERT(counts.size() == num_bins);
+      DIALS_ASSERT(total >= 0);
+    }
+
+    /**
+     * @returns The upper edges of all but the last bin in seconds
+     */
+    static af::shared<double> bin_edges() {
+      af::shared<double> result(num_bins - 1);
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = 1e-6 * std::pow(10.0, (double)i / bins_per_decade);
+      }
+      return result;
+    }
+
+    /**
+     * @param seconds The duration
+     * @returns The index of the bin holding the duration
+     */
+    static std::size_t bin_index(double seconds) {
+      if (!(seconds >= 1e-6)) {
+        return 0;
+      }
+      double k = std::floor(bins_per_decade * std::log10(seconds * 1e6)) + 1;
+      return std::min((std::size_t)k, (std::size_t)num_bins - 1);
+    }
+
+    /** @returns The number of durations in each bin */
+    af::shared<std::size_t> counts() const {
+      return counts_;
+    }
+
+    /** @returns The number of durations */
+    std::size_t count() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < counts_.size(); ++i) {
+        result += counts_[i];
+      }
+      return result;
+    }
+
+    /** @returns The sum of the durations in seconds */
+    double total() const {
+      return total_;
+    }
+
+    /** @returns The mean duration in seconds */
+    double mean() const {
+      std::size_t n = count();
+      return n > 0 ? total_ / n : 0.0;
+    }
+
+  private:
+    af::shared<std::size_t> counts_;
+    double total_;
+  };
+
+  /**
+   * A histogram of durations which can be added to from several threads at
+   * once. The durations are summed in nanoseconds so that only integer
+   * atomics are needed.
+   */
+  class AtomicTimingHistogram : public boost::noncopyable {
+  public:
+    AtomicTimingHistogram() : total_(0) {
+      for (std::size_t i = 0; i < TimingHistogram::num_bins; ++i) {
+        counts_[i] = 0;
+      }
+    }
+
+    /**
+     * Add a duration
+     * @param seconds The duration
+     */
+    void add(double seconds) {
+      seconds = std::max(seconds, 0.0);
+      counts_[TimingHistogram::bin_index(seconds)]++;
+      total_ += (boost::uint64_t)(seconds * 1e9);
+    }
+
+    /** @returns A copy of the histogram */
+    TimingHistogram histogram() const {
+      af::shared<std::size_t> counts(TimingHistogram::num_bins);
+      for (std::size_t i = 0; i < counts.size(); ++i) {
+        counts[i] = counts_[i];
+      }
+      return TimingHistogram(counts.const_ref(), 1e-9 * (double)total_);
+    }
+
+  private:
+    boost::atomic<boost::uint64_t> counts_[TimingHistogram::num_bins];
+    boost::atomic<boost::uint64_t> total_;
+  };
+
+  /**
+   * The telemetry from a run of one of the threaded integrators. The time
+   * spent by the main thread waiting for images to be read, waiting for room
+   * in the image buffer and copying images into it shows whether the run is
+   * limited by reading the images, while the thread utilisation and the time
+   * spent in each calculator show how well the processing of the reflections
+   * is spread over the threads. The buffer occupancy is the number of images
+   * in the buffer which are still needed by unfinished reflections, sampled
+   * each time an image is copied in.
+   */
+  struct IntegrationTelemetry {
+    std::size_t nthreads;
+    std::size_t buffer_size;
+    std::size_t num_images;
+    double wall_time;
+    double read_time;
+    double wait_time;
+    double copy_time;
+    double mean_occupancy;
+    std::size_t max_occupancy;
+    TimingHistogram extract;
+    TimingHistogram mask;
+    TimingHistogram background;
+    TimingHistogram intensity;
+    TimingHistogram reflection;
+
+    IntegrationTelemetry()
+        : nthreads(0),
+          buffer_size(0),
+          num_images(0),
+          wall_time(0),
+          read_time(0),
+          wait_time(0),
+          copy_time(0),
+          mean_occupancy(0),
+          max_occupancy(0) {}
+
+    /** @returns The number of reflections processed */
+    std::size_t num_reflections() const {
+      return reflection.count();
+    }
+
+    /** @returns The total time the threads spent processing reflections */
+    double busy_time() const {
+      return reflection.total();
+    }
+
+    /** @returns The number of reflections processed per second */
+    double reflections_per_second() const {
+      return wall_time > 0 ? num_reflections() / wall_time : 0.0;
+    }
+
+    /** @returns The fraction of the time the threads were busy */
+    double utilisation() const {
+      return wall_time > 0 && nthreads > 0 ? busy_time() / (wall_time * nthreads)
+                                           : 0.0;
+    }
+  };
+
+  /**
+   * Record the telemetry of a run of one of the threaded integrators. The
+   * image timings and the buffer occupancy are only recorded by the thread
+   * reading the images, while the calculator timings are recorded by all the
+   * threads processing reflections.
+   */
+  class TelemetryRecorder : public boost::noncopyable {
+  public:
+    enum Stage { Extract, Mask, Background, Intensity, Reflection };
+
+    /**
+     * Start recording
+     * @param nthreads The number of threads processing reflections
+     * @param buffer_size The number of images in the buffer
+     */
+    TelemetryRecorder(std::size_t nthreads, std::size_t buffer_size)
+        : nthreads_(nthreads),
+          buffer_size_(buffer_size),
+          num_images_(0),
+          start_time_(timestamp()),
+          read_time_(0),
+          wait_time_(0),
+          copy_time_(0),
+          total_occupancy_(0),
+          max_occupancy_(0) {}
+
+    /**
+     * Add the time taken by a stage of processing a reflection
+     * @param stage The stage
+     * @param seconds The duration
+     */
+    void add(Stage stage, double seconds) {
+      switch (stage) {
+      case Extract:
+        extract_.add(seconds);
+        break;
+      case Mask:
+        mask_.add(seconds);
+        break;
+      case Background:
+        background_.add(seconds);
+        break;
+      case Intensity:
+        intensity_.add(seconds);
+        break;
+      case Reflection:
+        reflection_.add(seconds);
+        break;
+      default:
+        DIALS_ERROR("Unknown stage");
+      }
+    }
+
+    /**
+     * Add the time spent waiting for an image to be read
+     * @param seconds The duration
+     */
+    void add_read_time(double seconds) {
+      read_time_ += seconds;
+    }
+
+    /**
+     * Add the time spent waiting for room in the buffer
+     * @param seconds The duration
+     */
+    void add_wait_time(double seconds) {
+      wait_time_ += seconds;
+    }
+
+    /**
+     * Add the time spent copying an image into the buffer and record the
+     * occupancy of the buffer once it has been copied
+     * @param seconds The duration
+     * @param occupancy The number of images in the buffer still needed
+     */
+    void add_image(double seconds, std::size_t occupancy) {
+      copy_time_ += seconds;
+      total_occupancy_ += occupancy;
+      max_occupancy_ = std::max(max_occupancy_, occupancy);
+      num_images_++;
+    }
+
+    /**
+     * @returns The telemetry recorded so far
+     */
+    IntegrationTelemetry telemetry() const {
+      IntegrationTelemetry result;
+      result.nthreads = nthreads_;
+      result.buffer_size = buffer_size_;
+      result.num_images = num_images_;
+      result.wall_time = timestamp() - start_time_;
+      result.read_time = read_time_;
+      result.wait_time = wait_time_;
+      result.copy_time = copy_time_;
+      result.mean_occupancy =
+        num_images_ > 0 ? (double)total_occupancy_ / num_images_ : 0.0;
+      result.max_occupancy = max_occupancy_;
+      result.extract = extract_.histogram();
+      result.mask = mask_.histogram();
+      result.background = background_.histogram();
+      result.intensity = intensity_.histogram();
+      result.reflection = reflection_.histogram();
+      return result;
+    }
+
+  private:
+    std::size_t nthreads_;
+    std::size_t buffer_size_;
+    std::size_t num_images_;
+    double start_time_;
+    double read_time_;
+    double wait_time_;
+    double copy_time_;
+    std::size_t total_occupancy_;
+    std::size_t max_occupancy_;
+    AtomicTimingHistogram extract_;
+    AtomicTimingHistogram mask_;
+    AtomicTimingHistogram background_;
+    AtomicTimingHistogram intensity_;
+    AtomicTimingHistogram reflection_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_TELEMETRY_H
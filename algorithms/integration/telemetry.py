@@ -0,0 +1,226 @@
+"""
+Summarise and export the telemetry from the threaded integrators.
+
+Each integration or reference profiling job records how long the main thread
+waited for images to be read, waited for room in the image buffer and spent
+copying images into it, together with histograms of the time taken by each
+stage of processing a reflection on the worker threads. The telemetry from
+each job is converted to a plain dictionary so that it can be returned from
+worker processes, and the dictionaries from all the jobs are merged at the
+end. The merged telemetry can be written as JSON or in the Prometheus text
+format.
+"""
+
+import json
+
+from dials.util import tabulate
+
+# The stages of processing each reflection with a timing histogram
+STAGES = ("extract", "mask", "background", "intensity", "reflection")
+
+# The times in seconds recorded by the thread reading the images
+TIMES = ("wall_time", "read_time", "wait_time", "copy_time")
+
+
+def _histogram_as_dict(histogram):
+    return {
+        "counts": list(histogram.counts()),
+        "count": histogram.count(),
+        "total": histogram.total(),
+    }
+
+
+def _add_derived(record):
+    """Add the values derived from the recorded timings."""
+    wall_time = record["wall_time"]
+    num_reflections = record["histograms"]["reflection"]["count"]
+    busy_time = record["histograms"]["reflection"]["total"]
+    record["num_reflections"] = num_reflections
+    record["busy_time"] = busy_time
+    record["reflections_per_second"] = (
+        num_reflections / wall_time if wall_time > 0 else 0.0
+    )
+    threads = record["nthreads"]
+    record["utilisation"] = (
+        busy_time / (wall_time * threads) if wall_time > 0 and threads > 0 else 0.0
+    )
+    record["read_fraction"] = record["read_time"] / wall_time if wall_time > 0 else 0.0
+    return record
+
+
+def as_dict(telemetry):
+    """
+    Convert the telemetry from an integration job to a dictionary.
+
+    :param telemetry: The IntegrationTelemetry object
+    :return: The telemetry as a dictionary
+    """
+    record = {
+        "jobs": 1,
+        "nthreads": telemetry.nthreads,
+        "buffer_size": telemetry.buffer_size,
+        "num_images": telemetry.num_images,
+        "mean_occupancy": telemetry.mean_occupancy,
+        "max_occupancy": telemetry.max_occupancy,
+        "bin_edges": list(telemetry.reflection.bin_edges()),
+        "histograms": {
+            stage: _histogram_as_dict(getattr(telemetry, stage)) for stage in STAGES
+        },
+    }
+    for name in TIMES:
+        record[name] = getattr(telemetry, name)
+    return _add_derived(record)
+
+
+def merge(records):
+    """
+    Merge the telemetry from several jobs. The times and counts are summed, so
+    the wall time is the total over all the jobs, and the threads are those of
+    a single job. Jobs which ran in parallel are not distinguished.
+
+    :param records: The telemetry dictionaries
+    :return: The merged dictionary, or None if there are none
+    """
+    records = [r for r in records if r is not None]
+    if not records:
+        return None
+    result = {
+        "jobs": sum(r["jobs"] for r in records),
+        "nthreads": max(r["nthreads"] for r in records),
+        "buffer_size": max(r["buffer_size"] for r in records),
+        "num_images": sum(r["num_images"] for r in records),
+        "max_occupancy": max(r["max_occupancy"] for r in records),
+        "bin_edges": records[0]["bin_edges"],
+        "histograms": {},
+    }
+    if result["num_images"] > 0:
+        result["mean_occupancy"] = (
+            sum(r["mean_occupancy"] * r["num_images"] for r in records)
+            / result["num_images"]
+        )
+    else:
+        result["mean_occupancy"] = 0.0
+    for name in TIMES:
+        result[name] = sum(r[name] for r in records)
+    for stage in STAGES:
+        histograms = [r["histograms"][stage] for r in records]
+        result["histograms"][stage] = {
+            "counts": [sum(c) for c in zip(*(h["counts"] for h in histograms))],
+            "count": sum(h["count"] for h in histograms),
+            "total": sum(h["total"] for h in histograms),
+        }
+    return _add_derived(result)
+
+
+def as_json(records, **kwargs):
+    """
+    :param records: A dictionary of telemetry dictionaries by pass name
+    :return: The telemetry as a JSON string
+    """
+    return json.dumps({k: v for k, v in records.items() if v is not None}, **kwargs)
+
+
+def as_prometheus(records, prefix="dials_integration"):
+    """
+    Format the telemetry in the Prometheus text exposition format. Each pass
+    is given as the value of a "pass" label, and each timing histogram is
+    exported as a cumulative histogram with a "stage" label.
+
+    :param records: A dictionary of telemetry dictionaries by pass name
+    :param prefix: The prefix of the metric names
+    :return: The formatted telemetry
+    """
+    gauges = (
+        ("jobs", "The number of jobs"),
+        ("nthreads", "The number of threads per job"),
+        ("buffer_size", "The number of images in the buffer"),
+        ("num_images", "The number of images read"),
+        ("num_reflections", "The number of reflections processed"),
+        ("wall_time", "The time taken by the jobs in seconds"),
+        ("read_time", "The time spent waiting for images to be read in seconds"),
+        ("wait_time", "The time spent waiting for room in the buffer in seconds"),
+        ("copy_time", "The time spent copying images into the buffer in seconds"),
+        ("busy_time", "The time the threads spent processing reflections"),
+        ("mean_occupancy", "The mean number of buffered images still needed"),
+        ("max_occupancy", "The largest number of buffered images still needed"),
+        ("reflections_per_second", "The number of reflections processed per second"),
+        ("utilisation", "The fraction of the time the threads were busy"),
+        ("read_fraction", "The fraction of the time waiting for images to be read"),
+    )
+    records = {k: v for k, v in records.items() if v is not None}
+    lines = []
+    for name, description in gauges:
+        metric = f"{prefix}_{name}"
+        lines.append(f"# HELP {metric} {description}")
+        lines.append(f"# TYPE {metric} gauge")
+        for label, record in records.items():
+            lines.append(f'{metric}{{pass="{label}"}} {record[name]!r}')
+    metric = f"{prefix}_stage_seconds"
+    lines.append(f"# HELP {metric} The time taken by each stage of a reflection")
+    lines.append(f"# TYPE {metric} histogram")
+    for label, record in records.items():
+        for stage in STAGES:
+            histogram = record["histograms"][stage]
+            labels = f'pass="{label}",stage="{stage}"'
+            cumulative = 0
+            for edge, count in zip(record["bin_edges"], histogram["counts"]):
+                cumulative += count
+                lines.append(f'{metric}_bucket{{{labels},le="{edge:g}"}} {cumulative}')
+            lines.append(f'{metric}_bucket{{{labels},le="+Inf"}} {histogram["count"]}')
+            lines.append(f"{metric}_sum{{{labels}}} {histogram['total']!r}")
+            lines.append(f"{metric}_count{{{labels}}} {histogram['count']}")
+    return "\n".join(lines) + "\n"
+
+
+def summary(record):
+    """
+    :param record: A telemetry dictionary
+    :return: A table summarising the telemetry
+    """
+    rows = [
+        ["Jobs", "%d" % record["jobs"]],
+        ["Threads per job", "%d" % record["nthreads"]],
+        ["Images", "%d" % record["num_images"]],
+        ["Reflections", "%d" % record["num_reflections"]],
+        ["Wall time", "%.2f seconds" % record["wall_time"]],
+        [
+            "Waiting for images",
+            "%.2f seconds (%.1f%%)"
+            % (record["read_time"], 100 * record["read_fraction"]),
+        ],
+        ["Waiting for buffer", "%.2f seconds" % record["wait_time"]],
+        ["Copying images", "%.2f seconds" % record["copy_time"]],
+        ["Reflections per second", "%.1f" % record["reflections_per_second"]],
+        ["Thread utilisation", "%.1f%%" % (100 * record["utilisation"])],
+        [
+            "Buffer occupancy (mean / max)",
+            "%.1f / %d of %d images"
+            % (
+                record["mean_occupancy"],
+                record["max_occupancy"],
+                record["buffer_size"],
+            ),
+        ],
+    ]
+    for stage in STAGES[:-1]:
+        histogram = record["histograms"][stage]
+        mean = histogram["total"] / histogram["count"] if histogram["count"] else 0
+        value = "%.2f seconds (%.1f us each)" % (histogram["total"], 1e6 * mean)
+        rows.append(["Time in %s" % stage, value])
+    return tabulate(rows)
+
+
+def write(records, json_filename=None, prometheus_filename=None):
+    """
+    Write the telemetry to file.
+
+    :param records: A dictionary of telemetry dictionaries by pass name
+    :param json_filename: The file to write the JSON to
+    :param prometheus_filename: The file to write the Prometheus text to
+    """
+    if json_filename:
+        with open(json_filename, "w") as outfile:
+            outfile.write(as_json(records, indent=2))
+    if prometheus_filename:
+        with open(prometheus_filename, "w") as outfile:
+            outfile.write(as_prometheus(records))
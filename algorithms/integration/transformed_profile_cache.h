@@ -0,0 +1,293 @@
+/*
+ * transformed_profile_cache.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_TRANSFORMED_PROFILE_CACHE_H
+#define DIALS_ALGORITHMS_INTEGRATION_TRANSFORMED_PROFILE_CACHE_H
+
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Shoebox;
+  using scitbx::vec3;
+  using scitbx::af::int6;
+
+  /**
+   * A cache of shoeboxes transformed to the reciprocal space grid. The
+   * reference profile pass stores the transformed data, background and mask
+   * of the reflections it models and the integration pass reuses them rather
+   * than transforming the same shoeboxes again.
+   *
+   * The entries are keyed by a hash of everything the transform depends on
+   * for a given experiment: the panel, bounding box, s1, phi and the shoebox
+   * data, background and mask. A reflection whose shoebox differs between the
+   * two passes, for example because more pixels are marked as overlapped when
+   * all reflections are present, simply misses the cache.
+   *
+   * Once the entries held in memory reach the memory limit any further
+   * entries are written to a temporary file and read back when needed. The
+   * cache may be shared between threads.
+   */
+  class TransformedProfileCache : public boost::noncopyable {
+  public:
+    typedef boost::uint64_t key_type;
+    typedef af::versa<double, af::c_grid<3> > data_type;
+    typedef af::versa<bool, af::c_grid<3> > mask_type;
+
+    /**
+     * Initialise the cache
+     * @param max_memory The maximum number of bytes held in memory
+     */
+    TransformedProfileCache(std::size_t max_memory)
+        : max_memory_(max_memory),
+          memory_(0),
+          num_spilled_(0),
+          hits_(0),
+          misses_(0),
+          file_(NULL),
+          file_size_(0) {}
+
+    /**
+     * Close the temporary file
+     */
+    ~TransformedProfileCache() {
+      if (file_ != NULL) {
+        std::fclose(file_);
+      }
+    }
+
+    /**
+     * Compute the key of a shoebox
+     * @param experiment_id The experiment id
+     * @param sbox The shoebox
+     * @param s1 The diffracted beam vector
+     * @param phi The rotation angle
+     * @returns The key
+     */
+    static key_type key(std::size_t experiment_id,
+                        const Shoebox<> &sbox,
+                        const vec3<double> &s1,
+                        double phi) {
+      key_type h = 14695981039346656037ULL;
+      h = hash(h, &experiment_id, sizeof(experiment_id));
+      h = hash(h, &sbox.panel, sizeof(sbox.panel));
+      h = hash(h, &sbox.bbox[0], 6 * sizeof(int));
+      h = hash(h, &s1[0], 3 * sizeof(double));
+      h = hash(h, &phi, sizeof(phi));
+      std::size_t float_size = sizeof(Shoebox<>::float_type);
+      h = hash(h, sbox.data.begin(), sbox.data.size() * float_size);
+      h = hash(h, sbox.background.begin(), sbox.background.size() * float_size);
+      h = hash(h, sbox.mask.begin(), sbox.mask.size() * sizeof(int));
+      return h;
+    }
+
+    /**
+     * Add a transformed shoebox. An existing entry is kept.
+     * @param key The key of the shoebox
+     * @param bbox The bounding box of the shoebox
+     * @param data The transformed data
+     * @param background The transformed background
+     * @param mask The transformed mask
+     */
+    void insert(key_type key,
+                const int6 &bbox,
+                const af::const_ref<double, af::c_grid<3> > &data,
+                const af::const_ref<double, af::c_grid<3> > &background,
+                const af::const_ref<bool, af::c_grid<3> > &mask) {
+      DIALS_ASSERT(data.accessor().all_eq(background.accessor()));
+      DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+      std::size_t n = data.size();
+      std::size_t nbytes = n * (2 * sizeof(double) + sizeof(bool));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (entries_.find(key) != entries_.end()) {
+        return;
+      }
+      Entry entry;
+      entry.bbox = bbox;
+      entry.accessor = data.accessor();
+      entry.offset = -1;
+      if (memory_ + nbytes <= max_memory_) {
+        entry.data = data_type(entry.accessor);
+        entry.background = data_type(entry.accessor);
+        entry.mask = mask_type(entry.accessor);
+        std::copy(data.begin(), data.end(), entry.data.begin());
+        std::copy(background.begin(), background.end(), entry.background.begin());
+        std::copy(mask.begin(), mask.end(), entry.mask.begin());
+        memory_ += nbytes;
+      } else {
+        if (!spill(data, background, mask, entry.offset)) {
+          return;
+        }
+        num_spilled_++;
+      }
+      entries_[key] = entry;
+    }
+
+    /**
+     * Get a transformed shoebox
+     * @param key The key of the shoebox
+     * @param bbox The bounding box of the shoebox
+     * @param data The transformed data
+     * @param background The transformed background
+     * @param mask The transformed mask
+     * @returns True/False the shoebox was found
+     */
+    bool find(key_type key,
+              const int6 &bbox,
+              data_type &data,
+              data_type &background,
+              mask_type &mask) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      std::map<key_type, Entry>::const_iterator it = entries_.find(key);
+      if (it == entries_.end() || !it->second.bbox.all_eq(bbox)) {
+        misses_++;
+        return false;
+      }
+      const Entry &entry = it->second;
+      data = data_type(entry.accessor);
+      background = data_type(entry.accessor);
+      mask = mask_type(entry.accessor);
+      if (entry.offset < 0) {
+        std::copy(entry.data.begin(), entry.data.end(), data.begin());
+        std::copy(
+          entry.background.begin(), entry.background.end(), background.begin());
+        std::copy(entry.mask.begin(), entry.mask.end(), mask.begin());
+      } else {
+        std::size_t n = entry.accessor.size_1d();
+        DIALS_ASSERT(std::fseek(file_, entry.offset, SEEK_SET) == 0);
+        DIALS_ASSERT(std::fread(data.begin(), sizeof(double), n, file_) == n);
+        DIALS_ASSERT(std::fread(background.begin(), sizeof(double), n, file_) == n);
+        DIALS_ASSERT(std::fread(mask.begin(), sizeof(bool), n, file_) == n);
+      }
+      hits_++;
+      return true;
+    }
+
+    /**
+     * @returns The number of entries
+     */
+    std::size_t size() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return entries_.size();
+    }
+
+    /**
+     * @returns The number of entries written to the temporary file
+     */
+    std::size_t num_spilled() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return num_spilled_;
+    }
+
+    /**
+     * @returns The number of bytes held in memory
+     */
+    std::size_t memory() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return memory_;
+    }
+
+    /**
+     * @returns The maximum number of bytes held in memory
+     */
+    std::size_t max_memory() const {
+      return max_memory_;
+    }
+
+    /**
+     * @returns The number of shoeboxes found in the cache
+     */
+    std::size_t hits() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return hits_;
+    }
+
+    /**
+     * @returns The number of shoeboxes not found in the cache
+     */
+    std::size_t misses() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return misses_;
+    }
+
+  private:
+    /**
+     * A transformed shoebox. If the offset is not negative the arrays are
+     * held in the temporary file at that offset.
+     */
+    struct Entry {
+      int6 bbox;
+      af::c_grid<3> accessor;
+      data_type data;
+      data_type background;
+      mask_type mask;
+      long offset;
+    };
+
+    /**
+     * Update a FNV-1a hash with some bytes
+     */
+    static key_type hash(key_type h, const void *data, std::size_t size) {
+      const unsigned char *bytes = static_cast<const unsigned char *>(data);
+      for (std::size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+      }
+      return h;
+    }
+
+    /**
+     * Append the arrays to the temporary file. The mutex must be held.
+     * @returns False if the file could not be written
+     */
+    bool spill(const af::const_ref<double, af::c_grid<3> > &data,
+               const af::const_ref<double, af::c_grid<3> > &background,
+               const af::const_ref<bool, af::c_grid<3> > &mask,
+               long &offset) {
+      if (file_ == NULL) {
+        file_ = std::tmpfile();
+        if (file_ == NULL) {
+          return false;
+        }
+      }
+      std::size_t n = data.size();
+      if (std::fseek(file_, file_size_, SEEK_SET) != 0
+          || std::fwrite(data.begin(), sizeof(double), n, file_) != n
+          || std::fwrite(background.begin(), sizeof(double), n, file_) != n
+          || std::fwrite(mask.begin(), sizeof(bool), n, file_) != n) {
+        return false;
+      }
+      offset = file_size_;
+      file_size_ += n * (2 * sizeof(double) + sizeof(bool));
+      return true;
+    }
+
+    std::size_t max_memory_;
+    std::size_t memory_;
+    std::size_t num_spilled_;
+    std::size_t hits_;
+    std::size_t misses_;
+    std::FILE *file_;
+    long file_size_;
+    std::map<key_type, Entry> entries_;
+    mutable boost::mutex mutex_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_TRANSFORMED_PROFILE_CACHE_H
@@ -64,9 +64,11 @@ def accumulate(self, other):
         for ms, mo in zip(self, other):
             ms.accumulate(mo)
 
-    def finalize(self):
+    def finalize(self, nthreads=1):
         """
         Finalize the model
+
+        :param nthreads: The number of threads used to normalise the profiles
         """
         assert not self.finalized()
         for m in self:
@@ -74,8 +76,8 @@ def finalize(self):
                 self.finalized_modeller = m.copy()
             else:
                 self.finalized_modeller.accumulate(m)
-            m.finalize()
-        self.finalized_modeller.finalize()
+            m.finalize(nthreads=nthreads)
+        self.finalized_modeller.finalize(nthreads=nthreads)
 
     def finalized(self):
         """
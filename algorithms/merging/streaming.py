@@ -0,0 +1,393 @@
+"""
+Out-of-core merging of scaled reflection files.
+
+The observations are read one reflection file at a time and split into chunks.
+Each chunk is mapped to the asymmetric unit, sorted and saved to disk as a
+sorted run. The runs are then merged, a block at a time, accumulating the sums
+needed for the merged intensities and the half-dataset statistics, so that only
+the unique reflections are ever held in memory.
+"""
+
+import logging
+import os
+import tempfile
+
+import numpy as np
+
+from cctbx import crystal, miller
+from dxtbx import flumpy
+
+from dials.algorithms.scaling.Ih_table import map_indices_to_asu
+from dials.array_family import flex
+from dials.util import tabulate
+from dials.util.filter_reflections import filter_reflection_table
+
+logger = logging.getLogger("dials")
+
+# Miller indices are packed into one sortable integer key, 21 bits per index
+_INDEX_BITS = 21
+_INDEX_OFFSET = 1 << (_INDEX_BITS - 1)
+_INDEX_MASK = (1 << _INDEX_BITS) - 1
+
+run_dtype = np.dtype(
+    [
+        ("key", np.int64),
+        ("intensity", np.float64),
+        ("variance", np.float64),
+        ("half", np.uint8),
+    ]
+)
+
+# The sums accumulated for each unique reflection
+_sum_names = ("n", "sum_w", "sum_wI", "n_0", "sum_I_0", "n_1", "sum_I_1")
+
+
+def pack_miller_indices(indices):
+    """Pack a flex.miller_index array into an array of sortable int64 keys."""
+    hkl = np.rint(flumpy.to_numpy(indices.as_vec3_double())).astype(np.int64)
+    hkl += _INDEX_OFFSET
+    if hkl.size and (hkl.min() < 0 or hkl.max() > _INDEX_MASK):
+        raise ValueError("Miller index out of range for streaming merging")
+    return (hkl[:, 0] << (2 * _INDEX_BITS)) | (hkl[:, 1] << _INDEX_BITS) | hkl[:, 2]
+
+
+def unpack_miller_indices(keys):
+    """Unpack an array of keys into a flex.miller_index array."""
+    hkl = np.column_stack(
+        [
+            (keys >> (2 * _INDEX_BITS)) & _INDEX_MASK,
+            (keys >> _INDEX_BITS) & _INDEX_MASK,
+            keys & _INDEX_MASK,
+        ]
+    )
+    hkl = (hkl - _INDEX_OFFSET).astype(np.int32)
+    return flumpy.miller_index_from_numpy(np.ascontiguousarray(hkl))
+
+
+def write_sorted_runs(
+    reflection_files,
+    space_group,
+    unit_cell,
+    run_dir,
+    chunk_size=1000000,
+    d_min=None,
+    d_max=None,
+    combine_partials=True,
+    partiality_threshold=0.4,
+    seed=0,
+):
+    """
+    Read the reflection files and save the scaled observations as sorted runs.
+
+    Each observation is randomly assigned to one half of the dataset, for the
+    half-dataset correlations.
+
+    Args:
+        reflection_files: The paths of the scaled reflection files.
+        space_group: The space group used to map the indices to the asu.
+        unit_cell: The unit cell used to calculate the d-values.
+        run_dir: The directory in which to save the runs.
+        chunk_size (int): The maximum number of observations in each run.
+        seed (int): The seed for the random half-dataset assignment.
+
+    Returns:
+        A list of the paths of the runs.
+    """
+    rng = np.random.default_rng(seed)
+    runs = []
+    for filename in reflection_files:
+        table = flex.reflection_table.from_file(filename)
+        table["d"] = unit_cell.d(table["miller_index"])
+        table = filter_reflection_table(
+            table,
+            intensity_choice=["scale"],
+            d_min=d_min,
+            d_max=d_max,
+            combine_partials=combine_partials,
+            partiality_threshold=partiality_threshold,
+        )
+        indices = table["miller_index"]
+        intensities = flumpy.to_numpy(table["intensity.scale.value"])
+        variances = flumpy.to_numpy(table["intensity.scale.variance"])
+        del table
+        for start in range(0, indices.size(), chunk_size):
+            end = min(start + chunk_size, indices.size())
+            run = np.empty(end - start, dtype=run_dtype)
+            run["key"] = pack_miller_indices(
+                map_indices_to_asu(indices[start:end], space_group, anomalous=True)
+            )
+            run["intensity"] = intensities[start:end]
+            run["variance"] = variances[start:end]
+            run["half"] = rng.integers(0, 2, size=run.size)
+            run = run[run["variance"] > 0]
+            run = run[np.argsort(run["key"], kind="stable")]
+            path = os.path.join(run_dir, f"run_{len(runs)}.npy")
+            np.save(path, run)
+            runs.append(path)
+        logger.debug("Read %s, %d runs saved", filename, len(runs))
+    return runs
+
+
+def iterate_merged_runs(runs, block_size=1000000):
+    """
+    Merge sorted runs, yielding sorted blocks of observations.
+
+    All the observations of a unique reflection are in the same block. Each
+    step takes the observations below the smallest last key of the next block
+    of each run, so that no observations of these keys remain in any run.
+
+    Args:
+        runs: A list of sorted observation arrays (e.g. memory mapped runs).
+        block_size (int): The number of observations read from each run at
+            each step.
+    """
+    positions = [0] * len(runs)
+    sizes = [block_size] * len(runs)
+    while True:
+        active = [i for i, run in enumerate(runs) if positions[i] < run.size]
+        if not active:
+            return
+        limit = None
+        for i in active:
+            end = positions[i] + sizes[i]
+            if end < runs[i].size:
+                last = runs[i]["key"][end - 1]
+                limit = last if limit is None else min(limit, last)
+        pieces = []
+        for i in active:
+            keys = runs[i]["key"][positions[i] : positions[i] + sizes[i]]
+            n = keys.size if limit is None else int(np.searchsorted(keys, limit))
+            pieces.append(runs[i][positions[i] : positions[i] + n])
+            positions[i] += n
+        block = np.concatenate(pieces)
+        if not block.size:
+            # One key fills the whole block of a run, so read more of it
+            for i in active:
+                end = positions[i] + sizes[i]
+                if end < runs[i].size and runs[i]["key"][end - 1] == limit:
+                    sizes[i] *= 2
+            continue
+        yield block[np.argsort(block["key"], kind="stable")]
+
+
+def accumulate_block(block):
+    """
+    Accumulate the sums for each unique reflection in a sorted block.
+
+    Returns:
+        A tuple of the unique keys and a dictionary of the sums.
+    """
+    keys = block["key"]
+    starts = np.flatnonzero(np.concatenate(([True], keys[1:] != keys[:-1])))
+    w = 1.0 / block["variance"]
+    I = block["intensity"]
+    half_0 = block["half"] == 0
+    sums = {
+        "n": np.diff(np.append(starts, keys.size)),
+        "sum_w": np.add.reduceat(w, starts),
+        "sum_wI": np.add.reduceat(w * I, starts),
+        "n_0": np.add.reduceat(half_0.astype(np.int64), starts),
+        "sum_I_0": np.add.reduceat(np.where(half_0, I, 0.0), starts),
+        "sum_I_1": np.add.reduceat(np.where(half_0, 0.0, I), starts),
+    }
+    sums["n_1"] = sums["n"] - sums["n_0"]
+    return keys[starts], sums
+
+
+def combine_sums(keys, sums):
+    """Combine the sums of equal keys, returning the sorted unique keys."""
+    unique, inverse = np.unique(keys, return_inverse=True)
+    combined = {
+        name: np.bincount(inverse, weights=values, minlength=unique.size).astype(
+            values.dtype
+        )
+        for name, values in sums.items()
+    }
+    return unique, combined
+
+
+class StreamingMergeResult:
+    """The merged intensities and statistics of a streaming merge."""
+
+    def __init__(self, crystal_symmetry, keys, sums, wavelength=None):
+        anomalous_set = miller.set(
+            crystal_symmetry, unpack_miller_indices(keys), anomalous_flag=True
+        )
+        self.merged_anomalous_array = self._merged_array(
+            anomalous_set, sums, wavelength
+        )
+        self.multiplicities = miller.array(
+            anomalous_set, data=flumpy.from_numpy(sums["n"].astype(np.int32))
+        )
+
+        # The mean intensities combine the sums of the Friedel mates
+        mean_keys, self.sums = combine_sums(
+            pack_miller_indices(
+                map_indices_to_asu(
+                    anomalous_set.indices(), crystal_symmetry.space_group()
+                )
+            ),
+            sums,
+        )
+        self.merged_set = miller.set(
+            crystal_symmetry, unpack_miller_indices(mean_keys), anomalous_flag=False
+        )
+        self.merged_array = self._merged_array(self.merged_set, self.sums, wavelength)
+        self.mean_multiplicities = miller.array(
+            self.merged_set, data=flumpy.from_numpy(self.sums["n"].astype(np.int32))
+        )
+
+    @staticmethod
+    def _merged_array(miller_set, sums, wavelength):
+        array = miller.array(
+            miller_set,
+            data=flumpy.from_numpy(sums["sum_wI"] / sums["sum_w"]),
+            sigmas=flumpy.from_numpy(np.sqrt(1.0 / sums["sum_w"])),
+        )
+        array.set_observation_type_xray_intensity()
+        array.set_info(
+            miller.array_info(
+                source="DIALS", source_type="streaming_merge", wavelength=wavelength
+            )
+        )
+        return array
+
+    def statistics(self, n_bins=20):
+        """
+        Calculate the merging statistics of the mean intensities in resolution
+        bins.
+
+        Returns:
+            A list of rows of (d_max, d_min, n_obs, n_unique, multiplicity,
+            <I/sigI>, CC1/2), with the overall statistics last.
+        """
+        self.merged_set.setup_binner(n_bins=n_bins)
+        binner = self.merged_set.binner()
+        selections = [
+            (binner.bin_d_range(i_bin), flumpy.to_numpy(binner.selection(i_bin)))
+            for i_bin in binner.range_used()
+        ]
+        selections.append(
+            (
+                (binner.d_max(), binner.d_min()),
+                np.full(self.merged_set.size(), True),
+            )
+        )
+        i_over_sigma = flumpy.to_numpy(self.merged_array.data()) / flumpy.to_numpy(
+            self.merged_array.sigmas()
+        )
+        rows = []
+        for (d_max, d_min), sel in selections:
+            n_obs = int(self.sums["n"][sel].sum())
+            n_unique = int(np.count_nonzero(sel))
+            rows.append(
+                (
+                    d_max,
+                    d_min,
+                    n_obs,
+                    n_unique,
+                    n_obs / n_unique if n_unique else 0.0,
+                    float(np.mean(i_over_sigma[sel])) if n_unique else 0.0,
+                    self._cc_half(sel),
+                )
+            )
+        return rows
+
+    def _cc_half(self, sel):
+        """The correlation of the means of the two halves of the dataset."""
+        n_0 = self.sums["n_0"][sel]
+        n_1 = self.sums["n_1"][sel]
+        both = (n_0 > 0) & (n_1 > 0)
+        if np.count_nonzero(both) < 2:
+            return 0.0
+        x = self.sums["sum_I_0"][sel][both] / n_0[both]
+        y = self.sums["sum_I_1"][sel][both] / n_1[both]
+        if np.std(x) == 0 or np.std(y) == 0:
+            return 0.0
+        return float(np.corrcoef(x, y)[0, 1])
+
+    def statistics_summary(self, n_bins=20):
+        """Format the merging statistics as a table."""
+        header = ["d_max", "d_min", "n_obs", "n_uniq", "mult", "<I/sI>", "cc_half"]
+        rows = [
+            [
+                f"{d_max:6.2f}",
+                f"{d_min:6.2f}",
+                f"{n_obs:d}",
+                f"{n_unique:d}",
+                f"{mult:6.2f}",
+                f"{i_sigi:6.2f}",
+                f"{cc_half:6.3f}",
+            ]
+            for d_max, d_min, n_obs, n_unique, mult, i_sigi, cc_half in self.statistics(
+                n_bins
+            )
+        ]
+        return "Merging statistics (streaming merge)\n" + tabulate(rows, header)
+
+
+def streaming_merge(
+    reflection_files,
+    crystal_symmetry,
+    wavelength=None,
+    chunk_size=1000000,
+    tmp_dir=None,
+    d_min=None,
+    d_max=None,
+    combine_partials=True,
+    partiality_threshold=0.4,
+    seed=0,
+):
+    """
+    Merge scaled reflection files that may be too large to fit in memory.
+
+    The input data are filtered in the same way as for merge, and merged with
+    weights of inverse variance.
+
+    Args:
+        reflection_files: The paths of the scaled reflection files.
+        crystal_symmetry: The space group and (best) unit cell of the data.
+        wavelength (float): The wavelength of the data.
+        chunk_size (int): The number of observations in each sorted run, and
+            read from each run when merging.
+        tmp_dir: The directory in which to create a directory for the runs.
+
+    Returns:
+        A StreamingMergeResult.
+    """
+    space_group = crystal_symmetry.space_group()
+    with tempfile.TemporaryDirectory(dir=tmp_dir) as run_dir:
+        run_files = write_sorted_runs(
+            reflection_files,
+            space_group,
+            crystal_symmetry.unit_cell(),
+            run_dir,
+            chunk_size=chunk_size,
+            d_min=d_min,
+            d_max=d_max,
+            combine_partials=combine_partials,
+            partiality_threshold=partiality_threshold,
+            seed=seed,
+        )
+        logger.info("Merging %d sorted runs of observations", len(run_files))
+        runs = [np.load(path, mmap_mode="r") for path in run_files]
+        keys = []
+        sums = {name: [] for name in _sum_names}
+        for block in iterate_merged_runs(runs, block_size=chunk_size):
+            block_keys, block_sums = accumulate_block(block)
+            keys.append(block_keys)
+            for name, values in block_sums.items():
+                sums[name].append(values)
+        del runs
+    if not keys:
+        raise ValueError("No reflections remain after filtering for merging")
+    return StreamingMergeResult(
+        crystal.symmetry(
+            unit_cell=crystal_symmetry.unit_cell(),
+            space_group=space_group,
+            assert_is_compatible_unit_cell=False,
+        ),
+        np.concatenate(keys),
+        {name: np.concatenate(values) for name, values in sums.items()},
+        wavelength=wavelength,
+    )
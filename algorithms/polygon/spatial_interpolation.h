@@ -102,28 +102,131 @@ namespace dials { namespace algorithms { namespace polygon {
     }
 
     /**
-     * Get the overlaps between an input quad and the grid points
+     * Clip a polygon with one side of an axis aligned box. The output buffer
+     * must have room for one vertex more than the input for a convex polygon.
+     * @param input The input vertices
+     * @param n The number of input vertices
+     * @param output The output vertices
+     * @param axis The axis of the side (0 = x, 1 = y)
+     * @param value The coordinate of the side
+     * @param keep_greater Keep the points greater than the value
+     * @returns The number of output vertices
+     */
+    inline std::size_t clip_with_axis_side(const vec2<double> *input,
+                                           std::size_t n,
+                                           vec2<double> *output,
+                                           std::size_t axis,
+                                           double value,
+                                           bool keep_greater) {
+      std::size_t m = 0;
+      std::size_t other = 1 - axis;
+      vec2<double> p1 = input[n - 1];
+      bool inside1 = keep_greater ? p1[axis] > value : p1[axis] < value;
+      for (std::size_t i = 0; i < n; ++i) {
+        vec2<double> p2 = input[i];
+        bool inside2 = keep_greater ? p2[axis] > value : p2[axis] < value;
+        if (inside1 != inside2) {
+          double t = (value - p1[axis]) / (p2[axis] - p1[axis]);
+          vec2<double> p;
+          p[axis] = value;
+          p[other] = p1[other] + t * (p2[other] - p1[other]);
+          output[m++] = p;
+        }
+        if (inside2) {
+          output[m++] = p2;
+        }
+        p1 = p2;
+        inside1 = inside2;
+      }
+      return m;
+    }
+
+    /**
+     * Get the intersection of a quad with a regular grid point. This gives the
+     * same area as clipping with quad_with_convex_quad but uses the fact that
+     * the grid point is axis aligned, so each side is clipped with a simple
+     * comparison and the vertices are kept in fixed buffers.
+     * @param a The quad
+     * @param i The fast grid index
+     * @param j The slow grid index
+     * @returns The area
+     */
+    inline double quad_grid_intersection_area_fast(const vert4 &a, int i, int j) {
+      // A convex quad gains at most one vertex per side; the buffers are
+      // larger so that slightly concave quads are also handled.
+      vec2<double> buffer1[16];
+      vec2<double> buffer2[16];
+      for (std::size_t k = 0; k < 4; ++k) {
+        buffer1[k] = a[k];
+      }
+      std::size_t n = 4;
+      n = clip_with_axis_side(buffer1, n, buffer2, 0, i, true);
+      if (n == 0) return 0.0;
+      n = clip_with_axis_side(buffer2, n, buffer1, 0, i + 1, false);
+      if (n == 0) return 0.0;
+      n = clip_with_axis_side(buffer1, n, buffer2, 1, j, true);
+      if (n == 0) return 0.0;
+      n = clip_with_axis_side(buffer2, n, buffer1, 1, j + 1, false);
+      if (n < 3) return 0.0;
+      double area = 0.0;
+      for (std::size_t k = 0, l = n - 1; k < n; l = k++) {
+        area += buffer1[l][0] * buffer1[k][1] - buffer1[k][0] * buffer1[l][1];
+      }
+      return std::abs(area) / 2.0;
+    }
+
+    /**
+     * Get the overlaps between an input quad and the grid points and append
+     * them to an existing list of matches. If the quad lies inside a single
+     * grid point then no clipping is done.
      * @param input The quad
      * @param output_size The size of the output grid
      * @param index The index of the quad
-     * @returns The matches between the quad and the grid
+     * @param matches The list of matches
      */
-    inline af::shared<Match> quad_to_grid(vert4 input,
-                                          af::c_grid<2> output_size,
-                                          int index) {
-      af::shared<Match> matches;
+    inline void quad_to_grid(vert4 input,
+                             af::c_grid<2> output_size,
+                             int index,
+                             af::shared<Match> &matches) {
       int4 range = quad_grid_range(input, output_size);
-      if (range[0] >= range[1] || range[2] >= range[3]) return matches;
+      if (range[0] >= range[1] || range[2] >= range[3]) return;
       double target_area = reverse_quad_inplace_if_backward(input);
+      if (range[1] - range[0] == 1 && range[3] - range[2] == 1) {
+        int ii = range[0];
+        int jj = range[2];
+        bool inside = true;
+        for (std::size_t k = 0; k < 4; ++k) {
+          inside = inside && input[k][0] >= ii && input[k][0] <= ii + 1
+                   && input[k][1] >= jj && input[k][1] <= jj + 1;
+        }
+        if (inside) {
+          matches.push_back(Match(index, ii + jj * output_size[1], 1.0));
+          return;
+        }
+      }
       for (std::size_t jj = range[2]; jj < range[3]; ++jj) {
         for (std::size_t ii = range[0]; ii < range[1]; ++ii) {
-          double result_area = quad_grid_intersection_area(input, ii, jj);
+          double result_area = quad_grid_intersection_area_fast(input, ii, jj);
           if (result_area > 0) {
             double fraction = result_area / target_area;
             matches.push_back(Match(index, ii + jj * output_size[1], fraction));
           }
         }
       }
+    }
+
+    /**
+     * Get the overlaps between an input quad and the grid points
+     * @param input The quad
+     * @param output_size The size of the output grid
+     * @param index The index of the quad
+     * @returns The matches between the quad and the grid
+     */
+    inline af::shared<Match> quad_to_grid(vert4 input,
+                                          af::c_grid<2> output_size,
+                                          int index) {
+      af::shared<Match> matches;
+      quad_to_grid(input, output_size, index, matches);
       return matches;
     }
 
@@ -169,8 +272,7 @@ namespace dials { namespace algorithms { namespace polygon {
         for (std::size_t i = 0; i < inputxy.accessor()[1] - 1; ++i, ++k) {
           vert4 input(
             inputxy(j, i), inputxy(j, i + 1), inputxy(j + 1, i + 1), inputxy(j + 1, i));
-          af::shared<Match> temp = quad_to_grid(input, output_size, k);
-          std::copy(temp.begin(), temp.end(), std::back_inserter(matches));
+          quad_to_grid(input, output_size, k, matches);
         }
       }
       return matches;
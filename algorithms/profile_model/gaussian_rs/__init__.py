@@ -7,6 +7,7 @@
     BBoxMultiCalculator,
     CoordinateSystem,
     CoordinateSystem2d,
+    CoordinateSystemBatch,
     GaussianRSProfileModeller,
     MaskCalculator2D,
     MaskCalculator3D,
@@ -18,6 +19,8 @@
     PartialityMultiCalculator,
     ideal_profile_double,
     ideal_profile_float,
+    shared_ideal_profile_double,
+    shared_ideal_profile_float,
     zeta_factor,
 )
 
@@ -29,6 +32,7 @@
     "BBoxMultiCalculator",
     "CoordinateSystem",
     "CoordinateSystem2d",
+    "CoordinateSystemBatch",
     "GaussianRSProfileModeller",
     "MaskCalculator",
     "MaskCalculator2D",
@@ -44,6 +48,8 @@
     "ideal_profile_double",
     "ideal_profile_float",
     "phil_scope",
+    "shared_ideal_profile_double",
+    "shared_ideal_profile_float",
     "zeta_factor",
 ]
 
@@ -33,14 +33,31 @@ class GaussianRSIntensityCalculatorFactory:
     """
 
     @staticmethod
-    def create(data, detector_space=False, deconvolution=False):
+    def create(
+        data,
+        detector_space=False,
+        deconvolution=False,
+        transform_cache=None,
+        batch=False,
+    ):
         """
         Create the intensity calculator
         """
         from dials.algorithms.integration.parallel_integrator import (
+            GaussianRSBatchIntensityCalculator,
             GaussianRSIntensityCalculator,
         )
 
+        # Fit the reflections of each job together
+        if batch and not detector_space:
+            if transform_cache is not None:
+                return GaussianRSBatchIntensityCalculator(data, transform_cache)
+            return GaussianRSBatchIntensityCalculator(data)
+
+        # Reuse the shoeboxes transformed by the reference pass
+        if transform_cache is not None and not detector_space:
+            return GaussianRSIntensityCalculator(data, transform_cache)
+
         # Return the intensity algorithm
         return GaussianRSIntensityCalculator(data, detector_space, deconvolution)
 
@@ -51,7 +68,14 @@ class GaussianRSReferenceCalculatorFactory:
     """
 
     @staticmethod
-    def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
+    def create(
+        experiments,
+        grid_size=5,
+        scan_step=5,
+        grid_method="circular_grid",
+        cache_tile_size=0,
+        transform_cache=None,
+    ):
         """
         Create the intensity calculator
         """
@@ -109,9 +133,15 @@ def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
                 experiment.profile.sigma_m(deg=False),
                 experiment.profile.n_sigma() * 1.5,
                 grid_size,
+                cache_tile_size,
             )
 
             spec_list.append(spec)
 
+        # Keep the transformed shoeboxes for the integration pass
+        algorithm = GaussianRSReferenceCalculator(sampler, spec_list)
+        if transform_cache is not None:
+            algorithm.set_transform_cache(transform_cache)
+
         # Return the intensity algorithm
-        return GaussianRSReferenceCalculator(sampler, spec_list)
+        return algorithm
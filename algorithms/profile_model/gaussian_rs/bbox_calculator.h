@@ -23,6 +23,7 @@
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials {
   namespace algorithms {
@@ -57,6 +58,53 @@ namespace dials {
     virtual af::shared<int6> array(const af::const_ref<vec3<double> > &s1,
                                    const af::const_ref<double> &frame,
                                    const af::const_ref<std::size_t> &panel) const = 0;
+
+    /**
+     * Calculate the rois for an array of reflections, sharing the
+     * reflections between a number of threads.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param panel The array of panel numbers
+     * @param nthreads The number of threads
+     */
+    af::shared<int6> array_parallel(const af::const_ref<vec3<double> > &s1,
+                                    const af::const_ref<double> &frame,
+                                    const af::const_ref<std::size_t> &panel,
+                                    std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == panel.size());
+      af::shared<int6> result(s1.size(), af::init_functor_null<int6>());
+      dials::util::parallel_for(
+        s1.size(), nthreads, ArrayJob(this, s1, frame, panel, result.ref()));
+      return result;
+    }
+
+  private:
+    /**
+     * Compute the rois for a contiguous range of reflections
+     */
+    class ArrayJob {
+    public:
+      ArrayJob(const BBoxCalculatorIface *compute,
+               const af::const_ref<vec3<double> > &s1,
+               const af::const_ref<double> &frame,
+               const af::const_ref<std::size_t> &panel,
+               af::ref<int6> result)
+          : compute_(compute), s1_(s1), frame_(frame), panel_(panel), result_(result) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          result_[i] = compute_->single(s1_[i], frame_[i], panel_[i]);
+        }
+      }
+
+    private:
+      const BBoxCalculatorIface *compute_;
+      af::const_ref<vec3<double> > s1_;
+      af::const_ref<double> frame_;
+      af::const_ref<std::size_t> panel_;
+      af::ref<int6> result_;
+    };
   };
 
   /** Calculate the bounding box for each reflection */
@@ -391,7 +439,66 @@ namespace dials {
       return result;
     }
 
+    /**
+     * Calculate the rois for an array of reflections, sharing the
+     * reflections between a number of threads.
+     * @param id The experiment id
+     * @param s1 The array of diffracted beam vectors
+     * @param phi The array of rotation angles.
+     * @param panel The panel number
+     * @param nthreads The number of threads
+     */
+    af::shared<int6> operator()(const af::const_ref<std::size_t> &id,
+                                const af::const_ref<vec3<double> > &s1,
+                                const af::const_ref<double> &phi,
+                                const af::const_ref<std::size_t> &panel,
+                                std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == id.size());
+      DIALS_ASSERT(s1.size() == phi.size());
+      DIALS_ASSERT(s1.size() == panel.size());
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] < size());
+      }
+      af::shared<int6> result(s1.size(), af::init_functor_null<int6>());
+      dials::util::parallel_for(
+        s1.size(), nthreads, ArrayJob(this, id, s1, phi, panel, result.ref()));
+      return result;
+    }
+
   private:
+    /**
+     * Compute the rois for a contiguous range of reflections
+     */
+    class ArrayJob {
+    public:
+      ArrayJob(const BBoxMultiCalculator *multi,
+               const af::const_ref<std::size_t> &id,
+               const af::const_ref<vec3<double> > &s1,
+               const af::const_ref<double> &phi,
+               const af::const_ref<std::size_t> &panel,
+               af::ref<int6> result)
+          : multi_(multi),
+            id_(id),
+            s1_(s1),
+            phi_(phi),
+            panel_(panel),
+            result_(result) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          result_[i] = multi_->compute_[id_[i]]->single(s1_[i], phi_[i], panel_[i]);
+        }
+      }
+
+    private:
+      const BBoxMultiCalculator *multi_;
+      af::const_ref<std::size_t> id_;
+      af::const_ref<vec3<double> > s1_;
+      af::const_ref<double> phi_;
+      af::const_ref<std::size_t> panel_;
+      af::ref<int6> result_;
+    };
+
     std::vector<boost::shared_ptr<BBoxCalculatorIface> > compute_;
   };
 
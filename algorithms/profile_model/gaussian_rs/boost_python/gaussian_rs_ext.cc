@@ -17,6 +17,7 @@
 #include <dials/algorithms/profile_model/gaussian_rs/ideal_profile.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <dials/algorithms/profile_model/gaussian_rs/modeller.h>
+#include <dials/algorithms/profile_model/modeller/compact_profile_store.h>
 #include <dials/algorithms/profile_model/modeller/boost_python/empirical_profile_modeller_wrapper.h>
 
 namespace dials {
@@ -76,6 +77,11 @@ namespace dials {
                                          obj.fit_method());
       }
 
+      /**
+       * Finalized profiles are only read, so they are saved in the compact
+       * form which is less than half the size. Profiles which are still being
+       * accumulated are saved in full so no precision is lost.
+       */
       static boost::python::tuple getstate(const GaussianRSProfileModeller& obj) {
         typedef GaussianRSProfileModeller::data_type data_type;
         typedef GaussianRSProfileModeller::mask_type mask_type;
@@ -84,6 +90,19 @@ namespace dials {
         boost::python::list nref_list;
         for (std::size_t i = 0; i < obj.size(); ++i) {
           nref_list.append(obj.n_reflections(i));
+        }
+        if (obj.finalized()) {
+          CompactProfileStore store(obj);
+          return boost::python::make_tuple(store.offset(),
+                                           store.count(),
+                                           store.mask_index(),
+                                           store.values(),
+                                           store.indices(),
+                                           store.masks(),
+                                           nref_list,
+                                           obj.finalized());
+        }
+        for (std::size_t i = 0; i < obj.size(); ++i) {
           try {
             data_list.append(obj.data(i));
             mask_list.append(obj.mask(i));
@@ -99,6 +118,10 @@ namespace dials {
       static void setstate(GaussianRSProfileModeller& obj, boost::python::tuple state) {
         typedef GaussianRSProfileModeller::data_type data_type;
         typedef GaussianRSProfileModeller::mask_type mask_type;
+        if (boost::python::len(state) == 8) {
+          setstate_compact(obj, state);
+          return;
+        }
         DIALS_ASSERT(boost::python::len(state) == 4);
         boost::python::list data_list = extract<boost::python::list>(state[0]);
         boost::python::list mask_list = extract<boost::python::list>(state[1]);
@@ -118,6 +141,31 @@ namespace dials {
         }
         obj.set_finalized(finalized);
       }
+
+      static void setstate_compact(GaussianRSProfileModeller& obj,
+                                   boost::python::tuple state) {
+        CompactProfileStore store(
+          obj.datasize(),
+          0.5,
+          extract<af::shared<std::size_t> >(state[0])().const_ref(),
+          extract<af::shared<std::size_t> >(state[1])().const_ref(),
+          extract<af::shared<int> >(state[2])().const_ref(),
+          extract<af::shared<float> >(state[3])().const_ref(),
+          extract<af::shared<int> >(state[4])().const_ref(),
+          extract<af::shared<bool> >(state[5])().const_ref());
+        boost::python::list nref_list = extract<boost::python::list>(state[6]);
+        bool finalized = extract<bool>(state[7]);
+        DIALS_ASSERT(store.size() == obj.size());
+        DIALS_ASSERT(boost::python::len(nref_list) == obj.size());
+        for (std::size_t i = 0; i < obj.size(); ++i) {
+          if (store.valid(i)) {
+            obj.set_data(i, store.data(i));
+            obj.set_mask(i, store.mask(i));
+          }
+          obj.set_n_reflections(i, boost::python::extract<std::size_t>(nref_list[i]));
+        }
+        obj.set_finalized(finalized);
+      }
     };
 
     void export_modeller() {
@@ -173,7 +221,10 @@ namespace dials {
              (arg("s1"), arg("frame"), arg("panel")))
         .def("__call__",
              &BBoxCalculatorIface::array,
-             (arg("s1"), arg("frame"), arg("panel")));
+             (arg("s1"), arg("frame"), arg("panel")))
+        .def("__call__",
+             &BBoxCalculatorIface::array_parallel,
+             (arg("s1"), arg("frame"), arg("panel"), arg("nthreads")));
 
       class_<BBoxCalculator3D, bases<BBoxCalculatorIface> >("BBoxCalculator3D", no_init)
         .def(init<const BeamBase&,
@@ -209,7 +260,21 @@ namespace dials {
       class_<BBoxMultiCalculator>("BBoxMultiCalculator")
         .def("append", &BBoxMultiCalculator::push_back)
         .def("__len__", &BBoxMultiCalculator::size)
-        .def("__call__", &BBoxMultiCalculator::operator());
+        .def("__call__",
+             (af::shared<int6>(BBoxMultiCalculator::*)(
+               const af::const_ref<std::size_t>&,
+               const af::const_ref<vec3<double> >&,
+               const af::const_ref<double>&,
+               const af::const_ref<std::size_t>&) const)
+               & BBoxMultiCalculator::operator())
+        .def("__call__",
+             (af::shared<int6>(BBoxMultiCalculator::*)(
+               const af::const_ref<std::size_t>&,
+               const af::const_ref<vec3<double> >&,
+               const af::const_ref<double>&,
+               const af::const_ref<std::size_t>&,
+               std::size_t) const)
+               & BBoxMultiCalculator::operator());
 
       class_<MaskCalculatorIface, boost::noncopyable>("MaskCalculatorIface", no_init)
         .def("__call__",
@@ -229,7 +294,10 @@ namespace dials {
              (arg("s1"), arg("frame"), arg("bbox")))
         .def("__call__",
              &PartialityCalculatorIface::array,
-             (arg("s1"), arg("frame"), arg("bbox")));
+             (arg("s1"), arg("frame"), arg("bbox")))
+        .def("__call__",
+             &PartialityCalculatorIface::array_parallel,
+             (arg("s1"), arg("frame"), arg("bbox"), arg("nthreads")));
 
       class_<PartialityCalculator3D, bases<PartialityCalculatorIface> >(
         "PartialityCalculator3D", no_init)
@@ -239,7 +307,10 @@ namespace dials {
                   const Goniometer&,
                   const Scan&,
                   const af::const_ref<double>&>(
-          (arg("beam"), arg("goniometer"), arg("scan"), arg("delta_m"))));
+          (arg("beam"), arg("goniometer"), arg("scan"), arg("delta_m"))))
+        .add_property("fast_erf",
+                      &PartialityCalculator3D::get_fast_erf,
+                      &PartialityCalculator3D::set_fast_erf);
 
       class_<PartialityCalculator2D, bases<PartialityCalculatorIface> >(
         "PartialityCalculator2D", no_init)
@@ -248,7 +319,21 @@ namespace dials {
       class_<PartialityMultiCalculator>("PartialityMultiCalculator")
         .def("append", &PartialityMultiCalculator::push_back)
         .def("__len__", &PartialityMultiCalculator::size)
-        .def("__call__", &PartialityMultiCalculator::operator());
+        .def("__call__",
+             (af::shared<double>(PartialityMultiCalculator::*)(
+               const af::const_ref<std::size_t>&,
+               const af::const_ref<vec3<double> >&,
+               const af::const_ref<double>&,
+               const af::const_ref<int6>&) const)
+               & PartialityMultiCalculator::operator())
+        .def("__call__",
+             (af::shared<double>(PartialityMultiCalculator::*)(
+               const af::const_ref<std::size_t>&,
+               const af::const_ref<vec3<double> >&,
+               const af::const_ref<double>&,
+               const af::const_ref<int6>&,
+               std::size_t) const)
+               & PartialityMultiCalculator::operator());
 
       class_<MaskCalculator3D, bases<MaskCalculatorIface> >("MaskCalculator3D", no_init)
         .def(init<const BeamBase&,
@@ -284,10 +369,26 @@ namespace dials {
       class_<MaskMultiCalculator>("MaskMultiCalculator")
         .def("append", &MaskMultiCalculator::push_back)
         .def("__len__", &MaskMultiCalculator::size)
-        .def("__call__", &MaskMultiCalculator::operator());
+        .def("__call__",
+             (void(MaskMultiCalculator::*)(const af::const_ref<int>&,
+                                           af::ref<Shoebox<> >,
+                                           const af::const_ref<vec3<double> >&,
+                                           const af::const_ref<double>&,
+                                           const af::const_ref<std::size_t>&) const)
+               & MaskMultiCalculator::operator())
+        .def("__call__",
+             (void(MaskMultiCalculator::*)(const af::const_ref<int>&,
+                                           af::ref<Shoebox<> >,
+                                           const af::const_ref<vec3<double> >&,
+                                           const af::const_ref<double>&,
+                                           const af::const_ref<std::size_t>&,
+                                           std::size_t) const)
+               & MaskMultiCalculator::operator());
 
       def("ideal_profile_float", &ideal_profile<float>);
       def("ideal_profile_double", &ideal_profile<double>);
+      def("shared_ideal_profile_float", &shared_ideal_profile<float>);
+      def("shared_ideal_profile_double", &shared_ideal_profile<double>);
 
       // Export zeta factor functions
       def("zeta_factor",
@@ -340,6 +441,30 @@ namespace dials {
         .def("to_beam_vector_and_rotation_angle",
              &CoordinateSystem::to_beam_vector_and_rotation_angle);
 
+      // Export the coordinate systems of a list of reflections
+      class_<CoordinateSystemBatch>("CoordinateSystemBatch", no_init)
+        .def(init<const af::const_ref<vec3<double> > &,
+                  const af::const_ref<vec3<double> > &,
+                  const af::const_ref<int> &,
+                  const af::const_ref<vec3<double> > &,
+                  const af::const_ref<double> &,
+                  std::size_t>((arg("m2"),
+                                arg("s0"),
+                                arg("id"),
+                                arg("s1"),
+                                arg("phi"),
+                                arg("nthreads") = 1)))
+        .def("m2", &CoordinateSystemBatch::m2)
+        .def("s0", &CoordinateSystemBatch::s0)
+        .def("s1", &CoordinateSystemBatch::s1)
+        .def("phi", &CoordinateSystemBatch::phi)
+        .def("e1_axis", &CoordinateSystemBatch::e1_axis)
+        .def("e2_axis", &CoordinateSystemBatch::e2_axis)
+        .def("e3_axis", &CoordinateSystemBatch::e3_axis)
+        .def("zeta", &CoordinateSystemBatch::zeta)
+        .def("__getitem__", &CoordinateSystemBatch::operator[])
+        .def("__len__", &CoordinateSystemBatch::size);
+
       boost_adaptbx::std_pair_conversions::to_tuple<vec3<double>, double>();
     }
 
@@ -15,6 +15,8 @@
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dxtbx/model/panel.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials {
@@ -138,6 +140,8 @@ namespace dials {
     vec3<double> e2_;
   };
 
+  class CoordinateSystemBatch;
+
   /**
    * Class representing the local reflection coordinate system
    */
@@ -363,6 +367,29 @@ namespace dials {
     }
 
   private:
+    friend class CoordinateSystemBatch;
+
+    /**
+     * Initialise the coordinate system from the axes computed before
+     */
+    CoordinateSystem(vec3<double> m2,
+                     vec3<double> s0,
+                     vec3<double> s1,
+                     double phi,
+                     vec3<double> e1,
+                     vec3<double> e2,
+                     vec3<double> e3,
+                     double zeta)
+        : m2_(m2),
+          s0_(s0),
+          s1_(s1),
+          phi_(phi),
+          p_star_(s1 - s0),
+          e1_(e1),
+          e2_(e2),
+          e3_(e3),
+          zeta_(zeta) {}
+
     vec3<double> m2_;
     vec3<double> s0_;
     vec3<double> s1_;
@@ -374,6 +401,160 @@ namespace dials {
     double zeta_;
   };
 
+  /**
+   * The local coordinate systems of all the reflections of a table, stored
+   * as one array for each axis. The axes are computed once, in parallel, and
+   * the coordinate system of a reflection is then made from them without
+   * computing them again, or the arrays are read directly.
+   */
+  class CoordinateSystemBatch {
+  public:
+    /**
+     * Compute the coordinate systems
+     * @param m2 The rotation axis of each experiment
+     * @param s0 The incident beam vector of each experiment
+     * @param id The experiment of each reflection (empty for all the first)
+     * @param s1 The diffracted beam vectors
+     * @param phi The rotation angles
+     * @param nthreads The number of threads
+     */
+    CoordinateSystemBatch(const af::const_ref<vec3<double> > &m2,
+                          const af::const_ref<vec3<double> > &s0,
+                          const af::const_ref<int> &id,
+                          const af::const_ref<vec3<double> > &s1,
+                          const af::const_ref<double> &phi,
+                          std::size_t nthreads = 1)
+        : m2_(m2.size()),
+          s0_(s0.begin(), s0.end()),
+          id_(s1.size(), 0),
+          s1_(s1.begin(), s1.end()),
+          phi_(phi.begin(), phi.end()),
+          e1_(s1.size()),
+          e2_(s1.size()),
+          e3_(s1.size()),
+          zeta_(s1.size()) {
+      DIALS_ASSERT(m2.size() > 0);
+      DIALS_ASSERT(m2.size() == s0.size());
+      DIALS_ASSERT(id.size() == 0 || id.size() == s1.size());
+      DIALS_ASSERT(phi.size() == s1.size());
+      DIALS_ASSERT(nthreads > 0);
+      for (std::size_t j = 0; j < m2.size(); ++j) {
+        m2_[j] = m2[j].normalize();
+      }
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] >= 0 && (std::size_t)id[i] < m2.size());
+        id_[i] = id[i];
+      }
+      dials::util::parallel_for(s1.size(), nthreads, Job(*this));
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return s1_.size();
+    }
+
+    /**
+     * @param index The index of the reflection
+     * @returns The coordinate system of the reflection
+     */
+    CoordinateSystem operator[](std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      std::size_t j = id_[index];
+      return CoordinateSystem(m2_[j],
+                              s0_[j],
+                              s1_[index],
+                              phi_[index],
+                              e1_[index],
+                              e2_[index],
+                              e3_[index],
+                              zeta_[index]);
+    }
+
+    /** @returns The normalized rotation axis of each reflection */
+    af::shared<vec3<double> > m2() const {
+      af::shared<vec3<double> > result(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        result[i] = m2_[id_[i]];
+      }
+      return result;
+    }
+
+    /** @returns The incident beam vector of each reflection */
+    af::shared<vec3<double> > s0() const {
+      af::shared<vec3<double> > result(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        result[i] = s0_[id_[i]];
+      }
+      return result;
+    }
+
+    /** @returns The diffracted beam vectors */
+    af::shared<vec3<double> > s1() const {
+      return s1_;
+    }
+
+    /** @returns The rotation angles */
+    af::shared<double> phi() const {
+      return phi_;
+    }
+
+    /** @returns The e1 axis of each reflection */
+    af::shared<vec3<double> > e1_axis() const {
+      return e1_;
+    }
+
+    /** @returns The e2 axis of each reflection */
+    af::shared<vec3<double> > e2_axis() const {
+      return e2_;
+    }
+
+    /** @returns The e3 axis of each reflection */
+    af::shared<vec3<double> > e3_axis() const {
+      return e3_;
+    }
+
+    /** @returns The zeta factor of each reflection */
+    af::shared<double> zeta() const {
+      return zeta_;
+    }
+
+  private:
+    /**
+     * Compute the axes of a range of the reflections
+     */
+    class Job {
+    public:
+      Job(CoordinateSystemBatch &self) : self_(&self) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t j = self_->id_[i];
+          vec3<double> m2 = self_->m2_[j];
+          vec3<double> s0 = self_->s0_[j];
+          vec3<double> s1 = self_->s1_[i];
+          vec3<double> e1 = s1.cross(s0).normalize();
+          self_->e1_[i] = e1;
+          self_->e2_[i] = s1.cross(e1).normalize();
+          self_->e3_[i] = (s1 + s0).normalize();
+          self_->zeta_[i] = zeta_factor(m2, e1);
+        }
+      }
+
+    private:
+      CoordinateSystemBatch *self_;
+    };
+
+    af::shared<vec3<double> > m2_;
+    af::shared<vec3<double> > s0_;
+    af::shared<std::size_t> id_;
+    af::shared<vec3<double> > s1_;
+    af::shared<double> phi_;
+    af::shared<vec3<double> > e1_;
+    af::shared<vec3<double> > e2_;
+    af::shared<vec3<double> > e3_;
+    af::shared<double> zeta_;
+  };
+
 }}}}  // namespace dials::algorithms::profile_model::gaussian_rs
 
 #endif  // DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_COORDINATE_SYSTEM_H
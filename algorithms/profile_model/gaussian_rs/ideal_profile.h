@@ -11,7 +11,12 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_IDEAL_PROFILE_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_IDEAL_PROFILE_H
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <utility>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/error.h>
@@ -35,7 +40,26 @@ namespace dials {
   }
 
   /**
-   * Generate an ideal profile in the reflection frame
+   * Generate the 1D gaussian along each axis of an ideal profile
+   * @param size The size of the grid (2 * size + 1)
+   * @param nsig The number of standard deviations
+   * @returns The unnormalised gaussian
+   */
+  template <typename FloatType>
+  af::shared<FloatType> ideal_profile_1d(std::size_t size, std::size_t nsig) {
+    FloatType centre = size;
+    FloatType sig = centre / nsig;
+    af::shared<FloatType> result(2 * size + 1);
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      result[i] = evaluate_gaussian<FloatType>(i, centre, sig);
+    }
+    return result;
+  }
+
+  /**
+   * Generate an ideal profile in the reflection frame. The gaussian is
+   * separable, so the profile is the outer product of the 1D gaussian along
+   * each axis and only needs 2 * size + 1 evaluations of the exponential.
    * @param size The size of the grid (2 * size + 1)
    * @param nsig The number of standard deviations
    * @returns The profile
@@ -43,19 +67,15 @@ namespace dials {
   template <typename FloatType>
   af::versa<FloatType, af::c_grid<3> > ideal_profile(std::size_t size,
                                                      std::size_t nsig) {
-    FloatType centre = size;
-    size = 2 * size + 1;
-    FloatType sig = centre / nsig;
+    af::shared<FloatType> g = ideal_profile_1d<FloatType>(size, nsig);
+    size = g.size();
 
     af::c_grid<3> accessor(size, size, size);
     af::versa<FloatType, af::c_grid<3> > profile(accessor, 0.0);
     for (std::size_t k = 0; k < size; ++k) {
       for (std::size_t j = 0; j < size; ++j) {
         for (std::size_t i = 0; i < size; ++i) {
-          FloatType gx = evaluate_gaussian<FloatType>(i, centre, sig);
-          FloatType gy = evaluate_gaussian<FloatType>(j, centre, sig);
-          FloatType gz = evaluate_gaussian<FloatType>(k, centre, sig);
-          profile(k, j, i) = gx * gy * gz;
+          profile(k, j, i) = g[i] * g[j] * g[k];
         }
       }
     }
@@ -67,6 +87,38 @@ namespace dials {
     return profile;
   }
 
+  /**
+   * Get an ideal profile from the profiles shared by all callers in the
+   * process. Each profile is computed the first time it is needed, and a
+   * copy is returned so the shared profile can't be changed.
+   * @param size The size of the grid (2 * size + 1)
+   * @param nsig The number of standard deviations
+   * @returns The profile
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<3> > shared_ideal_profile(std::size_t size,
+                                                            std::size_t nsig) {
+    typedef af::versa<FloatType, af::c_grid<3> > profile_type;
+    typedef std::map<std::pair<std::size_t, std::size_t>, profile_type> map_type;
+    static boost::mutex mutex;
+    static map_type profiles;
+    profile_type profile;
+    {
+      boost::lock_guard<boost::mutex> guard(mutex);
+      typename map_type::iterator it = profiles.find(std::make_pair(size, nsig));
+      if (it == profiles.end()) {
+        it = profiles
+               .insert(std::make_pair(std::make_pair(size, nsig),
+                                      ideal_profile<FloatType>(size, nsig)))
+               .first;
+      }
+      profile = it->second;
+    }
+    profile_type result(profile.accessor());
+    std::copy(profile.begin(), profile.end(), result.begin());
+    return result;
+  }
+
 }}}}  // namespace dials::algorithms::profile_model::gaussian_rs
 
 #endif /* DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_IDEAL_PROFILE_H */
@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MASK_FOREGROUND_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_MASK_FOREGROUND_H
 
+#include <algorithm>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
@@ -22,6 +24,7 @@
 #include <dials/model/data/image_volume.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <dials/algorithms/shoebox/mask_code.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials {
@@ -190,6 +193,14 @@ namespace dials {
       DIALS_ASSERT(bbox.size() == panel.size());
       af::shared<double> fraction(bbox.size());
       for (std::size_t i = 0; i < bbox.size(); ++i) {
+        // A windowed volume only masks its newest frame, so the reflections
+        // not on that frame are skipped and given a negative fraction
+        if (volume.windowed()
+            && (bbox[i][5] <= volume.mask_frame0()
+                || bbox[i][4] >= volume.mask_frame1())) {
+          fraction[i] = -1;
+          continue;
+        }
         fraction[i] =
           volume_single(volume.get(panel[i]), bbox[i], s1[i], frame[i], panel[i], i);
       }
@@ -214,9 +225,8 @@ namespace dials {
       int width = volume.accessor()[2];
       int height = volume.accessor()[1];
       int frame0 = volume.frame0();
-      int frame1 = volume.frame1();
-      z0 = std::max(frame0, z0);
-      z1 = std::min(frame1, z1);
+      z0 = std::max(volume.mask_frame0(), z0);
+      z1 = std::min(volume.mask_frame1(), z1);
       DIALS_ASSERT(x1 > x0);
       DIALS_ASSERT(y1 > y0);
       DIALS_ASSERT(z1 > z0);
@@ -375,6 +385,12 @@ namespace dials {
         }
       }
 
+      // The distance of each pixel from the ellipse only depends on its
+      // position on the detector, so compute it once for the frame slice along
+      // with the span of each row which can lie within the ellipse.
+      af::versa<double, af::c_grid<2> > dxy_min(af::c_grid<2>(ysize, xsize));
+      std::vector<int> span0(ysize, xsize);
+      std::vector<int> span1(ysize, 0);
       for (int j = 0; j < ysize; ++j) {
         for (int i = 0; i < xsize; ++i) {
           double dxy1 = dxy_array(j, i);
@@ -382,22 +398,60 @@ namespace dials {
           double dxy3 = dxy_array(j, i + 1);
           double dxy4 = dxy_array(j + 1, i + 1);
           double dxy = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
-          for (std::size_t k = 0; k < zsize; ++k) {
-            if (z0 + (int)k >= index0_ && z0 + (int)k < index1_) {
-              double gz1 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k - index0_) * dphi_);
-              double gz2 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
-              double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
-              double gzc2 = gz * gz * delta_m_r2;
-              /* int mask_value = (dxy + gzc2 <= 1.0) ? Foreground : Background; */
-              if (!adjacent) {
-                int mask_value = (dxy <= 1.0) ? Foreground : Background;
-                mask(k, j, i) |= mask_value;
-              } else {
-                if (dxy + gzc2 <= 1.0) {
-                  mask(k, j, i) |= Overlapped;
-                }
+          dxy_min(j, i) = dxy;
+          if (dxy <= 1.0) {
+            span0[j] = std::min(span0[j], i);
+            span1[j] = i + 1;
+          }
+        }
+      }
+
+      // The range of frames within the scan
+      int k0 = std::max(index0_ - z0, 0);
+      int k1 = std::min(index1_ - z0, zsize);
+
+      if (!adjacent) {
+        // The mask is the same on every frame so compute the slice once and
+        // apply it to each frame in turn; pixels outside the row spans are
+        // always background.
+        af::versa<int, af::c_grid<2> > slice(af::c_grid<2>(ysize, xsize), Background);
+        for (int j = 0; j < ysize; ++j) {
+          for (int i = span0[j]; i < span1[j]; ++i) {
+            if (dxy_min(j, i) <= 1.0) {
+              slice(j, i) = Foreground;
+            }
+          }
+        }
+        std::size_t slice_size = slice.size();
+        for (int k = k0; k < k1; ++k) {
+          int *m = mask.begin() + k * slice_size;
+          for (std::size_t n = 0; n < slice_size; ++n) {
+            m[n] |= slice[n];
+          }
+        }
+      } else {
+        // The ellipsoid gets smaller away from the centre in e3 so only pixels
+        // within the row spans need to be checked on each frame, and rows
+        // whose spans are outside the ellipsoid on a frame are skipped.
+        std::vector<double> row_min(ysize, 1.0);
+        for (int j = 0; j < ysize; ++j) {
+          for (int i = span0[j]; i < span1[j]; ++i) {
+            row_min[j] = std::min(row_min[j], dxy_min(j, i));
+          }
+        }
+        for (int k = k0; k < k1; ++k) {
+          double gz1 = cs.from_rotation_angle_fast(phi0_ + (z0 + k - index0_) * dphi_);
+          double gz2 =
+            cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
+          double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
+          double gzc2 = gz * gz * delta_m_r2;
+          for (int j = 0; j < ysize; ++j) {
+            if (span0[j] >= span1[j] || row_min[j] + gzc2 > 1.0) {
+              continue;
+            }
+            for (int i = span0[j]; i < span1[j]; ++i) {
+              if (dxy_min(j, i) + gzc2 <= 1.0) {
+                mask(k, j, i) |= Overlapped;
               }
             }
           }
@@ -623,6 +677,14 @@ namespace dials {
       DIALS_ASSERT(bbox.size() == panel.size());
       af::shared<double> fraction(bbox.size());
       for (std::size_t i = 0; i < bbox.size(); ++i) {
+        // A windowed volume only masks its newest frame, so the reflections
+        // not on that frame are skipped and given a negative fraction
+        if (volume.windowed()
+            && (bbox[i][5] <= volume.mask_frame0()
+                || bbox[i][4] >= volume.mask_frame1())) {
+          fraction[i] = -1;
+          continue;
+        }
         fraction[i] =
           volume_single(volume.get(panel[i]), bbox[i], s1[i], frame[i], panel[i], i);
       }
@@ -645,9 +707,8 @@ namespace dials {
       int width = volume.accessor()[2];
       int height = volume.accessor()[1];
       int frame0 = volume.frame0();
-      int frame1 = volume.frame1();
-      z0 = std::max(frame0, z0);
-      z1 = std::min(frame1, z1);
+      z0 = std::max(volume.mask_frame0(), z0);
+      z1 = std::min(volume.mask_frame1(), z1);
       DIALS_ASSERT(x1 > x0);
       DIALS_ASSERT(y1 > y0);
       DIALS_ASSERT(z1 > z0);
@@ -754,7 +815,67 @@ namespace dials {
       }
     }
 
+    /**
+     * Mask all the foreground/background pixels for all the shoeboxes,
+     * sharing the shoeboxes between a number of threads.
+     * @param id The experiment id
+     * @param shoeboxes The shoebox list
+     * @param s1 The list of beam vectors
+     * @param frame The list of frame numbers
+     * @param nthreads The number of threads
+     */
+    void operator()(const af::const_ref<int> &id,
+                    af::ref<Shoebox<> > shoeboxes,
+                    const af::const_ref<vec3<double> > &s1,
+                    const af::const_ref<double> &frame,
+                    const af::const_ref<std::size_t> &panel,
+                    std::size_t nthreads) const {
+      DIALS_ASSERT(shoeboxes.size() == id.size());
+      DIALS_ASSERT(shoeboxes.size() == s1.size());
+      DIALS_ASSERT(shoeboxes.size() == frame.size());
+      DIALS_ASSERT(shoeboxes.size() == panel.size());
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] < size());
+      }
+      dials::util::parallel_for(
+        shoeboxes.size(), nthreads, MaskJob(this, id, shoeboxes, s1, frame, panel));
+    }
+
   private:
+    /**
+     * Mask a contiguous range of shoeboxes. Each shoebox is only touched by
+     * one job so no locking is needed.
+     */
+    class MaskJob {
+    public:
+      MaskJob(const MaskMultiCalculator *multi,
+              const af::const_ref<int> &id,
+              af::ref<Shoebox<> > shoeboxes,
+              const af::const_ref<vec3<double> > &s1,
+              const af::const_ref<double> &frame,
+              const af::const_ref<std::size_t> &panel)
+          : multi_(multi),
+            id_(id),
+            shoeboxes_(shoeboxes),
+            s1_(s1),
+            frame_(frame),
+            panel_(panel) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          multi_->compute_[id_[i]]->single(shoeboxes_[i], s1_[i], frame_[i], panel_[i]);
+        }
+      }
+
+    private:
+      const MaskMultiCalculator *multi_;
+      af::const_ref<int> id_;
+      af::ref<Shoebox<> > shoeboxes_;
+      af::const_ref<vec3<double> > s1_;
+      af::const_ref<double> frame_;
+      af::const_ref<std::size_t> panel_;
+    };
+
     std::vector<boost::shared_ptr<MaskCalculatorIface> > compute_;
   };
 
@@ -59,6 +59,15 @@
         .help = "Filter reflections by min zeta"
     }
 
+    partiality
+    {
+      fast_erf = False
+        .type = bool
+        .help = "Use a fast approximation to the error function when computing"
+                "the partiality. The partialities are accurate to about 1.5e-7."
+        .expert_level = 2
+    }
+
     fitting {
 
       scan_step = 5
@@ -81,6 +90,43 @@
         .type = choice
         .help = "The fitting method"
 
+      batch_fit = False
+        .type = bool
+        .help = "Fit the profiles of the reflections in each job of the"
+                "threaded integrator together, with integration.mp.batch_size"
+                "reflections in each job. The shoeboxes are transformed to"
+                "reciprocal space one at a time and then the whole batch is"
+                "fitted in one pass, which runs on an accelerator if DIALS was"
+                "built with OpenMP offload (DIALS_ENABLE_OFFLOAD). Only used"
+                "when fitting in reciprocal space."
+        .expert_level = 2
+
+      geometry_cache_tile_size = 0
+        .type = int(value_min=0)
+        .help = "Cache the directions of the pixel corners in square tiles of"
+                "this size, so that the reciprocal space transform does not"
+                "recompute the detector geometry for every reflection. On"
+                "panels with a parallax correction each tile uses a single"
+                "attenuation length. Set to 0 to disable the cache."
+        .expert_level = 2
+
+      transform_cache {
+
+        enable = False
+          .type = bool
+          .help = "Keep the shoeboxes transformed to the reciprocal space grid"
+                  "while forming the reference profiles and reuse them when"
+                  "fitting the same shoeboxes during integration. Only used"
+                  "when fitting in reciprocal space with a single job."
+          .expert_level = 2
+
+        max_memory = 1073741824
+          .type = int(value_min=0)
+          .help = "The maximum number of bytes of transformed shoeboxes kept"
+                  "in memory. Further shoeboxes are written to a temporary file."
+          .expert_level = 2
+      }
+
       detector_space {
 
         deconvolution = False
@@ -413,6 +459,7 @@ def predict_reflections(
         margin=1,
         force_static=False,
         padding=0,
+        nthreads=1,
         **kwargs,
     ):
         """
@@ -444,6 +491,7 @@ def predict_reflections(
             margin=margin,
             force_static=force_static,
             padding=padding,
+            nthreads=nthreads,
         )
         return predict()
 
@@ -460,6 +508,7 @@ def compute_partiality(
         :param detector: The detector model
         :param goniometer: The goniometer model
         :param scan: The scan model
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.profile_model.gaussian_rs import PartialityCalculator
 
@@ -467,10 +516,15 @@ def compute_partiality(
         calculate = PartialityCalculator(
             crystal, beam, detector, goniometer, scan, self._sigma_m
         )
+        if self.params is not None and hasattr(calculate, "fast_erf"):
+            calculate.fast_erf = self.params.gaussian_rs.partiality.fast_erf
 
         # Compute the partiality
         partiality = calculate(
-            reflections["s1"], reflections["xyzcal.px"].parts()[2], reflections["bbox"]
+            reflections["s1"],
+            reflections["xyzcal.px"].parts()[2],
+            reflections["bbox"],
+            kwargs.get("nthreads", 1),
         )
 
         # Return the partiality
@@ -496,6 +550,7 @@ def compute_bbox(
         :param detector: The detector model
         :param goniometer: The goniometer model
         :param scan: The scan model
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.profile_model.gaussian_rs import BBoxCalculator
 
@@ -514,7 +569,10 @@ def compute_bbox(
 
         # Calculate the bounding boxes of all the reflections
         bbox = calculate(
-            reflections["s1"], reflections["xyzcal.px"].parts()[2], reflections["panel"]
+            reflections["s1"],
+            reflections["xyzcal.px"].parts()[2],
+            reflections["panel"],
+            kwargs.get("nthreads", 1),
         )
 
         # Return the bounding boxes
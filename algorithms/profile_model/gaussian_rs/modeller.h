@@ -314,10 +314,8 @@ namespace dials { namespace algorithms {
           // Get the indices and weights of the profiles
           af::shared<std::size_t> indices =
             sampler_->nearest_n(sbox[i].panel, xyzpx[i]);
-          af::shared<double> weights(indices.size());
-          for (std::size_t j = 0; j < indices.size(); ++j) {
-            weights[j] = sampler_->weight(indices[j], sbox[i].panel, xyzpx[i]);
-          }
+          af::shared<double> weights =
+            sampler_->weights(indices.const_ref(), sbox[i].panel, xyzpx[i]);
 
           // Add the profile
           add(
@@ -583,6 +581,8 @@ namespace dials { namespace algorithms {
                                        fit_method_);
       result.finalized_ = finalized_;
       result.n_reflections_.assign(n_reflections_.begin(), n_reflections_.end());
+      result.signal_.assign(signal_.begin(), signal_.end());
+      result.negative_.assign(negative_.begin(), negative_.end());
       for (std::size_t i = 0; i < data_.size(); ++i) {
         if (data_[i].size() > 0) {
           result.data_[i] = data_type(accessor_, 0);
@@ -24,6 +24,7 @@
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials {
   namespace algorithms {
@@ -47,6 +48,28 @@ namespace dials {
   using std::ceil;
   using std::floor;
 
+  /**
+   * A fast approximation to the error function (Abramowitz and Stegun
+   * 7.1.26). The absolute error is less than 1.5e-7. The function has no
+   * branches other than the sign so it is cheap to evaluate for a whole
+   * column of values.
+   * @param x The value
+   * @returns The approximate value of erf(x)
+   */
+  inline double erf_fast(double x) {
+    const double p = 0.3275911;
+    const double a1 = 0.254829592;
+    const double a2 = -0.284496736;
+    const double a3 = 1.421413741;
+    const double a4 = -1.453152027;
+    const double a5 = 1.061405429;
+    double sign = x < 0 ? -1.0 : 1.0;
+    double ax = std::abs(x);
+    double t = 1.0 / (1.0 + p * ax);
+    double y = ((((a5 * t + a4) * t + a3) * t + a2) * t + a1) * t;
+    return sign * (1.0 - y * std::exp(-ax * ax));
+  }
+
   /**
    * Interface for bounding box calculator.
    */
@@ -59,6 +82,53 @@ namespace dials {
     virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
                                      const af::const_ref<double> &frame,
                                      const af::const_ref<int6> &bbox) const = 0;
+
+    /**
+     * Calculate the partiality for an array of reflections, sharing the
+     * reflections between a number of threads.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     * @param nthreads The number of threads
+     */
+    af::shared<double> array_parallel(const af::const_ref<vec3<double> > &s1,
+                                      const af::const_ref<double> &frame,
+                                      const af::const_ref<int6> &bbox,
+                                      std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      dials::util::parallel_for(
+        s1.size(), nthreads, ArrayJob(this, s1, frame, bbox, result.ref()));
+      return result;
+    }
+
+  private:
+    /**
+     * Compute the partiality for a contiguous range of reflections
+     */
+    class ArrayJob {
+    public:
+      ArrayJob(const PartialityCalculatorIface *compute,
+               const af::const_ref<vec3<double> > &s1,
+               const af::const_ref<double> &frame,
+               const af::const_ref<int6> &bbox,
+               af::ref<double> result)
+          : compute_(compute), s1_(s1), frame_(frame), bbox_(bbox), result_(result) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          result_[i] = compute_->single(s1_[i], frame_[i], bbox_[i]);
+        }
+      }
+
+    private:
+      const PartialityCalculatorIface *compute_;
+      af::const_ref<vec3<double> > s1_;
+      af::const_ref<double> frame_;
+      af::const_ref<int6> bbox_;
+      af::ref<double> result_;
+    };
   };
 
   /** Calculate the partiality for each reflection */
@@ -76,9 +146,11 @@ namespace dials {
                            const Scan &scan,
                            double sigma_m)
         : s0_(beam.get_s0()),
-          m2_(gonio.get_rotation_axis()),
+          m2_(gonio.get_rotation_axis().normalize()),
           scan_(scan),
-          sigma_m_(1, sigma_m) {
+          dphi_(scan.get_oscillation()[1]),
+          sigma_m_(1, sigma_m),
+          fast_erf_(false) {
       DIALS_ASSERT(sigma_m > 0.0);
     }
 
@@ -94,9 +166,11 @@ namespace dials {
                            const Scan &scan,
                            const af::const_ref<double> &sigma_m)
         : s0_(beam.get_s0()),
-          m2_(gonio.get_rotation_axis()),
+          m2_(gonio.get_rotation_axis().normalize()),
           scan_(scan),
-          sigma_m_(sigma_m.begin(), sigma_m.end()) {
+          dphi_(scan.get_oscillation()[1]),
+          sigma_m_(sigma_m.begin(), sigma_m.end()),
+          fast_erf_(false) {
       DIALS_ASSERT(sigma_m.all_gt(0.0));
       DIALS_ASSERT(sigma_m.size() == scan.get_num_images());
       DIALS_ASSERT(sigma_m.size() > 0);
@@ -131,19 +205,41 @@ namespace dials {
         }
       }
 
-      // Get the rotation angle
-      double phi = scan_.get_angle_from_array_index(frame);
-      double phia = scan_.get_angle_from_array_index(bbox[4]);
-      double phib = scan_.get_angle_from_array_index(bbox[5]);
+      // The rotation angle is linear in the frame number, so the angles of
+      // the bbox edges relative to the reflection follow from the frames
+      double zeta = profile_model::gaussian_rs::zeta_factor(m2_, s0_, s1);
+      double c = std::abs(zeta) * dphi_ / (sqrt(2.0) * sigma_m);
+      double a = c * (bbox[4] - frame);
+      double b = c * (bbox[5] - frame);
 
       // Compute the partiality
-      double zeta = profile_model::gaussian_rs::zeta_factor(m2_.normalize(), s0_, s1);
-      double c = std::abs(zeta) / (sqrt(2.0) * sigma_m);
-      double p = 0.5 * (erf(c * (phib - phi)) - erf(c * (phia - phi)));
+      double p = 0.0;
+      if (fast_erf_) {
+        p = 0.5 * (erf_fast(b) - erf_fast(a));
+        p = std::min(std::max(p, 0.0), 1.0);
+      } else {
+        p = 0.5 * (erf(b) - erf(a));
+      }
       DIALS_ASSERT(p >= 0.0 && p <= 1.0);
       return p;
     }
 
+    /**
+     * Use the fast approximation to the error function. The partialities are
+     * then accurate to about 1.5e-7.
+     * @param fast_erf True/False use the fast approximation
+     */
+    void set_fast_erf(bool fast_erf) {
+      fast_erf_ = fast_erf;
+    }
+
+    /**
+     * @returns True/False the fast approximation to erf is used
+     */
+    bool get_fast_erf() const {
+      return fast_erf_;
+    }
+
     /**
      * Calculate the partiality for an array of reflections
      * @param s1 The array of diffracted beam vectors
@@ -166,7 +262,9 @@ namespace dials {
     vec3<double> s0_;
     vec3<double> m2_;
     Scan scan_;
+    double dphi_;
     af::shared<double> sigma_m_;
+    bool fast_erf_;
   };
 
   /** Calculate the partiality for each reflection */
@@ -264,7 +362,66 @@ namespace dials {
       return result;
     }
 
+    /**
+     * Calculate the partiality for an array of reflections, sharing the
+     * reflections between a number of threads.
+     * @param id The experiment id
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bounding boxes
+     * @param nthreads The number of threads
+     */
+    af::shared<double> operator()(const af::const_ref<std::size_t> &id,
+                                  const af::const_ref<vec3<double> > &s1,
+                                  const af::const_ref<double> &frame,
+                                  const af::const_ref<int6> &bbox,
+                                  std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == id.size());
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] < size());
+      }
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      dials::util::parallel_for(
+        s1.size(), nthreads, ArrayJob(this, id, s1, frame, bbox, result.ref()));
+      return result;
+    }
+
   private:
+    /**
+     * Compute the partiality for a contiguous range of reflections
+     */
+    class ArrayJob {
+    public:
+      ArrayJob(const PartialityMultiCalculator *multi,
+               const af::const_ref<std::size_t> &id,
+               const af::const_ref<vec3<double> > &s1,
+               const af::const_ref<double> &frame,
+               const af::const_ref<int6> &bbox,
+               af::ref<double> result)
+          : multi_(multi),
+            id_(id),
+            s1_(s1),
+            frame_(frame),
+            bbox_(bbox),
+            result_(result) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          result_[i] = multi_->compute_[id_[i]]->single(s1_[i], frame_[i], bbox_[i]);
+        }
+      }
+
+    private:
+      const PartialityMultiCalculator *multi_;
+      af::const_ref<std::size_t> id_;
+      af::const_ref<vec3<double> > s1_;
+      af::const_ref<double> frame_;
+      af::const_ref<int6> bbox_;
+      af::ref<double> result_;
+    };
+
     std::vector<boost::shared_ptr<PartialityCalculatorIface> > compute_;
   };
 
@@ -82,7 +82,8 @@ namespace dials {
                                          obj.sigma_b(),
                                          obj.sigma_m(),
                                          obj.n_sigma(),
-                                         obj.half_grid_size());
+                                         obj.half_grid_size(),
+                                         obj.cache_tile_size());
       }
     };
 
@@ -226,6 +227,15 @@ namespace dials {
                   double,
                   double,
                   std::size_t>())
+        .def(init<boost::shared_ptr<BeamBase>,
+                  const Detector &,
+                  const Goniometer &,
+                  const Scan &,
+                  double,
+                  double,
+                  double,
+                  std::size_t,
+                  std::size_t>())
         .def("__init__", make_constructor(&make_transform_spec_from_experiment))
         .def("sigma_b", &TransformSpec::sigma_b)
         .def("sigma_m", &TransformSpec::sigma_m)
@@ -233,6 +243,7 @@ namespace dials {
         .def("grid_size", &TransformSpec::grid_size)
         .def("step_size", &TransformSpec::step_size)
         .def("grid_centre", &TransformSpec::grid_centre)
+        .def("cache_tile_size", &TransformSpec::cache_tile_size)
         .def_pickle(TransformSpecPickleSuite());
 
       transform_forward_wrapper<double>("TransformForward");
@@ -0,0 +1,184 @@
+/*
+ * geometry_cache.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_GEOMETRY_CACHE_H
+#define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_GEOMETRY_CACHE_H
+
+#include <algorithm>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials {
+  namespace algorithms {
+    namespace profile_model {
+      namespace gaussian_rs {
+  namespace transform {
+
+    using dxtbx::model::Detector;
+    using dxtbx::model::Panel;
+    using scitbx::vec2;
+    using scitbx::vec3;
+    using scitbx::af::int2;
+
+    /**
+     * A cache of the directions of the pixel corners on the detector. The
+     * panels are divided into square tiles of pixel corners and the unit
+     * vectors in the direction of each corner are computed the first time a
+     * tile is needed, so neighbouring reflections share the same geometry
+     * rather than computing it again for every reflection.
+     *
+     * For panels with a parallax correction the corners of a tile are all
+     * computed with the attenuation length at the centre of the tile, rather
+     * than at the centre of each reflection. This changes the corner
+     * positions by a tiny fraction of a pixel.
+     *
+     * The tiles are shared between threads; a tile may occasionally be
+     * computed twice but is never changed once stored.
+     */
+    class TransformGeometryCache : public boost::noncopyable {
+    public:
+      /**
+       * The directions of the pixel corners in a tile
+       */
+      class Tile {
+      public:
+        /**
+         * Compute the directions of the corners in a tile
+         * @param panel The panel
+         * @param x0 The first corner in x
+         * @param y0 The first corner in y
+         * @param xsize The number of corners in x
+         * @param ysize The number of corners in y
+         */
+        Tile(const Panel &panel, int x0, int y0, int xsize, int ysize)
+            : x0_(x0),
+              y0_(y0),
+              direction_(af::c_grid<2>(ysize, xsize),
+                         af::init_functor_null<vec3<double> >()) {
+          DIALS_ASSERT(xsize > 0 && ysize > 0);
+          double attenuation_length =
+            panel.attenuation_length(vec2<double>(x0 + xsize / 2.0, y0 + ysize / 2.0));
+          for (int j = 0; j < ysize; ++j) {
+            for (int i = 0; i < xsize; ++i) {
+              vec3<double> sp =
+                panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j), attenuation_length);
+              direction_(j, i) = sp.normalize();
+            }
+          }
+        }
+
+        /**
+         * @returns True/False the corner is in the tile
+         */
+        bool contains(int x, int y) const {
+          return x >= x0_ && y >= y0_ && x < x0_ + (int)direction_.accessor()[1]
+                 && y < y0_ + (int)direction_.accessor()[0];
+        }
+
+        /**
+         * @returns The unit vector in the direction of a corner
+         */
+        const vec3<double> &direction(int x, int y) const {
+          return direction_(y - y0_, x - x0_);
+        }
+
+      private:
+        int x0_;
+        int y0_;
+        af::versa<vec3<double>, af::c_grid<2> > direction_;
+      };
+
+      typedef boost::shared_ptr<const Tile> tile_pointer;
+
+      /**
+       * Initialise the cache
+       * @param detector The detector model
+       * @param tile_size The number of pixel corners along each side of a tile
+       */
+      TransformGeometryCache(const Detector &detector, std::size_t tile_size = 32)
+          : tile_size_(tile_size) {
+        DIALS_ASSERT(tile_size > 0);
+        for (std::size_t i = 0; i < detector.size(); ++i) {
+          vec2<std::size_t> image_size = detector[i].get_image_size();
+          int size = (int)tile_size;
+          int2 num_corners((int)image_size[1] + 1, (int)image_size[0] + 1);
+          int2 num_tiles((num_corners[0] + size - 1) / size,
+                         (num_corners[1] + size - 1) / size);
+          num_corners_.push_back(num_corners);
+          num_tiles_.push_back(num_tiles);
+          tiles_.push_back(std::vector<tile_pointer>(num_tiles[0] * num_tiles[1]));
+        }
+      }
+
+      /**
+       * @returns The tile size
+       */
+      std::size_t tile_size() const {
+        return tile_size_;
+      }
+
+      /**
+       * Get the tile containing a pixel corner, computing it if needed
+       * @param panel The panel model
+       * @param index The panel number
+       * @param x The corner x coordinate
+       * @param y The corner y coordinate
+       * @returns The tile or NULL if the corner is not on the panel
+       */
+      tile_pointer tile(const Panel &panel, std::size_t index, int x, int y) {
+        DIALS_ASSERT(index < tiles_.size());
+        int2 num_corners = num_corners_[index];
+        if (x < 0 || y < 0 || y >= num_corners[0] || x >= num_corners[1]) {
+          return tile_pointer();
+        }
+        int tx = x / (int)tile_size_;
+        int ty = y / (int)tile_size_;
+        std::size_t k = ty * num_tiles_[index][1] + tx;
+        {
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          if (tiles_[index][k] != NULL) {
+            return tiles_[index][k];
+          }
+        }
+
+        // Compute the tile without holding the lock
+        int x0 = tx * (int)tile_size_;
+        int y0 = ty * (int)tile_size_;
+        tile_pointer result = boost::make_shared<Tile>(
+          panel,
+          x0,
+          y0,
+          std::min((int)tile_size_, num_corners[1] - x0),
+          std::min((int)tile_size_, num_corners[0] - y0));
+        boost::lock_guard<boost::mutex> guard(mutex_);
+        if (tiles_[index][k] == NULL) {
+          tiles_[index][k] = result;
+        }
+        return tiles_[index][k];
+      }
+
+    private:
+      std::size_t tile_size_;
+      std::vector<int2> num_corners_;
+      std::vector<int2> num_tiles_;
+      std::vector<std::vector<tile_pointer> > tiles_;
+      boost::mutex mutex_;
+    };
+
+}}}}}  // namespace dials::algorithms::profile_model::gaussian_rs::transform
+
+#endif /* DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_GEOMETRY_CACHE_H */
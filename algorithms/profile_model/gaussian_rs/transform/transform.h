@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 
+#include <algorithm>
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
@@ -22,6 +24,7 @@
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/map_frames.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/beam_vector_map.h>
+#include <dials/algorithms/profile_model/gaussian_rs/transform/geometry_cache.h>
 #include <dials/model/data/shoebox.h>
 
 namespace dials {
@@ -35,6 +38,8 @@ namespace dials {
     using dials::algorithms::polygon::clip::vert4;
     using dials::algorithms::polygon::clip::vert8;
     using dials::algorithms::polygon::spatial_interpolation::Match;
+    using dials::algorithms::polygon::spatial_interpolation::
+      quad_grid_intersection_area_fast;
     using dials::algorithms::polygon::spatial_interpolation::quad_to_grid;
     using dials::algorithms::polygon::spatial_interpolation::
       reverse_quad_inplace_if_backward;
@@ -78,6 +83,7 @@ namespace dials {
        * @param sigma_m The crystal mosaicity
        * @param n_sigma The number of standard deviations
        * @param grid_size The size of the reflection basis grid
+       * @param cache_tile_size The tile size of the geometry cache (0 = none)
        */
       TransformSpec(const boost::shared_ptr<BeamBase> beam,
                     const Detector &detector,
@@ -86,7 +92,8 @@ namespace dials {
                     double sigma_b,
                     double sigma_m,
                     double n_sigma,
-                    std::size_t grid_size)
+                    std::size_t grid_size,
+                    std::size_t cache_tile_size = 0)
           : beam_(beam),
             detector_(detector),
             goniometer_(gonio),
@@ -106,6 +113,10 @@ namespace dials {
         DIALS_ASSERT(detector.size() > 0);
         DIALS_ASSERT(step_size_.all_gt(0));
         DIALS_ASSERT(grid_size_.all_gt(0));
+        if (cache_tile_size > 0) {
+          geometry_cache_ =
+            boost::make_shared<TransformGeometryCache>(detector_, cache_tile_size);
+        }
       }
 
       /** @returns the beam */
@@ -163,6 +174,16 @@ namespace dials {
         return grid_centre_;
       }
 
+      /** @returns The geometry cache (NULL if not used) */
+      boost::shared_ptr<TransformGeometryCache> geometry_cache() const {
+        return geometry_cache_;
+      }
+
+      /** @returns The tile size of the geometry cache (0 if not used) */
+      std::size_t cache_tile_size() const {
+        return geometry_cache_ != NULL ? geometry_cache_->tile_size() : 0;
+      }
+
     private:
       boost::shared_ptr<BeamBase> beam_;
       Detector detector_;
@@ -175,6 +196,7 @@ namespace dials {
       int3 grid_size_;
       double3 step_size_;
       double3 grid_centre_;
+      boost::shared_ptr<TransformGeometryCache> geometry_cache_;
     };
 
     /**
@@ -241,6 +263,8 @@ namespace dials {
         // Initialise some stuff
         x0_ = bbox[0];
         y0_ = bbox[2];
+        panel_ = panel;
+        geometry_cache_ = spec.geometry_cache();
         shoebox_size_ = int3(bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]);
         DIALS_ASSERT(shoebox_size_.all_gt(0));
         step_size_ = spec.step_size();
@@ -286,7 +310,6 @@ namespace dials {
         DIALS_ASSERT(image.accessor().all_eq(shoebox_size_));
         DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
 
-        af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
         af::const_ref<FloatType, af::c_grid<2> > efraction = efraction_arr_.const_ref();
 
         // Initialise the profile arrays
@@ -309,54 +332,25 @@ namespace dials {
           }
         }
 
-        vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
-        double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
-
-        af::versa<vec2<double>, af::c_grid<2> > gc_array(
-          af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
-        for (int j = 0; j <= shoebox_size_[1]; ++j) {
-          for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
-          }
-        }
-
-        // Loop through all the points in the shoebox. Calculate the polygon
-        // formed by the pixel in the local coordinate system. Find the points
-        // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
-        af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
-        for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
-          if (y0_ + j < 0 | y0_ + j >= panel.get_image_size()[1]) {
-            // This y-coordinate is outside the bounds of the panel
-            continue;
-          }
-          for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
-            if (x0_ + i < 0 | x0_ + i >= panel.get_image_size()[0]) {
-              // This x-coordinate is outside the bounds of the panel
-              continue;
-            }
-            vert4 input(gc_array(j, i),
-                        gc_array(j, i + 1),
-                        gc_array(j + 1, i + 1),
-                        gc_array(j + 1, i));
-            af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
-            for (int m = 0; m < matches.size(); ++m) {
-              FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int ii = index % grid_size_[2];
-              int jj = index / grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType value = image(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    profile_(kk, jj, ii) += value * zfraction(k, kk);
-                  }
-                }
-              }
-            }
-          }
+        // Map the pixels to the grid, with the grid size fixed at compile
+        // time for the common sizes
+        af::shared<Match> matches = overlaps(panel);
+        switch (grid_size_[0]) {
+        case 7:
+          map_pixels<7>(matches.const_ref(), image, mask);
+          break;
+        case 9:
+          map_pixels<9>(matches.const_ref(), image, mask);
+          break;
+        case 11:
+          map_pixels<11>(matches.const_ref(), image, mask);
+          break;
+        case 13:
+          map_pixels<13>(matches.const_ref(), image, mask);
+          break;
+        default:
+          map_pixels<0>(matches.const_ref(), image, mask);
+          break;
         }
       }
 
@@ -375,7 +369,6 @@ namespace dials {
         DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
         DIALS_ASSERT(image.accessor().all_eq(bkgrd.accessor()));
 
-        af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
         af::const_ref<FloatType, af::c_grid<2> > efraction = efraction_arr_.const_ref();
 
         // Initialise the profile arrays
@@ -399,59 +392,126 @@ namespace dials {
           }
         }
 
-        vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
-        double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
+        // Map the pixels to the grid, with the grid size fixed at compile
+        // time for the common sizes
+        af::shared<Match> matches = overlaps(panel);
+        switch (grid_size_[0]) {
+        case 7:
+          map_pixels<7>(matches.const_ref(), image, bkgrd, mask);
+          break;
+        case 9:
+          map_pixels<9>(matches.const_ref(), image, bkgrd, mask);
+          break;
+        case 11:
+          map_pixels<11>(matches.const_ref(), image, bkgrd, mask);
+          break;
+        case 13:
+          map_pixels<13>(matches.const_ref(), image, bkgrd, mask);
+          break;
+        default:
+          map_pixels<0>(matches.const_ref(), image, bkgrd, mask);
+          break;
+        }
+      }
 
-        // Mapping from shoebox image coordinate to transformed grid coordinate
-        af::versa<vec2<double>, af::c_grid<2> > gc_array(
-          af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
-        for (int j = 0; j <= shoebox_size_[1]; ++j) {
-          for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
+      /**
+       * Loop through the overlaps between the pixels and the grid points.
+       * The overlaps are ordered by pixel, so the frames of each pixel are
+       * mapped to the grid frames once and the result is then shared between
+       * all the grid points the pixel overlaps. The grid is a cube of N
+       * points along each side, or of the run time grid size if N is 0.
+       * @param matches The overlaps between the pixels and the grid
+       * @param image The image to transform
+       * @param mask The mask accompanying the image
+       */
+      template <int N>
+      void map_pixels(const af::const_ref<Match> &matches,
+                      const af::const_ref<FloatType, af::c_grid<3> > &image,
+                      const af::const_ref<bool, af::c_grid<3> > &mask) {
+        const int nz = N > 0 ? N : grid_size_[0];
+        const int stride = N > 0 ? N * N : grid_size_[1] * grid_size_[2];
+        DIALS_ASSERT(N == 0 || grid_size_.all_eq(N));
+        af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
+        FloatType fixed_value[N > 0 ? N : 1];
+        std::vector<FloatType> dynamic_value(N > 0 ? 0 : nz);
+        FloatType *value = N > 0 ? fixed_value : &dynamic_value[0];
+        FloatType *profile = profile_.begin();
+        int current = -1;
+        for (std::size_t m = 0; m < matches.size(); ++m) {
+          if (matches[m].in != current) {
+            current = matches[m].in;
+            int j = current / shoebox_size_[2];
+            int i = current % shoebox_size_[2];
+            std::fill(value, value + nz, FloatType(0));
+            for (int k = 0; k < shoebox_size_[0]; ++k) {
+              if (mask(k, j, i)) {
+                FloatType v = image(k, j, i);
+                const FloatType *zf = &zfraction(k, 0);
+                for (int kk = 0; kk < nz; ++kk) {
+                  value[kk] += v * zf[kk];
+                }
+              }
+            }
+          }
+          FloatType fraction = matches[m].fraction;
+          std::size_t out = matches[m].out;
+          for (int kk = 0; kk < nz; ++kk) {
+            profile[out + kk * stride] += fraction * value[kk];
           }
         }
+      }
 
-        // Loop through all the points in the shoebox. Calculate the polygon
-        // formed by the pixel in the local coordinate system. Find the points
-        // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
-        af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
-        for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
-          if (y0_ + j < 0 | y0_ + j >= panel.get_image_size()[1]) {
-            // This y-coordinate is outside the bounds of the panel
-            continue;
-          }
-          for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
-            if (x0_ + i < 0 | x0_ + i >= panel.get_image_size()[0]) {
-              // This x-coordinate is outside the bounds of the panel
-              continue;
-            }
-            // The corners of the image pixel mapped to transformed grid coordinates
-            vert4 input(gc_array(j, i),
-                        gc_array(j, i + 1),
-                        gc_array(j + 1, i + 1),
-                        gc_array(j + 1, i));
-            af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
-            for (int m = 0; m < matches.size(); ++m) {
-              FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int jj = index / grid_size_[2];
-              int ii = index % grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType ivalue = image(k, j, i) * fraction;
-                  FloatType bvalue = bkgrd(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    FloatType zf = zfraction(k, kk);
-                    profile_(kk, jj, ii) += ivalue * zf;
-                    background_(kk, jj, ii) += bvalue * zf;
-                  }
+      /**
+       * Loop through the overlaps between the pixels and the grid points,
+       * mapping the image and background together.
+       * @param matches The overlaps between the pixels and the grid
+       * @param image The image to transform
+       * @param bkgrd The background image to transform
+       * @param mask The mask accompanying the image
+       */
+      template <int N>
+      void map_pixels(const af::const_ref<Match> &matches,
+                      const af::const_ref<FloatType, af::c_grid<3> > &image,
+                      const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
+                      const af::const_ref<bool, af::c_grid<3> > &mask) {
+        const int nz = N > 0 ? N : grid_size_[0];
+        const int stride = N > 0 ? N * N : grid_size_[1] * grid_size_[2];
+        DIALS_ASSERT(N == 0 || grid_size_.all_eq(N));
+        af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
+        FloatType fixed_ivalue[N > 0 ? N : 1];
+        FloatType fixed_bvalue[N > 0 ? N : 1];
+        std::vector<FloatType> dynamic_ivalue(N > 0 ? 0 : nz);
+        std::vector<FloatType> dynamic_bvalue(N > 0 ? 0 : nz);
+        FloatType *ivalue = N > 0 ? fixed_ivalue : &dynamic_ivalue[0];
+        FloatType *bvalue = N > 0 ? fixed_bvalue : &dynamic_bvalue[0];
+        FloatType *profile = profile_.begin();
+        FloatType *background = background_.begin();
+        int current = -1;
+        for (std::size_t m = 0; m < matches.size(); ++m) {
+          if (matches[m].in != current) {
+            current = matches[m].in;
+            int j = current / shoebox_size_[2];
+            int i = current % shoebox_size_[2];
+            std::fill(ivalue, ivalue + nz, FloatType(0));
+            std::fill(bvalue, bvalue + nz, FloatType(0));
+            for (int k = 0; k < shoebox_size_[0]; ++k) {
+              if (mask(k, j, i)) {
+                FloatType iv = image(k, j, i);
+                FloatType bv = bkgrd(k, j, i);
+                const FloatType *zf = &zfraction(k, 0);
+                for (int kk = 0; kk < nz; ++kk) {
+                  ivalue[kk] += iv * zf[kk];
+                  bvalue[kk] += bv * zf[kk];
                 }
               }
             }
           }
+          FloatType fraction = matches[m].fraction;
+          std::size_t out = matches[m].out;
+          for (int kk = 0; kk < nz; ++kk) {
+            profile[out + kk * stride] += fraction * ivalue[kk];
+            background[out + kk * stride] += fraction * bvalue[kk];
+          }
         }
       }
 
@@ -474,12 +534,93 @@ namespace dials {
                       double attenuation_length) const {
         vec3<double> sp =
           panel.get_pixel_lab_coord(vec2<double>(x0_ + i, y0_ + j), attenuation_length);
-        vec3<double> ds = sp.normalize() * s1_.length() - s1_;
+        return gc(sp.normalize());
+      }
+
+      /**
+       * Get a grid coordinate from the direction of a pixel corner
+       * @param direction The unit vector towards the corner
+       * @returns The grid (c1, c2) index
+       */
+      vec2<double> gc(const vec3<double> &direction) const {
+        vec3<double> ds = direction * s1_.length() - s1_;
         return vec2<double>(grid_cent_[2] + (e1_ * ds) / step_size_[2],
                             grid_cent_[1] + (e2_ * ds) / step_size_[1]);
       }
 
+      /**
+       * Compute the grid coordinates of all the pixel corners in the shoebox.
+       * If the spec has a geometry cache then the corner directions are taken
+       * from the cache where possible.
+       * @param panel The panel
+       * @returns The grid coordinates
+       */
+      af::versa<vec2<double>, af::c_grid<2> > grid_coords(const Panel &panel) const {
+        af::versa<vec2<double>, af::c_grid<2> > result(
+          af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
+        bool has_attenuation_length = false;
+        double attenuation_length = 0;
+        TransformGeometryCache::tile_pointer tile;
+        for (int j = 0; j <= shoebox_size_[1]; ++j) {
+          for (int i = 0; i <= shoebox_size_[2]; ++i) {
+            int x = x0_ + i;
+            int y = y0_ + j;
+            if (geometry_cache_ != NULL && (tile == NULL || !tile->contains(x, y))) {
+              tile = geometry_cache_->tile(panel, panel_, x, y);
+            }
+            if (tile != NULL) {
+              result(j, i) = gc(tile->direction(x, y));
+            } else {
+              if (!has_attenuation_length) {
+                vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
+                attenuation_length = panel.attenuation_length(shoebox_centroid_px);
+                has_attenuation_length = true;
+              }
+              result(j, i) = gc(panel, j, i, attenuation_length);
+            }
+          }
+        }
+        return result;
+      }
+
+      /**
+       * Compute the overlaps between the shoebox pixels and the grid points.
+       * The polygon formed by each pixel in the local coordinate system is
+       * clipped with the grid points it covers, giving a sparse list of
+       * (pixel, grid point, fraction) triplets. Pixels outside the panel are
+       * skipped and the triplets are ordered by pixel.
+       * @param panel The panel
+       * @returns The overlaps
+       */
+      af::shared<Match> overlaps(const Panel &panel) const {
+        af::versa<vec2<double>, af::c_grid<2> > gc_array = grid_coords(panel);
+        af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
+        af::shared<Match> matches;
+        matches.reserve(4 * shoebox_size_[1] * shoebox_size_[2]);
+        for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
+          if (y0_ + j < 0 | y0_ + j >= panel.get_image_size()[1]) {
+            // This y-coordinate is outside the bounds of the panel
+            continue;
+          }
+          for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
+            if (x0_ + i < 0 | x0_ + i >= panel.get_image_size()[0]) {
+              // This x-coordinate is outside the bounds of the panel
+              continue;
+            }
+            // The corners of the image pixel mapped to transformed grid coordinates
+            vert4 input(gc_array(j, i),
+                        gc_array(j, i + 1),
+                        gc_array(j + 1, i + 1),
+                        gc_array(j + 1, i));
+            quad_to_grid(input, grid_size2, j * shoebox_size_[2] + i, matches);
+          }
+        }
+        return matches;
+      }
+
       int x0_, y0_;
+      std::size_t panel_;
+      boost::shared_ptr<TransformGeometryCache> geometry_cache_;
       int3 shoebox_size_;
       int3 grid_size_;
       double3 step_size_;
@@ -748,6 +889,32 @@ namespace dials {
           z[k] = spec.scan().get_array_index_from_angle(phip) - bbox[4];
         }
 
+        // The frames covered by each slice and the fraction of the slice in
+        // each frame are the same for every pixel so compute them once
+        std::vector<int> z0(data.accessor()[0]);
+        std::vector<int> z1(data.accessor()[0]);
+        af::versa<double, af::c_grid<2> > zfraction(
+          af::c_grid<2>(data.accessor()[0], zs), 0);
+        for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
+          double f00 = std::min(z[k], z[k + 1]);
+          double f01 = std::max(z[k], z[k + 1]);
+          DIALS_ASSERT(f01 > f00);
+          double fr = f01 - f00;
+          z0[k] = std::max((int)0, (int)std::floor(f00));
+          z1[k] = std::min((int)zs, (int)std::ceil(f01));
+          DIALS_ASSERT(z0[k] >= 0 && z1[k] <= (int)zs);
+          for (int kk = z0[k]; kk < z1[k]; ++kk) {
+            std::size_t f10 = kk;
+            std::size_t f11 = kk + 1;
+            double f0 = std::max(f00, (double)f10);
+            double f1 = std::min(f01, (double)f11);
+            double fraction = f1 > f0 ? (f1 - f0) / fr : 0.0;
+            DIALS_ASSERT(fraction <= 1.0);
+            DIALS_ASSERT(fraction >= 0.0);
+            zfraction(k, kk) = fraction;
+          }
+        }
+
         // Get a list of pairs of overlapping polygons
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
@@ -771,14 +938,7 @@ namespace dials {
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                double area = quad_grid_intersection_area_fast(p1, ii, jj);
                 area /= p1_area;
                 const double EPS = 1e-7;
                 if (area < 0.0) {
@@ -792,22 +952,8 @@ namespace dials {
                 DIALS_ASSERT(0.0 <= area && area <= 1.0);
                 if (area > 0) {
                   for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-                    double f00 = std::min(z[k], z[k + 1]);
-                    double f01 = std::max(z[k], z[k + 1]);
-                    DIALS_ASSERT(f01 > f00);
-                    double fr = f01 - f00;
-                    int z0 = std::max((int)0, (int)std::floor(f00));
-                    int z1 = std::min((int)zs, (int)std::ceil(f01));
-                    DIALS_ASSERT(z0 >= 0 && z1 <= (int)zs);
-                    for (int kk = z0; kk < z1; ++kk) {
-                      std::size_t f10 = kk;
-                      std::size_t f11 = kk + 1;
-                      double f0 = std::max(f00, (double)f10);
-                      double f1 = std::min(f01, (double)f11);
-                      double fraction = f1 > f0 ? (f1 - f0) / fr : 0.0;
-                      DIALS_ASSERT(fraction <= 1.0);
-                      DIALS_ASSERT(fraction >= 0.0);
-                      double value = fraction * area * data(k, j, i);
+                    for (int kk = z0[k]; kk < z1[k]; ++kk) {
+                      double value = zfraction(k, kk) * area * data(k, j, i);
                       profile_(kk, jj, ii) += value;
                     }
                   }
@@ -908,6 +1054,26 @@ namespace dials {
           map_frames(zrange, cs.phi(), cs.zeta());
         af::const_ref<double, af::c_grid<2> > zfraction = zfraction_arr.const_ref();
 
+        // The frames covered by each slice are the same for every pixel so
+        // find them and check the fractions once
+        std::vector<int> z0(data.accessor()[0]);
+        std::vector<int> z1(data.accessor()[0]);
+        for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
+          const double EPS = 1e-7;
+          double f00 = std::min(z[k], z[k + 1]);
+          double f01 = std::max(z[k], z[k + 1]);
+          DIALS_ASSERT(f01 > f00);
+          z0[k] = std::max((int)0, (int)std::floor(f00));
+          z1[k] = std::min((int)zs, (int)std::ceil(f01));
+          DIALS_ASSERT(z0[k] >= 0 && z1[k] <= (int)zs);
+          DIALS_ASSERT(k < zfraction.accessor()[0]);
+          for (int kk = z0[k]; kk < z1[k]; ++kk) {
+            DIALS_ASSERT(kk < zfraction.accessor()[1]);
+            DIALS_ASSERT(zfraction(k, kk) <= 1.0 + EPS);
+            DIALS_ASSERT(zfraction(k, kk) >= 0.0 - EPS);
+          }
+        }
+
         // Get a list of pairs of overlapping polygons
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
@@ -931,14 +1097,7 @@ namespace dials {
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                double area = quad_grid_intersection_area_fast(p1, ii, jj);
                 area /= p1_area;
                 const double EPS = 1e-7;
                 if (area < 0.0) {
@@ -952,19 +1111,8 @@ namespace dials {
                 DIALS_ASSERT(0.0 <= area && area <= 1.0);
                 if (area > 0) {
                   for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
-                    double f00 = std::min(z[k], z[k + 1]);
-                    double f01 = std::max(z[k], z[k + 1]);
-                    DIALS_ASSERT(f01 > f00);
-                    int z0 = std::max((int)0, (int)std::floor(f00));
-                    int z1 = std::min((int)zs, (int)std::ceil(f01));
-                    DIALS_ASSERT(z0 >= 0 && z1 <= (int)zs);
-                    for (int kk = z0; kk < z1; ++kk) {
-                      DIALS_ASSERT(kk < zfraction.accessor()[1]);
-                      DIALS_ASSERT(k < zfraction.accessor()[0]);
-                      double fraction = zfraction(k, kk);
-                      DIALS_ASSERT(fraction <= 1.0 + EPS);
-                      DIALS_ASSERT(fraction >= 0.0 - EPS);
-                      double value = fraction * area * data(k, j, i);
+                    for (int kk = z0[k]; kk < z1[k]; ++kk) {
+                      double value = zfraction(k, kk) * area * data(k, j, i);
                       profile_(kk, jj, ii) += value;
                     }
                   }
@@ -2,6 +2,7 @@
 
 __all__ = (  # noqa: F405
     "CircleSampler",
+    "CompactProfileStore",
     "EmpiricalProfileModeller",
     "EwaldSphereSampler",
     "GridSampler",
@@ -18,6 +18,8 @@ namespace dials { namespace algorithms { namespace boost_python {
     result.def("add", &T::add)
       .def("valid", &T::valid)
       .def("n_reflections", &T::n_reflections)
+      .def("signal", &T::signal)
+      .def("negative_fraction", &T::negative_fraction)
       .def("model", &T::model)
       .def("fit", &T::fit)
       .def("validate", &T::validate)
@@ -14,6 +14,7 @@
 #include <dials/algorithms/profile_model/modeller/modeller_interface.h>
 #include <dials/algorithms/profile_model/modeller/empirical_modeller.h>
 #include <dials/algorithms/profile_model/modeller/multi_experiment_modeller.h>
+#include <dials/algorithms/profile_model/modeller/compact_profile_store.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -106,6 +107,19 @@ namespace dials { namespace algorithms { namespace boost_python {
     }
   };
 
+  struct CompactProfileStorePickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const CompactProfileStore &obj) {
+      return boost::python::make_tuple(obj.datasize(),
+                                       obj.sparse_threshold(),
+                                       obj.offset(),
+                                       obj.count(),
+                                       obj.mask_index(),
+                                       obj.values(),
+                                       obj.indices(),
+                                       obj.masks());
+    }
+  };
+
   void export_modeller() {
     class_<ProfileModellerIfaceWrapper,
            boost::shared_ptr<ProfileModellerIfaceWrapper>,
@@ -130,14 +144,27 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<std::size_t, int3, double>())
       .def("add", &EmpiricalProfileModeller::add)
       .def("valid", &EmpiricalProfileModeller::valid)
-      .def("n_reflections", &EmpiricalProfileModeller::n_reflections);
+      .def("n_reflections", &EmpiricalProfileModeller::n_reflections)
+      .def("finalize",
+           (void(EmpiricalProfileModeller::*)()) & EmpiricalProfileModeller::finalize)
+      .def("finalize",
+           (void(EmpiricalProfileModeller::*)(std::size_t))
+             & EmpiricalProfileModeller::finalize,
+           (arg("nthreads")))
+      .def("signal", &EmpiricalProfileModeller::signal)
+      .def("negative_fraction", &EmpiricalProfileModeller::negative_fraction);
 
     class_<MultiExpProfileModeller>("MultiExpProfileModeller")
       .def("add", &MultiExpProfileModeller::add)
       .def("__getitem__", &MultiExpProfileModeller::operator[])
       .def("model", &MultiExpProfileModeller::model)
       .def("accumulate", &MultiExpProfileModeller::accumulate)
-      .def("finalize", &MultiExpProfileModeller::finalize)
+      .def("finalize",
+           (void(MultiExpProfileModeller::*)()) & MultiExpProfileModeller::finalize)
+      .def("finalize",
+           (void(MultiExpProfileModeller::*)(std::size_t))
+             & MultiExpProfileModeller::finalize,
+           (arg("nthreads")))
       .def("finalized", &MultiExpProfileModeller::finalized)
       .def("fit", &MultiExpProfileModeller::fit)
       .def("validate", &MultiExpProfileModeller::validate)
@@ -145,6 +172,29 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("copy", &MultiExpProfileModeller::copy)
       .def_pickle(MultiExpProfileModellerPickleSuite());
     ;
+
+    class_<CompactProfileStore>("CompactProfileStore", no_init)
+      .def(init<int3, double>((arg("datasize"), arg("sparse_threshold") = 0.5)))
+      .def(init<int3,
+                double,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<int> &,
+                const af::const_ref<float> &,
+                const af::const_ref<int> &,
+                const af::const_ref<bool> &>())
+      .def("add", &CompactProfileStore::add)
+      .def("add_empty", &CompactProfileStore::add_empty)
+      .def("datasize", &CompactProfileStore::datasize)
+      .def("sparse_threshold", &CompactProfileStore::sparse_threshold)
+      .def("valid", &CompactProfileStore::valid)
+      .def("sparse", &CompactProfileStore::sparse)
+      .def("data", &CompactProfileStore::data)
+      .def("mask", &CompactProfileStore::mask)
+      .def("num_masks", &CompactProfileStore::num_masks)
+      .def("nbytes", &CompactProfileStore::nbytes)
+      .def("__len__", &CompactProfileStore::size)
+      .def_pickle(CompactProfileStorePickleSuite());
   }
 
 }}}  // namespace dials::algorithms::boost_python
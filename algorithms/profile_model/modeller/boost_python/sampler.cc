@@ -79,6 +79,7 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("nearest", pure_virtual(&SamplerIface::nearest))
       .def("nearest_n", pure_virtual(&SamplerIface::nearest_n))
       .def("weight", pure_virtual(&SamplerIface::weight))
+      .def("weights", &SamplerIface::weights)
       .def("coord", pure_virtual(&SamplerIface::coord))
       .def("neighbours", pure_virtual(&SamplerIface::neighbours))
       .def("__len__", &SamplerIface::size);
@@ -0,0 +1,324 @@
+/*
+ * compact_profile_store.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_COMPACT_PROFILE_STORE_H
+#define DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_COMPACT_PROFILE_STORE_H
+
+#include <algorithm>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/profile_model/modeller/empirical_modeller.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A compact copy of a set of finalized reference profiles. The profiles are
+   * stored in single precision in one contiguous buffer, and identical masks
+   * are stored once and shared between the profiles. Profiles where only a
+   * small fraction of the pixels are non-zero are stored as a list of pixel
+   * indices and values rather than in full.
+   *
+   * The store is used to pass the reference profiles between processes, which
+   * needs less than half the memory of the double precision profiles. The
+   * profiles are returned in double precision so rounding them to single
+   * precision changes the values by a relative amount of about 1e-7.
+   */
+  class CompactProfileStore {
+  public:
+    typedef ProfileModellerIface::data_type data_type;
+    typedef ProfileModellerIface::mask_type mask_type;
+
+    /**
+     * Initialise an empty store
+     * @param datasize The size of the profiles
+     * @param sparse_threshold Profiles with a smaller fraction of non-zero
+     *  pixels than this are stored sparsely
+     */
+    CompactProfileStore(int3 datasize, double sparse_threshold = 0.5)
+        : accessor_(datasize[0], datasize[1], datasize[2]),
+          sparse_threshold_(sparse_threshold) {
+      DIALS_ASSERT(datasize.all_gt(0));
+      DIALS_ASSERT(sparse_threshold >= 0 && sparse_threshold <= 1);
+    }
+
+    /**
+     * Copy the profiles from a modeller
+     * @param modeller The profile modeller
+     * @param sparse_threshold Profiles with a smaller fraction of non-zero
+     *  pixels than this are stored sparsely
+     */
+    CompactProfileStore(const EmpiricalProfileModeller &modeller,
+                        double sparse_threshold = 0.5)
+        : accessor_(modeller.datasize()[0],
+                    modeller.datasize()[1],
+                    modeller.datasize()[2]),
+          sparse_threshold_(sparse_threshold) {
+      DIALS_ASSERT(sparse_threshold >= 0 && sparse_threshold <= 1);
+      for (std::size_t i = 0; i < modeller.size(); ++i) {
+        if (modeller.valid(i)) {
+          add(modeller.data(i).const_ref(), modeller.mask(i));
+        } else {
+          add_empty();
+        }
+      }
+    }
+
+    /**
+     * Restore a store from its arrays
+     * @param datasize The size of the profiles
+     * @param sparse_threshold The sparse threshold
+     * @param offset The offset of each profile in the values
+     * @param count The number of values of each profile
+     * @param mask_index The index of the mask of each profile (-1 if empty)
+     * @param values The profile values
+     * @param indices The pixel indices of the sparse profile values
+     * @param masks The distinct masks, one after another
+     */
+    CompactProfileStore(int3 datasize,
+                        double sparse_threshold,
+                        const af::const_ref<std::size_t> &offset,
+                        const af::const_ref<std::size_t> &count,
+                        const af::const_ref<int> &mask_index,
+                        const af::const_ref<float> &values,
+                        const af::const_ref<int> &indices,
+                        const af::const_ref<bool> &masks)
+        : accessor_(datasize[0], datasize[1], datasize[2]),
+          sparse_threshold_(sparse_threshold),
+          offset_(offset.begin(), offset.end()),
+          count_(count.begin(), count.end()),
+          mask_index_(mask_index.begin(), mask_index.end()),
+          values_(values.begin(), values.end()),
+          indices_(indices.begin(), indices.end()) {
+      DIALS_ASSERT(datasize.all_gt(0));
+      DIALS_ASSERT(offset.size() == count.size());
+      DIALS_ASSERT(offset.size() == mask_index.size());
+      DIALS_ASSERT(masks.size() % accessor_.size_1d() == 0);
+      std::size_t n = accessor_.size_1d();
+      for (std::size_t i = 0; i < masks.size(); i += n) {
+        mask_type mask(accessor_);
+        std::copy(masks.begin() + i, masks.begin() + i + n, mask.begin());
+        masks_.push_back(mask);
+      }
+      std::size_t nindices = 0;
+      for (std::size_t i = 0; i < offset_.size(); ++i) {
+        DIALS_ASSERT(mask_index_[i] < (int)masks_.size());
+        DIALS_ASSERT(count_[i] <= n);
+        DIALS_ASSERT(offset_[i] + count_[i] <= values_.size());
+        index_offset_.push_back(nindices);
+        if (mask_index_[i] >= 0 && count_[i] < n) {
+          nindices += count_[i];
+        }
+      }
+      DIALS_ASSERT(nindices == indices_.size());
+    }
+
+    /**
+     * Add a profile to the store
+     * @param data The profile
+     * @param mask The profile mask
+     */
+    void add(const af::const_ref<double, af::c_grid<3> > &data, mask_type mask) {
+      DIALS_ASSERT(data.accessor().all_eq(accessor_));
+      DIALS_ASSERT(mask.accessor().all_eq(accessor_));
+
+      // Count the non-zero pixels to decide how to store the profile
+      std::size_t n = data.size();
+      std::size_t nonzero = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (data[i] != 0) {
+          nonzero++;
+        }
+      }
+      offset_.push_back(values_.size());
+      index_offset_.push_back(indices_.size());
+      if (nonzero < sparse_threshold_ * n) {
+        for (std::size_t i = 0; i < n; ++i) {
+          if (data[i] != 0) {
+            indices_.push_back((int)i);
+            values_.push_back((float)data[i]);
+          }
+        }
+        count_.push_back(nonzero);
+      } else {
+        for (std::size_t i = 0; i < n; ++i) {
+          values_.push_back((float)data[i]);
+        }
+        count_.push_back(n);
+      }
+      mask_index_.push_back(find_or_add_mask(mask));
+    }
+
+    /**
+     * Add an empty profile to the store
+     */
+    void add_empty() {
+      offset_.push_back(values_.size());
+      index_offset_.push_back(indices_.size());
+      count_.push_back(0);
+      mask_index_.push_back(-1);
+    }
+
+    /**
+     * @returns The number of profiles
+     */
+    std::size_t size() const {
+      return offset_.size();
+    }
+
+    /**
+     * @returns The size of the profiles
+     */
+    int3 datasize() const {
+      return int3(accessor_[0], accessor_[1], accessor_[2]);
+    }
+
+    /**
+     * @returns The sparse threshold
+     */
+    double sparse_threshold() const {
+      return sparse_threshold_;
+    }
+
+    /**
+     * @returns Is the profile valid
+     */
+    bool valid(std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      return mask_index_[index] >= 0;
+    }
+
+    /**
+     * @returns Is the profile stored sparsely
+     */
+    bool sparse(std::size_t index) const {
+      DIALS_ASSERT(valid(index));
+      return count_[index] < accessor_.size_1d();
+    }
+
+    /**
+     * @returns The profile at the index in double precision
+     */
+    data_type data(std::size_t index) const {
+      DIALS_ASSERT(valid(index));
+      data_type result(accessor_, 0);
+      std::size_t offset = offset_[index];
+      std::size_t count = count_[index];
+      if (sparse(index)) {
+        std::size_t first = index_offset_[index];
+        for (std::size_t i = 0; i < count; ++i) {
+          result[indices_[first + i]] = values_[offset + i];
+        }
+      } else {
+        std::copy(values_.begin() + offset, values_.begin() + offset + count,
+                  result.begin());
+      }
+      return result;
+    }
+
+    /**
+     * @returns The mask at the index. Profiles with the same mask share it.
+     */
+    mask_type mask(std::size_t index) const {
+      DIALS_ASSERT(valid(index));
+      return masks_[mask_index_[index]];
+    }
+
+    /**
+     * @returns The number of distinct masks
+     */
+    std::size_t num_masks() const {
+      return masks_.size();
+    }
+
+    /**
+     * @returns The number of bytes used by the profile data and masks
+     */
+    std::size_t nbytes() const {
+      return values_.size() * sizeof(float) + indices_.size() * sizeof(int)
+             + masks_.size() * accessor_.size_1d() * sizeof(bool)
+             + size() * (2 * sizeof(std::size_t) + sizeof(int));
+    }
+
+    /**
+     * @returns The offset of each profile in the values
+     */
+    af::shared<std::size_t> offset() const {
+      return offset_;
+    }
+
+    /**
+     * @returns The number of values of each profile
+     */
+    af::shared<std::size_t> count() const {
+      return count_;
+    }
+
+    /**
+     * @returns The index of the mask of each profile
+     */
+    af::shared<int> mask_index() const {
+      return mask_index_;
+    }
+
+    /**
+     * @returns The profile values
+     */
+    af::shared<float> values() const {
+      return values_;
+    }
+
+    /**
+     * @returns The pixel indices of the sparse profile values
+     */
+    af::shared<int> indices() const {
+      return indices_;
+    }
+
+    /**
+     * @returns The distinct masks, one after another
+     */
+    af::shared<bool> masks() const {
+      std::size_t n = accessor_.size_1d();
+      af::shared<bool> result(masks_.size() * n);
+      for (std::size_t i = 0; i < masks_.size(); ++i) {
+        std::copy(masks_[i].begin(), masks_[i].end(), result.begin() + i * n);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Find a mask equal to the given mask or add it to the list
+     */
+    int find_or_add_mask(const mask_type &mask) {
+      for (std::size_t i = 0; i < masks_.size(); ++i) {
+        if (std::equal(mask.begin(), mask.end(), masks_[i].begin())) {
+          return (int)i;
+        }
+      }
+      mask_type copy(accessor_);
+      std::copy(mask.begin(), mask.end(), copy.begin());
+      masks_.push_back(copy);
+      return (int)masks_.size() - 1;
+    }
+
+    af::c_grid<3> accessor_;
+    double sparse_threshold_;
+    af::shared<std::size_t> offset_;
+    af::shared<std::size_t> count_;
+    af::shared<int> mask_index_;
+    af::shared<float> values_;
+    af::shared<int> indices_;
+    af::shared<std::size_t> index_offset_;
+    af::shared<mask_type> masks_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_COMPACT_PROFILE_STORE_H
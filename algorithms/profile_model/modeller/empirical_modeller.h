@@ -16,6 +16,7 @@
 #include <boost/pointer_cast.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/modeller/modeller_interface.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace algorithms {
 
@@ -34,6 +35,8 @@ namespace dials { namespace algorithms {
         : data_(n),
           mask_(n),
           n_reflections_(n, 0),
+          signal_(n, 0),
+          negative_(n, 0),
           accessor_(af::c_grid<3>(datasize[0], datasize[1], datasize[2])),
           threshold_(threshold),
           finalized_(false) {
@@ -156,12 +159,17 @@ namespace dials { namespace algorithms {
      * Finalize the modeller
      */
     void finalize() {
+      finalize(1);
+    }
+
+    /**
+     * Finalize the modeller, normalising the profiles in parallel
+     * @param nthreads The number of threads to use
+     */
+    void finalize(std::size_t nthreads) {
       DIALS_ASSERT(finalized_ == false);
-      for (std::size_t i = 0; i < data_.size(); ++i) {
-        if (data_[i].size() != 0) {
-          finalize(i);
-        }
-      }
+      DIALS_ASSERT(nthreads > 0);
+      dials::util::parallel_for(data_.size(), nthreads, FinalizeJob(*this));
       finalized_ = true;
     }
 
@@ -257,6 +265,24 @@ namespace dials { namespace algorithms {
       return n_reflections_[index];
     }
 
+    /**
+     * @return The sum of the profile before it was normalised, or zero if
+     * the profile has not been finalized
+     */
+    double signal(std::size_t index) const {
+      DIALS_ASSERT(index < signal_.size());
+      return signal_[index];
+    }
+
+    /**
+     * @return The sum of the negative pixels set to zero when the profile was
+     * finalized as a fraction of the sum of the profile
+     */
+    double negative_fraction(std::size_t index) const {
+      DIALS_ASSERT(index < negative_.size());
+      return signal_[index] > 0 ? negative_[index] / signal_[index] : 0.0;
+    }
+
     /**
      * The model method
      */
@@ -286,11 +312,30 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Finalize a range of the profiles
+     */
+    class FinalizeJob {
+    public:
+      FinalizeJob(EmpiricalProfileModeller &self) : self_(&self) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          if (self_->data_[i].size() != 0) {
+            self_->finalize_profile(i);
+          }
+        }
+      }
+
+    private:
+      EmpiricalProfileModeller *self_;
+    };
+
     /**
      * Finalize a single profile
      * @param index The index of the profile to finalize
      */
-    void finalize(std::size_t index) {
+    void finalize_profile(std::size_t index) {
       // Check data
       DIALS_ASSERT(data_[index].accessor().all_eq(accessor_));
       DIALS_ASSERT(mask_[index].accessor().all_eq(accessor_));
@@ -304,10 +349,12 @@ namespace dials { namespace algorithms {
 
       // Get the sum of signal pixels
       double signal_sum = 0.0;
+      double negative_sum = 0.0;
       for (std::size_t i = 0; i < data.size(); ++i) {
         if (data[i] >= 0.0) {  // threshold) {
           signal_sum += data[i];
         } else {
+          negative_sum -= data[i];
           data[i] = 0.0;
           // mask[i] = false;
         }
@@ -315,6 +362,8 @@ namespace dials { namespace algorithms {
 
       // Normalize the profile such that sum of signal pixels == 1
       DIALS_ASSERT(signal_sum > 0);
+      signal_[index] = signal_sum;
+      negative_[index] = negative_sum;
       for (std::size_t i = 0; i < data.size(); ++i) {
         data[i] /= signal_sum;
       }
@@ -323,6 +372,8 @@ namespace dials { namespace algorithms {
     af::shared<data_type> data_;
     af::shared<mask_type> mask_;
     af::shared<std::size_t> n_reflections_;
+    af::shared<double> signal_;
+    af::shared<double> negative_;
     af::c_grid<3> accessor_;
     double threshold_;
     bool finalized_;
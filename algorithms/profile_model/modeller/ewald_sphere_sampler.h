@@ -11,6 +11,7 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_EWALD_SPHERE_SAMPLER_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_EWALD_SPHERE_SAMPLER_H
 
+#include <algorithm>
 #include <cmath>
 #include <scitbx/array_family/tiny_types.h>
 #include <dxtbx/model/beam.h>
@@ -147,6 +148,27 @@ namespace dials { namespace algorithms {
         }
       }
 
+      // The offset of the first profile in each circle
+      offset1_ = af::shared<std::size_t>(num1_.size() + 1, 0);
+      for (std::size_t i = 0; i < num1_.size(); ++i) {
+        offset1_[i + 1] = offset1_[i] + num1_[i];
+      }
+
+      // Cache the terms of the weight which only depend on the profile
+      cos_c0_ = af::shared<double>(coord_.size());
+      sin_c0_ = af::shared<double>(coord_.size());
+      cos_c1_ = af::shared<double>(coord_.size());
+      sin_c1_ = af::shared<double>(coord_.size());
+      weight_step_ = af::shared<double>(coord_.size());
+      for (std::size_t i = 0; i < coord_.size(); ++i) {
+        std::size_t idx = indx1_[i];
+        cos_c0_[i] = std::cos(coord_[i][0]);
+        sin_c0_[i] = std::sin(coord_[i][0]);
+        cos_c1_[i] = std::cos(coord_[i][1]);
+        sin_c1_[i] = std::sin(coord_[i][1]);
+        weight_step_[i] = (idx == 0 ? 2 * step1_[idx] : step1_[idx] - step1_[idx - 1]);
+      }
+
       // Compute the nearest n profiles from a main index
       neighbours_ = af::shared<af::shared<std::size_t> >(num_image * num_phi);
       for (std::size_t iz = 0, l = 0; iz < num_phi_; ++iz) {
@@ -208,7 +230,7 @@ namespace dials { namespace algorithms {
      * @returns The total number of grid points
      */
     std::size_t size() const {
-      return af::sum(num1_.const_ref()) * num_phi_;
+      return offset1_.back() * num_phi_;
     }
 
     /**
@@ -290,6 +312,45 @@ namespace dials { namespace algorithms {
       return std::exp(-4.0 * d * d * std::log(2.0));
     }
 
+    /**
+     * Get the weights for a list of profiles at the given coordinate. The
+     * direction of the coordinate is computed once and the trigonometric
+     * terms of the profile centres are cached, so each weight only needs an
+     * acos and an exp. The weights are the same as from weight().
+     * @param indices The profile indices
+     * @param xyz The coordinate
+     * @returns The weights (between 1.0 and 0.0)
+     */
+    af::shared<double> weights(const af::const_ref<std::size_t> &indices,
+                               std::size_t panel,
+                               double3 xyz) const {
+      vec3<double> s1 =
+        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
+      double z = s1 * zaxis_;
+      double y = s1 * yaxis_;
+      double x = s1 * xaxis_;
+
+      // sin(p1) = z, cos(p1) = sin(acos(z)) and l1 = atan2(y, x)
+      double sin_p1 = z;
+      double cos_p1 = std::sqrt(std::max(0.0, 1.0 - z * z));
+      double r = std::sqrt(x * x + y * y);
+      double cos_l1 = r > 0 ? x / r : 1.0;
+      double sin_l1 = r > 0 ? y / r : 0.0;
+      double log2 = std::log(2.0);
+      af::shared<double> result(indices.size());
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        std::size_t index = indices[i];
+        DIALS_ASSERT(index < coord_.size());
+        double cos_dl = cos_l1 * cos_c1_[index] + sin_l1 * sin_c1_[index];
+        double q = sin_p1 * cos_c0_[index] + cos_p1 * sin_c0_[index] * cos_dl;
+        if (q > 1) q = 1;
+        if (q < -1) q = -1;
+        double d = std::acos(q) / weight_step_[index];
+        result[i] = std::exp(-4.0 * d * d * log2);
+      }
+      return result;
+    }
+
     /**
      * Get the x, y, z coordinate of the reference profile at the given index.
      * @param index The index of the reference profile.
@@ -332,12 +393,7 @@ namespace dials { namespace algorithms {
 
   private:
     std::size_t index(std::size_t ix, std::size_t iy, std::size_t iz) const {
-      int tot_sum = af::sum(num1_.const_ref());
-      int par_sum = 0;
-      for (std::size_t i = 0; i < ix; ++i) {
-        par_sum += num1_[i];
-      }
-      return par_sum + iy + iz * tot_sum;
+      return offset1_[ix] + iy + iz * offset1_.back();
     }
 
     boost::shared_ptr<BeamBase> beam_;
@@ -354,6 +410,12 @@ namespace dials { namespace algorithms {
     af::shared<double> step2_;
     af::shared<double3> coord_;
     af::shared<std::size_t> indx1_;
+    af::shared<std::size_t> offset1_;
+    af::shared<double> cos_c0_;
+    af::shared<double> sin_c0_;
+    af::shared<double> cos_c1_;
+    af::shared<double> sin_c1_;
+    af::shared<double> weight_step_;
     af::shared<af::shared<std::size_t> > neighbours_;
     double step_phi_;
     vec2<int> scan_range_;
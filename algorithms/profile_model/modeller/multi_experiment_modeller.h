@@ -17,6 +17,7 @@
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/algorithms/profile_model/modeller/modeller_interface.h>
+#include <dials/algorithms/profile_model/modeller/empirical_modeller.h>
 
 namespace dials { namespace algorithms {
 
@@ -294,6 +295,23 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Finalize the profiles, normalising the profiles of the empirical
+     * modellers in parallel
+     * @param nthreads The number of threads to use
+     */
+    void finalize(std::size_t nthreads) {
+      for (std::size_t i = 0; i < modellers_.size(); ++i) {
+        boost::shared_ptr<EmpiricalProfileModeller> empirical =
+          boost::dynamic_pointer_cast<EmpiricalProfileModeller>(modellers_[i]);
+        if (empirical != NULL) {
+          empirical->finalize(nthreads);
+        } else {
+          modellers_[i]->finalize();
+        }
+      }
+    }
+
     /**
      * @return Is the model finalized
      */
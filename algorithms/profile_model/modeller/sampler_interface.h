@@ -57,6 +57,25 @@ namespace dials { namespace algorithms {
      */
     virtual double weight(std::size_t index, std::size_t panel, double3 xyz) const = 0;
 
+    /**
+     * Get the weights for a list of profiles at the given coordinate. This is
+     * usually called with the result of nearest_n, so samplers may override
+     * it to share the work for the coordinate between the profiles.
+     * @param indices The profile indices
+     * @param panel The panel
+     * @param xyz The coordinate
+     * @returns The weights (between 1.0 and 0.0)
+     */
+    virtual af::shared<double> weights(const af::const_ref<std::size_t> &indices,
+                                       std::size_t panel,
+                                       double3 xyz) const {
+      af::shared<double> result(indices.size());
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        result[i] = weight(indices[i], panel, xyz);
+      }
+      return result;
+    }
+
     /**
      * Get the x, y, z coordinate of the reference profile at the given index.
      * @param index The index of the reference profile.
@@ -27,8 +27,15 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("spacing", &GaussianSmoother::spacing)
       .def("positions", &GaussianSmoother::positions)
       .def("value_weight", &GaussianSmoother::value_weight)
+      .def("multi_weight", &GaussianSmoother::multi_weight)
       .def("multi_value_weight", &GaussianSmoother::multi_value_weight);
 
+    class_<SmootherWeights>("SmootherWeights", no_init)
+      .def("multi_value", &SmootherWeights::multi_value)
+      .def("multi_value_weight", &SmootherWeights::multi_value_weight)
+      .def("get_weight", &SmootherWeights::get_weight)
+      .def("get_sumweight", &SmootherWeights::get_sumweight);
+
     class_<SingleValueWeights>("SingleValueWeights", no_init)
       .def("get_value", &SingleValueWeights::get_value)
       .def("get_weight", &SingleValueWeights::get_weight)
@@ -1,14 +1,76 @@
-
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include "../outlier_detection/mahalanobis.h"
+#include "../outlier_detection/fast_mcd.h"
 
 using namespace boost::python;
 
 namespace dials { namespace refinement { namespace boost_python {
 
+  /**
+   * Convert estimates to a list of (det, T, S) tuples
+   */
+  list estimates_as_list(const std::vector<MCDEstimate> &estimates, std::size_t p) {
+    list result;
+    for (std::size_t i = 0; i < estimates.size(); ++i) {
+      const MCDEstimate &e = estimates[i];
+      af::shared<double> T(e.T.begin(), e.T.end());
+      af::versa<double, af::c_grid<2> > S(af::c_grid<2>(p, p));
+      std::copy(e.S.begin(), e.S.end(), S.begin());
+      result.append(make_tuple(e.det, T, S));
+    }
+    return result;
+  }
+
+  list fast_mcd_core_trials(const FastMCDCore &self,
+                            std::size_t h,
+                            std::size_t nsteps,
+                            const af::const_ref<std::size_t> &seeds,
+                            std::size_t nthreads) {
+    return estimates_as_list(self.trials(h, nsteps, seeds, nthreads),
+                             self.nparam());
+  }
+
+  list fast_mcd_core_refine(const FastMCDCore &self,
+                            object estimates,
+                            std::size_t h,
+                            std::size_t nsteps,
+                            bool stop_on_convergence,
+                            std::size_t nthreads) {
+    std::size_t p = self.nparam();
+    std::vector<MCDEstimate> initial(len(estimates));
+    for (std::size_t i = 0; i < initial.size(); ++i) {
+      object e = estimates[i];
+      af::const_ref<double> T = extract<af::const_ref<double> >(e[1])();
+      af::const_ref<double, af::c_grid<2> > S =
+        extract<af::const_ref<double, af::c_grid<2> > >(e[2])();
+      DIALS_ASSERT(T.size() == p);
+      DIALS_ASSERT(S.accessor()[0] == p && S.accessor().is_square());
+      initial[i].det = extract<double>(e[0])();
+      initial[i].T.assign(T.begin(), T.end());
+      initial[i].S.assign(S.begin(), S.end());
+    }
+    return estimates_as_list(
+      self.refine(initial, h, nsteps, stop_on_convergence, nthreads), p);
+  }
+
   void export_mahalanobis() {
     def("maha_dist_sq", &maha_dist_sq, (arg("obs"), arg("center"), arg("cov")));
+
+    class_<FastMCDCore>("FastMCDCore", no_init)
+      .def(init<const af::const_ref<double, af::c_grid<2> > &>((arg("obs"))))
+      .def("nobs", &FastMCDCore::nobs)
+      .def("nparam", &FastMCDCore::nparam)
+      .def("trials",
+           &fast_mcd_core_trials,
+           (arg("h"), arg("nsteps"), arg("seeds"), arg("nthreads") = 1))
+      .def("refine",
+           &fast_mcd_core_refine,
+           (arg("estimates"),
+            arg("h"),
+            arg("nsteps"),
+            arg("stop_on_convergence"),
+            arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::refinement::boost_python
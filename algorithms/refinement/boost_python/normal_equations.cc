@@ -0,0 +1,83 @@
+/*
+ * normal_equations.cc
+ *
+ *  Copyright (C) (2016) STFC Rutherford Appleton Laboratory, UK.
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../normal_equations.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  void export_normal_equations() {
+    void (*add_dense)(af::ref<double>,
+                      af::ref<double>,
+                      const af::const_ref<double> &,
+                      const af::const_ref<double, af::c_grid<2> > &,
+                      const af::const_ref<double> &,
+                      bool,
+                      std::size_t) = &add_normal_equations;
+    void (*add_sparse)(af::ref<double>,
+                       af::ref<double>,
+                       const af::const_ref<double> &,
+                       scitbx::sparse::matrix<double>,
+                       const af::const_ref<double> &,
+                       bool,
+                       std::size_t) = &add_normal_equations;
+
+    def("add_normal_equations",
+        add_dense,
+        (arg("normal_matrix"),
+         arg("right_hand_side"),
+         arg("residuals"),
+         arg("jacobian"),
+         arg("weights"),
+         arg("negate_right_hand_side") = false,
+         arg("nthreads") = 1));
+    def("add_normal_equations",
+        add_sparse,
+        (arg("normal_matrix"),
+         arg("right_hand_side"),
+         arg("residuals"),
+         arg("jacobian"),
+         arg("weights"),
+         arg("negate_right_hand_side") = false,
+         arg("nthreads") = 1));
+
+    class_<SparseNormalEquations>("SparseNormalEquations", no_init)
+      .def(init<std::size_t>((arg("n_parameters"))))
+      .def("reset", &SparseNormalEquations::reset)
+      .def("add_residuals",
+           &SparseNormalEquations::add_residuals,
+           (arg("residuals"), arg("weights")))
+      .def("add_equations",
+           &SparseNormalEquations::add_equations,
+           (arg("residuals"),
+            arg("jacobian"),
+            arg("weights"),
+            arg("negate_right_hand_side") = false,
+            arg("nthreads") = 1))
+      .def("add_constant_to_diagonal",
+           &SparseNormalEquations::add_constant_to_diagonal,
+           (arg("mu")))
+      .def("solve", &SparseNormalEquations::solve)
+      .def("solution", &SparseNormalEquations::solution)
+      .def("solved", &SparseNormalEquations::solved)
+      .def("right_hand_side", &SparseNormalEquations::right_hand_side)
+      .def("normal_matrix_diagonal", &SparseNormalEquations::normal_matrix_diagonal)
+      .def("n_parameters", &SparseNormalEquations::n_parameters)
+      .def("n_equations", &SparseNormalEquations::n_equations)
+      .def("dof", &SparseNormalEquations::dof)
+      .def("objective", &SparseNormalEquations::objective)
+      .def("chi_sq", &SparseNormalEquations::chi_sq)
+      .def("non_zeros", &SparseNormalEquations::non_zeros)
+      .def("factor_non_zeros", &SparseNormalEquations::factor_non_zeros)
+      .def("num_analyses", &SparseNormalEquations::num_analyses);
+  }
+
+}}}  // namespace dials::refinement::boost_python
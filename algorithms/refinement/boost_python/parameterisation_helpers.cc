@@ -8,7 +8,72 @@ using namespace boost::python;
 
 namespace dials { namespace refinement { namespace boost_python {
 
+  /**
+   * Build a Jacobian from a list for each type of residual of the list of
+   * gradient vectors for each parameter
+   */
+  template <typename Builder, typename Gradients>
+  Builder build_jacobian(object grads_each_dim, std::size_t nelem, std::size_t nparam) {
+    std::size_t ndim = std::size_t(len(grads_each_dim));
+    DIALS_ASSERT(ndim > 0);
+    DIALS_ASSERT(nelem % ndim == 0);
+    Builder builder(nelem / ndim, ndim, nparam);
+    for (std::size_t dim = 0; dim < ndim; ++dim) {
+      object grads = grads_each_dim[dim];
+      DIALS_ASSERT(std::size_t(len(grads)) == nparam);
+      for (std::size_t param = 0; param < nparam; ++param) {
+        builder.set_gradients(dim, param, extract<Gradients>(grads[param])());
+      }
+    }
+    return builder;
+  }
+
+  SparseJacobianBuilder::matrix_type build_sparse_jacobian(object grads_each_dim,
+                                                           std::size_t nelem,
+                                                           std::size_t nparam) {
+    return build_jacobian<SparseJacobianBuilder,
+                          const SparseJacobianBuilder::column_type &>(
+             grads_each_dim, nelem, nparam)
+      .jacobian();
+  }
+
+  af::versa<double, af::flex_grid<> > build_dense_jacobian(object grads_each_dim,
+                                                           std::size_t nelem,
+                                                           std::size_t nparam) {
+    return build_jacobian<DenseJacobianBuilder, af::const_ref<double> >(
+             grads_each_dim, nelem, nparam)
+      .jacobian();
+  }
+
+  /**
+   * Return the gradient and approximate curvature of the least squares
+   * functional with respect to a parameter, from the list of the gradient
+   * vectors of each type of residual
+   */
+  template <typename Gradients>
+  boost::python::tuple gradient_and_curvature(
+    const LeastSquaresGradientAccumulator &self,
+    object grads_each_dim) {
+    std::size_t ndim = std::size_t(len(grads_each_dim));
+    DIALS_ASSERT(ndim == self.ndim());
+    double gradient = 0.0;
+    double curvature = 0.0;
+    for (std::size_t dim = 0; dim < ndim; ++dim) {
+      self.add_gradients(
+        dim, extract<Gradients>(grads_each_dim[dim])(), gradient, curvature);
+    }
+    return boost::python::make_tuple(gradient, curvature);
+  }
+
   void export_parameterisation_helpers() {
+    def("build_sparse_jacobian",
+        &build_sparse_jacobian,
+        (arg("grads_each_dim"), arg("nelem"), arg("nparam")));
+
+    def("build_dense_jacobian",
+        &build_dense_jacobian,
+        (arg("grads_each_dim"), arg("nelem"), arg("nparam")));
+
     def("multi_panel_compose",
         &multi_panel_compose,
         (arg("initial_state"),
@@ -42,6 +107,24 @@ namespace dials { namespace refinement { namespace boost_python {
          arg("Tau1"),
          arg("dTau1_dtau1")));
 
+    class_<LeastSquaresGradientAccumulator>("LeastSquaresGradientAccumulator",
+                                            no_init)
+      .def(init<const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                std::size_t>((arg("residuals"), arg("weights"), arg("ndim"))))
+      .def("functional",
+           &LeastSquaresGradientAccumulator::functional,
+           (arg("squared_residuals")))
+      .def("dense_gradient_and_curvature",
+           &gradient_and_curvature<af::const_ref<double> >,
+           (arg("grads_each_dim")))
+      .def("sparse_gradient_and_curvature",
+           &gradient_and_curvature<
+             const LeastSquaresGradientAccumulator::column_type &>,
+           (arg("grads_each_dim")))
+      .def("ndim", &LeastSquaresGradientAccumulator::ndim)
+      .def("nref", &LeastSquaresGradientAccumulator::nref);
+
     class_<CrystalOrientationCompose>("CrystalOrientationCompose", no_init)
       .def(init<mat3<double>,
                 double,
@@ -15,6 +15,8 @@ namespace dials { namespace refinement { namespace boost_python {
   void export_gaussian_smoother();
   void export_gaussian_smoother_2D();
   void export_gaussian_smoother_3D();
+  void export_normal_equations();
+  void export_reflection_manager_helpers();
 
   BOOST_PYTHON_MODULE(dials_refinement_helpers_ext) {
     export_parameterisation_helpers();
@@ -26,5 +28,7 @@ namespace dials { namespace refinement { namespace boost_python {
     export_gaussian_smoother();
     export_gaussian_smoother_2D();
     export_gaussian_smoother_3D();
+    export_normal_equations();
+    export_reflection_manager_helpers();
   }
 }}}  // namespace dials::refinement::boost_python
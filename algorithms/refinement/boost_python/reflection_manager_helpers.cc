@@ -0,0 +1,29 @@
+/*
+ * reflection_manager_helpers.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../reflection_manager_helpers.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  void export_reflection_manager_helpers() {
+    class_<ReflectionGroupIndex>("ReflectionGroupIndex", no_init)
+      .def(init<const af::const_ref<int> &, std::size_t>(
+        (arg("group"), arg("ngroups"))))
+      .def("ngroups", &ReflectionGroupIndex::ngroups)
+      .def("size", &ReflectionGroupIndex::size, (arg("group")))
+      .def("indices", &ReflectionGroupIndex::indices, (arg("group")))
+      .def("select",
+           &ReflectionGroupIndex::select,
+           (arg("group"), arg("positions")));
+  }
+
+}}}  // namespace dials::refinement::boost_python
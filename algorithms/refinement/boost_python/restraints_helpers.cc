@@ -25,6 +25,19 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("daa_dp", &CalculateCellGradients::daa_dp)
       .def("dbb_dp", &CalculateCellGradients::dbb_dp)
       .def("dcc_dp", &CalculateCellGradients::dcc_dp);
+
+    def("add_cell_tie_gradients",
+        &add_cell_tie_gradients,
+        (arg("jacobian"),
+         arg("B"),
+         arg("dB_dp"),
+         arg("nparam"),
+         arg("icol"),
+         arg("sel"),
+         arg("irow"),
+         arg("gradfac"),
+         arg("meangradfac"),
+         arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <boost/python/class.hpp>
 #include "../rtmats.h"
 
 using namespace boost::python;
@@ -20,6 +21,14 @@ namespace dials { namespace refinement { namespace boost_python {
     def("dR_from_axis_and_angle",
         &dR_from_axis_and_angle,
         (arg("axis"), arg("angle"), arg("deg") = false));
+
+    def("rotation_matrices", &rotation_matrices, (arg("axes"), arg("angles")));
+
+    class_<RotationMatricesAndDerivatives>("RotationMatricesAndDerivatives", no_init)
+      .def(init<const af::const_ref<vec3<double> > &, const af::const_ref<double> &>(
+        (arg("axes"), arg("angles"))))
+      .def("R", &RotationMatricesAndDerivatives::R)
+      .def("dR_dangle", &RotationMatricesAndDerivatives::dR_dangle);
   }
 
 }}}  // namespace dials::refinement::boost_python
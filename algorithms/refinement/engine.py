@@ -16,6 +16,7 @@
 from scitbx.lstbx import normal_eqns, normal_eqns_solving
 
 from dials.algorithms.refinement import DialsRefineRuntimeError
+from dials_refinement_helpers_ext import add_normal_equations
 
 logger = logging.getLogger(__name__)
 
@@ -653,6 +654,22 @@ def restart(self):
     def parameter_vector_norm(self):
         return self.x.norm()
 
+    def add_equations(self, residuals, jacobian, weights):
+        """Add the equations for a set of residuals to the normal equations.
+        The normal matrix and right hand side of the step equations are
+        accumulated in C++, splitting the work between nproc threads"""
+        self.add_residuals(residuals, weights)
+        step_equations = self.step_equations()
+        add_normal_equations(
+            step_equations.normal_matrix_packed_u(),
+            step_equations.right_hand_side(),
+            residuals,
+            jacobian,
+            weights,
+            negate_right_hand_side=True,
+            nthreads=self._nproc,
+        )
+
     def build_up(self, objective_only=False):
 
         # code here to calculate the residuals. Rely on the target class
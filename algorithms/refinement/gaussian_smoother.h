@@ -14,6 +14,7 @@
 
 #include <cmath>      // for exp
 #include <algorithm>  // for std::min, std::max
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/sparse/vector.h>
 #include <scitbx/sparse/matrix.h>
@@ -73,6 +74,113 @@ namespace dials { namespace refinement {
     }
   };
 
+  /**
+   * The weights of a smoother at a fixed set of points. For each point the
+   * indices of the nearby values and their weights are kept in the order they
+   * were calculated, so interpolated values for new parameter values can be
+   * calculated without evaluating the weights again, and are identical to
+   * those from multi_value_weight.
+   */
+  class SmootherWeights {
+  public:
+    /**
+     * @param npoints The number of points
+     * @param nvalues The number of smoother values
+     * @param ncols The number of columns of the weight matrix
+     */
+    SmootherWeights(std::size_t npoints, std::size_t nvalues, std::size_t ncols)
+        : nvalues_(nvalues),
+          weight_(npoints, ncols),
+          sumweight_(npoints, af::init_functor_null<double>()),
+          row_start_(1, 0) {
+      row_start_.reserve(npoints + 1);
+    }
+
+    /**
+     * Add the weight of a value to the current point.
+     * @param ivalue The index of the value
+     * @param w The weight
+     */
+    void add(std::size_t ivalue, double w) {
+      DIALS_ASSERT(ivalue < nvalues_);
+      DIALS_ASSERT(row_start_.size() <= sumweight_.size());
+      index_.push_back(ivalue);
+      w_.push_back(w);
+    }
+
+    /**
+     * Finish the current point, summing its weights.
+     */
+    void next_point() {
+      std::size_t irow = row_start_.size() - 1;
+      DIALS_ASSERT(irow < sumweight_.size());
+      double sumw = 0.0;
+      for (std::size_t k = row_start_.back(); k < w_.size(); ++k) {
+        sumw += w_[k];
+      }
+      sumweight_[irow] = sumw;
+      row_start_.push_back(w_.size());
+    }
+
+    /**
+     * @returns The matrix of weights, with a row for each point
+     */
+    matrix<double> &weight() {
+      return weight_;
+    }
+
+    matrix<double> get_weight() const {
+      return weight_;
+    }
+
+    af::shared<double> get_sumweight() const {
+      return sumweight_;
+    }
+
+    /**
+     * Calculate the interpolated values at the points.
+     * @param values The parameter values
+     * @returns The interpolated values
+     */
+    af::shared<double> multi_value(const af::const_ref<double> values) const {
+      DIALS_ASSERT(values.size() == nvalues_);
+      std::size_t npoints = sumweight_.size();
+      DIALS_ASSERT(row_start_.size() == npoints + 1);
+      af::shared<double> value(npoints, af::init_functor_null<double>());
+      af::ref<double> value_ref = value.ref();
+      for (std::size_t irow = 0; irow < npoints; ++irow) {
+        double sumwv = 0.0;
+        for (std::size_t k = row_start_[irow]; k < row_start_[irow + 1]; ++k) {
+          sumwv += w_[k] * values[index_[k]];
+        }
+        double sumw = sumweight_[irow];
+        if (sumw > 0.0) {
+          value_ref[irow] = sumwv / sumw;
+        } else {
+          value_ref[irow] = 0.0;
+        }
+      }
+      return value;
+    }
+
+    /**
+     * Calculate the interpolated values at the points, and return them with
+     * the weights.
+     * @param values The parameter values
+     */
+    MultiValueWeights multi_value_weight(const af::const_ref<double> values) const {
+      return MultiValueWeights(multi_value(values), weight_, sumweight_);
+    }
+
+  private:
+    std::size_t nvalues_;
+    matrix<double> weight_;
+    af::shared<double> sumweight_;
+    std::vector<std::size_t> row_start_;
+    std::vector<std::size_t> index_;
+    std::vector<double> w_;
+  };
+
   // A Gaussian smoother, based largely on class SmoothedValue from Aimless.
   class GaussianSmoother {
   public:
@@ -205,34 +313,23 @@ namespace dials { namespace refinement {
     }
 
     /**
-     * Calculate multiple interpolated values of the parameters at points using
-     * the original unnormalised coordinate. Return this along with the matrix
-     * of weights at each position, and their sums. The matrix of weights is
-     * arranged such that each row contains the weights for a single point
-     * taken from x.
+     * Calculate the weights at points using the original unnormalised
+     * coordinate. The weights only depend on the points, so these may be kept
+     * and used to calculate interpolated values for any parameter values.
      * @param x The array of points to interpolate at
-     * @param param The parameter values
+     * @returns The weights at each point
      */
-    MultiValueWeights multi_value_weight(const af::const_ref<double> x,
-                                         const af::const_ref<double> values) {
+    SmootherWeights multi_weight(const af::const_ref<double> x) {
       // Use sparse storage as only naverage (default 3) values per row are
       // non-zero
       std::size_t npoints = x.size();
       DIALS_ASSERT(npoints > 1);
-      matrix<double> weight(npoints, nvalues);
-
-      // Allocate space for the interpolated values and sumweights, with raw
-      // refs for fastest access (See Michael Hohn's notes)
-      af::shared<double> value(npoints, af::init_functor_null<double>());
-      af::ref<double> value_ref = value.ref();
-      af::shared<double> sumweight(npoints, af::init_functor_null<double>());
-      af::ref<double> sumweight_ref = sumweight.ref();
+      SmootherWeights weights(npoints, nvalues, nvalues);
+      matrix<double> &weight = weights.weight();
 
       for (std::size_t irow = 0; irow < npoints; ++irow) {
         // normalised coordinate
         double z = (x[irow] - x0) / spacing_;
-        double sumw = 0.0;
-        double sumwv = 0.0;
 
         vec2<int> irange = idx_range(z);
 
@@ -240,19 +337,26 @@ namespace dials { namespace refinement {
           double ds = (z - positions_[icol]) / sigma_;
           double w = exp(-ds * ds);
           weight(irow, icol) = w;
-          sumw += w;
-          sumwv += w * values[icol];
-        }
-        sumweight_ref[irow] = sumw;
-
-        if (sumw > 0.0) {
-          value_ref[irow] = sumwv / sumw;
-        } else {
-          value_ref[irow] = 0.0;
+          weights.add(icol, w);
         }
+        weights.next_point();
       }
 
-      return MultiValueWeights(value, weight, sumweight);
+      return weights;
+    }
+
+    /**
+     * Calculate multiple interpolated values of the parameters at points using
+     * the original unnormalised coordinate. Return this along with the matrix
+     * of weights at each position, and their sums. The matrix of weights is
+     * arranged such that each row contains the weights for a single point
+     * taken from x.
+     * @param x The array of points to interpolate at
+     * @param param The parameter values
+     */
+    MultiValueWeights multi_value_weight(const af::const_ref<double> x,
+                                         const af::const_ref<double> values) {
+      return multi_weight(x).multi_value_weight(values);
     }
 
   protected:
@@ -206,38 +206,28 @@ namespace dials { namespace refinement {
     }
 
     /**
-     * Calculate multiple interpolated values of the parameters at points using
-     * the original unnormalised coordinate. Return this along with the matrix
-     * of weights at each position, and their sums. The matrix of weights is
-     * arranged such that each row contains the weights for a single point
-     * taken from x.
-     * @param x The array of points to interpolate at
-     * @param param The parameter values
+     * Calculate the weights at points using the original unnormalised
+     * coordinates. The weights only depend on the points, so these may be kept
+     * and used to calculate interpolated values for any parameter values.
+     * @param x The array of x coordinates of the points
+     * @param y The array of y coordinates of the points
+     * @returns The weights at each point
      */
-    MultiValueWeights multi_value_weight(const af::const_ref<double> x,
-                                         const af::const_ref<double> y,
-                                         const af::const_ref<double> values) {
+    SmootherWeights multi_weight(const af::const_ref<double> x,
+                                 const af::const_ref<double> y) {
       // Use sparse storage as only naverage (default 3) values per row are
       // non-zero
       std::size_t nxpoints = x.size();
       std::size_t nypoints = y.size();
       DIALS_ASSERT(nxpoints > 1);
       DIALS_ASSERT(nypoints == nxpoints);
-      matrix<double> weight(nxpoints, nxvalues * nyvalues);
-
-      // Allocate space for the interpolated values and sumweights, with raw
-      // refs for fastest access (See Michael Hohn's notes)
-      af::shared<double> value(nxpoints, af::init_functor_null<double>());
-      af::ref<double> value_ref = value.ref();
-      af::shared<double> sumweight(nxpoints, af::init_functor_null<double>());
-      af::ref<double> sumweight_ref = sumweight.ref();
+      SmootherWeights weights(nxpoints, nxvalues * nyvalues, nxvalues * nyvalues);
+      matrix<double> &weight = weights.weight();
 
       for (std::size_t irow = 0; irow < nxpoints; ++irow) {
         // normalised coordinate
         double z1 = (x[irow] - x0) / x_spacing_;
         double z2 = (y[irow] - y0) / y_spacing_;
-        double sumw = 0.0;
-        double sumwv = 0.0;
 
         vec2<int> irange = idx_range(z1, nxvalues, half_nxaverage, n_x_average);
         vec2<int> jrange = idx_range(z2, nyvalues, half_nyaverage, n_y_average);
@@ -251,20 +241,28 @@ namespace dials { namespace refinement {
             double w = exp(-ds * ds);
             int idx = icol + (jcol * nxvalues);
             weight(irow, idx) = w;
-            sumw += w;
-            sumwv += w * values[idx];
+            weights.add(idx, w);
           }
         }
-        sumweight_ref[irow] = sumw;
-
-        if (sumw > 0.0) {
-          value_ref[irow] = sumwv / sumw;
-        } else {
-          value_ref[irow] = 0.0;
-        }
+        weights.next_point();
       }
 
-      return MultiValueWeights(value, weight, sumweight);
+      return weights;
+    }
+
+    /**
+     * Calculate multiple interpolated values of the parameters at points using
+     * the original unnormalised coordinate. Return this along with the matrix
+     * of weights at each position, and their sums. The matrix of weights is
+     * arranged such that each row contains the weights for a single point
+     * taken from x.
+     * @param x The array of points to interpolate at
+     * @param param The parameter values
+     */
+    MultiValueWeights multi_value_weight(const af::const_ref<double> x,
+                                         const af::const_ref<double> y,
+                                         const af::const_ref<double> values) {
+      return multi_weight(x, y).multi_value_weight(values);
     }
 
   private:
@@ -0,0 +1,848 @@
+/*
+ * normal_equations.h
+ *
+ *  Copyright (C) (2016) STFC Rutherford Appleton Laboratory, UK.
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_NORMAL_EQUATIONS_H
+#define DIALS_REFINEMENT_NORMAL_EQUATIONS_H
+
+#include <algorithm>
+#include <vector>
+#include <scitbx/sparse/matrix.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/profile.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  namespace detail {
+
+    /**
+     * The offset of the start of a row of a packed upper triangle matrix
+     * @param i The row
+     * @param n The size of the matrix
+     */
+    inline std::size_t packed_u_row_start(std::size_t i, std::size_t n) {
+      return i * (2 * n - i + 1) / 2;
+    }
+
+    /**
+     * Base class for jobs accumulating rows of the normal matrix. Row i of the
+     * packed upper triangle has n - i elements, so each index processes row i
+     * together with row n - 1 - i to give each thread a similar amount of work.
+     * Each row of the normal matrix (and right hand side) is only written by
+     * the thread that owns it, so no reduction is needed.
+     */
+    template <typename Derived>
+    class NormalEquationsJobBase {
+    public:
+      static std::size_t size(std::size_t n) {
+        return (n + 1) / 2;
+      }
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const Derived &self = static_cast<const Derived &>(*this);
+        for (std::size_t i = first; i < last; ++i) {
+          self.add_row(i);
+          std::size_t j = self.n - 1 - i;
+          if (j != i) {
+            self.add_row(j);
+          }
+        }
+      }
+    };
+
+    /**
+     * Accumulate rows of the normal matrix from a dense Jacobian
+     */
+    class DenseNormalEquationsJob
+        : public NormalEquationsJobBase<DenseNormalEquationsJob> {
+    public:
+      DenseNormalEquationsJob(af::ref<double> normal_matrix,
+                              af::ref<double> right_hand_side,
+                              const af::const_ref<double> &residuals,
+                              const af::const_ref<double, af::c_grid<2> > &jacobian,
+                              const af::const_ref<double> &weights,
+                              double sign)
+          : n(jacobian.accessor()[1]),
+            normal_matrix_(normal_matrix),
+            right_hand_side_(right_hand_side),
+            residuals_(residuals),
+            jacobian_(jacobian),
+            weights_(weights),
+            sign_(sign) {}
+
+      void add_row(std::size_t i) const {
+        std::size_t m = jacobian_.accessor()[0];
+        double *a = &normal_matrix_[packed_u_row_start(i, n)];
+        double b = 0.0;
+        for (std::size_t k = 0; k < m; ++k) {
+          const double *jk = &jacobian_[k * n];
+          double wj = jk[i];
+          if (weights_.size() > 0) {
+            wj *= weights_[k];
+          }
+          if (wj == 0.0) {
+            continue;
+          }
+          b += wj * residuals_[k];
+          for (std::size_t j = i; j < n; ++j) {
+            a[j - i] += wj * jk[j];
+          }
+        }
+        right_hand_side_[i] += sign_ * b;
+      }
+
+      std::size_t n;
+
+    private:
+      af::ref<double> normal_matrix_;
+      af::ref<double> right_hand_side_;
+      af::const_ref<double> residuals_;
+      af::const_ref<double, af::c_grid<2> > jacobian_;
+      af::const_ref<double> weights_;
+      double sign_;
+    };
+
+    /**
+     * The non-zero elements of a sparse matrix, stored by row. The elements of
+     * each row are sorted by column.
+     */
+    class SparseRows {
+    public:
+      typedef scitbx::sparse::matrix<double> matrix_type;
+
+      SparseRows(const matrix_type &m) : row_start_(m.n_rows() + 1, 0) {
+        // Count the elements in each row, then fill them in column order
+        for (std::size_t j = 0; j < m.n_cols(); ++j) {
+          for (matrix_type::column_type::const_iterator p = m.col(j).begin();
+               p != m.col(j).end();
+               ++p) {
+            row_start_[p.index() + 1]++;
+          }
+        }
+        for (std::size_t k = 0; k < m.n_rows(); ++k) {
+          row_start_[k + 1] += row_start_[k];
+        }
+        std::vector<std::size_t> next(row_start_.begin(), row_start_.end() - 1);
+        cols_.resize(row_start_.back());
+        values_.resize(row_start_.back());
+        for (std::size_t j = 0; j < m.n_cols(); ++j) {
+          for (matrix_type::column_type::const_iterator p = m.col(j).begin();
+               p != m.col(j).end();
+               ++p) {
+            std::size_t pos = next[p.index()]++;
+            cols_[pos] = j;
+            values_[pos] = *p;
+          }
+        }
+      }
+
+      /**
+       * @returns The position of the first element of row k in column j or
+       * above
+       */
+      std::size_t lower_bound(std::size_t k, std::size_t j) const {
+        return std::lower_bound(
+                 cols_.begin() + row_start_[k], cols_.begin() + row_start_[k + 1], j)
+               - cols_.begin();
+      }
+
+      /**
+       * @returns The position after the last element of row k
+       */
+      std::size_t row_end(std::size_t k) const {
+        return row_start_[k + 1];
+      }
+
+      std::size_t col(std::size_t pos) const {
+        return cols_[pos];
+      }
+
+      double value(std::size_t pos) const {
+        return values_[pos];
+      }
+
+    private:
+      std::vector<std::size_t> row_start_;
+      std::vector<std::size_t> cols_;
+      std::vector<double> values_;
+    };
+
+    /**
+     * Accumulate rows of the normal matrix from a sparse Jacobian. Each row
+     * of the normal matrix is found from the column of the Jacobian, and the
+     * rows of the Jacobian touched by that column.
+     */
+    class SparseNormalEquationsJob
+        : public NormalEquationsJobBase<SparseNormalEquationsJob> {
+    public:
+      typedef scitbx::sparse::matrix<double> matrix_type;
+
+      SparseNormalEquationsJob(af::ref<double> normal_matrix,
+                               af::ref<double> right_hand_side,
+                               const af::const_ref<double> &residuals,
+                               const matrix_type &jacobian,
+                               const SparseRows &rows,
+                               const af::const_ref<double> &weights,
+                               double sign)
+          : n(jacobian.n_cols()),
+            normal_matrix_(normal_matrix),
+            right_hand_side_(right_hand_side),
+            residuals_(residuals),
+            jacobian_(&jacobian),
+            rows_(&rows),
+            weights_(weights),
+            sign_(sign) {}
+
+      void add_row(std::size_t i) const {
+        double *a = &normal_matrix_[packed_u_row_start(i, n)];
+        double b = 0.0;
+        const matrix_type::column_type &col = jacobian_->col(i);
+        for (matrix_type::column_type::const_iterator p = col.begin(); p != col.end();
+             ++p) {
+          std::size_t k = p.index();
+          double wj = *p;
+          if (weights_.size() > 0) {
+            wj *= weights_[k];
+          }
+          if (wj == 0.0) {
+            continue;
+          }
+          b += wj * residuals_[k];
+          std::size_t last = rows_->row_end(k);
+          for (std::size_t pos = rows_->lower_bound(k, i); pos < last; ++pos) {
+            a[rows_->col(pos) - i] += wj * rows_->value(pos);
+          }
+        }
+        right_hand_side_[i] += sign_ * b;
+      }
+
+      std::size_t n;
+
+    private:
+      af::ref<double> normal_matrix_;
+      af::ref<double> right_hand_side_;
+      af::const_ref<double> residuals_;
+      const matrix_type *jacobian_;
+      const SparseRows *rows_;
+      af::const_ref<double> weights_;
+      double sign_;
+    };
+
+    template <typename Job>
+    void run_normal_equations_job(const Job &job, std::size_t nthreads) {
+      DIALS_PROFILE_SCOPE("refinement.normal_equations");
+      dials::util::parallel_for(Job::size(job.n), nthreads, job);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Add the weighted least squares equations for a set of residuals to the
+   * normal equations J^T W J x = J^T W r, where the normal matrix is stored as
+   * a packed upper triangle. The rows of the normal matrix are shared between
+   * the threads.
+   * @param normal_matrix The packed upper triangle normal matrix
+   * @param right_hand_side The right hand side
+   * @param residuals The residuals
+   * @param jacobian The Jacobian of the residuals
+   * @param weights The weights of the residuals (or empty for unit weights)
+   * @param negate_right_hand_side Solve for J^T W J x = -J^T W r
+   * @param nthreads The number of threads
+   */
+  inline void add_normal_equations(
+    af::ref<double> normal_matrix,
+    af::ref<double> right_hand_side,
+    const af::const_ref<double> &residuals,
+    const af::const_ref<double, af::c_grid<2> > &jacobian,
+    const af::const_ref<double> &weights,
+    bool negate_right_hand_side,
+    std::size_t nthreads) {
+    std::size_t n = jacobian.accessor()[1];
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_ASSERT(residuals.size() == jacobian.accessor()[0]);
+    DIALS_ASSERT(weights.size() == 0 || weights.size() == residuals.size());
+    DIALS_ASSERT(right_hand_side.size() == n);
+    DIALS_ASSERT(normal_matrix.size() == n * (n + 1) / 2);
+    if (n == 0) {
+      return;
+    }
+    detail::run_normal_equations_job(
+      detail::DenseNormalEquationsJob(normal_matrix,
+                                      right_hand_side,
+                                      residuals,
+                                      jacobian,
+                                      weights,
+                                      negate_right_hand_side ? -1.0 : 1.0),
+      nthreads);
+  }
+
+  /**
+   * Add the weighted least squares equations for a set of residuals to the
+   * normal equations J^T W J x = J^T W r, reading a sparse Jacobian.
+   * @param normal_matrix The packed upper triangle normal matrix
+   * @param right_hand_side The right hand side
+   * @param residuals The residuals
+   * @param jacobian The sparse Jacobian of the residuals
+   * @param weights The weights of the residuals (or empty for unit weights)
+   * @param negate_right_hand_side Solve for J^T W J x = -J^T W r
+   * @param nthreads The number of threads
+   */
+  inline void add_normal_equations(af::ref<double> normal_matrix,
+                                   af::ref<double> right_hand_side,
+                                   const af::const_ref<double> &residuals,
+                                   scitbx::sparse::matrix<double> jacobian,
+                                   const af::const_ref<double> &weights,
+                                   bool negate_right_hand_side,
+                                   std::size_t nthreads) {
+    std::size_t n = jacobian.n_cols();
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_ASSERT(residuals.size() == jacobian.n_rows());
+    DIALS_ASSERT(weights.size() == 0 || weights.size() == residuals.size());
+    DIALS_ASSERT(right_hand_side.size() == n);
+    DIALS_ASSERT(normal_matrix.size() == n * (n + 1) / 2);
+    if (n == 0) {
+      return;
+    }
+
+    // call compact to ensure that each elt of the matrix is only defined once
+    jacobian.compact();
+    detail::SparseRows rows(jacobian);
+    detail::run_normal_equations_job(
+      detail::SparseNormalEquationsJob(normal_matrix,
+                                       right_hand_side,
+                                       residuals,
+                                       jacobian,
+                                       rows,
+                                       weights,
+                                       negate_right_hand_side ? -1.0 : 1.0),
+      nthreads);
+  }
+
+  namespace detail {
+
+    /**
+     * Accumulate the columns of a sparse normal matrix from a sparse Jacobian.
+     * Column j of the upper triangle holds the elements of rows i <= j, and is
+     * only written by the thread that owns it.
+     */
+    class SparseNormalMatrixJob : public NormalEquationsJobBase<SparseNormalMatrixJob> {
+    public:
+      typedef scitbx::sparse::matrix<double> matrix_type;
+
+      SparseNormalMatrixJob(std::vector<std::vector<std::size_t> > &rows,
+                            std::vector<std::vector<double> > &values,
+                            std::vector<unsigned char> &inserted,
+                            af::ref<double> right_hand_side,
+                            const af::const_ref<double> &residuals,
+                            const matrix_type &jacobian,
+                            const SparseRows &jacobian_rows,
+                            const af::const_ref<double> &weights,
+                            double sign)
+          : n(jacobian.n_cols()),
+            rows_(&rows),
+            values_(&values),
+            inserted_(&inserted),
+            right_hand_side_(right_hand_side),
+            residuals_(residuals),
+            jacobian_(&jacobian),
+            jacobian_rows_(&jacobian_rows),
+            weights_(weights),
+            sign_(sign) {}
+
+      void add_row(std::size_t j) const {
+        std::vector<std::size_t> &rows = (*rows_)[j];
+        std::vector<double> &values = (*values_)[j];
+        double b = 0.0;
+        const matrix_type::column_type &col = jacobian_->col(j);
+        for (matrix_type::column_type::const_iterator p = col.begin(); p != col.end();
+             ++p) {
+          std::size_t k = p.index();
+          double wj = *p;
+          if (weights_.size() > 0) {
+            wj *= weights_[k];
+          }
+          if (wj == 0.0) {
+            continue;
+          }
+          b += wj * residuals_[k];
+
+          // The elements of row k of the Jacobian in columns up to j are in
+          // column order, so the search for each starts after the last one
+          std::size_t first = jacobian_rows_->lower_bound(k, 0);
+          std::size_t last = jacobian_rows_->lower_bound(k, j + 1);
+          std::size_t pos = 0;
+          for (std::size_t q = first; q < last; ++q) {
+            std::size_t i = jacobian_rows_->col(q);
+            pos = std::lower_bound(rows.begin() + pos, rows.end(), i) - rows.begin();
+            if (pos == rows.size() || rows[pos] != i) {
+              rows.insert(rows.begin() + pos, i);
+              values.insert(values.begin() + pos, 0.0);
+              (*inserted_)[j] = 1;
+            }
+            values[pos] += wj * jacobian_rows_->value(q);
+          }
+        }
+        right_hand_side_[j] += sign_ * b;
+      }
+
+      std::size_t n;
+
+    private:
+      std::vector<std::vector<std::size_t> > *rows_;
+      std::vector<std::vector<double> > *values_;
+      std::vector<unsigned char> *inserted_;
+      af::ref<double> right_hand_side_;
+      af::const_ref<double> residuals_;
+      const matrix_type *jacobian_;
+      const SparseRows *jacobian_rows_;
+      af::const_ref<double> weights_;
+      double sign_;
+    };
+
+    /**
+     * Order columns by their degree, keeping the original order for columns
+     * of the same degree
+     */
+    struct CompareDegree {
+      const std::vector<std::size_t> *degree;
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        return (*degree)[a] < (*degree)[b];
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Normal equations with a sparse normal matrix, for problems with many
+   * parameters each coupled to only a few of the others, as in the joint
+   * refinement of many crystals. Only the upper triangle of the normal matrix
+   * is stored, by column, and the equations are solved by an LDL^T
+   * factorisation that only stores the non-zero elements of the factor (as in
+   * the LDL package of T. A. Davis, ACM Trans. Math. Softw. 31, 587 (2005)).
+   *
+   * The parameters are ordered by their degree in the normal matrix before
+   * the factorisation, so that those coupled to many others (e.g. a shared
+   * detector) are eliminated last and fill in only the last rows of the
+   * factor. The ordering and the elimination tree only depend on the pattern
+   * of the normal matrix, which is kept by reset, so they are found once and
+   * reused for each iteration until a new element of the normal matrix appears.
+   */
+  class SparseNormalEquations {
+  public:
+    typedef scitbx::sparse::matrix<double> matrix_type;
+
+    /**
+     * @param n_parameters The number of parameters
+     */
+    SparseNormalEquations(std::size_t n_parameters)
+        : n_(n_parameters),
+          rows_(n_parameters),
+          values_(n_parameters),
+          right_hand_side_(n_parameters, 0.0),
+          solution_(n_parameters, 0.0),
+          sum_w_r_sq_(0.0),
+          n_equations_(0),
+          solved_(false),
+          analysed_(false),
+          num_analyses_(0) {
+      // The diagonal is always stored, so a constant can be added to it
+      for (std::size_t j = 0; j < n_; ++j) {
+        rows_[j].push_back(j);
+        values_[j].push_back(0.0);
+      }
+    }
+
+    /**
+     * Remove all the equations, keeping the pattern of the normal matrix and
+     * its factorisation
+     */
+    void reset() {
+      for (std::size_t j = 0; j < n_; ++j) {
+        std::fill(values_[j].begin(), values_[j].end(), 0.0);
+      }
+      std::fill(right_hand_side_.begin(), right_hand_side_.end(), 0.0);
+      std::fill(solution_.begin(), solution_.end(), 0.0);
+      sum_w_r_sq_ = 0.0;
+      n_equations_ = 0;
+      solved_ = false;
+    }
+
+    /**
+     * Add residuals to the objective, without any gradients
+     * @param residuals The residuals
+     * @param weights The weights of the residuals (or empty for unit weights)
+     */
+    void add_residuals(const af::const_ref<double> &residuals,
+                       const af::const_ref<double> &weights) {
+      DIALS_ASSERT(weights.size() == 0 || weights.size() == residuals.size());
+      for (std::size_t k = 0; k < residuals.size(); ++k) {
+        double w = weights.size() > 0 ? weights[k] : 1.0;
+        sum_w_r_sq_ += w * residuals[k] * residuals[k];
+      }
+      n_equations_ += residuals.size();
+      solved_ = false;
+    }
+
+    /**
+     * Add the weighted least squares equations for a set of residuals
+     * @param residuals The residuals
+     * @param jacobian The sparse Jacobian of the residuals
+     * @param weights The weights of the residuals (or empty for unit weights)
+     * @param negate_right_hand_side Solve for J^T W J x = -J^T W r
+     * @param nthreads The number of threads
+     */
+    void add_equations(const af::const_ref<double> &residuals,
+                       scitbx::sparse::matrix<double> jacobian,
+                       const af::const_ref<double> &weights,
+                       bool negate_right_hand_side,
+                       std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(jacobian.n_cols() == n_);
+      DIALS_ASSERT(residuals.size() == jacobian.n_rows());
+      add_residuals(residuals, weights);
+      if (n_ == 0) {
+        return;
+      }
+
+      // call compact to ensure that each elt of the matrix is only defined once
+      jacobian.compact();
+      detail::SparseRows jacobian_rows(jacobian);
+      std::vector<unsigned char> inserted(n_, 0);
+      detail::run_normal_equations_job(
+        detail::SparseNormalMatrixJob(rows_,
+                                      values_,
+                                      inserted,
+                                      right_hand_side_.ref(),
+                                      residuals,
+                                      jacobian,
+                                      jacobian_rows,
+                                      weights,
+                                      negate_right_hand_side ? -1.0 : 1.0),
+        nthreads);
+      if (std::find(inserted.begin(), inserted.end(), 1) != inserted.end()) {
+        analysed_ = false;
+      }
+    }
+
+    /**
+     * Add a constant to the diagonal of the normal matrix
+     * @param mu The constant
+     */
+    void add_constant_to_diagonal(double mu) {
+      for (std::size_t j = 0; j < n_; ++j) {
+        values_[j].back() += mu;
+      }
+      solved_ = false;
+    }
+
+    /**
+     * Solve the normal equations, first finding the ordering and elimination
+     * tree if the pattern of the normal matrix has changed
+     */
+    void solve() {
+      DIALS_PROFILE_SCOPE("refinement.sparse_normal_equations.solve");
+      if (!analysed_) {
+        analyse();
+      }
+      factorise();
+
+      // Solve L D L^T x = P b for the permuted solution
+      std::vector<double> &x = work_;
+      for (std::size_t k = 0; k < n_; ++k) {
+        x[k] = right_hand_side_[perm_[k]];
+      }
+      for (std::size_t j = 0; j < n_; ++j) {
+        for (std::size_t p = lp_[j]; p < lp_[j + 1]; ++p) {
+          x[li_[p]] -= lx_[p] * x[j];
+        }
+      }
+      for (std::size_t j = 0; j < n_; ++j) {
+        x[j] /= d_[j];
+      }
+      for (std::size_t j = n_; j-- > 0;) {
+        for (std::size_t p = lp_[j]; p < lp_[j + 1]; ++p) {
+          x[j] -= lx_[p] * x[li_[p]];
+        }
+      }
+      for (std::size_t k = 0; k < n_; ++k) {
+        solution_[perm_[k]] = x[k];
+      }
+      solved_ = true;
+    }
+
+    /**
+     * @returns The solution of the normal equations
+     */
+    af::shared<double> solution() const {
+      DIALS_ASSERT(solved_);
+      return af::shared<double>(solution_.begin(), solution_.end());
+    }
+
+    /**
+     * @returns True/False if the normal equations have been solved
+     */
+    bool solved() const {
+      return solved_;
+    }
+
+    /**
+     * @returns The right hand side of the normal equations
+     */
+    af::shared<double> right_hand_side() const {
+      return af::shared<double>(right_hand_side_.begin(), right_hand_side_.end());
+    }
+
+    /**
+     * @returns The diagonal of the normal matrix
+     */
+    af::shared<double> normal_matrix_diagonal() const {
+      af::shared<double> result(n_, 0.0);
+      for (std::size_t j = 0; j < n_; ++j) {
+        result[j] = values_[j].back();
+      }
+      return result;
+    }
+
+    /**
+     * @returns The number of parameters
+     */
+    std::size_t n_parameters() const {
+      return n_;
+    }
+
+    /**
+     * @returns The number of equations
+     */
+    std::size_t n_equations() const {
+      return n_equations_;
+    }
+
+    /**
+     * @returns The number of degrees of freedom
+     */
+    long dof() const {
+      return (long)n_equations_ - (long)n_;
+    }
+
+    /**
+     * @returns Half the weighted sum of squared residuals
+     */
+    double objective() const {
+      return 0.5 * sum_w_r_sq_;
+    }
+
+    /**
+     * @returns The weighted sum of squared residuals per degree of freedom
+     */
+    double chi_sq() const {
+      DIALS_ASSERT(dof() > 0);
+      return sum_w_r_sq_ / dof();
+    }
+
+    /**
+     * @returns The number of elements stored in the upper triangle of the
+     * normal matrix
+     */
+    std::size_t non_zeros() const {
+      std::size_t result = 0;
+      for (std::size_t j = 0; j < n_; ++j) {
+        result += rows_[j].size();
+      }
+      return result;
+    }
+
+    /**
+     * @returns The number of elements of the factor below its diagonal
+     */
+    std::size_t factor_non_zeros() const {
+      return analysed_ ? lp_.back() : 0;
+    }
+
+    /**
+     * @returns The number of times the ordering and elimination tree were found
+     */
+    std::size_t num_analyses() const {
+      return num_analyses_;
+    }
+
+  private:
+    /**
+     * Find the ordering of the parameters, the pattern of the permuted normal
+     * matrix and its elimination tree, and allocate the factor.
+     */
+    void analyse() {
+      // Order the parameters by their degree
+      std::vector<std::size_t> degree(n_, 0);
+      for (std::size_t j = 0; j < n_; ++j) {
+        for (std::size_t p = 0; p < rows_[j].size(); ++p) {
+          if (rows_[j][p] != j) {
+            degree[rows_[j][p]]++;
+            degree[j]++;
+          }
+        }
+      }
+      perm_.resize(n_);
+      for (std::size_t j = 0; j < n_; ++j) {
+        perm_[j] = j;
+      }
+      detail::CompareDegree compare = {&degree};
+      std::stable_sort(perm_.begin(), perm_.end(), compare);
+      std::vector<std::size_t> pinv(n_);
+      for (std::size_t k = 0; k < n_; ++k) {
+        pinv[perm_[k]] = k;
+      }
+
+      // The upper triangle of the permuted matrix, by column, and the position
+      // in it of each element of the normal matrix
+      cp_.assign(n_ + 1, 0);
+      for (std::size_t j = 0; j < n_; ++j) {
+        for (std::size_t p = 0; p < rows_[j].size(); ++p) {
+          cp_[std::max(pinv[rows_[j][p]], pinv[j]) + 1]++;
+        }
+      }
+      for (std::size_t k = 0; k < n_; ++k) {
+        cp_[k + 1] += cp_[k];
+      }
+      std::vector<std::size_t> next(cp_.begin(), cp_.end() - 1);
+      ci_.resize(cp_.back());
+      cx_.resize(cp_.back());
+      map_.resize(cp_.back());
+      std::size_t m = 0;
+      for (std::size_t j = 0; j < n_; ++j) {
+        for (std::size_t p = 0; p < rows_[j].size(); ++p) {
+          std::size_t a = pinv[rows_[j][p]];
+          std::size_t b = pinv[j];
+          std::size_t pos = next[std::max(a, b)]++;
+          ci_[pos] = std::min(a, b);
+          map_[m++] = pos;
+        }
+      }
+
+      // The elimination tree and the number of elements in each column of L
+      const std::size_t none = n_;
+      parent_.assign(n_, none);
+      std::vector<std::size_t> lnz(n_, 0);
+      std::vector<std::size_t> flag(n_, 0);
+      for (std::size_t k = 0; k < n_; ++k) {
+        flag[k] = k;
+        for (std::size_t p = cp_[k]; p < cp_[k + 1]; ++p) {
+          for (std::size_t i = ci_[p]; i < k && flag[i] != k; i = parent_[i]) {
+            if (parent_[i] == none) {
+              parent_[i] = k;
+            }
+            lnz[i]++;
+            flag[i] = k;
+          }
+        }
+      }
+      lp_.assign(n_ + 1, 0);
+      for (std::size_t k = 0; k < n_; ++k) {
+        lp_[k + 1] = lp_[k] + lnz[k];
+      }
+      li_.resize(lp_.back());
+      lx_.resize(lp_.back());
+      d_.resize(n_);
+      work_.resize(n_);
+      pattern_.resize(n_);
+      flag_.resize(n_);
+      lnz_.resize(n_);
+      analysed_ = true;
+      num_analyses_++;
+    }
+
+    /**
+     * Find the numerical values of the factor with the up-looking algorithm,
+     * computing row k of L from the columns of the rows above it
+     */
+    void factorise() {
+      std::size_t m = 0;
+      for (std::size_t j = 0; j < n_; ++j) {
+        for (std::size_t p = 0; p < values_[j].size(); ++p) {
+          cx_[map_[m++]] = values_[j][p];
+        }
+      }
+      std::vector<double> &y = work_;
+      for (std::size_t k = 0; k < n_; ++k) {
+        // Scatter column k of the matrix and find the pattern of row k of L
+        // by following the elimination tree from each row
+        y[k] = 0.0;
+        std::size_t top = n_;
+        flag_[k] = k;
+        lnz_[k] = 0;
+        for (std::size_t p = cp_[k]; p < cp_[k + 1]; ++p) {
+          std::size_t i = ci_[p];
+          y[i] += cx_[p];
+          std::size_t len = 0;
+          for (; flag_[i] != k; i = parent_[i]) {
+            pattern_[len++] = i;
+            flag_[i] = k;
+          }
+          while (len > 0) {
+            pattern_[--top] = pattern_[--len];
+          }
+        }
+
+        // Compute the elements of row k of L and the diagonal
+        d_[k] = y[k];
+        y[k] = 0.0;
+        for (; top < n_; ++top) {
+          std::size_t i = pattern_[top];
+          double yi = y[i];
+          y[i] = 0.0;
+          std::size_t p = lp_[i];
+          for (; p < lp_[i] + lnz_[i]; ++p) {
+            y[li_[p]] -= lx_[p] * yi;
+          }
+          double l_ki = yi / d_[i];
+          d_[k] -= l_ki * yi;
+          li_[p] = k;
+          lx_[p] = l_ki;
+          lnz_[i]++;
+        }
+        if (d_[k] == 0.0) {
+          DIALS_ERROR("The normal matrix is singular");
+        }
+      }
+    }
+
+    std::size_t n_;
+    std::vector<std::vector<std::size_t> > rows_;
+    std::vector<std::vector<double> > values_;
+    af::shared<double> right_hand_side_;
+    std::vector<double> solution_;
+    double sum_w_r_sq_;
+    std::size_t n_equations_;
+    bool solved_;
+    bool analysed_;
+    std::size_t num_analyses_;
+
+    // The ordering, permuted matrix and symbolic factorisation
+    std::vector<std::size_t> perm_;
+    std::vector<std::size_t> cp_;
+    std::vector<std::size_t> ci_;
+    std::vector<double> cx_;
+    std::vector<std::size_t> map_;
+    std::vector<std::size_t> parent_;
+    std::vector<std::size_t> lp_;
+
+    // The numerical factorisation and the workspace used to compute it
+    std::vector<std::size_t> li_;
+    std::vector<double> lx_;
+    std::vector<double> d_;
+    std::vector<double> work_;
+    std::vector<std::size_t> pattern_;
+    std::vector<std::size_t> flag_;
+    std::vector<std::size_t> lnz_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_NORMAL_EQUATIONS_H
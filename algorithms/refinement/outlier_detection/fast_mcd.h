@@ -0,0 +1,349 @@
+/*
+ * fast_mcd.h
+ *
+ *  Copyright (C) (2016) STFC Rutherford Appleton Laboratory, UK.
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_FAST_MCD_H
+#define DIALS_REFINEMENT_FAST_MCD_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/random.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <scitbx/array_family/versa_matrix.h>
+#include <dials/algorithms/refinement/outlier_detection/mahalanobis.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  /**
+   * A location and scatter estimate from a subset of observations, with the
+   * determinant of the scatter matrix
+   */
+  struct MCDEstimate {
+    double det;
+    std::vector<double> T;
+    std::vector<double> S;
+
+    MCDEstimate() : det(0.0) {}
+
+    bool operator<(const MCDEstimate &other) const {
+      return det < other.det;
+    }
+  };
+
+  /**
+   * The inner loops of the FAST-MCD algorithm of Rousseeuw and van Driessen,
+   * working on a matrix of observations: forming random initial subsets and
+   * applying concentration steps. Independent trials are shared between
+   * threads. The random initial subset of each trial is drawn from its own
+   * seed, so the results do not depend on the number of threads.
+   */
+  class FastMCDCore {
+  public:
+    /**
+     * @param obs The nobs x nparam matrix of observations
+     */
+    FastMCDCore(const af::const_ref<double, af::c_grid<2> > &obs)
+        : nobs_(obs.accessor()[0]),
+          nparam_(obs.accessor()[1]),
+          obs_(obs.begin(), obs.end()) {
+      DIALS_ASSERT(nparam_ > 0);
+      DIALS_ASSERT(nobs_ > nparam_);
+    }
+
+    std::size_t nobs() const {
+      return nobs_;
+    }
+
+    std::size_t nparam() const {
+      return nparam_;
+    }
+
+    /**
+     * Calculate the means and covariance matrix of a subset of observations
+     * @param rows The rows of the observations in the subset
+     * @returns The estimate
+     */
+    MCDEstimate estimate(const std::vector<std::size_t> &rows) const {
+      std::size_t n = rows.size();
+      std::size_t p = nparam_;
+      DIALS_ASSERT(n > 1);
+      MCDEstimate result;
+      result.T.assign(p, 0.0);
+      result.S.assign(p * p, 0.0);
+      for (std::size_t i = 0; i < n; ++i) {
+        const double *x = &obs_[rows[i] * p];
+        for (std::size_t j = 0; j < p; ++j) {
+          result.T[j] += x[j];
+        }
+      }
+      for (std::size_t j = 0; j < p; ++j) {
+        result.T[j] /= n;
+      }
+      std::vector<double> dx(p);
+      for (std::size_t i = 0; i < n; ++i) {
+        const double *x = &obs_[rows[i] * p];
+        for (std::size_t j = 0; j < p; ++j) {
+          dx[j] = x[j] - result.T[j];
+        }
+        for (std::size_t j = 0; j < p; ++j) {
+          for (std::size_t k = j; k < p; ++k) {
+            result.S[j * p + k] += dx[j] * dx[k];
+          }
+        }
+      }
+      for (std::size_t j = 0; j < p; ++j) {
+        for (std::size_t k = j; k < p; ++k) {
+          result.S[j * p + k] /= (n - 1);
+          result.S[k * p + j] = result.S[j * p + k];
+        }
+      }
+      result.det = determinant(result.S);
+      return result;
+    }
+
+    /**
+     * A concentration step (Theorem 1 of R&vD): select the h observations
+     * closest to the estimate in Mahalanobis distance.
+     * @param estimate The current estimate
+     * @param h The size of the subset
+     * @returns The rows of the new subset, in increasing order
+     */
+    std::vector<std::size_t> concentrate(const MCDEstimate &estimate,
+                                         std::size_t h) const {
+      DIALS_ASSERT(h > 0 && h <= nobs_);
+      af::versa<double, af::c_grid<2> > covinv(af::c_grid<2>(nparam_, nparam_));
+      std::copy(estimate.S.begin(), estimate.S.end(), covinv.begin());
+      af::matrix_inversion_in_place(covinv.ref());
+      std::vector<double> d2(nobs_);
+      detail::maha_dist_sq(
+        &obs_[0], nobs_, nparam_, &estimate.T[0], covinv.begin(), &d2[0]);
+
+      // Select the h smallest distances, breaking ties by the row
+      std::vector<std::size_t> index(nobs_);
+      for (std::size_t i = 0; i < nobs_; ++i) {
+        index[i] = i;
+      }
+      std::nth_element(index.begin(),
+                       index.begin() + (h - 1),
+                       index.end(),
+                       CompareDistance(d2));
+      index.resize(h);
+      std::sort(index.begin(), index.end());
+      return index;
+    }
+
+    /**
+     * Apply concentration steps to an estimate
+     * @param estimate The initial estimate
+     * @param h The size of the subsets
+     * @param nsteps The maximum number of steps
+     * @param stop_on_convergence Stop when the determinant does not change
+     * @returns The final estimate
+     */
+    MCDEstimate refine(const MCDEstimate &estimate,
+                       std::size_t h,
+                       std::size_t nsteps,
+                       bool stop_on_convergence) const {
+      MCDEstimate current = estimate;
+      for (std::size_t i = 0; i < nsteps; ++i) {
+        MCDEstimate next = this->estimate(concentrate(current, h));
+        bool converged = next.det == current.det;
+        current = next;
+        if (stop_on_convergence && converged) {
+          break;
+        }
+      }
+      return current;
+    }
+
+    /**
+     * Perform a trial: form a random initial subset (method 2 of subsection
+     * 3.1 of R&vD) and apply concentration steps.
+     * @param h The size of the subsets
+     * @param nsteps The number of concentration steps
+     * @param seed The seed for the random initial subset
+     * @returns The estimate
+     */
+    MCDEstimate trial(std::size_t h, std::size_t nsteps, std::size_t seed) const {
+      // draw a random p+1 subset J (or larger if required) by shuffling rows
+      // into the start of the array as they are needed
+      boost::random::mt19937 gen(static_cast<boost::uint32_t>(seed));
+      std::vector<std::size_t> permuted(nobs_);
+      for (std::size_t i = 0; i < nobs_; ++i) {
+        permuted[i] = i;
+      }
+      std::size_t subset_size = 0;
+      MCDEstimate initial;
+      while (!(initial.det > 0.0)) {
+        DIALS_ASSERT(subset_size < nobs_);
+        std::size_t target = std::max(subset_size + 1, nparam_ + 1);
+        for (; subset_size < target; ++subset_size) {
+          boost::random::uniform_int_distribution<std::size_t> dist(subset_size,
+                                                                    nobs_ - 1);
+          std::swap(permuted[subset_size], permuted[dist(gen)]);
+        }
+        initial = estimate(std::vector<std::size_t>(
+          permuted.begin(), permuted.begin() + subset_size));
+      }
+
+      // apply the concentration steps. By Theorem 1 the determinant should
+      // not increase, but allow for some rounding error
+      MCDEstimate current = estimate(concentrate(initial, h));
+      for (std::size_t i = 0; i < nsteps; ++i) {
+        MCDEstimate next = estimate(concentrate(current, h));
+        DIALS_ASSERT(current.det > (next.det - next.det / 1.0e9));
+        current = next;
+      }
+      return current;
+    }
+
+    /**
+     * Perform independent trials on several threads
+     * @param h The size of the subsets
+     * @param nsteps The number of concentration steps
+     * @param seeds The seed of each trial
+     * @param nthreads The number of threads
+     * @returns The estimates of the trials, sorted by determinant
+     */
+    std::vector<MCDEstimate> trials(std::size_t h,
+                                    std::size_t nsteps,
+                                    const af::const_ref<std::size_t> &seeds,
+                                    std::size_t nthreads) const {
+      std::vector<MCDEstimate> result(seeds.size());
+      dials::util::parallel_for(
+        seeds.size(), nthreads, TrialJob(this, h, nsteps, &seeds[0], &result));
+      std::stable_sort(result.begin(), result.end());
+      return result;
+    }
+
+    /**
+     * Apply concentration steps to several estimates on several threads
+     * @param estimates The initial estimates
+     * @param h The size of the subsets
+     * @param nsteps The maximum number of steps
+     * @param stop_on_convergence Stop when the determinant does not change
+     * @param nthreads The number of threads
+     * @returns The final estimates, sorted by determinant
+     */
+    std::vector<MCDEstimate> refine(const std::vector<MCDEstimate> &estimates,
+                                    std::size_t h,
+                                    std::size_t nsteps,
+                                    bool stop_on_convergence,
+                                    std::size_t nthreads) const {
+      std::vector<MCDEstimate> result(estimates);
+      dials::util::parallel_for(
+        result.size(),
+        nthreads,
+        RefineJob(this, h, nsteps, stop_on_convergence, &result));
+      std::stable_sort(result.begin(), result.end());
+      return result;
+    }
+
+  private:
+    struct CompareDistance {
+      const std::vector<double> &d2;
+
+      CompareDistance(const std::vector<double> &d2_) : d2(d2_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        return d2[a] < d2[b] || (d2[a] == d2[b] && a < b);
+      }
+    };
+
+    struct TrialJob {
+      const FastMCDCore *core;
+      std::size_t h;
+      std::size_t nsteps;
+      const std::size_t *seeds;
+      std::vector<MCDEstimate> *result;
+
+      TrialJob(const FastMCDCore *core_,
+               std::size_t h_,
+               std::size_t nsteps_,
+               const std::size_t *seeds_,
+               std::vector<MCDEstimate> *result_)
+          : core(core_), h(h_), nsteps(nsteps_), seeds(seeds_), result(result_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          (*result)[i] = core->trial(h, nsteps, seeds[i]);
+        }
+      }
+    };
+
+    struct RefineJob {
+      const FastMCDCore *core;
+      std::size_t h;
+      std::size_t nsteps;
+      bool stop_on_convergence;
+      std::vector<MCDEstimate> *result;
+
+      RefineJob(const FastMCDCore *core_,
+                std::size_t h_,
+                std::size_t nsteps_,
+                bool stop_on_convergence_,
+                std::vector<MCDEstimate> *result_)
+          : core(core_),
+            h(h_),
+            nsteps(nsteps_),
+            stop_on_convergence(stop_on_convergence_),
+            result(result_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          (*result)[i] =
+            core->refine((*result)[i], h, nsteps, stop_on_convergence);
+        }
+      }
+    };
+
+    /**
+     * The determinant of a square matrix by LU decomposition with partial
+     * pivoting
+     */
+    double determinant(std::vector<double> a) const {
+      std::size_t p = nparam_;
+      double det = 1.0;
+      for (std::size_t k = 0; k < p; ++k) {
+        std::size_t pivot = k;
+        for (std::size_t i = k + 1; i < p; ++i) {
+          if (std::abs(a[i * p + k]) > std::abs(a[pivot * p + k])) {
+            pivot = i;
+          }
+        }
+        if (a[pivot * p + k] == 0.0) {
+          return 0.0;
+        }
+        if (pivot != k) {
+          for (std::size_t j = 0; j < p; ++j) {
+            std::swap(a[k * p + j], a[pivot * p + j]);
+          }
+          det = -det;
+        }
+        det *= a[k * p + k];
+        for (std::size_t i = k + 1; i < p; ++i) {
+          double f = a[i * p + k] / a[k * p + k];
+          for (std::size_t j = k + 1; j < p; ++j) {
+            a[i * p + j] -= f * a[k * p + j];
+          }
+        }
+      }
+      return det;
+    }
+
+    std::size_t nobs_;
+    std::size_t nparam_;
+    std::vector<double> obs_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_FAST_MCD_H
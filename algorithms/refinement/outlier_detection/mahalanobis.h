@@ -2,12 +2,60 @@
 #ifndef DIALS_REFINEMENT_MAHALANOBIS_H
 #define DIALS_REFINEMENT_MAHALANOBIS_H
 
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/array_family/versa_matrix.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
 
+  namespace detail {
+
+    /**
+     * Calculate the squared Mahalanobis distances of the rows of a matrix of
+     * observations from a center, with respect to an inverse covariance matrix
+     * @param obs The nobs x nparam matrix of observations
+     * @param nobs The number of observations
+     * @param nparam The number of parameters
+     * @param center The center
+     * @param covinv The inverse of the covariance matrix
+     * @param d2 The output squared distances
+     */
+    inline void maha_dist_sq(const double *obs,
+                             std::size_t nobs,
+                             std::size_t nparam,
+                             const double *center,
+                             const double *covinv,
+                             double *d2) {
+      std::vector<double> row(nparam);
+      for (std::size_t i = 0; i < nobs; i++) {
+        // copy row from obs and shift by means
+        for (std::size_t j = 0; j < nparam; j++) {
+          row[j] = obs[i * nparam + j] - center[j];
+        }
+
+        // Mahalanobis distance squared is defined by the matrix product
+        //
+        // (x - mu)^T [S]^-1 (x - mu)
+        //
+        // Each element of the right hand part of the product is formed and
+        // then added to the dot product with (x - mu).
+        double sum = 0.0;
+        for (std::size_t j = 0; j < nparam; j++) {
+          const double *c = covinv + j * nparam;
+          double prod = 0.0;
+          for (std::size_t k = 0; k < nparam; k++) {
+            prod += c[k] * row[k];
+          }
+          sum += row[j] * prod;
+        }
+        d2[i] = sum;
+      }
+    }
+
+  }  // namespace detail
+
+
   af::shared<double> maha_dist_sq(const af::const_ref<double, af::c_grid<2> > &obs,
                                   const af::const_ref<double> &center,
                                   const af::const_ref<double, af::c_grid<2> > &cov) {
@@ -26,33 +74,9 @@ namespace dials { namespace refinement {
     af::matrix_inversion_in_place(covinv.ref());
 
     // create output array
-    af::shared<double> d2(nobs);
-
-    // loop over observations
-    std::size_t k = 0;
-    for (std::size_t i = 0; i < nobs; i++) {
-      // copy row from obs and shift by means
-      af::shared<double> row(nparam);
-
-      for (std::size_t j = 0; j < nparam; j++) {
-        row[j] = obs[k] - center[j];
-        k++;
-      }
-
-      // Mahalanobis distance squared is defined by the matrix product
-      //
-      // (x - mu)^T [S]^-1 (x - mu)
-      //
-      // (x - mu) is in 'row' and [S]^-1 is 'covinv'. Perform the right
-      // hand part of the product first with matrix_multiply and the
-      // second step is just a dot product.
-      af::shared<double> prod =
-        af::matrix_multiply(covinv.const_ref(), row.const_ref());
-      d2[i] = 0.0;
-      for (std::size_t j = 0; j < nparam; j++) {
-        d2[i] += row[j] * prod[j];
-      }
-    }
+    af::shared<double> d2(nobs, af::init_functor_null<double>());
+    detail::maha_dist_sq(
+      obs.begin(), nobs, nparam, center.begin(), covinv.begin(), d2.begin());
     return d2;
   }
 
@@ -23,6 +23,7 @@ def __init__(
         k2=2,
         k3=100,
         threshold_probability=0.975,
+        nthreads=1,
     ):
 
         if cols is None:
@@ -44,6 +45,7 @@ def __init__(
         self._k1 = k1
         self._k2 = k2
         self._k3 = k3
+        self._nthreads = nthreads
 
         # Calculate Mahalanobis distance threshold
         df = len(cols)
@@ -62,6 +64,7 @@ def _detect_outliers(self, cols):
             k1=self._k1,
             k2=self._k2,
             k3=self._k3,
+            nthreads=self._nthreads,
         )
 
         # get location and MCD scatter estimate
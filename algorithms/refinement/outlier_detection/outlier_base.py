@@ -374,6 +374,11 @@ def __call__(self, reflections):
                "Observations whose robust Mahalanobis distances are larger than"
                "the obtained quantile will be flagged as outliers."
        .type = float(value_min = 0., value_max = 1.0)
+
+     nthreads=1
+       .help = "The number of threads used for the trials from random initial"
+               "subsets and the following concentration steps."
+       .type = int(value_min = 1)
   }
 
   sauter_poon
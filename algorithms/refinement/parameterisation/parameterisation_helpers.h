@@ -9,8 +9,10 @@
 #include <dxtbx/model/panel.h>
 #include <dials/error.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
-//#include <dials/algorithms/refinement/rtmats.h>
+#include <dials/algorithms/refinement/rtmats.h>
 #include <scitbx/math/r3_rotation.h>
+#include <scitbx/sparse/matrix.h>
+#include <scitbx/array_family/flex_types.h>
 
 namespace dials { namespace refinement {
 
@@ -19,12 +21,6 @@ namespace dials { namespace refinement {
   using scitbx::vec3;
   using scitbx::math::r3_rotation::axis_and_angle_as_matrix;
 
-  // declare this here - can't #include the header as the function is defined
-  // there, leading to multiple definitions
-  mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
-                                      double angle,
-                                      bool deg = false);
-
   af::shared<mat3<double> > selected_multi_panel_compose(
     const af::const_ref<vec3<double> > &initial_state,
     const af::const_ref<double> &params_vals,
@@ -926,6 +922,217 @@ namespace dials { namespace refinement {
     mat3<double> dU_dphi3_;
   };
 
+  /**
+   * Assemble a sparse Jacobian from the gradients of each type of residual
+   * (e.g. X, Y and phi) with respect to each parameter. The gradients of the
+   * residuals of each type fill a block of rows of the Jacobian, so the rows
+   * for type i start at i * nref.
+   */
+  class SparseJacobianBuilder {
+  public:
+    typedef scitbx::sparse::matrix<double> matrix_type;
+    typedef matrix_type::column_type column_type;
+
+    /**
+     * @param nref The number of reflections
+     * @param ndim The number of types of residual
+     * @param nparam The number of parameters
+     */
+    SparseJacobianBuilder(std::size_t nref, std::size_t ndim, std::size_t nparam)
+        : nref_(nref), ndim_(ndim), jacobian_(nref * ndim, nparam) {}
+
+    /**
+     * Set the gradients of one type of residual with respect to a parameter
+     * @param dim The type of residual
+     * @param param The parameter
+     * @param gradients The gradients for each reflection
+     */
+    void set_gradients(std::size_t dim,
+                       std::size_t param,
+                       const column_type &gradients) {
+      DIALS_ASSERT(dim < ndim_);
+      DIALS_ASSERT(param < jacobian_.n_cols());
+      DIALS_ASSERT(gradients.size() == nref_);
+      gradients.compact();
+      const std::size_t offset = dim * nref_;
+      for (column_type::const_iterator it = gradients.begin(); it != gradients.end();
+           ++it) {
+        jacobian_(offset + it.index(), param) = *it;
+      }
+    }
+
+    /**
+     * @returns The Jacobian
+     */
+    matrix_type jacobian() {
+      jacobian_.compact();
+      return jacobian_;
+    }
+
+  private:
+    std::size_t nref_;
+    std::size_t ndim_;
+    matrix_type jacobian_;
+  };
+
+  /**
+   * Assemble a dense Jacobian from the gradients of each type of residual with
+   * respect to each parameter, with the same layout as SparseJacobianBuilder.
+   */
+  class DenseJacobianBuilder {
+  public:
+    DenseJacobianBuilder(std::size_t nref, std::size_t ndim, std::size_t nparam)
+        : nref_(nref),
+          ndim_(ndim),
+          nparam_(nparam),
+          jacobian_(af::flex_grid<>(nref * ndim, nparam), 0) {}
+
+    /**
+     * Set the gradients of one type of residual with respect to a parameter
+     * @param dim The type of residual
+     * @param param The parameter
+     * @param gradients The gradients for each reflection
+     */
+    void set_gradients(std::size_t dim,
+                       std::size_t param,
+                       const af::const_ref<double> &gradients) {
+      DIALS_ASSERT(dim < ndim_);
+      DIALS_ASSERT(param < nparam_);
+      DIALS_ASSERT(gradients.size() == nref_);
+      double *row = &jacobian_[dim * nref_ * nparam_ + param];
+      for (std::size_t i = 0; i < nref_; ++i, row += nparam_) {
+        *row = gradients[i];
+      }
+    }
+
+    /**
+     * @returns The Jacobian
+     */
+    af::versa<double, af::flex_grid<> > jacobian() {
+      return jacobian_;
+    }
+
+  private:
+    std::size_t nref_;
+    std::size_t ndim_;
+    std::size_t nparam_;
+    af::versa<double, af::flex_grid<> > jacobian_;
+  };
+
+  /**
+   * Accumulate the gradients and approximate curvatures of the least squares
+   * functional L = 1/2 sum w r^2 one parameter at a time. The residuals and
+   * weights have the same layout as the rows of the Jacobian, and the
+   * gradients of each type of residual are given separately, as for the
+   * Jacobian builders. The gradients don't have to be concatenated, no
+   * temporary arrays are made, and only the non-zero elements of sparse
+   * gradients are visited.
+   */
+  class LeastSquaresGradientAccumulator {
+  public:
+    typedef scitbx::sparse::matrix<double>::column_type column_type;
+
+    /**
+     * @param residuals The residuals of each type, nref of each in turn
+     * @param weights The weights of the residuals
+     * @param ndim The number of types of residual
+     */
+    LeastSquaresGradientAccumulator(const af::const_ref<double> &residuals,
+                                    const af::const_ref<double> &weights,
+                                    std::size_t ndim)
+        : ndim_(ndim),
+          weighted_residuals_(residuals.size()),
+          weights_(weights.begin(), weights.end()) {
+      DIALS_ASSERT(ndim > 0);
+      DIALS_ASSERT(residuals.size() == weights.size());
+      DIALS_ASSERT(residuals.size() % ndim == 0);
+      nref_ = residuals.size() / ndim;
+      for (std::size_t i = 0; i < residuals.size(); ++i) {
+        weighted_residuals_[i] = weights[i] * residuals[i];
+      }
+    }
+
+    /**
+     * @param squared_residuals The squared residuals
+     * @returns The value of the functional
+     */
+    double functional(const af::const_ref<double> &squared_residuals) const {
+      DIALS_ASSERT(squared_residuals.size() == weights_.size());
+      double sum = 0.0;
+      for (std::size_t i = 0; i < squared_residuals.size(); ++i) {
+        sum += weights_[i] * squared_residuals[i];
+      }
+      return 0.5 * sum;
+    }
+
+    /**
+     * Add the contribution of the gradients of one type of residual with
+     * respect to a parameter
+     * @param dim The type of residual
+     * @param gradients The gradients for each reflection
+     * @param gradient The gradient of the functional to add to
+     * @param curvature The curvature of the functional to add to
+     */
+    void add_gradients(std::size_t dim,
+                       const af::const_ref<double> &gradients,
+                       double &gradient,
+                       double &curvature) const {
+      DIALS_ASSERT(dim < ndim_);
+      DIALS_ASSERT(gradients.size() == nref_);
+      const double *wr = weighted_residuals_.begin() + dim * nref_;
+      const double *w = weights_.begin() + dim * nref_;
+      for (std::size_t i = 0; i < nref_; ++i) {
+        double g = gradients[i];
+        gradient += wr[i] * g;
+        curvature += w[i] * g * g;
+      }
+    }
+
+    /**
+     * Add the contribution of the sparse gradients of one type of residual
+     * with respect to a parameter
+     * @param dim The type of residual
+     * @param gradients The gradients for each reflection
+     * @param gradient The gradient of the functional to add to
+     * @param curvature The curvature of the functional to add to
+     */
+    void add_gradients(std::size_t dim,
+                       const column_type &gradients,
+                       double &gradient,
+                       double &curvature) const {
+      DIALS_ASSERT(dim < ndim_);
+      DIALS_ASSERT(gradients.size() == nref_);
+      gradients.compact();
+      const std::size_t offset = dim * nref_;
+      for (column_type::const_iterator it = gradients.begin(); it != gradients.end();
+           ++it) {
+        double g = *it;
+        gradient += weighted_residuals_[offset + it.index()] * g;
+        curvature += weights_[offset + it.index()] * g * g;
+      }
+    }
+
+    /**
+     * @returns The number of types of residual
+     */
+    std::size_t ndim() const {
+      return ndim_;
+    }
+
+    /**
+     * @returns The number of reflections
+     */
+    std::size_t nref() const {
+      return nref_;
+    }
+
+  private:
+    std::size_t nref_;
+    std::size_t ndim_;
+    af::shared<double> weighted_residuals_;
+    af::shared<double> weights_;
+  };
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
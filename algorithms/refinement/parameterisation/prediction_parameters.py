@@ -4,6 +4,7 @@
 
 from dials.algorithms.refinement import DialsRefineConfigError
 from dials.array_family import flex
+from dials_refinement_helpers_ext import rotation_matrices
 
 """The PredictionParameterisation class ties together parameterisations for
 individual experimental models: beam, crystal orientation, crystal unit cell
@@ -686,18 +687,14 @@ def _local_setup(self, reflections):
         """Setup additional attributes used in gradients calculation. These are
         specific to scans-type prediction parameterisations"""
 
-        # Spindle rotation matrices for every reflection
-        # R = self._axis.axis_and_angle_as_r3_rotation_matrix(phi)
-        # R = flex.mat3_double(len(reflections))
-        # NB for now use flex.vec3_double.rotate_around_origin each time I need the
-        # rotation matrix R.
+        # Spindle rotation matrices for every reflection. These are calculated
+        # once here, rather than rotating the vectors for each parameter.
+        self._phi_calc = reflections["xyzcal.mm"].parts()[2]
+        self._R = rotation_matrices(self._axis, self._phi_calc)
 
         # r is the reciprocal lattice vector, in the lab frame
-        self._phi_calc = reflections["xyzcal.mm"].parts()[2]
         q = self._fixed_rotation * (self._UB * self._h)
-        self._r = self._setting_rotation * q.rotate_around_origin(
-            self._axis, self._phi_calc
-        )
+        self._r = self._setting_rotation * (self._R * q)
 
         # All of the derivatives of phi have a common denominator, given by
         # (e X r).s0, where e is the rotation axis. Calculate this once, here.
@@ -789,10 +786,9 @@ def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
         generic parameterisations."""
 
         # Get required data
-        axis = self._axis.select(isel)
+        R = self._R.select(isel)
         fixed_rotation = self._fixed_rotation.select(isel)
         setting_rotation = self._setting_rotation.select(isel)
-        phi_calc = self._phi_calc.select(isel)
         h = self._h.select(isel)
         s1 = self._s1.select(isel)
         e_X_r = self._e_X_r.select(isel)
@@ -825,7 +821,7 @@ def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
                 tmp = fixed_rotation * (der * B * h)
             else:
                 tmp = fixed_rotation * (U * der * h)
-            dr = setting_rotation * tmp.rotate_around_origin(axis, phi_calc)
+            dr = setting_rotation * (R * tmp)
 
             # calculate the derivative of phi for this parameter
             dphi = -1.0 * dr.dot(s1) / e_r_s0
@@ -861,9 +857,8 @@ def _goniometer_derivatives(
         derivatives of the goniometer parameterisations"""
 
         # Get required data
-        axis = self._axis.select(isel)
+        R = self._R.select(isel)
         fixed_rotation = self._fixed_rotation.select(isel)
-        phi_calc = self._phi_calc.select(isel)
         h = self._h.select(isel)
         s1 = self._s1.select(isel)
         e_X_r = self._e_X_r.select(isel)
@@ -871,6 +866,10 @@ def _goniometer_derivatives(
         UB = self._UB.select(isel)
         D = self._D.select(isel)
 
+        # the rotated relp before the setting rotation does not depend on the
+        # goniometer parameters
+        Rq = R * (fixed_rotation * (UB * h))
+
         if dS_dgon_p is None:
 
             # get derivatives of the setting matrix S wrt the parameters
@@ -891,8 +890,7 @@ def _goniometer_derivatives(
                 continue
 
             # calculate the derivative of r for this parameter
-            tmp = fixed_rotation * (UB * h)
-            dr = der * tmp.rotate_around_origin(axis, phi_calc)
+            dr = der * Rq
 
             # calculate the derivative of phi for this parameter
             dphi = -1.0 * dr.dot(s1) / e_r_s0
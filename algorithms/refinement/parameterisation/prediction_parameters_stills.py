@@ -3,7 +3,7 @@
     SparseGradientVectorMixin,
 )
 from dials.array_family import flex
-from dials_refinement_helpers_ext import dRq_de
+from dials_refinement_helpers_ext import dRq_de, rotation_matrices
 
 
 class StillsPredictionParameterisation(PredictionParameterisation):
@@ -43,6 +43,9 @@ def _local_setup(self, reflections):
         # e1 is the unit vector about which DeltaPsi rotation is defined
         self._e1 = self._q0.cross(self._s0u).each_normalize()
 
+        # the matrices of the DeltaPsi rotations, to rotate the derivatives of q
+        self._R_DeltaPsi = rotation_matrices(self._e1, self._DeltaPsi)
+
         # q1 completes an orthonormal set with q0 and e1
         self._q1 = self._q0.cross(self._e1).each_normalize()
 
@@ -75,6 +78,9 @@ def _beam_derivatives(self, isel, parameterisation=None, reflections=None):
         dDeltaPsi_dp = []
         dpv_dp = []
 
+        # the derivative of r wrt the axis e1 does not depend on the parameter
+        dr_de1 = None
+
         # loop through the parameters
         for der in ds0_dbeam_p:
 
@@ -97,7 +103,8 @@ def _beam_derivatives(self, isel, parameterisation=None, reflections=None):
 
             # calculate (d[r]/d[e1])(d[e1]/dp)
             de1_dp = c0.cross(ds0u)
-            dr_de1 = dRq_de(DeltaPsi, e1, q)
+            if dr_de1 is None:
+                dr_de1 = dRq_de(DeltaPsi, e1, q)
             drde_dedp = dr_de1 * de1_dp
 
             # dp = 1.e-8 # finite step size for the parameter
@@ -124,6 +131,7 @@ def _xl_orientation_derivatives(
         h = self._h.select(isel)
         e1 = self._e1.select(isel)
         DeltaPsi = self._DeltaPsi.select(isel)
+        R_DeltaPsi = self._R_DeltaPsi.select(isel)
         s1 = self._s1.select(isel)
         q = self._q.select(isel)
         q_scalar = self._q_scalar.select(isel)
@@ -154,7 +162,7 @@ def _xl_orientation_derivatives(
             dq = der_mat * B * h
 
             # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
+            dr = R_DeltaPsi * dq
 
             # calculate the derivative of DeltaPsi for this parameter
             dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
@@ -193,6 +201,7 @@ def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=Non
         h = self._h.select(isel)
         e1 = self._e1.select(isel)
         DeltaPsi = self._DeltaPsi.select(isel)
+        R_DeltaPsi = self._R_DeltaPsi.select(isel)
         s1 = self._s1.select(isel)
         q = self._q.select(isel)
         q_scalar = self._q_scalar.select(isel)
@@ -223,7 +232,7 @@ def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=Non
             dq = U * der_mat * h
 
             # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
+            dr = R_DeltaPsi * dq
 
             # calculate the derivative of DeltaPsi for this parameter
             dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
@@ -322,6 +331,9 @@ def _local_setup(self, reflections):
         # e1 is the unit vector about which DeltaPsi rotation is defined
         self._e1 = self._q0.cross(self._s0u).each_normalize()
 
+        # the matrices of the DeltaPsi rotations, to rotate the derivatives of q
+        self._R_DeltaPsi = rotation_matrices(self._e1, self._DeltaPsi)
+
         # q1 completes an orthonormal set with q0 and e1
         self._q1 = self._q0.cross(self._e1).each_normalize()
 
@@ -396,7 +408,7 @@ def _xl_orientation_derivatives(
         B = self._B.select(isel)
         h = self._h.select(isel)
         e1 = self._e1.select(isel)
-        DeltaPsi = self._DeltaPsi.select(isel)
+        R_DeltaPsi = self._R_DeltaPsi.select(isel)
         s1 = self._s1.select(isel)
         nu = self._nu.select(isel)
         q_s0 = self._q_s0.select(isel)
@@ -426,7 +438,7 @@ def _xl_orientation_derivatives(
             dq = der_mat * B * h
 
             # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
+            dr = R_DeltaPsi * dq
 
             # calculate the derivative of DeltaPsi for this parameter
             dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
@@ -451,7 +463,7 @@ def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=Non
         U = self._U.select(isel)
         h = self._h.select(isel)
         e1 = self._e1.select(isel)
-        DeltaPsi = self._DeltaPsi.select(isel)
+        R_DeltaPsi = self._R_DeltaPsi.select(isel)
         s1 = self._s1.select(isel)
         nu = self._nu.select(isel)
         q_s0 = self._q_s0.select(isel)
@@ -481,7 +493,7 @@ def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=Non
             dq = U * der_mat * h
 
             # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
+            dr = R_DeltaPsi * dq
 
             # calculate the derivative of DeltaPsi for this parameter
             dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
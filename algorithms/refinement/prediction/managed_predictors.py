@@ -101,6 +101,22 @@ def _post_prediction(self, reflections):
 
 
 class ScansExperimentsPredictor(ExperimentsPredictor):
+    """
+    Predict for scans. For scan static prediction the predictions for each
+    experiment are kept along with the models they were made with, and are
+    reused if neither the models nor the reflections have changed since the
+    last call. This is common in refinement, for example where the models of
+    some experiments are fixed or when predicting again for outlier rejection
+    before the first step. Scan varying predictions are always recalculated
+    as the per-reflection models are composed again for each call.
+    """
+
+    _predicted_columns = ("s1", "xyzcal.mm", "xyzcal.px")
+
+    def __init__(self, experiments):
+        super().__init__(experiments)
+        self._cache = {}
+
     def _predict_one_experiment(self, experiment, reflections):
 
         # scan-varying
@@ -113,9 +129,61 @@ def _predict_one_experiment(self, experiment, reflections):
             predictor.for_reflection_table(reflections, UB, s0, dmat, Smat)
         # scan static
         else:
+            state = self._model_state(experiment)
+            cached = self._cache.get(id(experiment))
+            if (
+                cached is not None
+                and cached[0] == state
+                and self._same_reflections(cached[1], reflections)
+            ):
+                self._restore_predictions(cached[1], reflections)
+                return
             predictor = sc(experiment)
             UB = experiment.crystal.get_A()
             predictor.for_reflection_table(reflections, UB)
+            self._cache[id(experiment)] = (state, self._copy_predictions(reflections))
+
+    @staticmethod
+    def _model_state(experiment):
+        """The state of the models that scan static prediction depends on"""
+
+        return (
+            experiment.crystal.get_A(),
+            experiment.beam.to_dict(),
+            experiment.detector.to_dict(),
+            experiment.goniometer.to_dict(),
+            experiment.scan.to_dict(),
+        )
+
+    def _copy_predictions(self, reflections):
+        """Copy the reflection indices and the predictions made for them"""
+
+        keep = ("miller_index", "entering", "panel") + self._predicted_columns
+        result = {key: reflections[key].deep_copy() for key in keep}
+        result["predicted"] = reflections.get_flags(reflections.flags.predicted)
+        return result
+
+    @staticmethod
+    def _same_reflections(cached, reflections):
+        """Check the reflections to predict are the cached reflections"""
+
+        if len(cached["panel"]) != len(reflections):
+            return False
+        for key in ("entering", "panel"):
+            if not (cached[key] == reflections[key]).all_eq(True):
+                return False
+        h1 = cached["miller_index"].as_vec3_double().parts()
+        h2 = reflections["miller_index"].as_vec3_double().parts()
+        return all((a == b).all_eq(True) for a, b in zip(h1, h2))
+
+    def _restore_predictions(self, cached, reflections):
+        """Copy the cached predictions to the reflections"""
+
+        for key in self._predicted_columns:
+            reflections[key] = cached[key].deep_copy()
+        predicted = cached["predicted"]
+        reflections.unset_flags(~predicted, reflections.flags.predicted)
+        reflections.set_flags(predicted, reflections.flags.predicted)
 
     def _post_prediction(self, reflections):
 
@@ -403,7 +403,9 @@ def _build_components(cls, params, reflections, experiments):
         # Build a restraints parameterisation (if requested).
         # Only unit cell restraints are supported at the moment.
         restraints_parameterisation = cls.config_restraints(
-            params.refinement.parameterisation, pred_param
+            params.refinement.parameterisation,
+            pred_param,
+            nproc=params.refinement.mp.nproc,
         )
 
         # Parameter reporting
@@ -504,13 +506,14 @@ def config_sparse(params, experiments):
         return params
 
     @staticmethod
-    def config_restraints(params, pred_param):
+    def config_restraints(params, pred_param, nproc=1):
         """Given a set of user parameters plus a model parameterisation, create
         restraints plus a parameterisation of these restraints
 
         Params:
             params: The input PHIL parameters
             pred_param: A PredictionParameters object
+            nproc: The number of threads to calculate the restraint gradients
 
         Returns:
             A restraints parameterisation or None
@@ -540,6 +543,7 @@ def config_restraints(params, pred_param):
             xl_orientation_parameterisations=xl_ori_params,
             xl_unit_cell_parameterisations=xl_uc_params,
             goniometer_parameterisations=gon_params,
+            nthreads=nproc,
         )
 
         # Shorten params path
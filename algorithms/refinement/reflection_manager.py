@@ -21,6 +21,7 @@
     set_obs_s1,
 )
 from dials.array_family import flex
+from dials_refinement_helpers_ext import ReflectionGroupIndex
 
 logger = logging.getLogger(__name__)
 
@@ -374,16 +375,11 @@ def __init__(
         # and proceed to sort by id and panel. This is required for the C++ extension
         # modules to allow for nlogn subselection of values used in refinement.
         l_id = reflections["id"]
-        id0 = l_id[0]
-        for id_x in l_id[1:]:
-            if id0 <= id_x:
-                id0 = id_x
-            else:
-                reflections.sort("id")  # Ensuring the ref_table is sorted by id
-                reflections.subsort(
-                    "id", "panel"
-                )  # Ensuring that within each sorted id block, sorting is next performed by panel
-                break
+        if (l_id[1:] < l_id[:-1]).count(True) > 0:
+            reflections.sort("id")  # Ensuring the ref_table is sorted by id
+            reflections.subsort(
+                "id", "panel"
+            )  # Ensuring that within each sorted id block, sorting is next performed by panel
 
         # set up the reflection inclusion criteria
         self._close_to_spindle_cutoff = close_to_spindle_cutoff  # close to spindle
@@ -528,13 +524,16 @@ def _id_refs_to_keep(self, obs_data):
         # for a particular experiment
         to_keep = flex.bool(len(inc), True)
 
+        # Index the reflections of each experiment in one pass
+        groups = ReflectionGroupIndex(obs_data["id"], len(self._experiments))
+
         for iexp, exp in enumerate(self._experiments):
             axis = self._axes[iexp]
             if not axis or exp.scan is None:
                 continue
             if exp.scan.is_still():
                 continue
-            sel = obs_data["id"] == iexp
+            sel = groups.indices(iexp)
             s0 = self._s0vecs[iexp]
             s1 = obs_data["s1"].select(sel)
             phi = obs_data["xyzobs.mm.value"].parts()[2].select(sel)
@@ -591,13 +590,13 @@ def _id_refs_to_keep(self, obs_data):
     def _create_working_set(self):
         """Make a subset of the indices of reflections to use in refinement"""
 
+        # Index the reflections of each experiment in one pass
+        groups = ReflectionGroupIndex(self._reflections["id"], len(self._experiments))
+
         working_isel = flex.size_t()
         for iexp, exp in enumerate(self._experiments):
 
-            sel = self._reflections["id"] == iexp
-            isel = sel.iselection()
-            # refs = self._reflections.select(sel)
-            nrefs = sample_size = len(isel)
+            nrefs = sample_size = groups.size(iexp)
 
             # set sample size according to nref_per_degree (per experiment)
             if exp.scan and self._nref_per_degree:
@@ -622,7 +621,9 @@ def _create_working_set(self):
 
             # determine subset and collect indices
             if sample_size < nrefs:
-                isel = isel.select(flex.random_selection(nrefs, sample_size))
+                isel = groups.select(iexp, flex.random_selection(nrefs, sample_size))
+            else:
+                isel = groups.indices(iexp)
             working_isel.extend(isel)
 
         # create subsets
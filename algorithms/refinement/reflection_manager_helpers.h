@@ -0,0 +1,100 @@
+/*
+ * reflection_manager_helpers.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_REFLECTION_MANAGER_HELPERS_H
+#define DIALS_REFINEMENT_REFLECTION_MANAGER_HELPERS_H
+
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  /**
+   * An index of the reflections in each group, e.g. the reflections of each
+   * experiment. The index is built by a single counting pass over the group
+   * ids, so the reflections of every group are found in time linear in the
+   * number of reflections rather than by a full comparison of the ids for each
+   * group. Each group keeps the order of its reflections in the table and
+   * reflections with ids outside the range of groups are left out.
+   */
+  class ReflectionGroupIndex {
+  public:
+    /**
+     * @param group The group id of each reflection
+     * @param ngroups The number of groups
+     */
+    ReflectionGroupIndex(const af::const_ref<int> &group, std::size_t ngroups)
+        : offset_(ngroups + 1, 0) {
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        if (group[i] >= 0 && std::size_t(group[i]) < ngroups) {
+          offset_[group[i] + 1]++;
+        }
+      }
+      for (std::size_t g = 0; g < ngroups; ++g) {
+        offset_[g + 1] += offset_[g];
+      }
+      indices_.resize(offset_[ngroups]);
+      af::shared<std::size_t> next(offset_.begin(), offset_.end() - 1);
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        if (group[i] >= 0 && std::size_t(group[i]) < ngroups) {
+          indices_[next[group[i]]++] = i;
+        }
+      }
+    }
+
+    /**
+     * @returns The number of groups
+     */
+    std::size_t ngroups() const {
+      return offset_.size() - 1;
+    }
+
+    /**
+     * @param g The group
+     * @returns The number of reflections in the group
+     */
+    std::size_t size(std::size_t g) const {
+      DIALS_ASSERT(g < ngroups());
+      return offset_[g + 1] - offset_[g];
+    }
+
+    /**
+     * @param g The group
+     * @returns The indices of the reflections in the group
+     */
+    af::shared<std::size_t> indices(std::size_t g) const {
+      DIALS_ASSERT(g < ngroups());
+      return af::shared<std::size_t>(indices_.begin() + offset_[g],
+                                     indices_.begin() + offset_[g + 1]);
+    }
+
+    /**
+     * @param g The group
+     * @param positions The positions of reflections within the group
+     * @returns The indices of the reflections at those positions
+     */
+    af::shared<std::size_t> select(std::size_t g,
+                                   const af::const_ref<std::size_t> &positions) const {
+      std::size_t n = size(g);
+      af::shared<std::size_t> result(positions.size());
+      for (std::size_t i = 0; i < positions.size(); ++i) {
+        DIALS_ASSERT(positions[i] < n);
+        result[i] = indices_[offset_[g] + positions[i]];
+      }
+      return result;
+    }
+
+  private:
+    af::shared<std::size_t> offset_;
+    af::shared<std::size_t> indices_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_REFLECTION_MANAGER_HELPERS_H
@@ -4,7 +4,7 @@
 from scitbx import sparse
 from scitbx.array_family import flex
 
-from dials_refinement_helpers_ext import CalculateCellGradients
+from dials_refinement_helpers_ext import CalculateCellGradients, add_cell_tie_gradients
 
 logger = logging.getLogger(__name__)
 
@@ -403,6 +403,43 @@ def gradients(self):
 
             yield dRdp
 
+    def _gradient_factors(self):
+        """Return the factors by which the gradients of a cell parameter are
+        multiplied for the residual of the crystal itself and, through the
+        average, for the residuals of the other crystals in the group"""
+        return self._gradfac, self._meangradfac
+
+    def add_gradients(self, jacobian, irow, istarts, nthreads=1):
+        """Write the gradients dR/dp of all the restraints of the group into the
+        restraints Jacobian, with the same layout as the blocks from gradients.
+        The cell gradients of all the crystals are calculated in a single call
+        to C++, on nthreads threads, and written straight to the sparse matrix.
+
+        irow is the first row of the group in the Jacobian and istarts is the
+        first column of the parameters of each crystal."""
+
+        B = flex.mat3_double()
+        dB_dp = flex.mat3_double()
+        nparam = flex.size_t()
+        for xlucp in self._xlucp:
+            ds_dp = flex.mat3_double(xlucp.get_ds_dp())
+            B.append(xlucp.get_state())
+            dB_dp.extend(ds_dp)
+            nparam.append(len(ds_dp))
+        gradfac, meangradfac = self._gradient_factors()
+        add_cell_tie_gradients(
+            jacobian,
+            B,
+            dB_dp,
+            nparam,
+            flex.size_t(istarts),
+            flex.bool(self._sel),
+            irow,
+            gradfac,
+            meangradfac,
+            nthreads,
+        )
+
     def weights(self):
         """Return the weights for the residuals vector"""
 
@@ -422,6 +459,9 @@ def _construct_grad_block(self, param_grads, i):
                 block[i, j] = g
         return block
 
+    def _gradient_factors(self):
+        return self._gradfac, 0.0
+
 
 class MedianUnitCellTie(MeanUnitCellTie):
     @staticmethod
@@ -441,3 +481,6 @@ def _construct_grad_block(self, param_grads, i):
             if abs(g) > 1e-20:  # skip gradient close to zero
                 block[i, j] = g
         return block
+
+    def _gradient_factors(self):
+        return 1.0, 0.0
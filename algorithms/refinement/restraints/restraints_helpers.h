@@ -15,11 +15,15 @@
 #define RAD2DEG(x) ((x)*57.29577951308232087721)
 #endif
 
+#include <cmath>
+#include <vector>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny.h>
 #include <scitbx/math/angle_derivative.h>
+#include <scitbx/sparse/matrix.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -146,6 +150,147 @@ namespace dials { namespace refinement {
     vec3<double> dbeta_da_, dbeta_dc_;
     vec3<double> dgamma_da_, dgamma_db_;
   };
+
+  namespace detail {
+
+    /**
+     * Calculate the gradients of the cell parameters of a range of crystals in
+     * a restrained group and write them to their columns of the Jacobian.
+     */
+    struct CellTieGradientsJob {
+      scitbx::sparse::matrix<double> *jacobian;
+      const af::const_ref<mat3<double> > *B;
+      const af::const_ref<mat3<double> > *dB_dp;
+      const af::const_ref<std::size_t> *nparam;
+      const af::const_ref<std::size_t> *icol;
+      const std::vector<std::size_t> *offset;
+      const af::const_ref<bool> *sel;
+      std::size_t irow;
+      double gradfac;
+      double meangradfac;
+
+      af::shared<double> cell_gradients(CalculateCellGradients &ccg,
+                                        std::size_t i) const {
+        switch (i) {
+        case 0:
+          return ccg.da_dp();
+        case 1:
+          return ccg.db_dp();
+        case 2:
+          return ccg.dc_dp();
+        case 3:
+          return ccg.daa_dp();
+        case 4:
+          return ccg.dbb_dp();
+        default:
+          return ccg.dcc_dp();
+        }
+      }
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t nxls = B->size();
+        for (std::size_t k = first; k < last; ++k) {
+          af::const_ref<mat3<double> > dB_dp_k(dB_dp->begin() + (*offset)[k],
+                                                (*nparam)[k]);
+          CalculateCellGradients ccg((*B)[k], dB_dp_k);
+          std::size_t row0 = irow;
+          for (std::size_t i = 0; i < 6; ++i) {
+            if (!(*sel)[i]) {
+              continue;
+            }
+            af::shared<double> grads = cell_gradients(ccg, i);
+            for (std::size_t j = 0; j < grads.size(); ++j) {
+              std::size_t col = (*icol)[k] + j;
+              double g = grads[j] * gradfac;
+              double mg = grads[j] * meangradfac;
+
+              // Through the average, every residual of the group depends on
+              // the parameters of this crystal. Skip gradients close to zero.
+              bool has_mean = std::abs(mg) > 1e-20;
+              if (has_mean) {
+                for (std::size_t r = 0; r < nxls; ++r) {
+                  if (r != k) {
+                    (*jacobian)(row0 + r, col) = -mg;
+                  }
+                }
+              }
+              if (std::abs(g) > 1e-20) {
+                (*jacobian)(row0 + k, col) = g;
+              } else if (has_mean) {
+                (*jacobian)(row0 + k, col) = -mg;
+              }
+            }
+            row0 += nxls;
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Write the gradients of the residuals of a group of unit cell restraints
+   * into the restraints Jacobian. For each restrained cell parameter there is
+   * a block of rows, one for each crystal, and the gradient of the residual
+   * of crystal k with respect to its own parameters is gradfac times the
+   * gradient of the cell parameter, while the gradient of the residuals of
+   * the other crystals is -meangradfac times the same (zero if the residuals
+   * are not taken from the mean of the group). The gradients are calculated
+   * for the crystals in parallel, each crystal writing only to the columns of
+   * its own parameters.
+   * @param jacobian The restraints Jacobian
+   * @param B The B matrix of each crystal
+   * @param dB_dp The derivatives of B of all the crystals, one after another
+   * @param nparam The number of parameters of each crystal
+   * @param icol The first column of the parameters of each crystal
+   * @param sel The six cell parameters that are restrained
+   * @param irow The first row of the group
+   * @param gradfac The factor for the residual of the crystal itself
+   * @param meangradfac The factor for the residuals of the other crystals
+   * @param nthreads The number of threads
+   */
+  inline void add_cell_tie_gradients(scitbx::sparse::matrix<double> &jacobian,
+                                     const af::const_ref<mat3<double> > &B,
+                                     const af::const_ref<mat3<double> > &dB_dp,
+                                     const af::const_ref<std::size_t> &nparam,
+                                     const af::const_ref<std::size_t> &icol,
+                                     const af::const_ref<bool> &sel,
+                                     std::size_t irow,
+                                     double gradfac,
+                                     double meangradfac,
+                                     std::size_t nthreads) {
+    DIALS_ASSERT(nparam.size() == B.size());
+    DIALS_ASSERT(icol.size() == B.size());
+    DIALS_ASSERT(sel.size() == 6);
+    DIALS_ASSERT(nthreads > 0);
+
+    // The rows of the group must fit in the Jacobian
+    std::size_t nsel = 0;
+    for (std::size_t i = 0; i < sel.size(); ++i) {
+      nsel += sel[i] ? 1 : 0;
+    }
+    DIALS_ASSERT(irow + nsel * B.size() <= jacobian.n_rows());
+
+    // The crystals are written in parallel, so their columns must not overlap
+    std::vector<std::size_t> offset(B.size());
+    std::vector<bool> used(jacobian.n_cols(), false);
+    std::size_t total = 0;
+    for (std::size_t k = 0; k < B.size(); ++k) {
+      offset[k] = total;
+      total += nparam[k];
+      DIALS_ASSERT(icol[k] + nparam[k] <= jacobian.n_cols());
+      for (std::size_t j = icol[k]; j < icol[k] + nparam[k]; ++j) {
+        DIALS_ASSERT(!used[j]);
+        used[j] = true;
+      }
+    }
+    DIALS_ASSERT(total == dB_dp.size());
+
+    detail::CellTieGradientsJob job = {
+      &jacobian, &B, &dB_dp, &nparam, &icol, &offset, &sel, irow, gradfac, meangradfac};
+    dials::util::parallel_for(B.size(), nthreads, job);
+  }
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_RESTRAINTS_HELPERS_H
@@ -83,6 +83,7 @@ def __init__(
         xl_orientation_parameterisations=None,
         xl_unit_cell_parameterisations=None,
         goniometer_parameterisations=None,
+        nthreads=1,
     ):
 
         if detector_parameterisations is None:
@@ -103,6 +104,9 @@ def __init__(
         self._xl_unit_cell_parameterisations = xl_unit_cell_parameterisations
         self._goniometer_parameterisations = goniometer_parameterisations
 
+        # number of threads used to calculate the gradients of group restraints
+        self._nthreads = nthreads
+
         # Loop over all parameterisations, extract experiment IDs and record
         # global parameter index for each that tells us which parameters have
         # non-zero derivatives
@@ -241,14 +245,12 @@ def get_residuals_gradients_and_weights(self):
             grads = flex.double(r.restraint.gradients())
             gradients.assign_block(grads, irow, icol)
 
-        # assign gradients in blocks for the group model restraints
+        # write the gradients of each group of restraints for all its unit cell
+        # models in one go
         for r in self._group_model_restraints:
-            # loop over the included unit cell models, k
-            for k, (icol, grads) in enumerate(zip(r.istart, r.restraint.gradients())):
-                irow = group_model_irow
-                for grad in grads:
-                    gradients.assign_block(grad, irow, icol)
-                    irow += grad.n_rows
-            group_model_irow = irow
+            r.restraint.add_gradients(
+                gradients, group_model_irow, r.istart, nthreads=self._nthreads
+            )
+            group_model_irow += r.restraint.num_residuals
 
         return residuals, gradients, weights
@@ -18,6 +18,7 @@
 #include <cmath>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -25,6 +26,45 @@ namespace dials { namespace refinement {
   using scitbx::mat3;
   using scitbx::vec3;
 
+  namespace detail {
+
+    /**
+     * Calculate a rotation matrix from a unit axis and the cosine and sine of
+     * the angle of rotation
+     */
+    inline mat3<double> rotation_matrix(const vec3<double> &u, double ca, double sa) {
+      double oca = 1.0 - ca;
+      return mat3<double>(ca + oca * u[0] * u[0],
+                          oca * u[0] * u[1] - sa * u[2],
+                          oca * u[0] * u[2] + sa * u[1],
+                          oca * u[1] * u[0] + sa * u[2],
+                          ca + oca * u[1] * u[1],
+                          oca * u[1] * u[2] - sa * u[0],
+                          oca * u[2] * u[0] - sa * u[1],
+                          oca * u[2] * u[1] + sa * u[0],
+                          ca + oca * u[2] * u[2]);
+    }
+
+    /**
+     * Calculate the first derivative of a rotation matrix with respect to the
+     * angle of rotation from a unit axis and the cosine and sine of the angle
+     */
+    inline mat3<double> rotation_derivative(const vec3<double> &u,
+                                            double ca,
+                                            double sa) {
+      return mat3<double>(sa * u[0] * u[0] - sa,
+                          sa * u[0] * u[1] - ca * u[2],
+                          sa * u[0] * u[2] + ca * u[1],
+                          sa * u[1] * u[0] + ca * u[2],
+                          sa * u[1] * u[1] - sa,
+                          sa * u[1] * u[2] - ca * u[0],
+                          sa * u[2] * u[0] - ca * u[1],
+                          sa * u[2] * u[1] + ca * u[0],
+                          sa * u[2] * u[2] - sa);
+    }
+
+  }  // namespace detail
+
   /**
    * Calculate the first derivative of a rotation matrix R with respect to the
    * angle of rotation, given the axis and angle.
@@ -33,22 +73,76 @@ namespace dials { namespace refinement {
    * Here the rotation is taken to be in a right-handed sense around the axis
    * whereas RTMATS uses a left-handed rotation.
    */
-  mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
-                                      double angle,
-                                      bool deg = false) {
+  inline mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
+                                             double angle,
+                                             bool deg = false) {
     if (deg) angle = DEG2RAD(angle);
-    vec3<double> axis_ = axis.normalize();
-    double ca = cos(angle);
-    double sa = sin(angle);
-    return mat3<double>(sa * axis_[0] * axis_[0] - sa,
-                        sa * axis_[0] * axis_[1] - ca * axis_[2],
-                        sa * axis_[0] * axis_[2] + ca * axis_[1],
-                        sa * axis_[1] * axis_[0] + ca * axis_[2],
-                        sa * axis_[1] * axis_[1] - sa,
-                        sa * axis_[1] * axis_[2] - ca * axis_[0],
-                        sa * axis_[2] * axis_[0] - ca * axis_[1],
-                        sa * axis_[2] * axis_[1] + ca * axis_[0],
-                        sa * axis_[2] * axis_[2] - sa);
+    return detail::rotation_derivative(axis.normalize(), cos(angle), sin(angle));
+  }
+
+  /**
+   * Calculate the rotation matrices and their first derivatives with respect
+   * to the angle of rotation for arrays of axes and angles. The sine and cosine
+   * of each angle are only evaluated once for both matrices.
+   */
+  class RotationMatricesAndDerivatives {
+  public:
+    /**
+     * @param axes The axes of rotation (need not be unit vectors)
+     * @param angles The angles of rotation, in radians
+     */
+    RotationMatricesAndDerivatives(const af::const_ref<vec3<double> > &axes,
+                                   const af::const_ref<double> &angles)
+        : R_(angles.size(), af::init_functor_null<mat3<double> >()),
+          dR_(angles.size(), af::init_functor_null<mat3<double> >()) {
+      DIALS_ASSERT(axes.size() == angles.size());
+      for (std::size_t i = 0; i < angles.size(); ++i) {
+        vec3<double> u = axes[i].normalize();
+        double ca = std::cos(angles[i]);
+        double sa = std::sin(angles[i]);
+        R_[i] = detail::rotation_matrix(u, ca, sa);
+        dR_[i] = detail::rotation_derivative(u, ca, sa);
+      }
+    }
+
+    /**
+     * @returns The rotation matrices
+     */
+    af::shared<mat3<double> > R() const {
+      return R_;
+    }
+
+    /**
+     * @returns The derivatives of the rotation matrices wrt the angles
+     */
+    af::shared<mat3<double> > dR_dangle() const {
+      return dR_;
+    }
+
+  private:
+    af::shared<mat3<double> > R_;
+    af::shared<mat3<double> > dR_;
+  };
+
+  /**
+   * Calculate the rotation matrices for arrays of axes and angles, so that
+   * several arrays of vectors can be rotated without evaluating the sine and
+   * cosine of the angles again
+   * @param axes The axes of rotation (need not be unit vectors)
+   * @param angles The angles of rotation, in radians
+   * @returns The rotation matrices
+   */
+  inline af::shared<mat3<double> > rotation_matrices(
+    const af::const_ref<vec3<double> > &axes,
+    const af::const_ref<double> &angles) {
+    DIALS_ASSERT(axes.size() == angles.size());
+    af::shared<mat3<double> > result(angles.size(),
+                                     af::init_functor_null<mat3<double> >());
+    for (std::size_t i = 0; i < angles.size(); ++i) {
+      result[i] = detail::rotation_matrix(
+        axes[i].normalize(), std::cos(angles[i]), std::sin(angles[i]));
+    }
+    return result;
   }
 
 }}  // namespace dials::refinement
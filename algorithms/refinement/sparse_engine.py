@@ -12,29 +12,20 @@
 import libtbx
 from scitbx.array_family import flex
 
-from dials.algorithms.refinement import DialsRefineConfigError
 from dials.algorithms.refinement.engine import AdaptLstbx as AdaptLstbxBase
 from dials.algorithms.refinement.engine import DisableMPmixin
 from dials.algorithms.refinement.engine import (
     GaussNewtonIterations as GaussNewtonIterationsBase,
 )
-from dials.algorithms.refinement.engine import LevenbergMarquardtIterations
-
-try:
-    from scitbx.examples.bevington import non_linear_ls_eigen_wrapper
-except ImportError:
-    raise DialsRefineConfigError(
-        """Eigen package is not available.  Please untar the Eigen source package
-     (http://eigen.tuxfamily.org) and place a link to it (eigen--> Eigen source dir) in
-     the modules directory of your developer install; then recompile.
-"""
-    )
+from dials.algorithms.refinement.engine import LevenbergMarquardtIterations, Refinery
+from dials_refinement_helpers_ext import SparseNormalEquations
 
 logger = logging.getLogger(__name__)
 
 
-class AdaptLstbxSparse(DisableMPmixin, AdaptLstbxBase, non_linear_ls_eigen_wrapper):
-    """Adapt the base class for Eigen"""
+class AdaptLstbxSparse(DisableMPmixin, AdaptLstbxBase):
+    """Adapt the base class to accumulate a sparse normal matrix and solve the
+    normal equations with a sparse LDL^T factorisation"""
 
     def __init__(
         self,
@@ -46,17 +37,82 @@ def __init__(
         max_iterations=None,
     ):
 
-        AdaptLstbxBase.__init__(
+        # The dense normal matrix of the lstbx base class would need memory
+        # proportional to the square of the number of parameters, so only the
+        # Refinery is initialised and the normal equations are kept here
+        Refinery.__init__(
             self,
             target,
             prediction_parameterisation,
-            constraints_manager=constraints_manager,
+            constraints_manager,
             log=log,
             tracking=tracking,
             max_iterations=max_iterations,
         )
+        self.x_0 = self.x.deep_copy()
+        self.cf = None
+
+        # The pattern of the normal matrix, and so the ordering and elimination
+        # tree of its factorisation, is kept between the iterations
+        self._normal_equations = SparseNormalEquations(n_parameters=len(self.x))
+
+    def reset(self):
+        self._normal_equations.reset()
+
+    def add_residuals(self, residuals, weights):
+        self._normal_equations.add_residuals(residuals, weights)
+
+    def add_equations(self, residuals, jacobian, weights):
+        """Add the residuals to the objective and their equations to the sparse
+        normal matrix"""
+        self._normal_equations.add_equations(
+            residuals,
+            jacobian,
+            weights,
+            negate_right_hand_side=True,
+            nthreads=self._nproc,
+        )
+
+    def step_equations(self):
+        return self._normal_equations
+
+    def objective(self):
+        return self._normal_equations.objective()
+
+    def opposite_of_gradient(self):
+        return self._normal_equations.right_hand_side()
+
+    @property
+    def dof(self):
+        return self._normal_equations.dof()
+
+    def chi_sq(self):
+        return self._normal_equations.chi_sq()
 
-        non_linear_ls_eigen_wrapper.__init__(self, n_parameters=len(self.x))
+    def solve(self):
+        self._normal_equations.solve()
+
+    def step(self):
+        return self._normal_equations.solution()
+
+    def get_normal_matrix_diagonal(self):
+        return self._normal_equations.normal_matrix_diagonal()
+
+    def add_constant_to_diagonal(self, mu):
+        self._normal_equations.add_constant_to_diagonal(mu)
+
+    def get_solver_summary(self):
+        """Describe the size of the normal matrix and its factor"""
+        return (
+            "Normal matrix of {} parameters with {} stored elements. The "
+            "factorisation has {} off-diagonal elements and its pattern "
+            "was analysed {} times".format(
+                self._normal_equations.n_parameters(),
+                self._normal_equations.non_zeros(),
+                self._normal_equations.factor_non_zeros(),
+                self._normal_equations.num_analyses(),
+            )
+        )
 
 
 class GaussNewtonIterations(AdaptLstbxSparse, GaussNewtonIterationsBase):
@@ -97,21 +153,17 @@ class SparseLevenbergMarquardtIterations(
 
     def set_cholesky_factor(self):
         """Override that disables this method of the base AdaptLstbx. For
-        sparse, large matrices this is numberically unstable; not to mention it
-        is not implemented for the Eigen wrapper"""
+        sparse, large matrices the inverse of the normal matrix needed for the
+        ESDs would be dense"""
         pass
 
     def setup_mu(self):
-        """Override that works with the Eigen wrapper"""
+        """Override that works with the sparse normal matrix"""
         a_diag = self.get_normal_matrix_diagonal()
         self.mu = self.tau * flex.max(a_diag)
 
-    def add_constant_to_diagonal(self, mu):
-        """Delegate to the method of non_linear_ls_eigen_wrapper"""
-        non_linear_ls_eigen_wrapper.add_constant_to_diagonal(self, self.mu)
-
     def report_progress(self, objective):
-        """Override for the Eigen wrapper to provide live feedback of progress
+        """Override for the sparse engine to provide live feedback of progress
         of the refinement"""
 
         logger.debug(
@@ -129,5 +181,5 @@ def run(self):
         # no attempt here to calculate esd's based on the variance covariance
         # matrix.
 
-        logger.info(self.get_eigen_summary())
+        logger.info(self.get_solver_summary())
         return
@@ -8,6 +8,12 @@
 from scitbx import sparse
 from scitbx.array_family import flex
 
+from dials_refinement_helpers_ext import (
+    LeastSquaresGradientAccumulator,
+    build_dense_jacobian,
+    build_sparse_jacobian,
+)
+
 phil_str = """
     rmsd_cutoff = *fraction_of_bin_size absolute
       .help = "Method to choose rmsd cutoffs. This is currently either as a"
@@ -313,11 +319,10 @@ def compute_functional_gradients_and_curvatures(self, block=None):
             return 1.0e12, [1.0] * len(self._prediction_parameterisation)
 
         residuals, weights = self._extract_residuals_and_weights(matches)
-        w_resid = weights * residuals
-        residuals2 = self._extract_squared_residuals(matches)
+        accumulator = LeastSquaresGradientAccumulator(residuals, weights, self.dim)
 
         # calculate target function
-        L = 0.5 * flex.sum(weights * residuals2)
+        L = accumulator.functional(self._extract_squared_residuals(matches))
 
         def process_one_gradient(result):
             # copy gradients out of the result in the right order
@@ -327,10 +332,11 @@ def process_one_gradient(result):
             for k in result:
                 result[k] = None
 
-            # add new keys
-            grads = self._concatenate_gradients(grads)
-            result["dL_dp"] = flex.sum(w_resid * grads)
-            result["curvature"] = flex.sum(weights * grads * grads)
+            # add new keys, summing over the gradients of each type of residual
+            # in C++ without concatenating them
+            result["dL_dp"], result["curvature"] = self._gradient_and_curvature(
+                accumulator, grads
+            )
             return result
 
         results = self.calculate_gradients(matches, callback=process_one_gradient)
@@ -461,15 +467,16 @@ def _build_jacobian(grads_each_dim, nelem=None, nparam=None):
         of gradients of the associated residual for each parameter. This method
         may be overridden for the case where these vectors use sparse storage"""
 
-        jacobian = flex.double(flex.grid(nelem, nparam))
-        # loop over parameters
-        for i in range(nparam):
-            col = grads_each_dim[0][i]
-            for g in grads_each_dim[1:]:
-                col.extend(g[i])
-            jacobian.matrix_paste_column_in_place(col, i)
+        return build_dense_jacobian(grads_each_dim, nelem, nparam)
 
-        return jacobian
+    @staticmethod
+    def _gradient_and_curvature(accumulator, grads):
+        """return the gradient and approximate curvature of the functional with
+        respect to one parameter from the gradient vectors of each type of
+        residual. This method may be overridden for the case where these vectors
+        use sparse storage"""
+
+        return accumulator.dense_gradient_and_curvature(grads)
 
     @staticmethod
     def _concatenate_gradients(grads):
@@ -653,21 +660,14 @@ class SparseGradientsMixin:
     def _build_jacobian(grads_each_dim, nelem=None, nparam=None):
         """construct Jacobian from lists of sparse gradient vectors."""
 
-        nref = int(nelem / len(grads_each_dim))
-
-        blocks = [sparse.matrix(nref, nparam) for _ in grads_each_dim]
-        jacobian = sparse.matrix(nelem, nparam)
+        return build_sparse_jacobian(grads_each_dim, nelem, nparam)
 
-        # loop over parameters, building full width blocks of the full Jacobian
-        for i in range(nparam):
-            for block, grad in zip(blocks, grads_each_dim):
-                block[:, i] = grad[i]
-
-        # set the blocks in the Jacobian
-        for i, block in enumerate(blocks):
-            jacobian.assign_block(block, (i * nref), 0)
+    @staticmethod
+    def _gradient_and_curvature(accumulator, grads):
+        """return the gradient and approximate curvature of the functional from
+        sparse gradient vectors."""
 
-        return jacobian
+        return accumulator.sparse_gradient_and_curvature(grads)
 
     @staticmethod
     def _concatenate_gradients(grads):
@@ -2,7 +2,10 @@
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/flex_types.h>
 #include <cctype>
+#include <vector>
 #include <dxtbx/model/panel.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
 #include <iostream>
 
 namespace recviewer { namespace ext {
@@ -65,11 +68,183 @@ namespace recviewer { namespace ext {
     }
   }
 
+  /**
+   * Map the images of a rotation sweep into a grid of voxels in reciprocal
+   * space, in the same way as fill_voxels. The scattering vectors of the
+   * target pixels are given once and rotated for each image.
+   *
+   * The images are mapped on a pool of threads, with up to one image per
+   * thread at a time. Each thread adds to a grid of its own, so one grid and
+   * one array of counts is kept per thread until the grids are merged at the
+   * end.
+   */
+  class ReciprocalSpaceMapper {
+  public:
+    /**
+     * @param S The scattering vectors of the target pixels before rotation
+     * @param xy The target pixels
+     * @param axis The rotation axis
+     * @param grid_size The number of voxels along each side of the grid
+     * @param rec_range The reciprocal space limit of the grid
+     * @param nthreads The number of threads
+     */
+    ReciprocalSpaceMapper(const af::const_ref<vec3<double> > &S,
+                          const af::const_ref<vec2<double> > &xy,
+                          vec3<double> axis,
+                          std::size_t grid_size,
+                          double rec_range,
+                          std::size_t nthreads)
+        : S_(S.begin(), S.end()),
+          xy_(xy.begin(), xy.end()),
+          axis_(axis.normalize()),
+          grid_size_(grid_size),
+          rec_range_(rec_range),
+          nthreads_(nthreads),
+          num_images_(0),
+          grids_(nthreads),
+          counts_(nthreads) {
+      DIALS_ASSERT(S.size() == xy.size());
+      DIALS_ASSERT(grid_size > 0);
+      DIALS_ASSERT(rec_range > 0);
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    /**
+     * Map a set of images into the grid
+     * @param images The images
+     * @param angles The angle in radians to rotate the scattering vectors by
+     *        for each image
+     */
+    void add_images(boost::python::list images, const af::const_ref<double> &angles) {
+      std::size_t n = boost::python::len(images);
+      DIALS_ASSERT(angles.size() == n);
+      std::vector<af::flex_int> data;
+      for (std::size_t i = 0; i < n; ++i) {
+        data.push_back(boost::python::extract<af::flex_int>(images[i])());
+        DIALS_ASSERT(data.back().accessor().nd() == 2);
+      }
+      std::size_t nslots = std::min(nthreads_, n);
+      for (std::size_t slot = 0; slot < nslots; ++slot) {
+        if (grids_[slot].empty()) {
+          std::size_t size = grid_size_ * grid_size_ * grid_size_;
+          grids_[slot].assign(size, 0.0);
+          counts_[slot].assign(size, 0);
+        }
+      }
+      dials::util::parallel_for(
+        nslots, nthreads_, MapJob(this, &data, angles.begin(), nslots));
+      num_images_ += n;
+    }
+
+    /** @returns The number of images mapped */
+    std::size_t num_images() const {
+      return num_images_;
+    }
+
+    /**
+     * Add the sums and counts of the voxels to a grid
+     * @param grid The grid to add the sums to
+     * @param counts The grid to add the counts to
+     */
+    void merge(af::flex_double &grid, af::flex_int &counts) const {
+      std::size_t size = grid_size_ * grid_size_ * grid_size_;
+      DIALS_ASSERT(grid.size() == size);
+      DIALS_ASSERT(counts.size() == size);
+      for (std::size_t slot = 0; slot < grids_.size(); ++slot) {
+        if (grids_[slot].empty()) {
+          continue;
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+          grid[i] += grids_[slot][i];
+          counts[i] += counts_[slot][i];
+        }
+      }
+    }
+
+  private:
+    /**
+     * Map the images given to a slot into its grid
+     */
+    struct MapJob {
+      ReciprocalSpaceMapper *self;
+      const std::vector<af::flex_int> *data;
+      const double *angles;
+      std::size_t nslots;
+
+      MapJob(ReciprocalSpaceMapper *self_,
+             const std::vector<af::flex_int> *data_,
+             const double *angles_,
+             std::size_t nslots_)
+          : self(self_), data(data_), angles(angles_), nslots(nslots_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t slot = first; slot < last; ++slot) {
+          for (std::size_t i = slot; i < data->size(); i += nslots) {
+            self->map_image((*data)[i], angles[i], slot);
+          }
+        }
+      }
+    };
+
+    void map_image(const af::flex_int &image, double angle, std::size_t slot) {
+      int npoints = grid_size_;
+      double step = 2 * rec_range_ / npoints;
+      std::size_t width = image.accessor().all()[1];
+      const int *pixels = image.begin();
+      double *grid = &grids_[slot][0];
+      int *counts = &counts_[slot][0];
+
+      for (std::size_t i = 0; i < S_.size(); i++) {
+        vec3<double> rotated_S = S_[i].rotate_around_origin(axis_, angle);
+        int ind_x = rotated_S[0] / step + npoints / 2 + 0.5;
+        int ind_y = rotated_S[1] / step + npoints / 2 + 0.5;
+        int ind_z = rotated_S[2] / step + npoints / 2 + 0.5;
+        std::size_t x = xy_[i][0];
+        std::size_t y = xy_[i][1];
+
+        if (ind_x >= npoints || ind_y >= npoints || ind_z >= npoints || ind_x < 0
+            || ind_y < 0 || ind_z < 0)
+          continue;
+        std::size_t index = ((std::size_t)ind_x * npoints + ind_y) * npoints + ind_z;
+        grid[index] += pixels[y * width + x];
+        counts[index]++;
+      }
+    }
+
+    std::vector<vec3<double> > S_;
+    std::vector<vec2<double> > xy_;
+    vec3<double> axis_;
+    std::size_t grid_size_;
+    double rec_range_;
+    std::size_t nthreads_;
+    std::size_t num_images_;
+    std::vector<std::vector<double> > grids_;
+    std::vector<std::vector<int> > counts_;
+  };
+
   void init_module() {
     using namespace boost::python;
     def("get_target_pixels", get_target_pixels);
     def("fill_voxels", fill_voxels);
     def("normalize_voxels", normalize_voxels);
+
+    class_<ReciprocalSpaceMapper>("ReciprocalSpaceMapper", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec2<double> > &,
+                vec3<double>,
+                std::size_t,
+                double,
+                std::size_t>((arg("S"),
+                              arg("xy"),
+                              arg("axis"),
+                              arg("grid_size"),
+                              arg("rec_range"),
+                              arg("nthreads") = 1)))
+      .def("add_images",
+           &ReciprocalSpaceMapper::add_images,
+           (arg("images"), arg("angles")))
+      .def("num_images", &ReciprocalSpaceMapper::num_images)
+      .def("merge", &ReciprocalSpaceMapper::merge, (arg("grid"), arg("counts")));
   }
 
 }}  // namespace recviewer::ext
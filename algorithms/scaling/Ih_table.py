@@ -16,8 +16,10 @@
 from dxtbx import flumpy
 from scitbx import sparse
 
+from dials.algorithms.scaling import data_cache
 from dials.algorithms.scaling.error_model.error_model import BasicErrorModel
 from dials.array_family import flex
+from dials_scaling_ext import IhTableGroups
 
 
 def map_indices_to_asu(miller_indices, space_group, anomalous=False):
@@ -32,6 +34,23 @@ def map_indices_to_asu(miller_indices, space_group, anomalous=False):
     return miller_set_in_asu.indices()
 
 
+def cached_map_indices_to_asu(miller_indices, space_group, anomalous=False):
+    """Map the indices to the asymmetric unit, using the scaling data cache."""
+    if data_cache.active_cache() is None:
+        return map_indices_to_asu(miller_indices, space_group, anomalous)
+    asu_indices = data_cache.cached(
+        "asu_miller_index",
+        [flumpy.to_numpy(miller_indices)],
+        {"space_group": space_group.type().hall_symbol(), "anomalous": anomalous},
+        lambda: {
+            "asu_miller_index": flumpy.to_numpy(
+                map_indices_to_asu(miller_indices, space_group, anomalous)
+            )
+        },
+    )["asu_miller_index"]
+    return flumpy.miller_index_from_numpy(np.ascontiguousarray(asu_indices))
+
+
 def get_sorted_asu_indices(asu_indices, space_group, anomalous=False):
     """Return the sorted asu indices and the permutation selection."""
     crystal_symmetry = crystal.symmetry(space_group=space_group)
@@ -83,12 +102,14 @@ def __init__(
         free_set_offset: int = 0,
         additional_cols: Optional[List[str]] = None,
         anomalous: bool = False,
+        nthreads: int = 1,
     ):
         """
         Distribute the input data into the required structure.
 
         The reflection data can be split into blocks, while the relevant
-        metadata is also generated.
+        metadata is also generated. The sums over the groups of equivalent
+        reflections in each block are shared between nthreads threads.
 
         A list of flex.size_t indices can be provided - this allows the
         reflection table data to maintain a reference to a dataset from which
@@ -102,6 +123,7 @@ def __init__(
         if indices_lists:
             assert len(indices_lists) == len(reflection_tables)
         self.anomalous = anomalous
+        self.nthreads = nthreads
         self._asu_index_dict = {}
         self._free_asu_index_dict = {}
         self.space_group = space_group
@@ -223,7 +245,7 @@ def _determine_required_block_structures(
         joint_asu_indices = flex.miller_index()
         for table in reflection_tables:
             if "asu_miller_index" not in table:
-                table["asu_miller_index"] = map_indices_to_asu(
+                table["asu_miller_index"] = cached_map_indices_to_asu(
                     table["miller_index"], self.space_group, self.anomalous
                 )
             joint_asu_indices.extend(table["asu_miller_index"])
@@ -321,6 +343,7 @@ def _create_empty_Ih_table_blocks(self) -> None:
                     n_groups=n_groups_in_block,
                     n_refl=n_refl_in_block,
                     n_datasets=self.n_datasets,
+                    nthreads=self.nthreads,
                 )
             )
 
@@ -436,7 +459,10 @@ def extract_free_set(self) -> None:
             tables.append(free_reflection_table[dataset_sel])
             indices_lists.append(free_indices[dataset_sel])
         free_block = IhTableBlock(
-            n_groups=len(set(free_hkl)), n_refl=n_refl, n_datasets=len(datasets)
+            n_groups=len(set(free_hkl)),
+            n_refl=n_refl,
+            n_datasets=len(datasets),
+            nthreads=self.nthreads,
         )
         group_ids = np.array(
             [self._free_asu_index_dict[tuple(index)] for index in free_hkl],
@@ -493,11 +519,15 @@ class IhTableBlock:
             entry with a value of 1.
         h_expand_matrix: The transpose of the h_index_matrix, used to expand an
             array of values for symmetry groups into an array of size n_refl.
+        groups: The group of each reflection, stored sorted by group, for
+            calculating sums over the groups of arrays of values in C++.
         derivatives: A matrix of derivatives of the reflections wrt the model
             parameters.
     """
 
-    def __init__(self, n_groups: int, n_refl: int, n_datasets: int = 1):
+    def __init__(
+        self, n_groups: int, n_refl: int, n_datasets: int = 1, nthreads: int = 1
+    ):
         """Create empty datastructures to which data can later be added."""
         self.Ih_table = pd.DataFrame()
         self.block_selections = [None] * n_datasets
@@ -513,6 +543,8 @@ def __init__(self, n_groups: int, n_refl: int, n_datasets: int = 1):
         self._csc_h_index_matrix = None
         self._csc_h_expand_matrix = None
         self._hkl = flex.miller_index([])
+        self.nthreads = nthreads
+        self.groups = None
 
     def add_data(
         self,
@@ -581,6 +613,11 @@ def _complete_setup(self) -> None:
         data = np.full(self._csc_cols.size, 1.0)
         self._csc_h_index_matrix = csc_matrix((data, (self._csc_rows, self._csc_cols)))
         self._csc_h_expand_matrix = self._csc_h_index_matrix.transpose()
+        self.groups = IhTableGroups(
+            flumpy.from_numpy(self._csc_cols.astype(np.uint64)),
+            self._csc_h_index_matrix.shape[1],
+            self.nthreads,
+        )
         self.weights = 1.0 / self.variances
         self._setup_info["setup_complete"] = True
 
@@ -603,7 +640,18 @@ def select(self, sel: np.array) -> "IhTableBlock":
         csc_h_idx_sel = self._csc_h_expand_matrix[:, sel]
         csc_h_index_matrix = csc_h_idx_sel.transpose()[:, flumpy.to_numpy(nz_col_sel)]
         csc_h_expand_matrix = csc_h_index_matrix.transpose()
-        newtable = IhTableBlock(n_groups=0, n_refl=0, n_datasets=self.n_datasets)
+        # renumber the groups that remain after the selection
+        nz_cols = flumpy.to_numpy(nz_col_sel)
+        new_group_id = np.cumsum(nz_cols, dtype=np.uint64) - 1
+        group_ids = flumpy.to_numpy(self.groups.group_ids())[sel]
+        newtable = IhTableBlock(
+            n_groups=0, n_refl=0, n_datasets=self.n_datasets, nthreads=self.nthreads
+        )
+        newtable.groups = IhTableGroups(
+            flumpy.from_numpy(np.ascontiguousarray(new_group_id[group_ids])),
+            int(np.count_nonzero(nz_cols)),
+            self.nthreads,
+        )
         newtable.Ih_table = Ih_table
         newtable._hkl = self._hkl.select(flumpy.from_numpy(sel))
         newtable.h_expand_matrix = h_expand
@@ -632,11 +680,12 @@ def select_on_groups(self, sel: np.array) -> "IhTableBlock":
 
     def calc_Ih(self) -> None:
         """Calculate the current best estimate for Ih for each reflection group."""
-        scale_factors = self.inverse_scale_factors
-        sumgsq = self.sum_in_groups(np.square(scale_factors) * self.weights)
-        sumgI = self.sum_in_groups(scale_factors * self.intensities * self.weights)
-        Ih = sumgI / sumgsq
-        self.Ih_table.loc[:, "Ih_values"] = Ih @ self._csc_h_expand_matrix
+        Ih = self.groups.calc_Ih(
+            _as_flex_double(self.inverse_scale_factors),
+            _as_flex_double(self.intensities),
+            _as_flex_double(self.weights),
+        )
+        self.Ih_table.loc[:, "Ih_values"] = flumpy.to_numpy(Ih)
 
     def update_weights(
         self,
@@ -667,7 +716,7 @@ def calc_nh(self) -> np.array:
         """Calculate the number of refls in the group to which the reflection belongs.
 
         This is a vector of length n_refl."""
-        return self.sum_in_groups(np.full(self.size, 1.0), output="per_refl")
+        return flumpy.to_numpy(self.groups.calc_nh())
 
     def match_Ih_values_to_target(self, target_Ih_table: IhTable) -> None:
         """
@@ -709,6 +758,7 @@ def match_Ih_values_to_target(self, target_Ih_table: IhTable) -> None:
         self.block_selections = new_table.block_selections
         self._csc_h_expand_matrix = new_table._csc_h_expand_matrix
         self._csc_h_index_matrix = new_table._csc_h_index_matrix
+        self.groups = new_table.groups
 
     @property
     def inverse_scale_factors(self) -> np.array:
@@ -816,6 +866,12 @@ def sum_in_groups(
         Sums an array object over the symmetry equivalent groups.
         The array's final dimension must equal the size of the Ih_table.
         """
+        if isinstance(array, np.ndarray) and array.ndim == 1:
+            values = _as_flex_double(array)
+            if output == "per_group":
+                return flumpy.to_numpy(self.groups.sum_in_groups(values))
+            elif output == "per_refl":
+                return flumpy.to_numpy(self.groups.sum_in_groups_per_refl(values))
         if output == "per_group":
             return array @ self._csc_h_index_matrix
         elif output == "per_refl":  # return the summed quantity per reflection
@@ -835,6 +891,11 @@ def as_reflection_table(self) -> flex.reflection_table:
         return table
 
 
+def _as_flex_double(array: np.array) -> flex.double:
+    """Convert a numpy array to a flex.double, for the IhTableGroups methods."""
+    return flumpy.from_numpy(np.ascontiguousarray(array, dtype=np.float64))
+
+
 def _reflection_table_to_iobs(
     table: flex.reflection_table,
     unit_cell: uctbx.unit_cell,
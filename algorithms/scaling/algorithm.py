@@ -8,6 +8,7 @@
 import logging
 import time
 
+from dials.algorithms.scaling import data_cache
 from dials.algorithms.scaling.observers import (
     ScalingHTMLContextManager,
     ScalingSummaryContextManager,
@@ -184,6 +185,7 @@ def __init__(self, params, experiments, reflections):
         self.merging_statistics_result = None
         self.anom_merging_statistics_result = None
         self.filtering_results = None
+        data_cache.set_cache_directory(params.scaling_options.data_cache)
         self.params, self.experiments, self.reflections = prepare_input(
             params, experiments, reflections
         )
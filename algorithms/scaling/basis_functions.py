@@ -7,7 +7,7 @@
 from scitbx import sparse
 
 from dials.array_family import flex
-from dials_scaling_ext import row_multiply
+from dials_scaling_ext import ScaleComponentsEvaluator, row_multiply
 
 
 class RefinerCalculator:
@@ -62,9 +62,48 @@ def _calculate_derivatives(apm, block_id, scales, derivatives_list):
             col_idx += d.n_cols
         return derivatives
 
+    @staticmethod
+    def _scale_components_evaluator(apm, block_id):
+        """Return a native evaluator of all the components of a block, or None if
+        any component can't be evaluated natively. The evaluator is kept in the
+        apm until the scale forms of the components change."""
+        forms = [
+            component["object"].scale_form(block_id)
+            for component in apm.components.values()
+        ]
+        if not forms or any(form is None for form in forms):
+            return None
+        cached = apm.scale_evaluators.get(block_id)
+        if cached and all(a is b for a, b in zip(cached[0], forms)):
+            return cached[1]
+        evaluator = ScaleComponentsEvaluator(apm.n_obs[block_id])
+        for form in forms:
+            if form.exponential:
+                evaluator.add_exponential_component(
+                    form.matrix, form.values, form.n_fixed
+                )
+            else:
+                evaluator.add_linear_component(form.matrix, form.values, form.n_fixed)
+        apm.scale_evaluators[block_id] = (forms, evaluator)
+        return evaluator
+
     @classmethod
-    def calculate_scales_and_derivatives(cls, apm, block_id):
-        """Calculate scale factors and derivatives for minimisation."""
+    def calculate_scales_and_derivatives(cls, apm, block_id, native=False, nthreads=1):
+        """Calculate scale factors and derivatives for minimisation.
+
+        If native is True, and all the components support it, the scales and
+        derivatives of all the components are evaluated in one threaded pass."""
+        if native:
+            evaluator = cls._scale_components_evaluator(apm, block_id)
+            if evaluator is not None:
+                parameters = flex.double()
+                for component in apm.components.values():
+                    parameters.extend(component["object"].parameters)
+                if apm.constant_g_values:
+                    constant_g = apm.constant_g_values[block_id]
+                else:
+                    constant_g = flex.double()
+                return evaluator.evaluate(parameters, constant_g, nthreads)
         scales, derivatives = cls._calc_component_scales_derivatives(apm, block_id)
         return (
             cls._calculate_scale_factors(apm, block_id, scales),
@@ -13,12 +13,15 @@ namespace dials_scaling { namespace boost_python {
   void export_row_multiply();
   void export_determine_outlier_indices();
   void export_calc_dIh_by_dpi();
-  void export_calc_jacobian();
   void export_calculate_harmonic_tables_from_selections();
   void export_calc_lookup_index();
   void export_create_sph_harm_lookup_table();
   void export_gaussian_smoother_first_fixed();
   void export_limit_outlier_weights();
+  void export_sum_in_bins();
+  void export_ih_table_groups();
+  void export_scale_components_evaluator();
+  void export_quasi_random_selection();
 
   BOOST_PYTHON_MODULE(dials_scaling_ext) {
     export_elementwise_square();
@@ -29,12 +32,15 @@ namespace dials_scaling { namespace boost_python {
     export_row_multiply();
     export_determine_outlier_indices();
     export_calc_dIh_by_dpi();
-    export_calc_jacobian();
     export_calculate_harmonic_tables_from_selections();
     export_calc_lookup_index();
     export_create_sph_harm_lookup_table();
     export_gaussian_smoother_first_fixed();
     export_limit_outlier_weights();
+    export_sum_in_bins();
+    export_ih_table_groups();
+    export_scale_components_evaluator();
+    export_quasi_random_selection();
   }
 
 }}  // namespace dials_scaling::boost_python
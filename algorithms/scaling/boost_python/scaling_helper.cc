@@ -24,21 +24,12 @@ namespace dials_scaling { namespace boost_python {
         (arg("a"), arg("sumgsq"), arg("h_index_mat"), arg("derivatives")));
   }
 
-  void export_calc_jacobian() {
-    def("calc_jacobian",
-        &calc_jacobian,
-        (arg("derivatives"),
-         arg("h_index_mat"),
-         arg("Ih"),
-         arg("g"),
-         arg("dIh"),
-         arg("sumgsq")));
-  }
-
   void export_sph_harm_table() {
     def("create_sph_harm_table",
         &create_sph_harm_table,
         (arg("s0_theta_phi"), arg("s1_theta_phi"), arg("lmax")));
+    def("sph_harm_table_as_dense", &sph_harm_table_as_dense, (arg("table")));
+    def("sph_harm_table_from_dense", &sph_harm_table_from_dense, (arg("values")));
   }
 
   void export_rotate_vectors_about_axis() {
@@ -65,6 +56,27 @@ namespace dials_scaling { namespace boost_python {
         (arg("weights"), arg("h_index_mat")));
   }
 
+  void export_sum_in_bins() {
+    def("sum_in_bins",
+        &sum_in_bins,
+        (arg("values"), arg("bin_index"), arg("n_bins"), arg("nthreads") = 1));
+  }
+
+  void export_quasi_random_selection() {
+    def("quasi_random_selection",
+        &quasi_random_selection,
+        (arg("group_ids"),
+         arg("class_ids"),
+         arg("bin_ids"),
+         arg("n_groups"),
+         arg("n_classes"),
+         arg("n_bins"),
+         arg("min_per_class"),
+         arg("min_total"),
+         arg("max_total"),
+         arg("nthreads") = 1));
+  }
+
   void export_calc_lookup_index() {
     def("calc_lookup_index",
         &calc_lookup_index,
@@ -96,9 +108,56 @@ namespace dials_scaling { namespace boost_python {
       .def("value_weight", &GaussianSmootherFirstFixed::value_weight)
       .def("value_weight_first_fixed",
            &GaussianSmootherFirstFixed::value_weight_first_fixed)
+      .def("multi_weight", &GaussianSmootherFirstFixed::multi_weight)
+      .def("multi_weight_first_fixed",
+           &GaussianSmootherFirstFixed::multi_weight_first_fixed)
       .def("multi_value_weight", &GaussianSmootherFirstFixed::multi_value_weight)
       .def("multi_value_weight_first_fixed",
            &GaussianSmootherFirstFixed::multi_value_weight_first_fixed);
   }
 
+  void export_ih_table_groups() {
+    class_<IhTableGroups>("IhTableGroups", no_init)
+      .def(init<const scitbx::af::const_ref<std::size_t> &, std::size_t, std::size_t>(
+        (arg("group_ids"), arg("n_groups"), arg("nthreads") = 1)))
+      .def("size", &IhTableGroups::size)
+      .def("n_groups", &IhTableGroups::n_groups)
+      .def("group_ids", &IhTableGroups::group_ids)
+      .def("group_multiplicities", &IhTableGroups::group_multiplicities)
+      .def("calc_nh", &IhTableGroups::calc_nh)
+      .def("sum_in_groups", &IhTableGroups::sum_in_groups, (arg("values")))
+      .def("sum_in_groups_per_refl",
+           &IhTableGroups::sum_in_groups_per_refl,
+           (arg("values")))
+      .def("expand", &IhTableGroups::expand, (arg("values")))
+      .def("calc_Ih", &IhTableGroups::calc_Ih, (arg("g"), arg("I"), arg("w")))
+      .def("calc_jacobian",
+           &IhTableGroups::calc_jacobian,
+           (arg("derivatives"), arg("g"), arg("I"), arg("w"), arg("Ih")))
+      .def("limit_outlier_weights",
+           &IhTableGroups::limit_outlier_weights,
+           (arg("weights")))
+      .def("determine_outlier_indices",
+           &IhTableGroups::determine_outlier_indices,
+           (arg("I"), arg("g"), arg("w"), arg("zmax")));
+  }
+
+  void export_scale_components_evaluator() {
+    typedef ScaleComponentsEvaluator w_t;
+    class_<w_t>("ScaleComponentsEvaluator", no_init)
+      .def(init<std::size_t>((arg("n_obs"))))
+      .def("add_linear_component",
+           &w_t::add_linear_component,
+           (arg("D"), arg("offset"), arg("n_fixed") = 0))
+      .def("add_exponential_component",
+           &w_t::add_exponential_component,
+           (arg("D"), arg("factors"), arg("n_fixed") = 0))
+      .def("n_obs", &w_t::n_obs)
+      .def("n_components", &w_t::n_components)
+      .def("n_params", &w_t::n_params)
+      .def("evaluate",
+           &w_t::evaluate,
+           (arg("parameters"), arg("constant_g"), arg("nthreads") = 1));
+  }
+
 }}  // namespace dials_scaling::boost_python
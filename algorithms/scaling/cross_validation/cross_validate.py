@@ -13,6 +13,12 @@
 nfolds should be set to 100/free_set_percentage, which would be nfolds=10 for
 the default free_set_percentage=10.0.
 
+The folds and options are independent scaling runs on the same data, so with
+nproc > 1 up to nproc of them are run at once. The first run is done on its
+own, keeping the prepared data (e.g. the asymmetric unit miller indices and
+the spherical harmonic tables) in memory, and the others are then run in
+processes forked from it, which all read that one copy of the prepared data.
+
 Two different modes are currently supported, controlled by cross_validation_mode=;
 1) cross_validation_mode=single
    dials.scale is run nfolds times for the user specified dials.scale options
@@ -37,6 +43,7 @@
 """
 
 
+import copy
 import itertools
 import logging
 import time
@@ -77,6 +84,12 @@
               "allowed is 1/free_set_percentage; if set greater than this then"
               "the repetition will finish after 1/free_set_percentage folds."
       .expert_level = 2
+    nproc = 1
+      .type = int(value_min=1)
+      .help = "Number of the cross-validation folds and options to run at once,"
+              "each in its own process. This is separate from the nproc of each"
+              "scaling run."
+      .expert_level = 2
   }
 """
 )
@@ -88,6 +101,7 @@ def cross_validate(params, cross_validator):
     start_time = time.time()
     free_set_percentage = cross_validator.get_free_set_percentage(params)
     options_dict = {}
+    jobs = []  # the params and configuration number of each scaling run
 
     if params.cross_validation.cross_validation_mode == "single":
         # just run the setup nfolds times
@@ -95,7 +109,7 @@ def cross_validate(params, cross_validator):
         for n in range(params.cross_validation.nfolds):
             if n < 100.0 / free_set_percentage:
                 params = cross_validator.set_free_set_offset(params, n)
-                cross_validator.run_script(params, config_no=0)
+                jobs.append((copy.deepcopy(params), 0))
 
     elif params.cross_validation.cross_validation_mode == "multi":
         # run each option nfolds times
@@ -156,11 +170,13 @@ def cross_validate(params, cross_validator):
             for n in range(params.cross_validation.nfolds):
                 if n < 100.0 / free_set_percentage:
                     params = cross_validator.set_free_set_offset(params, n)
-                    cross_validator.run_script(params, config_no=i)
+                    jobs.append((copy.deepcopy(params), i))
 
     else:
         raise ValueError("Error in interpreting mode and options.")
 
+    cross_validator.run_configurations(jobs, nproc=params.cross_validation.nproc)
+
     st = cross_validator.interpret_results()
     logger.info("Summary of the cross validation analysis: \n %s", st.format())
 
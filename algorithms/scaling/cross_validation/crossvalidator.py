@@ -3,7 +3,10 @@
 cross validator for dials.scale
 """
 
+import concurrent.futures
 import itertools
+import logging
+import multiprocessing
 from copy import deepcopy
 
 import pkg_resources
@@ -12,6 +15,23 @@
 from libtbx.table_utils import simple_table
 from scitbx.array_family import flex
 
+from dials.algorithms.scaling import data_cache
+
+logger = logging.getLogger("dials")
+
+# The cross validator and jobs of a parallel run, inherited by the forked
+# processes rather than pickled
+_forked_jobs = None
+
+
+def _run_forked_job(index):
+    """Run one of the jobs of a parallel run in a forked process."""
+    cross_validator, jobs = _forked_jobs
+    # The logs of the concurrent jobs would be interleaved
+    logging.getLogger("dials").setLevel(logging.WARNING)
+    params, _ = jobs[index]
+    return cross_validator.run_scaling(params)
+
 
 class CrossValidator:
     """Abstract class defining common methods for cross validation and methods
@@ -37,6 +57,13 @@ def run_script(self, params, config_no):
         configuration number being run."""
         raise NotImplementedError()
 
+    def run_configurations(self, jobs, nproc=1):
+        """Run the script for each of a list of (params, config_no) jobs, adding
+        the results to the results dict in the order of the jobs. Here the jobs
+        are run one after another."""
+        for params, config_no in jobs:
+            self.run_script(params, config_no)
+
     def get_results_from_script(self, script):
         """Return the work/free results list from the command line script object"""
         raise NotImplementedError()
@@ -209,9 +236,9 @@ def get_free_set_percentage(self, params):
         """Inspect the free set percentage in the correct place in the scope"""
         return params.scaling_options.free_set_percentage
 
-    def run_script(self, params, config_no):
-        """Run the scaling script with the params, get the free/work set results
-        and add to the results dict"""
+    def run_scaling(self, params):
+        """Run the scaling script with the params and return the free/work set
+        results"""
         from dials.algorithms.scaling.algorithm import ScalingAlgorithm
 
         params.scaling_options.__setattr__("use_free_set", True)
@@ -221,5 +248,46 @@ def run_script(self, params, config_no):
             reflections=deepcopy(self.reflections),
         )
         algorithm.run()
-        results = self.get_results_from_script(algorithm)
+        return self.get_results_from_script(algorithm)
+
+    def run_script(self, params, config_no):
+        """Run the scaling script with the params, get the free/work set results
+        and add to the results dict"""
+        results = self.run_scaling(params)
         self.add_results_to_results_dict(config_no, results)
+
+    def run_configurations(self, jobs, nproc=1):
+        """Run the scaling jobs, nproc at a time if nproc > 1.
+
+        The first job is run in this process, keeping the prepared data (the
+        asymmetric unit miller indices and spherical harmonic tables) in memory,
+        and the remaining jobs are then run in processes forked from this one,
+        which share that copy of the prepared data rather than each preparing
+        their own."""
+        global _forked_jobs
+        if (
+            nproc == 1
+            or len(jobs) < 2
+            or "fork" not in multiprocessing.get_all_start_methods()
+        ):
+            super().run_configurations(jobs)
+            return
+        with data_cache.shared_in_memory():
+            params, config_no = jobs[0]
+            self.run_script(params, config_no)
+            logger.info(
+                "Running the remaining %d cross validation jobs, %d at a time",
+                len(jobs) - 1,
+                min(nproc, len(jobs) - 1),
+            )
+            _forked_jobs = (self, jobs)
+            try:
+                with concurrent.futures.ProcessPoolExecutor(
+                    max_workers=min(nproc, len(jobs) - 1),
+                    mp_context=multiprocessing.get_context("fork"),
+                ) as executor:
+                    results = list(executor.map(_run_forked_job, range(1, len(jobs))))
+            finally:
+                _forked_jobs = None
+        for (_, config_no), result in zip(jobs[1:], results):
+            self.add_results_to_results_dict(config_no, result)
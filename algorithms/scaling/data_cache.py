@@ -0,0 +1,187 @@
+"""
+A persistent cache of prepared scaling data.
+
+Repeated runs of dials.scale on the same data (e.g. scaling, then filtering
+with scale_and_filter, then rescaling) recompute quantities that depend only on
+the input reflections, such as the asymmetric unit miller indices and the
+spherical harmonic tables of the absorption correction. With a cache
+directory set, each of these is stored as a set of .npy files in a
+subdirectory named by a hash of the inputs used to calculate it, and later
+runs memory-map the stored arrays rather than recalculating them.
+
+Several scaling runs in one job, such as the folds of a cross validation, can
+also share the prepared data in memory. Inside shared_in_memory() each entry
+is kept as a read-only array the first time it is needed, and is then used by
+all the later runs in the process and in any processes forked from it.
+"""
+
+import contextlib
+import hashlib
+import logging
+import os
+import shutil
+import tempfile
+import threading
+from typing import Callable, Dict, Optional, Sequence, Union
+
+import numpy as np
+
+logger = logging.getLogger("dials")
+
+_active_cache = None
+_memory_cache = None
+
+
+class ScalingDataCache:
+    """A directory of cached arrays, keyed by a hash of their inputs."""
+
+    def __init__(self, directory: str):
+        self.directory = directory
+        os.makedirs(directory, exist_ok=True)
+
+    @staticmethod
+    def key(name: str, inputs: Sequence[np.ndarray], params: Dict) -> str:
+        """Hash the name, parameters and input arrays of a cache entry."""
+        h = hashlib.blake2b(digest_size=20)
+        h.update(name.encode())
+        h.update(repr(sorted(params.items())).encode())
+        for array in inputs:
+            array = np.ascontiguousarray(array)
+            h.update(str((array.dtype.str, array.shape)).encode())
+            h.update(memoryview(array).cast("B"))
+        return f"{name}-{h.hexdigest()}"
+
+    def load(self, key: str) -> Optional[Dict[str, np.ndarray]]:
+        """Memory-map the arrays of an entry, or return None if it is missing."""
+        path = os.path.join(self.directory, key)
+        if not os.path.isdir(path):
+            return None
+        try:
+            return {
+                os.path.splitext(f)[0]: np.load(os.path.join(path, f), mmap_mode="r")
+                for f in os.listdir(path)
+                if f.endswith(".npy")
+            }
+        except (OSError, ValueError) as e:
+            logger.debug("Unable to read scaling data cache entry %s: %s", key, e)
+            return None
+
+    def save(self, key: str, arrays: Dict[str, np.ndarray]) -> None:
+        """
+        Store the arrays of an entry. The files are written to a temporary
+        directory which is then renamed, so that a concurrent or interrupted
+        run never sees a partial entry.
+        """
+        path = os.path.join(self.directory, key)
+        if os.path.isdir(path):
+            return
+        tmp = tempfile.mkdtemp(dir=self.directory, prefix=".tmp-")
+        try:
+            for name, array in arrays.items():
+                np.save(os.path.join(tmp, name + ".npy"), array)
+            os.rename(tmp, path)
+        except OSError as e:
+            logger.debug("Unable to write scaling data cache entry %s: %s", key, e)
+            shutil.rmtree(tmp, ignore_errors=True)
+
+    def get_or_compute(
+        self,
+        name: str,
+        inputs: Sequence[np.ndarray],
+        params: Dict,
+        compute: Callable[[], Dict[str, np.ndarray]],
+    ) -> Dict[str, np.ndarray]:
+        key = self.key(name, inputs, params)
+        arrays = self.load(key)
+        if arrays is not None:
+            logger.debug("Using cached %s from %s", name, self.directory)
+            return arrays
+        arrays = compute()
+        self.save(key, arrays)
+        return arrays
+
+
+class InMemoryScalingDataCache:
+    """
+    Read-only arrays kept in memory, keyed by a hash of their inputs. Entries
+    that are not in memory are taken from the directory cache, if one is set,
+    or calculated.
+    """
+
+    def __init__(self):
+        self._entries = {}
+        self._lock = threading.Lock()
+
+    def __len__(self):
+        return len(self._entries)
+
+    def get_or_compute(
+        self,
+        name: str,
+        inputs: Sequence[np.ndarray],
+        params: Dict,
+        compute: Callable[[], Dict[str, np.ndarray]],
+    ) -> Dict[str, np.ndarray]:
+        key = ScalingDataCache.key(name, inputs, params)
+        with self._lock:
+            arrays = self._entries.get(key)
+        if arrays is not None:
+            logger.debug("Using %s prepared in memory", name)
+            return arrays
+        if _active_cache is not None:
+            arrays = _active_cache.get_or_compute(name, inputs, params, compute)
+        else:
+            arrays = compute()
+        shared = {}
+        for array_name, array in arrays.items():
+            # copy any memory-mapped array, so an entry never refers to a file
+            array = np.array(array)
+            array.flags.writeable = False
+            shared[array_name] = array
+        with self._lock:
+            return self._entries.setdefault(key, shared)
+
+
+@contextlib.contextmanager
+def shared_in_memory():
+    """
+    Keep the prepared scaling data in memory for the duration of the context,
+    so it is calculated once and shared by all the scaling runs within it.
+    """
+    global _memory_cache
+    previous = _memory_cache
+    _memory_cache = InMemoryScalingDataCache()
+    try:
+        yield _memory_cache
+    finally:
+        _memory_cache = previous
+
+
+def set_cache_directory(directory: Optional[str]) -> None:
+    """Set the directory of the active cache, or disable it with None."""
+    global _active_cache
+    _active_cache = ScalingDataCache(directory) if directory else None
+
+
+def active_cache() -> Optional[Union[ScalingDataCache, InMemoryScalingDataCache]]:
+    """Return the active cache, or None if caching is disabled."""
+    if _memory_cache is not None:
+        return _memory_cache
+    return _active_cache
+
+
+def cached(
+    name: str,
+    inputs: Sequence[np.ndarray],
+    params: Dict,
+    compute: Callable[[], Dict[str, np.ndarray]],
+) -> Dict[str, np.ndarray]:
+    """
+    Get a dictionary of arrays from the active cache, calculating and storing
+    them with compute() if they are not there. Without an active cache this
+    just calls compute().
+    """
+    cache = active_cache()
+    if cache is None:
+        return compute()
+    return cache.get_or_compute(name, inputs, params, compute)
@@ -14,6 +14,7 @@
 
 from dials.array_family import flex
 from dials.util import tabulate
+from dials_scaling_ext import sum_in_bins
 
 logger = logging.getLogger("dials")
 
@@ -222,6 +223,7 @@ def __init__(self, Ih_table, min_reflections_required=250, n_bins=10):
         self.n_bins = n_bins
         self.Ih_table = Ih_table
         self.min_reflections_required = min_reflections_required
+        self.nthreads = Ih_table.nthreads
         self.n_h = self.Ih_table.calc_nh()
         self.sigmaprime = calc_sigmaprime([1.0, 0.0], self.Ih_table)
         self.summation_matrix = self._create_summation_matrix()
@@ -245,7 +247,6 @@ def _create_summation_matrix(self):
         per intensity bin unless there are very few reflections."""
         n = self.Ih_table.size
         self.binning_info["n_reflections"] = n
-        summation_matrix = sparse.matrix(n, self.n_bins)
         Ih = self.Ih_table.Ih_values * self.Ih_table.inverse_scale_factors
         size_order = flex.sort_permutation(flumpy.from_numpy(Ih), reverse=True)
         Imax = Ih.max()
@@ -263,14 +264,16 @@ def _create_summation_matrix(self):
         if Ih.size > 100 * self.min_reflections_required:
             self.min_reflections_required = int(Ih.size / 100.0)
         min_per_bin = min(self.min_reflections_required, int(n / (3.0 * self.n_bins)))
+        bin_index = np.full(n, self.n_bins, dtype=np.uint64)
         for i in range(len(self.binning_info["bin_boundaries"]) - 1):
             maximum = self.binning_info["bin_boundaries"][i]
             minimum = self.binning_info["bin_boundaries"][i + 1]
-            sel1 = Ih <= maximum
+            # a boundary may have moved below the next one, so exclude any
+            # reflections already in a bin to keep the bins disjoint.
+            sel1 = (Ih <= maximum) & (bin_index == self.n_bins)
             sel2 = Ih > minimum
             sel = sel1 & sel2
-            # isel = sel.iselection()
-            n_in_bin = np.count_nonzero(sel)  # isel.size()
+            n_in_bin = np.count_nonzero(sel)
             if n_in_bin < min_per_bin:  # need more in this bin
                 m = n_cumul + min_per_bin
                 if m < n:  # still some refl left to use
@@ -279,47 +282,22 @@ def _create_summation_matrix(self):
                     self.binning_info["bin_boundaries"][i + 1] = intensity
                     minimum = self.binning_info["bin_boundaries"][i + 1]
                     sel = sel1 & (Ih > minimum)
-                    # isel = sel.iselection()
-                    n_in_bin = np.count_nonzero(sel)  # isel.size()
+                    n_in_bin = np.count_nonzero(sel)
             self.binning_info["refl_per_bin"] = np.append(
                 self.binning_info["refl_per_bin"], [n_in_bin]
             )
-            for j in np.nonzero(sel)[0]:  # isel:
-                summation_matrix[int(j), i] = 1
+            bin_index[sel] = i
             n_cumul += n_in_bin
-        cols_to_del = []
-        for i, col in enumerate(summation_matrix.cols()):
-            if col.non_zeroes < min_per_bin - 5:
-                cols_to_del.append(i)
-        n_new_cols = summation_matrix.n_cols - len(cols_to_del)
-        if n_new_cols == self.n_bins:
-            for i in range(len(self.binning_info["bin_boundaries"]) - 1):
-                maximum = self.binning_info["bin_boundaries"][i]
-                minimum = self.binning_info["bin_boundaries"][i + 1]
-                sel1 = Ih <= maximum
-                sel2 = Ih > minimum
-                sel = sel1 & sel2
-                self.binning_info["mean_intensities"] = np.append(
-                    self.binning_info["mean_intensities"], [np.mean(Ih[sel])]
-                )
-            return summation_matrix
-        new_sum_matrix = sparse.matrix(summation_matrix.n_rows, n_new_cols)
-        next_col = 0
-        refl_per_bin = np.array([], dtype=float).reshape((0,))
-        new_bounds = np.array([], dtype=float).reshape((0,))
-        for i, col in enumerate(summation_matrix.cols()):
-            if i not in cols_to_del:
-                new_sum_matrix[:, next_col] = col
-                next_col += 1
-                new_bounds = np.append(
-                    new_bounds, [self.binning_info["bin_boundaries"][i]]
-                )
-                refl_per_bin = np.append(
-                    refl_per_bin, [self.binning_info["refl_per_bin"][i]]
-                )
-        self.binning_info["refl_per_bin"] = refl_per_bin
-        new_bounds = np.append(new_bounds, [self.binning_info["bin_boundaries"][-1]])
-        self.binning_info["bin_boundaries"] = new_bounds
+        kept = np.nonzero(self.binning_info["refl_per_bin"] >= min_per_bin - 5)[0]
+        n_new_cols = kept.size
+        if n_new_cols != self.n_bins:
+            bounds = self.binning_info["bin_boundaries"]
+            self.binning_info["refl_per_bin"] = self.binning_info["refl_per_bin"][kept]
+            self.binning_info["bin_boundaries"] = np.append(bounds[kept], [bounds[-1]])
+        new_index = np.full(self.n_bins + 1, n_new_cols, dtype=np.uint64)
+        new_index[kept] = np.arange(n_new_cols, dtype=np.uint64)
+        self.bin_index = new_index[bin_index]
+        new_bounds = self.binning_info["bin_boundaries"]
         for i in range(len(new_bounds) - 1):
             maximum = new_bounds[i]
             minimum = new_bounds[i + 1]
@@ -329,16 +307,25 @@ def _create_summation_matrix(self):
             self.binning_info["mean_intensities"] = np.append(
                 self.binning_info["mean_intensities"], [np.mean(Ih[sel])]
             )
-        return new_sum_matrix
+        return sparse.matrix(
+            n,
+            n_new_cols,
+            [
+                dict.fromkeys(np.nonzero(self.bin_index == i)[0].tolist(), 1.0)
+                for i in range(n_new_cols)
+            ],
+        )
 
     def calculate_bin_variances(self) -> np.array:
         """Calculate the variance of each bin."""
-        sum_deltasq = flumpy.to_numpy(
-            flumpy.from_numpy(np.square(self.delta_hl)) * self.summation_matrix
-        )
-        sum_delta_sq = np.square(
-            flumpy.to_numpy(flumpy.from_numpy(self.delta_hl) * self.summation_matrix)
+        sum_delta, sum_deltasq = sum_in_bins(
+            flumpy.from_numpy(self.delta_hl),
+            flumpy.from_numpy(self.bin_index),
+            self.summation_matrix.n_cols,
+            self.nthreads,
         )
+        sum_deltasq = flumpy.to_numpy(sum_deltasq)
+        sum_delta_sq = np.square(flumpy.to_numpy(sum_delta))
         bin_vars = (sum_deltasq / self.binning_info["refl_per_bin"]) - (
             sum_delta_sq / np.square(self.binning_info["refl_per_bin"])
         )
@@ -21,11 +21,28 @@
 the same way as the data in the Ih_table datastructure.
 """
 
+from collections import namedtuple
+
 from scitbx import sparse
 
 from dials.array_family import flex
 from dials_scaling_ext import calculate_harmonic_tables_from_selections
 
+# The form of the inverse scales of a component for a block, for the native
+# evaluation of all the components together. The inverse scales are
+# values + matrix * p for a linear component, or exp(values * (matrix * p)) for
+# an exponential component, where the first n_fixed parameters are not refined.
+ScaleForm = namedtuple("ScaleForm", ["exponential", "matrix", "values", "n_fixed"])
+
+
+def ones_column(n):
+    """Return an n x 1 sparse matrix of ones."""
+    matrix = sparse.matrix(n, 1)
+    ones = flex.double(n, 1.0)
+    ones.reshape(flex.grid(n, 1))
+    matrix.assign_block(ones, 0, 0)
+    return matrix
+
 
 class ScaleComponentBase:
     """
@@ -51,6 +68,7 @@ def __init__(self, initial_values, parameter_esds=None):
         self._n_refl = []  # store as a list, to allow holding of data in blocks
         self._parameter_restraints = None
         self._data = {}
+        self._scale_forms = {}
 
     @property
     def data(self):
@@ -176,6 +194,24 @@ def calculate_scales(self, block_id=0):
         """Calculate and return inverse scales for a given block."""
         raise NotImplementedError()
 
+    def scale_form(self, block_id=0):
+        """
+        Return the ScaleForm of the inverse scales of a given block, or None if
+        the component can't be evaluated natively.
+        """
+        return None
+
+    def _cached_scale_form(self, block_id, key, make_form):
+        """
+        Return the scale form of a block, made again only if the key is not the
+        same object as on the last call for the block.
+        """
+        cached = self._scale_forms.get(block_id)
+        if cached is None or cached[0] is not key:
+            cached = (key, make_form())
+            self._scale_forms[block_id] = cached
+        return cached[1]
+
 
 class SingleScaleFactor(ScaleComponentBase):
     """
@@ -236,6 +272,17 @@ def calculate_scales(self, block_id=0):
         """Calculate and return inverse scales for a given block."""
         return flex.double(self.n_refl[block_id], self._parameters[0])
 
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        n_refl = self.n_refl[block_id]
+        if n_refl == 0:
+            return None
+        return self._cached_scale_form(
+            block_id,
+            self._n_refl,
+            lambda: ScaleForm(False, ones_column(n_refl), 0.0, 0),
+        )
+
 
 class SingleBScaleFactor(ScaleComponentBase):
     """
@@ -306,6 +353,17 @@ def calculate_scales(self, block_id=0):
         )
         return scales
 
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        d = self._d_values[block_id]
+        if d.size() == 0:
+            return None
+        return self._cached_scale_form(
+            block_id,
+            d,
+            lambda: ScaleForm(True, ones_column(d.size()), 1.0 / (2.0 * d * d), 0),
+        )
+
 
 class LinearDoseDecay(ScaleComponentBase):
     """
@@ -384,6 +442,23 @@ def calculate_scales(self, block_id=0):
         )
         return scales
 
+    def _dose_factors(self, block_id):
+        """The factors multiplying the parameter in the exponent of the scales."""
+        return self._x[block_id] / self._d_values[block_id]
+
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        d = self._d_values[block_id]
+        if d.size() == 0:
+            return None
+        return self._cached_scale_form(
+            block_id,
+            d,
+            lambda: ScaleForm(
+                True, ones_column(d.size()), self._dose_factors(block_id), 0
+            ),
+        )
+
 
 class QuadraticDoseDecay(LinearDoseDecay):
     """
@@ -414,6 +489,10 @@ def calculate_scales(self, block_id=0):
         )
         return scales
 
+    def _dose_factors(self, block_id):
+        """The factors multiplying the parameter in the exponent of the scales."""
+        return self._x[block_id] / (self._d_values[block_id] ** 2)
+
 
 class SHScaleComponent(ScaleComponentBase):
     """
@@ -563,6 +642,18 @@ def calculate_scales_and_derivatives(self, block_id=0):
         elif self._mode == "memory":
             return self._calculate_scales_and_derivatives_memorymode(block_id)
 
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        if self._n_refl[block_id] == 0:
+            return None
+        if self._mode == "speed":
+            matrix = self._harmonic_values[block_id]
+        else:
+            matrix = self._matrices[block_id]
+        return self._cached_scale_form(
+            block_id, matrix, lambda: ScaleForm(False, matrix, 1.0, 0)
+        )
+
     def _calculate_scales_and_derivatives_speedmode(self, block_id, derivatives=True):
         abs_scale = flex.double(
             self._harmonic_values[block_id].n_rows, 1.0
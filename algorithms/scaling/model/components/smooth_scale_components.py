@@ -12,6 +12,7 @@
 
 from dials.algorithms.scaling.model.components.scale_components import (
     ScaleComponentBase,
+    ScaleForm,
 )
 from dials.array_family import flex
 from dials_refinement_helpers_ext import GaussianSmoother2D as GS2D
@@ -23,7 +24,36 @@
 # consistent with that used in dials.refinement.
 
 
-class GaussianSmoother1D(GS1D):
+class CachedWeightsMixin:
+    """Mixin class to keep the weights of a Gaussian smoother at sets of points.
+
+    The weights only depend on the points and the smoothing parameters, so they
+    are kept for each set of points and only calculated again when the points
+    are replaced or the smoothing parameters are changed."""
+
+    def __init__(self, *args):
+        super().__init__(*args)
+        self._cached_weights = {}
+
+    def set_smoothing(self, num_average, sigma):
+        """Set the smoothing parameters, discarding any cached weights."""
+        super().set_smoothing(num_average, sigma)
+        self._cached_weights = {}
+
+    def cached_weights(self, key, method, *coords):
+        """Return the smoother weights at the points given by the coordinates.
+
+        The weights are calculated again only if the coordinates are not the
+        same objects as on the last call with this key and method."""
+        cached = self._cached_weights.get((key, method))
+        if cached and all(a is b for a, b in zip(cached[0], coords)):
+            return cached[1]
+        weights = getattr(self, method)(*coords)
+        self._cached_weights[(key, method)] = (coords, weights)
+        return weights
+
+
+class GaussianSmoother1D(CachedWeightsMixin, GS1D):
     """A 1D Gaussian smoother."""
 
     def value_weight(self, x, value):
@@ -51,7 +81,7 @@ def positions(self):
         return list(super().positions())
 
 
-class GaussianSmoother2D(GS2D):
+class GaussianSmoother2D(CachedWeightsMixin, GS2D):
     """A 2D Gaussian smoother."""
 
     def value_weight(self, x, y, value):
@@ -73,7 +103,7 @@ def y_positions(self):
         return list(super().y_positions())
 
 
-class GaussianSmoother3D(GS3D):
+class GaussianSmoother3D(CachedWeightsMixin, GS3D):
     """A 3D Gaussian smoother."""
 
     def value_weight(self, x, y, z, value):
@@ -132,6 +162,12 @@ def nparam_to_val(n_params):
             return n_params - 1
         return n_params - 2
 
+    @staticmethod
+    def normalised_weights(weights):
+        """The smoother weights divided by the sum of the weights at each point,
+        i.e. the derivatives of the smoothed values."""
+        return row_multiply(weights.get_weight(), 1.0 / weights.get_sumweight())
+
 
 class SmoothScaleComponent1D(ScaleComponentBase, SmoothMixin):
     """A smoothly varying scale component in one dimension.
@@ -231,22 +267,22 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_values.append(normalised_values)
             self._n_refl.append(normalised_values.size())
 
+    def _weights(self, block_id):
+        """The smoother weights at the normalised values of a block."""
+        if self._fixed_initial:
+            method = "multi_weight_first_fixed"
+        else:
+            method = "multi_weight"
+        return self._smoother.cached_weights(
+            block_id, method, self._normalised_values[block_id]
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            if self._fixed_initial:
-                (
-                    value,
-                    weight,
-                    sumweight,
-                ) = self._smoother.multi_value_weight_first_fixed(
-                    self._normalised_values[block_id], self.value
-                )
-            else:
-                value, weight, sumweight = self._smoother.multi_value_weight(
-                    self._normalised_values[block_id], self.value
-                )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self._weights(block_id)
+            value = weights.multi_value(self.value)
+            inv_sw = 1.0 / weights.get_sumweight()
+            dv_dp = row_multiply(weights.get_weight(), inv_sw)
         elif self._n_refl[block_id] == 1:
             if self._fixed_initial:
                 value, weight, sumweight = self._smoother.value_weight_first_fixed(
@@ -268,9 +304,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """ "Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_values[block_id], self.value
-            )
+            value = self._weights(block_id).multi_value(self.value)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_values[block_id][0], self.value
@@ -280,6 +314,24 @@ def calculate_scales(self, block_id=0):
             value = flex.double([])
         return value
 
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        if self._n_refl[block_id] <= 1:
+            return None
+        # The evaluator is given the weights of all the parameters, and told
+        # whether the first is fixed
+        weights = self._smoother.cached_weights(
+            block_id, "multi_weight", self._normalised_values[block_id]
+        )
+        return self._cached_scale_form(
+            block_id,
+            weights,
+            lambda: self._make_scale_form(block_id, self.normalised_weights(weights)),
+        )
+
+    def _make_scale_form(self, block_id, matrix):
+        return ScaleForm(False, matrix, 0.0, 1 if self._fixed_initial else 0)
+
 
 class SmoothBScaleComponent1D(SmoothScaleComponent1D):
     """Subclass of SmoothScaleComponent1D to implement a smoothly
@@ -326,6 +378,12 @@ def calculate_scales(self, block_id=0):
         s = super().calculate_scales(block_id)
         return flex.exp(s / (2.0 * flex.pow2(self._d_values[block_id])))
 
+    def _make_scale_form(self, block_id, matrix):
+        d = self._d_values[block_id]
+        return ScaleForm(
+            True, matrix, 1.0 / (2.0 * d * d), 1 if self._fixed_initial else 0
+        )
+
     def calculate_restraints(self):
         residual = self.parameter_restraints * (self._parameters * self._parameters)
         gradient = 2.0 * self.parameter_restraints * self._parameters
@@ -432,15 +490,21 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_y_values.append(normalised_y_values)
             self._n_refl.append(normalised_x_values.size())
 
+    def _weights(self, block_id):
+        """The smoother weights at the normalised values of a block."""
+        return self._smoother.cached_weights(
+            block_id,
+            "multi_weight",
+            self._normalised_x_values[block_id],
+            self._normalised_y_values[block_id],
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            value, weight, sumweight = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self.value,
-            )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self._weights(block_id)
+            value = weights.multi_value(self.value)
+            inv_sw = 1.0 / weights.get_sumweight()
+            dv_dp = row_multiply(weights.get_weight(), inv_sw)
         elif self._n_refl[block_id] == 1:
             value, weight, sumweight = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -459,11 +523,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self.value,
-            )
+            value = self._weights(block_id).multi_value(self.value)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -475,6 +535,17 @@ def calculate_scales(self, block_id=0):
             value = flex.double([])
         return value
 
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        if self._n_refl[block_id] <= 1:
+            return None
+        weights = self._weights(block_id)
+        return self._cached_scale_form(
+            block_id,
+            weights,
+            lambda: ScaleForm(False, self.normalised_weights(weights), 0.0, 0),
+        )
+
 
 class SmoothScaleComponent3D(ScaleComponentBase, SmoothMixin):
     """Implementation of a 3D array-based smoothly varying scale factor.
@@ -595,16 +666,22 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_z_values.append(normalised_z_values)
             self._n_refl.append(normalised_x_values.size())
 
+    def _weights(self, block_id):
+        """The smoother weights at the normalised values of a block."""
+        return self._smoother.cached_weights(
+            block_id,
+            "multi_weight",
+            self._normalised_x_values[block_id],
+            self._normalised_y_values[block_id],
+            self._normalised_z_values[block_id],
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            value, weight, sumweight = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self._normalised_z_values[block_id],
-                self.value,
-            )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self._weights(block_id)
+            value = weights.multi_value(self.value)
+            inv_sw = 1.0 / weights.get_sumweight()
+            dv_dp = row_multiply(weights.get_weight(), inv_sw)
         elif self._n_refl[block_id] == 1:
             value, weight, sumweight = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -624,12 +701,7 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """ "Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self._normalised_z_values[block_id],
-                self.value,
-            )
+            value = self._weights(block_id).multi_value(self.value)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -641,3 +713,14 @@ def calculate_scales(self, block_id=0):
         else:
             value = flex.double([])
         return value
+
+    def scale_form(self, block_id=0):
+        """Return the ScaleForm of the inverse scales of a given block."""
+        if self._n_refl[block_id] <= 1:
+            return None
+        weights = self._weights(block_id)
+        return self._cached_scale_form(
+            block_id,
+            weights,
+            lambda: ScaleForm(False, self.normalised_weights(weights), 0.0, 0),
+        )
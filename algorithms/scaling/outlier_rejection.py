@@ -8,7 +8,6 @@
 Ih_table and returns flex.size_t index arrays of the outlier positions.
 """
 
-import copy
 import logging
 
 import numpy as np
@@ -18,7 +17,6 @@
 
 from dials.algorithms.scaling.Ih_table import IhTable
 from dials.util.normalisation import quasi_normalisation
-from dials_scaling_ext import determine_outlier_indices, limit_outlier_weights
 
 logger = logging.getLogger("dials")
 
@@ -300,9 +298,8 @@ class SimpleNormDevOutlierRejection(OutlierRejectionBase):
     def __init__(self, Ih_table, zmax):
         super().__init__(Ih_table, zmax)
         self.weights = flumpy.to_numpy(
-            limit_outlier_weights(
-                copy.deepcopy(self._Ih_table_block.weights),
-                self._Ih_table_block.h_index_matrix,
+            self._Ih_table_block.groups.limit_outlier_weights(
+                flumpy.from_numpy(self._Ih_table_block.weights)
             )
         )
 
@@ -353,9 +350,8 @@ class NormDevOutlierRejection(OutlierRejectionBase):
     def __init__(self, Ih_table, zmax):
         super().__init__(Ih_table, zmax)
         self.weights = flumpy.to_numpy(
-            limit_outlier_weights(
-                copy.deepcopy(self._Ih_table_block.weights),
-                self._Ih_table_block.h_index_matrix,
+            self._Ih_table_block.groups.limit_outlier_weights(
+                flumpy.from_numpy(self._Ih_table_block.weights)
             )
         )
 
@@ -374,41 +370,22 @@ def _round_of_outlier_rejection(self):
         Calculate normal deviations from the data in the Ih_table.
         """
         Ih_table = self._Ih_table_block
-        intensity = Ih_table.intensities
-        g = Ih_table.inverse_scale_factors
+        # The rejection analysis is only done if n_in_group > 2
         w = self.weights
-        wgIsum = Ih_table.sum_in_groups(w * g * intensity, output="per_refl")
-        wg2sum = Ih_table.sum_in_groups(w * g * g, output="per_refl")
-        wgIsum_others = wgIsum - (w * g * intensity)
-        wg2sum_others = wg2sum - (w * g * g)
-        # Now do the rejection analysis if n_in_group > 2
-        nh = Ih_table.calc_nh()
-        sel = nh > 2
-        wg2sum_others_sel = wg2sum_others[sel]
-        wgIsum_others_sel = wgIsum_others[sel]
-
-        # guard against zero division errors - can happen due to rounding errors
-        # or bad data giving g values are very small
-        zero_sel = wg2sum_others_sel == 0.0
-        # set as one for now, then mark as outlier below. This will only affect if
-        # g is near zero, if w is zero then throw an assertionerror.
-        wg2sum_others_sel[zero_sel] = 1.0
-        g_sel = g[sel]
-        I_sel = intensity[sel]
-        w_sel = w[sel]
-
-        assert np.all(w_sel > 0)  # guard against division by zero
-        norm_dev = (I_sel - (g_sel * wgIsum_others_sel / wg2sum_others_sel)) / (
-            np.sqrt((1.0 / w_sel) + (np.square(g_sel) / wg2sum_others_sel))
-        )
-        norm_dev[zero_sel] = 1000  # to trigger rejection
-        z_score = np.abs(norm_dev)
-        # Want an array same size as Ih table.
-        all_z_scores = np.zeros(Ih_table.size)
-        # all_z_scores.set_selected(sel.iselection(), z_score)
-        all_z_scores[sel] = z_score
-        outlier_indices, other_potential_outliers = determine_outlier_indices(
-            Ih_table.h_index_matrix, flumpy.from_numpy(all_z_scores), self._zmax
+        assert np.all(w[Ih_table.calc_nh() > 2] > 0)  # guard against division by zero
+        # The normalised deviations and the largest deviation in each group are
+        # calculated in C++, sharing the groups between the threads. If the sum
+        # of w g^2 of the other reflections is zero, e.g. due to rounding errors
+        # or bad data giving very small g values, the deviation is set to 1000 to
+        # trigger rejection.
+        (
+            outlier_indices,
+            other_potential_outliers,
+        ) = Ih_table.groups.determine_outlier_indices(
+            flumpy.from_numpy(Ih_table.intensities),
+            flumpy.from_numpy(Ih_table.inverse_scale_factors),
+            flumpy.from_numpy(w),
+            self._zmax,
         )
         sel = np.full(Ih_table.size, False, dtype=bool)
         outlier_indices = flumpy.to_numpy(outlier_indices)
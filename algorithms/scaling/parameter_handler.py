@@ -39,6 +39,11 @@ def __init__(self, components, selection_list):
         for component in components:
             n_obs.append(components[component].n_refl)
         self.n_obs = n_obs[0]  # list of length n_blocks
+        # options for the evaluation of the components during minimisation,
+        # and the native evaluators of each block, see RefinerCalculator
+        self.native_components = False
+        self.nthreads = 1
+        self.scale_evaluators = {}
 
 
 class ScalingParameterManagerGenerator(ParameterManagerGenerator):
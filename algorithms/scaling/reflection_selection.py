@@ -68,7 +68,6 @@
 import numpy as np
 
 from dxtbx import flumpy
-from scitbx import sparse
 
 from dials.algorithms.scaling.scaling_utilities import (
     BadDatasetForScalingException,
@@ -76,16 +75,11 @@
 )
 from dials.array_family import flex
 from dials.util import tabulate
+from dials_scaling_ext import quasi_random_selection
 
 logger = logging.getLogger("dials")
 
 
-def _build_class_matrix(class_index, class_matrix, offset=0):
-    for (i, val) in enumerate(class_index, start=offset):
-        class_matrix[val, i] = 1.0
-    return class_matrix
-
-
 def _select_groups_on_Isigma_cutoff(Ih_table, cutoff=2.0):
     """Select groups with multiplicity>1, Isigma>cutoff"""
     sumIsigm = Ih_table.sum_in_groups(
@@ -120,46 +114,6 @@ def _select_groups_on_Isigma_cutoff(Ih_table, cutoff=2.0):
     return sel_Ih_table
 
 
-def _perform_quasi_random_selection(
-    Ih_table, n_datasets, min_per_class, min_total, max_total
-):
-
-    class_matrix = sparse.matrix(n_datasets, Ih_table.size)
-    class_matrix = _build_class_matrix(
-        flumpy.from_numpy(Ih_table.Ih_table["dataset_id"].to_numpy()), class_matrix
-    )
-    segments_in_groups = class_matrix * Ih_table.h_index_matrix
-    total = flex.double(segments_in_groups.n_cols, 0)
-    for i, col in enumerate(segments_in_groups.cols()):
-        total[i] = col.non_zeroes
-    perm = flex.sort_permutation(total, reverse=True)
-    sorted_class_matrix = segments_in_groups.select_columns(perm)
-    # matrix of segment index vs asu groups
-
-    # now want to fill up until good coverage across board
-    total_in_classes, cols_not_used = _loop_over_class_matrix(
-        sorted_class_matrix, min_per_class, min_total, max_total
-    )
-
-    cols_used = flex.bool(sorted_class_matrix.n_cols, True)
-    cols_used.set_selected(cols_not_used, False)
-    actual_cols_used = perm.select(cols_used)
-
-    # now need to get reflection selection
-    reduced_Ih = Ih_table.select_on_groups(actual_cols_used)
-    indices_this_res = reduced_Ih.Ih_table["loc_indices"]
-    dataset_ids_this_res = reduced_Ih.Ih_table["dataset_id"]
-
-    n_groups_used = len(actual_cols_used)
-
-    return (
-        flumpy.from_numpy(indices_this_res.to_numpy()),
-        flumpy.from_numpy(dataset_ids_this_res.to_numpy()),
-        n_groups_used,
-        total_in_classes,
-    )
-
-
 def select_connected_reflections_across_datasets(
     Ih_table, experiment, Isigma_cutoff=2.0, min_total=40000, n_resolution_bins=20
 ):
@@ -204,37 +158,39 @@ def select_connected_reflections_across_datasets(
         summary_rows = []
         summary_header = ["d-range", "n_groups", "n_refl"]
 
-    indices = flex.size_t()
-    dataset_ids = flex.size_t()
-    total_groups_used = 0
+    # select the groups of all the resolution bins in one pass
+    dataset_id = sel_Ih_table.Ih_table["dataset_id"].to_numpy()
+    selection, n_groups_used, n_selected, totals = quasi_random_selection(
+        sel_Ih_table.groups.group_ids(),
+        flumpy.from_numpy(dataset_id.astype(np.uint64)),
+        binner.bin_indices(),
+        sel_Ih_table.n_groups,
+        n_datasets,
+        binner.n_bins_all(),
+        mpc,
+        mint,
+        maxt,
+        nthreads=sel_Ih_table.nthreads,
+    )
+    rows_selected = flumpy.to_numpy(selection)
+    loc_indices = sel_Ih_table.Ih_table["loc_indices"].to_numpy()[rows_selected]
+    indices = flumpy.from_numpy(loc_indices.astype(np.uint64))
+    dataset_ids = flumpy.from_numpy(dataset_id[rows_selected].astype(np.uint64))
     n_cols_used = 0
 
     for ibin in binner.range_all():
-        sel = binner.selection(ibin)
-        res_Ih_table = sel_Ih_table.select(flumpy.to_numpy(sel))
-        if not res_Ih_table.Ih_table.size:
-            continue
-
-        (
-            indices_this_res,
-            dataset_ids_this_res,
-            n_groups_used,
-            total_per_dataset,
-        ) = _perform_quasi_random_selection(res_Ih_table, n_datasets, mpc, mint, maxt)
-
-        indices.extend(indices_this_res)
-        dataset_ids.extend(dataset_ids_this_res)
-        total_groups_used += n_groups_used
+        if not n_groups_used[ibin]:
+            continue  # no reflections in this bin
         d0, d1 = binner.bin_d_range(ibin)
         drange = str(round(d0, 3)) + " - " + str(round(d1, 3))
-        n_refl = str(int(indices_this_res.size()))
+        n_refl = str(int(n_selected[ibin]))
         rows.append(
-            [drange, str(n_groups_used), n_refl]
-            + [str(int(i)) for i in total_per_dataset]
+            [drange, str(n_groups_used[ibin]), n_refl]
+            + [str(int(totals[ibin, i])) for i in range(n_datasets)]
         )
         if n_datasets >= 15:
-            summary_rows.append([drange, str(n_groups_used), n_refl])
-        n_cols_used += n_groups_used
+            summary_rows.append([drange, str(n_groups_used[ibin]), n_refl])
+        n_cols_used += n_groups_used[ibin]
 
     logger.info(
         "Summary of cross-dataset reflection groups chosen (%s groups, %s reflections):",
@@ -253,7 +209,10 @@ def select_connected_reflections_across_datasets(
 def _loop_over_class_matrix(
     sorted_class_matrix, min_per_area, min_per_bin, max_per_bin
 ):
-    """Build up the reflection set by looping over the class matrix."""
+    """Build up the reflection set by looping over the class matrix.
+
+    This is the choice of groups that quasi_random_selection makes for each
+    resolution bin."""
 
     def _get_next_row_needed(total_in_classes):
         current_min = flex.min(total_in_classes)
@@ -177,6 +177,9 @@ def _perform_scaling(
             shared=shared,
         )
         for apm in pmg.parameter_managers():
+            for apm_i in apm.apm_list:
+                apm_i.native_components = self.params.scaling_options.native_components
+                apm_i.nthreads = self.params.scaling_options.nproc
             if not engine:
                 engine = self.params.scaling_refinery.engine
             if not max_iterations:
@@ -506,7 +509,10 @@ def update_for_minimisation(self, apm, block_id):
         """Update the scale factors and Ih for the next minimisation iteration."""
         apm_i = apm.apm_list[0]
         scales_i, derivs_i = RefinerCalculator.calculate_scales_and_derivatives(
-            apm_i, block_id
+            apm_i,
+            block_id,
+            native=apm_i.native_components,
+            nthreads=apm_i.nthreads,
         )
         self.Ih_table.set_derivatives(derivs_i, block_id)
         self.Ih_table.set_inverse_scale_factors(flumpy.to_numpy(scales_i), block_id)
@@ -741,6 +747,7 @@ def _create_Ih_table(self):
             indices_lists=[self.scaling_selection.iselection()],
             nblocks=self.params.scaling_options.nproc,
             anomalous=self.params.anomalous,
+            nthreads=self.params.scaling_options.nproc,
         )
         if self._experiment.scaling_model.error_model:
             # update with the error model to add the correct weights
@@ -760,6 +767,7 @@ def _create_global_Ih_table(
             free_set_percentage=free_set_percentage,
             free_set_offset=self.params.scaling_options.free_set_offset,
             anomalous=anomalous,
+            nthreads=self.params.scaling_options.nproc,
         )
         if free_set_percentage:
             loc_indices = (
@@ -773,6 +781,7 @@ def _create_global_Ih_table(
                 [(~self.free_set_selection).iselection()],
                 nblocks=1,
                 anomalous=anomalous,
+                nthreads=self.params.scaling_options.nproc,
             )
             free_Ih_table = IhTable(
                 [sel_reflections.select(self.free_set_selection)],
@@ -780,6 +789,7 @@ def _create_global_Ih_table(
                 [self.free_set_selection.iselection()],
                 nblocks=1,
                 anomalous=anomalous,
+                nthreads=self.params.scaling_options.nproc,
             )
         return global_Ih_table, free_Ih_table
 
@@ -972,7 +982,10 @@ def _update_for_minimisation(self, apm, block_id, calc_Ih=True):
         derivs = []
         for apm_i in apm.apm_list:
             scales_i, derivs_i = RefinerCalculator.calculate_scales_and_derivatives(
-                apm_i, block_id
+                apm_i,
+                block_id,
+                native=apm_i.native_components,
+                nthreads=apm_i.nthreads,
             )
             scales.extend(scales_i)
             derivs.append(derivs_i)
@@ -1027,6 +1040,7 @@ def _create_global_Ih_table(self, anomalous=False, remove_outliers=False):
             free_set_percentage=free_set_percentage,
             free_set_offset=self.params.scaling_options.free_set_offset,
             anomalous=anomalous,
+            nthreads=self.params.scaling_options.nproc,
         )
         if free_set_percentage:
             # need to set free_set_selection in individual scalers
@@ -1057,6 +1071,7 @@ def _create_global_Ih_table(self, anomalous=False, remove_outliers=False):
                 indices_list,
                 nblocks=1,
                 anomalous=anomalous,
+                nthreads=self.params.scaling_options.nproc,
             )
             free_Ih_table = IhTable(
                 free_tables,
@@ -1064,6 +1079,7 @@ def _create_global_Ih_table(self, anomalous=False, remove_outliers=False):
                 free_indices_list,
                 nblocks=1,
                 anomalous=anomalous,
+                nthreads=self.params.scaling_options.nproc,
             )
         return global_Ih_table, free_Ih_table
 
@@ -1079,6 +1095,7 @@ def _create_Ih_table(self):
             indices_lists=indices_lists,
             nblocks=self.params.scaling_options.nproc,
             anomalous=self.params.anomalous,
+            nthreads=self.params.scaling_options.nproc,
         )
         for i, scaler in enumerate(self.active_scalers):
             error_model = scaler._experiment.scaling_model.error_model
@@ -1480,7 +1497,12 @@ def perform_error_optimisation(self, update_Ih=True):
                 continue
             tables = [s.get_valid_reflections().select(~s.outliers) for s in scalers]
             space_group = scalers[0].experiment.crystal.get_space_group()
-            Ih_table = IhTable(tables, space_group, anomalous=True)
+            Ih_table = IhTable(
+                tables,
+                space_group,
+                anomalous=True,
+                nthreads=self.params.scaling_options.nproc,
+            )
             if len(minimisation_groups) == 1:
                 logger.info("Determining a combined error model for all datasets")
             else:
@@ -1,6 +1,8 @@
 #ifndef DIALS_SCALING_SCALING_HELPER_H
 #define DIALS_SCALING_SCALING_HELPER_H
 
+#include <algorithm>
+#include <cmath>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/sparse/matrix.h>
 #include <scitbx/math/zernike.h>
@@ -8,6 +10,8 @@
 #include <dials/error.h>
 #include <math.h>
 #include <dials/algorithms/refinement/gaussian_smoother.h>
+#include <dials/algorithms/refinement/normal_equations.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 typedef scitbx::sparse::matrix<double>::column_type col_type;
 
@@ -55,28 +59,18 @@ public:
     return SingleValueWeights(value, weight, sumweight);
   }
 
-  dials::refinement::MultiValueWeights multi_value_weight_first_fixed(
-    const scitbx::af::const_ref<double> x,
-    const scitbx::af::const_ref<double> values) {
+  dials::refinement::SmootherWeights multi_weight_first_fixed(
+    const scitbx::af::const_ref<double> x) {
     // Use sparse storage as only naverage (default 3) values per row are
     // non-zero
     std::size_t npoints = x.size();  //# data
     DIALS_ASSERT(npoints > 1);
-    matrix<double> weight(npoints, nvalues - 1);
-
-    // Allocate space for the interpolated values and sumweights, with raw
-    // refs for fastest access (See Michael Hohn's notes)
-    scitbx::af::shared<double> value(npoints, scitbx::af::init_functor_null<double>());
-    scitbx::af::ref<double> value_ref = value.ref();
-    scitbx::af::shared<double> sumweight(npoints,
-                                         scitbx::af::init_functor_null<double>());
-    scitbx::af::ref<double> sumweight_ref = sumweight.ref();
+    dials::refinement::SmootherWeights weights(npoints, nvalues, nvalues - 1);
+    matrix<double> &weight = weights.weight();
 
     for (std::size_t irow = 0; irow < npoints; ++irow) {
       // normalised coordinate
       double z = (x[irow] - x0) / spacing_;
-      double sumw = 0.0;
-      double sumwv = 0.0;
 
       vec2<int> irange = idx_range(z);
 
@@ -86,19 +80,18 @@ public:
         if (icol > 0) {
           weight(irow, icol - 1) = w;
         }
-        sumw += w;
-        sumwv += w * values[icol];
-      }
-      sumweight_ref[irow] = sumw;
-
-      if (sumw > 0.0) {
-        value_ref[irow] = sumwv / sumw;
-      } else {
-        value_ref[irow] = 0.0;
+        weights.add(icol, w);
       }
+      weights.next_point();
     }
 
-    return MultiValueWeights(value, weight, sumweight);
+    return weights;
+  }
+
+  dials::refinement::MultiValueWeights multi_value_weight_first_fixed(
+    const scitbx::af::const_ref<double> x,
+    const scitbx::af::const_ref<double> values) {
+    return multi_weight_first_fixed(x).multi_value_weight(values);
   }
 };
 
@@ -176,83 +169,6 @@ scitbx::sparse::matrix<double> calculate_dIh_by_dpi(
   return dIh_by_dpi;
 }
 
-scitbx::sparse::matrix<double> calculate_dIh_by_dpi_transpose(
-  scitbx::af::shared<double> dIh,
-  scitbx::af::shared<double> sumgsq,
-  scitbx::sparse::matrix<double> h_index_mat,
-  scitbx::sparse::matrix<double> derivatives) {
-  // derivatives is a matrix where rows are params and cols are reflections
-  int n_params = derivatives.n_rows();
-  int n_groups = h_index_mat.n_cols();
-  scitbx::sparse::matrix<double> dIh_by_dpi(n_params, n_groups);
-
-  for (int i = 0; i < h_index_mat.n_cols(); ++i) {
-    const col_type column = h_index_mat.col(i);
-    // first loop over h_idx to get indices for a reflection group
-    column.compact();
-    scitbx::sparse::vector<double> deriv_of_group_by_params(n_params);
-    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
-      // it.index gives index of a refl from group i
-      int refl_idx = it.index();
-      const col_type dgidx_by_dpi = derivatives.col(refl_idx);
-      // deriv of one refl wrt all params
-      for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
-           dgit != dgidx_by_dpi.end();
-           ++dgit) {
-        // dgit.index indicates which params have nonzero derivs
-        dIh_by_dpi(dgit.index(), i) += (dIh[refl_idx] * *dgit / sumgsq[i]);
-      }
-    }
-  }
-  dIh_by_dpi.compact();
-  return dIh_by_dpi;
-}
-
-scitbx::sparse::matrix<double> calc_jacobian(scitbx::sparse::matrix<double> derivatives,
-                                             scitbx::sparse::matrix<double> h_index_mat,
-                                             scitbx::af::shared<double> Ih,
-                                             scitbx::af::shared<double> g,
-                                             scitbx::af::shared<double> dIh,
-                                             scitbx::af::shared<double> sumgsq) {
-  // derivatives is a matrix where rows are params and cols are reflections
-  int n_params = derivatives.n_rows();
-  int n_refl = derivatives.n_cols();
-
-  scitbx::sparse::matrix<double> dIhbydpiT =
-    calculate_dIh_by_dpi_transpose(dIh, sumgsq, h_index_mat, derivatives);
-  scitbx::sparse::matrix<double> Jacobian(n_refl, n_params);
-
-  for (int i = 0; i < h_index_mat.n_cols(); ++i) {
-    const col_type column = h_index_mat.col(i);
-    // first loop over h_idx to get indices for a reflection group
-    column.compact();
-    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
-      // it.index gives index of a refl from group i
-      int refl_idx = it.index();
-      const col_type dgidx_by_dpi = derivatives.col(refl_idx);
-      // deriv of one refl wrt all params
-      dgidx_by_dpi.compact();
-      // loop over nonzero elements of dgidx by dpi
-      for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
-           dgit != dgidx_by_dpi.end();
-           ++dgit) {
-        // dgit.index indicates which params have nonzero derivs
-        Jacobian(refl_idx, dgit.index()) -= *dgit * Ih[refl_idx];
-      }
-      // now loop over nonzero elements of dIhbydpi
-      // get col corresponding to group
-      const col_type dIh_col = dIhbydpiT.col(i);
-      // now loop over nonzero params
-      for (col_type::const_iterator dIit = dIh_col.begin(); dIit != dIh_col.end();
-           ++dIit) {
-        Jacobian(refl_idx, dIit.index()) -= g[refl_idx] * *dIit;
-      }
-    }
-  }
-  Jacobian.compact();
-  return Jacobian;
-}
-
 scitbx::sparse::matrix<double> row_multiply(scitbx::sparse::matrix<double> m,
                                             scitbx::af::const_ref<double> v) {
   DIALS_ASSERT(m.n_rows() == v.size());
@@ -339,6 +255,84 @@ boost::python::tuple determine_outlier_indices(
   return boost::python::make_tuple(outlier_indices, other_potential_outlier_indices);
 }
 
+/**
+ * Sum the values, and the squares of the values, for each block of reflections
+ * into its own row of partial sums
+ */
+struct BinSumJob {
+  static const std::size_t block_size = 16384;
+
+  const double *values;
+  const std::size_t *bin_index;
+  std::size_t n;
+  std::size_t n_bins;
+  double *partial_sums;
+
+  BinSumJob(const double *values_,
+            const std::size_t *bin_index_,
+            std::size_t n_,
+            std::size_t n_bins_,
+            double *partial_sums_)
+      : values(values_),
+        bin_index(bin_index_),
+        n(n_),
+        n_bins(n_bins_),
+        partial_sums(partial_sums_) {}
+
+  void operator()(std::size_t first, std::size_t last) const {
+    for (std::size_t b = first; b < last; ++b) {
+      double *sums = &partial_sums[b * 2 * n_bins];
+      std::size_t end = std::min(n, (b + 1) * block_size);
+      for (std::size_t i = b * block_size; i < end; ++i) {
+        if (bin_index[i] < n_bins) {
+          sums[bin_index[i]] += values[i];
+          sums[n_bins + bin_index[i]] += values[i] * values[i];
+        }
+      }
+    }
+  }
+};
+
+/**
+ * Sum values, and the squares of the values, over bins of reflections. Blocks
+ * of a fixed number of reflections are shared between the threads and their
+ * sums are added in order, so the result does not depend on the number of
+ * threads.
+ * @param values The value for each reflection
+ * @param bin_index The bin of each reflection, or n_bins if it is in no bin
+ * @param n_bins The number of bins
+ * @param nthreads The number of threads
+ * @returns A tuple of the sums and the sums of squares of each bin
+ */
+boost::python::tuple sum_in_bins(const scitbx::af::const_ref<double> &values,
+                                 const scitbx::af::const_ref<std::size_t> &bin_index,
+                                 std::size_t n_bins,
+                                 std::size_t nthreads) {
+  DIALS_ASSERT(values.size() == bin_index.size());
+  DIALS_ASSERT(nthreads > 0);
+  scitbx::af::shared<double> sums(n_bins, 0.0);
+  scitbx::af::shared<double> sums_of_squares(n_bins, 0.0);
+  std::size_t block_size = BinSumJob::block_size;
+  std::size_t n_blocks = (values.size() + block_size - 1) / block_size;
+  if (n_bins == 0 || n_blocks == 0) {
+    return boost::python::make_tuple(sums, sums_of_squares);
+  }
+  std::vector<double> partial_sums(n_blocks * 2 * n_bins, 0.0);
+  dials::util::parallel_for(
+    n_blocks,
+    nthreads,
+    BinSumJob(
+      values.begin(), bin_index.begin(), values.size(), n_bins, &partial_sums[0]));
+  for (std::size_t b = 0; b < n_blocks; ++b) {
+    const double *partial = &partial_sums[b * 2 * n_bins];
+    for (std::size_t j = 0; j < n_bins; ++j) {
+      sums[j] += partial[j];
+      sums_of_squares[j] += partial[n_bins + j];
+    }
+  }
+  return boost::python::make_tuple(sums, sums_of_squares);
+}
+
 scitbx::af::shared<double> calc_sigmasq(
   scitbx::sparse::matrix<double> jacobian_transpose,
   scitbx::sparse::matrix<double> var_cov_matrix) {
@@ -392,6 +386,1128 @@ scitbx::af::shared<scitbx::vec3<double> > rotate_vectors_about_axis(
   return rotated_vectors;
 }
 
+/**
+ * The groups of symmetry equivalent reflections of an Ih table block. The
+ * reflection indices are stored sorted by group (the compressed column layout
+ * of the h_index_matrix), so that each sum over a group is a single pass over
+ * a contiguous range, in the same order as the sparse matrix product. The
+ * groups are shared between threads.
+ */
+class IhTableGroups {
+public:
+  /**
+   * @param group_ids The group of each reflection
+   * @param n_groups The number of groups
+   * @param nthreads The number of threads
+   */
+  IhTableGroups(const scitbx::af::const_ref<std::size_t> &group_ids,
+                std::size_t n_groups,
+                std::size_t nthreads = 1)
+      : group_ids_(group_ids.begin(), group_ids.end()),
+        group_start_(n_groups + 1, 0),
+        refl_(group_ids.size()),
+        nthreads_(nthreads) {
+    DIALS_ASSERT(nthreads > 0);
+    for (std::size_t i = 0; i < group_ids.size(); ++i) {
+      DIALS_ASSERT(group_ids[i] < n_groups);
+      group_start_[group_ids[i] + 1]++;
+    }
+    for (std::size_t j = 0; j < n_groups; ++j) {
+      group_start_[j + 1] += group_start_[j];
+    }
+    std::vector<std::size_t> next(group_start_.begin(), group_start_.end() - 1);
+    for (std::size_t i = 0; i < group_ids.size(); ++i) {
+      refl_[next[group_ids[i]]++] = i;
+    }
+  }
+
+  std::size_t size() const {
+    return refl_.size();
+  }
+
+  std::size_t n_groups() const {
+    return group_start_.size() - 1;
+  }
+
+  /**
+   * @returns The group of each reflection
+   */
+  scitbx::af::shared<std::size_t> group_ids() const {
+    return scitbx::af::shared<std::size_t>(group_ids_.begin(), group_ids_.end());
+  }
+
+  /**
+   * @returns The number of reflections in each group
+   */
+  scitbx::af::shared<double> group_multiplicities() const {
+    scitbx::af::shared<double> result(n_groups());
+    for (std::size_t j = 0; j < result.size(); ++j) {
+      result[j] = group_start_[j + 1] - group_start_[j];
+    }
+    return result;
+  }
+
+  /**
+   * @returns The number of reflections in the group of each reflection
+   */
+  scitbx::af::shared<double> calc_nh() const {
+    return expand(group_multiplicities().const_ref());
+  }
+
+  /**
+   * Sum an array of values for the reflections over each group
+   * @param values The values for each reflection
+   * @returns The sum for each group
+   */
+  scitbx::af::shared<double> sum_in_groups(
+    const scitbx::af::const_ref<double> &values) const {
+    DIALS_ASSERT(values.size() == size());
+    scitbx::af::shared<double> result(n_groups(), 0.0);
+    dials::util::parallel_for(
+      n_groups(), nthreads_, SumJob(this, values.begin(), result.begin()));
+    return result;
+  }
+
+  /**
+   * Sum an array of values for the reflections over each group, and return
+   * the sum for the group of each reflection
+   * @param values The values for each reflection
+   * @returns The sum of the group for each reflection
+   */
+  scitbx::af::shared<double> sum_in_groups_per_refl(
+    const scitbx::af::const_ref<double> &values) const {
+    return expand(sum_in_groups(values).const_ref());
+  }
+
+  /**
+   * Expand an array of values for each group to the reflections
+   * @param values The values for each group
+   * @returns The value of the group for each reflection
+   */
+  scitbx::af::shared<double> expand(
+    const scitbx::af::const_ref<double> &values) const {
+    DIALS_ASSERT(values.size() == n_groups());
+    scitbx::af::shared<double> result(size(), 0.0);
+    dials::util::parallel_for(
+      n_groups(), nthreads_, ExpandJob(this, values.begin(), result.begin()));
+    return result;
+  }
+
+  /**
+   * Calculate the best estimate of the intensity of each group,
+   * Ih = sum(g w I) / sum(g^2 w), for the group of each reflection
+   * @param g The inverse scale factors
+   * @param I The intensities
+   * @param w The weights
+   * @returns The Ih values for each reflection
+   */
+  scitbx::af::shared<double> calc_Ih(const scitbx::af::const_ref<double> &g,
+                                     const scitbx::af::const_ref<double> &I,
+                                     const scitbx::af::const_ref<double> &w) const {
+    DIALS_ASSERT(g.size() == size());
+    DIALS_ASSERT(I.size() == size());
+    DIALS_ASSERT(w.size() == size());
+    scitbx::af::shared<double> result(size(), 0.0);
+    dials::util::parallel_for(
+      n_groups(),
+      nthreads_,
+      IhJob(this, g.begin(), I.begin(), w.begin(), result.begin()));
+    return result;
+  }
+
+  /**
+   * Calculate the Jacobian of the residuals I - g Ih with respect to the
+   * parameters, in a single pass over each group. For reflection i of a group,
+   * dr_i/dp = -Ih dg_i/dp - g_i dIh/dp, where the derivative of Ih for the group
+   * is dIh/dp = sum_j (I_j - 2 Ih g_j) w_j dg_j/dp / sum_j g_j^2 w_j.
+   * @param derivatives The n_refl x n_params matrix of derivatives of g
+   * @param g The inverse scale factors
+   * @param I The intensities
+   * @param w The weights
+   * @param Ih The Ih values for each reflection
+   * @returns The n_refl x n_params Jacobian
+   */
+  scitbx::sparse::matrix<double> calc_jacobian(
+    scitbx::sparse::matrix<double> derivatives,
+    const scitbx::af::const_ref<double> &g,
+    const scitbx::af::const_ref<double> &I,
+    const scitbx::af::const_ref<double> &w,
+    const scitbx::af::const_ref<double> &Ih) const {
+    DIALS_ASSERT(derivatives.n_rows() == size());
+    DIALS_ASSERT(g.size() == size());
+    DIALS_ASSERT(I.size() == size());
+    DIALS_ASSERT(w.size() == size());
+    DIALS_ASSERT(Ih.size() == size());
+    std::size_t n_params = derivatives.n_cols();
+
+    // call compact to ensure that each elt of the matrix is only defined once
+    derivatives.compact();
+    dials::refinement::detail::SparseRows rows(derivatives);
+    std::vector<GroupJacobian> blocks(n_groups());
+    dials::util::parallel_for(
+      n_groups(),
+      nthreads_,
+      JacobianJob(
+        this, &rows, n_params, g.begin(), I.begin(), w.begin(), Ih.begin(), &blocks));
+
+    // Fill the matrix in reflection order, so each column is filled in order
+    std::vector<std::size_t> position(size());
+    for (std::size_t j = 0; j < n_groups(); ++j) {
+      for (std::size_t k = group_start_[j]; k < group_start_[j + 1]; ++k) {
+        position[refl_[k]] = k - group_start_[j];
+      }
+    }
+    scitbx::sparse::matrix<double> jacobian(size(), n_params);
+    for (std::size_t i = 0; i < size(); ++i) {
+      const GroupJacobian &block = blocks[group_ids_[i]];
+      std::size_t n_cols = block.cols.size();
+      const double *values = &block.values[position[i] * n_cols];
+      for (std::size_t c = 0; c < n_cols; ++c) {
+        jacobian(i, block.cols[c]) = values[c];
+      }
+    }
+    jacobian.compact();
+    return jacobian;
+  }
+
+  /**
+   * Limit the weights of the reflections in each group to ten times the
+   * median weight of the group
+   * @param weights The weights
+   * @returns The limited weights
+   */
+  scitbx::af::shared<double> limit_outlier_weights(
+    const scitbx::af::const_ref<double> &weights) const {
+    DIALS_ASSERT(weights.size() == size());
+    scitbx::af::shared<double> result(weights.begin(), weights.end());
+    dials::util::parallel_for(
+      n_groups(), nthreads_, LimitWeightsJob(this, result.begin()));
+    return result;
+  }
+
+  /**
+   * Find the outliers in groups of more than two reflections from the
+   * normalised deviations of each reflection from the weighted mean of the
+   * other reflections of its group,
+   * (I - g sum(w g I)' / sum(w g^2)') / sqrt(1 / w + g^2 / sum(w g^2)')
+   * The reflection with the largest deviation above zmax is an outlier, and
+   * the other reflections of its group are potential outliers.
+   * @param I The intensities
+   * @param g The inverse scale factors
+   * @param w The weights
+   * @param zmax The threshold for the normalised deviations
+   * @returns A tuple of the outlier indices and the other potential outliers
+   */
+  boost::python::tuple determine_outlier_indices(
+    const scitbx::af::const_ref<double> &I,
+    const scitbx::af::const_ref<double> &g,
+    const scitbx::af::const_ref<double> &w,
+    double zmax) const {
+    DIALS_ASSERT(I.size() == size());
+    DIALS_ASSERT(g.size() == size());
+    DIALS_ASSERT(w.size() == size());
+    std::vector<std::size_t> index_of_max(n_groups(), size());
+    dials::util::parallel_for(
+      n_groups(),
+      nthreads_,
+      OutlierJob(this, I.begin(), g.begin(), w.begin(), zmax, &index_of_max[0]));
+    scitbx::af::shared<std::size_t> outlier_indices;
+    scitbx::af::shared<std::size_t> other_potential_outlier_indices;
+    for (std::size_t j = 0; j < n_groups(); ++j) {
+      if (index_of_max[j] == size()) {
+        continue;
+      }
+      outlier_indices.push_back(index_of_max[j]);
+      for (std::size_t k = group_start_[j]; k < group_start_[j + 1]; ++k) {
+        if (refl_[k] != index_of_max[j]) {
+          other_potential_outlier_indices.push_back(refl_[k]);
+        }
+      }
+    }
+    return boost::python::make_tuple(outlier_indices, other_potential_outlier_indices);
+  }
+
+private:
+  /**
+   * The rows of the Jacobian for the reflections of a group, which share the
+   * parameters that any reflection of the group depends on
+   */
+  struct GroupJacobian {
+    std::vector<std::size_t> cols;
+    std::vector<double> values;
+  };
+
+  struct SumJob {
+    const IhTableGroups *groups;
+    const double *values;
+    double *result;
+
+    SumJob(const IhTableGroups *groups_, const double *values_, double *result_)
+        : groups(groups_), values(values_), result(result_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t j = first; j < last; ++j) {
+        double sum = 0.0;
+        for (std::size_t k = groups->group_start_[j]; k < groups->group_start_[j + 1];
+             ++k) {
+          sum += values[groups->refl_[k]];
+        }
+        result[j] = sum;
+      }
+    }
+  };
+
+  struct ExpandJob {
+    const IhTableGroups *groups;
+    const double *values;
+    double *result;
+
+    ExpandJob(const IhTableGroups *groups_, const double *values_, double *result_)
+        : groups(groups_), values(values_), result(result_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t j = first; j < last; ++j) {
+        for (std::size_t k = groups->group_start_[j]; k < groups->group_start_[j + 1];
+             ++k) {
+          result[groups->refl_[k]] = values[j];
+        }
+      }
+    }
+  };
+
+  struct IhJob {
+    const IhTableGroups *groups;
+    const double *g;
+    const double *I;
+    const double *w;
+    double *result;
+
+    IhJob(const IhTableGroups *groups_,
+          const double *g_,
+          const double *I_,
+          const double *w_,
+          double *result_)
+        : groups(groups_), g(g_), I(I_), w(w_), result(result_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t j = first; j < last; ++j) {
+        std::size_t begin = groups->group_start_[j];
+        std::size_t end = groups->group_start_[j + 1];
+        double sumgsq = 0.0;
+        double sumgI = 0.0;
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          sumgsq += g[i] * g[i] * w[i];
+          sumgI += g[i] * I[i] * w[i];
+        }
+        double Ih = sumgI / sumgsq;
+        for (std::size_t k = begin; k < end; ++k) {
+          result[groups->refl_[k]] = Ih;
+        }
+      }
+    }
+  };
+
+  struct JacobianJob {
+    const IhTableGroups *groups;
+    const dials::refinement::detail::SparseRows *rows;
+    std::size_t n_params;
+    const double *g;
+    const double *I;
+    const double *w;
+    const double *Ih;
+    std::vector<GroupJacobian> *blocks;
+
+    JacobianJob(const IhTableGroups *groups_,
+                const dials::refinement::detail::SparseRows *rows_,
+                std::size_t n_params_,
+                const double *g_,
+                const double *I_,
+                const double *w_,
+                const double *Ih_,
+                std::vector<GroupJacobian> *blocks_)
+        : groups(groups_),
+          rows(rows_),
+          n_params(n_params_),
+          g(g_),
+          I(I_),
+          w(w_),
+          Ih(Ih_),
+          blocks(blocks_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      // The derivatives of Ih for one group at a time, reset after each group
+      std::vector<double> dIh_by_dp(n_params, 0.0);
+      std::vector<bool> used(n_params, false);
+      for (std::size_t j = first; j < last; ++j) {
+        std::size_t begin = groups->group_start_[j];
+        std::size_t end = groups->group_start_[j + 1];
+        double sumgsq = 0.0;
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          sumgsq += g[i] * g[i] * w[i];
+        }
+        GroupJacobian &block = (*blocks)[j];
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          double dIh = (I[i] - Ih[i] * 2.0 * g[i]) * w[i];
+          for (std::size_t pos = rows->lower_bound(i, 0); pos < rows->row_end(i);
+               ++pos) {
+            std::size_t p = rows->col(pos);
+            if (!used[p]) {
+              used[p] = true;
+              block.cols.push_back(p);
+            }
+            dIh_by_dp[p] += dIh * rows->value(pos) / sumgsq;
+          }
+        }
+        std::sort(block.cols.begin(), block.cols.end());
+
+        // The parameters of each reflection are a subset of those of the group
+        std::size_t n_cols = block.cols.size();
+        block.values.resize((end - begin) * n_cols);
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          double *values = &block.values[(k - begin) * n_cols];
+          std::size_t pos = rows->lower_bound(i, 0);
+          for (std::size_t c = 0; c < n_cols; ++c) {
+            std::size_t p = block.cols[c];
+            double value = 0.0;
+            if (pos < rows->row_end(i) && rows->col(pos) == p) {
+              value -= rows->value(pos) * Ih[i];
+              ++pos;
+            }
+            values[c] = value - g[i] * dIh_by_dp[p];
+          }
+        }
+        for (std::size_t c = 0; c < n_cols; ++c) {
+          dIh_by_dp[block.cols[c]] = 0.0;
+          used[block.cols[c]] = false;
+        }
+      }
+    }
+  };
+
+  struct LimitWeightsJob {
+    const IhTableGroups *groups;
+    double *weights;
+
+    LimitWeightsJob(const IhTableGroups *groups_, double *weights_)
+        : groups(groups_), weights(weights_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      scitbx::math::median_functor med;
+      std::vector<double> theseweights;
+      for (std::size_t j = first; j < last; ++j) {
+        std::size_t begin = groups->group_start_[j];
+        std::size_t end = groups->group_start_[j + 1];
+        if (begin == end) {
+          continue;
+        }
+        theseweights.clear();
+        for (std::size_t k = begin; k < end; ++k) {
+          theseweights.push_back(weights[groups->refl_[k]]);
+        }
+        double ceil = 10.0
+                      * med(scitbx::af::ref<double>(&theseweights[0],
+                                                    theseweights.size()));
+        for (std::size_t k = begin; k < end; ++k) {
+          double &weight = weights[groups->refl_[k]];
+          if (weight > ceil) {
+            weight = ceil;
+          }
+        }
+      }
+    }
+  };
+
+  struct OutlierJob {
+    const IhTableGroups *groups;
+    const double *I;
+    const double *g;
+    const double *w;
+    double zmax;
+    std::size_t *index_of_max;
+
+    OutlierJob(const IhTableGroups *groups_,
+               const double *I_,
+               const double *g_,
+               const double *w_,
+               double zmax_,
+               std::size_t *index_of_max_)
+        : groups(groups_),
+          I(I_),
+          g(g_),
+          w(w_),
+          zmax(zmax_),
+          index_of_max(index_of_max_) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t j = first; j < last; ++j) {
+        std::size_t begin = groups->group_start_[j];
+        std::size_t end = groups->group_start_[j + 1];
+        if (end - begin <= 2) {
+          continue;
+        }
+        double wgIsum = 0.0;
+        double wg2sum = 0.0;
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          wgIsum += w[i] * g[i] * I[i];
+          wg2sum += w[i] * g[i] * g[i];
+        }
+        double max_z = zmax;
+        for (std::size_t k = begin; k < end; ++k) {
+          std::size_t i = groups->refl_[k];
+          double wgIsum_others = wgIsum - (w[i] * g[i] * I[i]);
+          double wg2sum_others = wg2sum - (w[i] * g[i] * g[i]);
+          // guard against zero division errors - can happen due to rounding
+          // errors or bad data giving g values are very small
+          double z = 1000;
+          if (wg2sum_others != 0.0) {
+            z = std::abs(
+              (I[i] - (g[i] * wgIsum_others / wg2sum_others))
+              / (std::sqrt((1.0 / w[i]) + (g[i] * g[i] / wg2sum_others))));
+          }
+          if (z > max_z) {
+            max_z = z;
+            index_of_max[j] = i;
+          }
+        }
+      }
+    }
+  };
+
+  std::vector<std::size_t> group_ids_;
+  std::vector<std::size_t> group_start_;
+  std::vector<std::size_t> refl_;
+  std::size_t nthreads_;
+};
+
+/**
+ * Evaluate the inverse scales of the components of a scaling model, and their
+ * derivatives, for an Ih table block. Each component is given by a sparse
+ * matrix D, with a row for each reflection and a column for each parameter,
+ * and has an inverse scale that is either linear in the parameters,
+ * s = c + D.p, as for the smooth and absorption components, or exponential,
+ * s = exp(f * D.p) with a factor f for each reflection, as for the B-factor
+ * and dose decay components. The matrices only change when the reflections of
+ * the block do, so they are kept and each evaluation with new parameters is a
+ * single threaded pass over the reflections, forming the product of the
+ * component scales, followed by a threaded pass over the parameters to fill
+ * in the derivatives of the product.
+ */
+class ScaleComponentsEvaluator {
+public:
+  /**
+   * @param n_obs The number of reflections in the block
+   */
+  ScaleComponentsEvaluator(std::size_t n_obs) : n_obs_(n_obs), n_params_(0) {}
+
+  /**
+   * Add a component with the inverse scale s = offset + D.p
+   * @param D The derivatives of the inverse scale with respect to all the
+   *          parameters of the component
+   * @param offset The inverse scale for zero parameters
+   * @param n_fixed The number of leading parameters that are not refined
+   */
+  void add_linear_component(const scitbx::sparse::matrix<double> &D,
+                            double offset,
+                            std::size_t n_fixed = 0) {
+    add_component(D, false, offset, scitbx::af::const_ref<double>(0, 0), n_fixed);
+  }
+
+  /**
+   * Add a component with the inverse scale s = exp(f * D.p)
+   * @param D The matrix
+   * @param factors The factor f of each reflection
+   * @param n_fixed The number of leading parameters that are not refined
+   */
+  void add_exponential_component(const scitbx::sparse::matrix<double> &D,
+                                 const scitbx::af::const_ref<double> &factors,
+                                 std::size_t n_fixed = 0) {
+    DIALS_ASSERT(factors.size() == n_obs_);
+    add_component(D, true, 0.0, factors, n_fixed);
+  }
+
+  std::size_t n_obs() const {
+    return n_obs_;
+  }
+
+  std::size_t n_components() const {
+    return components_.size();
+  }
+
+  /**
+   * @returns The number of refined parameters of all the components
+   */
+  std::size_t n_params() const {
+    return n_params_;
+  }
+
+  /**
+   * Evaluate the inverse scales and derivatives for a set of parameters. As
+   * in RefinerCalculator, the derivatives of a model with a single component
+   * are those of the component alone.
+   * @param parameters All the parameters of each component in turn
+   * @param constant_g The inverse scales of the fixed components, or empty
+   * @param nthreads The number of threads
+   * @returns A tuple of the inverse scales and derivatives of the block
+   */
+  boost::python::tuple evaluate(const scitbx::af::const_ref<double> &parameters,
+                                const scitbx::af::const_ref<double> &constant_g,
+                                std::size_t nthreads = 1) const {
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_ASSERT(constant_g.size() == 0 || constant_g.size() == n_obs_);
+    std::size_t n_all = 0;
+    for (std::size_t c = 0; c < components_.size(); ++c) {
+      n_all += components_[c].D.n_cols();
+    }
+    DIALS_ASSERT(parameters.size() == n_all);
+
+    scitbx::af::shared<double> scales(n_obs_, 1.0);
+    std::vector<double> factors(n_obs_ * components_.size(), 0.0);
+    double *f = factors.empty() ? NULL : &factors[0];
+    dials::util::parallel_for(
+      n_obs_,
+      nthreads,
+      ScaleJob(this, parameters.begin(), constant_g, scales.begin(), f));
+
+    scitbx::sparse::matrix<double> derivatives(n_obs_, n_params_);
+    dials::util::parallel_for(
+      n_params_, nthreads, DerivativeJob(this, f, &derivatives));
+    return boost::python::make_tuple(scales, derivatives);
+  }
+
+private:
+  struct Component {
+    scitbx::sparse::matrix<double> D;
+    dials::refinement::detail::SparseRows rows;
+    bool exponential;
+    double offset;
+    std::vector<double> factors;
+    std::size_t n_fixed;
+    std::size_t first_param;
+    std::size_t first_column;
+
+    Component(const scitbx::sparse::matrix<double> &D_) : D(D_), rows(compact(D)) {}
+
+    static const scitbx::sparse::matrix<double> &compact(
+      scitbx::sparse::matrix<double> &m) {
+      m.compact();
+      return m;
+    }
+  };
+
+  void add_component(const scitbx::sparse::matrix<double> &D,
+                     bool exponential,
+                     double offset,
+                     const scitbx::af::const_ref<double> &factors,
+                     std::size_t n_fixed) {
+    DIALS_ASSERT(D.n_rows() == n_obs_);
+    DIALS_ASSERT(n_fixed <= D.n_cols());
+    std::size_t first_param = 0;
+    if (!components_.empty()) {
+      first_param = components_.back().first_param + components_.back().D.n_cols();
+    }
+    components_.push_back(Component(D));
+    Component &c = components_.back();
+    c.exponential = exponential;
+    c.offset = offset;
+    c.factors.assign(factors.begin(), factors.end());
+    c.n_fixed = n_fixed;
+    c.first_param = first_param;
+    c.first_column = n_params_;
+    n_params_ += D.n_cols() - n_fixed;
+  }
+
+  /**
+   * For a range of reflections, calculate the inverse scale of each component
+   * and the product of them all, and the factor multiplying the derivatives
+   * of each component in the derivatives of the product.
+   */
+  class ScaleJob {
+  public:
+    ScaleJob(const ScaleComponentsEvaluator *evaluator,
+             const double *parameters,
+             const scitbx::af::const_ref<double> &constant_g,
+             double *scales,
+             double *factors)
+        : evaluator_(evaluator),
+          parameters_(parameters),
+          constant_g_(constant_g),
+          scales_(scales),
+          factors_(factors) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      const std::vector<Component> &components = evaluator_->components_;
+      const std::size_t nc = components.size();
+      std::vector<double> s(nc);
+      for (std::size_t i = first; i < last; ++i) {
+        double g = constant_g_.size() ? constant_g_[i] : 1.0;
+        double product = g;
+        for (std::size_t c = 0; c < nc; ++c) {
+          const Component &comp = components[c];
+          const double *p = parameters_ + comp.first_param;
+          double v = 0.0;
+          std::size_t end = comp.rows.row_end(i);
+          for (std::size_t pos = comp.rows.lower_bound(i, 0); pos < end; ++pos) {
+            v += comp.rows.value(pos) * p[comp.rows.col(pos)];
+          }
+          s[c] = comp.exponential ? std::exp(comp.factors[i] * v) : comp.offset + v;
+          product *= s[c];
+        }
+        scales_[i] = product;
+        for (std::size_t c = 0; c < nc; ++c) {
+          const Component &comp = components[c];
+          // The product of the other scales, formed directly as a component
+          // scale may be zero
+          double others = nc > 1 ? g : 1.0;
+          for (std::size_t c2 = 0; c2 < nc; ++c2) {
+            if (c2 != c) {
+              others *= s[c2];
+            }
+          }
+          if (comp.exponential) {
+            others *= comp.factors[i] * s[c];
+          }
+          factors_[i * nc + c] = others;
+        }
+      }
+    }
+
+  private:
+    const ScaleComponentsEvaluator *evaluator_;
+    const double *parameters_;
+    scitbx::af::const_ref<double> constant_g_;
+    double *scales_;
+    double *factors_;
+  };
+
+  /**
+   * Fill in a range of the columns of the derivatives. Each column is only
+   * written by one thread.
+   */
+  class DerivativeJob {
+  public:
+    DerivativeJob(const ScaleComponentsEvaluator *evaluator,
+                  const double *factors,
+                  scitbx::sparse::matrix<double> *derivatives)
+        : evaluator_(evaluator), factors_(factors), derivatives_(derivatives) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      const std::vector<Component> &components = evaluator_->components_;
+      const std::size_t nc = components.size();
+      std::size_t c = 0;
+      for (std::size_t j = first; j < last; ++j) {
+        while (j >= components[c].first_column + components[c].D.n_cols()
+                      - components[c].n_fixed) {
+          c++;
+        }
+        const Component &comp = components[c];
+        std::size_t col = j - comp.first_column + comp.n_fixed;
+        const scitbx::sparse::matrix<double>::column_type &column = comp.D.col(col);
+        for (scitbx::sparse::matrix<double>::column_type::const_iterator p =
+               column.begin();
+             p != column.end();
+             ++p) {
+          std::size_t i = p.index();
+          (*derivatives_)(i, j) = *p * factors_[i * nc + c];
+        }
+      }
+    }
+
+  private:
+    const ScaleComponentsEvaluator *evaluator_;
+    const double *factors_;
+    scitbx::sparse::matrix<double> *derivatives_;
+  };
+
+  std::size_t n_obs_;
+  std::size_t n_params_;
+  std::vector<Component> components_;
+};
+
+/**
+ * The groups chosen in one resolution bin by the quasi-random reflection
+ * selection, see quasi_random_selection
+ */
+struct QuasiRandomBinResult {
+  std::vector<std::size_t> rows;
+  std::vector<double> totals;
+  std::size_t n_groups_used;
+
+  QuasiRandomBinResult() : n_groups_used(0) {}
+};
+
+/**
+ * Choose the groups of a resolution bin. The columns of the class matrix are
+ * the groups of the bin, sorted by the number of classes each covers, and the
+ * set of groups is built up by adding the first unused group that covers the
+ * class with the fewest reflections so far, as in _loop_over_class_matrix in
+ * reflection_selection.py. Rather than scanning all the unused groups for
+ * each addition, each class keeps a cursor into the sorted groups that cover
+ * it, so the whole bin takes a single pass over the nonzero entries.
+ */
+class QuasiRandomBinSelector {
+public:
+  QuasiRandomBinSelector(std::size_t n_classes,
+                         std::size_t n_cols,
+                         const std::vector<double> &counts,
+                         double min_per_class,
+                         double min_total,
+                         double max_total)
+      : n_classes_(n_classes),
+        n_cols_(n_cols),
+        counts_(counts),
+        min_per_class_(min_per_class),
+        min_total_(min_total),
+        max_total_(max_total),
+        used_(n_cols, false),
+        class_start_(n_classes + 1, 0),
+        cursor_(n_classes, 0) {
+    // The columns covering each class, in order
+    for (std::size_t j = 0; j < n_cols; ++j) {
+      for (std::size_t c = 0; c < n_classes; ++c) {
+        if (counts_[j * n_classes + c] != 0.0) {
+          class_start_[c + 1]++;
+        }
+      }
+    }
+    for (std::size_t c = 0; c < n_classes; ++c) {
+      class_start_[c + 1] += class_start_[c];
+      cursor_[c] = class_start_[c];
+    }
+    class_cols_.resize(class_start_[n_classes]);
+    std::vector<std::size_t> next(cursor_);
+    for (std::size_t j = 0; j < n_cols; ++j) {
+      for (std::size_t c = 0; c < n_classes; ++c) {
+        if (counts_[j * n_classes + c] != 0.0) {
+          class_cols_[next[c]++] = j;
+        }
+      }
+    }
+  }
+
+  /**
+   * @param totals The number of reflections chosen in each class
+   * @returns Whether each column was chosen
+   */
+  const std::vector<bool> &select(std::vector<double> &totals) {
+    totals.assign(counts_.begin(), counts_.begin() + n_classes_);
+    used_[0] = true;
+    n_unused_ = n_cols_ - 1;
+    std::vector<double> deficit(n_classes_, 0.0);
+    double total_deficit = 0.0;
+    while (min_value(totals) < min_per_class_
+           && (sum(totals) - total_deficit) < max_total_) {
+      std::size_t row = first_min(totals);
+      if (!add_next_column(row, totals)) {
+        double current = totals[row];
+        deficit[row] = min_per_class_ - current;
+        total_deficit += min_per_class_ - current;
+        totals[row] = min_per_class_;
+      }
+      if (sum(totals) > max_total_) {
+        subtract(totals, deficit);
+        return used_;
+      }
+    }
+    subtract(totals, deficit);
+    double n = sum(totals);
+    if (n < min_total_ && n_unused_ > 0) {
+      std::size_t c = 0;
+      for (std::size_t i = 0; i < n_classes_; ++i) {
+        if (deficit[i] != 0.0) {
+          c++;
+        }
+      }
+      int multiplier = int(
+        std::floor(min_total_ * (n_classes_ - c) / (n * n_classes_)) + 1);
+      double new_limit = min_per_class_ * multiplier;
+      for (std::size_t i = 0; i < n_classes_; ++i) {
+        if (deficit[i] != 0.0) {
+          totals[i] = new_limit;
+          deficit[i] = deficit[i] + new_limit - min_per_class_;
+        }
+      }
+      while (n_unused_ > 0 && min_value(totals) < new_limit) {
+        std::size_t row = first_min(totals);
+        if (!add_next_column(row, totals)) {
+          double current = totals[row];
+          deficit[row] = new_limit - current;
+          totals[row] = new_limit;
+        }
+      }
+      subtract(totals, deficit);
+    }
+    return used_;
+  }
+
+private:
+  bool add_next_column(std::size_t row, std::vector<double> &totals) {
+    std::size_t &k = cursor_[row];
+    while (k < class_start_[row + 1] && used_[class_cols_[k]]) {
+      k++;
+    }
+    if (k == class_start_[row + 1]) {
+      return false;
+    }
+    std::size_t j = class_cols_[k];
+    used_[j] = true;
+    n_unused_--;
+    for (std::size_t c = 0; c < n_classes_; ++c) {
+      totals[c] += counts_[j * n_classes_ + c];
+    }
+    return true;
+  }
+
+  static double min_value(const std::vector<double> &v) {
+    return *std::min_element(v.begin(), v.end());
+  }
+
+  static std::size_t first_min(const std::vector<double> &v) {
+    return std::min_element(v.begin(), v.end()) - v.begin();
+  }
+
+  static double sum(const std::vector<double> &v) {
+    double result = 0.0;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      result += v[i];
+    }
+    return result;
+  }
+
+  static void subtract(std::vector<double> &v, const std::vector<double> &w) {
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      v[i] -= w[i];
+    }
+  }
+
+  std::size_t n_classes_;
+  std::size_t n_cols_;
+  const std::vector<double> &counts_;
+  double min_per_class_;
+  double min_total_;
+  double max_total_;
+  std::vector<bool> used_;
+  std::size_t n_unused_;
+  std::vector<std::size_t> class_start_;
+  std::vector<std::size_t> cursor_;
+  std::vector<std::size_t> class_cols_;
+};
+
+/**
+ * Run the quasi-random selection for a range of the resolution bins
+ */
+class QuasiRandomSelectionJob {
+public:
+  QuasiRandomSelectionJob(const std::size_t *group_ids,
+                          const std::size_t *class_ids,
+                          const std::size_t *bin_start,
+                          const std::size_t *bin_rows,
+                          std::size_t n_groups,
+                          std::size_t n_classes,
+                          double min_per_class,
+                          double min_total,
+                          double max_total,
+                          QuasiRandomBinResult *results)
+      : group_ids_(group_ids),
+        class_ids_(class_ids),
+        bin_start_(bin_start),
+        bin_rows_(bin_rows),
+        n_groups_(n_groups),
+        n_classes_(n_classes),
+        min_per_class_(min_per_class),
+        min_total_(min_total),
+        max_total_(max_total),
+        results_(results) {}
+
+  void operator()(std::size_t first, std::size_t last) const {
+    std::vector<std::size_t> column(n_groups_, n_groups_);
+    for (std::size_t b = first; b < last; ++b) {
+      const std::size_t *rows = bin_rows_ + bin_start_[b];
+      const std::size_t n_rows = bin_start_[b + 1] - bin_start_[b];
+      if (n_rows == 0) {
+        continue;
+      }
+
+      // The groups of the bin in order, and the number of reflections of
+      // each class in each group
+      std::vector<std::size_t> groups;
+      for (std::size_t i = 0; i < n_rows; ++i) {
+        groups.push_back(group_ids_[rows[i]]);
+      }
+      std::sort(groups.begin(), groups.end());
+      groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+      const std::size_t n_cols = groups.size();
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        column[groups[j]] = j;
+      }
+      std::vector<double> counts(n_cols * n_classes_, 0.0);
+      for (std::size_t i = 0; i < n_rows; ++i) {
+        std::size_t c = class_ids_[rows[i]];
+        DIALS_ASSERT(c < n_classes_);
+        counts[column[group_ids_[rows[i]]] * n_classes_ + c] += 1.0;
+      }
+
+      // Sort the groups by the number of classes they cover, keeping the
+      // order of groups covering the same number
+      std::vector<std::size_t> n_covered(n_cols, 0);
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        for (std::size_t c = 0; c < n_classes_; ++c) {
+          if (counts[j * n_classes_ + c] != 0.0) {
+            n_covered[j]++;
+          }
+        }
+      }
+      std::vector<std::size_t> perm(n_cols);
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        perm[j] = j;
+      }
+      std::stable_sort(perm.begin(), perm.end(), MoreCovered(n_covered));
+      std::vector<double> sorted_counts(n_cols * n_classes_);
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        std::copy(counts.begin() + perm[j] * n_classes_,
+                  counts.begin() + (perm[j] + 1) * n_classes_,
+                  sorted_counts.begin() + j * n_classes_);
+      }
+
+      QuasiRandomBinResult &result = results_[b];
+      QuasiRandomBinSelector selector(n_classes_,
+                                      n_cols,
+                                      sorted_counts,
+                                      min_per_class_,
+                                      min_total_,
+                                      max_total_);
+      const std::vector<bool> &used = selector.select(result.totals);
+      std::vector<bool> chosen(n_cols, false);
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        if (used[j]) {
+          chosen[perm[j]] = true;
+          result.n_groups_used++;
+        }
+      }
+      for (std::size_t i = 0; i < n_rows; ++i) {
+        if (chosen[column[group_ids_[rows[i]]]]) {
+          result.rows.push_back(rows[i]);
+        }
+      }
+    }
+  }
+
+private:
+  struct MoreCovered {
+    const std::vector<std::size_t> &n;
+    MoreCovered(const std::vector<std::size_t> &n_) : n(n_) {}
+    bool operator()(std::size_t a, std::size_t b) const {
+      return n[a] > n[b];
+    }
+  };
+
+  const std::size_t *group_ids_;
+  const std::size_t *class_ids_;
+  const std::size_t *bin_start_;
+  const std::size_t *bin_rows_;
+  std::size_t n_groups_;
+  std::size_t n_classes_;
+  double min_per_class_;
+  double min_total_;
+  double max_total_;
+  QuasiRandomBinResult *results_;
+};
+
+/**
+ * Select a well connected subset of the reflections of an Ih table block, as
+ * described in reflection_selection.py. In each resolution bin, a matrix of
+ * the number of reflections of each class (dataset) in each symmetry group
+ * is built and groups are added, most connected first, until each class has
+ * min_per_class reflections or the bin has max_total. The bins are
+ * independent and are shared between the threads, and the result does not
+ * depend on the number of threads.
+ * @param group_ids The symmetry group of each reflection
+ * @param class_ids The class of each reflection
+ * @param bin_ids The resolution bin of each reflection
+ * @param n_groups The number of groups
+ * @param n_classes The number of classes
+ * @param n_bins The number of bins
+ * @param min_per_class The target number of reflections per class in a bin
+ * @param min_total The minimum number of reflections to choose in a bin
+ * @param max_total The maximum number of reflections to choose in a bin
+ * @param nthreads The number of threads
+ * @returns A tuple of the indices of the chosen reflections, in order within
+ *          each bin and then by bin, and for each bin the number of groups
+ *          and reflections chosen and the number of reflections chosen in
+ *          each class (an n_bins x n_classes array)
+ */
+boost::python::tuple quasi_random_selection(
+  const scitbx::af::const_ref<std::size_t> &group_ids,
+  const scitbx::af::const_ref<std::size_t> &class_ids,
+  const scitbx::af::const_ref<std::size_t> &bin_ids,
+  std::size_t n_groups,
+  std::size_t n_classes,
+  std::size_t n_bins,
+  double min_per_class,
+  double min_total,
+  double max_total,
+  std::size_t nthreads = 1) {
+  DIALS_ASSERT(group_ids.size() == class_ids.size());
+  DIALS_ASSERT(group_ids.size() == bin_ids.size());
+  DIALS_ASSERT(n_classes > 0);
+  DIALS_ASSERT(nthreads > 0);
+
+  // The reflections of each bin, in order
+  std::vector<std::size_t> bin_start(n_bins + 1, 0);
+  for (std::size_t i = 0; i < bin_ids.size(); ++i) {
+    DIALS_ASSERT(bin_ids[i] < n_bins);
+    DIALS_ASSERT(group_ids[i] < n_groups);
+    bin_start[bin_ids[i] + 1]++;
+  }
+  for (std::size_t b = 0; b < n_bins; ++b) {
+    bin_start[b + 1] += bin_start[b];
+  }
+  std::vector<std::size_t> bin_rows(bin_ids.size());
+  std::vector<std::size_t> next(bin_start.begin(), bin_start.end() - 1);
+  for (std::size_t i = 0; i < bin_ids.size(); ++i) {
+    bin_rows[next[bin_ids[i]]++] = i;
+  }
+
+  std::vector<QuasiRandomBinResult> results(n_bins);
+  if (n_bins > 0) {
+    dials::util::parallel_for(n_bins,
+                              nthreads,
+                              QuasiRandomSelectionJob(group_ids.begin(),
+                                                      class_ids.begin(),
+                                                      &bin_start[0],
+                                                      bin_rows.empty() ? NULL
+                                                                       : &bin_rows[0],
+                                                      n_groups,
+                                                      n_classes,
+                                                      min_per_class,
+                                                      min_total,
+                                                      max_total,
+                                                      &results[0]));
+  }
+
+  scitbx::af::shared<std::size_t> selection;
+  scitbx::af::shared<std::size_t> n_groups_used(n_bins, 0);
+  scitbx::af::shared<std::size_t> n_selected(n_bins, 0);
+  scitbx::af::versa<double, scitbx::af::c_grid<2> > totals(
+    scitbx::af::c_grid<2>(n_bins, n_classes), 0.0);
+  for (std::size_t b = 0; b < n_bins; ++b) {
+    const QuasiRandomBinResult &result = results[b];
+    for (std::size_t i = 0; i < result.rows.size(); ++i) {
+      selection.push_back(result.rows[i]);
+    }
+    n_groups_used[b] = result.n_groups_used;
+    n_selected[b] = result.rows.size();
+    for (std::size_t c = 0; c < result.totals.size(); ++c) {
+      totals(b, c) = result.totals[c];
+    }
+  }
+  return boost::python::make_tuple(selection, n_groups_used, n_selected, totals);
+}
+
 /**
  * Spherical harmonic table
  */
@@ -427,108 +1543,287 @@ boost::python::tuple calculate_harmonic_tables_from_selections(
   return boost::python::make_tuple(output_coefficients_list, coefficients_matrix);
 }
 
+/**
+ * The real spherical harmonic terms of the absorption surface, for l = 1 to
+ * lmax and m = -l to l, in the order of the absorption parameters. Rather than
+ * evaluating each term directly, the fully normalised associated Legendre
+ * functions are found with their recurrence in l, and cos(m phi), sin(m phi)
+ * with the angle addition formulae, so all terms for a direction cost
+ * O(lmax^2) operations. The inner loops run over a block of directions so that
+ * they can be vectorised by the compiler. The sign of each term is taken from
+ * nss_spherical_harmonics::spherical_harmonic_direct at a reference direction,
+ * so the terms are the same as those of the direct evaluation.
+ */
+class RealSphericalHarmonics {
+public:
+  static const std::size_t block_size = 256;
+
+  /**
+   * @param lmax The maximum order of the harmonics
+   */
+  RealSphericalHarmonics(int lmax)
+      : lmax_(lmax),
+        a_((lmax + 1) * (lmax + 1), 0.0),
+        b_((lmax + 1) * (lmax + 1), 0.0),
+        cos_factor_((lmax + 1) * (lmax + 1), 0.0),
+        sin_factor_((lmax + 1) * (lmax + 1), 0.0) {
+    DIALS_ASSERT(lmax > 0);
+    double sqrt2 = 1.414213562;
+    for (int m = 0; m <= lmax; ++m) {
+      for (int l = m + 1; l <= lmax; ++l) {
+        a_[index(l, m)] = std::sqrt((4.0 * l * l - 1.0) / (l * l - m * m));
+        double k = l - 1.0;
+        b_[index(l, m)] = std::sqrt((k * k - m * m) / (4.0 * k * k - 1.0));
+      }
+      for (int l = std::max(m, 1); l <= lmax; ++l) {
+        cos_factor_[index(l, m)] = m == 0 ? 1.0 : sqrt2 * pow(-1.0, m);
+        sin_factor_[index(l, m)] = m == 0 ? 0.0 : sqrt2 * pow(-1.0, m);
+      }
+    }
+
+    // Match the phases of the terms to the direct evaluation at a direction
+    // away from the zeros of all of the terms: below the first zero of the
+    // Legendre polynomials in theta, and with 0 < m phi < pi / 2
+    nss_spherical_harmonics<double> nsssphe(
+      lmax, 50000, log_factorial_generator<double>((2 * lmax) + 1));
+    double theta = 1.0 / (lmax + 1);
+    double phi = scitbx::constants::pi / (2.0 * (lmax + 1));
+    std::vector<double> values(n_terms());
+    std::vector<double *> terms(n_terms());
+    for (std::size_t t = 0; t < n_terms(); ++t) {
+      terms[t] = &values[t];
+    }
+    evaluate(&theta, &phi, 1, &terms[0]);
+    for (int l = 1; l <= lmax; ++l) {
+      for (int m = 0; m <= l; ++m) {
+        std::complex<double> Y = nsssphe.spherical_harmonic_direct(l, m, theta, phi);
+        double prefactor = m == 0 ? 1.0 : sqrt2 * pow(-1.0, m);
+        match_phase(prefactor * Y.real(), values[term(l, m)], cos_factor_[index(l, m)]);
+        if (m > 0) {
+          match_phase(
+            prefactor * Y.imag(), values[term(l, -m)], sin_factor_[index(l, m)]);
+        }
+      }
+    }
+  }
+
+  /**
+   * @returns The number of terms, lmax (lmax + 2)
+   */
+  std::size_t n_terms() const {
+    return lmax_ * (lmax_ + 2);
+  }
+
+  /**
+   * Evaluate the terms for a set of directions
+   * @param theta The polar angle of each direction, from 0 to pi
+   * @param phi The azimuthal angle of each direction
+   * @param n The number of directions
+   * @param terms For each term, the array to write the values to
+   */
+  void evaluate(const double *theta,
+                const double *phi,
+                std::size_t n,
+                double *const *terms) const {
+    std::size_t block = block_size;
+    std::vector<double> work(9 * block);
+    double *x = &work[0];
+    double *y = x + block;
+    double *cos_phi = y + block;
+    double *sin_phi = cos_phi + block;
+    double *cos_m_phi = sin_phi + block;
+    double *sin_m_phi = cos_m_phi + block;
+    double *p_mm = sin_m_phi + block;
+    double *p_prev = p_mm + block;
+    double *p = p_prev + block;
+    for (std::size_t first = 0; first < n; first += block) {
+      std::size_t size = std::min(block, n - first);
+      for (std::size_t i = 0; i < size; ++i) {
+        x[i] = std::cos(theta[first + i]);
+        y[i] = std::sin(theta[first + i]);
+        cos_phi[i] = std::cos(phi[first + i]);
+        sin_phi[i] = std::sin(phi[first + i]);
+        cos_m_phi[i] = 1.0;
+        sin_m_phi[i] = 0.0;
+        p_mm[i] = 1.0 / std::sqrt(4.0 * scitbx::constants::pi);
+      }
+      for (int m = 0; m <= lmax_; ++m) {
+        if (m > 0) {
+          double f = std::sqrt((2.0 * m + 1.0) / (2.0 * m));
+          for (std::size_t i = 0; i < size; ++i) {
+            p_mm[i] *= f * y[i];
+            double c = cos_m_phi[i] * cos_phi[i] - sin_m_phi[i] * sin_phi[i];
+            sin_m_phi[i] = sin_m_phi[i] * cos_phi[i] + cos_m_phi[i] * sin_phi[i];
+            cos_m_phi[i] = c;
+          }
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+          p_prev[i] = 0.0;
+          p[i] = p_mm[i];
+        }
+        for (int l = m; l <= lmax_; ++l) {
+          if (l > m) {
+            double a = a_[index(l, m)];
+            double b = b_[index(l, m)];
+            for (std::size_t i = 0; i < size; ++i) {
+              double next = a * (x[i] * p[i] - b * p_prev[i]);
+              p_prev[i] = p[i];
+              p[i] = next;
+            }
+          }
+          if (l == 0) {
+            continue;
+          }
+          double *cos_term = terms[term(l, m)] + first;
+          double fc = cos_factor_[index(l, m)];
+          if (m == 0) {
+            for (std::size_t i = 0; i < size; ++i) {
+              cos_term[i] = fc * p[i];
+            }
+          } else {
+            double *sin_term = terms[term(l, -m)] + first;
+            double fs = sin_factor_[index(l, m)];
+            for (std::size_t i = 0; i < size; ++i) {
+              cos_term[i] = fc * p[i] * cos_m_phi[i];
+              sin_term[i] = fs * p[i] * sin_m_phi[i];
+            }
+          }
+        }
+      }
+    }
+  }
+
+private:
+  std::size_t index(int l, int m) const {
+    return l * (lmax_ + 1) + m;
+  }
+
+  /**
+   * @returns The position of the (l, m) term in the parameter order
+   */
+  static std::size_t term(int l, int m) {
+    return l * l - 1 + l + m;
+  }
+
+  /**
+   * Flip the sign of a factor if the value does not have the sign of the
+   * reference. The magnitudes should agree if the normalisations do.
+   */
+  static void match_phase(double reference, double value, double &factor) {
+    DIALS_ASSERT(std::abs(std::abs(reference) - std::abs(value))
+                 <= 1e-6 * std::abs(reference));
+    if ((reference < 0.0) != (value < 0.0)) {
+      factor = -factor;
+    }
+  }
+
+  int lmax_;
+  std::vector<double> a_;
+  std::vector<double> b_;
+  std::vector<double> cos_factor_;
+  std::vector<double> sin_factor_;
+};
+
 matrix<double> create_sph_harm_table(
   scitbx::af::shared<scitbx::vec2<double> > const s0_theta_phi,
   scitbx::af::shared<scitbx::vec2<double> > const s1_theta_phi,
   int lmax) {
-  nss_spherical_harmonics<double> nsssphe(
-    lmax, 50000, log_factorial_generator<double>((2 * lmax) + 1));
-  int n_abs_param = (2 * lmax) + (pow(double(lmax), 2));
-  int n_obs = s1_theta_phi.size();
+  DIALS_ASSERT(s0_theta_phi.size() == s1_theta_phi.size());
+  RealSphericalHarmonics harmonics(lmax);
+  std::size_t n_abs_param = harmonics.n_terms();
+  std::size_t n_obs = s1_theta_phi.size();
   matrix<double> sph_harm_terms_(n_abs_param, n_obs);
-  double sqrt2 = 1.414213562;
-  int counter = 0;
-  for (int l = 1; l < lmax + 1; l++) {
-    for (int m = -1 * l; m < l + 1; m++) {
-      if (m < 0) {
-        double prefactor = sqrt2 * pow(-1.0, m) / 2.0;
-        for (int i = 0; i < n_obs; i++) {
-          sph_harm_terms_(counter, i) =
-            prefactor
-            * (nsssphe
-                 .spherical_harmonic_direct(
-                   l, -1 * m, s0_theta_phi[i][0], s0_theta_phi[i][1])
-                 .imag()
-               + nsssphe
-                   .spherical_harmonic_direct(
-                     l, -1 * m, s1_theta_phi[i][0], s1_theta_phi[i][1])
-                   .imag());
-        }
-      } else if (m == 0) {
-        for (int i = 0; i < n_obs; i++) {
-          sph_harm_terms_(counter, i) =
-            (0.5
-             * (nsssphe
-                  .spherical_harmonic_direct(
-                    l, 0, s0_theta_phi[i][0], s0_theta_phi[i][1])
-                  .real()
-                + nsssphe
-                    .spherical_harmonic_direct(
-                      l, 0, s1_theta_phi[i][0], s1_theta_phi[i][1])
-                    .real()));
-        }
-      } else {
-        double prefactor = sqrt2 * pow(-1.0, m) / 2.0;
-        for (int i = 0; i < n_obs; i++) {
-          double val = prefactor
-                       * (nsssphe
-                            .spherical_harmonic_direct(
-                              l, m, s0_theta_phi[i][0], s0_theta_phi[i][1])
-                            .real()
-                          + nsssphe
-                              .spherical_harmonic_direct(
-                                l, m, s1_theta_phi[i][0], s1_theta_phi[i][1])
-                              .real());
-          sph_harm_terms_(counter, i) = val;
-        }
-      }
-      counter += 1;
+
+  // Evaluate the terms for the s0 and s1 directions of a block of
+  // observations at a time, and average them
+  std::size_t block = RealSphericalHarmonics::block_size;
+  std::vector<double> theta(2 * block);
+  std::vector<double> phi(2 * block);
+  std::vector<double> values(2 * block * n_abs_param);
+  std::vector<double *> terms(n_abs_param);
+  for (std::size_t first = 0; first < n_obs; first += block) {
+    std::size_t n = std::min(block, n_obs - first);
+    for (std::size_t i = 0; i < n; ++i) {
+      theta[i] = s0_theta_phi[first + i][0];
+      phi[i] = s0_theta_phi[first + i][1];
+      theta[n + i] = s1_theta_phi[first + i][0];
+      phi[n + i] = s1_theta_phi[first + i][1];
+    }
+    for (std::size_t t = 0; t < n_abs_param; ++t) {
+      terms[t] = &values[t * 2 * n];
+    }
+    harmonics.evaluate(&theta[0], &phi[0], 2 * n, &terms[0]);
+    for (std::size_t i = 0; i < n; ++i) {
+      for (std::size_t t = 0; t < n_abs_param; ++t) {
+        sph_harm_terms_(t, first + i) = 0.5 * (terms[t][i] + terms[t][n + i]);
+      }
     }
   }
   return sph_harm_terms_;
 }
 
+/**
+ * Get the values of a spherical harmonic table as a dense n_obs x n_terms
+ * array, e.g. to store them
+ * @param table The n_terms x n_obs table
+ * @returns The values
+ */
+scitbx::af::versa<double, scitbx::af::c_grid<2> > sph_harm_table_as_dense(
+  const matrix<double> &table) {
+  std::size_t n_terms = table.n_rows();
+  std::size_t n_obs = table.n_cols();
+  scitbx::af::versa<double, scitbx::af::c_grid<2> > result(
+    scitbx::af::c_grid<2>(n_obs, n_terms), 0.0);
+  for (std::size_t i = 0; i < n_obs; ++i) {
+    const matrix<double>::column_type &col = table.col(i);
+    for (matrix<double>::column_type::const_iterator p = col.begin(); p != col.end();
+         ++p) {
+      result(i, p.index()) += *p;
+    }
+  }
+  return result;
+}
+
+/**
+ * Create a spherical harmonic table from its dense values, the inverse of
+ * sph_harm_table_as_dense
+ * @param values The n_obs x n_terms values
+ * @returns The n_terms x n_obs table
+ */
+matrix<double> sph_harm_table_from_dense(
+  const scitbx::af::const_ref<double, scitbx::af::c_grid<2> > &values) {
+  std::size_t n_obs = values.accessor()[0];
+  std::size_t n_terms = values.accessor()[1];
+  matrix<double> result(n_terms, n_obs);
+  for (std::size_t i = 0; i < n_obs; ++i) {
+    for (std::size_t t = 0; t < n_terms; ++t) {
+      result(t, i) = values(i, t);
+    }
+  }
+  return result;
+}
+
 boost::python::list create_sph_harm_lookup_table(int lmax, int points_per_degree) {
-  nss_spherical_harmonics<double> nsssphe(
-    lmax, 50000, log_factorial_generator<double>((2 * lmax) + 1));
-  boost::python::list coefficients_list;
-  double sqrt2 = 1.414213562;
+  RealSphericalHarmonics harmonics(lmax);
   int n_items = 360 * 180 * points_per_degree * points_per_degree;
-  for (int l = 1; l < lmax + 1; l++) {
-    for (int m = -1 * l; m < l + 1; m++) {
-      scitbx::af::shared<double> coefficients(n_items);
-      if (m < 0) {
-        double prefactor = sqrt2 * pow(-1.0, m);
-        for (int i = 0; i < n_items; i++) {
-          double theta = (floor(i / (360.0 * points_per_degree)) * scitbx::constants::pi
-                          / (180.0 * points_per_degree));
-          double phi = ((i % (360 * points_per_degree)) * scitbx::constants::pi
-                        / (180.0 * points_per_degree));
-          coefficients[i] =
-            prefactor
-            * (nsssphe.spherical_harmonic_direct(l, -1 * m, theta, phi).imag());
-        }
-      } else if (m == 0) {
-        for (int i = 0; i < n_items; i++) {
-          double theta = (floor(i / (360.0 * points_per_degree)) * scitbx::constants::pi
-                          / (180.0 * points_per_degree));
-          double phi = ((i % (360 * points_per_degree)) * scitbx::constants::pi
-                        / (180.0 * points_per_degree));
-          coefficients[i] = nsssphe.spherical_harmonic_direct(l, 0, theta, phi).real();
-        }
-      } else {
-        double prefactor = sqrt2 * pow(-1.0, m);
-        for (int i = 0; i < n_items; i++) {
-          double theta = (floor(i / (360.0 * points_per_degree)) * scitbx::constants::pi
-                          / (180.0 * points_per_degree));
-          double phi = ((i % (360 * points_per_degree)) * scitbx::constants::pi
-                        / (180.0 * points_per_degree));
-          coefficients[i] =
-            prefactor * (nsssphe.spherical_harmonic_direct(l, m, theta, phi).real());
-        }
-      }
-      coefficients_list.append(coefficients);
-    }
+  std::vector<double> theta(n_items);
+  std::vector<double> phi(n_items);
+  for (int i = 0; i < n_items; i++) {
+    theta[i] = (floor(i / (360.0 * points_per_degree)) * scitbx::constants::pi
+                / (180.0 * points_per_degree));
+    phi[i] = ((i % (360 * points_per_degree)) * scitbx::constants::pi
+              / (180.0 * points_per_degree));
+  }
+  std::vector<scitbx::af::shared<double> > coefficients;
+  std::vector<double *> terms;
+  for (std::size_t t = 0; t < harmonics.n_terms(); ++t) {
+    coefficients.push_back(scitbx::af::shared<double>(n_items));
+    terms.push_back(coefficients.back().begin());
+  }
+  harmonics.evaluate(&theta[0], &phi[0], n_items, &terms[0]);
+  boost::python::list coefficients_list;
+  for (std::size_t t = 0; t < coefficients.size(); ++t) {
+    coefficients_list.append(coefficients[t]);
   }
   return coefficients_list;
 }
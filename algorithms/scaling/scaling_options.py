@@ -159,7 +159,24 @@
       .type = int(value_min=1)
       .help = "Number of blocks to divide the data into for minimisation.
               This also sets the number of processes to use if the option is
-              available."
+              available, and the number of threads for the sums over groups
+              of symmetry equivalent reflections."
+      .expert_level = 2
+    native_components = False
+      .type = bool
+      .help = "Evaluate the inverse scales and derivatives of all the refined
+              model components of each block in one native, threaded pass
+              during minimisation, rather than component by component. This
+              is used when every component supports it, and otherwise the
+              components are evaluated one by one."
+      .expert_level = 3
+    data_cache = None
+      .type = path
+      .help = "A directory in which to keep prepared scaling data (the
+              asymmetric unit miller indices and the absorption correction
+              spherical harmonic tables) between runs, keyed by a hash of the
+              input data. Later runs on the same data, e.g. rescaling after
+              filtering, read these rather than recalculating them."
       .expert_level = 2
     use_free_set = False
       .type = bool
@@ -12,12 +12,15 @@
 import dxtbx.flumpy as flumpy
 from cctbx import miller
 
+from dials.algorithms.scaling import data_cache
 from dials.array_family import flex
 from dials.util.normalisation import quasi_normalisation as _quasi_normalisation
 from dials_scaling_ext import (
     calc_theta_phi,
     create_sph_harm_table,
     rotate_vectors_about_axis,
+    sph_harm_table_as_dense,
+    sph_harm_table_from_dense,
 )
 
 logger = logging.getLogger("dials")
@@ -122,10 +125,24 @@ def align_axis_along_z(alignment_axis, vectors):
 def sph_harm_table(reflection_table, lmax):
     """Calculate the spherical harmonic table for a spherical
     harmonic absorption correction."""
-    theta_phi = calc_theta_phi(reflection_table["s0c"])
-    theta_phi_2 = calc_theta_phi(reflection_table["s1c"])
-    sph_h_t = create_sph_harm_table(theta_phi, theta_phi_2, lmax)
-    return sph_h_t
+
+    def calculate():
+        theta_phi = calc_theta_phi(reflection_table["s0c"])
+        theta_phi_2 = calc_theta_phi(reflection_table["s1c"])
+        return create_sph_harm_table(theta_phi, theta_phi_2, lmax)
+
+    if data_cache.active_cache() is None:
+        return calculate()
+    values = data_cache.cached(
+        "sph_harm_table",
+        [
+            flumpy.to_numpy(reflection_table["s0c"]),
+            flumpy.to_numpy(reflection_table["s1c"]),
+        ],
+        {"lmax": lmax},
+        lambda: {"values": flumpy.to_numpy(sph_harm_table_as_dense(calculate()))},
+    )["values"]
+    return sph_harm_table_from_dense(flumpy.from_numpy(np.ascontiguousarray(values)))
 
 
 def quasi_normalisation(reflection_table, experiment):
@@ -12,7 +12,7 @@
 
 from dials.algorithms.scaling.scaling_restraints import ScalingRestraintsCalculator
 from dials.array_family import flex
-from dials_scaling_ext import calc_dIh_by_dpi, calc_jacobian, row_multiply
+from dials_scaling_ext import calc_dIh_by_dpi, row_multiply
 
 
 class ScalingTarget:
@@ -99,19 +99,12 @@ def calculate_gradients(Ih_table):
     @staticmethod
     def calculate_jacobian(Ih_table):
         """Calculate the jacobian matrix, size Ih_table.size by len(self.apm.x)."""
-        gsq = np.square(Ih_table.inverse_scale_factors) * Ih_table.weights
-        sumgsq = Ih_table.sum_in_groups(gsq)
-        dIh = (
-            Ih_table.intensities
-            - (Ih_table.Ih_values * 2.0 * Ih_table.inverse_scale_factors)
-        ) * Ih_table.weights
-        jacobian = calc_jacobian(
-            Ih_table.derivatives.transpose(),
-            Ih_table.h_index_matrix,
-            flumpy.from_numpy(Ih_table.Ih_values),
+        jacobian = Ih_table.groups.calc_jacobian(
+            Ih_table.derivatives,
             flumpy.from_numpy(Ih_table.inverse_scale_factors),
-            flumpy.from_numpy(dIh),
-            flumpy.from_numpy(sumgsq),
+            flumpy.from_numpy(Ih_table.intensities),
+            flumpy.from_numpy(Ih_table.weights),
+            flumpy.from_numpy(Ih_table.Ih_values),
         )
         return jacobian
 
@@ -19,10 +19,14 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   using namespace boost::python;
 
   void export_find_overlapping() {
-    def("find_overlapping", &find_overlapping, (arg("bboxes")));
-    def("find_overlapping", &find_overlapping_multi_panel, (arg("bbox"), arg("panel")));
+    def("find_overlapping", &find_overlapping, (arg("bboxes"), arg("nthreads") = 1));
+    def("find_overlapping",
+        &find_overlapping_multi_panel,
+        (arg("bbox"), arg("panel"), arg("nthreads") = 1));
 
-    class_<OverlapFinder>("OverlapFinder").def("__call__", &OverlapFinder::operator());
+    class_<OverlapFinder>("OverlapFinder")
+      .def(init<std::size_t>((arg("nthreads") = 1)))
+      .def("__call__", &OverlapFinder::operator());
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -18,6 +18,8 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
 
   void export_mask_overlapping() {
     class_<MaskOverlapping>("MaskOverlapping")
+      .def(init<bool>((arg("by_cluster"))))
+      .def("by_cluster", &MaskOverlapping::by_cluster)
       .def("__call__",
            &MaskOverlapping::operator(),
            (arg("shoeboxes"), arg("coords"), arg("adjacency_list")));
@@ -18,9 +18,15 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   using namespace boost::python;
 
   void export_overload_checker() {
+    typedef af::shared<bool> (OverloadChecker::*call_shoeboxes)(
+      const af::const_ref<int>, af::ref<Shoebox<> >) const;
+    typedef af::shared<bool> (OverloadChecker::*call_arena)(
+      const af::const_ref<int>, ShoeboxArena<> &) const;
+
     class_<OverloadChecker>("OverloadChecker")
       .def("add", &OverloadChecker::add)
-      .def("__call__", &OverloadChecker::operator());
+      .def("__call__", (call_shoeboxes)&OverloadChecker::operator())
+      .def("__call__", (call_arena)&OverloadChecker::operator());
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -11,11 +11,15 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_FIND_OVERLAPPING_H
 #define DIALS_ALGORITHMS_INTEGRATION_FIND_OVERLAPPING_H
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/adjacency_list.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/algorithms/spatial_indexing/detect_collisions.h>
 #include <dials/error.h>
 
@@ -60,118 +64,335 @@ namespace dials { namespace algorithms { namespace shoebox {
   using dials::model::AdjacencyList;
   using scitbx::af::int6;
 
-  /**
-   * Given a set of reflections, find the bounding_boxes that overlap.
-   * This function uses a single shot collision detection algorithm to
-   * find the colliding bounding_boxes and then puts all the pairs of colliding
-   * indices into an adjacency list. Vertices are referred to in the
-   * adjacency list by index.
-   * @param bbox The list of bounding boxes
-   * @returns An adjacency list
-   */
-  inline AdjacencyList find_overlapping(const af::const_ref<int6> &bboxes) {
-    // Ensure we have a valid number of bboxes
-    DIALS_ASSERT(bboxes.size() > 0);
+  namespace detail {
 
-    // Create a list of all the pairs of collisions between bounding boxes.
-    std::vector<std::pair<int, int> > collisions;
-    detect_collisions3d(bboxes.begin(), bboxes.end(), collisions);
+    /**
+     * Find the overlapping bounding boxes within groups of boxes, e.g. the
+     * boxes on the same panel of the same imageset. Boxes in different
+     * groups never overlap.
+     *
+     * The boxes of each group are put into a uniform grid of cells in x and
+     * y, with cells about the size of an average box, so that a box covers
+     * only a few cells. Each cell holds the boxes that cover it sorted by
+     * their minimum z, and the pairs of boxes in a cell are found by
+     * sweeping through the cell in z. A pair of boxes is reported only by
+     * the cell containing the minimum corner of their intersection, so that
+     * a pair sharing several cells is found once. The cells of all the
+     * groups are independent and are searched on several threads.
+     */
+    class GroupedOverlapFinder {
+    public:
+      typedef AdjacencyList::index_type index_type;
+      typedef std::pair<index_type, index_type> edge_type;
+
+      /**
+       * @param bbox The bounding boxes
+       * @param group The group of each bounding box
+       */
+      GroupedOverlapFinder(const af::const_ref<int6> &bbox,
+                           const af::const_ref<std::size_t> &group)
+          : bbox_(bbox) {
+        DIALS_ASSERT(bbox.size() == group.size());
+        DIALS_ASSERT(bbox.size() <= std::numeric_limits<index_type>::max());
+
+        // Sort the boxes by group and then by minimum z
+        std::vector<index_type> order(bbox.size());
+        for (std::size_t i = 0; i < order.size(); ++i) {
+          order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), sort_by_group_and_z(bbox, group));
+
+        // Make a grid for each group and find the cells covered by each box
+        std::size_t ncells = 0;
+        for (std::size_t k0 = 0, k1 = 0; k0 < order.size(); k0 = k1) {
+          k1 = k0 + 1;
+          while (k1 < order.size() && group[order[k1]] == group[order[k0]]) {
+            ++k1;
+          }
+          grid_.push_back(make_grid(order, k0, k1, ncells));
+          ncells = grid_.back().end();
+        }
 
-    // Put all the collisions into an adjacency list
-    AdjacencyList list(bboxes.size());
-    for (std::size_t i = 0; i < collisions.size(); ++i) {
-      list.add_edge(collisions[i].first, collisions[i].second);
-    }
-    list.finish();
+        // Put the boxes into the cells, keeping the order by z in each cell
+        std::vector<std::size_t> grid_index(order.size());
+        for (std::size_t g = 0, k = 0; g < grid_.size(); ++g) {
+          for (; k < grid_[g].last; ++k) {
+            grid_index[k] = g;
+          }
+        }
+        offset_.assign(ncells + 1, 0);
+        for (std::size_t k = 0; k < order.size(); ++k) {
+          const Grid &grid = grid_[grid_index[k]];
+          const int6 &b = bbox[order[k]];
+          std::size_t i1 = grid.x(last_pixel(b[0], b[1]));
+          std::size_t j1 = grid.y(last_pixel(b[2], b[3]));
+          for (std::size_t j = grid.y(b[2]); j <= j1; ++j) {
+            for (std::size_t i = grid.x(b[0]); i <= i1; ++i) {
+              offset_[grid.cell(i, j) + 1]++;
+            }
+          }
+        }
+        for (std::size_t c = 0; c < ncells; ++c) {
+          offset_[c + 1] += offset_[c];
+        }
+        cell_.resize(offset_.back());
+        std::vector<std::size_t> position(offset_.begin(), offset_.end() - 1);
+        for (std::size_t k = 0; k < order.size(); ++k) {
+          const Grid &grid = grid_[grid_index[k]];
+          const int6 &b = bbox[order[k]];
+          std::size_t i1 = grid.x(last_pixel(b[0], b[1]));
+          std::size_t j1 = grid.y(last_pixel(b[2], b[3]));
+          for (std::size_t j = grid.y(b[2]); j <= j1; ++j) {
+            for (std::size_t i = grid.x(b[0]); i <= i1; ++i) {
+              cell_[position[grid.cell(i, j)]++] = order[k];
+            }
+          }
+        }
+      }
 
-    // Return the adjacency list
-    return list;
-  }
+      /**
+       * Find the overlapping boxes
+       * @param nthreads The number of threads
+       * @returns The adjacency list of the overlapping boxes
+       */
+      AdjacencyList operator()(std::size_t nthreads) const {
+        DIALS_ASSERT(nthreads > 0);
+        std::size_t ncells = offset_.size() - 1;
+        std::size_t nchunks = std::min(nthreads == 1 ? 1 : 8 * nthreads, ncells);
+        std::vector<std::vector<edge_type> > edges(nchunks);
+        FindJob job = {this, ncells, &edges};
+        dials::util::parallel_for(nchunks, nthreads, job);
+
+        // Put the edges straight into the adjacency list
+        std::size_t nedges = 0;
+        for (std::size_t i = 0; i < edges.size(); ++i) {
+          nedges += edges[i].size();
+        }
+        AdjacencyList list(bbox_.size());
+        list.reserve(nedges);
+        for (std::size_t i = 0; i < edges.size(); ++i) {
+          for (std::size_t j = 0; j < edges[i].size(); ++j) {
+            list.add_edge(edges[i][j].first, edges[i][j].second);
+          }
+          std::vector<edge_type>().swap(edges[i]);
+        }
+        list.finish(nthreads);
+        return list;
+      }
 
-  namespace detail {
+    private:
+      /**
+       * The grid of cells of a group. The group is the boxes first to last in
+       * the sorted order and its cells are numbered from base.
+       */
+      struct Grid {
+        std::size_t first;
+        std::size_t last;
+        std::size_t base;
+        int x0;
+        int y0;
+        int xsize;
+        int ysize;
+        std::size_t nx;
+        std::size_t ny;
+
+        Grid()
+            : first(0),
+              last(0),
+              base(0),
+              x0(0),
+              y0(0),
+              xsize(1),
+              ysize(1),
+              nx(0),
+              ny(0) {}
+
+        std::size_t end() const {
+          return base + nx * ny;
+        }
 
-    // Struct to help sort data
-    struct sort_by_panel {
-      const af::const_ref<std::size_t> p_;
-      sort_by_panel(const af::const_ref<std::size_t> &p) : p_(p) {}
-      bool operator()(std::size_t a, std::size_t b) {
-        return p_[a] < p_[b];
+        std::size_t x(int x) const {
+          return (x - x0) / xsize;
+        }
+
+        std::size_t y(int y) const {
+          return (y - y0) / ysize;
+        }
+
+        std::size_t cell(std::size_t i, std::size_t j) const {
+          return base + j * nx + i;
+        }
+      };
+
+      struct sort_by_group_and_z {
+        af::const_ref<int6> bbox;
+        af::const_ref<std::size_t> group;
+
+        sort_by_group_and_z(const af::const_ref<int6> &bbox_,
+                            const af::const_ref<std::size_t> &group_)
+            : bbox(bbox_), group(group_) {}
+
+        bool operator()(index_type a, index_type b) const {
+          if (group[a] != group[b]) {
+            return group[a] < group[b];
+          }
+          if (bbox[a][4] != bbox[b][4]) {
+            return bbox[a][4] < bbox[b][4];
+          }
+          return a < b;
+        }
+      };
+
+      struct FindJob {
+        const GroupedOverlapFinder *finder;
+        std::size_t ncells;
+        std::vector<std::vector<edge_type> > *edges;
+
+        void operator()(std::size_t first, std::size_t last) const {
+          std::size_t nchunks = edges->size();
+          for (std::size_t i = first; i < last; ++i) {
+            finder->find(i * ncells / nchunks, (i + 1) * ncells / nchunks, (*edges)[i]);
+          }
+        }
+      };
+
+      /** @returns The last pixel covered by [x0, x1), or x0 if it is empty */
+      static int last_pixel(int x0, int x1) {
+        return std::max(x0, x1 - 1);
+      }
+
+      /**
+       * Make a grid with cells about the size of an average box, and with no
+       * more than a few cells for each box.
+       */
+      Grid make_grid(const std::vector<index_type> &order,
+                     std::size_t first,
+                     std::size_t last,
+                     std::size_t base) const {
+        Grid grid;
+        grid.first = first;
+        grid.last = last;
+        grid.base = base;
+        const int6 &b0 = bbox_[order[first]];
+        int x0 = b0[0], x1 = last_pixel(b0[0], b0[1]);
+        int y0 = b0[2], y1 = last_pixel(b0[2], b0[3]);
+        double xsum = 0, ysum = 0;
+        for (std::size_t k = first; k < last; ++k) {
+          const int6 &b = bbox_[order[k]];
+          x0 = std::min(x0, b[0]);
+          x1 = std::max(x1, last_pixel(b[0], b[1]));
+          y0 = std::min(y0, b[2]);
+          y1 = std::max(y1, last_pixel(b[2], b[3]));
+          xsum += std::max(0, b[1] - b[0]);
+          ysum += std::max(0, b[3] - b[2]);
+        }
+        std::size_t count = last - first;
+        grid.x0 = x0;
+        grid.y0 = y0;
+        grid.xsize = std::max(1, (int)std::ceil(xsum / count));
+        grid.ysize = std::max(1, (int)std::ceil(ysum / count));
+        for (;;) {
+          grid.nx = grid.x(x1) + 1;
+          grid.ny = grid.y(y1) + 1;
+          if (grid.nx * grid.ny <= 4 * count + 16) {
+            break;
+          }
+          grid.xsize *= 2;
+          grid.ysize *= 2;
+        }
+        return grid;
       }
+
+      /**
+       * Find the pairs of overlapping boxes in a range of cells
+       */
+      void find(std::size_t first,
+                std::size_t last,
+                std::vector<edge_type> &edges) const {
+        if (first == last) {
+          return;
+        }
+        std::size_t g = std::upper_bound(grid_.begin(), grid_.end(), first, cell_less)
+                        - grid_.begin() - 1;
+        for (std::size_t c = first; c < last; ++c) {
+          while (c >= grid_[g].end()) {
+            ++g;
+          }
+          const Grid &grid = grid_[g];
+          std::size_t o1 = offset_[c];
+          std::size_t o2 = offset_[c + 1];
+          for (std::size_t a = o1; a < o2; ++a) {
+            const int6 &ba = bbox_[cell_[a]];
+            for (std::size_t b = a + 1; b < o2; ++b) {
+              const int6 &bb = bbox_[cell_[b]];
+              if (bb[4] >= ba[5]) {
+                break;
+              }
+              if (ba[0] < bb[1] && bb[0] < ba[1] && ba[2] < bb[3] && bb[2] < ba[3]
+                  && ba[4] < bb[5]
+                  && grid.cell(grid.x(std::max(ba[0], bb[0])),
+                               grid.y(std::max(ba[2], bb[2])))
+                       == c) {
+                edges.push_back(edge_type(cell_[a], cell_[b]));
+              }
+            }
+          }
+        }
+      }
+
+      static bool cell_less(std::size_t c, const Grid &grid) {
+        return c < grid.base;
+      }
+
+      af::const_ref<int6> bbox_;
+      std::vector<Grid> grid_;
+      std::vector<std::size_t> offset_;
+      std::vector<index_type> cell_;
     };
+
   }  // namespace detail
 
   /**
    * Given a set of reflections, find the bounding_boxes that overlap.
-   * This function uses a single shot collision detection algorithm to
-   * find the colliding bounding_boxes and then puts all the pairs of colliding
-   * indices into an adjacency list. Vertices are referred to in the
-   * adjacency list by index.
+   * The bounding boxes are put into a uniform grid and the overlapping
+   * pairs found in each cell are put into an adjacency list. Vertices are
+   * referred to in the adjacency list by index.
+   * @param bbox The list of bounding boxes
+   * @param nthreads The number of threads
+   * @returns An adjacency list
+   */
+  inline AdjacencyList find_overlapping(const af::const_ref<int6> &bboxes,
+                                        std::size_t nthreads = 1) {
+    // Ensure we have a valid number of bboxes
+    DIALS_ASSERT(bboxes.size() > 0);
+    af::shared<std::size_t> group(bboxes.size(), 0);
+    return detail::GroupedOverlapFinder(bboxes, group.const_ref())(nthreads);
+  }
+
+  /**
+   * Given a set of reflections, find the bounding_boxes that overlap.
+   * Only bounding boxes on the same panel are compared, and the panels are
+   * searched concurrently. Vertices are referred to in the adjacency list
+   * by index.
    * @param panel The list of panels
    * @param bbox The list of bounding boxes
+   * @param nthreads The number of threads
    * @returns An adjacency list
    */
   inline AdjacencyList find_overlapping_multi_panel(
     const af::const_ref<int6> &bbox,
-    const af::const_ref<std::size_t> &panel) {
+    const af::const_ref<std::size_t> &panel,
+    std::size_t nthreads = 1) {
     DIALS_ASSERT(panel.size() > 0);
     DIALS_ASSERT(panel.size() == bbox.size());
-
-    // The arrays to use in the collision detection
-    std::vector<int6> data(panel.size());
-    std::vector<std::size_t> index(panel.size());
-    for (std::size_t i = 0; i < index.size(); ++i) {
-      index[i] = i;
-    }
-    std::vector<std::size_t> offset;
-
-    // Sort arrays by panel
-    std::sort(index.begin(), index.end(), detail::sort_by_panel(panel));
-
-    // Create an array of offsets where the panel number is the same
-    // and put the sorted list of bboxes into an new array
-    offset.push_back(0);
-    std::size_t p = panel[index[0]];
-    for (std::size_t i = 0; i < index.size(); ++i) {
-      std::size_t j = index[i];
-      data[i] = bbox[j];
-      if (panel[j] != p) {
-        p = panel[j];
-        offset.push_back(i);
-      }
-    }
-    offset.push_back(index.size());
-
-    // Do the collision detection for all bboxes in the same panel
-    AdjacencyList list(bbox.size());
-    for (std::size_t j = 0; j < offset.size() - 1; ++j) {
-      std::size_t d0 = offset[j];
-      std::size_t d1 = offset[j + 1];
-      std::vector<std::pair<int, int> > collisions;
-
-      // Detect the collisions
-      detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
-
-      // Put all the collisions into an adjacency list
-      for (std::size_t i = 0; i < collisions.size(); ++i) {
-        list.add_edge(index[d0 + collisions[i].first],
-                      index[d0 + collisions[i].second]);
-      }
-    }
-    list.finish();
-    return list;
+    return detail::GroupedOverlapFinder(bbox, panel)(nthreads);
   }
 
   class OverlapFinder {
   public:
-    OverlapFinder() {}
-
-    struct sort_by_group {
-      const std::vector<std::size_t> &g_;
-      sort_by_group(const std::vector<std::size_t> &g) : g_(g) {}
-      bool operator()(std::size_t a, std::size_t b) {
-        return g_[a] < g_[b];
-      }
-    };
+    OverlapFinder(std::size_t nthreads = 1) : nthreads_(nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+    }
 
     AdjacencyList operator()(const af::const_ref<std::size_t> &id,
                              const af::const_ref<std::size_t> &panel,
@@ -180,59 +401,17 @@ namespace dials { namespace algorithms { namespace shoebox {
       DIALS_ASSERT(panel.size() == bbox.size());
       DIALS_ASSERT(panel.size() == id.size());
 
-      // Get the maximum panel number
+      // Group the reflections by experiment and panel
       std::size_t max_panel = af::max(panel);
-      std::size_t max_id = af::max(id);
-      std::size_t max_group = (max_panel + 1) * (max_id + 1);
-
-      // The arrays to use in the collision detection
-      std::vector<std::size_t> group(panel.size());
-      std::vector<int6> data(panel.size());
-      std::vector<std::size_t> index(panel.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
+      af::shared<std::size_t> group(panel.size());
+      for (std::size_t i = 0; i < group.size(); ++i) {
         group[i] = id[i] * (max_panel + 1) + panel[i];
-        index[i] = i;
       }
-      std::vector<std::size_t> offset;
-
-      // Sort arrays by group
-      std::sort(index.begin(), index.end(), sort_by_group(group));
-
-      // Create an array of offsets where the group number is the same and put
-      // the sorted list of bboxes into an new array
-      offset.push_back(0);
-      std::size_t g = group[index[0]];
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        std::size_t j = index[i];
-        data[i] = bbox[j];
-        if (group[j] != g) {
-          DIALS_ASSERT(group[j] > g);
-          g = group[j];
-          offset.push_back(i);
-        }
-      }
-      offset.push_back(index.size());
-      DIALS_ASSERT(offset.size() <= max_group + 1);
-
-      // Do the collision detection for all bboxes in the same group
-      AdjacencyList list(bbox.size());
-      for (std::size_t j = 0; j < offset.size() - 1; ++j) {
-        std::size_t d0 = offset[j];
-        std::size_t d1 = offset[j + 1];
-        std::vector<std::pair<int, int> > collisions;
-
-        // Detect the collisions
-        detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
-
-        // Put all the collisions into an adjacency list
-        for (std::size_t i = 0; i < collisions.size(); ++i) {
-          list.add_edge(index[d0 + collisions[i].first],
-                        index[d0 + collisions[i].second]);
-        }
-      }
-      list.finish();
-      return list;
+      return detail::GroupedOverlapFinder(bbox, group.const_ref())(nthreads_);
     }
+
+  private:
+    std::size_t nthreads_;
   };
 
 }}}  // namespace dials::algorithms::shoebox
@@ -11,6 +11,7 @@
 #ifndef DIALS_ALGORITHMS_SHOEBOX_MASK_EMPIRICAL_H
 #define DIALS_ALGORITHMS_SHOEBOX_MASK_EMPIRICAL_H
 
+#include <algorithm>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <dials/model/data/shoebox.h>
@@ -26,6 +27,7 @@ namespace dials { namespace algorithms { namespace shoebox {
   using dials::model::Shoebox;
   using scitbx::vec2;
   using scitbx::vec3;
+  using scitbx::af::int3;
   using scitbx::af::int6;
 
   /**
@@ -119,25 +121,52 @@ namespace dials { namespace algorithms { namespace shoebox {
           int rmid_y = boost::math::iround((nny2 - nny1) / 2);
           int rmid_z = boost::math::iround((nnz2 - nnz1) / 2);
 
-          // Union this reflection's mask with the query reflection
-          for (std::size_t z = 0; z < nnz2 - nnz1; z++) {
-            for (std::size_t y = 0; y < nny2 - nny1; y++) {
-              for (std::size_t x = 0; x < nnx2 - nnx1; x++) {
-                table_mask(
-                  tmid_z - rmid_z + z, tmid_y - rmid_y + y, tmid_x - rmid_x + x) |=
-                  reference_mask(z, y, x);
-              }
-            }
-          }
+          // Union this reflection's mask with the query reflection. Only the
+          // part of the reference mask which falls inside the query shoebox is
+          // used and each row is combined in a single inner loop.
+          union_mask(table_mask,
+                     reference_mask.begin(),
+                     int3(nnz2 - nnz1, nny2 - nny1, nnx2 - nnx1),
+                     int3(tmid_z - rmid_z, tmid_y - rmid_y, tmid_x - rmid_x));
         }
 
         // Finally, need to explicitly set the background flags for the rest of the
         // pixels as they are not set by spotfinder in the reference set
-        for (std::size_t z = 0; z < tblz2 - tblz1; z++)
-          for (std::size_t y = 0; y < tbly2 - tbly1; y++)
-            for (std::size_t x = 0; x < tblx2 - tblx1; x++)
-              if ((table_mask(z, y, x) & Foreground) != Foreground)
-                table_mask(z, y, x) |= Background;
+        for (std::size_t i = 0; i < table_mask.size(); ++i) {
+          int m = table_mask[i];
+          table_mask[i] = m | (Background * ((m & Foreground) != Foreground));
+        }
+      }
+    }
+
+  private:
+    /**
+     * Or a reference mask into a region of a mask
+     * @param mask The mask to update
+     * @param reference The reference mask values
+     * @param size The size of the reference mask
+     * @param offset The position of the reference mask in the mask
+     */
+    static void union_mask(af::ref<int, af::c_grid<3> > mask,
+                           const int *reference,
+                           int3 size,
+                           int3 offset) {
+      int3 shape(mask.accessor()[0], mask.accessor()[1], mask.accessor()[2]);
+      int3 lo, hi;
+      for (std::size_t j = 0; j < 3; ++j) {
+        lo[j] = std::max(0, -offset[j]);
+        hi[j] = std::min(size[j], shape[j] - offset[j]);
+      }
+      int n = hi[2] - lo[2];
+      for (int z = lo[0]; z < hi[0]; ++z) {
+        for (int y = lo[1]; y < hi[1]; ++y) {
+          int k = ((z + offset[0]) * shape[1] + y + offset[1]) * shape[2];
+          int *dst = mask.begin() + k + offset[2] + lo[2];
+          const int *src = reference + (z * size[1] + y) * size[2] + lo[2];
+          for (int x = 0; x < n; ++x) {
+            dst[x] |= src[x];
+          }
+        }
       }
     }
 
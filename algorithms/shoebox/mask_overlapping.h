@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_MASK_OVERLAPPING_H
 #define DIALS_ALGORITHMS_INTEGRATION_MASK_OVERLAPPING_H
 
+#include <algorithm>
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/model/data/adjacency_list.h>
@@ -29,13 +31,20 @@ namespace dials { namespace algorithms { namespace shoebox {
   class MaskOverlapping {
   public:
     // Useful typedefs
-    typedef AdjacencyList::edge_iterator edge_iterator;
-    typedef AdjacencyList::edge_iterator_range edge_iterator_range;
+    typedef AdjacencyList::vertex_iterator vertex_iterator;
+    typedef AdjacencyList::vertex_iterator_range vertex_iterator_range;
 
     /**
      * Initialise the algorithm
+     * @param by_cluster Assign the pixels of each cluster of overlapping
+     *   reflections at once from a label image, rather than pair by pair
      */
-    MaskOverlapping() {}
+    MaskOverlapping(bool by_cluster = false) : by_cluster_(by_cluster) {}
+
+    /** @returns Are the pixels assigned cluster by cluster */
+    bool by_cluster() const {
+      return by_cluster_;
+    }
 
     /**
      * The entry point of the functor. The list of reflections is queried
@@ -46,6 +55,15 @@ namespace dials { namespace algorithms { namespace shoebox {
      * reflection whose predicted central location is closer to the pixel
      * will gain ownership of the pixel (mask value 1).
      *
+     * In the cluster mode, each connected set of overlapping reflections is
+     * handled together: every pixel of the union of their bounding boxes is
+     * labelled with the closest reflection whose box contains it, and then
+     * each reflection keeps only the pixels with its own label. This gives
+     * the same masks as comparing the reflections in pairs, but touches each
+     * pixel of a cluster once per reflection rather than once per pair. If
+     * the union of the boxes is much larger than the boxes themselves, the
+     * cluster is done pair by pair.
+     *
      * @param shoeboxes The list of shoeboxes
      * @param coords The pixel coordinate
      * @param adjacency_list The adjacency_list
@@ -54,19 +72,29 @@ namespace dials { namespace algorithms { namespace shoebox {
                     const af::const_ref<vec3<double> > &coords,
                     const boost::shared_ptr<AdjacencyList> &adjacency_list) const {
       // Loop through all the reflections
-      if (adjacency_list) {
+      if (adjacency_list && by_cluster_) {
+        DIALS_ASSERT(adjacency_list->num_vertices() == shoeboxes.size());
+        std::vector<bool> visited(shoeboxes.size(), false);
+        std::vector<std::size_t> cluster;
+        for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+          if (!visited[i]) {
+            find_cluster(*adjacency_list, i, visited, cluster);
+            if (cluster.size() > 1) {
+              assign_cluster_ownership(shoeboxes, coords, *adjacency_list, cluster);
+            }
+          }
+        }
+      } else if (adjacency_list) {
         for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
           // Get a reference to the reflection
           Shoebox<> &s = shoeboxes[i];
           vec3<double> c = coords[i];
 
           // Get the list of overlapping shoeboxes
-          edge_iterator_range range = adjacency_list->edges(i);
-          for (edge_iterator it = range.first; it != range.second; ++it) {
-            std::size_t index1 = it->first;
-            std::size_t index2 = it->second;
-            DIALS_ASSERT(index1 == i);
-            if (index1 < index2) {
+          vertex_iterator_range range = adjacency_list->adjacent_vertices(i);
+          for (vertex_iterator it = range.first; it != range.second; ++it) {
+            std::size_t index2 = *it;
+            if (i < index2) {
               assign_ownership(s, c, shoeboxes[index2], coords[index2]);
             }
           }
@@ -75,6 +103,117 @@ namespace dials { namespace algorithms { namespace shoebox {
     }
 
   private:
+    /**
+     * Find the reflections connected to a reflection
+     * @param adjacency_list The adjacency list
+     * @param first The reflection to start from
+     * @param visited Which reflections have been put in a cluster
+     * @param cluster The indices of the reflections, in increasing order
+     */
+    void find_cluster(const AdjacencyList &adjacency_list,
+                      std::size_t first,
+                      std::vector<bool> &visited,
+                      std::vector<std::size_t> &cluster) const {
+      cluster.clear();
+      cluster.push_back(first);
+      visited[first] = true;
+      for (std::size_t n = 0; n < cluster.size(); ++n) {
+        vertex_iterator_range range = adjacency_list.adjacent_vertices(cluster[n]);
+        for (vertex_iterator it = range.first; it != range.second; ++it) {
+          if (!visited[*it]) {
+            visited[*it] = true;
+            cluster.push_back(*it);
+          }
+        }
+      }
+      std::sort(cluster.begin(), cluster.end());
+    }
+
+    /**
+     * Assign ownership of the pixels of a cluster of overlapping reflections.
+     * The reflections are labelled in increasing order of index so that,
+     * as in assign_ownership, the higher index wins when the distances are
+     * equal.
+     * @param shoeboxes The list of shoeboxes
+     * @param coords The pixel coordinates
+     * @param adjacency_list The adjacency list
+     * @param cluster The indices of the reflections in the cluster
+     */
+    void assign_cluster_ownership(af::ref<Shoebox<> > shoeboxes,
+                                  const af::const_ref<vec3<double> > &coords,
+                                  const AdjacencyList &adjacency_list,
+                                  const std::vector<std::size_t> &cluster) const {
+      // Get the union of the bounding boxes
+      int6 box = shoeboxes[cluster[0]].bbox;
+      std::size_t volume = 0;
+      for (std::size_t n = 0; n < cluster.size(); ++n) {
+        const Shoebox<> &s = shoeboxes[cluster[n]];
+        DIALS_ASSERT(s.mask.accessor().all_eq(
+          int3(s.bbox[5] - s.bbox[4], s.bbox[3] - s.bbox[2], s.bbox[1] - s.bbox[0])));
+        for (std::size_t d = 0; d < 3; ++d) {
+          box[2 * d] = std::min(box[2 * d], s.bbox[2 * d]);
+          box[2 * d + 1] = std::max(box[2 * d + 1], s.bbox[2 * d + 1]);
+        }
+        volume += s.mask.size();
+      }
+      int xsize = box[1] - box[0];
+      int ysize = box[3] - box[2];
+      int zsize = box[5] - box[4];
+
+      // A long thin cluster covers little of its bounding box
+      std::size_t box_volume = (std::size_t)xsize * ysize * zsize;
+      if (box_volume > 8 * volume) {
+        for (std::size_t n = 0; n < cluster.size(); ++n) {
+          std::size_t i = cluster[n];
+          vertex_iterator_range range = adjacency_list.adjacent_vertices(i);
+          for (vertex_iterator it = range.first; it != range.second; ++it) {
+            if (i < *it) {
+              assign_ownership(shoeboxes[i], coords[i], shoeboxes[*it], coords[*it]);
+            }
+          }
+        }
+        return;
+      }
+
+      // Label each pixel with the closest reflection
+      std::vector<int> label(box_volume, -1);
+      std::vector<double> best(label.size());
+      for (std::size_t n = 0; n < cluster.size(); ++n) {
+        const int6 &b = shoeboxes[cluster[n]].bbox;
+        vec3<double> c = coords[cluster[n]];
+        for (int k = b[4]; k < b[5]; ++k) {
+          for (int j = b[2]; j < b[3]; ++j) {
+            int p = ((k - box[4]) * ysize + (j - box[2])) * xsize - box[0];
+            for (int i = b[0]; i < b[1]; ++i) {
+              double d = distance(c, voxel_coord(i, j, k));
+              if (label[p + i] < 0 || !(best[p + i] < d)) {
+                label[p + i] = n;
+                best[p + i] = d;
+              }
+            }
+          }
+        }
+      }
+
+      // Clear the pixels of each reflection which belong to another
+      for (std::size_t n = 0; n < cluster.size(); ++n) {
+        Shoebox<> &s = shoeboxes[cluster[n]];
+        af::ref<int, af::c_grid<3> > mask = s.mask.ref();
+        const int6 &b = s.bbox;
+        std::size_t q = 0;
+        for (int k = b[4]; k < b[5]; ++k) {
+          for (int j = b[2]; j < b[3]; ++j) {
+            int p = ((k - box[4]) * ysize + (j - box[2])) * xsize - box[0];
+            for (int i = b[0]; i < b[1]; ++i, ++q) {
+              if (label[p + i] != (int)n) {
+                mask[q] = 0;
+              }
+            }
+          }
+        }
+      }
+    }
+
     /**
      * The distance between two points
      * @param a Point a
@@ -163,6 +302,8 @@ namespace dials { namespace algorithms { namespace shoebox {
         }
       }
     }
+
+    bool by_cluster_;
   };
 
 }}}  // namespace dials::algorithms::shoebox
@@ -15,7 +15,7 @@ def __init__(self, experiment):
         from dials.algorithms.shoebox import MaskOverlapping
 
         # Construct the overlapping reflection mask
-        self.mask_overlapping = MaskOverlapping()
+        self.mask_overlapping = MaskOverlapping(by_cluster=True)
 
     def __call__(self, reflections, adjacency_list=None):
         """Mask the given reflections.
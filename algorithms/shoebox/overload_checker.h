@@ -14,11 +14,37 @@
 #include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
+#include <dials/model/data/shoebox_arena.h>
+#include <dials/algorithms/shoebox/mask_code.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms { namespace shoebox {
 
   using dials::model::Shoebox;
+  using dials::model::ShoeboxArena;
+
+  /**
+   * Mark the pixels at or above the overload value as invalid. The loop has
+   * no branches so that the compiler can vectorise it.
+   * @param overload The overload value
+   * @param data The pixel values
+   * @param mask The pixel mask values
+   * @param n The number of pixels
+   * @returns True if any pixels are overloaded
+   */
+  template <typename FloatType>
+  bool mask_overloaded_pixels(double overload,
+                              const FloatType *data,
+                              int *mask,
+                              std::size_t n) {
+    int count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      int over = (double)data[i] >= overload;
+      mask[i] &= ~(Valid * over);
+      count += over;
+    }
+    return count > 0;
+  }
 
   /**
    * A class to check for and mark overloaded pixels
@@ -49,15 +75,17 @@ namespace dials { namespace algorithms { namespace shoebox {
         DIALS_ASSERT(panel < overload_.size());
         DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
         DIALS_ASSERT(data.size() == mask.size());
-        bool result = false;
-        double overload_value = overload_[panel];
-        for (std::size_t i = 0; i < data.size(); ++i) {
-          if (data[i] >= overload_value) {
-            mask[i] &= ~Valid;
-            result = true;
-          }
-        }
-        return result;
+        return mask_overloaded_pixels(
+          overload_[panel], data.begin(), mask.begin(), data.size());
+      }
+
+      /**
+       * @param panel The panel number
+       * @returns The overload value of the panel
+       */
+      double overload(std::size_t panel) const {
+        DIALS_ASSERT(panel < overload_.size());
+        return overload_[panel];
       }
 
     private:
@@ -92,6 +120,34 @@ namespace dials { namespace algorithms { namespace shoebox {
       return result;
     }
 
+    /**
+     * Check each shoebox of an arena to see if it contains overloads. The
+     * overload value of each shoebox is looked up first and the pixels are
+     * then checked in one pass over the contiguous arrays.
+     * @param id The experiment id
+     * @param arena The shoeboxes
+     * @returns flex.bool True contains outliers
+     */
+    af::shared<bool> operator()(const af::const_ref<int> id,
+                                ShoeboxArena<> &arena) const {
+      DIALS_ASSERT(id.size() == arena.size());
+      af::shared<std::size_t> panel = arena.panels();
+      std::vector<double> overload(id.size());
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        DIALS_ASSERT(id[i] >= 0);
+        DIALS_ASSERT(id[i] < checker_.size());
+        overload[i] = checker_[id[i]].overload(panel[i]);
+      }
+      af::shared<bool> result(id.size(), false);
+      for (std::size_t i = 0; i < id.size(); ++i) {
+        result[i] = mask_overloaded_pixels(overload[i],
+                                           arena.data(i).begin(),
+                                           arena.mask(i).begin(),
+                                           arena.npixels(i));
+      }
+      return result;
+    }
+
   private:
     std::vector<Checker> checker_;
   };
@@ -2,5 +2,7 @@
 
 __all__ = (  # noqa: F405
     "integrate_reciprocal_space_gaussian",
+    "integrate_reciprocal_space_gaussian_batch",
     "simulate_reciprocal_space_gaussian",
+    "simulate_reciprocal_space_gaussian_batch",
 )
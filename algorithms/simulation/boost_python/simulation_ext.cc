@@ -19,6 +19,34 @@ namespace dials { namespace algorithms { namespace boost_python {
   BOOST_PYTHON_MODULE(dials_algorithms_simulation_ext) {
     def("simulate_reciprocal_space_gaussian", &simulate_reciprocal_space_gaussian);
     def("integrate_reciprocal_space_gaussian", &integrate_reciprocal_space_gaussian);
+    def("simulate_reciprocal_space_gaussian_batch",
+        &simulate_reciprocal_space_gaussian_batch,
+        (arg("beam"),
+         arg("detector"),
+         arg("goniometer"),
+         arg("scan"),
+         arg("sigma_b"),
+         arg("sigma_m"),
+         arg("s1"),
+         arg("phi"),
+         arg("I"),
+         arg("shoeboxes"),
+         arg("seed"),
+         arg("nthreads") = 1));
+    def("integrate_reciprocal_space_gaussian_batch",
+        &integrate_reciprocal_space_gaussian_batch,
+        (arg("beam"),
+         arg("detector"),
+         arg("goniometer"),
+         arg("scan"),
+         arg("sigma_b"),
+         arg("sigma_m"),
+         arg("s1"),
+         arg("phi"),
+         arg("I"),
+         arg("shoeboxes"),
+         arg("seed"),
+         arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,131 @@
+/*
+ * philox.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SIMULATION_PHILOX_H
+#define DIALS_ALGORITHMS_SIMULATION_PHILOX_H
+
+#include <cmath>
+#include <boost/cstdint.hpp>
+#include <scitbx/constants.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The Philox4x32-10 counter based random number generator of Salmon et al.
+   * (2011), "Parallel random numbers: as easy as 1, 2, 3". Each call maps a
+   * 128 bit counter and a 64 bit key to four random 32 bit numbers, so any
+   * number in any stream can be computed directly without generating the
+   * numbers before it. This allows simulations on several threads to give
+   * the same results whatever the number of threads.
+   */
+  class Philox4x32 {
+  public:
+    typedef boost::uint32_t value_type;
+
+    /**
+     * @param seed The key of the generator
+     */
+    Philox4x32(boost::uint64_t seed)
+        : key0_((value_type)seed), key1_((value_type)(seed >> 32)) {}
+
+    /**
+     * Compute the random numbers for a counter
+     * @param counter The counter, which is replaced by the random numbers
+     */
+    void operator()(value_type counter[4]) const {
+      value_type k0 = key0_;
+      value_type k1 = key1_;
+      for (std::size_t i = 0; i < 10; ++i) {
+        if (i > 0) {
+          k0 += 0x9E3779B9;
+          k1 += 0xBB67AE85;
+        }
+        boost::uint64_t p0 = (boost::uint64_t)0xD2511F53 * counter[0];
+        boost::uint64_t p1 = (boost::uint64_t)0xCD9E8D57 * counter[2];
+        value_type c1 = counter[1];
+        value_type c3 = counter[3];
+        counter[0] = (value_type)(p1 >> 32) ^ c1 ^ k0;
+        counter[1] = (value_type)p1;
+        counter[2] = (value_type)(p0 >> 32) ^ c3 ^ k1;
+        counter[3] = (value_type)p0;
+      }
+    }
+
+  private:
+    value_type key0_;
+    value_type key1_;
+  };
+
+  /**
+   * A stream of normally distributed random numbers from a Philox4x32
+   * generator. Each stream is identified by a 64 bit number, for example the
+   * index of a reflection, and the numbers are made in blocks of four from
+   * consecutive counters using the Box-Muller transform.
+   */
+  class NormalStream {
+  public:
+    /**
+     * @param seed The seed shared by all the streams
+     * @param stream The number of the stream
+     */
+    NormalStream(boost::uint64_t seed, boost::uint64_t stream)
+        : generator_(seed), stream_(stream), counter_(0), next_(4) {}
+
+    /**
+     * @returns A random number from the standard normal distribution
+     */
+    double operator()() {
+      if (next_ == 4) {
+        refill();
+      }
+      return block_[next_++];
+    }
+
+    /**
+     * Fill an array with random numbers from the standard normal distribution
+     * @param first The start of the array
+     * @param last The end of the array
+     */
+    void fill(double *first, double *last) {
+      for (; first != last; ++first) {
+        *first = (*this)();
+      }
+    }
+
+  private:
+    void refill() {
+      Philox4x32::value_type c[4];
+      c[0] = (Philox4x32::value_type)counter_;
+      c[1] = (Philox4x32::value_type)(counter_ >> 32);
+      c[2] = (Philox4x32::value_type)stream_;
+      c[3] = (Philox4x32::value_type)(stream_ >> 32);
+      generator_(c);
+      counter_++;
+      for (std::size_t i = 0; i < 4; i += 2) {
+        // Uniform numbers in (0, 1] and [0, 1)
+        double u1 = (c[i] + 1.0) / 4294967296.0;
+        double u2 = c[i + 1] / 4294967296.0;
+        double r = std::sqrt(-2.0 * std::log(u1));
+        double theta = scitbx::constants::two_pi * u2;
+        block_[i] = r * std::cos(theta);
+        block_[i + 1] = r * std::sin(theta);
+      }
+      next_ = 0;
+    }
+
+    Philox4x32 generator_;
+    boost::uint64_t stream_;
+    boost::uint64_t counter_;
+    std::size_t next_;
+    double block_[4];
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SIMULATION_PHILOX_H
@@ -6,12 +6,20 @@
 class Simulator:
     """Class to help with simulation from reciprocal space."""
 
-    def __init__(self, experiment, sigma_b, sigma_m, n_sigma):
-        """Initialise with models and parameters."""
+    def __init__(self, experiment, sigma_b, sigma_m, n_sigma, seed=None, nproc=1):
+        """Initialise with models and parameters.
+
+        The signal of each reflection is simulated from its own stream of
+        random numbers, so for a given seed the result does not depend on nproc.
+        """
         self.experiment = experiment
         self.sigma_b = sigma_b
         self.sigma_m = sigma_m
         self.n_sigma = n_sigma
+        if seed is None:
+            seed = random.getrandbits(64)
+        self.seed = seed
+        self.nproc = nproc
 
     def with_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         """Generate reflections with a given intensity and background."""
@@ -50,11 +58,13 @@ def with_random_intensity(self, N, Imax, Bamax, Bbmax, Bcmax, Bdmax):
 
     def with_individual_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         """Generate reflections with given intensity and background."""
-        from dials.algorithms.simulation import simulate_reciprocal_space_gaussian
+        from dials.algorithms.simulation import (
+            simulate_reciprocal_space_gaussian_batch,
+        )
         from dials.algorithms.simulation.generate_test_reflections import (
             random_background_plane2,
         )
-        from dials.util.command_line import ProgressBar
+        from dials.util.command_line import Command, ProgressBar
 
         # Check the lengths
         assert N == len(In)
@@ -67,36 +77,26 @@ def with_individual_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         refl = self.generate_predictions(N)
 
         # Calculate the signal
-        progress = ProgressBar(title=f"Calculating signal for {len(refl)} reflections")
-        s1 = refl["s1"]
-        phi = refl["xyzcal.mm"].parts()[2]
-        bbox = refl["bbox"]
-        shoebox = refl["shoebox"]
-        m = int(len(refl) / 100)
-        I_exp = flex.double(len(refl), 0)
-        for i in range(len(refl)):
-            if In[i] > 0:
-                data = shoebox[i].data.as_double()
-                I_exp[i] = simulate_reciprocal_space_gaussian(
-                    self.experiment.beam,
-                    self.experiment.detector,
-                    self.experiment.goniometer,
-                    self.experiment.scan,
-                    self.sigma_b,
-                    self.sigma_m,
-                    s1[i],
-                    phi[i],
-                    bbox[i],
-                    In[i],
-                    data,
-                    shoebox[i].mask,
-                )
-                shoebox[i].data = data.as_float()
-            if i % m == 0:
-                progress.update(100.0 * float(i) / len(refl))
-        progress.finished(f"Calculated signal impacts for {len(refl)} reflections")
+        Command.start(f"Calculating signal for {len(refl)} reflections")
+        I_exp = simulate_reciprocal_space_gaussian_batch(
+            self.experiment.beam,
+            self.experiment.detector,
+            self.experiment.goniometer,
+            self.experiment.scan,
+            self.sigma_b,
+            self.sigma_m,
+            refl["s1"],
+            refl["xyzcal.mm"].parts()[2],
+            In,
+            refl["shoebox"],
+            self.seed,
+            self.nproc,
+        ).as_double()
+        Command.end(f"Calculated signal impacts for {len(refl)} reflections")
 
         # Calculate the background
+        shoebox = refl["shoebox"]
+        m = int(len(refl) / 100)
         progress = ProgressBar(
             title=f"Calculating background for {len(refl)} reflections"
         )
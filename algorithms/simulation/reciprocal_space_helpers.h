@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_SIMULATION_RECIPROCAL_SPACE_HELPERS_H
 #define DIALS_ALGORITHMS_SIMULATION_RECIPROCAL_SPACE_HELPERS_H
 
+#include <algorithm>
+#include <boost/cstdint.hpp>
 #include <boost/random.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
@@ -23,24 +25,227 @@
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <ctime>
 #include <dials/model/data/shoebox.h>
+#include <dials/algorithms/simulation/philox.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using dials::model::Foreground;
+  using dials::model::Shoebox;
   using dxtbx::model::BeamBase;
   using dxtbx::model::Detector;
   using dxtbx::model::Goniometer;
+  using dxtbx::model::Panel;
   using dxtbx::model::Scan;
   using profile_model::gaussian_rs::CoordinateSystem;
   using scitbx::vec2;
   using scitbx::vec3;
   using scitbx::af::int6;
 
+  namespace detail {
+
+    /** The number of events sampled in one batch */
+    const std::size_t simulation_batch_size = 256;
+
+    /**
+     * Map a batch of random events in reciprocal space into a shoebox
+     * @param cs The reciprocal space coordinate system of the reflection
+     * @param panel The panel of the reflection
+     * @param scan The scan
+     * @param bbox The bounding box of the reflection
+     * @param e The e1, e2, e3 coordinates of each event
+     * @param n The number of events
+     * @param shoebox The shoebox data to add the counts to (or NULL)
+     * @param mask The shoebox mask
+     * @returns The number of events in the foreground
+     */
+    template <typename FloatType>
+    int add_reciprocal_space_events(const CoordinateSystem &cs,
+                                    const Panel &panel,
+                                    const Scan &scan,
+                                    const int6 &bbox,
+                                    const double *e,
+                                    std::size_t n,
+                                    FloatType *shoebox,
+                                    const af::const_ref<int, af::c_grid<3> > &mask) {
+      std::size_t ysize = mask.accessor()[1];
+      std::size_t xsize = mask.accessor()[2];
+      int counts = 0;
+      for (std::size_t i = 0; i < n; ++i, e += 3) {
+        // Get the beam vector and rotation angle
+        vec3<double> s1_dash = cs.to_beam_vector(vec2<double>(e[0], e[1]));
+        double phi_dash = cs.to_rotation_angle_fast(e[2]);
+
+        // Get the pixel coordinate
+        vec2<double> mm = panel.get_ray_intersection(s1_dash);
+        vec2<double> px = panel.millimeter_to_pixel(mm);
+
+        // Get the frame
+        double frame = scan.get_array_index_from_angle(phi_dash);
+
+        // Make sure coordinate is within range
+        if (px[0] < bbox[0] || px[0] >= bbox[1] || px[1] < bbox[2] || px[1] >= bbox[3]
+            || frame < bbox[4] || frame >= bbox[5]) {
+          continue;
+        }
+
+        // Get the pixel index
+        int x = (int)(px[0] - bbox[0]);
+        int y = (int)(px[1] - bbox[2]);
+        int z = (int)(frame - bbox[4]);
+        std::size_t k = (z * ysize + y) * xsize + x;
+
+        // Add the count
+        if (shoebox != NULL) {
+          shoebox[k] += 1;
+        }
+        if (mask[k] & Foreground) {
+          counts += 1;
+        }
+      }
+      return counts;
+    }
+
+    /**
+     * Simulate a gaussian for one reflection with a sequential generator
+     */
+    template <typename FloatType>
+    int simulate_with_mt19937(const BeamBase &beam,
+                              const Detector &detector,
+                              const Goniometer &goniometer,
+                              const Scan &scan,
+                              double sigma_b,
+                              double sigma_m,
+                              const vec3<double> s1,
+                              double phi,
+                              const int6 &bbox,
+                              std::size_t I,
+                              FloatType *shoebox,
+                              const af::const_ref<int, af::c_grid<3> > &mask) {
+      vec3<double> s0 = beam.get_s0();
+      vec3<double> m2 = goniometer.get_rotation_axis();
+
+      // Seed the random number generator
+      boost::random::mt19937 gen(time(0));
+      boost::random::normal_distribution<double> dist_x(0, sigma_b);
+      boost::random::normal_distribution<double> dist_y(0, sigma_b);
+      boost::random::normal_distribution<double> dist_z(0, sigma_m);
+
+      // Do the simulation in batches
+      int counts = 0;
+      CoordinateSystem cs(m2, s0, s1, phi);
+      double e[3 * simulation_batch_size];
+      for (std::size_t i = 0; i < I; i += simulation_batch_size) {
+        std::size_t n = std::min(simulation_batch_size, I - i);
+        for (std::size_t j = 0; j < n; ++j) {
+          e[3 * j + 0] = dist_x(gen);
+          e[3 * j + 1] = dist_y(gen);
+          e[3 * j + 2] = dist_z(gen);
+        }
+        counts += add_reciprocal_space_events(
+          cs, detector[0], scan, bbox, e, n, shoebox, mask);
+      }
+      return counts;
+    }
+
+    /**
+     * Simulate the gaussians of a range of reflections. Each reflection has
+     * its own stream of random numbers so the result does not depend on how
+     * the reflections are split between threads.
+     */
+    struct SimulationJob {
+      vec3<double> s0;
+      vec3<double> m2;
+      const Detector *detector;
+      const Scan *scan;
+      double sigma_b;
+      double sigma_m;
+      const vec3<double> *s1;
+      const double *phi;
+      const int *I;
+      Shoebox<> *shoeboxes;
+      boost::uint64_t seed;
+      bool simulate;
+      int *counts;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        double e[3 * simulation_batch_size];
+        for (std::size_t i = first; i < last; ++i) {
+          Shoebox<> &sbox = shoeboxes[i];
+          CoordinateSystem cs(m2, s0, s1[i], phi[i]);
+          NormalStream normal(seed, i);
+          Shoebox<>::float_type *data = simulate ? sbox.data.begin() : NULL;
+          int total = 0;
+          std::size_t size = I[i];
+          for (std::size_t j = 0; j < size; j += simulation_batch_size) {
+            std::size_t n = std::min(simulation_batch_size, size - j);
+            normal.fill(e, e + 3 * n);
+            for (std::size_t k = 0; k < n; ++k) {
+              e[3 * k + 0] *= sigma_b;
+              e[3 * k + 1] *= sigma_b;
+              e[3 * k + 2] *= sigma_m;
+            }
+            total += add_reciprocal_space_events(cs,
+                                                 (*detector)[sbox.panel],
+                                                 *scan,
+                                                 sbox.bbox,
+                                                 e,
+                                                 n,
+                                                 data,
+                                                 sbox.mask.const_ref());
+          }
+          counts[i] = total;
+        }
+      }
+    };
+
+    inline af::shared<int> simulate_batch(const BeamBase &beam,
+                                          const Detector &detector,
+                                          const Goniometer &goniometer,
+                                          const Scan &scan,
+                                          double sigma_b,
+                                          double sigma_m,
+                                          const af::const_ref<vec3<double> > &s1,
+                                          const af::const_ref<double> &phi,
+                                          const af::const_ref<int> &I,
+                                          af::ref<Shoebox<> > shoeboxes,
+                                          boost::uint64_t seed,
+                                          bool simulate,
+                                          std::size_t nthreads) {
+      DIALS_ASSERT(s1.size() == shoeboxes.size());
+      DIALS_ASSERT(phi.size() == shoeboxes.size());
+      DIALS_ASSERT(I.size() == shoeboxes.size());
+      for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+        DIALS_ASSERT(I[i] >= 0);
+        DIALS_ASSERT(shoeboxes[i].panel < detector.size());
+        DIALS_ASSERT(shoeboxes[i].is_consistent());
+      }
+      af::shared<int> counts(shoeboxes.size(), 0);
+      SimulationJob job = {beam.get_s0(),
+                           goniometer.get_rotation_axis(),
+                           &detector,
+                           &scan,
+                           sigma_b,
+                           sigma_m,
+                           s1.begin(),
+                           phi.begin(),
+                           I.begin(),
+                           shoeboxes.begin(),
+                           seed,
+                           simulate,
+                           counts.begin()};
+      dials::util::parallel_for(shoeboxes.size(), nthreads, job);
+      return counts;
+    }
+
+  }  // namespace detail
+
   /**
    * Simulate a gaussian in reciprocal space and transform back to detector
    * space.
    */
-  int simulate_reciprocal_space_gaussian(
+  inline int simulate_reciprocal_space_gaussian(
     const BeamBase &beam,
     const Detector &detector,
     const Goniometer &goniometer,
@@ -53,61 +258,26 @@ namespace dials { namespace algorithms {
     std::size_t I,
     af::ref<double, af::c_grid<3> > shoebox,
     const af::const_ref<int, af::c_grid<3> > &mask) {
-    vec3<double> s0 = beam.get_s0();
-    vec3<double> m2 = goniometer.get_rotation_axis();
-
-    // Seed the random number generator
-    boost::random::mt19937 gen(time(0));
-    boost::random::normal_distribution<double> dist_x(0, sigma_b);
-    boost::random::normal_distribution<double> dist_y(0, sigma_b);
-    boost::random::normal_distribution<double> dist_z(0, sigma_m);
-
-    // Do the simulation
-    int counts = 0;
-    CoordinateSystem cs(m2, s0, s1, phi);
-    for (std::size_t i = 0; i < I; ++i) {
-      // Get the random coordinates
-      double e1 = dist_x(gen);
-      double e2 = dist_y(gen);
-      double e3 = dist_z(gen);
-
-      // Get the beam vector and rotation angle
-      vec3<double> s1_dash = cs.to_beam_vector(vec2<double>(e1, e2));
-      double phi_dash = cs.to_rotation_angle_fast(e3);
-
-      // Get the pixel coordinate
-      vec2<double> mm = detector[0].get_ray_intersection(s1_dash);
-      vec2<double> px = detector[0].millimeter_to_pixel(mm);
-
-      // Get the frame
-      double frame = scan.get_array_index_from_angle(phi_dash);
-
-      // Make sure coordinate is within range
-      if (px[0] < bbox[0] || px[0] >= bbox[1] || px[1] < bbox[2] || px[1] >= bbox[3]
-          || frame < bbox[4] || frame >= bbox[5]) {
-        continue;
-      }
-
-      // Get the pixel index
-      int x = (int)(px[0] - bbox[0]);
-      int y = (int)(px[1] - bbox[2]);
-      int z = (int)(frame - bbox[4]);
-
-      // Add the count
-      shoebox(z, y, x) += 1;
-
-      if (mask(z, y, x) & Foreground) {
-        counts += 1;
-      }
-    }
-    return counts;
+    DIALS_ASSERT(shoebox.accessor().all_eq(mask.accessor()));
+    return detail::simulate_with_mt19937(beam,
+                                         detector,
+                                         goniometer,
+                                         scan,
+                                         sigma_b,
+                                         sigma_m,
+                                         s1,
+                                         phi,
+                                         bbox,
+                                         I,
+                                         shoebox.begin(),
+                                         mask);
   }
 
   /**
    * Simulate a gaussian in reciprocal space and transform back to detector
    * space. Estimate the expected intensity within the masked region.
    */
-  int integrate_reciprocal_space_gaussian(
+  inline int integrate_reciprocal_space_gaussian(
     const BeamBase &beam,
     const Detector &detector,
     const Goniometer &goniometer,
@@ -119,52 +289,112 @@ namespace dials { namespace algorithms {
     const int6 &bbox,
     std::size_t I,
     const af::const_ref<int, af::c_grid<3> > &mask) {
-    vec3<double> s0 = beam.get_s0();
-    vec3<double> m2 = goniometer.get_rotation_axis();
-
-    // Seed the random number generator
-    boost::random::mt19937 gen(time(0));
-    boost::random::normal_distribution<double> dist_x(0, sigma_b);
-    boost::random::normal_distribution<double> dist_y(0, sigma_b);
-    boost::random::normal_distribution<double> dist_z(0, sigma_m);
-
-    // Do the simulation
-    int counts = 0;
-    CoordinateSystem cs(m2, s0, s1, phi);
-    for (std::size_t i = 0; i < I; ++i) {
-      // Get the random coordinates
-      double e1 = dist_x(gen);
-      double e2 = dist_y(gen);
-      double e3 = dist_z(gen);
-
-      // Get the beam vector and rotation angle
-      vec3<double> s1_dash = cs.to_beam_vector(vec2<double>(e1, e2));
-      double phi_dash = cs.to_rotation_angle_fast(e3);
-
-      // Get the pixel coordinate
-      vec2<double> mm = detector[0].get_ray_intersection(s1_dash);
-      vec2<double> px = detector[0].millimeter_to_pixel(mm);
-
-      // Get the frame
-      double frame = scan.get_array_index_from_angle(phi_dash);
-
-      // Make sure coordinate is within range
-      if (px[0] < bbox[0] || px[0] >= bbox[1] || px[1] < bbox[2] || px[1] >= bbox[3]
-          || frame < bbox[4] || frame >= bbox[5]) {
-        continue;
-      }
+    return detail::simulate_with_mt19937<double>(beam,
+                                                 detector,
+                                                 goniometer,
+                                                 scan,
+                                                 sigma_b,
+                                                 sigma_m,
+                                                 s1,
+                                                 phi,
+                                                 bbox,
+                                                 I,
+                                                 NULL,
+                                                 mask);
+  }
 
-      // Get the pixel index
-      int x = (int)(px[0] - bbox[0]);
-      int y = (int)(px[1] - bbox[2]);
-      int z = (int)(frame - bbox[4]);
+  /**
+   * Simulate gaussians in reciprocal space for many reflections and add the
+   * counts to their shoeboxes. The reflections are split between threads;
+   * each one is given its own counter based random number stream, so for a
+   * given seed the result is the same whatever the number of threads.
+   * @param beam The beam model
+   * @param detector The detector model
+   * @param goniometer The goniometer model
+   * @param scan The scan model
+   * @param sigma_b The beam divergence
+   * @param sigma_m The mosaicity
+   * @param s1 The diffracted beam vectors
+   * @param phi The rotation angles
+   * @param I The number of counts to simulate for each reflection
+   * @param shoeboxes The shoeboxes
+   * @param seed The random seed
+   * @param nthreads The number of threads
+   * @returns The number of counts in the foreground of each reflection
+   */
+  inline af::shared<int> simulate_reciprocal_space_gaussian_batch(
+    const BeamBase &beam,
+    const Detector &detector,
+    const Goniometer &goniometer,
+    const Scan &scan,
+    double sigma_b,
+    double sigma_m,
+    const af::const_ref<vec3<double> > &s1,
+    const af::const_ref<double> &phi,
+    const af::const_ref<int> &I,
+    af::ref<Shoebox<> > shoeboxes,
+    boost::uint64_t seed,
+    std::size_t nthreads = 1) {
+    return detail::simulate_batch(beam,
+                                  detector,
+                                  goniometer,
+                                  scan,
+                                  sigma_b,
+                                  sigma_m,
+                                  s1,
+                                  phi,
+                                  I,
+                                  shoeboxes,
+                                  seed,
+                                  true,
+                                  nthreads);
+  }
 
-      // Add the count
-      if (mask(z, y, x) & Foreground) {
-        counts += 1;
-      }
-    }
-    return counts;
+  /**
+   * Simulate gaussians in reciprocal space for many reflections and count the
+   * events which land in the foreground of each shoebox, without changing the
+   * shoebox data. The random numbers are as for
+   * simulate_reciprocal_space_gaussian_batch.
+   * @param beam The beam model
+   * @param detector The detector model
+   * @param goniometer The goniometer model
+   * @param scan The scan model
+   * @param sigma_b The beam divergence
+   * @param sigma_m The mosaicity
+   * @param s1 The diffracted beam vectors
+   * @param phi The rotation angles
+   * @param I The number of counts to simulate for each reflection
+   * @param shoeboxes The shoeboxes
+   * @param seed The random seed
+   * @param nthreads The number of threads
+   * @returns The number of counts in the foreground of each reflection
+   */
+  inline af::shared<int> integrate_reciprocal_space_gaussian_batch(
+    const BeamBase &beam,
+    const Detector &detector,
+    const Goniometer &goniometer,
+    const Scan &scan,
+    double sigma_b,
+    double sigma_m,
+    const af::const_ref<vec3<double> > &s1,
+    const af::const_ref<double> &phi,
+    const af::const_ref<int> &I,
+    af::ref<Shoebox<> > shoeboxes,
+    boost::uint64_t seed,
+    std::size_t nthreads = 1) {
+    return detail::simulate_batch(beam,
+                                  detector,
+                                  goniometer,
+                                  scan,
+                                  sigma_b,
+                                  sigma_m,
+                                  s1,
+                                  phi,
+                                  I,
+                                  shoeboxes,
+                                  seed,
+                                  false,
+                                  nthreads);
   }
 
 }}  // namespace dials::algorithms
@@ -0,0 +1,376 @@
+/*
+ * parallel_detect_collisions.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPATIAL_INDEXING_PARALLEL_DETECT_COLLISIONS_H
+#define DIALS_ALGORITHMS_SPATIAL_INDEXING_PARALLEL_DETECT_COLLISIONS_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <boost/bind/bind.hpp>
+#include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The same kd partitioning as DetectCollisions, without recursion and on
+   * several threads.
+   *
+   * The bounds of the objects are first copied into one array per dimension.
+   * The space is then split in the same way as in DetectCollisions, but the
+   * subdivisions are kept on an explicit stack rather than the call stack.
+   * The first few levels are split on the calling thread until there are a
+   * few subdivisions for each thread, and each of these is then searched on
+   * the work stealing thread pool. In the leaves, the bounds of the objects
+   * are gathered into small contiguous arrays and each object is tested
+   * against the rest without branches, so that the compiler can vectorize the
+   * box against box tests.
+   *
+   * The collisions of each subdivision are kept separately and appended in
+   * order at the end, so the result does not depend on the number of
+   * threads.
+   */
+  template <int DIM, typename Iterator, typename ListType, bool touching = false>
+  class ParallelDetectCollisions {
+  public:
+    typedef Iterator DataIterator;
+    typedef std::iterator_traits<DataIterator> traits;
+    typedef typename traits::value_type ObjectType;
+    typedef typename bound_coord_type<ObjectType>::type CoordType;
+    typedef typename ListType::value_type Collision;
+    typedef BoundingBox<DIM, CoordType> BoxType;
+    typedef BoxSize<DIM, CoordType> DimType;
+    typedef std::vector<std::pair<int, int> > PairList;
+
+    /**
+     * @param nthreads The number of threads
+     * @param leaf_size The number of objects below which a subdivision is
+     *                  searched by brute force
+     */
+    ParallelDetectCollisions(std::size_t nthreads = 1,
+                             std::size_t leaf_size = default_leaf_size())
+        : nthreads_(nthreads), leaf_size_(leaf_size) {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(leaf_size > 1);
+    }
+
+    static std::size_t default_leaf_size() {
+      return 16;
+    }
+
+    /**
+     * Find the colliding objects
+     * @param first The first iterator in the range
+     * @param last The last iterator in the range
+     * @param collisions The list of collisions
+     */
+    void operator()(DataIterator first, DataIterator last, ListType &collisions) {
+      int n = last - first;
+      DIALS_ASSERT(n > 0);
+
+      // Copy the lower and upper bounds of the objects into an array for each
+      // dimension
+      n_ = n;
+      bound_.resize(2 * DIM * n);
+      for (int i = 0; i < n; ++i) {
+        BoxType b;
+        for_each<range_c<int, 0, DIM> >(
+          init_bounding_box<BoxType, ObjectType>(*(first + i), b));
+        for (std::size_t d = 0; d < DIM; ++d) {
+          bound_[2 * (d * n + i)] = b.min[d];
+          bound_[2 * (d * n + i) + 1] = b.max[d];
+        }
+      }
+
+      // Get the bounding box and the maximum depth as in DetectCollisions
+      Node root;
+      root.box = get_bounding_box<BoxType>(first, last);
+      root.axis = 0;
+      root.depth = 0;
+      root.begin = 0;
+      root.end = n;
+      DimType min_size = get_minimum_box_size<DimType>(first, last);
+      for (std::size_t i = 0; i < DIM; ++i) {
+        DIALS_ASSERT(min_size.d[i] > 0);
+      }
+      CoordType min_length = root.box.max[0] - root.box.min[0];
+      std::size_t j = 0;
+      for (std::size_t i = 0; i < DIM; ++i) {
+        if (root.box.max[i] - root.box.min[i] < min_length) {
+          min_length = root.box.max[i] - root.box.min[i];
+          j = i;
+        }
+      }
+      max_depth_ = log2(min_length / min_size.d[j]) - 1;
+      if (max_depth_ < 1) max_depth_ = 1;
+      max_depth_ *= DIM;
+
+      // Split the top levels until there are enough subdivisions to share
+      // between the threads, keeping them in depth first order. Each of
+      // these has its own array of indices.
+      std::vector<Task> tasks(1);
+      tasks[0].node = root;
+      tasks[0].index.resize(n);
+      for (int i = 0; i < n; ++i) {
+        tasks[0].index[i] = i;
+      }
+      std::size_t ntasks = nthreads_ == 1 ? 1 : 4 * nthreads_;
+      while (tasks.size() < ntasks) {
+        std::vector<Task> next;
+        bool any_split = false;
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+          Task &task = tasks[i];
+          if (is_leaf(task.node)) {
+            next.push_back(Task());
+            std::swap(next.back(), task);
+          } else {
+            Node left, right;
+            split(task.node, task.index, left, right);
+            next.push_back(Task());
+            next.back().assign(left, task.index);
+            next.push_back(Task());
+            next.back().assign(right, task.index);
+            any_split = true;
+          }
+        }
+        tasks.swap(next);
+        if (!any_split) {
+          break;
+        }
+      }
+
+      // Search each subdivision
+      std::vector<PairList> result(tasks.size());
+      if (nthreads_ == 1 || tasks.size() == 1) {
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+          search(&tasks[i], &result[i]);
+        }
+      } else {
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads_, tasks.size()));
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+          pool.post(boost::bind(
+            &ParallelDetectCollisions::search, this, &tasks[i], &result[i]));
+        }
+        pool.wait();
+      }
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        for (std::size_t k = 0; k < result[i].size(); ++k) {
+          collisions.push_back(Collision(result[i][k].first, result[i][k].second));
+        }
+      }
+    }
+
+  private:
+    /**
+     * A subdivision of the space. The indices of the objects that touch it
+     * are the elements begin to end of an array of indices.
+     */
+    struct Node {
+      BoxType box;
+      int axis;
+      int depth;
+      std::size_t begin;
+      std::size_t end;
+    };
+
+    /** A subdivision to search on a thread, with its own array of indices */
+    struct Task {
+      Node node;
+      std::vector<int> index;
+
+      void assign(const Node &other, const std::vector<int> &other_index) {
+        node = other;
+        node.begin = 0;
+        node.end = other.end - other.begin;
+        index.assign(other_index.begin() + other.begin,
+                     other_index.begin() + other.end);
+      }
+    };
+
+    bool is_leaf(const Node &node) const {
+      return node.depth >= max_depth_ || node.end - node.begin <= leaf_size_;
+    }
+
+    /**
+     * Split a subdivision in half along its axis. Objects whose lower bound
+     * is below the split go to the left and objects whose upper bound is at
+     * or above the split go to the right, so objects spanning the split go
+     * to both sides.
+     *
+     * The indices of the subdivision must be at the end of the array. They
+     * are replaced by the indices of the right and then the left half, so
+     * that the array works as a stack.
+     */
+    void split(const Node &node,
+               std::vector<int> &index,
+               Node &left,
+               Node &right) const {
+      DIALS_ASSERT(node.end == index.size());
+      const int d = node.axis;
+      const CoordType *bound = &bound_[2 * d * n_];
+      CoordType div = node.box.min[d] + (node.box.max[d] - node.box.min[d]) / 2;
+      left.box = node.box;
+      left.box.max[d] = div;
+      right.box = node.box;
+      right.box.min[d] = div;
+      left.axis = right.axis = (d + 1) % DIM;
+      left.depth = right.depth = node.depth + 1;
+
+      // Write the right and left halves after the subdivision in one pass,
+      // then move them down over it
+      std::size_t count = node.end - node.begin;
+      index.resize(node.end + 2 * count);
+      int *input = &index[node.begin];
+      int *output_right = &index[node.end];
+      int *output_left = output_right + count;
+      std::size_t nright = 0;
+      std::size_t nleft = 0;
+      for (std::size_t i = 0; i < count; ++i) {
+        int k = input[i];
+        output_left[nleft] = k;
+        output_right[nright] = k;
+        nleft += bound[2 * k] < div;
+        nright += !(bound[2 * k + 1] < div);
+      }
+      std::copy(output_right, output_right + nright, input);
+      std::copy(output_left, output_left + nleft, input + nright);
+      right.begin = node.begin;
+      right.end = node.begin + nright;
+      left.begin = right.end;
+      left.end = right.end + nleft;
+      index.resize(left.end);
+    }
+
+    /**
+     * Search a subdivision, keeping the subdivisions still to be searched on
+     * a stack.
+     */
+    void search(Task *task, PairList *collisions) const {
+      std::vector<int> &index = task->index;
+      std::vector<Node> stack(1, task->node);
+      std::vector<CoordType> buffer;
+      std::vector<unsigned char> hit;
+      while (!stack.empty()) {
+        Node node = stack.back();
+        stack.pop_back();
+        if (is_leaf(node)) {
+          search_leaf(node, index, buffer, hit, *collisions);
+          index.resize(node.begin);
+        } else {
+          Node left, right;
+          split(node, index, left, right);
+          stack.push_back(right);
+          stack.push_back(left);
+        }
+      }
+    }
+
+    /**
+     * Test every pair of objects in a leaf. The bounds of the objects are
+     * gathered into contiguous arrays, then the tests of one object against
+     * all the following objects are done without branches.
+     */
+    void search_leaf(const Node &node,
+                     const std::vector<int> &index,
+                     std::vector<CoordType> &buffer,
+                     std::vector<unsigned char> &hit,
+                     PairList &collisions) const {
+      const int *leaf = &index[0] + node.begin;
+      const std::size_t m = node.end - node.begin;
+      if (m < 2) {
+        return;
+      }
+      buffer.resize(2 * DIM * m);
+      hit.resize(m);
+      CoordType *lower = &buffer[0];
+      CoordType *upper = &buffer[DIM * m];
+      for (std::size_t d = 0; d < DIM; ++d) {
+        for (std::size_t i = 0; i < m; ++i) {
+          lower[d * m + i] = bound_[2 * (d * n_ + leaf[i])];
+          upper[d * m + i] = bound_[2 * (d * n_ + leaf[i]) + 1];
+        }
+      }
+      for (std::size_t a = 0; a < m - 1; ++a) {
+        for (std::size_t b = a + 1; b < m; ++b) {
+          hit[b] = 1;
+        }
+        for (std::size_t d = 0; d < DIM; ++d) {
+          const CoordType *lo = &lower[d * m];
+          const CoordType *hi = &upper[d * m];
+          const CoordType lo_a = lo[a];
+          const CoordType hi_a = hi[a];
+          const CoordType box_min = node.box.min[d];
+          for (std::size_t b = a + 1; b < m; ++b) {
+            hit[b] &= overlaps(lo_a, hi_a, lo[b], hi[b]);
+          }
+          if (lo_a < box_min) {
+            // Pairs whose lower bounds are both before the subdivision in
+            // any dimension have been found in an earlier subdivision
+            visited(lo, box_min, a, m, hit);
+          }
+        }
+        for (std::size_t b = a + 1; b < m; ++b) {
+          if (hit[b]) {
+            collisions.push_back(std::make_pair(leaf[a], leaf[b]));
+          }
+        }
+      }
+    }
+
+    static unsigned char overlaps(CoordType lo_a,
+                                  CoordType hi_a,
+                                  CoordType lo_b,
+                                  CoordType hi_b) {
+      return touching ? (lo_a <= hi_b) & (lo_b <= hi_a)
+                      : (lo_a < hi_b) & (lo_b < hi_a);
+    }
+
+    static void visited(const CoordType *lo,
+                        CoordType box_min,
+                        std::size_t a,
+                        std::size_t m,
+                        std::vector<unsigned char> &hit) {
+      for (std::size_t b = a + 1; b < m; ++b) {
+        hit[b] &= !(lo[b] < box_min);
+      }
+    }
+
+    std::size_t nthreads_;
+    std::size_t leaf_size_;
+    int max_depth_;
+    int n_;
+    std::vector<CoordType> bound_;
+  };
+
+  /** Parallel 2D collision detection */
+  template <typename Iterator, typename ListType>
+  void detect_collisions2d(Iterator first,
+                           Iterator last,
+                           ListType &collisions,
+                           std::size_t nthreads,
+                           std::size_t leaf_size = 16) {
+    ParallelDetectCollisions<2, Iterator, ListType, false>(nthreads, leaf_size)(
+      first, last, collisions);
+  }
+
+  /** Parallel 3D collision detection */
+  template <typename Iterator, typename ListType>
+  void detect_collisions3d(Iterator first,
+                           Iterator last,
+                           ListType &collisions,
+                           std::size_t nthreads,
+                           std::size_t leaf_size = 16) {
+    ParallelDetectCollisions<3, Iterator, ListType, false>(nthreads, leaf_size)(
+      first, last, collisions);
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPATIAL_INDEXING_PARALLEL_DETECT_COLLISIONS_H
@@ -1,3 +1,3 @@
 from dials_algorithms_spot_finding_ext import *  # noqa: F403; lgtm
 
-__all__ = ("StrongSpotCombiner",)  # noqa: F405
+__all__ = ("PerImageStatistics", "PixelStatistics", "StrongSpotCombiner")  # noqa: F405
@@ -11,15 +11,88 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/spot_finding/helpers.h>
+#include <dials/algorithms/spot_finding/per_image_analysis.h>
+#include <dials/algorithms/spot_finding/pixel_statistics.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  /**
+   * Pickle the pixel statistics as their arrays, so the statistics of the
+   * images read by other processes can be merged
+   */
+  struct PixelStatisticsPickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const PixelStatistics &obj) {
+      return boost::python::make_tuple(obj.trusted_min(),
+                                       obj.trusted_max(),
+                                       obj.num_images(),
+                                       obj.count(),
+                                       obj.mean(),
+                                       obj.m2(),
+                                       obj.num_strong(),
+                                       obj.num_untrusted());
+    }
+  };
+
   BOOST_PYTHON_MODULE(dials_algorithms_spot_finding_ext) {
-    class_<StrongSpotCombiner>("StrongSpotCombiner")
+    class_<StrongSpotCombiner>("StrongSpotCombiner", no_init)
+      .def(init<bool>((arg("take_ownership") = false)))
       .def("add", &StrongSpotCombiner::add)
       .def("shoeboxes", &StrongSpotCombiner::shoeboxes);
+
+    class_<PerImageStatistics>("PerImageStatistics", no_init)
+      .def(init<int, std::size_t, std::size_t, double>(
+        (arg("first_image"), arg("num_images"), arg("num_bins"), arg("d_min"))))
+      .def("add_ring", &PerImageStatistics::add_ring)
+      .def("add_panel", &PerImageStatistics::add_panel)
+      .def("add_spots", &PerImageStatistics::add_spots)
+      .def("add_pixels", &PerImageStatistics::add_pixels)
+      .def("merge", &PerImageStatistics::merge)
+      .def("first_image", &PerImageStatistics::first_image)
+      .def("num_images", &PerImageStatistics::num_images)
+      .def("num_rejected", &PerImageStatistics::num_rejected)
+      .def("n_spots_total", &PerImageStatistics::n_spots_total)
+      .def("n_spots_no_ice", &PerImageStatistics::n_spots_no_ice)
+      .def("n_spots_4A", &PerImageStatistics::n_spots_4A)
+      .def("total_intensity", &PerImageStatistics::total_intensity)
+      .def("d_min", &PerImageStatistics::d_min)
+      .def("bin_edges", &PerImageStatistics::bin_edges)
+      .def("histogram", &PerImageStatistics::histogram);
+
+    class_<PixelStatistics>("PixelStatistics", no_init)
+      .def(init<int2, double, double>(
+        (arg("size"), arg("trusted_min"), arg("trusted_max"))))
+      .def(init<double,
+                double,
+                std::size_t,
+                const af::versa<int, af::c_grid<2> > &,
+                const af::versa<double, af::c_grid<2> > &,
+                const af::versa<double, af::c_grid<2> > &,
+                const af::versa<int, af::c_grid<2> > &,
+                const af::versa<int, af::c_grid<2> > &>((arg("trusted_min"),
+                                                         arg("trusted_max"),
+                                                         arg("num_images"),
+                                                         arg("count"),
+                                                         arg("mean"),
+                                                         arg("m2"),
+                                                         arg("num_strong"),
+                                                         arg("num_untrusted"))))
+      .def("add",
+           &PixelStatistics::add,
+           (arg("image"), arg("mask"), arg("strong"), arg("nthreads") = 1))
+      .def("merge", &PixelStatistics::merge)
+      .def("size", &PixelStatistics::size)
+      .def("trusted_min", &PixelStatistics::trusted_min)
+      .def("trusted_max", &PixelStatistics::trusted_max)
+      .def("num_images", &PixelStatistics::num_images)
+      .def("count", &PixelStatistics::count)
+      .def("mean", &PixelStatistics::mean)
+      .def("m2", &PixelStatistics::m2)
+      .def("variance", &PixelStatistics::variance)
+      .def("num_strong", &PixelStatistics::num_strong)
+      .def("num_untrusted", &PixelStatistics::num_untrusted)
+      .def_pickle(PixelStatisticsPickleSuite());
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -60,6 +60,12 @@ def generate_phil_scope():
       .type = bool
       .help = "Compute the mean background for each image"
 
+    timing_file = None
+      .type = path
+      .help = "Write the time taken by each stage of spot finding and the"
+              "number of pixels and spots found on each image to this JSON file"
+      .expert_level = 1
+
     filter
       .help = "Parameters used in the spot finding filter strategy."
 
@@ -126,6 +132,15 @@ def generate_phil_scope():
       min_chunksize = 20
         .type = int(value_min=1)
         .help = "When chunksize is auto, this is the minimum chunksize"
+
+      interleave_imagesets = True
+        .type = bool
+        .help = "Process the images of all the imagesets with one pool of"
+                "processes, so the processes start on the next imageset while"
+                "the last images of one are finishing instead of the pool"
+                "starting up and draining for each imageset. Only used with a"
+                "single job."
+        .expert_level = 2
     }
   }
   """,
@@ -404,13 +419,23 @@ class SpotFinderFactory:
     """
 
     @staticmethod
-    def from_parameters(params=None, experiments=None, is_stills=False):
+    def from_parameters(
+        params=None,
+        experiments=None,
+        is_stills=False,
+        threshold_function=None,
+        mask_generator=None,
+    ):
         """
         Given a set of parameters, construct the spot finder
 
         :param params: The input parameters
         :param is_stills:   [ADVANCED] Force still-handling of experiment
                             ID remapping for dials.stills_process.
+        :param threshold_function: [ADVANCED] Use an existing threshold
+                                   strategy rather than creating a new one
+        :param mask_generator: [ADVANCED] Use an existing mask generator
+                               rather than creating a new one
         :returns: The spot finder instance
         """
         if params is None:
@@ -438,11 +463,13 @@ def from_parameters(params=None, experiments=None, is_stills=False):
         filter_spots = SpotFinderFactory.configure_filter(params)
 
         # Create the threshold strategy
-        threshold_function = SpotFinderFactory.configure_threshold(params)
+        if threshold_function is None:
+            threshold_function = SpotFinderFactory.configure_threshold(params)
 
-        mask_generator = functools.partial(
-            dials.util.masking.generate_mask, params=params.spotfinder.filter
-        )
+        if mask_generator is None:
+            mask_generator = functools.partial(
+                dials.util.masking.generate_mask, params=params.spotfinder.filter
+            )
 
         # Make sure 'none' is interpreted as None
         if params.spotfinder.mp.method == "none":
@@ -469,6 +496,8 @@ def from_parameters(params=None, experiments=None, is_stills=False):
             no_shoeboxes_2d=no_shoeboxes_2d,
             min_chunksize=params.spotfinder.mp.min_chunksize,
             is_stills=is_stills,
+            timing_file=params.spotfinder.timing_file,
+            interleave_imagesets=params.spotfinder.mp.interleave_imagesets,
         )
 
     @staticmethod
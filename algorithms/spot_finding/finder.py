@@ -5,6 +5,7 @@
 import logging
 import math
 import pickle
+import time
 from typing import Iterable, Tuple
 
 import libtbx
@@ -12,6 +13,13 @@
 from dxtbx.imageset import ImageSequence, ImageSet
 from dxtbx.model import ExperimentList
 
+from dials.algorithms.image.connected_components import StreamingLabelImageStack3d
+from dials.algorithms.shoebox import MaskCode
+from dials.algorithms.spot_finding.instrumentation import (
+    PIXEL_LIST_BYTES_PER_PIXEL,
+    SpotFindingStats,
+    shoebox_bytes,
+)
 from dials.array_family import flex
 from dials.model.data import PixelList, PixelListLabeller
 from dials.util import Sorry, log
@@ -50,10 +58,25 @@ def __init__(
         self.region_of_interest = region_of_interest
         self.max_strong_pixel_fraction = max_strong_pixel_fraction
         self.compute_mean_background = compute_mean_background
+        self.last_record = None
         if self.mask is not None:
             detector = self.imageset.get_detector()
             assert len(self.mask) == len(detector)
 
+    def _use_runs(self):
+        """
+        Check whether the strong pixels can be computed as runs. The dense
+        mask is still needed for the mean background and the region of
+        interest.
+
+        :returns: True/False
+        """
+        return (
+            hasattr(self.threshold_function, "compute_threshold_runs")
+            and not self.compute_mean_background
+            and self.region_of_interest is None
+        )
+
     def __call__(self, index):
         """
         Extract strong pixels from an image
@@ -73,6 +96,7 @@ def __call__(self, index):
         pixel_list = []
 
         # Get the image and mask
+        t0 = time.perf_counter()
         image = self.imageset.get_corrected_data(index)
         mask = self.imageset.get_mask(index)
 
@@ -80,17 +104,18 @@ def __call__(self, index):
         if self.mask is not None:
             assert len(self.mask) == len(mask)
             mask = tuple(m1 & m2 for m1, m2 in zip(mask, self.mask))
+        time_read = time.perf_counter() - t0
 
-        logger.debug(
-            "Number of masked pixels for image %i: %i",
-            index,
-            sum(m.count(False) for m in mask),
-        )
+        num_masked = sum(m.count(False) for m in mask)
+        logger.debug("Number of masked pixels for image %i: %i", index, num_masked)
 
         # Add the images to the pixel lists
         num_strong = 0
         average_background = 0
+        time_threshold = 0
+        time_pixel_list = 0
         for im, mk in zip(image, mask):
+            t0 = time.perf_counter()
             if self.region_of_interest is not None:
                 x0, x1, y0, y1 = self.region_of_interest
                 height, width = im.all()
@@ -105,12 +130,19 @@ def __call__(self, index):
                 tm_roi = self.threshold_function.compute_threshold(im_roi, mk_roi)
                 threshold_mask = flex.bool(im.accessor(), False)
                 threshold_mask[y0:y1, x0:x1] = tm_roi
+            elif self._use_runs():
+                # Only the strong pixels are needed so skip the dense mask
+                threshold_mask = self.threshold_function.compute_threshold_runs(im, mk)
             else:
                 threshold_mask = self.threshold_function.compute_threshold(im, mk)
+            t1 = time.perf_counter()
 
             # Add the pixel list
             plist = PixelList(frame, im, threshold_mask)
             pixel_list.append(plist)
+            t2 = time.perf_counter()
+            time_threshold += t1 - t0
+            time_pixel_list += t2 - t1
 
             # Get average background
             if self.compute_mean_background:
@@ -148,6 +180,19 @@ def __call__(self, index):
         else:
             logger.info("Found %d strong pixels on image %d", num_strong, frame + 1)
 
+        # Record the timings and counters for the frame
+        self.last_record = {
+            "frame": frame,
+            "time": {
+                "read": time_read,
+                "threshold": time_threshold,
+                "pixel_list": time_pixel_list,
+            },
+            "masked_pixels": num_masked,
+            "strong_pixels": num_strong,
+            "bytes": num_strong * PIXEL_LIST_BYTES_PER_PIXEL,
+        }
+
         # Return the result
         return pixel_list
 
@@ -218,6 +263,7 @@ def __call__(self, index):
             min_spot_size=self.min_spot_size,
             max_spot_size=self.max_spot_size,
             write_hot_pixel_mask=False,
+            stats=self.last_record,
         )
 
         # Delete the shoeboxes
@@ -248,7 +294,26 @@ def __call__(self, task):
         result = self.function(task)
         handlers = logging.getLogger("dials").handlers
         assert len(handlers) == 1, "Invalid number of logging handlers"
-        return result, handlers[0].records
+        return result, handlers[0].records, self.function.last_record
+
+
+class ExtractSpotsFromImagesetsTask:
+    """
+    Execute the spot finder task for an image of one of several imagesets in
+    parallel. Each task carries the function of its own imageset, so only that
+    imageset is pickled with it.
+    """
+
+    def __call__(self, task):
+        """
+        Call the function of the task with its image and save the IO
+        """
+        k, function, index = task
+        log.config_simple_cached()
+        result = function(index)
+        handlers = logging.getLogger("dials").handlers
+        assert len(handlers) == 1, "Invalid number of logging handlers"
+        return k, result, handlers[0].records, function.last_record
 
 
 def pixel_list_to_shoeboxes(
@@ -257,9 +322,11 @@ def pixel_list_to_shoeboxes(
     min_spot_size: int,
     max_spot_size: int,
     write_hot_pixel_mask: bool,
+    stats: dict = None,
 ) -> Tuple[flex.shoebox, Tuple[flex.size_t, ...]]:
     """Convert a pixel list to shoeboxes"""
     # Extract the pixel lists into a list of reflections
+    t0 = time.perf_counter()
     shoeboxes = flex.shoebox()
     spotsizes = flex.size_t()
     hotpixels = tuple(flex.size_t() for i in range(len(imageset.get_detector())))
@@ -292,15 +359,24 @@ def pixel_list_to_shoeboxes(
     logger.info("Removed %d spots with size < %d pixels", ntoosmall, min_spot_size)
     logger.info("Removed %d spots with size > %d pixels", ntoolarge, max_spot_size)
 
+    # Record the timings and counters
+    if stats is not None:
+        stats.setdefault("time", {})["shoeboxes"] = time.perf_counter() - t0
+        stats["components"] = len(selection)
+        stats["rejected_too_small"] = ntoosmall
+        stats["rejected_too_large"] = ntoolarge
+        stats["bytes"] = stats.get("bytes", 0) + shoebox_bytes(shoeboxes)
+
     # Return the shoeboxes
     return shoeboxes, hotpixels
 
 
 def shoeboxes_to_reflection_table(
-    imageset: ImageSet, shoeboxes: flex.shoebox, filter_spots
+    imageset: ImageSet, shoeboxes: flex.shoebox, filter_spots, stats: dict = None
 ) -> flex.reflection_table:
     """Filter shoeboxes and create reflection table"""
     # Calculate the spot centroids
+    t0 = time.perf_counter()
     centroid = shoeboxes.centroid_valid()
     logger.info("Calculated %d spot centroids", len(shoeboxes))
 
@@ -312,12 +388,21 @@ def shoeboxes_to_reflection_table(
     observed = flex.observation(shoeboxes.panels(), centroid, intensity)
 
     # Filter the reflections and select only the desired spots
+    t1 = time.perf_counter()
     flags = filter_spots(
         None, sweep=imageset, observations=observed, shoeboxes=shoeboxes
     )
     observed = observed.select(flags)
     shoeboxes = shoeboxes.select(flags)
 
+    # Record the timings and counters
+    if stats is not None:
+        t2 = time.perf_counter()
+        stats.setdefault("time", {})["centroids"] = t1 - t0
+        stats["time"]["filter"] = t2 - t1
+        stats["rejected_by_filter"] = flags.count(False)
+        stats["spots"] = len(shoeboxes)
+
     # Return as a reflection list
     return flex.reflection_table(observed, shoeboxes)
 
@@ -329,6 +414,7 @@ def pixel_list_to_reflection_table(
     min_spot_size: int,
     max_spot_size: int,
     write_hot_pixel_mask: bool,
+    stats: dict = None,
 ) -> Tuple[flex.shoebox, Tuple[flex.size_t, ...]]:
     """Convert pixel list to reflection table"""
     shoeboxes, hot_pixels = pixel_list_to_shoeboxes(
@@ -337,10 +423,13 @@ def pixel_list_to_reflection_table(
         min_spot_size=min_spot_size,
         max_spot_size=max_spot_size,
         write_hot_pixel_mask=write_hot_pixel_mask,
+        stats=stats,
     )
     # Setup the reflection table converter
     return (
-        shoeboxes_to_reflection_table(imageset, shoeboxes, filter_spots=filter_spots),
+        shoeboxes_to_reflection_table(
+            imageset, shoeboxes, filter_spots=filter_spots, stats=stats
+        ),
         hot_pixels,
     )
 
@@ -367,6 +456,7 @@ def __init__(
         no_shoeboxes_2d=False,
         min_chunksize=50,
         write_hot_pixel_mask=False,
+        stats=None,
     ):
         """
         Initialise the class with the strategy
@@ -376,6 +466,7 @@ def __init__(
         :param mp_method: The multi processing method
         :param nproc: The number of processors
         :param max_strong_pixel_fraction: The maximum number of strong pixels
+        :param stats: The SpotFindingStats to record the timings in
         """
         # Set the required strategies
         self.threshold_function = threshold_function
@@ -393,6 +484,9 @@ def __init__(
         self.no_shoeboxes_2d = no_shoeboxes_2d
         self.min_chunksize = min_chunksize
         self.write_hot_pixel_mask = write_hot_pixel_mask
+        if stats is None:
+            stats = SpotFindingStats()
+        self.stats = stats
 
     def __call__(self, imageset):
         """
@@ -421,12 +515,13 @@ def _compute_chunksize(self, nimg, nproc, min_chunksize):
             test_chunksize -= 1
         return chunksize
 
-    def _find_spots(self, imageset):
+    def _mp_settings(self, num_images):
         """
-        Find the spots in the imageset
+        Compute the number of processors, jobs and the chunk size for a number
+        of images
 
-        :param imageset: The imageset to process
-        :return: The list of spot shoeboxes
+        :param num_images: The number of images to process
+        :return: The number of processors, jobs and the chunk size
         """
         # Change the number of processors if necessary
         mp_nproc = self.mp_nproc
@@ -434,20 +529,20 @@ def _find_spots(self, imageset):
         if mp_nproc is libtbx.Auto:
             mp_nproc = available_cores()
             logger.info(f"Setting nproc={mp_nproc}")
-        if mp_nproc * mp_njobs > len(imageset):
-            mp_nproc = min(mp_nproc, len(imageset))
-            mp_njobs = int(math.ceil(len(imageset) / mp_nproc))
+        if mp_nproc * mp_njobs > num_images:
+            mp_nproc = min(mp_nproc, num_images)
+            mp_njobs = int(math.ceil(num_images / mp_nproc))
 
         mp_method = self.mp_method
         mp_chunksize = self.mp_chunksize
 
         if mp_chunksize is libtbx.Auto:
             mp_chunksize = self._compute_chunksize(
-                len(imageset), mp_njobs * mp_nproc, self.min_chunksize
+                num_images, mp_njobs * mp_nproc, self.min_chunksize
             )
             logger.info("Setting chunksize=%i", mp_chunksize)
 
-        len_by_nproc = int(math.floor(len(imageset) / (mp_njobs * mp_nproc)))
+        len_by_nproc = int(math.floor(num_images / (mp_njobs * mp_nproc)))
         if mp_chunksize > len_by_nproc:
             mp_chunksize = len_by_nproc
         if mp_chunksize == 0:
@@ -457,6 +552,18 @@ def _find_spots(self, imageset):
         assert mp_njobs == 1 or mp_method is not None, "Invalid cluster method"
         assert mp_chunksize > 0, "Invalid chunk size"
 
+        return mp_nproc, mp_njobs, mp_chunksize
+
+    def _find_spots(self, imageset):
+        """
+        Find the spots in the imageset
+
+        :param imageset: The imageset to process
+        :return: The list of spot shoeboxes
+        """
+        mp_nproc, mp_njobs, mp_chunksize = self._mp_settings(len(imageset))
+        mp_method = self.mp_method
+
         # The extract pixels function
         function = ExtractPixelsFromImage(
             imageset=imageset,
@@ -489,6 +596,7 @@ def _find_spots(self, imageset):
 
             def process_output(result):
                 rehandle_cached_records(result[1])
+                self.stats.add_frame(result[2])
                 assert len(pixel_labeller) == len(result[0]), "Inconsistent size"
                 for plabeller, plist in zip(pixel_labeller, result[0]):
                     plabeller.add(plist)
@@ -505,20 +613,121 @@ def process_output(result):
         else:
             for task in indices:
                 result = function(task)
+                self.stats.add_frame(function.last_record)
                 assert len(pixel_labeller) == len(result), "Inconsistent size"
                 for plabeller, plist in zip(pixel_labeller, result):
                     plabeller.add(plist)
                 result.clear()
 
         # Create shoeboxes from pixel list
-        return pixel_list_to_reflection_table(
+        return self._labelled_spots(imageset, pixel_labeller)
+
+    def _labelled_spots(self, imageset, pixel_labeller):
+        """
+        Create the spots from the labelled pixels of an imageset
+
+        :param imageset: The imageset
+        :param pixel_labeller: The pixel labeller of each panel
+        :return: The spots and the hot pixels
+        """
+        stage = {"num_frames": len(imageset)}
+        result = pixel_list_to_reflection_table(
             imageset,
             pixel_labeller,
             filter_spots=self.filter_spots,
             min_spot_size=self.min_spot_size,
             max_spot_size=self.max_spot_size,
             write_hot_pixel_mask=self.write_hot_pixel_mask,
+            stats=stage,
+        )
+        self.stats.add_stage("extract_spots", stage)
+        return result
+
+    def find_spots_in_imagesets(self, imagesets, masks):
+        """
+        Find the spots in several imagesets at once. The images of all the
+        imagesets are given to one pool of processes in order, so the processes
+        start reading the next imageset while the last images of one are still
+        being processed instead of the pool draining and starting up again for
+        each imageset. The spots of each imageset are created once its last
+        image is done.
+
+        :param imagesets: The imagesets to process
+        :param masks: The mask of each imageset
+        :return: The spots and the hot pixels of each imageset
+        """
+        assert len(imagesets) == len(masks), "Inconsistent size"
+        assert not self.no_shoeboxes_2d, "2D spot finding is not interleaved"
+        num_images = sum(len(imageset) for imageset in imagesets)
+        mp_nproc, mp_njobs, mp_chunksize = self._mp_settings(num_images)
+        assert mp_njobs == 1, "Imagesets can only be interleaved in one job"
+
+        # The extract pixels function of each imageset
+        functions = [
+            ExtractPixelsFromImage(
+                imageset=imageset,
+                threshold_function=self.threshold_function,
+                mask=mask,
+                max_strong_pixel_fraction=self.max_strong_pixel_fraction,
+                compute_mean_background=self.compute_mean_background,
+                region_of_interest=self.region_of_interest,
+            )
+            for imageset, mask in zip(imagesets, masks)
+        ]
+
+        # The images of all the imagesets, one imageset after another
+        tasks = [
+            (k, function, index)
+            for k, function in enumerate(functions)
+            for index in range(len(function.imageset))
+        ]
+
+        # The pixel labellers of each imageset and the images left to add
+        pixel_labellers = [
+            [PixelListLabeller() for p in imageset.get_detector()]
+            for imageset in imagesets
+        ]
+        num_left = [len(imageset) for imageset in imagesets]
+        results = [None] * len(imagesets)
+
+        def add_image(k, pixel_lists, record):
+            self.stats.add_frame(record)
+            assert len(pixel_labellers[k]) == len(pixel_lists), "Inconsistent size"
+            for plabeller, plist in zip(pixel_labellers[k], pixel_lists):
+                plabeller.add(plist)
+            num_left[k] -= 1
+            if num_left[k] == 0:
+                results[k] = self._labelled_spots(imagesets[k], pixel_labellers[k])
+                pixel_labellers[k] = None
+
+        # Do the processing
+        logger.info(
+            "Extracting strong pixels from %d images of %d imagesets",
+            num_images,
+            len(imagesets),
         )
+        logger.info(" Using multiprocessing with %d parallel job(s)\n", mp_nproc)
+        if mp_nproc > 1:
+
+            def process_output(result):
+                rehandle_cached_records(result[2])
+                add_image(result[0], result[1], result[3])
+
+            batch_multi_node_parallel_map(
+                func=ExtractSpotsFromImagesetsTask(),
+                iterable=tasks,
+                nproc=mp_nproc,
+                njobs=1,
+                cluster_method=None,
+                chunksize=mp_chunksize,
+                callback=process_output,
+            )
+        else:
+            for k, function, index in tasks:
+                result = function(index)
+                add_image(k, result, function.last_record)
+                result.clear()
+        return results
 
     def _find_spots_2d_no_shoeboxes(self, imageset):
         """
@@ -586,6 +795,7 @@ def _find_spots_2d_no_shoeboxes(self, imageset):
             def process_output(result):
                 for message in result[1]:
                     logger.log(message.levelno, message.msg)
+                self.stats.add_frame(result[2])
                 reflections.extend(result[0][0])
                 result[0][0] = None
 
@@ -599,8 +809,11 @@ def process_output(result):
                 callback=process_output,
             )
         else:
+            tables = []
             for task in indices:
-                reflections.extend(function(task)[0])
+                tables.append(function(task)[0])
+                self.stats.add_frame(function.last_record)
+            reflections = flex.reflection_table.concatenate(tables)
 
         # Return the reflections
         return reflections, None
@@ -632,6 +845,8 @@ def __init__(
         no_shoeboxes_2d=False,
         min_chunksize=50,
         is_stills=False,
+        timing_file=None,
+        interleave_imagesets=False,
     ):
         """
         Initialise the class.
@@ -641,6 +856,10 @@ def __init__(
         :param scan_range: The scan range to find spots over
         :param is_stills:   [ADVANCED] Force still-handling of experiment
                             ID remapping for dials.stills_process.
+        :param timing_file: Write the per-frame timings and counters to this
+                            JSON file
+        :param interleave_imagesets: Process the images of all the imagesets
+                                     with one pool of processes
         """
 
         # Set the filter and some other stuff
@@ -663,6 +882,9 @@ def __init__(
         self.no_shoeboxes_2d = no_shoeboxes_2d
         self.min_chunksize = min_chunksize
         self.is_stills = is_stills
+        self.timing_file = timing_file
+        self.interleave_imagesets = interleave_imagesets
+        self.stats = None
 
     def find_spots(self, experiments: ExperimentList) -> flex.reflection_table:
         """
@@ -682,14 +904,28 @@ def find_spots(self, experiments: ExperimentList) -> flex.reflection_table:
 
         # Loop through all the imagesets and find the strong spots
         reflections = flex.reflection_table()
+        self.stats = SpotFindingStats()
+
+        # Find the strong spots in all the imagesets together
+        if self._interleave(imagesets):
+            logger.info(
+                "-" * 80 + "\nFinding strong spots in %d imagesets\n" + "-" * 80,
+                len(imagesets),
+            )
+            found = self._find_spots_in_imagesets(imagesets)
+        else:
+            found = None
 
         for j, imageset in enumerate(imagesets):
 
             # Find the strong spots in the sequence
-            logger.info(
-                "-" * 80 + "\nFinding strong spots in imageset %d\n" + "-" * 80, j
-            )
-            table, hot_mask = self._find_spots_in_imageset(imageset)
+            if found is not None:
+                table, hot_mask = found[j]
+            else:
+                logger.info(
+                    "-" * 80 + "\nFinding strong spots in imageset %d\n" + "-" * 80, j
+                )
+                table, hot_mask = self._find_spots_in_imageset(imageset)
 
             # Fix up the experiment ID's now
             table["id"] = flex.int(table.nrows(), -1)
@@ -737,23 +973,102 @@ def find_spots(self, experiments: ExperimentList) -> flex.reflection_table:
         # Check for overloads
         reflections.is_overloaded(experiments)
 
+        # Write the timings and counters
+        if self.timing_file:
+            self.stats.as_file(self.timing_file)
+
         # Return the reflections
         return reflections
 
-    def _find_spots_in_imageset(self, imageset):
+    def find_spots_streaming(self, imageset):
         """
-        Do the spot finding.
+        Find the strong spots of a sequence one image at a time. The strong
+        pixels are labelled in 3D with a streaming labeller, so each spot is
+        given as soon as an image is read with none of its pixels, and the spots
+        can be processed while later images are still being read or collected.
+        The scan range, hot pixel mask and multiprocessing options aren't used.
+
+        :param imageset: The image sequence to process
+        :returns: An iterator of the image index and the spots finished once
+                  that image was added
+        """
+        mask = self.mask_generator(imageset)
+        if self.mask is not None:
+            mask = tuple(m1 & m2 for m1, m2 in zip(mask, self.mask))
+        labellers = [
+            StreamingLabelImageStack3d(p.get_image_size()[::-1])
+            for p in imageset.get_detector()
+        ]
+        zstart = imageset.get_array_range()[0]
+        for index in range(len(imageset)):
+            image = imageset.get_corrected_data(index)
+            image_mask = imageset.get_mask(index)
+            num_strong = 0
+            for labeller, im, mk, m in zip(labellers, image, image_mask, mask):
+                threshold_mask = self.threshold_function.compute_threshold(im, mk & m)
+                labeller.add_image(im, threshold_mask)
+                num_strong += threshold_mask.count(True)
+            logger.debug(
+                "Found %d strong pixels on image %d", num_strong, zstart + index + 1
+            )
+            if index == len(imageset) - 1:
+                for labeller in labellers:
+                    labeller.finish()
+            yield index, self._finished_spots(imageset, labellers, zstart)
 
-        :param imageset: The imageset to process
-        :return: The observed spots
+    def _finished_spots(self, imageset, labellers, zstart):
+        """
+        Create the reflections of the spots finished by streaming labellers
+        and clear the labellers.
+        """
+        shoeboxes = flex.shoebox()
+        for panel, labeller in enumerate(labellers):
+            shoeboxes.extend(flex.shoebox(labeller, panel, zstart))
+            labeller.clear()
+        size = shoeboxes.count_mask_values(MaskCode.Foreground | MaskCode.Valid)
+        shoeboxes = shoeboxes.select(
+            (size >= self.min_spot_size) & (size <= self.max_spot_size)
+        )
+        reflections = shoeboxes_to_reflection_table(
+            imageset, shoeboxes, filter_spots=self.filter_spots
+        )
+        reflections.set_flags(
+            flex.size_t_range(len(reflections)), reflections.flags.strong
+        )
+        return reflections
+
+    def _interleave(self, imagesets):
+        """
+        Check whether the images of the imagesets can be processed together.
+        The processes are only shared within a single job and the 2D spot
+        finding without shoeboxes is done for each imageset.
+
+        :param imagesets: The imagesets to process
+        :returns: True/False
+        """
+        return (
+            self.interleave_imagesets
+            and len(imagesets) > 1
+            and self.mp_njobs == 1
+            and not self.no_shoeboxes_2d
+        )
+
+    def _imageset_mask(self, imageset):
+        """
+        :param imageset: The imageset
+        :return: The input mask of the imageset
         """
-        # The input mask
         mask = self.mask_generator(imageset)
         if self.mask is not None:
             mask = tuple(m1 & m2 for m1, m2 in zip(mask, self.mask))
+        return mask
 
-        # Set the spot finding algorithm
-        extract_spots = ExtractSpots(
+    def _extract_spots(self, mask):
+        """
+        :param mask: The input mask
+        :return: The spot finding algorithm
+        """
+        return ExtractSpots(
             threshold_function=self.threshold_function,
             mask=mask,
             region_of_interest=self.region_of_interest,
@@ -769,8 +1084,16 @@ def _find_spots_in_imageset(self, imageset):
             no_shoeboxes_2d=self.no_shoeboxes_2d,
             min_chunksize=self.min_chunksize,
             write_hot_pixel_mask=self.write_hot_mask,
+            stats=self.stats,
         )
 
+    def _scan_slices(self, imageset):
+        """
+        Split an imageset into the parts given by the scan range.
+
+        :param imageset: The imageset to process
+        :return: The first and last image and the imageset of each part
+        """
         # Get the max scan range
         if isinstance(imageset, ImageSequence):
             max_scan_range = imageset.get_array_range()
@@ -783,9 +1106,8 @@ def _find_spots_in_imageset(self, imageset):
         else:
             scan_range = self.scan_range
 
-        # Get spots from bits of scan
-        hot_pixels = tuple(flex.size_t() for i in range(len(imageset.get_detector())))
-        reflections = flex.reflection_table()
+        # Get the bits of scan
+        slices = []
         for j0, j1 in scan_range:
             # Make sure we were asked to do something sensible
             if j1 < j0:
@@ -796,13 +1118,23 @@ def _find_spots_in_imageset(self, imageset):
                         max_scan_range[0] + 1, max_scan_range[1]
                     )
                 )
-
-            logger.info("\nFinding spots in image %s to %s...", j0, j1)
-            j0 -= 1
             if len(imageset) == 1:
-                r, h = extract_spots(imageset)
+                slices.append((j0, j1, imageset))
             else:
-                r, h = extract_spots(imageset[j0:j1])
+                slices.append((j0, j1, imageset[j0 - 1 : j1]))
+        return slices
+
+    def _combine_slices(self, imageset, results):
+        """
+        Combine the spots found in the parts of the scan range of an imageset.
+
+        :param imageset: The imageset
+        :param results: The spots and hot pixels of each part
+        :return: The observed spots and the hot pixel mask
+        """
+        hot_pixels = tuple(flex.size_t() for i in range(len(imageset.get_detector())))
+        reflections = flex.reflection_table()
+        for r, h in results:
             reflections.extend(r)
             if h is not None:
                 for h1, h2 in zip(hot_pixels, h):
@@ -814,6 +1146,49 @@ def _find_spots_in_imageset(self, imageset):
         # Return as a reflection list
         return reflections, hot_mask
 
+    def _find_spots_in_imageset(self, imageset):
+        """
+        Do the spot finding.
+
+        :param imageset: The imageset to process
+        :return: The observed spots
+        """
+        # Set the spot finding algorithm
+        extract_spots = self._extract_spots(self._imageset_mask(imageset))
+
+        # Get spots from bits of scan
+        results = []
+        for j0, j1, scan_slice in self._scan_slices(imageset):
+            logger.info("\nFinding spots in image %s to %s...", j0, j1)
+            results.append(extract_spots(scan_slice))
+        return self._combine_slices(imageset, results)
+
+    def _find_spots_in_imagesets(self, imagesets):
+        """
+        Do the spot finding for several imagesets at once.
+
+        :param imagesets: The imagesets to process
+        :return: The observed spots and hot pixel mask of each imageset
+        """
+        extract_spots = self._extract_spots(None)
+        slices = []
+        masks = []
+        owners = []
+        for k, imageset in enumerate(imagesets):
+            mask = self._imageset_mask(imageset)
+            for j0, j1, scan_slice in self._scan_slices(imageset):
+                logger.info("Finding spots in imageset %d image %s to %s", k, j0, j1)
+                slices.append(scan_slice)
+                masks.append(mask)
+                owners.append(k)
+        results = extract_spots.find_spots_in_imagesets(slices, masks)
+        return [
+            self._combine_slices(
+                imageset, [r for r, o in zip(results, owners) if o == k]
+            )
+            for k, imageset in enumerate(imagesets)
+        ]
+
     def _create_hot_mask(self, imageset, hot_pixels):
         """
         Find hot pixels in images
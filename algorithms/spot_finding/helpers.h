@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_SPOT_FINDING_HELPERS_H
 #define DIALS_ALGORITHMS_SPOT_FINDING_HELPERS_H
 
+#include <map>
+#include <vector>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
@@ -24,7 +26,10 @@ namespace dials { namespace algorithms {
    */
   class Labeller {
   public:
-    Labeller() {}
+    /**
+     * @param take_ownership Reuse the input buffers where possible
+     */
+    Labeller(bool take_ownership = false) : take_ownership_(take_ownership) {}
 
     void add(const Shoebox<> &shoebox) {
       // Add to the list of shoeboxes
@@ -38,37 +43,50 @@ namespace dials { namespace algorithms {
       typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
         AdjacencyList;
 
-      // Create the edges between shoeboxes
+      // Nothing to do if there are no shoeboxes
+      if (shoeboxes_.size() == 0) {
+        return af::shared<Shoebox<> >();
+      }
+
+      // Bucket the shoeboxes by panel, first frame and a coarse grid in x/y
+      // so that only shoeboxes which could touch are compared
+      typedef std::map<GridKey, std::vector<std::size_t> > GridMap;
+      GridMap grid;
+      for (std::size_t s2 = 0; s2 < shoeboxes_.size(); ++s2) {
+        const int6 &bbox2 = shoeboxes_[s2].bbox;
+        for (int gy = bbox2[2] / grid_size; gy <= (bbox2[3] - 1) / grid_size; ++gy) {
+          for (int gx = bbox2[0] / grid_size; gx <= (bbox2[1] - 1) / grid_size;
+               ++gx) {
+            GridKey key(shoeboxes_[s2].panel, bbox2[4], gy, gx);
+            grid[key].push_back(s2);
+          }
+        }
+      }
+
+      // Create the edges between shoeboxes. Only pairs where the first
+      // shoebox ends on the frame where the second starts are connected.
       AdjacencyList graph(shoeboxes_.size());
+      std::vector<std::size_t> visited(shoeboxes_.size(), shoeboxes_.size());
       for (std::size_t s1 = 0; s1 < shoeboxes_.size() - 1; ++s1) {
         std::size_t panel1 = shoeboxes_[s1].panel;
         int6 bbox1 = shoeboxes_[s1].bbox;
-        for (std::size_t s2 = s1 + 1; s2 < shoeboxes_.size(); ++s2) {
-          std::size_t panel2 = shoeboxes_[s2].panel;
-          int6 bbox2 = shoeboxes_[s2].bbox;
-          if (panel1 == panel2 && bbox1[5] == bbox2[4]
-              && (bbox1[0] < bbox2[1] && bbox1[1] > bbox2[0] && bbox1[2] < bbox2[3]
-                  && bbox1[3] > bbox2[2])) {
-            af::const_ref<int, af::c_grid<3> > mask1 = shoeboxes_[s1].mask.const_ref();
-            af::const_ref<int, af::c_grid<3> > mask2 = shoeboxes_[s2].mask.const_ref();
-            int x0 = std::max(bbox1[0], bbox2[0]);
-            int x1 = std::min(bbox1[1], bbox2[1]);
-            int y0 = std::max(bbox1[2], bbox2[2]);
-            int y1 = std::min(bbox1[3], bbox2[3]);
-            int k1 = mask1.accessor()[0] - 1;
-            int k2 = 0;
-            for (int y = y0; y < y1; ++y) {
-              for (int x = x0; x < x1; ++x) {
-                int i1 = x - bbox1[0];
-                int i2 = x - bbox2[0];
-                int j1 = y - bbox1[2];
-                int j2 = y - bbox2[2];
-                DIALS_ASSERT(i1 >= 0 && i1 < mask1.accessor()[2]);
-                DIALS_ASSERT(i2 >= 0 && i2 < mask2.accessor()[2]);
-                DIALS_ASSERT(j1 >= 0 && j1 < mask1.accessor()[1]);
-                DIALS_ASSERT(j2 >= 0 && j2 < mask2.accessor()[1]);
-                if ((mask1(k1, j1, i1) & Foreground)
-                    && (mask2(k2, j2, i2) & Foreground)) {
+        for (int gy = bbox1[2] / grid_size; gy <= (bbox1[3] - 1) / grid_size; ++gy) {
+          for (int gx = bbox1[0] / grid_size; gx <= (bbox1[1] - 1) / grid_size;
+               ++gx) {
+            GridMap::const_iterator it = grid.find(GridKey(panel1, bbox1[5], gy, gx));
+            if (it == grid.end()) {
+              continue;
+            }
+            for (std::size_t n = 0; n < it->second.size(); ++n) {
+              std::size_t s2 = it->second[n];
+              if (s2 <= s1 || visited[s2] == s1) {
+                continue;
+              }
+              visited[s2] = s1;
+              int6 bbox2 = shoeboxes_[s2].bbox;
+              if (bbox1[0] < bbox2[1] && bbox1[1] > bbox2[0] && bbox1[2] < bbox2[3]
+                  && bbox1[3] > bbox2[2]) {
+                if (is_touching(shoeboxes_[s1], shoeboxes_[s2])) {
                   boost::add_edge(s1, s2, graph);
                 }
               }
@@ -92,6 +110,12 @@ namespace dials { namespace algorithms {
         result[i].panel = -1;
       }
 
+      // Count the number of shoeboxes in each component
+      std::vector<std::size_t> count(result.size(), 0);
+      for (std::size_t i = 0; i < labels.size(); ++i) {
+        count[labels[i]]++;
+      }
+
       // Set the shoeboxes
       for (std::size_t i = 0; i < labels.size(); ++i) {
         int l = labels[i];
@@ -109,14 +133,27 @@ namespace dials { namespace algorithms {
         }
       }
 
-      // Allocate all the arrays
+      // Allocate all the arrays. If we own the input then shoeboxes which
+      // are not merged with any other are passed through without a copy.
+      for (std::size_t i = 0; i < labels.size(); ++i) {
+        int l = labels[i];
+        if (take_ownership_ && count[l] == 1) {
+          result[l] = shoeboxes_[i];
+          shoeboxes_[i] = Shoebox<>();
+        }
+      }
       for (std::size_t i = 0; i < result.size(); ++i) {
-        result[i].allocate();
+        if (!(take_ownership_ && count[i] == 1)) {
+          result[i].allocate();
+        }
       }
 
       // Set all the mask and data points
       for (std::size_t i = 0; i < labels.size(); ++i) {
         int l = labels[i];
+        if (take_ownership_ && count[l] == 1) {
+          continue;
+        }
         int6 bbox1 = shoeboxes_[i].bbox;
         int6 bbox2 = result[l].bbox;
         DIALS_ASSERT(result[l].is_consistent());
@@ -148,6 +185,16 @@ namespace dials { namespace algorithms {
             }
           }
         }
+
+        // Release the input as soon as it has been merged
+        if (take_ownership_) {
+          shoeboxes_[i].deallocate();
+        }
+      }
+
+      // The input is no longer needed
+      if (take_ownership_) {
+        clear();
       }
 
       return result;
@@ -158,25 +205,93 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * The size of the cells used to bucket the shoeboxes in x and y
+     */
+    static const int grid_size = 32;
+
+    /**
+     * A key of (panel, frame, grid y, grid x)
+     */
+    struct GridKey {
+      std::size_t panel;
+      int z, y, x;
+
+      GridKey(std::size_t panel_, int z_, int y_, int x_)
+          : panel(panel_), z(z_), y(y_), x(x_) {}
+
+      bool operator<(const GridKey &other) const {
+        if (panel != other.panel) return panel < other.panel;
+        if (z != other.z) return z < other.z;
+        if (y != other.y) return y < other.y;
+        return x < other.x;
+      }
+    };
+
+    /**
+     * Check if a foreground pixel on the last frame of the first shoebox is
+     * next to a foreground pixel on the first frame of the second shoebox.
+     */
+    static bool is_touching(const Shoebox<> &sbox1, const Shoebox<> &sbox2) {
+      const int6 &bbox1 = sbox1.bbox;
+      const int6 &bbox2 = sbox2.bbox;
+      af::const_ref<int, af::c_grid<3> > mask1 = sbox1.mask.const_ref();
+      af::const_ref<int, af::c_grid<3> > mask2 = sbox2.mask.const_ref();
+      int x0 = std::max(bbox1[0], bbox2[0]);
+      int x1 = std::min(bbox1[1], bbox2[1]);
+      int y0 = std::max(bbox1[2], bbox2[2]);
+      int y1 = std::min(bbox1[3], bbox2[3]);
+      int k1 = mask1.accessor()[0] - 1;
+      int k2 = 0;
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+          int i1 = x - bbox1[0];
+          int i2 = x - bbox2[0];
+          int j1 = y - bbox1[2];
+          int j2 = y - bbox2[2];
+          DIALS_ASSERT(i1 >= 0 && i1 < mask1.accessor()[2]);
+          DIALS_ASSERT(i2 >= 0 && i2 < mask2.accessor()[2]);
+          DIALS_ASSERT(j1 >= 0 && j1 < mask1.accessor()[1]);
+          DIALS_ASSERT(j2 >= 0 && j2 < mask2.accessor()[1]);
+          if ((mask1(k1, j1, i1) & Foreground) && (mask2(k2, j2, i2) & Foreground)) {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    bool take_ownership_;
     af::shared<Shoebox<> > shoeboxes_;
   };
 
   /**
    * A class to combine strong spot lists (i.e. perform the connected component
    * labelling at the boundary of two spot lists from the same sequence.
+   *
+   * If take_ownership is set, the combiner takes the data and mask buffers of
+   * the shoeboxes passed to add() and leaves empty shoeboxes in their place.
+   * Only the components which span the block boundaries are then allocated
+   * again; all other shoeboxes are returned with their original buffers. In
+   * this mode, shoeboxes() hands over the result and resets the combiner.
    */
   class StrongSpotCombiner {
   public:
     /**
      * Initialise everything
+     * @param take_ownership Take the buffers of the input shoeboxes
      */
-    StrongSpotCombiner() : all_minz_(0), all_maxz_(0) {}
+    StrongSpotCombiner(bool take_ownership = false)
+        : labeller_(take_ownership),
+          take_ownership_(take_ownership),
+          all_minz_(0),
+          all_maxz_(0) {}
 
     /**
      * Add a reflection table to the combiner
      * @param rlist The reflection table
      */
-    void add(af::const_ref<Shoebox<> > shoebox) {
+    void add(af::ref<Shoebox<> > shoebox) {
       // Find the min and max frame
       int minz = shoebox[0].bbox[4];
       int maxz = shoebox[0].bbox[5];
@@ -208,6 +323,9 @@ namespace dials { namespace algorithms {
         } else {
           labeller_.add(shoebox[i]);
         }
+        if (take_ownership_) {
+          shoebox[i] = Shoebox<>();
+        }
       }
     }
 
@@ -218,11 +336,19 @@ namespace dials { namespace algorithms {
       af::shared<Shoebox<> > labelled = labeller_.shoeboxes();
       finished_.insert(finished_.end(), labelled.begin(), labelled.end());
       labeller_.clear();
+      if (take_ownership_) {
+        af::shared<Shoebox<> > result = finished_;
+        finished_ = af::shared<Shoebox<> >();
+        all_minz_ = 0;
+        all_maxz_ = 0;
+        return result;
+      }
       return finished_;
     }
 
   private:
     Labeller labeller_;
+    bool take_ownership_;
     af::shared<Shoebox<> > finished_;
     int all_minz_;
     int all_maxz_;
@@ -0,0 +1,88 @@
+"""
+Lightweight timings and counters for spot finding.
+
+The records are plain dictionaries so they can be returned from worker
+processes and written directly as JSON.
+"""
+
+import json
+import logging
+
+from dials.array_family import flex
+
+logger = logging.getLogger(__name__)
+
+# The bytes per pixel in a PixelList (value and index)
+PIXEL_LIST_BYTES_PER_PIXEL = 16
+
+# The bytes per pixel in an allocated shoebox (data, mask and background)
+SHOEBOX_BYTES_PER_PIXEL = 12
+
+
+def shoebox_bytes(shoeboxes):
+    """
+    Estimate the memory used by a list of shoeboxes from their bounding boxes.
+
+    :param shoeboxes: The shoeboxes
+    :returns: The number of bytes
+    """
+    if len(shoeboxes) == 0:
+        return 0
+    x0, x1, y0, y1, z0, z1 = shoeboxes.bounding_boxes().parts()
+    volume = (x1 - x0).as_double() * (y1 - y0).as_double() * (z1 - z0).as_double()
+    return int(flex.sum(volume)) * SHOEBOX_BYTES_PER_PIXEL
+
+
+class SpotFindingStats:
+    """
+    Collect the per-frame records and the per-stage records for a spot finding
+    run.
+
+    A frame record has the frame number, the time in seconds for each step
+    done on the frame and the counters for the frame. A stage record is for
+    work done once for a block of frames, such as labelling the strong
+    pixels, and has the name of the stage, its timings and its counters.
+    """
+
+    def __init__(self):
+        self.frames = []
+        self.stages = []
+
+    def add_frame(self, record):
+        """
+        Add a frame record.
+
+        :param record: The record for the frame
+        """
+        if record is not None:
+            self.frames.append(record)
+
+    def add_stage(self, name, record):
+        """
+        Add a stage record.
+
+        :param name: The name of the stage
+        :param record: The timings and counters for the stage
+        """
+        stage = {"stage": name}
+        stage.update(record)
+        self.stages.append(stage)
+
+    def as_dict(self):
+        """
+        :returns: The records as a dictionary, with the frames in order
+        """
+        return {
+            "frames": sorted(self.frames, key=lambda r: r["frame"]),
+            "stages": self.stages,
+        }
+
+    def as_file(self, filename):
+        """
+        Write the records to a JSON file.
+
+        :param filename: The output filename
+        """
+        logger.info("Writing spot finding timings to %s", filename)
+        with open(filename, "w") as outfile:
+            json.dump(self.as_dict(), outfile, indent=2)
@@ -0,0 +1,254 @@
+/*
+ * per_image_analysis.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/integration/prefilter.h>
+#include <dials/util/masking.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::util::ResolutionMap;
+  using scitbx::vec3;
+
+  /**
+   * Accumulate the per image spot statistics of per_image_analysis as the
+   * spots are found. Each spot is added once, with its resolution given
+   * directly or looked up in the resolution map of its panel, and the image
+   * counts are updated in place, so the statistics for a sweep are ready as
+   * soon as its last spot has been added.
+   *
+   * For each image this counts all the spots, the spots outside the ice rings
+   * and the spots at lower resolution than 4A, sums the intensity of the spots
+   * outside the ice rings and bins them by 1/d^2.
+   */
+  class PerImageStatistics {
+  public:
+    /**
+     * @param first_image The index of the first image
+     * @param num_images The number of images
+     * @param num_bins The number of resolution bins
+     * @param d_min The resolution of the outer edge of the last bin
+     */
+    PerImageStatistics(int first_image,
+                       std::size_t num_images,
+                       std::size_t num_bins,
+                       double d_min)
+        : first_image_(first_image),
+          num_bins_(num_bins),
+          d_star_sq_max_(1.0 / (d_min * d_min)),
+          num_rejected_(0),
+          n_spots_total_(num_images, 0),
+          n_spots_no_ice_(num_images, 0),
+          n_spots_4A_(num_images, 0),
+          total_intensity_(num_images, 0),
+          d_min_(num_images, -1),
+          histogram_(af::c_grid<2>(num_images, num_bins), 0) {
+      DIALS_ASSERT(num_images > 0);
+      DIALS_ASSERT(num_bins > 0);
+      DIALS_ASSERT(d_min > 0);
+    }
+
+    /**
+     * Add an ice ring. Spots within a ring are not counted as no ice spots.
+     * @param d_star_sq_min The inner edge of the ring in 1/d^2
+     * @param d_star_sq_max The outer edge of the ring in 1/d^2
+     */
+    void add_ring(double d_star_sq_min, double d_star_sq_max) {
+      rings_.add_ring(d_star_sq_min, d_star_sq_max);
+    }
+
+    /**
+     * Add the resolution map of the next panel
+     * @param map The resolution map
+     */
+    void add_panel(const ResolutionMap &map) {
+      panels_.push_back(map.resolution());
+    }
+
+    /**
+     * Add some spots with known resolution
+     * @param d The resolution of each spot
+     * @param xyz The pixel centroid of each spot
+     * @param intensity The intensity of each spot
+     */
+    void add_spots(const af::const_ref<double> &d,
+                   const af::const_ref<vec3<double> > &xyz,
+                   const af::const_ref<double> &intensity) {
+      DIALS_ASSERT(d.size() == xyz.size());
+      DIALS_ASSERT(d.size() == intensity.size());
+      for (std::size_t i = 0; i < d.size(); ++i) {
+        add_spot(image_index(xyz[i][2]), d[i], intensity[i]);
+      }
+    }
+
+    /**
+     * Add some spots, looking up their resolution from the map of the panel
+     * at the pixel holding their centroid.
+     * @param panel The panel of each spot
+     * @param xyz The pixel centroid of each spot
+     * @param intensity The intensity of each spot
+     */
+    void add_pixels(const af::const_ref<std::size_t> &panel,
+                    const af::const_ref<vec3<double> > &xyz,
+                    const af::const_ref<double> &intensity) {
+      DIALS_ASSERT(panel.size() == xyz.size());
+      DIALS_ASSERT(panel.size() == intensity.size());
+      for (std::size_t i = 0; i < panel.size(); ++i) {
+        DIALS_ASSERT(panel[i] < panels_.size());
+        const af::versa<double, af::c_grid<2> > &map = panels_[panel[i]];
+        int ysize = (int)map.accessor()[0];
+        int xsize = (int)map.accessor()[1];
+        int x = std::max(0, std::min(xsize - 1, (int)std::floor(xyz[i][0])));
+        int y = std::max(0, std::min(ysize - 1, (int)std::floor(xyz[i][1])));
+        add_spot(image_index(xyz[i][2]), map(y, x), intensity[i]);
+      }
+    }
+
+    /**
+     * Add the statistics of another set of spots from the same images, e.g.
+     * those found by another process
+     * @param other The other statistics
+     */
+    void merge(const PerImageStatistics &other) {
+      DIALS_ASSERT(other.first_image_ == first_image_);
+      DIALS_ASSERT(other.histogram_.accessor().all_eq(histogram_.accessor()));
+      DIALS_ASSERT(other.d_star_sq_max_ == d_star_sq_max_);
+      num_rejected_ += other.num_rejected_;
+      for (std::size_t i = 0; i < n_spots_total_.size(); ++i) {
+        n_spots_total_[i] += other.n_spots_total_[i];
+        n_spots_no_ice_[i] += other.n_spots_no_ice_[i];
+        n_spots_4A_[i] += other.n_spots_4A_[i];
+        total_intensity_[i] += other.total_intensity_[i];
+        if (other.d_min_[i] > 0 && (d_min_[i] < 0 || other.d_min_[i] < d_min_[i])) {
+          d_min_[i] = other.d_min_[i];
+        }
+      }
+      for (std::size_t i = 0; i < histogram_.size(); ++i) {
+        histogram_[i] += other.histogram_[i];
+      }
+    }
+
+    /** @returns The index of the first image */
+    int first_image() const {
+      return first_image_;
+    }
+
+    /** @returns The number of images */
+    std::size_t num_images() const {
+      return n_spots_total_.size();
+    }
+
+    /** @returns The number of spots outside the images or with no resolution */
+    std::size_t num_rejected() const {
+      return num_rejected_;
+    }
+
+    /** @returns The number of spots on each image */
+    af::shared<std::size_t> n_spots_total() const {
+      return af::shared<std::size_t>(n_spots_total_.begin(), n_spots_total_.end());
+    }
+
+    /** @returns The number of spots outside the ice rings on each image */
+    af::shared<std::size_t> n_spots_no_ice() const {
+      return af::shared<std::size_t>(n_spots_no_ice_.begin(), n_spots_no_ice_.end());
+    }
+
+    /** @returns The number of spots at lower resolution than 4A on each image */
+    af::shared<std::size_t> n_spots_4A() const {
+      return af::shared<std::size_t>(n_spots_4A_.begin(), n_spots_4A_.end());
+    }
+
+    /** @returns The intensity of the spots outside the ice rings */
+    af::shared<double> total_intensity() const {
+      return af::shared<double>(total_intensity_.begin(), total_intensity_.end());
+    }
+
+    /** @returns The resolution of the best spot outside the ice rings or -1 */
+    af::shared<double> d_min() const {
+      return af::shared<double>(d_min_.begin(), d_min_.end());
+    }
+
+    /** @returns The edges of the resolution bins in 1/d^2 */
+    af::shared<double> bin_edges() const {
+      af::shared<double> result(num_bins_ + 1);
+      for (std::size_t i = 0; i <= num_bins_; ++i) {
+        result[i] = d_star_sq_max_ * i / num_bins_;
+      }
+      return result;
+    }
+
+    /**
+     * @returns The number of spots outside the ice rings in each resolution
+     * bin of each image. Spots beyond the last bin are counted in it.
+     */
+    af::versa<std::size_t, af::c_grid<2> > histogram() const {
+      af::versa<std::size_t, af::c_grid<2> > result(histogram_.accessor());
+      std::copy(histogram_.begin(), histogram_.end(), result.begin());
+      return result;
+    }
+
+  private:
+    /**
+     * @returns The index of the image holding the frame or -1
+     */
+    int image_index(double z) const {
+      double image = std::floor(z) - first_image_;
+      if (!(image >= 0 && image < (double)n_spots_total_.size())) {
+        return -1;
+      }
+      return (int)image;
+    }
+
+    void add_spot(int image, double d, double intensity) {
+      if (image < 0 || !(d > 0) || !(d < std::numeric_limits<double>::infinity())) {
+        num_rejected_++;
+        return;
+      }
+      n_spots_total_[image]++;
+      if (d > 4) {
+        n_spots_4A_[image]++;
+      }
+      if (rings_.in_ring(d)) {
+        return;
+      }
+      n_spots_no_ice_[image]++;
+      total_intensity_[image] += intensity;
+      if (d_min_[image] < 0 || d < d_min_[image]) {
+        d_min_[image] = d;
+      }
+      double d_star_sq = 1.0 / (d * d);
+      std::size_t bin = (std::size_t)(num_bins_ * d_star_sq / d_star_sq_max_);
+      histogram_(image, std::min(bin, num_bins_ - 1))++;
+    }
+
+    int first_image_;
+    std::size_t num_bins_;
+    double d_star_sq_max_;
+    std::size_t num_rejected_;
+    IntegrationPrefilter rings_;
+    std::vector<af::versa<double, af::c_grid<2> > > panels_;
+    af::shared<std::size_t> n_spots_total_;
+    af::shared<std::size_t> n_spots_no_ice_;
+    af::shared<std::size_t> n_spots_4A_;
+    af::shared<double> total_intensity_;
+    af::shared<double> d_min_;
+    af::versa<std::size_t, af::c_grid<2> > histogram_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_ANALYSIS_H
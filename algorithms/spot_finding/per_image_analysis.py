@@ -6,8 +6,10 @@
 from scitbx import matrix
 
 from dials.algorithms.integration import filtering
+from dials.algorithms.spot_finding import PerImageStatistics
 from dials.array_family import flex
 from dials.util import tabulate
+from dials.util.masking import get_resolution_map
 
 Slot = collections.namedtuple("Slot", "d_min d_max")
 _stats_field_names = [
@@ -621,38 +623,87 @@ def stats_for_reflection_table(
     )
 
 
-def stats_per_image(experiment, reflections, resolution_analysis=True):
-    n_spots_total = []
-    n_spots_no_ice = []
-    n_spots_4A = []
-    total_intensity = []
-    estimated_d_min = []
-    d_min_distl_method_1 = []
-    d_min_distl_method_2 = []
-    noisiness_method_1 = []
-    noisiness_method_2 = []
-
-    image_number = reflections["xyzobs.px.value"].parts()[2]
-    image_number = flex.floor(image_number)
+def per_image_statistics(experiment, n_bins=20, filter_ice=True, ice_rings_width=0.004):
+    """
+    Create the accumulator for the per image spot counts of an experiment.
+
+    Spots can be added to it as they are found, either with their resolution
+    or with their pixel centroids, in which case their resolution is taken from
+    the cached resolution map of their panel.
 
+    :param experiment: The experiment
+    :param n_bins: The number of resolution bins
+    :param filter_ice: Don't count the spots in the ice rings as no ice spots
+    :param ice_rings_width: The width of the ice rings in 1/d^2
+    :returns: The PerImageStatistics accumulator
+    """
+    beam = experiment.beam
+    maps = [get_resolution_map(beam, panel) for panel in experiment.detector]
+    d_min = min(flex.min(m.resolution()) for m in maps)
     try:
         start, end = experiment.scan.get_array_range()
     except AttributeError:
         start, end = 0, 1
-    for i in range(start, end):
-        stats = stats_for_reflection_table(
-            reflections.select(image_number == i),
-            resolution_analysis=resolution_analysis,
+    statistics = PerImageStatistics(start, end - start, n_bins, d_min)
+    for m in maps:
+        statistics.add_panel(m)
+    if filter_ice:
+        # Include the rings just beyond the corners of the detector, since
+        # centroids can be further out than the centres of the last pixels
+        unit_cell = uctbx.unit_cell((4.498, 4.498, 7.338, 90, 90, 120))
+        space_group = sgtbx.space_group_info(number=194).group()
+        ice_filter = filtering.PowderRingFilter(
+            unit_cell, space_group, 0.9 * d_min, ice_rings_width
         )
-        n_spots_total.append(stats.n_spots_total)
-        n_spots_no_ice.append(stats.n_spots_no_ice)
-        n_spots_4A.append(stats.n_spots_4A)
-        total_intensity.append(stats.total_intensity)
-        estimated_d_min.append(stats.estimated_d_min)
-        d_min_distl_method_1.append(stats.d_min_distl_method_1)
-        noisiness_method_1.append(stats.noisiness_method_1)
-        d_min_distl_method_2.append(stats.d_min_distl_method_2)
-        noisiness_method_2.append(stats.noisiness_method_2)
+        for d_star_sq_min, d_star_sq_max in ice_filter.ranges():
+            statistics.add_ring(d_star_sq_min, d_star_sq_max)
+    return statistics
+
+
+def stats_per_image(experiment, reflections, resolution_analysis=True):
+    # Count the spots on each image in one pass. If the spots have not been
+    # mapped to reciprocal space then their resolution is found from the
+    # resolution map of their panel.
+    statistics = per_image_statistics(experiment)
+    xyz = reflections["xyzobs.px.value"]
+    intensities = reflections["intensity.sum.value"]
+    if "rlp" in reflections:
+        reflections = reflections.select(reflections["rlp"].norms() > 0)
+        d_spacings = uctbx.d_star_sq_as_d(flex.pow2(reflections["rlp"].norms()))
+        xyz = reflections["xyzobs.px.value"]
+        intensities = reflections["intensity.sum.value"]
+        statistics.add_spots(d_spacings, xyz, intensities)
+    else:
+        assert not resolution_analysis, "Reflections must have rlp for analysis"
+        statistics.add_pixels(reflections["panel"], xyz, intensities)
+
+    n_spots_total = list(statistics.n_spots_total())
+    n_spots_no_ice = list(statistics.n_spots_no_ice())
+    n_spots_4A = list(statistics.n_spots_4A())
+    total_intensity = list(statistics.total_intensity())
+    n_images = statistics.num_images()
+    estimated_d_min = [-1.0] * n_images
+    d_min_distl_method_1 = [-1.0] * n_images
+    d_min_distl_method_2 = [-1.0] * n_images
+    noisiness_method_1 = [-1.0] * n_images
+    noisiness_method_2 = [-1.0] * n_images
+
+    if resolution_analysis:
+        image_number = flex.floor(xyz.parts()[2])
+        for i in range(n_images):
+            if n_spots_no_ice[i] <= 10:
+                continue
+            refl = reflections.select(image_number == statistics.first_image() + i)
+            ice_sel = ice_rings_selection(refl)
+            estimated_d_min[i] = estimate_resolution_limit(refl, ice_sel=ice_sel)
+            (
+                d_min_distl_method_1[i],
+                noisiness_method_1[i],
+            ) = estimate_resolution_limit_distl_method1(refl)
+            (
+                d_min_distl_method_2[i],
+                noisiness_method_2[i],
+            ) = estimate_resolution_limit_distl_method2(refl)
 
     return StatsMultiImage(
         n_spots_total=n_spots_total,
@@ -667,6 +718,27 @@ def stats_per_image(experiment, reflections, resolution_analysis=True):
     )
 
 
+def stats_from_image_summary(summary):
+    """
+    Get the per image spot counts from the ImageSummary written by spot finding.
+    The resolution analysis needs the reflections, so its values are all -1.
+    """
+    if "n_spots_total" not in summary:
+        raise ValueError("The image summary has no spot statistics")
+    unknown = [-1.0] * summary.num_images
+    return StatsMultiImage(
+        n_spots_total=summary["n_spots_total"],
+        n_spots_no_ice=summary["n_spots_no_ice"],
+        n_spots_4A=summary["n_spots_4A"],
+        total_intensity=summary["total_intensity"],
+        estimated_d_min=unknown,
+        d_min_distl_method_1=unknown,
+        noisiness_method_1=unknown,
+        d_min_distl_method_2=unknown,
+        noisiness_method_2=unknown,
+    )
+
+
 def plot_stats(stats, filename="per_image_analysis.png"):
     from matplotlib import pyplot
 
@@ -0,0 +1,253 @@
+/*
+ * pixel_statistics.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_PIXEL_STATISTICS_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_PIXEL_STATISTICS_H
+
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::af::int2;
+
+  /**
+   * Accumulate the statistics of each pixel of a panel over the images of a
+   * sweep as they are read, so that hot and bad pixels can be found in one
+   * pass over the images.
+   *
+   * Each image is added with its mask and the strong pixels found by the
+   * threshold. For each pixel this counts the images where it is masked in
+   * but outside the trusted range and the images where it is strong, and
+   * keeps the running mean and sum of squared deviations of the trusted
+   * values with Welford's update. The rows of an image are split into bands
+   * for the threads, each of which only updates the pixels of its own band,
+   * and the statistics of images added to separate accumulators, e.g. by
+   * separate processes, can be merged.
+   */
+  class PixelStatistics {
+  public:
+    /**
+     * @param size The size of the panel as (slow, fast)
+     * @param trusted_min The minimum trusted value
+     * @param trusted_max The maximum trusted value
+     */
+    PixelStatistics(int2 size, double trusted_min, double trusted_max)
+        : trusted_min_(trusted_min),
+          trusted_max_(trusted_max),
+          num_images_(0),
+          count_(af::c_grid<2>(size[0], size[1]), 0),
+          mean_(count_.accessor(), 0),
+          m2_(count_.accessor(), 0),
+          num_strong_(count_.accessor(), 0),
+          num_untrusted_(count_.accessor(), 0) {
+      DIALS_ASSERT(size.all_gt(0));
+      DIALS_ASSERT(trusted_min <= trusted_max);
+    }
+
+    /**
+     * Initialise from the statistics accumulated before
+     * @param trusted_min The minimum trusted value
+     * @param trusted_max The maximum trusted value
+     * @param num_images The number of images added
+     * @param count The number of trusted values of each pixel
+     * @param mean The mean of the trusted values
+     * @param m2 The sum of the squared deviations from the mean
+     * @param num_strong The number of images where each pixel is strong
+     * @param num_untrusted The number of untrusted values of each pixel
+     */
+    PixelStatistics(double trusted_min,
+                    double trusted_max,
+                    std::size_t num_images,
+                    const af::versa<int, af::c_grid<2> > &count,
+                    const af::versa<double, af::c_grid<2> > &mean,
+                    const af::versa<double, af::c_grid<2> > &m2,
+                    const af::versa<int, af::c_grid<2> > &num_strong,
+                    const af::versa<int, af::c_grid<2> > &num_untrusted)
+        : trusted_min_(trusted_min),
+          trusted_max_(trusted_max),
+          num_images_(num_images),
+          count_(count),
+          mean_(mean),
+          m2_(m2),
+          num_strong_(num_strong),
+          num_untrusted_(num_untrusted) {
+      DIALS_ASSERT(mean.accessor().all_eq(count.accessor()));
+      DIALS_ASSERT(m2.accessor().all_eq(count.accessor()));
+      DIALS_ASSERT(num_strong.accessor().all_eq(count.accessor()));
+      DIALS_ASSERT(num_untrusted.accessor().all_eq(count.accessor()));
+    }
+
+    /**
+     * Add an image
+     * @param image The image data
+     * @param mask The mask of the image
+     * @param strong The strong pixels of the image
+     * @param nthreads The number of threads to use
+     */
+    void add(const af::const_ref<double, af::c_grid<2> > &image,
+             const af::const_ref<bool, af::c_grid<2> > &mask,
+             const af::const_ref<bool, af::c_grid<2> > &strong,
+             std::size_t nthreads = 1) {
+      DIALS_ASSERT(image.accessor().all_eq(count_.accessor()));
+      DIALS_ASSERT(mask.accessor().all_eq(count_.accessor()));
+      DIALS_ASSERT(strong.accessor().all_eq(count_.accessor()));
+      DIALS_ASSERT(nthreads > 0);
+      dials::util::parallel_for(
+        count_.accessor()[0],
+        nthreads,
+        AddJob(*this, image.begin(), mask.begin(), strong.begin()));
+      num_images_++;
+    }
+
+    /**
+     * Add the statistics of other images of the same panel
+     * @param other The other statistics
+     */
+    void merge(const PixelStatistics &other) {
+      DIALS_ASSERT(other.count_.accessor().all_eq(count_.accessor()));
+      DIALS_ASSERT(other.trusted_min_ == trusted_min_);
+      DIALS_ASSERT(other.trusted_max_ == trusted_max_);
+      for (std::size_t i = 0; i < count_.size(); ++i) {
+        // Combine the moments as for Welford's update with a batch of values
+        int na = count_[i];
+        int nb = other.count_[i];
+        if (nb > 0) {
+          double n = na + nb;
+          double delta = other.mean_[i] - mean_[i];
+          mean_[i] += delta * nb / n;
+          m2_[i] += other.m2_[i] + delta * delta * ((double)na * nb / n);
+          count_[i] = na + nb;
+        }
+        num_strong_[i] += other.num_strong_[i];
+        num_untrusted_[i] += other.num_untrusted_[i];
+      }
+      num_images_ += other.num_images_;
+    }
+
+    /** @returns The size of the panel as (slow, fast) */
+    int2 size() const {
+      return int2((int)count_.accessor()[0], (int)count_.accessor()[1]);
+    }
+
+    /** @returns The minimum trusted value */
+    double trusted_min() const {
+      return trusted_min_;
+    }
+
+    /** @returns The maximum trusted value */
+    double trusted_max() const {
+      return trusted_max_;
+    }
+
+    /** @returns The number of images added */
+    std::size_t num_images() const {
+      return num_images_;
+    }
+
+    /** @returns The number of trusted values of each pixel */
+    af::versa<int, af::c_grid<2> > count() const {
+      return count_;
+    }
+
+    /** @returns The mean of the trusted values of each pixel */
+    af::versa<double, af::c_grid<2> > mean() const {
+      return mean_;
+    }
+
+    /** @returns The sum of the squared deviations from the mean */
+    af::versa<double, af::c_grid<2> > m2() const {
+      return m2_;
+    }
+
+    /**
+     * @returns The sample variance of the trusted values of each pixel, or
+     * zero for pixels with fewer than two values
+     */
+    af::versa<double, af::c_grid<2> > variance() const {
+      af::versa<double, af::c_grid<2> > result(count_.accessor(), 0);
+      for (std::size_t i = 0; i < count_.size(); ++i) {
+        if (count_[i] > 1) {
+          result[i] = m2_[i] / (count_[i] - 1);
+        }
+      }
+      return result;
+    }
+
+    /** @returns The number of images where each pixel is strong */
+    af::versa<int, af::c_grid<2> > num_strong() const {
+      return num_strong_;
+    }
+
+    /** @returns The number of images where each pixel is not trusted */
+    af::versa<int, af::c_grid<2> > num_untrusted() const {
+      return num_untrusted_;
+    }
+
+  private:
+    /**
+     * Add a band of rows of an image
+     */
+    class AddJob {
+    public:
+      AddJob(PixelStatistics &self,
+             const double *image,
+             const bool *mask,
+             const bool *strong)
+          : self_(&self), image_(image), mask_(mask), strong_(strong) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const std::size_t width = self_->count_.accessor()[1];
+        const double lo = self_->trusted_min_;
+        const double hi = self_->trusted_max_;
+        int *count = self_->count_.begin();
+        double *mean = self_->mean_.begin();
+        double *m2 = self_->m2_.begin();
+        int *num_strong = self_->num_strong_.begin();
+        int *num_untrusted = self_->num_untrusted_.begin();
+        for (std::size_t i = first * width; i < last * width; ++i) {
+          if (!mask_[i]) {
+            continue;
+          }
+          double value = image_[i];
+          if (!(value >= lo && value <= hi)) {
+            num_untrusted[i]++;
+            continue;
+          }
+          int n = ++count[i];
+          double delta = value - mean[i];
+          mean[i] += delta / n;
+          m2[i] += delta * (value - mean[i]);
+          if (strong_[i]) {
+            num_strong[i]++;
+          }
+        }
+      }
+
+    private:
+      PixelStatistics *self_;
+      const double *image_;
+      const bool *mask_;
+      const bool *strong_;
+    };
+
+    double trusted_min_;
+    double trusted_max_;
+    std::size_t num_images_;
+    af::versa<int, af::c_grid<2> > count_;
+    af::versa<double, af::c_grid<2> > mean_;
+    af::versa<double, af::c_grid<2> > m2_;
+    af::versa<int, af::c_grid<2> > num_strong_;
+    af::versa<int, af::c_grid<2> > num_untrusted_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_PIXEL_STATISTICS_H
@@ -16,6 +16,52 @@ def __call__(self, image):
         raise RuntimeError("Overload Me!")
 
 
+def threshold_batch(algorithm, images, masks, gain_map=None):
+    """
+    Threshold a batch of images with a batch threshold algorithm. The images
+    and masks are copied into single contiguous stacks so the whole batch is
+    passed to the algorithm in one call.
+
+    :param algorithm: The batch threshold algorithm
+    :param images: The list of images, all the same size
+    :param masks: The list of masks
+    :param gain_map: The gain map or None
+    :return: The list of thresholded images
+    """
+    from dials.array_family import flex
+
+    assert len(images) == len(masks)
+    if len(images) == 0:
+        return []
+    size = images[0].all()
+    image_stack = images[0].__class__()
+    mask_stack = flex.bool()
+    for image, mask in zip(images, masks):
+        assert image.all() == size and mask.all() == size
+        image_stack.extend(image.as_1d())
+        mask_stack.extend(mask.as_1d())
+    grid = flex.grid((len(images),) + size)
+    image_stack.reshape(grid)
+    mask_stack.reshape(grid)
+
+    # Compute the threshold
+    result = flex.bool(grid)
+    if gain_map is not None:
+        algorithm(image_stack, mask_stack, gain_map, result)
+    else:
+        algorithm(image_stack, mask_stack, result)
+
+    # Split the result into the individual images
+    n = size[0] * size[1]
+    result = result.as_1d()
+    output = []
+    for k in range(len(images)):
+        mask = result[k * n : (k + 1) * n]
+        mask.reshape(flex.grid(size))
+        output.append(mask)
+    return output
+
+
 class DispersionThresholdStrategy(ThresholdStrategy):
     """
     A class implementing a 'gain' threshold.
@@ -36,12 +82,15 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._tile_size = kwargs.get("tile_size")
+        self._nthreads = kwargs.get("nthreads", 1)
 
-        # Save the constant gain
-        self._gain_map = None
+        # Save the constant gain map for each image size
+        self._gain_map = {}
 
         # Create a buffer
         self.algorithm = {}
+        self.batch_algorithm = {}
 
     def __call__(self, image, mask):
         """
@@ -51,38 +100,124 @@ def __call__(self, image, mask):
         :param mask: The mask to use
         :return: The thresholded image
         """
-        from dials.algorithms.image import threshold
         from dials.array_family import flex
 
-        # Initialise the algorithm
-        try:
-            algorithm = self.algorithm[image.all()]
-        except Exception:
-            algorithm = threshold.DispersionThreshold(
-                image.all(),
+        algorithm = self._get_algorithm(image)
+        gain_map = self._get_gain_map(image)
+
+        # Compute the threshold
+        result = flex.bool(flex.grid(image.all()))
+        if gain_map is not None:
+            algorithm(image, mask, gain_map, result)
+        else:
+            algorithm(image, mask, result)
+
+        # Return the result
+        return result
+
+    def compute_runs(self, image, mask):
+        """
+        Call the thresholding function and return the strong pixels as runs
+        rather than as a dense mask.
+
+        :param image: The image to process
+        :param mask: The mask to use
+        :return: The strong pixel runs
+        """
+        from dials.model.data import StrongPixelRuns
+
+        algorithm = self._get_algorithm(image)
+        if not hasattr(algorithm, "threshold_runs"):
+            return StrongPixelRuns(self(image, mask))
+        gain_map = self._get_gain_map(image)
+
+        # Compute the threshold
+        result = StrongPixelRuns(image.all())
+        if gain_map is not None:
+            algorithm.threshold_runs(image, mask, gain_map, result)
+        else:
+            algorithm.threshold_runs(image, mask, result)
+        return result
+
+    def compute_batch(self, images, masks):
+        """
+        Call the thresholding function for a batch of images
+
+        :param images: The list of images, all the same size
+        :param masks: The list of masks
+        :return: The list of thresholded images
+        """
+        from dials.algorithms.image import threshold
+
+        if len(images) == 0:
+            return []
+        size = images[0].all()
+        algorithm = self.batch_algorithm.get(size)
+        if algorithm is None:
+            algorithm = threshold.BatchDispersionThreshold(
+                size,
                 self._kernel_size,
                 self._n_sigma_b,
                 self._n_sigma_s,
                 self._threshold,
                 self._min_count,
+                self._nthreads,
             )
+            self.batch_algorithm[size] = algorithm
+        return threshold_batch(algorithm, images, masks, self._get_gain_map(images[0]))
+
+    def _get_algorithm(self, image):
+        """
+        Get the threshold algorithm for the image size, creating it if needed.
+
+        :param image: The image to process
+        :return: The threshold algorithm
+        """
+        from dials.algorithms.image import threshold
+
+        try:
+            algorithm = self.algorithm[image.all()]
+        except Exception:
+            if self._tile_size is not None or self._nthreads > 1:
+                algorithm = threshold.TiledDispersionThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    self._tile_size or (512, 512),
+                    self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
+        return algorithm
 
-        # Set the gain
-        if self._gain is not None:
-            assert self._gain > 0
-            self._gain_map = flex.double(image.accessor(), self._gain)
-            self._gain = None
+    def _get_gain_map(self, image):
+        """
+        Get the constant gain map for the image size.
 
-        # Compute the threshold
-        result = flex.bool(flex.grid(image.all()))
-        if self._gain_map:
-            algorithm(image, mask, self._gain_map, result)
-        else:
-            algorithm(image, mask, result)
+        :param image: The image to process
+        :return: The gain map or None if no gain is set
+        """
+        from dials.array_family import flex
 
-        # Return the result
-        return result
+        if self._gain is None:
+            return None
+        assert self._gain > 0
+        gain_map = self._gain_map.get(image.all())
+        if gain_map is None:
+            gain_map = flex.double(image.accessor(), self._gain)
+            self._gain_map[image.all()] = gain_map
+        return gain_map
 
 
 class DispersionExtendedThresholdStrategy(ThresholdStrategy):
@@ -105,12 +240,15 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._tile_size = kwargs.get("tile_size")
+        self._nthreads = kwargs.get("nthreads", 1)
 
-        # Save the constant gain
-        self._gain_map = None
+        # Save the constant gain map for each image size
+        self._gain_map = {}
 
         # Create a buffer
         self.algorithm = {}
+        self.batch_algorithm = {}
 
     def __call__(self, image, mask):
         """
@@ -127,28 +265,81 @@ def __call__(self, image, mask):
         try:
             algorithm = self.algorithm[image.all()]
         except Exception:
-            algorithm = threshold.DispersionExtendedThreshold(
-                image.all(),
-                self._kernel_size,
-                self._n_sigma_b,
-                self._n_sigma_s,
-                self._threshold,
-                self._min_count,
-            )
+            if self._tile_size is not None or self._nthreads > 1:
+                algorithm = threshold.TiledDispersionExtendedThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    self._tile_size or (512, 512),
+                    self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionExtendedThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
 
         # Set the gain
+        gain_map = None
         if self._gain is not None:
             assert self._gain > 0
-            self._gain_map = flex.double(image.accessor(), self._gain)
-            self._gain = None
+            gain_map = self._gain_map.get(image.all())
+            if gain_map is None:
+                gain_map = flex.double(image.accessor(), self._gain)
+                self._gain_map[image.all()] = gain_map
 
         # Compute the threshold
         result = flex.bool(flex.grid(image.all()))
-        if self._gain_map:
-            algorithm(image, mask, self._gain_map, result)
+        if gain_map is not None:
+            algorithm(image, mask, gain_map, result)
         else:
             algorithm(image, mask, result)
 
         # Return the result
         return result
+
+    def compute_batch(self, images, masks):
+        """
+        Call the thresholding function for a batch of images
+
+        :param images: The list of images, all the same size
+        :param masks: The list of masks
+        :return: The list of thresholded images
+        """
+        from dials.algorithms.image import threshold
+        from dials.array_family import flex
+
+        if len(images) == 0:
+            return []
+        images = [image.as_double() for image in images]
+        size = images[0].all()
+        algorithm = self.batch_algorithm.get(size)
+        if algorithm is None:
+            algorithm = threshold.BatchDispersionExtendedThreshold(
+                size,
+                self._kernel_size,
+                self._n_sigma_b,
+                self._n_sigma_s,
+                self._threshold,
+                self._min_count,
+                self._nthreads,
+            )
+            self.batch_algorithm[size] = algorithm
+
+        # Set the gain
+        gain_map = None
+        if self._gain is not None:
+            assert self._gain > 0
+            gain_map = self._gain_map.get(size)
+            if gain_map is None:
+                gain_map = flex.double(flex.grid(size), self._gain)
+                self._gain_map[size] = gain_map
+        return threshold_batch(algorithm, images, masks, gain_map)
@@ -41,7 +41,13 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const BeamBase &, const Detector &, const CrystalBase &>())
       .def("h", &PixelToMillerIndex_h_rotation)
       .def("h", &PixelToMillerIndex_h_stills)
-      .def("q", &PixelToMillerIndex::q);
+      .def("q", &PixelToMillerIndex::q)
+      .def("h_grid",
+           &PixelToMillerIndex::h_grid,
+           (arg("panel"), arg("z"), arg("nthreads") = 1))
+      .def("h_grid_stills",
+           &PixelToMillerIndex::h_grid_stills,
+           (arg("panel"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -29,8 +29,14 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double,
                 double>())
-      .def("for_ub_old_index_generator", &Predictor::for_ub_old_index_generator)
-      .def("for_ub", &Predictor::for_ub)
+      .def("for_ub_old_index_generator",
+           &Predictor::for_ub_old_index_generator,
+           (arg("ub"), arg("nthreads") = 1))
+      .def("for_ub", &Predictor::for_ub, (arg("ub"), arg("nthreads") = 1))
+      .def("frame_range", &Predictor::frame_range)
+      .def("for_ub_on_frame_range",
+           &Predictor::for_ub_on_frame_range,
+           (arg("ub"), arg("frame0"), arg("frame1"), arg("nthreads") = 1))
       .def("for_hkl", &Predictor::for_hkl)
       .def("for_hkl", &Predictor::for_hkl_with_individual_ub)
       .def("for_reflection_table", &Predictor::for_reflection_table)
@@ -82,6 +88,9 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double&>())
       .def("__call__", predict_all)
       .def("for_ub", &Predictor::for_ub)
+      .def("for_ub_multi",
+           &Predictor::for_ub_multi,
+           (arg("ub"), arg("unit_cell"), arg("s0"), arg("nthreads") = 1))
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
@@ -116,6 +125,9 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double&>())
       .def("__call__", predict_all)
       .def("for_ub", &Predictor::for_ub)
+      .def("for_ub_multi",
+           &Predictor::for_ub_multi,
+           (arg("ub"), arg("unit_cell"), arg("s0"), arg("nthreads") = 1))
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
@@ -148,6 +160,9 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double&>())
       .def("__call__", predict_all)
       .def("for_ub", &Predictor::for_ub)
+      .def("for_ub_multi",
+           &Predictor::for_ub_multi,
+           (arg("ub"), arg("unit_cell"), arg("s0"), arg("nthreads") = 1))
       .def("__call__", predict_observed)
       .def("__call__", predict_observed_with_panel)
       .def("__call__", predict_observed_with_panel_list)
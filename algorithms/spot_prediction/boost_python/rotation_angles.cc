@@ -16,6 +16,16 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  static boost::python::tuple rotation_angles_batch(
+    const RotationAngles &self,
+    const af::const_ref<scitbx::vec3<double> > &pstar0) {
+    af::shared<double> phi1(pstar0.size());
+    af::shared<double> phi2(pstar0.size());
+    af::shared<bool> valid(pstar0.size());
+    self(pstar0, phi1.ref(), phi2.ref(), valid.ref());
+    return boost::python::make_tuple(phi1, phi2, valid);
+  }
+
   void export_rotation_angles() {
     scitbx::vec2<double> (RotationAngles::*calculate_pstar0)(scitbx::vec3<double>)
       const = &RotationAngles::operator();
@@ -27,7 +37,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<scitbx::vec3<double>, scitbx::vec3<double> >(
         (arg("beam_direction"), arg("rotation_axis"))))
       .def("__call__", calculate_pstar0)
-      .def("__call__", calculate_miller);
+      .def("__call__", calculate_miller)
+      .def("batch", &rotation_angles_batch, (arg("pstar0")));
   }
 
 }}}  // namespace dials::algorithms::boost_python
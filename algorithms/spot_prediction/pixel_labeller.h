@@ -19,6 +19,7 @@
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -80,27 +81,53 @@ namespace dials { namespace algorithms {
      * @param index The index labels
      * @param A The setting matrix
      * @param panel_number The panel
+     * @param nthreads The number of threads to split the rows between
      */
     void label(af::ref<cctbx::miller::index<> > index,
                mat3<double> A,
-               std::size_t panel_number) const {
+               std::size_t panel_number,
+               std::size_t nthreads = 1) const {
       DIALS_ASSERT(panel_number < size());
+      DIALS_ASSERT(nthreads > 0);
       af::c_grid<2> size = panel_size(panel_number);
       DIALS_ASSERT(index.size() == size[0] * size[1]);
-      mat3<double> A1 = A.inverse();
-      pstar_array_type ps = p_star_[panel_number];
-      for (std::size_t j = 0; j < size[0]; ++j) {
-        for (std::size_t i = 0; i < size[1]; ++i) {
-          vec3<double> hf = A1 * ps(j, i);
-          cctbx::miller::index<> h((int)std::floor(hf[0] + 0.5),
-                                   (int)std::floor(hf[1] + 0.5),
-                                   (int)std::floor(hf[2] + 0.5));
-          index[i + j * size[1]] = h;
-        }
-      }
+      dials::util::parallel_for(
+        size[0],
+        nthreads,
+        LabelJob(A.inverse(), p_star_[panel_number].const_ref(), index));
     }
 
   private:
+    /**
+     * Label the pixels in a range of rows. Each row is written by only one
+     * job so the rows can be labelled in parallel.
+     */
+    class LabelJob {
+    public:
+      LabelJob(mat3<double> A1,
+               af::const_ref<vec3<double>, af::c_grid<2> > ps,
+               af::ref<cctbx::miller::index<> > index)
+          : A1_(A1), ps_(ps), index_(index) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t width = ps_.accessor()[1];
+        for (std::size_t j = first; j < last; ++j) {
+          for (std::size_t i = 0; i < width; ++i) {
+            vec3<double> hf = A1_ * ps_(j, i);
+            cctbx::miller::index<> h((int)std::floor(hf[0] + 0.5),
+                                     (int)std::floor(hf[1] + 0.5),
+                                     (int)std::floor(hf[2] + 0.5));
+            index_[i + j * width] = h;
+          }
+        }
+      }
+
+    private:
+      mat3<double> A1_;
+      af::const_ref<vec3<double>, af::c_grid<2> > ps_;
+      af::ref<cctbx::miller::index<> > index_;
+    };
+
     array_type p_star_;
   };
 
@@ -11,11 +11,14 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dxtbx/model/scan.h>
 #include <dxtbx/model/crystal.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -24,6 +27,7 @@ namespace dials { namespace algorithms {
   using dxtbx::model::CrystalBase;
   using dxtbx::model::Detector;
   using dxtbx::model::Goniometer;
+  using dxtbx::model::Panel;
   using dxtbx::model::Scan;
   using scitbx::mat3;
   using scitbx::vec2;
@@ -48,7 +52,8 @@ namespace dials { namespace algorithms {
           m2_(goniometer.get_rotation_axis_datum()),
           S_inv_(goniometer.get_setting_rotation().inverse()),
           F_inv_(goniometer.get_fixed_rotation().inverse()),
-          A_inv_(crystal.get_A().inverse()) {}
+          A_inv_(crystal.get_A().inverse()),
+          q_grid_(detector.size()) {}
 
     /**
      * Initialize with models
@@ -61,7 +66,8 @@ namespace dials { namespace algorithms {
           m2_(0, 0, 0),
           S_inv_(0, 0, 0, 0, 0, 0, 0, 0, 0),
           F_inv_(0, 0, 0, 0, 0, 0, 0, 0, 0),
-          A_inv_(crystal.get_A().inverse()) {}
+          A_inv_(crystal.get_A().inverse()),
+          q_grid_(detector.size()) {}
 
     /**
      * Compute the miller index
@@ -128,7 +134,110 @@ namespace dials { namespace algorithms {
       return s1 - s0_;
     }
 
+    /**
+     * Compute the miller index at the centre of every pixel of a panel on an
+     * image. The reciprocal lattice vectors of the pixel centres are computed
+     * the first time a panel is used and reused for every image after that,
+     * so only the rotation is applied for each image.
+     * @param panel The panel number
+     * @param z The image number
+     * @param nthreads The number of threads
+     * @returns The miller index of each pixel
+     */
+    af::versa<vec3<double>, af::c_grid<2> > h_grid(std::size_t panel,
+                                                   double z,
+                                                   std::size_t nthreads = 1) {
+      DIALS_ASSERT(!(m2_[0] == 0 && m2_[1] == 0 && m2_[2] == 0));
+      double angle = scan_.get_angle_from_array_index(z);
+      mat3<double> R = scitbx::math::r3_rotation::axis_and_angle_as_matrix(m2_, angle);
+      return transform_grid(
+        panel, A_inv_ * F_inv_ * R.transpose() * S_inv_, nthreads);
+    }
+
+    /**
+     * Compute the miller index at the centre of every pixel of a panel for a
+     * still image.
+     * @param panel The panel number
+     * @param nthreads The number of threads
+     * @returns The miller index of each pixel
+     */
+    af::versa<vec3<double>, af::c_grid<2> > h_grid_stills(std::size_t panel,
+                                                          std::size_t nthreads = 1) {
+      return transform_grid(panel, A_inv_, nthreads);
+    }
+
   protected:
+    typedef af::versa<vec3<double>, af::c_grid<2> > grid_type;
+
+    /**
+     * Compute the reciprocal lattice vectors at the pixel centres for a range
+     * of rows of a panel
+     */
+    class QJob {
+    public:
+      QJob(const Panel &panel, vec3<double> s0, af::ref<vec3<double>, af::c_grid<2> > q)
+          : panel_(&panel), s0_(s0), q_(q) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t j = first; j < last; ++j) {
+          for (std::size_t i = 0; i < q_.accessor()[1]; ++i) {
+            vec3<double> s1 =
+              panel_->get_pixel_lab_coord(vec2<double>(i + 0.5, j + 0.5)).normalize()
+              * s0_.length();
+            q_(j, i) = s1 - s0_;
+          }
+        }
+      }
+
+    private:
+      const Panel *panel_;
+      vec3<double> s0_;
+      af::ref<vec3<double>, af::c_grid<2> > q_;
+    };
+
+    /**
+     * Transform the reciprocal lattice vectors for a range of rows
+     */
+    class TransformJob {
+    public:
+      TransformJob(mat3<double> M,
+                   af::const_ref<vec3<double>, af::c_grid<2> > q,
+                   af::ref<vec3<double>, af::c_grid<2> > h)
+          : M_(M), q_(q), h_(h) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t width = q_.accessor()[1];
+        for (std::size_t k = first * width; k < last * width; ++k) {
+          h_[k] = M_ * q_[k];
+        }
+      }
+
+    private:
+      mat3<double> M_;
+      af::const_ref<vec3<double>, af::c_grid<2> > q_;
+      af::ref<vec3<double>, af::c_grid<2> > h_;
+    };
+
+    /**
+     * Apply a transformation to the reciprocal lattice vectors of a panel
+     */
+    grid_type transform_grid(std::size_t panel, mat3<double> M, std::size_t nthreads) {
+      DIALS_ASSERT(panel < detector_.size());
+      DIALS_ASSERT(nthreads > 0);
+      if (q_grid_[panel].size() == 0) {
+        vec2<std::size_t> image_size = detector_[panel].get_image_size();
+        grid_type q(af::c_grid<2>(image_size[1], image_size[0]));
+        dials::util::parallel_for(
+          image_size[1], nthreads, QJob(detector_[panel], s0_, q.ref()));
+        q_grid_[panel] = q;
+      }
+      const grid_type &q = q_grid_[panel];
+      grid_type h(q.accessor());
+      dials::util::parallel_for(
+        q.accessor()[0], nthreads, TransformJob(M, q.const_ref(), h.ref()));
+      return h;
+    }
+
     Detector detector_;
     Scan scan_;
     vec3<double> s0_;
@@ -136,6 +245,7 @@ namespace dials { namespace algorithms {
     mat3<double> S_inv_;
     mat3<double> F_inv_;
     mat3<double> A_inv_;
+    std::vector<grid_type> q_grid_;
   };
 
 }}  // namespace dials::algorithms
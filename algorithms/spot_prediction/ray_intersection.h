@@ -11,9 +11,13 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 
+#include <typeinfo>
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
 #include <dxtbx/model/detector.h>
+#include <dxtbx/model/pixel_to_millimeter.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/error.h>
 
@@ -22,9 +26,162 @@ namespace dials { namespace algorithms {
   // Using lots of stuff from other namespaces
   using dxtbx::model::Detector;
   using dxtbx::model::Panel;
+  using dxtbx::model::ParallaxCorrectedPxMmStrategy;
+  using dxtbx::model::PxMmStrategy;
+  using dxtbx::model::SimplePxMmStrategy;
+  using scitbx::mat3;
   using scitbx::vec2;
   using scitbx::vec3;
 
+  /**
+   * Intersect many rays with a multi-panel detector.
+   *
+   * Gives the same result as Detector::get_ray_intersection, i.e. the valid
+   * intersection with the largest w component and the lowest panel number on
+   * a tie, but is cheaper for detectors with many panels. The D matrices of
+   * the panels are copied into one contiguous block so the w components for
+   * all panels are computed in a single loop the compiler can vectorise. The
+   * full intersection is then only computed for panels which could beat the
+   * current best, starting with the panel of the previous ray, and checked
+   * against the millimetre bounds of each panel before the more expensive
+   * validity test of the panel itself.
+   */
+  class BatchRayIntersection {
+  public:
+    /**
+     * Cache the panel geometry
+     * @param detector The detector model
+     */
+    BatchRayIntersection(const Detector &detector)
+        : detector_(detector),
+          d_(9 * detector.size()),
+          bounds_(detector.size()),
+          w_(detector.size()),
+          last_(0) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        const Panel &p = detector[i];
+        mat3<double> D = p.get_D_matrix();
+        for (std::size_t j = 0; j < 9; ++j) {
+          d_[9 * i + j] = D[j];
+        }
+        bounds_[i] = panel_bounds(p);
+      }
+    }
+
+    /**
+     * Find the intersection of a ray with the detector
+     * @param s1 The diffracted beam vector
+     * @param panel The panel number of the intersection
+     * @param xy The millimetre coordinate of the intersection
+     * @returns True/False the ray intersects the detector
+     */
+    bool operator()(const vec3<double> &s1, std::size_t &panel, vec2<double> &xy) {
+      std::size_t n = w_.size();
+      if (n == 0) {
+        return false;
+      }
+
+      // The w component of the ray on every panel
+      const double *d = &d_[0];
+      double *w = &w_[0];
+      for (std::size_t i = 0; i < n; ++i) {
+        w[i] = d[9 * i + 6] * s1[0] + d[9 * i + 7] * s1[1] + d[9 * i + 8] * s1[2];
+      }
+
+      // Start from the panel hit by the previous ray, then look for a valid
+      // panel with a larger w, or the same w and a lower panel number
+      bool found = false;
+      double w_max = 0;
+      std::size_t best = 0;
+      vec2<double> xy_temp;
+      if (w[last_] > 0 && intersect(last_, s1, xy_temp)) {
+        found = true;
+        w_max = w[last_];
+        best = last_;
+        xy = xy_temp;
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+        if (w[i] > w_max || (found && w[i] == w_max && i < best)) {
+          if (intersect(i, s1, xy_temp)) {
+            found = true;
+            w_max = w[i];
+            best = i;
+            xy = xy_temp;
+          }
+        }
+      }
+      if (found) {
+        panel = best;
+        last_ = best;
+      }
+      return found;
+    }
+
+  private:
+    /**
+     * The millimetre bounds outside of which a coordinate cannot be valid.
+     * The bounds are padded by a pixel for rounding and, with a parallax
+     * correction, by the attenuation length, which bounds the correction.
+     * For other pixel to millimetre strategies the panel is unbounded.
+     */
+    struct Bounds {
+      bool bounded;
+      double x0, x1, y0, y1;
+    };
+
+    static Bounds panel_bounds(const Panel &p) {
+      Bounds b = {false, 0, 0, 0, 0};
+      const PxMmStrategy *strategy = p.get_px_mm_strategy().get();
+      double pad = 0;
+      if (strategy == NULL) {
+        return b;
+      } else if (typeid(*strategy) == typeid(SimplePxMmStrategy)) {
+        pad = 0;
+      } else if (typeid(*strategy) == typeid(ParallaxCorrectedPxMmStrategy)) {
+        double mu =
+          static_cast<const ParallaxCorrectedPxMmStrategy *>(strategy)->mu();
+        if (!(mu > 0)) {
+          return b;
+        }
+        pad = 1.0 / mu;
+      } else {
+        return b;
+      }
+      vec2<double> pixel_size = p.get_pixel_size();
+      vec2<std::size_t> image_size = p.get_image_size();
+      double padx = pad + pixel_size[0];
+      double pady = pad + pixel_size[1];
+      b.bounded = true;
+      b.x0 = -padx;
+      b.x1 = image_size[0] * pixel_size[0] + padx;
+      b.y0 = -pady;
+      b.y1 = image_size[1] * pixel_size[1] + pady;
+      return b;
+    }
+
+    /**
+     * Compute the intersection with a panel where w is known to be positive
+     */
+    bool intersect(std::size_t i, const vec3<double> &s1, vec2<double> &xy) const {
+      const double *d = &d_[9 * i];
+      double w = w_[i];
+      xy[0] = (d[0] * s1[0] + d[1] * s1[1] + d[2] * s1[2]) / w;
+      xy[1] = (d[3] * s1[0] + d[4] * s1[1] + d[5] * s1[2]) / w;
+      const Bounds &b = bounds_[i];
+      if (b.bounded
+          && (xy[0] < b.x0 || xy[0] > b.x1 || xy[1] < b.y0 || xy[1] > b.y1)) {
+        return false;
+      }
+      return detector_[i].is_coord_valid_mm(xy);
+    }
+
+    const Detector &detector_;
+    std::vector<double> d_;
+    std::vector<Bounds> bounds_;
+    std::vector<double> w_;
+    std::size_t last_;
+  };
+
   // class ray_intersection2 {
   // public:
 
@@ -104,13 +261,19 @@ namespace dials { namespace algorithms {
     af::ref<std::size_t> panel = reflections["panel"];
     af::ref<vec3<double> > xyzcalmm = reflections["xyzcal.mm"];
     af::shared<bool> success(reflections.size(), true);
+    BatchRayIntersection intersection(detector);
     for (std::size_t i = 0; i < reflections.size(); ++i) {
       try {
-        Detector::coord_type coord = detector.get_ray_intersection(s1[i]);
-        xyzcalmm[i][0] = coord.second[0];
-        xyzcalmm[i][1] = coord.second[1];
-        xyzcalmm[i][2] = phi[i];
-        panel[i] = coord.first;
+        std::size_t panel_number = 0;
+        vec2<double> coord;
+        if (intersection(s1[i], panel_number, coord)) {
+          xyzcalmm[i][0] = coord[0];
+          xyzcalmm[i][1] = coord[1];
+          xyzcalmm[i][2] = phi[i];
+          panel[i] = panel_number;
+        } else {
+          success[i] = false;
+        }
       } catch (dxtbx::error const &) {
         success[i] = false;
       }
@@ -86,9 +86,7 @@ namespace dials { namespace algorithms {
 
       // Try to calculate the diffracting rotation angles
       vec2<double> phi;
-      try {
-        phi = calculate_rotation_angles_(pstar0);
-      } catch (error const&) {
+      if (!calculate_rotation_angles_.calculate(pstar0, phi)) {
         return rays;
       }
 
@@ -122,9 +120,7 @@ namespace dials { namespace algorithms {
 
       // Try to calculate the diffracting rotation angles
       vec2<double> phi;
-      try {
-        phi = calculate_rotation_angles_(pstar0);
-      } catch (error const&) {
+      if (!calculate_rotation_angles_.calculate(pstar0, phi)) {
         return rays;
       }
 
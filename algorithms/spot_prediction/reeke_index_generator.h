@@ -14,6 +14,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <vector>
 #include <boost/optional.hpp>
 #include <cctbx/miller.h>
 #include <cctbx/sgtbx/space_group_type.h>
@@ -232,6 +233,113 @@ namespace dials { namespace algorithms {
       af::small<double, 15> cp_end;
     };
 
+    /**
+     * Class to test for systematic absences along a line of indices
+     * h = h0 + r * e for integer r.
+     *
+     * An index is absent if it is left unchanged by the rotation part of a
+     * symmetry operator for which h.t is not an integer. Operators without a
+     * translation can never give an absence, so only the others are kept.
+     * For each line the remaining operators are split into those which leave
+     * every index on the line unchanged, for which h.t is linear in r, and
+     * those which leave at most one index unchanged. Each index can then be
+     * tested with a few integer operations rather than applying every
+     * symmetry operator in the space group.
+     */
+    class sys_absent_filter {
+    public:
+      /**
+       * Keep the symmetry operators with a translation
+       * @param space_group The space group
+       */
+      sys_absent_filter(cctbx::sgtbx::space_group const& space_group) {
+        for (std::size_t i = 0; i < space_group.order_z(); ++i) {
+          cctbx::sgtbx::rt_mx op = space_group(i);
+          operation o;
+          o.r = op.r();
+          o.t = op.t().num();
+          o.den = op.t().den();
+          if (o.t[0] % o.den != 0 || o.t[1] % o.den != 0 || o.t[2] % o.den != 0) {
+            ops_.push_back(o);
+          }
+        }
+      }
+
+      /**
+       * Set up the tests for a new line of indices
+       * @param h0 The index at r = 0
+       * @param e The change in index for a unit change in r
+       */
+      void set_line(cctbx::miller::index<> h0, cctbx::miller::index<> e) {
+        line_.clear();
+        points_.clear();
+        for (std::size_t i = 0; i < ops_.size(); ++i) {
+          const operation& o = ops_[i];
+          cctbx::miller::index<> h0r = h0 * o.r;
+          cctbx::miller::index<> er = e * o.r;
+          int d0[3] = {h0r[0] - h0[0], h0r[1] - h0[1], h0r[2] - h0[2]};
+          int de[3] = {er[0] - e[0], er[1] - e[1], er[2] - e[2]};
+          int a = dot(h0, o.t);
+          int b = dot(e, o.t);
+          if (de[0] == 0 && de[1] == 0 && de[2] == 0) {
+            // The operator leaves either all or none of the line unchanged
+            if (d0[0] == 0 && d0[1] == 0 && d0[2] == 0
+                && (a % o.den != 0 || b % o.den != 0)) {
+              term t = {a, b, o.den};
+              line_.push_back(t);
+            }
+          } else {
+            // The operator leaves at most one index on the line unchanged
+            std::size_t k = de[0] != 0 ? 0 : (de[1] != 0 ? 1 : 2);
+            if (d0[k] % de[k] == 0) {
+              int r = -d0[k] / de[k];
+              if (d0[0] + r * de[0] == 0 && d0[1] + r * de[1] == 0
+                  && d0[2] + r * de[2] == 0 && (a + r * b) % o.den != 0) {
+                points_.push_back(r);
+              }
+            }
+          }
+        }
+      }
+
+      /**
+       * @param r The position along the current line
+       * @returns True/False the index is systematically absent
+       */
+      bool is_absent(int r) const {
+        for (std::size_t i = 0; i < line_.size(); ++i) {
+          if ((line_[i].a + r * line_[i].b) % line_[i].den != 0) {
+            return true;
+          }
+        }
+        for (std::size_t i = 0; i < points_.size(); ++i) {
+          if (points_[i] == r) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+    private:
+      struct operation {
+        cctbx::sgtbx::rot_mx r;
+        cctbx::sgtbx::sg_vec3 t;
+        int den;
+      };
+
+      struct term {
+        int a, b, den;
+      };
+
+      static int dot(cctbx::miller::index<> const& h, cctbx::sgtbx::sg_vec3 const& t) {
+        return h[0] * t[0] + h[1] * t[1] + h[2] * t[2];
+      }
+
+      std::vector<operation> ops_;
+      std::vector<term> line_;
+      std::vector<int> points_;
+    };
+
   }  // namespace reeke_detail
 
   /**
@@ -669,7 +777,8 @@ namespace dials { namespace algorithms {
                         double dmin,
                         int margin)
         : model_(ub_beg, ub_end, axis, -s0, -s0, dmin, margin),
-          space_group_type_(space_group_type) {}
+          absent_(space_group_type.group()),
+          state_(0) {}
 
     /**
      * Initialise the reeke model with varying s0 vector
@@ -690,22 +799,14 @@ namespace dials { namespace algorithms {
                         double dmin,
                         int margin)
         : model_(ub_beg, ub_end, axis, -s0_beg, -s0_end, dmin, margin),
-          space_group_type_(space_group_type) {}
+          absent_(space_group_type.group()),
+          state_(0) {}
 
     /**
      * @returns The next miller index to be generated
      */
     cctbx::miller::index<> next() {
-      for (;;) {
-        cctbx::miller::index<> h = model_.permutation() * next_pqr();
-        if (h.is_zero()) {
-          break;
-        }
-        if (!space_group_type_.group().is_sys_absent(h)) {
-          return h;
-        }
-      }
-      return cctbx::miller::index<>(0, 0, 0);
+      return model_.permutation() * next_pqr();
     }
 
     /**
@@ -726,39 +827,38 @@ namespace dials { namespace algorithms {
 
   private:
     /**
-     * @returns The next pqr index
+     * @returns The next pqr index which is not systematically absent
      */
     cctbx::miller::index<> next_pqr() {
       // Constants to make clearer
       const int enter = 0;
       const int yield = 1;
 
-      // Static variables
-      static vec2<int> p;
-      static vec2<int> q;
-      static af::small<vec2<int>, 2> r;
-      static std::size_t ridx;
-      static int state = enter;
-
       // This switch simulates a co-routine or python generator. The first time
       // the function is executed, control starts at the top (case 1). On
       // subsequent calls, control starts after the "yield" point (case 0), The
-      // static variables ensure that the state is recovered on each subsequent
-      // function call.
+      // member variables ensure that the state is recovered on each subsequent
+      // function call. The absences are tested once per line of constant p
+      // and q, rather than by applying the symmetry operators to each index.
       cctbx::miller::index<> result(0, 0, 0);
-      switch (state) {
+      switch (state_) {
       case enter:
-        state = yield;
-        p = model_.p_limits();
-        for (; p[0] < p[1]; ++p[0]) {
-          q = model_.q_limits(p[0]);
-          for (; q[0] < q[1]; ++q[0]) {
-            r = model_.r_limits(p[0], q[0]);
-            ridx = 0;
-            for (; ridx < r.size(); ++ridx) {
-              for (; r[ridx][0] < r[ridx][1]; ++r[ridx][0]) {
-                result = cctbx::miller::index<>(p[0], q[0], r[ridx][0]);
-                if (!result.is_zero()) {
+        state_ = yield;
+        p_ = model_.p_limits();
+        for (; p_[0] < p_[1]; ++p_[0]) {
+          q_ = model_.q_limits(p_[0]);
+          for (; q_[0] < q_[1]; ++q_[0]) {
+            r_ = model_.r_limits(p_[0], q_[0]);
+            if (r_.size() > 0) {
+              absent_.set_line(
+                model_.permutation() * cctbx::miller::index<>(p_[0], q_[0], 0),
+                model_.permutation() * cctbx::miller::index<>(0, 0, 1));
+            }
+            ridx_ = 0;
+            for (; ridx_ < r_.size(); ++ridx_) {
+              for (; r_[ridx_][0] < r_[ridx_][1]; ++r_[ridx_][0]) {
+                result = cctbx::miller::index<>(p_[0], q_[0], r_[ridx_][0]);
+                if (!result.is_zero() && !absent_.is_absent(r_[ridx_][0])) {
                   return result;
                 case yield:;
                 }
@@ -767,12 +867,17 @@ namespace dials { namespace algorithms {
           }
         }
       }
-      state = enter;
+      state_ = enter;
       return cctbx::miller::index<>(0, 0, 0);
     }
 
     ReekeModel model_;
-    cctbx::sgtbx::space_group_type space_group_type_;
+    reeke_detail::sys_absent_filter absent_;
+    vec2<int> p_;
+    vec2<int> q_;
+    af::small<vec2<int>, 2> r_;
+    std::size_t ridx_;
+    int state_;
   };
 
 }}  // namespace dials::algorithms
@@ -13,6 +13,10 @@
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_REFLECTION_PREDICTOR_H
 
 #include <algorithm>
+#include <map>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scitbx/math/r3_rotation.h>
 #include <scitbx/constants.h>
 #include <dxtbx/model/beam.h>
@@ -27,6 +31,7 @@
 #include <dials/algorithms/spot_prediction/scan_varying_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/stills_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/ray_intersection.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace algorithms {
 
@@ -65,6 +70,20 @@ namespace dials { namespace algorithms {
       xyz_mm = table.get<vec3<double> >("xyzcal.mm");
       flags = table.get<std::size_t>("flags");
     }
+
+    /**
+     * Append the predictions from another container
+     * @param other The other predictions
+     */
+    void extend(const prediction_data &other) {
+      hkl.extend(other.hkl.begin(), other.hkl.end());
+      panel.extend(other.panel.begin(), other.panel.end());
+      enter.extend(other.enter.begin(), other.enter.end());
+      s1.extend(other.s1.begin(), other.s1.end());
+      xyz_px.extend(other.xyz_px.begin(), other.xyz_px.end());
+      xyz_mm.extend(other.xyz_mm.begin(), other.xyz_mm.end());
+      flags.extend(other.flags.begin(), other.flags.end());
+    }
   };
 
   struct stills_prediction_data : prediction_data {
@@ -73,6 +92,15 @@ namespace dials { namespace algorithms {
     stills_prediction_data(af::reflection_table &table) : prediction_data(table) {
       delpsi = table.get<double>("delpsical.rad");
     }
+
+    /**
+     * Append the predictions from another container
+     * @param other The other predictions
+     */
+    void extend(const stills_prediction_data &other) {
+      prediction_data::extend(other);
+      delpsi.extend(other.delpsi.begin(), other.delpsi.end());
+    }
   };
 
   /**
@@ -112,7 +140,19 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(padding >= 0);
     }
 
-    af::reflection_table for_ub_old_index_generator(const mat3<double> &ub) const {
+    /**
+     * Predict reflections for UB by generating all the indices to the
+     * resolution limit. With more than one thread the indices are generated
+     * first and then split between the threads. The predictions are in the
+     * same order for any number of threads.
+     * @param ub The UB matrix
+     * @param nthreads The number of threads
+     * @returns A reflection table.
+     */
+    af::reflection_table for_ub_old_index_generator(const mat3<double> &ub,
+                                                    std::size_t nthreads = 1) const {
+      DIALS_ASSERT(nthreads > 0);
+
       // Create the reflection table and the local container
       af::reflection_table table;
       prediction_data predictions(table);
@@ -120,31 +160,79 @@ namespace dials { namespace algorithms {
       // Create the index generate and loop through the indices. For each index,
       // predict the rays and append to the reflection table
       IndexGenerator indices(unit_cell_, space_group_type_, dmin_);
+      if (nthreads == 1) {
+        for (;;) {
+          miller_index h = indices.next();
+          if (h.is_zero()) {
+            break;
+          }
+          append_for_index(predictions, ub, h);
+        }
+        return table;
+      }
+      std::vector<miller_index> hkl;
       for (;;) {
         miller_index h = indices.next();
         if (h.is_zero()) {
           break;
         }
-        append_for_index(predictions, ub, h);
+        hkl.push_back(h);
       }
+      std::map<std::size_t, af::reflection_table> chunks;
+      boost::mutex mutex;
+      dials::util::parallel_for(
+        hkl.size(), nthreads, IndexJob(this, ub, hkl, chunks, mutex));
+      extend(predictions, chunks);
 
       // Return the reflection table
       return table;
     }
 
     /**
-     * Predict reflections for UB
+     * Predict reflections for UB. With more than one thread the frames are
+     * split into ranges which are predicted into separate tables by each
+     * thread and then joined in order of frame, so the predictions are in the
+     * same order for any number of threads.
      * @param ub The UB matrix
+     * @param nthreads The number of threads
      * @returns A reflection table.
      */
-    af::reflection_table for_ub(const mat3<double> &ub) const {
-      // Get the array range and loop through all the images
+    af::reflection_table for_ub(const mat3<double> &ub,
+                                std::size_t nthreads = 1) const {
+      af::tiny<int, 2> z = frame_range();
+      return for_ub_on_frame_range(ub, z[0], z[1], nthreads);
+    }
+
+    /**
+     * @returns The range of frames predicted by for_ub, including the padding
+     */
+    af::tiny<int, 2> frame_range() const {
       double a0 = scan_.get_oscillation_range()[0];
       double a1 = scan_.get_oscillation_range()[1];
       int z0 =
         std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
       int z1 =
         std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
+      return af::tiny<int, 2>(z0, z1);
+    }
+
+    /**
+     * Predict reflections for UB on a range of frames. Predicting consecutive
+     * ranges of frames in turn gives the same reflections in the same order
+     * as for_ub, so the predictions for a scan can be made a block of frames
+     * at a time.
+     * @param ub The UB matrix
+     * @param z0 The first frame
+     * @param z1 The frame after the last frame
+     * @param nthreads The number of threads
+     * @returns A reflection table.
+     */
+    af::reflection_table for_ub_on_frame_range(const mat3<double> &ub,
+                                               int z0,
+                                               int z1,
+                                               std::size_t nthreads = 1) const {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(z1 >= z0);
 
       // Get the rotation axis and beam vector
       vec3<double> m2 = goniometer_.get_rotation_axis_datum();
@@ -153,22 +241,17 @@ namespace dials { namespace algorithms {
       // Create the reflection table and the local container
       af::reflection_table table;
       prediction_data predictions(table);
-      for (int frame = z0; frame < z1; ++frame) {
-        mat3<double> A1 = ub;
-        mat3<double> A2 = ub;
-        compute_setting_matrices(A1, A2, frame);
-
-        // Create the index generate and loop through the indices. For each index,
-        // predict the rays and append to the reflection table
-        ReekeIndexGenerator indices(A1, A2, space_group_type_, m2, s0, dmin_, margin_);
-        for (;;) {
-          miller_index h = indices.next();
-          if (h.is_zero()) {
-            break;
-          }
-          append_for_index(predictions, ub, h, frame);
+      if (nthreads == 1 || z1 - z0 <= 1) {
+        for (int frame = z0; frame < z1; ++frame) {
+          append_for_frame(predictions, ub, m2, s0, frame);
         }
+        return table;
       }
+      std::map<std::size_t, af::reflection_table> chunks;
+      boost::mutex mutex;
+      dials::util::parallel_for(
+        z1 - z0, nthreads, FrameJob(this, ub, m2, s0, z0, chunks, mutex));
+      extend(predictions, chunks);
 
       // Return the reflection table
       return table;
@@ -259,6 +342,116 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Predict the reflections for a range of frames into a separate table
+     */
+    class FrameJob {
+    public:
+      FrameJob(const ScanStaticReflectionPredictor *predictor,
+               mat3<double> ub,
+               vec3<double> m2,
+               vec3<double> s0,
+               int z0,
+               std::map<std::size_t, af::reflection_table> &chunks,
+               boost::mutex &mutex)
+          : predictor_(predictor),
+            ub_(ub),
+            m2_(m2),
+            s0_(s0),
+            z0_(z0),
+            chunks_(&chunks),
+            mutex_(&mutex) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        af::reflection_table table;
+        prediction_data predictions(table);
+        for (std::size_t i = first; i < last; ++i) {
+          predictor_->append_for_frame(predictions, ub_, m2_, s0_, z0_ + (int)i);
+        }
+        boost::lock_guard<boost::mutex> guard(*mutex_);
+        (*chunks_)[first] = table;
+      }
+
+    private:
+      const ScanStaticReflectionPredictor *predictor_;
+      mat3<double> ub_;
+      vec3<double> m2_;
+      vec3<double> s0_;
+      int z0_;
+      std::map<std::size_t, af::reflection_table> *chunks_;
+      boost::mutex *mutex_;
+    };
+
+    /**
+     * Predict the reflections for a range of indices into a separate table
+     */
+    class IndexJob {
+    public:
+      IndexJob(const ScanStaticReflectionPredictor *predictor,
+               mat3<double> ub,
+               const std::vector<miller_index> &hkl,
+               std::map<std::size_t, af::reflection_table> &chunks,
+               boost::mutex &mutex)
+          : predictor_(predictor),
+            ub_(ub),
+            hkl_(&hkl),
+            chunks_(&chunks),
+            mutex_(&mutex) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        af::reflection_table table;
+        prediction_data predictions(table);
+        for (std::size_t i = first; i < last; ++i) {
+          predictor_->append_for_index(predictions, ub_, (*hkl_)[i]);
+        }
+        boost::lock_guard<boost::mutex> guard(*mutex_);
+        (*chunks_)[first] = table;
+      }
+
+    private:
+      const ScanStaticReflectionPredictor *predictor_;
+      mat3<double> ub_;
+      const std::vector<miller_index> *hkl_;
+      std::map<std::size_t, af::reflection_table> *chunks_;
+      boost::mutex *mutex_;
+    };
+
+    /**
+     * Join the tables predicted by each thread in order
+     */
+    static void extend(prediction_data &p,
+                       std::map<std::size_t, af::reflection_table> &chunks) {
+      for (std::map<std::size_t, af::reflection_table>::iterator it = chunks.begin();
+           it != chunks.end();
+           ++it) {
+        p.extend(prediction_data(it->second));
+      }
+    }
+
+    /**
+     * Predict the reflections on a single frame
+     */
+    void append_for_frame(prediction_data &p,
+                          const mat3<double> &ub,
+                          const vec3<double> &m2,
+                          const vec3<double> &s0,
+                          int frame) const {
+      mat3<double> A1 = ub;
+      mat3<double> A2 = ub;
+      compute_setting_matrices(A1, A2, frame);
+
+      // Create the index generate and loop through the indices. For each index,
+      // predict the rays and append to the reflection table
+      ReekeIndexGenerator indices(A1, A2, space_group_type_, m2, s0, dmin_, margin_);
+      for (;;) {
+        miller_index h = indices.next();
+        if (h.is_zero()) {
+          break;
+        }
+        append_for_index(p, ub, h, frame);
+      }
+    }
+
     /**
      * Helper function to compute the setting matrix and the beginning and end
      * of a frame.
@@ -617,9 +810,10 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(scan_.get_oscillation()[1] > 0.0);
       af::reflection_table table;
       prediction_data predictions(table);
+      ModelCache cache;
       for (std::size_t i = 0; i < h.size(); ++i) {
         append_for_index(
-          predictions, ub[i], s0[i], d[i], S[i], h[i], entering[i], panel[i]);
+          predictions, cache, ub[i], s0[i], d[i], S[i], h[i], entering[i], panel[i]);
       }
       DIALS_ASSERT(table.nrows() == h.size());
       return table;
@@ -756,7 +950,9 @@ namespace dials { namespace algorithms {
       vec3<double> m2 = goniometer_.get_rotation_axis_datum();
       compute_setting_matrices(A1, A2, S1, S2, frame);
 
-      // Construct the index generator and do the predictions for each index
+      // Construct the index generator and do the predictions for each index.
+      // The interpolation of the beam is the same for all indices on the image.
+      ScanVaryingRayPredictor::BeamSegment beam(s0a, s0b);
       ReekeIndexGenerator indices(
         A1, A2, space_group_type_, m2, s0a, s0b, dmin_, margin_);
       for (;;) {
@@ -764,7 +960,7 @@ namespace dials { namespace algorithms {
         if (h.is_zero()) {
           break;
         }
-        append_for_index(p, A1, A2, s0a, s0b, frame, h);
+        append_for_index(p, A1, A2, beam, frame, h);
       }
     }
 
@@ -778,8 +974,8 @@ namespace dials { namespace algorithms {
      * @param h The Miller index
      */
     void append_for_index(prediction_data &p,
-                          mat3<double> A1,
-                          mat3<double> A2,
+                          const mat3<double> &A1,
+                          const mat3<double> &A2,
                           std::size_t frame,
                           const miller_index &h,
                           int panel = -1) const {
@@ -795,20 +991,18 @@ namespace dials { namespace algorithms {
      * @param p The reflection data
      * @param A1 The beginning setting matrix
      * @param A2 The end setting matrix
-     * @param s0a The beginning s0 vector
-     * @param s0b The end s0 vector
+     * @param beam The beginning and end s0 vectors
      * @param frame The frame to predict on
      * @param h The Miller index
      */
     void append_for_index(prediction_data &p,
-                          mat3<double> A1,
-                          mat3<double> A2,
-                          vec3<double> s0a,
-                          vec3<double> s0b,
+                          const mat3<double> &A1,
+                          const mat3<double> &A2,
+                          const ScanVaryingRayPredictor::BeamSegment &beam,
                           std::size_t frame,
                           const miller_index &h,
                           int panel = -1) const {
-      boost::optional<Ray> ray = predict_rays_(h, A1, A2, s0a, s0b, frame, 1);
+      boost::optional<Ray> ray = predict_rays_(h, A1, A2, beam, frame, 1);
       if (ray) {
         append_for_ray(p, h, *ray, panel);
       }
@@ -848,9 +1042,32 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * The local ray predictor and panel for the models of the last reflection.
+     * Consecutive reflections usually share the beam, goniometer setting and
+     * detector models, so these are only rebuilt when the models change.
+     */
+    struct ModelCache {
+      boost::shared_ptr<ScanStaticRayPredictor> predict_rays;
+      vec3<double> s0;
+      mat3<double> S;
+      boost::shared_ptr<Panel> panel;
+      std::size_t panel_index;
+      mat3<double> d;
+    };
+
+    /**
+     * @returns True/False the elements of two vectors or matrices are equal
+     */
+    template <typename T>
+    static bool equal(const T &a, const T &b) {
+      return std::equal(a.begin(), a.end(), b.begin());
+    }
+
     /**
      * Predict for a given miller index and all model states.
      * @param p The reflection data
+     * @param cache The ray predictor and panel for the last model state
      * @param ub The UB matrix
      * @param s0 The s0 vector
      * @param d The d matrix
@@ -860,6 +1077,7 @@ namespace dials { namespace algorithms {
      * @param panel The panel number
      */
     void append_for_index(prediction_data &p,
+                          ModelCache &cache,
                           const mat3<double> ub,
                           const vec3<double> s0,
                           const mat3<double> d,
@@ -871,20 +1089,31 @@ namespace dials { namespace algorithms {
       p.enter.push_back(entering);
       p.panel.push_back(panel);
       // Need a local ray predictor for just this reflection's s0
-      ScanStaticRayPredictor local_predict_rays_(s0,
-                                                 goniometer_.get_rotation_axis_datum(),
-                                                 goniometer_.get_fixed_rotation(),
-                                                 S,
-                                                 vec2<double>(0.0, two_pi));
-      af::small<Ray, 2> rays = local_predict_rays_(h, ub);
+      if (!cache.predict_rays || !equal(cache.s0, s0) || !equal(cache.S, S)) {
+        cache.predict_rays = boost::make_shared<ScanStaticRayPredictor>(
+          s0,
+          goniometer_.get_rotation_axis_datum(),
+          goniometer_.get_fixed_rotation(),
+          S,
+          vec2<double>(0.0, two_pi));
+        cache.s0 = s0;
+        cache.S = S;
+      }
+      af::small<Ray, 2> rays = (*cache.predict_rays)(h, ub);
       for (std::size_t i = 0; i < rays.size(); ++i) {
         if (rays[i].entering == entering) {
           p.s1.push_back(rays[i].s1);
           double frame = scan_.get_array_index_from_angle(rays[i].angle);
           try {
             // Need a local panel with the right D matrix
-            Panel local_panel(detector_[panel]);
-            local_panel.set_frame(d.get_column(0), d.get_column(1), d.get_column(2));
+            if (!cache.panel || cache.panel_index != panel || !equal(cache.d, d)) {
+              shared_ptr<Panel> local = boost::make_shared<Panel>(detector_[panel]);
+              local->set_frame(d.get_column(0), d.get_column(1), d.get_column(2));
+              cache.panel = local;
+              cache.panel_index = panel;
+              cache.d = d;
+            }
+            const Panel &local_panel = *cache.panel;
             vec2<double> mm = local_panel.get_ray_intersection(rays[i].s1);
             vec2<double> px = local_panel.millimeter_to_pixel(mm);
             p.xyz_mm.push_back(vec3<double>(mm[0], mm[1], rays[i].angle));
@@ -978,6 +1207,26 @@ namespace dials { namespace algorithms {
       return table;
     }
 
+    /**
+     * Predict reflections for many lattices which share the detector and
+     * space group, such as the lattices from a batch of stills. With more than
+     * one thread the lattices are split between the threads and the
+     * predictions joined in order of lattice, so they are the same for any
+     * number of threads.
+     * @param ub The UB matrix of each lattice
+     * @param unit_cell The unit cell of each lattice
+     * @param s0 The beam vector of each lattice
+     * @param nthreads The number of threads
+     * @returns A reflection table with the index of the lattice in the id column
+     */
+    af::reflection_table for_ub_multi(
+      const af::const_ref<mat3<double> > &ub,
+      const af::const_ref<cctbx::uctbx::unit_cell> &unit_cell,
+      const af::const_ref<vec3<double> > &s0,
+      std::size_t nthreads = 1) const {
+      return predict_multi(*this, ub, unit_cell, s0, nthreads);
+    }
+
     /**
      * Predict the reflections with given Miller indices.
      * @param h The miller index
@@ -1091,6 +1340,52 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Predict the reflections for many lattices with a predictor of the given
+     * type. Each thread predicts with its own copy of the predictor.
+     */
+    template <typename Predictor>
+    static af::reflection_table predict_multi(
+      const Predictor &predictor,
+      const af::const_ref<mat3<double> > &ub,
+      const af::const_ref<cctbx::uctbx::unit_cell> &unit_cell,
+      const af::const_ref<vec3<double> > &s0,
+      std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(ub.size() == unit_cell.size());
+      DIALS_ASSERT(ub.size() == s0.size());
+      std::map<std::size_t, af::reflection_table> chunks;
+      boost::mutex mutex;
+      MultiJob<Predictor> job(&predictor, ub, unit_cell, s0, chunks, mutex);
+      if (nthreads == 1 || ub.size() <= 1) {
+        job(0, ub.size());
+      } else {
+        dials::util::parallel_for(ub.size(), nthreads, job);
+      }
+
+      // Join the tables predicted by each thread in order
+      af::reflection_table table;
+      stills_prediction_data predictions(table);
+      af::shared<int> id = table.get<int>("id");
+      for (std::map<std::size_t, af::reflection_table>::iterator it = chunks.begin();
+           it != chunks.end();
+           ++it) {
+        predictions.extend(stills_prediction_data(it->second));
+        af::shared<int> chunk_id = it->second.get<int>("id");
+        id.extend(chunk_id.begin(), chunk_id.end());
+      }
+      DIALS_ASSERT(table.is_consistent());
+      return table;
+    }
+
+    /**
+     * Set the beam vector used to predict the rays
+     * @param s0 The beam vector
+     */
+    virtual void set_s0(vec3<double> s0) {
+      predict_ray_ = StillsRayPredictor(s0);
+    }
+
     /**
      * Predict for the given Miller index, UB matrix and panel number
      * @param p The reflection data
@@ -1145,6 +1440,51 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Predict the reflections for a range of lattices into a separate table
+     */
+    template <typename Predictor>
+    class MultiJob {
+    public:
+      MultiJob(const Predictor *predictor,
+               const af::const_ref<mat3<double> > &ub,
+               const af::const_ref<cctbx::uctbx::unit_cell> &unit_cell,
+               const af::const_ref<vec3<double> > &s0,
+               std::map<std::size_t, af::reflection_table> &chunks,
+               boost::mutex &mutex)
+          : predictor_(predictor),
+            ub_(ub),
+            unit_cell_(unit_cell),
+            s0_(s0),
+            chunks_(&chunks),
+            mutex_(&mutex) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        Predictor local(*predictor_);
+        StillsDeltaPsiReflectionPredictor &base = local;
+        af::reflection_table table;
+        stills_prediction_data predictions(table);
+        af::shared<int> id = table.get<int>("id");
+        for (std::size_t i = first; i < last; ++i) {
+          base.unit_cell_ = unit_cell_[i];
+          base.set_s0(s0_[i]);
+          af::reflection_table lattice = local.for_ub(ub_[i]);
+          predictions.extend(stills_prediction_data(lattice));
+          id.resize(predictions.hkl.size(), (int)i);
+        }
+        boost::lock_guard<boost::mutex> guard(*mutex_);
+        (*chunks_)[first] = table;
+      }
+
+    private:
+      const Predictor *predictor_;
+      af::const_ref<mat3<double> > ub_;
+      af::const_ref<cctbx::uctbx::unit_cell> unit_cell_;
+      af::const_ref<vec3<double> > s0_;
+      std::map<std::size_t, af::reflection_table> *chunks_;
+      boost::mutex *mutex_;
+    };
+
     /**
      * Helper function to do ray intersection with/without panel set.
      */
@@ -1227,6 +1567,22 @@ namespace dials { namespace algorithms {
       return table;
     }
 
+    /**
+     * Predict reflections for many lattices which share the detector
+     * @param ub The UB matrix of each lattice
+     * @param unit_cell The unit cell of each lattice
+     * @param s0 The beam vector of each lattice
+     * @param nthreads The number of threads
+     * @returns A reflection table with the index of the lattice in the id column
+     */
+    af::reflection_table for_ub_multi(
+      const af::const_ref<mat3<double> > &ub,
+      const af::const_ref<cctbx::uctbx::unit_cell> &unit_cell,
+      const af::const_ref<vec3<double> > &s0,
+      std::size_t nthreads = 1) const {
+      return predict_multi(*this, ub, unit_cell, s0, nthreads);
+    }
+
   private:
     const double ML_half_mosaicity_deg_;
     const double ML_domain_size_ang_;
@@ -1288,7 +1644,32 @@ namespace dials { namespace algorithms {
       return table;
     }
 
+    /**
+     * Predict reflections for many lattices which share the detector
+     * @param ub The UB matrix of each lattice
+     * @param unit_cell The unit cell of each lattice
+     * @param s0 The beam vector of each lattice
+     * @param nthreads The number of threads
+     * @returns A reflection table with the index of the lattice in the id column
+     */
+    af::reflection_table for_ub_multi(
+      const af::const_ref<mat3<double> > &ub,
+      const af::const_ref<cctbx::uctbx::unit_cell> &unit_cell,
+      const af::const_ref<vec3<double> > &s0,
+      std::size_t nthreads = 1) const {
+      return predict_multi(*this, ub, unit_cell, s0, nthreads);
+    }
+
   protected:
+    /**
+     * Set the beam vector used to predict the rays
+     * @param s0 The beam vector
+     */
+    virtual void set_s0(vec3<double> s0) {
+      StillsDeltaPsiReflectionPredictor::set_s0(s0);
+      spherical_relp_predict_ray_ = SphericalRelpStillsRayPredictor(s0);
+    }
+
     /**
      * Predict for the given Miller index, UB matrix and panel number.
      * Override uses SphericalRelpStillsRayPredictor.
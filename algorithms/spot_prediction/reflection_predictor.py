@@ -43,7 +43,14 @@ class ReflectionPredictor:
     """
 
     def __init__(
-        self, experiment, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        self,
+        experiment,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
     ):
         """
         Initialise a predictor for each experiment.
@@ -53,6 +60,7 @@ def __init__(
         :param dmax: The minimum resolution
         :param margin: The margin of hkl to predict
         :param force_static: force scan varying prediction to be static
+        :param nthreads: The number of threads for scan static prediction
         """
         from dxtbx.imageset import ImageSequence
 
@@ -156,7 +164,9 @@ def __call__(self):
 
                 predict = Predictor(
                     "scan static prediction",
-                    lambda: predict_method(experiment.crystal.get_A()),
+                    lambda: predict_method(
+                        experiment.crystal.get_A(), nthreads=nthreads
+                    ),
                 )
         else:
             predictor = StillsReflectionPredictor(experiment, dmin=dmin)
@@ -188,3 +198,73 @@ def predictor(self, index):
         :return: The predictor
         """
         return self._predict[index]
+
+
+def stills_batch_key(experiment, dmin=None):
+    """
+    Get the models which must be the same for stills experiments to be
+    predicted together with predict_stills.
+
+    :param experiment: The experiment
+    :param dmin: The maximum resolution
+    :return: The key, or None if the experiment must be predicted on its own
+    """
+    from dxtbx.imageset import ImageSequence
+
+    from dials.algorithms.profile_model.gaussian_rs import Model
+
+    if isinstance(experiment.imageset, ImageSequence) or experiment.crystal is None:
+        return None
+    if experiment.profile is not None and not isinstance(experiment.profile, Model):
+        return None
+    if dmin is None:
+        dmin = experiment.detector.get_max_resolution(experiment.beam.get_s0())
+    elif dmin < 0.5 * experiment.beam.get_wavelength():
+        return None
+
+    # The Nave model parameters of each crystal are fixed in the predictor
+    crystal = experiment.crystal
+    try:
+        mosaicity = (crystal.get_half_mosaicity_deg(), crystal.get_domain_size_ang())
+    except AttributeError:
+        mosaicity = None
+    if mosaicity is not None and None in mosaicity:
+        mosaicity = None
+    return (experiment.detector, crystal.get_space_group(), dmin, mosaicity)
+
+
+def predict_stills(experiments, dmin=None, dmax=None, nthreads=1):
+    """
+    Predict the reflections for a batch of stills experiments at once, rather
+    than one at a time. The experiments must all have the same key from
+    stills_batch_key. Each experiment may have its own beam.
+
+    :param experiments: The experiments to predict for
+    :param dmin: The maximum resolution
+    :param dmax: The minimum resolution
+    :param nthreads: The number of threads
+    :return: A reflection table with the index of the experiment in the id column
+    """
+    import dials_array_family_flex_ext
+    from dials.algorithms.spot_prediction import StillsReflectionPredictor
+    from dials.array_family import flex
+
+    keys = [stills_batch_key(e, dmin) for e in experiments]
+    assert keys and keys[0] is not None
+    assert all(k == keys[0] for k in keys)
+
+    predictor = StillsReflectionPredictor(experiments[0], dmin=dmin)
+    ub = flex.mat3_double([e.crystal.get_A() for e in experiments])
+    unit_cell = dials_array_family_flex_ext.unit_cell(len(experiments))
+    for i, e in enumerate(experiments):
+        unit_cell[i] = e.crystal.get_unit_cell()
+    s0 = flex.vec3_double([e.beam.get_s0() for e in experiments])
+    result = predictor.for_ub_multi(ub, unit_cell, s0, nthreads=nthreads)
+    if dmax is not None:
+        assert dmax > 0
+        result.compute_d(experiments)
+        result.del_selected(result["d"] > dmax)
+    logger.info(
+        "Predicted %d reflections for %d stills", len(result), len(experiments)
+    )
+    return result
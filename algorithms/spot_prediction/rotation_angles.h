@@ -16,6 +16,7 @@
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -49,7 +50,8 @@ namespace dials { namespace algorithms {
           m1_(calculate_goniometer_m1_axis()),
           m3_(calculate_goniometer_m3_axis()),
           s0_d_m2(s0_ * m2_),
-          s0_d_m3(s0_ * m3_) {}
+          s0_d_m3(s0_ * m3_),
+          four_s0_len_sq_(4 * s0_.length_sq()) {}
 
     /**
      * Calculate the rotation angles using the XDS method
@@ -58,9 +60,49 @@ namespace dials { namespace algorithms {
      * @throws error if no angles exist.
      */
     vec2<double> operator()(vec3<double> pstar0) const {
+      vec2<double> phi;
+      DIALS_ASSERT(calculate(pstar0, phi));
+      return phi;
+    }
+
+    /**
+     * Calculate the rotation angles for an array of reciprocal space vectors.
+     * Points which never reach the diffracting condition are marked as invalid
+     * and their angles set to zero.
+     * @param pstar0 The unrotated reciprocal space vectors
+     * @param phi1 The first rotation angle of each point
+     * @param phi2 The second rotation angle of each point
+     * @param valid Whether the angles exist for each point
+     */
+    void operator()(const af::const_ref<vec3<double> > &pstar0,
+                    af::ref<double> phi1,
+                    af::ref<double> phi2,
+                    af::ref<bool> valid) const {
+      DIALS_ASSERT(phi1.size() == pstar0.size());
+      DIALS_ASSERT(phi2.size() == pstar0.size());
+      DIALS_ASSERT(valid.size() == pstar0.size());
+      for (std::size_t i = 0; i < pstar0.size(); ++i) {
+        vec2<double> phi(0, 0);
+        valid[i] = calculate(pstar0[i], phi);
+        phi1[i] = phi[0];
+        phi2[i] = phi[1];
+      }
+    }
+
+    /**
+     * Calculate the rotation angles without throwing when they don't exist.
+     * This is much quicker than catching the error when many of the points
+     * never diffract.
+     * @param pstar0 The unrotated reciprocal space vector
+     * @param phi The two rotation angles
+     * @returns True if the angles exist
+     */
+    bool calculate(vec3<double> pstar0, vec2<double> &phi) const {
       // Calculate sq length of pstar0 and ensure p*^2 <= 4s0^2
       double pstar0_len_sq = pstar0.length_sq();
-      DIALS_ASSERT(pstar0_len_sq <= 4 * s0_.length_sq());
+      if (!(pstar0_len_sq <= four_s0_len_sq_)) {
+        return false;
+      }
 
       // Calculate dot product of p*0 with m1 and m3
       double pstar0_d_m1 = pstar0 * m1_;
@@ -73,7 +115,9 @@ namespace dials { namespace algorithms {
       // Calculate sq distance of p*0 from rotation axis and ensure that
       // rho^2 >= (p*.m3)^2
       double rho_sq = (pstar0_len_sq - sqr(pstar0_d_m2));
-      DIALS_ASSERT(rho_sq >= sqr(pstar_d_m3));
+      if (!(rho_sq >= sqr(pstar_d_m3))) {
+        return false;
+      }
 
       // Calculate dot product of p* with m1
       double pstar_d_m1 = sqrt(rho_sq - sqr(pstar_d_m3));
@@ -86,7 +130,8 @@ namespace dials { namespace algorithms {
       sinphi2 = (-(pstar_d_m1 * pstar0_d_m3) - (pstar_d_m3 * pstar0_d_m1));
 
       // Return the two angles
-      return vec2<double>(atan2(sinphi1, cosphi1), atan2(sinphi2, cosphi2));
+      phi = vec2<double>(atan2(sinphi1, cosphi1), atan2(sinphi2, cosphi2));
+      return true;
     }
 
     /**
@@ -118,6 +163,7 @@ namespace dials { namespace algorithms {
     vec3<double> m3_;
     double s0_d_m2;
     double s0_d_m3;
+    double four_s0_len_sq_;
   };
 
   /**
@@ -50,6 +50,29 @@ namespace dials { namespace algorithms {
     // Typedef the miller_index type
     typedef cctbx::miller::index<> miller_index;
 
+    /**
+     * The beam vectors at the beginning and end of a step, with the lengths
+     * and directions needed to interpolate between them
+     */
+    struct BeamSegment {
+      vec3<double> s0a;
+      vec3<double> s0b;
+      double s0a_mag;
+      double s0b_mag;
+      vec3<double> us0a;
+      vec3<double> dus0;
+      double wavenumber;
+
+      BeamSegment(const vec3<double> &s0a_, const vec3<double> &s0b_)
+          : s0a(s0a_),
+            s0b(s0b_),
+            s0a_mag(s0a_.length()),
+            s0b_mag(s0b_.length()),
+            us0a(s0a_.normalize()),
+            dus0(s0b_.normalize() - us0a),
+            wavenumber((s0a_mag + s0b_mag) * 0.5) {}
+    };
+
     /**
      * Initialise the predictor.
      * @param s0 The beam vector
@@ -90,8 +113,13 @@ namespace dials { namespace algorithms {
                                     const mat3<double> &A2,
                                     int image,
                                     std::size_t step) const {
-      // Calculate the reciprocal space vectors
+      // Calculate the reciprocal space vectors. Most of the candidate indices
+      // are outside the resolution limit so check that first.
       vec3<double> r1 = A1 * h;
+      double r1_sq = r1.length_sq();
+      if (r1_sq > dstarmax_sq_) {
+        return boost::optional<Ray>();
+      }
       vec3<double> r2 = A2 * h;
       vec3<double> dr = r2 - r1;
       vec3<double> s0pr1 = s0_ + r1;
@@ -101,12 +129,10 @@ namespace dials { namespace algorithms {
       double r1_from_es = s0pr1.length() - s0_mag_;
       double r2_from_es = s0pr2.length() - s0_mag_;
 
-      // Check that the reflection cross the ewald sphere and is within
-      // the resolution limit
+      // Check that the reflection cross the ewald sphere
       bool starts_outside = r1_from_es >= 0.0;
       bool ends_outside = r2_from_es >= 0.0;
-      bool is_outside_res_limit = r1.length_sq() > dstarmax_sq_;
-      if (starts_outside == ends_outside || is_outside_res_limit) {
+      if (starts_outside == ends_outside) {
         return boost::optional<Ray>();
       }
 
@@ -114,16 +140,8 @@ namespace dials { namespace algorithms {
       // equivalent to solving the quadratic equation
       //
       // alpha^2*dr.dr + 2*alpha(s0 + r1).dr + 2*s0.r1 + r1.r1 = 0
-      af::small<double, 2> roots = reeke_detail::solve_quad(
-        dr.length_sq(), 2.0 * s0pr1 * dr, r1.length_sq() + 2.0 * s0_ * r1);
-
-      // Choose a root that lies in [0,1]
       double alpha;
-      if (0.0 <= roots[0] && roots[0] <= 1.0) {
-        alpha = roots[0];
-      } else if (0.0 <= roots[1] && roots[1] <= 1.0) {
-        alpha = roots[1];
-      } else {
+      if (!unit_root(dr.length_sq(), 2.0 * s0pr1 * dr, r1_sq + 2.0 * s0_ * r1, alpha)) {
         return boost::optional<Ray>();
       }
 
@@ -155,25 +173,48 @@ namespace dials { namespace algorithms {
                                     const vec3<double> &s0b,
                                     int image,
                                     std::size_t step) const {
-      // Calculate the reciprocal space vectors
+      return (*this)(h, A1, A2, BeamSegment(s0a, s0b), image, step);
+    }
+
+    /**
+     * Predict the ray for the given Miller index on the given image, where the
+     * UB matrix and the s0 vector differs between the start and end of the
+     * step. The beam segment is the same for all the indices on an image so
+     * should be computed once for the image.
+     * @param h The miller index
+     * @param A1 The setting matrix for the beginning of the step.
+     * @param A2 The setting matrix for the end of the step.
+     * @param beam The beam at the beginning and end of the step
+     * @param image The image index
+     * @param step The step to predict over.
+     * @returns The ray if predicted
+     */
+    boost::optional<Ray> operator()(const miller_index &h,
+                                    const mat3<double> &A1,
+                                    const mat3<double> &A2,
+                                    const BeamSegment &beam,
+                                    int image,
+                                    std::size_t step) const {
+      // Calculate the reciprocal space vectors. Most of the candidate indices
+      // are outside the resolution limit so check that first.
       vec3<double> r1 = A1 * h;
+      double r1_sq = r1.length_sq();
+      if (r1_sq > dstarmax_sq_) {
+        return boost::optional<Ray>();
+      }
       vec3<double> r2 = A2 * h;
       vec3<double> dr = r2 - r1;
-      vec3<double> s0pr1 = s0a + r1;
-      vec3<double> s0pr2 = s0b + r2;
+      vec3<double> s0pr1 = beam.s0a + r1;
+      vec3<double> s0pr2 = beam.s0b + r2;
 
       // Calculate the distances from the Ewald spheres along radii
-      double s0a_mag = s0a.length();
-      double s0b_mag = s0b.length();
-      double r1_from_es = s0pr1.length() - s0a_mag;
-      double r2_from_es = s0pr2.length() - s0b_mag;
+      double r1_from_es = s0pr1.length() - beam.s0a_mag;
+      double r2_from_es = s0pr2.length() - beam.s0b_mag;
 
-      // Check that the reflection cross the ewald sphere and is within
-      // the resolution limit
+      // Check that the reflection cross the ewald sphere
       bool starts_outside = r1_from_es >= 0.0;
       bool ends_outside = r2_from_es >= 0.0;
-      bool is_outside_res_limit = r1.length_sq() > dstarmax_sq_;
-      if (starts_outside == ends_outside || is_outside_res_limit) {
+      if (starts_outside == ends_outside) {
         return boost::optional<Ray>();
       }
 
@@ -183,16 +224,9 @@ namespace dials { namespace algorithms {
       // solving the quadratic equation
       //
       // alpha^2*dr.dr + 2*alpha(s0a + r1).dr + 2*s0a.r1 + r1.r1 = 0
-      af::small<double, 2> roots = reeke_detail::solve_quad(
-        dr.length_sq(), 2.0 * s0pr1 * dr, r1.length_sq() + 2.0 * s0a * r1);
-
-      // Choose a root that lies in [0,1]
+      double dr_sq = dr.length_sq();
       double alpha1;
-      if (0.0 <= roots[0] && roots[0] <= 1.0) {
-        alpha1 = roots[0];
-      } else if (0.0 <= roots[1] && roots[1] <= 1.0) {
-        alpha1 = roots[1];
-      } else {
+      if (!unit_root(dr_sq, 2.0 * s0pr1 * dr, r1_sq + 2.0 * beam.s0a * r1, alpha1)) {
         return boost::optional<Ray>();
       }
 
@@ -202,15 +236,9 @@ namespace dials { namespace algorithms {
       // solving the quadratic equation
       //
       // alpha^2*dr.dr - 2*alpha(s0b + r2).dr + 2*s0b.r2 + r2.r2 = 0
-      roots = reeke_detail::solve_quad(
-        dr.length_sq(), -2.0 * s0pr2 * dr, r2.length_sq() + 2.0 * s0b * r2);
-      // Choose a root that lies in [0,1]
       double alpha2;
-      if (0.0 <= roots[0] && roots[0] <= 1.0) {
-        alpha2 = roots[0];
-      } else if (0.0 <= roots[1] && roots[1] <= 1.0) {
-        alpha2 = roots[1];
-      } else {
+      if (!unit_root(
+            dr_sq, -2.0 * s0pr2 * dr, r2.length_sq() + 2.0 * beam.s0b * r2, alpha2)) {
         return boost::optional<Ray>();
       }
 
@@ -220,10 +248,8 @@ namespace dials { namespace algorithms {
       double alpha = alpha1 / (alpha1 + alpha2);
 
       // Linear approximation to the s0 vector at intersection
-      vec3<double> us0a = s0a.normalize();
-      vec3<double> us0_at_intersection = alpha * (s0b.normalize() - us0a) + us0a;
-      double wavenumber = (s0a_mag + s0b_mag) * 0.5;
-      vec3<double> s0_at_intersection = wavenumber * us0_at_intersection;
+      vec3<double> us0_at_intersection = alpha * beam.dus0 + beam.us0a;
+      vec3<double> s0_at_intersection = beam.wavenumber * us0_at_intersection;
 
       // Calculate the scattering vector and rotation angle
       vec3<double> s1 = r1 + alpha * dr + s0_at_intersection;
@@ -234,6 +260,21 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Solve the quadratic and choose a root that lies in [0,1]
+     * @returns True/False a root was found
+     */
+    static bool unit_root(double a, double b, double c, double &root) {
+      af::small<double, 2> roots = reeke_detail::solve_quad(a, b, c);
+      for (std::size_t i = 0; i < roots.size(); ++i) {
+        if (0.0 <= roots[i] && roots[i] <= 1.0) {
+          root = roots[i];
+          return true;
+        }
+      }
+      return false;
+    }
+
     vec3<double> s0_;
     vec3<double> m2_;
     int frame0_;
@@ -12,9 +12,14 @@
 #ifndef DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
 #define DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include <boost/math/special_functions/erf.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
 #include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -323,6 +328,265 @@ namespace dials { namespace algorithms {
     double sigma_;
   };
 
+  namespace detail {
+
+    /**
+     * Fit the binned gaussian model to a histogram with contiguous bins. This
+     * performs the same iterations as BinnedGMMSingle1D and
+     * BinnedGMMSingle1DFixedMean, but the error function and gaussian terms
+     * are evaluated once at each bin edge rather than twice.
+     */
+    class ContiguousBinnedGMMFitter {
+    public:
+      /**
+       * @param edges The n + 1 bin edges
+       * @param fixed_mean Keep the mean fixed
+       * @param epsilon The convergence tolerance
+       * @param max_iter The maximum number of iterations
+       */
+      ContiguousBinnedGMMFitter(const af::const_ref<double> &edges,
+                                bool fixed_mean,
+                                double epsilon,
+                                std::size_t max_iter)
+          : edges_(edges),
+            fixed_mean_(fixed_mean),
+            epsilon_(epsilon),
+            max_iter_(max_iter),
+            erf_(edges.size()),
+            pdf_(edges.size()) {}
+
+      /**
+       * Fit the model
+       * @param n The counts in each bin
+       * @param mu The mean estimate, updated in place
+       * @param sigma The sigma estimate, updated in place
+       * @returns The number of iterations
+       */
+      std::size_t fit(const double *n, double &mu, double &sigma) {
+        std::size_t nbins = edges_.size() - 1;
+        double c = 0.0;
+        for (std::size_t i = 0; i < nbins; ++i) {
+          c += n[i];
+        }
+        double logL0 = 0.0;
+        std::size_t num_iter = 0;
+        for (num_iter = 0; num_iter < max_iter_; ++num_iter) {
+          for (std::size_t k = 0; k < edges_.size(); ++k) {
+            double x = edges_[k];
+            erf_[k] = erf((x - mu) / (std::sqrt(2.0) * sigma));
+            pdf_[k] = std::exp(-(x - mu) * (x - mu) / (2 * sigma * sigma))
+                      / (std::sqrt(2.0 * pi) * sigma);
+          }
+          double sum_n_log_p = 0;
+          double sum_n = 0;
+          double sum_log_p = 0;
+          double mu_new = 0;
+          double va_new = 0;
+          for (std::size_t i = 0; i < nbins; ++i) {
+            double a = edges_[i];
+            double b = edges_[i + 1];
+            double e1 = erf_[i + 1];
+            double e2 = erf_[i];
+            double e3 = pdf_[i];
+            double e4 = pdf_[i + 1];
+            double P = 0.5 * (e1 - e2);
+            double E2 = (sigma * sigma / 2.0) * (e1 - e2)
+                        + sigma * sigma * ((a - mu) * e3 - (b - mu) * e4);
+            if (fixed_mean_) {
+              if (n[i] >= 1) {
+                if (P > 1e-100) {
+                  va_new += n[i] * E2 / P;
+                }
+                double log_p = P > 1e-100 ? std::log(P) : std::log(1e-100);
+                sum_n_log_p += n[i] * log_p;
+                sum_n += n[i];
+                sum_log_p += log_p;
+              }
+            } else if (n[i] > 0 && P > 1e-10) {
+              double E1 =
+                0.5 * mu * (e1 - e2) + (sigma * sigma / std::sqrt(2 * pi)) * (e3 - e4);
+              mu_new += n[i] * E1 / P;
+              va_new += n[i] * E2 / P;
+              sum_n_log_p += n[i] * std::log(P);
+              sum_n += n[i];
+              sum_log_p += std::log(P);
+            }
+          }
+          if (!fixed_mean_) {
+            mu = mu_new / c;
+          }
+          sigma = std::sqrt(va_new / c);
+
+          // Check the convergence
+          double logL = sum_n_log_p - sum_n * sum_log_p;
+          double error = std::abs((logL - logL0) / std::max(logL0, 1e-10));
+          if (num_iter > 0 && error < epsilon_) {
+            break;
+          }
+          logL0 = logL;
+        }
+        return num_iter;
+      }
+
+    private:
+      af::const_ref<double> edges_;
+      bool fixed_mean_;
+      double epsilon_;
+      std::size_t max_iter_;
+      std::vector<double> erf_;
+      std::vector<double> pdf_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * Fit the binned gaussian model to many histograms with the same
+   * contiguous bins using expectation maximization. The histograms are split
+   * into a fixed number of blocks of consecutive histograms, which are shared
+   * between threads. With a warm start, each fit in a block starts from the
+   * parameters of the previous histogram in the block (e.g. the previous
+   * image), which usually saves iterations; the first fit in each block
+   * starts from the given estimates. The blocks do not depend on the number
+   * of threads, so neither do the results.
+   */
+  class BinnedGMMSingle1DBatch {
+  public:
+    /**
+     * Compute the parameters
+     * @param edges The n + 1 edges of the bins
+     * @param counts The number of counts in each bin of each histogram
+     * @param mu The mean parameter estimate of each histogram
+     * @param sigma The sigma parameter estimate of each histogram
+     * @param fixed_mean Keep the mean of each histogram fixed
+     * @param warm_start Start from the parameters of the previous histogram
+     * @param epsilon The convergence tolerance
+     * @param max_iter The maximum number of iterations
+     * @param nthreads The number of threads
+     */
+    BinnedGMMSingle1DBatch(const af::const_ref<double> &edges,
+                           const af::const_ref<double, af::c_grid<2> > &counts,
+                           const af::const_ref<double> &mu,
+                           const af::const_ref<double> &sigma,
+                           bool fixed_mean,
+                           bool warm_start,
+                           double epsilon,
+                           std::size_t max_iter,
+                           std::size_t nthreads)
+        : max_iter_(max_iter),
+          epsilon_(epsilon),
+          mu_(mu.begin(), mu.end()),
+          sigma_(sigma.begin(), sigma.end()),
+          num_iter_(mu.size(), 0) {
+      std::size_t nhist = counts.accessor()[0];
+      DIALS_ASSERT(epsilon > 0);
+      DIALS_ASSERT(max_iter > 1);
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(edges.size() > 1);
+      for (std::size_t i = 1; i < edges.size(); ++i) {
+        DIALS_ASSERT(edges[i] > edges[i - 1]);
+      }
+      DIALS_ASSERT(counts.accessor()[1] == edges.size() - 1);
+      DIALS_ASSERT(mu.size() == nhist);
+      DIALS_ASSERT(sigma.size() == nhist);
+      for (std::size_t i = 0; i < nhist; ++i) {
+        DIALS_ASSERT(sigma[i] > 0);
+      }
+      std::size_t max_blocks = 32;
+      std::size_t n_blocks = std::min(nhist, max_blocks);
+      dials::util::parallel_for(
+        n_blocks,
+        nthreads,
+        FitJob(this, edges, counts, fixed_mean, warm_start, n_blocks));
+    }
+
+    /**
+     * @returns The maximum number of iterations
+     */
+    std::size_t max_iter() const {
+      return max_iter_;
+    }
+
+    /**
+     * @returns The number of iterations of each fit
+     */
+    af::shared<std::size_t> num_iter() const {
+      return af::shared<std::size_t>(num_iter_.begin(), num_iter_.end());
+    }
+
+    /**
+     * @returns The epsilon
+     */
+    double epsilon() const {
+      return epsilon_;
+    }
+
+    /**
+     * @returns The mu parameter estimate of each histogram
+     */
+    af::shared<double> mu() const {
+      return af::shared<double>(mu_.begin(), mu_.end());
+    }
+
+    /**
+     * @returns The sigma parameter estimate of each histogram
+     */
+    af::shared<double> sigma() const {
+      return af::shared<double>(sigma_.begin(), sigma_.end());
+    }
+
+  private:
+    struct FitJob {
+      BinnedGMMSingle1DBatch *self;
+      af::const_ref<double> edges;
+      af::const_ref<double, af::c_grid<2> > counts;
+      bool fixed_mean;
+      bool warm_start;
+      std::size_t n_blocks;
+
+      FitJob(BinnedGMMSingle1DBatch *self_,
+             const af::const_ref<double> &edges_,
+             const af::const_ref<double, af::c_grid<2> > &counts_,
+             bool fixed_mean_,
+             bool warm_start_,
+             std::size_t n_blocks_)
+          : self(self_),
+            edges(edges_),
+            counts(counts_),
+            fixed_mean(fixed_mean_),
+            warm_start(warm_start_),
+            n_blocks(n_blocks_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        detail::ContiguousBinnedGMMFitter fitter(
+          edges, fixed_mean, self->epsilon_, self->max_iter_);
+        std::size_t nhist = counts.accessor()[0];
+        std::size_t nbins = counts.accessor()[1];
+        for (std::size_t block = first; block < last; ++block) {
+          std::size_t begin = (block * nhist) / n_blocks;
+          std::size_t end = ((block + 1) * nhist) / n_blocks;
+          for (std::size_t i = begin; i < end; ++i) {
+            // Only start from the previous fit if it gave a usable sigma
+            if (warm_start && i > begin && self->sigma_[i - 1] > 0
+                && boost::math::isfinite(self->sigma_[i - 1])) {
+              if (!fixed_mean) {
+                self->mu_[i] = self->mu_[i - 1];
+              }
+              self->sigma_[i] = self->sigma_[i - 1];
+            }
+            self->num_iter_[i] =
+              fitter.fit(&counts[i * nbins], self->mu_[i], self->sigma_[i]);
+          }
+        }
+      }
+    };
+
+    std::size_t max_iter_;
+    double epsilon_;
+    std::vector<double> mu_;
+    std::vector<double> sigma_;
+    std::vector<std::size_t> num_iter_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
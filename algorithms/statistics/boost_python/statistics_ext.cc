@@ -17,6 +17,7 @@
 #include <dials/algorithms/statistics/kolmogorov_smirnov_test.h>
 #include <dials/algorithms/statistics/poisson_test.h>
 #include <dials/algorithms/statistics/correlation.h>
+#include <dials/algorithms/statistics/delta_cchalf.h>
 #include <dials/algorithms/statistics/binned_gmm.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
@@ -62,6 +63,32 @@ namespace dials { namespace algorithms { namespace boost_python {
     return boost::python::make_tuple(result.first, result.second);
   }
 
+  template <typename RealType>
+  boost::python::tuple kolmogorov_smirnov_test_standard_normal_batch(
+    const af::const_ref<RealType> &data,
+    const af::const_ref<std::size_t> &size,
+    std::string type,
+    std::size_t nthreads) {
+    KSType etype = TwoSided;
+    if (type.compare("less") == 0) {
+      etype = Less;
+    } else if (type.compare("greater") == 0) {
+      etype = Greater;
+    } else {
+      DIALS_ASSERT(type.compare("two_sided") == 0);
+    }
+    af::shared<RealType> d(size.size());
+    af::shared<RealType> p(size.size());
+    kolmogorov_smirnov_test(boost::math::normal_distribution<RealType>(0, 1),
+                            data,
+                            size,
+                            etype,
+                            d.ref(),
+                            p.ref(),
+                            nthreads);
+    return boost::python::make_tuple(d, p);
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_statistics_ext) {
     def("kolmogorov_smirnov_one_sided_cdf", &kolmogorov_smirnov_one_sided_cdf<double>);
     def("kolmogorov_smirnov_two_sided_cdf", &kolmogorov_smirnov_two_sided_cdf<double>);
@@ -71,11 +98,56 @@ namespace dials { namespace algorithms { namespace boost_python {
         &kolmogorov_smirnov_test_standard_normal<double>,
         (arg("data"), arg("type") = "two_sided"));
 
-    def("poisson_expected_max_counts", &poisson_expected_max_counts);
+    def("kolmogorov_smirnov_test_standard_normal_batch",
+        &kolmogorov_smirnov_test_standard_normal_batch<double>,
+        (arg("data"), arg("size"), arg("type") = "two_sided", arg("nthreads") = 1));
+
+    double (*poisson_expected_max_counts_single)(double, std::size_t) =
+      &poisson_expected_max_counts;
+    af::shared<double> (*poisson_expected_max_counts_batch)(
+      const af::const_ref<double> &, const af::const_ref<std::size_t> &, std::size_t) =
+      &poisson_expected_max_counts;
+    def("poisson_expected_max_counts",
+        poisson_expected_max_counts_single,
+        (arg("mean"), arg("nobs")));
+    def("poisson_expected_max_counts",
+        poisson_expected_max_counts_batch,
+        (arg("mean"), arg("nobs"), arg("nthreads") = 1));
 
     def("spearman_correlation_coefficient", &spearman_correlation_coefficient<double>);
     def("pearson_correlation_coefficient", &pearson_correlation_coefficient<double>);
 
+    typedef PearsonCorrelationAccumulator<double> pearson_type;
+    class_<pearson_type>("PearsonCorrelationAccumulator")
+      .def("add", (void(pearson_type::*)(double, double)) & pearson_type::add)
+      .def("add", (void(pearson_type::*)(const pearson_type &)) & pearson_type::add)
+      .def("remove", &pearson_type::remove)
+      .def("n", &pearson_type::n)
+      .def("coefficient", &pearson_type::coefficient);
+
+    typedef CCHalfSigmaTauAccumulator<double> cchalf_type;
+    class_<cchalf_type>("CCHalfSigmaTauAccumulator")
+      .def("add", (void(cchalf_type::*)(double, double)) & cchalf_type::add)
+      .def("add", (void(cchalf_type::*)(const cchalf_type &)) & cchalf_type::add)
+      .def("remove", &cchalf_type::remove)
+      .def("n", &cchalf_type::n)
+      .def("cchalf", &cchalf_type::cchalf);
+
+    class_<PerGroupCCHalf>("PerGroupCCHalf", no_init)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                std::size_t,
+                const af::const_ref<double> &,
+                const af::const_ref<std::size_t> &,
+                std::size_t>((arg("unique_index"),
+                              arg("unique_bin"),
+                              arg("n_bins"),
+                              arg("intensity"),
+                              arg("group"),
+                              arg("n_groups"))))
+      .def("mean_cchalf", &PerGroupCCHalf::mean_cchalf)
+      .def("cchalf_excluding_groups", &PerGroupCCHalf::cchalf_excluding_groups);
+
     class_<BinnedGMMSingle1DFixedMean>("BinnedGMMSingle1DFixedMean", no_init)
       .def(init<const af::const_ref<double> &,
                 const af::const_ref<double> &,
@@ -103,6 +175,30 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("epsilon", &BinnedGMMSingle1D::epsilon)
       .def("mu", &BinnedGMMSingle1D::mu)
       .def("sigma", &BinnedGMMSingle1D::sigma);
+
+    class_<BinnedGMMSingle1DBatch>("BinnedGMMSingle1DBatch", no_init)
+      .def(init<const af::const_ref<double> &,
+                const af::const_ref<double, af::c_grid<2> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                bool,
+                bool,
+                double,
+                std::size_t,
+                std::size_t>((arg("edges"),
+                              arg("counts"),
+                              arg("mu"),
+                              arg("sigma"),
+                              arg("fixed_mean") = false,
+                              arg("warm_start") = false,
+                              arg("epsilon") = 1e-3,
+                              arg("max_iter") = 100,
+                              arg("nthreads") = 1)))
+      .def("max_iter", &BinnedGMMSingle1DBatch::max_iter)
+      .def("num_iter", &BinnedGMMSingle1DBatch::num_iter)
+      .def("epsilon", &BinnedGMMSingle1DBatch::epsilon)
+      .def("mu", &BinnedGMMSingle1DBatch::mu)
+      .def("sigma", &BinnedGMMSingle1DBatch::sigma);
   }
 
 }}}  // namespace dials::algorithms::boost_python
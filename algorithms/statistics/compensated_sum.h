@@ -0,0 +1,51 @@
+/*
+ * compensated_sum.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_STATISTICS_COMPENSATED_SUM_H
+#define DIALS_ALGORITHMS_STATISTICS_COMPENSATED_SUM_H
+
+#include <cmath>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A sum which keeps track of the rounding error of each addition
+   * (Neumaier's variant of Kahan summation), so that long sums of values of
+   * very different sizes keep their precision.
+   */
+  class CompensatedSum {
+  public:
+    CompensatedSum() : sum_(0), error_(0) {}
+
+    /**
+     * Add a value to the sum
+     * @param x The value
+     */
+    void add(double x) {
+      double t = sum_ + x;
+      if (std::abs(sum_) >= std::abs(x)) {
+        error_ += (sum_ - t) + x;
+      } else {
+        error_ += (x - t) + sum_;
+      }
+      sum_ = t;
+    }
+
+    /** @returns The sum */
+    double value() const {
+      return sum_ + error_;
+    }
+
+  private:
+    double sum_;
+    double error_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_STATISTICS_COMPENSATED_SUM_H
@@ -13,6 +13,9 @@
 #define DIALS_ALGORITHMS_STATISTICS_CORRELATION_H
 
 #include <algorithm>
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -133,6 +136,159 @@ namespace dials { namespace algorithms {
     return sdxy / (std::sqrt(sdx2) * std::sqrt(sdy2));
   }
 
+  /**
+   * Accumulate the sums needed for the correlation coefficient between two
+   * quantities, so that pairs of values can be added and removed without
+   * passing over the data again.
+   */
+  template <typename T>
+  class PearsonCorrelationAccumulator {
+  public:
+    PearsonCorrelationAccumulator()
+        : n_(0), sum_x_(0), sum_y_(0), sum_xx_(0), sum_yy_(0), sum_xy_(0) {}
+
+    /**
+     * Add a pair of values
+     * @param x The x value
+     * @param y The y value
+     */
+    void add(T x, T y) {
+      n_++;
+      sum_x_ += x;
+      sum_y_ += y;
+      sum_xx_ += x * x;
+      sum_yy_ += y * y;
+      sum_xy_ += x * y;
+    }
+
+    /**
+     * Remove a pair of values that was previously added
+     * @param x The x value
+     * @param y The y value
+     */
+    void remove(T x, T y) {
+      DIALS_ASSERT(n_ > 0);
+      n_--;
+      sum_x_ -= x;
+      sum_y_ -= y;
+      sum_xx_ -= x * x;
+      sum_yy_ -= y * y;
+      sum_xy_ -= x * y;
+    }
+
+    /**
+     * Add the values of another accumulator
+     * @param other The other accumulator
+     */
+    void add(const PearsonCorrelationAccumulator &other) {
+      n_ += other.n_;
+      sum_x_ += other.sum_x_;
+      sum_y_ += other.sum_y_;
+      sum_xx_ += other.sum_xx_;
+      sum_yy_ += other.sum_yy_;
+      sum_xy_ += other.sum_xy_;
+    }
+
+    /**
+     * @returns The number of pairs
+     */
+    std::size_t n() const {
+      return n_;
+    }
+
+    /**
+     * @returns The correlation coefficient
+     */
+    T coefficient() const {
+      DIALS_ASSERT(n_ > 0);
+      T sdx2 = sum_xx_ - sum_x_ * sum_x_ / n_;
+      T sdy2 = sum_yy_ - sum_y_ * sum_y_ / n_;
+      T sdxy = sum_xy_ - sum_x_ * sum_y_ / n_;
+      DIALS_ASSERT(sdx2 > 0 && sdy2 > 0);
+      return sdxy / (std::sqrt(sdx2) * std::sqrt(sdy2));
+    }
+
+  private:
+    std::size_t n_;
+    T sum_x_;
+    T sum_y_;
+    T sum_xx_;
+    T sum_yy_;
+    T sum_xy_;
+  };
+
+  /**
+   * Accumulate the sums needed for the CC 1/2 of a set of unique reflections
+   * by the sigma-tau method of Assmann, Brehm and Diederichs (2016), from the
+   * mean intensity of each reflection and the variance of that mean. The
+   * reflections can be added and removed without passing over the data
+   * again.
+   */
+  template <typename T>
+  class CCHalfSigmaTauAccumulator {
+  public:
+    CCHalfSigmaTauAccumulator() : n_(0), sum_mean_(0), sum_mean_sq_(0), sum_var_(0) {}
+
+    /**
+     * Add a reflection
+     * @param mean The mean intensity
+     * @param variance The variance of the mean intensity
+     */
+    void add(T mean, T variance) {
+      n_++;
+      sum_mean_ += mean;
+      sum_mean_sq_ += mean * mean;
+      sum_var_ += variance;
+    }
+
+    /**
+     * Remove a reflection that was previously added
+     * @param mean The mean intensity
+     * @param variance The variance of the mean intensity
+     */
+    void remove(T mean, T variance) {
+      DIALS_ASSERT(n_ > 0);
+      n_--;
+      sum_mean_ -= mean;
+      sum_mean_sq_ -= mean * mean;
+      sum_var_ -= variance;
+    }
+
+    /**
+     * Add the reflections of another accumulator
+     * @param other The other accumulator
+     */
+    void add(const CCHalfSigmaTauAccumulator &other) {
+      n_ += other.n_;
+      sum_mean_ += other.sum_mean_;
+      sum_mean_sq_ += other.sum_mean_sq_;
+      sum_var_ += other.sum_var_;
+    }
+
+    /**
+     * @returns The number of reflections
+     */
+    std::size_t n() const {
+      return n_;
+    }
+
+    /**
+     * @returns The CC 1/2
+     */
+    T cchalf() const {
+      DIALS_ASSERT(n_ > 1);
+      T sigma_y = (sum_mean_sq_ - sum_mean_ * sum_mean_ / n_) / (n_ - 1);
+      T sigma_e = sum_var_ / n_;
+      return (sigma_y - sigma_e) / (sigma_y + sigma_e);
+    }
+
+  private:
+    std::size_t n_;
+    T sum_mean_;
+    T sum_mean_sq_;
+    T sum_var_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_CORRELATION_H
@@ -0,0 +1,205 @@
+/*
+ * delta_cchalf.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
+#define DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
+
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/statistics/correlation.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * Compute the mean CC 1/2 over resolution bins of a set of observations,
+   * and the mean CC 1/2 with each group of observations excluded in turn.
+   *
+   * The sums of I and I^2 are kept for each unique reflection and the sums
+   * needed for the CC 1/2 are kept for each bin. Excluding a group only
+   * updates the unique reflections it has observations of, so the whole
+   * calculation takes a time proportional to the number of observations
+   * (plus the number of groups times the number of bins).
+   */
+  class PerGroupCCHalf {
+  public:
+    typedef CCHalfSigmaTauAccumulator<double> accumulator_type;
+
+    /**
+     * @param unique_index The unique reflection of each observation
+     * @param unique_bin The resolution bin of each unique reflection
+     * @param n_bins The number of resolution bins
+     * @param intensity The intensity of each observation
+     * @param group The group of each observation
+     * @param n_groups The number of groups
+     */
+    PerGroupCCHalf(const af::const_ref<std::size_t> &unique_index,
+                   const af::const_ref<std::size_t> &unique_bin,
+                   std::size_t n_bins,
+                   const af::const_ref<double> &intensity,
+                   const af::const_ref<std::size_t> &group,
+                   std::size_t n_groups)
+        : n_bins_(n_bins),
+          unique_bin_(unique_bin.begin(), unique_bin.end()),
+          sum_x_(unique_bin.size(), 0.0),
+          sum_x2_(unique_bin.size(), 0.0),
+          n_(unique_bin.size(), 0),
+          bins_(n_bins) {
+      DIALS_ASSERT(unique_index.size() == intensity.size());
+      DIALS_ASSERT(group.size() == intensity.size());
+      for (std::size_t i = 0; i < unique_bin.size(); ++i) {
+        DIALS_ASSERT(unique_bin[i] < n_bins);
+      }
+
+      // Accumulate the sums for each unique reflection
+      for (std::size_t i = 0; i < intensity.size(); ++i) {
+        std::size_t h = unique_index[i];
+        DIALS_ASSERT(h < n_.size());
+        DIALS_ASSERT(group[i] < n_groups);
+        sum_x_[h] += intensity[i];
+        sum_x2_[h] += intensity[i] * intensity[i];
+        n_[h]++;
+      }
+      for (std::size_t h = 0; h < n_.size(); ++h) {
+        add(bins_, h, sum_x_[h], sum_x2_[h], n_[h]);
+      }
+      mean_cchalf_ = mean_cchalf(bins_);
+
+      // Sort the observations by group
+      std::vector<std::size_t> group_start(n_groups + 1, 0);
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        group_start[group[i] + 1]++;
+      }
+      for (std::size_t g = 0; g < n_groups; ++g) {
+        group_start[g + 1] += group_start[g];
+      }
+      std::vector<std::size_t> next(group_start.begin(), group_start.end() - 1);
+      std::vector<std::size_t> order(group.size());
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        order[next[group[i]]++] = i;
+      }
+
+      // Compute the CC 1/2 without each group, updating only the unique
+      // reflections observed in that group
+      std::vector<double> dsum_x(n_.size(), 0.0);
+      std::vector<double> dsum_x2(n_.size(), 0.0);
+      std::vector<std::size_t> dn(n_.size(), 0);
+      std::vector<std::size_t> touched;
+      cchalf_excluding_groups_.resize(n_groups);
+      for (std::size_t g = 0; g < n_groups; ++g) {
+        touched.clear();
+        for (std::size_t k = group_start[g]; k < group_start[g + 1]; ++k) {
+          std::size_t i = order[k];
+          std::size_t h = unique_index[i];
+          if (dn[h] == 0) {
+            touched.push_back(h);
+          }
+          dsum_x[h] += intensity[i];
+          dsum_x2[h] += intensity[i] * intensity[i];
+          dn[h]++;
+        }
+        std::vector<accumulator_type> bins(bins_);
+        for (std::size_t k = 0; k < touched.size(); ++k) {
+          std::size_t h = touched[k];
+          remove(bins, h, sum_x_[h], sum_x2_[h], n_[h]);
+          add(bins, h, sum_x_[h] - dsum_x[h], sum_x2_[h] - dsum_x2[h], n_[h] - dn[h]);
+          dsum_x[h] = 0.0;
+          dsum_x2[h] = 0.0;
+          dn[h] = 0;
+        }
+        cchalf_excluding_groups_[g] = mean_cchalf(bins);
+      }
+    }
+
+    /**
+     * @returns The mean CC 1/2 of all the observations
+     */
+    double mean_cchalf() const {
+      return mean_cchalf_;
+    }
+
+    /**
+     * @returns The mean CC 1/2 with each group excluded
+     */
+    af::shared<double> cchalf_excluding_groups() const {
+      return af::shared<double>(cchalf_excluding_groups_.begin(),
+                                cchalf_excluding_groups_.end());
+    }
+
+  private:
+    /**
+     * The mean and variance of the mean of a unique reflection, which only
+     * contributes to the CC 1/2 if it has more than one observation
+     */
+    static bool mean_and_variance(double sum_x,
+                                  double sum_x2,
+                                  std::size_t n,
+                                  double &mean,
+                                  double &variance) {
+      if (n < 2) {
+        return false;
+      }
+      mean = sum_x / n;
+      variance = (sum_x2 - sum_x * sum_x / n) / (n - 1) / n;
+      return true;
+    }
+
+    void add(std::vector<accumulator_type> &bins,
+             std::size_t h,
+             double sum_x,
+             double sum_x2,
+             std::size_t n) const {
+      double mean = 0, variance = 0;
+      if (mean_and_variance(sum_x, sum_x2, n, mean, variance)) {
+        bins[unique_bin_[h]].add(mean, variance);
+      }
+    }
+
+    void remove(std::vector<accumulator_type> &bins,
+                std::size_t h,
+                double sum_x,
+                double sum_x2,
+                std::size_t n) const {
+      double mean = 0, variance = 0;
+      if (mean_and_variance(sum_x, sum_x2, n, mean, variance)) {
+        bins[unique_bin_[h]].remove(mean, variance);
+      }
+    }
+
+    /**
+     * The mean CC 1/2 over the bins, weighted by the number of reflections
+     * in each bin with more than one reflection
+     */
+    static double mean_cchalf(const std::vector<accumulator_type> &bins) {
+      double sum = 0.0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < bins.size(); ++i) {
+        std::size_t n = bins[i].n();
+        if (n > 1) {
+          sum += n * bins[i].cchalf();
+          count += n;
+        }
+      }
+      DIALS_ASSERT(count > 0);
+      return sum / count;
+    }
+
+    std::size_t n_bins_;
+    std::vector<std::size_t> unique_bin_;
+    std::vector<double> sum_x_;
+    std::vector<double> sum_x2_;
+    std::vector<std::size_t> n_;
+    std::vector<accumulator_type> bins_;
+    double mean_cchalf_;
+    std::vector<double> cchalf_excluding_groups_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_STATISTICS_DELTA_CCHALF_H
@@ -1,7 +1,9 @@
 import math
+import random
 
 from scitbx.array_family import flex
 
+from dials_refinement_helpers_ext import FastMCDCore
 from dials_refinement_helpers_ext import maha_dist_sq as maha_dist_sq_cpp
 from dials_refinement_helpers_ext import mcd_consistency
 
@@ -31,21 +33,25 @@ def cov(*args):
     return cov
 
 
+def observation_matrix(cols):
+    """Form the matrix of observations with the vectors in the list cols as
+    its columns"""
+
+    obs = flex.double(flex.grid(len(cols[0]), len(cols)))
+    for i, col in enumerate(cols):
+        obs.matrix_paste_column_in_place(col, i)
+    return obs
+
+
 def maha_dist_sq(cols, center, cov):
     """Calculate squared Mahalanobis distance of all observations (rows in the
     vectors contained in the list cols) from the center vector with respect to
     the covariance matrix cov"""
 
-    n = len(cols[0])
     p = len(cols)
     assert len(center) == p
 
-    # observation matrix
-    obs = flex.double(flex.grid(n, p))
-    for i, col in enumerate(cols):
-        obs.matrix_paste_column_in_place(col, i)
-
-    d2 = maha_dist_sq_cpp(obs, flex.double(center), cov)
+    d2 = maha_dist_sq_cpp(observation_matrix(cols), flex.double(center), cov)
     return d2
 
 
@@ -128,7 +134,9 @@ def mcd_finite_sample(p, n, alpha):
 
 class FastMCD:
     """Experimental implementation of the FAST-MCD algorithm of Rousseeuw and
-    van Driessen"""
+    van Driessen. The random initial subsets and concentration steps of the
+    trials are done in C++ by FastMCDCore, which shares the independent trials
+    between nthreads threads"""
 
     def __init__(
         self,
@@ -140,6 +148,7 @@ def __init__(
         k1=2,
         k2=2,
         k3=100,
+        nthreads=1,
     ):
         """data expected to be a list of flex.double arrays of the same length,
         representing the vectors of observations in each dimension"""
@@ -180,6 +189,9 @@ def __init__(
         self._k2 = k2
         self._k3 = k3
 
+        # number of threads for the trials
+        self._nthreads = nthreads
+
         # correction factors
         self._consistency_fac = mcd_consistency(self._p, self._h / self._n)
         self._finite_samp_fac = mcd_finite_sample(self._p, self._n, self._alpha)
@@ -263,79 +275,39 @@ def split_into_groups(self, sample, ngroups):
 
         return groups
 
-    def form_initial_subset(self, h, data):
-        """Method 2 of subsection 3.1 of R&vD"""
-
-        # permutation of input data for sampling
-        p = flex.random_permutation(len(data[0]))
-        permuted = [col.select(p) for col in data]
+    def _trials(self, core, h, n_trials, nsteps):
+        """Perform n_trials trials from random initial subsets (method 2 of
+        subsection 3.1 of R&vD), each followed by nsteps concentration steps.
+        Return the estimates as (det, T, S) tuples sorted by determinant. Each
+        trial has its own random seed so the results do not depend on the
+        number of threads"""
 
-        # draw random p+1 subset J (or larger if required)
-        detS0 = 0.0
-        i = 0
-        while not detS0 > 0.0:
-            subset_size = self._p + 1 + i
-            J = [e[0:subset_size] for e in permuted]
-            i += 1
-            T0, S0 = self.means_and_covariance(J)
-            detS0 = S0.matrix_determinant_via_lu()
+        seeds = flex.size_t([random.getrandbits(31) for _ in range(n_trials)])
+        return core.trials(h, nsteps, seeds, nthreads=self._nthreads)
 
-        H1 = self.concentration_step(h, data, T0, S0)
-        return H1
+    def _refine(self, core, h, estimates, nsteps, stop_on_convergence):
+        """Apply up to nsteps concentration steps (Theorem 1 of R&vD) to each of
+        the estimates, stopping early for an estimate if the determinant no
+        longer changes if stop_on_convergence is set. Return the estimates sorted
+        by determinant"""
 
-    @staticmethod
-    def concentration_step(h, data, T, S):
-        """Practical application of Theorem 1 of R&vD"""
-
-        d2s = maha_dist_sq(data, T, S)
-        p = flex.sort_permutation(d2s)
-        H1 = [col.select(p)[0:h] for col in data]
-        return H1
+        return core.refine(
+            estimates, h, nsteps, stop_on_convergence, nthreads=self._nthreads
+        )
 
     def small_dataset_estimate(self):
         """When a dataset is small, perform the initial trials directly on the
         whole dataset"""
 
-        trials = []
-        for i in range(self._n_trials):
-
-            H1 = self.form_initial_subset(h=self._h, data=self._data)
-            T1, S1 = self.means_and_covariance(H1)
-            detS1 = S1.matrix_determinant_via_lu()
-
-            # perform concentration steps
-            detScurr, Tcurr, Scurr = detS1, T1, S1
-            for j in range(self._k1):  # take maximum of k1 steps
-
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detSnew = Snew.matrix_determinant_via_lu()
-
-                # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
-                # this is not always the case here. Ensure that detScurr is no smaller than
-                # one billionth the value of detSnew less than detSnew
-                assert detScurr > (detSnew - detSnew / 1.0e9)
-                detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-            trials.append((detSnew, Tnew, Snew))
-
-        # choose 10 trials with the lowest detS3
-        trials.sort(key=lambda x: x[0])
-        best_trials = []
-        for i in range(10):
-            detCurr, Tcurr, Scurr = trials[i]
-            for j in range(self._k3):  # take maximum of k3 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detNew = Snew.matrix_determinant_via_lu()
-                if detNew == detCurr:
-                    # print "trial {0}; iteration {1}; convergence".format(i,j)
-                    break
-                detCurr, Tcurr, Scurr = detNew, Tnew, Snew
-            best_trials.append((detNew, Tnew, Snew))
+        core = FastMCDCore(observation_matrix(self._data))
+        trials = self._trials(core, self._h, self._n_trials, self._k1)
+
+        # choose 10 trials with the lowest detS3 and take a maximum of k3 steps
+        best_trials = self._refine(
+            core, self._h, trials[0:10], self._k3, stop_on_convergence=True
+        )
 
         # Find the minimum covariance determinant from that set of 10
-        best_trials.sort(key=lambda x: x[0])
         _, Tbest, Sbest = best_trials[0]
         return Tbest, Sbest
 
@@ -362,52 +334,19 @@ def large_dataset_estimate(self):
         h_frac = self._h / self._n
         for group in groups:
 
-            h_sub = int(len(group[0]) * h_frac)
-            gp_trials = []
-            for i in range(n_trials):
-
-                H1 = self.form_initial_subset(h=h_sub, data=group)
-                T1, S1 = self.means_and_covariance(H1)
-                detS1 = S1.matrix_determinant_via_lu()
-
-                # perform concentration steps
-                detScurr, Tcurr, Scurr = detS1, T1, S1
-                for j in range(self._k1):  # take k1 steps
-
-                    Hnew = self.concentration_step(h_sub, group, Tcurr, Scurr)
-                    Tnew, Snew = self.means_and_covariance(Hnew)
-                    detSnew = Snew.matrix_determinant_via_lu()
-
-                    # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
-                    # this is not always the case here. Ensure that detScurr is no smaller than
-                    # one billionth the value of detSnew less than detSnew
-                    assert detScurr > (detSnew - detSnew / 1.0e9)
-                    detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-                gp_trials.append((detSnew, Tnew, Snew))
-
             # choose 10 trials with the lowest determinant and put in the outer list
-            gp_trials.sort(key=lambda x: x[0])
+            h_sub = int(len(group[0]) * h_frac)
+            core = FastMCDCore(observation_matrix(group))
+            gp_trials = self._trials(core, h_sub, n_trials, self._k1)
             trials.extend(gp_trials[0:10])
 
         # now have 10 best trials from each group. Work with the merged (==sampled)
-        # set
-        mrgd_trials = []
+        # set, taking k2 steps, and sort trials by the lowest detS3
         h_mrgd = int(sample_size * h_frac)
-        for trial in trials:
-
-            detScurr, Tcurr, Scurr = trial
-            for j in range(self._k2):  # take k2 steps
-
-                Hnew = self.concentration_step(h_mrgd, sampled, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detSnew = Snew.matrix_determinant_via_lu()
-                detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-            mrgd_trials.append((detSnew, Tnew, Snew))
-
-        # sort trials by the lowest detS3 and work with the whole dataset now
-        mrgd_trials.sort(key=lambda x: x[0])
+        core = FastMCDCore(observation_matrix(sampled))
+        mrgd_trials = self._refine(
+            core, h_mrgd, trials, self._k2, stop_on_convergence=False
+        )
 
         # choose number of steps to iterate based on dataset size (ugly)
         size = self._n * self._p
@@ -437,24 +376,12 @@ def large_dataset_estimate(self):
         # choose number of trials to look at based on number of obs (ugly)
         n_reps = 1 if self._n > 5000 else 10
 
-        best_trials = []
-        for i in range(n_reps):
-            detCurr, Tcurr, Scurr = mrgd_trials[i]
-            for j in range(k4):  # take maximum of k4 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detNew = Snew.matrix_determinant_via_lu()
-                if detNew == detCurr:
-                    # print "trial {0}; iteration {1}; convergence".format(i,j)
-                    break
-                detCurr, Tcurr, Scurr = detNew, Tnew, Snew
-            # print "determinant", detNew
-            # print "location:", list(Tnew)
-            # print "covariance:"
-            # print Snew.as_scitbx_matrix()
-            best_trials.append((detNew, Tnew, Snew))
+        # work with the whole dataset now, taking a maximum of k4 steps
+        core = FastMCDCore(observation_matrix(self._data))
+        best_trials = self._refine(
+            core, self._h, mrgd_trials[0:n_reps], k4, stop_on_convergence=True
+        )
 
         # Find the minimum covariance determinant from that set of 10
-        best_trials.sort(key=lambda x: x[0])
         _, Tbest, Sbest = best_trials[0]
         return Tbest, Sbest
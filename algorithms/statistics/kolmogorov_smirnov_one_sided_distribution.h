@@ -76,9 +76,10 @@ namespace dials { namespace algorithms {
     /**
      * An implementation fo the exact kolmogorov smirnov one sided distribution
      * (as shown above) for large values of N. This function is slower but uses
-     * a sum of logarithms to avoid a floating point overflow. It uses the
-     * relationship between the gamma function and the biniomial coefficients to
-     * calculate log of the binomial coefficients
+     * a sum of logarithms to avoid a floating point overflow. The log of the
+     * binomial coefficients is updated from one term to the next, as in
+     * cdf_small, rather than computed from the gamma function for each term,
+     * so each term costs two logarithms and an exponential.
      */
     template <typename RealType>
     RealType cdf_large(const kolmogorov_smirnov_one_sided_distribution<RealType> &dist,
@@ -86,14 +87,14 @@ namespace dials { namespace algorithms {
       int n = (int)dist.n();
       int m = (int)std::floor(n * (1.0 - x));
       RealType s = 0.0;
-      RealType b = boost::math::lgamma(n + 1);
+      RealType b = 0.0;
       for (int j = 0; j <= m; ++j) {
         RealType a = x + (RealType)j / (RealType)n;
         if (1.0 - a > 0 && a > 0) {
-          RealType c = b - boost::math::lgamma(j + 1) - boost::math::lgamma(n - j + 1)
-                       + (n - j) * std::log(1.0 - a) + (j - 1) * std::log(a);
+          RealType c = b + (n - j) * std::log(1.0 - a) + (j - 1) * std::log(a);
           s += std::exp(c);
         }
+        b += std::log((RealType)(n - j) / (RealType)(j + 1));
       }
       return 1.0 - x * s;
     }
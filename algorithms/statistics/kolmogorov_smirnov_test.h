@@ -13,8 +13,10 @@
 #define DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_TEST_H
 
 #include <iostream>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/statistics/kolmogorov_smirnov_one_sided_distribution.h>
 #include <dials/algorithms/statistics/kolmogorov_smirnov_two_sided_distribution.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -147,6 +149,73 @@ namespace dials { namespace algorithms {
     return result;
   }
 
+  namespace detail {
+
+    /**
+     * Test a range of samples
+     */
+    template <typename Dist>
+    struct KolmogorovSmirnovTestJob {
+      typedef typename Dist::value_type value_type;
+      const Dist *dist;
+      const af::const_ref<value_type> *data;
+      const std::vector<std::size_t> *offset;
+      KSType kstype;
+      af::ref<value_type> *d;
+      af::ref<value_type> *p;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t i0 = (*offset)[i];
+          std::size_t i1 = (*offset)[i + 1];
+          if (i0 == i1) {
+            (*d)[i] = 0;
+            (*p)[i] = 1;
+            continue;
+          }
+          std::pair<value_type, value_type> result = kolmogorov_smirnov_test(
+            *dist, data->begin() + i0, data->begin() + i1, kstype);
+          (*d)[i] = result.first;
+          (*p)[i] = result.second;
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Perform the kolmogorov smirnov test on many samples at once, for example
+   * the normalised background residuals of each shoebox. The values of the
+   * samples are stored one after another and the samples are tested on a pool
+   * of threads. Empty samples are given D = 0 and a p-value of 1.
+   * @param dist The distribution
+   * @param data The values of all the samples
+   * @param size The number of values in each sample
+   * @param kstype The type of test to perform (less, greater, two_sided)
+   * @param d The D statistic of each sample
+   * @param p The p-value of each sample
+   * @param nthreads The number of threads
+   */
+  template <typename Dist>
+  void kolmogorov_smirnov_test(const Dist &dist,
+                               const af::const_ref<typename Dist::value_type> &data,
+                               const af::const_ref<std::size_t> &size,
+                               const KSType &kstype,
+                               af::ref<typename Dist::value_type> d,
+                               af::ref<typename Dist::value_type> p,
+                               std::size_t nthreads = 1) {
+    DIALS_ASSERT(d.size() == size.size());
+    DIALS_ASSERT(p.size() == size.size());
+    std::vector<std::size_t> offset(size.size() + 1, 0);
+    for (std::size_t i = 0; i < size.size(); ++i) {
+      offset[i + 1] = offset[i] + size[i];
+    }
+    DIALS_ASSERT(offset.back() == data.size());
+    detail::KolmogorovSmirnovTestJob<Dist> job = {
+      &dist, &data, &offset, kstype, &d, &p};
+    dials::util::parallel_for(size.size(), nthreads, job);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_KOLMOGOROV_SMIRNOV_TEST_H
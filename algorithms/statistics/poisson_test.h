@@ -2,15 +2,90 @@
 #ifndef DIALS_ALGORITHMS_STATISTICS_POISSON_TEST_H
 #define DIALS_ALGORITHMS_STATISTICS_POISSON_TEST_H
 
+#include <cmath>
 #include <boost/math/distributions.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
+  /**
+   * Compute the expected maximum of a number of counts from a poisson
+   * distribution: one more than the quantile of the distribution at
+   * 1 - 1 / nobs.
+   *
+   * Rather than finding the quantile with a root finder, this starts from the
+   * cumulative distribution at the mean and steps one count at a time using
+   * the recurrence for the probability mass function, which needs only a few
+   * steps of order sqrt(mean). This gives the same results as
+   * boost::math::quantile with its default rounding policy.
+   * @param mean The mean of the poisson distribution
+   * @param nobs The number of observations
+   * @returns The expected maximum count
+   */
   inline double poisson_expected_max_counts(double mean, std::size_t nobs) {
     DIALS_ASSERT(nobs > 0);
-    boost::math::poisson_distribution<double> d(mean);
-    return boost::math::quantile(d, 1 - 1.0 / nobs) + 1;
+    DIALS_ASSERT(mean > 0);
+    double p = 1.0 - 1.0 / nobs;
+    if (p <= 0) {
+      return 1;
+    }
+    double k = std::floor(mean);
+    double c = boost::math::gamma_q(k + 1, mean);
+    double pmf = std::exp(k * std::log(mean) - mean - boost::math::lgamma(k + 1));
+    if (c >= p) {
+      while (k > 0 && c - pmf >= p) {
+        c -= pmf;
+        pmf *= k / mean;
+        k -= 1;
+      }
+    } else {
+      while (c < p) {
+        k += 1;
+        pmf *= mean / k;
+        c += pmf;
+      }
+    }
+    return k + 1;
+  }
+
+  namespace detail {
+
+    /**
+     * Compute the expected maximum counts of a range of samples
+     */
+    struct PoissonExpectedMaxCountsJob {
+      const af::const_ref<double> *mean;
+      const af::const_ref<std::size_t> *nobs;
+      af::ref<double> *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          (*result)[i] = poisson_expected_max_counts((*mean)[i], (*nobs)[i]);
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the expected maximum counts of many samples at once
+   * @param mean The mean of each sample
+   * @param nobs The number of observations in each sample
+   * @param nthreads The number of threads
+   * @returns The expected maximum count of each sample
+   */
+  inline af::shared<double> poisson_expected_max_counts(
+    const af::const_ref<double> &mean,
+    const af::const_ref<std::size_t> &nobs,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(mean.size() == nobs.size());
+    af::shared<double> result(mean.size());
+    af::ref<double> result_ref = result.ref();
+    detail::PoissonExpectedMaxCountsJob job = {&mean, &nobs, &result_ref};
+    dials::util::parallel_for(mean.size(), nthreads, job);
+    return result;
   }
 
 }}  // namespace dials::algorithms
@@ -0,0 +1,45 @@
+/*
+ * symmetry_ext.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/symmetry/laue_group.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  boost::python::list symmetry_element_pairs_compute(
+    const SymmetryElementPairs &self,
+    const af::const_ref<mat3<double> > &inverse,
+    const af::const_ref<mat3<double> > &element,
+    std::size_t nthreads) {
+    std::vector<af::shared<double> > x;
+    std::vector<af::shared<double> > y;
+    self.compute(inverse, element, nthreads, x, y);
+    boost::python::list result;
+    for (std::size_t i = 0; i < x.size(); ++i) {
+      result.append(boost::python::make_tuple(x[i], y[i]));
+    }
+    return result;
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_symmetry_ext) {
+    class_<SymmetryElementPairs>("SymmetryElementPairs", no_init)
+      .def(init<const af::const_ref<cctbx::miller::index<> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<bool> &,
+                bool>(
+        (arg("indices"), arg("data"), arg("in_asu"), arg("anomalous_flag"))))
+      .def("size", &SymmetryElementPairs::size)
+      .def("compute",
+           &symmetry_element_pairs_compute,
+           (arg("inverse"), arg("element"), arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -82,8 +82,8 @@
 
 nproc = None
   .type = int(value_min=1)
-  .help = "Deprecated"
-  .deprecated = True
+  .help = "The number of threads used to compute the rij matrix. By default all"
+          "the available cores are used."
 """
 )
 
@@ -199,6 +199,7 @@ def _intialise_target(self):
             lattice_group=self.lattice_group,
             dimensions=dimensions,
             weights=self.params.weights,
+            nproc=self.params.nproc,
         )
 
     def _determine_dimensions(self):
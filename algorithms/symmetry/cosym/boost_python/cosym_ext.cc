@@ -0,0 +1,61 @@
+/*
+ * cosym_ext.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/symmetry/cosym/pairwise_correlation.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  boost::python::tuple pairwise_correlation_matrix(const PairwiseCorrelation &self,
+                                                   std::size_t min_pairs,
+                                                   std::size_t nthreads) {
+    af::c_grid<2> grid(self.n_columns(), self.n_columns());
+    af::versa<double, af::c_grid<2> > rij(grid);
+    af::versa<double, af::c_grid<2> > counts(grid);
+    self.compute_matrix(min_pairs, nthreads, rij.ref(), counts.ref());
+    return boost::python::make_tuple(rij, counts);
+  }
+
+  boost::python::tuple pairwise_correlation_pairs(
+    const PairwiseCorrelation &self,
+    const af::const_ref<std::size_t> &first,
+    const af::const_ref<std::size_t> &second,
+    std::size_t min_pairs,
+    std::size_t nthreads) {
+    af::shared<double> rij(first.size());
+    af::shared<double> counts(first.size());
+    self.compute_pairs(first, second, min_pairs, nthreads, rij.ref(), counts.ref());
+    return boost::python::make_tuple(rij, counts);
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_symmetry_cosym_ext) {
+    class_<PairwiseCorrelation>("PairwiseCorrelation", no_init)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                std::size_t>(
+        (arg("columns"), arg("indices"), arg("values"), arg("n_columns"))))
+      .def("n_columns", &PairwiseCorrelation::n_columns)
+      .def("n_indices", &PairwiseCorrelation::n_indices)
+      .def("n_observations", &PairwiseCorrelation::n_observations)
+      .def("column_sizes", &PairwiseCorrelation::column_sizes)
+      .def("matrix",
+           &pairwise_correlation_matrix,
+           (arg("min_pairs") = 3, arg("nthreads") = 1))
+      .def("pairs",
+           &pairwise_correlation_pairs,
+           (arg("first"),
+            arg("second"),
+            arg("min_pairs") = 3,
+            arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,404 @@
+/*
+ * pairwise_correlation.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
+#define DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * The sums needed for the correlation coefficient between two columns
+     */
+    struct PairSums {
+      std::size_t n;
+      double sx;
+      double sy;
+      double sxx;
+      double syy;
+      double sxy;
+
+      PairSums() : n(0), sx(0), sy(0), sxx(0), syy(0), sxy(0) {}
+
+      void add(double x, double y) {
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        syy += y * y;
+        sxy += x * y;
+      }
+
+      /**
+       * The correlation coefficient is zero if there are fewer than min_pairs
+       * pairs, or if either column is constant over the pairs. The tolerance
+       * on the variances allows for the rounding of the sums.
+       * @param min_pairs The minimum number of pairs
+       * @returns The correlation coefficient
+       */
+      double coefficient(std::size_t min_pairs) const {
+        if (n < min_pairs || n < 2) {
+          return 0.0;
+        }
+        double dxx = sxx - sx * sx / n;
+        double dyy = syy - sy * sy / n;
+        double dxy = sxy - sx * sy / n;
+        if (!(dxx > 1e-12 * sxx && dyy > 1e-12 * syy)) {
+          return 0.0;
+        }
+        double r = dxy / (std::sqrt(dxx) * std::sqrt(dyy));
+        return std::max(-1.0, std::min(1.0, r));
+      }
+    };
+
+    /**
+     * Order the observations by column then by index, keeping the input order
+     * of repeated observations
+     */
+    struct ObservationOrder {
+      const std::size_t *columns;
+      const std::size_t *indices;
+      ObservationOrder(const std::size_t *columns_, const std::size_t *indices_)
+          : columns(columns_), indices(indices_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        if (columns[a] != columns[b]) {
+          return columns[a] < columns[b];
+        }
+        return indices[a] < indices[b];
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the correlation coefficients between all pairs of columns of a
+   * sparse matrix of intensities, as used for the rij matrix of cosym. Each
+   * column holds the merged intensities of one dataset reindexed by one
+   * symmetry operation and each row is a unique Miller index. The
+   * coefficient between two columns is computed over the Miller indices
+   * common to both, so no dense matrix of the intensities is needed.
+   *
+   * The observations are stored both by column and by Miller index. The rows
+   * of the matrix are shared between threads, and the coefficients of each
+   * row are found by accumulating the sums for every column sharing a Miller
+   * index with it, so the cost only depends on the number of common
+   * reflections. The values are centred on the mean of their column to keep
+   * the sums accurate.
+   */
+  class PairwiseCorrelation {
+  public:
+    /**
+     * Repeated observations of the same Miller index in a column are replaced
+     * by the last one given.
+     * @param columns The column of each observation
+     * @param indices The flattened Miller index of each observation
+     * @param values The intensity of each observation
+     * @param n_columns The number of columns
+     */
+    PairwiseCorrelation(const af::const_ref<std::size_t> &columns,
+                        const af::const_ref<std::size_t> &indices,
+                        const af::const_ref<double> &values,
+                        std::size_t n_columns)
+        : column_start_(n_columns + 1, 0) {
+      DIALS_ASSERT(columns.size() == indices.size());
+      DIALS_ASSERT(columns.size() == values.size());
+      std::size_t n = columns.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        DIALS_ASSERT(columns[i] < n_columns);
+      }
+
+      // Number the distinct Miller indices
+      std::vector<std::size_t> unique(indices.begin(), indices.end());
+      std::sort(unique.begin(), unique.end());
+      unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+      // Store the observations by column, sorted by Miller index
+      std::vector<std::size_t> order(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        order[i] = i;
+      }
+      std::stable_sort(order.begin(),
+                       order.end(),
+                       detail::ObservationOrder(columns.begin(), indices.begin()));
+      column_index_.reserve(n);
+      column_value_.reserve(n);
+      for (std::size_t k = 0; k < n; ++k) {
+        std::size_t i = order[k];
+        if (k + 1 < n && columns[order[k + 1]] == columns[i]
+            && indices[order[k + 1]] == indices[i]) {
+          continue;
+        }
+        column_index_.push_back(
+          std::lower_bound(unique.begin(), unique.end(), indices[i]) - unique.begin());
+        column_value_.push_back(values[i]);
+        column_start_[columns[i] + 1]++;
+      }
+      for (std::size_t c = 0; c < n_columns; ++c) {
+        column_start_[c + 1] += column_start_[c];
+      }
+
+      // Centre the values of each column
+      for (std::size_t c = 0; c < n_columns; ++c) {
+        std::size_t first = column_start_[c];
+        std::size_t last = column_start_[c + 1];
+        if (first == last) {
+          continue;
+        }
+        double mean = 0;
+        for (std::size_t k = first; k < last; ++k) {
+          mean += column_value_[k];
+        }
+        mean /= (last - first);
+        for (std::size_t k = first; k < last; ++k) {
+          column_value_[k] -= mean;
+        }
+      }
+
+      // Store the observations by Miller index, sorted by column
+      row_start_.assign(unique.size() + 1, 0);
+      for (std::size_t k = 0; k < column_index_.size(); ++k) {
+        row_start_[column_index_[k] + 1]++;
+      }
+      for (std::size_t h = 0; h < unique.size(); ++h) {
+        row_start_[h + 1] += row_start_[h];
+      }
+      std::vector<std::size_t> next(row_start_.begin(), row_start_.end() - 1);
+      row_column_.resize(column_index_.size());
+      row_value_.resize(column_index_.size());
+      for (std::size_t c = 0; c < n_columns; ++c) {
+        for (std::size_t k = column_start_[c]; k < column_start_[c + 1]; ++k) {
+          std::size_t j = next[column_index_[k]]++;
+          row_column_[j] = c;
+          row_value_[j] = column_value_[k];
+        }
+      }
+    }
+
+    /** @returns The number of columns */
+    std::size_t n_columns() const {
+      return column_start_.size() - 1;
+    }
+
+    /** @returns The number of distinct Miller indices */
+    std::size_t n_indices() const {
+      return row_start_.size() - 1;
+    }
+
+    /** @returns The number of observations after removing repeats */
+    std::size_t n_observations() const {
+      return column_index_.size();
+    }
+
+    /** @returns The number of observations in each column */
+    af::shared<std::size_t> column_sizes() const {
+      af::shared<std::size_t> result(n_columns());
+      for (std::size_t c = 0; c < result.size(); ++c) {
+        result[c] = column_start_[c + 1] - column_start_[c];
+      }
+      return result;
+    }
+
+    /**
+     * Compute the full matrix of correlation coefficients. The diagonal is
+     * set to zero.
+     * @param min_pairs The minimum number of common reflections
+     * @param nthreads The number of threads
+     * @param rij The correlation coefficients
+     * @param counts The number of common reflections
+     */
+    void compute_matrix(std::size_t min_pairs,
+                        std::size_t nthreads,
+                        af::ref<double, af::c_grid<2> > rij,
+                        af::ref<double, af::c_grid<2> > counts) const {
+      std::size_t n = n_columns();
+      DIALS_ASSERT(rij.accessor()[0] == n && rij.accessor()[1] == n);
+      DIALS_ASSERT(counts.accessor()[0] == n && counts.accessor()[1] == n);
+      DIALS_ASSERT(nthreads > 0);
+      std::fill(rij.begin(), rij.end(), 0.0);
+      std::fill(counts.begin(), counts.end(), 0.0);
+      dials::util::parallel_for(
+        n, nthreads, RowJob(this, min_pairs, rij.begin(), counts.begin()));
+    }
+
+    /**
+     * Compute the correlation coefficients between selected pairs of columns,
+     * for example the entries needed by a stochastic gradient.
+     * @param first The first column of each pair
+     * @param second The second column of each pair
+     * @param min_pairs The minimum number of common reflections
+     * @param nthreads The number of threads
+     * @param rij The correlation coefficients
+     * @param counts The number of common reflections
+     */
+    void compute_pairs(const af::const_ref<std::size_t> &first,
+                       const af::const_ref<std::size_t> &second,
+                       std::size_t min_pairs,
+                       std::size_t nthreads,
+                       af::ref<double> rij,
+                       af::ref<double> counts) const {
+      DIALS_ASSERT(first.size() == second.size());
+      DIALS_ASSERT(rij.size() == first.size());
+      DIALS_ASSERT(counts.size() == first.size());
+      DIALS_ASSERT(nthreads > 0);
+      for (std::size_t i = 0; i < first.size(); ++i) {
+        DIALS_ASSERT(first[i] < n_columns());
+        DIALS_ASSERT(second[i] < n_columns());
+      }
+      dials::util::parallel_for(first.size(),
+                                nthreads,
+                                PairJob(this,
+                                        first.begin(),
+                                        second.begin(),
+                                        min_pairs,
+                                        rij.begin(),
+                                        counts.begin()));
+    }
+
+  private:
+    /**
+     * Accumulate the sums between column a and every later column sharing a
+     * Miller index with it, and fill in the entries of the matrix for them.
+     */
+    void compute_row(std::size_t a,
+                     std::size_t min_pairs,
+                     std::vector<detail::PairSums> &sums,
+                     std::vector<std::size_t> &touched,
+                     double *rij,
+                     double *counts) const {
+      std::size_t n = n_columns();
+      touched.clear();
+      for (std::size_t k = column_start_[a]; k < column_start_[a + 1]; ++k) {
+        std::size_t h = column_index_[k];
+        double x = column_value_[k];
+        std::vector<std::size_t>::const_iterator begin = row_column_.begin();
+        std::vector<std::size_t>::const_iterator later =
+          std::upper_bound(begin + row_start_[h], begin + row_start_[h + 1], a);
+        for (std::size_t j = later - begin; j < row_start_[h + 1]; ++j) {
+          detail::PairSums &s = sums[row_column_[j]];
+          if (s.n == 0) {
+            touched.push_back(row_column_[j]);
+          }
+          s.add(x, row_value_[j]);
+        }
+      }
+      for (std::size_t i = 0; i < touched.size(); ++i) {
+        std::size_t b = touched[i];
+        double r = sums[b].coefficient(min_pairs);
+        rij[a * n + b] = r;
+        rij[b * n + a] = r;
+        counts[a * n + b] = (double)sums[b].n;
+        counts[b * n + a] = (double)sums[b].n;
+        sums[b] = detail::PairSums();
+      }
+    }
+
+    /**
+     * Accumulate the sums between two columns by merging their sorted Miller
+     * indices.
+     */
+    detail::PairSums pair_sums(std::size_t a, std::size_t b) const {
+      detail::PairSums result;
+      std::size_t i = column_start_[a];
+      std::size_t j = column_start_[b];
+      while (i < column_start_[a + 1] && j < column_start_[b + 1]) {
+        if (column_index_[i] < column_index_[j]) {
+          ++i;
+        } else if (column_index_[j] < column_index_[i]) {
+          ++j;
+        } else {
+          result.add(column_value_[i++], column_value_[j++]);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Compute a range of rows of the matrix. The early rows have the most
+     * later columns to correlate with, so the rows are taken alternately
+     * from the start and the end to balance the work between the chunks.
+     */
+    struct RowJob {
+      const PairwiseCorrelation *self;
+      std::size_t min_pairs;
+      double *rij;
+      double *counts;
+
+      RowJob(const PairwiseCorrelation *self_,
+             std::size_t min_pairs_,
+             double *rij_,
+             double *counts_)
+          : self(self_), min_pairs(min_pairs_), rij(rij_), counts(counts_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t n = self->n_columns();
+        std::vector<detail::PairSums> sums(n);
+        std::vector<std::size_t> touched;
+        for (std::size_t k = first; k < last; ++k) {
+          std::size_t a = (k % 2 == 0) ? k / 2 : n - 1 - k / 2;
+          self->compute_row(a, min_pairs, sums, touched, rij, counts);
+        }
+      }
+    };
+
+    /**
+     * Compute a range of selected pairs
+     */
+    struct PairJob {
+      const PairwiseCorrelation *self;
+      const std::size_t *first_column;
+      const std::size_t *second_column;
+      std::size_t min_pairs;
+      double *rij;
+      double *counts;
+
+      PairJob(const PairwiseCorrelation *self_,
+              const std::size_t *first_column_,
+              const std::size_t *second_column_,
+              std::size_t min_pairs_,
+              double *rij_,
+              double *counts_)
+          : self(self_),
+            first_column(first_column_),
+            second_column(second_column_),
+            min_pairs(min_pairs_),
+            rij(rij_),
+            counts(counts_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          if (first_column[i] == second_column[i]) {
+            rij[i] = 0.0;
+            counts[i] = 0.0;
+            continue;
+          }
+          detail::PairSums s = self->pair_sums(first_column[i], second_column[i]);
+          rij[i] = s.coefficient(min_pairs);
+          counts[i] = (double)s.n;
+        }
+      }
+    };
+
+    std::vector<std::size_t> column_start_;
+    std::vector<std::size_t> column_index_;
+    std::vector<double> column_value_;
+    std::vector<std::size_t> row_start_;
+    std::vector<std::size_t> row_column_;
+    std::vector<double> row_value_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SYMMETRY_COSYM_PAIRWISE_CORRELATION_H
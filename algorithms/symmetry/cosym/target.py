@@ -1,18 +1,19 @@
 """Target function for cosym analysis."""
 
 import copy
-import itertools
 import logging
 import warnings
 
 import numpy as np
-import pandas as pd
 from orderedset import OrderedSet
 
 import cctbx.sgtbx.cosets
 from cctbx import miller, sgtbx
 from cctbx.array_family import flex
 
+from dials.util.mp import available_cores
+from dials_algorithms_symmetry_cosym_ext import PairwiseCorrelation
+
 logger = logging.getLogger(__name__)
 
 
@@ -55,10 +56,12 @@ def __init__(
             in the analysis. If not set, then the number of dimensions used is
             equal to the greater of 2 or the number of symmetry operations in the
             lattice group.
-          nproc (int): Deprecated
+          nproc (int): The number of threads used to compute the rij matrix. If not
+            set, then all the available cores are used.
         """
-        if nproc is not None:
-            warnings.warn("nproc is deprecated", UserWarning)
+        if nproc is None:
+            nproc = available_cores()
+        self._nproc = nproc
 
         if weights is not None:
             assert weights in ("count", "standard_error")
@@ -195,60 +198,47 @@ def _compute_rij_wij(self, use_cache=True):
         for cb_op, hkl in indices.items():
             indices[cb_op] = np.ravel_multi_index((hkl + offset).T, dims)
 
-        # Create an empty 2D array of shape (m * n, L), where m is the number of sym
-        # ops, n is the number of lattices, and L is the number of unique miller indices
-        all_intensities = np.empty((n_sym_ops * n_lattices, np.prod(dims)))
-
-        # Populate all_intensities with intensity values, filling absent intensities
-        # with np.nan
-        all_intensities.fill(np.nan)
-        slices = np.append(self._lattices, intensities.size)
-        slices = list(map(slice, slices[:-1], slices[1:]))
+        # The rij matrix is the correlation matrix of the columns of a sparse
+        # (L, m * n) matrix of intensities, where L is the number of unique miller
+        # indices, m is the number of sym ops and n is the number of lattices. Each
+        # column holds the intensities of one lattice after applying one sym op.
+        lattice = np.repeat(
+            np.arange(n_lattices), np.diff(np.append(self._lattices, intensities.size))
+        )
+        columns = []
+        flat_indices = []
+        values = []
         for i, (mil_ind, eps) in enumerate(zip(indices.values(), epsilons.values())):
-            for j, selection in enumerate(slices):
-                # map (i, j) to a column in all_intensities
-                column = np.ravel_multi_index((i, j), (n_sym_ops, n_lattices))
-                epsilon_equals_one = eps[selection] == 1
-                valid_mil_ind = mil_ind[selection][epsilon_equals_one]
-                valid_intensities = intensities[selection][epsilon_equals_one]
-                all_intensities[column, valid_mil_ind] = valid_intensities
-
-        # Ideally we would use `np.ma.corrcoef` here, but it is broken, so use
-        # pd.DataFrame.corr() instead (see numpy/numpy#15601)
-        rij = (
-            pd.DataFrame(all_intensities)
-            .T.dropna(how="all")
-            .corr(min_periods=self._min_pairs)
-            .values
+            epsilon_equals_one = eps == 1
+            columns.append(i * n_lattices + lattice[epsilon_equals_one])
+            flat_indices.append(mil_ind[epsilon_equals_one])
+            values.append(intensities[epsilon_equals_one])
+        correlation = PairwiseCorrelation(
+            flex.size_t(np.concatenate(columns).astype(np.uint64)),
+            flex.size_t(np.concatenate(flat_indices).astype(np.uint64)),
+            flex.double(np.concatenate(values)),
+            n_sym_ops * n_lattices,
         )
-        # Set any NaN correlation coefficients to zero
-        np.nan_to_num(rij, copy=False)
-        # Cosym does not make use of the on-diagonal correlation coefficients
-        np.fill_diagonal(rij, 0)
+        rij, counts = correlation.matrix(
+            min_pairs=self._min_pairs, nthreads=self._nproc
+        )
+        # Coefficients with fewer than min_pairs reflections, and the on-diagonal
+        # coefficients which cosym does not make use of, are zero
+        rij = rij.as_numpy_array()
 
         if self._weights:
-            wij = np.zeros_like(rij)
-            right_up = np.triu_indices_from(wij, k=1)
-
             # For each correlation coefficient, set the weight equal to the size of
             # the sample used to calculate that coefficient
-            pairwise_combos = itertools.combinations(np.isfinite(all_intensities), 2)
-            sample_size = lambda x, y: np.count_nonzero(x & y)
-            wij[right_up] = list(itertools.starmap(sample_size, pairwise_combos))
+            wij = counts.as_numpy_array()
 
             if self._weights == "standard_error":
                 # Set each weights as the reciprocal of the standard error on the
                 # corresponding correlation coefficient
                 # http://www.sjsu.edu/faculty/gerstman/StatPrimer/correlation.pdf
                 with np.errstate(divide="ignore", invalid="ignore"):
-                    reciprocal_se = np.sqrt(
-                        (wij[right_up] - 2) / (1 - np.square(rij[right_up]))
-                    )
-
-                wij[right_up] = np.where(wij[right_up] > 2, reciprocal_se, 0)
+                    reciprocal_se = np.sqrt((wij - 2) / (1 - np.square(rij)))
 
-            # Symmetrise the wij matrix
-            wij += wij.T
+                wij = np.where(wij > 2, reciprocal_se, 0)
         else:
             wij = None
 
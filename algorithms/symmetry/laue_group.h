@@ -0,0 +1,255 @@
+/*
+ * laue_group.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SYMMETRY_LAUE_GROUP_H
+#define DIALS_ALGORITHMS_SYMMETRY_LAUE_GROUP_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/mat3.h>
+#include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::mat3;
+
+  namespace detail {
+
+    /**
+     * @returns Whether a Miller index comes before another in lexical order
+     */
+    inline bool less(const cctbx::miller::index<> &a, const cctbx::miller::index<> &b) {
+      for (std::size_t k = 0; k < 3; ++k) {
+        if (a[k] != b[k]) {
+          return a[k] < b[k];
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Order the reflections by Miller index, keeping the input order of
+     * repeated Miller indices
+     */
+    struct MillerIndexOrder {
+      const cctbx::miller::index<> *indices;
+      MillerIndexOrder(const cctbx::miller::index<> *indices_) : indices(indices_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return less(indices[a], indices[b]);
+      }
+    };
+
+    /**
+     * Compare a Miller index with that of a reflection, for searching the
+     * reflections sorted by MillerIndexOrder
+     */
+    struct MillerIndexSearch {
+      const cctbx::miller::index<> *indices;
+      MillerIndexSearch(const cctbx::miller::index<> *indices_) : indices(indices_) {}
+      bool operator()(const cctbx::miller::index<> &h, std::size_t b) const {
+        return less(h, indices[b]);
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Find the pairs of intensities related by each of a set of symmetry
+   * operations, as used to score the symmetry elements of the lattice group.
+   *
+   * For each operation this gives the same pairs, in the same order, as
+   * reindexing the intensities, mapping them to the asymmetric unit of P1,
+   * taking the common set with the original intensities and selecting the
+   * reflections with an epsilon of one in the group generated by the
+   * symmetry element. The reflections are sorted by Miller index once, and
+   * rather than reindexing the whole set for each operation it is the Miller
+   * index of each reflection that is transformed back and looked up, so only
+   * the search is repeated. Where a Miller index appears more than once the
+   * last reflection is used, and the operations are shared between threads.
+   */
+  class SymmetryElementPairs {
+  public:
+    /**
+     * @param indices The Miller indices
+     * @param data The intensities
+     * @param in_asu Whether each Miller index is in the asymmetric unit of P1
+     * @param anomalous_flag Whether the Friedel mates are separate
+     */
+    SymmetryElementPairs(const af::const_ref<cctbx::miller::index<> > &indices,
+                         const af::const_ref<double> &data,
+                         const af::const_ref<bool> &in_asu,
+                         bool anomalous_flag)
+        : indices_(indices.begin(), indices.end()),
+          data_(data.begin(), data.end()),
+          in_asu_(in_asu.begin(), in_asu.end()),
+          anomalous_flag_(anomalous_flag),
+          order_(indices.size()) {
+      DIALS_ASSERT(data.size() == indices.size());
+      DIALS_ASSERT(in_asu.size() == indices.size());
+      if (indices_.empty()) {
+        return;
+      }
+      for (std::size_t i = 0; i < order_.size(); ++i) {
+        order_[i] = i;
+      }
+      std::stable_sort(
+        order_.begin(), order_.end(), detail::MillerIndexOrder(&indices_[0]));
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return indices_.size();
+    }
+
+    /**
+     * Find the pairs for each operation. The reflection with Miller index h is
+     * paired with the one whose reindexed Miller index is h in the asymmetric
+     * unit, i.e. the one with Miller index h * inverse (or -h * inverse if
+     * the Friedel mates aren't separate). Operations that aren't a symmetry
+     * element of the lattice, e.g. the inversion used in place of the
+     * identity, are handled by giving the element separately.
+     * @param inverse The inverse of the reindexing matrix of each operation
+     * @param element The rotation matrix of the symmetry element
+     * @param nthreads The number of threads
+     * @param x The first intensity of each pair
+     * @param y The second intensity of each pair
+     */
+    void compute(const af::const_ref<mat3<double> > &inverse,
+                 const af::const_ref<mat3<double> > &element,
+                 std::size_t nthreads,
+                 std::vector<af::shared<double> > &x,
+                 std::vector<af::shared<double> > &y) const {
+      DIALS_ASSERT(element.size() == inverse.size());
+      DIALS_ASSERT(nthreads > 0);
+      // Each operation has its own arrays, so no two threads share one
+      x.clear();
+      y.clear();
+      for (std::size_t i = 0; i < inverse.size(); ++i) {
+        x.push_back(af::shared<double>());
+        y.push_back(af::shared<double>());
+      }
+      dials::util::parallel_for(
+        inverse.size(), nthreads, PairJob(this, inverse, element, x, y));
+    }
+
+  private:
+    typedef mat3<int> int_mat3;
+
+    static int_mat3 as_int(const mat3<double> &m) {
+      int_mat3 result;
+      for (std::size_t k = 0; k < 9; ++k) {
+        result[k] = (int)std::floor(m[k] + 0.5);
+        DIALS_ASSERT(std::abs(m[k] - result[k]) < 1e-6);
+      }
+      return result;
+    }
+
+    static cctbx::miller::index<> multiply(const cctbx::miller::index<> &h,
+                                           const int_mat3 &m) {
+      return cctbx::miller::index<>(h[0] * m[0] + h[1] * m[3] + h[2] * m[6],
+                                    h[0] * m[1] + h[1] * m[4] + h[2] * m[7],
+                                    h[0] * m[2] + h[1] * m[5] + h[2] * m[8]);
+    }
+
+    /**
+     * @returns The last reflection with a Miller index, or the number of
+     * reflections if there is none
+     */
+    std::size_t find(const cctbx::miller::index<> &h) const {
+      if (order_.empty()) {
+        return 0;
+      }
+      std::vector<std::size_t>::const_iterator it = std::upper_bound(
+        order_.begin(), order_.end(), h, detail::MillerIndexSearch(&indices_[0]));
+      if (it != order_.begin() && indices_[*(it - 1)] == h) {
+        return *(it - 1);
+      }
+      return order_.size();
+    }
+
+    void compute_pairs(const int_mat3 &inverse,
+                       const int_mat3 &element,
+                       af::shared<double> &x,
+                       af::shared<double> &y) const {
+      // The powers of the symmetry element other than the identity
+      std::vector<int_mat3> powers;
+      int_mat3 identity(1, 0, 0, 0, 1, 0, 0, 0, 1);
+      int_mat3 power = element;
+      while (!std::equal(power.begin(), power.end(), identity.begin())) {
+        DIALS_ASSERT(powers.size() < 6);
+        powers.push_back(power);
+        power = power * element;
+      }
+
+      const std::size_t n = indices_.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (!in_asu_[i]) {
+          continue;
+        }
+        const cctbx::miller::index<> &h = indices_[i];
+        bool fixed = false;
+        for (std::size_t k = 0; k < powers.size() && !fixed; ++k) {
+          fixed = (multiply(h, powers[k]) == h);
+        }
+        if (fixed) {
+          continue;
+        }
+        cctbx::miller::index<> g = multiply(h, inverse);
+        std::size_t j = find(g);
+        if (!anomalous_flag_) {
+          std::size_t j_minus = find(-g);
+          if (j_minus < n && (j == n || j_minus > j)) {
+            j = j_minus;
+          }
+        }
+        if (j < n) {
+          x.push_back(data_[i]);
+          y.push_back(data_[j]);
+        }
+      }
+    }
+
+    /**
+     * Find the pairs of a range of the operations
+     */
+    struct PairJob {
+      const SymmetryElementPairs *self;
+      af::const_ref<mat3<double> > inverse;
+      af::const_ref<mat3<double> > element;
+      std::vector<af::shared<double> > *x;
+      std::vector<af::shared<double> > *y;
+
+      PairJob(const SymmetryElementPairs *self_,
+              const af::const_ref<mat3<double> > &inverse_,
+              const af::const_ref<mat3<double> > &element_,
+              std::vector<af::shared<double> > &x_,
+              std::vector<af::shared<double> > &y_)
+          : self(self_), inverse(inverse_), element(element_), x(&x_), y(&y_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          self->compute_pairs(
+            as_int(inverse[i]), as_int(element[i]), (*x)[i], (*y)[i]);
+        }
+      }
+    };
+
+    std::vector<cctbx::miller::index<> > indices_;
+    std::vector<double> data_;
+    std::vector<bool> in_asu_;
+    bool anomalous_flag_;
+    std::vector<std::size_t> order_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SYMMETRY_LAUE_GROUP_H
@@ -8,11 +8,12 @@
 
 import libtbx
 from cctbx import crystal, sgtbx
-from scitbx.array_family import flex
+from cctbx.array_family import flex
 from scitbx.math import five_number_summary
 
 import dials.util
 from dials.algorithms.symmetry import symmetry_base
+from dials_algorithms_symmetry_ext import SymmetryElementPairs
 
 logger = logging.getLogger(__name__)
 
@@ -38,6 +39,7 @@ def __init__(
         relative_length_tolerance=None,
         absolute_angle_tolerance=None,
         best_monoclinic_beta=True,
+        nproc=1,
     ):
         """Initialise a LaueGroupAnalysis object.
 
@@ -64,7 +66,10 @@ def __init__(
           best_monoclinic_beta (bool): If True, then for monoclinic centered cells, I2
             will be preferred over C2 if it gives a less oblique cell (i.e. smaller
             beta angle).
+          nproc (int): The number of threads to use when scoring the symmetry
+            elements.
         """
+        self._nproc = nproc
         super().__init__(
             intensities,
             normalisation=normalisation,
@@ -210,15 +215,16 @@ def _estimate_cc_true(self):
         logger.debug("cc_true: %g", self.cc_true)
 
     def _score_symmetry_elements(self):
-        self.sym_op_scores = []
-        for smx in self.lattice_group.smx():
-            if smx.r().info().sense() < 0:
-                continue
-            self.sym_op_scores.append(
-                ScoreSymmetryElement(
-                    self.intensities, smx, self.cc_true, self.cc_sig_fac
-                )
+        sym_ops = [
+            smx for smx in self.lattice_group.smx() if smx.r().info().sense() >= 0
+        ]
+        pairs = symmetry_element_pairs(self.intensities, sym_ops, nproc=self._nproc)
+        self.sym_op_scores = [
+            ScoreSymmetryElement(
+                self.intensities, smx, self.cc_true, self.cc_sig_fac, pairs=op_pairs
             )
+            for smx, op_pairs in zip(sym_ops, pairs)
+        ]
 
     def _score_laue_groups(self):
         subgroup_scores = [
@@ -466,6 +472,61 @@ def _denominator(self, x):
         return self._p_mu_power_pdf(x)
 
 
+def _as_matrix(cb_op):
+    """The matrix m for which cb_op.apply(h) == h * m for a row vector h."""
+    rows = cb_op.apply(flex.miller_index([(1, 0, 0), (0, 1, 0), (0, 0, 1)]))
+    return tuple(float(v) for row in rows for v in row)
+
+
+def symmetry_element_pairs(intensities, sym_ops, nproc=1):
+    """Find the pairs of intensities related by each of a set of symmetry elements.
+
+    For each symmetry element the intensities are paired with those reindexed by
+    the element, and by its inverse if the element has an order greater than two,
+    excluding the reflections that are fixed by the element. The identity is
+    replaced by the inversion, so that Friedel mates are paired. The intensities
+    are grouped by Miller index once and the elements are scored in parallel.
+
+    Args:
+      intensities (cctbx.miller.array): The intensities on which to perform
+        symmetry analysis.
+      sym_ops (list): The symmetry operations (cctbx.sgtbx.rt_mx) for analysis.
+      nproc (int): The number of threads to use.
+
+    Returns:
+      list: For each symmetry operation, a list of the (x, y) pairs of
+        flex.double intensities for each of its reindexing operations.
+    """
+    in_asu = intensities.indices() == intensities.map_to_asu().indices()
+    pairs = SymmetryElementPairs(
+        intensities.indices(),
+        intensities.data(),
+        in_asu,
+        intensities.anomalous_flag(),
+    )
+    inverse = flex.mat3_double()
+    element = flex.mat3_double()
+    n_ops = []
+    for sym_op in sym_ops:
+        cb_op = sgtbx.change_of_basis_op(sym_op)
+        cb_ops = [cb_op]
+        if sym_op.r().order() > 2:
+            # include inverse symmetry operation
+            cb_ops.append(cb_op.inverse())
+        for cb_op in cb_ops:
+            if cb_op.is_identity_op():
+                cb_op = sgtbx.change_of_basis_op("-x,-y,-z")
+            inverse.append(_as_matrix(cb_op.inverse()))
+            element.append(_as_matrix(sgtbx.change_of_basis_op(sym_op)))
+        n_ops.append(len(cb_ops))
+    result = pairs.compute(inverse, element, nthreads=nproc)
+    grouped = []
+    for n in n_ops:
+        grouped.append(result[:n])
+        result = result[n:]
+    return grouped
+
+
 class ScoreSymmetryElement:
     """Analyse intensities for presence of a given symmetry operation.
 
@@ -485,7 +546,7 @@ class ScoreSymmetryElement:
     <https://doi.org/10.1107/S090744491003982X>`_
     """
 
-    def __init__(self, intensities, sym_op, cc_true, cc_sig_fac):
+    def __init__(self, intensities, sym_op, cc_true, cc_sig_fac, pairs=None):
         """Initialise a ScoreSymmetryElement object.
 
         Args:
@@ -495,29 +556,19 @@ def __init__(self, intensities, sym_op, cc_true, cc_sig_fac):
           cc_true (float): the expected value of CC if the symmetry element is present,
             E(CC; S)
           cc_sig_fac (float): Estimation of sigma(CC) as a function of sample size.
+          pairs (list): Optional pairs of related intensities for each of the
+            operations of the symmetry element, as given by
+            :func:`symmetry_element_pairs`. If None then they are found here.
         """
         self.sym_op = sym_op
         assert self.sym_op.r().info().sense() >= 0
         self.cc = CorrelationCoefficientAccumulator()
-        cb_op = sgtbx.change_of_basis_op(self.sym_op)
-        cb_ops = [cb_op]
-        if self.sym_op.r().order() > 2:
-            # include inverse symmetry operation
-            cb_ops.append(cb_op.inverse())
-        for cb_op in cb_ops:
-            if cb_op.is_identity_op():
-                cb_op = sgtbx.change_of_basis_op("-x,-y,-z")
-            reindexed_intensities = intensities.change_basis(cb_op).map_to_asu()
-            x, y = intensities.common_sets(
-                reindexed_intensities, assert_is_similar_symmetry=False
-            )
-            sel = sgtbx.space_group().expand_smx(self.sym_op).epsilon(x.indices()) == 1
-            x = x.select(sel)
-            y = y.select(sel)
-
-            outliers = flex.bool(len(x.data()), False)
+        if pairs is None:
+            pairs = symmetry_element_pairs(intensities, [sym_op])[0]
+        for x, y in pairs:
+            outliers = flex.bool(len(x), False)
             iqr_multiplier = 20  # very generous tolerance
-            for col in (x.data(), y.data()):
+            for col in (x, y):
                 if col.size():
                     min_x, q1_x, med_x, q3_x, max_x = five_number_summary(col)
                     iqr_x = q3_x - q1_x
@@ -532,7 +583,7 @@ def __init__(self, intensities, sym_op, cc_true, cc_sig_fac):
                 x = x.select(~outliers)
                 y = y.select(~outliers)
 
-            self.cc += CorrelationCoefficientAccumulator(x.data(), y.data())
+            self.cc += CorrelationCoefficientAccumulator(x, y)
 
         self.n_refs = self.cc.n()
         if self.n_refs <= 0:
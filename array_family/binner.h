@@ -11,12 +11,212 @@
 #ifndef DIALS_ARRAY_FAMILY_BINNER_H
 #define DIALS_ARRAY_FAMILY_BINNER_H
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace af {
 
+  /**
+   * The count, sum, sum of squares, extrema and weighted sum of several
+   * columns of values in each bin. Bins with no values have zero for all
+   * statistics.
+   */
+  class BinnedStatistics {
+  public:
+    /**
+     * @param nbins The number of bins
+     * @param ncols The number of columns
+     */
+    BinnedStatistics(std::size_t nbins, std::size_t ncols)
+        : nbins_(nbins),
+          ncols_(ncols),
+          count_(nbins * ncols, 0),
+          sum_(nbins * ncols, 0.0),
+          sum_sq_(nbins * ncols, 0.0),
+          min_(nbins * ncols, 0.0),
+          max_(nbins * ncols, 0.0),
+          sum_weights_(nbins * ncols, 0.0),
+          weighted_sum_(nbins * ncols, 0.0) {}
+
+    /**
+     * Add a value to a bin
+     * @param bin The bin
+     * @param col The column
+     * @param x The value
+     * @param w The weight of the value
+     */
+    void add(std::size_t bin, std::size_t col, double x, double w) {
+      std::size_t k = col * nbins_ + bin;
+      if (count_[k] == 0) {
+        min_[k] = x;
+        max_[k] = x;
+      } else {
+        min_[k] = std::min(min_[k], x);
+        max_[k] = std::max(max_[k], x);
+      }
+      count_[k]++;
+      sum_[k] += x;
+      sum_sq_[k] += x * x;
+      sum_weights_[k] += w;
+      weighted_sum_[k] += w * x;
+    }
+
+    /**
+     * Add the statistics of another set of values
+     * @param other The other statistics
+     */
+    void add(const BinnedStatistics &other) {
+      DIALS_ASSERT(other.nbins_ == nbins_);
+      DIALS_ASSERT(other.ncols_ == ncols_);
+      for (std::size_t k = 0; k < count_.size(); ++k) {
+        if (other.count_[k] == 0) {
+          continue;
+        }
+        if (count_[k] == 0) {
+          min_[k] = other.min_[k];
+          max_[k] = other.max_[k];
+        } else {
+          min_[k] = std::min(min_[k], other.min_[k]);
+          max_[k] = std::max(max_[k], other.max_[k]);
+        }
+        count_[k] += other.count_[k];
+        sum_[k] += other.sum_[k];
+        sum_sq_[k] += other.sum_sq_[k];
+        sum_weights_[k] += other.sum_weights_[k];
+        weighted_sum_[k] += other.weighted_sum_[k];
+      }
+    }
+
+    std::size_t nbins() const {
+      return nbins_;
+    }
+
+    std::size_t ncols() const {
+      return ncols_;
+    }
+
+    /**
+     * @param col The column
+     * @returns The number of values in each bin
+     */
+    af::shared<std::size_t> count(std::size_t col) const {
+      return column(count_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The sum of the values in each bin
+     */
+    af::shared<double> sum(std::size_t col) const {
+      return column(sum_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The sum of the squared values in each bin
+     */
+    af::shared<double> sum_sq(std::size_t col) const {
+      return column(sum_sq_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The smallest value in each bin
+     */
+    af::shared<double> min(std::size_t col) const {
+      return column(min_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The largest value in each bin
+     */
+    af::shared<double> max(std::size_t col) const {
+      return column(max_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The sum of the weights in each bin
+     */
+    af::shared<double> sum_weights(std::size_t col) const {
+      return column(sum_weights_, col);
+    }
+
+    /**
+     * @param col The column
+     * @returns The mean of the values in each bin
+     */
+    af::shared<double> mean(std::size_t col) const {
+      af::shared<double> result = sum(col);
+      for (std::size_t i = 0; i < nbins_; ++i) {
+        std::size_t n = count_[col * nbins_ + i];
+        if (n > 0) {
+          result[i] /= n;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @param col The column
+     * @returns The unbiased variance of the values in each bin, or zero for
+     * bins with fewer than two values
+     */
+    af::shared<double> variance(std::size_t col) const {
+      DIALS_ASSERT(col < ncols_);
+      af::shared<double> result(nbins_, 0.0);
+      for (std::size_t i = 0; i < nbins_; ++i) {
+        std::size_t k = col * nbins_ + i;
+        std::size_t n = count_[k];
+        if (n > 1) {
+          double m = sum_[k] / n;
+          result[i] = std::max(0.0, (sum_sq_[k] - n * m * m) / (n - 1));
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @param col The column
+     * @returns The weighted mean of the values in each bin, or zero for bins
+     * where the sum of the weights is zero
+     */
+    af::shared<double> weighted_mean(std::size_t col) const {
+      DIALS_ASSERT(col < ncols_);
+      af::shared<double> result(nbins_, 0.0);
+      for (std::size_t i = 0; i < nbins_; ++i) {
+        std::size_t k = col * nbins_ + i;
+        if (sum_weights_[k] != 0.0) {
+          result[i] = weighted_sum_[k] / sum_weights_[k];
+        }
+      }
+      return result;
+    }
+
+  private:
+    template <typename T>
+    af::shared<T> column(const std::vector<T> &data, std::size_t col) const {
+      DIALS_ASSERT(col < ncols_);
+      return af::shared<T>(data.begin() + col * nbins_,
+                           data.begin() + (col + 1) * nbins_);
+    }
+
+    std::size_t nbins_;
+    std::size_t ncols_;
+    std::vector<std::size_t> count_;
+    std::vector<double> sum_;
+    std::vector<double> sum_sq_;
+    std::vector<double> min_;
+    std::vector<double> max_;
+    std::vector<double> sum_weights_;
+    std::vector<double> weighted_sum_;
+  };
+
   /**
    * A class to compute the count, sum and mean of values in bins
    */
@@ -122,7 +322,81 @@ namespace dials { namespace af {
       return result;
     }
 
+    /**
+     * Compute the statistics of several columns of values in each bin in a
+     * single pass. The values are split into a fixed number of blocks that
+     * are shared between the threads, and the statistics of the blocks are
+     * added in order, so the results do not depend on the number of threads.
+     * @param values The ncols x n values
+     * @param weights The ncols x n weights (or empty for unit weights)
+     * @param mask The ncols x n values to include (or empty to include all)
+     * @param nthreads The number of threads
+     * @returns The statistics
+     */
+    BinnedStatistics statistics(
+      const af::const_ref<double, af::c_grid<2> > &values,
+      const af::const_ref<double, af::c_grid<2> > &weights,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      std::size_t nthreads) const {
+      std::size_t ncols = values.accessor()[0];
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(values.accessor()[1] == index_.size());
+      DIALS_ASSERT(weights.size() == 0 || weights.accessor().all_eq(values.accessor()));
+      DIALS_ASSERT(mask.size() == 0 || mask.accessor().all_eq(values.accessor()));
+      std::size_t max_blocks = 32;
+      std::size_t n_blocks = std::min(index_.size(), max_blocks);
+      std::vector<BinnedStatistics> blocks(n_blocks, BinnedStatistics(nbins_, ncols));
+      dials::util::parallel_for(
+        n_blocks, nthreads, StatisticsJob(this, values, weights, mask, &blocks));
+      BinnedStatistics result(nbins_, ncols);
+      for (std::size_t i = 0; i < n_blocks; ++i) {
+        result.add(blocks[i]);
+      }
+      return result;
+    }
+
   private:
+    struct StatisticsJob {
+      const BinIndexer *indexer;
+      af::const_ref<double, af::c_grid<2> > values;
+      af::const_ref<double, af::c_grid<2> > weights;
+      af::const_ref<bool, af::c_grid<2> > mask;
+      std::vector<BinnedStatistics> *blocks;
+
+      StatisticsJob(const BinIndexer *indexer_,
+                    const af::const_ref<double, af::c_grid<2> > &values_,
+                    const af::const_ref<double, af::c_grid<2> > &weights_,
+                    const af::const_ref<bool, af::c_grid<2> > &mask_,
+                    std::vector<BinnedStatistics> *blocks_)
+          : indexer(indexer_),
+            values(values_),
+            weights(weights_),
+            mask(mask_),
+            blocks(blocks_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const std::size_t *index = indexer->index_.begin();
+        std::size_t n = indexer->index_.size();
+        std::size_t ncols = values.accessor()[0];
+        std::size_t n_blocks = blocks->size();
+        for (std::size_t b = first; b < last; ++b) {
+          BinnedStatistics &block = (*blocks)[b];
+          std::size_t begin = (b * n) / n_blocks;
+          std::size_t end = ((b + 1) * n) / n_blocks;
+          for (std::size_t col = 0; col < ncols; ++col) {
+            std::size_t offset = col * n;
+            for (std::size_t i = begin; i < end; ++i) {
+              if (mask.size() > 0 && !mask[offset + i]) {
+                continue;
+              }
+              double w = weights.size() > 0 ? weights[offset + i] : 1.0;
+              block.add(index[i], col, values[offset + i], w);
+            }
+          }
+        }
+      }
+    };
+
     std::size_t nbins_;
     af::shared<std::size_t> index_;
   };
@@ -30,13 +30,27 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   void export_flex_binner() {
+    class_<BinnedStatistics>("BinnedStatistics", no_init)
+      .def("nbins", &BinnedStatistics::nbins)
+      .def("ncols", &BinnedStatistics::ncols)
+      .def("count", &BinnedStatistics::count)
+      .def("sum", &BinnedStatistics::sum)
+      .def("sum_sq", &BinnedStatistics::sum_sq)
+      .def("min", &BinnedStatistics::min)
+      .def("max", &BinnedStatistics::max)
+      .def("sum_weights", &BinnedStatistics::sum_weights)
+      .def("mean", &BinnedStatistics::mean)
+      .def("variance", &BinnedStatistics::variance)
+      .def("weighted_mean", &BinnedStatistics::weighted_mean);
+
     class_<BinIndexer>("BinIndexer", no_init)
       .def("indices", &BinIndexer::indices)
       .def("count", &BinIndexer::count)
       .def("sum", &sum_double)
       .def("sum", &sum_int)
       .def("sum", &sum_bool)
-      .def("mean", &BinIndexer::mean);
+      .def("mean", &BinIndexer::mean)
+      .def("_statistics", &BinIndexer::statistics);
 
     class_<Binner>("Binner", no_init)
       .def(init<const af::const_ref<double> &>())
@@ -12,11 +12,19 @@
 #include <boost/python/def.hpp>
 #include <boost/python/suite/indexing/map_indexing_suite.hpp>
 #include <dials/util/python_streambuf.h>
+#include <algorithm>
+#include <cmath>
 #include <numeric>
+#include <set>
+#include <string>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/array_family/reflection_table_msgpack_adapter.h>
+#include <dials/array_family/sort_index.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/observation.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
@@ -35,6 +43,7 @@ namespace dials { namespace af { namespace boost_python {
   using dials::util::streambuf;
   using flex_table_suite::column_to_object_visitor;
   using flex_table_suite::flex_table_wrapper;
+  using scitbx::mat3;
   using scitbx::vec2;
   using scitbx::vec3;
   using scitbx::af::int6;
@@ -546,6 +555,153 @@ namespace dials { namespace af { namespace boost_python {
     return result;
   }
 
+  /**
+   * Compare elements of a column. Vector elements are compared element by
+   * element, like tuples in Python.
+   */
+  template <typename U>
+  struct element_less {
+    static bool less(const U &a, const U &b) {
+      return a < b;
+    }
+  };
+
+  template <typename U, std::size_t N>
+  struct lexicographic_less {
+    static bool less(const U &a, const U &b) {
+      for (std::size_t i = 0; i < N; ++i) {
+        if (a[i] < b[i]) return true;
+        if (b[i] < a[i]) return false;
+      }
+      return false;
+    }
+  };
+
+  template <>
+  struct element_less<vec2<double> > : lexicographic_less<vec2<double>, 2> {};
+
+  template <>
+  struct element_less<vec3<double> > : lexicographic_less<vec3<double>, 3> {};
+
+  template <>
+  struct element_less<mat3<double> > : lexicographic_less<mat3<double>, 9> {};
+
+  template <>
+  struct element_less<int6> : lexicographic_less<int6, 6> {};
+
+  template <>
+  struct element_less<cctbx::miller::index<> >
+      : lexicographic_less<cctbx::miller::index<>, 3> {};
+
+  /**
+   * Compare two rows by the value of a column
+   */
+  struct row_comparer_base {
+    virtual ~row_comparer_base() {}
+    virtual int compare(std::size_t a, std::size_t b) const = 0;
+  };
+
+  template <typename U>
+  struct row_comparer : public row_comparer_base {
+    af::shared<U> column;
+
+    row_comparer(const af::shared<U> &column_) : column(column_) {}
+
+    virtual int compare(std::size_t a, std::size_t b) const {
+      if (element_less<U>::less(column[a], column[b])) return -1;
+      if (element_less<U>::less(column[b], column[a])) return 1;
+      return 0;
+    }
+  };
+
+  /**
+   * A visitor to create a row comparer for a column
+   */
+  struct row_comparer_visitor
+      : public boost::static_visitor<boost::shared_ptr<row_comparer_base> > {
+    template <typename U>
+    boost::shared_ptr<row_comparer_base> operator()(const af::shared<U> &column) const {
+      return boost::make_shared<row_comparer<U> >(column);
+    }
+
+    boost::shared_ptr<row_comparer_base> operator()(
+      const af::shared<Shoebox<> > &) const {
+      throw DIALS_ERROR("Cannot sort by a shoebox column");
+    }
+  };
+
+  /**
+   * Compare rows by several columns in turn
+   */
+  struct multi_key_less {
+    const std::vector<boost::shared_ptr<row_comparer_base> > *keys;
+    bool reverse;
+
+    bool operator()(std::size_t a, std::size_t b) const {
+      for (std::size_t k = 0; k < keys->size(); ++k) {
+        int c = (*keys)[k]->compare(a, b);
+        if (c != 0) {
+          return reverse ? c > 0 : c < 0;
+        }
+      }
+      return false;
+    }
+  };
+
+  /**
+   * Compute the permutation which stable sorts the table by one or more
+   * columns. Rows are ordered by the first column, then rows with equal
+   * values by the second column and so on, in a single sort. A single int or
+   * size_t column is sorted with a parallel radix sort, anything else with a
+   * parallel merge sort.
+   * @param self The reflection table
+   * @param keys The names of the columns to sort by
+   * @param reverse Sort in descending rather than ascending order
+   * @param nthreads The number of threads, or 0 to choose from the table size
+   * @returns The permutation
+   */
+  template <typename T>
+  af::shared<std::size_t> sort_permutation(const T &self,
+                                           boost::python::object keys,
+                                           bool reverse,
+                                           std::size_t nthreads) {
+    std::size_t nkeys = boost::python::len(keys);
+    DIALS_ASSERT(nkeys > 0);
+    if (nthreads == 0) {
+      nthreads = flex_table_suite::default_num_threads(self.nrows());
+    }
+    std::vector<typename T::mapped_type> columns;
+    for (std::size_t i = 0; i < nkeys; ++i) {
+      std::string key = boost::python::extract<std::string>(keys[i])();
+      typename T::const_iterator it = self.find(key);
+      DIALS_ASSERT(it != self.end());
+      columns.push_back(it->second);
+    }
+
+    // Fast path for integer keys
+    if (nkeys == 1) {
+      if (const af::shared<int> *col = boost::get<af::shared<int> >(&columns[0])) {
+        return radix_sort_permutation(col->const_ref(), reverse, nthreads);
+      }
+      if (const af::shared<std::size_t> *col =
+            boost::get<af::shared<std::size_t> >(&columns[0])) {
+        return radix_sort_permutation(col->const_ref(), reverse, nthreads);
+      }
+    }
+
+    std::vector<boost::shared_ptr<row_comparer_base> > comparers;
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+      comparers.push_back(boost::apply_visitor(row_comparer_visitor(), columns[i]));
+    }
+    af::shared<std::size_t> index(self.nrows());
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      index[i] = i;
+    }
+    multi_key_less compare = {&comparers, reverse};
+    parallel_stable_sort(index.begin(), index.size(), compare, nthreads);
+    return index;
+  }
+
   /**
    * Compute phi range of reflection
    */
@@ -812,14 +968,41 @@ namespace dials { namespace af { namespace boost_python {
     return result;
   }
 
+  /**
+   * Pack the reflection table in msgpack format, with or without compressing
+   * the columns
+   * @param stream The stream to pack into
+   * @param self The reflection table
+   * @param compression_level The zlib compression level, or 0 for none
+   * @param nthreads The number of threads to compress with
+   */
+  template <typename Stream>
+  void pack_reflection_table(Stream &stream,
+                             const reflection_table &self,
+                             int compression_level,
+                             std::size_t nthreads) {
+    DIALS_ASSERT(compression_level >= 0 && compression_level <= 9);
+    DIALS_ASSERT(nthreads > 0);
+    if (compression_level == 0) {
+      msgpack::pack(stream, self);
+    } else {
+      msgpack::pack(stream,
+                    compressed_reflection_table(self, compression_level, nthreads));
+    }
+  }
+
   /**
    * Pack the reflection table in msgpack format
    * @param self The reflection table
+   * @param compression_level The zlib compression level, or 0 for none
+   * @param nthreads The number of threads to compress with
    * @returns The msgpack string
    */
-  boost::python::object reflection_table_as_msgpack(reflection_table self) {
+  boost::python::object reflection_table_as_msgpack(reflection_table self,
+                                                    int compression_level,
+                                                    std::size_t nthreads) {
     std::stringstream buffer;
-    msgpack::pack(buffer, self);
+    pack_reflection_table(buffer, self, compression_level, nthreads);
     // Convert to a python bytes object
     std::string data = buffer.str();
     boost::python::object data_bytes(
@@ -831,10 +1014,15 @@ namespace dials { namespace af { namespace boost_python {
    * Pack the reflection table in msgpack format into a streambuf object
    * @param self The reflection table
    * @param output A streambuf object encapsulating a Python file-like object
+   * @param compression_level The zlib compression level, or 0 for none
+   * @param nthreads The number of threads to compress with
    */
-  void reflection_table_as_msgpack_to_file(reflection_table self, streambuf &output) {
+  void reflection_table_as_msgpack_to_file(reflection_table self,
+                                           streambuf &output,
+                                           int compression_level,
+                                           std::size_t nthreads) {
     streambuf::ostream os(output);
-    msgpack::pack(os, self);
+    pack_reflection_table(os, self, compression_level, nthreads);
   }
 
   /**
@@ -847,20 +1035,362 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Unpack the reflection table from msgpack format
-   * @param the msgpack string
+   * Hold a read-only view of a Python buffer for the lifetime of the object
+   */
+  class buffer_view : boost::noncopyable {
+  public:
+    buffer_view(boost::python::object obj) {
+      if (PyObject_GetBuffer(obj.ptr(), &view_, PyBUF_SIMPLE) != 0) {
+        boost::python::throw_error_already_set();
+      }
+    }
+
+    ~buffer_view() {
+      PyBuffer_Release(&view_);
+    }
+
+    const char *data() const {
+      return static_cast<const char *>(view_.buf);
+    }
+
+    std::size_t size() const {
+      return view_.len;
+    }
+
+  private:
+    Py_buffer view_;
+  };
+
+  /**
+   * Get the range of frames [first, last) covered by the reflections, from the
+   * bounding boxes if there are any, otherwise from the calculated or observed
+   * centroids
+   * @param self The reflection table
+   * @param first The first frame
+   * @param last One past the last frame
+   * @returns False if the frame range could not be found
+   */
+  bool reflection_table_frame_range(const reflection_table &self,
+                                    int &first,
+                                    int &last) {
+    if (self.nrows() == 0) {
+      return false;
+    }
+    if (self.contains("bbox")) {
+      af::const_ref<int6> bbox = self.get<int6>("bbox").const_ref();
+      first = bbox[0][4];
+      last = bbox[0][5];
+      for (std::size_t i = 1; i < bbox.size(); ++i) {
+        first = std::min(first, bbox[i][4]);
+        last = std::max(last, bbox[i][5]);
+      }
+      return true;
+    }
+    const char *names[] = {"xyzcal.px", "xyzobs.px.value"};
+    for (std::size_t k = 0; k < 2; ++k) {
+      if (self.contains(names[k])) {
+        af::const_ref<vec3<double> > xyz =
+          self.get<vec3<double> >(names[k]).const_ref();
+        double zmin = xyz[0][2];
+        double zmax = xyz[0][2];
+        for (std::size_t i = 1; i < xyz.size(); ++i) {
+          zmin = std::min(zmin, xyz[i][2]);
+          zmax = std::max(zmax, xyz[i][2]);
+        }
+        first = (int)std::floor(zmin);
+        last = (int)std::floor(zmax) + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Get the range of panels [first, last] of the reflections
+   * @param self The reflection table
+   * @param first The first panel
+   * @param last The last panel
+   * @returns False if the table has no panel column or no rows
+   */
+  bool reflection_table_panel_range(const reflection_table &self,
+                                    std::size_t &first,
+                                    std::size_t &last) {
+    if (self.nrows() == 0 || !self.contains("panel")) {
+      return false;
+    }
+    af::const_ref<std::size_t> panel = self.get<std::size_t>("panel").const_ref();
+    first = *std::min_element(panel.begin(), panel.end());
+    last = *std::max_element(panel.begin(), panel.end());
+    return true;
+  }
+
+  /**
+   * Get the header of a reflection file made of row groups. The header is a
+   * msgpack array like ["dials::af::reflection_table", 2, {}], and is
+   * followed by any number of row groups, each written by
+   * reflection_table_as_msgpack_row_group.
+   * @returns The msgpack string
+   */
+  boost::python::object reflection_table_msgpack_row_group_header() {
+    std::stringstream buffer;
+    msgpack::packer<std::stringstream> o(buffer);
+    o.pack_array(3);
+    o.pack(std::string("dials::af::reflection_table"));
+    o.pack(2);
+    o.pack_map(0);
+    std::string data = buffer.str();
+    return boost::python::object(
+      boost::python::handle<>(PyBytes_FromStringAndSize(data.c_str(), data.size())));
+  }
+
+  /**
+   * Pack the reflection table as a row group of a reflection file. The group
+   * is a msgpack array [nrows, nbytes, frames, panels] followed by nbytes of
+   * the table in the usual msgpack format, so each group can be decoded on
+   * its own, and a reader can skip over a group without decoding it. The
+   * frames are the range [first, last) of frames of the reflections and the
+   * panels the range [first, last] of their panels, or nil if not known.
+   * @param self The reflection table
+   * @param compression_level The zlib compression level, or 0 for none
+   * @param nthreads The number of threads to compress with
+   * @returns The msgpack string
+   */
+  boost::python::object reflection_table_as_msgpack_row_group(
+    reflection_table self,
+    int compression_level,
+    std::size_t nthreads) {
+    std::stringstream payload;
+    pack_reflection_table(payload, self, compression_level, nthreads);
+    std::string table_data = payload.str();
+
+    std::stringstream buffer;
+    msgpack::packer<std::stringstream> o(buffer);
+    o.pack_array(4);
+    o.pack(self.nrows());
+    o.pack(table_data.size());
+    int first_frame = 0, last_frame = 0;
+    if (reflection_table_frame_range(self, first_frame, last_frame)) {
+      o.pack_array(2);
+      o.pack(first_frame);
+      o.pack(last_frame);
+    } else {
+      o.pack_nil();
+    }
+    std::size_t first_panel = 0, last_panel = 0;
+    if (reflection_table_panel_range(self, first_panel, last_panel)) {
+      o.pack_array(2);
+      o.pack(first_panel);
+      o.pack(last_panel);
+    } else {
+      o.pack_nil();
+    }
+    buffer.write(table_data.c_str(), table_data.size());
+    std::string data = buffer.str();
+    return boost::python::object(
+      boost::python::handle<>(PyBytes_FromStringAndSize(data.c_str(), data.size())));
+  }
+
+  /**
+   * Check if a msgpack object is the header of a file of row groups
+   */
+  bool is_msgpack_row_group_header(const msgpack::object &o) {
+    if (o.type != msgpack::type::ARRAY || o.via.array.size != 3) {
+      return false;
+    }
+    const msgpack::object &version = o.via.array.ptr[1];
+    return version.type == msgpack::type::POSITIVE_INTEGER
+           && version.as<std::size_t>() == 2;
+  }
+
+  /**
+   * The location and statistics of a row group
+   */
+  struct msgpack_row_group {
+    std::size_t offset;
+    std::size_t nbytes;
+    std::size_t nrows;
+    boost::python::object frames;
+    boost::python::object panels;
+  };
+
+  /**
+   * Convert a [first, last] msgpack array or nil to a python tuple or None
+   */
+  template <typename T>
+  boost::python::object msgpack_range_to_python(const msgpack::object &o) {
+    if (o.type == msgpack::type::NIL) {
+      return boost::python::object();
+    }
+    DIALS_ASSERT(o.type == msgpack::type::ARRAY && o.via.array.size == 2);
+    return boost::python::make_tuple(o.via.array.ptr[0].as<T>(),
+                                     o.via.array.ptr[1].as<T>());
+  }
+
+  /**
+   * Find the row groups following the header of a file of row groups, only
+   * decoding the small array before each group.
+   * @param data The packed data
+   * @param size The size of the packed data
+   * @param off The offset of the first group
+   * @returns The row groups
+   */
+  std::vector<msgpack_row_group> find_msgpack_row_groups(const char *data,
+                                                         std::size_t size,
+                                                         std::size_t off) {
+    std::vector<msgpack_row_group> groups;
+    while (off < size) {
+      msgpack::unpacked result;
+      msgpack::unpack(result, data, size, off, reflection_table_reference_func);
+      const msgpack::object &o = result.get();
+      if (o.type != msgpack::type::ARRAY || o.via.array.size != 4) {
+        throw DIALS_ERROR("dials::af::reflection_table: bad row group");
+      }
+      msgpack_row_group group;
+      group.offset = off;
+      group.nrows = o.via.array.ptr[0].as<std::size_t>();
+      group.nbytes = o.via.array.ptr[1].as<std::size_t>();
+      group.frames = msgpack_range_to_python<int>(o.via.array.ptr[2]);
+      group.panels = msgpack_range_to_python<std::size_t>(o.via.array.ptr[3]);
+      if (group.nbytes > size - off) {
+        throw DIALS_ERROR("dials::af::reflection_table: truncated row group");
+      }
+      off += group.nbytes;
+      groups.push_back(group);
+    }
+    return groups;
+  }
+
+  /**
+   * List the row groups of a reflection file in msgpack format
+   * @param packed The msgpack data
+   * @returns A list of (offset, nbytes, nrows, frames, panels) tuples, or None
+   * if the data is a single table rather than a file of row groups
+   */
+  boost::python::object reflection_table_msgpack_row_groups(
+    boost::python::object packed) {
+    buffer_view view(packed);
+    msgpack::unpacked result;
+    std::size_t off = 0;
+    msgpack::unpack(
+      result, view.data(), view.size(), off, reflection_table_reference_func);
+    if (!is_msgpack_row_group_header(result.get())) {
+      return boost::python::object();
+    }
+    std::vector<msgpack_row_group> groups =
+      find_msgpack_row_groups(view.data(), view.size(), off);
+    boost::python::list info;
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+      info.append(boost::python::make_tuple(groups[i].offset,
+                                            groups[i].nbytes,
+                                            groups[i].nrows,
+                                            groups[i].frames,
+                                            groups[i].panels));
+    }
+    return info;
+  }
+
+  /**
+   * Unpack the reflection table from msgpack format. The packed data can be
+   * any object supporting the buffer protocol, such as bytes or a memory
+   * mapped file. The columns reference the packed data while it is unpacked,
+   * and only the requested columns are copied into the table, so unpacking
+   * some columns of a memory mapped file only reads the pages they are in.
+   * @param packed The msgpack data
+   * @param columns The names of the columns to read, or None for all
    * @returns The reflection table
    */
-  reflection_table reflection_table_from_msgpack(boost::python::object packed) {
-    const char *data = PyBytes_AsString(packed.ptr());
-    std::size_t size = PyBytes_Size(packed.ptr());
+  reflection_table reflection_table_from_msgpack(boost::python::object packed,
+                                                 boost::python::object columns) {
+    std::set<std::string> column_set;
+    if (!columns.is_none()) {
+      for (std::size_t i = 0; i < boost::python::len(columns); ++i) {
+        column_set.insert(boost::python::extract<std::string>(columns[i])());
+      }
+    }
+    buffer_view view(packed);
     msgpack::unpacked result;
     std::size_t off = 0;
-    msgpack::unpack(result, data, size, off, reflection_table_reference_func);
-    reflection_table r = result.get().as<reflection_table>();
+    msgpack::unpack(
+      result, view.data(), view.size(), off, reflection_table_reference_func);
+    const std::set<std::string> *selected = columns.is_none() ? NULL : &column_set;
+    reflection_table r;
+    if (!is_msgpack_row_group_header(result.get())) {
+      msgpack::adaptor::convert<reflection_table>::read(result.get(), r, selected);
+      return r;
+    }
+
+    // Concatenate the row groups
+    std::vector<msgpack_row_group> groups =
+      find_msgpack_row_groups(view.data(), view.size(), off);
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+      msgpack::unpacked group_result;
+      std::size_t group_off = 0;
+      msgpack::unpack(group_result,
+                      view.data() + groups[i].offset,
+                      groups[i].nbytes,
+                      group_off,
+                      reflection_table_reference_func);
+      reflection_table group;
+      msgpack::adaptor::convert<reflection_table>::read(
+        group_result.get(), group, selected);
+      if (i == 0) {
+        r = group;
+      } else {
+        reflection_table_extend(r, group);
+      }
+    }
     return r;
   }
 
+  /**
+   * List the columns of a reflection table in msgpack format without reading
+   * their data. For a file of row groups these are the columns of the first
+   * group.
+   * @param packed The msgpack data
+   * @returns A list of (name, type) tuples of the columns
+   */
+  boost::python::list reflection_table_msgpack_columns(boost::python::object packed) {
+    buffer_view view(packed);
+    msgpack::unpacked result;
+    std::size_t off = 0;
+    msgpack::unpack(
+      result, view.data(), view.size(), off, reflection_table_reference_func);
+    boost::python::list columns;
+    if (is_msgpack_row_group_header(result.get())) {
+      std::vector<msgpack_row_group> groups =
+        find_msgpack_row_groups(view.data(), view.size(), off);
+      if (groups.empty()) {
+        return columns;
+      }
+      off = 0;
+      msgpack::unpack(result,
+                      view.data() + groups[0].offset,
+                      groups[0].nbytes,
+                      off,
+                      reflection_table_reference_func);
+    }
+    const msgpack::object &o = result.get();
+    DIALS_ASSERT(o.type == msgpack::type::ARRAY && o.via.array.size == 3);
+    const msgpack::object &header = o.via.array.ptr[2];
+    DIALS_ASSERT(header.type == msgpack::type::MAP);
+    for (std::size_t i = 0; i < header.via.map.size; ++i) {
+      const msgpack::object_kv &item = header.via.map.ptr[i];
+      if (item.key.as<std::string>() != "data") {
+        continue;
+      }
+      DIALS_ASSERT(item.val.type == msgpack::type::MAP);
+      for (std::size_t j = 0; j < item.val.via.map.size; ++j) {
+        const msgpack::object_kv &column = item.val.via.map.ptr[j];
+        DIALS_ASSERT(column.val.type == msgpack::type::ARRAY
+                     && column.val.via.array.size == 2);
+        columns.append(
+          boost::python::make_tuple(column.key.as<std::string>(),
+                                    column.val.via.array.ptr[0].as<std::string>()));
+      }
+    }
+    return columns;
+  }
+
   /*
    * Class to pickle and unpickle the table
    */
@@ -999,11 +1529,29 @@ namespace dials { namespace af { namespace boost_python {
         .def("split_by_experiment_id", &split_by_experiment_id<flex_table_type>)
         .def("split_indices_by_experiment_id",
              &split_indices_by_experiment_id<flex_table_type>)
+        .def("sort_permutation",
+             &sort_permutation<flex_table_type>,
+             (arg("keys"), arg("reverse") = false, arg("nthreads") = 0))
         .def("compute_phi_range", &compute_phi_range<flex_table_type>)
-        .def("as_msgpack", &reflection_table_as_msgpack)
-        .def("as_msgpack_to_file", &reflection_table_as_msgpack_to_file)
-        .def("from_msgpack", &reflection_table_from_msgpack)
+        .def("as_msgpack",
+             &reflection_table_as_msgpack,
+             (arg("compression_level") = 0, arg("nthreads") = 1))
+        .def("as_msgpack_to_file",
+             &reflection_table_as_msgpack_to_file,
+             (arg("output"), arg("compression_level") = 0, arg("nthreads") = 1))
+        .def("from_msgpack",
+             &reflection_table_from_msgpack,
+             (arg("packed"), arg("columns") = boost::python::object()))
         .staticmethod("from_msgpack")
+        .def("msgpack_columns", &reflection_table_msgpack_columns)
+        .staticmethod("msgpack_columns")
+        .def("as_msgpack_row_group",
+             &reflection_table_as_msgpack_row_group,
+             (arg("compression_level") = 0, arg("nthreads") = 1))
+        .def("msgpack_row_group_header", &reflection_table_msgpack_row_group_header)
+        .staticmethod("msgpack_row_group_header")
+        .def("msgpack_row_groups", &reflection_table_msgpack_row_groups)
+        .staticmethod("msgpack_row_groups")
         .def("experiment_identifiers", &T::experiment_identifiers)
         .def("select", &reflection_table_select_rows_index<flex_table_type>)
         .def("select", &reflection_table_select_rows_flags<flex_table_type>)
@@ -21,6 +21,7 @@
 #include <dials/model/data/observation.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
 #include <dials/algorithms/spot_prediction/pixel_to_miller_index.h>
+#include <dials/algorithms/centroid/batch_centroid.h>
 #include <dials/config.h>
 
 namespace dials { namespace af { namespace boost_python {
@@ -31,9 +32,13 @@ namespace dials { namespace af { namespace boost_python {
   using af::int2;
   using af::int6;
   using af::small;
+  using dials::algorithms::BayesianIntegrator;
   using dials::algorithms::LabelImageStack;
   using dials::algorithms::LabelPixels;
   using dials::algorithms::PixelToMillerIndex;
+  using dials::algorithms::PosteriorMomentsTable;
+  using dials::algorithms::StreamingLabelImageStack;
+  using dials::algorithms::batch_centroid;
   using dials::model::Background;
   using dials::model::BackgroundUsed;
   using dials::model::Centroid;
@@ -42,6 +47,7 @@ namespace dials { namespace af { namespace boost_python {
   using dials::model::Observation;
   using dials::model::PixelListLabeller;
   using dials::model::Shoebox;
+  using dials::model::Strong;
   using dials::model::Valid;
   using dxtbx::model::BeamBase;
   using dxtbx::model::CrystalBase;
@@ -88,12 +94,11 @@ namespace dials { namespace af { namespace boost_python {
       DIALS_ASSERT(min_pixels > 0);
       DIALS_ASSERT(max_pixels > min_pixels);
 
-      // Get the stuff from the label struct
+      // Get the labels. The pixels are read from the compressed arrays of the
+      // labeller rather than expanded into arrays of coordinates and values.
+      typedef PixelListLabeller::Reader Reader;
       af::shared<int> labels = twod ? pixel.labels_2d() : pixel.labels_3d();
-      af::shared<double> values = pixel.values();
-      af::shared<vec3<int> > coords = pixel.coords();
-      DIALS_ASSERT(labels.size() == values.size());
-      DIALS_ASSERT(labels.size() == coords.size());
+      DIALS_ASSERT(labels.size() == pixel.num_pixels());
 
       // Get the number of labels and allocate the array
       std::size_t num = af::max(labels.const_ref()) + 1;
@@ -116,9 +121,9 @@ namespace dials { namespace af { namespace boost_python {
 
       // Set the shoeboxes
       std::vector<std::size_t> num_pixels(num);
-      for (std::size_t i = 0; i < labels.size(); ++i) {
-        int l = labels[i];
-        vec3<int> c = coords[i];
+      for (Reader reader(pixel); !reader.at_end(); reader.next()) {
+        int l = labels[reader.pixel()];
+        vec3<int> c = reader.coord();
         DIALS_ASSERT(l < num_pixels.size());
         DIALS_ASSERT(c[2] < xsize && c[2] >= 0);
         DIALS_ASSERT(c[1] < ysize && c[1] >= 0);
@@ -143,11 +148,11 @@ namespace dials { namespace af { namespace boost_python {
       }
 
       // Set all the mask and data points
-      for (std::size_t i = 0; i < labels.size(); ++i) {
-        int l = labels[i];
+      for (Reader reader(pixel); !reader.at_end(); reader.next()) {
+        int l = labels[reader.pixel()];
         if (result_[l].is_allocated()) {
-          FloatType v = values[i];
-          vec3<int> c = coords[i];
+          FloatType v = reader.value();
+          vec3<int> c = reader.coord();
           int ii = c[2] - result_[l].bbox[0];
           int jj = c[1] - result_[l].bbox[2];
           int kk = c[0] - result_[l].bbox[4];
@@ -166,8 +171,8 @@ namespace dials { namespace af { namespace boost_python {
         int last_frame = minmaxz[1];
         af::versa<int, af::c_grid<2> > hot_mask(af::c_grid<2>(ysize, xsize),
                                                 first_frame - 1);
-        for (std::size_t i = 0; i < coords.size(); ++i) {
-          vec3<int> c = coords[i];
+        for (Reader reader(pixel); !reader.at_end(); reader.next()) {
+          vec3<int> c = reader.coord();
           if (c[0] == first_frame) {
             hot_mask(c[1], c[2]) = c[0];
           } else {
@@ -355,6 +360,86 @@ namespace dials { namespace af { namespace boost_python {
       typename af::flex<Shoebox<FloatType> >::type(result, af::flex_grid<>(num));
   }
 
+  /**
+   * Construct an array of shoeboxes from the components finished so far by a
+   * streaming labeller. The labeller is not modified; call its clear method
+   * once the shoeboxes have been created.
+   */
+  template <typename FloatType>
+  typename af::flex<Shoebox<FloatType> >::type *from_streaming_labels(
+    const StreamingLabelImageStack &label,
+    std::size_t panel,
+    std::size_t zstart) {
+    // Get the stuff from the label struct
+    af::shared<int> labels = label.labels();
+    af::shared<double> values = label.values();
+    af::shared<vec3<int> > coords = label.coords();
+    if (labels.size() == 0) {
+      return new typename af::flex<Shoebox<FloatType> >::type();
+    }
+
+    // Labels are unique over the whole stack so offset them to start at zero
+    int first = af::min(labels.const_ref());
+    std::size_t num = af::max(labels.const_ref()) - first + 1;
+    af::shared<Shoebox<FloatType> > result(num, Shoebox<FloatType>());
+
+    // Initialise the bboxes
+    int xsize = label.size()[1];
+    int ysize = label.size()[0];
+    int zsize = label.num_images();
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      result[i].panel = panel;
+      result[i].bbox[0] = xsize;
+      result[i].bbox[1] = 0;
+      result[i].bbox[2] = ysize;
+      result[i].bbox[3] = 0;
+      result[i].bbox[4] = zsize;
+      result[i].bbox[5] = 0;
+    }
+
+    // Set the shoeboxes
+    for (std::size_t i = 0; i < labels.size(); ++i) {
+      int l = labels[i] - first;
+      vec3<int> c = coords[i];
+      if (c[2] < result[l].bbox[0]) result[l].bbox[0] = c[2];
+      if (c[2] >= result[l].bbox[1]) result[l].bbox[1] = c[2] + 1;
+      if (c[1] < result[l].bbox[2]) result[l].bbox[2] = c[1];
+      if (c[1] >= result[l].bbox[3]) result[l].bbox[3] = c[1] + 1;
+      if (c[0] < result[l].bbox[4]) result[l].bbox[4] = c[0];
+      if (c[0] >= result[l].bbox[5]) result[l].bbox[5] = c[0] + 1;
+    }
+
+    // Allocate all the arrays
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      result[i].allocate();
+    }
+
+    // Set all the mask and data points
+    for (std::size_t i = 0; i < labels.size(); ++i) {
+      int l = labels[i] - first;
+      vec3<int> c = coords[i];
+      int ii = c[2] - result[l].bbox[0];
+      int jj = c[1] - result[l].bbox[2];
+      int kk = c[0] - result[l].bbox[4];
+      DIALS_ASSERT(ii >= 0 && jj >= 0 && kk >= 0);
+      DIALS_ASSERT(ii < result[l].xsize());
+      DIALS_ASSERT(jj < result[l].ysize());
+      DIALS_ASSERT(kk < result[l].zsize());
+      result[l].data(kk, jj, ii) = (FloatType)values[i];
+      result[l].mask(kk, jj, ii) = Valid | Foreground;
+    }
+
+    // Shift bbox z start position
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      result[i].bbox[4] += zstart;
+      result[i].bbox[5] += zstart;
+    }
+
+    // Return the array
+    return new
+      typename af::flex<Shoebox<FloatType> >::type(result, af::flex_grid<>(num));
+  }
+
   /**
    * Allocate the shoeboxes
    */
@@ -502,52 +587,44 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_masked(const const_ref<Shoebox<FloatType> > &a,
-                                       int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked(code);
-    }
-    return result;
+  af::shared<Centroid> centroid_masked(
+    const const_ref<Shoebox<FloatType> > &a,
+    int code,
+    std::size_t nthreads) {
+    return batch_centroid(a, code, false, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_valid(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid();
-    }
-    return result;
+  af::shared<Centroid> centroid_valid(
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid, false, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_foreground(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground();
-    }
-    return result;
+  af::shared<Centroid> centroid_foreground(
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid | Foreground, false, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_strong(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong();
-    }
-    return result;
+  af::shared<Centroid> centroid_strong(
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid | Strong, false, nthreads);
   }
 
   /**
@@ -564,67 +641,70 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_masked_minus_background(
     const const_ref<Shoebox<FloatType> > &a,
-    int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked_minus_background(code);
-    }
-    return result;
+    int code,
+    std::size_t nthreads) {
+    return batch_centroid(a, code, true, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_valid_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid, true, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_foreground_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid | Foreground, true, nthreads);
   }
 
   /**
-   * Get a list of centroid
+   * Get a list of centroid. The shoeboxes are split between the threads.
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_strong_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return batch_centroid(a, Valid | Strong, true, nthreads);
   }
 
   /**
-   * Get a list of intensities
+   * Sum the pixels of a range of shoeboxes
    */
   template <typename FloatType>
-  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Intensity> result(a.size(), Intensity());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].summed_intensity();
+  struct SummedIntensityJob {
+    const const_ref<Shoebox<FloatType> > *shoeboxes;
+    Intensity *result;
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        result[i] = (*shoeboxes)[i].summed_intensity();
+      }
     }
+  };
+
+  /**
+   * Get a list of intensities, splitting the shoeboxes between threads
+   */
+  template <typename FloatType>
+  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a,
+                                         std::size_t nthreads) {
+    af::shared<Intensity> result(a.size(), Intensity());
+    SummedIntensityJob<FloatType> job = {&a, result.begin()};
+    dials::util::parallel_for(a.size(), nthreads, job);
     return result;
   }
 
@@ -640,6 +720,46 @@ namespace dials { namespace af { namespace boost_python {
     return result;
   }
 
+  /**
+   * Integrate a range of shoeboxes with a table of posterior moments
+   */
+  template <typename FloatType>
+  struct BayesianIntensityJob {
+    const const_ref<Shoebox<FloatType> > *shoeboxes;
+    const PosteriorMomentsTable *table;
+    Intensity *result;
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        const Shoebox<FloatType> &s = (*shoeboxes)[i];
+        BayesianIntegrator<FloatType> integrator(s.data.const_ref().as_1d(),
+                                                 s.background.const_ref().as_1d(),
+                                                 s.mask.const_ref().as_1d(),
+                                                 *table);
+        result[i].observed.value = integrator.intensity();
+        result[i].observed.variance = integrator.variance();
+        result[i].background.value = integrator.background();
+        result[i].background.variance = integrator.background_variance();
+        result[i].observed.success = integrator.success();
+      }
+    }
+  };
+
+  /**
+   * Get a list of intensities, taking the posterior moments from a table
+   * and splitting the shoeboxes between threads
+   */
+  template <typename FloatType>
+  af::shared<Intensity> bayesian_intensity_with_table(
+    const const_ref<Shoebox<FloatType> > &a,
+    const PosteriorMomentsTable &table,
+    std::size_t nthreads) {
+    af::shared<Intensity> result(a.size(), Intensity());
+    BayesianIntensityJob<FloatType> job = {&a, &table, result.begin()};
+    dials::util::parallel_for(a.size(), nthreads, job);
+    return result;
+  }
+
   /**
    * Get the mean background.
    */
@@ -1006,6 +1126,12 @@ namespace dials { namespace af { namespace boost_python {
                from_pixel_labeller<FloatType>,
                default_call_policies(),
                (boost::python::arg("labels"), boost::python::arg("panel") = 0)))
+        .def("__init__",
+             make_constructor(from_streaming_labels<FloatType>,
+                              default_call_policies(),
+                              (boost::python::arg("labels"),
+                               boost::python::arg("panel") = 0,
+                               boost::python::arg("zstart") = 0)))
         .def("__init__",
              make_constructor(from_panel_and_bbox<FloatType>,
                               default_call_policies(),
@@ -1029,21 +1155,38 @@ namespace dials { namespace af { namespace boost_python {
              (boost::python::arg("mask")))
         .def("peak_coordinates", &peak_coordinates<FloatType>)
         .def("centroid_all", &centroid_all<FloatType>)
-        .def("centroid_masked", &centroid_masked<FloatType>)
-        .def("centroid_valid", &centroid_valid<FloatType>)
-        .def("centroid_foreground", &centroid_foreground<FloatType>)
-        .def("centroid_strong", &centroid_strong<FloatType>)
+        .def("centroid_masked",
+             &centroid_masked<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_valid",
+             &centroid_valid<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_foreground",
+             &centroid_foreground<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_strong",
+             &centroid_strong<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_all_minus_background", &centroid_all_minus_background<FloatType>)
         .def("centroid_masked_minus_background",
-             &centroid_masked_minus_background<FloatType>)
+             &centroid_masked_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_valid_minus_background",
-             &centroid_valid_minus_background<FloatType>)
+             &centroid_valid_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_foreground_minus_background",
-             &centroid_foreground_minus_background<FloatType>)
+             &centroid_foreground_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_strong_minus_background",
-             &centroid_strong_minus_background<FloatType>)
+             &centroid_strong_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("bayesian_intensity", &bayesian_intensity<FloatType>)
-        .def("summed_intensity", &summed_intensity<FloatType>)
+        .def("bayesian_intensity",
+             &bayesian_intensity_with_table<FloatType>,
+             (boost::python::arg("table"), boost::python::arg("nthreads") = 1))
+        .def("summed_intensity",
+             &summed_intensity<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("mean_background", &mean_background<FloatType>)
         .def("mean_modelled_background", &mean_modelled_background<FloatType>)
         .def("flatten", &flatten<FloatType>)
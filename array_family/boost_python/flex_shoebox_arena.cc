@@ -0,0 +1,147 @@
+/*
+ * flex_shoebox_arena.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/model/data/shoebox_arena.h>
+#include <dials/algorithms/centroid/batch_centroid.h>
+#include <dials/config.h>
+
+namespace dials { namespace af { namespace boost_python {
+
+  using namespace boost::python;
+
+  using dials::algorithms::batch_centroid;
+  using dials::model::Centroid;
+  using dials::model::Shoebox;
+  using dials::model::ShoeboxArena;
+
+  /**
+   * Pickle the arena as its arrays
+   */
+  template <typename FloatType>
+  struct shoebox_arena_pickle_suite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const ShoeboxArena<FloatType> &self) {
+      return boost::python::make_tuple(self.panels(),
+                                       self.bounding_boxes(),
+                                       self.flat(),
+                                       self.offsets(),
+                                       self.data(),
+                                       self.mask(),
+                                       self.background());
+    }
+  };
+
+  template <typename FloatType>
+  ShoeboxArena<FloatType> *make_from_shoeboxes(
+    const af::const_ref<Shoebox<FloatType> > &shoeboxes) {
+    return new ShoeboxArena<FloatType>(shoeboxes);
+  }
+
+  template <typename FloatType>
+  af::shared<FloatType> get_data(const ShoeboxArena<FloatType> &self) {
+    return self.data();
+  }
+
+  template <typename FloatType>
+  af::shared<int> get_mask(const ShoeboxArena<FloatType> &self) {
+    return self.mask();
+  }
+
+  template <typename FloatType>
+  af::shared<FloatType> get_background(const ShoeboxArena<FloatType> &self) {
+    return self.background();
+  }
+
+  template <typename FloatType>
+  Shoebox<FloatType> getitem(const ShoeboxArena<FloatType> &self, long index) {
+    if (index < 0) {
+      index += self.size();
+    }
+    if (index < 0 || index >= (long)self.size()) {
+      PyErr_SetString(PyExc_IndexError, "Index out of range");
+      boost::python::throw_error_already_set();
+    }
+    return self.shoebox(index);
+  }
+
+  template <typename FloatType>
+  af::shared<Centroid> centroid_masked(const ShoeboxArena<FloatType> &self,
+                                       int code,
+                                       std::size_t nthreads) {
+    return batch_centroid(self, code, false, nthreads);
+  }
+
+  template <typename FloatType>
+  af::shared<Centroid> centroid_masked_minus_background(
+    const ShoeboxArena<FloatType> &self,
+    int code,
+    std::size_t nthreads) {
+    return batch_centroid(self, code, true, nthreads);
+  }
+
+  template <typename FloatType>
+  void shoebox_arena_wrapper(const char *name) {
+    typedef ShoeboxArena<FloatType> arena_type;
+
+    class_<arena_type>(name)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<int6> &,
+                bool,
+                bool>((arg("panel"),
+                       arg("bbox"),
+                       arg("allocate") = false,
+                       arg("flatten") = false)))
+      .def(init<const af::shared<std::size_t> &,
+                const af::shared<int6> &,
+                const af::shared<bool> &,
+                const af::shared<std::size_t> &,
+                const af::shared<FloatType> &,
+                const af::shared<int> &,
+                const af::shared<FloatType> &>((arg("panel"),
+                                                 arg("bbox"),
+                                                 arg("flat"),
+                                                 arg("offset"),
+                                                 arg("data"),
+                                                 arg("mask"),
+                                                 arg("background"))))
+      .def("from_shoeboxes",
+           &make_from_shoeboxes<FloatType>,
+           return_value_policy<manage_new_object>())
+      .staticmethod("from_shoeboxes")
+      .def("__len__", &arena_type::size)
+      .def("__getitem__", &getitem<FloatType>)
+      .def("size", &arena_type::size)
+      .def("panels", &arena_type::panels)
+      .def("bounding_boxes", &arena_type::bounding_boxes)
+      .def("flat", &arena_type::flat)
+      .def("offsets", &arena_type::offsets)
+      .def("data", &get_data<FloatType>)
+      .def("mask", &get_mask<FloatType>)
+      .def("background", &get_background<FloatType>)
+      .def("npixels", &arena_type::npixels)
+      .def("is_allocated", &arena_type::is_allocated)
+      .def("shoeboxes", &arena_type::shoeboxes)
+      .def("count_mask_values", &arena_type::count_mask_values)
+      .def("summed_intensity",
+           &arena_type::summed_intensity,
+           (arg("nthreads") = 1))
+      .def("centroid_masked",
+           &centroid_masked<FloatType>,
+           (arg("code"), arg("nthreads") = 1))
+      .def("centroid_masked_minus_background",
+           &centroid_masked_minus_background<FloatType>,
+           (arg("code"), arg("nthreads") = 1))
+      .def_pickle(shoebox_arena_pickle_suite<FloatType>());
+  }
+
+  void export_flex_shoebox_arena() {
+    shoebox_arena_wrapper<ProfileFloatType>("shoebox_arena");
+  }
+
+}}}  // namespace dials::af::boost_python
@@ -18,11 +18,18 @@ namespace dials { namespace af { namespace boost_python {
 
   void export_flex_shoebox_extractor() {
     class_<ShoeboxExtractor>("ShoeboxExtractor", no_init)
-      .def(init<af::reflection_table, std::size_t, int, int>(
+      .def(init<af::reflection_table, std::size_t, int, int, std::size_t>(
         (boost::python::arg("data"),
          boost::python::arg("npanels"),
          boost::python::arg("frame0"),
-         boost::python::arg("frame1"))))
+         boost::python::arg("frame1"),
+         boost::python::arg("nthreads") = 1)))
+      .def(init<ShoeboxArena<>, std::size_t, int, int, std::size_t>(
+        (boost::python::arg("shoeboxes"),
+         boost::python::arg("npanels"),
+         boost::python::arg("frame0"),
+         boost::python::arg("frame1"),
+         boost::python::arg("nthreads") = 1)))
       .def("next", &ShoeboxExtractor::next<int>)
       .def("next", &ShoeboxExtractor::next<float>)
       .def("next", &ShoeboxExtractor::next<double>)
@@ -31,6 +38,7 @@ namespace dials { namespace af { namespace boost_python {
       .def("frame1", &ShoeboxExtractor::frame1)
       .def("frame", &ShoeboxExtractor::frame)
       .def("nframes", &ShoeboxExtractor::nframes)
+      .def("nthreads", &ShoeboxExtractor::nthreads)
       .def("npanals", &ShoeboxExtractor::npanels);
   }
 
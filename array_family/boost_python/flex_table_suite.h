@@ -12,22 +12,28 @@
 #ifndef DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 #define DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 
+#include <algorithm>
+#include <map>
 #include <string>
 #include <iterator>
 #include <iostream>
 #include <sstream>
 #include <set>
+#include <vector>
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <boost/python/slice.hpp>
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
 #include <boost/mpl/for_each.hpp>
+#include <boost/thread.hpp>
+#include <boost/type_traits/has_trivial_assign.hpp>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/array_family/boost_python/ref_pickle_double_buffered.h>
 #include <scitbx/boost_python/slice.h>
 #include <scitbx/boost_python/utils.h>
 #include <dials/array_family/flex_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 #include <dxtbx/model/experiment.h>
 #include <dxtbx/model/experiment_list.h>
@@ -75,31 +81,6 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     }
   };
 
-  /**
-   * A visitor to append column data from 1 table to another
-   */
-  template <typename T>
-  struct extend_column_visitor : public boost::static_visitor<void> {
-    T &self;
-    typename T::key_type key;
-    typename T::size_type na, nb;
-
-    extend_column_visitor(T &self_,
-                          typename T::key_type key_,
-                          typename T::size_type na_,
-                          typename T::size_type nb_)
-        : self(self_), key(key_), na(na_), nb(nb_) {}
-
-    template <typename U>
-    void operator()(const U &other_column) {
-      U self_column = self[key];
-      DIALS_ASSERT(na + nb == self_column.size());
-      for (typename T::size_type i = 0; i < nb; ++i) {
-        self_column[na + i] = other_column[i];
-      }
-    }
-  };
-
   /**
    * A visitor to add new columns (and over-write old columns) in the table.
    */
@@ -196,6 +177,173 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     }
   };
 
+  /**
+   * The number of threads to use for an operation on a number of rows. Small
+   * tables are processed on the calling thread, and larger ones on up to 8
+   * threads since the copies are limited by memory bandwidth.
+   */
+  inline std::size_t default_num_threads(std::size_t nrows) {
+    if (nrows < (1 << 16)) {
+      return 1;
+    }
+    return std::max(1u, std::min(8u, boost::thread::hardware_concurrency()));
+  }
+
+  /**
+   * Copy blocks of rows output[i] = input[index[i]]
+   */
+  template <typename U>
+  struct gather_rows_job {
+    const U *input;
+    U *output;
+    const std::size_t *index;
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        output[i] = input[index[i]];
+      }
+    }
+  };
+
+  /**
+   * Copy the rows output[i] = input[index[i]]. Elements which are assigned by
+   * a plain copy are copied in parallel. Others, such as shoeboxes which
+   * share reference counted arrays, are copied on one thread.
+   * @param input The input rows
+   * @param output The output rows
+   * @param index The index of the input row of each output row
+   * @param nthreads The number of threads
+   */
+  template <typename U>
+  void gather_rows(const U *input,
+                   U *output,
+                   const af::const_ref<std::size_t> &index,
+                   std::size_t nthreads) {
+    if (!boost::has_trivial_assign<U>::value) {
+      nthreads = 1;
+    }
+    gather_rows_job<U> job = {input, output, index.begin()};
+    dials::util::parallel_for(index.size(), nthreads, job);
+  }
+
+  /**
+   * Copy blocks of rows output[i] = input[i]
+   */
+  template <typename U>
+  struct copy_rows_job {
+    const U *input;
+    U *output;
+
+    void operator()(std::size_t first, std::size_t last) const {
+      std::copy(input + first, input + last, output + first);
+    }
+  };
+
+  /**
+   * Copy blocks of rows from a list of inputs to consecutive ranges of the
+   * output. Inputs which are null leave their range of the output as it is.
+   */
+  template <typename U>
+  struct concatenate_rows_job {
+    const std::vector<const U *> *inputs;
+    const std::vector<std::size_t> *offsets;
+    U *output;
+
+    void operator()(std::size_t first, std::size_t last) const {
+      std::size_t k =
+        std::upper_bound(offsets->begin(), offsets->end(), first) - offsets->begin();
+      for (--k; first < last; ++k) {
+        std::size_t end = std::min(last, (*offsets)[k + 1]);
+        const U *input = (*inputs)[k];
+        if (input != NULL) {
+          std::copy(input + (first - (*offsets)[k]),
+                    input + (end - (*offsets)[k]),
+                    output + first);
+        }
+        first = end;
+      }
+    }
+  };
+
+  /**
+   * A visitor to append column data from 1 table to another
+   */
+  template <typename T>
+  struct extend_column_visitor : public boost::static_visitor<void> {
+    T &self;
+    typename T::key_type key;
+    typename T::size_type na, nb;
+    std::size_t nthreads;
+
+    extend_column_visitor(T &self_,
+                          typename T::key_type key_,
+                          typename T::size_type na_,
+                          typename T::size_type nb_,
+                          std::size_t nthreads_ = 1)
+        : self(self_), key(key_), na(na_), nb(nb_), nthreads(nthreads_) {}
+
+    template <typename U>
+    void operator()(const U &other_column) {
+      typedef typename U::value_type value_type;
+      U self_column = self[key];
+      DIALS_ASSERT(na + nb == self_column.size());
+      if (!boost::has_trivial_assign<value_type>::value) {
+        nthreads = 1;
+      }
+      copy_rows_job<value_type> job = {other_column.begin(),
+                                       self_column.begin() + na};
+      dials::util::parallel_for(nb, nthreads, job);
+    }
+  };
+
+  /**
+   * A visitor to fill a column of a table with the same column of a list of
+   * tables placed one after the other.
+   */
+  template <typename T>
+  struct concatenate_column_visitor : public boost::static_visitor<void> {
+    T &result;
+    typename T::key_type key;
+    const std::vector<T> &tables;
+    const std::vector<std::size_t> &offsets;
+    std::size_t nthreads;
+
+    concatenate_column_visitor(T &result_,
+                               typename T::key_type key_,
+                               const std::vector<T> &tables_,
+                               const std::vector<std::size_t> &offsets_,
+                               std::size_t nthreads_)
+        : result(result_),
+          key(key_),
+          tables(tables_),
+          offsets(offsets_),
+          nthreads(nthreads_) {}
+
+    template <typename U>
+    void operator()(const U &) {
+      typedef typename U::value_type value_type;
+      std::vector<const value_type *> inputs(tables.size(), NULL);
+      for (std::size_t k = 0; k < tables.size(); ++k) {
+        typename T::const_iterator it = tables[k].find(key);
+        if (it != tables[k].end()) {
+          const U *column = boost::get<U>(&it->second);
+          if (column == NULL) {
+            throw DIALS_ERROR("Column types do not match for column " + key);
+          }
+          inputs[k] = column->begin();
+        }
+      }
+      U result_column = result[key];
+      DIALS_ASSERT(result_column.size() == offsets.back());
+      if (!boost::has_trivial_assign<value_type>::value) {
+        nthreads = 1;
+      }
+      concatenate_rows_job<value_type> job = {
+        &inputs, &offsets, result_column.begin()};
+      dials::util::parallel_for(result_column.size(), nthreads, job);
+    }
+  };
+
   /**
    * Copy the selected rows from the input column to a output column.
    */
@@ -204,19 +352,19 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     T &result;
     typename T::key_type key;
     af::const_ref<std::size_t> index;
+    std::size_t nthreads;
 
     copy_from_indices_visitor(T &result_,
                               typename T::key_type key_,
-                              af::const_ref<std::size_t> index_)
-        : result(result_), key(key_), index(index_) {}
+                              af::const_ref<std::size_t> index_,
+                              std::size_t nthreads_ = 1)
+        : result(result_), key(key_), index(index_), nthreads(nthreads_) {}
 
     template <typename U>
     void operator()(const U &other_column) {
       U result_column = result[key];
       DIALS_ASSERT(result_column.size() == index.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        result_column[i] = other_column[index[i]];
-      }
+      gather_rows(other_column.begin(), result_column.begin(), index, nthreads);
     }
   };
 
@@ -277,16 +425,17 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
    */
   struct reorder_visitor : public boost::static_visitor<void> {
     af::const_ref<std::size_t> index;
+    std::size_t nthreads;
 
-    reorder_visitor(const af::const_ref<std::size_t> &index_) : index(index_) {}
+    reorder_visitor(const af::const_ref<std::size_t> &index_,
+                    std::size_t nthreads_ = 1)
+        : index(index_), nthreads(nthreads_) {}
 
     template <typename T>
     void operator()(T &column) {
-      std::vector<typename T::value_type> temp(column.begin(), column.end());
+      T temp(column.begin(), column.end());
       DIALS_ASSERT(index.size() == column.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        column[i] = temp[index[i]];
-      }
+      gather_rows(temp.begin(), column.begin(), index, nthreads);
     }
   };
 
@@ -589,15 +738,65 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     typedef typename T::const_iterator iterator;
     typename T::size_type ns = self.nrows();
     typename T::size_type no = other.nrows();
+    reserve_rows(self, ns + no);
     self.resize(ns + no);
+    std::size_t nthreads = default_num_threads(no);
     for (iterator it = other.begin(); it != other.end(); ++it) {
-      extend_column_visitor<T> visitor(self, it->first, ns, no);
+      extend_column_visitor<T> visitor(self, it->first, ns, no, nthreads);
       it->second.apply_visitor(visitor);
     }
     // now extend identifiers
     reflection_table_extend_identifiers(self, other);
   }
 
+  /**
+   * Make sure the columns of the table can hold a number of rows. When the
+   * columns need to grow their capacity is at least doubled, so that building
+   * a table by extending it many times copies each row a constant number of
+   * times on average.
+   * @param self The table
+   * @param n The number of rows
+   */
+  template <typename T>
+  void reserve_rows(T &self, typename T::size_type n) {
+    typename T::size_type capacity = self.capacity();
+    if (capacity < n) {
+      self.reserve(std::max(n, 2 * capacity));
+    }
+  }
+
+  /**
+   * Join a list of tables into a new table. The result is allocated once and
+   * each column is filled in parallel, which is much faster than extending a
+   * table with each of the tables in turn. Rows of tables which do not have a
+   * column get the default value in that column.
+   * @param tables The list of tables
+   * @returns The new table
+   */
+  template <typename T>
+  T concatenate(boost::python::object tables) {
+    typedef typename T::const_iterator iterator;
+    std::vector<T> items;
+    std::vector<std::size_t> offsets(1, 0);
+    for (std::size_t k = 0; k < len(tables); ++k) {
+      items.push_back(extract<T>(tables[k])());
+      offsets.push_back(offsets.back() + items.back().nrows());
+    }
+    T result(offsets.back());
+    std::size_t nthreads = default_num_threads(offsets.back());
+    for (std::size_t k = 0; k < items.size(); ++k) {
+      for (iterator it = items[k].begin(); it != items[k].end(); ++it) {
+        if (!result.contains(it->first)) {
+          concatenate_column_visitor<T> visitor(
+            result, it->first, items, offsets, nthreads);
+          it->second.apply_visitor(visitor);
+        }
+      }
+      reflection_table_extend_identifiers(result, items[k]);
+    }
+    return result;
+  }
+
   /**
    * Update the table with column data from another table. New columns are added
    * to the table and existing columns are over-written by columns from the
@@ -634,8 +833,9 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
 
     // Get the indices from the table
     T result(index.size());
+    std::size_t nthreads = default_num_threads(index.size());
     for (typename T::const_iterator it = self.begin(); it != self.end(); ++it) {
-      copy_from_indices_visitor<T> visitor(result, it->first, index);
+      copy_from_indices_visitor<T> visitor(result, it->first, index, nthreads);
       it->second.apply_visitor(visitor);
     }
 
@@ -709,21 +909,123 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     return select_cols_keys(self, keys_array.const_ref());
   }
 
+  /**
+   * Find the id value of an experiment identifier
+   * @param self The table
+   * @param identifier The experiment identifier
+   * @returns The id value, or -1 if the identifier is not in the table
+   */
   template <typename T>
-  T select_using_experiment(T &self, dxtbx::model::Experiment expt) {
+  int experiment_id_value(const T &self, const std::string &identifier) {
     typedef typename T::experiment_map_type::const_iterator const_iterator;
-
-    std::string identifier = expt.get_identifier();
-    int id_value = -1;
     for (const_iterator it = self.experiment_identifiers()->begin();
          it != self.experiment_identifiers()->end();
          ++it) {
       if (identifier == it->second) {
-        id_value = it->first;
-        break;
+        return it->first;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * Look up the position of an id value in a list of id values. Ids are
+   * looked up in a dense array when their range is small, as it is for the ids
+   * of experiments, otherwise in a map.
+   */
+  class id_lookup {
+  public:
+    id_lookup(const std::vector<int> &ids) : min_id_(0) {
+      if (ids.empty()) {
+        return;
+      }
+      int min_id = *std::min_element(ids.begin(), ids.end());
+      int max_id = *std::max_element(ids.begin(), ids.end());
+      if ((double)max_id - (double)min_id < (1 << 24)) {
+        min_id_ = min_id;
+        dense_.assign(max_id - min_id + 1, npos());
+        for (std::size_t i = ids.size(); i > 0; --i) {
+          dense_[ids[i - 1] - min_id] = i - 1;
+        }
+      } else {
+        for (std::size_t i = ids.size(); i > 0; --i) {
+          sparse_[ids[i - 1]] = i - 1;
+        }
+      }
+    }
+
+    static std::size_t npos() {
+      return std::size_t(-1);
+    }
+
+    /**
+     * @returns The first position of the id, or npos() if it is not there
+     */
+    std::size_t find(int id) const {
+      if (!dense_.empty()) {
+        double offset = (double)id - (double)min_id_;
+        if (offset < 0 || offset >= dense_.size()) {
+          return npos();
+        }
+        return dense_[id - min_id_];
       }
+      std::map<int, std::size_t>::const_iterator it = sparse_.find(id);
+      return it == sparse_.end() ? npos() : it->second;
     }
 
+  private:
+    int min_id_;
+    std::vector<std::size_t> dense_;
+    std::map<int, std::size_t> sparse_;
+  };
+
+  /**
+   * Find the rows with each of a list of id values in a single pass over the
+   * id column, by partitioning the rows by id.
+   * @param id The id column
+   * @param ids The id values
+   * @returns The rows with each id value in turn, in the order of the table
+   */
+  inline af::shared<std::size_t> rows_with_ids(const af::const_ref<int> &id,
+                                               const std::vector<int> &ids) {
+    id_lookup lookup(ids);
+    std::vector<std::size_t> slot(id.size());
+    std::vector<std::size_t> count(ids.size() + 1, 0);
+    for (std::size_t i = 0; i < id.size(); ++i) {
+      slot[i] = lookup.find(id[i]);
+      if (slot[i] != id_lookup::npos()) {
+        count[slot[i] + 1]++;
+      }
+    }
+    std::vector<std::size_t> offset(count.size(), 0);
+    for (std::size_t k = 1; k < count.size(); ++k) {
+      offset[k] = offset[k - 1] + count[k];
+    }
+    std::vector<std::size_t> partition(offset.back());
+    std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+    for (std::size_t i = 0; i < id.size(); ++i) {
+      if (slot[i] != id_lookup::npos()) {
+        partition[next[slot[i]]++] = i;
+      }
+    }
+
+    // Ids which are repeated were only given a slot the first time
+    af::shared<std::size_t> result;
+    if (partition.empty()) {
+      return result;
+    }
+    result.reserve(partition.size());
+    for (std::size_t k = 0; k < ids.size(); ++k) {
+      std::size_t j = lookup.find(ids[k]);
+      result.insert(
+        result.end(), &partition[0] + offset[j], &partition[0] + offset[j + 1]);
+    }
+    return result;
+  }
+
+  template <typename T>
+  T select_using_experiment(T &self, dxtbx::model::Experiment expt) {
+    int id_value = experiment_id_value(self, expt.get_identifier());
     T result;
     if (self.contains("id") && id_value != -1) {
       af::shared<int> col1 = self["id"];
@@ -741,39 +1043,50 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     return result;
   }
 
+  /**
+   * Select the rows of a list of experiments. The rows of each experiment
+   * are found with a single pass over the id column and copied in one go,
+   * rather than each experiment being selected and appended in turn.
+   * @param self The table
+   * @param expts The experiments
+   * @returns The rows of each experiment in turn
+   */
   template <typename T>
   T select_using_experiments(T &self, dxtbx::model::ExperimentList expts) {
-    typedef typename T::experiment_map_type::const_iterator const_iterator;
     typedef dxtbx::model::ExperimentList::shared_type::const_iterator
       expt_const_iterator;
-    T result;
-    for (expt_const_iterator expt = expts.begin(); expt != expts.end(); ++expt) {
-      std::string identifier = expt->get_identifier();
-      int id_value = -1;
-      for (const_iterator it = self.experiment_identifiers()->begin();
-           it != self.experiment_identifiers()->end();
-           ++it) {
-        if (identifier == it->second) {
-          id_value = it->first;
-          break;
-        }
-      }
-
-      if (self.contains("id") && id_value != -1) {
-        af::shared<int> col1 = self["id"];
-        af::shared<std::size_t> sel;
-        for (int i = 0; i < col1.size(); ++i) {
-          if (col1[i] == id_value) {
-            sel.push_back(i);
-          }
+    std::vector<int> ids;
+    if (self.contains("id")) {
+      for (expt_const_iterator expt = expts.begin(); expt != expts.end(); ++expt) {
+        int id_value = experiment_id_value(self, expt->get_identifier());
+        if (id_value != -1) {
+          ids.push_back(id_value);
         }
-        af::const_ref<std::size_t> idx = sel.const_ref();
-
-        T sel_refl = select_rows_index(self, idx);
-        extend(result, sel_refl);
       }
     }
+    if (ids.empty()) {
+      return T();
+    }
+    af::shared<int> id = self["id"];
+    af::shared<std::size_t> rows = rows_with_ids(id.const_ref(), ids);
+    return select_rows_index(self, rows.const_ref());
+  }
 
+  /**
+   * Find the rows with any of a list of id values
+   * @param self The table
+   * @param ids The id values
+   * @returns A mask which is true for rows with one of the ids
+   */
+  template <typename T>
+  af::shared<bool> id_mask(T &self, const af::const_ref<int> &ids) {
+    DIALS_ASSERT(self.contains("id"));
+    af::const_ref<int> id = self["id"];
+    id_lookup lookup(std::vector<int>(ids.begin(), ids.end()));
+    af::shared<bool> result(id.size());
+    for (std::size_t i = 0; i < id.size(); ++i) {
+      result[i] = lookup.find(id[i]) != id_lookup::npos();
+    }
     return result;
   }
 
@@ -953,7 +1266,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   void reorder(T &self, const af::const_ref<std::size_t> &index) {
     typedef typename T::iterator iterator;
     DIALS_ASSERT(self.is_consistent());
-    reorder_visitor visitor(index);
+    reorder_visitor visitor(index, default_num_threads(index.size()));
     for (iterator it = self.begin(); it != self.end(); ++it) {
       it->second.apply_visitor(visitor);
     }
@@ -1271,6 +1584,10 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("append", &append<flex_table_type>)
         .def("insert", &insert<flex_table_type>)
         .def("extend", &extend<flex_table_type>)
+        .def("concatenate", &concatenate<flex_table_type>)
+        .staticmethod("concatenate")
+        .def("reserve", &flex_table_type::reserve)
+        .def("capacity", &flex_table_type::capacity)
         .def("update", &update<flex_table_type>)
         .def("nrows", &flex_table_type::nrows)
         .def("ncols", &flex_table_type::ncols)
@@ -1297,6 +1614,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("select", &select_cols_tuple<flex_table_type>)
         .def("select", &select_using_experiment<flex_table_type>)
         .def("select", &select_using_experiments<flex_table_type>)
+        .def("id_mask", &id_mask<flex_table_type>)
         .def("set_selected", &set_selected_rows_index<flex_table_type>)
         .def("set_selected", &set_selected_rows_flags<flex_table_type>)
         .def("set_selected", &set_selected_cols_keys<flex_table_type>)
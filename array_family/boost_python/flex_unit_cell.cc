@@ -12,32 +12,161 @@
 #include <scitbx/array_family/boost_python/flex_helpers.h>
 #include <cctbx/uctbx.h>
 #include <cctbx/miller.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace af { namespace boost_python {
 
   using cctbx::uctbx::unit_cell;
 
-  scitbx::af::shared<double> d(
+  /**
+   * Compute a resolution quantity of a range of miller indices, each with the
+   * unit cell of its experiment
+   */
+  template <typename IndexType>
+  class ResolutionJob {
+  public:
+    enum Quantity { D, D_STAR_SQ, TWO_THETA };
+
+    ResolutionJob(Quantity quantity,
+                  const scitbx::af::const_ref<unit_cell> &cells,
+                  const scitbx::af::const_ref<cctbx::miller::index<> > &hkl,
+                  const scitbx::af::const_ref<IndexType> &index,
+                  const scitbx::af::const_ref<double> &wavelength,
+                  bool deg,
+                  scitbx::af::ref<double> result)
+        : quantity_(quantity),
+          cells_(cells),
+          hkl_(hkl),
+          index_(index),
+          wavelength_(wavelength),
+          deg_(deg),
+          result_(result) {}
+
+    void operator()(std::size_t first, std::size_t last) const {
+      for (std::size_t i = first; i < last; ++i) {
+        const unit_cell &cell = cells_[index_[i]];
+        if (quantity_ == D) {
+          result_[i] = cell.d(hkl_[i]);
+        } else if (quantity_ == D_STAR_SQ) {
+          result_[i] = cell.d_star_sq(hkl_[i]);
+        } else {
+          result_[i] = cell.two_theta(hkl_[i], wavelength_[index_[i]], deg_);
+        }
+      }
+    }
+
+  private:
+    Quantity quantity_;
+    scitbx::af::const_ref<unit_cell> cells_;
+    scitbx::af::const_ref<cctbx::miller::index<> > hkl_;
+    scitbx::af::const_ref<IndexType> index_;
+    scitbx::af::const_ref<double> wavelength_;
+    bool deg_;
+    scitbx::af::ref<double> result_;
+  };
+
+  /**
+   * Compute a resolution quantity of each miller index, with the unit cell
+   * given by the experiment index of the reflection. The reflections are
+   * split between threads.
+   */
+  template <typename IndexType>
+  scitbx::af::shared<double> resolution(
+    typename ResolutionJob<IndexType>::Quantity quantity,
     const scitbx::af::const_ref<unit_cell> &self,
     const scitbx::af::const_ref<cctbx::miller::index<> > &hkl,
-    const scitbx::af::const_ref<std::size_t> index) {
+    const scitbx::af::const_ref<IndexType> &index,
+    const scitbx::af::const_ref<double> &wavelength,
+    bool deg,
+    std::size_t nthreads) {
     DIALS_ASSERT(index.size() == hkl.size());
-    scitbx::af::shared<double> result(hkl.size());
-    for (std::size_t i = 0; i < hkl.size(); ++i) {
-      std::size_t j = index[i];
-      DIALS_ASSERT(j < self.size());
-      result[i] = self[j].d(hkl[i]);
+    DIALS_ASSERT(nthreads > 0);
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      DIALS_ASSERT(index[i] >= 0 && (std::size_t)index[i] < self.size());
     }
+    scitbx::af::shared<double> result(hkl.size());
+    dials::util::parallel_for(
+      hkl.size(),
+      nthreads,
+      ResolutionJob<IndexType>(
+        quantity, self, hkl, index, wavelength, deg, result.ref()));
     return result;
   }
 
+  template <typename IndexType>
+  scitbx::af::shared<double> d(
+    const scitbx::af::const_ref<unit_cell> &self,
+    const scitbx::af::const_ref<cctbx::miller::index<> > &hkl,
+    const scitbx::af::const_ref<IndexType> &index,
+    std::size_t nthreads) {
+    return resolution<IndexType>(ResolutionJob<IndexType>::D,
+                                 self,
+                                 hkl,
+                                 index,
+                                 scitbx::af::const_ref<double>(NULL, 0),
+                                 false,
+                                 nthreads);
+  }
+
+  template <typename IndexType>
+  scitbx::af::shared<double> d_star_sq(
+    const scitbx::af::const_ref<unit_cell> &self,
+    const scitbx::af::const_ref<cctbx::miller::index<> > &hkl,
+    const scitbx::af::const_ref<IndexType> &index,
+    std::size_t nthreads) {
+    return resolution<IndexType>(ResolutionJob<IndexType>::D_STAR_SQ,
+                                 self,
+                                 hkl,
+                                 index,
+                                 scitbx::af::const_ref<double>(NULL, 0),
+                                 false,
+                                 nthreads);
+  }
+
+  template <typename IndexType>
+  scitbx::af::shared<double> two_theta(
+    const scitbx::af::const_ref<unit_cell> &self,
+    const scitbx::af::const_ref<cctbx::miller::index<> > &hkl,
+    const scitbx::af::const_ref<IndexType> &index,
+    const scitbx::af::const_ref<double> &wavelength,
+    bool deg,
+    std::size_t nthreads) {
+    DIALS_ASSERT(wavelength.size() == self.size());
+    return resolution<IndexType>(ResolutionJob<IndexType>::TWO_THETA,
+                                 self,
+                                 hkl,
+                                 index,
+                                 wavelength,
+                                 deg,
+                                 nthreads);
+  }
+
   void export_flex_unit_cell() {
     using namespace boost::python;
     using boost::python::arg;
     typedef scitbx::af::boost_python::flex_wrapper<unit_cell> f_w;
-    f_w::plain("unit_cell").def("d", &d, (arg("hkl"), arg("id")));
-    ;
+    f_w::plain("unit_cell")
+      .def("d", &d<std::size_t>, (arg("hkl"), arg("id"), arg("nthreads") = 1))
+      .def("d", &d<int>, (arg("hkl"), arg("id"), arg("nthreads") = 1))
+      .def("d_star_sq",
+           &d_star_sq<std::size_t>,
+           (arg("hkl"), arg("id"), arg("nthreads") = 1))
+      .def("d_star_sq", &d_star_sq<int>, (arg("hkl"), arg("id"), arg("nthreads") = 1))
+      .def("two_theta",
+           &two_theta<std::size_t>,
+           (arg("hkl"),
+            arg("id"),
+            arg("wavelength"),
+            arg("deg") = false,
+            arg("nthreads") = 1))
+      .def("two_theta",
+           &two_theta<int>,
+           (arg("hkl"),
+            arg("id"),
+            arg("wavelength"),
+            arg("deg") = false,
+            arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::af::boost_python
@@ -0,0 +1,255 @@
+/*
+ * column_codec.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_COLUMN_CODEC_H
+#define DIALS_ARRAY_FAMILY_COLUMN_CODEC_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <zlib.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  /**
+   * Compress and decompress the binary data of a reflection table column.
+   *
+   * The data is split into blocks which are compressed independently, so that
+   * blocks can be compressed and decompressed in parallel. Before compression
+   * each block is passed through a filter which makes it easier to compress:
+   *
+   *  "delta"   - replace each word by its difference from the previous word,
+   *              which turns sorted or slowly varying integers into small
+   *              numbers
+   *  "shuffle" - group the first bytes of each word together, then the second
+   *              bytes and so on, which puts the slowly varying exponent bytes
+   *              of floating point numbers next to each other
+   *  "none"    - leave the data as it is
+   */
+  class ColumnCodec {
+  public:
+    /**
+     * @param filter The name of the filter
+     * @param word_size The size in bytes of the words the filter works on
+     * @param block_size The size of the uncompressed blocks
+     */
+    ColumnCodec(const std::string &filter,
+                std::size_t word_size,
+                std::size_t block_size = default_block_size())
+        : filter_(filter), word_size_(word_size), block_size_(block_size) {
+      DIALS_ASSERT(filter == "none" || filter == "delta" || filter == "shuffle");
+      DIALS_ASSERT(filter != "delta" || word_size == 4 || word_size == 8);
+      DIALS_ASSERT(word_size > 0);
+      DIALS_ASSERT(block_size > 0 && block_size % word_size == 0);
+    }
+
+    static std::size_t default_block_size() {
+      return 1 << 20;
+    }
+
+    const std::string &filter() const {
+      return filter_;
+    }
+
+    std::size_t word_size() const {
+      return word_size_;
+    }
+
+    std::size_t block_size() const {
+      return block_size_;
+    }
+
+    /**
+     * @param size The size of the uncompressed data
+     * @returns The number of blocks the data is split into
+     */
+    std::size_t num_blocks(std::size_t size) const {
+      return (size + block_size_ - 1) / block_size_;
+    }
+
+    /**
+     * Compress some data
+     * @param data The data
+     * @param size The size of the data
+     * @param level The zlib compression level
+     * @param nthreads The number of threads
+     * @returns The compressed blocks
+     */
+    std::vector<std::string> compress(const char *data,
+                                      std::size_t size,
+                                      int level,
+                                      std::size_t nthreads) const {
+      DIALS_ASSERT(size % word_size_ == 0);
+      std::vector<std::string> blocks(num_blocks(size));
+      CompressJob job = {this, data, size, level, &blocks};
+      dials::util::parallel_for(blocks.size(), nthreads, job);
+      return blocks;
+    }
+
+    /**
+     * Decompress some data
+     * @param blocks Pointers to the compressed blocks
+     * @param sizes The sizes of the compressed blocks
+     * @param data The buffer for the decompressed data
+     * @param size The size of the decompressed data
+     * @param nthreads The number of threads
+     */
+    void decompress(const std::vector<const char *> &blocks,
+                    const std::vector<std::size_t> &sizes,
+                    char *data,
+                    std::size_t size,
+                    std::size_t nthreads) const {
+      DIALS_ASSERT(blocks.size() == sizes.size());
+      DIALS_ASSERT(blocks.size() == num_blocks(size));
+      DecompressJob job = {this, &blocks, &sizes, data, size};
+      dials::util::parallel_for(blocks.size(), nthreads, job);
+    }
+
+    /**
+     * @returns A sensible number of threads to decompress a number of blocks
+     */
+    static std::size_t default_threads(std::size_t nblocks) {
+      std::size_t ncores = std::max(1u, boost::thread::hardware_concurrency());
+      return std::max(std::size_t(1), std::min(nblocks, ncores));
+    }
+
+  private:
+    struct CompressJob {
+      const ColumnCodec *codec;
+      const char *data;
+      std::size_t size;
+      int level;
+      std::vector<std::string> *blocks;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::vector<char> filtered;
+        std::vector<Bytef> compressed;
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t offset = i * codec->block_size_;
+          std::size_t n = std::min(codec->block_size_, size - offset);
+          filtered.assign(data + offset, data + offset + n);
+          codec->encode(&filtered[0], n);
+          uLongf length = compressBound(n);
+          compressed.resize(length);
+          int status = compress2(&compressed[0],
+                                 &length,
+                                 reinterpret_cast<const Bytef *>(&filtered[0]),
+                                 n,
+                                 level);
+          DIALS_ASSERT(status == Z_OK);
+          (*blocks)[i].assign(reinterpret_cast<const char *>(&compressed[0]), length);
+        }
+      }
+    };
+
+    struct DecompressJob {
+      const ColumnCodec *codec;
+      const std::vector<const char *> *blocks;
+      const std::vector<std::size_t> *sizes;
+      char *data;
+      std::size_t size;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t offset = i * codec->block_size_;
+          std::size_t n = std::min(codec->block_size_, size - offset);
+          uLongf length = n;
+          int status = uncompress(reinterpret_cast<Bytef *>(data + offset),
+                                  &length,
+                                  reinterpret_cast<const Bytef *>((*blocks)[i]),
+                                  (*sizes)[i]);
+          if (status != Z_OK || length != n) {
+            throw DIALS_ERROR("dials::af::ColumnCodec: corrupt compressed block");
+          }
+          codec->decode(data + offset, n);
+        }
+      }
+    };
+
+    /**
+     * Apply the filter to a block in place
+     */
+    void encode(char *data, std::size_t size) const {
+      if (filter_ == "delta") {
+        if (word_size_ == 4) {
+          delta_encode<boost::uint32_t>(data, size);
+        } else {
+          delta_encode<boost::uint64_t>(data, size);
+        }
+      } else if (filter_ == "shuffle") {
+        std::vector<char> input(data, data + size);
+        std::size_t n = size / word_size_;
+        for (std::size_t i = 0; i < n; ++i) {
+          for (std::size_t b = 0; b < word_size_; ++b) {
+            data[b * n + i] = input[i * word_size_ + b];
+          }
+        }
+      }
+    }
+
+    /**
+     * Undo the filter of a block in place
+     */
+    void decode(char *data, std::size_t size) const {
+      if (filter_ == "delta") {
+        if (word_size_ == 4) {
+          delta_decode<boost::uint32_t>(data, size);
+        } else {
+          delta_decode<boost::uint64_t>(data, size);
+        }
+      } else if (filter_ == "shuffle") {
+        std::vector<char> input(data, data + size);
+        std::size_t n = size / word_size_;
+        for (std::size_t i = 0; i < n; ++i) {
+          for (std::size_t b = 0; b < word_size_; ++b) {
+            data[i * word_size_ + b] = input[b * n + i];
+          }
+        }
+      }
+    }
+
+    /**
+     * Replace words by their differences, using unsigned arithmetic so that
+     * the differences wrap around rather than overflow
+     */
+    template <typename Word>
+    static void delta_encode(char *data, std::size_t size) {
+      Word previous = 0;
+      for (std::size_t i = 0; i + sizeof(Word) <= size; i += sizeof(Word)) {
+        Word x;
+        std::memcpy(&x, data + i, sizeof(Word));
+        Word d = x - previous;
+        std::memcpy(data + i, &d, sizeof(Word));
+        previous = x;
+      }
+    }
+
+    template <typename Word>
+    static void delta_decode(char *data, std::size_t size) {
+      Word previous = 0;
+      for (std::size_t i = 0; i + sizeof(Word) <= size; i += sizeof(Word)) {
+        Word d;
+        std::memcpy(&d, data + i, sizeof(Word));
+        previous += d;
+        std::memcpy(data + i, &previous, sizeof(Word));
+      }
+    }
+
+    std::string filter_;
+    std::size_t word_size_;
+    std::size_t block_size_;
+  };
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_COLUMN_CODEC_H
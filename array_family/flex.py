@@ -135,7 +135,9 @@
 )
 
 from dials.array_family.flex_ext import (  # noqa: F401; lgtm
+    lazy_reflection_table,
     real,
+    reflection_file_writer,
     reflection_table_selector,
 )
 from dials_array_family_flex_ext import (  # noqa: F401; lgtm
@@ -146,4 +148,5 @@
     reflection_table,
     reflection_table_to_list_of_reflections,
     shoebox,
+    shoebox_arena,
 )
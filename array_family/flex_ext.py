@@ -6,8 +6,10 @@
 import collections
 import copy
 import functools
+import io
 import itertools
 import logging
+import mmap
 import operator
 import os
 import pickle
@@ -18,6 +20,7 @@
 import boost_adaptbx.boost.python
 import cctbx.array_family.flex
 import cctbx.miller
+import libtbx
 import libtbx.smart_open
 from scitbx import matrix
 
@@ -27,7 +30,12 @@
 import dials_array_family_flex_ext
 from dials.algorithms.centroid import centroid_px_to_mm_panel
 
-__all__ = ["real", "reflection_table_selector"]
+__all__ = [
+    "lazy_reflection_table",
+    "real",
+    "reflection_file_writer",
+    "reflection_table_selector",
+]
 
 logger = logging.getLogger(__name__)
 
@@ -60,7 +68,13 @@ class _:
 
     @staticmethod
     def from_predictions(
-        experiment, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        experiment,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
     ):
         """
         Construct a reflection table from predictions.
@@ -71,6 +85,7 @@ def from_predictions(
         :param margin: The margin to predict around
         :param force_static: Do static prediction with a scan varying model
         :param padding: Padding in degrees
+        :param nthreads: The number of threads for scan static prediction
         :return: The reflection table of predictions
         """
         if experiment.profile is not None:
@@ -86,6 +101,7 @@ def from_predictions(
                 margin=margin,
                 force_static=force_static,
                 padding=padding,
+                nthreads=nthreads,
             )
         from dials.algorithms.spot_prediction.reflection_predictor import (
             ReflectionPredictor,
@@ -98,12 +114,19 @@ def from_predictions(
             margin=margin,
             force_static=force_static,
             padding=padding,
+            nthreads=nthreads,
         )
         return predict()
 
     @staticmethod
     def from_predictions_multi(
-        experiments, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        experiments,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
     ):
         """
         Construct a reflection table from predictions.
@@ -114,26 +137,56 @@ def from_predictions_multi(
         :param margin: The margin to predict around
         :param force_static: Do static prediction with a scan varying model
         :param padding: Padding in degrees
+        :param nthreads: The number of threads for prediction
         :return: The reflection table of predictions
         """
+        from dials.algorithms.spot_prediction.reflection_predictor import (
+            predict_stills,
+            stills_batch_key,
+        )
+
+        # Consecutive stills which share the detector and crystal symmetry are
+        # predicted together, the other experiments one at a time
         result = dials_array_family_flex_ext.reflection_table()
-        for i, e in enumerate(experiments):
-            rlist = dials_array_family_flex_ext.reflection_table.from_predictions(
-                e,
-                dmin=dmin,
-                dmax=dmax,
-                margin=margin,
-                force_static=force_static,
-                padding=padding,
-            )
-            rlist["id"] = cctbx.array_family.flex.int(len(rlist), i)
-            if e.identifier:
-                rlist.experiment_identifiers()[i] = e.identifier
-            result.extend(rlist)
+        groups = itertools.groupby(
+            enumerate(experiments), key=lambda x: stills_batch_key(x[1], dmin)
+        )
+        for key, group in groups:
+            group = list(group)
+            if key is not None and len(group) > 1:
+                rlist = predict_stills(
+                    [e for _, e in group], dmin=dmin, dmax=dmax, nthreads=nthreads
+                )
+                rlist["id"] = rlist["id"] + group[0][0]
+                for i, e in group:
+                    if e.identifier:
+                        rlist.experiment_identifiers()[i] = e.identifier
+                result.extend(rlist)
+                continue
+            for i, e in group:
+                rlist = dials_array_family_flex_ext.reflection_table.from_predictions(
+                    e,
+                    dmin=dmin,
+                    dmax=dmax,
+                    margin=margin,
+                    force_static=force_static,
+                    padding=padding,
+                    nthreads=nthreads,
+                )
+                rlist["id"] = cctbx.array_family.flex.int(len(rlist), i)
+                if e.identifier:
+                    rlist.experiment_identifiers()[i] = e.identifier
+                result.extend(rlist)
         return result
 
     @staticmethod
-    def from_observations(experiments, params=None, is_stills=False):
+    def from_observations(
+        experiments,
+        params=None,
+        is_stills=False,
+        threshold_function=None,
+        mask_generator=None,
+    ):
         """
         Construct a reflection table from observations.
 
@@ -143,6 +196,10 @@ def from_observations(experiments, params=None, is_stills=False):
                             ID remapping for dials.stills_process. Do
                             not use for general processing unless you
                             know all the implications.
+        :param threshold_function: [ADVANCED] Reuse an existing threshold
+                                   strategy, e.g. to keep the threshold
+                                   buffers between calls
+        :param mask_generator: [ADVANCED] Reuse an existing mask generator
         :return: The reflection table of observations
         """
         from dials.algorithms.spot_finding.factory import SpotFinderFactory
@@ -168,7 +225,11 @@ def from_observations(experiments, params=None, is_stills=False):
         # Get the integrator from the input parameters
         logger.info("Configuring spot finder from input parameters")
         spotfinder = SpotFinderFactory.from_parameters(
-            experiments=experiments, params=params, is_stills=is_stills
+            experiments=experiments,
+            params=params,
+            is_stills=is_stills,
+            threshold_function=threshold_function,
+            mask_generator=mask_generator,
         )
 
         # Find the spots
@@ -189,47 +250,130 @@ def from_pickle(filename):
             assert isinstance(result, dials_array_family_flex_ext.reflection_table)
             return result
 
-    def as_msgpack_file(self, filename):
+    def as_msgpack_file(self, filename, compression_level=0, nthreads=1):
         """
         Write the reflection table to file in msgpack format
+
+        With a compression level above zero the data of each column is split
+        into blocks which are compressed in parallel with zlib, after a delta
+        filter for integer columns or a byte shuffle for floating point columns.
+        The default of no compression is the fastest for local disks.
+
+        :param filename: The msgpack file
+        :param compression_level: The zlib compression level (0-9)
+        :param nthreads: The number of threads to compress with
         """
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
         with libtbx.smart_open.for_writing(filename, "wb") as outfile:
-            self.as_msgpack_to_file(dials.util.ext.streambuf(python_file_obj=outfile))
+            self.as_msgpack_to_file(
+                dials.util.ext.streambuf(python_file_obj=outfile),
+                compression_level,
+                nthreads,
+            )
 
     @staticmethod
-    def from_msgpack_file(filename):
+    def from_msgpack_file(filename, columns=None):
         """
         Read the reflection table from file in msgpack format
+
+        Uncompressed files are memory mapped rather than read into memory, and
+        the columns are copied straight out of the mapped file, so reading only
+        some columns of a large file only touches the parts of the file that
+        hold them.
+
+        :param filename: The msgpack file
+        :param columns: An optional list of the names of the columns to read
         """
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
-        with libtbx.smart_open.for_reading(filename, "rb") as infile:
+        if columns is not None:
+            columns = list(columns)
+        packed = _read_msgpack_buffer(filename)
+        try:
             return dials_array_family_flex_ext.reflection_table.from_msgpack(
-                infile.read()
+                packed, columns
             )
+        finally:
+            if isinstance(packed, mmap.mmap):
+                packed.close()
+
+    @staticmethod
+    def iterate_row_groups(filename, columns=None, frames=None, panel=None):
+        """
+        Read a reflection file one row group at a time
+
+        Files written by reflection_file_writer are made of row groups, each of
+        which records the range of frames and panels of its reflections, so
+        groups outside the frames or panel of interest are skipped without
+        being decoded. Other reflection files are read as a single group.
+
+        :param filename: The msgpack file
+        :param columns: An optional list of the names of the columns to read
+        :param frames: Only read the groups with reflections in the frame
+                       range (first, last), where last is exclusive
+        :param panel: Only read the groups with reflections on this panel
+        :return: An iterator over the reflection tables of the groups
+        """
+        if filename and hasattr(filename, "__fspath__"):
+            filename = filename.__fspath__()
+        if columns is not None:
+            columns = list(columns)
+        reflection_table = dials_array_family_flex_ext.reflection_table
+        packed = _read_msgpack_buffer(filename)
+        try:
+            groups = reflection_table.msgpack_row_groups(packed)
+            if groups is None:
+                yield reflection_table.from_msgpack(packed, columns)
+                return
+            for offset, nbytes, _, group_frames, group_panels in groups:
+                if frames is not None and group_frames is not None:
+                    if group_frames[1] <= frames[0] or group_frames[0] >= frames[1]:
+                        continue
+                if panel is not None and group_panels is not None:
+                    if not group_panels[0] <= panel <= group_panels[1]:
+                        continue
+                with memoryview(packed) as view:
+                    table = reflection_table.from_msgpack(
+                        view[offset : offset + nbytes], columns
+                    )
+                yield table
+        finally:
+            if isinstance(packed, mmap.mmap):
+                packed.close()
 
-    def as_file(self, filename):
+    def as_file(self, filename, compression_level=0, nthreads=1):
         """
         Write the reflection table to file in either msgpack or pickle format
+
+        :param filename: The reflection file
+        :param compression_level: The column compression level for msgpack files
+        :param nthreads: The number of threads to compress with
         """
         if os.getenv("DIALS_USE_PICKLE"):
             self.as_pickle(filename)
         else:
-            self.as_msgpack_file(filename)
+            self.as_msgpack_file(filename, compression_level, nthreads)
 
     @staticmethod
-    def from_file(filename):
+    def from_file(filename, columns=None):
         """
         Read the reflection table from either pickle or msgpack
+
+        :param filename: The reflection file
+        :param columns: An optional list of the names of the columns to read
         """
         try:
             return dials_array_family_flex_ext.reflection_table.from_msgpack_file(
-                filename
+                filename, columns
             )
         except RuntimeError:
-            return dials_array_family_flex_ext.reflection_table.from_pickle(filename)
+            table = dials_array_family_flex_ext.reflection_table.from_pickle(filename)
+            if columns is not None:
+                for key in list(table.keys()):
+                    if key not in columns:
+                        del table[key]
+            return table
 
     @staticmethod
     def empty_standard(nrows):
@@ -419,36 +563,26 @@ def sort(self, name, reverse=False, order=None):
         """
         Sort the reflection table by a key.
 
-        :param name: The name of the column
+        The sort is stable. Multi element items are ordered like tuples, and
+        several columns can be given to sort by each in turn in a single pass.
+
+        :param name: The name of the column, or a list of names
         :param reverse: Reverse the sort order
         :param order: For multi element items specify order
         """
-
-        if type(self[name]) in (
-            cctbx.array_family.flex.vec2_double,
-            cctbx.array_family.flex.vec3_double,
-            cctbx.array_family.flex.mat3_double,
-            dials_array_family_flex_ext.int6,
-            cctbx.array_family.flex.miller_index,
-        ):
+        if order:
             data = self[name]
-            if not order:
-                perm = cctbx.array_family.flex.size_t(
-                    sorted(range(len(self)), key=lambda x: data[x], reverse=reverse)
-                )
-            else:
-                assert len(order) == len(data[0])
-                perm = cctbx.array_family.flex.size_t(
-                    sorted(
-                        range(len(self)),
-                        key=lambda x: tuple(data[x][i] for i in order),
-                        reverse=reverse,
-                    )
+            assert len(order) == len(data[0])
+            perm = cctbx.array_family.flex.size_t(
+                sorted(
+                    range(len(self)),
+                    key=lambda x: tuple(data[x][i] for i in order),
+                    reverse=reverse,
                 )
-        else:
-            perm = cctbx.array_family.flex.sort_permutation(
-                self[name], reverse=reverse, stable=True
             )
+        else:
+            keys = [name] if isinstance(name, str) else list(name)
+            perm = self.sort_permutation(keys, reverse)
         self.reorder(perm)
 
     """
@@ -686,6 +820,30 @@ def compute_zeta_multi(self, experiments):
         self["zeta"] = zeta_factor(m2, s0, self["s1"], self["id"])
         return self["zeta"]
 
+    def compute_coordinate_systems(self, experiments, nthreads=1):
+        """
+        Compute the local reflection coordinate system of each reflection.
+
+        :param experiments: The list of experiments
+        :param nthreads: The number of threads to use
+        :return: The coordinate systems of the reflections
+        """
+        from dials.algorithms.profile_model.gaussian_rs import CoordinateSystemBatch
+
+        if nthreads is libtbx.Auto:
+            from dials.util.mp import available_cores
+
+            nthreads = available_cores()
+        m2 = cctbx.array_family.flex.vec3_double(len(experiments))
+        s0 = cctbx.array_family.flex.vec3_double(len(experiments))
+        for i, e in enumerate(experiments):
+            m2[i] = e.goniometer.get_rotation_axis()
+            s0[i] = e.beam.get_s0()
+        phi = self["xyzcal.mm"].parts()[2]
+        return CoordinateSystemBatch(
+            m2, s0, self["id"], self["s1"], phi, nthreads=nthreads
+        )
+
     def compute_d_single(self, experiment):
         """
         Compute the resolution for each reflection.
@@ -700,31 +858,52 @@ def compute_d_single(self, experiment):
         )
         return self["d"]
 
-    def compute_d(self, experiments):
+    def compute_d(self, experiments, nthreads=1):
         """
         Compute the resolution for each reflection.
 
         :param experiments: The experiment list
+        :param nthreads: The number of threads to use
         :return: The resolution for each reflection
         """
         uc = dials_array_family_flex_ext.unit_cell(len(experiments))
         for i, e in enumerate(experiments):
             uc[i] = e.crystal.get_unit_cell()
-        assert self["id"].all_ge(0)
-        self["d"] = uc.d(
-            self["miller_index"], cctbx.array_family.flex.size_t(list(self["id"]))
-        )
+        self["d"] = uc.d(self["miller_index"], self["id"], nthreads=nthreads)
         return self["d"]
 
-    def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
+    def compute_two_theta(self, experiments, deg=False, nthreads=1):
+        """
+        Compute the scattering angle of each reflection from its miller index.
+
+        :param experiments: The experiment list
+        :param deg: Compute the angles in degrees rather than radians
+        :param nthreads: The number of threads to use
+        :return: The scattering angle of each reflection
+        """
+        uc = dials_array_family_flex_ext.unit_cell(len(experiments))
+        wavelength = cctbx.array_family.flex.double(len(experiments))
+        for i, e in enumerate(experiments):
+            uc[i] = e.crystal.get_unit_cell()
+            wavelength[i] = e.beam.get_wavelength()
+        return uc.two_theta(
+            self["miller_index"], self["id"], wavelength, deg=deg, nthreads=nthreads
+        )
+
+    def compute_bbox(self, experiments, sigma_b_multiplier=2.0, nthreads=1):
         """
         Compute the bounding boxes.
 
         :param experiments: The list of experiments
         :param profile_model: The profile models
         :param sigma_b_multiplier: Multiplier to cover extra background
+        :param nthreads: The number of threads to use
         :return: The bounding box for each reflection
         """
+        if nthreads is libtbx.Auto:
+            from dials.util.mp import available_cores
+
+            nthreads = available_cores()
         self["bbox"] = dials_array_family_flex_ext.int6(len(self))
         for expr, indices in self.iterate_experiments_and_indices(experiments):
             self["bbox"].set_selected(
@@ -737,18 +916,24 @@ def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
                     expr.goniometer,
                     expr.scan,
                     sigma_b_multiplier=sigma_b_multiplier,
+                    nthreads=nthreads,
                 ),
             )
         return self["bbox"]
 
-    def compute_partiality(self, experiments):
+    def compute_partiality(self, experiments, nthreads=1):
         """
         Compute the reflection partiality.
 
         :param experiments: The experiment list
         :param profile_model: The profile models
+        :param nthreads: The number of threads to use
         :return: The partiality for each reflection
         """
+        if nthreads is libtbx.Auto:
+            from dials.util.mp import available_cores
+
+            nthreads = available_cores()
         self["partiality"] = cctbx.array_family.flex.double(len(self))
         for expr, indices in self.iterate_experiments_and_indices(experiments):
             self["partiality"].set_selected(
@@ -760,6 +945,7 @@ def compute_partiality(self, experiments):
                     expr.detector,
                     expr.goniometer,
                     expr.scan,
+                    nthreads=nthreads,
                 ),
             )
         return self["partiality"]
@@ -784,7 +970,12 @@ def compute_mask(self, experiments, image_volume=None, overlaps=None):
             if result is not None:
                 if "fraction" not in self:
                     self["fraction"] = cctbx.array_family.flex.double(len(self))
-                self["fraction"].set_selected(indices, result)
+                # A windowed image volume skips the reflections not on its
+                # newest frame and gives them a negative fraction
+                selection = result >= 0
+                self["fraction"].set_selected(
+                    indices.select(selection), result.select(selection)
+                )
 
     def iterate_experiments_and_indices(self, experiments):
         """
@@ -839,14 +1030,21 @@ def compute_centroid(self, experiments, image_volume=None):
         )
 
     def compute_summed_intensity(
-        self, image_volume: dials.model.data.MultiPanelImageVolume = None
+        self,
+        image_volume: dials.model.data.MultiPanelImageVolume = None,
+        nthreads: int = 1,
     ) -> None:
         """
         Compute intensity via summation integration.
+
+        :param image_volume: The image volume to sum, or None to use the shoeboxes
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.integration.sum import sum_integrate_and_update_table
 
-        success = sum_integrate_and_update_table(self, image_volume=image_volume)
+        success = sum_integrate_and_update_table(
+            self, image_volume=image_volume, nthreads=nthreads
+        )
         self.set_flags(~success, self.flags.failed_during_summation)
 
     def compute_fitted_intensity(self, fitter):
@@ -859,11 +1057,12 @@ def compute_fitted_intensity(self, fitter):
         success = fitter.fit(self)
         self.set_flags(~success, self.flags.failed_during_profile_fitting)
 
-    def compute_corrections(self, experiments):
+    def compute_corrections(self, experiments, nthreads=1):
         """
         Helper function to correct the intensity.
 
         :param experiments: The list of experiments
+        :param nthreads: The number of threads to use
         :return: The LP correction for each reflection
         """
         from dials.algorithms.integration import Corrections, CorrectionsMulti
@@ -878,34 +1077,38 @@ def compute_corrections(self, experiments):
                 )
             else:
                 compute.append(Corrections(experiment.beam, experiment.detector))
-        lp = compute.lp(self["id"], self["s1"])
+        lp = compute.lp(self["id"], self["s1"], nthreads)
         self["lp"] = lp
         if experiment.detector[0].get_mu() > 0:
-            qe = compute.qe(self["id"], self["s1"], self["panel"])
+            qe = compute.qe(self["id"], self["s1"], self["panel"], nthreads)
             self["qe"] = qe
         return lp
 
-    def extract_shoeboxes(self, imageset, mask=None, nthreads=1):
+    def extract_shoeboxes(self, imageset, mask=None, nthreads=1, shoeboxes=None):
         """
         Helper function to read a load of shoebox data.
 
         :param imageset: The imageset
         :param mask: The mask to apply
         :param nthreads: The number of threads to use
+        :param shoeboxes: A flex.shoebox_arena to extract the pixels into,
+                          rather than the shoebox column of the table
         :return: A tuple containing read time and extract time
         """
         from time import time
 
         from dials.model.data import make_image
 
-        assert "shoebox" in self
         detector = imageset.get_detector()
         try:
             frame0, frame1 = imageset.get_array_range()
         except Exception:
             frame0, frame1 = (0, len(imageset))
+        if shoeboxes is None:
+            assert "shoebox" in self
+            shoeboxes = self
         extractor = dials_array_family_flex_ext.ShoeboxExtractor(
-            self, len(detector), frame0, frame1
+            shoeboxes, len(detector), frame0, frame1, nthreads
         )
         logger.info(" Beginning to read images")
         read_time = 0
@@ -978,12 +1181,13 @@ def contains_invalid_pixels(self):
         self.set_flags(ninvfg > 0, self.flags.foreground_includes_bad_pixels)
         return (ntotal - nvalid) > 0
 
-    def find_overlaps(self, experiments=None, border=0):
+    def find_overlaps(self, experiments=None, border=0, nthreads=1):
         """
         Check for overlapping reflections.
 
         :param experiments: The experiment list
         :param tolerance: A positive integer specifying border around shoebox
+        :param nthreads: The number of threads to search for overlaps on
         :return: The overlap list
         """
         from dials.algorithms.shoebox import OverlapFinder
@@ -1024,7 +1228,7 @@ def find_overlaps(self, experiments=None, border=0):
             raise RuntimeError("Either need to supply experiments or have imageset_id")
 
         # Create the overlap finder
-        find_overlapping = OverlapFinder()
+        find_overlapping = OverlapFinder(nthreads)
 
         # Find the overlaps
         overlaps = find_overlapping(group_id, panel, bbox)
@@ -1097,46 +1301,29 @@ def select_on_experiment_identifiers(self, list_of_identifiers):
         and return a reflection table with properly configured experiment_identifiers
         map.
         """
-        # First get the reverse of the map i.e. ids for a given exp_identifier
-        id_values = []
-        for exp_id in list_of_identifiers:
-            for k in self.experiment_identifiers().keys():
-                if self.experiment_identifiers()[k] == exp_id:
-                    id_values.append(k)
-                    break
-        if len(id_values) != len(list_of_identifiers):
-            raise KeyError(
-                """Not all requested identifiers
-found in the table's map, has the experiment_identifiers() map been created?
-Requested %s:
-Found %s"""
-                % (list_of_identifiers, id_values)
-            )
-        # Build up a selection and use this
-        sel = cctbx.array_family.flex.bool(self.size(), False)
-        for id_val, exp_id in zip(id_values, list_of_identifiers):
-            id_sel = self["id"] == id_val
-            sel.set_selected(id_sel, True)
-        self = self.select(sel)
+        id_values = self._experiment_id_values(list_of_identifiers)
+        self = self.select(self.id_mask(cctbx.array_family.flex.int(id_values)))
         # Remove entries from the experiment_identifiers map
+        id_values = set(id_values)
         for k in self.experiment_identifiers().keys():
             if k not in id_values:
                 del self.experiment_identifiers()[k]
         return self
 
-    def remove_on_experiment_identifiers(self, list_of_identifiers):
+    def _experiment_id_values(self, list_of_identifiers):
         """
-        Remove datasets from the table, given a list of experiment
-        identifiers (strings).
+        Get the id values of a list of experiment identifiers, using the
+        reverse of the experiment_identifiers map
         """
-        # First get the reverse of the map i.e. ids for a given exp_identifier
-        assert "id" in self
-        id_values = []
-        for exp_id in list_of_identifiers:
-            for k in self.experiment_identifiers().keys():
-                if self.experiment_identifiers()[k] == exp_id:
-                    id_values.append(k)
-                    break
+        identifiers = self.experiment_identifiers()
+        reverse_map = {}
+        for k, v in zip(identifiers.keys(), identifiers.values()):
+            reverse_map.setdefault(v, k)
+        id_values = [
+            reverse_map[exp_id]
+            for exp_id in list_of_identifiers
+            if exp_id in reverse_map
+        ]
         if len(id_values) != len(list_of_identifiers):
             raise KeyError(
                 """Not all requested identifiers
@@ -1145,10 +1332,18 @@ def remove_on_experiment_identifiers(self, list_of_identifiers):
 Found %s"""
                 % (list_of_identifiers, id_values)
             )
-        # Now delete the selections, also removing the entry from the map
-        for id_val in id_values:
-            sel = self["id"] == id_val
-            self.del_selected(sel)
+        return id_values
+
+    def remove_on_experiment_identifiers(self, list_of_identifiers):
+        """
+        Remove datasets from the table, given a list of experiment
+        identifiers (strings).
+        """
+        assert "id" in self
+        id_values = self._experiment_id_values(list_of_identifiers)
+        # Now delete the selections, also removing the entries from the map
+        self.del_selected(self.id_mask(cctbx.array_family.flex.int(id_values)))
+        for id_val in set(id_values):
             del self.experiment_identifiers()[id_val]
         return self
 
@@ -1325,6 +1520,236 @@ def get(self, key, default=None):
         return default
 
 
+@boost_adaptbx.boost.python.inject_into(dials_array_family_flex_ext.BinIndexer)
+class _:
+    def statistics(self, columns, weights=None, mask=None, nthreads=1):
+        """
+        Compute the count, sum, sum of squares, extrema and weighted sum of
+        several columns of values in each bin in one pass.
+
+        Args:
+            columns: A list of flex.double columns, one value per indexed item
+            weights: An optional list of flex.double weights for each column
+            mask: An optional list of flex.bool selections of the values of each
+                column to include
+            nthreads (int): The number of threads to use
+
+        Returns:
+            A BinnedStatistics object; the statistics of column i are found with
+            e.g. result.mean(i)
+        """
+
+        def as_grid(arrays, flex_type):
+            if arrays is None:
+                return flex_type(cctbx.array_family.flex.grid(0, 0))
+            assert len(arrays) == len(columns)
+            result = flex_type()
+            for array in arrays:
+                result.extend(array)
+            result.reshape(cctbx.array_family.flex.grid(len(arrays), len(columns[0])))
+            return result
+
+        assert len(columns) > 0
+        return self._statistics(
+            as_grid(columns, cctbx.array_family.flex.double),
+            as_grid(weights, cctbx.array_family.flex.double),
+            as_grid(mask, cctbx.array_family.flex.bool),
+            nthreads,
+        )
+
+
+def _read_msgpack_buffer(filename):
+    """
+    Memory map an uncompressed msgpack file, or read a compressed one into
+    memory.
+
+    :param filename: The msgpack file
+    :return: An mmap.mmap or bytes object with the file contents
+    """
+    with libtbx.smart_open.for_reading(filename, "rb") as infile:
+        if isinstance(infile, io.BufferedReader):
+            try:
+                return mmap.mmap(infile.fileno(), 0, access=mmap.ACCESS_READ)
+            except (OSError, ValueError):
+                # e.g. an empty file or a pipe
+                pass
+        return infile.read()
+
+
+class reflection_file_writer:
+    """
+    Write a reflection file in pieces, as a sequence of independently
+    decodable row groups.
+
+    This lets a program write its reflections as they are produced (e.g. as
+    integration jobs finish) rather than holding the whole table in memory.
+    The file is read as one table by reflection_table.from_file, or a group
+    at a time with reflection_table.iterate_row_groups.
+    """
+
+    def __init__(self, filename, compression_level=0, nthreads=1):
+        """
+        Open the file and write the header
+
+        :param filename: The reflection file
+        :param compression_level: The column compression level (see
+                                  reflection_table.as_msgpack_file)
+        :param nthreads: The number of threads to compress with
+        """
+        if filename and hasattr(filename, "__fspath__"):
+            filename = filename.__fspath__()
+        self._compression_level = compression_level
+        self._nthreads = nthreads
+        self._file = libtbx.smart_open.for_writing(filename, "wb")
+        self._file.write(
+            dials_array_family_flex_ext.reflection_table.msgpack_row_group_header()
+        )
+
+    def append(self, table):
+        """
+        Write a reflection table as the next row group
+
+        :param table: The reflection table
+        """
+        self._file.write(
+            table.as_msgpack_row_group(self._compression_level, self._nthreads)
+        )
+
+    def close(self):
+        self._file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+class lazy_reflection_table:
+    """
+    A read-only view of a reflection file which only reads the columns that
+    are used.
+
+    Opening the file only reads the list of columns, the number of rows and the
+    experiment identifiers. Each column is then read from the file the first
+    time it is accessed and kept for later use, so scripts which look at a few
+    columns of a large file never convert (or, for uncompressed files, touch)
+    the rest of it.
+    """
+
+    def __init__(self, filename):
+        """
+        Open the reflection file
+
+        :param filename: The msgpack reflection file
+        """
+        if filename and hasattr(filename, "__fspath__"):
+            filename = filename.__fspath__()
+        self._packed = _read_msgpack_buffer(filename)
+        try:
+            self._types = collections.OrderedDict(
+                dials_array_family_flex_ext.reflection_table.msgpack_columns(
+                    self._packed
+                )
+            )
+            # A table with no columns holds the size and identifiers
+            self._table = self._read([])
+        except Exception:
+            self.close()
+            raise
+
+    def _read(self, columns):
+        return dials_array_family_flex_ext.reflection_table.from_msgpack(
+            self._packed, columns
+        )
+
+    def close(self):
+        """
+        Release the file. Columns which have already been read are kept.
+        """
+        if isinstance(self._packed, mmap.mmap):
+            self._packed.close()
+        self._packed = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return self._table.size()
+
+    def size(self):
+        return self._table.size()
+
+    def nrows(self):
+        return self._table.nrows()
+
+    def keys(self):
+        """
+        :return: The names of all the columns in the file
+        """
+        return list(self._types)
+
+    def __contains__(self, key):
+        return key in self._types
+
+    def __iter__(self):
+        return iter(self._types)
+
+    def column_type(self, key):
+        """
+        :param key: The column name
+        :return: The type of the column as written in the file, e.g. "double"
+        """
+        return self._types[key]
+
+    def experiment_identifiers(self):
+        return self._table.experiment_identifiers()
+
+    def loaded_keys(self):
+        """
+        :return: The names of the columns which have been read so far
+        """
+        return list(self._table.keys())
+
+    def load(self, keys):
+        """
+        Read some columns in a single pass over the file
+
+        :param keys: The names of the columns to read
+        """
+        missing = [k for k in keys if k not in self._table]
+        for key in missing:
+            if key not in self._types:
+                raise KeyError(key)
+        if missing:
+            if self._packed is None:
+                raise ValueError("Reflection file has been closed")
+            table = self._read(missing)
+            for key in missing:
+                self._table[key] = table[key]
+
+    def __getitem__(self, key):
+        self.load([key])
+        return self._table[key]
+
+    def select_columns(self, keys=None):
+        """
+        Create a reflection table with some of the columns, reading any which
+        have not been read yet
+
+        :param keys: The names of the columns, or None for all of them
+        :return: The reflection table
+        """
+        if keys is None:
+            keys = self.keys()
+        keys = list(keys)
+        self.load(keys)
+        return self._table.select(tuple(keys))
+
+
 class reflection_table_selector:
     """
     A class to select columns from reflection table.
@@ -188,6 +188,24 @@ namespace dials { namespace af {
       }
     };
 
+    /** Get the capacity of each column */
+    struct capacity_visitor : boost::static_visitor<size_type> {
+      template <typename T>
+      size_type operator()(const T &v) const {
+        return v.capacity();
+      }
+    };
+
+    /** Reserve space in each column */
+    struct reserve_visitor : boost::static_visitor<void> {
+      size_type n_;
+      reserve_visitor(size_type n) : n_(n) {}
+      template <typename T>
+      void operator()(T &v) const {
+        v.reserve(n_);
+      }
+    };
+
     /** Insert an element into each column */
     struct insert_visitor : boost::static_visitor<void> {
       size_type pos, n;
@@ -361,6 +379,33 @@ namespace dials { namespace af {
       default_nrows_ = n;
     }
 
+    /**
+     * @returns The number of rows the columns can hold without reallocating
+     */
+    size_type capacity() const {
+      if (empty()) {
+        return default_nrows_;
+      }
+      capacity_visitor visitor;
+      const_iterator it = begin();
+      size_type result = it->second.apply_visitor(visitor);
+      for (++it; it != end(); ++it) {
+        result = std::min(result, it->second.apply_visitor(visitor));
+      }
+      return result;
+    }
+
+    /**
+     * Reserve space for a number of rows in each column
+     * @param n The number of rows
+     */
+    void reserve(size_type n) {
+      reserve_visitor visitor(n);
+      for (iterator it = begin(); it != end(); ++it) {
+        it->second.apply_visitor(visitor);
+      }
+    }
+
     /**
      * Insert an element at the given position in each column
      * @param pos The position to insert at
@@ -11,29 +11,132 @@
 #ifndef DIALS_ARRAY_FAMILY_REFLECTION_H
 #define DIALS_ARRAY_FAMILY_REFLECTION_H
 
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 #include <dials/array_family/reflection_table.h>
 
 namespace dials { namespace af {
 
   /**
-   * A class to represent a reflection
+   * The columns of a reflection which are held in fixed slots of the
+   * reflection object. These are the columns read and written for every
+   * reflection by the integration code, so they can be accessed by index
+   * without looking up their names. Any other column is held by name.
+   */
+  namespace reflection_column {
+
+    enum type {
+      id = 0,
+      panel,
+      flags,
+      bbox,
+      shoebox,
+      miller_index,
+      entering,
+      s1,
+      xyzcal_px,
+      xyzcal_mm,
+      xyzobs_px_value,
+      xyzobs_px_variance,
+      partiality,
+      partiality_old,
+      d,
+      zeta,
+      lp,
+      qe,
+      intensity_sum_value,
+      intensity_sum_variance,
+      intensity_prf_value,
+      intensity_prf_variance,
+      intensity_prf_correlation,
+      background_sum_value,
+      background_sum_variance,
+      num_pixels_valid,
+      num_pixels_foreground,
+      num_pixels_background,
+      num_pixels_background_used,
+      ncolumns
+    };
+
+    /**
+     * @param column The column
+     * @returns The name of the column
+     */
+    inline const char *name(type column) {
+      static const char *const names[] = {
+        "id",
+        "panel",
+        "flags",
+        "bbox",
+        "shoebox",
+        "miller_index",
+        "entering",
+        "s1",
+        "xyzcal.px",
+        "xyzcal.mm",
+        "xyzobs.px.value",
+        "xyzobs.px.variance",
+        "partiality",
+        "partiality_old",
+        "d",
+        "zeta",
+        "lp",
+        "qe",
+        "intensity.sum.value",
+        "intensity.sum.variance",
+        "intensity.prf.value",
+        "intensity.prf.variance",
+        "intensity.prf.correlation",
+        "background.sum.value",
+        "background.sum.variance",
+        "num_pixels.valid",
+        "num_pixels.foreground",
+        "num_pixels.background",
+        "num_pixels.background_used",
+      };
+      DIALS_ASSERT(column >= 0 && column < ncolumns);
+      return names[column];
+    }
+
+    /**
+     * @param key The column name
+     * @returns The column with the name, or -1 if it has no slot
+     */
+    inline int find(const std::string &key) {
+      for (int i = 0; i < ncolumns; ++i) {
+        if (key == name((type)i)) {
+          return i;
+        }
+      }
+      return -1;
+    }
+
+  }  // namespace reflection_column
+
+  /**
+   * A class to represent a reflection. The values of the columns in
+   * reflection_column are held in an array of slots, and the values of any
+   * other columns in a map keyed by name, so that a reflection with the
+   * usual columns is filled without allocating a node per column.
    */
   class Reflection {
   public:
     typedef reflection_table_type_generator::data_type data_type;
     typedef std::map<std::string, data_type> map_type;
+    typedef reflection_column::type column_type;
 
     typedef map_type::key_type key_type;
     typedef map_type::mapped_type mapped_type;
-    typedef map_type::value_type map_value_type;
-    typedef map_type::iterator iterator;
-    typedef map_type::const_iterator const_iterator;
     typedef map_type::size_type size_type;
 
     /**
      * Instantiate
      */
-    Reflection() {}
+    Reflection() {
+      std::fill(present_, present_ + reflection_column::ncolumns, false);
+    }
 
     /**
      * Access a value by key
@@ -41,8 +144,12 @@ namespace dials { namespace af {
      * @returns The proxy object to access the value
      */
     const mapped_type &operator[](const key_type &key) const {
-      const_iterator it = find(key);
-      DIALS_ASSERT(it != end());
+      int column = reflection_column::find(key);
+      if (column >= 0) {
+        return (*this)[(column_type)column];
+      }
+      map_type::const_iterator it = extra_.find(key);
+      DIALS_ASSERT(it != extra_.end());
       return it->second;
     }
 
@@ -52,7 +159,32 @@ namespace dials { namespace af {
      * @returns The proxy object to access the value
      */
     mapped_type &operator[](const key_type &key) {
-      return data_[key];
+      int column = reflection_column::find(key);
+      if (column >= 0) {
+        return (*this)[(column_type)column];
+      }
+      return extra_[key];
+    }
+
+    /**
+     * Access a value by column
+     * @param column The column
+     * @returns The proxy object to access the value
+     */
+    const mapped_type &operator[](column_type column) const {
+      DIALS_ASSERT(contains(column));
+      return core_[column];
+    }
+
+    /**
+     * Access a value by column
+     * @param column The column
+     * @returns The proxy object to access the value
+     */
+    mapped_type &operator[](column_type column) {
+      DIALS_ASSERT(column >= 0 && column < reflection_column::ncolumns);
+      present_[column] = true;
+      return core_[column];
     }
 
     /**
@@ -62,9 +194,8 @@ namespace dials { namespace af {
      */
     template <typename T>
     T &get(const key_type &key) {
-      iterator it = find(key);
-      DIALS_ASSERT(it != end());
-      return boost::get<T>(it->second);
+      DIALS_ASSERT(contains(key));
+      return boost::get<T>((*this)[key]);
     }
 
     /**
@@ -74,86 +205,120 @@ namespace dials { namespace af {
      */
     template <typename T>
     const T &get(const key_type &key) const {
-      const_iterator it = find(key);
-      DIALS_ASSERT(it != end());
-      return boost::get<T>(it->second);
-    }
-
-    /** @returns An iterator to the beginning of the column map */
-    iterator begin() {
-      return data_.begin();
+      return boost::get<T>((*this)[key]);
     }
 
-    /** @returns An iterator to the end of the column map */
-    iterator end() {
-      return data_.end();
-    }
-
-    /** @returns A const iterator to the beginning of the column map */
-    const_iterator begin() const {
-      return data_.begin();
+    /**
+     * Access a value by column
+     * @param column The column
+     * @returns The value.
+     */
+    template <typename T>
+    T &get(column_type column) {
+      DIALS_ASSERT(contains(column));
+      return boost::get<T>(core_[column]);
     }
 
-    /** @returns A const iterator to the end of the column map */
-    const_iterator end() const {
-      return data_.end();
+    /**
+     * Access a value by column
+     * @param column The column
+     * @returns The value.
+     */
+    template <typename T>
+    const T &get(column_type column) const {
+      DIALS_ASSERT(contains(column));
+      return boost::get<T>(core_[column]);
     }
 
-    /** @returns The number of values in the table */
+    /** @returns The number of values in the reflection */
     size_type size() const {
-      return data_.size();
+      return std::count(present_, present_ + reflection_column::ncolumns, true)
+             + extra_.size();
     }
 
-    /** @returns Is the table empty */
+    /** @returns Is the reflection empty */
     bool empty() const {
-      return data_.empty();
+      return size() == 0;
     }
 
     /** @returns The number of columns matching the key (0 or 1) */
     size_type count(const key_type &key) const {
-      return data_.count(key);
+      return contains(key) ? 1 : 0;
     }
 
     /**
-     * Find a column matching the key
+     * Erase a column from the reflection.
      * @param key The column name
-     * @returns An iterator to the column
-     */
-    iterator find(const key_type &key) {
-      return data_.find(key);
-    }
-
-    /**
-     * Find a column matching the key
-     * @param key The column name
-     * @returns A const iterator to the column
+     * @returns The number of columns removed
      */
-    const_iterator find(const key_type &key) const {
-      return data_.find(key);
+    size_type erase(const key_type &key) {
+      int column = reflection_column::find(key);
+      if (column >= 0) {
+        return erase((column_type)column);
+      }
+      return extra_.erase(key);
     }
 
     /**
-     * Erase a column from the table.
-     * @param key The column name
+     * Erase a column from the reflection.
+     * @param column The column
      * @returns The number of columns removed
      */
-    size_type erase(const key_type &key) {
-      return data_.erase(key);
+    size_type erase(column_type column) {
+      if (!contains(column)) {
+        return 0;
+      }
+      present_[column] = false;
+      core_[column] = data_type();
+      return 1;
     }
 
-    /** Clear the table */
+    /** Clear the reflection */
     void clear() {
-      data_.clear();
+      for (std::size_t i = 0; i < reflection_column::ncolumns; ++i) {
+        erase((column_type)i);
+      }
+      extra_.clear();
     }
 
-    /** @returns Does the table contain the key. */
+    /** @returns Does the reflection contain the key. */
     bool contains(const key_type &key) const {
-      const_iterator it = find(key);
-      return it != end();
+      int column = reflection_column::find(key);
+      if (column >= 0) {
+        return contains((column_type)column);
+      }
+      return extra_.find(key) != extra_.end();
+    }
+
+    /** @returns Does the reflection contain the column. */
+    bool contains(column_type column) const {
+      DIALS_ASSERT(column >= 0 && column < reflection_column::ncolumns);
+      return present_[column];
+    }
+
+    /** @returns The names of the columns in the reflection */
+    std::vector<std::string> keys() const {
+      std::vector<std::string> result;
+      for (std::size_t i = 0; i < reflection_column::ncolumns; ++i) {
+        if (present_[i]) {
+          result.push_back(reflection_column::name((column_type)i));
+        }
+      }
+      for (map_type::const_iterator it = extra_.begin(); it != extra_.end(); ++it) {
+        result.push_back(it->first);
+      }
+      return result;
+    }
+
+    /** @returns The values of the columns which do not have a slot */
+    const map_type &extra() const {
+      return extra_;
     }
 
   protected:
-    map_type data_;
+    data_type core_[reflection_column::ncolumns];
+    bool present_[reflection_column::ncolumns];
+    map_type extra_;
   };
 
   namespace detail {
@@ -173,60 +338,164 @@ namespace dials { namespace af {
     };
 
     /**
-     * A visitor to convert a reflection object to a reflection table row
+     * A visitor to create a column for a reflection value
      */
-    struct reflection_to_row_visitor : public boost::static_visitor<void> {
+    struct create_column_visitor
+        : public boost::static_visitor<af::reflection_table::mapped_type> {
       af::reflection_table table_;
-      std::size_t n_;
       Reflection::key_type key_;
-      reflection_to_row_visitor(af::reflection_table table,
-                                std::size_t n,
-                                Reflection::key_type key)
-          : table_(table), n_(n), key_(key) {}
+      create_column_visitor(af::reflection_table table, Reflection::key_type key)
+          : table_(table), key_(key) {}
+      template <typename T>
+      af::reflection_table::mapped_type operator()(const T &) {
+        af::shared<T> col = table_[key_];
+        return af::reflection_table::mapped_type(col);
+      }
+    };
+
+    /**
+     * A visitor to write a reflection value to a column
+     */
+    struct write_to_column_visitor : public boost::static_visitor<void> {
+      af::reflection_table::mapped_type &column_;
+      std::size_t n_;
+      write_to_column_visitor(af::reflection_table::mapped_type &column, std::size_t n)
+          : column_(column), n_(n) {}
       template <typename T>
       void operator()(const T &item) {
-        af::ref<T> col = table_[key_];
+        af::shared<T> &col = boost::get<af::shared<T> >(column_);
         DIALS_ASSERT(n_ < col.size());
         col[n_] = item;
       }
     };
 
+  }  // namespace detail
+
+  /**
+   * A view of a reflection table to read and write single reflections without
+   * converting the whole table to an array of reflections. The columns are
+   * looked up once on construction so a row is read or written by going
+   * straight to the column data. Writing a value for a column which does not
+   * exist adds the column to the table.
+   *
+   * The view is not thread safe; when used from multiple threads the caller
+   * must serialise the calls, and the table must not otherwise be modified
+   * while the view is in use.
+   */
+  class ReflectionTableView {
+  public:
+    typedef af::reflection_table::mapped_type column_type;
+
     /**
-     * Get a reflection object from the reflection table
+     * Initialise the view
      * @param table The reflection table
-     * @param index The array index
-     * @returns The reflection object
      */
-    inline Reflection reflection_table_get_reflection(af::reflection_table table,
-                                                      std::size_t index) {
+    ReflectionTableView(af::reflection_table table)
+        : table_(table), nrows_(table.nrows()) {
       typedef af::reflection_table::const_iterator iterator;
-      DIALS_ASSERT(index < table.size());
+      std::fill(core_, core_ + reflection_column::ncolumns, -1);
+      for (iterator it = table_.begin(); it != table_.end(); ++it) {
+        add_column(it->first, it->second);
+      }
+    }
+
+    /**
+     * @returns The number of reflections
+     */
+    std::size_t size() const {
+      return nrows_;
+    }
+
+    /**
+     * @returns The reflection table
+     */
+    af::reflection_table table() const {
+      return table_;
+    }
+
+    /**
+     * Get a reflection from the table
+     * @param index The reflection index
+     * @returns The reflection object
+     */
+    Reflection get(std::size_t index) const {
+      DIALS_ASSERT(index < nrows_);
       Reflection result;
-      row_to_reflection_visitor visitor(index);
-      for (iterator it = table.begin(); it != table.end(); ++it) {
-        result[it->first] = it->second.apply_visitor(visitor);
+      detail::row_to_reflection_visitor visitor(index);
+      for (std::size_t i = 0; i < columns_.size(); ++i) {
+        if (slot_[i] >= 0) {
+          Reflection::column_type column = (Reflection::column_type)slot_[i];
+          result[column] = columns_[i].apply_visitor(visitor);
+        } else {
+          result[keys_[i]] = columns_[i].apply_visitor(visitor);
+        }
       }
       return result;
     }
 
     /**
-     * Set the reflection object in the reflection table
-     * @param table The reflection table
-     * @param index The array index
-     * @param value The reflection
+     * Set a reflection in the table
+     * @param index The reflection index
+     * @param value The reflection object
      */
-    inline void reflection_table_set_reflection(af::reflection_table table,
-                                                std::size_t index,
-                                                Reflection value) {
-      typedef Reflection::const_iterator iterator;
-      DIALS_ASSERT(index < table.size());
-      for (iterator it = value.begin(); it != value.end(); ++it) {
-        reflection_to_row_visitor visitor(table, index, it->first);
+    void set(std::size_t index, const Reflection &value) {
+      typedef Reflection::map_type::const_iterator iterator;
+      typedef std::map<std::string, std::size_t>::const_iterator lookup_iterator;
+      DIALS_ASSERT(index < nrows_);
+      for (std::size_t c = 0; c < reflection_column::ncolumns; ++c) {
+        Reflection::column_type column = (Reflection::column_type)c;
+        if (value.contains(column)) {
+          if (core_[c] < 0) {
+            create_column(reflection_column::name(column), value[column]);
+          }
+          detail::write_to_column_visitor visitor(columns_[core_[c]], index);
+          value[column].apply_visitor(visitor);
+        }
+      }
+      const Reflection::map_type &extra = value.extra();
+      for (iterator it = extra.begin(); it != extra.end(); ++it) {
+        lookup_iterator col = lookup_.find(it->first);
+        if (col == lookup_.end()) {
+          create_column(it->first, it->second);
+          col = lookup_.find(it->first);
+        }
+        detail::write_to_column_visitor visitor(columns_[col->second], index);
         it->second.apply_visitor(visitor);
       }
     }
 
-  }  // namespace detail
+  protected:
+    /**
+     * Add a column to the table for a value
+     */
+    void create_column(const std::string &key, const Reflection::data_type &value) {
+      detail::create_column_visitor visitor(table_, key);
+      add_column(key, value.apply_visitor(visitor));
+    }
+
+    /**
+     * Add a column to the lookup
+     */
+    void add_column(const std::string &key, const column_type &column) {
+      int slot = reflection_column::find(key);
+      if (slot >= 0) {
+        core_[slot] = keys_.size();
+      } else {
+        lookup_[key] = keys_.size();
+      }
+      keys_.push_back(key);
+      slot_.push_back(slot);
+      columns_.push_back(column);
+    }
+
+    af::reflection_table table_;
+    std::size_t nrows_;
+    std::vector<std::string> keys_;
+    std::vector<int> slot_;
+    std::vector<column_type> columns_;
+    std::map<std::string, std::size_t> lookup_;
+    int core_[reflection_column::ncolumns];
+  };
 
   /**
    * Convert a reflection table to an array of reflections
@@ -234,10 +503,11 @@ namespace dials { namespace af {
    * @returns The array of reflections
    */
   inline af::shared<Reflection> reflection_table_to_array(af::reflection_table table) {
+    ReflectionTableView view(table);
     af::shared<Reflection> result;
-    result.reserve(table.size());
-    for (std::size_t i = 0; i < table.size(); ++i) {
-      result.push_back(detail::reflection_table_get_reflection(table, i));
+    result.reserve(view.size());
+    for (std::size_t i = 0; i < view.size(); ++i) {
+      result.push_back(view.get(i));
     }
     return result;
   }
@@ -250,8 +520,9 @@ namespace dials { namespace af {
   inline af::reflection_table reflection_table_from_array(
     af::const_ref<Reflection> array) {
     af::reflection_table result(array.size());
+    ReflectionTableView view(result);
     for (std::size_t i = 0; i < array.size(); ++i) {
-      detail::reflection_table_set_reflection(result, i, array[i]);
+      view.set(i, array[i]);
     }
     return result;
   }
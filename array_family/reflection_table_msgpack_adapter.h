@@ -11,10 +11,38 @@
 #ifndef DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 #define DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 #include <scitbx/array_family/shared.h>
+#include <dials/array_family/column_codec.h>
 #include <dials/array_family/reflection_table.h>
 #include <msgpack.hpp>
 
+namespace dials { namespace af {
+
+  /**
+   * A reflection table to be packed with its columns compressed
+   */
+  struct compressed_reflection_table {
+    /**
+     * @param table_ The reflection table
+     * @param level_ The zlib compression level
+     * @param nthreads_ The number of threads to compress with
+     */
+    compressed_reflection_table(const reflection_table &table_,
+                                int level_,
+                                std::size_t nthreads_)
+        : table(table_), level(level_), nthreads(nthreads_) {}
+
+    const reflection_table &table;
+    int level;
+    std::size_t nthreads;
+  };
+
+}}  // namespace dials::af
+
 namespace msgpack {
 MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
   namespace adaptor {
@@ -135,6 +163,196 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
       }
     };
 
+    /**
+     * Helper struct giving the filter used to compress a column type. By
+     * default the data is compressed without a filter.
+     */
+    template <typename T>
+    struct column_filter {
+      static std::string name() {
+        return "none";
+      }
+      static std::size_t word_size() {
+        return 1;
+      }
+    };
+
+    /**
+     * Integer columns are often sorted (e.g. id) so store the differences
+     */
+    template <>
+    struct column_filter<int> {
+      static std::string name() {
+        return "delta";
+      }
+      static std::size_t word_size() {
+        return sizeof(int);
+      }
+    };
+
+    template <>
+    struct column_filter<std::size_t> {
+      static std::string name() {
+        return "delta";
+      }
+      static std::size_t word_size() {
+        return sizeof(std::size_t);
+      }
+    };
+
+    /**
+     * Floating point and small integer array columns are byte shuffled
+     */
+    template <std::size_t W>
+    struct shuffle_column_filter {
+      static std::string name() {
+        return "shuffle";
+      }
+      static std::size_t word_size() {
+        return W;
+      }
+    };
+
+    template <>
+    struct column_filter<double> : shuffle_column_filter<sizeof(double)> {};
+
+    template <>
+    struct column_filter<scitbx::vec2<double> >
+        : shuffle_column_filter<sizeof(double)> {};
+
+    template <>
+    struct column_filter<scitbx::vec3<double> >
+        : shuffle_column_filter<sizeof(double)> {};
+
+    template <>
+    struct column_filter<scitbx::mat3<double> >
+        : shuffle_column_filter<sizeof(double)> {};
+
+    template <>
+    struct column_filter<scitbx::af::tiny<int, 6> >
+        : shuffle_column_filter<sizeof(int)> {};
+
+    template <>
+    struct column_filter<cctbx::miller::index<> >
+        : shuffle_column_filter<sizeof(int)> {};
+
+    /**
+     * Get the binary data of a column, which is either a msgpack bin or a map
+     * describing the compressed blocks of the data, like:
+     * {
+     *   "codec" : "zlib",
+     *   "filter" : FILTER,
+     *   "word_size" : WORD_SIZE,
+     *   "block_size" : BLOCK_SIZE,
+     *   "size" : SIZE,
+     *   "blocks" : [ BIN, BIN, ... ]
+     * }
+     * Uncompressed data is returned without a copy; compressed data is
+     * decompressed into the buffer, using a thread per block up to the number
+     * of cores.
+     * @param o The msgpack object
+     * @param buffer The buffer to decompress into
+     * @returns The pointer to and size of the data
+     */
+    inline std::pair<const char*, std::size_t> column_binary_data(
+      msgpack::object const& o,
+      std::vector<char>& buffer) {
+      if (o.type == msgpack::type::BIN) {
+        return std::make_pair(o.via.bin.ptr, (std::size_t)o.via.bin.size);
+      }
+      if (o.type != msgpack::type::MAP) {
+        throw DIALS_ERROR("column data: msgpack type is not BIN or MAP");
+      }
+      std::string codec;
+      std::string filter = "none";
+      std::size_t word_size = 1;
+      std::size_t block_size = dials::af::ColumnCodec::default_block_size();
+      std::size_t size = 0;
+      msgpack::object* blocks = NULL;
+      for (std::size_t i = 0; i < o.via.map.size; ++i) {
+        std::string key;
+        o.via.map.ptr[i].key.convert(key);
+        msgpack::object& value = o.via.map.ptr[i].val;
+        if (key == "codec") {
+          value.convert(codec);
+        } else if (key == "filter") {
+          value.convert(filter);
+        } else if (key == "word_size") {
+          value.convert(word_size);
+        } else if (key == "block_size") {
+          value.convert(block_size);
+        } else if (key == "size") {
+          value.convert(size);
+        } else if (key == "blocks") {
+          blocks = &value;
+        }
+      }
+      if (codec != "zlib") {
+        throw DIALS_ERROR("column data: unknown compression codec");
+      }
+      if (blocks == NULL || blocks->type != msgpack::type::ARRAY) {
+        throw DIALS_ERROR("column data: compressed blocks not found");
+      }
+      std::vector<const char*> block_data;
+      std::vector<std::size_t> block_sizes;
+      for (std::size_t i = 0; i < blocks->via.array.size; ++i) {
+        msgpack::object& block = blocks->via.array.ptr[i];
+        if (block.type != msgpack::type::BIN) {
+          throw DIALS_ERROR("column data: compressed block is not BIN");
+        }
+        block_data.push_back(block.via.bin.ptr);
+        block_sizes.push_back(block.via.bin.size);
+      }
+      dials::af::ColumnCodec column_codec(filter, word_size, block_size);
+      if (size == 0) {
+        return std::make_pair((const char*)NULL, size);
+      }
+      buffer.resize(size);
+      column_codec.decompress(
+        block_data,
+        block_sizes,
+        &buffer[0],
+        size,
+        dials::af::ColumnCodec::default_threads(block_data.size()));
+      return std::make_pair((const char*)&buffer[0], size);
+    }
+
+    /**
+     * Pack the binary data of a column as compressed blocks
+     * @param o The msgpack packer
+     * @param codec The codec to compress with
+     * @param data The data
+     * @param size The size of the data
+     * @param level The zlib compression level
+     * @param nthreads The number of threads
+     */
+    template <typename Stream>
+    void pack_compressed_binary_data(msgpack::packer<Stream>& o,
+                                     const dials::af::ColumnCodec& codec,
+                                     const char* data,
+                                     std::size_t size,
+                                     int level,
+                                     std::size_t nthreads) {
+      std::vector<std::string> blocks = codec.compress(data, size, level, nthreads);
+      o.pack_map(6);
+      o.pack("codec");
+      o.pack("zlib");
+      o.pack("filter");
+      o.pack(codec.filter());
+      o.pack("word_size");
+      o.pack(codec.word_size());
+      o.pack("block_size");
+      o.pack(codec.block_size());
+      o.pack("size");
+      o.pack(size);
+      o.pack("blocks");
+      o.pack_array(blocks.size());
+      for (std::size_t i = 0; i < blocks.size(); ++i) {
+        o.pack_bin(blocks[i].size());
+        o.pack_bin_body(blocks[i].c_str(), blocks[i].size());
+      }
+    }
+
     /**
      * A helper class to return size of an element
      */
@@ -187,6 +405,18 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
       msgpack::packer<Stream>& operator()(
         msgpack::packer<Stream>& o,
         const scitbx::af::const_ref<dials::af::Shoebox<T> >& v) const {
+        // Serialise the string to msgpack binary
+        std::string buffer_string = serialize(v);
+        o.pack_bin(buffer_string.size());
+        o.pack_bin_body(buffer_string.c_str(), buffer_string.size());
+        return o;
+      }
+
+      /**
+       * Write the shoeboxes to a binary string
+       */
+      static std::string serialize(
+        const scitbx::af::const_ref<dials::af::Shoebox<T> >& v) {
         typedef typename scitbx::af::const_ref<dials::af::Shoebox<T> >::const_iterator
           iterator;
         std::stringstream buffer;
@@ -231,16 +461,11 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
             write(buffer, (uint8_t)0);
           }
         }
-
-        // Serialise the string to msgpack binary
-        std::string buffer_string = buffer.str();
-        o.pack_bin(buffer_string.size());
-        o.pack_bin_body(buffer_string.c_str(), buffer_string.size());
-        return o;
+        return buffer.str();
       }
 
       template <typename Stream, typename ValueType>
-      void write(Stream& buffer, const ValueType& x) const {
+      static void write(Stream& buffer, const ValueType& x) {
         buffer.write((const char*)&x, sizeof(ValueType));
       }
     };
@@ -324,6 +549,58 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
       }
     };
 
+    /**
+     * A helper struct to give the binary data of a column
+     */
+    template <typename T>
+    struct column_binary {
+      column_binary(const scitbx::af::const_ref<T>& v)
+          : data(reinterpret_cast<const char*>(v.begin())),
+            size(v.size() * element_size_helper<T>::size()) {}
+      const char* data;
+      std::size_t size;
+    };
+
+    /**
+     * Shoeboxes are serialized to a buffer first
+     */
+    template <typename T>
+    struct column_binary<dials::af::Shoebox<T> > {
+      column_binary(const scitbx::af::const_ref<dials::af::Shoebox<T> >& v)
+          : buffer(pack<scitbx::af::const_ref<dials::af::Shoebox<T> > >::serialize(v)),
+            data(buffer.c_str()),
+            size(buffer.size()) {}
+      std::string buffer;
+      const char* data;
+      std::size_t size;
+    };
+
+    /**
+     * A visitor to help with packing a compressed column variant type.
+     * Pack the column into an array like: [ name, [ size, compressed data ] ]
+     */
+    template <typename Stream>
+    struct compressed_packer_visitor : boost::static_visitor<void> {
+      packer<Stream>& o_;
+      int level_;
+      std::size_t nthreads_;
+      compressed_packer_visitor(packer<Stream>& o, int level, std::size_t nthreads)
+          : o_(o), level_(level), nthreads_(nthreads) {}
+      template <typename T>
+      void operator()(T const& value) const {
+        typedef typename T::value_type value_type;
+        dials::af::ColumnCodec codec(column_filter<value_type>::name(),
+                                     column_filter<value_type>::word_size());
+        column_binary<value_type> binary(value.const_ref());
+        o_.pack_array(2);
+        o_.pack(column_type<value_type>::name());
+        o_.pack_array(2);
+        o_.pack(value.size());
+        pack_compressed_binary_data(
+          o_, codec, binary.data, binary.size, level_, nthreads_);
+      }
+    };
+
     /**
      * Pack the reflection table into an array with a map like:
      * [
@@ -347,6 +624,16 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
       template <typename Stream>
       msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o,
                                           const dials::af::reflection_table& v) const {
+        return pack_table(o, v, packer_visitor<Stream>(o));
+      }
+
+      /**
+       * Pack the table, using a visitor to pack each column
+       */
+      template <typename Stream, typename Visitor>
+      static msgpack::packer<Stream>& pack_table(msgpack::packer<Stream>& o,
+                                                 const dials::af::reflection_table& v,
+                                                 const Visitor& visitor) {
         typedef dials::af::reflection_table::const_iterator iterator;
         std::string filetype = "dials::af::reflection_table";
         std::size_t version = 1;
@@ -380,12 +667,29 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         o.pack_map(v.ncols());
         for (iterator it = v.begin(); it != v.end(); ++it) {
           o.pack(it->first);
-          boost::apply_visitor(packer_visitor<Stream>(o), it->second);
+          boost::apply_visitor(visitor, it->second);
         }
         return o;
       }
     };
 
+    /**
+     * Pack the reflection table like an uncompressed table, except that the
+     * binary data of each column is split into blocks which are filtered and
+     * compressed with zlib (see column_binary_data). The blocks are compressed
+     * in parallel.
+     */
+    template <>
+    struct pack<dials::af::compressed_reflection_table> {
+      template <typename Stream>
+      msgpack::packer<Stream>& operator()(
+        msgpack::packer<Stream>& o,
+        const dials::af::compressed_reflection_table& v) const {
+        return pack<dials::af::reflection_table>::pack_table(
+          o, v.table, compressed_packer_visitor<Stream>(o, v.level, v.nthreads));
+      }
+    };
+
     /**
      * Convert a msgpack array into a fixed size scitbx::af::ref
      */
@@ -393,14 +697,13 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
     struct convert<scitbx::af::ref<T> > {
       msgpack::object const& operator()(msgpack::object const& o,
                                         scitbx::af::ref<T>& v) const {
-        // Ensure the type is an array
-        if (o.type != msgpack::type::BIN) {
-          throw DIALS_ERROR("scitbx::af::ref: msgpack type is not BIN");
-        }
+        // Get the binary data, decompressing it if necessary
+        std::vector<char> buffer;
+        std::pair<const char*, std::size_t> binary = column_binary_data(o, buffer);
 
         // Compute the element and binary sizes
         std::size_t element_size = element_size_helper<T>::size();
-        std::size_t binary_size = o.via.bin.size;
+        std::size_t binary_size = binary.second;
         std::size_t num_elements = binary_size / element_size;
 
         // Check the sizes are consistent
@@ -416,7 +719,7 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         }
 
         // Copy the binary data
-        const T* first = reinterpret_cast<const T*>(o.via.bin.ptr);
+        const T* first = reinterpret_cast<const T*>(binary.first);
         const T* last = first + num_elements;
         std::copy(first, last, v.begin());
         return o;
@@ -436,15 +739,11 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         scitbx::af::ref<dials::af::Shoebox<T> >& v) const {
         typedef typename scitbx::af::ref<dials::af::Shoebox<T> >::iterator iterator;
 
-        // Ensure the type is an array
-        if (o.type != msgpack::type::BIN) {
-          throw DIALS_ERROR("scitbx::af::ref<Shoebox>: msgpack type is not BIN");
-        }
-
-        // Get the data and size
-        std::size_t binary_size = o.via.bin.size;
-        const char* binary_data = reinterpret_cast<const char*>(o.via.bin.ptr);
-        std::stringstream buffer(std::string(binary_data, binary_size));
+        // Get the data and size, decompressing it if necessary
+        std::vector<char> decompressed;
+        std::pair<const char*, std::size_t> binary =
+          column_binary_data(o, decompressed);
+        std::stringstream buffer(std::string(binary.first, binary.second));
 
         // Stream into shoeboxes
         for (iterator it = v.begin(); it != v.end(); ++it) {
@@ -711,6 +1010,22 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
     struct convert<dials::af::reflection_table> {
       msgpack::object const& operator()(msgpack::object const& o,
                                         dials::af::reflection_table& v) const {
+        read(o, v, NULL);
+        return o;
+      }
+
+      /**
+       * Read a reflection table, optionally with only some of its columns. The
+       * other columns are skipped without being converted, so when the msgpack
+       * object references the packed data only the requested columns are
+       * copied out of it.
+       * @param o The msgpack object
+       * @param v The reflection table
+       * @param columns The names of the columns to read, or NULL for all
+       */
+      static void read(msgpack::object const& o,
+                       dials::af::reflection_table& v,
+                       const std::set<std::string>* columns) {
         typedef dials::af::reflection_table::key_type key_type;
         typedef dials::af::reflection_table::mapped_type mapped_type;
 
@@ -827,13 +1142,15 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
           msgpack::object_kv* last = first + map_object->via.map.size;
           for (msgpack::object_kv* it = first; it != last; ++it) {
             key_type key;
-            mapped_type value;
             it->key.convert(key);
+            if (columns != NULL && columns->count(key) == 0) {
+              continue;
+            }
+            mapped_type value;
             it->val.convert(value);
             v[key] = value;
           }
         }
-        return o;
       }
     };
 
@@ -22,12 +22,15 @@
 #include <vector>
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
+#include <dials/model/data/shoebox_arena.h>
 #include <dials/array_family/reflection_table.h>
+#include <dials/util/work_stealing_thread_pool.h>
 
 namespace dials { namespace af {
 
   using model::Image;
   using model::Shoebox;
+  using model::ShoeboxArena;
   using model::Valid;
 
   /**
@@ -39,18 +42,22 @@ namespace dials { namespace af {
      * Initialise the index array. Determine which reflections are recorded on
      * each frame and panel ahead of time to enable quick lookup of the
      * reflections to be written to when processing each image.
+     *
+     * The reflections on each frame have disjoint pixel arrays, so the
+     * reflections of a frame are split between the threads when extracting.
      */
     ShoeboxExtractor(af::reflection_table data,
                      std::size_t npanels,
                      int frame0,
-                     int frame1)
+                     int frame1,
+                     std::size_t nthreads = 1)
         : npanels_(npanels),
           frame0_(frame0),
           frame1_(frame1),
           frame_(frame0),
-          nframes_(frame1 - frame0) {
-      DIALS_ASSERT(frame0_ < frame1_);
-      DIALS_ASSERT(npanels_ > 0);
+          nframes_(frame1 - frame0),
+          nthreads_(nthreads),
+          use_arena_(false) {
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.contains("panel"));
       DIALS_ASSERT(data.contains("bbox"));
@@ -58,35 +65,30 @@ namespace dials { namespace af {
       shoebox_ = data["shoebox"];
       af::const_ref<std::size_t> panel = data["panel"];
       af::const_ref<int6> bbox = data["bbox"];
-      std::size_t size = nframes_ * npanels_;
-      std::vector<std::size_t> num(size, 0);
-      std::vector<std::size_t> count(size, 0);
-      for (std::size_t i = 0; i < bbox.size(); ++i) {
-        DIALS_ASSERT(bbox[i][4] >= frame0_);
-        DIALS_ASSERT(bbox[i][5] <= frame1_);
-        DIALS_ASSERT(bbox[i][1] > bbox[i][0]);
-        DIALS_ASSERT(bbox[i][3] > bbox[i][2]);
-        DIALS_ASSERT(bbox[i][5] > bbox[i][4]);
-        for (int z = bbox[i][4]; z < bbox[i][5]; ++z) {
-          std::size_t j = panel[i] + (z - frame0_) * npanels_;
-          DIALS_ASSERT(j < num.size());
-          num[j]++;
-        }
-      }
-      offset_.push_back(0);
-      std::partial_sum(num.begin(), num.end(), std::back_inserter(offset_));
-      indices_.resize(offset_.back());
-      for (std::size_t i = 0; i < bbox.size(); ++i) {
-        for (int z = bbox[i][4]; z < bbox[i][5]; ++z) {
-          std::size_t j = panel[i] + (z - frame0_) * npanels_;
-          std::size_t k = offset_[j] + count[j];
-          DIALS_ASSERT(j < count.size());
-          DIALS_ASSERT(k < indices_.size());
-          indices_[k] = i;
-          count[j]++;
-        }
-      }
-      DIALS_ASSERT(count == num);
+      bbox_ = af::shared<int6>(bbox.begin(), bbox.end());
+      init(panel, bbox);
+    }
+
+    /**
+     * Initialise the index array to extract the pixels into a column of
+     * shoeboxes held in contiguous arrays
+     */
+    ShoeboxExtractor(ShoeboxArena<> arena,
+                     std::size_t npanels,
+                     int frame0,
+                     int frame1,
+                     std::size_t nthreads = 1)
+        : npanels_(npanels),
+          frame0_(frame0),
+          frame1_(frame1),
+          frame_(frame0),
+          nframes_(frame1 - frame0),
+          nthreads_(nthreads),
+          arena_(arena),
+          bbox_(arena.bounding_boxes()),
+          use_arena_(true) {
+      af::shared<std::size_t> panel = arena.panels();
+      init(panel.const_ref(), bbox_.const_ref());
     }
 
     /**
@@ -96,53 +98,16 @@ namespace dials { namespace af {
      */
     template <typename T>
     void next(const Image<T>& image) {
-      typedef Shoebox<>::float_type float_type;
-      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
-      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
       DIALS_ASSERT(frame_ >= frame0_ && frame_ < frame1_);
       DIALS_ASSERT(image.npanels() == npanels_);
       for (std::size_t p = 0; p < image.npanels(); ++p) {
-        af::const_ref<std::size_t> ind = indices(frame_, p);
-        af::const_ref<T, af::c_grid<2> > data = image.data(p);
-        af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-        for (std::size_t i = 0; i < ind.size(); ++i) {
-          DIALS_ASSERT(ind[i] < shoebox_.size());
-          Shoebox<>& sbox = shoebox_[ind[i]];
-          int6 b = sbox.bbox;
-          sbox_data_type sdata = sbox.data.ref();
-          sbox_mask_type smask = sbox.mask.ref();
-          DIALS_ASSERT(b[1] > b[0]);
-          DIALS_ASSERT(b[3] > b[2]);
-          DIALS_ASSERT(b[5] > b[4]);
-          DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
-          int x0 = b[0];
-          int x1 = b[1];
-          int y0 = b[2];
-          int y1 = b[3];
-          int z0 = b[4];
-          std::size_t xs = x1 - x0;
-          std::size_t ys = y1 - y0;
-          std::size_t z = frame_ - z0;
-          std::size_t yi = data.accessor()[0];
-          std::size_t xi = data.accessor()[1];
-          int xb = x0 >= 0 ? 0 : std::abs(x0);
-          int yb = y0 >= 0 ? 0 : std::abs(y0);
-          int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
-          int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
-          DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
-          DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
-          DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
-          DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
-          DIALS_ASSERT(sbox.is_consistent());
-          for (std::size_t y = yb; y < ye; ++y) {
-            for (std::size_t x = xb; x < xe; ++x) {
-              sdata(z, y, x) = data(y + y0, x + x0);
-              smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
-            }
-          }
-        }
+        DIALS_ASSERT(image.data(p).accessor().all_eq(image.mask(p).accessor()));
       }
+      std::size_t j0 = (frame_ - frame0_) * npanels_;
+      std::size_t k0 = offset_[j0];
+      std::size_t k1 = offset_[j0 + npanels_];
+      dials::util::parallel_for(
+        k1 - k0, nthreads_, ExtractJob<T>(this, &image, j0, k0));
       frame_++;
     }
 
@@ -171,6 +136,11 @@ namespace dials { namespace af {
       return npanels_;
     }
 
+    /** @returns The number of threads */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
     /**
      * @returns Is the extraction finished.
      */
@@ -179,6 +149,143 @@ namespace dials { namespace af {
     }
 
   private:
+    /**
+     * Extract the pixels of a range of the entries of the index for the
+     * current frame. The entries are ordered by panel.
+     */
+    template <typename T>
+    struct ExtractJob {
+      ShoeboxExtractor* self;
+      const Image<T>* image;
+      std::size_t j0;
+      std::size_t k0;
+
+      ExtractJob(ShoeboxExtractor* self_,
+                 const Image<T>* image_,
+                 std::size_t j0_,
+                 std::size_t k0_)
+          : self(self_), image(image_), j0(j0_), k0(k0_) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const std::vector<std::size_t>& offset = self->offset_;
+        std::size_t p = 0;
+        for (std::size_t k = k0 + first; k < k0 + last; ++k) {
+          while (offset[j0 + p + 1] <= k) {
+            p++;
+          }
+          self->extract_one(image->data(p), image->mask(p), self->indices_[k]);
+        }
+      }
+    };
+
+    /**
+     * Copy the pixels of the current frame to a shoebox
+     * @param data The image data
+     * @param mask The image mask
+     * @param index The index of the shoebox
+     */
+    template <typename T>
+    void extract_one(const af::const_ref<T, af::c_grid<2> >& data,
+                     const af::const_ref<bool, af::c_grid<2> >& mask,
+                     std::size_t index) {
+      DIALS_ASSERT(index < bbox_.size());
+      if (use_arena_) {
+        extract(data, mask, bbox_[index], arena_.data(index), arena_.mask(index));
+      } else {
+        Shoebox<>& sbox = shoebox_[index];
+        DIALS_ASSERT(sbox.is_consistent());
+        extract(data, mask, sbox.bbox, sbox.data.ref(), sbox.mask.ref());
+      }
+    }
+
+    /**
+     * Determine which reflections are recorded on each frame and panel
+     * @param panel The panel of each reflection
+     * @param bbox The bounding box of each reflection
+     */
+    void init(const af::const_ref<std::size_t>& panel,
+              const af::const_ref<int6>& bbox) {
+      DIALS_ASSERT(frame0_ < frame1_);
+      DIALS_ASSERT(npanels_ > 0);
+      DIALS_ASSERT(nthreads_ > 0);
+      DIALS_ASSERT(panel.size() == bbox.size());
+      std::size_t size = nframes_ * npanels_;
+      std::vector<std::size_t> num(size, 0);
+      std::vector<std::size_t> count(size, 0);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        DIALS_ASSERT(bbox[i][4] >= frame0_);
+        DIALS_ASSERT(bbox[i][5] <= frame1_);
+        DIALS_ASSERT(bbox[i][1] > bbox[i][0]);
+        DIALS_ASSERT(bbox[i][3] > bbox[i][2]);
+        DIALS_ASSERT(bbox[i][5] > bbox[i][4]);
+        for (int z = bbox[i][4]; z < bbox[i][5]; ++z) {
+          std::size_t j = panel[i] + (z - frame0_) * npanels_;
+          DIALS_ASSERT(j < num.size());
+          num[j]++;
+        }
+      }
+      offset_.push_back(0);
+      std::partial_sum(num.begin(), num.end(), std::back_inserter(offset_));
+      indices_.resize(offset_.back());
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        for (int z = bbox[i][4]; z < bbox[i][5]; ++z) {
+          std::size_t j = panel[i] + (z - frame0_) * npanels_;
+          std::size_t k = offset_[j] + count[j];
+          DIALS_ASSERT(j < count.size());
+          DIALS_ASSERT(k < indices_.size());
+          indices_[k] = i;
+          count[j]++;
+        }
+      }
+      DIALS_ASSERT(count == num);
+    }
+
+    /**
+     * Copy the pixels of the current frame to the arrays of a shoebox
+     * @param data The image data
+     * @param mask The image mask
+     * @param b The bounding box of the shoebox
+     * @param sdata The shoebox data
+     * @param smask The shoebox mask
+     */
+    template <typename T>
+    void extract(const af::const_ref<T, af::c_grid<2> >& data,
+                 const af::const_ref<bool, af::c_grid<2> >& mask,
+                 const int6& b,
+                 af::ref<Shoebox<>::float_type, af::c_grid<3> > sdata,
+                 af::ref<int, af::c_grid<3> > smask) const {
+      DIALS_ASSERT(b[1] > b[0]);
+      DIALS_ASSERT(b[3] > b[2]);
+      DIALS_ASSERT(b[5] > b[4]);
+      DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
+      int x0 = b[0];
+      int x1 = b[1];
+      int y0 = b[2];
+      int y1 = b[3];
+      int z0 = b[4];
+      std::size_t xs = x1 - x0;
+      std::size_t ys = y1 - y0;
+      std::size_t z = frame_ - z0;
+      std::size_t yi = data.accessor()[0];
+      std::size_t xi = data.accessor()[1];
+      int xb = x0 >= 0 ? 0 : std::abs(x0);
+      int yb = y0 >= 0 ? 0 : std::abs(y0);
+      int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
+      int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
+      DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
+      DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
+      DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
+      DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
+      DIALS_ASSERT(sdata.accessor().all_eq(int3(b[5] - b[4], ys, xs)));
+      DIALS_ASSERT(smask.accessor().all_eq(sdata.accessor()));
+      for (std::size_t y = yb; y < ye; ++y) {
+        for (std::size_t x = xb; x < xe; ++x) {
+          sdata(z, y, x) = data(y + y0, x + x0);
+          smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
+        }
+      }
+    }
+
     /**
      * Get an index array specifying which reflections are recorded on a given
      * frame and panel.
@@ -204,7 +311,11 @@ namespace dials { namespace af {
     int frame1_;
     int frame_;
     std::size_t nframes_;
+    std::size_t nthreads_;
     af::shared<Shoebox<> > shoebox_;
+    ShoeboxArena<> arena_;
+    af::shared<int6> bbox_;
+    bool use_arena_;
     std::vector<std::size_t> indices_;
     std::vector<std::size_t> offset_;
   };
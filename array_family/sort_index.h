@@ -12,6 +12,13 @@
 #define DIALS_ARRAY_FAMILY_SORT_INDEX_H
 
 #include <algorithm>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
 
 namespace dials { namespace af {
 
@@ -39,6 +46,244 @@ namespace dials { namespace af {
     std::sort(begin, end, index_less<RandomAccessIterator>(v));
   }
 
+  namespace detail {
+
+    /**
+     * Stable sort blocks of an index array
+     */
+    template <typename Compare>
+    struct stable_sort_blocks_job {
+      std::size_t *index;
+      const std::vector<std::size_t> *bounds;
+      Compare compare;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t k = first; k < last; ++k) {
+          std::stable_sort(
+            index + (*bounds)[k], index + (*bounds)[k + 1], compare);
+        }
+      }
+    };
+
+    /**
+     * Merge pairs of adjacent sorted runs of an index array
+     */
+    template <typename Compare>
+    struct merge_runs_job {
+      const std::size_t *input;
+      std::size_t *output;
+      const std::vector<std::size_t> *bounds;
+      std::size_t width;
+      Compare compare;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t nblocks = bounds->size() - 1;
+        for (std::size_t k = first; k < last; ++k) {
+          std::size_t a = std::min(2 * k * width, nblocks);
+          std::size_t b = std::min(a + width, nblocks);
+          std::size_t c = std::min(b + width, nblocks);
+          std::merge(input + (*bounds)[a],
+                     input + (*bounds)[b],
+                     input + (*bounds)[b],
+                     input + (*bounds)[c],
+                     output + (*bounds)[a],
+                     compare);
+        }
+      }
+    };
+
+    /**
+     * Count the digits of the keys in blocks of rows for a radix sort pass
+     */
+    template <typename Key>
+    struct radix_count_job {
+      const Key *keys;
+      const std::vector<std::size_t> *bounds;
+      std::size_t shift;
+      std::size_t *counts;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t k = first; k < last; ++k) {
+          std::size_t *c = counts + k * 256;
+          for (std::size_t i = (*bounds)[k]; i < (*bounds)[k + 1]; ++i) {
+            c[(keys[i] >> shift) & 0xff]++;
+          }
+        }
+      }
+    };
+
+    /**
+     * Move the keys and indices of blocks of rows to their place after a
+     * radix sort pass
+     */
+    template <typename Key>
+    struct radix_scatter_job {
+      const Key *keys;
+      const std::size_t *index;
+      Key *keys_out;
+      std::size_t *index_out;
+      const std::vector<std::size_t> *bounds;
+      std::size_t shift;
+      const std::size_t *offsets;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::vector<std::size_t> offset;
+        for (std::size_t k = first; k < last; ++k) {
+          offset.assign(offsets + k * 256, offsets + k * 256 + 256);
+          for (std::size_t i = (*bounds)[k]; i < (*bounds)[k + 1]; ++i) {
+            std::size_t j = offset[(keys[i] >> shift) & 0xff]++;
+            keys_out[j] = keys[i];
+            index_out[j] = index[i];
+          }
+        }
+      }
+    };
+
+    /**
+     * Split a number of rows into a number of blocks depending on the number
+     * of threads, so that the result does not depend on how the blocks are
+     * shared between the threads.
+     */
+    inline std::vector<std::size_t> block_bounds(std::size_t size,
+                                                 std::size_t nthreads) {
+      const std::size_t min_block_size = 1 << 14;
+      std::size_t nblocks =
+        std::max(std::size_t(1), std::min(nthreads, size / min_block_size));
+      std::vector<std::size_t> bounds(nblocks + 1);
+      for (std::size_t k = 0; k <= nblocks; ++k) {
+        bounds[k] = (k * size) / nblocks;
+      }
+      return bounds;
+    }
+
+    /**
+     * Map a key to an unsigned integer with the same order
+     */
+    template <typename Key>
+    boost::uint64_t radix_key(Key x) {
+      typedef typename boost::make_unsigned<Key>::type unsigned_type;
+      unsigned_type u = static_cast<unsigned_type>(x);
+      if (boost::is_signed<Key>::value) {
+        u ^= unsigned_type(1) << (8 * sizeof(unsigned_type) - 1);
+      }
+      return u;
+    }
+
+  }  // namespace detail
+
+  /**
+   * Stable sort an index array with a comparison functor using a parallel
+   * merge sort. Blocks of the array are sorted on separate threads and then
+   * merged in pairs until one sorted run is left.
+   * @param index The index array
+   * @param size The size of the index array
+   * @param compare The comparison functor of two indices
+   * @param nthreads The number of threads
+   */
+  template <typename Compare>
+  void parallel_stable_sort(std::size_t *index,
+                            std::size_t size,
+                            Compare compare,
+                            std::size_t nthreads) {
+    DIALS_ASSERT(nthreads > 0);
+    std::vector<std::size_t> bounds = detail::block_bounds(size, nthreads);
+    std::size_t nblocks = bounds.size() - 1;
+    detail::stable_sort_blocks_job<Compare> sort_job = {index, &bounds, compare};
+    dials::util::parallel_for(nblocks, nthreads, sort_job);
+    if (nblocks == 1) {
+      return;
+    }
+    std::vector<std::size_t> buffer(size);
+    std::size_t *input = index;
+    std::size_t *output = &buffer[0];
+    for (std::size_t width = 1; width < nblocks; width *= 2) {
+      std::size_t npairs = (nblocks + 2 * width - 1) / (2 * width);
+      detail::merge_runs_job<Compare> merge_job = {
+        input, output, &bounds, width, compare};
+      dials::util::parallel_for(npairs, nthreads, merge_job);
+      std::swap(input, output);
+    }
+    if (input != index) {
+      std::copy(input, input + size, index);
+    }
+  }
+
+  /**
+   * Compute the stable sort permutation of an array of integers using a
+   * parallel least significant digit radix sort. Each pass sorts by one byte
+   * of the keys; passes where every key has the same byte are skipped.
+   * @param keys The integer keys
+   * @param reverse Sort in descending rather than ascending order
+   * @param nthreads The number of threads
+   * @returns The permutation
+   */
+  template <typename Key>
+  af::shared<std::size_t> radix_sort_permutation(const af::const_ref<Key> &keys,
+                                                 bool reverse,
+                                                 std::size_t nthreads) {
+    typedef boost::uint64_t key_type;
+    DIALS_ASSERT(nthreads > 0);
+    std::size_t size = keys.size();
+    std::vector<key_type> k(size), k2(size);
+    af::shared<std::size_t> result(size);
+    std::vector<std::size_t> index2(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      k[i] = detail::radix_key(keys[i]);
+      if (reverse) {
+        k[i] = ~k[i];
+      }
+      result[i] = i;
+    }
+    if (size == 0) {
+      return result;
+    }
+    std::vector<std::size_t> bounds = detail::block_bounds(size, nthreads);
+    std::size_t nblocks = bounds.size() - 1;
+    std::vector<std::size_t> counts(nblocks * 256);
+    key_type *keys_in = &k[0];
+    key_type *keys_out = &k2[0];
+    std::size_t *index_in = &result[0];
+    std::size_t *index_out = &index2[0];
+    for (std::size_t shift = 0; shift < 8 * sizeof(Key); shift += 8) {
+      std::fill(counts.begin(), counts.end(), 0);
+      detail::radix_count_job<key_type> count_job = {
+        keys_in, &bounds, shift, &counts[0]};
+      dials::util::parallel_for(nblocks, nthreads, count_job);
+
+      // Skip the pass if all the keys are in one bucket
+      bool skip = false;
+      for (std::size_t d = 0; d < 256 && !skip; ++d) {
+        std::size_t total = 0;
+        for (std::size_t b = 0; b < nblocks; ++b) {
+          total += counts[b * 256 + d];
+        }
+        skip = (total == size);
+      }
+      if (skip) {
+        continue;
+      }
+
+      // Turn the counts into the offset of each digit in each block
+      std::size_t offset = 0;
+      for (std::size_t d = 0; d < 256; ++d) {
+        for (std::size_t b = 0; b < nblocks; ++b) {
+          std::size_t count = counts[b * 256 + d];
+          counts[b * 256 + d] = offset;
+          offset += count;
+        }
+      }
+      detail::radix_scatter_job<key_type> scatter_job = {
+        keys_in, index_in, keys_out, index_out, &bounds, shift, &counts[0]};
+      dials::util::parallel_for(nblocks, nthreads, scatter_job);
+      std::swap(keys_in, keys_out);
+      std::swap(index_in, index_out);
+    }
+    if (index_in != &result[0]) {
+      std::copy(index_in, index_in + size, result.begin());
+    }
+    return result;
+  }
+
 }}  // namespace dials::af
 
 #endif /* DIALS_ARRAY_FAMILY_SORT_INDEX_H */
@@ -0,0 +1,500 @@
+/*
+ * benchmark.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_BENCHMARKS_BENCHMARK_H
+#define DIALS_BENCHMARKS_BENCHMARK_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread.hpp>
+#include <dials/error.h>
+
+namespace dials { namespace benchmark {
+
+  /**
+   * Stop the compiler from optimising away the computation of a value
+   * @param value The value
+   */
+  template <typename T>
+  inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const void *volatile sink;
+    sink = &value;
+#endif
+  }
+
+  /**
+   * The state of a benchmark while it is run. As with Google Benchmark, a
+   * benchmark is a function which does its setup and then times the loop
+   *
+   *  while (state.keep_running()) {
+   *    ...
+   *  }
+   *
+   * Work done inside the loop which should not be timed, such as resetting
+   * the input, can be done between pause_timing and resume_timing.
+   */
+  class State {
+  public:
+    /**
+     * @param max_iterations The number of iterations to run
+     * @param arg The argument of the benchmark, e.g. a number of threads
+     */
+    State(std::size_t max_iterations, int arg)
+        : max_iterations_(max_iterations),
+          arg_(arg),
+          iterations_(0),
+          running_(false),
+          real_time_(0),
+          cpu_time_(0),
+          items_processed_(0),
+          bytes_processed_(0) {}
+
+    /**
+     * @returns True until the requested number of iterations have been run
+     */
+    bool keep_running() {
+      if (iterations_ == 0) {
+        resume_timing();
+      }
+      if (iterations_ < max_iterations_) {
+        iterations_++;
+        return true;
+      }
+      pause_timing();
+      return false;
+    }
+
+    /** Stop the timer */
+    void pause_timing() {
+      DIALS_ASSERT(running_);
+      real_time_ += (now() - real_start_).total_microseconds() * 1e-6;
+      cpu_time_ += (double)(std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+      running_ = false;
+    }
+
+    /** Restart the timer */
+    void resume_timing() {
+      DIALS_ASSERT(!running_);
+      real_start_ = now();
+      cpu_start_ = std::clock();
+      running_ = true;
+    }
+
+    /**
+     * Set the number of items processed by all the iterations
+     * @param items The number of items
+     */
+    void set_items_processed(double items) {
+      items_processed_ = items;
+    }
+
+    /**
+     * Set the number of bytes processed by all the iterations
+     * @param bytes The number of bytes
+     */
+    void set_bytes_processed(double bytes) {
+      bytes_processed_ = bytes;
+    }
+
+    /** @returns The argument of the benchmark */
+    int arg() const {
+      return arg_;
+    }
+
+    /** @returns The number of iterations run */
+    std::size_t iterations() const {
+      return iterations_;
+    }
+
+    /** @returns The number of iterations to run */
+    std::size_t max_iterations() const {
+      return max_iterations_;
+    }
+
+    /** @returns The elapsed time of the iterations in seconds */
+    double real_time() const {
+      return real_time_;
+    }
+
+    /** @returns The processor time of the iterations in seconds */
+    double cpu_time() const {
+      return cpu_time_;
+    }
+
+    /** @returns The number of items processed */
+    double items_processed() const {
+      return items_processed_;
+    }
+
+    /** @returns The number of bytes processed */
+    double bytes_processed() const {
+      return bytes_processed_;
+    }
+
+  private:
+    static boost::posix_time::ptime now() {
+      return boost::posix_time::microsec_clock::universal_time();
+    }
+
+    std::size_t max_iterations_;
+    int arg_;
+    std::size_t iterations_;
+    bool running_;
+    boost::posix_time::ptime real_start_;
+    std::clock_t cpu_start_;
+    double real_time_;
+    double cpu_time_;
+    double items_processed_;
+    double bytes_processed_;
+  };
+
+  /**
+   * The result of one run or the aggregate of the repetitions of a benchmark
+   */
+  struct Result {
+    std::string name;
+    std::string run_type;
+    std::string aggregate_name;
+    std::size_t repetitions;
+    std::size_t repetition_index;
+    std::size_t iterations;
+    double real_time;
+    double cpu_time;
+    double items_per_second;
+    double bytes_per_second;
+  };
+
+  /**
+   * Run a set of benchmarks and report their timings. Each benchmark is run
+   * for enough iterations to take at least the minimum time, and then the
+   * time per iteration is reported in nanoseconds. The results can be written
+   * as JSON in the same layout as Google Benchmark, so the usual tools for
+   * comparing runs can be used on them.
+   */
+  class Runner {
+  public:
+    typedef void (*Function)(State &);
+
+    Runner() : min_time_(0.5), repetitions_(1), json_(false), list_only_(false) {}
+
+    /**
+     * Read the options from the command line. The options are those of Google
+     * Benchmark, except that the filter is a substring of the name rather than
+     * a regular expression:
+     *
+     *  --benchmark_filter=<text>     Only run benchmarks with text in the name
+     *  --benchmark_min_time=<s>      The minimum time of each run in seconds
+     *  --benchmark_repetitions=<n>   The number of runs of each benchmark
+     *  --benchmark_format=<format>   Print the results as console or json
+     *  --benchmark_out=<filename>    Write the JSON results to the file
+     *  --benchmark_list_tests        Only list the names of the benchmarks
+     *
+     * @param argc The number of arguments
+     * @param argv The arguments
+     */
+    void parse(int argc, char **argv) {
+      executable_ = argc > 0 ? argv[0] : "";
+      for (int i = 1; i < argc; ++i) {
+        std::string option(argv[i]);
+        std::string value;
+        if (match(option, "--benchmark_filter=", value)) {
+          filter_ = value;
+        } else if (match(option, "--benchmark_min_time=", value)) {
+          min_time_ = std::atof(value.c_str());
+          DIALS_ASSERT(min_time_ > 0);
+        } else if (match(option, "--benchmark_repetitions=", value)) {
+          int repetitions = std::atoi(value.c_str());
+          DIALS_ASSERT(repetitions > 0);
+          repetitions_ = repetitions;
+        } else if (match(option, "--benchmark_format=", value)) {
+          DIALS_ASSERT(value == "console" || value == "json");
+          json_ = value == "json";
+        } else if (match(option, "--benchmark_out=", value)) {
+          output_ = value;
+        } else if (option == "--benchmark_list_tests") {
+          list_only_ = true;
+        } else {
+          throw DIALS_ERROR("Unknown option: " + option);
+        }
+      }
+    }
+
+    /**
+     * Add a benchmark
+     * @param name The name of the benchmark
+     * @param function The benchmark function
+     */
+    void add(const std::string &name, Function function) {
+      Benchmark benchmark = {name, function, 0};
+      benchmarks_.push_back(benchmark);
+    }
+
+    /**
+     * Add a benchmark with an argument, named name/arg
+     * @param name The name of the benchmark
+     * @param function The benchmark function
+     * @param arg The argument
+     */
+    void add(const std::string &name, Function function, int arg) {
+      std::ostringstream full_name;
+      full_name << name << "/" << arg;
+      Benchmark benchmark = {full_name.str(), function, arg};
+      benchmarks_.push_back(benchmark);
+    }
+
+    /**
+     * Run the benchmarks matching the filter, printing a table of the results
+     * as they finish. The table is printed to stderr when the JSON results are
+     * printed to stdout.
+     */
+    void run() {
+      std::ostream &out = json_ && !list_only_ ? std::cerr : std::cout;
+      results_.clear();
+      for (std::size_t i = 0; i < benchmarks_.size(); ++i) {
+        const Benchmark &benchmark = benchmarks_[i];
+        if (benchmark.name.find(filter_) == std::string::npos) {
+          continue;
+        }
+        if (list_only_) {
+          out << benchmark.name << std::endl;
+          continue;
+        }
+        std::vector<Result> runs;
+        for (std::size_t r = 0; r < repetitions_; ++r) {
+          runs.push_back(run_once(benchmark, r));
+          print(out, runs.back());
+        }
+        results_.insert(results_.end(), runs.begin(), runs.end());
+        if (repetitions_ > 1) {
+          add_aggregates(runs, out);
+        }
+      }
+    }
+
+    /**
+     * Write the results as JSON to stdout and the output file, if requested
+     */
+    void write() const {
+      if (list_only_) {
+        return;
+      }
+      if (json_) {
+        write_json(std::cout);
+      }
+      if (!output_.empty()) {
+        std::ofstream outfile(output_.c_str());
+        DIALS_ASSERT(outfile.good());
+        write_json(outfile);
+      }
+    }
+
+    /**
+     * Write the results as JSON
+     * @param out The output stream
+     */
+    void write_json(std::ostream &out) const {
+      char date[64];
+      std::time_t t = std::time(NULL);
+      std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+      out << "{\n";
+      out << "  \"context\": {\n";
+      out << "    \"date\": " << quote(date) << ",\n";
+      out << "    \"executable\": " << quote(executable_) << ",\n";
+      out << "    \"num_cpus\": " << boost::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+      out << "    \"library_build_type\": \"release\"\n";
+#else
+      out << "    \"library_build_type\": \"debug\"\n";
+#endif
+      out << "  },\n";
+      out << "  \"benchmarks\": [";
+      for (std::size_t i = 0; i < results_.size(); ++i) {
+        const Result &r = results_[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\n";
+        out << "      \"name\": " << quote(full_name(r)) << ",\n";
+        out << "      \"run_name\": " << quote(r.name) << ",\n";
+        out << "      \"run_type\": " << quote(r.run_type) << ",\n";
+        out << "      \"repetitions\": " << r.repetitions << ",\n";
+        out << "      \"repetition_index\": " << r.repetition_index << ",\n";
+        if (r.run_type == "aggregate") {
+          out << "      \"aggregate_name\": " << quote(r.aggregate_name) << ",\n";
+        }
+        out << "      \"iterations\": " << r.iterations << ",\n";
+        out << std::setprecision(10);
+        out << "      \"real_time\": " << r.real_time << ",\n";
+        out << "      \"cpu_time\": " << r.cpu_time << ",\n";
+        if (r.bytes_per_second > 0) {
+          out << "      \"bytes_per_second\": " << r.bytes_per_second << ",\n";
+        }
+        if (r.items_per_second > 0) {
+          out << "      \"items_per_second\": " << r.items_per_second << ",\n";
+        }
+        out << "      \"time_unit\": \"ns\"\n";
+        out << "    }";
+      }
+      out << "\n  ]\n";
+      out << "}\n";
+    }
+
+  private:
+    struct Benchmark {
+      std::string name;
+      Function function;
+      int arg;
+    };
+
+    /**
+     * Run a benchmark, increasing the number of iterations until the run
+     * takes at least the minimum time
+     */
+    Result run_once(const Benchmark &benchmark, std::size_t index) const {
+      std::size_t iterations = 1;
+      for (;;) {
+        State state(iterations, benchmark.arg);
+        benchmark.function(state);
+        DIALS_ASSERT(state.iterations() == iterations);
+        double elapsed = state.real_time();
+        if (elapsed >= min_time_ || iterations >= max_iterations) {
+          Result result;
+          result.name = benchmark.name;
+          result.run_type = "iteration";
+          result.repetitions = repetitions_;
+          result.repetition_index = index;
+          result.iterations = iterations;
+          result.real_time = 1e9 * elapsed / iterations;
+          result.cpu_time = 1e9 * state.cpu_time() / iterations;
+          result.items_per_second = state.items_processed() / elapsed;
+          result.bytes_per_second = state.bytes_processed() / elapsed;
+          return result;
+        }
+
+        // Predict the number of iterations needed from this run, growing by
+        // at most 10 times in case the run was too short to time well
+        double multiplier = 10;
+        if (elapsed > 0.1 * min_time_) {
+          multiplier = std::max(1.4 * min_time_ / elapsed, 1.1);
+        }
+        iterations = std::min(
+          max_iterations,
+          std::max(iterations + 1, (std::size_t)std::ceil(iterations * multiplier)));
+      }
+    }
+
+    /**
+     * Add the mean, median and standard deviation of the repetitions
+     */
+    void add_aggregates(const std::vector<Result> &runs, std::ostream &out) {
+      const char *names[] = {"mean", "median", "stddev"};
+      for (std::size_t i = 0; i < 3; ++i) {
+        Result result = runs[0];
+        result.run_type = "aggregate";
+        result.aggregate_name = names[i];
+        result.repetition_index = 0;
+        result.iterations = runs.size();
+        result.real_time = aggregate(runs, &Result::real_time, names[i]);
+        result.cpu_time = aggregate(runs, &Result::cpu_time, names[i]);
+        result.items_per_second = aggregate(runs, &Result::items_per_second, names[i]);
+        result.bytes_per_second = aggregate(runs, &Result::bytes_per_second, names[i]);
+        results_.push_back(result);
+        print(out, result);
+      }
+    }
+
+    static double aggregate(const std::vector<Result> &runs,
+                            double Result::*member,
+                            const std::string &name) {
+      std::vector<double> values;
+      for (std::size_t i = 0; i < runs.size(); ++i) {
+        values.push_back(runs[i].*member);
+      }
+      double mean = 0;
+      for (std::size_t i = 0; i < values.size(); ++i) {
+        mean += values[i];
+      }
+      mean /= values.size();
+      if (name == "mean") {
+        return mean;
+      }
+      if (name == "median") {
+        std::sort(values.begin(), values.end());
+        std::size_t n = values.size();
+        return n % 2 == 1 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+      }
+      double sum_sq = 0;
+      for (std::size_t i = 0; i < values.size(); ++i) {
+        sum_sq += (values[i] - mean) * (values[i] - mean);
+      }
+      return values.size() > 1 ? std::sqrt(sum_sq / (values.size() - 1)) : 0;
+    }
+
+    static void print(std::ostream &out, const Result &r) {
+      out << std::left << std::setw(48) << full_name(r) << std::right << std::fixed
+          << std::setprecision(0) << std::setw(15) << r.real_time << " ns"
+          << std::setw(15) << r.cpu_time << " ns" << std::setw(12) << r.iterations;
+      if (r.items_per_second > 0) {
+        out << std::scientific << std::setprecision(3) << "  items/s="
+            << r.items_per_second;
+      }
+      out << std::endl;
+      out.unsetf(std::ios::floatfield);
+    }
+
+    static std::string full_name(const Result &r) {
+      return r.run_type == "aggregate" ? r.name + "_" + r.aggregate_name : r.name;
+    }
+
+    static bool match(const std::string &option,
+                      const std::string &prefix,
+                      std::string &value) {
+      if (option.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+      }
+      value = option.substr(prefix.size());
+      return true;
+    }
+
+    static std::string quote(const std::string &text) {
+      std::string result = "\"";
+      for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '"' || text[i] == '\\') {
+          result += '\\';
+        }
+        result += text[i];
+      }
+      return result + "\"";
+    }
+
+    static const std::size_t max_iterations = 1000000000;
+
+    std::vector<Benchmark> benchmarks_;
+    std::vector<Result> results_;
+    std::string executable_;
+    std::string filter_;
+    std::string output_;
+    double min_time_;
+    std::size_t repetitions_;
+    bool json_;
+    bool list_only_;
+  };
+
+}}  // namespace dials::benchmark
+
+#endif  // DIALS_BENCHMARKS_BENCHMARK_H
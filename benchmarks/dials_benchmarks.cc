@@ -0,0 +1,497 @@
+/*
+ * dials_benchmarks.cc
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+/**
+ * Microbenchmarks of the C++ kernels used in spot finding, integration and
+ * reading and writing reflection files. The inputs are synthetic and made
+ * from fixed seeds, so the timings of different builds and releases can be
+ * compared directly. The usual Google Benchmark options are accepted, e.g.
+ *
+ *  dials_benchmarks --benchmark_format=json --benchmark_out=results.json
+ *
+ * The benchmarks named name/n use n threads.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
+#include <msgpack.hpp>
+#include <scitbx/constants.h>
+#include <scitbx/mat3.h>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/array_family/tiny_types.h>
+#include <scitbx/math/r3_rotation.h>
+#include <cctbx/sgtbx/space_group_type.h>
+#include <dxtbx/model/beam.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/model/goniometer.h>
+#include <dxtbx/model/panel.h>
+#include <dxtbx/model/scan.h>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/reflection_table_msgpack_adapter.h>
+#include <dials/array_family/boost_python/flex_table_suite.h>
+#include <dials/algorithms/background/glm/creator.h>
+#include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/integration/fit/fitting.h>
+#include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/transform/transform.h>
+#include <dials/algorithms/shoebox/find_overlapping.h>
+#include <dials/algorithms/spot_prediction/reeke_index_generator.h>
+#include <dials/model/data/mask_code.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/benchmarks/benchmark.h>
+#include <dials/error.h>
+
+using dials::benchmark::do_not_optimize;
+using dials::benchmark::Runner;
+using dials::benchmark::State;
+
+namespace af = dials::af;
+namespace flex_table_suite = dials::af::boost_python::flex_table_suite;
+namespace gaussian_rs = dials::algorithms::profile_model::gaussian_rs;
+
+using dials::algorithms::DispersionThreshold;
+using dials::algorithms::GLMBackgroundCreator;
+using dials::algorithms::LabelImageStack;
+using dials::algorithms::ProfileFitter;
+using dials::algorithms::ReekeIndexGenerator;
+using dials::model::Background;
+using dials::model::Shoebox;
+using dials::model::Valid;
+using dxtbx::model::Beam;
+using dxtbx::model::BeamBase;
+using dxtbx::model::Detector;
+using dxtbx::model::Goniometer;
+using dxtbx::model::Panel;
+using dxtbx::model::Scan;
+using scitbx::mat3;
+using scitbx::vec2;
+using scitbx::vec3;
+using scitbx::af::int2;
+using scitbx::af::int6;
+
+typedef boost::random::mt19937 random_generator;
+
+/// The seed of the random number generator used for all the inputs
+const unsigned int random_seed = 42;
+
+/**
+ * Make an image of poisson background counts and gaussian spots
+ * @param size The size of the image
+ * @param num_spots The number of spots
+ * @param gen The random number generator
+ * @returns The image
+ */
+af::versa<int, af::c_grid<2> > make_image(int2 size,
+                                          std::size_t num_spots,
+                                          random_generator &gen) {
+  af::versa<double, af::c_grid<2> > mean(af::c_grid<2>(size[0], size[1]), 1.0);
+  boost::random::uniform_int_distribution<int> y_dist(3, size[0] - 4);
+  boost::random::uniform_int_distribution<int> x_dist(3, size[1] - 4);
+  for (std::size_t i = 0; i < num_spots; ++i) {
+    int y0 = y_dist(gen);
+    int x0 = x_dist(gen);
+    for (int y = y0 - 3; y <= y0 + 3; ++y) {
+      for (int x = x0 - 3; x <= x0 + 3; ++x) {
+        double r2 = (x - x0) * (x - x0) + (y - y0) * (y - y0);
+        mean(y, x) += 100.0 * std::exp(-r2 / 2.0);
+      }
+    }
+  }
+  af::versa<int, af::c_grid<2> > image(mean.accessor());
+  for (std::size_t i = 0; i < image.size(); ++i) {
+    image[i] = boost::random::poisson_distribution<int>(mean[i])(gen);
+  }
+  return image;
+}
+
+/**
+ * Threshold an image with the dispersion algorithm used in spot finding
+ */
+void bm_dispersion_threshold(State &state) {
+  random_generator gen(random_seed);
+  int2 size(1024, 1024);
+  af::versa<int, af::c_grid<2> > image = make_image(size, 500, gen);
+  af::versa<bool, af::c_grid<2> > mask(image.accessor(), true);
+  af::versa<bool, af::c_grid<2> > dst(image.accessor(), false);
+  DispersionThreshold algorithm(size, int2(3, 3), 6.0, 3.0, 0.0, 2);
+  while (state.keep_running()) {
+    algorithm.threshold(image.const_ref(), mask.const_ref(), dst.ref());
+    do_not_optimize(dst[0]);
+  }
+  state.set_items_processed((double)state.iterations() * image.size());
+}
+
+/**
+ * Label the connected strong pixels of a stack of images
+ */
+void bm_label_image_stack(State &state) {
+  random_generator gen(random_seed);
+  int2 size(1024, 1024);
+  std::size_t num_images = 10;
+  std::vector<af::versa<int, af::c_grid<2> > > images;
+  std::vector<af::versa<bool, af::c_grid<2> > > masks;
+  for (std::size_t i = 0; i < num_images; ++i) {
+    images.push_back(make_image(size, 500, gen));
+    af::versa<bool, af::c_grid<2> > mask(images.back().accessor());
+    for (std::size_t j = 0; j < mask.size(); ++j) {
+      mask[j] = images.back()[j] > 10;
+    }
+    masks.push_back(mask);
+  }
+  while (state.keep_running()) {
+    LabelImageStack<2> label(size);
+    for (std::size_t i = 0; i < num_images; ++i) {
+      label.add_image(images[i].const_ref(), masks[i].const_ref());
+    }
+    af::shared<int> labels = label.labels();
+    do_not_optimize(labels.size());
+  }
+  state.set_items_processed((double)state.iterations() * num_images * size[0]
+                            * size[1]);
+}
+
+/**
+ * Transform the shoeboxes of reflections to the profile grid
+ */
+void bm_transform_forward(State &state) {
+  random_generator gen(random_seed);
+  double d2r = scitbx::constants::pi / 180.0;
+
+  // A square detector 200mm from the sample, with 1 degree images
+  vec3<double> s0(0, 0, -1);
+  boost::shared_ptr<BeamBase> beam(new Beam(s0));
+  Panel panel("PAD",
+              "Panel",
+              vec3<double>(1, 0, 0),
+              vec3<double>(0, -1, 0),
+              vec3<double>(-86, 86, -200),
+              vec2<double>(0.172, 0.172),
+              scitbx::af::tiny<std::size_t, 2>(1000, 1000),
+              vec2<double>(0, 1e6),
+              0.32,
+              "Si");
+  Detector detector(panel);
+  vec3<double> m2(1, 0, 0);
+  Goniometer goniometer(m2);
+  Scan scan(scitbx::af::tiny<int, 2>(1, 100), vec2<double>(0, 1.0 * d2r));
+  gaussian_rs::transform::TransformSpec spec(
+    beam, detector, goniometer, scan, 0.05 * d2r, 0.1 * d2r, 3.0, 5);
+
+  // Reflections away from the rotation axis
+  std::size_t num_reflections = 200;
+  boost::random::uniform_real_distribution<double> x_dist(100, 900);
+  boost::random::uniform_real_distribution<double> y_dist(100, 350);
+  boost::random::uniform_real_distribution<double> z_dist(10, 90);
+  std::vector<gaussian_rs::CoordinateSystem> cs;
+  std::vector<int6> bbox;
+  std::vector<af::versa<double, af::c_grid<3> > > images;
+  std::vector<af::versa<bool, af::c_grid<3> > > masks;
+  for (std::size_t i = 0; i < num_reflections; ++i) {
+    vec2<double> xy(x_dist(gen), y_dist(gen));
+    double z = z_dist(gen);
+    vec3<double> s1 = detector[0].get_pixel_lab_coord(xy).normalize();
+    double phi = scan.get_angle_from_array_index(z);
+    cs.push_back(gaussian_rs::CoordinateSystem(m2, s0, s1, phi));
+    int x0 = (int)xy[0], y0 = (int)xy[1], z0 = (int)z;
+    bbox.push_back(int6(x0 - 5, x0 + 6, y0 - 5, y0 + 6, z0 - 3, z0 + 4));
+    af::c_grid<3> grid(7, 11, 11);
+    af::versa<double, af::c_grid<3> > image(grid);
+    for (std::size_t j = 0; j < image.size(); ++j) {
+      image[j] = boost::random::poisson_distribution<int>(5.0)(gen);
+    }
+    images.push_back(image);
+    masks.push_back(af::versa<bool, af::c_grid<3> >(grid, true));
+  }
+
+  while (state.keep_running()) {
+    for (std::size_t i = 0; i < num_reflections; ++i) {
+      gaussian_rs::transform::TransformForward<> transform(
+        spec, cs[i], bbox[i], 0, images[i].const_ref(), masks[i].const_ref());
+      do_not_optimize(transform.profile()[0]);
+    }
+  }
+  state.set_items_processed((double)state.iterations() * num_reflections);
+}
+
+/**
+ * Profile fit the intensities of reflections
+ */
+void bm_profile_fitter(State &state) {
+  random_generator gen(random_seed);
+  std::size_t num_reflections = 1000;
+  std::size_t size = 9 * 9 * 9;
+
+  // The same gaussian profile for every reflection
+  af::shared<double> profile(size);
+  double sum = 0;
+  for (std::size_t k = 0, j = 0; k < 9; ++k) {
+    for (std::size_t y = 0; y < 9; ++y) {
+      for (std::size_t x = 0; x < 9; ++x, ++j) {
+        double r2 = (x - 4.0) * (x - 4.0) + (y - 4.0) * (y - 4.0)
+                    + (k - 4.0) * (k - 4.0);
+        profile[j] = std::exp(-r2 / 4.0);
+        sum += profile[j];
+      }
+    }
+  }
+  for (std::size_t j = 0; j < size; ++j) {
+    profile[j] /= sum;
+  }
+  af::shared<bool> mask(size, true);
+  af::shared<double> background(size, 2.0);
+  boost::random::uniform_real_distribution<double> intensity_dist(10, 10000);
+  std::vector<af::shared<double> > data;
+  for (std::size_t i = 0; i < num_reflections; ++i) {
+    double intensity = intensity_dist(gen);
+    af::shared<double> d(size);
+    for (std::size_t j = 0; j < size; ++j) {
+      double mean = background[j] + intensity * profile[j];
+      d[j] = boost::random::poisson_distribution<int>(mean)(gen);
+    }
+    data.push_back(d);
+  }
+
+  while (state.keep_running()) {
+    double total = 0;
+    for (std::size_t i = 0; i < num_reflections; ++i) {
+      ProfileFitter<double> fit(data[i].const_ref(),
+                                background.const_ref(),
+                                mask.const_ref(),
+                                profile.const_ref(),
+                                1e-3,
+                                10);
+      total += fit.intensity()[0];
+    }
+    do_not_optimize(total);
+  }
+  state.set_items_processed((double)state.iterations() * num_reflections);
+}
+
+/**
+ * Fit the robust constant background model to shoeboxes
+ */
+void bm_glm_background_creator(State &state) {
+  random_generator gen(random_seed);
+  std::size_t num_shoeboxes = 2000;
+  af::shared<Shoebox<> > shoeboxes(num_shoeboxes);
+  for (std::size_t i = 0; i < num_shoeboxes; ++i) {
+    Shoebox<> &sbox = shoeboxes[i];
+    sbox.bbox = int6(0, 11, 0, 11, 0, 7);
+    sbox.allocate_with_value(Valid | Background);
+    for (std::size_t j = 0; j < sbox.data.size(); ++j) {
+      sbox.data[j] = boost::random::poisson_distribution<int>(2.0)(gen);
+    }
+  }
+  GLMBackgroundCreator creator(GLMBackgroundCreator::Constant3d, 1.345, 100, 10);
+  while (state.keep_running()) {
+    af::shared<bool> success = creator.shoebox(shoeboxes.ref(), state.arg());
+    do_not_optimize(success[0]);
+  }
+  state.set_items_processed((double)state.iterations() * num_shoeboxes);
+}
+
+/**
+ * Find the overlapping bounding boxes of a sweep of reflections
+ */
+void bm_find_overlapping(State &state) {
+  random_generator gen(random_seed);
+  std::size_t num_reflections = 100000;
+  boost::random::uniform_int_distribution<int> x_dist(0, 2000);
+  boost::random::uniform_int_distribution<int> y_dist(0, 2000);
+  boost::random::uniform_int_distribution<int> z_dist(0, 900);
+  boost::random::uniform_int_distribution<int> size_dist(5, 12);
+  af::shared<int6> bboxes(num_reflections);
+  for (std::size_t i = 0; i < num_reflections; ++i) {
+    int x = x_dist(gen), y = y_dist(gen), z = z_dist(gen);
+    int size = size_dist(gen);
+    bboxes[i] = int6(x, x + size, y, y + size, z, z + size / 2);
+  }
+  while (state.keep_running()) {
+    dials::algorithms::shoebox::AdjacencyList overlaps =
+      dials::algorithms::shoebox::find_overlapping(bboxes.const_ref(), state.arg());
+    do_not_optimize(overlaps.num_edges());
+  }
+  state.set_items_processed((double)state.iterations() * num_reflections);
+}
+
+/**
+ * Generate the miller indices of the reflections on each image of a sweep
+ */
+void bm_reeke_index_generator(State &state) {
+  double a = 50;
+  mat3<double> ub(1.0 / a, 0.0, 0.0, 0.0, 1.0 / a, 0.0, 0.0, 0.0, 1.0 / a);
+  vec3<double> axis(0, 1, 0);
+  vec3<double> s0(0, 0, -1);
+  cctbx::sgtbx::space_group_type space_group_type("P 21 21 21");
+  std::size_t num_images = 10;
+  std::vector<mat3<double> > ub_image;
+  for (std::size_t i = 0; i <= num_images; ++i) {
+    ub_image.push_back(
+      scitbx::math::r3_rotation::axis_and_angle_as_matrix(axis, (double)i, true) * ub);
+  }
+  std::size_t num_indices = 0;
+  while (state.keep_running()) {
+    num_indices = 0;
+    for (std::size_t i = 0; i < num_images; ++i) {
+      ReekeIndexGenerator generator(
+        ub_image[i], ub_image[i + 1], space_group_type, axis, s0, 1.5, 1);
+      num_indices += generator.to_array().size();
+    }
+    do_not_optimize(num_indices);
+  }
+  state.set_items_processed((double)state.iterations() * num_indices);
+}
+
+/**
+ * Make a reflection table with the usual columns of integrated reflections
+ * @param num_rows The number of rows
+ * @returns The reflection table
+ */
+af::reflection_table make_reflection_table(std::size_t num_rows) {
+  random_generator gen(random_seed);
+  boost::random::uniform_int_distribution<int> index_dist(-50, 50);
+  boost::random::uniform_real_distribution<double> xyz_dist(0, 2000);
+  boost::random::uniform_real_distribution<double> intensity_dist(0, 10000);
+  af::reflection_table table(num_rows);
+  af::shared<cctbx::miller::index<> > hkl = table["miller_index"];
+  af::shared<int> id = table["id"];
+  af::shared<std::size_t> panel = table["panel"];
+  af::shared<std::size_t> flags = table["flags"];
+  af::shared<vec3<double> > xyzcal = table["xyzcal.px"];
+  af::shared<int6> bbox = table["bbox"];
+  af::shared<double> intensity = table["intensity.sum.value"];
+  af::shared<double> variance = table["intensity.sum.variance"];
+  for (std::size_t i = 0; i < num_rows; ++i) {
+    hkl[i] = cctbx::miller::index<>(index_dist(gen), index_dist(gen), index_dist(gen));
+    id[i] = 0;
+    panel[i] = 0;
+    flags[i] = 1 << 8;
+    xyzcal[i] = vec3<double>(xyz_dist(gen), xyz_dist(gen), xyz_dist(gen) / 10);
+    int x = (int)xyzcal[i][0], y = (int)xyzcal[i][1], z = (int)xyzcal[i][2];
+    bbox[i] = int6(x - 5, x + 5, y - 5, y + 5, z - 2, z + 3);
+    intensity[i] = intensity_dist(gen);
+    variance[i] = intensity[i] + 10;
+  }
+  return table;
+}
+
+/**
+ * Reference the packed data when unpacking rather than copying it
+ */
+bool reference_packed_data(msgpack::type::object_type type,
+                           std::size_t length,
+                           void *user_data) {
+  return true;
+}
+
+/**
+ * Pack a reflection table in msgpack format
+ */
+void bm_msgpack_pack(State &state) {
+  af::reflection_table table = make_reflection_table(200000);
+  std::size_t nbytes = 0;
+  while (state.keep_running()) {
+    msgpack::sbuffer buffer;
+    msgpack::pack(buffer, table);
+    nbytes = buffer.size();
+    do_not_optimize(buffer.data()[0]);
+  }
+  state.set_bytes_processed((double)state.iterations() * nbytes);
+}
+
+/**
+ * Unpack a reflection table from msgpack format
+ */
+void bm_msgpack_unpack(State &state) {
+  af::reflection_table table = make_reflection_table(200000);
+  msgpack::sbuffer buffer;
+  msgpack::pack(buffer, table);
+  while (state.keep_running()) {
+    msgpack::unpacked result;
+    std::size_t off = 0;
+    msgpack::unpack(result, buffer.data(), buffer.size(), off, reference_packed_data);
+    af::reflection_table unpacked;
+    msgpack::adaptor::convert<af::reflection_table>::read(
+      result.get(), unpacked, NULL);
+    do_not_optimize(unpacked.nrows());
+  }
+  state.set_bytes_processed((double)state.iterations() * buffer.size());
+}
+
+/**
+ * Select half the rows of a reflection table
+ */
+void bm_flex_table_select(State &state) {
+  af::reflection_table table = make_reflection_table(1000000);
+  af::shared<double> intensity = table["intensity.sum.value"];
+  af::shared<bool> flags(table.nrows());
+  for (std::size_t i = 0; i < flags.size(); ++i) {
+    flags[i] = intensity[i] > 5000;
+  }
+  while (state.keep_running()) {
+    af::reflection_table selected =
+      flex_table_suite::select_rows_flags(table, flags.const_ref());
+    do_not_optimize(selected.nrows());
+  }
+  state.set_items_processed((double)state.iterations() * table.nrows());
+}
+
+/**
+ * Sort a reflection table by a column
+ */
+void bm_flex_table_sort(State &state) {
+  af::reflection_table table = make_reflection_table(1000000);
+  af::shared<std::size_t> index(table.nrows());
+  for (std::size_t i = 0; i < index.size(); ++i) {
+    index[i] = i;
+  }
+  while (state.keep_running()) {
+    // Sort a fresh copy each time, since sorting a sorted table is faster
+    state.pause_timing();
+    af::reflection_table copy =
+      flex_table_suite::select_rows_index(table, index.const_ref());
+    state.resume_timing();
+    flex_table_suite::sort(copy, "intensity.sum.value", false);
+    do_not_optimize(copy.nrows());
+  }
+  state.set_items_processed((double)state.iterations() * table.nrows());
+}
+
+int main(int argc, char **argv) {
+  Runner runner;
+  runner.add("dispersion_threshold", bm_dispersion_threshold);
+  runner.add("label_image_stack", bm_label_image_stack);
+  runner.add("transform_forward", bm_transform_forward);
+  runner.add("profile_fitter", bm_profile_fitter);
+  runner.add("glm_background_creator", bm_glm_background_creator, 1);
+  runner.add("glm_background_creator", bm_glm_background_creator, 4);
+  runner.add("find_overlapping", bm_find_overlapping, 1);
+  runner.add("find_overlapping", bm_find_overlapping, 4);
+  runner.add("reeke_index_generator", bm_reeke_index_generator);
+  runner.add("msgpack_pack", bm_msgpack_pack);
+  runner.add("msgpack_unpack", bm_msgpack_unpack);
+  runner.add("flex_table_select", bm_flex_table_select);
+  runner.add("flex_table_sort", bm_flex_table_sort);
+  try {
+    runner.parse(argc, argv);
+    runner.run();
+    runner.write();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
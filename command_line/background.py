@@ -94,6 +94,14 @@ def run(args=None):
         intensities = []
         sigmas = []
 
+        # The static mask and pixel geometry are the same for every image
+        static_mask = dials.util.masking.generate_mask(imageset, params.masking)
+        beam = imageset.get_beam()
+        two_theta = [
+            dials.util.masking.get_resolution_map(beam, panel).two_theta()
+            for panel in imageset.get_detector()
+        ]
+
         for indx in images:
             print(f"For imageset {i_imgset} image {indx}:")
             d, I, sig = background(
@@ -102,6 +110,8 @@ def run(args=None):
                 n_bins=params.n_bins,
                 corrected=params.corrected,
                 mask_params=params.masking,
+                static_mask=static_mask,
+                two_theta=two_theta,
             )
 
             print(f"{'d':>8} {'I':>8} {'sig':>8}")
@@ -148,7 +158,23 @@ def run(args=None):
             raise Sorry(f"Unable to save plot to {params.output.plot}")
 
 
-def background(imageset, indx, n_bins, corrected=False, mask_params=None):
+def background(
+    imageset,
+    indx,
+    n_bins,
+    corrected=False,
+    mask_params=None,
+    static_mask=None,
+    two_theta=None,
+):
+    """
+    Compute the radial background profile of an image
+
+    :param static_mask: The mask generated from the mask parameters, if it has
+                        already been computed for the imageset
+    :param two_theta: The two theta array of each panel, if it has already been
+                      computed for the imageset
+    """
     if mask_params is None:
         # Default mask params for trusted range
         mask_params = phil_scope.fetch(parse("")).extract().masking
@@ -160,8 +186,9 @@ def background(imageset, indx, n_bins, corrected=False, mask_params=None):
     assert len(detector) == 1
     panel = detector[0]
     imageset_mask = imageset.get_mask(indx)[0]
-    mask = dials.util.masking.generate_mask(imageset, mask_params)[0]
-    mask = imageset_mask & mask
+    if static_mask is None:
+        static_mask = dials.util.masking.generate_mask(imageset, mask_params)
+    mask = imageset_mask & static_mask[0]
 
     n = matrix.col(panel.get_normal()).normalize()
     b = matrix.col(beam.get_s0()).normalize()
@@ -206,8 +233,9 @@ def background(imageset, indx, n_bins, corrected=False, mask_params=None):
     # the radial profile out, need to set the number of bins
     # sensibly; inspired by method in PyFAI
 
-    two_theta_array = panel.get_two_theta_array(beam.get_s0())
-    two_theta_array = two_theta_array.as_1d().select(background_pixels.iselection())
+    if two_theta is None:
+        two_theta = [dials.util.masking.get_resolution_map(beam, panel).two_theta()]
+    two_theta_array = two_theta[0].as_1d().select(background_pixels.iselection())
 
     # Use flex.weighted_histogram
     h0 = flex.weighted_histogram(two_theta_array, n_slots=n_bins)
@@ -0,0 +1,405 @@
+# LIBTBX_SET_DISPATCHER_NAME dials.benchmark
+
+import datetime
+import glob
+import json
+import logging
+import os
+import pathlib
+import subprocess
+import sys
+import time
+
+import iotbx.phil
+from libtbx import Auto
+
+import dials.util
+import dials.util.log
+from dials.util.mp import available_cores
+from dials.util.options import ArgumentParser
+from dials.util.version import dials_version
+
+logger = logging.getLogger("dials.command_line.benchmark")
+
+help_message = """
+Time the processing of a reference dataset from import to scaling.
+
+Each stage of the processing is run as a separate program, and while it runs
+the wall time, the peak resident memory, the bytes read and written and the
+number of threads of the program and its child processes are recorded. The
+results are saved to a JSON report, and if the report of an earlier run is
+given as a baseline, any stages which are slower or use more memory than the
+baseline by more than the tolerance are listed and the program fails.
+
+The datasets are fetched with dials_data, so the same images are used for
+every run:
+
+  thaumatin  A thaumatin rotation dataset (thaumatin_i04), processed with
+             import, find_spots, index, refine, integrate and scale
+  ssx        A serial crystallography dataset of stills (cunir_serial),
+             processed with import, find_spots, ssx_index, integrate and scale
+
+The bytes read and written and the thread counts are sampled from /proc, so
+are only recorded on Linux, and may miss short lived child processes.
+
+Examples::
+
+  dials.benchmark dataset=thaumatin nproc=8
+
+  dials.benchmark dataset=thaumatin baseline=dials.benchmark.json
+
+  dials.benchmark dataset=ssx stages="import find_spots"
+"""
+
+phil_scope = iotbx.phil.parse(
+    """
+dataset = *thaumatin ssx
+  .type = choice
+  .help = "The reference dataset to process"
+images = None
+  .type = strings
+  .help = "Use these images rather than fetching those of the dataset, e.g."
+          "for a local copy of the data"
+stages = None
+  .type = strings
+  .help = "Only run these stages, e.g. import find_spots index. The later"
+          "stages need the output of the earlier ones in the directory."
+nproc = Auto
+  .type = int(value_min=1)
+  .help = "The number of processes used by find_spots and integrate"
+sample_interval = 0.1
+  .type = float(value_min=0.001)
+  .help = "The interval in seconds between samples of the threads and I/O"
+baseline = None
+  .type = path
+  .help = "The report of an earlier run to compare against"
+tolerance {
+  wall_time = 0.1
+    .type = float(value_min=0)
+    .help = "The fractional increase in wall time counted as a regression"
+  peak_rss = 0.1
+    .type = float(value_min=0)
+    .help = "The fractional increase in peak memory counted as a regression"
+}
+output {
+  directory = benchmark
+    .type = path
+    .help = "The directory in which the stages are run"
+  json = dials.benchmark.json
+    .type = path
+    .help = "The report of the run"
+  log = dials.benchmark.log
+    .type = path
+}
+"""
+)
+
+# The stages of processing each dataset. The commands are run in the output
+# directory, with {images} replaced by the images and {nproc} by nproc=N.
+datasets = {
+    "thaumatin": {
+        "dials_data": "thaumatin_i04",
+        "images": "th_8_2_0*cbf",
+        "stages": [
+            ("import", ["dials.import", "{images}"]),
+            ("find_spots", ["dials.find_spots", "imported.expt", "{nproc}"]),
+            ("index", ["dials.index", "imported.expt", "strong.refl"]),
+            ("refine", ["dials.refine", "indexed.expt", "indexed.refl"]),
+            (
+                "integrate",
+                ["dials.integrate", "refined.expt", "refined.refl", "{nproc}"],
+            ),
+            ("scale", ["dials.scale", "integrated.expt", "integrated.refl"]),
+        ],
+    },
+    "ssx": {
+        "dials_data": "cunir_serial",
+        "images": "*.cbf",
+        "stages": [
+            ("import", ["dials.import", "{images}"]),
+            ("find_spots", ["dials.find_spots", "imported.expt", "{nproc}"]),
+            ("index", ["dev.dials.ssx_index", "imported.expt", "strong.refl"]),
+            (
+                "integrate",
+                ["dials.integrate", "indexed.expt", "indexed.refl", "{nproc}"],
+            ),
+            ("scale", ["dials.scale", "integrated.expt", "integrated.refl"]),
+        ],
+    },
+}
+
+
+def _process_tree(pid):
+    """
+    :param pid: The process id
+    :returns: The ids of the process and all its descendants
+    """
+    pids = [pid]
+    for p in pids:
+        for task in glob.glob(f"/proc/{p}/task/*/children"):
+            try:
+                with open(task) as infile:
+                    pids.extend(int(child) for child in infile.read().split())
+            except OSError:
+                pass
+    return pids
+
+
+def _read_proc(pid):
+    """
+    :param pid: The process id
+    :returns: The number of threads and the bytes read and written by the
+              process, or None if it has gone
+    """
+    try:
+        with open(f"/proc/{pid}/status") as infile:
+            status = dict(line.split(":", 1) for line in infile if ":" in line)
+        with open(f"/proc/{pid}/io") as infile:
+            io = dict(line.split(":", 1) for line in infile if ":" in line)
+    except OSError:
+        return None
+    return int(status["Threads"]), int(io["rchar"]), int(io["wchar"])
+
+
+def measure_command(command, working_directory, logfile, sample_interval=0.1):
+    """
+    Run a command and measure the resources it uses.
+
+    :param command: The command
+    :param working_directory: The directory to run the command in
+    :param logfile: The file for the output of the command
+    :param sample_interval: The interval in seconds between samples of the
+                            threads and I/O
+    :returns: A dictionary of the wall time, peak resident memory in bytes,
+              bytes read and written, maximum number of threads and the
+              return code. The I/O and threads are None if not available.
+    """
+    have_proc = os.path.isdir("/proc/self/task")
+    io_bytes = {}
+    max_threads = 0
+    env = dict(os.environ, DIALS_NOBANNER="1")
+    start = time.perf_counter()
+    with open(logfile, "wb") as log:
+        process = subprocess.Popen(
+            command,
+            cwd=working_directory,
+            stdout=log,
+            stderr=subprocess.STDOUT,
+            env=env,
+        )
+        while True:
+            pid, status, rusage = os.wait4(process.pid, os.WNOHANG)
+            if pid:
+                break
+            if have_proc:
+                threads = 0
+                for p in _process_tree(process.pid):
+                    values = _read_proc(p)
+                    if values:
+                        threads += values[0]
+                        io_bytes[p] = values[1:]
+                max_threads = max(max_threads, threads)
+            time.sleep(sample_interval)
+    wall_time = time.perf_counter() - start
+    if os.WIFSIGNALED(status):
+        process.returncode = -os.WTERMSIG(status)
+    else:
+        process.returncode = os.WEXITSTATUS(status)
+
+    # The maximum resident set size is in kilobytes except on macOS
+    peak_rss = rusage.ru_maxrss * (1 if sys.platform == "darwin" else 1024)
+    return {
+        "command": [str(c) for c in command],
+        "wall_time": wall_time,
+        "user_time": rusage.ru_utime,
+        "system_time": rusage.ru_stime,
+        "peak_rss": peak_rss,
+        "read_bytes": sum(r for r, _ in io_bytes.values()) if have_proc else None,
+        "write_bytes": sum(w for _, w in io_bytes.values()) if have_proc else None,
+        "max_threads": max_threads if have_proc else None,
+        "returncode": process.returncode,
+    }
+
+
+def dataset_images(params):
+    """
+    :param params: The parameters
+    :returns: The image files of the dataset
+    """
+    if params.images:
+        return params.images
+    try:
+        import dials_data.download
+    except ImportError:
+        raise dials.util.Sorry(
+            "dials_data is needed for the reference datasets; "
+            "otherwise give the images"
+        )
+    dataset = datasets[params.dataset]
+    path = dials_data.download.DataFetcher()(dataset["dials_data"], pathlib=True)
+    images = sorted(glob.glob(str(path / dataset["images"])))
+    if not images:
+        raise dials.util.Sorry(f"No images found for {params.dataset}")
+    return images
+
+
+def run_pipeline(params):
+    """
+    Run the stages of processing a dataset, measuring each of them.
+
+    :param params: The parameters
+    :returns: The report
+    """
+    stages = datasets[params.dataset]["stages"]
+    if params.stages:
+        names = [name for name, _ in stages]
+        unknown = set(params.stages) - set(names)
+        if unknown:
+            raise dials.util.Sorry(
+                f"Unknown stages {', '.join(sorted(unknown))}; "
+                f"the stages are {' '.join(names)}"
+            )
+        stages = [stage for stage in stages if stage[0] in params.stages]
+    images = dataset_images(params) if stages[0][0] == "import" else []
+
+    directory = pathlib.Path(params.output.directory)
+    directory.mkdir(parents=True, exist_ok=True)
+    report = {
+        "dataset": params.dataset,
+        "dials_version": dials_version(),
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "nproc": params.nproc,
+        "num_cpus": os.cpu_count(),
+        "stages": [],
+    }
+    for name, template in stages:
+        command = []
+        for arg in template:
+            if arg == "{images}":
+                command.extend(images)
+            else:
+                command.append(arg.replace("{nproc}", f"nproc={params.nproc}"))
+        logger.info("Running %s: %s", name, " ".join(template))
+        result = measure_command(
+            command,
+            directory,
+            directory / f"{name}.log",
+            sample_interval=params.sample_interval,
+        )
+        result["name"] = name
+        report["stages"].append(result)
+        logger.info("  %.1f s, peak memory %s", result["wall_time"], _mb(result))
+        if result["returncode"]:
+            raise dials.util.Sorry(
+                f"{name} failed with code {result['returncode']}, "
+                f"see {directory / (name + '.log')}"
+            )
+    return report
+
+
+def compare_with_baseline(report, baseline, tolerance):
+    """
+    Compare the stages of a run with those of a baseline run.
+
+    :param report: The report of the run
+    :param baseline: The report of the baseline run
+    :param tolerance: The fractional increase in wall_time and peak_rss
+                      counted as a regression
+    :returns: The rows of a comparison table and a list of the regressions
+    """
+    rows = [("Stage", "Time (s)", "Baseline (s)", "Memory (MB)", "Baseline (MB)")]
+    regressions = []
+    base_stages = {stage["name"]: stage for stage in baseline["stages"]}
+    for stage in report["stages"]:
+        base = base_stages.get(stage["name"])
+        if base is None:
+            continue
+        rows.append(
+            (
+                stage["name"],
+                f"{stage['wall_time']:.1f}",
+                f"{base['wall_time']:.1f}",
+                _mb(stage),
+                _mb(base),
+            )
+        )
+        for key in ("wall_time", "peak_rss"):
+            limit = base[key] * (1 + getattr(tolerance, key))
+            if base[key] and stage[key] > limit:
+                regressions.append(
+                    f"{stage['name']} {key} {stage[key]:.6g} > {limit:.6g}"
+                )
+    return rows, regressions
+
+
+def show_report(report):
+    """
+    Print a table of the stages of a run.
+    """
+    rows = [("Stage", "Time (s)", "Memory (MB)", "Read (MB)", "Write (MB)", "Threads")]
+    for stage in report["stages"]:
+        rows.append(
+            (
+                stage["name"],
+                f"{stage['wall_time']:.1f}",
+                _mb(stage),
+                _mb(stage, "read_bytes"),
+                _mb(stage, "write_bytes"),
+                f"{stage['max_threads']}",
+            )
+        )
+    logger.info(
+        "Processing %s with nproc=%d\n%s",
+        report["dataset"],
+        report["nproc"],
+        dials.util.tabulate(rows, headers="firstrow"),
+    )
+
+
+def _mb(stage, key="peak_rss"):
+    value = stage.get(key)
+    return "-" if value is None else f"{value / 2**20:.1f}"
+
+
+@dials.util.show_mail_handle_errors()
+def run(args=None):
+    usage = "dials.benchmark [options]"
+
+    parser = ArgumentParser(usage=usage, phil=phil_scope, epilog=help_message)
+
+    params, options = parser.parse_args(args, show_diff_phil=True)
+    dials.util.log.config(verbosity=options.verbose, logfile=params.output.log)
+    if params.nproc is Auto:
+        params.nproc = available_cores()
+
+    baseline = None
+    if params.baseline:
+        with open(params.baseline) as infile:
+            baseline = json.load(infile)
+        if baseline["dataset"] != params.dataset:
+            raise dials.util.Sorry(
+                f"The baseline is of {baseline['dataset']}, not {params.dataset}"
+            )
+
+    report = run_pipeline(params)
+    show_report(report)
+    with open(params.output.json, "w") as outfile:
+        json.dump(report, outfile, indent=2)
+
+    if baseline:
+        rows, regressions = compare_with_baseline(report, baseline, params.tolerance)
+        logger.info(
+            "Compared with %s\n%s",
+            params.baseline,
+            dials.util.tabulate(rows, headers="firstrow"),
+        )
+        if regressions:
+            raise dials.util.Sorry(
+                "Performance regressions since the baseline:\n  "
+                + "\n  ".join(regressions)
+            )
+        logger.info("No performance regressions since the baseline")
+
+
+if __name__ == "__main__":
+    run()
@@ -0,0 +1,327 @@
+# LIBTBX_SET_DISPATCHER_NAME dev.dials.benchmark_background
+
+import json
+import logging
+import pickle
+import time
+import tracemalloc
+
+import numpy as np
+
+import iotbx.phil
+from dxtbx.model import ExperimentList
+
+import dials.extensions
+import dials.util
+import dials.util.log
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
+
+logger = logging.getLogger("dials.command_line.benchmark_background")
+
+help_message = """
+Time the background algorithms on the same set of shoeboxes.
+
+Without a reflection file a table of synthetic shoeboxes is generated, with a
+Gaussian peak on a Poisson background of known mean that the algorithms are
+compared against. With a reflection file containing shoeboxes, for example
+from dials.integrate debug.output=True, the algorithms are compared against
+the first algorithm in the list.
+
+For each algorithm the best time of the repeats is reported with the
+throughput in reflections and pixels per second, along with the number and
+peak size of the Python allocations and the bias and RMS difference of the
+mean background. Memory allocated by the C++ code is not included.
+
+Examples::
+
+  dev.dials.benchmark_background
+
+  dev.dials.benchmark_background synthetic.nrefl=10000 algorithms="simple glm"
+
+  dev.dials.benchmark_background integrated.expt shoeboxes.refl
+"""
+
+phil_scope = iotbx.phil.parse(
+    """
+algorithms = simple glm gmodel median Auto null
+  .type = strings
+  .help = "The background algorithms to benchmark. The gmodel algorithm is"
+          "skipped unless integration.background.gmodel.model is set and the"
+          "Auto algorithm is skipped without experiments."
+repeats = 3
+  .type = int(value_min=1)
+  .help = "The number of times each algorithm is run"
+synthetic {
+  nrefl = 1000
+    .type = int(value_min=1)
+  shoebox_size = 5 11 11
+    .type = ints(size=3, value_min=1)
+    .help = "The size of the shoeboxes (z, y, x)"
+  background = 2.0
+    .type = float(value_min=0)
+    .help = "The mean background at the centre of the shoeboxes"
+  gradient = 0.0
+    .type = float
+    .help = "The change in background per pixel along x"
+  counts = 1000
+    .type = int(value_min=0)
+    .help = "The mean counts in the peak"
+  spot_size = 1.0
+    .type = float(value_min=0)
+    .help = "The standard deviation of the peak in pixels"
+  seed = 0
+    .type = int
+}
+output {
+  json = None
+    .type = path
+    .help = "Save the results to a json file"
+}
+include scope dials.algorithms.integration.integrator.phil_scope
+""",
+    process_includes=True,
+)
+
+
+def generate_shoeboxes(params):
+    """
+    Generate a reflection table of shoeboxes with a peak on a known background.
+
+    :param params: The synthetic parameters
+    :returns: The reflections and the true mean background
+    """
+    rng = np.random.default_rng(params.seed)
+    zsize, ysize, xsize = params.shoebox_size
+    nrefl = params.nrefl
+
+    # Lay the shoeboxes out on a grid so that none of them overlap
+    ncol = int(np.ceil(np.sqrt(nrefl)))
+    bbox = flex.int6(nrefl)
+    for i in range(nrefl):
+        x0 = (i % ncol) * xsize
+        y0 = (i // ncol) * ysize
+        bbox[i] = (x0, x0 + xsize, y0, y0 + ysize, 0, zsize)
+    panel = flex.size_t(nrefl, 0)
+
+    # The background plane and peak profile are the same for all shoeboxes
+    k, j, i = np.indices((zsize, ysize, xsize), dtype=float)
+    centre = np.array([zsize, ysize, xsize], dtype=float) / 2 - 0.5
+    plane = np.clip(params.background + params.gradient * (i - centre[2]), 0, None)
+    sigma = max(params.spot_size, 1e-3)
+    d2 = ((k - centre[0]) ** 2 + (j - centre[1]) ** 2 + (i - centre[2]) ** 2) / (
+        sigma**2
+    )
+    profile = np.exp(-0.5 * d2)
+    profile /= profile.sum()
+    foreground = (d2 <= 9).ravel()
+    grid = flex.grid(zsize, ysize, xsize)
+    mask = flex.int(grid, MaskCode.Valid | MaskCode.Background)
+    mask.set_selected(
+        flex.bool(foreground.tolist()), MaskCode.Valid | MaskCode.Foreground
+    )
+
+    shoebox = flex.shoebox(panel, bbox, allocate=True)
+    for n in range(nrefl):
+        pixels = rng.poisson(plane) + rng.poisson(params.counts * profile)
+        data = flex.float(pixels.ravel().astype(float).tolist())
+        data.reshape(grid)
+        shoebox[n].data = data
+        shoebox[n].mask = mask.deep_copy()
+
+    reflections = flex.reflection_table()
+    reflections["bbox"] = bbox
+    reflections["panel"] = panel
+    reflections["shoebox"] = shoebox
+    reflections["xyzcal.px"] = flex.vec3_double(
+        [((b[0] + b[1]) / 2, (b[2] + b[3]) / 2, (b[4] + b[5]) / 2) for b in bbox]
+    )
+    truth = flex.double(nrefl, float(plane.mean()))
+    return reflections, truth
+
+
+def copy_reflections(reflections):
+    """
+    Copy the reflections, including the shoebox arrays, so that each run of an
+    algorithm starts from the same shoeboxes.
+    """
+    return pickle.loads(pickle.dumps(reflections, pickle.HIGHEST_PROTOCOL))
+
+
+def benchmark(name, params, experiments, reflections, repeats):
+    """
+    Run a background algorithm on copies of the reflections.
+
+    :param name: The name of the background extension
+    :param params: The input parameters
+    :param experiments: The experiment list
+    :param reflections: The reflections with shoeboxes
+    :param repeats: The number of repeats
+    :returns: A dictionary of timings, allocations and the mean background
+    """
+    algorithm = dials.extensions.Background.load(name)(params, experiments)
+
+    times = []
+    blocks = 0
+    peak = 0
+    result = None
+    for _ in range(repeats):
+        table = copy_reflections(reflections)
+        tracemalloc.start()
+        start = time.perf_counter()
+        success = algorithm.compute_background(table)
+        times.append(time.perf_counter() - start)
+        snapshot = tracemalloc.take_snapshot()
+        peak = max(peak, tracemalloc.get_traced_memory()[1])
+        tracemalloc.stop()
+        blocks = max(blocks, sum(s.count for s in snapshot.statistics("filename")))
+        result = table
+
+    return {
+        "times": times,
+        "allocated_blocks": blocks,
+        "peak_memory": peak,
+        "success": success.count(True),
+        "background": result["shoebox"].mean_background(),
+    }
+
+
+def select_algorithms(params, experiments):
+    """
+    Get the algorithms which can be run with the given input.
+    """
+    known = {e.name for e in dials.extensions.Background.extensions()}
+    selected = []
+    for name in params.algorithms:
+        if name not in known:
+            raise dials.util.Sorry(f"Unknown background algorithm {name}")
+        if name == "gmodel" and params.integration.background.gmodel.model is None:
+            logger.info("Skipping gmodel: no model given")
+            continue
+        if name == "Auto" and len(experiments) == 0:
+            logger.info("Skipping Auto: no experiments given")
+            continue
+        selected.append(name)
+    return selected
+
+
+def run_benchmark(params, experiments, reflections):
+    """
+    Run the benchmark and return the results for each algorithm.
+    """
+    if reflections is None:
+        reflections, truth = generate_shoeboxes(params.synthetic)
+        reference = "truth"
+    else:
+        if "shoebox" not in reflections:
+            raise dials.util.Sorry("The reflections must contain shoeboxes")
+        truth = None
+        reference = None
+
+    npixels = sum(s.data.size() for s in reflections["shoebox"])
+    logger.info(
+        "Benchmarking %d reflections with %d pixels in total", len(reflections), npixels
+    )
+
+    results = {}
+    for name in select_algorithms(params, experiments):
+        result = benchmark(name, params, experiments, reflections, params.repeats)
+        background = result.pop("background")
+        if truth is None:
+            truth = background
+            reference = name
+        diff = background - truth
+        best = min(result["times"])
+        result.update(
+            {
+                "best_time": best,
+                "reflections_per_second": len(reflections) / best if best else 0,
+                "pixels_per_second": npixels / best if best else 0,
+                "bias": flex.mean(diff),
+                "rmsd": flex.mean(diff * diff) ** 0.5,
+            }
+        )
+        results[name] = result
+
+    return {
+        "nrefl": len(reflections),
+        "npixels": npixels,
+        "reference": reference,
+        "algorithms": results,
+    }
+
+
+def show_results(results):
+    """
+    Print a table of the results.
+    """
+    rows = [
+        (
+            "Algorithm",
+            "Time (s)",
+            "Refl/s",
+            "Pixels/s",
+            "Success",
+            "Blocks",
+            "Peak (kB)",
+            "Bias",
+            "RMSD",
+        )
+    ]
+    for name, r in results["algorithms"].items():
+        rows.append(
+            (
+                name,
+                f"{r['best_time']:.4f}",
+                f"{r['reflections_per_second']:.0f}",
+                f"{r['pixels_per_second']:.3g}",
+                f"{r['success']}",
+                f"{r['allocated_blocks']}",
+                f"{r['peak_memory'] / 1024:.1f}",
+                f"{r['bias']:.4f}",
+                f"{r['rmsd']:.4f}",
+            )
+        )
+    logger.info(
+        "Mean background compared against %s\n%s",
+        results["reference"],
+        dials.util.tabulate(rows, headers="firstrow"),
+    )
+
+
+@dials.util.show_mail_handle_errors()
+def run(args=None):
+    usage = "dev.dials.benchmark_background [options] [integrated.expt shoeboxes.refl]"
+
+    parser = ArgumentParser(
+        usage=usage,
+        phil=phil_scope,
+        read_experiments=True,
+        read_reflections=True,
+        check_format=False,
+        epilog=help_message,
+    )
+
+    params, options = parser.parse_args(args, show_diff_phil=True)
+    dials.util.log.config(verbosity=options.verbose)
+
+    reflections, experiments = reflections_and_experiments_from_files(
+        params.input.reflections, params.input.experiments
+    )
+    if len(reflections) > 1:
+        raise dials.util.Sorry("Only one reflection file can be given")
+    reflections = reflections[0] if reflections else None
+    if not experiments:
+        experiments = ExperimentList()
+
+    results = run_benchmark(params, experiments, reflections)
+    show_results(results)
+
+    if params.output.json:
+        with open(params.output.json, "w") as outfile:
+            json.dump(results, outfile, indent=2)
+
+
+if __name__ == "__main__":
+    run()
@@ -0,0 +1,339 @@
+# LIBTBX_SET_DISPATCHER_NAME dev.dials.benchmark_prediction
+
+import json
+import logging
+import math
+import random
+import time
+
+import iotbx.phil
+from dxtbx.model import (
+    BeamFactory,
+    Crystal,
+    Detector,
+    DetectorFactory,
+    GoniometerFactory,
+    ScanFactory,
+)
+from dxtbx.model.experiment_list import Experiment, ExperimentList
+from scitbx import matrix
+
+import dials.util
+import dials.util.log
+from dials.algorithms.spot_prediction import (
+    ReekeIndexGenerator,
+    ScanStaticReflectionPredictor,
+    ScanVaryingReflectionPredictor,
+    StillsReflectionPredictor,
+    ray_intersection,
+)
+from dials.array_family import flex
+from dials.util.options import ArgumentParser
+
+logger = logging.getLogger("dials.command_line.benchmark_prediction")
+
+help_message = """
+Time the reflection prediction code on synthetic reference geometries.
+
+Each geometry has a tetragonal crystal in a 1 Angstrom beam on one of the
+following detectors:
+
+  pilatus6m  A single 2463x2527 panel of 0.172 mm pixels at 200 mm
+  eiger32m   A single 6000x5400 panel of 0.075 mm pixels at 150 mm
+  xfel       An 8x8 array of 194x185 panels of 0.11 mm pixels at 100 mm
+
+For each geometry and benchmark the best time of the repeats is reported with
+the number of reflections (or Miller indices for the Reeke index generator)
+generated per second. The stills benchmark predicts a still for each of a set
+of random crystal orientations and the ray intersection benchmark intersects
+the diffracted beam vectors of the scan static predictions with the detector.
+
+Examples::
+
+  dev.dials.benchmark_prediction
+
+  dev.dials.benchmark_prediction geometries=xfel benchmarks="stills ray_intersection"
+
+  dev.dials.benchmark_prediction num_images=360 d_min=1.5 output.json=times.json
+"""
+
+phil_scope = iotbx.phil.parse(
+    """
+geometries = pilatus6m eiger32m xfel
+  .type = strings
+  .help = "The reference geometries to benchmark"
+benchmarks = reeke scan_static scan_varying stills ray_intersection
+  .type = strings
+  .help = "The prediction code to benchmark"
+repeats = 3
+  .type = int(value_min=1)
+  .help = "The number of times each benchmark is run"
+num_images = 50
+  .type = int(value_min=1)
+  .help = "The number of 0.1 degree images in the rotation scans"
+num_stills = 20
+  .type = int(value_min=1)
+  .help = "The number of crystal orientations for the stills benchmark"
+d_min = 2.0
+  .type = float(value_min=0)
+  .help = "The resolution limit of the predictions"
+nthreads = 1
+  .type = int(value_min=1)
+  .help = "The number of threads for scan static prediction"
+seed = 0
+  .type = int
+output {
+  json = None
+    .type = path
+    .help = "Save the results to a json file"
+}
+"""
+)
+
+
+def make_detector(name):
+    """
+    Create one of the reference detectors.
+
+    :param name: The name of the geometry
+    :returns: The detector model
+    """
+    if name == "pilatus6m":
+        pixel_size, image_size, distance = 0.172, (2463, 2527), 200
+    elif name == "eiger32m":
+        pixel_size, image_size, distance = 0.075, (6000, 5400), 150
+    elif name == "xfel":
+        detector = Detector()
+        for j in range(8):
+            for i in range(8):
+                panel = detector.add_panel()
+                panel.set_image_size((194, 185))
+                panel.set_pixel_size((0.11, 0.11))
+                panel.set_frame(
+                    (1, 0, 0), (0, -1, 0), (-90 + 22.5 * i, 90 - 22.5 * j, -100)
+                )
+        return detector
+    else:
+        raise dials.util.Sorry(f"Unknown geometry {name}")
+    return DetectorFactory.simple(
+        "PAD",
+        distance,
+        (pixel_size * image_size[0] / 2, pixel_size * image_size[1] / 2),
+        "+x",
+        "-y",
+        (pixel_size, pixel_size),
+        image_size,
+    )
+
+
+def make_crystal(rng):
+    """
+    Create a tetragonal crystal in a random orientation.
+
+    :param rng: The random number generator
+    :returns: The crystal model
+    """
+    crystal = Crystal(
+        (79.0, 0, 0), (0, 79.0, 0), (0, 0, 38.0), space_group_symbol="P 43 21 2"
+    )
+    axis = matrix.col((rng.gauss(0, 1), rng.gauss(0, 1), rng.gauss(0, 1))).normalize()
+    U = axis.axis_and_angle_as_r3_rotation_matrix(rng.uniform(0, 2 * math.pi))
+    crystal.set_U(U)
+    return crystal
+
+
+def make_experiments(name, params):
+    """
+    Create the rotation experiment and stills for a reference geometry.
+
+    :param name: The name of the geometry
+    :param params: The input parameters
+    :returns: The rotation experiment and a list of stills
+    """
+    rng = random.Random(params.seed)
+    beam = BeamFactory.simple((0, 0, 1), 1.0)
+    detector = make_detector(name)
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    scan = ScanFactory.make_scan(
+        image_range=(1, params.num_images),
+        exposure_times=0.1,
+        oscillation=(0, 0.1),
+        epochs=list(range(params.num_images)),
+        deg=True,
+    )
+    rotation = Experiment(
+        beam=beam,
+        detector=detector,
+        goniometer=goniometer,
+        scan=scan,
+        crystal=make_crystal(rng),
+    )
+    stills = ExperimentList()
+    for _ in range(params.num_stills):
+        stills.append(
+            Experiment(beam=beam, detector=detector, crystal=make_crystal(rng))
+        )
+    return rotation, stills
+
+
+def _reeke(rotation, stills, params):
+    crystal, goniometer, scan = rotation.crystal, rotation.goniometer, rotation.scan
+    A = matrix.sqr(crystal.get_A())
+    S = matrix.sqr(goniometer.get_setting_rotation())
+    F = matrix.sqr(goniometer.get_fixed_rotation())
+    m2 = matrix.col(goniometer.get_rotation_axis_datum())
+    s0 = rotation.beam.get_s0()
+    space_group_type = crystal.get_space_group().build_derived_patterson_group().type()
+    z0, z1 = scan.get_array_range()
+    R = [
+        m2.axis_and_angle_as_r3_rotation_matrix(scan.get_angle_from_array_index(z))
+        for z in range(z0, z1 + 1)
+    ]
+    count = 0
+    for i in range(z1 - z0):
+        indices = ReekeIndexGenerator(
+            S * R[i] * F * A,
+            S * R[i + 1] * F * A,
+            space_group_type,
+            m2,
+            s0,
+            params.d_min,
+            1,
+        ).to_array()
+        count += len(indices)
+    return count
+
+
+def _scan_static(rotation, stills, params):
+    predictor = ScanStaticReflectionPredictor(rotation, dmin=params.d_min)
+    return len(predictor.for_ub(rotation.crystal.get_A(), nthreads=params.nthreads))
+
+
+def _scan_varying(rotation, stills, params):
+    predictor = ScanVaryingReflectionPredictor(rotation, dmin=params.d_min)
+    A = flex.mat3_double(params.num_images + 1, rotation.crystal.get_A())
+    return len(predictor.for_ub(A))
+
+
+def _stills(rotation, stills, params):
+    count = 0
+    for experiment in stills:
+        predictor = StillsReflectionPredictor(experiment, dmin=params.d_min)
+        count += len(predictor.for_ub(experiment.crystal.get_A()))
+    return count
+
+
+def _ray_intersection(rotation, stills, params):
+    reflections = ScanStaticReflectionPredictor(rotation, dmin=params.d_min).for_ub(
+        rotation.crystal.get_A()
+    )
+    if not len(reflections):
+        return 0
+
+    def run():
+        ray_intersection(rotation.detector, reflections)
+
+    return len(reflections), run
+
+
+benchmarks = {
+    "reeke": _reeke,
+    "scan_static": _scan_static,
+    "scan_varying": _scan_varying,
+    "stills": _stills,
+    "ray_intersection": _ray_intersection,
+}
+
+
+def benchmark(name, rotation, stills, params):
+    """
+    Time a benchmark on the experiments of a reference geometry.
+
+    A benchmark function either does the work and returns the number of
+    reflections, or returns the number of reflections and a function which
+    does the work, when the setup should not be included in the timings.
+
+    :param name: The name of the benchmark
+    :param rotation: The rotation experiment
+    :param stills: The list of stills
+    :param params: The input parameters
+    :returns: A dictionary of the timings and the number of reflections
+    """
+    function = benchmarks[name]
+    times = []
+    count = 0
+    for _ in range(params.repeats):
+        start = time.perf_counter()
+        result = function(rotation, stills, params)
+        if isinstance(result, tuple):
+            count, run = result
+            start = time.perf_counter()
+            run()
+        else:
+            count = result
+        times.append(time.perf_counter() - start)
+    best = min(times)
+    return {
+        "times": times,
+        "best_time": best,
+        "reflections": count,
+        "reflections_per_second": count / best if best else 0,
+    }
+
+
+def run_benchmark(params):
+    """
+    Run the benchmarks and return the results for each geometry.
+    """
+    for name in params.benchmarks:
+        if name not in benchmarks:
+            raise dials.util.Sorry(f"Unknown benchmark {name}")
+    results = {}
+    for geometry in params.geometries:
+        rotation, stills = make_experiments(geometry, params)
+        logger.info("Benchmarking %s", geometry)
+        results[geometry] = {
+            name: benchmark(name, rotation, stills, params)
+            for name in params.benchmarks
+        }
+    return results
+
+
+def show_results(results):
+    """
+    Print a table of the results.
+    """
+    rows = [("Geometry", "Benchmark", "Time (s)", "Reflections", "Refl/s")]
+    for geometry, result in results.items():
+        for name, r in result.items():
+            rows.append(
+                (
+                    geometry,
+                    name,
+                    f"{r['best_time']:.4f}",
+                    f"{r['reflections']}",
+                    f"{r['reflections_per_second']:.3g}",
+                )
+            )
+    logger.info(dials.util.tabulate(rows, headers="firstrow"))
+
+
+@dials.util.show_mail_handle_errors()
+def run(args=None):
+    usage = "dev.dials.benchmark_prediction [options]"
+
+    parser = ArgumentParser(usage=usage, phil=phil_scope, epilog=help_message)
+
+    params, options = parser.parse_args(args, show_diff_phil=True)
+    dials.util.log.config(verbosity=options.verbose)
+
+    results = run_benchmark(params)
+    show_results(results)
+
+    if params.output.json:
+        with open(params.output.json, "w") as outfile:
+            json.dump(results, outfile, indent=2)
+
+
+if __name__ == "__main__":
+    run()
@@ -6,17 +6,19 @@
 
 import iotbx.mtz
 import iotbx.phil
+import libtbx
 from cctbx import crystal
 from dxtbx.model import ExperimentList
-from xfel.clustering.cluster import Cluster
 from xfel.clustering.cluster_groups import unit_cell_info
 
 import dials.util
+from dials.algorithms.clustering.unit_cell import UnitCellCluster
 from dials.array_family import flex
 from dials.util.multi_dataset_handling import (
     assign_unique_identifiers,
     parse_multiple_datasets,
 )
+from dials.util.mp import available_cores
 from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
 
 help_message = """
@@ -27,6 +29,14 @@
 threshold = 5000
   .type = float(value_min=0)
   .help = 'Threshold value for the clustering'
+incremental = False
+  .type = bool
+  .help = "Use incremental single linkage clustering, which avoids computing"
+          "the distances between all pairs of unit cells. No dendrogram is"
+          "plotted."
+nproc = Auto
+  .type = int(value_min=1)
+  .help = "The number of threads used for incremental clustering"
 plot {
   show = False
     .type = bool
@@ -158,9 +168,18 @@ def _assign_and_return_joint(experiments, reflections):
 
 def do_cluster_analysis(crystal_symmetries, params):
     lattice_ids = list(range(len(crystal_symmetries)))
-    ucs = Cluster.from_crystal_symmetries(crystal_symmetries, lattice_ids=lattice_ids)
+    ucs = UnitCellCluster.from_crystal_symmetries(
+        crystal_symmetries, lattice_ids=lattice_ids
+    )
+
+    if params.incremental:
+        nproc = params.nproc
+        if nproc is libtbx.Auto:
+            nproc = available_cores()
+        clusters, _ = ucs.incremental_cluster(params.threshold, nproc=nproc)
+        print(unit_cell_info(clusters))
 
-    if params.plot.show or params.plot.name is not None:
+    elif params.plot.show or params.plot.name is not None:
         if not params.plot.show:
             import matplotlib
 
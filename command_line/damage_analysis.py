@@ -38,6 +38,7 @@
 
 from jinja2 import ChoiceLoader, Environment, PackageLoader
 
+import libtbx.introspection
 from cctbx import crystal, miller
 from iotbx import mtz
 from libtbx import phil
@@ -90,6 +91,9 @@
         .type = str
         .help = "Filename for the html report data in json format."
 }
+nproc = Auto
+    .type = int(value_min=1)
+    .help = "The number of threads used to accumulate the statistics."
 include scope dials.pychef.phil_scope
 """,
     process_includes=True,
@@ -235,6 +239,9 @@ def from_dials_data_files(cls, params, experiments, reflection_table):
 
     def run(self):
         """Run the pychef analysis."""
+        nproc = self.params.nproc
+        if nproc is libtbx.Auto:
+            nproc = libtbx.introspection.number_of_processors()
         self.stats = Statistics(
             self.intensities,
             self.dose,
@@ -242,6 +249,7 @@ def run(self):
             range_min=self.params.range.min,
             range_max=self.params.range.max,
             range_width=self.params.range.width,
+            nthreads=nproc,
         )
 
         logger.debug(self.stats.completeness_vs_dose_str())
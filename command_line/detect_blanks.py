@@ -5,6 +5,7 @@
 import libtbx.phil
 
 from dials.util import detect_blanks, show_mail_handle_errors
+from dials.util.image_summary import read_image_summaries
 
 logger = logging.getLogger("dials.detect_blanks")
 
@@ -21,6 +22,10 @@
   .type = float(value_min=0, value_max=1)
   .help = "Fractional loss (relative to the bin with the highest misigma) after "
           "which a bin is flagged as potentially containing blank images."
+image_summary = None
+  .type = path
+  .help = "Read the per-image summary written by dials.find_spots or "
+          "dials.integrate (output.image_summary) instead of a reflection file."
 output {
   json = blanks.json
     .type = path
@@ -36,6 +41,89 @@
 """
 
 
+def _log_blank_regions(results):
+    for blank_start, blank_end in results["blank_regions"]:
+        logger.info(f"Potential blank images: {blank_start + 1} -> {blank_end}")
+
+
+def _analyse_reflections(reflections, scan, params):
+    integrated_sel = reflections.get_flags(reflections.flags.integrated)
+    indexed_sel = reflections.get_flags(reflections.flags.indexed)
+    centroid_outlier_sel = reflections.get_flags(reflections.flags.centroid_outlier)
+    strong_sel = reflections.get_flags(reflections.flags.strong)
+    indexed_sel &= ~centroid_outlier_sel
+
+    logger.info(f"Analysis of {strong_sel.count(True)} strong reflections:")
+    strong_results = detect_blanks.blank_counts_analysis(
+        reflections.select(strong_sel),
+        scan,
+        phi_step=params.phi_step,
+        fractional_loss=params.counts_fractional_loss,
+    )
+    _log_blank_regions(strong_results)
+
+    indexed_results = None
+    if indexed_sel.count(True) > 0:
+        logger.info(f"Analysis of {indexed_sel.count(True)} indexed reflections:")
+        indexed_results = detect_blanks.blank_counts_analysis(
+            reflections.select(indexed_sel),
+            scan,
+            phi_step=params.phi_step,
+            fractional_loss=params.counts_fractional_loss,
+        )
+        _log_blank_regions(indexed_results)
+
+    integrated_results = None
+    if integrated_sel.count(True) > 0:
+        logger.info(f"Analysis of {integrated_sel.count(True)} integrated reflections:")
+        integrated_results = detect_blanks.blank_integrated_analysis(
+            reflections.select(integrated_sel),
+            scan,
+            phi_step=params.phi_step,
+            fractional_loss=params.misigma_fractional_loss,
+        )
+        _log_blank_regions(integrated_results)
+
+    return strong_results, indexed_results, integrated_results
+
+
+def _analyse_summary(summary, scan, params):
+    logger.info(f"Analysis of {sum(summary['n_strong'])} strong reflections:")
+    strong_results = detect_blanks.blank_counts_analysis_from_summary(
+        summary,
+        scan,
+        phi_step=params.phi_step,
+        fractional_loss=params.counts_fractional_loss,
+    )
+    _log_blank_regions(strong_results)
+
+    indexed_results = None
+    if any(summary["n_indexed"]):
+        logger.info(f"Analysis of {sum(summary['n_indexed'])} indexed reflections:")
+        indexed_results = detect_blanks.blank_counts_analysis_from_summary(
+            summary,
+            scan,
+            phi_step=params.phi_step,
+            fractional_loss=params.counts_fractional_loss,
+            name="n_indexed",
+        )
+        _log_blank_regions(indexed_results)
+
+    integrated_results = None
+    if any(summary["n_integrated"]):
+        n_integrated = sum(summary["n_integrated"])
+        logger.info(f"Analysis of {n_integrated} integrated reflections:")
+        integrated_results = detect_blanks.blank_integrated_analysis_from_summary(
+            summary,
+            scan,
+            phi_step=params.phi_step,
+            fractional_loss=params.misigma_fractional_loss,
+        )
+        _log_blank_regions(integrated_results)
+
+    return strong_results, indexed_results, integrated_results
+
+
 @show_mail_handle_errors()
 def run(args=None):
     from dials.util import log
@@ -44,7 +132,10 @@ def run(args=None):
         reflections_and_experiments_from_files,
     )
 
-    usage = "dials.detect_blanks [options] models.expt observations.refl"
+    usage = (
+        "dials.detect_blanks [options] models.expt "
+        "{observations.refl | image_summary=summary.json}"
+    )
 
     parser = ArgumentParser(
         usage=usage,
@@ -60,7 +151,7 @@ def run(args=None):
         params.input.reflections, params.input.experiments
     )
 
-    if len(experiments) == 0 or len(reflections) == 0:
+    if len(experiments) == 0 or (len(reflections) == 0 and not params.image_summary):
         parser.print_help()
         exit(0)
 
@@ -73,8 +164,6 @@ def run(args=None):
         logger.info("The following parameters have been modified:\n")
         logger.info(diff_phil)
 
-    reflections = reflections[0]
-
     imagesets = experiments.imagesets()
 
     if any(experiment.is_still() for experiment in experiments):
@@ -84,45 +173,14 @@ def run(args=None):
     imageset = imagesets[0]
     scan = imageset.get_scan()
 
-    integrated_sel = reflections.get_flags(reflections.flags.integrated)
-    indexed_sel = reflections.get_flags(reflections.flags.indexed)
-    centroid_outlier_sel = reflections.get_flags(reflections.flags.centroid_outlier)
-    strong_sel = reflections.get_flags(reflections.flags.strong)
-    indexed_sel &= ~centroid_outlier_sel
-
-    logger.info(f"Analysis of {strong_sel.count(True)} strong reflections:")
-    strong_results = detect_blanks.blank_counts_analysis(
-        reflections.select(strong_sel),
-        scan,
-        phi_step=params.phi_step,
-        fractional_loss=params.counts_fractional_loss,
-    )
-    for blank_start, blank_end in strong_results["blank_regions"]:
-        logger.info(f"Potential blank images: {blank_start + 1} -> {blank_end}")
-
-    indexed_results = None
-    if indexed_sel.count(True) > 0:
-        logger.info(f"Analysis of {indexed_sel.count(True)} indexed reflections:")
-        indexed_results = detect_blanks.blank_counts_analysis(
-            reflections.select(indexed_sel),
-            scan,
-            phi_step=params.phi_step,
-            fractional_loss=params.counts_fractional_loss,
+    if params.image_summary:
+        strong_results, indexed_results, integrated_results = _analyse_summary(
+            read_image_summaries(params.image_summary)[0], scan, params
         )
-        for blank_start, blank_end in indexed_results["blank_regions"]:
-            logger.info(f"Potential blank images: {blank_start + 1} -> {blank_end}")
-
-    integrated_results = None
-    if integrated_sel.count(True) > 0:
-        logger.info(f"Analysis of {integrated_sel.count(True)} integrated reflections:")
-        integrated_results = detect_blanks.blank_integrated_analysis(
-            reflections.select(integrated_sel),
-            scan,
-            phi_step=params.phi_step,
-            fractional_loss=params.misigma_fractional_loss,
+    else:
+        strong_results, indexed_results, integrated_results = _analyse_reflections(
+            reflections[0], scan, params
         )
-        for blank_start, blank_end in integrated_results["blank_regions"]:
-            logger.info(f"Potential blank images: {blank_start + 1} -> {blank_end}")
 
     d = {
         "strong": strong_results,
@@ -28,6 +28,9 @@
     .type = int
     .help = "For multi-file images (NeXus for example), report a gain for each"
             "image, up to max_images, and then report an average gain"
+  nproc = 1
+    .type = int(value_min=1)
+    .help = "The number of images to estimate the gain of in parallel"
   output {
     gain_map = None
       .type = str
@@ -38,73 +41,41 @@
 )
 
 
-def estimate_gain(imageset, kernel_size=(10, 10), output_gain_map=None, max_images=1):
+def estimate_gain(
+    imageset, kernel_size=(10, 10), output_gain_map=None, max_images=1, nproc=1
+):
     detector = imageset.get_detector()
 
-    from dials.algorithms.image.threshold import DispersionThresholdDebug
+    from dials.algorithms.image.filter import GainEstimator
 
+    # The gain of each image is estimated from the index of dispersion of its
+    # pixels; nproc images are read and then estimated in parallel
+    num_images = max(1, min(len(imageset), max_images))
+    estimator = GainEstimator(kernel_size)
     gains = flex.double()
 
-    for image_no in range(len(imageset)):
-        raw_data = imageset.get_raw_data(image_no)
-
-        gain_value = 1
-        gain_map = [
-            flex.double(raw_data[i].accessor(), gain_value)
-            for i in range(len(detector))
-        ]
-
-        mask = imageset.get_mask(image_no)
-
-        min_local = 0
-
-        # dummy values, shouldn't affect results
-        nsigma_b = 6
-        nsigma_s = 3
-        global_threshold = 0
-
-        kabsch_debug_list = [
-            DispersionThresholdDebug(
-                raw_data[i_panel].as_double(),
-                mask[i_panel],
-                gain_map[i_panel],
-                kernel_size,
-                nsigma_b,
-                nsigma_s,
-                global_threshold,
-                min_local,
-            )
-            for i_panel in range(len(detector))
-        ]
-
-        dispersion = flex.double()
-        for kabsch in kabsch_debug_list:
-            dispersion.extend(kabsch.index_of_dispersion().as_1d())
-
-        sorted_dispersion = flex.sorted(dispersion)
-        from libtbx.math_utils import nearest_integer as nint
-
-        q1 = sorted_dispersion[nint(len(sorted_dispersion) / 4)]
-        q2 = sorted_dispersion[nint(len(sorted_dispersion) / 2)]
-        q3 = sorted_dispersion[nint(len(sorted_dispersion) * 3 / 4)]
-        iqr = q3 - q1
-
-        print(f"q1, q2, q3: {q1:.2f}, {q2:.2f}, {q3:.2f}")
-        if iqr == 0.0:
-            raise Sorry("Unable to robustly estimate the variation of pixel values.")
-
-        inlier_sel = (sorted_dispersion > (q1 - 1.5 * iqr)) & (
-            sorted_dispersion < (q3 + 1.5 * iqr)
-        )
-        sorted_dispersion = sorted_dispersion.select(inlier_sel)
-        gain = sorted_dispersion[nint(len(sorted_dispersion) / 2)]
-        print(f"Estimated gain: {gain:.2f}")
-        gains.append(gain)
-
-        if image_no == 0:
-            gain0 = gain
-        if image_no + 1 >= max_images:
-            break
+    for first in range(0, num_images, nproc):
+        estimator.clear()
+        for image_no in range(first, min(first + nproc, num_images)):
+            raw_data = imageset.get_raw_data(image_no)
+            mask = imageset.get_mask(image_no)
+            estimator.add_frame()
+            for i_panel in range(len(detector)):
+                estimator.add_panel(raw_data[i_panel].as_double(), mask[i_panel])
+        estimator.estimate(nthreads=nproc)
+
+        for q1, q2, q3, gain in zip(
+            estimator.q1(), estimator.q2(), estimator.q3(), estimator.gain()
+        ):
+            print(f"q1, q2, q3: {q1:.2f}, {q2:.2f}, {q3:.2f}")
+            if q3 - q1 == 0.0:
+                raise Sorry(
+                    "Unable to robustly estimate the variation of pixel values."
+                )
+            print(f"Estimated gain: {gain:.2f}")
+            gains.append(gain)
+
+    gain0 = gains[0]
 
     if len(gains) > 1:
         stats = flex.mean_and_variance(gains)
@@ -158,7 +129,11 @@ def run(args=None):
     assert len(imagesets) == 1
     imageset = imagesets[0]
     estimate_gain(
-        imageset, params.kernel_size, params.output.gain_map, params.max_images
+        imageset,
+        params.kernel_size,
+        params.output.gain_map,
+        params.max_images,
+        params.nproc,
     )
 
 
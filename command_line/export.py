@@ -87,6 +87,13 @@
     .type = bool
     .help = "Output additional debugging information"
 
+  nproc = Auto
+    .type = int(value_min=1)
+    .help = "The number of threads to convert the reflections to MTZ rows or
+             to format them as text for the sadabs, xds_ascii and mmcif
+             formats. Auto uses all the available cores."
+    .expert_level = 2
+
   mtz {
 
     combine_partials = True
@@ -136,6 +143,12 @@
             "and as the overall unit cell in the exported mtz. If None, the median"
             "cell will be used."
 
+    chunk_size = 1000000
+      .type = int(value_min=1)
+      .help = "The number of reflections to convert and write to the file at
+               a time."
+      .expert_level = 2
+
   }
 
   sadabs {
@@ -271,7 +284,7 @@ def export_mtz(params, experiments, reflections):
 
     _check_input(experiments, reflections)
 
-    from dials.util.export_mtz import export_mtz
+    from dials.util.export_mtz import export_mtz, show_mtz_summary
 
     # Handle case where user has passed data before integration
     if (
@@ -311,10 +324,12 @@ def export_mtz(params, experiments, reflections):
         force_static_model=params.mtz.force_static_model,
         crystal_name=params.mtz.crystal_name,
         project_name=params.mtz.project_name,
+        chunk_size=params.mtz.chunk_size,
+        nproc=params.nproc,
     )
 
     summary = StringIO()
-    m.show_summary(out=summary)
+    show_mtz_summary(m, out=summary)
     logger.info("")
     logger.info(summary.getvalue())
 
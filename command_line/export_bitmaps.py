@@ -1,5 +1,7 @@
+import math
 import os
 import sys
+from concurrent.futures import ProcessPoolExecutor
 
 from PIL import Image
 
@@ -69,6 +71,10 @@
   .type = int
 show_mask = False
   .type = bool
+nproc = 1
+  .type = int(value_min=1)
+  .help = "The number of processes to use. The images are split into blocks "
+          "which are exported in parallel."
 png {
   compress_level = 1
     .type = int(value_min=0, value_max=9)
@@ -128,8 +134,6 @@ def run(args=None):
 
 
 def imageset_as_bitmaps(imageset, params):
-    brightness = params.brightness / 100
-    vendortype = "made up"
     # check that binning is a power of 2
     binning = params.binning
     if not (binning > 0 and ((binning & (binning - 1)) == 0)):
@@ -139,20 +143,8 @@ def imageset_as_bitmaps(imageset, params):
         output_dir = "."
     elif not os.path.exists(output_dir):
         os.makedirs(output_dir)
-    output_files = []
-
-    detector = imageset.get_detector()
-
-    # Furnish detector with 2D projection axes
-    detector.projected_2d = get_detector_projection_2d_axes(detector)
-    detector.projection = params.projection
 
-    panel = detector[0]
     scan = imageset.get_scan()
-    # XXX is this inclusive or exclusive?
-    saturation = panel.get_trusted_range()[1]
-    if params.saturation:
-        saturation = params.saturation
     if scan is not None and scan.get_oscillation()[1] > 0 and not params.imageset_index:
         start, end = scan.get_image_range()
     else:
@@ -165,6 +157,43 @@ def imageset_as_bitmaps(imageset, params):
     ]
     if params.output.file and len(image_range) != 1:
         sys.exit("output.file can only be specified if a single image is exported")
+
+    nproc = min(params.nproc, len(image_range))
+    if nproc <= 1:
+        return _export_images(imageset, image_range, start, output_dir, params)
+
+    # Export contiguous blocks of images in parallel, keeping the output order
+    n = int(math.ceil(len(image_range) / nproc))
+    chunks = [image_range[i : i + n] for i in range(0, len(image_range), n)]
+    output_files = []
+    with ProcessPoolExecutor(max_workers=len(chunks)) as p:
+        jobs = [
+            p.submit(_export_images, imageset, chunk, start, output_dir, params)
+            for chunk in chunks
+        ]
+        for job in jobs:
+            output_files.extend(job.result())
+    return output_files
+
+
+def _export_images(imageset, image_range, start, output_dir, params):
+    """Export a list of images from an imageset, returning the file names"""
+    brightness = params.brightness / 100
+    vendortype = "made up"
+    binning = params.binning
+    output_files = []
+
+    detector = imageset.get_detector()
+
+    # Furnish detector with 2D projection axes
+    detector.projected_2d = get_detector_projection_2d_axes(detector)
+    detector.projection = params.projection
+
+    panel = detector[0]
+    # XXX is this inclusive or exclusive?
+    saturation = panel.get_trusted_range()[1]
+    if params.saturation:
+        saturation = params.saturation
     for i_image in image_range:
         image = imageset.get_raw_data(i_image - start)
 
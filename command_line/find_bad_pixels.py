@@ -6,6 +6,7 @@
 from scitbx.array_family import flex
 
 import dials.util
+from dials.algorithms.spot_finding import PixelStatistics
 from dials.algorithms.spot_finding.factory import SpotFinderFactory
 from dials.algorithms.spot_finding.factory import phil_scope as spot_phil
 from dials.util.options import ArgumentParser, flatten_experiments
@@ -58,9 +59,10 @@
 def find_constant_signal_pixels(imageset, images):
     """Find pixels which are constantly reporting as signal through the
     images in imageset: on every image the pixel dispersion index is computed,
-    and signal pixels identified using the default settings. A map is then
-    calculated of the number of times a pixel is identified as signal: if this
-    is >= 50% of the images (say) that pixel is untrustworthy."""
+    and signal pixels identified using the default settings. The statistics
+    of each pixel are accumulated as the images are read, including the number
+    of times it is identified as signal: if this is >= 50% of the images (say)
+    that pixel is untrustworthy."""
 
     panels = imageset.get_detector()
 
@@ -70,11 +72,16 @@ def find_constant_signal_pixels(imageset, images):
     # trusted range the same for all panels anyway
     detector = panels[0]
     trusted = detector.get_trusted_range()
+    trusted_min = int(round(trusted[0]))
+    trusted_max = int(round(trusted[1]))
 
-    # construct an integer array same shape as image; accumulate number of
-    # "signal" pixels in each pixel across data
+    spot_params = spot_phil.fetch(source=iotbx.phil.parse("min_spot_size=1")).extract()
+    threshold_function = SpotFinderFactory.configure_threshold(spot_params)
 
-    total = None
+    # accumulate the statistics of each pixel in an array the same shape as
+    # the image, including the number of times it is a "signal" pixel
+
+    statistics = None
 
     for idx in images:
         pixels = imageset.get_raw_data(idx - 1)
@@ -95,24 +102,22 @@ def find_constant_signal_pixels(imageset, images):
             for j in range(24):
                 data.matrix_paste_block_in_place(pixels[j], j * (ny + 17), 0)
 
-        negative = data < int(round(trusted[0]))
-        hot = data > int(round(trusted[1]))
+        negative = data < trusted_min
+        hot = data > trusted_max
         bad = negative | hot
 
         data = data.as_double()
 
-        spot_params = spot_phil.fetch(
-            source=iotbx.phil.parse("min_spot_size=1")
-        ).extract()
-        threshold_function = SpotFinderFactory.configure_threshold(spot_params)
         peak_pixels = threshold_function.compute_threshold(data, ~bad)
 
-        if total is None:
-            total = peak_pixels.as_1d().as_int()
-        else:
-            total += peak_pixels.as_1d().as_int()
+        # the masked pixels and the gaps are set to -1 so are counted as
+        # untrusted rather than masked out
+        if statistics is None:
+            statistics = PixelStatistics(data.focus(), trusted_min, trusted_max)
+            valid = flex.bool(data.accessor(), True)
+        statistics.add(data, valid, peak_pixels)
 
-    return total
+    return statistics
 
 
 @dials.util.show_mail_handle_errors()
@@ -174,16 +179,17 @@ def run(args=None):
         if len(chunks) < params.nproc:
             params.nproc = len(chunks)
 
-        total = None
+        statistics = None
         with ProcessPoolExecutor(max_workers=params.nproc) as p:
             jobs = []
             for j in range(params.nproc):
                 jobs.append(p.submit(find_constant_signal_pixels, imageset, chunks[j]))
             for job in as_completed(jobs):
-                if total is None:
-                    total = job.result()
+                if statistics is None:
+                    statistics = job.result()
                 else:
-                    total += job.result()
+                    statistics.merge(job.result())
+        total = statistics.num_strong().as_1d()
 
         if hot_mask is None:
             hot_mask = total >= (len(images) // 2)
@@ -10,6 +10,7 @@
 from dials.array_family import flex
 from dials.util import log, show_mail_handle_errors
 from dials.util.ascii_art import spot_counts_per_image_plot
+from dials.util.image_summary import image_summaries, write_image_summaries
 from dials.util.multi_dataset_handling import generate_experiment_identifiers
 from dials.util.options import ArgumentParser, flatten_experiments
 from dials.util.version import dials_version
@@ -64,6 +65,12 @@
     log = 'dials.find_spots.log'
       .type = str
       .help = "The log filename"
+
+    image_summary = None
+      .type = str
+      .help = "Save a per-image summary of the spots, which can be read by"
+              "dials.detect_blanks and dials.spot_counts_per_image in place of"
+              "the reflections."
   }
 
   maximum_trusted_value = None
@@ -201,6 +208,11 @@ def run(self, args=None):
         logger.info(
             "Saved %s reflections to %s", len(reflections), params.output.reflections
         )
+        if params.output.image_summary:
+            write_image_summaries(
+                image_summaries(experiments, reflections, spot_statistics=True),
+                params.output.image_summary,
+            )
 
         # Reset the trusted ranges
         if params.maximum_trusted_value is not None:
@@ -220,8 +232,6 @@ def run(self, args=None):
             for i, experiment in enumerate(experiments):
                 logger.info("Number of centroids per image for imageset %i:", i)
                 refl = reflections.select(reflections["id"] == i)
-                refl.centroid_px_to_mm([experiment])
-                refl.map_centroids_to_reciprocal_space([experiment])
                 stats = per_image_analysis.stats_per_image(
                     experiment, refl, resolution_analysis=False
                 )
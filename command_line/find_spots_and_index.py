@@ -0,0 +1,203 @@
+# DIALS_ENABLE_COMMAND_LINE_COMPLETION
+
+import logging
+import sys
+
+import iotbx.phil
+import libtbx
+
+from dials.algorithms.indexing.progressive import ProgressiveIndexer
+from dials.algorithms.spot_finding.factory import SpotFinderFactory
+from dials.array_family import flex
+from dials.util import log, show_mail_handle_errors, tabulate
+from dials.util.multi_dataset_handling import generate_experiment_identifiers
+from dials.util.options import ArgumentParser, flatten_experiments
+from dials.util.version import dials_version
+
+logger = logging.getLogger("dials.command_line.find_spots_and_index")
+
+help_message = """
+This program finds the strong spots of a rotation sequence and indexes them
+while the images are still being read, rather than finding the spots of the
+whole sequence before indexing them as dials.find_spots and dials.index do.
+
+The strong pixels of each image are labelled in 3D as the image is read, so
+each spot is ready as soon as an image is read with none of its pixels. Once
+the spots cover progressive.min_degrees of rotation a first attempt is made to
+index them, and another attempt is made each time progressive.step_degrees
+more have been read, so that an orientation matrix and unit cell are known
+while the data are still being collected. With indexing.method=fft3d the
+reciprocal space grid is kept between the attempts and the new spots are added
+to it, so each attempt only has to transform the grid. A final attempt is made
+once the last image has been read.
+
+The output is the strong spots, as from dials.find_spots, and the indexed
+experiments and reflections of the last successful attempt, as from
+dials.index.
+
+Examples::
+
+  dials.find_spots_and_index imported.expt
+
+  dials.find_spots_and_index imported.expt progressive.min_degrees=3 \\
+    progressive.step_degrees=2
+"""
+
+phil_scope = iotbx.phil.parse(
+    """\
+progressive {
+  min_degrees = 5
+    .type = float(value_min=0)
+    .help = "The rotation in degrees to read before the first attempt at"
+            "indexing"
+  step_degrees = 5
+    .type = float(value_min=0)
+    .help = "The rotation in degrees to read before each later attempt"
+}
+include scope dials.algorithms.spot_finding.factory.phil_scope
+include scope dials.algorithms.indexing.indexer.phil_scope
+indexing {
+  include scope dials.algorithms.indexing.lattice_search.basis_vector_search_phil_scope
+}
+include scope dials.algorithms.refinement.refiner.phil_scope
+output {
+  strong = strong.refl
+    .type = path
+    .help = "The strong spots"
+  experiments = indexed.expt
+    .type = path
+  reflections = indexed.refl
+    .type = path
+  log = dials.find_spots_and_index.log
+    .type = str
+}
+""",
+    process_includes=True,
+)
+
+# override default refinement parameters, as for dials.index
+phil_overrides = phil_scope.fetch(
+    source=iotbx.phil.parse(
+        """\
+refinement {
+    reflections {
+        reflections_per_degree=100
+    }
+}
+"""
+    )
+)
+working_phil = phil_scope.fetch(sources=[phil_overrides])
+
+
+def find_spots_and_index(experiments, params):
+    """
+    Find the strong spots of a sequence and index them progressively.
+
+    Args:
+        experiments: The experiment of the sequence
+        params: An instance of the phil scope
+
+    Returns:
+        (tuple): tuple containing:
+            strong: The strong spots
+            indexer: The progressive indexer, with the results of each attempt
+    """
+    if params.spotfinder.filter.min_spot_size is libtbx.Auto:
+        detector = experiments[0].imageset.get_detector()
+        if detector[0].get_type() == "SENSOR_PAD":
+            # smaller default value for pixel array detectors
+            params.spotfinder.filter.min_spot_size = 3
+        else:
+            params.spotfinder.filter.min_spot_size = 6
+    spotfinder = SpotFinderFactory.from_parameters(
+        experiments=experiments, params=params
+    )
+    indexer = ProgressiveIndexer(
+        experiments,
+        params,
+        min_degrees=params.progressive.min_degrees,
+        step_degrees=params.progressive.step_degrees,
+    )
+
+    strong = flex.reflection_table()
+    last = len(experiments[0].imageset) - 1
+    for index, spots in spotfinder.find_spots_streaming(experiments[0].imageset):
+        if indexer.add_spots(spots, index) and index < last:
+            indexer.index()
+        strong.extend(spots)
+    indexer.index()
+    return strong, indexer
+
+
+@show_mail_handle_errors()
+def run(args=None, phil=working_phil):
+    usage = "dials.find_spots_and_index [options] imported.expt"
+
+    parser = ArgumentParser(
+        usage=usage,
+        phil=phil,
+        read_experiments=True,
+        read_experiments_from_images=True,
+        epilog=help_message,
+    )
+
+    params, options = parser.parse_args(args=args, show_diff_phil=False)
+
+    # Configure the logging
+    log.config(verbosity=options.verbose, logfile=params.output.log)
+    logger.info(dials_version())
+
+    # Log the diff phil
+    diff_phil = parser.diff_phil.as_str()
+    if diff_phil != "":
+        logger.info("The following parameters have been modified:\n")
+        logger.info(diff_phil)
+
+    experiments = flatten_experiments(params.input.experiments)
+    if len(experiments) == 0:
+        parser.print_help()
+        return
+    if len(experiments) > 1:
+        sys.exit("Only one sequence can be processed")
+    if experiments[0].scan is None or experiments[0].scan.is_still():
+        sys.exit("Progressive indexing needs a rotation sequence")
+    if not experiments[0].identifier:
+        generate_experiment_identifiers(experiments)
+
+    strong, indexer = find_spots_and_index(experiments, params)
+
+    rows = [("Degrees", "Spots", "Indexed", "Unit cell")]
+    for attempt in indexer.attempts:
+        if attempt.unit_cell is None:
+            unit_cell = "failed"
+        else:
+            unit_cell = ", ".join(f"{p:.2f}" for p in attempt.unit_cell.parameters())
+        rows.append(
+            (
+                f"{attempt.degrees:.1f}",
+                attempt.num_spots,
+                attempt.num_indexed,
+                unit_cell,
+            )
+        )
+    logger.info("\n" + tabulate(rows, headers="firstrow"))
+
+    logger.info("Saving %d strong spots to %s", len(strong), params.output.strong)
+    strong.as_file(params.output.strong)
+
+    if indexer.refined_experiments is None:
+        sys.exit("Indexing failed")
+
+    # Save experiments
+    logger.info("Saving refined experiments to %s", params.output.experiments)
+    assert indexer.refined_experiments.is_consistent()
+    indexer.refined_experiments.as_file(params.output.experiments)
+
+    # Save reflections
+    logger.info("Saving refined reflections to %s", params.output.reflections)
+    indexer.refined_reflections.as_file(filename=params.output.reflections)
+
+
+if __name__ == "__main__":
+    run()
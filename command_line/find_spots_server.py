@@ -1,3 +1,6 @@
+import collections
+import copy
+import functools
 import http.server as server_base
 import json
 import logging
@@ -6,6 +9,8 @@
 import time
 import urllib.parse
 
+import msgpack
+
 import libtbx.phil
 from cctbx import uctbx
 from dxtbx.model.experiment_list import ExperimentListFactory
@@ -69,10 +74,22 @@
 To stop the server::
 
   dials.find_spots_client stop [host=hostname] [port=1234]
+
+For low latency feedback the server may be started in persistent mode::
+
+  dials.find_spots_server persistent=True
+
+In this mode each server process keeps the parsed parameters, threshold
+algorithms and masks for each detector geometry between requests, rather than
+recreating them for every image. Clients sending the header
+``Accept: application/msgpack`` receive the response as msgpack rather than JSON.
 """
 
 stop = False
 
+# The warmed-up spot finding state, only used in persistent mode
+_cache = None
+
 
 def _filter_by_resolution(experiments, reflections, d_min=None, d_max=None):
     reflections.centroid_px_to_mm(experiments)
@@ -93,10 +110,81 @@ def _filter_by_resolution(experiments, reflections, d_min=None, d_max=None):
     return reflections
 
 
-def work(filename, cl=None):
-    if cl is None:
-        cl = []
+class SpotFinderCache:
+    """
+    Keep the threshold strategy and mask for each detector geometry and set of
+    spot finding parameters so they can be reused between requests.
+    """
+
+    def __init__(self, max_size=8):
+        self._max_size = max_size
+        self._entries = collections.OrderedDict()
+
+    def get(self, experiments, params, cl):
+        """
+        Get the threshold function and mask generator for the experiments.
+
+        :param experiments: The experiments to find spots on
+        :param params: The spot finding parameters
+        :param cl: The command line the parameters were created from
+        :returns: A tuple of (threshold function, mask generator)
+        """
+        from dials.algorithms.spot_finding.factory import SpotFinderFactory
+
+        imageset = experiments[0].imageset
+        key = (
+            json.dumps(imageset.get_detector().to_dict(), sort_keys=True),
+            tuple(cl),
+        )
+        # Only the resolution dependent masks change with the beam, so the
+        # beam, e.g. the wavelength of each XFEL shot, needn't match otherwise
+        if _mask_depends_on_beam(params.spotfinder.filter):
+            beam = imageset.get_beam()
+            key += (json.dumps(beam.to_dict(), sort_keys=True) if beam else None,)
+        try:
+            entry = self._entries.pop(key)
+        except KeyError:
+            entry = (
+                SpotFinderFactory.configure_threshold(params),
+                _CachedMaskGenerator(params.spotfinder.filter),
+            )
+            if len(self._entries) >= self._max_size:
+                self._entries.popitem(last=False)
+        self._entries[key] = entry
+        return entry
+
+
+def _mask_depends_on_beam(params):
+    """Whether the mask generated with these parameters depends on the beam"""
+    return (
+        params.d_min is not None
+        or params.d_max is not None
+        or any(params.resolution_range or [])
+        or params.ice_rings.filter
+    )
 
+
+class _CachedMaskGenerator:
+    """Generate the mask for the first imageset and reuse it afterwards."""
+
+    def __init__(self, params):
+        self._params = params
+        self._mask = None
+
+    def __call__(self, imageset):
+        from dials.util.masking import generate_mask
+
+        if self._mask is None:
+            self._mask = generate_mask(imageset, params=self._params)
+        return self._mask
+
+
+@functools.lru_cache(maxsize=32)
+def _process_command_line(cl):
+    """
+    Process the per-request command line, caching the result so that the PHIL
+    is only parsed once for each distinct set of parameters.
+    """
     phil_scope = libtbx.phil.parse(
         """\
 ice_rings {
@@ -115,21 +203,34 @@ def work(filename, cl=None):
     )
     interp = phil_scope.command_line_argument_interpreter()
     params, unhandled = interp.process_and_fetch(
-        cl, custom_processor="collect_remaining"
+        list(cl), custom_processor="collect_remaining"
     )
-    filter_ice = params.extract().ice_rings.filter
-    ice_rings_width = params.extract().ice_rings.width
-    index = params.extract().index
-    integrate = params.extract().integrate
-    indexing_min_spots = params.extract().indexing_min_spots
+    server_params = params.extract()
 
     interp = find_spots_phil_scope.command_line_argument_interpreter()
     phil_scope, unhandled = interp.process_and_fetch(
         unhandled, custom_processor="collect_remaining"
     )
+    diff = find_spots_phil_scope.fetch_diff(source=phil_scope).as_str()
+    return server_params, phil_scope.extract(), diff, tuple(unhandled)
+
+
+def work(filename, cl=None, cache=None):
+    if cl is None:
+        cl = []
+
+    server_params, params, diff, unhandled = _process_command_line(tuple(cl))
+    unhandled = list(unhandled)
+    # The cached parameters are modified below so take a copy
+    params = copy.deepcopy(params)
+    filter_ice = server_params.ice_rings.filter
+    ice_rings_width = server_params.ice_rings.width
+    index = server_params.index
+    integrate = server_params.integrate
+    indexing_min_spots = server_params.indexing_min_spots
+
     logger.info("The following spotfinding parameters have been modified:")
-    logger.info(find_spots_phil_scope.fetch_diff(source=phil_scope).as_str())
-    params = phil_scope.extract()
+    logger.info(diff)
     # no need to write the hot mask in the server/client
     params.spotfinder.write_hot_mask = False
     experiments = ExperimentListFactory.from_filenames([filename])
@@ -147,7 +248,16 @@ def work(filename, cl=None):
     params.spotfinder.filter.d_max = None
 
     t0 = time.perf_counter()
-    reflections = flex.reflection_table.from_observations(experiments, params)
+    if cache is not None:
+        threshold_function, mask_generator = cache.get(experiments, params, cl)
+    else:
+        threshold_function, mask_generator = None, None
+    reflections = flex.reflection_table.from_observations(
+        experiments,
+        params,
+        threshold_function=threshold_function,
+        mask_generator=mask_generator,
+    )
 
     if d_min or d_max:
         reflections = _filter_by_resolution(
@@ -312,18 +422,25 @@ def do_GET(self):
         d = {"image": filename}
 
         try:
-            stats = work(filename, params)
+            stats = work(filename, params, cache=_cache)
             d.update(stats)
             response = 200
         except Exception as e:
             d["error"] = str(e)
             response = 500
 
+        if "application/msgpack" in self.headers.get("Accept", ""):
+            content_type = "application/msgpack"
+            body = msgpack.packb(d, use_bin_type=True)
+        else:
+            content_type = "application/json"
+            body = json.dumps(d).encode()
+
         self.send_response(response)
-        self.send_header("Content-type", "application/json")
+        self.send_header("Content-type", content_type)
+        self.send_header("Content-Length", str(len(body)))
         self.end_headers()
-        response = json.dumps(d).encode()
-        self.wfile.write(response)
+        self.wfile.write(body)
 
 
 def serve(httpd):
@@ -340,11 +457,19 @@ def serve(httpd):
   .type = int(value_min=1)
 port = 1701
   .type = int(value_min=1)
+persistent = False
+  .type = bool
+  .help = "Keep the parsed parameters, threshold algorithms and masks for each"
+          "detector geometry between requests to reduce the per-image latency"
 """
 )
 
 
-def main(nproc, port):
+def main(nproc, port, persistent=False):
+    global _cache
+    if persistent:
+        # Created before forking so each process gets its own copy
+        _cache = SpotFinderCache()
     server_class = server_base.HTTPServer
     httpd = server_class(("", port), handler)
     print(time.asctime(), "Serving %d processes on port %d" % (nproc, port))
@@ -370,7 +495,7 @@ def run(args=None):
     params, options = parser.parse_args(args, show_diff_phil=True)
     if params.nproc is libtbx.Auto:
         params.nproc = number_of_processors(return_value_if_unknown=-1)
-    main(params.nproc, params.port)
+    main(params.nproc, params.port, persistent=params.persistent)
 
 
 if __name__ == "__main__":
@@ -20,6 +20,7 @@
 """
 
 
+import atexit
 import logging
 import math
 import sys
@@ -35,6 +36,8 @@
 from dials.array_family import flex
 from dials.util import show_mail_handle_errors
 from dials.util.command_line import heading
+from dials.util.image_summary import image_summaries, write_image_summaries
+from dials.util.mp import mpi_stop_workers, mpi_worker_loop, mpi_world
 from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
 from dials.util.slice import slice_crystal
 from dials.util.version import dials_version
@@ -72,6 +75,11 @@
       .type = str
       .help = "The integration report filename (*.xml or *.json)"
 
+    image_summary = None
+      .type = str
+      .help = "Save a per-image summary of the integrated reflections, which"
+              "can be read by dials.detect_blanks in place of the reflections."
+
     include_bad_reference = False
       .type = bool
       .help = "Include bad reference data including unindexed spots,"
@@ -674,6 +682,15 @@ def run(args=None, phil=working_phil):
 
     params, options = parser.parse_args(args=args, show_diff_phil=False)
 
+    # With MPI only rank 0 runs the program; the other ranks process the tasks
+    # that it sends them
+    if params.integration.mp.method == "mpi":
+        comm = mpi_world()
+        if comm.Get_rank() > 0:
+            mpi_worker_loop(comm)
+            return
+        atexit.register(mpi_stop_workers, comm)
+
     # Configure the logging
     dials.util.log.config(verbosity=options.verbose, logfile=params.output.log)
 
@@ -723,6 +740,10 @@ def run(args=None, phil=working_phil):
             "Saving %d reflections to %s", reflections.size(), params.output.reflections
         )
         reflections.as_file(params.output.reflections)
+        if params.output.image_summary:
+            write_image_summaries(
+                image_summaries(experiments, reflections), params.output.image_summary
+            )
         logger.info("Saving the experiments to %s", params.output.experiments)
         experiments.as_file(params.output.experiments)
 
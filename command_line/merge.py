@@ -3,9 +3,11 @@
 """
 
 import logging
+import os
 import sys
 from io import StringIO
 
+from cctbx import crystal
 from dxtbx.model import ExperimentList
 from iotbx import phil
 
@@ -18,10 +20,15 @@
     show_wilson_scaling_analysis,
     truncate,
 )
+from dials.algorithms.merging.streaming import streaming_merge
 from dials.algorithms.scaling.scaling_library import determine_best_unit_cell
 from dials.util import Sorry, log, show_mail_handle_errors
 from dials.util.export_mtz import match_wavelengths
-from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
+from dials.util.options import (
+    ArgumentParser,
+    flatten_experiments,
+    reflections_and_experiments_from_files,
+)
 from dials.util.version import dials_version
 
 help_message = """
@@ -32,6 +39,8 @@
   dials.merge scaled.expt scaled.refl
 
   dials.merge scaled.expt scaled.refl truncate=False
+
+  dials.merge scaled.expt scaled_*.refl streaming.enable=True
 """
 
 logger = logging.getLogger("dials")
@@ -73,6 +82,24 @@
 n_residues = 200
     .type = int
     .help = "Number of residues to use in Wilson scaling"
+streaming {
+    enable = False
+        .type = bool
+        .help = "Merge the data without loading all the observations into"
+                "memory. The reflection files are read one at a time and sorted"
+                "runs of observations are saved to disk, then merged. More"
+                "than one reflection file may be given. Only data at a single"
+                "wavelength and merging with use_internal_variance=False are"
+                "supported, and a reduced summary of the merging statistics is"
+                "reported."
+    chunk_size = 1000000
+        .type = int(value_min=1)
+        .help = "The number of observations in each sorted run."
+    tmp_dir = None
+        .type = path
+        .help = "The directory for the sorted runs. If undefined, the system"
+                "temporary directory is used."
+}
 merging {
     use_internal_variance = False
         .type = bool
@@ -108,6 +135,46 @@
 )
 
 
+def add_merged_data(
+    params,
+    mtz_dataset,
+    merged_array,
+    merged_anomalous_array,
+    multiplicities,
+    stats_summary,
+):
+    """Truncate and analyse the merged data and save it in the mtz_dataset."""
+    # Save the relevant data in the mtz_dataset dataclass
+    # This will add the data for IMEAN/SIGIMEAN
+    mtz_dataset.merged_array = merged_array
+    # This will add the data for I(+), I(-), SIGI(+), SIGI(-), N(+), N(-)
+    # (or N if there is no anomalous data)
+    mtz_dataset.merged_anomalous_array = merged_anomalous_array
+    mtz_dataset.multiplicities = multiplicities
+
+    if params.anomalous:
+        merged_intensities = merged_anomalous_array
+    else:
+        merged_intensities = merged_array
+
+    anom_amplitudes = None
+    if params.truncate:
+        amplitudes, anom_amplitudes, dano = truncate(merged_intensities)
+        # This will add the data for F, SIGF
+        mtz_dataset.amplitudes = amplitudes
+        # This will add the data for F(+), F(-), SIGF(+), SIGF(-)
+        mtz_dataset.anomalous_amplitudes = anom_amplitudes
+        # This will add the data for DANO, SIGDANO
+        mtz_dataset.dano = dano
+
+    # print out analysis statistics
+    show_wilson_scaling_analysis(merged_intensities)
+    if stats_summary:
+        logger.info(stats_summary)
+    if anom_amplitudes:
+        logger.info(make_dano_table(anom_amplitudes))
+
+
 def merge_data_to_mtz(params, experiments, reflections):
     """Merge data (at each wavelength) and write to an mtz file object."""
     wavelengths = match_wavelengths(
@@ -187,45 +254,117 @@ def merge_data_to_mtz(params, experiments, reflections):
         )
 
         merged_array = merged.array()
-        # Save the relevant data in the mtz_dataset dataclass
-        # This will add the data for IMEAN/SIGIMEAN
-        mtz_dataset.merged_array = merged_array
         if merged_anomalous:
             merged_anomalous_array = merged_anomalous.array()
-            # This will add the data for I(+), I(-), SIGI(+), SIGI(-), N(+), N(-)
-            mtz_dataset.merged_anomalous_array = merged_anomalous_array
-            mtz_dataset.multiplicities = merged_anomalous.redundancies()
+            multiplicities = merged_anomalous.redundancies()
         else:
             merged_anomalous_array = None
-            # This will add the data for N
-            mtz_dataset.multiplicities = merged.redundancies()
-
-        if params.anomalous:
-            merged_intensities = merged_anomalous_array
-        else:
-            merged_intensities = merged_array
-
-        anom_amplitudes = None
-        if params.truncate:
-            amplitudes, anom_amplitudes, dano = truncate(merged_intensities)
-            # This will add the data for F, SIGF
-            mtz_dataset.amplitudes = amplitudes
-            # This will add the data for F(+), F(-), SIGF(+), SIGF(-)
-            mtz_dataset.anomalous_amplitudes = anom_amplitudes
-            # This will add the data for DANO, SIGDANO
-            mtz_dataset.dano = dano
-
-        # print out analysis statistics
-        show_wilson_scaling_analysis(merged_intensities)
-        if stats_summary:
-            logger.info(stats_summary)
-        if anom_amplitudes:
-            logger.info(make_dano_table(anom_amplitudes))
+            multiplicities = merged.redundancies()
+        add_merged_data(
+            params,
+            mtz_dataset,
+            merged_array,
+            merged_anomalous_array,
+            multiplicities,
+            stats_summary,
+        )
 
     # pass the dataclasses to an MTZ writer to generate the mtz file and return.
     return make_merged_mtz_file(mtz_datasets)
 
 
+def streaming_merge_data_to_mtz(params, experiments, reflection_files):
+    """Merge the reflection files out of core and write to an mtz file object."""
+    wavelengths = match_wavelengths(
+        experiments,
+        absolute_tolerance=params.wavelength_tolerance,
+    )
+    if len(wavelengths) > 1:
+        raise ValueError("Streaming merging only supports data at one wavelength")
+    if params.merging.use_internal_variance:
+        raise ValueError(
+            "Streaming merging does not support merging.use_internal_variance=True"
+        )
+    best_unit_cell = params.best_unit_cell
+    if not best_unit_cell:
+        best_unit_cell = determine_best_unit_cell(experiments)
+    crystal_symmetry = crystal.symmetry(
+        unit_cell=best_unit_cell,
+        space_group=experiments[0].crystal.get_space_group(),
+        assert_is_compatible_unit_cell=False,
+    )
+    wavelength = list(wavelengths.keys())[0]
+
+    result = streaming_merge(
+        reflection_files,
+        crystal_symmetry,
+        wavelength=wavelength,
+        chunk_size=params.streaming.chunk_size,
+        tmp_dir=params.streaming.tmp_dir,
+        d_min=params.d_min,
+        d_max=params.d_max,
+        combine_partials=params.combine_partials,
+        partiality_threshold=params.partiality_threshold,
+    )
+    mtz_dataset = MTZDataClass(
+        wavelength=wavelength,
+        project_name=params.output.project_name,
+        dataset_name=params.output.dataset_names[0],
+        crystal_name=params.output.crystal_names[0],
+    )
+    if params.anomalous:
+        merged_anomalous_array = result.merged_anomalous_array
+        multiplicities = result.multiplicities
+    else:
+        merged_anomalous_array = None
+        multiplicities = result.mean_multiplicities
+    add_merged_data(
+        params,
+        mtz_dataset,
+        result.merged_array,
+        merged_anomalous_array,
+        multiplicities,
+        result.statistics_summary(n_bins=params.merging.n_bins),
+    )
+    return make_merged_mtz_file([mtz_dataset])
+
+
+def run_streaming(args, usage):
+    """Run the streaming merging, without reading the reflection files."""
+    parser = ArgumentParser(
+        usage=usage,
+        read_experiments=True,
+        phil=phil_scope,
+        check_format=False,
+        epilog=help_message,
+    )
+    params, options, unhandled = parser.parse_args(
+        args=args, show_diff_phil=False, return_unhandled=True
+    )
+    missing = [arg for arg in unhandled if not os.path.isfile(arg)]
+    if missing:
+        raise Sorry(f"Unable to handle the input arguments: {', '.join(missing)}")
+    reflection_files = unhandled
+    experiments = flatten_experiments(params.input.experiments)
+    if not experiments or not reflection_files:
+        parser.print_help()
+        sys.exit()
+
+    log.config(verbosity=options.verbose, logfile=params.output.log)
+    logger.info(dials_version())
+
+    diff_phil = parser.diff_phil.as_str()
+    if diff_phil != "":
+        logger.info("The following parameters have been modified:\n")
+        logger.info(diff_phil)
+
+    try:
+        mtz_file = streaming_merge_data_to_mtz(params, experiments, reflection_files)
+    except ValueError as e:
+        raise Sorry(e)
+    return params, mtz_file
+
+
 @show_mail_handle_errors()
 def run(args=None):
     """Run the merging from the command-line."""
@@ -239,6 +378,13 @@ def run(args=None):
         check_format=False,
         epilog=help_message,
     )
+    # Check first whether the reflection files should be read in full
+    quick_params, _ = parser.parse_args(args=args, quick_parse=True)
+    if quick_params.streaming.enable:
+        params, mtz_file = run_streaming(args, usage)
+        write_mtz_and_report(params, mtz_file)
+        return
+
     params, options = parser.parse_args(args=args, show_diff_phil=False)
 
     if not params.input.experiments or not params.input.reflections:
@@ -283,6 +429,11 @@ def run(args=None):
     except ValueError as e:
         raise Sorry(e)
 
+    write_mtz_and_report(params, mtz_file)
+
+
+def write_mtz_and_report(params, mtz_file):
+    """Write the mtz file and the html report."""
     logger.info("\nWriting reflections to %s", (params.output.mtz))
     out = StringIO()
     mtz_file.show_summary(out=out)
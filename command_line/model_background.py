@@ -21,6 +21,12 @@
       .type = str
       .help = "The output filename"
 
+    mapped_model = None
+      .type = str
+      .help = "Also write the model to a binary file. When this file is given"
+              "as background.gmodel.model to dials.integrate it is memory"
+              "mapped read-only, so all processes share one copy of the model."
+
     log = 'dials.model_background.log'
       .type = str
       .help = "The log filename"
@@ -80,6 +86,11 @@
       .type = choice
       .help = "Which image to use"
 
+    nthreads = 1
+      .type = int(value_min=1)
+      .help = "The number of threads used to accumulate the background"
+              "statistics from each block of images"
+
   }
 
   include scope dials.algorithms.integration.integrator.phil_scope
@@ -269,6 +280,12 @@ def run(self, args=None):
             static_model.add(m.model)
         with open(params.output.model, "wb") as outfile:
             pickle.dump(static_model, outfile, protocol=pickle.HIGHEST_PROTOCOL)
+        if params.output.mapped_model:
+            logger.info(
+                "Saving memory mappable background model to %s",
+                params.output.mapped_model,
+            )
+            static_model.save(params.output.mapped_model)
 
         # Output some diagnostic images
         image_generator = ImageGenerator(model)
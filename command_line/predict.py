@@ -43,6 +43,10 @@
     .type = float
     .help = "Minimum d-spacing of predicted reflections"
 
+  nthreads = 1
+    .type = int(value_min=1)
+    .help = "The number of threads used for scan static prediction"
+
     include scope dials.algorithms.profile_model.factory.phil_scope
 """,
     process_includes=True,
@@ -104,7 +108,10 @@ def run(self, args=None):
 
             # Populate the reflection table with predictions
             predicted = flex.reflection_table.from_predictions(
-                expt, force_static=params.force_static, dmin=params.d_min
+                expt,
+                force_static=params.force_static,
+                dmin=params.d_min,
+                nthreads=params.nthreads,
             )
             predicted["id"] = flex.int(len(predicted), i_expt)
             predicted_all.extend(predicted)
@@ -1,5 +1,6 @@
 import math
 
+import libtbx
 from cctbx import sgtbx, uctbx
 from iotbx import ccp4_map, phil
 from scitbx.array_family import flex
@@ -7,6 +8,7 @@
 import dials.algorithms.rs_mapper as recviewer
 import dials.util
 from dials.util import Sorry
+from dials.util.mp import available_cores
 from dials.util.options import ArgumentParser, flatten_experiments
 
 help_message = """
@@ -47,6 +49,10 @@
     .type = bool
     .optional = True
     .short_caption = Ignore masks from dxtbx class
+  nproc = Auto
+    .type = int(value_min=1)
+    .help = "The number of threads used to map the images. Each thread keeps a"
+            "grid of its own, needing 12 * grid_size^3 bytes of memory."
 }
 """,
     process_includes=True,
@@ -89,6 +95,9 @@ def run(self, args=None):
         self.grid_size = params.rs_mapper.grid_size
         self.max_resolution = params.rs_mapper.max_resolution
         self.ignore_mask = params.rs_mapper.ignore_mask
+        self.nproc = params.rs_mapper.nproc
+        if self.nproc is libtbx.Auto:
+            self.nproc = available_cores()
 
         self.grid = flex.double(
             flex.grid(self.grid_size, self.grid_size, self.grid_size), 0
@@ -138,24 +147,36 @@ def process_imageset(self, imageset):
         s1 = s1 / s1.norms() * (1 / beam.get_wavelength())
         S = s1 - s0
 
+        axis = imageset.get_goniometer().get_rotation_axis()
+        mapper = recviewer.ReciprocalSpaceMapper(
+            S, xy, axis, self.grid_size, rec_range, nthreads=self.nproc
+        )
+
+        # Read the images in batches of one per thread and map each batch with
+        # the threads
+        images = []
+        angles = flex.double()
         for i in range(len(imageset)):
-            axis = imageset.get_goniometer().get_rotation_axis()
             osc_range = imageset.get_scan(i).get_oscillation_range()
             print(f"Oscillation range: {osc_range[0]:.2f} - {osc_range[1]:.2f}")
             angle = (osc_range[0] + osc_range[1]) / 2 / 180 * math.pi
             if not self.reverse_phi:
                 # the pixel is in S AFTER rotation. Thus we have to rotate BACK.
                 angle *= -1
-            rotated_S = S.rotate_around_origin(axis, angle)
 
             data = imageset.get_raw_data(i)[0]
             if not self.ignore_mask:
                 mask = imageset.get_mask(i)[0]
                 data.set_selected(~mask, 0)
 
-            recviewer.fill_voxels(
-                data, self.grid, self.counts, rotated_S, xy, rec_range
-            )
+            images.append(data)
+            angles.append(angle)
+            if len(images) == self.nproc or i == len(imageset) - 1:
+                mapper.add_images(images, angles)
+                images = []
+                angles = flex.double()
+
+        mapper.merge(self.grid, self.counts)
 
 
 @dials.util.show_mail_handle_errors()
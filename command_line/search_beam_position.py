@@ -19,6 +19,7 @@
 from scitbx.simplex import simplex_opt
 
 import dials.util
+from dials.algorithms.indexing import ext
 from dials.algorithms.indexing.indexer import find_max_cell
 from dials.util import Sorry, log
 from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
@@ -68,6 +69,13 @@
   .help = "Number of macro cycles for an iterative beam centre search."
 d_min = None
   .type = float(value_min=0)
+native_scoring = False
+  .type = bool
+  .help = "Score the trial origin offsets natively against the real space basis"
+          "vectors of the DPS solutions, mapping the lab coordinates of the"
+          "spots found once to reciprocal space for each offset, instead of"
+          "updating the detector model and running the directional FFTs of each"
+          "solution for every offset."
 
 seed = 42
   .type = int(value_min=0)
@@ -90,9 +98,15 @@ def optimize_origin_offset_local_scope(
     mm_search_scope=4,
     wide_search_binning=1,
     plot_search_scope=False,
+    scorer=None,
+    nproc=1,
 ):
     """Local scope: find the optimal origin-offset closest to the current overall detector position
-    (local minimum, simple minimization)"""
+    (local minimum, simple minimization)
+
+    If a native OriginOffsetScorer is given then it scores the offsets of the
+    grid search, in parallel over nproc threads, and does the local refinement,
+    instead of the directional FFTs of the solutions."""
 
     beam = experiments[0].beam
     s0 = matrix.col(beam.get_s0())
@@ -126,11 +140,19 @@ def get_experiment_score_for_coord(x, y):
                 for i, experiment in enumerate(experiments)
             )
 
-        scores = flex.double(
-            get_experiment_score_for_coord(x, y)
-            for y in range(-grid, grid + 1)
-            for x in range(-grid, grid + 1)
-        )
+        if scorer is not None:
+            offsets = flex.vec3_double(
+                (x * plot_px_sz * beamr1 + y * plot_px_sz * beamr2).elems
+                for y in range(-grid, grid + 1)
+                for x in range(-grid, grid + 1)
+            )
+            scores = scorer.scores(offsets, nthreads=nproc)
+        else:
+            scores = flex.double(
+                get_experiment_score_for_coord(x, y)
+                for y in range(-grid, grid + 1)
+                for x in range(-grid, grid + 1)
+            )
 
         def igrid(x):
             return x - (widegrid // 2)
@@ -185,7 +207,15 @@ def target(self, vector):
                 )
             return target
 
-    new_offset = simplex_minimizer(wide_search_offset).offset
+    if scorer is not None:
+        start = wide_search_offset
+        if start is None:
+            start = matrix.col((0, 0, 0))
+        new_offset = matrix.col(
+            scorer.refine(start.elems, beamr1.elems, beamr2.elems, step=0.2)
+        )
+    else:
+        new_offset = simplex_minimizer(wide_search_offset).offset
 
     if plot_search_scope:
         plot_px_sz = experiments[0].get_detector()[0].get_pixel_size()[0]
@@ -351,7 +381,41 @@ def run_dps(experiment, spots_mm, max_cell):
     # There must be at least 3 solutions to make a set, otherwise return empty result
     if len(solutions) < 3:
         return {}
-    return {"solutions": flex.vec3_double(s.dvec for s in solutions), "amax": DPS.amax}
+    return {
+        "solutions": flex.vec3_double(s.dvec for s in solutions),
+        "basis_vectors": flex.vec3_double(
+            (matrix.col(s.dvec) * s.real).elems for s in solutions
+        ),
+        "amax": DPS.amax,
+    }
+
+
+def _origin_offset_scorer(experiments, reflection_lists, basis_vector_lists):
+    """
+    Create a native scorer of the origin offsets from the lab coordinates of
+    the spots on the current detector and the basis vectors of the solutions.
+    """
+    scorer = ext.OriginOffsetScorer()
+    for expt, refl, basis_vectors in zip(
+        experiments, reflection_lists, basis_vector_lists
+    ):
+        x, y, phi = refl["xyzobs.mm.value"].parts()
+        panel_numbers = flex.size_t(refl["panel"])
+        lab_coords = flex.vec3_double(len(refl))
+        for i_panel, panel in enumerate(expt.detector):
+            sel = panel_numbers == i_panel
+            lab_coords.set_selected(
+                sel, panel.get_lab_coord(flex.vec2_double(x.select(sel), y.select(sel)))
+            )
+        scorer.add_experiment(
+            lab_coords=lab_coords,
+            phi=phi,
+            s0=expt.beam.get_s0(),
+            rotation_axis=expt.goniometer.get_rotation_axis_datum(),
+            setting_rotation=expt.goniometer.get_setting_rotation(),
+            basis_vectors=basis_vectors[:20],
+        )
+    return scorer
 
 
 def discover_better_experimental_model(
@@ -415,16 +479,22 @@ def discover_better_experimental_model(
     with concurrent.futures.ProcessPoolExecutor(max_workers=nproc) as pool:
         solution_lists = []
         amax_list = []
+        basis_vector_lists = []
         for result in pool.map(
             run_dps, experiments, refl_lists, itertools.repeat(max_cell)
         ):
             if result.get("solutions"):
                 solution_lists.append(result["solutions"])
                 amax_list.append(result["amax"])
+                basis_vector_lists.append(result["basis_vectors"])
 
     if not solution_lists:
         raise Sorry("No solutions found")
 
+    scorer = None
+    if params.native_scoring:
+        scorer = _origin_offset_scorer(experiments, refl_lists, basis_vector_lists)
+
     new_experiments = optimize_origin_offset_local_scope(
         experiments,
         refl_lists,
@@ -433,6 +503,8 @@ def discover_better_experimental_model(
         mm_search_scope=mm_search_scope,
         wide_search_binning=wide_search_binning,
         plot_search_scope=plot_search_scope,
+        scorer=scorer,
+        nproc=nproc,
     )
     new_detector = new_experiments[0].detector
     old_panel, old_beam_centre = detector.get_ray_intersection(beam.get_s0())
@@ -2,7 +2,6 @@
 
 
 import dials.util
-from dials.array_family import flex
 
 help_message = """
 
@@ -48,12 +47,6 @@ def __init__(self):
             usage=usage, phil=phil_scope, read_reflections=True, epilog=help_message
         )
 
-    @staticmethod
-    def sort_permutation(column, reverse=False):
-        indices = flex.size_t_range(len(column))
-        perm = sorted(indices, key=lambda k: column[k], reverse=reverse)
-        return flex.size_t(perm)
-
     def run(self, args=None):
         """Execute the script."""
         from dials.util.options import flatten_reflections
@@ -73,7 +66,7 @@ def run(self, args=None):
 
         # Sort the reflections
         print(f"Sorting by {params.key} with reverse={params.reverse!r}")
-        perm = self.sort_permutation(reflections[params.key], params.reverse)
+        perm = reflections.sort_permutation([params.key], params.reverse)
         reflections = reflections.select(perm)
 
         if options.verbose > 0:
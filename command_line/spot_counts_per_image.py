@@ -6,6 +6,7 @@
 import dials.util
 from dials.algorithms.spot_finding import per_image_analysis
 from dials.util import tabulate
+from dials.util.image_summary import read_image_summaries
 from dials.util.options import ArgumentParser, reflections_and_experiments_from_files
 
 help_message = """
@@ -19,6 +20,8 @@
   dials.spot_counts_per_image imported.expt strong.refl
 
   dials.spot_counts_per_image imported.expt strong.refl plot=per_image.png
+
+  dials.spot_counts_per_image image_summary=summary.json
 """
 
 phil_scope = iotbx.phil.parse(
@@ -35,6 +38,11 @@
   .type = bool
 id = None
   .type = int(value_min=0)
+image_summary = None
+  .type = path
+  .help = "Read the per-image summary written by dials.find_spots"
+          "(output.image_summary) instead of the reflections. The resolution"
+          "analysis needs the reflections, so is not done."
 """
 )
 
@@ -57,6 +65,23 @@ def run(args=None):
         params.input.reflections, params.input.experiments
     )
 
+    if params.image_summary:
+        summaries = read_image_summaries(params.image_summary)
+        if params.id is not None:
+            summaries = [summaries[params.id]]
+        stats = _combine_stats(
+            per_image_analysis.stats_from_image_summary(s) for s in summaries
+        )
+        print(stats)
+        rows = [
+            ("Overall statistics", ""),
+            ("#spots", "%i" % sum(stats.n_spots_total)),
+            ("#spots_no_ice", "%i" % sum(stats.n_spots_no_ice)),
+        ]
+        print(tabulate(rows, headers="firstrow"))
+        _write_stats(stats, params)
+        return
+
     if not reflections and not experiments:
         parser.print_help()
         return
@@ -86,14 +111,7 @@ def run(args=None):
             expt, refl, resolution_analysis=params.resolution_analysis
         )
         all_stats.append(stats)
-
-    # transpose stats
-    summary_table = {}
-    for s in all_stats:
-        for k, value in s._asdict().items():
-            summary_table.setdefault(k, [])
-            summary_table[k].extend(value)
-    stats = per_image_analysis.StatsMultiImage(**summary_table)
+    stats = _combine_stats(all_stats)
     print(stats)
 
     overall_stats = per_image_analysis.stats_for_reflection_table(
@@ -117,6 +135,20 @@ def run(args=None):
     ]
     print(tabulate(rows, headers="firstrow"))
 
+    _write_stats(stats, params)
+
+
+def _combine_stats(all_stats):
+    # transpose stats
+    summary_table = {}
+    for s in all_stats:
+        for k, value in s._asdict().items():
+            summary_table.setdefault(k, [])
+            summary_table[k].extend(value)
+    return per_image_analysis.StatsMultiImage(**summary_table)
+
+
+def _write_stats(stats, params):
     if params.json:
         if params.split_json:
             for k, v in stats._asdict().items():
@@ -183,6 +183,31 @@
                 processed
     }
   }
+
+  worker {
+    queue = None
+      .type = str
+      .help = Run as a long-lived worker, reading the paths of the images to     \
+              process one per line from this file as they are appended to it,  \
+              or from the standard input if "-". The parameters, reference      \
+              geometry, masks and spot finding threshold are set up once and    \
+              kept between images. A line reading "endrun" stops the worker.   \
+              With MPI, a %d in the path is replaced by the rank so that each   \
+              rank can be given its own queue.
+    chunk_size = 100
+      .type = int(value_min=1)
+      .help = With composite output, write the results of the worker after this \
+              many images, starting a new set of files each time so that the    \
+              results can be used while the worker is still running.
+    poll_interval = 1
+      .type = float(value_min=0)
+      .help = The time in seconds to wait before reading the queue again when   \
+              there are no new paths in it
+    timeout = None
+      .type = float(value_min=0)
+      .help = If set, stop the worker when no new paths have been queued for this \
+              many seconds
+  }
 """
 
 dials_phil_str = """
@@ -327,6 +352,51 @@ def do_import(filename, load_models=True):
     return all_experiments
 
 
+def follow_queue(path, poll_interval=1, timeout=None):
+    """
+    Yield the paths queued one per line in a file, following the file as more
+    paths are appended to it, until a line reading "endrun". If the path is "-"
+    the paths are read from the standard input until it is closed instead.
+
+    :param path: The path of the queue file
+    :param poll_interval: The time to wait for more paths at the end of the file
+    :param timeout: If set, stop when no new paths have arrived for this long
+    """
+    if path == "-":
+        for line in sys.stdin:
+            line = line.strip()
+            if line == "endrun":
+                return
+            if line:
+                yield line
+        return
+
+    with open(path) as fh:
+        partial = ""
+        last = time.time()
+        while True:
+            line = fh.readline()
+            if not line:
+                if timeout is not None and time.time() - last > timeout:
+                    # Take the last line if it wasn't terminated
+                    partial = partial.strip()
+                    if partial and partial != "endrun":
+                        yield partial
+                    return
+                time.sleep(poll_interval)
+                continue
+            # The writer may not have finished the line yet
+            partial += line
+            if not partial.endswith("\n"):
+                continue
+            line, partial = partial.strip(), ""
+            last = time.time()
+            if line == "endrun":
+                return
+            if line:
+                yield line
+
+
 def sync_geometry(src, dest):
     dest.set_local_frame(
         src.get_local_fast_axis(), src.get_local_slow_axis(), src.get_local_origin()
@@ -415,7 +485,7 @@ def run(self, args=None):
             params, options, all_paths = comm.bcast(transmitted_info, root=0)
 
         # Check we have some filenames
-        if not all_paths:
+        if not all_paths and params.worker.queue is None:
             self.parser.print_help()
             return
 
@@ -678,7 +748,9 @@ def process_this_event(nevent):
                 return n_accept
 
         # Process the data
-        if params.mp.method == "mpi":
+        if params.worker.queue is not None:
+            self.run_worker(rank, update_geometry)
+        elif params.mp.method == "mpi":
             if size <= 2:  # client/server only makes sense for n>2
                 subset = [
                     item for i, item in enumerate(iterable) if (i + rank) % size == 0
@@ -764,6 +836,97 @@ def process_this_event(nevent):
             )
 
 
+    def run_worker(self, rank, update_geometry):
+        """
+        Process the images queued for this worker as they arrive, with a single
+        processor kept for the lifetime of the worker so that everything set up
+        from the parameters, e.g. the masks and the spot finding threshold, is
+        reused between images. With composite output the results are written
+        every worker.chunk_size images.
+
+        :param rank: The rank of this worker
+        :param update_geometry: The manual geometry updater
+        """
+        from dials.command_line.find_spots_server import SpotFinderCache
+
+        params = self.params
+        if params.mp.composite_stride is not None:
+            raise Sorry("mp.composite_stride is not supported in worker mode")
+        queue = params.worker.queue
+        if "%d" in queue:
+            queue = queue % rank
+        if queue != "-" and not os.path.isfile(queue):
+            raise Sorry(f"Queue {queue} not found")
+        logger.info("Running as a worker, reading paths from %s", queue)
+
+        chunk = 0
+        processor = Processor(
+            copy.deepcopy(params), composite_tag="%04d_%05d" % (rank, chunk), rank=rank
+        )
+        processor.spotfinder_cache = SpotFinderCache()
+
+        num_images = 0
+        for path in follow_queue(
+            queue,
+            poll_interval=params.worker.poll_interval,
+            timeout=params.worker.timeout,
+        ):
+            if params.input.max_images and num_images >= params.input.max_images:
+                break
+            try:
+                experiments = do_import(path, load_models=True)
+            except Abort as e:
+                logger.warning("Could not import %s, %s", path, e)
+                continue
+
+            basename = os.path.splitext(os.path.basename(path))[0]
+            for i in range(len(experiments)):
+                if params.input.max_images and num_images >= params.input.max_images:
+                    break
+                if len(experiments) > 1:
+                    tag = "%s_%05d" % (basename, i)
+                else:
+                    tag = basename
+                if params.input.image_tag and tag not in params.input.image_tag:
+                    continue
+
+                subset = experiments[i : i + 1]
+                experiment = subset[0]
+                imageset = experiment.imageset
+                try:
+                    update_geometry(imageset)
+                    experiment.beam = imageset.get_beam()
+                    experiment.detector = imageset.get_detector()
+                except RuntimeError as e:
+                    logger.warning("Error updating geometry on item %s, %s", tag, e)
+                    continue
+
+                if self.reference_detector is not None:
+                    if params.input.sync_reference_geom:
+                        sync_geometry(
+                            self.reference_detector.hierarchy(),
+                            imageset.get_detector().hierarchy(),
+                        )
+                        experiment.detector = imageset.get_detector()
+                    else:
+                        experiment.detector = copy.deepcopy(self.reference_detector)
+
+                processor.process_experiments(tag, subset)
+                imageset.clear_cache()
+                num_images += 1
+
+                # Write the results so far and start the next set of files
+                if (
+                    params.output.composite_output
+                    and num_images % params.worker.chunk_size == 0
+                ):
+                    processor.finalize()
+                    chunk += 1
+                    processor.setup_composite_output("%04d_%05d" % (rank, chunk))
+
+        logger.info("Worker processed %d images", num_images)
+        processor.finalize()
+
 class Processor:
     def __init__(self, params, composite_tag=None, rank=0):
         self.params = params
@@ -799,21 +962,30 @@ def __init__(self, params, composite_tag=None, rank=0):
         if write_newline:  # needed if the there was a crash
             self.debug_write("")
 
+        # A cache of the spot finding threshold and mask for each detector, set
+        # for a long-lived processor to reuse them between images
+        self.spotfinder_cache = None
+
         if params.output.composite_output:
-            assert composite_tag is not None
+            self.setup_composite_output(composite_tag)
 
-            self.all_imported_experiments = ExperimentList()
-            self.all_strong_reflections = flex.reflection_table()
-            self.all_indexed_experiments = ExperimentList()
-            self.all_indexed_reflections = flex.reflection_table()
-            self.all_integrated_experiments = ExperimentList()
-            self.all_integrated_reflections = flex.reflection_table()
-            self.all_int_pickle_filenames = []
-            self.all_int_pickles = []
-            self.all_coset_experiments = ExperimentList()
-            self.all_coset_reflections = flex.reflection_table()
+    def setup_composite_output(self, composite_tag):
+        """Start a new, empty, set of composite output files with this tag"""
+        assert composite_tag is not None
+        self.composite_tag = composite_tag
 
-            self.setup_filenames(composite_tag)
+        self.all_imported_experiments = ExperimentList()
+        self.all_strong_reflections = flex.reflection_table()
+        self.all_indexed_experiments = ExperimentList()
+        self.all_indexed_reflections = flex.reflection_table()
+        self.all_integrated_experiments = ExperimentList()
+        self.all_integrated_reflections = flex.reflection_table()
+        self.all_int_pickle_filenames = []
+        self.all_int_pickles = []
+        self.all_coset_experiments = ExperimentList()
+        self.all_coset_reflections = flex.reflection_table()
+
+        self.setup_filenames(composite_tag)
 
     def setup_filenames(self, tag):
         # before processing, set output paths according to the templates
@@ -1032,8 +1204,18 @@ def find_spots(self, experiments):
         logger.info("*" * 80)
 
         # Find the strong spots
+        if self.spotfinder_cache is not None:
+            threshold_function, mask_generator = self.spotfinder_cache.get(
+                experiments, self.params, ()
+            )
+        else:
+            threshold_function, mask_generator = None, None
         observed = flex.reflection_table.from_observations(
-            experiments, self.params, is_stills=True
+            experiments,
+            self.params,
+            is_stills=True,
+            threshold_function=threshold_function,
+            mask_generator=mask_generator,
         )
 
         # Reset z coordinates for dials.image_viewer; see Issues #226 for details
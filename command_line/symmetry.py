@@ -89,6 +89,10 @@
   .help = "If True, then for monoclinic centered cells, I2 will be preferred over C2 if"
           "it gives a less oblique cell (i.e. smaller beta angle)."
 
+nproc = 1
+  .type = int(value_min=1)
+  .help = "The number of threads to use when scoring the symmetry elements."
+
 systematic_absences {
 
   check = True
@@ -355,6 +359,7 @@ def symmetry(experiments, reflection_tables, params=None):
             relative_length_tolerance=params.relative_length_tolerance,
             absolute_angle_tolerance=params.absolute_angle_tolerance,
             best_monoclinic_beta=params.best_monoclinic_beta,
+            nproc=params.nproc,
         )
         logger.info("")
         logger.info(result)
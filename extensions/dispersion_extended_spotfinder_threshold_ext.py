@@ -29,6 +29,13 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The threshold buffers cannot be pickled, they are recreated if needed
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -38,6 +45,29 @@ def compute_threshold(self, image, mask):
         :param mask: The pixel mask on the image
         :returns: A boolean mask showing foreground/background pixels
         """
+        return self._get_algorithm(image, mask)(image, mask)
+
+    def compute_threshold_batch(self, images, masks):
+        """
+        Compute the threshold for a batch of images of the same size in one
+        call.
+
+        :param images: The list of images to process
+        :param masks: The pixel mask on each image
+        :returns: The list of boolean masks showing foreground/background pixels
+        """
+        if len(images) == 0:
+            return []
+        return self._get_algorithm(images[0], masks[0]).compute_batch(images, masks)
+
+    def _get_algorithm(self, image, mask):
+        """
+        Get the threshold strategy, creating it on first use.
+
+        :param image: The image to process
+        :param mask: The pixel mask on the image
+        :returns: The threshold strategy
+        """
 
         params = self.params
         if params.spotfinder.threshold.dispersion.global_threshold is libtbx.Auto:
@@ -49,17 +79,21 @@ def compute_threshold(self, image, mask):
                 params.spotfinder.threshold.dispersion.global_threshold,
             )
 
-        self._algorithm = DispersionExtendedThresholdStrategy(
-            kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
-            gain=params.spotfinder.threshold.dispersion.gain,
-            mask=params.spotfinder.lookup.mask,
-            n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
-            n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
-            min_count=params.spotfinder.threshold.dispersion.min_local,
-            global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
-        )
+        # The strategy keeps its buffers between images, so only create it once
+        if self._algorithm is None:
+            self._algorithm = DispersionExtendedThresholdStrategy(
+                kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
+                gain=params.spotfinder.threshold.dispersion.gain,
+                mask=params.spotfinder.lookup.mask,
+                n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
+                n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
+                min_count=params.spotfinder.threshold.dispersion.min_local,
+                global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+                tile_size=params.spotfinder.threshold.dispersion.tile_size,
+                nthreads=params.spotfinder.threshold.dispersion.nthreads,
+            )
 
-        return self._algorithm(image, mask)
+        return self._algorithm
 
 
 def estimate_global_threshold(image, mask=None, plot=False):
@@ -59,6 +59,20 @@ def phil():
         .type = float
         .help = "The global threshold value. Consider all pixels less than this"
                 "value to be part of the background."
+
+      tile_size = None
+        .help = "If set, threshold each panel in tiles of this size (ny nx)."
+                "Each tile is padded with enough neighbouring pixels that the"
+                "result is the same as thresholding the whole panel."
+        .type = ints(size=2, value_min=1)
+        .expert_level = 2
+
+      nthreads = 1
+        .help = "The number of threads used to threshold the tiles of a"
+                "single image. If greater than 1 and tile_size is not set"
+                "then tiles of 512 x 512 pixels are used."
+        .type = int(value_min=1)
+        .expert_level = 2
     """
         )
         return phil
@@ -70,6 +84,13 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The threshold buffers cannot be pickled, they are recreated if needed
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -79,6 +100,40 @@ def compute_threshold(self, image, mask):
         :param mask: The pixel mask on the image
         :returns: A boolean mask showing foreground/background pixels
         """
+        return self._get_algorithm(image, mask)(image, mask)
+
+    def compute_threshold_runs(self, image, mask):
+        """
+        Compute the threshold and return the strong pixels as runs, which
+        avoids creating the dense mask for the whole image.
+
+        :param image: The image to process
+        :param mask: The pixel mask on the image
+        :returns: The strong pixel runs
+        """
+        return self._get_algorithm(image, mask).compute_runs(image, mask)
+
+    def compute_threshold_batch(self, images, masks):
+        """
+        Compute the threshold for a batch of images of the same size in one
+        call.
+
+        :param images: The list of images to process
+        :param masks: The pixel mask on each image
+        :returns: The list of boolean masks showing foreground/background pixels
+        """
+        if len(images) == 0:
+            return []
+        return self._get_algorithm(images[0], masks[0]).compute_batch(images, masks)
+
+    def _get_algorithm(self, image, mask):
+        """
+        Get the threshold strategy, creating it on first use.
+
+        :param image: The image to process
+        :param mask: The pixel mask on the image
+        :returns: The threshold strategy
+        """
 
         import libtbx
 
@@ -92,19 +147,25 @@ def compute_threshold(self, image, mask):
                 params.spotfinder.threshold.dispersion.global_threshold,
             )
 
-        from dials.algorithms.spot_finding.threshold import DispersionThresholdStrategy
+        # The strategy keeps its buffers between images, so only create it once
+        if self._algorithm is None:
+            from dials.algorithms.spot_finding.threshold import (
+                DispersionThresholdStrategy,
+            )
 
-        self._algorithm = DispersionThresholdStrategy(
-            kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
-            gain=params.spotfinder.threshold.dispersion.gain,
-            mask=params.spotfinder.lookup.mask,
-            n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
-            n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
-            min_count=params.spotfinder.threshold.dispersion.min_local,
-            global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
-        )
+            self._algorithm = DispersionThresholdStrategy(
+                kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
+                gain=params.spotfinder.threshold.dispersion.gain,
+                mask=params.spotfinder.lookup.mask,
+                n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
+                n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
+                min_count=params.spotfinder.threshold.dispersion.min_local,
+                global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+                tile_size=params.spotfinder.threshold.dispersion.tile_size,
+                nthreads=params.spotfinder.threshold.dispersion.nthreads,
+            )
 
-        return self._algorithm(image, mask)
+        return self._algorithm
 
 
 def estimate_global_threshold(image, mask=None, plot=False):
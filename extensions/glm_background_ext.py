@@ -25,6 +25,24 @@ def phil():
       min_pixels = 10
         .type = int(value_min=1)
         .help = "The minimum number of pixels required"
+
+      nthreads = 1
+        .type = int(value_min=1)
+        .help = "The number of threads used to model the backgrounds of the"
+                "shoeboxes in a job. Leave at 1 when the jobs already run on"
+                "every core."
+        .expert_level = 2
+
+      share_overlaps = False
+        .type = bool
+        .help = "Fit one background to each cluster of overlapping shoeboxes"
+                "and share it between the reflections in the cluster"
+        .expert_level = 2
+
+      max_cluster_size = 8
+        .type = int(value_min=1)
+        .help = "The maximum number of shoeboxes sharing a background"
+        .expert_level = 2
     """
         )
         return phil
@@ -52,6 +70,9 @@ def __init__(self, params, experiments):
             tuning_constant=params.robust.tuning_constant,
             model=params.model.algorithm,
             min_pixels=params.min_pixels,
+            nthreads=params.nthreads,
+            share_overlaps=params.share_overlaps,
+            max_cluster_size=params.max_cluster_size,
         )
 
     def compute_background(self, reflections, image_volume=None):
@@ -90,6 +90,17 @@ def phil():
       min_pixels = 10
         .type = int(value_min=1)
         .help = "The minimum number of pixels to compute the background"
+
+      share_overlaps = False
+        .type = bool
+        .help = "Fit one background to each cluster of overlapping shoeboxes"
+                "and share it between the reflections in the cluster"
+        .expert_level = 2
+
+      max_cluster_size = 8
+        .type = int(value_min=1)
+        .help = "The maximum number of shoeboxes sharing a background"
+        .expert_level = 2
     """
         )
         return phil
@@ -116,6 +127,8 @@ def __init__(self, params, experiments):
             "model": params.model.algorithm,
             "outlier": params.outlier.algorithm,
             "min_pixels": params.min_pixels,
+            "share_overlaps": params.share_overlaps,
+            "max_cluster_size": params.max_cluster_size,
         }
 
         # Create all the keyword parameters
@@ -23,5 +23,6 @@
     "Prediction",
     "Ray",
     "Shoebox",
+    "StrongPixelRuns",
     "make_image",
 )
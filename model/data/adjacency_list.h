@@ -11,31 +11,83 @@
 #ifndef DIALS_MODEL_ADJACENCY_LIST_H
 #define DIALS_MODEL_ADJACENCY_LIST_H
 
-#include <iostream>
-#include <deque>
+#include <algorithm>
+#include <limits>
 #include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace model {
 
-  // Create the adjacency list type
-  // typedef boost::adjacency_list<
-  //  boost::listS,
-  //  boost::vecS,
-  //  boost::undirectedS> AdjacencyList;
-
-  // typedef boost_adaptbx::graph_type::adjacency_list_undirected_vecS_setS_type
-  // AdjacencyList;
-
+  /**
+   * An undirected graph stored in compressed sparse row form. The neighbours
+   * of vertex i are the elements offset[i] to offset[i+1] of a single array
+   * of 32 bit vertex indices, sorted in increasing order. Edges are added
+   * with add_edge and the rows are built by a counting sort in finish().
+   */
   class AdjacencyList {
   public:
+    typedef boost::uint32_t index_type;
     typedef std::pair<std::size_t, std::size_t> edge_descriptor;
-    typedef std::deque<edge_descriptor> edge_list;
-    typedef edge_list::const_iterator edge_iterator;
+    typedef const index_type *vertex_iterator;
+    typedef std::pair<vertex_iterator, vertex_iterator> vertex_iterator_range;
+
+    /**
+     * Iterate through the edges (source, target) of a range of rows. Each
+     * undirected edge appears once in the row of each of its vertices.
+     */
+    class edge_iterator : public boost::iterator_facade<edge_iterator,
+                                                        edge_descriptor,
+                                                        boost::forward_traversal_tag,
+                                                        edge_descriptor> {
+    public:
+      edge_iterator() : offset_(0), target_(0), nvertices_(0), vertex_(0), arc_(0) {}
+
+      edge_iterator(const std::size_t *offset,
+                    const index_type *target,
+                    std::size_t nvertices,
+                    std::size_t vertex,
+                    std::size_t arc)
+          : offset_(offset),
+            target_(target),
+            nvertices_(nvertices),
+            vertex_(vertex),
+            arc_(arc) {}
+
+    private:
+      friend class boost::iterator_core_access;
+
+      void increment() {
+        ++arc_;
+        while (vertex_ < nvertices_ && offset_[vertex_ + 1] <= arc_) {
+          ++vertex_;
+        }
+      }
+
+      bool equal(const edge_iterator &other) const {
+        return arc_ == other.arc_;
+      }
+
+      edge_descriptor dereference() const {
+        return edge_descriptor(vertex_, target_[arc_]);
+      }
+
+      const std::size_t *offset_;
+      const index_type *target_;
+      std::size_t nvertices_;
+      std::size_t vertex_;
+      std::size_t arc_;
+    };
+
     typedef std::pair<edge_iterator, edge_iterator> edge_iterator_range;
 
     AdjacencyList(std::size_t num_vertices)
-        : offset_(num_vertices + 1), num_vertices_(num_vertices), consistent_(false) {}
+        : offset_(num_vertices + 1, 0), num_vertices_(num_vertices), consistent_(true) {
+      DIALS_ASSERT(num_vertices <= std::numeric_limits<index_type>::max());
+    }
 
     std::size_t source(edge_descriptor edge) const {
       DIALS_ASSERT(consistent_);
@@ -49,49 +101,110 @@ namespace dials { namespace model {
 
     edge_iterator_range edges() const {
       DIALS_ASSERT(consistent_);
-      return edge_iterator_range(edges_.begin(), edges_.end());
+      std::size_t first = std::upper_bound(offset_.begin(), offset_.end(), 0)
+                          - offset_.begin() - 1;
+      return edge_iterator_range(make_edge_iterator(first, 0),
+                                 make_edge_iterator(num_vertices(), target_.size()));
     }
 
     edge_iterator_range edges(std::size_t i) const {
       DIALS_ASSERT(consistent_);
       DIALS_ASSERT(i < num_vertices());
-      DIALS_ASSERT(i < offset_.size() - 1);
       std::size_t o1 = offset_[i];
       std::size_t o2 = offset_[i + 1];
       DIALS_ASSERT(o2 >= o1);
-      DIALS_ASSERT(o2 <= edges_.size());
-      return edge_iterator_range(edges_.begin() + o1, edges_.begin() + o2);
+      DIALS_ASSERT(o2 <= target_.size());
+      return edge_iterator_range(make_edge_iterator(i, o1), make_edge_iterator(i, o2));
+    }
+
+    /**
+     * @param i The vertex
+     * @returns The range of vertices adjacent to vertex i
+     */
+    vertex_iterator_range adjacent_vertices(std::size_t i) const {
+      DIALS_ASSERT(consistent_);
+      DIALS_ASSERT(i < num_vertices());
+      const index_type *target = target_.empty() ? 0 : &target_[0];
+      return vertex_iterator_range(target + offset_[i], target + offset_[i + 1]);
     }
 
     void add_edge(std::size_t a, std::size_t b) {
       consistent_ = false;
-      DIALS_ASSERT(num_vertices());
-      DIALS_ASSERT(num_vertices());
-      edges_.push_back(edge_descriptor(a, b));
-      edges_.push_back(edge_descriptor(b, a));
+      DIALS_ASSERT(a < num_vertices());
+      DIALS_ASSERT(b < num_vertices());
+      pending_.push_back(a);
+      pending_.push_back(b);
     }
 
-    void finish() {
-      std::sort(edges_.begin(), edges_.end());
-      std::vector<std::size_t> num(num_vertices());
-      for (std::size_t i = 0; i < edges_.size(); ++i) {
-        num[edges_[i].first]++;
-      }
-      offset_[0] = 0;
-      for (std::size_t i = 0; i < num.size(); ++i) {
-        offset_[i + 1] = offset_[i] + num[i];
+    /**
+     * Reserve space for a number of edges to be added
+     * @param n The number of edges
+     */
+    void reserve(std::size_t n) {
+      pending_.reserve(pending_.size() + 2 * n);
+    }
+
+    /**
+     * Put the added edges into the rows of the list. The number of arcs in
+     * each row is counted, the rows are laid out end to end and the arcs are
+     * scattered into place, then each row is sorted.
+     * @param nthreads The number of threads used to sort the rows
+     */
+    void finish(std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      if (!pending_.empty()) {
+        std::vector<std::size_t> offset(num_vertices() + 1, 0);
+        for (std::size_t i = 0; i < num_vertices(); ++i) {
+          offset[i + 1] = offset_[i + 1] - offset_[i];
+        }
+        for (std::size_t i = 0; i < pending_.size(); ++i) {
+          offset[pending_[i] + 1]++;
+        }
+        for (std::size_t i = 0; i < num_vertices(); ++i) {
+          offset[i + 1] += offset[i];
+        }
+
+        // Copy the existing rows to the start of the new ones
+        std::vector<index_type> target(offset.back());
+        std::vector<std::size_t> position(offset.begin(), offset.end() - 1);
+        for (std::size_t i = 0; i < num_vertices(); ++i) {
+          for (std::size_t k = offset_[i]; k < offset_[i + 1]; ++k) {
+            target[position[i]++] = target_[k];
+          }
+        }
+
+        // Scatter both directions of each new edge
+        for (std::size_t i = 0; i < pending_.size(); i += 2) {
+          index_type a = pending_[i];
+          index_type b = pending_[i + 1];
+          target[position[a]++] = b;
+          target[position[b]++] = a;
+        }
+        offset_.swap(offset);
+        target_.swap(target);
+        std::vector<index_type>().swap(pending_);
+        SortRowsJob job = {&offset_[0], target_.empty() ? 0 : &target_[0]};
+        dials::util::parallel_for(num_vertices(), nthreads, job);
       }
-      DIALS_ASSERT(offset_.back() == edges_.size());
+      DIALS_ASSERT(offset_.back() == target_.size());
       consistent_ = true;
     }
 
+    /**
+     * Put the added edges into the rows of the list, using a number of threads
+     * suitable for the number of edges
+     */
+    void finish() {
+      finish(default_num_threads(target_.size() + pending_.size()));
+    }
+
     std::size_t num_vertices() const {
       return num_vertices_;
     }
 
     std::size_t num_edges() const {
-      DIALS_ASSERT((edges_.size() & 1) == 0);
-      return edges_.size() / 2;
+      DIALS_ASSERT((target_.size() & 1) == 0);
+      return (target_.size() + pending_.size()) / 2;
     }
 
     std::size_t vertex_num_edges(std::size_t i) const {
@@ -102,8 +215,39 @@ namespace dials { namespace model {
       return o2 - o1;
     }
 
+    /**
+     * @returns A sensible number of threads to sort a number of arcs
+     */
+    static std::size_t default_num_threads(std::size_t narcs) {
+      if (narcs < (1 << 20)) {
+        return 1;
+      }
+      std::size_t ncores = std::max(1u, boost::thread::hardware_concurrency());
+      return std::min(std::size_t(8), ncores);
+    }
+
   private:
-    edge_list edges_;
+    struct SortRowsJob {
+      const std::size_t *offset;
+      index_type *target;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::sort(target + offset[i], target + offset[i + 1]);
+        }
+      }
+    };
+
+    edge_iterator make_edge_iterator(std::size_t vertex, std::size_t arc) const {
+      return edge_iterator(&offset_[0],
+                           target_.empty() ? 0 : &target_[0],
+                           num_vertices(),
+                           vertex,
+                           arc);
+    }
+
+    std::vector<index_type> target_;
+    std::vector<index_type> pending_;
     std::vector<std::size_t> offset_;
     std::size_t num_vertices_;
     bool consistent_;
@@ -20,11 +20,11 @@ namespace dials { namespace model { namespace boost_python {
   using namespace boost::python;
 
   struct adjacent_vertices_iterator {
-    AdjacencyList::edge_iterator first_;
-    AdjacencyList::edge_iterator last_;
+    AdjacencyList::vertex_iterator first_;
+    AdjacencyList::vertex_iterator last_;
 
-    adjacent_vertices_iterator(AdjacencyList::edge_iterator first,
-                               AdjacencyList::edge_iterator last)
+    adjacent_vertices_iterator(AdjacencyList::vertex_iterator first,
+                               AdjacencyList::vertex_iterator last)
         : first_(first), last_(last) {}
 
     std::size_t next() {
@@ -32,7 +32,7 @@ namespace dials { namespace model { namespace boost_python {
         PyErr_SetString(PyExc_StopIteration, "No more data.");
         boost::python::throw_error_already_set();
       }
-      std::size_t result = first_->second;
+      std::size_t result = *first_;
       first_++;
       return result;
     }
@@ -62,8 +62,8 @@ namespace dials { namespace model { namespace boost_python {
 
   adjacent_vertices_iterator make_adjacent_vertices_iterator(const AdjacencyList &self,
                                                              std::size_t index) {
-    return adjacent_vertices_iterator(self.edges(index).first,
-                                      self.edges(index).second);
+    AdjacencyList::vertex_iterator_range range = self.adjacent_vertices(index);
+    return adjacent_vertices_iterator(range.first, range.second);
   }
 
   void export_adjacency_list() {
@@ -78,7 +78,8 @@ namespace dials { namespace model { namespace boost_python {
       .def("edges", boost::python::range(edges_begin, edges_end))
       .def("add_edge", &AdjacencyList::add_edge)
       .def("num_vertices", &AdjacencyList::num_vertices)
-      .def("num_edges", &AdjacencyList::num_edges);
+      .def("num_edges", &AdjacencyList::num_edges)
+      .def("vertex_num_edges", &AdjacencyList::vertex_num_edges);
   }
 
 }}}  // namespace dials::model::boost_python
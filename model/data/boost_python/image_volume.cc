@@ -61,6 +61,11 @@ namespace dials { namespace model { namespace boost_python {
       ImageVolume<FloatType> v = image_volume.get(panel[i]);
       DIALS_ASSERT(v.is_consistent());
 
+      // In a windowed volume, wait until the reflection's last frame is added
+      if (!v.is_finalised(bbox[i])) {
+        continue;
+      }
+
       // Trim the bounding box
       int6 b = v.trim_bbox(bbox[i]);
 
@@ -140,8 +145,16 @@ namespace dials { namespace model { namespace boost_python {
 
     class_<Class>(name, no_init)
       .def(init<int, int, std::size_t, std::size_t>())
+      .def(init<int, int, std::size_t, std::size_t, std::size_t>())
       .def("frame0", &Class::frame0)
       .def("frame1", &Class::frame1)
+      .def("windowed", &Class::windowed)
+      .def("window_size", &Class::window_size)
+      .def("window_frame0", &Class::window_frame0)
+      .def("window_frame1", &Class::window_frame1)
+      .def("mask_frame0", &Class::mask_frame0)
+      .def("mask_frame1", &Class::mask_frame1)
+      .def("is_finalised", &Class::is_finalised)
       .def("accessor", &Class::accessor)
       .def("data", &Class::data)
       .def("background", &Class::background)
@@ -161,6 +174,13 @@ namespace dials { namespace model { namespace boost_python {
     class_<Class>(name)
       .def("frame0", &Class::frame0)
       .def("frame1", &Class::frame1)
+      .def("windowed", &Class::windowed)
+      .def("window_size", &Class::window_size)
+      .def("window_frame0", &Class::window_frame0)
+      .def("window_frame1", &Class::window_frame1)
+      .def("mask_frame0", &Class::mask_frame0)
+      .def("mask_frame1", &Class::mask_frame1)
+      .def("is_finalised", &Class::is_finalised)
       .def("add", &Class::add)
       .def("get", &Class::get)
       .def("set_image", &Class::template set_image<int>)
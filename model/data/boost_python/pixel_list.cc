@@ -33,7 +33,37 @@ namespace dials { namespace model { namespace boost_python {
     return ss.str();
   }
 
+  struct StrongPixelRunsPickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const StrongPixelRuns &obj) {
+      return boost::python::make_tuple(obj.size(), obj.row(), obj.x0(), obj.x1());
+    }
+  };
+
   void export_pixel_list() {
+    af::shared<int> (StrongPixelRuns::*runs_row)() const = &StrongPixelRuns::row;
+    af::shared<int> (StrongPixelRuns::*runs_x0)() const = &StrongPixelRuns::x0;
+    af::shared<int> (StrongPixelRuns::*runs_x1)() const = &StrongPixelRuns::x1;
+
+    class_<StrongPixelRuns>("StrongPixelRuns", no_init)
+      .def(init<int2>((arg("size"))))
+      .def(init<const af::const_ref<bool, af::c_grid<2> > &>((arg("mask"))))
+      .def(init<int2,
+                const af::const_ref<int> &,
+                const af::const_ref<int> &,
+                const af::const_ref<int> &>(
+        (arg("size"), arg("row"), arg("x0"), arg("x1"))))
+      .def("add_run", &StrongPixelRuns::add_run, (arg("row"), arg("x0"), arg("x1")))
+      .def("size", &StrongPixelRuns::size)
+      .def("num_runs", &StrongPixelRuns::num_runs)
+      .def("num_pixels", &StrongPixelRuns::num_pixels)
+      .def("row", runs_row)
+      .def("x0", runs_x0)
+      .def("x1", runs_x1)
+      .def("index", &StrongPixelRuns::index)
+      .def("as_mask", &StrongPixelRuns::as_mask)
+      .def("__len__", &StrongPixelRuns::num_runs)
+      .def_pickle(StrongPixelRunsPickleSuite());
+
     class_<PixelList>("PixelList", no_init)
       .def(init<int,
                 int2,
@@ -48,6 +78,12 @@ namespace dials { namespace model { namespace boost_python {
                 const af::const_ref<double, af::c_grid<2> > &,
                 const af::const_ref<bool, af::c_grid<2> > &>(
         (arg("frame"), arg("size"), arg("value"), arg("index"))))
+      .def(init<int,
+                const af::const_ref<int, af::c_grid<2> > &,
+                const StrongPixelRuns &>((arg("frame"), arg("image"), arg("runs"))))
+      .def(init<int,
+                const af::const_ref<double, af::c_grid<2> > &,
+                const StrongPixelRuns &>((arg("frame"), arg("image"), arg("runs"))))
       .def("size", &PixelList::size)
       .def("frame", &PixelList::frame)
       .def("index", &PixelList::index)
@@ -66,6 +102,8 @@ namespace dials { namespace model { namespace boost_python {
       .def("num_frames", &PixelListLabeller::num_frames)
       .def("coords", &PixelListLabeller::coords)
       .def("values", &PixelListLabeller::values)
+      .def("packed", &PixelListLabeller::packed)
+      .def("num_bytes", &PixelListLabeller::num_bytes)
       .def("labels_3d", &PixelListLabeller::labels_3d)
       .def("labels_2d", &PixelListLabeller::labels_2d);
   }
@@ -11,6 +11,7 @@
 #ifndef DIALS_MODEL_DATA_IMAGE_VOLUME_H
 #define DIALS_MODEL_DATA_IMAGE_VOLUME_H
 
+#include <algorithm>
 #include <boost/cstdint.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -20,6 +21,7 @@
 
 namespace dials { namespace model {
 
+  using dials::model::PackedMaskType;
   using dials::model::Valid;
   using scitbx::af::int6;
 
@@ -57,7 +59,35 @@ namespace dials { namespace model {
           data_(grid_, 0),
           background_(grid_, 0),
           mask_(grid_, 0),
-          label_(grid_) {}
+          label_(grid_),
+          windowed_(false),
+          window_(init_window(frame0, frame1)) {}
+
+    /**
+     * Initialise the class with a circular buffer of frames. Only the last
+     * window frames added with set_image are held, so the memory used does
+     * not depend on the number of frames. The frames must be added in
+     * order; adding a frame to a full buffer drops the oldest frame.
+     * @param frame0 The first frame
+     * @param frame1 The last frame
+     * @param height The image height
+     * @param width The image width
+     * @param window The number of frames to hold
+     */
+    ImageVolume(int frame0,
+                int frame1,
+                std::size_t height,
+                std::size_t width,
+                std::size_t window)
+        : frame0_(frame0),
+          frame1_(frame1),
+          grid_(init_grid(frame0, frame1, height, width, window)),
+          data_(grid_, 0),
+          background_(grid_, 0),
+          mask_(grid_, 0),
+          label_(grid_),
+          windowed_(true),
+          window_(init_window(frame0, frame0)) {}
 
     /**
      * Check the arrays all make sense
@@ -81,6 +111,71 @@ namespace dials { namespace model {
       return frame1_;
     }
 
+    /**
+     * @returns Is the volume a circular buffer of frames
+     */
+    bool windowed() const {
+      return windowed_;
+    }
+
+    /**
+     * @returns The number of frames held at once
+     */
+    std::size_t window_size() const {
+      return grid_[0];
+    }
+
+    /**
+     * @returns The first frame held
+     */
+    int window_frame0() const {
+      return window_[0];
+    }
+
+    /**
+     * @returns The last frame held
+     */
+    int window_frame1() const {
+      return window_[1];
+    }
+
+    /**
+     * In a windowed volume only the newest frame can be masked, so that the
+     * mask of each frame is set once while the frame is added.
+     * @returns The first frame whose mask can be set
+     */
+    int mask_frame0() const {
+      return windowed_ ? std::max(window_[0], window_[1] - 1) : window_[0];
+    }
+
+    /**
+     * @returns The last frame whose mask can be set
+     */
+    int mask_frame1() const {
+      return window_[1];
+    }
+
+    /**
+     * Check if a reflection can be finalised. In a windowed volume a
+     * reflection is finalised when its last frame is added, after which the
+     * first frames of the reflection start to be dropped. Since the window is
+     * at least as big as the bbox z-extent, all its frames are held then.
+     * @param bbox The bounding box
+     * @returns True/False
+     */
+    bool is_finalised(int6 bbox) const {
+      return !windowed_ || std::min(frame1_, bbox[5]) == window_[1];
+    }
+
+    /**
+     * @param frame The frame number
+     * @returns The index of the frame in the arrays
+     */
+    std::size_t frame_index(int frame) const {
+      DIALS_ASSERT(frame >= window_[0] && frame < window_[1]);
+      return (frame - frame0_) % grid_[0];
+    }
+
     /**
      * @returns The accessor
      */
@@ -103,9 +198,18 @@ namespace dials { namespace model {
     }
 
     /**
-     * @returns The mask array
+     * @returns A copy of the mask array as int mask codes
      */
     af::versa<int, af::c_grid<3> > mask() const {
+      af::versa<int, af::c_grid<3> > result(grid_);
+      std::copy(mask_.begin(), mask_.end(), result.begin());
+      return result;
+    }
+
+    /**
+     * @returns The mask array, stored as 8 bit mask codes
+     */
+    af::versa<PackedMaskType, af::c_grid<3> > packed_mask() const {
       return mask_;
     }
 
@@ -122,10 +226,10 @@ namespace dials { namespace model {
     int6 trim_bbox(int6 bbox) const {
       int x0 = std::max(0, bbox[0]);
       int y0 = std::max(0, bbox[2]);
-      int z0 = std::max(frame0_, bbox[4]);
+      int z0 = std::max(window_[0], bbox[4]);
       int x1 = std::min((int)grid_[2], bbox[1]);
       int y1 = std::min((int)grid_[1], bbox[3]);
-      int z1 = std::min(frame1_, bbox[5]);
+      int z1 = std::min(window_[1], bbox[5]);
       DIALS_ASSERT(z1 > z0);
       DIALS_ASSERT(y1 > y0);
       DIALS_ASSERT(x1 > x0);
@@ -136,26 +240,18 @@ namespace dials { namespace model {
      * Extract data with the given bbox
      */
     af::versa<FloatType, af::c_grid<3> > extract_data(int6 bbox) const {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
       af::versa<FloatType, af::c_grid<3> > result(af::c_grid<3>(zsize, ysize, xsize));
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
-      std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
+        std::size_t kk = frame_index(bbox[4] + k);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            result(k, j, i) = data_(k + k0, j + j0, i + i0);
+            result(k, j, i) = data_(kk, j + j0, i + i0);
           }
         }
       }
@@ -166,26 +262,18 @@ namespace dials { namespace model {
      * Extract data with the given bbox
      */
     af::versa<FloatType, af::c_grid<3> > extract_background(int6 bbox) const {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
       af::versa<FloatType, af::c_grid<3> > result(af::c_grid<3>(zsize, ysize, xsize));
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
-      std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
+        std::size_t kk = frame_index(bbox[4] + k);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            result(k, j, i) = background_(k + k0, j + j0, i + i0);
+            result(k, j, i) = background_(kk, j + j0, i + i0);
           }
         }
       }
@@ -196,26 +284,18 @@ namespace dials { namespace model {
      * Extract data with the given bbox
      */
     af::versa<int, af::c_grid<3> > extract_mask(int6 bbox, std::size_t index) const {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
       af::versa<int, af::c_grid<3> > result(af::c_grid<3>(zsize, ysize, xsize));
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
-      std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
+        std::size_t kk = frame_index(bbox[4] + k);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            std::size_t l = grid_(k + k0, j + j0, i + i0);
+            std::size_t l = grid_(kk, j + j0, i + i0);
             int value = mask_[l];
             if (value & Foreground) {
               const Label &label = label_[l];
@@ -235,15 +315,7 @@ namespace dials { namespace model {
      * Set data with the given bbox
      */
     void set_data(int6 bbox, const af::const_ref<FloatType, af::c_grid<3> > &data) {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
@@ -252,11 +324,11 @@ namespace dials { namespace model {
       DIALS_ASSERT(zsize == data.accessor()[0]);
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
-      std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
+        std::size_t kk = frame_index(bbox[4] + k);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            data_(k + k0, j + j0, i + i0) = data(k, j, i);
+            data_(kk, j + j0, i + i0) = data(k, j, i);
           }
         }
       }
@@ -267,15 +339,7 @@ namespace dials { namespace model {
      */
     void set_background(int6 bbox,
                         const af::const_ref<FloatType, af::c_grid<3> > &background) {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
@@ -284,11 +348,11 @@ namespace dials { namespace model {
       DIALS_ASSERT(zsize == background.accessor()[0]);
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
-      std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
+        std::size_t kk = frame_index(bbox[4] + k);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            background_(k + k0, j + j0, i + i0) = background(k, j, i);
+            background_(kk, j + j0, i + i0) = background(k, j, i);
           }
         }
       }
@@ -300,15 +364,7 @@ namespace dials { namespace model {
     void set_mask(int6 bbox,
                   std::size_t index,
                   const af::const_ref<int, af::c_grid<3> > &mask) {
-      DIALS_ASSERT(bbox[0] >= 0);
-      DIALS_ASSERT(bbox[2] >= 0);
-      DIALS_ASSERT(bbox[4] >= frame0_);
-      DIALS_ASSERT(bbox[1] <= grid_[2]);
-      DIALS_ASSERT(bbox[3] <= grid_[1]);
-      DIALS_ASSERT(bbox[5] <= frame1_);
-      DIALS_ASSERT(bbox[1] > bbox[0]);
-      DIALS_ASSERT(bbox[3] > bbox[2]);
-      DIALS_ASSERT(bbox[5] > bbox[4]);
+      check_bbox(bbox);
       std::size_t xsize = bbox[1] - bbox[0];
       std::size_t ysize = bbox[3] - bbox[2];
       std::size_t zsize = bbox[5] - bbox[4];
@@ -317,6 +373,7 @@ namespace dials { namespace model {
       DIALS_ASSERT(zsize == mask.accessor()[0]);
       std::size_t i0 = bbox[0];
       std::size_t j0 = bbox[2];
+      DIALS_ASSERT(bbox[4] >= mask_frame0());
       std::size_t k0 = bbox[4] - frame0_;
       for (std::size_t k = 0; k < zsize; ++k) {
         for (std::size_t j = 0; j < ysize; ++j) {
@@ -329,13 +386,18 @@ namespace dials { namespace model {
 
     /**
      * Helper function to set mask value
+     * @param k The frame relative to the first frame
+     * @param j The y coordinate
+     * @param i The x coordinate
+     * @param value The mask value
+     * @param index The reflection index
      */
     void set_mask_value(std::size_t k,
                         std::size_t j,
                         std::size_t i,
                         int value,
                         std::size_t index) {
-      std::size_t l = grid_(k, j, i);
+      std::size_t l = grid_(k < grid_[0] ? k : k % grid_[0], j, i);
       int value1 = mask_[l];
       int value2 = value;
       if (value1 & Foreground) {
@@ -356,11 +418,13 @@ namespace dials { namespace model {
           value2 |= Overlapped;
         }
       }
-      mask_[l] = value1 | value2;
+      mask_[l] = (PackedMaskType)(value1 | value2);
     }
 
     /**
-     * Set the image data
+     * Set the image data. In a windowed volume the frame must be the one
+     * after the last frame added and, if the buffer is full, the oldest frame
+     * is dropped to make room for it.
      * @param frame The frame number
      * @param data The data array
      * @param mask The mask array
@@ -373,7 +437,19 @@ namespace dials { namespace model {
       DIALS_ASSERT(frame < frame1_);
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(data.accessor().all_eq(af::c_grid<2>(grid_[1], grid_[2])));
-      std::size_t k = frame - frame0_;
+      if (windowed_) {
+        DIALS_ASSERT(frame == window_[1]);
+        if ((std::size_t)(window_[1] - window_[0]) == grid_[0]) {
+          window_[0]++;
+        }
+        window_[1]++;
+      }
+      std::size_t k = frame_index(frame);
+      if (windowed_) {
+        std::size_t n = grid_[1] * grid_[2];
+        std::fill_n(background_.begin() + k * n, n, FloatType(0));
+        std::fill_n(label_.begin() + k * n, n, Label());
+      }
       for (std::size_t j = 0; j < data.accessor()[0]; ++j) {
         for (std::size_t i = 0; i < data.accessor()[1]; ++i) {
           data_(k, j, i) = (FloatType)data(j, i);
@@ -388,9 +464,46 @@ namespace dials { namespace model {
                             std::size_t height,
                             std::size_t width) const {
       DIALS_ASSERT(frame1 > frame0);
+      return init_grid(frame0, frame1, height, width, frame1 - frame0);
+    }
+
+    af::c_grid<3> init_grid(int frame0,
+                            int frame1,
+                            std::size_t height,
+                            std::size_t width,
+                            std::size_t window) const {
+      DIALS_ASSERT(frame1 > frame0);
       DIALS_ASSERT(height > 0);
       DIALS_ASSERT(width > 0);
-      return af::c_grid<3>(frame1 - frame0, height, width);
+      DIALS_ASSERT(window > 0);
+      window = std::min(window, (std::size_t)(frame1 - frame0));
+      return af::c_grid<3>(window, height, width);
+    }
+
+    /**
+     * The frames held are kept in a shared array so that copies of the
+     * volume, which share the pixel arrays, agree on them.
+     */
+    af::shared<int> init_window(int first, int last) const {
+      af::shared<int> result(2);
+      result[0] = first;
+      result[1] = last;
+      return result;
+    }
+
+    /**
+     * Check the bbox is within the frames held
+     */
+    void check_bbox(const int6 &bbox) const {
+      DIALS_ASSERT(bbox[0] >= 0);
+      DIALS_ASSERT(bbox[2] >= 0);
+      DIALS_ASSERT(bbox[4] >= window_[0]);
+      DIALS_ASSERT(bbox[1] <= grid_[2]);
+      DIALS_ASSERT(bbox[3] <= grid_[1]);
+      DIALS_ASSERT(bbox[5] <= window_[1]);
+      DIALS_ASSERT(bbox[1] > bbox[0]);
+      DIALS_ASSERT(bbox[3] > bbox[2]);
+      DIALS_ASSERT(bbox[5] > bbox[4]);
     }
 
     int frame0_;
@@ -398,8 +511,10 @@ namespace dials { namespace model {
     af::c_grid<3> grid_;
     af::versa<FloatType, af::c_grid<3> > data_;
     af::versa<FloatType, af::c_grid<3> > background_;
-    af::versa<int, af::c_grid<3> > mask_;
+    af::versa<PackedMaskType, af::c_grid<3> > mask_;
     af::versa<Label, af::c_grid<3> > label_;
+    bool windowed_;
+    af::shared<int> window_;
   };
 
   /**
@@ -421,6 +536,8 @@ namespace dials { namespace model {
       if (size() > 0) {
         DIALS_ASSERT(x.frame0() == volume_[0].frame0());
         DIALS_ASSERT(x.frame1() == volume_[0].frame1());
+        DIALS_ASSERT(x.windowed() == volume_[0].windowed());
+        DIALS_ASSERT(x.window_size() == volume_[0].window_size());
       }
       volume_.push_back(x);
     }
@@ -441,6 +558,63 @@ namespace dials { namespace model {
       return volume_[0].frame1();
     }
 
+    /**
+     * @returns Is the volume a circular buffer of frames
+     */
+    bool windowed() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].windowed();
+    }
+
+    /**
+     * @returns The number of frames held at once
+     */
+    std::size_t window_size() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].window_size();
+    }
+
+    /**
+     * @returns The first frame held
+     */
+    int window_frame0() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].window_frame0();
+    }
+
+    /**
+     * @returns The last frame held
+     */
+    int window_frame1() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].window_frame1();
+    }
+
+    /**
+     * @returns The first frame whose mask can be set
+     */
+    int mask_frame0() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].mask_frame0();
+    }
+
+    /**
+     * @returns The last frame whose mask can be set
+     */
+    int mask_frame1() const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].mask_frame1();
+    }
+
+    /**
+     * @param bbox The bounding box
+     * @returns Can the reflection be finalised
+     */
+    bool is_finalised(int6 bbox) const {
+      DIALS_ASSERT(size() > 0);
+      return volume_[0].is_finalised(bbox);
+    }
+
     /**
      * Get the image volume for the panel
      * @param index The panel index
@@ -11,6 +11,8 @@
 #ifndef DIALS_MODEL_DATA_MASK_CODE_H
 #define DIALS_MODEL_DATA_MASK_CODE_H
 
+#include <boost/cstdint.hpp>
+
 namespace dials { namespace model {
 
   /**
@@ -31,6 +33,13 @@ namespace dials { namespace model {
     Overlapped = (1 << 5),      ///< Pixel overlaps another reflection foreground
   };
 
+  /**
+   * The type used to store the mask codes of large volumes of pixels. All the
+   * mask codes fit into 8 bits, so this takes a quarter of the memory of an
+   * int mask, and the per-pixel loops over the mask read less memory.
+   */
+  typedef boost::uint8_t PackedMaskType;
+
 }}  // namespace dials::model
 
 #endif
@@ -11,10 +11,13 @@
 #ifndef DIALS_MODEL_DATA_PIXEL_LIST_H
 #define DIALS_MODEL_DATA_PIXEL_LIST_H
 
+#include <vector>
+#include <boost/cstdint.hpp>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
-#include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/model/data/strong_pixel_runs.h>
+#include <dials/util/profile.h>
 #include <dials/error.h>
 
 namespace dials { namespace model {
@@ -22,20 +25,6 @@ namespace dials { namespace model {
   using scitbx::vec3;
   using scitbx::af::int2;
 
-  namespace detail {
-
-    inline bool lessthan(const vec3<int> &a, const vec3<int> &b) {
-      return (
-        a[0] < b[0]
-          ? true
-          : (a[0] == b[0]
-               ? (a[1] < b[1] ? true
-                              : (a[1] == b[1] ? (a[2] < b[2] ? true : false) : false))
-               : false));
-    }
-
-  }  // namespace detail
-
   /**
    * A class to hold a list of pixels
    */
@@ -113,6 +102,33 @@ namespace dials { namespace model {
       }
     }
 
+    /**
+     * Initialise the list from the strong pixel runs. Only the strong pixels
+     * are read from the image.
+     * @param frame The current frame
+     * @param image The image values
+     * @param runs The strong pixel runs
+     */
+    template <typename T>
+    PixelList(int frame,
+              const af::const_ref<T, af::c_grid<2> > &image,
+              const StrongPixelRuns &runs) {
+      DIALS_ASSERT(image.accessor().all_eq(runs.size()));
+
+      frame_ = frame;
+      size_ = image.accessor();
+
+      value_.reserve(runs.num_pixels());
+      index_.reserve(runs.num_pixels());
+      for (std::size_t i = 0; i < runs.num_runs(); ++i) {
+        std::size_t k = runs.row(i) * size_[1];
+        for (int x = runs.x0(i); x < runs.x1(i); ++x) {
+          value_.push_back(image[k + x]);
+          index_.push_back(k + x);
+        }
+      }
+    }
+
     /**
      * Initialise the list
      * @param frame The current frame
@@ -168,12 +184,148 @@ namespace dials { namespace model {
     }
   };
 
+  namespace detail {
+
+    /**
+     * Append an unsigned integer to a byte array using 7 bits per byte, with
+     * the top bit set on all but the last byte.
+     */
+    inline void encode_varint(af::shared<boost::uint8_t> &code, std::size_t value) {
+      while (value >= 0x80) {
+        code.push_back((boost::uint8_t)(value | 0x80));
+        value >>= 7;
+      }
+      code.push_back((boost::uint8_t)value);
+    }
+
+    /**
+     * Read an unsigned integer from a byte array and advance the position
+     */
+    inline std::size_t decode_varint(const boost::uint8_t *code, std::size_t &pos) {
+      std::size_t value = 0;
+      std::size_t shift = 0;
+      boost::uint8_t byte;
+      do {
+        byte = code[pos++];
+        value |= (std::size_t)(byte & 0x7f) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+      return value;
+    }
+
+    /**
+     * Find the root of a set, halving the path on the way
+     */
+    inline std::size_t find_root(std::vector<std::size_t> &parent, std::size_t i) {
+      while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+      }
+      return i;
+    }
+
+    /**
+     * Join two sets, keeping the smallest index as the root
+     */
+    inline void join_sets(std::vector<std::size_t> &parent,
+                          std::size_t a,
+                          std::size_t b) {
+      a = find_root(parent, a);
+      b = find_root(parent, b);
+      if (a < b) {
+        parent[b] = a;
+      } else if (b < a) {
+        parent[a] = b;
+      }
+    }
+
+  }  // namespace detail
+
   /**
-   * A class to label the pixels as spots
+   * A class to label the pixels as spots.
+   *
+   * The pixels are held compressed. The pixels of each frame are sorted by
+   * their index in the image, and each index is stored as the gap from the
+   * previous one as a variable length integer, which is one byte for the
+   * closely packed pixels of a spot. The values are stored as 16 bit
+   * integers while they are all integers which fit, and as floats
+   * otherwise. This uses 3 to 5 bytes for each pixel, rather than 20 for a
+   * coordinate and a double value, which matters on powder-like or diffuse
+   * data where there are many strong pixels.
+   *
+   * The labelling and the shoebox creation read the pixels in order straight
+   * from the compressed arrays with a Reader.
    */
   class PixelListLabeller {
   public:
-    PixelListLabeller() : size_(0, 0), first_frame_(0), last_frame_(0) {}
+    /**
+     * Read the pixels in order from the compressed arrays
+     */
+    class Reader {
+    public:
+      /**
+       * @param labeller The labeller to read
+       */
+      Reader(const PixelListLabeller &labeller)
+          : labeller_(labeller), pixel_(0), frame_(0), pos_(0), index_(-1) {
+        if (!at_end()) {
+          read();
+        }
+      }
+
+      /** @returns Have all the pixels been read */
+      bool at_end() const {
+        return pixel_ == labeller_.num_pixels();
+      }
+
+      /** Move to the next pixel */
+      void next() {
+        ++pixel_;
+        if (!at_end()) {
+          read();
+        }
+      }
+
+      /** @returns The index of the pixel in the list */
+      std::size_t pixel() const {
+        return pixel_;
+      }
+
+      /** @returns The coordinate of the pixel */
+      vec3<int> coord() const {
+        int y = index_ / labeller_.size_[1];
+        int x = index_ - y * labeller_.size_[1];
+        return vec3<int>(labeller_.first_frame_ + frame_, y, x);
+      }
+
+      /** @returns The value of the pixel */
+      double value() const {
+        return labeller_.value(pixel_);
+      }
+
+    private:
+      void read() {
+        while (pixel_ == labeller_.frame_offset_[frame_ + 1]) {
+          ++frame_;
+          index_ = -1;
+        }
+        index_ += 1 + detail::decode_varint(&labeller_.code_[0], pos_);
+      }
+
+      const PixelListLabeller &labeller_;
+      std::size_t pixel_;
+      std::size_t frame_;
+      std::size_t pos_;
+      long index_;
+    };
+
+    PixelListLabeller()
+        : size_(0, 0),
+          first_frame_(0),
+          last_frame_(0),
+          frame_offset_(1, 0),
+          code_offset_(1, 0),
+          packed_(true) {}
 
     /**
      * Add a pixel list
@@ -190,8 +342,7 @@ namespace dials { namespace model {
       }
 
       // Update the last frame number
-      int frame = pixel_list.frame();
-      last_frame_ = frame + 1;
+      last_frame_ = pixel_list.frame() + 1;
 
       // Get pixel list info
       int2 size = pixel_list.size();
@@ -199,18 +350,36 @@ namespace dials { namespace model {
       af::const_ref<std::size_t> index = pixel_list.index().const_ref();
       DIALS_ASSERT(value.size() == index.size());
 
-      // Add the values and coordinates
-      for (std::size_t i = 0; i < value.size(); ++i) {
-        std::size_t k = index[i];
-        DIALS_ASSERT(i < size[0] * size[1]);
-        std::size_t y = k / size[1];
-        std::size_t x = k - y * size[1];
-        DIALS_ASSERT(x < size[1]);
-        DIALS_ASSERT(y < size[0]);
-        vec3<int> coord(frame, y, x);
-        values_.push_back(value[i]);
-        coords_.push_back(coord);
+      // Add the index gaps, which must be positive so the pixels are sorted
+      long previous = -1;
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        long k = index[i];
+        DIALS_ASSERT(k < (long)size[0] * size[1]);
+        DIALS_ASSERT(k > previous);
+        detail::encode_varint(code_, k - previous - 1);
+        previous = k;
+      }
+
+      // Add the values, switching to floats if they don't all fit
+      if (packed_) {
+        for (std::size_t i = 0; i < value.size(); ++i) {
+          if (value[i] < 0 || value[i] > 65535 || value[i] != (int)value[i]) {
+            unpack();
+            break;
+          }
+        }
       }
+      if (packed_) {
+        for (std::size_t i = 0; i < value.size(); ++i) {
+          value16_.push_back((boost::uint16_t)value[i]);
+        }
+      } else {
+        for (std::size_t i = 0; i < value.size(); ++i) {
+          value32_.push_back((float)value[i]);
+        }
+      }
+      frame_offset_.push_back(frame_offset_.back() + index.size());
+      code_offset_.push_back(code_.size());
     }
 
     /**
@@ -222,7 +391,7 @@ namespace dials { namespace model {
 
     /** @returns The number of pixels */
     std::size_t num_pixels() const {
-      return values_.size();
+      return frame_offset_.back();
     }
 
     /** @returns The first frame number */
@@ -247,127 +416,166 @@ namespace dials { namespace model {
       return last_frame_ - first_frame_;
     }
 
+    /** @returns Are the values held as 16 bit integers */
+    bool packed() const {
+      return packed_;
+    }
+
+    /** @returns The number of bytes used to hold the pixels */
+    std::size_t num_bytes() const {
+      return code_.size() + value16_.size() * sizeof(boost::uint16_t)
+             + value32_.size() * sizeof(float);
+    }
+
+    /**
+     * @param i The index of the pixel
+     * @returns The value of the pixel
+     */
+    double value(std::size_t i) const {
+      return packed_ ? value16_[i] : value32_[i];
+    }
+
     /**
      * @returns The list of valid point coordinates
      */
     af::shared<vec3<int> > coords() const {
-      return coords_;
+      af::shared<vec3<int> > result;
+      result.reserve(num_pixels());
+      for (Reader reader(*this); !reader.at_end(); reader.next()) {
+        result.push_back(reader.coord());
+      }
+      return result;
     }
 
     /**
      * @returns The list of valid point values
      */
     af::shared<double> values() const {
-      return values_;
+      af::shared<double> result(num_pixels());
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = value(i);
+      }
+      return result;
     }
 
     /**
      * Label the pixels in 3D
      */
     af::shared<int> labels_3d() const {
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
+      return labels(true);
+    }
 
-      if (coords_.size() == 0) {
-        return af::shared<int>();
-      }
+    /**
+     * Label the pixels in 2D
+     */
+    af::shared<int> labels_2d() const {
+      return labels(false);
+    }
 
-      // Calculate the coordinate indices
-      for (std::size_t i = 0; i < coords_.size(); ++i) {
-        if (i > 0) {
-          DIALS_ASSERT(detail::lessthan(coords_[i - 1], coords_[i]));
-        }
-      }
+  private:
+    /**
+     * Convert the values to floats
+     */
+    void unpack() {
+      value32_ = af::shared<float>(value16_.begin(), value16_.end());
+      value16_ = af::shared<boost::uint16_t>();
+      packed_ = false;
+    }
 
-      // Create a graph of coordinates
-      AdjacencyList graph(coords_.size());
-      std::size_t i1 = 0, i2 = 0, i3 = 0;
-      for (; i1 < coords_.size() - 1; ++i1) {
-        vec3<int> a0 = coords_[i1];
-        vec3<int> a1(a0[0], a0[1], a0[2] + 1);
-        vec3<int> a2(a0[0], a0[1] + 1, a0[2]);
-        vec3<int> a3(a0[0] + 1, a0[1], a0[2]);
-        if (coords_[i1 + 1] == a1) {
-          boost::add_edge(i1, i1 + 1, graph);
-        }
-        if (a0[1] < size_[0] - 1) {
-          for (; detail::lessthan(coords_[i2], a2) && i2 < coords_.size() - 1; ++i2)
-            ;
-          if (coords_[i2] == a2) {
-            boost::add_edge(i1, i2, graph);
-          }
-        }
-        if (a0[0] < last_frame_ - 1) {
-          if (i2 > i3) i3 = i2;
-          for (; detail::lessthan(coords_[i3], a3) && i3 < coords_.size() - 1; ++i3)
-            ;
-          if (coords_[i3] == a3) {
-            boost::add_edge(i1, i3, graph);
-          }
-        }
+    /**
+     * Read the image indices of the pixels on a frame
+     * @param frame The frame index
+     * @param index The image indices
+     */
+    void decode_frame(std::size_t frame, std::vector<std::size_t> &index) const {
+      std::size_t n = frame_offset_[frame + 1] - frame_offset_[frame];
+      std::size_t pos = code_offset_[frame];
+      index.resize(n);
+      long previous = -1;
+      for (std::size_t i = 0; i < n; ++i) {
+        previous += 1 + detail::decode_varint(&code_[0], pos);
+        index[i] = previous;
       }
-
-      // Do the connected components
-      af::shared<int> labels(num_vertices(graph), af::init_functor_null<int>());
-      DIALS_ASSERT(labels.size() == coords_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
-      return labels;
+      DIALS_ASSERT(pos == code_offset_[frame + 1]);
     }
 
     /**
-     * Label the pixels in 2D
+     * Label the connected pixels. The frames are decoded one at a time and
+     * the pixels joined to their neighbours along x and y, and along z for
+     * 3D labels, by walking through the sorted indices of the frame and the
+     * previous frame. The labels are numbered in the order of the first
+     * pixel of each spot.
+     * @param three_d Join pixels on adjacent frames
+     * @returns The labels
      */
-    af::shared<int> labels_2d() const {
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
-
-      if (coords_.size() == 0) {
+    af::shared<int> labels(bool three_d) const {
+      if (num_pixels() == 0) {
         return af::shared<int>();
       }
-
-      // Calculate the coordinate indices
-      for (std::size_t i = 0; i < coords_.size(); ++i) {
-        if (i > 0) {
-          DIALS_ASSERT(detail::lessthan(coords_[i - 1], coords_[i]));
-        }
+      DIALS_PROFILE_SCOPE("spot_finding.label");
+      DIALS_PROFILE_COUNT("spot_finding.strong_pixels", num_pixels());
+
+      // Join the neighbouring pixels
+      std::size_t width = size_[1];
+      std::size_t npixels = (std::size_t)size_[0] * width;
+      std::vector<std::size_t> parent(num_pixels());
+      for (std::size_t i = 0; i < parent.size(); ++i) {
+        parent[i] = i;
       }
-
-      // Create a graph of coordinates
-      AdjacencyList graph(coords_.size());
-      std::size_t i1 = 0, i2 = 0;
-      for (; i1 < coords_.size() - 1; ++i1) {
-        vec3<int> a0 = coords_[i1];
-        vec3<int> a1(a0[0], a0[1], a0[2] + 1);
-        vec3<int> a2(a0[0], a0[1] + 1, a0[2]);
-        if (coords_[i1 + 1] == a1) {
-          boost::add_edge(i1, i1 + 1, graph);
+      std::vector<std::size_t> previous, current;
+      for (std::size_t f = 0; f < frame_offset_.size() - 1; ++f) {
+        std::size_t base = frame_offset_[f];
+        decode_frame(f, current);
+        std::size_t n = current.size();
+        for (std::size_t i = 0, j = 0; i < n; ++i) {
+          std::size_t k = current[i];
+          if (i + 1 < n && current[i + 1] == k + 1 && (k % width) + 1 < width) {
+            detail::join_sets(parent, base + i, base + i + 1);
+          }
+          if (k + width < npixels) {
+            for (; j < n && current[j] < k + width; ++j)
+              ;
+            if (j < n && current[j] == k + width) {
+              detail::join_sets(parent, base + i, base + j);
+            }
+          }
         }
-        if (a0[1] < size_[0] - 1) {
-          for (; detail::lessthan(coords_[i2], a2) && i2 < coords_.size() - 1; ++i2)
-            ;
-          if (coords_[i2] == a2) {
-            boost::add_edge(i1, i2, graph);
+        if (three_d && f > 0) {
+          std::size_t base0 = frame_offset_[f - 1];
+          for (std::size_t i = 0, j = 0; i < previous.size() && j < n;) {
+            if (previous[i] < current[j]) {
+              ++i;
+            } else if (current[j] < previous[i]) {
+              ++j;
+            } else {
+              detail::join_sets(parent, base0 + i, base + j);
+              ++i;
+              ++j;
+            }
           }
         }
+        previous.swap(current);
       }
 
-      // Do the connected components
-      af::shared<int> labels(num_vertices(graph));
-      DIALS_ASSERT(labels.size() == coords_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
+      // The root of each set is its first pixel, so number the sets in order
+      af::shared<int> labels(parent.size());
+      int num = 0;
+      for (std::size_t i = 0; i < parent.size(); ++i) {
+        std::size_t root = detail::find_root(parent, i);
+        labels[i] = (root == i) ? num++ : labels[root];
+      }
       return labels;
     }
 
-  private:
     int2 size_;
     int first_frame_;
     int last_frame_;
-    af::shared<vec3<int> > coords_;
-    af::shared<double> values_;
+    af::shared<std::size_t> frame_offset_;
+    af::shared<std::size_t> code_offset_;
+    af::shared<boost::uint8_t> code_;
+    af::shared<boost::uint16_t> value16_;
+    af::shared<float> value32_;
+    bool packed_;
   };
 
 }}  // namespace dials::model
@@ -0,0 +1,352 @@
+/*
+ * shoebox_arena.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_MODEL_DATA_SHOEBOX_ARENA_H
+#define DIALS_MODEL_DATA_SHOEBOX_ARENA_H
+
+#include <algorithm>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/model/data/observation.h>
+#include <dials/algorithms/integration/sum/summation.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/config.h>
+#include <dials/error.h>
+
+namespace dials { namespace model {
+
+  using dials::algorithms::Summation;
+  using scitbx::af::int3;
+  using scitbx::af::int6;
+
+  /**
+   * A column of shoeboxes whose pixels are held in three contiguous arrays
+   * (data, mask and background) for the whole column, rather than in three
+   * separately allocated arrays for each shoebox. The pixels of shoebox i are
+   * the elements offset[i] to offset[i+1] of each array, and the arrays of a
+   * shoebox are accessed as references into them. A shoebox whose arrays are
+   * not allocated has no pixels.
+   *
+   * Building the column makes one allocation per array, and the arrays can be
+   * passed to the image extraction, the summation and the serialization code
+   * without touching millions of small heap blocks.
+   */
+  template <typename FloatType = ProfileFloatType>
+  class ShoeboxArena {
+  public:
+    typedef FloatType float_type;
+    typedef af::ref<FloatType, af::c_grid<3> > data_ref_type;
+    typedef af::const_ref<FloatType, af::c_grid<3> > data_const_ref_type;
+    typedef af::ref<int, af::c_grid<3> > mask_ref_type;
+    typedef af::const_ref<int, af::c_grid<3> > mask_const_ref_type;
+
+    /**
+     * Initialise an empty column
+     */
+    ShoeboxArena() : offset_(1, 0) {}
+
+    /**
+     * Initialise the column from panels and bounding boxes
+     * @param panel The panel of each shoebox
+     * @param bbox The bounding box of each shoebox
+     * @param allocate Allocate the pixels of each shoebox
+     * @param flat Make the shoeboxes flat
+     */
+    ShoeboxArena(const af::const_ref<std::size_t> &panel,
+                 const af::const_ref<int6> &bbox,
+                 bool allocate = false,
+                 bool flat = false)
+        : panel_(panel.begin(), panel.end()),
+          bbox_(bbox.begin(), bbox.end()),
+          flat_(panel.size(), flat),
+          offset_(1, 0) {
+      DIALS_ASSERT(panel.size() == bbox.size());
+      offset_.reserve(bbox.size() + 1);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        std::size_t n = allocate ? full_accessor(i).size_1d() : 0;
+        offset_.push_back(offset_.back() + n);
+      }
+      data_.resize(offset_.back(), 0);
+      mask_.resize(offset_.back(), 0);
+      background_.resize(offset_.back(), 0);
+    }
+
+    /**
+     * Copy an array of shoeboxes into a column
+     * @param shoeboxes The shoeboxes
+     */
+    ShoeboxArena(const af::const_ref<Shoebox<FloatType> > &shoeboxes)
+        : panel_(shoeboxes.size()),
+          bbox_(shoeboxes.size()),
+          flat_(shoeboxes.size()),
+          offset_(1, 0) {
+      offset_.reserve(shoeboxes.size() + 1);
+      for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+        const Shoebox<FloatType> &sbox = shoeboxes[i];
+        DIALS_ASSERT(sbox.data.size() == 0 || sbox.is_consistent());
+        panel_[i] = sbox.panel;
+        bbox_[i] = sbox.bbox;
+        flat_[i] = sbox.flat;
+        offset_.push_back(offset_.back() + sbox.data.size());
+      }
+      data_.resize(offset_.back());
+      mask_.resize(offset_.back());
+      background_.resize(offset_.back());
+      for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+        const Shoebox<FloatType> &sbox = shoeboxes[i];
+        std::size_t k = offset_[i];
+        std::copy(sbox.data.begin(), sbox.data.end(), data_.begin() + k);
+        std::copy(sbox.mask.begin(), sbox.mask.end(), mask_.begin() + k);
+        std::copy(
+          sbox.background.begin(), sbox.background.end(), background_.begin() + k);
+      }
+    }
+
+    /**
+     * Initialise the column from its arrays, e.g. after reading them from file
+     * @param panel The panel of each shoebox
+     * @param bbox The bounding box of each shoebox
+     * @param flat Is each shoebox flat
+     * @param offset The offset of the pixels of each shoebox
+     * @param data The data of all the shoeboxes
+     * @param mask The mask of all the shoeboxes
+     * @param background The background of all the shoeboxes
+     */
+    ShoeboxArena(const af::shared<std::size_t> &panel,
+                 const af::shared<int6> &bbox,
+                 const af::shared<bool> &flat,
+                 const af::shared<std::size_t> &offset,
+                 const af::shared<FloatType> &data,
+                 const af::shared<int> &mask,
+                 const af::shared<FloatType> &background)
+        : panel_(panel),
+          bbox_(bbox),
+          flat_(flat),
+          offset_(offset),
+          data_(data),
+          mask_(mask),
+          background_(background) {
+      DIALS_ASSERT(bbox.size() == panel.size());
+      DIALS_ASSERT(flat.size() == panel.size());
+      DIALS_ASSERT(offset.size() == panel.size() + 1);
+      DIALS_ASSERT(offset[0] == 0);
+      DIALS_ASSERT(data.size() == offset.back());
+      DIALS_ASSERT(mask.size() == offset.back());
+      DIALS_ASSERT(background.size() == offset.back());
+      for (std::size_t i = 0; i < panel.size(); ++i) {
+        std::size_t n = offset[i + 1] - offset[i];
+        DIALS_ASSERT(offset[i + 1] >= offset[i]);
+        DIALS_ASSERT(n == 0 || n == full_accessor(i).size_1d());
+      }
+    }
+
+    /** @returns The number of shoeboxes */
+    std::size_t size() const {
+      return panel_.size();
+    }
+
+    /** @returns The panel of each shoebox */
+    af::shared<std::size_t> panels() const {
+      return panel_;
+    }
+
+    /** @returns The bounding box of each shoebox */
+    af::shared<int6> bounding_boxes() const {
+      return bbox_;
+    }
+
+    /** @returns Whether each shoebox is flat */
+    af::shared<bool> flat() const {
+      return flat_;
+    }
+
+    /** @returns The offset of the pixels of each shoebox */
+    af::shared<std::size_t> offsets() const {
+      return offset_;
+    }
+
+    /** @returns The data of all the shoeboxes */
+    af::shared<FloatType> data() const {
+      return data_;
+    }
+
+    /** @returns The mask of all the shoeboxes */
+    af::shared<int> mask() const {
+      return mask_;
+    }
+
+    /** @returns The background of all the shoeboxes */
+    af::shared<FloatType> background() const {
+      return background_;
+    }
+
+    /** @returns The number of pixels of a shoebox */
+    std::size_t npixels(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      return offset_[i + 1] - offset_[i];
+    }
+
+    /** @returns Are the pixels of a shoebox allocated */
+    bool is_allocated(std::size_t i) const {
+      return npixels(i) > 0;
+    }
+
+    /** @returns The shape of the arrays of a shoebox */
+    af::c_grid<3> accessor(std::size_t i) const {
+      return is_allocated(i) ? full_accessor(i) : af::c_grid<3>(0, 0, 0);
+    }
+
+    /** @returns A reference to the data of a shoebox */
+    data_ref_type data(std::size_t i) {
+      return data_ref_type(data_.begin() + offset_[i], accessor(i));
+    }
+
+    /** @returns A reference to the data of a shoebox */
+    data_const_ref_type data(std::size_t i) const {
+      return data_const_ref_type(data_.begin() + offset_[i], accessor(i));
+    }
+
+    /** @returns A reference to the mask of a shoebox */
+    mask_ref_type mask(std::size_t i) {
+      return mask_ref_type(mask_.begin() + offset_[i], accessor(i));
+    }
+
+    /** @returns A reference to the mask of a shoebox */
+    mask_const_ref_type mask(std::size_t i) const {
+      return mask_const_ref_type(mask_.begin() + offset_[i], accessor(i));
+    }
+
+    /** @returns A reference to the background of a shoebox */
+    data_ref_type background(std::size_t i) {
+      return data_ref_type(background_.begin() + offset_[i], accessor(i));
+    }
+
+    /** @returns A reference to the background of a shoebox */
+    data_const_ref_type background(std::size_t i) const {
+      return data_const_ref_type(background_.begin() + offset_[i], accessor(i));
+    }
+
+    /**
+     * Copy a shoebox out of the column
+     * @param i The index of the shoebox
+     * @returns The shoebox
+     */
+    Shoebox<FloatType> shoebox(std::size_t i) const {
+      Shoebox<FloatType> result(panel_[i], bbox_[i], flat_[i]);
+      if (is_allocated(i)) {
+        af::c_grid<3> grid = accessor(i);
+        std::size_t k0 = offset_[i];
+        std::size_t k1 = offset_[i + 1];
+        result.data = af::versa<FloatType, af::c_grid<3> >(grid);
+        result.mask = af::versa<int, af::c_grid<3> >(grid);
+        result.background = af::versa<FloatType, af::c_grid<3> >(grid);
+        std::copy(data_.begin() + k0, data_.begin() + k1, result.data.begin());
+        std::copy(mask_.begin() + k0, mask_.begin() + k1, result.mask.begin());
+        std::copy(background_.begin() + k0,
+                  background_.begin() + k1,
+                  result.background.begin());
+      }
+      return result;
+    }
+
+    /**
+     * @returns The column as an array of shoeboxes
+     */
+    af::shared<Shoebox<FloatType> > shoeboxes() const {
+      af::shared<Shoebox<FloatType> > result;
+      result.reserve(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        result.push_back(shoebox(i));
+      }
+      return result;
+    }
+
+    /**
+     * Count the number of mask pixels with the given value in each shoebox
+     * @param code The code
+     * @returns The number of pixels with that code
+     */
+    af::shared<int> count_mask_values(int code) const {
+      af::shared<int> result(size(), 0);
+      for (std::size_t i = 0; i < size(); ++i) {
+        for (std::size_t k = offset_[i]; k < offset_[i + 1]; ++k) {
+          if ((mask_[k] & code) == code) {
+            result[i]++;
+          }
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Get the summed intensity of each shoebox, splitting the shoeboxes
+     * between threads
+     * @param nthreads The number of threads
+     * @returns The intensities
+     */
+    af::shared<Intensity> summed_intensity(std::size_t nthreads = 1) const {
+      af::shared<Intensity> result(size());
+      SummedIntensityJob job = {offset_.begin(),
+                                data_.begin(),
+                                background_.begin(),
+                                mask_.begin(),
+                                result.begin()};
+      dials::util::parallel_for(size(), nthreads, job);
+      return result;
+    }
+
+  private:
+    /**
+     * Sum the pixels of a range of shoeboxes
+     */
+    struct SummedIntensityJob {
+      const std::size_t *offset;
+      const FloatType *data;
+      const FloatType *background;
+      const int *mask;
+      Intensity *result;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          std::size_t k = offset[i];
+          std::size_t n = offset[i + 1] - k;
+          Summation<FloatType> summation(af::const_ref<FloatType>(data + k, n),
+                                         af::const_ref<FloatType>(background + k, n),
+                                         af::const_ref<int>(mask + k, n));
+          result[i].observed.value = summation.intensity();
+          result[i].observed.variance = summation.variance();
+          result[i].background.value = summation.background();
+          result[i].background.variance = summation.background_variance();
+          result[i].observed.success = summation.success();
+        }
+      }
+    };
+
+    /** @returns The shape of the arrays of a shoebox when allocated */
+    af::c_grid<3> full_accessor(std::size_t i) const {
+      const int6 &b = bbox_[i];
+      DIALS_ASSERT(b[1] >= b[0]);
+      DIALS_ASSERT(b[3] >= b[2]);
+      DIALS_ASSERT(b[5] >= b[4]);
+      std::size_t zs = flat_[i] ? 1 : b[5] - b[4];
+      return af::c_grid<3>(zs, b[3] - b[2], b[1] - b[0]);
+    }
+
+    af::shared<std::size_t> panel_;
+    af::shared<int6> bbox_;
+    af::shared<bool> flat_;
+    af::shared<std::size_t> offset_;
+    af::shared<FloatType> data_;
+    af::shared<int> mask_;
+    af::shared<FloatType> background_;
+  };
+
+}}  // namespace dials::model
+
+#endif  // DIALS_MODEL_DATA_SHOEBOX_ARENA_H
@@ -0,0 +1,236 @@
+/*
+ * strong_pixel_runs.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_MODEL_DATA_STRONG_PIXEL_RUNS_H
+#define DIALS_MODEL_DATA_STRONG_PIXEL_RUNS_H
+
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace model {
+
+  using scitbx::af::int2;
+
+  /**
+   * A run length encoded mask of the strong pixels on an image. Each run is a
+   * set of consecutive strong pixels [x0, x1) on a single row of the image.
+   * The runs are stored in the order of the pixels in the image. Since strong
+   * pixels are usually a tiny fraction of an image, this is much smaller than
+   * the dense mask and can be read without scanning the whole image.
+   */
+  class StrongPixelRuns {
+  public:
+    /**
+     * Initialise an empty list
+     */
+    StrongPixelRuns() : size_(0, 0), num_pixels_(0) {}
+
+    /**
+     * Initialise an empty list for an image
+     * @param size The size of the image
+     */
+    StrongPixelRuns(int2 size) : size_(size), num_pixels_(0) {
+      DIALS_ASSERT(size.all_ge(0));
+    }
+
+    /**
+     * Encode a dense mask
+     * @param mask The strong pixel mask
+     */
+    StrongPixelRuns(const af::const_ref<bool, af::c_grid<2> > &mask)
+        : size_(mask.accessor()), num_pixels_(0) {
+      for (std::size_t j = 0; j < size_[0]; ++j) {
+        add_row(j, &mask[j * size_[1]]);
+      }
+    }
+
+    /**
+     * Initialise from the list of runs
+     * @param size The size of the image
+     * @param row The row of each run
+     * @param x0 The first pixel of each run
+     * @param x1 One past the last pixel of each run
+     */
+    StrongPixelRuns(int2 size,
+                    const af::const_ref<int> &row,
+                    const af::const_ref<int> &x0,
+                    const af::const_ref<int> &x1)
+        : size_(size), num_pixels_(0) {
+      DIALS_ASSERT(row.size() == x0.size());
+      DIALS_ASSERT(row.size() == x1.size());
+      for (std::size_t i = 0; i < row.size(); ++i) {
+        add_run(row[i], x0[i], x1[i]);
+      }
+    }
+
+    /**
+     * Remove all the runs and set the image size
+     * @param size The size of the image
+     */
+    void reset(int2 size) {
+      DIALS_ASSERT(size.all_ge(0));
+      size_ = size;
+      row_.clear();
+      x0_.clear();
+      x1_.clear();
+      num_pixels_ = 0;
+    }
+
+    /**
+     * Add a run to the end of the list. A run adjacent to the previous run
+     * is merged with it.
+     * @param row The row of the run
+     * @param x0 The first pixel of the run
+     * @param x1 One past the last pixel of the run
+     */
+    void add_run(int row, int x0, int x1) {
+      DIALS_ASSERT(row >= 0 && row < size_[0]);
+      DIALS_ASSERT(x0 >= 0 && x0 < x1 && x1 <= size_[1]);
+      if (row_.size() > 0) {
+        std::size_t last = row_.size() - 1;
+        DIALS_ASSERT(row > row_[last] || (row == row_[last] && x0 >= x1_[last]));
+        if (row == row_[last] && x0 == x1_[last]) {
+          x1_[last] = x1;
+          num_pixels_ += x1 - x0;
+          return;
+        }
+      }
+      row_.push_back(row);
+      x0_.push_back(x0);
+      x1_.push_back(x1);
+      num_pixels_ += x1 - x0;
+    }
+
+    /**
+     * Encode a row of the dense mask and add the runs to the end of the list.
+     * @param row The row
+     * @param mask The mask for the row
+     */
+    void add_row(int row, const bool *mask) {
+      int xsize = size_[1];
+      int i = 0;
+      while (i < xsize) {
+        for (; i < xsize && !mask[i]; ++i)
+          ;
+        if (i == xsize) {
+          break;
+        }
+        int x0 = i;
+        for (; i < xsize && mask[i]; ++i)
+          ;
+        add_run(row, x0, i);
+      }
+    }
+
+    /**
+     * @returns The image size
+     */
+    int2 size() const {
+      return size_;
+    }
+
+    /**
+     * @returns The number of runs
+     */
+    std::size_t num_runs() const {
+      return row_.size();
+    }
+
+    /**
+     * @returns The number of strong pixels
+     */
+    std::size_t num_pixels() const {
+      return num_pixels_;
+    }
+
+    /**
+     * @returns The row of each run
+     */
+    af::shared<int> row() const {
+      return row_;
+    }
+
+    /**
+     * @returns The first pixel of each run
+     */
+    af::shared<int> x0() const {
+      return x0_;
+    }
+
+    /**
+     * @returns One past the last pixel of each run
+     */
+    af::shared<int> x1() const {
+      return x1_;
+    }
+
+    /**
+     * @returns The row of run i
+     */
+    int row(std::size_t i) const {
+      DIALS_ASSERT(i < row_.size());
+      return row_[i];
+    }
+
+    /**
+     * @returns The first pixel of run i
+     */
+    int x0(std::size_t i) const {
+      DIALS_ASSERT(i < x0_.size());
+      return x0_[i];
+    }
+
+    /**
+     * @returns One past the last pixel of run i
+     */
+    int x1(std::size_t i) const {
+      DIALS_ASSERT(i < x1_.size());
+      return x1_[i];
+    }
+
+    /**
+     * @returns The indices of the strong pixels in the image
+     */
+    af::shared<std::size_t> index() const {
+      af::shared<std::size_t> result;
+      result.reserve(num_pixels_);
+      for (std::size_t i = 0; i < row_.size(); ++i) {
+        std::size_t k = row_[i] * size_[1];
+        for (int x = x0_[i]; x < x1_[i]; ++x) {
+          result.push_back(k + x);
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @returns The dense strong pixel mask
+     */
+    af::versa<bool, af::c_grid<2> > as_mask() const {
+      af::versa<bool, af::c_grid<2> > result(af::c_grid<2>(size_), false);
+      for (std::size_t i = 0; i < row_.size(); ++i) {
+        std::size_t k = row_[i] * size_[1];
+        for (int x = x0_[i]; x < x1_[i]; ++x) {
+          result[k + x] = true;
+        }
+      }
+      return result;
+    }
+
+  private:
+    int2 size_;
+    af::shared<int> row_;
+    af::shared<int> x0_;
+    af::shared<int> x1_;
+    std::size_t num_pixels_;
+  };
+
+}}  // namespace dials::model
+
+#endif  // DIALS_MODEL_DATA_STRONG_PIXEL_RUNS_H
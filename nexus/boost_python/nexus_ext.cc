@@ -15,6 +15,7 @@
 #include <scitbx/array_family/boost_python/flex_wrapper.h>
 #include <H5Cpp.h>
 #include <dials/nexus/nxmx.h>
+#include <dials/nexus/image_reader.h>
 #include <dials/error.h>
 
 namespace dials { namespace nexus { namespace boost_python {
@@ -53,6 +54,36 @@ namespace dials { namespace nexus { namespace boost_python {
       }
     };
 
+    template <typename Type, typename Class>
+    struct lazy_getter {
+      typedef Type value_type;
+      typedef Class class_type;
+      typedef LazyDataset<value_type> class_type::*pointer_type;
+
+      const pointer_type variable;
+
+      lazy_getter(pointer_type p) : variable(p) {}
+
+      value_type operator()(const class_type &obj) const {
+        return (obj.*variable).get();
+      }
+    };
+
+    template <typename Type, typename Class>
+    struct lazy_setter {
+      typedef Type value_type;
+      typedef Class class_type;
+      typedef LazyDataset<value_type> class_type::*pointer_type;
+
+      pointer_type variable;
+
+      lazy_setter(pointer_type p) : variable(p) {}
+
+      void operator()(class_type &obj, value_type value) const {
+        obj.*variable = LazyDataset<value_type>(value);
+      }
+    };
+
     template <typename Type, typename Class>
     object make_getter(Type Class::*ptr) {
       typedef boost::mpl::vector<Type, const Class &> signature;
@@ -67,6 +98,20 @@ namespace dials { namespace nexus { namespace boost_python {
         setter<Type, Class>(ptr), default_call_policies(), signature());
     }
 
+    template <typename Type, typename Class>
+    object make_getter(LazyDataset<Type> Class::*ptr) {
+      typedef boost::mpl::vector<Type, const Class &> signature;
+      return make_function(
+        lazy_getter<Type, Class>(ptr), default_call_policies(), signature());
+    }
+
+    template <typename Type, typename Class>
+    object make_setter(LazyDataset<Type> Class::*ptr) {
+      typedef boost::mpl::vector<void, Class &, Type> signature;
+      return make_function(
+        lazy_setter<Type, Class>(ptr), default_call_policies(), signature());
+    }
+
   }  // namespace detail
 
   af::shared<NXmx> load(const char *filename) {
@@ -289,6 +334,21 @@ namespace dials { namespace nexus { namespace boost_python {
     // Methods to load and dump NXmx
     def("load", load);
     def("dump", dump);
+
+    // Read blocks of image frames
+    class_<ImageBlockReader, boost::noncopyable>("ImageBlockReader", no_init)
+      .def(init<const std::string &, const std::string &, std::size_t, bool>(
+        (arg("filename"),
+         arg("path"),
+         arg("block_size") = 0,
+         arg("prefetch") = false)))
+      .def("num_frames", &ImageBlockReader::num_frames)
+      .def("image_size", &ImageBlockReader::image_size)
+      .def("block_size", &ImageBlockReader::block_size)
+      .def("read", &ImageBlockReader::read, (arg("frame0"), arg("frame1")))
+      .def("frame", &ImageBlockReader::frame)
+      .def("has_next", &ImageBlockReader::has_next)
+      .def("next", &ImageBlockReader::next);
   }
 
 }}}  // namespace dials::nexus::boost_python
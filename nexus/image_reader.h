@@ -0,0 +1,179 @@
+#ifndef DIALS_NEXUS_IMAGE_READER_H
+#define DIALS_NEXUS_IMAGE_READER_H
+
+#include <H5Cpp.h>
+#include <algorithm>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace nexus {
+
+  using scitbx::af::int2;
+
+  /**
+   * Read an image dataset with dimensions (frame, slow, fast), e.g. the data of
+   * an NXdata group, in blocks of whole frames. Each block is read with a
+   * single hyperslab selection, and by default a block is one chunk deep so
+   * that each chunk is read and decompressed only once.
+   *
+   * The blocks can be read in order with next(), in which case the reader can
+   * read the following block on a background thread while the caller works on
+   * the current one. HDF5 is not usually built to be thread safe, so the reads
+   * of a reader are done one at a time, and nothing else should use HDF5
+   * while a block is being read in the background.
+   */
+  class ImageBlockReader : public boost::noncopyable {
+  public:
+    typedef af::versa<int, af::c_grid<3> > block_type;
+
+    /**
+     * Open the dataset
+     * @param filename The file name
+     * @param path The path of the dataset in the file
+     * @param block_size The number of frames in a block (0 for one chunk)
+     * @param prefetch Read the next block in the background
+     */
+    ImageBlockReader(const std::string &filename,
+                     const std::string &path,
+                     std::size_t block_size = 0,
+                     bool prefetch = false)
+        : file_(filename, H5F_ACC_RDONLY),
+          dataset_(file_.openDataSet(path)),
+          block_size_(block_size),
+          prefetch_(prefetch),
+          frame_(0) {
+      H5::DataSpace dataspace = dataset_.getSpace();
+      DIALS_ASSERT(dataspace.isSimple());
+      DIALS_ASSERT(dataspace.getSimpleExtentNdims() == 3);
+      dataspace.getSimpleExtentDims(dims_);
+      if (block_size_ == 0) {
+        block_size_ = 1;
+        H5::DSetCreatPropList plist = dataset_.getCreatePlist();
+        if (plist.getLayout() == H5D_CHUNKED) {
+          hsize_t chunk[3] = {0, 0, 0};
+          plist.getChunk(3, chunk);
+          block_size_ = std::max(chunk[0], (hsize_t)1);
+        }
+      }
+    }
+
+    /**
+     * Wait for any block being read in the background
+     */
+    ~ImageBlockReader() {
+      if (thread_) {
+        thread_->join();
+      }
+    }
+
+    /** @returns The number of frames */
+    std::size_t num_frames() const {
+      return dims_[0];
+    }
+
+    /** @returns The size of each frame (slow, fast) */
+    int2 image_size() const {
+      return int2((int)dims_[1], (int)dims_[2]);
+    }
+
+    /** @returns The number of frames in a block */
+    std::size_t block_size() const {
+      return block_size_;
+    }
+
+    /**
+     * Read a range of frames
+     * @param frame0 The first frame
+     * @param frame1 The frame after the last frame
+     * @returns The frames
+     */
+    block_type read(std::size_t frame0, std::size_t frame1) const {
+      DIALS_ASSERT(frame0 < frame1 && frame1 <= num_frames());
+      hsize_t offset[3] = {frame0, 0, 0};
+      hsize_t count[3] = {frame1 - frame0, dims_[1], dims_[2]};
+      block_type result(
+        af::c_grid<3>(frame1 - frame0, (std::size_t)dims_[1], (std::size_t)dims_[2]));
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      H5::DataSpace filespace = dataset_.getSpace();
+      filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+      H5::DataSpace memspace(3, count);
+      dataset_.read(result.begin(), H5::PredType::NATIVE_INT, memspace, filespace);
+      return result;
+    }
+
+    /** @returns The first frame of the block that next() will return */
+    std::size_t frame() const {
+      return frame_;
+    }
+
+    /** @returns Are there more blocks to read with next() */
+    bool has_next() const {
+      return frame_ < num_frames();
+    }
+
+    /**
+     * Get the next block of frames, and start reading the block after it if
+     * prefetching is enabled
+     * @returns The frames
+     */
+    block_type next() {
+      DIALS_ASSERT(has_next());
+      std::size_t frame1 = std::min(frame_ + block_size_, num_frames());
+      block_type result;
+      if (thread_) {
+        thread_->join();
+        thread_.reset();
+        if (!error_.empty()) {
+          std::string message;
+          message.swap(error_);
+          DIALS_ERROR(message);
+        }
+        result = prefetched_;
+        prefetched_ = block_type();
+      } else {
+        result = read(frame_, frame1);
+      }
+      frame_ = frame1;
+      if (prefetch_ && has_next()) {
+        std::size_t frame2 = std::min(frame_ + block_size_, num_frames());
+        thread_.reset(new boost::thread(
+          boost::bind(&ImageBlockReader::prefetch, this, frame_, frame2)));
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Read a block in the background, keeping any error until next()
+     */
+    void prefetch(std::size_t frame0, std::size_t frame1) {
+      try {
+        prefetched_ = read(frame0, frame1);
+      } catch (H5::Exception &e) {
+        error_ = "Failed to read frames: " + e.getDetailMsg();
+      } catch (std::exception &e) {
+        error_ = e.what();
+      }
+    }
+
+    H5::H5File file_;
+    H5::DataSet dataset_;
+    hsize_t dims_[3];
+    std::size_t block_size_;
+    bool prefetch_;
+    std::size_t frame_;
+    mutable boost::mutex mutex_;
+    boost::scoped_ptr<boost::thread> thread_;
+    block_type prefetched_;
+    std::string error_;
+  };
+
+}}  // namespace dials::nexus
+
+#endif  // DIALS_NEXUS_IMAGE_READER_H
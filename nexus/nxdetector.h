@@ -4,6 +4,7 @@
 
 #include <boost/optional.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/nexus/serialize.h>
 #include <dials/nexus/nxdetector_module.h>
 
 namespace dials { namespace nexus {
@@ -30,10 +31,10 @@ namespace dials { namespace nexus {
     boost::optional<bool> flatfield_applied;
     boost::optional<bool> pixel_mask_applied;
     boost::optional<bool> countrate_correction_applied_applied;
-    af::versa<double, af::c_grid<2> > angular_calibration;
-    af::versa<double, af::c_grid<2> > flatfield;
-    af::versa<double, af::c_grid<2> > flatfield_error;
-    af::versa<int, af::c_grid<2> > pixel_mask;
+    LazyDataset<af::versa<double, af::c_grid<2> > > angular_calibration;
+    LazyDataset<af::versa<double, af::c_grid<2> > > flatfield;
+    LazyDataset<af::versa<double, af::c_grid<2> > > flatfield_error;
+    LazyDataset<af::versa<int, af::c_grid<2> > > pixel_mask;
     af::shared<NXdetector_module> module;
   };
 
@@ -99,16 +100,13 @@ namespace dials { namespace nexus {
           } else if (name == "countrate_correction_applied_applied") {
             result.countrate_correction_applied_applied = serialize<bool>::load(dset);
           } else if (name == "angular_calibration") {
-            result.angular_calibration =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+            result.angular_calibration = dset;
           } else if (name == "flatfield") {
-            result.flatfield =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+            result.flatfield = dset;
           } else if (name == "flatfield_error") {
-            result.flatfield_error =
-              serialize<af::versa<double, af::c_grid<2> > >::load(dset);
+            result.flatfield_error = dset;
           } else if (name == "pixel_mask") {
-            result.pixel_mask = serialize<af::versa<int, af::c_grid<2> > >::load(dset);
+            result.pixel_mask = dset;
           }
         } break;
 
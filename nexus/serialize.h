@@ -2,7 +2,9 @@
 #ifndef DIALS_NEXUS_SERIALIZE_H
 #define DIALS_NEXUS_SERIALIZE_H
 
+#include <stdexcept>
 #include <string>
+#include <boost/shared_ptr.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -199,6 +201,77 @@ namespace dials { namespace nexus {
     static void dump(const af::versa<int, af::c_grid<2> > &obj, Handle &handle) {}
   };
 
+  /**
+   * A dataset which is only read when its value is first asked for, so that
+   * loading the metadata of a file does not read large arrays (e.g. the pixel
+   * mask or flatfield) which may never be used. The dataset keeps the file
+   * open until it has been read. Copies share the value once it is read.
+   */
+  template <typename T>
+  class LazyDataset {
+  public:
+    /**
+     * Initialise with no dataset
+     */
+    LazyDataset() : state_(new state_type()) {}
+
+    /**
+     * Initialise with a dataset to read later
+     * @param dataset The dataset
+     */
+    LazyDataset(const H5::DataSet &dataset) : state_(new state_type()) {
+      state_->dataset = dataset;
+      state_->has_dataset = true;
+    }
+
+    /**
+     * Initialise with a value
+     * @param value The value
+     */
+    LazyDataset(const T &value) : state_(new state_type()) {
+      state_->value = value;
+      state_->loaded = true;
+    }
+
+    /** @returns Is there a value or a dataset to read it from */
+    bool empty() const {
+      return !state_->loaded && !state_->has_dataset;
+    }
+
+    /** @returns Has the value been read (or set) */
+    bool is_loaded() const {
+      return state_->loaded;
+    }
+
+    /**
+     * @returns The value, reading the dataset the first time
+     */
+    T get() const {
+      if (!state_->loaded && state_->has_dataset) {
+        try {
+          state_->value = serialize<T>::load(state_->dataset);
+        } catch (H5::Exception &e) {
+          throw std::runtime_error(e.getDetailMsg());
+        }
+        state_->dataset = H5::DataSet();
+        state_->has_dataset = false;
+        state_->loaded = true;
+      }
+      return state_->value;
+    }
+
+  private:
+    struct state_type {
+      H5::DataSet dataset;
+      bool has_dataset;
+      bool loaded;
+      T value;
+      state_type() : has_dataset(false), loaded(false) {}
+    };
+
+    boost::shared_ptr<state_type> state_;
+  };
+
   template <typename Handle>
   bool is_nx_class(const Handle &handle, std::string test_name) {
     if (handle.attrExists("NX_class")) {
@@ -20,7 +20,10 @@
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/versa.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
+#include <algorithm>
+#include <vector>
 
 namespace dials { namespace pychef {
 
@@ -47,19 +50,19 @@ namespace dials { namespace pychef {
       iminus_.push_back(iminus);
     }
 
-    scitbx::af::shared<std::size_t> iplus() {
+    scitbx::af::shared<std::size_t> iplus() const {
       return iplus_;
     }
 
-    scitbx::af::shared<std::size_t> iminus() {
+    scitbx::af::shared<std::size_t> iminus() const {
       return iminus_;
     }
 
-    cctbx::miller::index<> miller_index() {
+    cctbx::miller::index<> miller_index() const {
       return miller_index_;
     }
 
-    bool is_centric() {
+    bool is_centric() const {
       return centric_;
     }
 
@@ -130,6 +133,46 @@ namespace dials { namespace pychef {
 
   namespace accumulator {
 
+    namespace detail {
+
+      /**
+       * Add the elements of one array to another of the same size
+       */
+      template <typename Array>
+      void add_in_place(Array &a, const Array &b) {
+        DIALS_ASSERT(a.size() == b.size());
+        for (std::size_t i = 0; i < a.size(); ++i) {
+          a.begin()[i] += b.begin()[i];
+        }
+      }
+
+      /**
+       * Accumulate contiguous blocks of observation groups, each into its own
+       * accumulator
+       */
+      template <typename Accumulator>
+      struct AccumulateJob {
+        const std::vector<ObservationGroup> *groups;
+        std::vector<Accumulator> *blocks;
+
+        AccumulateJob(const std::vector<ObservationGroup> *groups_,
+                      std::vector<Accumulator> *blocks_)
+            : groups(groups_), blocks(blocks_) {}
+
+        void operator()(std::size_t first, std::size_t last) const {
+          std::size_t n = groups->size();
+          std::size_t n_blocks = blocks->size();
+          for (std::size_t b = first; b < last; ++b) {
+            Accumulator &accumulator = (*blocks)[b];
+            for (std::size_t i = b * n / n_blocks; i < (b + 1) * n / n_blocks; ++i) {
+              accumulator((*groups)[i]);
+            }
+          }
+        }
+      };
+
+    }  // namespace detail
+
     class CompletenessAccumulator {
     public:
       CompletenessAccumulator(af::const_ref<std::size_t> const &dose,
@@ -150,14 +193,42 @@ namespace dials { namespace pychef {
             ieither_comp_overall(n_steps, 0.0),
             iboth_comp_overall(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
+      /**
+       * @returns An accumulator for the same observations, with nothing
+       * accumulated
+       */
+      CompletenessAccumulator empty() const {
+        DIALS_ASSERT(!finalised_);
+        CompletenessAccumulator result(*this);
+        af::c_grid<2> grid(binner_.n_bins_used(), n_steps_);
+        result.iplus_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.iminus_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.ieither_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.iboth_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        return result;
+      }
+
+      /**
+       * Add the counts accumulated by another accumulator
+       */
+      void add(const CompletenessAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        detail::add_in_place(iplus_count, other.iplus_count);
+        detail::add_in_place(iminus_count, other.iminus_count);
+        detail::add_in_place(ieither_count, other.ieither_count);
+        detail::add_in_place(iboth_count, other.iboth_count);
+      }
+
+      void operator()(const ObservationGroup &group) {
+        af::const_ref<std::size_t> iplus = group.iplus().const_ref();
+        af::const_ref<std::size_t> iminus = group.iminus().const_ref();
         std::size_t dose_min_iplus = 1e8;
         std::size_t dose_min_iminus = 1e8;
         std::size_t i_bin;
-        if (group.iplus().size()) {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
+        if (iplus.size()) {
+          i_bin = binner_.get_i_bin(d_star_sq_[iplus[0]]);
         } else {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iminus()[0]]);
+          i_bin = binner_.get_i_bin(d_star_sq_[iminus[0]]);
         }
 
         if (i_bin == 0) {
@@ -167,19 +238,19 @@ namespace dials { namespace pychef {
 
         i_bin -= 1;
 
-        for (std::size_t i = 0; i < group.iplus().size(); i++) {
-          std::size_t dose_i = dose_[group.iplus()[i]];
+        for (std::size_t i = 0; i < iplus.size(); i++) {
+          std::size_t dose_i = dose_[iplus[i]];
           dose_min_iplus = std::min(dose_i, dose_min_iplus);
           if (group.is_centric()) {
             dose_min_iminus = std::min(dose_i, dose_min_iminus);
           }
         }
 
-        for (std::size_t i = 0; i < group.iminus().size(); i++) {
-          for (std::size_t j = 0; j < group.iplus().size(); j++) {
-            DIALS_ASSERT(group.iminus()[i] != group.iplus()[j]);
+        for (std::size_t i = 0; i < iminus.size(); i++) {
+          for (std::size_t j = 0; j < iplus.size(); j++) {
+            DIALS_ASSERT(iminus[i] != iplus[j]);
           }
-          std::size_t dose_i = dose_[group.iminus()[i]];
+          std::size_t dose_i = dose_[iminus[i]];
           dose_min_iminus = std::min(dose_i, dose_min_iminus);
         }
 
@@ -323,11 +394,35 @@ namespace dials { namespace pychef {
             rcp_(n_steps, 0.0),
             scp_(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
+      /**
+       * @returns An accumulator for the same observations, with nothing
+       * accumulated
+       */
+      RcpScpAccumulator empty() const {
+        DIALS_ASSERT(!finalised_);
+        RcpScpAccumulator result(*this);
+        af::c_grid<2> grid(binner_.n_bins_used(), n_steps_);
+        result.A = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.B = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.isigma = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.count = af::versa<std::size_t, af::c_grid<2> >(grid, 0);
+        return result;
+      }
+
+      /**
+       * Add the sums accumulated by another accumulator
+       */
+      void add(const RcpScpAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        detail::add_in_place(A, other.A);
+        detail::add_in_place(B, other.B);
+        detail::add_in_place(isigma, other.isigma);
+        detail::add_in_place(count, other.count);
+      }
+
+      void operator()(const ObservationGroup &group) {
         if (group.iplus().size()) {
           std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
-          if (i_bin > binner_.n_bins_used()) {
-          }
           DIALS_ASSERT(i_bin <= binner_.n_bins_used())(i_bin);
           if (i_bin == 0) {
             // outside "used" bins
@@ -470,7 +565,29 @@ namespace dials { namespace pychef {
             rd_bottom(n_steps, 0.0),
             rd_(n_steps, 0.0) {}
 
-      void operator()(ObservationGroup group) {
+      /**
+       * @returns An accumulator for the same observations, with nothing
+       * accumulated
+       */
+      RdAccumulator empty() const {
+        DIALS_ASSERT(!finalised_);
+        RdAccumulator result(*this);
+        result.rd_top = af::shared<double>(n_steps_, 0.0);
+        result.rd_bottom = af::shared<double>(n_steps_, 0.0);
+        result.rd_ = af::shared<double>(n_steps_, 0.0);
+        return result;
+      }
+
+      /**
+       * Add the sums accumulated by another accumulator
+       */
+      void add(const RdAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        detail::add_in_place(rd_top, other.rd_top);
+        detail::add_in_place(rd_bottom, other.rd_bottom);
+      }
+
+      void operator()(const ObservationGroup &group) {
         if (group.iplus().size()) {
           accumulate(group.iplus());
         }
@@ -523,6 +640,82 @@ namespace dials { namespace pychef {
       af::shared<double> rd_top, rd_bottom, rd_;
     };
 
+    /**
+     * The accumulators of the chef statistics, fed each observation group in
+     * a single pass
+     */
+    class ChefAccumulator {
+    public:
+      ChefAccumulator(af::const_ref<double> const &intensities,
+                      af::const_ref<double> const &sigmas,
+                      af::const_ref<std::size_t> const &dose,
+                      af::const_ref<double> const &d_star_sq,
+                      cctbx::miller::binner const &binner,
+                      int n_steps)
+          : completeness(dose, d_star_sq, binner, n_steps),
+            rcp_scp(intensities, sigmas, dose, d_star_sq, binner, n_steps),
+            rd(intensities, dose, n_steps) {}
+
+      ChefAccumulator empty() const {
+        return ChefAccumulator(completeness.empty(), rcp_scp.empty(), rd.empty());
+      }
+
+      void add(const ChefAccumulator &other) {
+        completeness.add(other.completeness);
+        rcp_scp.add(other.rcp_scp);
+        rd.add(other.rd);
+      }
+
+      void operator()(const ObservationGroup &group) {
+        completeness(group);
+        rcp_scp(group);
+        rd(group);
+      }
+
+      CompletenessAccumulator completeness;
+      RcpScpAccumulator rcp_scp;
+      RdAccumulator rd;
+
+    private:
+      ChefAccumulator(const CompletenessAccumulator &completeness_,
+                      const RcpScpAccumulator &rcp_scp_,
+                      const RdAccumulator &rd_)
+          : completeness(completeness_), rcp_scp(rcp_scp_), rd(rd_) {}
+    };
+
+    /**
+     * Feed each observation group to an accumulator. The groups are split
+     * into a fixed number of blocks which are shared between the threads. Each
+     * block is accumulated by its own empty copy of the accumulator and the
+     * blocks are then added in order, so the results do not depend on the
+     * number of threads. The accumulator must provide operator()(group),
+     * empty() and add(other).
+     * @param groups The observation groups
+     * @param accumulator The accumulator
+     * @param nthreads The number of threads
+     */
+    template <typename Accumulator>
+    void accumulate_groups(const std::vector<ObservationGroup> &groups,
+                           Accumulator &accumulator,
+                           std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t max_blocks = 32;
+      std::size_t n_blocks = std::min(groups.size(), max_blocks);
+      if (n_blocks == 0) {
+        return;
+      }
+      std::vector<Accumulator> blocks;
+      blocks.reserve(n_blocks);
+      for (std::size_t i = 0; i < n_blocks; ++i) {
+        blocks.push_back(accumulator.empty());
+      }
+      dials::util::parallel_for(
+        n_blocks, nthreads, detail::AccumulateJob<Accumulator>(&groups, &blocks));
+      for (std::size_t i = 0; i < n_blocks; ++i) {
+        accumulator.add(blocks[i]);
+      }
+    }
+
   }  // namespace accumulator
 
   class ChefStatistics {
@@ -536,84 +729,80 @@ namespace dials { namespace pychef {
                    cctbx::miller::binner const &binner,
                    sgtbx::space_group space_group,
                    bool anomalous_flag,
-                   int n_steps)
+                   int n_steps,
+                   std::size_t nthreads = 1)
         : observations(miller_indices, space_group, anomalous_flag),
-          completeness_accumulator(dose, d_star_sq, binner, n_steps),
-          rcp_scp_accumulator(intensities, sigmas, dose, d_star_sq, binner, n_steps),
-          rd_accumulator(intensities, dose, n_steps) {
+          accumulator_(intensities, sigmas, dose, d_star_sq, binner, n_steps) {
       typedef Observations::map_type map_t;
-      map_t groups = observations.observation_groups();
-
-      for (map_t::iterator it = groups.begin(); it != groups.end(); it++) {
-        ObservationGroup group = it->second;
-        completeness_accumulator(group);
-        rcp_scp_accumulator(group);
-        rd_accumulator(group);
+      const map_t &groups = observations.observation_groups_;
+      std::vector<ObservationGroup> group_list;
+      group_list.reserve(groups.size());
+      for (map_t::const_iterator it = groups.begin(); it != groups.end(); it++) {
+        group_list.push_back(it->second);
       }
+      accumulator::accumulate_groups(group_list, accumulator_, nthreads);
 
-      completeness_accumulator.finalise(counts_complete);
-      rcp_scp_accumulator.finalise();
-      rd_accumulator.finalise();
+      accumulator_.completeness.finalise(counts_complete);
+      accumulator_.rcp_scp.finalise();
+      accumulator_.rd.finalise();
     }
 
     af::versa<double, af::c_grid<2> > iplus_completeness_bins() {
-      return completeness_accumulator.iplus_completeness_bins();
+      return accumulator_.completeness.iplus_completeness_bins();
     }
 
     af::versa<double, af::c_grid<2> > iminus_completeness_bins() {
-      return completeness_accumulator.iminus_completeness_bins();
+      return accumulator_.completeness.iminus_completeness_bins();
     }
 
     af::versa<double, af::c_grid<2> > ieither_completeness_bins() {
-      return completeness_accumulator.ieither_completeness_bins();
+      return accumulator_.completeness.ieither_completeness_bins();
     }
 
     af::versa<double, af::c_grid<2> > iboth_completeness_bins() {
-      return completeness_accumulator.iboth_completeness_bins();
+      return accumulator_.completeness.iboth_completeness_bins();
     }
 
     af::shared<double> iplus_completeness() {
-      return completeness_accumulator.iplus_completeness();
+      return accumulator_.completeness.iplus_completeness();
     }
 
     af::shared<double> iminus_completeness() {
-      return completeness_accumulator.iminus_completeness();
+      return accumulator_.completeness.iminus_completeness();
     }
 
     af::shared<double> ieither_completeness() {
-      return completeness_accumulator.ieither_completeness();
+      return accumulator_.completeness.ieither_completeness();
     }
 
     af::shared<double> iboth_completeness() {
-      return completeness_accumulator.iboth_completeness();
+      return accumulator_.completeness.iboth_completeness();
     }
 
     af::versa<double, af::c_grid<2> > rcp_bins() {
-      return rcp_scp_accumulator.rcp_bins();
+      return accumulator_.rcp_scp.rcp_bins();
     }
 
     af::versa<double, af::c_grid<2> > scp_bins() {
-      return rcp_scp_accumulator.scp_bins();
+      return accumulator_.rcp_scp.scp_bins();
     }
 
     af::shared<double> rcp() {
-      return rcp_scp_accumulator.rcp();
+      return accumulator_.rcp_scp.rcp();
     }
 
     af::shared<double> scp() {
-      return rcp_scp_accumulator.scp();
+      return accumulator_.rcp_scp.scp();
     }
 
     af::shared<double> rd() {
-      return rd_accumulator.rd();
+      return accumulator_.rd.rd();
     }
 
   private:
     Observations observations;
 
-    accumulator::CompletenessAccumulator completeness_accumulator;
-    accumulator::RcpScpAccumulator rcp_scp_accumulator;
-    accumulator::RdAccumulator rd_accumulator;
+    accumulator::ChefAccumulator accumulator_;
   };
 
 }}  // namespace dials::pychef
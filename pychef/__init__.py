@@ -106,7 +106,14 @@ def interpret_images_to_doses_options(
 
 class Statistics:
     def __init__(
-        self, intensities, dose, n_bins=8, range_min=None, range_max=None, range_width=1
+        self,
+        intensities,
+        dose,
+        n_bins=8,
+        range_min=None,
+        range_max=None,
+        range_width=1,
+        nthreads=1,
     ):
 
         if isinstance(dose, flex.double):
@@ -176,6 +183,7 @@ def __init__(
             intensities.space_group(),
             intensities.anomalous_flag(),
             self.n_steps,
+            nthreads,
         )
 
         self.iplus_comp_bins = chef_stats.iplus_completeness_bins()
@@ -0,0 +1,151 @@
+import random
+
+import pytest
+
+from dials.algorithms.background.glm import Creator, RobustPoissonMean
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+from dials.model.data import Shoebox
+
+
+def generate_shoeboxes(n, size=(3, 7, 7)):
+    shoeboxes = flex.shoebox(n)
+    code = MaskCode.Valid | MaskCode.Background
+    for i in range(n):
+        x0 = random.randint(0, 1000)
+        y0 = random.randint(0, 1000)
+        z0 = random.randint(0, 100)
+        bbox = (x0, x0 + size[2], y0, y0 + size[1], z0, z0 + size[0])
+        shoeboxes[i] = Shoebox(bbox)
+        shoeboxes[i].allocate()
+        mean = random.uniform(1, 100)
+        data = flex.random_double(size[0] * size[1] * size[2]) * mean
+        data.reshape(flex.grid(size))
+        shoeboxes[i].data = data.as_float()
+        shoeboxes[i].mask = flex.int(flex.grid(size), code)
+    return shoeboxes
+
+
+def copy_shoeboxes(shoeboxes):
+    result = flex.shoebox(len(shoeboxes))
+    for i in range(len(shoeboxes)):
+        result[i] = Shoebox(shoeboxes[i].bbox)
+        result[i].allocate()
+        result[i].data = shoeboxes[i].data.deep_copy()
+        result[i].mask = shoeboxes[i].mask.deep_copy()
+    return result
+
+
+@pytest.mark.parametrize("model", ["constant2d", "constant3d", "loglinear2d"])
+def test_creator_threads(model):
+    creator = Creator(
+        model=getattr(Creator.model, model),
+        tuning_constant=1.345,
+        max_iter=100,
+        min_pixels=10,
+    )
+    shoeboxes1 = generate_shoeboxes(100)
+    shoeboxes2 = copy_shoeboxes(shoeboxes1)
+
+    success1 = creator(shoeboxes1)
+    success2 = creator(shoeboxes2, nthreads=4)
+    assert success1.count(True) > 0
+    assert list(success1) == list(success2)
+    for s1, s2 in zip(shoeboxes1, shoeboxes2):
+        assert list(s1.background) == list(s2.background)
+        assert list(s1.mask) == list(s2.mask)
+
+
+def test_creator_status():
+    creator = Creator(
+        model=Creator.model.constant3d,
+        tuning_constant=1.345,
+        max_iter=100,
+        min_pixels=10,
+    )
+    shoeboxes = generate_shoeboxes(4)
+
+    # Too few background pixels
+    shoeboxes[1].mask = flex.int(shoeboxes[1].mask.accessor(), MaskCode.Valid)
+
+    # Negative pixel values
+    data = shoeboxes[2].data
+    data[0] = -1
+    shoeboxes[2].data = data
+
+    # Inconsistent shoebox
+    shoeboxes[3].data = flex.float(flex.grid(1, 1, 1))
+
+    status = creator.shoebox_status(shoeboxes, nthreads=2)
+    assert list(status) == [
+        Creator.status.success,
+        Creator.status.too_few_pixels,
+        Creator.status.negative_pixels,
+        Creator.status.inconsistent_shoebox,
+    ]
+    assert list(creator(shoeboxes)) == [True, False, False, False]
+
+
+def test_creator_constant3d_matches_robust_poisson_mean():
+    creator = Creator(
+        model=Creator.model.constant3d,
+        tuning_constant=1.345,
+        max_iter=100,
+        min_pixels=10,
+    )
+    shoeboxes = generate_shoeboxes(20)
+    success = creator(shoeboxes)
+    assert success.all_eq(True)
+    for sbox in shoeboxes:
+        data = sbox.data.as_double().as_1d()
+        median = max(1.0, flex.sorted(data)[len(data) // 2])
+        expected = RobustPoissonMean(data, median).mean()
+        assert sbox.background[0] == pytest.approx(expected, rel=1e-2)
+
+
+def test_creator_by_cluster():
+    from dials.algorithms.background import overlap_clusters
+
+    creator = Creator(
+        model=Creator.model.constant3d,
+        tuning_constant=1.345,
+        max_iter=100,
+        min_pixels=10,
+    )
+
+    # Two overlapping shoeboxes cut from the same image and one on its own
+    image = {}
+    bboxes = flex.int6(3)
+    bboxes[0] = (0, 10, 0, 10, 0, 3)
+    bboxes[1] = (5, 15, 5, 15, 0, 3)
+    bboxes[2] = (40, 50, 20, 30, 0, 3)
+    shoeboxes = flex.shoebox(len(bboxes))
+    code = MaskCode.Valid | MaskCode.Background
+    for i, bbox in enumerate(bboxes):
+        x0, x1, y0, y1, z0, z1 = bbox
+        data = flex.float(flex.grid(z1 - z0, y1 - y0, x1 - x0))
+        for k in range(z0, z1):
+            for j in range(y0, y1):
+                for ii in range(x0, x1):
+                    value = image.setdefault((k, j, ii), random.randint(0, 20))
+                    data[k - z0, j - y0, ii - x0] = value
+        shoeboxes[i] = Shoebox(bbox)
+        shoeboxes[i].allocate()
+        shoeboxes[i].data = data
+        shoeboxes[i].mask = flex.int(data.accessor(), code)
+
+    cluster = overlap_clusters(bboxes, flex.size_t(len(bboxes), 0), max_size=8)
+    assert list(cluster) == [0, 0, 1]
+
+    reference = copy_shoeboxes(shoeboxes)
+    success = creator.by_cluster(shoeboxes, cluster)
+    assert success.all_eq(True)
+
+    # The overlapping shoeboxes share one background
+    assert list(shoeboxes[0].background) == pytest.approx(
+        list(shoeboxes[1].background)
+    )
+
+    # The shoebox on its own is fitted as usual
+    creator(reference)
+    assert list(shoeboxes[2].background) == list(reference[2].background)
@@ -137,3 +137,32 @@ def test_robust(dials_data, model, tmpdir):
 
     scale4 = integrated4["background.scale"]
     assert (scale4 > 0).count(False) == 0
+
+
+def test_mapped_model(tmpdir):
+    from dials.algorithms.background.gmodel import StaticBackgroundModel
+    from dials.algorithms.background.gmodel.algorithm import ModelCache
+    from dials.array_family import flex
+
+    data = flex.random_double(40 * 50)
+    data.reshape(flex.grid(40, 50))
+    model = StaticBackgroundModel()
+    model.add(flex.double(flex.grid(20, 30), 1))
+    model.add(data)
+
+    model_file = tmpdir.join("model.bin")
+    model.save(model_file.strpath)
+    assert StaticBackgroundModel.is_model_file(model_file.strpath)
+    assert not StaticBackgroundModel.is_model_file(__file__)
+
+    mapped = ModelCache().get(model_file.strpath)
+    assert mapped.is_mapped()
+    assert len(mapped) == 2
+    assert list(mapped.data(1)) == list(data)
+    bbox = (45, 55, 35, 45, 0, 3)
+    assert list(mapped.extract(1, bbox)) == list(model.extract(1, bbox))
+
+    # A pickled mapped model is loaded into memory
+    unpickled = pickle.loads(pickle.dumps(mapped))
+    assert not unpickled.is_mapped()
+    assert list(unpickled.data(1)) == list(data)
@@ -4,6 +4,7 @@
     NormalOutlierRejector,
     NSigmaOutlierRejector,
     TruncatedOutlierRejector,
+    TukeyOutlierRejector,
 )
 from dials.algorithms.shoebox import MaskCode
 from dials.algorithms.simulation.generate_test_reflections import (
@@ -114,6 +115,40 @@ def assert_is_correct(data, mask):
         assert_is_correct(data, mask)
 
 
+def test_tukey():
+    lower = 1.5
+    upper = 1.5
+    reject = TukeyOutlierRejector(lower, upper)
+    size = (9, 9, 9)
+    ninvalid = 5
+    nforeground = 20
+    mean = 20
+
+    def assert_is_correct(data, mask):
+        (
+            invalid,
+            foreground,
+            background,
+            background_used,
+            background_valid,
+        ) = assert_basic_mask_is_correct(mask, ninvalid, nforeground)
+        subdata = sorted(data.select(background_valid))
+        mid = len(subdata) // 2
+        q1 = subdata[mid // 2]
+        q3 = subdata[mid + (len(subdata) - mid) // 2]
+        iqr = q3 - q1
+        p0 = q1 - lower * iqr
+        p1 = q3 + upper * iqr
+        exp = [i for i in background_valid if p0 <= data[i] <= p1]
+        assert list(background_used) == exp
+
+    for i in range(10):
+        data, mask = generate_shoebox(size, mean, nforeground, ninvalid)
+        data[0] = 1000
+        reject(data, mask)
+        assert_is_correct(data, mask)
+
+
 def test_normal():
     min_data = 10
     reject = NormalOutlierRejector(min_data)
@@ -0,0 +1,40 @@
+import pytest
+
+
+def test_radial_average_threads_and_streaming():
+    from dxtbx.model import BeamFactory, DetectorFactory
+
+    from dials.algorithms.background import RadialAverage
+    from dials.array_family import flex
+
+    beam = BeamFactory.make_beam(wavelength=0.97625, sample_to_source=(0, 0, 1))
+    detector = DetectorFactory.simple(
+        sensor="PAD",
+        distance=100,
+        beam_centre=(10, 12),
+        fast_direction="+x",
+        slow_direction="-y",
+        pixel_size=(0.172, 0.172),
+        image_size=(200, 150),
+        trusted_range=(-1, 1e8),
+    )
+
+    data = flex.random_double(150 * 200) * 100
+    data.reshape(flex.grid(150, 200))
+    mask = flex.random_bool(150 * 200, 0.9)
+    mask.reshape(flex.grid(150, 200))
+
+    single = RadialAverage(beam, detector, 0, 0.1, 50)
+    single.add(data, mask)
+    assert flex.sum(single.weight()) > 0
+
+    # Two images streamed through one object with several threads
+    threaded = RadialAverage(beam, detector, 0, 0.1, 50, nthreads=4)
+    threaded.add(data, mask)
+    threaded.add(data, mask)
+    assert list(threaded.weight()) == list(2 * single.weight())
+    assert list(threaded.mean()) == pytest.approx(list(single.mean()))
+
+    # Merging partial averages
+    single += single
+    assert list(single.weight()) == list(threaded.weight())
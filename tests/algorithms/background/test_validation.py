@@ -0,0 +1,35 @@
+import random
+
+from dials.algorithms.background import BackgroundValidation
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+from dials.model.data import Shoebox
+
+
+def test_background_validation():
+    random.seed(0)
+    size = (5, 9, 9)
+    n = size[0] * size[1] * size[2]
+    code = MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed
+    shoeboxes = flex.shoebox(4)
+    for i, scale in enumerate((1, 1, 4, 1)):
+        shoeboxes[i] = Shoebox((0, size[2], 0, size[1], 0, size[0]))
+        shoeboxes[i].allocate()
+        mean = 50
+        data = flex.double(scale * random.gauss(mean, mean ** 0.5) for _ in range(n))
+        data.reshape(flex.grid(size))
+        shoeboxes[i].data = data.as_float()
+        shoeboxes[i].background = flex.float(flex.grid(size), mean)
+        shoeboxes[i].mask = flex.int(flex.grid(size), code)
+    # No pixels used for the background
+    shoeboxes[3].mask = flex.int(flex.grid(size), MaskCode.Valid)
+
+    result = BackgroundValidation(shoeboxes)
+    result4 = BackgroundValidation(shoeboxes, nthreads=4)
+    assert list(result.ks_p()) == list(result4.ks_p())
+    assert list(result.num_pixels()) == [n, n, n, 0]
+    assert list(result.mean_background()) == [50, 50, 50, 0]
+    assert result.ks_p()[0] > 0.01
+    assert result.ks_p()[2] < 1e-6
+    assert result.ks_p()[3] == 1
+    assert list(result.is_poisson())[2:] == [False, True]
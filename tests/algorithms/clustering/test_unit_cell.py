@@ -2,8 +2,12 @@
 
 from cctbx import sgtbx
 from scitbx.array_family import flex
+from xfel.clustering.singleframe import SingleFrame
 
-from dials.algorithms.clustering.unit_cell import UnitCellCluster
+from dials.algorithms.clustering.unit_cell import (
+    IncrementalUnitCellClustering,
+    UnitCellCluster,
+)
 
 
 def test_unit_cell():
@@ -18,3 +22,40 @@ def test_unit_cell():
         crystal_symmetries, lattice_ids=lattice_ids
     )
     clusters, dendrogram, _ = ucs.ab_cluster(write_file_lists=False, doplot=False)
+
+
+def test_incremental_cluster():
+    # generate unit cells in two groups
+    sgi = sgtbx.space_group_info("P1")
+    crystal_symmetries = [
+        sgi.any_compatible_crystal_symmetry(volume=random.uniform(v, v + 50))
+        for v in (1000, 2000)
+        for i in range(20)
+    ]
+    lattice_ids = flex.int_range(0, len(crystal_symmetries)).as_string()
+    ucs = UnitCellCluster.from_crystal_symmetries(
+        crystal_symmetries, lattice_ids=lattice_ids
+    )
+
+    def members(clusters):
+        return sorted(sorted(m.lattice_id for m in c.members) for c in clusters)
+
+    for schnell in (False, True):
+        expected, _, _ = ucs.ab_cluster(
+            threshold=1000, schnell=schnell, write_file_lists=False, doplot=False
+        )
+        clusters, clustering = ucs.incremental_cluster(
+            threshold=1000, schnell=schnell, nproc=2
+        )
+        assert members(clusters) == members(expected)
+        assert len(clustering) == len(crystal_symmetries)
+        assert clustering.num_clusters() == len(clusters)
+
+        # Adding the unit cells a few at a time gives the same clusters
+        g6 = [SingleFrame.make_g6(image.uc) for image in ucs.members]
+        incremental = IncrementalUnitCellClustering(1000, euclidean=schnell)
+        for first in range(0, len(g6), 7):
+            cells = flex.double([x for cell in g6[first : first + 7] for x in cell])
+            cells.reshape(flex.grid(len(cells) // 6, 6))
+            incremental.add(cells)
+        assert list(incremental.cluster_ids()) == list(clustering.cluster_ids())
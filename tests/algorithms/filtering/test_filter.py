@@ -0,0 +1,92 @@
+import math
+import random
+
+import pytest
+
+from dxtbx.model import Beam, Goniometer
+from scitbx.array_family import flex
+
+from dials.algorithms import filtering
+
+
+@pytest.fixture
+def models():
+    random.seed(0)
+    goniometers = [Goniometer((1, 0, 0)), Goniometer((0, 0.6, 0.8))]
+    beams = [Beam((0, 0, -1.2)), Beam((0.01, 0, -1.0))]
+    ids = flex.int(random.randint(0, 1) for _ in range(5000))
+    s1 = flex.vec3_double()
+    for i in ids:
+        theta = math.acos(random.uniform(-1, 1))
+        phi = random.uniform(0, 2 * math.pi)
+        length = 1 / beams[i].get_wavelength()
+        s1.append(
+            (
+                length * math.sin(theta) * math.cos(phi),
+                length * math.sin(theta) * math.sin(phi),
+                length * math.cos(theta),
+            )
+        )
+    return goniometers, beams, ids, s1
+
+
+@pytest.mark.parametrize("delta_m", [0.0, 0.05, 0.3, 1.0, 3.2])
+def test_batched_filters(models, delta_m):
+    goniometers, beams, ids, s1 = models
+    m2 = flex.vec3_double(g.get_rotation_axis() for g in goniometers)
+    s0 = flex.vec3_double(b.get_s0() for b in beams)
+    min_zeta = delta_m / 4
+    for nthreads in (1, 3):
+        zeta = filtering.by_zeta(m2, s0, ids, s1, min_zeta, nthreads=nthreads)
+        small = filtering.by_xds_small_angle(m2, s0, ids, s1, delta_m, nthreads)
+        angle = filtering.by_xds_angle(m2, s0, ids, s1, delta_m, nthreads=nthreads)
+        for k, i in enumerate(ids):
+            g, b = goniometers[i], beams[i]
+            assert zeta[k] == filtering.is_zeta_valid(g, b, s1[k], min_zeta)
+            assert small[k] == filtering.is_xds_small_angle_valid(g, b, s1[k], delta_m)
+            assert angle[k] == filtering.is_xds_angle_valid(g, b, s1[k], delta_m)
+
+    # The single experiment filters give the same results
+    sel = ids == 0
+    assert list(
+        filtering.by_zeta(goniometers[0], beams[0], s1.select(sel), min_zeta)
+    ) == list(zeta.select(sel))
+    assert list(
+        filtering.by_xds_angle(
+            goniometers[0], beams[0], s1.select(sel), delta_m, nthreads=2
+        )
+    ) == list(angle.select(sel))
+
+
+@pytest.mark.parametrize("delta_m", [0.05, 0.3])
+def test_coordinate_system_filters(models, delta_m):
+    from dials.algorithms.profile_model.gaussian_rs import (
+        CoordinateSystem,
+        CoordinateSystemBatch,
+    )
+
+    goniometers, beams, ids, s1 = models
+    m2 = flex.vec3_double(g.get_rotation_axis() for g in goniometers)
+    s0 = flex.vec3_double(b.get_s0() for b in beams)
+    phi = flex.double(random.uniform(-1, 1) for _ in ids)
+    batch = CoordinateSystemBatch(m2, s0, ids, s1, phi, nthreads=3)
+    assert len(batch) == len(s1)
+
+    # The coordinate systems of the batch are the same as those made singly
+    for k in (0, 1, 2, 1000, 4999):
+        expected = CoordinateSystem(m2[ids[k]], s0[ids[k]], s1[k], phi[k])
+        cs = batch[k]
+        assert cs.e1_axis() == expected.e1_axis()
+        assert cs.e2_axis() == expected.e2_axis()
+        assert cs.e3_axis() == expected.e3_axis()
+        assert cs.zeta() == expected.zeta() == batch.zeta()[k]
+        assert cs.limits() == expected.limits()
+
+    zeta = filtering.by_zeta(batch, delta_m / 4)
+    small = filtering.by_xds_small_angle(batch, delta_m, nthreads=2)
+    angle = filtering.by_xds_angle(batch, delta_m, nthreads=2)
+    for k in range(len(batch)):
+        cs = batch[k]
+        assert zeta[k] == filtering.is_zeta_valid(cs, delta_m / 4)
+        assert small[k] == filtering.is_xds_small_angle_valid(cs, delta_m)
+        assert angle[k] == filtering.is_xds_angle_valid(cs, delta_m)
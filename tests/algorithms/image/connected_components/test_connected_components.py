@@ -56,6 +56,17 @@ def test_values_are_valid(self):
                     vi += 1
                     assert v1 == v2
 
+    def test_labels_from_runs(self):
+        from dials.algorithms.image.connected_components import LabelImageStack2d
+        from dials.model.data import StrongPixelRuns
+
+        label_images = LabelImageStack2d(self.size)
+        for i in range(10):
+            runs = StrongPixelRuns(self.mask_list[i])
+            label_images.add_image(self.data_list[i], runs)
+        assert label_images.labels().all_eq(self.labels)
+        assert label_images.values().all_eq(self.label_images.values())
+
     def test_labels_are_valid(self):
         from scitbx.array_family import flex
 
@@ -145,6 +156,21 @@ def test_values_are_valid(self):
                     vi += 1
                     assert v1 == v2
 
+    def test_labels_from_runs(self):
+        from dials.algorithms.image.connected_components import LabelImageStack3d
+        from dials.model.data import StrongPixelRuns
+
+        # Mix the dense and run length encoded masks
+        label_images = LabelImageStack3d(self.size)
+        for i in range(10):
+            if i % 2:
+                mask = StrongPixelRuns(self.mask_list[i])
+            else:
+                mask = self.mask_list[i]
+            label_images.add_image(self.data_list[i], mask)
+        assert label_images.labels().all_eq(self.labels)
+        assert label_images.values().all_eq(self.label_images.values())
+
     def test_labels_are_valid(self):
         from scitbx.array_family import flex
 
@@ -171,3 +197,87 @@ def test_labels_are_valid(self):
                             l2 = label_map[k, j, i - 1]
                             assert l2 == l1
                         vi += 1
+
+
+class TestStreaming3d:
+    def setup_class(self):
+        from scitbx.array_family import flex
+
+        from dials.algorithms.image.connected_components import (
+            LabelImageStack3d,
+            StreamingLabelImageStack3d,
+        )
+
+        self.size = (200, 200)
+        self.label_images = LabelImageStack3d(self.size)
+        self.streaming = StreamingLabelImageStack3d(self.size)
+
+        self.mask_list = []
+        self.finished = []
+        for i in range(10):
+            data = flex.random_int_gaussian_distribution(
+                self.size[0] * self.size[1], 100, 10
+            )
+            data.reshape(flex.grid(self.size))
+            mask = flex.random_bool(self.size[0] * self.size[1], 0.2)
+            mask.reshape(flex.grid(self.size))
+            self.mask_list.append(mask)
+            self.label_images.add_image(data, mask)
+            self.streaming.add_image(data, mask)
+            self.finished.append(
+                (
+                    list(self.streaming.coords()),
+                    list(self.streaming.values()),
+                    list(self.streaming.labels()),
+                )
+            )
+            self.streaming.clear()
+        self.streaming.finish()
+        self.finished.append(
+            (
+                list(self.streaming.coords()),
+                list(self.streaming.values()),
+                list(self.streaming.labels()),
+            )
+        )
+
+    def test_components_are_finished_when_they_stop_growing(self):
+        # Components emitted after image k cannot have pixels on image k
+        for k, (coords, values, labels) in enumerate(self.finished[:-1]):
+            assert all(c[0] < k for c in coords)
+        assert self.streaming.num_open() == 0
+
+    def test_labels_match_label_image_stack(self):
+        streaming_labels = {}
+        for coords, values, labels in self.finished:
+            for c, l in zip(coords, labels):
+                assert c not in streaming_labels
+                streaming_labels[c] = l
+
+        coords = self.label_images.coords()
+        labels = self.label_images.labels()
+        assert len(coords) == len(streaming_labels)
+
+        # The partition of pixels into components should be the same
+        forward = {}
+        backward = {}
+        for c, l in zip(coords, labels):
+            s = streaming_labels[c]
+            assert forward.setdefault(l, s) == s
+            assert backward.setdefault(s, l) == l
+        assert self.streaming.num_finished() == len(forward)
+
+    def test_shoeboxes(self):
+        from dials.array_family import flex
+
+        self.streaming.clear()
+        self.streaming.add_image(
+            flex.double(flex.grid(self.size), 1), self.mask_list[0]
+        )
+        self.streaming.finish()
+        shoeboxes = flex.shoebox(self.streaming, 0, 5)
+        assert len(shoeboxes) > 0
+        assert all(s.bbox[4] == 15 and s.bbox[5] == 16 for s in shoeboxes)
+        assert flex.sum(shoeboxes.count_mask_values(5)) == self.mask_list[0].count(
+            True
+        )
@@ -21,3 +21,30 @@ def test():
     filled = result.as_1d().select(~mask.as_1d())
     assert flex.max(filled) <= flex.max(known)
     assert flex.min(filled) >= flex.min(known)
+
+
+def test_diffusion_fill():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.fill_holes import diffusion_fill
+
+    mask = flex.bool(flex.grid(50, 60), True)
+    data = flex.double(flex.grid(50, 60), 0)
+    for j in range(50):
+        for i in range(60):
+            data[j, i] = 10 + j * 0.5 + i * 0.25
+            if (j - 20) ** 2 + (i - 30) ** 2 <= 64 or i == 59:
+                mask[j, i] = False
+                data[j, i] = 0
+
+    # The known pixels are unchanged and the holes converge to the plane
+    result = diffusion_fill(data, mask, 2000)
+    for j in range(50):
+        for i in range(60):
+            if mask[j, i]:
+                assert result[j, i] == data[j, i]
+            elif i < 59:
+                assert abs(result[j, i] - (10 + j * 0.5 + i * 0.25)) < 1e-3
+
+    other = diffusion_fill(data, mask, 10, nthreads=4)
+    assert list(other) == list(diffusion_fill(data, mask, 10))
@@ -0,0 +1,64 @@
+import random
+
+import pytest
+
+
+def reference(data, niter, kappa, gamma):
+    height, width = data.all()
+    result = data.deep_copy()
+    for _ in range(niter):
+        a = result.deep_copy()
+        for j in range(1, height - 1):
+            for i in range(1, width - 1):
+                delta = 0
+                for jj, ii in ((j - 1, i), (j, i - 1), (j + 1, i), (j, i + 1)):
+                    d = a[jj, ii] - a[j, i]
+                    delta += d / (1.0 + d * d / (kappa * kappa))
+                result[j, i] = a[j, i] + gamma * delta
+    return result
+
+
+def test_anisotropic_diffusion():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import anisotropic_diffusion
+
+    random.seed(0)
+    data = flex.double(flex.grid(20, 30), 0)
+    for k in range(len(data)):
+        data[k] = random.randint(0, 100)
+
+    result = anisotropic_diffusion(data, niter=3, kappa=50, gamma=0.1)
+    expected = reference(data, 3, 50, 0.1)
+    assert list(result) == pytest.approx(list(expected))
+
+    other = anisotropic_diffusion(data, niter=3, kappa=50, gamma=0.1, nthreads=4)
+    assert list(other) == list(result)
+
+
+def test_masked_anisotropic_diffusion():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import anisotropic_diffusion
+
+    random.seed(0)
+    data = flex.double(flex.grid(20, 30), 0)
+    mask = flex.bool(flex.grid(20, 30), True)
+    for k in range(len(data)):
+        data[k] = random.randint(0, 100)
+        mask[k] = random.random() > 0.2
+
+    # With nothing masked this is the same as the unmasked filter
+    all_valid = flex.bool(flex.grid(20, 30), True)
+    assert list(anisotropic_diffusion(data, all_valid, niter=2)) == list(
+        anisotropic_diffusion(data, niter=2)
+    )
+
+    # Masked pixels are left alone
+    result = anisotropic_diffusion(data, mask, niter=2)
+    for k in range(len(data)):
+        if not mask[k]:
+            assert result[k] == data[k]
+
+    other = anisotropic_diffusion(data, mask, niter=2, nthreads=4)
+    assert list(other) == list(result)
@@ -0,0 +1,49 @@
+import math
+
+import pytest
+
+
+def direct_convolve(image, kernel):
+    ny, nx = image.all()
+    ky, kx = kernel.all()
+    result = []
+    for j in range(ny):
+        for i in range(nx):
+            value = 0
+            for jj in range(ky):
+                for ii in range(kx):
+                    y = min(max(j + jj - ky // 2, 0), ny - 1)
+                    x = min(max(i + ii - kx // 2, 0), nx - 1)
+                    value += image[y, x] * kernel[jj, ii]
+            result.append(value)
+    return result
+
+
+@pytest.mark.parametrize("separable", [True, False])
+def test_convolve(separable):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import convolve, convolve_col, convolve_row
+
+    image = flex.random_double(20 * 30)
+    image.reshape(flex.grid(20, 30))
+
+    kernel = flex.double(flex.grid(5, 7))
+    for j in range(5):
+        for i in range(7):
+            kernel[j, i] = math.exp(-0.3 * (j - 2) ** 2 - 0.2 * (i - 3) ** 2)
+    if not separable:
+        kernel[0, 0] += 1
+
+    result = convolve(image, kernel)
+    assert list(result) == pytest.approx(direct_convolve(image, kernel))
+
+    row = flex.double([1, 2, 3, 2, 1])
+    result = convolve_row(image, row)
+    row.reshape(flex.grid(1, 5))
+    assert list(result) == pytest.approx(direct_convolve(image, row))
+
+    col = flex.double([1, 2, 3, 2, 1])
+    result = convolve_col(image, col)
+    col.reshape(flex.grid(5, 1))
+    assert list(result) == pytest.approx(direct_convolve(image, col))
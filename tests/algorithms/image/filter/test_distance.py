@@ -1,4 +1,7 @@
 import math
+import random
+
+import pytest
 
 
 def test_manhattan():
@@ -108,3 +111,47 @@ def test_chebyshev_small():
     known.reshape(distance.accessor())
 
     assert (known == distance).count(False) == 0
+
+
+def brute_force_distances(data, value):
+    height, width = data.all()
+    points = [
+        (j, i) for j in range(height) for i in range(width) if data[j, i] == value
+    ]
+    for j in range(height):
+        for i in range(width):
+            delta = [(abs(j - jj), abs(i - ii)) for jj, ii in points]
+            yield (
+                (j, i),
+                min(dj + di for dj, di in delta),
+                min(max(dj, di) for dj, di in delta),
+                min(math.sqrt(dj * dj + di * di) for dj, di in delta),
+            )
+
+
+def test_distances_exact():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import (
+        chebyshev_distance,
+        euclidean_distance,
+        manhattan_distance,
+    )
+
+    random.seed(0)
+    data = flex.bool(flex.grid(17, 23), False)
+    for k in range(len(data)):
+        data[k] = random.random() < 0.05
+    data[0, 0] = False
+    data[16, 0] = True
+
+    manhattan = manhattan_distance(data, True)
+    chebyshev = chebyshev_distance(data, True)
+    euclidean = euclidean_distance(data, True)
+    for index, m, c, e in brute_force_distances(data, True):
+        assert manhattan[index] == m
+        assert chebyshev[index] == c
+        assert euclidean[index] == pytest.approx(e)
+
+    assert list(manhattan_distance(data, True, nthreads=4)) == list(manhattan)
+    assert list(euclidean_distance(data, True, nthreads=4)) == list(euclidean)
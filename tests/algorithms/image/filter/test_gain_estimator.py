@@ -0,0 +1,51 @@
+from libtbx.math_utils import nearest_integer as nint
+from scitbx.array_family import flex
+
+from dials.algorithms.image.filter import GainEstimator, index_of_dispersion_filter
+
+
+def _reference_gain(panels, kernel_size):
+    # The estimate made by dials.estimate_gain from the filter maps
+    dispersion = flex.double()
+    for image, mask in panels:
+        cv = index_of_dispersion_filter(image, mask.as_int(), kernel_size, 0)
+        dispersion.extend(cv.index_of_dispersion().as_1d())
+    dispersion = flex.sorted(dispersion)
+    q1 = dispersion[nint(len(dispersion) / 4)]
+    q2 = dispersion[nint(len(dispersion) / 2)]
+    q3 = dispersion[nint(len(dispersion) * 3 / 4)]
+    iqr = q3 - q1
+    inliers = dispersion.select(
+        (dispersion > (q1 - 1.5 * iqr)) & (dispersion < (q3 + 1.5 * iqr))
+    )
+    return q1, q2, q3, inliers[nint(len(inliers) / 2)]
+
+
+def test_gain_estimator():
+    kernel_size = (3, 2)
+    frames = []
+    for scale in (2, 1, 3):
+        panels = []
+        for size in ((40, 53), (31, 53)):
+            image = flex.random_double(size[0] * size[1]) * 40 * scale + 20
+            image.reshape(flex.grid(size))
+            mask = flex.random_bool(size[0] * size[1], 0.998)
+            mask.reshape(flex.grid(size))
+            panels.append((image, mask))
+        frames.append(panels)
+
+    estimator = GainEstimator(kernel_size)
+    for panels in frames:
+        estimator.add_frame()
+        for image, mask in panels:
+            estimator.add_panel(image, mask)
+    assert estimator.num_frames() == 3
+
+    for nthreads in (1, 2, 4):
+        estimator.estimate(nthreads=nthreads)
+        for i, panels in enumerate(frames):
+            q1, q2, q3, gain = _reference_gain(panels, kernel_size)
+            assert estimator.q1()[i] == q1
+            assert estimator.q2()[i] == q2
+            assert estimator.q3()[i] == q3
+            assert estimator.gain()[i] == gain
@@ -73,3 +73,32 @@ def test_masked_filter():
                     pixels = sorted(pixels)
                     value = pixels[len(pixels) // 2]
                 assert result[j, i] == pytest.approx(value, abs=eps)
+
+
+def test_masked_filter_integer_image():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import median_filter
+
+    xsize = 50
+    ysize = 40
+    kernel = (2, 3)
+
+    # Integer counts use the sliding histogram filter
+    image = flex.floor(flex.random_double(xsize * ysize) * 100) - 10
+    image.reshape(flex.grid(ysize, xsize))
+    mask = generate_mask(xsize, ysize)
+    result = median_filter(image, mask, kernel)
+
+    for j in range(ysize):
+        for i in range(xsize):
+            j0 = max(j - kernel[0], 0)
+            j1 = min(j + kernel[0] + 1, ysize)
+            i0 = max(i - kernel[1], 0)
+            i1 = min(i + kernel[1] + 1, xsize)
+            pixels = image[j0:j1, i0:i1].as_1d()
+            pixels = sorted(pixels.select(mask[j0:j1, i0:i1].as_1d()))
+            if len(pixels) > 0:
+                assert result[j, i] == pixels[len(pixels) // 2]
+            else:
+                assert result[j, i] == 0
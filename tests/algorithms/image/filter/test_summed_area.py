@@ -23,3 +23,19 @@ def test():
         v = sa[j, i]
         e = flex.sum(image[j - 3 : j + 4, i - 3 : i + 4])
         assert e == pytest.approx(v, abs=1e-7)
+
+
+def test_integer_image():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import summed_area
+
+    # The summed area table of this image does not fit in 32 bits
+    image = flex.int(flex.grid(300, 300), 100000)
+    image[0] = 7
+
+    for nthreads in (1, 4):
+        sa = summed_area(image, (2, 2), nthreads=nthreads)
+        assert sa[0, 0] == 7 + 8 * 100000
+        assert sa[150, 150] == 25 * 100000
+        assert sa[299, 299] == 9 * 100000
@@ -7,10 +7,17 @@
 from scitbx.array_family import flex
 
 from dials.algorithms.image.threshold import (
+    BatchDispersionExtendedThreshold,
+    BatchDispersionThreshold,
     DispersionExtendedThreshold,
     DispersionExtendedThresholdDebug,
     DispersionThreshold,
     DispersionThresholdDebug,
+    TiledDispersionExtendedThreshold,
+    TiledDispersionThreshold,
+    UnimodalHistogram,
+    maximum_deviation,
+    probability_distribution,
 )
 
 
@@ -188,6 +195,78 @@ def test_dispersion_threshold(self):
         assert result1 == result3
         assert result2 == result4
 
+    def test_dispersion_threshold_simd(self):
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        simd_level = algorithm.simd_level
+
+        # Run with the vectorized and the scalar kernels
+        results = []
+        for level in (simd_level, 0):
+            algorithm.simd_level = level
+            result1 = flex.bool(flex.grid(self.image.all()))
+            result2 = flex.bool(flex.grid(self.image.all()))
+            algorithm(self.image, self.mask, result1)
+            algorithm(self.image, self.mask, self.gain, result2)
+            results.append((result1, result2))
+        assert algorithm.simd_level == 0
+
+        # The results should be identical
+        assert results[0][0] == results[1][0]
+        assert results[0][1] == results[1][1]
+
+    def test_dispersion_threshold_w_gain_and_pedestal(self):
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+
+        # A raw integer image with a pedestal
+        raw = self.image.iround()
+        pedestal = flex.random_double(2000 * 2000) * 2
+        pedestal.reshape(flex.grid(2000, 2000))
+        corrected = raw.as_double() - pedestal
+
+        result1 = flex.bool(flex.grid(self.image.all()))
+        result2 = flex.bool(flex.grid(self.image.all()))
+        algorithm(corrected, self.mask, self.gain, result1)
+        algorithm.threshold_w_gain_and_pedestal(
+            raw, self.mask, self.gain, pedestal, result2
+        )
+        assert result1.all_eq(result2)
+
+        # Check with the scalar kernel too
+        algorithm.simd_level = 0
+        result3 = flex.bool(flex.grid(self.image.all()))
+        algorithm.threshold_w_gain_and_pedestal(
+            raw, self.mask, self.gain, pedestal, result3
+        )
+        assert result1.all_eq(result3)
+
+    def test_dispersion_threshold_runs(self):
+        from dials.model.data import StrongPixelRuns
+
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        for image in (self.image, self.image.iround()):
+            result1 = flex.bool(flex.grid(self.image.all()))
+            result2 = flex.bool(flex.grid(self.image.all()))
+            algorithm(image, self.mask, result1)
+            algorithm(image, self.mask, self.gain, result2)
+            runs1 = StrongPixelRuns(self.image.all())
+            runs2 = StrongPixelRuns(self.image.all())
+            algorithm.threshold_runs(image, self.mask, runs1)
+            algorithm.threshold_runs(image, self.mask, self.gain, runs2)
+            assert runs1.as_mask().all_eq(result1)
+            assert runs2.as_mask().all_eq(result2)
+
     def test_dispersion_extended_threshold(self):
         from dials.algorithms.image.threshold import (
             DispersionExtendedThreshold,
@@ -225,6 +304,85 @@ def test_dispersion_extended_threshold(self):
         result4 = debug.final_mask()
         assert result2 == result4
 
+    @pytest.mark.parametrize(
+        "algorithm,tiled_algorithm",
+        [
+            (DispersionThreshold, TiledDispersionThreshold),
+            (DispersionExtendedThreshold, TiledDispersionExtendedThreshold),
+        ],
+    )
+    @pytest.mark.parametrize("nthreads", [1, 4])
+    def test_tiled_dispersion_threshold(self, algorithm, tiled_algorithm, nthreads):
+        nsig_b = 3
+        nsig_s = 3
+
+        thresholder = algorithm(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        result1 = flex.bool(flex.grid(self.image.all()))
+        result2 = flex.bool(flex.grid(self.image.all()))
+        thresholder(self.image, self.mask, result1)
+        thresholder(self.image, self.mask, self.gain, result2)
+
+        # Use a tile size that does not divide the image exactly
+        tiled = tiled_algorithm(
+            self.image.all(),
+            self.size,
+            nsig_b,
+            nsig_s,
+            0,
+            self.min_count,
+            (300, 450),
+            nthreads,
+        )
+        assert tiled.num_tiles() == 7 * 5
+        result3 = flex.bool(flex.grid(self.image.all()))
+        result4 = flex.bool(flex.grid(self.image.all()))
+        tiled(self.image, self.mask, result3)
+        tiled(self.image, self.mask, self.gain, result4)
+
+        assert result1.all_eq(result3)
+        assert result2.all_eq(result4)
+
+    @pytest.mark.parametrize(
+        "algorithm,batch_algorithm",
+        [
+            (DispersionThreshold, BatchDispersionThreshold),
+            (DispersionExtendedThreshold, BatchDispersionExtendedThreshold),
+        ],
+    )
+    @pytest.mark.parametrize("nthreads", [1, 2, 4])
+    def test_batch_dispersion_threshold(self, algorithm, batch_algorithm, nthreads):
+        from dials.algorithms.spot_finding.threshold import threshold_batch
+
+        nsig_b = 3
+        nsig_s = 3
+
+        # Cut the image into a batch of frames
+        size = (500, 400)
+        images = []
+        masks = []
+        for y0, x0 in [(0, 0), (500, 400), (1000, 800), (1500, 1200), (0, 1600)]:
+            images.append(self.image[y0 : y0 + size[0], x0 : x0 + size[1]])
+            masks.append(self.mask[y0 : y0 + size[0], x0 : x0 + size[1]])
+        gain = self.gain[0 : size[0], 0 : size[1]]
+
+        thresholder = algorithm(size, self.size, nsig_b, nsig_s, 0, self.min_count)
+        batch = batch_algorithm(
+            size, self.size, nsig_b, nsig_s, 0, self.min_count, nthreads
+        )
+        assert batch.nthreads() == nthreads
+        results1 = threshold_batch(batch, images, masks)
+        results2 = threshold_batch(batch, images, masks, gain)
+        assert len(results1) == len(images)
+        for image, mask, result1, result2 in zip(images, masks, results1, results2):
+            expected1 = flex.bool(flex.grid(size))
+            expected2 = flex.bool(flex.grid(size))
+            thresholder(image, mask, expected1)
+            thresholder(image, mask, gain, expected2)
+            assert result1.all_eq(expected1)
+            assert result2.all_eq(expected2)
+
     @pytest.mark.parametrize(
         "algorithm", [DispersionThreshold, DispersionExtendedThreshold]
     )
@@ -292,3 +450,42 @@ def transpose_a_flex_bool(arr):
         result2_t = transpose_a_flex_bool(result2)
 
         assert (result1 == result2_t).all_eq(True)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_unimodal_histogram(nthreads):
+    images = []
+    for _ in range(3):
+        image = flex.int(poisson(5, size=200 * 150).tolist())
+        image.reshape(flex.grid(200, 150))
+        images.append(image)
+    mask = flex.bool(flex.grid(200, 150), True)
+    mask[10, 20] = False
+
+    # One image matches the functions on a histogram
+    histogram = UnimodalHistogram((0, 40))
+    histogram.add(images[0], nthreads=nthreads)
+    expected = probability_distribution(images[0], (0, 40))
+    assert list(histogram.probability_distribution()) == list(expected)
+    assert histogram.threshold() == maximum_deviation(expected)
+
+    # Images added one at a time give the histogram of them all
+    for image in images[1:]:
+        histogram.add(image, mask, nthreads=nthreads)
+    assert histogram.count() == 3 * 200 * 150 - 2
+    total = flex.size_t(41, 0)
+    for i, image in enumerate(images):
+        selection = mask.as_1d() if i else flex.bool(mask.size(), True)
+        for value in image.as_1d().select(selection):
+            total[value] += 1
+    assert list(histogram.histogram()) == list(total[: len(histogram.histogram())])
+
+    # The histogram of some images can be merged with the rest
+    merged = UnimodalHistogram((0, 40))
+    merged.add(images[0])
+    others = UnimodalHistogram((0, 40))
+    for image in images[1:]:
+        others.add(image, mask)
+    merged.merge(others)
+    assert list(merged.histogram()) == list(histogram.histogram())
+    assert merged.threshold() == histogram.threshold()
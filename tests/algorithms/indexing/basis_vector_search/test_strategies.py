@@ -1,8 +1,13 @@
+import copy
+
 import pytest
 
+from scitbx.array_family import flex
+
 from dials.algorithms.indexing.basis_vector_search import (
     FFT1D,
     FFT3D,
+    ProgressiveFFT3D,
     RealSpaceGridSearch,
 )
 
@@ -29,6 +34,70 @@ def test_fft3d(self, setup_rlp):
         basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
         self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
 
+    def test_fft3d_half_complex(self, setup_rlp):
+        max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+        reference = FFT3D(max_cell)
+        expected, expected_used = reference._fft(setup_rlp["rlp"], d_min=5)
+
+        params = FFT3D.phil_scope.extract()
+        params.reciprocal_space_grid.half_complex = True
+        params.nthreads = 2
+        strategy = FFT3D(max_cell, params=params)
+        grid_real, used = strategy._fft(setup_rlp["rlp"], d_min=5)
+        assert list(used) == list(expected_used)
+        assert grid_real.all() == expected.all()
+        assert flex.max(flex.abs(grid_real - expected)) < 1e-6 * flex.max(expected)
+
+        basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
+        self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+    @pytest.mark.parametrize("half_complex", [False, True])
+    def test_progressive_fft3d(self, setup_rlp, half_complex):
+        max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+        params = FFT3D.phil_scope.extract()
+        params.reciprocal_space_grid.half_complex = half_complex
+        strategy = ProgressiveFFT3D(max_cell, params=params)
+        reference = FFT3D(max_cell, params=FFT3D.phil_scope.extract())
+        expected, expected_used = reference._fft(setup_rlp["rlp"], d_min=strategy.d_min)
+
+        # Add the vectors to the grid in two parts
+        rlp = setup_rlp["rlp"]
+        n = len(rlp) // 2
+        used = strategy.add_reciprocal_lattice_vectors(rlp[:n])
+        used.extend(strategy.add_reciprocal_lattice_vectors(rlp[n:]))
+        assert list(used) == list(expected_used)
+        assert strategy.num_mapped == expected_used.count(True)
+
+        # The grid is kept, so it can be searched more than once
+        for i in range(2):
+            basis_vectors, used = strategy.find_basis_vectors(rlp)
+            assert list(used) == list(expected_used)
+            self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+    def test_fft3d_new_d_min(self, setup_rlp):
+        max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+        rlp = setup_rlp["rlp"]
+        strategy = FFT3D(max_cell)
+        strategy._map_centroids_to_reciprocal_space_grid(rlp, d_min=5)
+
+        # Mapping the same vectors again fills the grid from the stored vectors
+        params = FFT3D.phil_scope.extract()
+        params.b_iso = strategy._params.b_iso
+        reference = FFT3D(max_cell, params=params)
+        expected, expected_used = reference._map_centroids_to_reciprocal_space_grid(
+            rlp, d_min=3
+        )
+        grid, used = strategy._map_centroids_to_reciprocal_space_grid(rlp, d_min=3)
+        assert list(used) == list(expected_used)
+        assert flex.max(flex.abs(grid - expected)) == 0
+
+        # The progressive search can change d_min without the vectors
+        progressive = ProgressiveFFT3D(max_cell, params=copy.deepcopy(params))
+        progressive.add_reciprocal_lattice_vectors(rlp)
+        progressive.set_d_min(3)
+        assert progressive.d_min == 3
+        assert progressive.num_mapped == expected_used.count(True)
+
     def test_real_space_grid_search(self, setup_rlp):
         max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
         strategy = RealSpaceGridSearch(
@@ -36,3 +105,22 @@ def test_real_space_grid_search(self, setup_rlp):
         )
         basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
         self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+    @pytest.mark.parametrize("nthreads", [1, 3])
+    def test_real_space_grid_search_scores(self, setup_rlp, nthreads):
+        unit_cell = setup_rlp["crystal_symmetry"].unit_cell()
+        params = RealSpaceGridSearch.phil_scope.extract()
+        params.characteristic_grid = 0.1
+        params.nthreads = nthreads
+        strategy = RealSpaceGridSearch(
+            1.3 * max(unit_cell.parameters()[:3]),
+            target_unit_cell=unit_cell,
+            params=params,
+        )
+        vectors, scores = strategy.score_vectors(setup_rlp["rlp"])
+        assert len(vectors) == len(scores) > 0
+        assert list(vectors) == [v.elems for v in strategy.search_vectors]
+        for v, score in zip(vectors, scores):
+            assert score == pytest.approx(
+                strategy.compute_functional(v, setup_rlp["rlp"])
+            )
@@ -20,6 +20,7 @@
 from scitbx import matrix
 from scitbx.math import euler_angles_as_matrix
 
+from dials.algorithms.indexing import ext
 from dials.algorithms.indexing.assign_indices import (
     AssignIndicesGlobal,
     AssignIndicesLocal,
@@ -224,7 +225,8 @@ def __init__(self, experiment, reflections, expected_miller_indices):
         )
 
 
-def test_index_reflections(dials_regression):
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_index_reflections(dials_regression, nthreads):
     experiments_json = os.path.join(
         dials_regression, "indexing_test_data", "i04_weak_data", "experiments.json"
     )
@@ -238,13 +240,14 @@ def test_index_reflections(dials_regression):
     reflections.map_centroids_to_reciprocal_space(experiments)
     reflections["imageset_id"] = flex.int(len(reflections), 0)
     reflections["id"] = flex.int(len(reflections), -1)
-    AssignIndicesGlobal(tolerance=0.3)(reflections, experiments)
+    AssignIndicesGlobal(tolerance=0.3, nthreads=nthreads)(reflections, experiments)
     assert "miller_index" in reflections
     counts = reflections["id"].counts()
     assert dict(counts) == {-1: 1390, 0: 114692}
 
 
-def test_local_multiple_rotations(dials_data):
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_local_multiple_rotations(dials_data, nthreads):
     """Test the fix for https://github.com/dials/dials/issues/1458"""
 
     experiments = load.experiment_list(
@@ -270,7 +273,7 @@ def test_local_multiple_rotations(dials_data):
     reflections["miller_index"] = flex.miller_index(len(reflections), (0, 0, 0))
 
     # Assign indices with the correct scan oscillation
-    AssignIndicesLocal()(reflections, experiments)
+    AssignIndicesLocal(nthreads=nthreads)(reflections, experiments)
 
     # Assert we have correctly indexed all reflections
     assert (reflections["miller_index"] == (0, 0, 0)).count(True) == 0
@@ -286,7 +289,7 @@ def test_local_multiple_rotations(dials_data):
     reflections.map_centroids_to_reciprocal_space(experiments)
 
     # Assign indices, this time with the incorrect scan oscillation
-    AssignIndicesLocal()(reflections, experiments)
+    AssignIndicesLocal(nthreads=nthreads)(reflections, experiments)
 
     # Assert that most reflections have been indexed
     indexed_sel = reflections["miller_index"] == (0, 0, 0)
@@ -296,3 +299,37 @@ def test_local_multiple_rotations(dials_data):
     assert (
         (reflections["miller_index"] != predicted_miller_indices) & ~indexed_sel
     ).count(True) == 0
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_score_candidate_models(nthreads):
+    A = matrix.sqr((0.02, 0.001, 0, 0, 0.03, 0.002, 0.001, 0, 0.04))
+    hkl = [
+        (h, k, l)
+        for h in range(-5, 6)
+        for k in range(-5, 6)
+        for l in range(-5, 6)
+        if (h, k, l) != (0, 0, 0)
+    ]
+    rlps = flex.vec3_double([A * matrix.col(mi) for mi in hkl])
+    # the true lattice, a lattice with a doubled c axis and an unrelated one
+    doubled = A * matrix.sqr((1, 0, 0, 0, 1, 0, 0, 0, 0.5))
+    other = matrix.sqr((0.021, 0, 0, 0, 0.033, 0, 0, 0, 0.05))
+    UB_matrices = flex.mat3_double([A, doubled, other])
+
+    scores = ext.ScoreCandidateModels(
+        rlps, UB_matrices, tolerance=0.3, nthreads=nthreads
+    )
+    n_indexed = scores.n_indexed()
+    rmsd = scores.rmsd()
+    assert list(n_indexed[:2]) == [len(hkl), len(hkl)]
+    assert rmsd[0] == pytest.approx(0, abs=1e-8)
+    assert rmsd[1] == pytest.approx(0, abs=1e-8)
+    assert n_indexed[2] < len(hkl)
+    assert rmsd[2] > rmsd[0]
+
+    # each candidate is scored as if it were the only lattice
+    for i in range(len(UB_matrices)):
+        single = ext.ScoreCandidateModels(rlps, UB_matrices[i : i + 1])
+        assert single.n_indexed()[0] == n_indexed[i]
+        assert single.rmsd()[0] == pytest.approx(rmsd[i])
@@ -135,6 +135,34 @@ def test_index_i04_weak_data_fft3d(dials_regression, tmpdir):
     )
 
 
+def test_index_i04_weak_data_fft3d_quick_score(dials_regression, tmpdir):
+    # thaumatin, refining only the best candidates after quick scoring
+    data_dir = os.path.join(dials_regression, "indexing_test_data", "i04_weak_data")
+    pickle_path = os.path.join(data_dir, "full.pickle")
+    sequence_path = os.path.join(data_dir, "experiments_import.json")
+    extra_args = [
+        "bin_size_fraction=0.25",
+        "image_range=1,20",
+        "image_range=250,270",
+        "image_range=520,540",
+        "basis_vector_combinations.max_quick_score=10",
+        "nproc=2",
+    ]
+    expected_unit_cell = uctbx.unit_cell((57.7, 57.7, 149.8, 90, 90, 90))
+    expected_rmsds = (0.05, 0.04, 0.0005)
+    expected_hall_symbol = " P 1"
+
+    run_indexing(
+        pickle_path,
+        sequence_path,
+        tmpdir,
+        extra_args,
+        expected_unit_cell,
+        expected_rmsds,
+        expected_hall_symbol,
+    )
+
+
 def test_index_trypsin_four_lattice_P212121(dials_regression, tmpdir):
     # synthetic trypsin multi-lattice dataset (4 lattices)
     data_dir = os.path.join(dials_regression, "indexing_test_data", "trypsin")
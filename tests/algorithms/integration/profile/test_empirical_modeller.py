@@ -1,5 +1,7 @@
 import math
 
+import pytest
+
 from dials.algorithms.profile_model.modeller import EmpiricalProfileModeller
 
 
@@ -163,3 +165,23 @@ def generate_systematically_offset_profiles(self):
 
         rlist["xyzcal.px"] = xyz
         return rlist, profiles
+
+    def test_parallel_finalize(self):
+        from scitbx.array_family import flex
+
+        reflections, profiles = self.generate_systematically_offset_profiles()
+        profiles = [p - 1 for p in profiles]
+        serial = Modeller(self.n, self.grid_size, self.threshold)
+        parallel = Modeller(self.n, self.grid_size, self.threshold)
+        serial.model(reflections, profiles)
+        parallel.model(reflections, profiles)
+        serial.finalize()
+        parallel.finalize(nthreads=4)
+        assert parallel.finalized()
+
+        for index in range(len(parallel)):
+            assert list(parallel.data(index)) == list(serial.data(index))
+            assert parallel.signal(index) == serial.signal(index)
+            assert parallel.signal(index) > 0
+            assert 0 < parallel.negative_fraction(index) < 1
+            assert flex.sum(parallel.data(index)) == pytest.approx(1)
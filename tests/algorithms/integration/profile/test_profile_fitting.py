@@ -3,7 +3,7 @@
 import numpy as np
 import pytest
 
-from dials.algorithms.integration.fit import ProfileFitter
+from dials.algorithms.integration.fit import BatchProfileFitter, ProfileFitter
 from dials.array_family import flex
 
 
@@ -515,3 +515,48 @@ def test_deconvolve_7_with_flat_background():
     for i in range(7):
         assert intensity[i] == pytest.approx(Iknown[i], abs=eps)
         assert V[i] == pytest.approx(Vknown[i], abs=eps)
+
+
+def test_batch_matches_single():
+    np.random.seed(0)
+
+    # Create profile
+    p = gaussian((9, 9, 9), 1, (4, 4, 4), (2, 2, 2))
+    p = p / flex.sum(p)
+
+    # Create a batch of reflections with different intensities and backgrounds.
+    # One reflection has no valid pixels so can not be fitted.
+    n = 11
+    c = flex.double(flex.grid(n, 9, 9, 9))
+    b = flex.double(flex.grid(n, 9, 9, 9))
+    m = flex.bool(flex.grid(n, 9, 9, 9), True)
+    for i in range(n):
+        bb = flex.double(flex.grid(9, 9, 9), i % 3)
+        cc = add_poisson_noise(100 * i * p + bb)
+        cc.reshape(flex.grid(1, 9, 9, 9))
+        bb.reshape(flex.grid(1, 9, 9, 9))
+        c[i : i + 1, :, :, :] = cc
+        b[i : i + 1, :, :, :] = bb
+    m[3:4, :, :, :] = flex.bool(flex.grid(1, 9, 9, 9), False)
+
+    # Fit together and one at a time
+    fit = BatchProfileFitter(c, b, m, p)
+    assert len(fit) == n
+    for i in range(n):
+        cc = c[i : i + 1, :, :, :]
+        bb = b[i : i + 1, :, :, :]
+        mm = m[i : i + 1, :, :, :]
+        cc.reshape(p.accessor())
+        bb.reshape(p.accessor())
+        mm.reshape(p.accessor())
+        if i == 3:
+            assert not fit.success()[i]
+            with pytest.raises(RuntimeError):
+                ProfileFitter(cc, bb, mm, p)
+            continue
+        single = ProfileFitter(cc, bb, mm, p)
+        assert fit.success()[i]
+        assert fit.niter()[i] == single.niter()
+        assert fit.intensity()[i] == pytest.approx(single.intensity()[0])
+        assert fit.variance()[i] == pytest.approx(single.variance()[0])
+        assert fit.correlation()[i] == pytest.approx(single.correlation())
@@ -0,0 +1,76 @@
+import random
+
+import pytest
+
+from dials.algorithms.integration.bayes import (
+    PosteriorMomentsTable,
+    integrate_by_bayesian_integrator,
+    posterior_moments,
+)
+from dials.array_family import flex
+
+
+def test_posterior_moments():
+    # With no counts the posterior is exp(-I) whatever the background
+    for background in (0, 0.5, 10, 1000):
+        assert posterior_moments(0, background) == pytest.approx((1, 1))
+
+    # With no background the posterior is a gamma distribution
+    assert posterior_moments(10, 0) == pytest.approx((11, 11))
+
+    # (B^2 + 2B + 2) / (B + 1) - B for one count
+    mean, variance = posterior_moments(1, 0.5)
+    assert mean == pytest.approx(5 / 3)
+    assert variance == pytest.approx(17 / 9)
+
+    # A very weak reflection on a strong background
+    mean, variance = posterior_moments(50, 2000)
+    assert mean == pytest.approx(1.0256141, rel=1e-6)
+    assert variance == pytest.approx(1.0518567, rel=1e-6)
+
+
+def test_posterior_moments_table():
+    table = PosteriorMomentsTable(
+        max_counts=20, num_counts=81, max_background=20, num_background=81
+    )
+    assert table.contains(10, 10)
+    assert not table.contains(30, 10)
+    assert 0 < table.mean_error() < 0.05
+    assert 0 < table.variance_error() < 0.05
+
+    random.seed(0)
+    for _ in range(200):
+        counts = random.uniform(0, 30)
+        background = random.uniform(0, 30)
+        mean, variance = posterior_moments(counts, background)
+        tab_mean, tab_variance = table(counts, background)
+        assert tab_mean == pytest.approx(mean, abs=1.1 * table.mean_error())
+        assert tab_variance == pytest.approx(
+            variance, abs=1.1 * table.variance_error()
+        )
+
+
+def test_bayesian_intensity_with_table():
+    from dials.model.data import Shoebox
+
+    random.seed(0)
+    shoeboxes = flex.shoebox(20)
+    for i in range(20):
+        shoeboxes[i] = Shoebox(0, (0, 3, 0, 3, 0, 2))
+        shoeboxes[i].allocate()
+        for k in range(len(shoeboxes[i].data)):
+            shoeboxes[i].data[k] = random.randint(0, 3)
+            shoeboxes[i].background[k] = random.uniform(0, 2)
+            shoeboxes[i].mask[k] = random.choice([3, 5, 5])
+
+    table = PosteriorMomentsTable()
+    result = shoeboxes.bayesian_intensity(table, nthreads=2)
+    for s, r in zip(shoeboxes, result):
+        exact = integrate_by_bayesian_integrator(s.data, s.background, s.mask)
+        assert r.observed.value == pytest.approx(
+            exact.intensity(), abs=1.1 * table.mean_error()
+        )
+        assert r.observed.variance == pytest.approx(
+            exact.variance(), abs=1.1 * table.variance_error()
+        )
+        assert r.background.value == pytest.approx(exact.background())
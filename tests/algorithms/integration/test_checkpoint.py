@@ -0,0 +1,85 @@
+import os
+import types
+
+import dials.algorithms.integration
+from dials.algorithms.integration.checkpoint import JobCheckpoint, clear_checkpoints
+from dials.array_family import flex
+
+
+def _task(index, n):
+    reflections = flex.reflection_table()
+    reflections["id"] = flex.int(n, 0)
+    reflections["bbox"] = flex.int6(n, (0, 1, 0, 1, index, index + 1))
+    reflections["flags"] = flex.size_t(n, 0)
+    return types.SimpleNamespace(
+        index=index, job=(index, index + 1), reflections=reflections
+    )
+
+
+def _result(task):
+    reflections = task.reflections.copy()
+    reflections["intensity.sum.value"] = flex.double(len(reflections), task.index)
+    return dials.algorithms.integration.Result(
+        index=task.index,
+        reflections=reflections,
+        data={"index": task.index},
+        read_time=0,
+        extract_time=0,
+        process_time=0,
+        total_time=0,
+    )
+
+
+def _run(checkpoint, tasks):
+    results = {}
+
+    def accumulate(result):
+        checkpoint.save(result)
+        results[result.index] = result
+
+    run = []
+    for task in checkpoint.tasks(tasks, accumulate):
+        run.append(task.index)
+        accumulate(_result(task))
+    return run, results
+
+
+def test_checkpoint_resume(tmp_path):
+    directory = str(tmp_path / "checkpoint")
+
+    # Run the first two jobs, as if the run was then interrupted
+    checkpoint = JobCheckpoint(directory, "integration")
+    run, results = _run(checkpoint, [_task(0, 5), _task(1, 6)])
+    assert run == [0, 1]
+    assert len(os.listdir(directory)) == 4
+
+    # A resumed run only runs the jobs which were not saved, or whose input
+    # has changed
+    checkpoint = JobCheckpoint(directory, "integration")
+    run, results = _run(checkpoint, [_task(0, 5), _task(1, 7), _task(2, 3)])
+    assert run == [1, 2]
+    assert sorted(results) == [0, 1, 2]
+    restored = results[0]
+    assert restored.data == {"index": 0}
+    assert len(restored.reflections) == 5
+    assert list(restored.reflections["intensity.sum.value"]) == [0] * 5
+
+    # Another pass does not use the jobs of the first
+    run, _ = _run(JobCheckpoint(directory, "reference"), [_task(0, 5)])
+    assert run == [0]
+
+    # A job whose results were not completely saved is run again
+    checkpoint = JobCheckpoint(directory, "integration")
+    os.remove(checkpoint._path(checkpoint.key(_task(2, 3)), ".pickle"))
+    run, _ = _run(checkpoint, [_task(0, 5), _task(1, 7), _task(2, 3)])
+    assert run == [2]
+
+    # Only the checkpoint files are removed
+    other = os.path.join(directory, "other.txt")
+    with open(other, "w") as outfile:
+        outfile.write("other")
+    clear_checkpoints(directory)
+    assert os.listdir(directory) == ["other.txt"]
+    os.remove(other)
+    clear_checkpoints(directory)
+    assert not os.path.exists(directory)
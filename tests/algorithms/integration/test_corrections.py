@@ -1,7 +1,9 @@
+import pytest
+
 from dxtbx.model.experiment_list import ExperimentListFactory
 from scitbx import matrix
 
-from dials.algorithms.integration import Corrections, CorrectionsMulti
+from dials.algorithms.integration import Corrections, CorrectionsMulti, qe_correction
 from dials.array_family import flex
 
 
@@ -50,3 +52,30 @@ def LP_calculations(experiment, s1):
     )
 
     return L_f / P_f
+
+
+def test_corrections_multi_threads(dials_data):
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    exlist = ExperimentListFactory.from_json_file(filename)
+    rlist = flex.reflection_table.from_predictions_multi(exlist)
+
+    experiment = exlist[0]
+    corrector = CorrectionsMulti()
+    corrector.append(
+        Corrections(experiment.beam, experiment.goniometer, experiment.detector)
+    )
+
+    lp1 = corrector.lp(rlist["id"], rlist["s1"])
+    lp3 = corrector.lp(rlist["id"], rlist["s1"], nthreads=3)
+    assert list(lp1) == list(lp3)
+
+    qe1 = corrector.qe(rlist["id"], rlist["s1"], rlist["panel"])
+    qe3 = corrector.qe(rlist["id"], rlist["s1"], rlist["panel"], nthreads=3)
+    assert list(qe1) == list(qe3)
+
+    panel = experiment.detector[0]
+    for s1, qe in zip(rlist["s1"][:100], qe1[:100]):
+        expected = qe_correction(
+            panel.get_mu(), panel.get_thickness(), s1, panel.get_normal()
+        )
+        assert qe == pytest.approx(expected)
@@ -12,3 +12,39 @@ def test_powder_ring_filter():
     ice_filter = filtering.PowderRingFilter(unit_cell, space_group, d_min, width=0.004)
     assert min(uctbx.d_star_sq_as_d(ice_filter.d_star_sq)) < d_min
     assert all(ice_filter(d_spacings))
+
+
+def test_ice_ring_filter():
+    ice_filter = filtering.IceRingFilter()
+    d = 1.0 / flex.sqrt(flex.double(range(1, 600)) / 1000.0)
+    d2 = 1.0 / flex.pow2(d)
+    expected = [any(lo <= x <= hi for lo, hi in ice_filter.ice_rings) for x in d2]
+    assert list(ice_filter(d)) == expected
+
+
+def test_integration_prefilter():
+    from dials.algorithms.integration import IntegrationPrefilter
+    from dials.array_family import flex as dials_flex
+
+    prefilter = IntegrationPrefilter(min_zeta=0.05, d_min=1.5, d_max=20)
+    for ring in [(0.07, 0.078), (0.064, 0.069), (0.068, 0.072), (0.5, 0.6)]:
+        prefilter.add_ring(*ring)
+    assert prefilter.num_rings() == 2
+    assert prefilter.in_ring(1 / 0.075**0.5)
+    assert not prefilter.in_ring(1 / 0.08**0.5)
+    assert not prefilter.in_ring(1 / 0.06**0.5)
+
+    table = dials_flex.reflection_table()
+    table["zeta"] = flex.double([0.01, 0.5, -0.5, 0.5, 0.5])
+    table["d"] = flex.double([3.0, 1.0, 1 / 0.066**0.5, 30.0, 3.0])
+    table["flags"] = flex.size_t(5, 0)
+    assert prefilter.apply(table["zeta"], table["d"], table["flags"]) == 3
+    dont_integrate = table.get_flags(table.flags.dont_integrate)
+    in_powder_ring = table.get_flags(table.flags.in_powder_ring)
+    assert list(dont_integrate) == [True, True, False, True, False]
+    assert list(in_powder_ring) == [False, False, True, False, False]
+
+    # Flags which are already set are not counted again, and stills have no zeta
+    assert prefilter.apply(table["zeta"], table["d"], table["flags"]) == 0
+    table["flags"] = flex.size_t(5, 0)
+    assert prefilter.apply(flex.double(), table["d"], table["flags"]) == 2
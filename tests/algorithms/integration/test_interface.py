@@ -400,6 +400,56 @@ def test_reflection_manager():
     # Test passed
 
 
+def test_reflection_buckets():
+    from dials.algorithms.integration.integrator import JobList, ReflectionManager
+    from dials.algorithms.integration.processor import ReflectionBuckets
+    from dials.array_family import flex
+
+    random.seed(0)
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6()
+    reflections["id"] = flex.int()
+    reflections["flags"] = flex.size_t()
+    reflections["value"] = flex.int()
+    for i in range(1000):
+        z0 = random.randint(0, 120)
+        z1 = z0 + random.randint(1, 10)
+        flags = flex.reflection_table.flags.reference_spot
+        if i % 100 == 0:
+            flags |= flex.reflection_table.flags.dont_integrate
+        reflections.append(
+            {"bbox": (0, 1, 0, 1, z0, z1), "id": 0, "flags": flags, "value": i}
+        )
+
+    jobs = JobList()
+    jobs.add((0, 1), (0, 130), 20, 10)
+    manager = ReflectionManager(jobs, reflections)
+
+    # Add the reflections in frame order a few frames at a time and check that
+    # each job gets the same reflections as when splitting the whole table
+    buckets = ReflectionBuckets(jobs)
+    z0 = reflections["bbox"].parts()[4]
+    taken = {}
+    for frame in range(0, 140, 5):
+        buckets.add(reflections.select((z0 >= frame - 5) & (z0 < frame)))
+        for index in buckets.ready(0, frame):
+            taken[index] = buckets.take(index)
+            assert buckets.num_reflections(index) == 0
+    assert buckets.finished()
+    assert sorted(taken) == list(range(len(jobs)))
+    for index, table in taken.items():
+        assert sorted(table["value"]) == sorted(manager.split(index)["value"])
+    assert list(buckets.unassigned()["value"]) == sorted(
+        v for v in reflections["value"] if v % 100 == 0
+    )
+
+    # Reflections can't be added to a job once it is ready
+    buckets = ReflectionBuckets(jobs)
+    assert list(buckets.ready(0, 20)) == [0]
+    with pytest.raises(RuntimeError):
+        buckets.add(reflections.select(reflections["bbox"].parts()[5] <= 20))
+
+
 @pytest.mark.parametrize("nproc", [1, 2])
 def test_integrator_3d(dials_data, nproc):
     from math import pi
@@ -137,3 +137,25 @@ def test_kapton(run_in_tmpdir, dials_data):
     # y < 0; kapton correction should average out but should be slightly higher
     assert without_kapton_medians[3] == pytest.approx(with_kapton_medians[3], abs=5.0)
     assert without_kapton_medians[3] < with_kapton_medians[3]
+
+
+def test_kapton_path_threads():
+    from scitbx.matrix import col
+
+    from dials.algorithms.integration import get_kapton_path_cpp
+    from dials.algorithms.integration.kapton_2019_correction import KaptonTape_2019
+
+    tape = KaptonTape_2019(0.04, 0.025, 0.665, 0.55, wavelength_ang=1.3)
+    centre = sum(tape.edge_points, col((0, 0, 0))) / len(tape.edge_points)
+
+    s1 = flex.vec3_double([centre.normalize().elems])
+    for i in range(-50, 51):
+        for j in range(-50, 51):
+            s1.append(col((i / 50, j / 50, -1)).normalize().elems)
+
+    paths = get_kapton_path_cpp(tape.faces[:4], s1)
+    assert paths[0] > 0
+    assert list(get_kapton_path_cpp(tape.faces[:4], s1, nthreads=3)) == list(paths)
+    assert list(tape.abs_correction_flex(s1, nthreads=2)) == list(
+        tape.abs_correction_flex(s1)
+    )
@@ -0,0 +1,65 @@
+import collections
+
+import pytest
+
+from dials.algorithms.integration.memory_planner import (
+    MemoryPlanner,
+    column_bytes,
+    format_plan,
+)
+from dials.array_family import flex
+from dials.command_line.integrate import phil_scope
+
+
+class LinearPlanner(MemoryPlanner):
+    """A planner with 1 MB per image and 1 MB per thread and batch"""
+
+    def __init__(self, params, num_images=100):
+        self.params = params
+        self.num_images = num_images
+
+    def estimate(self, block_size, nproc, batch_size):
+        return collections.OrderedDict(
+            [
+                ("image_buffer", min(block_size, self.num_images) * 10 ** 6),
+                ("shoeboxes", nproc * batch_size * 10 ** 6),
+            ]
+        )
+
+
+def test_plan():
+    params = phil_scope.extract()
+    params.integration.mp.nproc = 8
+    params.integration.mp.batch_size = 4
+    planner = LinearPlanner(params)
+
+    # Everything fits
+    plan = planner.plan(50, budget=200 * 10 ** 6)
+    assert (plan.block_size, plan.nproc, plan.batch_size) == (50, 8, 4)
+    assert plan.max_block_size == 100
+    assert "Memory plan" in format_plan(plan)
+
+    # Process one reflection at a time
+    plan = planner.plan(50, budget=60 * 10 ** 6)
+    assert (plan.block_size, plan.nproc, plan.batch_size) == (50, 8, 1)
+
+    # Halve the threads until the block fits
+    plan = planner.plan(50, budget=53 * 10 ** 6)
+    assert (plan.block_size, plan.nproc, plan.batch_size) == (50, 2, 1)
+
+    # Keep the threads and shrink the block
+    plan = planner.plan(60, budget=50 * 10 ** 6)
+    assert (plan.block_size, plan.nproc, plan.batch_size) == (42, 8, 1)
+    assert plan.max_block_size == 42
+
+    with pytest.raises(RuntimeError):
+        planner.plan(50, budget=5 * 10 ** 6)
+
+
+def test_column_bytes():
+    reflections = flex.reflection_table()
+    reflections["intensity"] = flex.double(10)
+    reflections["flags"] = flex.size_t(10)
+    reflections["bbox"] = flex.int6(10)
+    reflections["miller_index"] = flex.miller_index(10)
+    assert column_bytes(reflections) == 10 * (8 + 8 + 24 + 12)
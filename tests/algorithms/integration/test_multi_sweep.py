@@ -0,0 +1,50 @@
+from dxtbx.model import Experiment, ExperimentList
+from dxtbx.model.experiment_list import ExperimentListFactory
+
+from dials.algorithms.integration.multi_sweep import merge_sweeps, split_sweeps
+from dials.array_family import flex
+
+
+def test_split_and_merge_sweeps(dials_data):
+    path = dials_data("centroid_test_data").join("experiments.json").strpath
+    first = ExperimentListFactory.from_json_file(path, check_format=False)[0]
+    first.identifier = "a"
+    second = Experiment(
+        imageset=first.imageset[0:5],
+        beam=first.beam,
+        detector=first.detector,
+        goniometer=first.goniometer,
+        scan=first.scan[0:5],
+        crystal=first.crystal,
+        identifier="b",
+    )
+    third = Experiment(
+        imageset=first.imageset,
+        beam=first.beam,
+        detector=first.detector,
+        goniometer=first.goniometer,
+        scan=first.scan,
+        crystal=first.crystal,
+        identifier="c",
+    )
+    experiments = ExperimentList([first, second, third])
+
+    reflections = flex.reflection_table()
+    reflections["id"] = flex.int([0, 1, 2, 1, 0, 2, 2])
+    reflections["intensity"] = flex.double(range(7))
+    for i, expt in enumerate(experiments):
+        reflections.experiment_identifiers()[i] = expt.identifier
+
+    sweeps = split_sweeps(experiments, reflections)
+    assert [sweep.expt_ids for sweep in sweeps] == [[0, 2], [1]]
+    assert list(sweeps[0].reflections["id"]) == [0, 1, 0, 1, 1]
+    assert list(sweeps[0].reflections["intensity"]) == [0, 2, 4, 5, 6]
+    assert dict(sweeps[0].reflections.experiment_identifiers()) == {0: "a", 1: "c"}
+    assert list(sweeps[1].reflections["id"]) == [0, 0]
+    assert dict(sweeps[1].reflections.experiment_identifiers()) == {0: "b"}
+    assert [e.identifier for e in sweeps[0].experiments] == ["a", "c"]
+
+    merged = merge_sweeps(experiments, sweeps, [s.reflections for s in sweeps])
+    assert list(merged["id"]) == [0, 2, 0, 2, 2, 1, 1]
+    assert list(merged["intensity"]) == [0, 2, 4, 5, 6, 1, 3]
+    assert dict(merged.experiment_identifiers()) == {0: "a", 1: "b", 2: "c"}
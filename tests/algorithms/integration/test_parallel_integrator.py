@@ -372,6 +372,93 @@ def test_gaussianrs_reference_profile_calculator(data):
     assert count == 9
 
 
+def test_gaussianrs_transform_cache(data):
+    from dials.algorithms.integration.parallel_integrator import (
+        TransformedProfileCache,
+    )
+    from dials.algorithms.profile_model.gaussian_rs.algorithm import (
+        GaussianRSIntensityCalculatorFactory,
+        GaussianRSReferenceCalculatorFactory,
+    )
+
+    # Use a small memory limit so that some shoeboxes go to the file
+    cache = TransformedProfileCache(max_memory=1000000)
+    algorithm = GaussianRSReferenceCalculatorFactory.create(
+        data.experiments, transform_cache=cache
+    )
+    for r in flex.reflection_table_to_list_of_reflections(data.reflections):
+        algorithm(r)
+    assert len(cache) > 0
+    assert cache.num_spilled() > 0
+    assert cache.memory() <= cache.max_memory()
+
+    profiles = algorithm.reference_profiles()
+    compute_intensity = GaussianRSIntensityCalculatorFactory.create(profiles)
+    compute_intensity_cached = GaussianRSIntensityCalculatorFactory.create(
+        profiles, transform_cache=cache
+    )
+
+    reflections = flex.reflection_table_to_list_of_reflections(data.reflections)
+    reflections_cached = flex.reflection_table_to_list_of_reflections(
+        data.reflections
+    )
+    for r1, r2 in zip(reflections, reflections_cached):
+        try:
+            compute_intensity(r1, [])
+        except Exception:
+            continue
+        compute_intensity_cached(r2, [])
+        assert r2.get("intensity.prf.value") == pytest.approx(
+            r1.get("intensity.prf.value")
+        )
+        assert r2.get("intensity.prf.variance") == pytest.approx(
+            r1.get("intensity.prf.variance")
+        )
+    assert cache.hits() > 0
+
+
+def test_gaussianrs_batch_intensity(data):
+    from dials.algorithms.profile_model.gaussian_rs.algorithm import (
+        GaussianRSIntensityCalculatorFactory,
+        GaussianRSReferenceCalculatorFactory,
+    )
+
+    algorithm = GaussianRSReferenceCalculatorFactory.create(data.experiments)
+    for r in flex.reflection_table_to_list_of_reflections(data.reflections):
+        algorithm(r)
+    profiles = algorithm.reference_profiles()
+
+    compute_intensity = GaussianRSIntensityCalculatorFactory.create(profiles)
+    compute_batch = GaussianRSIntensityCalculatorFactory.create(profiles, batch=True)
+    assert not compute_intensity.batched()
+    assert compute_batch.batched()
+
+    reflections = flex.reflection_table_to_list_of_reflections(data.reflections)
+    batch = flex.reflection_table_to_list_of_reflections(data.reflections)
+    success = compute_batch.batch(batch, [[] for r in batch])
+    assert len(success) == len(batch)
+
+    count = 0
+    for r1, r2, fitted in zip(reflections, batch, success):
+        try:
+            compute_intensity(r1, [])
+        except Exception:
+            assert not fitted
+            continue
+        assert fitted
+        count += 1
+        assert r2.get("intensity.prf.value") == pytest.approx(
+            r1.get("intensity.prf.value")
+        )
+        assert r2.get("intensity.prf.variance") == pytest.approx(
+            r1.get("intensity.prf.variance")
+        )
+        assert r2.get("intensity.prf.correlation") == pytest.approx(
+            r1.get("intensity.prf.correlation")
+        )
+    assert count > 0
+
+
 def test_job_list():
     from dials.algorithms.integration.parallel_integrator import SimpleBlockList
 
@@ -395,6 +482,37 @@ def test_job_list():
         assert jobs.block_index(frame) == 4
 
 
+def test_adaptive_job_list():
+    from dials.algorithms.integration.parallel_integrator import SimpleBlockList
+
+    # Narrow reflections in the first half and wider ones in the second half
+    bbox = flex.int6()
+    for z in range(100):
+        width = 4 if z < 50 else 10
+        bbox.append((0, 1, 0, 1, z, min(100, z + width)))
+    jobs = SimpleBlockList((0, 100), bbox, 0.9, 20)
+
+    assert jobs[0][0] == 0
+    assert jobs[len(jobs) - 1][1] == 100
+    for i in range(len(jobs) - 1):
+        assert jobs[i][0] < jobs[i + 1][0]
+        assert jobs[i + 1][0] <= jobs[i][1] < jobs[i + 1][1]
+    sizes = [j1 - j0 for j0, j1 in jobs]
+    assert max(sizes) <= 20
+    assert sizes[0] == 4
+    assert sizes[-2] == 10
+
+    # Without any reflections the blocks are the maximum size
+    jobs = SimpleBlockList((0, 60), flex.int6(), 0.9, 20)
+    assert [jobs[i] for i in range(len(jobs))] == [
+        (0, 20),
+        (10, 30),
+        (20, 40),
+        (30, 50),
+        (40, 60),
+    ]
+
+
 def test_reflection_manager(data):
     from dials.algorithms.integration.parallel_integrator import (
         SimpleBlockList,
@@ -1,5 +1,6 @@
 import math
 import os
+import random
 from unittest import mock
 
 import pytest
@@ -10,7 +11,14 @@
 from dials.algorithms.integration.processor import assess_available_memory
 from dials.algorithms.profile_model.gaussian_rs import Model
 from dials.array_family import flex
-from dials_algorithms_integration_integrator_ext import JobList, max_memory_needed
+from dials.model.data import make_image
+from dials_algorithms_integration_integrator_ext import (
+    Executor,
+    JobList,
+    ReflectionManagerPerImage,
+    ShoeboxProcessor,
+    max_memory_needed,
+)
 
 
 def test_shoebox_memory_is_a_reasonable_guesstimate(dials_data):
@@ -98,3 +106,107 @@ def test_assess_available_memory_condor_job_ad(mocker, monkeypatch, tmp_path):
     )
     available_memory, _, _ = assess_available_memory(params)
     assert available_memory and available_memory != 123
+
+
+class _RecordingExecutor(Executor):
+    def __init__(self):
+        super().__init__()
+        self.processed = []
+
+    def process(self, frame, reflections):
+        self.processed.append((frame, len(reflections)))
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_shoebox_processor_threaded_extraction(nthreads):
+    random.seed(0)
+    npanels, frame0, frame1, ny, nx = 3, 10, 16, 40, 50
+    panel = flex.size_t()
+    bbox = flex.int6()
+    for _ in range(500):
+        x0, y0 = random.randint(-3, nx), random.randint(-3, ny)
+        z0 = random.randint(frame0, frame1 - 1)
+        panel.append(random.randrange(npanels))
+        bbox.append(
+            (
+                x0,
+                x0 + random.randint(1, 6),
+                y0,
+                y0 + random.randint(1, 6),
+                z0,
+                min(frame1, z0 + random.randint(1, 4)),
+            )
+        )
+    reflections = flex.reflection_table()
+    reflections["panel"] = panel
+    reflections["bbox"] = bbox
+    reflections["shoebox"] = flex.shoebox(panel, bbox, allocate=False)
+
+    def pixel(z, p, y, x):
+        return float(((z * npanels + p) * ny + y) * nx + x)
+
+    executor = _RecordingExecutor()
+    processor = ShoeboxProcessor(
+        reflections, npanels, frame0, frame1, True, nthreads=nthreads
+    )
+    for z in range(frame0, frame1):
+        data = []
+        for p in range(npanels):
+            image = flex.double(
+                [pixel(z, p, y, x) for y in range(ny) for x in range(nx)]
+            )
+            image.reshape(flex.grid(ny, nx))
+            data.append(image)
+        mask = tuple(flex.bool(d.accessor(), True) for d in data)
+        processor.next(make_image(tuple(data), mask), executor)
+    assert processor.finished()
+    assert processor.extract_time() >= 0
+
+    def on_image(b):
+        return b[0] < nx and b[1] > 0 and b[2] < ny and b[3] > 0
+
+    expected = {}
+    for p, b in zip(panel, bbox):
+        if on_image(b):
+            expected[b[5] - 1] = expected.get(b[5] - 1, 0) + 1
+    assert dict(executor.processed) == expected
+
+    for p, b, sbox in zip(panel, bbox, reflections["shoebox"]):
+        assert sbox.is_allocated()
+        for z in range(b[4], b[5]):
+            for y in range(max(b[2], 0), min(b[3], ny)):
+                for x in range(max(b[0], 0), min(b[1], nx)):
+                    k = (z - b[4], y - b[2], x - b[0])
+                    assert sbox.data[k] == pixel(z, p, y, x)
+                    assert sbox.mask[k] == 1
+
+
+@pytest.mark.parametrize("block_size", [1, 3, 4])
+def test_reflection_manager_per_image_blocks(block_size):
+    random.seed(0)
+    frame0, frame1 = 5, 15
+    bbox = flex.int6()
+    for _ in range(100):
+        z0 = random.randint(frame0, frame1 - 1)
+        bbox.append((0, 2, 0, 2, z0, z0 + 1))
+    reflections = flex.reflection_table()
+    reflections["id"] = flex.int(len(bbox), 0)
+    reflections["bbox"] = bbox
+    reflections["value"] = flex.int(len(bbox), 0)
+
+    manager = ReflectionManagerPerImage(
+        (frame0, frame1), reflections, block_size=block_size
+    )
+    assert len(manager) == -(-(frame1 - frame0) // block_size)
+    for index in range(len(manager)):
+        f0, f1 = manager.frames(index)
+        assert f0 == frame0 + index * block_size
+        assert f1 == min(f0 + block_size, frame1)
+        split = manager.split(index)
+        expected = sum(1 for b in bbox if f0 <= b[4] < f1)
+        assert len(split) == manager.num_reflections(index) == expected
+        split["value"] = flex.int(len(split), index + 1)
+        manager.accumulate(index, split)
+    assert manager.finished()
+    for b, value in zip(bbox, manager.data()["value"]):
+        assert value == (b[4] - frame0) // block_size + 1
@@ -0,0 +1,110 @@
+import json
+import types
+
+from dials.algorithms.integration import telemetry
+from dials.algorithms.integration.parallel_integrator import (
+    IntegrationTelemetry,
+    TimingHistogram,
+)
+from dials.array_family import flex
+
+
+def _histogram(bins, total):
+    counts = flex.size_t(30, 0)
+    for i in bins:
+        counts[i] += 1
+    return TimingHistogram(counts, total)
+
+
+def _telemetry(nreflections):
+    return types.SimpleNamespace(
+        nthreads=2,
+        buffer_size=5,
+        num_images=10,
+        wall_time=2.0,
+        read_time=0.5,
+        wait_time=0.25,
+        copy_time=0.1,
+        mean_occupancy=2.5,
+        max_occupancy=4,
+        extract=_histogram([5] * nreflections, 0.1),
+        mask=_histogram([6] * nreflections, 0.2),
+        background=_histogram([7] * nreflections, 0.3),
+        intensity=_histogram([8] * nreflections, 0.4),
+        reflection=_histogram([9] * nreflections, 1.0),
+    )
+
+
+def test_timing_histogram():
+    edges = TimingHistogram.bin_edges()
+    assert len(edges) == 29
+    assert edges[0] == 1e-6
+    assert abs(edges[-1] - 10) < 1e-9
+    assert TimingHistogram.bin_index(0) == 0
+    assert TimingHistogram.bin_index(1.5e-6) == 1
+    assert TimingHistogram.bin_index(1e-3 * 1.001) == 13
+    assert TimingHistogram.bin_index(1e-3 * 0.999) == 12
+    assert TimingHistogram.bin_index(100) == 29
+
+    histogram = _histogram([1, 1, 2], 0.3)
+    assert histogram.count() == 3
+    assert abs(histogram.mean() - 0.1) < 1e-12
+
+    empty = IntegrationTelemetry()
+    assert empty.num_reflections() == 0
+    assert empty.reflections_per_second() == 0
+    assert empty.utilisation() == 0
+
+
+def test_telemetry_as_dict_and_merge():
+    first = telemetry.as_dict(_telemetry(10))
+    assert first["num_reflections"] == 10
+    assert first["reflections_per_second"] == 5
+    assert first["utilisation"] == 0.25
+    assert first["read_fraction"] == 0.25
+    assert first["histograms"]["mask"]["counts"][6] == 10
+
+    second = telemetry.as_dict(_telemetry(30))
+    second["mean_occupancy"] = 3.5
+    second["max_occupancy"] = 5
+    merged = telemetry.merge([first, None, second])
+    assert merged["jobs"] == 2
+    assert merged["num_images"] == 20
+    assert merged["num_reflections"] == 40
+    assert merged["wall_time"] == 4
+    assert merged["reflections_per_second"] == 10
+    assert merged["mean_occupancy"] == 3
+    assert merged["max_occupancy"] == 5
+    assert merged["histograms"]["intensity"]["counts"][8] == 40
+    assert abs(merged["histograms"]["intensity"]["total"] - 0.8) < 1e-12
+    assert telemetry.merge([None]) is None
+
+    # The summary can be formatted
+    assert "Thread utilisation" in telemetry.summary(merged)
+
+
+def test_telemetry_export(tmp_path):
+    records = {
+        "modelling": None,
+        "integration": telemetry.as_dict(_telemetry(10)),
+    }
+    json_filename = tmp_path / "telemetry.json"
+    prometheus_filename = tmp_path / "telemetry.prom"
+    telemetry.write(records, str(json_filename), str(prometheus_filename))
+
+    with json_filename.open() as infile:
+        loaded = json.load(infile)
+    assert list(loaded) == ["integration"]
+    assert loaded["integration"]["num_reflections"] == 10
+
+    lines = prometheus_filename.read_text().splitlines()
+    assert 'dials_integration_num_reflections{pass="integration"} 10' in lines
+    assert 'dials_integration_utilisation{pass="integration"} 0.25' in lines
+    labels = 'pass="integration",stage="mask"'
+    prefix = f"dials_integration_stage_seconds_bucket{{{labels},"
+    buckets = [line for line in lines if line.startswith(prefix)]
+    assert len(buckets) == 30
+    assert buckets[5].endswith(" 0")
+    assert buckets[6].endswith(" 10")
+    assert buckets[-1] == prefix + 'le="+Inf"} 10'
+    assert f"dials_integration_stage_seconds_count{{{labels}}} 10" in lines
@@ -0,0 +1,118 @@
+import random
+
+import numpy as np
+import pytest
+
+from cctbx import crystal, miller
+
+from dials.algorithms.merging.streaming import (
+    iterate_merged_runs,
+    pack_miller_indices,
+    run_dtype,
+    streaming_merge,
+    unpack_miller_indices,
+)
+from dials.array_family import flex
+
+
+def test_pack_miller_indices():
+    indices = flex.miller_index([(0, 0, 1), (-3, 2, -1), (100, -200, 300), (0, 0, 0)])
+    keys = pack_miller_indices(indices)
+    assert list(unpack_miller_indices(keys)) == list(indices)
+    # the keys sort in the order of the indices
+    assert sorted(keys) == [keys[i] for i in sorted(range(4), key=lambda i: indices[i])]
+
+
+@pytest.mark.parametrize("block_size", [1, 3, 1000])
+def test_iterate_merged_runs(block_size):
+    rng = np.random.default_rng(0)
+    runs = []
+    for size in [0, 1, 10, 57]:
+        run = np.zeros(size, dtype=run_dtype)
+        run["key"] = np.sort(rng.integers(0, 8, size=size))
+        run["intensity"] = rng.normal(size=size)
+        runs.append(run)
+    blocks = list(iterate_merged_runs(runs, block_size=block_size))
+    merged = np.concatenate(blocks)
+    assert merged.size == sum(run.size for run in runs)
+    assert np.all(np.diff(merged["key"]) >= 0)
+    assert sorted(merged["intensity"]) == sorted(
+        np.concatenate([run["intensity"] for run in runs])
+    )
+    # each key is only in one block
+    for key in np.unique(merged["key"]):
+        assert sum(np.any(block["key"] == key) for block in blocks) == 1
+
+
+def test_streaming_merge(tmp_path):
+    symmetry = crystal.symmetry(
+        unit_cell=(40, 40, 60, 90, 90, 120), space_group_symbol="P 31 2 1"
+    )
+    unique = miller.build_set(symmetry, anomalous_flag=True, d_min=4.0).expand_to_p1()
+    random.seed(0)
+    files = []
+    all_tables = flex.reflection_table()
+    for i in range(3):
+        indices = flex.miller_index(
+            [random.choice(unique.indices()) for _ in range(2000)]
+        )
+        table = flex.reflection_table()
+        table["miller_index"] = indices
+        table["id"] = flex.int(indices.size(), i)
+        table["intensity.scale.value"] = flex.double(
+            [random.uniform(10, 100) for _ in indices]
+        )
+        table["intensity.scale.variance"] = flex.double(
+            [random.uniform(1, 10) for _ in indices]
+        )
+        table["inverse_scale_factor"] = flex.double(
+            [random.uniform(0.5, 2) for _ in indices]
+        )
+        files.append(str(tmp_path / f"scaled_{i}.refl"))
+        table.as_file(files[-1])
+        all_tables.extend(table)
+
+    result = streaming_merge(files, symmetry, chunk_size=500, tmp_dir=str(tmp_path))
+
+    g = all_tables["inverse_scale_factor"]
+    observations = miller.array(
+        miller.set(symmetry, all_tables["miller_index"], anomalous_flag=True),
+        data=all_tables["intensity.scale.value"] / g,
+        sigmas=flex.sqrt(all_tables["intensity.scale.variance"]) / g,
+    ).map_to_asu()
+    for merged, anomalous in [
+        (result.merged_anomalous_array, True),
+        (result.merged_array, False),
+    ]:
+        if anomalous:
+            expected = observations.merge_equivalents(use_internal_variance=False)
+        else:
+            expected = observations.as_non_anomalous_array().merge_equivalents(
+                use_internal_variance=False
+            )
+        multiplicities = (
+            result.multiplicities if anomalous else result.mean_multiplicities
+        )
+        assert merged.anomalous_flag() == anomalous
+        expected_array = expected.array()
+        assert merged.size() == expected_array.size()
+        matches = miller.match_indices(expected_array.indices(), merged.indices())
+        assert matches.pairs().size() == merged.size()
+        for i, j in matches.pairs():
+            assert merged.data()[j] == pytest.approx(expected_array.data()[i])
+            assert merged.sigmas()[j] == pytest.approx(expected_array.sigmas()[i])
+            assert multiplicities.data()[j] == expected.redundancies().data()[i]
+
+    rows = result.statistics(n_bins=5)
+    assert len(rows) > 1
+    assert sum(row[2] for row in rows[:-1]) == rows[-1][2] == 6000
+    assert rows[-1][3] == result.merged_array.size()
+    assert -1 <= rows[-1][6] <= 1
+    assert "cc_half" in result.statistics_summary(n_bins=5)
+
+    # the temporary runs are removed
+    assert sorted(p.name for p in tmp_path.iterdir()) == [
+        "scaled_0.refl",
+        "scaled_1.refl",
+        "scaled_2.refl",
+    ]
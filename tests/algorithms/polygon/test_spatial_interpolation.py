@@ -1,6 +1,7 @@
 import random
 
 from dials.algorithms.polygon.spatial_interpolation import (
+    irregular_grid_to_grid,
     regrid_grid_to_irregular_grid,
     regrid_irregular_grid_to_grid,
 )
@@ -216,6 +217,40 @@ def test_conservation_of_counts():
         eps = 1e-7
         assert abs(flex.sum(output) - flex.sum(grid)) <= eps
 
+    @staticmethod
+    def test_matches():
+        from collections import defaultdict
+        from math import cos, pi, sin
+
+        from scitbx import matrix
+        from scitbx.array_family import flex
+
+        # Create a small rotated input grid, so each input pixel lies inside
+        # a single output pixel, and a larger one which overlaps several
+        for scale, min_count in [(0.2, 1), (3.0, 4)]:
+            angle = random.uniform(0, pi / 2)
+            R = matrix.sqr((cos(angle), -sin(angle), sin(angle), cos(angle)))
+            xy = []
+            for j in range(4):
+                for i in range(4):
+                    ij = R * matrix.col((i, j)) * scale
+                    xy.append((ij[0] + 25.5, ij[1] + 25.5))
+            gridxy = flex.vec2_double(xy)
+            gridxy.reshape(flex.grid(4, 4))
+
+            # Check the fractions of each input pixel sum to one
+            matches = irregular_grid_to_grid(gridxy, (50, 50))
+            total = defaultdict(float)
+            count = defaultdict(int)
+            for m in matches:
+                assert m.fraction > 0
+                total[getattr(m, "in")] += m.fraction
+                count[getattr(m, "in")] += 1
+            assert sorted(total) == list(range(9))
+            for k in total:
+                assert abs(total[k] - 1.0) <= 1e-7
+                assert count[k] >= min_count
+
 
 class TestRegridRegularToIrregular:
     @staticmethod
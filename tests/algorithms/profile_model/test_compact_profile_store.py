@@ -0,0 +1,42 @@
+import pickle
+
+import pytest
+
+from dials.algorithms.profile_model.modeller import CompactProfileStore
+from dials.array_family import flex
+
+
+def make_profile(values):
+    data = flex.double(flex.grid(3, 4, 5), 0)
+    for index, value in values.items():
+        data[index] = value
+    return data
+
+
+def test_store_round_trip():
+    sparse = make_profile({5: 0.25, 7: 0.75})
+    dense = flex.double(flex.grid(3, 4, 5), 1.0 / 60)
+    mask = flex.bool(flex.grid(3, 4, 5), True)
+
+    store = CompactProfileStore((3, 4, 5))
+    store.add(sparse, mask)
+    store.add_empty()
+    store.add(dense, mask.deep_copy())
+
+    assert len(store) == 3
+    assert store.valid(0) and not store.valid(1) and store.valid(2)
+    assert store.sparse(0)
+    assert not store.sparse(2)
+    assert store.num_masks() == 1
+    assert store.nbytes() < 2 * 60 * 8
+
+    for index, expected in ((0, sparse), (2, dense)):
+        assert store.data(index).all() == (3, 4, 5)
+        assert list(store.data(index)) == pytest.approx(list(expected), rel=1e-6)
+        assert store.mask(index).all_eq(True)
+
+    other = pickle.loads(pickle.dumps(store))
+    assert len(other) == 3
+    assert not other.valid(1)
+    assert list(other.data(0)) == list(store.data(0))
+    assert list(other.data(2)) == list(store.data(2))
@@ -1,3 +1,6 @@
+import pytest
+
+
 def test_run(dials_data):
     experiments = dials_data("centroid_test_data").join("experiments.json")
 
@@ -71,3 +74,30 @@ def test_run(dials_data):
     # pylab.colorbar()
     # pylab.scatter(points_x, points_y)
     # pylab.show()
+
+
+def test_weights(dials_data):
+    experiments = dials_data("centroid_test_data").join("experiments.json")
+
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms.profile_model.modeller import EwaldSphereSampler
+    from dials.array_family import flex
+
+    experiments = ExperimentListFactory.from_json_file(experiments.strpath)
+    sampler = EwaldSphereSampler(
+        experiments[0].beam,
+        experiments[0].detector,
+        experiments[0].goniometer,
+        experiments[0].scan,
+        1,
+    )
+
+    width, height = experiments[0].detector[0].get_image_size()
+    for j in range(0, height, 97):
+        for i in range(0, width, 89):
+            coord = (i + 0.5, j + 0.5, 0.5)
+            indices = flex.size_t(sampler.nearest_n(sampler.nearest(0, coord)))
+            weights = sampler.weights(indices, 0, coord)
+            expected = [sampler.weight(index, 0, coord) for index in indices]
+            assert list(weights) == pytest.approx(expected, abs=1e-9)
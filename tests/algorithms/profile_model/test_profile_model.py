@@ -1,3 +1,6 @@
+import pytest
+
+
 def test_load_and_dump():
     from dials.algorithms.profile_model.gaussian_rs import Model
 
@@ -11,3 +14,24 @@ def test_load_and_dump():
     assert model2.n_sigma() == 2
     assert model2.sigma_b() == 4
     assert model2.sigma_m() == 5
+
+
+def test_shared_ideal_profile():
+    import math
+
+    from dials.algorithms.profile_model.gaussian_rs import (
+        ideal_profile_double,
+        shared_ideal_profile_double,
+    )
+
+    profile = ideal_profile_double(4, 3)
+    assert profile.all() == (9, 9, 9)
+    assert sum(profile) == pytest.approx(1)
+    g = [math.exp(-(((i - 4) * 3 / 4) ** 2) / 2) for i in range(9)]
+    assert profile[1, 2, 3] / profile[4, 4, 4] == pytest.approx(g[1] * g[2] * g[3])
+
+    # The shared profile is the same, and changing a copy doesn't change it
+    shared = shared_ideal_profile_double(4, 3)
+    assert list(shared) == list(profile)
+    shared[0] = -1
+    assert list(shared_ideal_profile_double(4, 3)) == list(profile)
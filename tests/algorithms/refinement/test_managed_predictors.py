@@ -0,0 +1,102 @@
+"""Check that the scan static predictions cached between calls match the
+predictions made from scratch"""
+
+
+import pytest
+
+
+@pytest.fixture
+def setup():
+    from cctbx.sgtbx import space_group, space_group_symbols
+    from dxtbx.model import ScanFactory
+    from dxtbx.model.experiment_list import Experiment, ExperimentList
+    from libtbx.phil import parse
+    from scitbx.array_family import flex
+
+    from dials.algorithms.refinement.prediction.managed_predictors import (
+        ScansRayPredictor,
+    )
+    from dials.algorithms.spot_prediction import IndexGenerator
+    from dials.tests.algorithms.refinement.setup_geometry import Extract
+
+    master_phil = parse(
+        """
+  include scope dials.tests.algorithms.refinement.geometry_phil
+  """,
+        process_includes=True,
+    )
+    models = Extract(master_phil)
+
+    scan = ScanFactory().make_scan(
+        image_range=(1, 100),
+        exposure_times=0.1,
+        oscillation=(0, 0.1),
+        epochs=list(range(100)),
+        deg=True,
+    )
+    experiments = ExperimentList()
+    experiments.append(
+        Experiment(
+            beam=models.beam,
+            detector=models.detector,
+            goniometer=models.goniometer,
+            scan=scan,
+            crystal=models.crystal,
+            imageset=None,
+        )
+    )
+
+    indices = IndexGenerator(
+        models.crystal.get_unit_cell(),
+        space_group(space_group_symbols(1).hall()).type(),
+        3.0,
+    ).to_array()
+    ray_predictor = ScansRayPredictor(experiments, scan.get_oscillation_range())
+    reflections = ray_predictor(indices)
+    reflections["id"] = flex.int(len(reflections), 0)
+    reflections["xyzobs.mm.value"] = reflections["xyzcal.mm"]
+    return experiments, reflections
+
+
+def _predict(experiments, reflections):
+    from dials.algorithms.refinement.prediction.managed_predictors import (
+        ScansExperimentsPredictor,
+    )
+
+    return ScansExperimentsPredictor(experiments)(reflections.copy())
+
+
+def test_cached_predictions(setup):
+    from scitbx import matrix
+
+    from dials.algorithms.refinement.prediction.managed_predictors import (
+        ScansExperimentsPredictor,
+    )
+
+    experiments, reflections = setup
+    assert len(reflections) > 0
+    predictor = ScansExperimentsPredictor(experiments)
+
+    # Predicting again with the same models gives the same predictions
+    first = predictor(reflections.copy())
+    second = predictor(reflections.copy())
+    for key in ("s1", "xyzcal.mm", "xyzcal.px", "flags"):
+        assert list(first[key]) == list(second[key])
+
+    # After a small change to the orientation the predictions are made again
+    crystal = experiments[0].crystal
+    U = matrix.sqr(crystal.get_U())
+    R = matrix.col((1, 0, 0)).axis_and_angle_as_r3_rotation_matrix(0.001, deg=True)
+    crystal.set_U(R * U)
+    third = predictor(reflections.copy())
+    expected = _predict(experiments, reflections)
+    assert list(third["xyzcal.mm"]) != list(first["xyzcal.mm"])
+    for key in ("s1", "xyzcal.mm", "xyzcal.px", "flags"):
+        assert list(third[key]) == list(expected[key])
+
+    # A different set of reflections is also predicted again
+    subset = reflections.select(reflections["entering"])
+    fourth = predictor(subset.copy())
+    expected = _predict(experiments, subset)
+    for key in ("s1", "xyzcal.mm", "xyzcal.px", "flags"):
+        assert list(fourth[key]) == list(expected[key])
@@ -0,0 +1,133 @@
+import random
+
+import pytest
+
+from scitbx import sparse
+from scitbx.array_family import flex
+from scitbx.lstbx import normal_eqns
+
+from dials_refinement_helpers_ext import SparseNormalEquations, add_normal_equations
+
+
+def make_equations(nobs, nparam):
+    random.seed(0)
+    residuals = flex.double([random.uniform(-1, 1) for _ in range(nobs)])
+    weights = flex.double([random.uniform(0.5, 2) for _ in range(nobs)])
+    jacobian = flex.double(flex.grid(nobs, nparam), 0)
+    for i in range(nobs):
+        for j in random.sample(range(nparam), 3):
+            jacobian[i, j] = random.uniform(-1, 1)
+    return residuals, jacobian, weights
+
+
+def as_sparse(jacobian):
+    nobs, nparam = jacobian.all()
+    j = sparse.matrix(nobs, nparam)
+    for i in range(nobs):
+        for k in range(nparam):
+            if jacobian[i, k]:
+                j[i, k] = jacobian[i, k]
+    return j
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+@pytest.mark.parametrize("use_sparse", [False, True])
+def test_add_normal_equations(nthreads, use_sparse):
+    nobs, nparam = 200, 11
+    residuals, jacobian, weights = make_equations(nobs, nparam)
+    ls = normal_eqns.non_linear_ls(n_parameters=nparam)
+    ls.add_equations(residuals, jacobian, weights)
+    expected = ls.step_equations()
+
+    if use_sparse:
+        jacobian = as_sparse(jacobian)
+    a = flex.double(nparam * (nparam + 1) // 2, 0)
+    b = flex.double(nparam, 0)
+    add_normal_equations(
+        a,
+        b,
+        residuals,
+        jacobian,
+        weights,
+        negate_right_hand_side=True,
+        nthreads=nthreads,
+    )
+    assert list(a) == pytest.approx(list(expected.normal_matrix_packed_u()))
+    assert list(b) == pytest.approx(list(expected.right_hand_side()))
+
+    # The equations are added to those already accumulated
+    add_normal_equations(a, b, residuals, jacobian, flex.double(), nthreads=nthreads)
+    ls = normal_eqns.non_linear_ls(n_parameters=nparam)
+    ls.add_equations(residuals, make_equations(nobs, nparam)[1], weights)
+    ls.add_equations(-residuals, make_equations(nobs, nparam)[1], flex.double(nobs, 1))
+    expected = ls.step_equations()
+    assert list(a) == pytest.approx(list(expected.normal_matrix_packed_u()))
+    assert list(b) == pytest.approx(list(expected.right_hand_side()))
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_sparse_normal_equations(nthreads):
+    nobs, nparam = 200, 11
+    residuals, jacobian, weights = make_equations(nobs, nparam)
+    ls = normal_eqns.non_linear_ls(n_parameters=nparam)
+    ls.add_equations(residuals, jacobian, weights)
+    expected = ls.step_equations()
+
+    ne = SparseNormalEquations(n_parameters=nparam)
+    ne.add_equations(
+        residuals,
+        as_sparse(jacobian),
+        weights,
+        negate_right_hand_side=True,
+        nthreads=nthreads,
+    )
+    assert ne.n_equations() == nobs
+    assert ne.dof() == nobs - nparam
+    assert ne.objective() == pytest.approx(ls.objective())
+    assert list(ne.right_hand_side()) == pytest.approx(list(expected.right_hand_side()))
+    diagonal = expected.normal_matrix_packed_u().matrix_packed_u_diagonal()
+    assert list(ne.normal_matrix_diagonal()) == pytest.approx(list(diagonal))
+    ne.add_constant_to_diagonal(0.1)
+    assert list(ne.normal_matrix_diagonal()) == pytest.approx(list(diagonal + 0.1))
+    ne.add_constant_to_diagonal(-0.1)
+    expected.solve()
+    ne.solve()
+    assert ne.solved()
+    assert list(ne.solution()) == pytest.approx(list(expected.solution()))
+    assert ne.num_analyses() == 1
+
+    # The pattern, and so the analysis of the factorisation, is kept by reset
+    ne.reset()
+    assert ne.objective() == 0
+    ne.add_equations(residuals, as_sparse(jacobian), weights, True, nthreads)
+    ne.solve()
+    assert list(ne.solution()) == pytest.approx(list(expected.solution()))
+    assert ne.num_analyses() == 1
+
+
+def test_sparse_normal_equations_block_arrow():
+    # Ten blocks of four parameters, each coupled to the first two parameters
+    random.seed(0)
+    nshared, nblocks, nblock = 2, 10, 4
+    nparam = nshared + nblocks * nblock
+    nobs = nblocks * 30
+    jacobian = flex.double(flex.grid(nobs, nparam), 0)
+    for i in range(nobs):
+        first = nshared + (i // 30) * nblock
+        for k in list(range(nshared)) + list(range(first, first + nblock)):
+            jacobian[i, k] = random.uniform(-1, 1)
+    residuals = flex.double([random.uniform(-1, 1) for _ in range(nobs)])
+    weights = flex.double(nobs, 1)
+
+    ls = normal_eqns.non_linear_ls(n_parameters=nparam)
+    ls.add_equations(residuals, jacobian, weights)
+    expected = ls.step_equations()
+    expected.solve()
+
+    ne = SparseNormalEquations(n_parameters=nparam)
+    ne.add_equations(residuals, as_sparse(jacobian), weights, True)
+    ne.solve()
+    assert list(ne.solution()) == pytest.approx(list(expected.solution()))
+
+    # The shared parameters are eliminated last, so there is no fill in
+    assert ne.factor_non_zeros() == ne.non_zeros() - nparam
@@ -44,3 +44,18 @@ def test_scan_margin(dials_data):
     # Check 1 degree scan margin trims approximately 1 degree
     assert min(phi2) == pytest.approx(min(phi1) + math.radians(margin), abs=1e-3)
     assert max(phi2) == pytest.approx(max(phi1) - math.radians(margin), abs=1e-3)
+
+
+def test_reflection_group_index():
+    from dials_refinement_helpers_ext import ReflectionGroupIndex
+
+    group = flex.int([1, 0, 2, 1, -1, 0, 5, 1])
+    groups = ReflectionGroupIndex(group, 3)
+    assert groups.ngroups() == 3
+    for g in range(3):
+        expected = (group == g).iselection()
+        assert groups.size(g) == len(expected)
+        assert list(groups.indices(g)) == list(expected)
+    assert list(groups.select(1, flex.size_t([2, 0]))) == [7, 0]
+    with pytest.raises(RuntimeError):
+        groups.select(2, flex.size_t([1]))
@@ -489,3 +489,54 @@ def test_group_restraint_with_multiple_crystals_and_a_stills_refiner(dials_regre
         # print list(fd.round(6))
         # print
         assert an == pytest.approx(fd, abs=1e-5)
+
+
+@pytest.mark.parametrize("target", ["mean", "low_memory_mean", "median"])
+def test_group_restraint_gradients_written_in_one_call(dials_regression, target):
+    """Compare the gradients of a group restraint written in one threaded call
+    with those assembled from the blocks of each crystal"""
+
+    from scitbx import sparse
+
+    from dials.algorithms.refinement.refiner import phil_scope
+
+    user_phil = parse(
+        f"""
+  refinement.parameterisation.crystal.unit_cell.restraints.tie_to_group {{
+    target={target}
+    sigmas=1,0,2,0,0,1
+  }}
+  """
+    )
+    working_params = phil_scope.fetch(source=user_phil).extract()
+
+    # use the multi stills test data
+    data_dir = os.path.join(dials_regression, "refinement_test_data", "multi_stills")
+    experiments = ExperimentListFactory.from_json_file(
+        os.path.join(data_dir, "combined_experiments.json"), check_format=False
+    )
+    reflections = flex.reflection_table.from_file(
+        os.path.join(data_dir, "combined_reflections.pickle")
+    )
+    refiner = RefinerFactory.from_parameters_data_experiments(
+        working_params, reflections, experiments
+    )
+    rp = refiner._target._restraints_parameterisation
+    nparam = len(refiner._pred_param.get_param_vals())
+    restraint, istarts = rp._group_model_restraints[0]
+
+    expected = sparse.matrix(restraint.num_residuals, nparam)
+    for icol, grads in zip(istarts, restraint.gradients()):
+        irow = 0
+        for grad in grads:
+            expected.assign_block(grad, irow, icol)
+            irow += grad.n_rows
+
+    for nthreads in (1, 2):
+        jacobian = sparse.matrix(restraint.num_residuals, nparam)
+        restraint.add_gradients(jacobian, 0, istarts, nthreads=nthreads)
+        assert jacobian.non_zeroes == expected.non_zeroes
+        for j in range(nparam):
+            assert jacobian.col(j).as_dense_vector() == pytest.approx(
+                expected.col(j).as_dense_vector()
+            )
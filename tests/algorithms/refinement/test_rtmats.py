@@ -0,0 +1,67 @@
+"""Test the rotation matrices and their derivatives calculated for arrays of
+axes and angles against the single matrix versions"""
+
+
+import random
+
+import pytest
+
+from scitbx import matrix
+from scitbx.array_family import flex
+
+from dials.algorithms.refinement.refinement_helpers import (
+    dR_from_axis_and_angle,
+    dRq_de,
+)
+from dials_refinement_helpers_ext import (
+    RotationMatricesAndDerivatives,
+    rotation_matrices,
+)
+from dials_refinement_helpers_ext import dRq_de as dRq_de_cpp
+
+
+def random_axes_and_angles(n):
+    random.seed(0)
+    axes = flex.vec3_double(
+        [(random.gauss(0, 1), random.gauss(0, 1), random.gauss(0, 1)) for _ in range(n)]
+    )
+    angles = flex.double([random.uniform(-3.0, 3.0) for _ in range(n)])
+    return axes, angles
+
+
+def test_rotation_matrices():
+    axes, angles = random_axes_and_angles(100)
+    R = rotation_matrices(axes, angles)
+    rd = RotationMatricesAndDerivatives(axes, angles)
+    assert len(R) == len(rd.R()) == len(rd.dR_dangle()) == 100
+
+    for axis, angle, R1, R2, dR in zip(axes, angles, R, rd.R(), rd.dR_dangle()):
+        expected = matrix.col(axis).axis_and_angle_as_r3_rotation_matrix(angle)
+        assert R1 == pytest.approx(expected.elems, abs=1e-14)
+        assert R2 == pytest.approx(expected.elems, abs=1e-14)
+        expected = dR_from_axis_and_angle(matrix.col(axis), angle)
+        assert dR == pytest.approx(expected.elems, abs=1e-14)
+
+    # rotating by the matrices is the same as rotating the vectors
+    vectors = flex.vec3_double(len(axes), (0.1, -0.2, 0.3))
+    rotated = vectors.rotate_around_origin(axes, angles)
+    for v1, v2 in zip(R * vectors, rotated):
+        assert v1 == pytest.approx(v2, abs=1e-14)
+
+    with pytest.raises(RuntimeError):
+        rotation_matrices(axes, angles[:-1])
+
+
+def test_dRq_de():
+    e, theta = random_axes_and_angles(100)
+    q = flex.vec3_double(
+        [(random.gauss(0, 1), random.gauss(0, 1), random.gauss(0, 1)) for _ in e]
+    )
+    result = dRq_de_cpp(theta, e, q)
+    for i, der in enumerate(result):
+        expected = dRq_de(theta[i], matrix.col(e[i]), matrix.col(q[i]))
+        assert der == pytest.approx(expected.elems, abs=1e-12)
+
+    # zero angle gives a null matrix
+    result = dRq_de_cpp(flex.double([0.0]), e[:1], q[:1])
+    assert result[0] == (0.0,) * 9
@@ -0,0 +1,81 @@
+import random
+
+import pytest
+
+from scitbx import sparse
+from scitbx.array_family import flex
+
+from dials.algorithms.refinement.target import SparseGradientsMixin, Target
+
+
+def _random_gradients(nref, nparam, ndim):
+    random.seed(0)
+    dense = [[flex.double(nref, 0) for _ in range(nparam)] for _ in range(ndim)]
+    for grads in dense:
+        for g in grads:
+            for i in random.sample(range(nref), nref // 3):
+                g[i] = random.uniform(-1, 1)
+    return dense
+
+
+@pytest.mark.parametrize("nref,nparam,ndim", [(1, 1, 1), (50, 7, 3), (11, 4, 2)])
+def test_build_jacobian(nref, nparam, ndim):
+    dense = _random_gradients(nref, nparam, ndim)
+    nelem = nref * ndim
+
+    jacobian = Target._build_jacobian(dense, nelem=nelem, nparam=nparam)
+    assert jacobian.all() == (nelem, nparam)
+    for dim, grads in enumerate(dense):
+        for j, g in enumerate(grads):
+            for i in range(nref):
+                assert jacobian[dim * nref + i, j] == g[i]
+
+    grads_sparse = []
+    for grads in dense:
+        columns = []
+        for g in grads:
+            column = sparse.matrix_column(nref)
+            for i in (g != 0).iselection():
+                column[i] = g[i]
+            columns.append(column)
+        grads_sparse.append(columns)
+    sparse_jacobian = SparseGradientsMixin._build_jacobian(
+        grads_sparse, nelem=nelem, nparam=nparam
+    )
+    assert sparse_jacobian.n_rows == nelem
+    assert sparse_jacobian.n_cols == nparam
+    assert list(sparse_jacobian.as_dense_matrix()) == list(jacobian)
+
+
+@pytest.mark.parametrize("nref,nparam,ndim", [(1, 1, 1), (50, 7, 3), (11, 4, 2)])
+def test_gradient_and_curvature(nref, nparam, ndim):
+    from dials_refinement_helpers_ext import LeastSquaresGradientAccumulator
+
+    dense = _random_gradients(nref, nparam, ndim)
+    residuals = flex.double([random.uniform(-1, 1) for _ in range(nref * ndim)])
+    weights = flex.double([random.uniform(0.5, 2) for _ in range(nref * ndim)])
+    accumulator = LeastSquaresGradientAccumulator(residuals, weights, ndim)
+    assert accumulator.functional(residuals * residuals) == pytest.approx(
+        0.5 * flex.sum(weights * residuals * residuals)
+    )
+
+    for j in range(nparam):
+        grads = [dense[dim][j] for dim in range(ndim)]
+        concatenated = Target._concatenate_gradients([g.deep_copy() for g in grads])
+        expected = (
+            flex.sum(weights * residuals * concatenated),
+            flex.sum(weights * concatenated * concatenated),
+        )
+        assert Target._gradient_and_curvature(accumulator, grads) == pytest.approx(
+            expected
+        )
+
+        columns = []
+        for g in grads:
+            column = sparse.matrix_column(nref)
+            for i in (g != 0).iselection():
+                column[i] = g[i]
+            columns.append(column)
+        assert SparseGradientsMixin._gradient_and_curvature(
+            accumulator, columns
+        ) == pytest.approx(expected)
@@ -16,10 +16,6 @@ def test_joint_refinement(dials_regression, run_in_tmpdir):
     """A basic test of joint refinement of the CS-PAD detector at hierarchy level 2
     with 300 crystals."""
 
-    bevington = pytest.importorskip("scitbx.examples.bevington")
-    if not hasattr(bevington, "non_linear_ls_eigen_wrapper"):
-        pytest.skip("Skipping test as SparseLevMar engine not available")
-
     data_dir = os.path.join(dials_regression, "refinement_test_data", "xfel_metrology")
 
     # Do refinement and load the history
@@ -53,10 +49,6 @@ def test_constrained_refinement(dials_regression, run_in_tmpdir):
     on it still moves with its partners in the constraint.
     See https://github.com/dials/dials/issues/990"""
 
-    bevington = pytest.importorskip("scitbx.examples.bevington")
-    if not hasattr(bevington, "non_linear_ls_eigen_wrapper"):
-        pytest.skip("Skipping test as SparseLevMar engine not available")
-
     data_dir = os.path.join(dials_regression, "refinement_test_data", "xfel_metrology")
 
     # Load experiments and reflections
@@ -1,4 +1,5 @@
 import math
+import pickle
 import random
 
 import pytest
@@ -508,3 +509,78 @@ def test_forward_panel_edge(dials_data):
         )
         # The total transformed counts should be less than the (unmasked) image counts
         assert flex.sum(grid) < flex.sum(image)
+
+
+def test_forward_geometry_cache(dials_data):
+    expt = ExperimentList.from_file(
+        dials_data("centroid_test_data").join("imported_experiments.json").strpath
+    )[0]
+
+    # Get the models
+    beam = expt.beam
+    detector = expt.detector
+    gonio = expt.goniometer
+    scan = expt.scan
+
+    # Set some parameters
+    sigma_divergence = 0.00101229
+    mosaicity = 0.157 * math.pi / 180
+    n_sigma = 3
+    grid_size = 7
+    delta_divergence = n_sigma * sigma_divergence
+    step_size = delta_divergence / grid_size
+    delta_divergence2 = delta_divergence + step_size * 0.5
+    delta_mosaicity = n_sigma * mosaicity
+
+    # Create the bounding box calculator
+    calculate_bbox = BBoxCalculator3D(
+        beam, detector, gonio, scan, delta_divergence2, delta_mosaicity
+    )
+
+    # Initialise the transforms with and without the cache
+    spec = transform.TransformSpec(
+        beam, detector, gonio, scan, sigma_divergence, mosaicity, n_sigma + 1, grid_size
+    )
+    cached_spec = transform.TransformSpec(
+        beam,
+        detector,
+        gonio,
+        scan,
+        sigma_divergence,
+        mosaicity,
+        n_sigma + 1,
+        grid_size,
+        16,
+    )
+    assert spec.cache_tile_size() == 0
+    assert cached_spec.cache_tile_size() == 16
+    assert pickle.loads(pickle.dumps(cached_spec)).cache_tile_size() == 16
+
+    s0 = beam.get_s0()
+    m2 = gonio.get_rotation_axis()
+    s0_length = matrix.col(beam.get_s0()).length()
+
+    for i in range(20):
+
+        # Get random x, y, z including near the panel edges
+        x = random.uniform(0, 2000)
+        y = random.uniform(0, 2000)
+        z = random.uniform(0, 9)
+
+        s1 = matrix.col(detector[0].get_pixel_lab_coord((x, y))).normalize() * s0_length
+        phi = scan.get_angle_from_array_index(z, deg=False)
+        bbox = calculate_bbox(s1, z, 0)
+        x0, x1, y0, y1, z0, z1 = bbox
+        cs = CoordinateSystem(m2, s0, s1, phi)
+
+        image = gaussian(
+            (z1 - z0, y1 - y0, x1 - x0), 10.0, (z - z0, y - y0, x - x0), (2.0, 2.0, 2.0)
+        ).as_double()
+        mask = flex.bool(flex.grid(image.all()), True)
+
+        # The profiles should be the same
+        expected = transform.TransformForward(spec, cs, bbox, 0, image, mask)
+        cached = transform.TransformForward(cached_spec, cs, bbox, 0, image, mask)
+        assert list(cached.profile()) == pytest.approx(
+            list(expected.profile()), abs=1e-6
+        )
@@ -1,3 +1,4 @@
+import multiprocessing
 from unittest import mock
 
 import pytest
@@ -212,3 +213,26 @@ def test_cross_validate_script():
             param.cross_validation.cross_validation_mode = "bad"
             with pytest.raises(ValueError):
                 cross_validate(param, crossvalidator)
+
+
+@pytest.mark.skipif(
+    "fork" not in multiprocessing.get_all_start_methods(),
+    reason="parallel cross validation needs fork",
+)
+def test_run_configurations_parallel():
+    """Test that jobs run in forked processes add their results in order."""
+
+    def run_scaling(self, params):
+        return [float(params.scaling_options.free_set_offset)] * 6
+
+    crossvalidator = DialsScaleCrossValidator([], [])
+    crossvalidator.create_results_dict(2)
+    jobs = []
+    for n in range(6):
+        params = generated_param()
+        params.scaling_options.free_set_offset = n
+        jobs.append((params, n % 2))
+    with mock.patch.object(DialsScaleCrossValidator, "run_scaling", run_scaling):
+        crossvalidator.run_configurations(jobs, nproc=3)
+    assert crossvalidator.results_dict[0]["work Rmeas"] == [0.0, 2.0, 4.0]
+    assert crossvalidator.results_dict[1]["free CC1/2"] == [1.0, 3.0, 5.0]
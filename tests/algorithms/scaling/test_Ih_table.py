@@ -3,6 +3,7 @@
 import numpy as np
 import pandas as pd
 import pytest
+from scipy.sparse import csc_matrix
 
 from cctbx.sgtbx import space_group, uctbx
 from dxtbx import flumpy
@@ -10,6 +11,7 @@
 
 from dials.algorithms.scaling.Ih_table import IhTable, IhTableBlock, map_indices_to_asu
 from dials.array_family import flex
+from dials_scaling_ext import IhTableGroups
 
 
 @pytest.fixture()
@@ -340,6 +342,94 @@ def test_IhTableblock_twodatasets(large_reflection_table, test_sg):
     assert new_block.h_expand_matrix[0, 2] == 1
 
 
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_IhTableGroups(nthreads):
+    """Test the group sums against the sparse matrix products."""
+    rng = np.random.default_rng(0)
+    n_refl, n_groups = 2000, 300
+    group_ids = rng.integers(0, n_groups, n_refl).astype(np.uint64)
+    group_ids[:n_groups] = np.arange(n_groups, dtype=np.uint64)
+    h_index = csc_matrix(
+        (np.full(n_refl, 1.0), (np.arange(n_refl), group_ids.astype(np.int64)))
+    )
+    groups = IhTableGroups(flumpy.from_numpy(group_ids), n_groups, nthreads)
+    assert groups.size() == n_refl
+    assert groups.n_groups() == n_groups
+    assert list(groups.group_ids()) == list(group_ids)
+
+    values = rng.random(n_refl)
+    sums = values @ h_index
+    assert list(groups.sum_in_groups(flumpy.from_numpy(values))) == pytest.approx(sums)
+    per_refl = groups.sum_in_groups_per_refl(flumpy.from_numpy(values))
+    assert list(per_refl) == pytest.approx(sums @ h_index.transpose())
+    ones = np.full(n_refl, 1.0) @ h_index
+    assert list(groups.group_multiplicities()) == list(ones)
+    assert list(groups.calc_nh()) == list(ones @ h_index.transpose())
+
+    g = rng.random(n_refl) + 0.5
+    intensities = rng.random(n_refl) * 100
+    w = rng.random(n_refl)
+    Ih = ((g * intensities * w) @ h_index) / ((np.square(g) * w) @ h_index)
+    result = groups.calc_Ih(
+        flumpy.from_numpy(g), flumpy.from_numpy(intensities), flumpy.from_numpy(w)
+    )
+    assert list(result) == pytest.approx(Ih @ h_index.transpose())
+
+    with pytest.raises(RuntimeError):
+        groups.sum_in_groups(flex.double(n_refl - 1))
+    with pytest.raises(RuntimeError):
+        IhTableGroups(flumpy.from_numpy(group_ids), n_groups - 1)
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_IhTableGroups_calc_jacobian(nthreads):
+    """Test the Jacobian against the dense matrix products."""
+    rng = np.random.default_rng(1)
+    n_refl, n_groups, n_params = 200, 40, 12
+    group_ids = rng.integers(0, n_groups, n_refl).astype(np.uint64)
+    group_ids[:n_groups] = np.arange(n_groups, dtype=np.uint64)
+    h_index = np.zeros((n_refl, n_groups))
+    h_index[np.arange(n_refl), group_ids.astype(np.int64)] = 1.0
+    groups = IhTableGroups(flumpy.from_numpy(group_ids), n_groups, nthreads)
+
+    # each reflection depends on a few of the parameters
+    derivatives = sparse.matrix(n_refl, n_params)
+    dense_derivatives = np.zeros((n_refl, n_params))
+    for i in range(n_refl):
+        for j in rng.choice(n_params, 3, replace=False):
+            dense_derivatives[i, j] = derivatives[i, int(j)] = rng.random()
+
+    g = rng.random(n_refl) + 0.5
+    intensities = rng.random(n_refl) * 100
+    w = rng.random(n_refl)
+    sumgsq = (np.square(g) * w) @ h_index
+    Ih = h_index @ (((g * intensities * w) @ h_index) / sumgsq)
+    dIh = (intensities - 2.0 * Ih * g) * w
+    dIh_by_dp = (h_index.T @ (dIh[:, None] * dense_derivatives)) / sumgsq[:, None]
+    expected = -Ih[:, None] * dense_derivatives - g[:, None] * (h_index @ dIh_by_dp)
+
+    jacobian = groups.calc_jacobian(
+        derivatives,
+        flumpy.from_numpy(g),
+        flumpy.from_numpy(intensities),
+        flumpy.from_numpy(w),
+        flumpy.from_numpy(Ih),
+    )
+    assert jacobian.n_rows == n_refl
+    assert jacobian.n_cols == n_params
+    result = flumpy.to_numpy(jacobian.as_dense_matrix())
+    assert result.flatten() == pytest.approx(expected.flatten())
+
+    with pytest.raises(RuntimeError):
+        groups.calc_jacobian(
+            sparse.matrix(n_refl - 1, n_params),
+            flumpy.from_numpy(g),
+            flumpy.from_numpy(intensities),
+            flumpy.from_numpy(w),
+            flumpy.from_numpy(Ih),
+        )
+
+
 def test_IhTable_split_into_blocks(
     large_reflection_table, small_reflection_table, test_sg
 ):
@@ -6,9 +6,14 @@
 
 from dials.algorithms.scaling.basis_functions import RefinerCalculator
 from dials.algorithms.scaling.model.components.scale_components import (
+    LinearDoseDecay,
     SingleBScaleFactor,
     SingleScaleFactor,
 )
+from dials.algorithms.scaling.model.components.smooth_scale_components import (
+    SmoothBScaleComponent1D,
+    SmoothScaleComponent1D,
+)
 from dials.algorithms.scaling.parameter_handler import scaling_active_parameter_manager
 from dials.array_family import flex
 
@@ -109,3 +114,48 @@ def test_RefinerCalculator(small_reflection_table):
     apm = scaling_active_parameter_manager(components, [])
     _, d = RefinerCalculator.calculate_scales_and_derivatives(apm, 0)
     assert d.n_cols == 0 and d.n_rows == 0
+
+
+@pytest.mark.parametrize("nthreads", [1, 2])
+def test_RefinerCalculator_native(nthreads):
+    """Test that the native evaluation of the components gives the same scales
+    and derivatives as evaluating the components one by one."""
+    n = 20
+    x = flex.double(range(n)) * 0.5
+    d_values = flex.double([1.0 + 0.1 * i for i in range(n)])
+    components = {
+        "scale": SmoothScaleComponent1D(flex.double([1.0, 1.1, 0.9, 1.2, 1.05])),
+        "decay": SmoothBScaleComponent1D(flex.double([0.0, -0.5, 0.3, 0.2])),
+        "dose": LinearDoseDecay(flex.double([0.02])),
+        "fixed": SingleScaleFactor(flex.double([1.5])),
+    }
+    components["scale"].data = {"x": x}
+    components["decay"].data = {"x": x, "d": d_values}
+    components["dose"].data = {"x": x, "d": d_values}
+    components["fixed"].data = {"id": flex.int(n, 0)}
+    components["scale"].fix_initial_parameter()
+    for component in components.values():
+        component.update_reflection_data()
+
+    for selection in (["scale", "decay", "dose"], ["decay"]):
+        apm = scaling_active_parameter_manager(components, selection)
+        s, d = RefinerCalculator.calculate_scales_and_derivatives(apm, 0)
+        native_s, native_d = RefinerCalculator.calculate_scales_and_derivatives(
+            apm, 0, native=True, nthreads=nthreads
+        )
+        assert list(native_s) == pytest.approx(list(s))
+        assert (native_d.n_rows, native_d.n_cols) == (d.n_rows, d.n_cols)
+        assert native_d.n_cols == apm.n_active_params
+        for i in range(d.n_rows):
+            for j in range(d.n_cols):
+                assert native_d[i, j] == pytest.approx(d[i, j])
+
+        # The evaluator is kept while the reflection data are unchanged
+        evaluator = apm.scale_evaluators[0][1]
+        apm.set_param_vals(apm.get_param_vals() * 1.01)
+        s, _ = RefinerCalculator.calculate_scales_and_derivatives(apm, 0)
+        native_s, _ = RefinerCalculator.calculate_scales_and_derivatives(
+            apm, 0, native=True, nthreads=nthreads
+        )
+        assert apm.scale_evaluators[0][1] is evaluator
+        assert list(native_s) == pytest.approx(list(s))
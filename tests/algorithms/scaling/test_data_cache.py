@@ -0,0 +1,104 @@
+"""Tests for the persistent cache of prepared scaling data."""
+
+import os
+import random
+
+import numpy as np
+import pytest
+
+from cctbx import sgtbx
+from dxtbx import flumpy
+
+from dials.algorithms.scaling import data_cache
+from dials.algorithms.scaling.Ih_table import (
+    cached_map_indices_to_asu,
+    map_indices_to_asu,
+)
+from dials.algorithms.scaling.scaling_utilities import sph_harm_table
+from dials.array_family import flex
+
+
+@pytest.fixture
+def cache_dir(tmp_path):
+    directory = str(tmp_path / "cache")
+    data_cache.set_cache_directory(directory)
+    yield directory
+    data_cache.set_cache_directory(None)
+
+
+def test_scaling_data_cache(tmp_path):
+    cache = data_cache.ScalingDataCache(str(tmp_path))
+    inputs = [np.arange(10, dtype=np.float64), np.ones((3, 2), dtype=np.int32)]
+    calls = []
+
+    def compute():
+        calls.append(1)
+        return {"a": np.arange(5), "b": np.zeros((2, 3))}
+
+    first = cache.get_or_compute("test", inputs, {"x": 1}, compute)
+    second = cache.get_or_compute("test", inputs, {"x": 1}, compute)
+    assert len(calls) == 1
+    assert isinstance(second["a"], np.memmap)
+    for name in ("a", "b"):
+        assert np.array_equal(first[name], second[name])
+
+    # different inputs or parameters give a new entry
+    cache.get_or_compute("test", inputs, {"x": 2}, compute)
+    cache.get_or_compute("test", [inputs[0] + 1, inputs[1]], {"x": 1}, compute)
+    assert len(calls) == 3
+    assert len([f for f in os.listdir(str(tmp_path)) if f.startswith("test-")]) == 3
+    assert not [f for f in os.listdir(str(tmp_path)) if f.startswith(".tmp")]
+
+
+def test_cached_sph_harm_table(cache_dir):
+    random.seed(0)
+    table = flex.reflection_table()
+    for col in ("s0c", "s1c"):
+        vectors = flex.vec3_double(
+            [tuple(random.gauss(0, 1) for _ in range(3)) for _ in range(50)]
+        )
+        table[col] = vectors.each_normalize()
+    data_cache.set_cache_directory(None)
+    expected = sph_harm_table(table, 4)
+    data_cache.set_cache_directory(cache_dir)
+    for _ in range(2):
+        result = sph_harm_table(table, 4)
+        assert result.n_rows == expected.n_rows
+        assert result.n_cols == expected.n_cols
+        assert flumpy.to_numpy(result.as_dense_matrix()) == pytest.approx(
+            flumpy.to_numpy(expected.as_dense_matrix())
+        )
+    assert len(os.listdir(cache_dir)) == 1
+
+
+def test_cached_map_indices_to_asu(cache_dir):
+    space_group = sgtbx.space_group_info("P 41 21 2").group()
+    indices = flex.miller_index([(1, 2, 3), (-2, 1, -3), (3, -1, 5), (0, 0, -4)])
+    for anomalous in (False, True):
+        expected = map_indices_to_asu(indices, space_group, anomalous)
+        for _ in range(2):
+            result = cached_map_indices_to_asu(indices, space_group, anomalous)
+            assert list(result) == list(expected)
+    assert len(os.listdir(cache_dir)) == 2
+
+
+def test_shared_in_memory(tmp_path):
+    calls = []
+
+    def compute():
+        calls.append(1)
+        return {"a": np.arange(5)}
+
+    inputs = [np.arange(10, dtype=np.float64)]
+    with data_cache.shared_in_memory() as cache:
+        assert data_cache.active_cache() is cache
+        first = data_cache.cached("test", inputs, {}, compute)
+        # the directory cache of a scaling run doesn't replace the shared data
+        data_cache.set_cache_directory(str(tmp_path))
+        second = data_cache.cached("test", inputs, {}, compute)
+        data_cache.set_cache_directory(None)
+        assert second["a"] is first["a"]
+        assert not first["a"].flags.writeable
+        assert len(cache) == 1
+    assert len(calls) == 1
+    assert data_cache.active_cache() is None
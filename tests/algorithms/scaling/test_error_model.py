@@ -8,6 +8,7 @@
 import pytest
 
 from cctbx.sgtbx import space_group
+from dxtbx import flumpy
 from libtbx import phil
 
 from dials.algorithms.scaling.error_model.engine import ErrorModelRefinery
@@ -21,6 +22,7 @@
 from dials.algorithms.scaling.Ih_table import IhTable
 from dials.array_family import flex
 from dials.util.options import ArgumentParser
+from dials_scaling_ext import sum_in_bins
 
 
 @pytest.fixture()
@@ -233,6 +235,27 @@ def test_errormodel(large_reflection_table, test_sg):
     assert list(delta_hl) == pytest.approx(expected_deltas)
 
 
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_sum_in_bins(nthreads):
+    rng = np.random.default_rng(0)
+    values = rng.normal(size=100000)
+    # reflections with bin index n_bins are not in any bin
+    bin_index = rng.integers(0, 11, size=values.size).astype(np.uint64)
+    sums, sums_of_squares = sum_in_bins(
+        flumpy.from_numpy(values), flumpy.from_numpy(bin_index), 10, nthreads
+    )
+    assert len(sums) == len(sums_of_squares) == 10
+    for i in range(10):
+        sel = bin_index == i
+        assert sums[i] == pytest.approx(np.sum(values[sel]))
+        assert sums_of_squares[i] == pytest.approx(np.sum(np.square(values[sel])))
+
+    # the sums do not depend on the number of threads
+    assert list(sums) == list(
+        sum_in_bins(flumpy.from_numpy(values), flumpy.from_numpy(bin_index), 10)[0]
+    )
+
+
 def test_error_model_target(large_reflection_table, test_sg):
     """Test the error model target."""
     Ih_table = IhTable([large_reflection_table], test_sg, nblocks=1)
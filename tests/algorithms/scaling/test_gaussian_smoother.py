@@ -3,6 +3,7 @@
 import pytest
 
 from dials.algorithms.scaling.model.components.smooth_scale_components import (
+    GaussianSmoother1D,
     GaussianSmoother2D,
     GaussianSmoother3D,
 )
@@ -95,3 +96,45 @@ def test_3DGaussianSmoother():
     assert GS3D.num_x_average() == 2
     assert GS3D.num_y_average() == 3
     assert GS3D.num_y_average() == 3
+
+
+def test_cached_weights():
+    """Test that cached weights give the same values as multi_value_weight"""
+    x = flex.double([0.1 * i for i in range(40)])
+    y = flex.double([0.05 * i for i in range(40)])
+    z = flex.double([0.075 * i for i in range(40)])
+    smoothers = [
+        (GaussianSmoother1D([0, 4], 3), "multi_weight", (x,)),
+        (GaussianSmoother1D([0, 4], 3), "multi_weight_first_fixed", (x,)),
+        (GaussianSmoother2D([0, 4], 3, [0, 2], 2), "multi_weight", (x, y)),
+        (
+            GaussianSmoother3D([0, 4], 3, [0, 2], 2, [0, 3], 1),
+            "multi_weight",
+            (x, y, z),
+        ),
+    ]
+    for smoother, method, coords in smoothers:
+        if method == "multi_weight_first_fixed":
+            multi_value_weight = smoother.multi_value_weight_first_fixed
+        else:
+            multi_value_weight = smoother.multi_value_weight
+        weights = smoother.cached_weights(0, method, *coords)
+        assert smoother.cached_weights(0, method, *coords) is weights
+        n = weights.get_weight().n_cols
+        if method == "multi_weight_first_fixed":
+            n += 1
+        for scale in (1.0, 2.0):
+            parameters = flex.double([scale * (1.0 + 0.1 * i) for i in range(n)])
+            value, weight, sumw = multi_value_weight(*coords, parameters)
+            assert list(weights.multi_value(parameters)) == list(value)
+            assert list(weights.get_sumweight()) == list(sumw)
+            assert list(weights.get_weight().as_dense_matrix()) == list(
+                weight.as_dense_matrix()
+            )
+
+        # New coordinates or smoothing parameters give new weights
+        copies = [c.deep_copy() for c in coords]
+        assert smoother.cached_weights(0, method, *copies) is not weights
+        weights = smoother.cached_weights(0, method, *coords)
+        smoother.set_smoothing(2, -1.0)
+        assert smoother.cached_weights(0, method, *coords) is not weights
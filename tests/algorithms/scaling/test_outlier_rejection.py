@@ -4,10 +4,13 @@
 
 from unittest.mock import Mock
 
+import numpy as np
 import pytest
 
 from cctbx import uctbx
 from cctbx.sgtbx import space_group
+from dxtbx import flumpy
+from scitbx import sparse
 
 from dials.algorithms.scaling.Ih_table import IhTable
 from dials.algorithms.scaling.outlier_rejection import (
@@ -16,10 +19,10 @@
     TargetedOutlierRejection,
     determine_Esq_outlier_index_arrays,
     determine_outlier_index_arrays,
-    limit_outlier_weights,
     reject_outliers,
 )
 from dials.array_family import flex
+from dials_scaling_ext import IhTableGroups, limit_outlier_weights
 
 
 @pytest.fixture(scope="module")
@@ -249,6 +252,53 @@ def test_limit_outlier_weights():
     assert all(i <= 0.1 for i in new_weights)
 
 
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_IhTableGroups_outlier_methods(nthreads):
+    rng = np.random.default_rng(0)
+    n_groups = 200
+    group_ids = rng.integers(0, n_groups, size=2000).astype(np.uint64)
+    I = rng.normal(100.0, 10.0, size=group_ids.size)
+    I[::97] = 1000.0
+    g = rng.uniform(0.5, 2.0, size=group_ids.size)
+    w = rng.uniform(0.5, 2.0, size=group_ids.size)
+    groups = IhTableGroups(flumpy.from_numpy(group_ids), n_groups, nthreads)
+
+    # weight limiting matches the sparse matrix implementation
+    h_index_matrix = sparse.matrix(
+        group_ids.size,
+        n_groups,
+        [
+            dict.fromkeys(np.nonzero(group_ids == i)[0].tolist(), 1.0)
+            for i in range(n_groups)
+        ],
+    )
+    expected = limit_outlier_weights(flumpy.from_numpy(w), h_index_matrix)
+    assert list(groups.limit_outlier_weights(flumpy.from_numpy(w))) == list(expected)
+
+    # the outlier in each group is the largest deviation from the other members
+    outliers, others = groups.determine_outlier_indices(
+        flumpy.from_numpy(I), flumpy.from_numpy(g), flumpy.from_numpy(w), 6.0
+    )
+    outliers = set(outliers)
+    assert outliers
+    nh = np.bincount(group_ids.astype(np.int64), minlength=n_groups)
+    for i in range(n_groups):
+        members = np.nonzero(group_ids == i)[0]
+        if nh[i] <= 2:
+            assert not outliers.intersection(members)
+            continue
+        z = []
+        for j in members:
+            sel = members[members != j]
+            wg2 = np.sum(w[sel] * g[sel] * g[sel])
+            Ih = np.sum(w[sel] * g[sel] * I[sel]) / wg2
+            z.append(abs(I[j] - g[j] * Ih) / np.sqrt(1.0 / w[j] + g[j] ** 2 / wg2))
+        worst = members[int(np.argmax(z))]
+        assert (worst in outliers) == (max(z) > 6.0)
+        assert len(outliers.intersection(members)) <= 1
+    assert not outliers.intersection(others)
+
+
 def test_multi_dataset_outlier_rejection(test_sg):
     """Test outlier rejection with two datasets."""
     rt1 = flex.reflection_table()
@@ -17,6 +17,7 @@
     select_connected_reflections_across_datasets,
 )
 from dials.array_family import flex
+from dials_scaling_ext import quasi_random_selection
 
 
 def test_select_connected_reflections_across_datasets():
@@ -127,6 +128,31 @@ def test_loop_over_class_matrix():
     assert list(total_in_classes) == [11.0, 7.0, 13.0]
 
 
+def test_quasi_random_selection():
+    """Test the native selection with the groups of the example above in each
+    of two resolution bins (with an empty bin between them)."""
+    n_per_class = [[3, 3, 2, 0, 1, 1, 1], [0, 2, 0, 0, 3, 2, 1], [2, 1, 1, 5, 0, 4, 0]]
+    group_ids = flex.size_t()
+    class_ids = flex.size_t()
+    bin_ids = flex.size_t()
+    for ibin, offset in ((0, 0), (2, 7)):
+        for class_id, n_list in enumerate(n_per_class):
+            for group, n in enumerate(n_list):
+                group_ids.extend(flex.size_t(n, group + offset))
+                class_ids.extend(flex.size_t(n, class_id))
+                bin_ids.extend(flex.size_t(n, ibin))
+    expected_rows = [0, 1, 2, 3, 4, 5, 8, 9] + list(range(11, 18))
+    expected_rows += [19, 20, 21, 28, 29, 30, 31]
+    for nthreads in (1, 3):
+        selection, n_groups_used, n_selected, totals = quasi_random_selection(
+            group_ids, class_ids, bin_ids, 14, 3, 3, 2, 30, 36, nthreads=nthreads
+        )
+        assert list(selection) == expected_rows + [i + 32 for i in expected_rows]
+        assert list(n_groups_used) == [4, 0, 4]
+        assert list(n_selected) == [22, 0, 22]
+        assert list(totals) == [8.0, 7.0, 7.0, 0.0, 0.0, 0.0, 8.0, 7.0, 7.0]
+
+
 def generated_param():
     """Generate a param phil scope."""
     phil_scope = phil.parse(
@@ -7,6 +7,7 @@
 import numpy as np
 import pytest
 
+from dxtbx import flumpy
 from dxtbx.model import (
     Beam,
     Crystal,
@@ -392,6 +393,36 @@ def test_create_sph_harm_table(test_reflection_table, test_experiment_singleaxis
     # Now test that you get the same by just calling the function.
 
 
+@pytest.mark.parametrize("lmax", [1, 4])
+def test_sph_harm_table_orthonormal(lmax):
+    """Test that the terms are orthonormal over the sphere, integrating with a
+    Gauss-Legendre rule in cos(theta), and that the lookup table gives the same
+    values at its grid points."""
+    x, w = np.polynomial.legendre.leggauss(20)
+    phi = np.arange(36) * 2 * pi / 36
+    theta_phi = flex.vec2_double([(t, p) for t in np.arccos(x) for p in phi])
+    weights = np.repeat(w, len(phi)) * 2 * pi / len(phi)
+    sph_h_t = create_sph_harm_table(theta_phi, theta_phi, lmax)
+    assert sph_h_t.n_rows == lmax * (lmax + 2)
+    assert sph_h_t.n_cols == len(theta_phi)
+    terms = flumpy.to_numpy(sph_h_t.as_dense_matrix())
+    overlap = (terms * weights) @ terms.T
+    assert overlap.ravel() == pytest.approx(np.identity(len(terms)).ravel(), abs=1e-8)
+
+    # The lookup table with one point per degree is indexed by theta * 360 + phi
+    coefficients = create_sph_harm_lookup_table(lmax, 1)
+    assert len(coefficients) == lmax * (lmax + 2)
+    corners = [(t, p) for t in (0, 1, 45, 90, 179) for p in (0, 7, 300)]
+    sph_h_t = create_sph_harm_table(
+        flex.vec2_double([(t * pi / 180, p * pi / 180) for t, p in corners]),
+        flex.vec2_double([(t * pi / 180, p * pi / 180) for t, p in corners]),
+        lmax,
+    )
+    for i, c in enumerate(coefficients):
+        for j, (t, p) in enumerate(corners):
+            assert c[t * 360 + p] == pytest.approx(sph_h_t[i, j], abs=1e-12)
+
+
 def test_calculate_wilson_outliers(wilson_test_reflection_table):
     """Test the set wilson outliers function."""
     reflection_table = set_wilson_outliers(wilson_test_reflection_table)
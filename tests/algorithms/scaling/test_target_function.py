@@ -23,6 +23,7 @@
 from dials.algorithms.scaling.target_function import ScalingTarget, ScalingTargetFixedIH
 from dials.array_family import flex
 from dials.util.options import ArgumentParser
+from dials_scaling_ext import IhTableGroups
 
 
 @pytest.fixture
@@ -129,6 +130,7 @@ def mock_single_Ih_table():
     Ih_table.derivatives = sparse.matrix(3, 1, [{0: 1.0, 1: 2.0, 2: 3.0}])
     Ih_table.h_index_matrix = sparse.matrix(3, 2, [{0: 1, 1: 1}, {2: 1}])
     Ih_table.h_expand_matrix = Ih_table.h_index_matrix.transpose()
+    Ih_table.groups = IhTableGroups(flex.size_t([0, 0, 1]), 2)
     Ih_table._csc_h_index_matrix = csc_matrix(
         (np.array([1, 1, 1]), (np.array([0, 1, 2]), np.array([0, 0, 1])))
     )
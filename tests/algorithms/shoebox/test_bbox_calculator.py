@@ -8,6 +8,7 @@
 
 from dials.algorithms.profile_model.gaussian_rs import (
     BBoxCalculator3D,
+    BBoxMultiCalculator,
     CoordinateSystem,
 )
 
@@ -177,3 +178,32 @@ def test_radius(setup):
             if bbox[2] > 0 and bbox[3] < height:
                 assert math.sqrt(e11 ** 2 + e21 ** 2) >= radius12
                 assert math.sqrt(e12 ** 2 + e22 ** 2) >= radius12
+
+
+def test_threaded(setup):
+    from dials.array_family import flex
+
+    s0_length = matrix.col(setup["beam"].get_s0()).length()
+    s1 = flex.vec3_double()
+    z = flex.double()
+    for i in range(1000):
+        x = random.uniform(0, 2000)
+        y = random.uniform(0, 2000)
+        s1.append(
+            matrix.col(setup["detector"][0].get_pixel_lab_coord((x, y))).normalize()
+            * s0_length
+        )
+        z.append(random.uniform(0, 9))
+    panel = flex.size_t(len(s1), 0)
+
+    # Check the threaded calculation gives the same bounding boxes
+    expected = setup["calculate_bbox"](s1, z, panel)
+    bbox = setup["calculate_bbox"](s1, z, panel, 4)
+    assert list(bbox) == list(expected)
+
+    multi = BBoxMultiCalculator()
+    multi.append(setup["calculate_bbox"])
+    multi.append(setup["calculate_bbox"])
+    ids = flex.size_t([i % 2 for i in range(len(s1))])
+    assert list(multi(ids, s1, z, panel)) == list(expected)
+    assert list(multi(ids, s1, z, panel, 4)) == list(expected)
@@ -68,6 +68,57 @@ def test_multiple_panels():
         assert edge in edges
 
 
+def test_adjacent_vertices():
+    from dials.array_family import flex
+
+    nrefl = 500
+    bbox = flex.int6(nrefl)
+    for i in range(nrefl):
+        x0 = random.randint(0, 200)
+        y0 = random.randint(0, 200)
+        z0 = random.randint(0, 10)
+        bbox[i] = (x0, x0 + 8, y0, y0 + 8, z0, z0 + 5)
+
+    overlaps = find_overlapping(bbox)
+    expected = {i: [] for i in range(nrefl)}
+    for i, j in brute_force(bbox):
+        expected[i].append(j)
+        expected[j].append(i)
+
+    # The rows of the adjacency list are sorted and agree with the edges
+    for i in range(nrefl):
+        adjacent = list(overlaps.adjacent_vertices(i))
+        assert adjacent == sorted(expected[i])
+        assert overlaps.vertex_num_edges(i) == len(adjacent)
+    edges = [(overlaps.source(e), overlaps.target(e)) for e in overlaps.edges()]
+    assert edges == sorted(edges)
+    assert len(edges) == 2 * overlaps.num_edges()
+
+
+def test_multiple_threads():
+    from dials.algorithms.shoebox import OverlapFinder
+    from dials.array_family import flex
+
+    nrefl = 2000
+    bbox = flex.int6(nrefl)
+    panel = flex.size_t(nrefl)
+    for i in range(nrefl):
+        x0 = random.randint(0, 300)
+        y0 = random.randint(0, 300)
+        z0 = random.randint(0, 10)
+        bbox[i] = (x0, x0 + random.randint(1, 20), y0, y0 + 6, z0, z0 + 3)
+        panel[i] = random.randint(0, 3)
+    ids = flex.size_t(nrefl, 0)
+
+    def edges(overlaps):
+        return [(overlaps.source(e), overlaps.target(e)) for e in overlaps.edges()]
+
+    expected = edges(find_overlapping(bbox, panel))
+    assert len(expected) == 2 * len(brute_force(bbox, panel))
+    assert edges(find_overlapping(bbox, panel, nthreads=4)) == expected
+    assert edges(OverlapFinder(nthreads=4)(ids, panel, bbox)) == expected
+
+
 def brute_force(bbox, panel=None):
     overlaps = []
     if panel is None:
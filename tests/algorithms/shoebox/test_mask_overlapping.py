@@ -1,4 +1,5 @@
 import numpy as np
+import pytest
 
 
 def predict_reflections(sequence, crystal):
@@ -41,7 +42,8 @@ def predict_reflections(sequence, crystal):
     return predicted, overlaps
 
 
-def test(dials_data):
+@pytest.mark.parametrize("by_cluster", [False, True])
+def test(dials_data, by_cluster):
     from dxtbx.serialize import load
 
     from dials.algorithms import shoebox
@@ -68,7 +70,7 @@ def test(dials_data):
     image_size = detector[0].get_image_size()
     shoeboxes = reflections["shoebox"]
     coords = reflections["xyzcal.px"]
-    shoebox_masker = shoebox.MaskOverlapping()
+    shoebox_masker = shoebox.MaskOverlapping(by_cluster=by_cluster)
     shoebox_masker(shoeboxes, coords, adjacency_list)
 
     # Loop through all edges
@@ -0,0 +1,36 @@
+import random
+
+from dials.algorithms.shoebox import MaskCode, OverloadChecker
+from dials.array_family import flex
+from dials.model.data import Shoebox
+
+
+def test_overload_checker():
+    random.seed(0)
+    shoeboxes = flex.shoebox(30)
+    for i in range(30):
+        shoeboxes[i] = Shoebox(i % 2, (0, 4, 0, 3, i, i + 2))
+        shoeboxes[i].allocate()
+        for k in range(len(shoeboxes[i].data)):
+            shoeboxes[i].data[k] = random.uniform(0, 120)
+            shoeboxes[i].mask[k] = MaskCode.Valid | MaskCode.Foreground
+    ids = flex.int(i % 3 for i in range(30))
+    arena = flex.shoebox_arena.from_shoeboxes(shoeboxes)
+
+    overloads = ((100, 110), (115, 119), (200, 200))
+    checker = OverloadChecker()
+    for overload in overloads:
+        checker.add(flex.double(overload))
+
+    result = checker(ids, shoeboxes)
+    assert list(checker(ids, arena)) == list(result)
+    for i, sbox in enumerate(shoeboxes):
+        overload = overloads[ids[i]][sbox.panel]
+        overloaded = [v >= overload for v in sbox.data]
+        assert result[i] == any(overloaded)
+        for k, over in enumerate(overloaded):
+            expected = MaskCode.Foreground
+            if not over:
+                expected |= MaskCode.Valid
+            assert sbox.mask[k] == expected
+            assert arena[i].mask[k] == expected
@@ -66,3 +66,15 @@ def test(dials_data):
     # Should have all partials
     assert len(partiality) == len(predicted)
     assert partiality.all_le(1.0) and partiality.all_gt(0)
+
+    # Check the threaded and approximate calculations agree
+    threaded = calculator(
+        predicted["s1"], predicted["xyzcal.px"].parts()[2], predicted["bbox"], 4
+    )
+    assert list(threaded) == list(partiality)
+    assert not calculator.fast_erf
+    calculator.fast_erf = True
+    approximate = calculator(
+        predicted["s1"], predicted["xyzcal.px"].parts()[2], predicted["bbox"], 4
+    )
+    assert flex.max(flex.abs(approximate - partiality)) < 2e-7
@@ -20,3 +20,52 @@ def test_simulation(dials_data):
     B = 10
     simulate = Simulator(experiments[0], sigma_b, sigma_m, n_sigma)
     simulate.with_random_intensity(N, In, B, 0, 0, 0)
+
+
+def test_simulation_batch(dials_data):
+    from dials.algorithms.shoebox import MaskCode
+    from dials.algorithms.simulation import (
+        integrate_reciprocal_space_gaussian_batch,
+        simulate_reciprocal_space_gaussian_batch,
+    )
+    from dials.array_family import flex
+
+    experiments = ExperimentListFactory.from_json_file(
+        dials_data("centroid_test_data").join("experiments.json").strpath,
+        check_format=False,
+    )
+    experiment = experiments[0]
+    sigma_b = 0.058 * math.pi / 180
+    sigma_m = 0.157 * math.pi / 180
+    simulate = Simulator(experiment, sigma_b, sigma_m, 3)
+    refl = simulate.generate_predictions(50)
+    In = flex.int(len(refl), 500)
+
+    def run(function, nthreads, seed=1234):
+        return function(
+            experiment.beam,
+            experiment.detector,
+            experiment.goniometer,
+            experiment.scan,
+            sigma_b,
+            sigma_m,
+            refl["s1"],
+            refl["xyzcal.mm"].parts()[2],
+            In,
+            refl["shoebox"],
+            seed,
+            nthreads,
+        )
+
+    # The result depends on the seed but not on the number of threads
+    expected = run(integrate_reciprocal_space_gaussian_batch, 1)
+    assert list(run(integrate_reciprocal_space_gaussian_batch, 4)) == list(expected)
+    assert list(run(integrate_reciprocal_space_gaussian_batch, 1, 1)) != list(expected)
+    assert flex.sum(expected) > 0.5 * flex.sum(In)
+
+    # The simulated shoeboxes see the same events
+    counts = run(simulate_reciprocal_space_gaussian_batch, 3)
+    assert list(counts) == list(expected)
+    for sbox, n in zip(refl["shoebox"], counts):
+        foreground = (sbox.mask & MaskCode.Foreground) != 0
+        assert flex.sum(sbox.data.as_1d().select(foreground.as_1d())) == n
@@ -3,7 +3,9 @@
 #include <iostream>
 #include <sstream>
 #include <deque>
+#include <algorithm>
 #include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/algorithms/spatial_indexing/parallel_detect_collisions.h>
 
 struct Box {
   int x0, y0, x1, y1;
@@ -189,9 +191,54 @@ void tst_detect_3d() {
   std::cout << "OK" << std::endl;
 }
 
+std::vector<std::pair<int, int> > sorted_pairs(
+  const std::vector<std::pair<int, int> > &collisions) {
+  std::vector<std::pair<int, int> > result(collisions);
+  for (std::size_t i = 0; i < result.size(); ++i) {
+    if (result[i].first > result[i].second) {
+      std::swap(result[i].first, result[i].second);
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+void tst_parallel_detect_3d() {
+  int num = 10000;
+  std::vector<Box3d> data(num);
+  std::vector<std::pair<int, int> > collisions1;
+
+  Box3d bounds(0, 0, 0, 512, 512, 512);
+
+  // Create a load of random boxes
+  for (std::size_t i = 0; i < num; ++i) {
+    data[i] = random_box3d(bounds, 3, 8);
+  }
+
+  // The serial result
+  detect_collisions3d(data.begin(), data.end(), collisions1);
+  collisions1 = sorted_pairs(collisions1);
+
+  // Check the same collisions are found with any number of threads and leaf
+  // size, and the result does not depend on the number of threads
+  std::size_t leaf_size[] = {2, 10, 32, 100};
+  for (std::size_t j = 0; j < 4; ++j) {
+    std::vector<std::pair<int, int> > collisions2;
+    std::vector<std::pair<int, int> > collisions3;
+    detect_collisions3d(data.begin(), data.end(), collisions2, 1, leaf_size[j]);
+    detect_collisions3d(data.begin(), data.end(), collisions3, 4, leaf_size[j]);
+    assert(collisions2 == collisions3);
+    assert(sorted_pairs(collisions2) == collisions1);
+  }
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
 int main(int argc, char const *argv[]) {
   tst_detect_2d();
   tst_detect_3d();
+  tst_parallel_detect_3d();
 
   return 0;
 }
@@ -0,0 +1,36 @@
+import json
+
+from dxtbx.model.experiment_list import ExperimentListFactory
+
+from dials.array_family import flex
+from dials.command_line.find_spots import phil_scope
+from dials.util.phil import parse
+
+
+def test_spot_finding_timing_file(dials_data, tmp_path):
+    filenames = dials_data("centroid_test_data").listdir("*.cbf", sort=True)
+    experiments = ExperimentListFactory.from_filenames(f.strpath for f in filenames)
+    timing_file = tmp_path / "timing.json"
+    params = phil_scope.fetch(
+        source=parse(f"spotfinder.timing_file={timing_file}")
+    ).extract()
+    reflections = flex.reflection_table.from_observations(experiments, params)
+
+    with timing_file.open() as fh:
+        stats = json.load(fh)
+
+    # One record for each frame with the strong pixel count
+    frames = stats["frames"]
+    assert [f["frame"] for f in frames] == list(range(len(filenames)))
+    for f in frames:
+        assert set(f["time"]) == {"read", "threshold", "pixel_list"}
+        assert f["strong_pixels"] > 0
+
+    # One record for the labelling of the whole sequence
+    (stage,) = stats["stages"]
+    assert stage["stage"] == "extract_spots"
+    assert stage["num_frames"] == len(filenames)
+    assert set(stage["time"]) == {"shoeboxes", "centroids", "filter"}
+    assert stage["spots"] == len(reflections)
+    assert stage["components"] >= stage["spots"]
+    assert stage["bytes"] > 0
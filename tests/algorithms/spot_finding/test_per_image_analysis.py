@@ -144,3 +144,39 @@ def test_plot_stats(centroid_test_data, tmpdir):
     image_file = tmpdir.join("pia.png")
     per_image_analysis.plot_stats(stats, filename=image_file.strpath)
     assert image_file.check()
+
+
+def test_per_image_statistics(centroid_test_data):
+    experiments, reflections = centroid_test_data
+    expected = per_image_analysis.stats_per_image(
+        experiments[0], reflections, resolution_analysis=False
+    )
+
+    # Spots which have not been mapped to reciprocal space use the resolution
+    # maps of the panels
+    strong = reflections.copy()
+    del strong["rlp"]
+    stats = per_image_analysis.stats_per_image(
+        experiments[0], strong, resolution_analysis=False
+    )
+    assert stats.n_spots_total == expected.n_spots_total
+    assert stats.n_spots_4A == pytest.approx(expected.n_spots_4A, abs=2)
+    assert stats.n_spots_no_ice == pytest.approx(expected.n_spots_no_ice, abs=2)
+
+    # The statistics from two halves of the spots can be merged
+    statistics = per_image_analysis.per_image_statistics(experiments[0])
+    half = per_image_analysis.per_image_statistics(experiments[0])
+    n = len(strong) // 2
+    for s, refl in ((statistics, strong[:n]), (half, strong[n:])):
+        s.add_pixels(
+            refl["panel"], refl["xyzobs.px.value"], refl["intensity.sum.value"]
+        )
+    statistics.merge(half)
+    assert list(statistics.n_spots_total()) == stats.n_spots_total
+    assert list(statistics.n_spots_no_ice()) == stats.n_spots_no_ice
+    assert list(statistics.total_intensity()) == pytest.approx(stats.total_intensity)
+    histogram = statistics.histogram()
+    assert histogram.all() == (statistics.num_images(), 20)
+    assert flex.sum(histogram.as_1d()) == sum(stats.n_spots_no_ice)
+    assert len(statistics.bin_edges()) == 21
+    assert statistics.num_rejected() == 0
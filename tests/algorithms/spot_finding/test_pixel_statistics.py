@@ -0,0 +1,63 @@
+import pickle
+import random
+
+import pytest
+
+from dials.algorithms.spot_finding import PixelStatistics
+from dials.array_family import flex
+
+
+def _images(n, size, seed=0):
+    random.seed(seed)
+    images = []
+    for _ in range(n):
+        data = flex.double([random.uniform(-10, 110) for _ in range(size[0] * size[1])])
+        data.reshape(flex.grid(size))
+        mask = flex.bool(flex.grid(size), True)
+        mask[0, 0] = False
+        images.append((data, mask, data > 50))
+    return images
+
+
+def test_pixel_statistics():
+    size = (13, 7)
+    images = _images(20, size)
+    statistics = PixelStatistics(size, 0, 100)
+    for data, mask, strong in images:
+        statistics.add(data, mask, strong, nthreads=3)
+    assert statistics.num_images() == 20
+    assert statistics.size() == size
+
+    for j, i in [(0, 0), (0, 1), (6, 3), (12, 6)]:
+        values = [d[j, i] for d, m, s in images if m[j, i]]
+        trusted = [v for v in values if 0 <= v <= 100]
+        assert statistics.count()[j, i] == len(trusted)
+        assert statistics.num_untrusted()[j, i] == len(values) - len(trusted)
+        assert statistics.num_strong()[j, i] == len([v for v in trusted if v > 50])
+        if trusted:
+            mean = sum(trusted) / len(trusted)
+            variance = sum((v - mean) ** 2 for v in trusted) / (len(trusted) - 1)
+            assert statistics.mean()[j, i] == pytest.approx(mean)
+            assert statistics.variance()[j, i] == pytest.approx(variance)
+        else:
+            assert statistics.variance()[j, i] == 0
+
+
+def test_pixel_statistics_merge():
+    size = (9, 5)
+    images = _images(12, size, seed=1)
+    whole = PixelStatistics(size, 0, 100)
+    first = PixelStatistics(size, 0, 100)
+    second = PixelStatistics(size, 0, 100)
+    for k, (data, mask, strong) in enumerate(images):
+        whole.add(data, mask, strong)
+        (first if k < 5 else second).add(data, mask, strong)
+
+    # The statistics of other processes are merged after pickling
+    first.merge(pickle.loads(pickle.dumps(second)))
+    assert first.num_images() == whole.num_images()
+    assert list(first.count()) == list(whole.count())
+    assert list(first.num_strong()) == list(whole.num_strong())
+    assert list(first.num_untrusted()) == list(whole.num_untrusted())
+    assert list(first.mean()) == pytest.approx(list(whole.mean()))
+    assert list(first.variance()) == pytest.approx(list(whole.variance()))
@@ -0,0 +1,73 @@
+from dials.algorithms.spot_finding import StrongSpotCombiner
+from dials.array_family import flex
+
+
+def make_shoeboxes(bboxes):
+    shoeboxes = flex.shoebox(flex.size_t(len(bboxes), 0), flex.int6(bboxes))
+    shoeboxes.allocate_with_value(5)
+    return shoeboxes
+
+
+def test_strong_spot_combiner():
+    # Two blocks of frames 0-5 and 5-10
+    block1 = make_shoeboxes([(0, 5, 0, 5, 0, 2), (10, 20, 10, 20, 3, 5)])
+    block2 = make_shoeboxes(
+        [
+            (15, 25, 15, 25, 5, 7),
+            (100, 110, 100, 110, 5, 6),
+            (200, 210, 200, 210, 8, 10),
+        ]
+    )
+
+    combiner = StrongSpotCombiner()
+    combiner.add(block1)
+    combiner.add(block2)
+    shoeboxes = combiner.shoeboxes()
+
+    # Only the spots touching at the block boundary should be merged
+    bboxes = sorted(tuple(s.bbox) for s in shoeboxes)
+    assert bboxes == [
+        (0, 5, 0, 5, 0, 2),
+        (10, 25, 10, 25, 3, 7),
+        (100, 110, 100, 110, 5, 6),
+        (200, 210, 200, 210, 8, 10),
+    ]
+
+    # The merged shoebox only has the pixels of the two input shoeboxes
+    merged = [s for s in shoeboxes if tuple(s.bbox) == (10, 25, 10, 25, 3, 7)][0]
+    assert merged.count_mask_values(5) == 10 * 10 * 2 + 10 * 10 * 2
+
+
+def test_strong_spot_combiner_take_ownership():
+    bboxes1 = [(0, 5, 0, 5, 0, 2), (10, 20, 10, 20, 3, 5)]
+    bboxes2 = [
+        (15, 25, 15, 25, 5, 7),
+        (100, 110, 100, 110, 5, 6),
+        (200, 210, 200, 210, 8, 10),
+    ]
+    block1 = make_shoeboxes(bboxes1)
+    block2 = make_shoeboxes(bboxes2)
+
+    combiner = StrongSpotCombiner(take_ownership=True)
+    combiner.add(block1)
+    combiner.add(block2)
+
+    # The buffers have been taken from the input
+    assert block1.is_allocated().count(True) == 0
+    assert block2.is_allocated().count(True) == 0
+
+    shoeboxes = combiner.shoeboxes()
+    expected = StrongSpotCombiner()
+    expected.add(make_shoeboxes(bboxes1))
+    expected.add(make_shoeboxes(bboxes2))
+    expected = expected.shoeboxes()
+
+    assert sorted(tuple(s.bbox) for s in shoeboxes) == sorted(
+        tuple(s.bbox) for s in expected
+    )
+    assert sorted(shoeboxes.count_mask_values(5)) == sorted(
+        expected.count_mask_values(5)
+    )
+
+    # The combiner is reset once the result is handed over
+    assert len(combiner.shoeboxes()) == 0
@@ -27,3 +27,34 @@ def test(dials_data):
         h0 = r["miller_index"]
         h1 = transform.h(panel, x, y, z)
         assert h0 == pytest.approx(h1, abs=1e-7)
+
+
+def test_h_grid(dials_data):
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms.spot_prediction import PixelToMillerIndex
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+
+    experiments = ExperimentListFactory.from_json_file(filename)
+
+    transform = PixelToMillerIndex(
+        experiments[0].beam,
+        experiments[0].detector,
+        experiments[0].goniometer,
+        experiments[0].scan,
+        experiments[0].crystal,
+    )
+
+    width, height = experiments[0].detector[0].get_image_size()
+    for z in (0.5, 4.5):
+        grid = transform.h_grid(0, z)
+        assert grid.all() == (height, width)
+        for j in range(0, height, 97):
+            for i in range(0, width, 89):
+                assert grid[j * width + i] == transform.h(0, i + 0.5, j + 0.5, z)
+
+        # The result does not depend on the number of threads
+        threaded = transform.h_grid(0, z, nthreads=4)
+        for a, b in zip(grid.parts(), threaded.parts()):
+            assert a.all_eq(b)
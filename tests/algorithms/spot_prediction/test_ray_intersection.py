@@ -0,0 +1,57 @@
+import random
+
+from dxtbx.model import Detector, ParallaxCorrectedPxMmStrategy
+from scitbx import matrix
+
+from dials.algorithms.spot_prediction import ray_intersection
+from dials.array_family import flex
+
+
+def make_detector():
+    """A detector of slightly tilted panels, some with a parallax correction"""
+    detector = Detector()
+    for j in range(4):
+        for i in range(4):
+            angle = 0.01 * ((4 * j + i) % 3 - 1)
+            fast = matrix.col((1, 0, 0)).rotate_around_origin(
+                matrix.col((0, 1, 0)), angle
+            )
+            p = detector.add_panel()
+            p.set_image_size((200, 100))
+            p.set_pixel_size((0.1, 0.1))
+            p.set_frame(
+                fast.elems, (0, 1, 0), (-40 + 20.5 * i, -20 + 10.5 * j, -100 - j)
+            )
+            if (i + j) % 2:
+                p.set_px_mm_strategy(ParallaxCorrectedPxMmStrategy(2.0, 0.5))
+    return detector
+
+
+def test_ray_intersection_matches_detector():
+    detector = make_detector()
+    random.seed(0)
+    s1 = flex.vec3_double(
+        [
+            (random.uniform(-0.5, 0.5), random.uniform(-0.3, 0.3), -1)
+            for _ in range(2000)
+        ]
+    )
+
+    reflections = flex.reflection_table()
+    reflections["s1"] = s1
+    reflections["phi"] = flex.double(len(s1), 0)
+    reflections["panel"] = flex.size_t(len(s1), 0)
+    reflections["xyzcal.mm"] = flex.vec3_double(len(s1))
+    success = ray_intersection(detector, reflections)
+
+    assert success.count(True) > 0
+    assert success.count(False) > 0
+    for i, s in enumerate(s1):
+        try:
+            panel, xy = detector.get_ray_intersection(s)
+        except RuntimeError:
+            assert not success[i]
+            continue
+        assert success[i]
+        assert reflections["panel"][i] == panel
+        assert reflections["xyzcal.mm"][i][0:2] == xy
@@ -130,3 +130,53 @@ def test_versus_brute_force():
 
     for oi in obs_indices:
         assert tuple(map(int, oi)) in reeke_indices
+
+
+def test_systematic_absences():
+    """Check the absences are the same as those from the space group, for the
+    same generated indices as in P1"""
+
+    a = 50.0
+    ub_beg = matrix.sqr((1.0 / a, 0.0, 0.0, 0.0, 1.0 / a, 0.0, 0.0, 0.0, 1.0 / a))
+    axis = matrix.col((0, 1, 0))
+    r_osc = matrix.sqr(
+        r3_rotation_axis_and_angle_as_matrix(axis=axis, angle=1.0, deg=True)
+    )
+    ub_end = r_osc * ub_beg
+    s0 = matrix.col((0, 0, 1))
+    dmin = 1.5
+
+    p1 = space_group_info("P 1").group()
+    all_indices = ReekeIndexGenerator(
+        ub_beg, ub_end, p1.type(), axis, s0, dmin, margin=1
+    ).to_array()
+
+    for symbol in ("P 21 21 21", "I 21 21 21", "P 61 2 2", "F d -3 m", "P 41 3 2"):
+        sg = space_group_info(symbol).group()
+        expected = [h for h in all_indices if not sg.is_sys_absent(h)]
+        indices = ReekeIndexGenerator(
+            ub_beg, ub_end, sg.type(), axis, s0, dmin, margin=1
+        ).to_array()
+        assert list(indices) == expected
+
+
+def test_independent_generators():
+    """Check that generators do not share their state"""
+
+    a = 50.0
+    ub = matrix.sqr((1.0 / a, 0.0, 0.0, 0.0, 1.0 / a, 0.0, 0.0, 0.0, 1.0 / a))
+    axis = matrix.col((0, 1, 0))
+    s0 = matrix.col((0, 0, 1))
+    sg = space_group_info("P 1").group()
+    expected = ReekeIndexGenerator(ub, ub, sg.type(), axis, s0, 1.5, 1).to_array()
+
+    r1 = ReekeIndexGenerator(ub, ub, sg.type(), axis, s0, 1.5, 1)
+    r2 = ReekeIndexGenerator(ub, ub, sg.type(), axis, s0, 1.5, 1)
+    indices1 = []
+    indices2 = []
+    for _ in range(len(expected)):
+        indices1.append(r1.next())
+        indices2.append(r2.next())
+    assert indices1 == list(expected)
+    assert indices2 == list(expected)
+    assert r1.next() == (0, 0, 0)
@@ -106,3 +106,29 @@ def test(dials_regression, run_in_tmpdir):
 
         # Check the Phi values are the same
         assert xds_phi == pytest.approx(my_phi, abs=0.1)
+
+
+def test_batch():
+    import random
+
+    from dials.algorithms.spot_prediction import RotationAngles
+    from dials.array_family import flex
+
+    ra = RotationAngles((0.01, 0.02, -1.0), (1.0, 0.01, 0.02))
+
+    random.seed(0)
+    pstar0 = flex.vec3_double(
+        [tuple(random.uniform(-1.5, 1.5) for _ in range(3)) for _ in range(1000)]
+    )
+    phi1, phi2, valid = ra.batch(pstar0)
+    assert valid.count(True) > 0
+    assert valid.count(False) > 0
+    for p, a, b, v in zip(pstar0, phi1, phi2, valid):
+        try:
+            expected = ra(p)
+        except RuntimeError:
+            assert not v
+            assert (a, b) == (0, 0)
+            continue
+        assert v
+        assert (a, b) == tuple(expected)
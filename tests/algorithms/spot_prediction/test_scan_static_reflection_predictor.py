@@ -117,6 +117,40 @@ def test_with_old_index_generator(data):
         )
 
 
+@pytest.mark.parametrize("method", ["for_ub", "for_ub_old_index_generator"])
+def test_threads(data, method):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+    A = data.experiments[0].crystal.get_A()
+    r1 = getattr(predict, method)(A)
+    r2 = getattr(predict, method)(A, nthreads=4)
+    assert len(r1) > 0
+    assert len(r1) == len(r2)
+    for key in ("miller_index", "panel", "entering", "s1", "xyzcal.px", "flags"):
+        assert list(r1[key]) == list(r2[key])
+
+
+def test_frame_range(data):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+    from dials.array_family import flex
+
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+    A = data.experiments[0].crystal.get_A()
+    r1 = predict.for_ub(A)
+
+    # Predicting consecutive blocks of frames gives the same reflections
+    z0, z1 = predict.frame_range()
+    assert (z0, z1) == data.experiments[0].scan.get_array_range()
+    r2 = flex.reflection_table()
+    for frame in range(z0, z1, 3):
+        r2.extend(predict.for_ub_on_frame_range(A, frame, min(frame + 3, z1)))
+    assert len(r1) > 0
+    assert len(r1) == len(r2)
+    for key in ("miller_index", "panel", "entering", "s1", "xyzcal.px", "flags"):
+        assert list(r1[key]) == list(r2[key])
+
+
 def test_with_reflection_table(data):
     from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
     from dials.array_family import flex
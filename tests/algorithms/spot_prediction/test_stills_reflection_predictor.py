@@ -158,3 +158,75 @@ def test_spherical_relps():
         denom = sqrt(radicand)
         s1 = es_radius * (q + s0) / denom
         assert approx_equal(s1, ref["s1"])
+
+
+def _make_stills(model, n):
+    """Copies of the experiment with rotated crystals and slightly different
+    beams, sharing the detector"""
+    import copy
+
+    from dxtbx.model.experiment_list import Experiment, ExperimentList
+
+    experiments = ExperimentList()
+    for i in range(n):
+        crystal = copy.deepcopy(model.crystal)
+        axis = matrix.col((1, 2, 3 + i)).normalize()
+        R = axis.axis_and_angle_as_r3_rotation_matrix(10 * i, deg=True)
+        crystal.set_U(R * matrix.sqr(crystal.get_U()))
+        beam = copy.deepcopy(model.beam)
+        beam.set_wavelength(1.0 + 0.01 * i)
+        experiments.append(
+            Experiment(
+                beam=beam,
+                detector=model.detector,
+                crystal=crystal,
+                imageset=None,
+            )
+        )
+    return experiments
+
+
+@pytest.mark.parametrize("nave_model", [True, False], ids=["nave", "native"])
+def test_for_ub_multi(nave_model):
+    from dials.algorithms.spot_prediction import StillsReflectionPredictor
+    from dials.array_family import flex
+    from dials_array_family_flex_ext import unit_cell
+
+    model = Model(test_nave_model=nave_model)
+    experiments = _make_stills(model, 5)
+    ub = flex.mat3_double([e.crystal.get_A() for e in experiments])
+    cells = unit_cell(len(experiments))
+    for i, e in enumerate(experiments):
+        cells[i] = e.crystal.get_unit_cell()
+    s0 = flex.vec3_double([e.beam.get_s0() for e in experiments])
+
+    predictor = StillsReflectionPredictor(experiments[0], dmin=1.5)
+    for nthreads in (1, 3):
+        result = predictor.for_ub_multi(ub, cells, s0, nthreads=nthreads)
+        assert set(result["id"]) == set(range(len(experiments)))
+        for i, e in enumerate(experiments):
+            expected = StillsReflectionPredictor(e, dmin=1.5).for_ub(
+                e.crystal.get_A()
+            )
+            subset = result.select(result["id"] == i)
+            for key in ("miller_index", "panel", "s1", "xyzcal.px", "delpsical.rad"):
+                assert list(subset[key]) == list(expected[key])
+
+
+def test_from_predictions_multi_stills():
+    from dials.array_family import flex
+
+    model = Model()
+    experiments = _make_stills(model, 4)
+    for i, e in enumerate(experiments):
+        e.identifier = str(i)
+    result = flex.reflection_table.from_predictions_multi(
+        experiments, dmin=2.0, dmax=20.0
+    )
+    assert dict(result.experiment_identifiers()) == {i: str(i) for i in range(4)}
+    for i, e in enumerate(experiments):
+        expected = flex.reflection_table.from_predictions(e, dmin=2.0, dmax=20.0)
+        subset = result.select(result["id"] == i)
+        assert len(expected) > 0
+        assert list(subset["miller_index"]) == list(expected["miller_index"])
+        assert list(subset["xyzcal.mm"]) == list(expected["xyzcal.mm"])
@@ -0,0 +1,74 @@
+import random
+
+import pytest
+
+from dials.algorithms.statistics import (
+    BinnedGMMSingle1D,
+    BinnedGMMSingle1DBatch,
+    BinnedGMMSingle1DFixedMean,
+)
+from dials.array_family import flex
+
+
+def _histograms(nhist, nbins):
+    random.seed(0)
+    edges = flex.double([-6.0 + 12.0 * i / nbins for i in range(nbins + 1)])
+    histograms = []
+    for j in range(nhist):
+        mu, sigma = 0.5 + 0.01 * j, 1.0 + 0.02 * j
+        n = flex.double(nbins, 0)
+        for _ in range(2000):
+            x = random.gauss(mu, sigma)
+            i = int((x - edges[0]) / (edges[1] - edges[0]))
+            if 0 <= i < nbins:
+                n[i] += 1
+        histograms.append(n)
+    counts = flex.double()
+    for n in histograms:
+        counts.extend(n)
+    counts.reshape(flex.grid(nhist, nbins))
+    return edges, histograms, counts
+
+
+@pytest.mark.parametrize("fixed_mean", [False, True])
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_binned_gmm_batch(fixed_mean, nthreads):
+    nhist, nbins = 50, 40
+    edges, histograms, counts = _histograms(nhist, nbins)
+    a, b = edges[:-1], edges[1:]
+    mu0 = flex.double(nhist, 0.5)
+    sigma0 = flex.double(nhist, 2.0)
+
+    batch = BinnedGMMSingle1DBatch(
+        edges,
+        counts,
+        mu0,
+        sigma0,
+        fixed_mean=fixed_mean,
+        epsilon=1e-7,
+        max_iter=1000,
+        nthreads=nthreads,
+    )
+    single_type = BinnedGMMSingle1DFixedMean if fixed_mean else BinnedGMMSingle1D
+    for j, n in enumerate(histograms):
+        single = single_type(a, b, n, 0.5, 2.0, 1e-7, 1000)
+        assert batch.mu()[j] == pytest.approx(single.mu())
+        assert batch.sigma()[j] == pytest.approx(single.sigma())
+        assert batch.num_iter()[j] == pytest.approx(single.num_iter(), abs=1)
+
+    # starting each fit from the previous histogram gives the same answers in
+    # fewer iterations
+    warm = BinnedGMMSingle1DBatch(
+        edges,
+        counts,
+        mu0,
+        sigma0,
+        fixed_mean=fixed_mean,
+        warm_start=True,
+        epsilon=1e-7,
+        max_iter=1000,
+        nthreads=nthreads,
+    )
+    assert list(warm.mu()) == pytest.approx(list(batch.mu()), abs=1e-2)
+    assert list(warm.sigma()) == pytest.approx(list(batch.sigma()), abs=1e-2)
+    assert sum(warm.num_iter()) < sum(batch.num_iter())
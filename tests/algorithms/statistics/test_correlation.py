@@ -0,0 +1,114 @@
+import random
+
+import pytest
+
+from dials.algorithms.statistics import (
+    CCHalfSigmaTauAccumulator,
+    PearsonCorrelationAccumulator,
+    PerGroupCCHalf,
+    pearson_correlation_coefficient,
+)
+from dials.array_family import flex
+
+
+def test_pearson_correlation_accumulator():
+    random.seed(0)
+    x = flex.double([random.gauss(0, 1) for _ in range(100)])
+    y = x + flex.double([random.gauss(0, 0.5) for _ in range(100)])
+    acc = PearsonCorrelationAccumulator()
+    for xi, yi in zip(x, y):
+        acc.add(xi, yi)
+    assert acc.n() == 100
+    assert acc.coefficient() == pytest.approx(pearson_correlation_coefficient(x, y))
+
+    # leave out each pair in turn
+    for i in (0, 17, 99):
+        acc.remove(x[i], y[i])
+        sel = flex.bool(100, True)
+        sel[i] = False
+        assert acc.coefficient() == pytest.approx(
+            pearson_correlation_coefficient(x.select(sel), y.select(sel))
+        )
+        acc.add(x[i], y[i])
+
+    # merge two halves
+    first, second = PearsonCorrelationAccumulator(), PearsonCorrelationAccumulator()
+    for i in range(100):
+        (first if i < 40 else second).add(x[i], y[i])
+    first.add(second)
+    assert first.n() == 100
+    assert first.coefficient() == pytest.approx(acc.coefficient())
+
+
+def _cchalf(means, variances):
+    n = len(means)
+    mean_of_means = sum(means) / n
+    sigma_e = sum(variances) / n
+    sigma_y = sum((m - mean_of_means) ** 2 for m in means) / (n - 1)
+    return (sigma_y - sigma_e) / (sigma_y + sigma_e)
+
+
+def _mean_cchalf(unique_index, unique_bin, n_bins, intensity, keep):
+    """A direct calculation of the mean CC 1/2 in resolution bins"""
+    observations = {}
+    for h, i, k in zip(unique_index, intensity, keep):
+        if k:
+            observations.setdefault(h, []).append(i)
+    bins = [([], []) for _ in range(n_bins)]
+    for h, values in observations.items():
+        n = len(values)
+        if n > 1:
+            mean = sum(values) / n
+            var = sum((v - mean) ** 2 for v in values) / (n - 1) / n
+            bins[unique_bin[h]][0].append(mean)
+            bins[unique_bin[h]][1].append(var)
+    total = count = 0
+    for means, variances in bins:
+        if len(means) > 1:
+            total += len(means) * _cchalf(means, variances)
+            count += len(means)
+    return total / count
+
+
+def test_cchalf_sigma_tau_accumulator():
+    random.seed(0)
+    means = [random.uniform(10, 100) for _ in range(50)]
+    variances = [random.uniform(1, 10) for _ in range(50)]
+    acc = CCHalfSigmaTauAccumulator()
+    for m, v in zip(means, variances):
+        acc.add(m, v)
+    assert acc.n() == 50
+    assert acc.cchalf() == pytest.approx(_cchalf(means, variances))
+    acc.remove(means[0], variances[0])
+    assert acc.cchalf() == pytest.approx(_cchalf(means[1:], variances[1:]))
+
+
+def test_per_group_cchalf():
+    random.seed(0)
+    n_unique, n_bins, n_groups = 200, 4, 6
+    unique_bin = flex.size_t([random.randrange(n_bins) for _ in range(n_unique)])
+    true_intensity = [random.uniform(10, 1000) for _ in range(n_unique)]
+    unique_index = flex.size_t([random.randrange(n_unique) for _ in range(2000)])
+    group = flex.size_t([random.randrange(n_groups) for _ in unique_index])
+    intensity = flex.double([random.gauss(true_intensity[h], 20) for h in unique_index])
+    # make one group bad
+    for i, g in enumerate(group):
+        if g == 3:
+            intensity[i] = random.uniform(0, 1000)
+
+    result = PerGroupCCHalf(
+        unique_index, unique_bin, n_bins, intensity, group, n_groups
+    )
+    assert result.mean_cchalf() == pytest.approx(
+        _mean_cchalf(unique_index, unique_bin, n_bins, intensity, [True] * 2000)
+    )
+    excluded = result.cchalf_excluding_groups()
+    assert len(excluded) == n_groups
+    for g in range(n_groups):
+        assert excluded[g] == pytest.approx(
+            _mean_cchalf(
+                unique_index, unique_bin, n_bins, intensity, [x != g for x in group]
+            )
+        )
+    # excluding the bad group improves the CC 1/2 the most
+    assert max(range(n_groups), key=lambda g: excluded[g]) == 3
@@ -260,3 +260,36 @@ def test_fast_mcd_large(dials_regression):
     # Correction factors
     assert approx_equal(fast_mcd._consistency_fac, 2.45659976388)
     assert approx_equal(fast_mcd._finite_samp_fac, 1.00193273884)
+
+
+def test_fast_mcd_nthreads():
+    # the trials are shared between threads, but each has its own random seed
+    # so the result should not depend on the number of threads
+    import random
+
+    from scitbx.array_family import flex
+
+    from dials.algorithms.statistics.fast_mcd import FastMCD
+
+    random.seed(0)
+    data = [
+        flex.double([random.gauss(0, i + 1) for _ in range(1000)]) for i in range(3)
+    ]
+    for i in range(0, 1000, 10):
+        for col in data:
+            col[i] += 20
+
+    results = []
+    for nthreads in (1, 4):
+        random.seed(42)
+        flex.set_random_seed(42)
+        fast_mcd = FastMCD(data, nthreads=nthreads)
+        results.append(fast_mcd.get_raw_T_and_S())
+
+    (T1, S1), (T2, S2) = results
+    assert list(T1) == list(T2)
+    assert list(S1) == list(S2)
+
+    # the outliers should not affect the location estimate
+    for t in T1:
+        assert abs(t) < 0.5
@@ -0,0 +1,43 @@
+import random
+
+from dials.algorithms.statistics import (
+    kolmogorov_smirnov_test_standard_normal,
+    kolmogorov_smirnov_test_standard_normal_batch,
+    poisson_expected_max_counts,
+)
+from dials.array_family import flex
+
+
+def test_kolmogorov_smirnov_test_batch():
+    random.seed(0)
+    samples = [
+        flex.double(random.gauss(0, 1) for _ in range(n)) for n in (0, 5, 100, 3000)
+    ]
+    samples.append(flex.double(random.gauss(2, 1) for _ in range(100)))
+    data = flex.double()
+    for sample in samples:
+        data.extend(sample)
+    size = flex.size_t(len(sample) for sample in samples)
+
+    for kstype in ("less", "greater", "two_sided"):
+        d, p = kolmogorov_smirnov_test_standard_normal_batch(data, size, kstype)
+        d4, p4 = kolmogorov_smirnov_test_standard_normal_batch(
+            data, size, kstype, nthreads=4
+        )
+        assert list(d) == list(d4)
+        assert list(p) == list(p4)
+        assert (d[0], p[0]) == (0, 1)
+        for i, sample in enumerate(samples[1:], start=1):
+            assert (d[i], p[i]) == kolmogorov_smirnov_test_standard_normal(
+                sample, kstype
+            )
+    assert p[-1] < 1e-6
+
+
+def test_poisson_expected_max_counts_batch():
+    mean = flex.double([0.1, 1, 10, 100, 1000, 10])
+    nobs = flex.size_t([10, 100, 1000, 50, 5, 1])
+    expected = [poisson_expected_max_counts(m, n) for m, n in zip(mean, nobs)]
+    assert list(poisson_expected_max_counts(mean, nobs)) == expected
+    assert list(poisson_expected_max_counts(mean, nobs, nthreads=3)) == expected
+    assert expected[-1] == 1
@@ -50,3 +50,52 @@ def test_cosym_target(space_group):
         assert f < f0
         assert pytest.approx(g, abs=1e-3) == [0] * len(g)
         assert pytest.approx(g_fd, abs=1e-3) == [0] * len(g)
+
+
+def test_pairwise_correlation():
+    pd = pytest.importorskip("pandas")
+    from dials_algorithms_symmetry_cosym_ext import PairwiseCorrelation
+
+    rng = np.random.default_rng(42)
+    n_columns = 20
+    n_obs = 1000
+    columns = rng.integers(n_columns, size=n_obs)
+    indices = 1000 + 7 * rng.integers(100, size=n_obs)
+    values = rng.normal(1e4, 100, size=n_obs)
+    # A column with a constant value has no defined correlation coefficients
+    values[columns == 3] = 5
+
+    # The dense matrix of intensities, where repeated observations are replaced
+    # by the last one
+    unique, rows = np.unique(indices, return_inverse=True)
+    dense = np.full((len(unique), n_columns), np.nan)
+    dense[rows, columns] = values
+    expected = pd.DataFrame(dense).corr(min_periods=3).values
+    np.nan_to_num(expected, copy=False)
+    np.fill_diagonal(expected, 0)
+    present = np.isfinite(dense).astype(int)
+    expected_counts = present.T @ present
+    np.fill_diagonal(expected_counts, 0)
+
+    correlation = PairwiseCorrelation(
+        flex.size_t(columns.astype(np.uint64)),
+        flex.size_t(indices.astype(np.uint64)),
+        flex.double(values),
+        n_columns,
+    )
+    assert correlation.n_indices() == len(unique)
+    assert correlation.n_observations() == np.count_nonzero(present)
+    for nthreads in (1, 4):
+        rij, counts = correlation.matrix(min_pairs=3, nthreads=nthreads)
+        np.testing.assert_allclose(rij.as_numpy_array(), expected, atol=1e-12)
+        assert (counts.as_numpy_array() == expected_counts).all()
+    assert not rij.as_numpy_array()[3].any()
+
+    # Selected entries give the same values as the full matrix
+    first = flex.size_t([0, 5, 7, 19, 2])
+    second = flex.size_t([1, 5, 3, 0, 18])
+    rij, counts = correlation.pairs(first, second, min_pairs=3, nthreads=2)
+    np.testing.assert_allclose(
+        list(rij), expected[list(first), list(second)], atol=1e-12
+    )
+    assert list(counts) == list(expected_counts[list(first), list(second)])
@@ -8,6 +8,7 @@
     ScoreCorrelationCoefficient,
     ScoreSubGroup,
     ScoreSymmetryElement,
+    symmetry_element_pairs,
 )
 
 
@@ -110,3 +111,40 @@ def test_score_symmetry_element_subgroup(space_group):
             assert score.likelihood > 0.8
         else:
             assert score.likelihood < 0.1
+
+
+@pytest.mark.parametrize("space_group", ["P2", "P4", "P6", "I23"])
+def test_symmetry_element_pairs(space_group):
+    sgi = sgtbx.space_group_info(symbol=space_group)
+    cs = sgi.any_compatible_crystal_symmetry(volume=10000).minimum_cell()
+    intensities = (
+        generate_intensities(cs, d_min=2.0)
+        .set_observation_type_xray_intensity()
+        .expand_to_p1()
+        .map_to_asu()
+    )
+    subgroups = metric_subgroups(
+        intensities.crystal_symmetry(), max_delta=2.0, bravais_types_only=False
+    )
+    lattice_group = subgroups.result_groups[0]["subsym"].space_group()
+    sym_ops = [s for s in lattice_group.smx() if s.r().info().sense() >= 0]
+
+    pairs = symmetry_element_pairs(intensities, sym_ops, nproc=2)
+    assert len(pairs) == len(sym_ops)
+    for sym_op, op_pairs in zip(sym_ops, pairs):
+        # Compare with reindexing the intensities and taking the common sets
+        cb_op = sgtbx.change_of_basis_op(sym_op)
+        cb_ops = [cb_op]
+        if sym_op.r().order() > 2:
+            cb_ops.append(cb_op.inverse())
+        assert len(op_pairs) == len(cb_ops)
+        for cb_op, (x, y) in zip(cb_ops, op_pairs):
+            if cb_op.is_identity_op():
+                cb_op = sgtbx.change_of_basis_op("-x,-y,-z")
+            reindexed = intensities.change_basis(cb_op).map_to_asu()
+            xe, ye = intensities.common_sets(
+                reindexed, assert_is_similar_symmetry=False
+            )
+            sel = sgtbx.space_group().expand_smx(sym_op).epsilon(xe.indices()) == 1
+            assert list(x) == list(xe.data().select(sel))
+            assert list(y) == list(ye.data().select(sel))
@@ -0,0 +1,56 @@
+import random
+
+import pytest
+
+from dials.array_family import flex
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_bin_indexer_statistics(nthreads):
+    random.seed(0)
+    n = 1000
+    binner = flex.Binner(flex.double([0, 1, 2, 3, 4]))
+    indexer = binner.indexer(flex.double([random.uniform(0, 4) for _ in range(n)]))
+    x = flex.double([random.gauss(10, 2) for _ in range(n)])
+    y = flex.double([random.uniform(-1, 1) for _ in range(n)])
+    w = flex.double([random.uniform(0.5, 2) for _ in range(n)])
+    sel = flex.bool([random.random() < 0.5 for _ in range(n)])
+
+    stats = indexer.statistics(
+        [x, y], weights=[w, w], mask=[flex.bool(n, True), sel], nthreads=nthreads
+    )
+    assert stats.nbins() == len(binner)
+    assert stats.ncols() == 2
+
+    for col, values, mask in [(0, x, flex.bool(n, True)), (1, y, sel)]:
+        assert list(stats.count(col)) == list(indexer.sum(mask))
+        for i in range(len(binner)):
+            in_bin = flex.bool(n, False)
+            in_bin.set_selected(indexer.indices(i), True)
+            v = values.select(in_bin & mask)
+            wv = w.select(in_bin & mask)
+            if len(v) == 0:
+                assert stats.count(col)[i] == 0
+                assert stats.mean(col)[i] == 0
+                assert stats.min(col)[i] == 0
+                continue
+            assert stats.sum(col)[i] == pytest.approx(flex.sum(v))
+            assert stats.sum_sq(col)[i] == pytest.approx(flex.sum(v * v))
+            assert stats.min(col)[i] == flex.min(v)
+            assert stats.max(col)[i] == flex.max(v)
+            assert stats.mean(col)[i] == pytest.approx(flex.mean(v))
+            assert stats.sum_weights(col)[i] == pytest.approx(flex.sum(wv))
+            assert stats.weighted_mean(col)[i] == pytest.approx(
+                flex.sum(wv * v) / flex.sum(wv)
+            )
+            if len(v) > 1:
+                assert stats.variance(col)[i] == pytest.approx(
+                    flex.mean_and_variance(v).unweighted_sample_variance()
+                )
+
+    # the results do not depend on the number of threads, and the mean matches
+    # the existing per-bin mean
+    single = indexer.statistics([x], nthreads=1)
+    assert list(single.sum(0)) == list(stats.sum(0))
+    assert list(single.mean(0)) == pytest.approx(list(indexer.mean(x)))
+    assert list(single.weighted_mean(0)) == pytest.approx(list(indexer.mean(x)))
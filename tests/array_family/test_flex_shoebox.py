@@ -137,3 +137,155 @@ def test_bounding_boxes():
     bbox2 = shoebox.bounding_boxes()
     for i in range(10):
         assert bbox2[i] == bbox[i]
+
+
+def test_shoebox_arena():
+    import pickle
+
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    random.seed(0)
+    shoeboxes = flex.shoebox(20)
+    for i in range(20):
+        x0, y0, z0 = (random.randint(0, 100) for _ in range(3))
+        bbox = (
+            x0,
+            x0 + random.randint(1, 5),
+            y0,
+            y0 + random.randint(1, 5),
+            z0,
+            z0 + random.randint(1, 5),
+        )
+        shoeboxes[i] = Shoebox(i % 3, bbox)
+        if i % 4:
+            shoeboxes[i].allocate()
+            for k in range(len(shoeboxes[i].data)):
+                shoeboxes[i].data[k] = random.uniform(0, 100)
+                shoeboxes[i].background[k] = random.uniform(0, 10)
+                shoeboxes[i].mask[k] = random.choice([0, 1, 3, 5])
+
+    arena = flex.shoebox_arena.from_shoeboxes(shoeboxes)
+    assert len(arena) == 20
+    assert list(arena.panels()) == list(shoeboxes.panels())
+    assert list(arena.bounding_boxes()) == list(shoeboxes.bounding_boxes())
+    assert len(arena.data()) == sum(len(s.data) for s in shoeboxes)
+    for i in range(20):
+        assert arena.is_allocated(i) == bool(i % 4)
+        assert arena.npixels(i) == len(shoeboxes[i].data)
+    for i in range(20):
+        assert arena[i] == shoeboxes[i]
+    assert list(arena.count_mask_values(1)) == list(shoeboxes.count_mask_values(1))
+    for a, b in zip(arena.summed_intensity(), shoeboxes.summed_intensity()):
+        assert a.observed.value == b.observed.value
+        assert a.background.value == b.background.value
+
+    # round trip through the arrays
+    unpacked = pickle.loads(pickle.dumps(arena)).shoeboxes()
+    assert all(a == b for a, b in zip(unpacked, shoeboxes))
+
+    # allocate straight from the panels and bounding boxes
+    arena = flex.shoebox_arena(
+        shoeboxes.panels(), shoeboxes.bounding_boxes(), allocate=True
+    )
+    allocated = flex.shoebox(shoeboxes.panels(), shoeboxes.bounding_boxes(), True)
+    assert list(arena.offsets())[-1] == sum(len(s.data) for s in allocated)
+    for i in range(20):
+        assert arena[i] == allocated[i]
+
+
+def test_batch_centroid():
+    import pytest
+
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    random.seed(0)
+    shoeboxes = flex.shoebox(50)
+    for i in range(50):
+        x0, y0, z0 = (random.randint(0, 100) for _ in range(3))
+        bbox = (
+            x0,
+            x0 + random.randint(1, 5),
+            y0,
+            y0 + random.randint(1, 5),
+            z0,
+            z0 + random.randint(1, 5),
+        )
+        shoeboxes[i] = Shoebox(0, bbox)
+        shoeboxes[i].allocate()
+        for k in range(len(shoeboxes[i].data)):
+            shoeboxes[i].data[k] = random.uniform(0, 100)
+            shoeboxes[i].background[k] = random.uniform(0, 50)
+            shoeboxes[i].mask[k] = random.choice([1, 3, 5])
+
+    arena = flex.shoebox_arena.from_shoeboxes(shoeboxes)
+    for minus_background in (False, True):
+        if minus_background:
+            expected = [s.centroid_masked_minus_background(3) for s in shoeboxes]
+            results = (
+                shoeboxes.centroid_masked_minus_background(3, nthreads=4),
+                arena.centroid_masked_minus_background(3, nthreads=4),
+            )
+        else:
+            expected = [s.centroid_masked(3) for s in shoeboxes]
+            results = (
+                shoeboxes.centroid_masked(3, nthreads=4),
+                arena.centroid_masked(3, nthreads=4),
+            )
+        for result in results:
+            assert len(result) == len(expected)
+            for a, b in zip(result, expected):
+                assert a.px.position == pytest.approx(b.px.position, rel=1e-4)
+                assert a.px.variance == pytest.approx(b.px.variance, rel=1e-3)
+
+
+def test_batch_summed_intensity():
+    import pytest
+
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    random.seed(0)
+    shoeboxes = flex.shoebox(50)
+    for i in range(50):
+        x0, y0, z0 = (random.randint(0, 100) for _ in range(3))
+        bbox = (
+            x0,
+            x0 + random.randint(1, 5),
+            y0,
+            y0 + random.randint(1, 5),
+            z0,
+            z0 + random.randint(1, 5),
+        )
+        shoeboxes[i] = Shoebox(0, bbox)
+        shoeboxes[i].allocate()
+        for k in range(len(shoeboxes[i].data)):
+            shoeboxes[i].data[k] = random.uniform(0, 1e5)
+            shoeboxes[i].background[k] = random.uniform(0, 50)
+            shoeboxes[i].mask[k] = random.choice([1, 5, 5, 5, 19, 19, 37])
+
+    # Sum the pixels directly from the mask codes
+    expected = []
+    for s in shoeboxes:
+        signal = [
+            (d, b)
+            for d, b, m in zip(s.data, s.background, s.mask)
+            if m & 4 and m & 33 == 1
+        ]
+        success = all(m & 33 == 1 for m in s.mask if m & 4)
+        sum_p = sum(d for d, _ in signal)
+        sum_b = sum(b for _, b in signal)
+        expected.append((sum_p - sum_b, sum_b, success))
+
+    arena = flex.shoebox_arena.from_shoeboxes(shoeboxes)
+    for result in (
+        shoeboxes.summed_intensity(),
+        shoeboxes.summed_intensity(nthreads=4),
+        arena.summed_intensity(nthreads=4),
+    ):
+        assert len(result) == len(expected)
+        for a, (value, background, success) in zip(result, expected):
+            assert a.observed.value == pytest.approx(value, rel=1e-6, abs=1e-2)
+            assert a.background.value == pytest.approx(background, rel=1e-6)
+            assert a.observed.success == success
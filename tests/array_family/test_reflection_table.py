@@ -6,7 +6,7 @@
 import pytest
 
 from cctbx import sgtbx
-from dxtbx.model import Crystal, Experiment, ExperimentList
+from dxtbx.model import Beam, Crystal, Experiment, ExperimentList
 from dxtbx.serialize import load
 
 from dials.array_family import flex
@@ -276,6 +276,47 @@ def test_row_operations():
     assert table[10]["col3"] == "hello"
 
 
+@pytest.mark.parametrize("nrows", [10, 100000])
+def test_extend_and_concatenate(nrows):
+    tables = []
+    for i in range(5):
+        table = flex.reflection_table()
+        table["id"] = flex.int(nrows, i)
+        table["x"] = flex.double(range(i * nrows, (i + 1) * nrows))
+        if i % 2:
+            table["name"] = flex.std_string(nrows, str(i))
+        table.experiment_identifiers()[i] = str(i)
+        tables.append(table)
+
+    extended = flex.reflection_table()
+    for table in tables:
+        extended.extend(table)
+        # the columns grow geometrically
+        assert extended.capacity() >= len(extended)
+    assert len(extended) == 5 * nrows
+    assert list(extended["x"]) == list(range(5 * nrows))
+
+    concatenated = flex.reflection_table.concatenate(tables)
+    assert len(concatenated) == 5 * nrows
+    assert sorted(concatenated.keys()) == sorted(extended.keys())
+    for key in ("id", "x", "name"):
+        assert list(concatenated[key]) == list(extended[key])
+    assert list(concatenated["name"][:nrows]) == [""] * nrows
+    assert dict(concatenated.experiment_identifiers()) == {i: str(i) for i in range(5)}
+
+    assert len(flex.reflection_table.concatenate([])) == 0
+    bad = flex.reflection_table()
+    bad["x"] = flex.int(5)
+    with pytest.raises(RuntimeError):
+        flex.reflection_table.concatenate([tables[0], bad])
+
+    table = flex.reflection_table()
+    table["x"] = flex.double(10)
+    table.reserve(1000)
+    assert table.capacity() >= 1000
+    assert len(table) == 10
+
+
 def test_iteration():
     # The columns as lists
     c1 = list(range(10))
@@ -637,6 +678,35 @@ def test_sort():
     ]
 
 
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_sort_permutation(nthreads):
+    random.seed(0)
+    n = 100000
+    ids = [random.randrange(-5, 5) for _ in range(n)]
+    values = [random.randrange(100) * 0.5 for _ in range(n)]
+    table = flex.reflection_table()
+    table["id"] = flex.int(ids)
+    table["flags"] = flex.size_t([random.randrange(1 << 40) for _ in range(n)])
+    table["intensity"] = flex.double(values)
+    table["xyz"] = flex.vec3_double([(v, i, 0) for i, v in zip(ids, values)])
+
+    for reverse in (False, True):
+        for key in ("id", "flags", "intensity", "xyz"):
+            data = list(table[key])
+            expected = sorted(range(n), key=data.__getitem__, reverse=reverse)
+            perm = table.sort_permutation([key], reverse, nthreads)
+            assert list(perm) == expected
+        expected = sorted(range(n), key=lambda i: (ids[i], values[i]), reverse=reverse)
+        perm = table.sort_permutation(["id", "intensity"], reverse, nthreads)
+        assert list(perm) == expected
+
+    # select and reorder large tables on several threads
+    sorted_table = table.select(perm)
+    assert list(sorted_table["flags"]) == [table["flags"][i] for i in perm]
+    table.sort(["id", "intensity"], reverse=True)
+    assert list(table["xyz"]) == list(sorted_table["xyz"])
+
+
 def test_flags():
     # Create a table with flags all 0
     table = flex.reflection_table()
@@ -844,6 +914,12 @@ def get_mask(self, index):
                         assert v1 == 0
                         assert m1 == 0
 
+    # Splitting the reflections of each frame between threads, into an arena
+    arena = flex.shoebox_arena(reflections["panel"], reflections["bbox"], True)
+    reflections.extract_shoeboxes(imageset, nthreads=4, shoeboxes=arena)
+    for i in range(len(reflections)):
+        assert arena[i] == reflections[i]["shoebox"]
+
 
 def test_split_by_experiment_id():
     r = flex.reflection_table()
@@ -1176,6 +1252,171 @@ def compare(a, b):
     assert all(tuple(compare(a, b) for a, b in zip(new_table["col11"], c11)))
 
 
+def test_from_msgpack_columns(tmp_path):
+    table = flex.reflection_table()
+    table["id"] = flex.int([0, 1, 1])
+    table["intensity"] = flex.double([1.0, 2.0, 3.0])
+    table["miller_index"] = flex.miller_index([(1, 0, 0), (0, 1, 0), (0, 0, 1)])
+    table.experiment_identifiers()[0] = "a"
+    table.experiment_identifiers()[1] = "b"
+
+    # from bytes, or any object supporting the buffer protocol
+    packed = table.as_msgpack()
+    for data in (packed, bytearray(packed), memoryview(packed)):
+        new_table = flex.reflection_table.from_msgpack(data, ["intensity", "id"])
+        assert sorted(new_table.keys()) == ["id", "intensity"]
+        assert new_table.nrows() == 3
+        assert list(new_table["intensity"]) == [1.0, 2.0, 3.0]
+        identifiers = new_table.experiment_identifiers()
+        assert list(identifiers.keys()) == [0, 1]
+        assert list(identifiers.values()) == ["a", "b"]
+
+    # from a memory mapped file, or a compressed file
+    for filename in ("table.refl", "table.refl.gz"):
+        path = str(tmp_path / filename)
+        table.as_msgpack_file(path)
+        new_table = flex.reflection_table.from_file(path, columns=["miller_index"])
+        assert list(new_table.keys()) == ["miller_index"]
+        assert list(new_table["miller_index"]) == list(table["miller_index"])
+        new_table = flex.reflection_table.from_file(path)
+        assert sorted(new_table.keys()) == sorted(table.keys())
+
+    # columns that are not in the table are ignored
+    new_table = flex.reflection_table.from_msgpack(packed, ["id", "missing"])
+    assert list(new_table.keys()) == ["id"]
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_msgpack_compressed_columns(tmp_path, nthreads):
+    n = 5000
+    table = flex.reflection_table()
+    table["id"] = flex.int(n, 0)
+    table["flags"] = flex.size_t_range(n)
+    table["intensity"] = flex.double([i * 0.25 for i in range(n)])
+    table["xyzobs.px.value"] = flex.vec3_double(
+        [(i, i + 0.5, i * 0.1) for i in range(n)]
+    )
+    table["miller_index"] = flex.miller_index(
+        [(i % 7, -i % 5, i % 3) for i in range(n)]
+    )
+    table["bbox"] = flex.int6([(0, 3, 0, 3, i % 10, i % 10 + 2) for i in range(n)])
+    table["overload"] = flex.bool([i % 2 == 0 for i in range(n)])
+    table["shoebox"] = flex.shoebox(flex.size_t(n, 0), table["bbox"], allocate=True)
+    table.experiment_identifiers()[0] = "a"
+
+    uncompressed = table.as_msgpack()
+    compressed = table.as_msgpack(compression_level=6, nthreads=nthreads)
+    assert len(compressed) < len(uncompressed) / 4
+    for packed in (uncompressed, compressed):
+        new_table = flex.reflection_table.from_msgpack(packed)
+        assert sorted(new_table.keys()) == sorted(table.keys())
+        for key in table.keys():
+            if key != "shoebox":
+                assert list(new_table[key]) == list(table[key])
+        assert list(new_table["shoebox"].bounding_boxes()) == list(table["bbox"])
+        assert list(new_table.experiment_identifiers().values()) == ["a"]
+
+    path = str(tmp_path / "compressed.refl")
+    table.as_file(path, compression_level=1, nthreads=nthreads)
+    new_table = flex.reflection_table.from_file(path, columns=["intensity", "flags"])
+    assert list(new_table["intensity"]) == list(table["intensity"])
+    assert list(new_table["flags"]) == list(table["flags"])
+
+
+def test_lazy_reflection_table(tmp_path):
+    table = flex.reflection_table()
+    table["id"] = flex.int([0, 1, 1])
+    table["intensity"] = flex.double([1.0, 2.0, 3.0])
+    table["miller_index"] = flex.miller_index([(1, 0, 0), (0, 1, 0), (0, 0, 1)])
+    table.experiment_identifiers()[0] = "a"
+    table.experiment_identifiers()[1] = "b"
+
+    for filename in ("table.refl", "table.refl.gz"):
+        path = str(tmp_path / filename)
+        table.as_msgpack_file(path)
+        with flex.lazy_reflection_table(path) as lazy:
+            assert sorted(lazy.keys()) == sorted(table.keys())
+            assert "intensity" in lazy and "missing" not in lazy
+            assert lazy.column_type("miller_index") == "cctbx::miller::index<>"
+            assert len(lazy) == 3
+            assert list(lazy.experiment_identifiers().values()) == ["a", "b"]
+            assert lazy.loaded_keys() == []
+
+            assert list(lazy["intensity"]) == [1.0, 2.0, 3.0]
+            assert lazy.loaded_keys() == ["intensity"]
+            with pytest.raises(KeyError):
+                lazy["missing"]
+
+            subset = lazy.select_columns(["id", "intensity"])
+            assert sorted(subset.keys()) == ["id", "intensity"]
+            assert list(subset["id"]) == [0, 1, 1]
+            assert list(subset.experiment_identifiers().keys()) == [0, 1]
+
+        # columns already read are still available after closing
+        assert list(lazy["id"]) == [0, 1, 1]
+        with pytest.raises(ValueError):
+            lazy["miller_index"]
+
+
+def test_reflection_file_row_groups(tmp_path):
+    tables = []
+    for i in range(4):
+        table = flex.reflection_table()
+        table["id"] = flex.int([0, 0, 0])
+        table["panel"] = flex.size_t([i % 2] * 3)
+        table["bbox"] = flex.int6(
+            [(0, 5, 0, 5, 10 * i + j, 10 * i + j + 3) for j in range(3)]
+        )
+        table["intensity"] = flex.double([i, i + 0.5, i + 0.25])
+        table.experiment_identifiers()[0] = "a"
+        tables.append(table)
+
+    for filename in ("table.refl", "table.refl.gz"):
+        path = str(tmp_path / filename)
+        with flex.reflection_file_writer(path) as writer:
+            for table in tables:
+                writer.append(table)
+
+        # read as a single table
+        table = flex.reflection_table.from_file(path)
+        assert table.size() == 12
+        assert list(table["intensity"]) == [x for t in tables for x in t["intensity"]]
+        assert list(table.experiment_identifiers().values()) == ["a"]
+        table = flex.reflection_table.from_file(path, columns=["panel"])
+        assert list(table.keys()) == ["panel"]
+        with flex.lazy_reflection_table(path) as lazy:
+            assert sorted(lazy.keys()) == sorted(tables[0].keys())
+            assert len(lazy) == 12
+            assert list(lazy["panel"]) == [x for t in tables for x in t["panel"]]
+
+        # read a group at a time, skipping groups by frame and panel
+        groups = list(flex.reflection_table.iterate_row_groups(path))
+        assert [list(g["intensity"]) for g in groups] == [
+            list(t["intensity"]) for t in tables
+        ]
+        groups = flex.reflection_table.iterate_row_groups(
+            path, columns=["intensity"], frames=(12, 25)
+        )
+        assert [list(g["intensity"]) for g in groups] == [
+            list(t["intensity"]) for t in tables[1:3]
+        ]
+        groups = flex.reflection_table.iterate_row_groups(path, frames=(0, 40), panel=1)
+        assert [g["panel"][0] for g in groups] == [1, 1]
+
+    # a file with a single table is a single group
+    path = str(tmp_path / "single.refl")
+    tables[0].as_file(path)
+    groups = list(flex.reflection_table.iterate_row_groups(path, panel=1))
+    assert len(groups) == 1 and groups[0].size() == 3
+
+    row_groups = flex.reflection_table.msgpack_row_groups(
+        flex.reflection_table.msgpack_row_group_header()
+        + tables[2].as_msgpack_row_group()
+    )
+    assert len(row_groups) == 1
+    assert row_groups[0][2:] == (3, (20, 25), (0, 0))
+
+
 def test_experiment_identifiers():
     from dxtbx.model import Experiment, ExperimentList
 
@@ -1348,6 +1589,43 @@ def test_select_remove_on_experiment_identifiers():
         table.select_on_experiment_identifiers(["abcd", "mnop"])
 
 
+def test_select_using_experiments():
+    random.seed(0)
+    n_expt = 20
+    table = flex.reflection_table()
+    table["id"] = flex.int([random.randrange(n_expt) for _ in range(1000)])
+    table["x"] = flex.double(range(1000))
+    experiments = ExperimentList()
+    for i in range(n_expt):
+        experiments.append(Experiment(identifier=str(i)))
+        table.experiment_identifiers()[i] = str(i)
+
+    # the rows of each experiment in turn, in the order of the table
+    subset = ExperimentList([experiments[i] for i in (7, 2, 15, 2)])
+    result = table.select(subset)
+    expected = []
+    for i in (7, 2, 15, 2):
+        expected.extend(x for x, j in zip(table["x"], table["id"]) if j == i)
+    assert list(result["x"]) == expected
+    concatenated = flex.reflection_table()
+    for expt in subset:
+        concatenated.extend(table.select(expt))
+    assert list(result["x"]) == list(concatenated["x"])
+
+    mask = table.id_mask(flex.int([3, 11, 25]))
+    assert list(mask) == [i in (3, 11) for i in table["id"]]
+    assert table.id_mask(flex.int()).count(True) == 0
+
+    selected = table.select_on_experiment_identifiers(["3", "11"])
+    assert set(selected["id"]) == {3, 11}
+    assert sorted(selected.experiment_identifiers().keys()) == [3, 11]
+    assert len(selected) == mask.count(True)
+    table.remove_on_experiment_identifiers(["3", "11"])
+    assert 3 not in set(table["id"]) and 11 not in set(table["id"])
+    assert len(table) == 1000 - mask.count(True)
+    assert len(table.experiment_identifiers()) == n_expt - 2
+
+
 def test_as_miller_array():
     table = flex.reflection_table()
     table["intensity.1.value"] = flex.double([1.0, 2.0, 3.0])
@@ -1547,3 +1825,54 @@ def r():
 
     for _a, _b in zip(a_["xyz"], b_["xyz"]):
         assert _a == pytest.approx(_b)
+
+
+def test_list_of_reflections():
+    table = flex.reflection_table()
+    table["flags"] = flex.size_t([1, 2, 3])
+    table["bbox"] = flex.int6([(0, 1, 0, 1, 0, 1)] * 3)
+    table["my.column"] = flex.double([0.5, 1.5, 2.5])
+
+    reflections = flex.reflection_table_to_list_of_reflections(table)
+    assert len(reflections) == 3
+    assert [r.get("flags") for r in reflections] == [1, 2, 3]
+    assert [r.get("my.column") for r in reflections] == [0.5, 1.5, 2.5]
+    assert reflections[0].get("bbox") == (0, 1, 0, 1, 0, 1)
+
+    reflections[1].set_size_t("flags", 10)
+    reflections[1].set_double("my.column", 7.0)
+    other = reflections[1].copy()
+    assert other.get("flags") == 10
+    assert other.get("my.column") == 7.0
+    with pytest.raises(RuntimeError):
+        other.get("panel")
+
+
+def test_compute_d_and_two_theta():
+    experiments = ExperimentList()
+    for a, wavelength in [(10, 1.0), (23, 0.8)]:
+        experiments.append(
+            Experiment(
+                crystal=Crystal(
+                    (a, 0, 0), (0, 11, 1), (0, 0, 12), space_group_symbol="P1"
+                ),
+                beam=Beam((0, 0, 1), wavelength),
+            )
+        )
+    table = flex.reflection_table()
+    table["miller_index"] = flex.miller_index(
+        [(1, 2, 3), (-4, 0, 2), (0, 0, 1), (5, -1, 7), (2, 2, 2)]
+    )
+    table["id"] = flex.int([0, 1, 1, 0, 1])
+
+    d = table.compute_d(experiments, nthreads=2)
+    two_theta = table.compute_two_theta(experiments, deg=True, nthreads=2)
+    for h, i, di, tti in zip(table["miller_index"], table["id"], d, two_theta):
+        cell = experiments[i].crystal.get_unit_cell()
+        assert di == cell.d(h)
+        wavelength = experiments[i].beam.get_wavelength()
+        assert tti == pytest.approx(cell.two_theta(h, wavelength, deg=True))
+
+    table["id"][2] = -1
+    with pytest.raises(RuntimeError):
+        table.compute_d(experiments)
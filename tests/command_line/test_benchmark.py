@@ -0,0 +1,67 @@
+import sys
+
+from dials.command_line.benchmark import (
+    compare_with_baseline,
+    measure_command,
+    phil_scope,
+)
+
+
+def test_measure_command(tmp_path):
+    # Allocate 100 MB, write 1 MB and run a second thread
+    script = (
+        "import threading, time\n"
+        "data = b'x' * (100 * 2**20)\n"
+        "open('out.bin', 'wb').write(bytes(2**20))\n"
+        "thread = threading.Thread(target=time.sleep, args=(0.5,))\n"
+        "thread.start()\n"
+        "thread.join()\n"
+    )
+    result = measure_command(
+        [sys.executable, "-c", script],
+        tmp_path,
+        tmp_path / "out.log",
+        sample_interval=0.01,
+    )
+    assert result["returncode"] == 0
+    assert result["wall_time"] >= 0.5
+    assert result["peak_rss"] > 100 * 2**20
+    assert (tmp_path / "out.bin").stat().st_size == 2**20
+    if sys.platform.startswith("linux"):
+        assert result["write_bytes"] >= 2**20
+        assert result["max_threads"] >= 2
+
+    result = measure_command(
+        [sys.executable, "-c", "import sys; print('failed'); sys.exit(3)"],
+        tmp_path,
+        tmp_path / "fail.log",
+    )
+    assert result["returncode"] == 3
+    assert (tmp_path / "fail.log").read_text().strip() == "failed"
+
+
+def test_compare_with_baseline():
+    tolerance = phil_scope.extract().tolerance
+    baseline = {
+        "stages": [
+            {"name": "import", "wall_time": 10.0, "peak_rss": 100},
+            {"name": "find_spots", "wall_time": 100.0, "peak_rss": 1000},
+        ]
+    }
+    report = {
+        "stages": [
+            {"name": "import", "wall_time": 10.5, "peak_rss": 100},
+            {"name": "find_spots", "wall_time": 120.0, "peak_rss": 1200},
+            {"name": "index", "wall_time": 50.0, "peak_rss": 500},
+        ]
+    }
+    rows, regressions = compare_with_baseline(report, baseline, tolerance)
+    assert [row[0] for row in rows] == ["Stage", "import", "find_spots"]
+    assert len(regressions) == 2
+    assert all(r.startswith("find_spots") for r in regressions)
+
+    tolerance.wall_time = 0.5
+    tolerance.peak_rss = 0.5
+    rows, regressions = compare_with_baseline(report, baseline, tolerance)
+    assert not regressions
+
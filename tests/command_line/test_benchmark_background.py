@@ -0,0 +1,46 @@
+import json
+
+import procrunner
+import pytest
+
+from dials.array_family import flex
+from dials.command_line.benchmark_background import generate_shoeboxes, phil_scope
+
+
+def test_generate_shoeboxes():
+    params = phil_scope.extract().synthetic
+    params.nrefl = 10
+    params.counts = 0
+    reflections, truth = generate_shoeboxes(params)
+    assert len(reflections) == 10
+    assert truth.all_eq(params.background)
+    mean = flex.mean(
+        flex.double([flex.mean(s.data.as_double()) for s in reflections["shoebox"]])
+    )
+    assert mean == pytest.approx(params.background, rel=0.1)
+
+
+def test_benchmark_background(tmp_path):
+    result = procrunner.run(
+        [
+            "dev.dials.benchmark_background",
+            "synthetic.nrefl=50",
+            "repeats=2",
+            "algorithms=null simple glm",
+            "output.json=benchmark.json",
+        ],
+        working_directory=tmp_path,
+    )
+    assert not result.returncode and not result.stderr
+
+    with (tmp_path / "benchmark.json").open() as infile:
+        results = json.load(infile)
+    assert results["nrefl"] == 50
+    assert results["reference"] == "truth"
+    assert list(results["algorithms"]) == ["null", "simple", "glm"]
+    for name in ("simple", "glm"):
+        r = results["algorithms"][name]
+        assert len(r["times"]) == 2
+        assert r["success"] == 50
+        assert abs(r["bias"]) < 0.5
+    assert results["algorithms"]["null"]["bias"] == pytest.approx(-2.0)
@@ -0,0 +1,48 @@
+import json
+
+import procrunner
+import pytest
+
+from dials.command_line.benchmark_prediction import make_experiments, phil_scope
+
+
+@pytest.mark.parametrize("geometry", ["pilatus6m", "eiger32m", "xfel"])
+def test_make_experiments(geometry):
+    params = phil_scope.extract()
+    params.num_images = 5
+    params.num_stills = 3
+    rotation, stills = make_experiments(geometry, params)
+    assert len(stills) == 3
+    assert rotation.scan.get_num_images() == 5
+    assert len(rotation.detector) == (64 if geometry == "xfel" else 1)
+
+
+def test_benchmark_prediction(tmp_path):
+    result = procrunner.run(
+        [
+            "dev.dials.benchmark_prediction",
+            "geometries=pilatus6m xfel",
+            "num_images=5",
+            "num_stills=2",
+            "d_min=3",
+            "repeats=1",
+            "output.json=benchmark.json",
+        ],
+        working_directory=tmp_path,
+    )
+    assert not result.returncode and not result.stderr
+
+    with (tmp_path / "benchmark.json").open() as infile:
+        results = json.load(infile)
+    assert list(results) == ["pilatus6m", "xfel"]
+    for geometry in results.values():
+        assert list(geometry) == [
+            "reeke",
+            "scan_static",
+            "scan_varying",
+            "stills",
+            "ray_intersection",
+        ]
+        for r in geometry.values():
+            assert len(r["times"]) == 1
+            assert r["reflections"] > 0
@@ -51,6 +51,35 @@ def test_mtz(dials_data, tmp_path):
     assert mtz_obj.crystals()[1].project_name() == "ham"
 
 
+def test_mtz_chunked(dials_data, tmp_path):
+    # Writing the reflections in small chunks on several threads should give
+    # the same file as writing them all at once
+    columns = []
+    for chunk_size, nproc in ((1000000, 1), (100, 2)):
+        hklout = tmp_path / f"chunked_{chunk_size}.mtz"
+        result = procrunner.run(
+            [
+                "dials.export",
+                "format=mtz",
+                f"mtz.chunk_size={chunk_size}",
+                f"nproc={nproc}",
+                f"mtz.hklout={hklout}",
+                dials_data("centroid_test_data", pathlib=True) / "experiments.json",
+                dials_data("centroid_test_data", pathlib=True) / "integrated.pickle",
+            ],
+            working_directory=tmp_path,
+        )
+        assert not result.returncode and not result.stderr
+        mtz_obj = mtz.object(str(hklout))
+        assert mtz_obj.n_reflections() > 100
+        columns.append(
+            {c.label(): list(c.extract_values()) for c in mtz_obj.columns()}
+        )
+    assert columns[0].keys() == columns[1].keys()
+    for label in "H", "K", "L", "M_ISYM", "BATCH", "I", "SIGI", "XDET", "ROT":
+        assert columns[0][label] == pytest.approx(columns[1][label])
+
+
 def test_mtz_recalculated_cell(dials_data, tmp_path):
     # First run dials.two_theta_refine to ensure that the crystals have
     # recalculated_unit_cell set
@@ -138,3 +138,18 @@ def test_export_restricted_multiimage(dials_data, tmpdir):
     assert [f.basename for f in tmpdir.listdir("*.png")] == [
         "image0002.png"
     ], "Only one image expected"
+
+
+def test_export_bitmaps_in_parallel(dials_data, tmpdir):
+    result = procrunner.run(
+        [
+            "dials.export_bitmaps",
+            dials_data("centroid_test_data").join("experiments.json").strpath,
+            "nproc=3",
+        ],
+        working_directory=tmpdir.strpath,
+    )
+    assert not result.returncode and not result.stderr
+    assert sorted(f.basename for f in tmpdir.listdir("*.png")) == [
+        "image%04i.png" % i for i in range(1, 10)
+    ]
@@ -375,3 +375,34 @@ def test_find_spots_with_per_image_statistics(dials_data, tmpdir):
     assert (
         b"|   image |   #spots |   #spots_no_ice |   total_intensity |" in result.stdout
     )
+
+
+def test_find_spots_interleaved_imagesets(dials_data, tmpdir):
+    # Leave out an image so the images are imported as two sequences
+    images = [
+        f.strpath
+        for f in dials_data("centroid_test_data").listdir("centroid*.cbf")
+        if not f.basename.endswith("0005.cbf")
+    ]
+    for interleave in (True, False):
+        result = procrunner.run(
+            [
+                "dials.find_spots",
+                "nproc=2",
+                f"interleave_imagesets={interleave}",
+                f"output.reflections=strong_{interleave}.refl",
+                "algorithm=dispersion",
+            ]
+            + images,
+            working_directory=tmpdir.strpath,
+        )
+        assert not result.returncode and not result.stderr
+
+    interleaved = flex.reflection_table.from_file(tmpdir / "strong_True.refl")
+    sequential = flex.reflection_table.from_file(tmpdir / "strong_False.refl")
+    assert set(interleaved["id"]) == {0, 1}
+    assert len(interleaved) == len(sequential)
+    assert list(interleaved["id"]) == list(sequential["id"])
+    assert interleaved["xyzobs.px.value"] == pytest.approx(
+        sequential["xyzobs.px.value"]
+    )
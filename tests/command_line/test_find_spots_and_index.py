@@ -0,0 +1,33 @@
+import procrunner
+
+from dxtbx.serialize import load
+
+from dials.array_family import flex
+
+
+def test_find_spots_and_index(dials_data, tmpdir):
+    result = procrunner.run(
+        [
+            "dials.find_spots_and_index",
+            dials_data("centroid_test_data").join("imported_experiments.json"),
+            "progressive.min_degrees=0.6",
+            "progressive.step_degrees=0.4",
+            "spotfinder.threshold.algorithm=dispersion",
+        ],
+        working_directory=tmpdir,
+    )
+    assert not result.returncode and not result.stderr
+    assert tmpdir.join("strong.refl").check(file=1)
+    assert tmpdir.join("indexed.expt").check(file=1)
+    assert tmpdir.join("indexed.refl").check(file=1)
+
+    # The spots are the same as from the whole sequence
+    strong = flex.reflection_table.from_file(tmpdir.join("strong.refl"))
+    assert len(strong) in range(653, 655)
+
+    experiments = load.experiment_list(
+        tmpdir.join("indexed.expt").strpath, check_format=False
+    )
+    assert len(experiments.crystals()) == 1
+    indexed = flex.reflection_table.from_file(tmpdir.join("indexed.refl"))
+    assert indexed.get_flags(indexed.flags.indexed).count(True) > 0
@@ -6,9 +6,12 @@
 import urllib.request
 from xml.dom import minidom
 
+import msgpack
 import procrunner
 import pytest
 
+from dials.command_line import find_spots_server
+
 
 @pytest.fixture
 def server(tmp_path) -> int:
@@ -39,6 +42,33 @@ def test_server_return_codes(dials_data, server):
         urllib.request.urlopen(f"http://127.0.0.1:{server}/some/junk/filename")
 
 
+def test_server_msgpack_response(dials_data, server):
+    first_file = dials_data("centroid_test_data").listdir("*.cbf", sort=True)[0].strpath
+    request = urllib.request.Request(
+        f"http://127.0.0.1:{server}/{first_file}",
+        headers={"Accept": "application/msgpack"},
+    )
+    response = urllib.request.urlopen(request)
+    assert response.code == 200
+    assert response.headers["Content-type"] == "application/msgpack"
+    d = msgpack.unpackb(response.read(), raw=False)
+    assert d["image"] == first_file
+    assert "n_spots_total" in d
+
+
+def test_work_with_persistent_cache(dials_data):
+    filenames = dials_data("centroid_test_data").listdir("*.cbf", sort=True)
+    cache = find_spots_server.SpotFinderCache()
+    params = ["min_spot_size=3", "algorithm=dispersion"]
+    first = find_spots_server.work(filenames[0].strpath, params, cache=cache)
+    expected = find_spots_server.work(filenames[1].strpath, params)
+    second = find_spots_server.work(filenames[1].strpath, params, cache=cache)
+    assert first["n_spots_total"] > 0
+    assert second == expected
+    # Both images have the same geometry so share the same cache entry
+    assert len(cache._entries) == 1
+
+
 def test_find_spots_server_client(dials_data, tmp_path, server):
     filenames = [
         f.strpath for f in dials_data("centroid_test_data").listdir("*.cbf", sort=True)
@@ -123,6 +123,45 @@ def test_merge_dmin_dmax(dials_data, tmp_path, best_unit_cell):
     assert max_min_resolution[1] >= 1
 
 
+def test_merge_streaming(dials_data, tmp_path):
+    """Test that the streaming merge gives the same merged intensities"""
+
+    location = dials_data("l_cysteine_4_sweeps_scaled", pathlib=True)
+    refls = location / "scaled_20_25.refl"
+    expts = location / "scaled_20_25.expt"
+
+    arrays = {}
+    for streaming in [False, True]:
+        mtz_file = tmp_path / f"merge-{streaming}.mtz"
+        command = [
+            "dials.merge",
+            refls,
+            expts,
+            "truncate=False",
+            f"streaming.enable={streaming}",
+            "streaming.chunk_size=1000",
+            f"output.mtz={str(mtz_file)}",
+        ]
+        result = procrunner.run(command, working_directory=tmp_path)
+        assert not result.returncode and not result.stderr
+        validate_mtz(mtz_file, ["IMEAN", "SIGIMEAN", "I(+)", "I(-)", "N(+)", "N(-)"])
+        arrays[streaming] = {
+            ma.info().labels[0]: ma
+            for ma in mtz.object(str(mtz_file)).as_miller_arrays()
+        }
+
+    for label in ["IMEAN", "I(+)", "N(+)"]:
+        expected, streamed = arrays[False][label], arrays[True][label]
+        assert streamed.size() == expected.size()
+        expected, streamed = expected.common_sets(streamed)
+        assert streamed.size() == expected.size()
+        assert list(streamed.data()) == pytest.approx(list(expected.data()), rel=1e-5)
+        if streamed.sigmas():
+            assert list(streamed.sigmas()) == pytest.approx(
+                list(expected.sigmas()), rel=1e-5
+            )
+
+
 def test_merge_multi_wavelength(dials_data, tmp_path):
     """Test that merge handles multi-wavelength data suitably - should be
     exported into an mtz with separate columns for each wavelength."""
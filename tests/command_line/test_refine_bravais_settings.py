@@ -228,3 +228,25 @@ def test_setting_c2_vs_i2(
         sgtbx.space_group_info(expected_space_group).group()
     )
     assert f"{expected_bravais_lattice}: {expected_short_name}" in captured.out
+
+
+def test_refine_bravais_settings_nproc(dials_regression, tmpdir):
+    """The settings refined in parallel match those refined one by one"""
+    data_dir = os.path.join(dials_regression, "indexing_test_data", "i04_weak_data")
+    summaries = []
+    for nproc in (1, 3):
+        with tmpdir.mkdir("nproc_%d" % nproc).as_cwd():
+            refine_bravais_settings.run(
+                [
+                    os.path.join(data_dir, "indexed.pickle"),
+                    os.path.join(data_dir, "experiments.json"),
+                    "reflections_per_degree=5",
+                    "minimum_sample_size=500",
+                    "beam.fix=all",
+                    "detector.fix=all",
+                    "nproc=%d" % nproc,
+                ]
+            )
+            with open("bravais_summary.json") as fh:
+                summaries.append(json.load(fh))
+    assert summaries[0] == summaries[1]
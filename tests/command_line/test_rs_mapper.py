@@ -49,3 +49,28 @@ def test_masked(dials_data, tmp_path):
     # load results
     m = ccp4_map.map_reader(file_name=str(tmp_path / "junk.ccp4"))
     assert m.header_max == pytest.approx(6330.33350)
+
+
+def test_rs_mapper_nproc(dials_data, tmp_path):
+    experiments = (
+        dials_data("centroid_test_data", pathlib=True) / "imported_experiments.json"
+    )
+    maps = []
+    for nproc in (1, 3):
+        map_file = tmp_path / f"nproc_{nproc}.ccp4"
+        result = procrunner.run(
+            [
+                "dials.rs_mapper",
+                experiments,
+                f"map_file={map_file}",
+                f"nproc={nproc}",
+                "grid_size=64",
+            ],
+            working_directory=tmp_path,
+        )
+        assert not result.returncode and not result.stderr
+        maps.append(ccp4_map.map_reader(file_name=str(map_file)).data)
+
+    # The map does not depend on the number of threads
+    assert maps[0].all() == maps[1].all()
+    assert list(maps[0]) == list(maps[1])
@@ -167,6 +167,29 @@ def test_search_single(run_in_tmpdir, dials_regression):
     assert shift.elems == pytest.approx((-0.976, 2.497, 0.0), abs=1e-1)
 
 
+def test_search_single_native_scoring(run_in_tmpdir, dials_regression):
+    """Check that the native scoring of the origin offsets finds the same shift
+    in detector origin as the directional FFTs."""
+
+    data_dir = os.path.join(dials_regression, "indexing_test_data", "phi_scan")
+    pickle_path = os.path.join(data_dir, "strong.pickle")
+    experiments_path = os.path.join(data_dir, "datablock.json")
+
+    search_beam_position.run(
+        [experiments_path, pickle_path, "native_scoring=True", "nproc=2"]
+    )
+    assert os.path.exists("optimised.expt")
+
+    experiments = load.experiment_list(experiments_path, check_format=False)
+    optimized_experiments = load.experiment_list("optimised.expt", check_format=False)
+    detector_1 = experiments.detectors()[0]
+    detector_2 = optimized_experiments.detectors()[0]
+    shift = scitbx.matrix.col(detector_1[0].get_origin()) - scitbx.matrix.col(
+        detector_2[0].get_origin()
+    )
+    assert shift.elems == pytest.approx((-0.976, 2.497, 0.0), abs=2e-1)
+
+
 def test_search_small_molecule(dials_data, run_in_tmpdir):
     """Perform a beam-centre search on a multi-sequence data set..
 
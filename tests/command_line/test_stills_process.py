@@ -11,7 +11,7 @@
 from libtbx.phil import parse
 
 from dials.array_family import flex
-from dials.command_line.stills_process import Processor, phil_scope
+from dials.command_line.stills_process import Processor, follow_queue, phil_scope
 
 cspad_cbf_in_memory_phil = """
 dispatch.squash_errors = False
@@ -188,3 +188,40 @@ def test_pseudo_scan(dials_data, tmp_path):
         tmp_path / "idx-0000_refined.expt", check_format=False
     )
     assert len(experiments) == 2
+
+
+def test_follow_queue(tmp_path):
+    queue = tmp_path / "queue.txt"
+    queue.write_text("a.cbf\n\nb.cbf\nendrun\nc.cbf\n")
+    assert list(follow_queue(str(queue), poll_interval=0)) == ["a.cbf", "b.cbf"]
+
+    # Without a stop the unterminated last path is taken once the queue is idle
+    queue.write_text("a.cbf\nb.cbf")
+    paths = follow_queue(str(queue), poll_interval=0.01, timeout=0.1)
+    assert list(paths) == ["a.cbf", "b.cbf"]
+
+
+def test_worker(dials_data, tmp_path):
+    queue = tmp_path / "queue.txt"
+    data_dir = dials_data("centroid_test_data")
+    images = data_dir.listdir("centroid_000[1-2].cbf", sort=True)
+    queue.write_text("".join(f"{image.strpath}\n" for image in images) + "endrun\n")
+    result = procrunner.run(
+        (
+            "dials.stills_process",
+            f"worker.queue={queue}",
+            "worker.chunk_size=1",
+            "convert_sequences_to_stills=True",
+            "squash_errors=False",
+            "composite_output=True",
+        ),
+        working_directory=tmp_path,
+    )
+    assert not result.returncode and not result.stderr
+
+    # Each chunk of the queue is written to its own set of files
+    for chunk in range(2):
+        experiments = ExperimentListFactory.from_json_file(
+            tmp_path / f"idx-0000_{chunk:05d}_refined.expt", check_format=False
+        )
+        assert len(experiments) == 1
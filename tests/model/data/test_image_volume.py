@@ -0,0 +1,51 @@
+import pytest
+
+from dials.array_family import flex
+from dials.model.data import ImageVolume, MultiPanelImageVolume, make_image
+
+
+def add_frames(volume, frame0, frame1, ny=4, nx=5):
+    for frame in range(frame0, frame1):
+        data = flex.double(flex.grid(ny, nx), frame)
+        mask = flex.bool(flex.grid(ny, nx), True)
+        volume.set_image(frame, make_image((data,), (mask,)))
+
+
+def test_windowed_image_volume():
+    volume = MultiPanelImageVolume()
+    volume.add(ImageVolume(10, 30, 4, 5, 3))
+    assert volume.windowed()
+    assert volume.window_size() == 3
+
+    bbox = (0, 5, 0, 4, 14, 17)
+    for frame in range(10, 30):
+        add_frames(volume, frame, frame + 1)
+        assert volume.window_frame0() == max(10, frame - 2)
+        assert volume.window_frame1() == frame + 1
+        assert volume.mask_frame0() == frame
+        assert volume.mask_frame1() == frame + 1
+        assert volume.is_finalised(bbox) == (frame == 16)
+        if frame == 16:
+            data = volume.get(0).extract_data(bbox)
+            assert list(data[:20]) == [14] * 20
+            assert list(data[40:]) == [16] * 20
+
+    # The oldest frames have been dropped
+    with pytest.raises(RuntimeError):
+        volume.get(0).extract_data(bbox)
+
+    # Frames must be added in order
+    with pytest.raises(RuntimeError):
+        add_frames(volume, 29, 30)
+
+
+def test_full_image_volume():
+    volume = MultiPanelImageVolume()
+    volume.add(ImageVolume(0, 5, 4, 5))
+    assert not volume.windowed()
+    add_frames(volume, 0, 5)
+    assert volume.window_frame0() == 0
+    assert volume.window_frame1() == 5
+    assert volume.mask_frame0() == 0
+    assert volume.mask_frame1() == 5
+    assert volume.is_finalised((0, 5, 0, 4, 1, 3))
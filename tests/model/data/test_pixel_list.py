@@ -28,6 +28,41 @@ def test_pickle():
     assert pl2.value().all_eq(pl.value())
 
 
+def test_strong_pixel_runs():
+    from scitbx.array_family import flex
+
+    from dials.model.data import PixelList, StrongPixelRuns
+
+    size = (100, 120)
+    image = flex.double(flex.grid(size))
+    mask = flex.bool(flex.grid(size))
+    for i in range(len(image)):
+        image[i] = random.randint(0, 100)
+        mask[i] = random.random() < 0.2
+    runs = StrongPixelRuns(mask)
+    assert runs.size() == size
+    assert runs.num_pixels() == mask.count(True)
+    assert runs.as_mask().all_eq(mask)
+    assert runs.index().all_eq(mask.as_1d().iselection())
+
+    # Adjacent runs are merged
+    for row, x0, x1 in zip(runs.row(), runs.x0(), runs.x1()):
+        assert mask[row, x1 - 1]
+        assert x0 == 0 or not mask[row, x0 - 1]
+        assert x1 == size[1] or not mask[row, x1]
+
+    runs2 = pickle.loads(pickle.dumps(runs))
+    assert runs2.as_mask().all_eq(mask)
+
+    # The pixel list from the runs is the same as from the dense mask
+    pl1 = PixelList(10, image, mask)
+    pl2 = PixelList(10, image, runs)
+    assert pl2.index().all_eq(pl1.index())
+    assert pl2.value().all_eq(pl1.value())
+    pl3 = PixelList(10, image.iround(), runs)
+    assert pl3.index().all_eq(pl1.index())
+
+
 def test_add_image():
     from scitbx.array_family import flex
 
@@ -175,3 +210,29 @@ def test_with_no_points():
     assert len(coords) == 0
     assert len(labels1) == 0
     assert len(labels2) == 0
+
+
+def test_compressed_values():
+    from scitbx.array_family import flex
+
+    from dials.model.data import PixelList, PixelListLabeller
+
+    size = (100, 100)
+    labeller = PixelListLabeller()
+    expected = flex.double()
+    for i in range(3):
+        image = flex.random_int_gaussian_distribution(size[0] * size[1], 100, 5)
+        image = image.as_double()
+        if i == 2:
+            image += 0.25
+        mask = flex.random_bool(size[0] * size[1], 0.5)
+        image.reshape(flex.grid(size))
+        mask.reshape(flex.grid(size))
+        labeller.add(PixelList(i, image, mask))
+        expected.extend(image.as_1d().select(mask.as_1d()))
+
+        # Integer values are held as 16 bit integers until one doesn't fit
+        assert labeller.packed() == (i < 2)
+
+    assert labeller.values().all_eq(expected)
+    assert labeller.num_bytes() < 6 * labeller.num_pixels()
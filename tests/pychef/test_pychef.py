@@ -20,7 +20,8 @@ def test_observations():
     assert list(groups[(1, 2, 3)].iminus()) == [1, 2]
 
 
-def test_accumulators(dials_data):
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_accumulators(dials_data, nthreads):
     f = dials_data("pychef").join("insulin_dials_scaled_unmerged.mtz").strpath
     mtz_object = iotbx.mtz.object(file_name=f)
     arrays = mtz_object.as_miller_arrays(merge_equivalents=False)
@@ -38,7 +39,7 @@ def test_accumulators(dials_data):
     if anomalous_flag:
         intensities = intensities.as_anomalous_array()
 
-    stats = dials.pychef.Statistics(intensities, batches.data())
+    stats = dials.pychef.Statistics(intensities, batches.data(), nthreads=nthreads)
 
     # test completeness
     assert stats.iplus_comp_overall.size() == 46
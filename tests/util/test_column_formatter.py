@@ -0,0 +1,48 @@
+import io
+
+import pytest
+
+from dials.array_family import flex
+from dials.util.export_text import write_formatted_columns
+from dials.util.ext import ColumnFormatter
+
+
+def test_column_formatter():
+    n = 10000
+    ordinal = flex.size_t_range(1, n + 1)
+    h = flex.int(range(-n // 2, n // 2))
+    intensity = flex.double(i * 0.37 - 100 for i in range(n))
+    sigma = flex.double(i * 1.0e-3 for i in range(n))
+
+    formatter = ColumnFormatter()
+    formatter.add_size_t_column(ordinal, "%6i")
+    formatter.add_int_column(h, " %-4d")
+    formatter.add_double_column(intensity, "%8.2f")
+    formatter.add_double_column(sigma, " %7.3e")
+    assert len(formatter) == n
+    assert formatter.num_columns() == 4
+
+    expected = "".join(
+        "%6i %-4d%8.2f %7.3e\n" % row for row in zip(ordinal, h, intensity, sigma)
+    )
+    assert formatter.format(0, n) == expected
+    assert formatter.format(0, n, nthreads=4) == expected
+    assert formatter.format(10, 20) == "".join(expected.splitlines(True)[10:20])
+
+    fh = io.StringIO()
+    write_formatted_columns(fh, formatter, nproc=2, chunk_size=999)
+    assert fh.getvalue() == expected
+
+
+def test_column_formatter_errors():
+    formatter = ColumnFormatter()
+    formatter.add_double_column(flex.double(3), "%f")
+    with pytest.raises(RuntimeError):
+        # Wrong conversion for the type
+        formatter.add_int_column(flex.int(3), "%f")
+    with pytest.raises(RuntimeError):
+        # More than one conversion
+        formatter.add_double_column(flex.double(3), "%f %f")
+    with pytest.raises(RuntimeError):
+        # Wrong length
+        formatter.add_double_column(flex.double(4), "%f")
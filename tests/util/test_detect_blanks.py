@@ -128,3 +128,54 @@ def test_blank_integrated_analysis(dials_data):
     )
     assert not any(results["data"][0]["blank"])
     assert results["blank_regions"] == []
+
+
+def test_blank_analysis_from_image_summary(dials_data, tmp_path):
+    from dials.util.image_summary import (
+        image_summaries,
+        read_image_summaries,
+        write_image_summaries,
+    )
+
+    expts = ExperimentList.from_file(
+        dials_data("insulin_processed") / "integrated.expt", check_format=False
+    )
+    refl = flex.reflection_table.from_file(
+        dials_data("insulin_processed") / "integrated.refl"
+    )
+    strong = flex.reflection_table.from_file(
+        dials_data("insulin_processed") / "strong.refl"
+    )
+    z = refl["xyzobs.px.value"].parts()[2]
+    refl["intensity.prf.value"].set_selected(z < 10, refl["intensity.prf.value"] * 0.05)
+
+    # The summaries can be written and read back
+    filename = str(tmp_path / "summary.json")
+    write_image_summaries(image_summaries(expts, refl), filename)
+    (summary,) = read_image_summaries(filename)
+    assert summary.num_images == len(expts[0].scan)
+    integrated = refl.get_flags(refl.flags.integrated)
+    assert sum(summary["n_integrated"]) == integrated.count(True)
+
+    # With whole images in each bin the results match those from the reflections
+    expected = detect_blanks.blank_integrated_analysis(
+        refl, expts[0].scan, phi_step=5, fractional_loss=0.1
+    )
+    results = detect_blanks.blank_integrated_analysis_from_summary(
+        summary, expts[0].scan, phi_step=5, fractional_loss=0.1
+    )
+    assert results["data"][0]["x"] == expected["data"][0]["x"]
+    assert results["data"][0]["y"] == pytest.approx(expected["data"][0]["y"])
+    assert results["blank_regions"] == expected["blank_regions"] == [(0, 10)]
+
+    (summary,) = image_summaries(expts, strong)
+    for phi_step in (5, 2):
+        expected = detect_blanks.blank_counts_analysis(
+            strong, expts[0].scan, phi_step=phi_step, fractional_loss=0.1
+        )
+        results = detect_blanks.blank_counts_analysis_from_summary(
+            summary, expts[0].scan, phi_step=phi_step, fractional_loss=0.1
+        )
+        assert sum(results["data"][0]["y"]) == sum(expected["data"][0]["y"])
+        if phi_step == 5:
+            assert results["data"][0]["y"] == expected["data"][0]["y"]
@@ -222,3 +222,71 @@ def test_generate_mask_parallax_correction(
     for m, im in zip(mask, imageset.get_raw_data(0)):
         assert m.all() == im.all()
     assert mask[0].count(False) == expected
+
+
+def test_resolution_map(dials_data):
+    import pickle
+
+    from dials.util.ext import ResolutionMap
+
+    imageset = load.imageset(
+        dials_data("centroid_test_data").join("sweep.json").strpath
+    )
+    beam = imageset.get_beam()
+    panel = imageset.get_detector()[0]
+
+    resolution_map = ResolutionMap(beam, panel)
+    resolution = resolution_map.resolution()
+    two_theta = resolution_map.two_theta()
+    assert resolution.all() == tuple(reversed(panel.get_image_size()))
+    assert two_theta.all() == resolution.all()
+    expected = panel.get_two_theta_array(beam.get_s0())
+    assert flex.max(flex.abs(two_theta - expected)) < 1e-10
+    for j, i in ((0, 0), (100, 200), (2000, 1500)):
+        d = panel.get_resolution_at_pixel(beam.get_s0(), (i + 0.5, j + 0.5))
+        assert resolution[j, i] == pytest.approx(d)
+
+    threaded = ResolutionMap(beam, panel, nthreads=4)
+    assert list(threaded.resolution()) == list(resolution)
+    assert list(threaded.two_theta()) == list(two_theta)
+
+    other = pickle.loads(pickle.dumps(resolution_map))
+    assert list(other.resolution()) == list(resolution)
+
+    # The map is only computed once for each beam and panel
+    first = dials.util.masking.get_resolution_map(beam, panel)
+    assert dials.util.masking.get_resolution_map(beam, panel) is first
+
+
+def test_polygon_mask_generator():
+    from dials.util.ext import PolygonMaskGenerator
+
+    # A square covering whole pixels and a triangle cutting pixels diagonally
+    square = flex.vec2_double([(2, 1), (6, 1), (6, 4), (2, 4)])
+    triangle = flex.vec2_double([(10, 2), (14, 2), (10, 6)])
+
+    def mask_with(min_coverage, nthreads=1):
+        generator = PolygonMaskGenerator(min_coverage)
+        generator.add(square)
+        generator.add(triangle)
+        assert len(generator) == 2
+        mask = flex.bool(flex.grid(8, 16), True)
+        generator.apply(mask, nthreads=nthreads)
+        return mask
+
+    full = mask_with(1.0)
+    assert full.count(False) == 12 + 6
+    for j in range(1, 4):
+        for i in range(2, 6):
+            assert not full[j, i]
+    assert full[2, 13] and full[3, 12]
+    assert not full[2, 12]
+
+    # The pixels on the hypotenuse are half covered
+    half = mask_with(0.5)
+    assert half.count(False) == 12 + 10
+    assert not half[2, 13] and not half[5, 10]
+    assert list(mask_with(0.5, nthreads=3)) == list(half)
+
+    # Any overlap masks the pixel
+    assert mask_with(0).count(False) == 12 + 10
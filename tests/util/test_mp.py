@@ -41,3 +41,54 @@ def test_available_cores_condor_job_ad(monkeypatch, tmp_path):
 """
     )
     assert dials.util.mp.available_cores() == true_cores
+
+
+class _FakeComm:
+    """A single process stand in for an MPI communicator"""
+
+    def __init__(self, rank=0, size=1, messages=()):
+        self.rank = rank
+        self.size = size
+        self.messages = list(messages)
+        self.sent = []
+
+    def Get_rank(self):
+        return self.rank
+
+    def Get_size(self):
+        return self.size
+
+    def recv(self, source=None):
+        return self.messages.pop(0)
+
+    def send(self, obj, dest=None):
+        self.sent.append((dest, obj))
+
+
+def test_mpi_parallel_map_single_rank():
+    results = []
+    dials.util.mp.mpi_parallel_map(
+        func=lambda x: x * x,
+        iterable=iter(range(5)),
+        callback=results.append,
+        comm=_FakeComm(),
+    )
+    assert results == [0, 1, 4, 9, 16]
+
+
+def _fail(x):
+    raise ValueError(x)
+
+
+def test_mpi_worker_loop():
+    comm = _FakeComm(rank=1, size=2, messages=[(abs, -2), (_fail, 3), None])
+    dials.util.mp.mpi_worker_loop(comm)
+    assert comm.sent[0] == (0, (True, 2))
+    dest, (success, error) = comm.sent[1]
+    assert dest == 0 and not success and isinstance(error, ValueError)
+    assert len(comm.sent) == 2
+
+    # Rank 0 tells every other rank to stop
+    comm = _FakeComm(rank=0, size=3)
+    dials.util.mp.mpi_stop_workers(comm)
+    assert comm.sent == [(1, None), (2, None)]
@@ -0,0 +1,52 @@
+import json
+
+from dials.util import perf
+
+
+def test_scope_and_count():
+    perf.clear()
+    with perf.scope("not_recorded"):
+        perf.count("not_counted")
+    assert not perf.events()
+
+    perf.enable()
+    try:
+        assert perf.enabled()
+        for i in range(3):
+            with perf.scope("outer"):
+                with perf.scope("inner"):
+                    perf.count("items", 2)
+    finally:
+        perf.disable()
+    with perf.scope("not_recorded"):
+        pass
+
+    recorded = perf.events()
+    assert sorted({e.name for e in recorded}) == ["inner", "items", "outer"]
+    result = perf.summary(recorded)
+    assert result["timers"]["outer"]["calls"] == 3
+    assert result["timers"]["inner"]["calls"] == 3
+    assert result["timers"]["outer"]["total"] >= result["timers"]["inner"]["total"]
+    assert result["counters"] == {"items": 6}
+    assert "outer" in perf.report(recorded)
+
+    perf.clear()
+    assert not perf.events()
+
+
+def test_chrome_trace(tmp_path):
+    recorded = [
+        perf.Event("count", "C", 10.5, 0, 2, 1),
+        perf.Event("job", "X", 10.0, 0.5, 0, 1),
+        perf.Event("count", "C", 10.6, 0, 3, 0),
+    ]
+    perf.write_chrome_trace(tmp_path / "trace.json", recorded)
+    trace = json.loads((tmp_path / "trace.json").read_text())
+    events = trace["traceEvents"]
+    assert [e["name"] for e in events] == ["job", "count", "count"]
+    assert events[0]["ph"] == "X"
+    assert events[0]["ts"] == 0
+    assert events[0]["dur"] == 0.5e6
+    assert events[1]["args"] == {"value": 2}
+    assert events[2]["args"] == {"value": 5}
+    assert events[2]["tid"] == 0
@@ -0,0 +1,38 @@
+import random
+
+import pytest
+
+from dials.array_family import flex
+from dials.util.ext import PointCloud
+
+
+def test_point_cloud():
+    random.seed(0)
+    points = flex.vec3_double(
+        [(random.random(), random.random(), random.random()) for _ in range(5000)]
+    )
+    colors = flex.vec3_double([(i % 2, 0.5, 1) for i in range(len(points))])
+    cloud = PointCloud(points, colors, nthreads=2)
+    assert len(cloud) == len(points)
+
+    # The points are ordered from coarse to fine, keeping the input order
+    order = cloud.order()
+    level = cloud.level()
+    assert sorted(order) == list(range(len(points)))
+    assert list(order) == sorted(range(len(points)), key=lambda i: level[i])
+    assert list(PointCloud(points, colors, nthreads=1).order()) == list(order)
+
+    # The coarsest level has at most one point per octant
+    assert 0 < list(level).count(0) <= 8
+
+    vertices, vertex_colors = cloud.crosses(10, 0.1, nthreads=2)
+    assert len(vertices) == len(vertex_colors) == 180
+    for j in range(10):
+        p = points[order[j]]
+        for axis in range(3):
+            for side, sign in enumerate((-1, 1)):
+                k = 18 * j + 6 * axis + 3 * side
+                expected = list(p)
+                expected[axis] += sign * 0.1
+                assert list(vertices[k : k + 3]) == pytest.approx(expected, abs=1e-6)
+                assert list(vertex_colors[k : k + 3]) == list(colors[order[j]])
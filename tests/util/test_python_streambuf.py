@@ -150,3 +150,24 @@ def test_with_bytesio():
 def test_with_file(tmpdir):
     with tmpdir.as_cwd():
         mere_file_test_case().run()
+
+
+@pytest.mark.parametrize("buffer_type", [bytes, bytearray, memoryview])
+def test_read_from_buffer(buffer_type):
+    data = buffer_type(io_test_case.phrase)
+    words = ext.read_word(streambuf(data))
+    assert words == b"Coding, should, be, fun, [ fail, eof ]"
+    words = ext.read_and_seek(streambuf(data))
+    assert words == b"should, should, uld, ding, fun, [ eof ]"
+
+
+def test_write_to_file_descriptor(tmpdir):
+    filename = tmpdir.join("tmp_tst_python_streambuf").strpath
+    with open(filename, "wb") as f:
+        f.write(b"<")
+        report = ext.write_word(ostream(f))
+        assert report == b""
+        f.write(b">")
+        assert f.tell() == 24
+    with open(filename, "rb") as f:
+        assert f.read() == b"<2 times 1.6 equals 3.2>"
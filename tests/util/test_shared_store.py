@@ -0,0 +1,87 @@
+import multiprocessing
+import os
+import pickle
+
+from dials.array_family import flex
+from dials.util import shared_store
+
+
+class _Accumulator:
+    def __init__(self, model):
+        self.model = model
+        self.total = 0
+
+
+def _load_square(handle):
+    data, factor = handle.load()
+    return [x * factor for x in data]
+
+
+def _load_reflections(handle):
+    return list(handle.load()["intensity.sum.value"])
+
+
+def test_shared_object(tmp_path):
+    model = {"name": "model", "values": list(range(10))}
+    with shared_store.SharedStore(str(tmp_path)) as store:
+        handle = store.put(model)
+        assert store.put(model) is handle
+        assert len(pickle.dumps(handle)) < 200
+
+        # A cached object is only unpickled once in a process
+        loaded = pickle.loads(pickle.dumps(handle)).load()
+        assert loaded == model
+        assert loaded is not model
+        assert handle.load() is loaded
+
+        # An uncached object is loaded afresh, but refers to the cached model
+        accumulator = _Accumulator(model)
+        accumulator_handle = store.put(accumulator, references=[model], cached=False)
+        first = accumulator_handle.load()
+        first.total += 1
+        second = accumulator_handle.load()
+        assert first is not second
+        assert second.total == 0
+        assert first.model is loaded
+        assert second.model is loaded
+        directory = store.directory
+        assert os.path.isdir(directory)
+    assert not os.path.exists(directory)
+
+
+def test_shared_reflections(tmp_path):
+    tables = []
+    for i in range(3):
+        table = flex.reflection_table()
+        table["id"] = flex.int(10 + i, i)
+        table["intensity.sum.value"] = flex.double(range(10 + i)) * (i + 1)
+        table.experiment_identifiers()[i] = "expt-%d" % i
+        tables.append(table)
+    with shared_store.SharedStore(str(tmp_path)) as store:
+        handles = [store.put_reflections(table) for table in tables]
+        assert [h.offset for h in handles[1:]] == [
+            h.offset + h.nbytes for h in handles[:-1]
+        ]
+        for table, handle in zip(tables, handles):
+            handle = pickle.loads(pickle.dumps(handle))
+            loaded = handle.load()
+            assert len(loaded) == len(table)
+            assert list(loaded["id"]) == list(table["id"])
+            assert list(loaded["intensity.sum.value"]) == list(
+                table["intensity.sum.value"]
+            )
+            assert dict(loaded.experiment_identifiers()) == dict(
+                table.experiment_identifiers()
+            )
+            assert list(handle.load(columns=["id"]).keys()) == ["id"]
+
+
+def test_shared_store_multiprocessing(tmp_path):
+    table = flex.reflection_table()
+    table["intensity.sum.value"] = flex.double([1, 2, 3])
+    with shared_store.SharedStore(str(tmp_path)) as store:
+        handle = store.put(([1, 2, 3], 2))
+        reflections = store.put_reflections(table)
+        with multiprocessing.Pool(2) as pool:
+            assert pool.map(_load_square, [handle] * 4) == [[2, 4, 6]] * 4
+            assert pool.map(_load_reflections, [reflections] * 2) == [[1, 2, 3]] * 2
@@ -2,8 +2,11 @@
 #include <boost/python/def.hpp>
 #include <dials/util/scale_down_array.h>
 #include <dials/util/masking.h>
+#include <dials/util/point_cloud.h>
 #include <dials/util/export_mtz_helpers.h>
+#include <dials/util/column_formatter.h>
 #include <dials/util/python_streambuf.h>
+#include <dials/util/profile.h>
 
 std::size_t dials::util::streambuf::default_buffer_size = 1024;
 namespace dials { namespace util { namespace boost_python {
@@ -11,7 +14,25 @@ namespace dials { namespace util { namespace boost_python {
     typedef dials::util::streambuf wt;
 
     static void wrap() {
-      using namespace boost::python;
+      /**
+   * Add rows from a list of flex.double columns
+   */
+  void mtz_stream_writer_add_rows(MtzStreamWriter &self,
+                                  const af::const_ref<cctbx::miller::index<> > &hkl,
+                                  boost::python::list columns,
+                                  std::size_t nthreads) {
+    std::vector<af::shared<double> > arrays;
+    for (std::size_t i = 0; i < boost::python::len(columns); ++i) {
+      arrays.push_back(boost::python::extract<af::shared<double> >(columns[i])());
+    }
+    std::vector<af::const_ref<double> > values;
+    for (std::size_t i = 0; i < arrays.size(); ++i) {
+      values.push_back(arrays[i].const_ref());
+    }
+    self.add_rows(hkl, values, nthreads);
+  }
+
+  using namespace boost::python;
       class_<wt, boost::noncopyable>("streambuf", no_init)
         .def(init<boost::python::object &, std::size_t>(
           (arg("python_file_obj"), arg("buffer_size") = 0)))
@@ -34,6 +55,92 @@ namespace dials { namespace util { namespace boost_python {
     }
   };
 
+  /**
+   * Pickle the resolution map as its arrays
+   */
+  struct resolution_map_pickle_suite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const ResolutionMap &self) {
+      return boost::python::make_tuple(self.resolution(), self.two_theta());
+    }
+  };
+
+  /**
+   * Access to the profiler from Python. The names of events recorded from
+   * Python are kept by the profiler.
+   */
+  struct profile_wrapper {
+    typedef dials::util::profile::Profiler Profiler;
+
+    static void enable(bool value) {
+      Profiler::instance().enable(value);
+    }
+
+    static bool enabled() {
+      return Profiler::instance().enabled();
+    }
+
+    static void clear() {
+      Profiler::instance().clear();
+    }
+
+    static void record(const std::string &name, double start, double duration) {
+      Profiler &profiler = Profiler::instance();
+      if (profiler.enabled()) {
+        profiler.record(profiler.intern(name), 'X', start, duration, 0);
+      }
+    }
+
+    static void count(const std::string &name, double value) {
+      Profiler &profiler = Profiler::instance();
+      if (profiler.enabled()) {
+        profiler.record(
+          profiler.intern(name), 'C', dials::util::profile::timestamp(), 0, value);
+      }
+    }
+
+    /**
+     * @returns A list of (name, phase, start, duration, value, thread) tuples
+     */
+    static boost::python::list events() {
+      std::vector<dials::util::profile::Event> events = Profiler::instance().events();
+      boost::python::list result;
+      for (std::size_t i = 0; i < events.size(); ++i) {
+        const dials::util::profile::Event &e = events[i];
+        result.append(boost::python::make_tuple(std::string(e.name),
+                                                std::string(1, e.phase),
+                                                e.start,
+                                                e.duration,
+                                                e.value,
+                                                e.thread));
+      }
+      return result;
+    }
+
+    static void wrap() {
+      using namespace boost::python;
+      def("profile_enable", &enable, (arg("value") = true));
+      def("profile_enabled", &enabled);
+      def("profile_clear", &clear);
+      def("profile_timestamp", &dials::util::profile::timestamp);
+      def("profile_record", &record, (arg("name"), arg("start"), arg("duration")));
+      def("profile_count", &count, (arg("name"), arg("value") = 1));
+      def("profile_events", &events);
+    }
+  };
+
+  /**
+   * @returns The vertices and colours of the crosses as flex.float arrays
+   */
+  boost::python::tuple point_cloud_crosses(const PointCloud &self,
+                                           std::size_t num_points,
+                                           double size,
+                                           std::size_t nthreads) {
+    af::shared<float> vertices(18 * num_points);
+    af::shared<float> colors(18 * num_points);
+    self.crosses(num_points, size, nthreads, vertices.ref(), colors.ref());
+    return boost::python::make_tuple(vertices, colors);
+  }
+
   using namespace boost::python;
   BOOST_PYTHON_MODULE(dials_util_ext) {
     def("scale_down_array", &scale_down_array, (arg("image"), arg("scale_factor")));
@@ -57,11 +164,68 @@ namespace dials { namespace util { namespace boost_python {
          arg("axis"),
          arg("s0n")));
 
+    class_<MtzStreamWriter, boost::noncopyable>("MtzStreamWriter", no_init)
+      .def(init<iotbx::mtz::object, const std::string &>(
+        (arg("mtz"), arg("filename"))))
+      .def("add_rows",
+           &mtz_stream_writer_add_rows,
+           (arg("miller_index"), arg("columns"), arg("nthreads") = 1))
+      .def("finish", &MtzStreamWriter::finish)
+      .def("n_reflections", &MtzStreamWriter::n_reflections);
+
+    class_<ColumnFormatter>("ColumnFormatter", no_init)
+      .def(init<const std::string &>((arg("line_end") = "\n")))
+      .def("add_int_column",
+           &ColumnFormatter::add_int_column,
+           (arg("values"), arg("format")))
+      .def("add_size_t_column",
+           &ColumnFormatter::add_size_t_column,
+           (arg("values"), arg("format")))
+      .def("add_double_column",
+           &ColumnFormatter::add_double_column,
+           (arg("values"), arg("format")))
+      .def("format",
+           &ColumnFormatter::format,
+           (arg("first"), arg("last"), arg("nthreads") = 1))
+      .def("num_columns", &ColumnFormatter::num_columns)
+      .def("__len__", &ColumnFormatter::size);
+
+    class_<ResolutionMap>("ResolutionMap", no_init)
+      .def(init<const BeamBase &, const Panel &, std::size_t>(
+        (arg("beam"), arg("panel"), arg("nthreads") = 1)))
+      .def(init<const af::versa<double, af::c_grid<2> > &,
+                const af::versa<double, af::c_grid<2> > &>(
+        (arg("resolution"), arg("two_theta"))))
+      .def("resolution", &ResolutionMap::resolution)
+      .def("two_theta", &ResolutionMap::two_theta)
+      .def_pickle(resolution_map_pickle_suite());
+
     class_<ResolutionMaskGenerator>("ResolutionMaskGenerator", no_init)
       .def(init<const BeamBase &, const Panel &>())
+      .def(init<const ResolutionMap &>())
       .def("apply", &ResolutionMaskGenerator::apply);
 
+    class_<PolygonMaskGenerator>("PolygonMaskGenerator", no_init)
+      .def(init<double>((arg("min_coverage"))))
+      .def("add", &PolygonMaskGenerator::add, (arg("polygon")))
+      .def("apply",
+           &PolygonMaskGenerator::apply,
+           (arg("mask"), arg("nthreads") = 1))
+      .def("__len__", &PolygonMaskGenerator::size);
+
+    class_<PointCloud>("PointCloud", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                std::size_t>((arg("points"), arg("colors"), arg("nthreads") = 1)))
+      .def("order", &PointCloud::order)
+      .def("level", &PointCloud::level)
+      .def("crosses",
+           &point_cloud_crosses,
+           (arg("num_points"), arg("size"), arg("nthreads") = 1))
+      .def("__len__", &PointCloud::size);
+
     python_streambuf_wrapper::wrap();
     python_ostream_wrapper::wrap();
+    profile_wrapper::wrap();
   }
 }}}  // namespace dials::util::boost_python
@@ -0,0 +1,245 @@
+/*
+ * column_formatter.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_COLUMN_FORMATTER_H
+#define DIALS_UTIL_COLUMN_FORMATTER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  /**
+   * Format columns of numbers as lines of text, as for the reflection records
+   * of XDS_ASCII, SADABS and mmCIF files. Each column has a printf style
+   * format with a single conversion, e.g. "%4d" or " %8.2f", which may also
+   * hold literal text. A line is the formatted columns in order followed by
+   * the line ending, so the text is the same as formatting each row with
+   * Python's % operator. Blocks of rows are formatted on a pool of threads
+   * and joined in order into one string, ready for a single write.
+   */
+  class ColumnFormatter {
+  public:
+    /**
+     * @param line_end The text at the end of each line
+     */
+    ColumnFormatter(const std::string &line_end = "\n")
+        : line_end_(line_end), size_(0) {}
+
+    /**
+     * Add a column of integers
+     * @param values The values
+     * @param format The format, with a d or i conversion
+     */
+    void add_int_column(const af::shared<int> &values, const std::string &format) {
+      Column column(INT, checked_format(format, "di", ""), values.size());
+      column.ints = values;
+      add_column(column);
+    }
+
+    /**
+     * Add a column of unsigned integers
+     * @param values The values
+     * @param format The format, with a d, i or u conversion
+     */
+    void add_size_t_column(const af::shared<std::size_t> &values,
+                           const std::string &format) {
+      Column column(SIZE_T, checked_format(format, "diu", "lu"), values.size());
+      column.size_ts = values;
+      add_column(column);
+    }
+
+    /**
+     * Add a column of floating point numbers
+     * @param values The values
+     * @param format The format, with an f, e or g conversion
+     */
+    void add_double_column(const af::shared<double> &values,
+                           const std::string &format) {
+      Column column(DOUBLE, checked_format(format, "feEgG", ""), values.size());
+      column.doubles = values;
+      add_column(column);
+    }
+
+    /** @returns The number of rows */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /** @returns The number of columns */
+    std::size_t num_columns() const {
+      return columns_.size();
+    }
+
+    /**
+     * Format a range of rows
+     * @param first The first row
+     * @param last The last row (exclusive)
+     * @param nthreads The number of threads
+     * @returns The text of the rows
+     */
+    std::string format(std::size_t first,
+                       std::size_t last,
+                       std::size_t nthreads = 1) const {
+      DIALS_ASSERT(first <= last && last <= size_);
+      std::size_t num_blocks = (last - first + block_size - 1) / block_size;
+      std::vector<std::string> blocks(num_blocks);
+      FormatJob job = {this, first, last, &blocks};
+      parallel_for(num_blocks, nthreads, job);
+      std::size_t length = 0;
+      for (std::size_t i = 0; i < blocks.size(); ++i) {
+        length += blocks[i].size();
+      }
+      std::string result;
+      result.reserve(length);
+      for (std::size_t i = 0; i < blocks.size(); ++i) {
+        result += blocks[i];
+      }
+      return result;
+    }
+
+  private:
+    enum ColumnType { INT, SIZE_T, DOUBLE };
+
+    /// The number of rows formatted together by one thread
+    static const std::size_t block_size = 4096;
+
+    struct Column {
+      Column(ColumnType type_, const std::string &format_, std::size_t size_)
+          : type(type_), format(format_), size(size_) {}
+      ColumnType type;
+      std::string format;
+      std::size_t size;
+      af::shared<int> ints;
+      af::shared<std::size_t> size_ts;
+      af::shared<double> doubles;
+    };
+
+    /**
+     * Format the rows of a range of blocks
+     */
+    struct FormatJob {
+      const ColumnFormatter *formatter;
+      std::size_t first_row;
+      std::size_t last_row;
+      std::vector<std::string> *blocks;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t b = first; b < last; ++b) {
+          std::size_t i0 = first_row + b * block_size;
+          std::size_t i1 = std::min(i0 + block_size, last_row);
+          for (std::size_t i = i0; i < i1; ++i) {
+            formatter->format_row(i, (*blocks)[b]);
+          }
+        }
+      }
+    };
+
+    friend struct FormatJob;
+
+    void add_column(const Column &column) {
+      if (columns_.empty()) {
+        size_ = column.size;
+      }
+      DIALS_ASSERT(column.size == size_);
+      columns_.push_back(column);
+    }
+
+    /**
+     * Append a row to a string
+     */
+    void format_row(std::size_t i, std::string &text) const {
+      for (std::size_t j = 0; j < columns_.size(); ++j) {
+        const Column &column = columns_[j];
+        switch (column.type) {
+        case INT:
+          append(text, column.format, column.ints[i]);
+          break;
+        case SIZE_T:
+          append(text, column.format, (unsigned long)column.size_ts[i]);
+          break;
+        case DOUBLE:
+          append(text, column.format, column.doubles[i]);
+          break;
+        };
+      }
+      text += line_end_;
+    }
+
+    /**
+     * Append a formatted value to a string
+     */
+    template <typename T>
+    static void append(std::string &text, const std::string &format, T value) {
+      char buffer[64];
+      int n = snprintf(buffer, sizeof(buffer), format.c_str(), value);
+      DIALS_ASSERT(n >= 0);
+      if (n < (int)sizeof(buffer)) {
+        text.append(buffer, n);
+      } else {
+        std::vector<char> large(n + 1);
+        snprintf(&large[0], large.size(), format.c_str(), value);
+        text.append(&large[0], n);
+      }
+    }
+
+    /**
+     * Check that a format has exactly one conversion of the allowed types
+     * @param format The format
+     * @param allowed The allowed conversion characters
+     * @param replacement If not empty, replace the conversion with this
+     * @returns The format
+     */
+    static std::string checked_format(const std::string &format,
+                                      const std::string &allowed,
+                                      const std::string &replacement) {
+      std::string result;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < format.size(); ++i) {
+        if (format[i] != '%') {
+          result += format[i];
+          continue;
+        }
+        if (i + 1 < format.size() && format[i + 1] == '%') {
+          result += "%%";
+          ++i;
+          continue;
+        }
+        // Flags, width and precision
+        std::size_t j = i + 1;
+        while (j < format.size() && is_flag(format[j])) {
+          ++j;
+        }
+        DIALS_ASSERT(j < format.size());
+        DIALS_ASSERT(allowed.find(format[j]) != std::string::npos);
+        result += format.substr(i, j - i);
+        result += replacement.empty() ? std::string(1, format[j]) : replacement;
+        count++;
+        i = j;
+      }
+      DIALS_ASSERT(count == 1);
+      return result;
+    }
+
+    static bool is_flag(char c) {
+      return std::string("-+ #0123456789.").find(c) != std::string::npos;
+    }
+
+    std::string line_end_;
+    std::size_t size_;
+    std::vector<Column> columns_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_COLUMN_FORMATTER_H
@@ -37,37 +37,10 @@ def blank_counts_analysis(reflections, scan, phi_step, fractional_loss):
 
     potential_blank_sel = fractional_counts <= fractional_loss
 
-    xmin, xmax = zip(
-        *[
-            (slot_info.low_cutoff, slot_info.high_cutoff)
-            for slot_info in hist.slot_infos()
-        ]
+    return _blank_analysis_result(
+        *_histogram_slots(hist), list(hist.slots()), potential_blank_sel
     )
 
-    d = {
-        "data": [
-            {
-                "x": list(hist.slot_centers()),
-                "y": list(hist.slots()),
-                "xlow": xmin,
-                "xhigh": xmax,
-                "blank": list(potential_blank_sel),
-                "type": "bar",
-                "name": "blank_counts_analysis",
-            }
-        ],
-        "layout": {
-            "xaxis": {"title": "z observed (images)"},
-            "yaxis": {"title": "Number of reflections"},
-            "bargap": 0,
-        },
-    }
-
-    blank_regions = blank_regions_from_sel(d["data"][0])
-    d["blank_regions"] = blank_regions
-
-    return d
-
 
 def blank_integrated_analysis(reflections, scan, phi_step, fractional_loss):
     prf_sel = reflections.get_flags(reflections.flags.integrated_prf)
@@ -111,18 +84,122 @@ def blank_integrated_analysis(reflections, scan, phi_step, fractional_loss):
 
     potential_blank_sel = mean_i_sigi <= (fractional_loss * flex.max(mean_i_sigi))
 
+    return _blank_analysis_result(
+        *_histogram_slots(hist), list(mean_i_sigi), potential_blank_sel
+    )
+
+
+def _slots_from_summary(summary, name, scan, phi_step, observed_range):
+    """
+    Bin the images of a summary as for the reflections. Each image is put in
+    the slot holding its centre.
+
+    :param summary: The per-image summary
+    :param name: The count column
+    :param scan: The scan
+    :param phi_step: The width of the bins in degrees
+    :param observed_range: Choose the number of bins from the images with
+                           counts, rather than from the whole scan
+    :returns: The total count and value sum of each slot and the slot limits
+    """
+    osc = scan.get_oscillation()[1]
+    n_images_per_step = iceil(phi_step / osc)
+    phi_step = n_images_per_step * osc
+
+    counts = summary[name]
+    array_range = scan.get_array_range()
+    image_range = array_range
+    if observed_range:
+        observed = [i for i, n in enumerate(counts) if n > 0]
+        image_range = (
+            summary.first_image + observed[0],
+            summary.first_image + observed[-1] + 1,
+        )
+    phi_min = scan.get_angle_from_array_index(image_range[0])
+    phi_max = scan.get_angle_from_array_index(image_range[1])
+    n_steps = max(int(round((phi_max - phi_min) / phi_step)), 1)
+    width = (array_range[1] - array_range[0]) / n_steps
+
+    totals = [0] * n_steps
+    sums = [0.0] * n_steps
+    values = summary[name + "_sum"] if name + "_sum" in summary else counts
+    for i, (n, v) in enumerate(zip(counts, values)):
+        centre = summary.first_image + i + 0.5
+        slot = int((centre - array_range[0]) // width)
+        if 0 <= slot < n_steps:
+            totals[slot] += n
+            sums[slot] += v
+    xlow = [array_range[0] + i * width for i in range(n_steps)]
+    xhigh = [array_range[0] + (i + 1) * width for i in range(n_steps)]
+    return totals, sums, xlow, xhigh
+
+
+def blank_counts_analysis_from_summary(
+    summary, scan, phi_step, fractional_loss, name="n_strong"
+):
+    """
+    As blank_counts_analysis, from the per-image summary of the reflections.
+
+    :param summary: The ImageSummary of the experiment
+    :param name: The count column, e.g. n_strong or n_indexed
+    """
+    if name not in summary or not any(summary[name]):
+        raise ValueError("Input contains no reflections")
+    counts, _, xlow, xhigh = _slots_from_summary(
+        summary, name, scan, phi_step, observed_range=False
+    )
+    max_count = max(counts)
+    potential_blank_sel = [n / max_count <= fractional_loss for n in counts]
+    x = [(low + high) / 2 for low, high in zip(xlow, xhigh)]
+    return _blank_analysis_result(x, xlow, xhigh, counts, potential_blank_sel)
+
+
+def blank_integrated_analysis_from_summary(summary, scan, phi_step, fractional_loss):
+    """
+    As blank_integrated_analysis, from the per-image summary of the reflections.
+
+    :param summary: The ImageSummary of the experiment
+    """
+    if "i_sigi" not in summary or not any(summary["i_sigi"]):
+        raise ValueError("Input contains no integrated reflections")
+    counts, sums, xlow, xhigh = _slots_from_summary(
+        summary, "i_sigi", scan, phi_step, observed_range=True
+    )
+    mean_i_sigi = [s / n if n else 0 for n, s in zip(counts, sums)]
+    max_i_sigi = max(mean_i_sigi)
+    potential_blank_sel = [m <= fractional_loss * max_i_sigi for m in mean_i_sigi]
+    x = [(low + high) / 2 for low, high in zip(xlow, xhigh)]
+    return _blank_analysis_result(x, xlow, xhigh, mean_i_sigi, potential_blank_sel)
+
+
+def _histogram_slots(hist):
+    """
+    :param hist: The histogram
+    :returns: The centres, lower limits and upper limits of the slots
+    """
     xmin, xmax = zip(
         *[
             (slot_info.low_cutoff, slot_info.high_cutoff)
             for slot_info in hist.slot_infos()
         ]
     )
-
+    return list(hist.slot_centers()), xmin, xmax
+
+
+def _blank_analysis_result(x, xmin, xmax, y, potential_blank_sel):
+    """
+    :param x: The centre of each slot
+    :param xmin: The lower limit of each slot
+    :param xmax: The upper limit of each slot
+    :param y: The value for each slot
+    :param potential_blank_sel: Is each slot potentially blank
+    :returns: The plot of the analysis and the blank regions
+    """
     d = {
         "data": [
             {
-                "x": list(hist.slot_centers()),
-                "y": list(mean_i_sigi),
+                "x": x,
+                "y": y,
                 "xlow": xmin,
                 "xhigh": xmax,
                 "blank": list(potential_blank_sel),
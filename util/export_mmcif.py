@@ -15,6 +15,8 @@
 from scitbx.array_family import flex
 
 import dials.util.version
+from dials.util.export_text import write_formatted_columns
+from dials.util.ext import ColumnFormatter
 from dials.util.filter_reflections import filter_reflection_table
 
 logger = logging.getLogger(__name__)
@@ -56,10 +58,11 @@ def write(self, experiments, reflections):
         else:
             filename = self.params.mmcif.hklout
 
-        # Add the block
-        self._cif["dials"] = self.make_cif_block(experiments, reflections)
-
-        loop_format_strings = {"_pdbx_diffrn_unmerged_refln": self._fmt}
+        # Add the block; the unmerged reflections are formatted separately
+        self._unmerged_reflections = None
+        self._cif["dials"] = self.make_cif_block(
+            experiments, reflections, add_unmerged_reflections=False
+        )
 
         # Print to file
         if self.params.mmcif.compress and not filename.endswith(
@@ -75,13 +78,41 @@ def write(self, experiments, reflections):
         else:
             open_fn = open
         with open_fn(filename, "wt") as fh:
-            self._cif.show(out=fh, loop_format_strings=loop_format_strings)
+            self._cif.show(out=fh)
+            if self._unmerged_reflections is not None:
+                self.write_unmerged_reflections(fh, *self._unmerged_reflections)
 
         # Log
         logger.info("Wrote reflections to %s", filename)
 
-    def make_cif_block(self, experiments, reflections):
-        """Write the data to a cif block"""
+    def write_unmerged_reflections(self, fh, header, loop_values):
+        """
+        Write the _pdbx_diffrn_unmerged_refln loop at the end of the last block,
+        formatting the rows in C++ with the loop format string.
+
+        :param fh: The open text file
+        :param header: The names of the loop items
+        :param loop_values: The flex array of values of each item
+        """
+        formatter = ColumnFormatter()
+        for i, (fmt, values) in enumerate(zip(self._fmt.split(), loop_values)):
+            if i > 0:
+                fmt = " " + fmt
+            if isinstance(values, flex.size_t):
+                formatter.add_size_t_column(values, fmt)
+            elif isinstance(values, flex.int):
+                formatter.add_int_column(values, fmt)
+            else:
+                formatter.add_double_column(values, fmt)
+        fh.write("\nloop_\n")
+        for name in header:
+            fh.write("  %s\n" % name)
+        write_formatted_columns(fh, formatter, self.params.nproc)
+
+    def make_cif_block(self, experiments, reflections, add_unmerged_reflections=True):
+        """Write the data to a cif block. If add_unmerged_reflections is False
+        the unmerged reflection loop is kept to be written by
+        write_unmerged_reflections."""
         # Select reflections
         selection = reflections.get_flags(reflections.flags.integrated, all=True)
         reflections = reflections.select(selection)
@@ -416,6 +447,9 @@ def make_cif_block(self, experiments, reflections):
             k,
             l,
         ] + [reflections[name] for name in variables_present]
+        if not add_unmerged_reflections:
+            self._unmerged_reflections = (header, loop_values)
+            return cif_block
         cif_loop = iotbx.cif.model.loop(data=dict(zip(header, loop_values)))
         cif_block.add_loop(cif_loop)
 
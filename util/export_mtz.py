@@ -4,7 +4,7 @@
 from math import isclose
 
 from iotbx import mtz
-from libtbx import env
+from libtbx import Auto, env
 from scitbx import matrix
 
 import dials.util.ext
@@ -16,6 +16,7 @@
     get_image_ranges,
 )
 from dials.util.filter_reflections import filter_reflection_table
+from dials.util.mp import available_cores
 from dials.util.multi_dataset_handling import (
     assign_unique_identifiers,
     parse_multiple_datasets,
@@ -24,6 +25,31 @@
 
 logger = logging.getLogger(__name__)
 
+# The MTZ column types of the unmerged columns
+column_types = {
+    "H": "H",
+    "K": "H",
+    "L": "H",
+    "I": "J",
+    "SIGI": "Q",
+    "IPR": "J",
+    "SIGIPR": "Q",
+    "BG": "R",
+    "SIGBG": "R",
+    "XDET": "R",
+    "YDET": "R",
+    "BATCH": "B",
+    "BGPKRATIOS": "R",
+    "WIDTH": "R",
+    "MPART": "I",
+    "M_ISYM": "Y",
+    "FLAG": "I",
+    "LP": "R",
+    "FRACTIONCALC": "R",
+    "ROT": "R",
+    "QE": "R",
+}
+
 
 class MTZWriterBase:
     """Helper for adding metadata, crystals and datasets to an mtz file object."""
@@ -252,37 +278,7 @@ def write_columns(self, reflection_table):
 
         nref = len(reflection_table["miller_index"])
         assert nref
-        xdet, ydet, _ = [
-            flex.double(x) for x in reflection_table["xyzobs.px.value"].parts()
-        ]
-
-        # now add column information...
-
-        # FIXME add DIALS_FLAG which can include e.g. was partial etc.
-
-        type_table = {
-            "H": "H",
-            "K": "H",
-            "L": "H",
-            "I": "J",
-            "SIGI": "Q",
-            "IPR": "J",
-            "SIGIPR": "Q",
-            "BG": "R",
-            "SIGBG": "R",
-            "XDET": "R",
-            "YDET": "R",
-            "BATCH": "B",
-            "BGPKRATIOS": "R",
-            "WIDTH": "R",
-            "MPART": "I",
-            "M_ISYM": "Y",
-            "FLAG": "I",
-            "LP": "R",
-            "FRACTIONCALC": "R",
-            "ROT": "R",
-            "QE": "R",
-        }
+        columns = self._column_values(reflection_table)
 
         # derive index columns from original indices with
         #
@@ -297,7 +293,7 @@ def write_columns(self, reflection_table):
 
         # assign H, K, L, M_ISYM space
         for column in "H", "K", "L", "M_ISYM":
-            dataset.add_column(column, type_table[column]).set_values(
+            dataset.add_column(column, column_types[column]).set_values(
                 flex.double(nref, 0.0).as_float()
             )
 
@@ -305,9 +301,65 @@ def write_columns(self, reflection_table):
             reflection_table["miller_index"]
         )
 
-        dataset.add_column("BATCH", type_table["BATCH"]).set_values(
-            reflection_table["batch"].as_double().as_float()
-        )
+        for label, column_type, values in columns:
+            dataset.add_column(label, column_type).set_values(values.as_float())
+
+    def stream_columns(self, filename, reflection_tables, chunk_size, nproc=1):
+        """
+        Write the column definitions to the current dataset and the data
+        straight to the file, a chunk of reflections at a time. The columns are
+        the same as for write_columns, but only one chunk of the derived
+        columns is held in memory at once.
+
+        :param filename: The MTZ file to write
+        :param reflection_tables: The reflection data to write, in order
+        :param chunk_size: The number of reflections in each chunk
+        :param nproc: The number of threads to convert the rows
+        :returns: The number of reflections written
+        """
+        writer = None
+        for reflection_table in reflection_tables:
+            nref = len(reflection_table["miller_index"])
+            for first in range(0, nref, chunk_size):
+                chunk = {
+                    k: v[first : first + chunk_size]
+                    for k, v in reflection_table.items()
+                }
+                columns = self._column_values(chunk)
+                if writer is None:
+                    dataset = self.current_dataset
+                    for column in "H", "K", "L", "M_ISYM":
+                        dataset.add_column(column, column_types[column])
+                    for label, column_type, _ in columns:
+                        dataset.add_column(label, column_type)
+                    writer = dials.util.ext.MtzStreamWriter(self.mtz_file, filename)
+                writer.add_rows(
+                    chunk["miller_index"], [values for _, _, values in columns], nproc
+                )
+        assert writer is not None, "No reflections to write"
+        writer.finish()
+        return writer.n_reflections()
+
+    @staticmethod
+    def _column_values(reflection_table):
+        """
+        :param reflection_table: The reflection data
+        :returns: The label, type and values of each column after H, K, L and
+                  M_ISYM
+        """
+        nref = len(reflection_table["miller_index"])
+        xdet, ydet, _ = [
+            flex.double(x) for x in reflection_table["xyzobs.px.value"].parts()
+        ]
+
+        # FIXME add DIALS_FLAG which can include e.g. was partial etc.
+
+        columns = []
+
+        def add_column(label, values, column_type=None):
+            columns.append((label, column_type or column_types[label], values))
+
+        add_column("BATCH", reflection_table["batch"].as_double())
 
         # if intensity values used in scaling exist, then just export these as I, SIGI
         if "intensity.scale.value" in reflection_table:
@@ -315,15 +367,13 @@ def write_columns(self, reflection_table):
             V_scaling = reflection_table["intensity.scale.variance"]
             # Trap negative variances
             assert V_scaling.all_gt(0)
-            dataset.add_column("I", type_table["I"]).set_values(I_scaling.as_float())
-            dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                flex.sqrt(V_scaling).as_float()
-            )
-            dataset.add_column("SCALEUSED", "R").set_values(
-                reflection_table["inverse_scale_factor"].as_float()
-            )
-            dataset.add_column("SIGSCALEUSED", "R").set_values(
-                flex.sqrt(reflection_table["inverse_scale_factor_variance"]).as_float()
+            add_column("I", I_scaling)
+            add_column("SIGI", flex.sqrt(V_scaling))
+            add_column("SCALEUSED", reflection_table["inverse_scale_factor"], "R")
+            add_column(
+                "SIGSCALEUSED",
+                flex.sqrt(reflection_table["inverse_scale_factor_variance"]),
+                "R",
             )
         else:
             if "intensity.prf.value" in reflection_table:
@@ -335,21 +385,15 @@ def write_columns(self, reflection_table):
                 V_profile = reflection_table["intensity.prf.variance"]
                 # Trap negative variances
                 assert V_profile.all_gt(0)
-                dataset.add_column(col_names[0], type_table["I"]).set_values(
-                    I_profile.as_float()
-                )
-                dataset.add_column(col_names[1], type_table["SIGI"]).set_values(
-                    flex.sqrt(V_profile).as_float()
-                )
+                add_column(col_names[0], I_profile, column_types["I"])
+                add_column(col_names[1], flex.sqrt(V_profile), column_types["SIGI"])
             if "intensity.sum.value" in reflection_table:
                 I_sum = reflection_table["intensity.sum.value"]
                 V_sum = reflection_table["intensity.sum.variance"]
                 # Trap negative variances
                 assert V_sum.all_gt(0)
-                dataset.add_column("I", type_table["I"]).set_values(I_sum.as_float())
-                dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                    flex.sqrt(V_sum).as_float()
-                )
+                add_column("I", I_sum)
+                add_column("SIGI", flex.sqrt(V_sum))
         if (
             "background.sum.value" in reflection_table
             and "background.sum.variance" in reflection_table
@@ -358,36 +402,23 @@ def write_columns(self, reflection_table):
             varbg = reflection_table["background.sum.variance"]
             assert (varbg >= 0).count(False) == 0
             sigbg = flex.sqrt(varbg)
-            dataset.add_column("BG", type_table["BG"]).set_values(bg.as_float())
-            dataset.add_column("SIGBG", type_table["SIGBG"]).set_values(
-                sigbg.as_float()
-            )
+            add_column("BG", bg)
+            add_column("SIGBG", sigbg)
 
-        dataset.add_column("FRACTIONCALC", type_table["FRACTIONCALC"]).set_values(
-            reflection_table["fractioncalc"].as_float()
-        )
+        add_column("FRACTIONCALC", reflection_table["fractioncalc"])
 
-        dataset.add_column("XDET", type_table["XDET"]).set_values(xdet.as_float())
-        dataset.add_column("YDET", type_table["YDET"]).set_values(ydet.as_float())
-        dataset.add_column("ROT", type_table["ROT"]).set_values(
-            reflection_table["ROT"].as_float()
-        )
+        add_column("XDET", xdet)
+        add_column("YDET", ydet)
+        add_column("ROT", reflection_table["ROT"])
         if "lp" in reflection_table:
-            dataset.add_column("LP", type_table["LP"]).set_values(
-                reflection_table["lp"].as_float()
-            )
+            add_column("LP", reflection_table["lp"])
         if "qe" in reflection_table:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                reflection_table["qe"].as_float()
-            )
+            add_column("QE", reflection_table["qe"])
         elif "dqe" in reflection_table:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                reflection_table["dqe"].as_float()
-            )
+            add_column("QE", reflection_table["dqe"])
         else:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                flex.double(nref, 1.0).as_float()
-            )
+            add_column("QE", flex.double(nref, 1.0))
+        return columns
 
 
 def export_mtz(
@@ -404,9 +435,14 @@ def export_mtz(
     force_static_model=False,
     crystal_name=None,
     project_name=None,
+    chunk_size=1000000,
+    nproc=1,
 ):
     """Export data from reflection_table corresponding to experiment_list to an
-    MTZ file hklout."""
+    MTZ file hklout.
+
+    The reflections are written straight to the file a chunk at a time, so the
+    returned MTZ object holds the header but not the reflection data."""
 
     # First get the experiment identifier information out of the data
     expids_in_table = reflection_table.experiment_identifiers()
@@ -570,27 +606,55 @@ def export_mtz(
     for wavelength in wavelengths:
         mtz_writer.add_empty_dataset(wavelength)
 
-    # Combine all of the experiment data columns before writing
-    combined_data = {k: v.deep_copy() for k, v in experiment_list[0].data.items()}
-    for experiment in experiment_list[1:]:
-        for k, v in experiment.data.items():
-            combined_data[k].extend(v)
     # ALL columns must be the same length
-    assert len({len(v) for v in combined_data.values()}) == 1, "Column length mismatch"
-    assert len(combined_data["id"]) == len(
+    for experiment in experiment_list:
+        assert (
+            len({len(v) for v in experiment.data.values()}) == 1
+        ), "Column length mismatch"
+    assert sum(len(e.data["id"]) for e in experiment_list) == len(
         reflection_table["id"]
     ), "Lost rows in split/combine"
 
-    # Write all the data and columns to the mtz file
-    mtz_writer.write_columns(combined_data)
-
+    # Write all the data and columns to the mtz file, one experiment after
+    # another in chunks rather than combining them first
+    if nproc is Auto:
+        nproc = available_cores()
     logger.info(
-        "Saving %s integrated reflections to %s", len(combined_data["id"]), filename
+        "Saving %s integrated reflections to %s", len(reflection_table["id"]), filename
+    )
+    mtz_writer.stream_columns(
+        filename, [e.data for e in experiment_list], chunk_size, nproc
     )
-    mtz_file = mtz_writer.mtz_file
-    mtz_file.write(filename)
 
-    return mtz_file
+    return mtz_writer.mtz_file
+
+
+def show_mtz_summary(mtz_file, out):
+    """
+    Show a summary of the header of an MTZ file written by export_mtz. This
+    needs only the header, unlike mtz_file.show_summary, which also looks at
+    the reflection data.
+
+    :param mtz_file: The MTZ object
+    :param out: The stream to write the summary to
+    """
+    print("Title: %s" % mtz_file.title(), file=out)
+    print("Space group symbol: %s" % mtz_file.space_group_name(), file=out)
+    print("Number of batches: %d" % len(mtz_file.batches()), file=out)
+    print("Number of reflections: %d" % mtz_file.n_reflections(), file=out)
+    for crystal in mtz_file.crystals():
+        print("Crystal: %s" % crystal.name(), file=out)
+        print("  Project: %s" % crystal.project_name(), file=out)
+        cell = ", ".join("%.6g" % p for p in crystal.unit_cell().parameters())
+        print("  Unit cell: (%s)" % cell, file=out)
+        for dataset in crystal.datasets():
+            print("  Dataset: %s" % dataset.name(), file=out)
+            print("    Wavelength: %.6g" % dataset.wavelength(), file=out)
+            columns = dataset.columns()
+            if columns:
+                print("    Columns:", file=out)
+                for column in columns:
+                    print("      %-12s %s" % (column.label(), column.type()), file=out)
 
 
 def match_wavelengths(experiments, absolute_tolerance=1e-4):
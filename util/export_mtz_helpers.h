@@ -2,6 +2,8 @@
 #define DIALS_UTIL_EXPORT_MTZ_HELPERS_H
 
 #include <cmath>
+#include <string>
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/vec2.h>
 #include <scitbx/constants.h>
@@ -9,7 +11,10 @@
 #include <scitbx/math/r3_rotation.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <cctbx/uctbx.h>
+#include <cctbx/miller/asu.h>
 #include <iotbx/mtz/object.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
 
 namespace dials { namespace util {
 
@@ -200,6 +205,130 @@ namespace dials { namespace util {
 
     return mosflm_U;
   }
+  /**
+   * Write the reflections of an unmerged MTZ file straight to disk in chunks,
+   * rather than filling the columns of the MTZ object in memory and writing
+   * the whole file at the end. The MTZ object holds the header: the crystals,
+   * datasets, batches and the (empty) columns, starting with H, K, L and
+   * M_ISYM. Each chunk is converted to rows of floats on a pool of threads
+   * and then written in order, so memory use is set by the chunk size and not
+   * by the number of reflections.
+   */
+  class MtzStreamWriter {
+  public:
+    /**
+     * @param mtz The MTZ object with the header and columns
+     * @param filename The file to write
+     */
+    MtzStreamWriter(iotbx::mtz::object mtz, const std::string &filename)
+        : mtz_(mtz), nref_(0), open_(false) {
+      CMtz::MTZ *ptr = mtz_.ptr();
+      DIALS_ASSERT(ptr->nref == 0);
+      for (int x = 0; x < ptr->nxtal; ++x) {
+        for (int s = 0; s < ptr->xtal[x]->nset; ++s) {
+          for (int c = 0; c < ptr->xtal[x]->set[s]->ncol; ++c) {
+            columns_.push_back(ptr->xtal[x]->set[s]->col[c]);
+          }
+        }
+      }
+      DIALS_ASSERT(columns_.size() >= 4);
+      DIALS_ASSERT(std::string(columns_[0]->label) == "H");
+      DIALS_ASSERT(std::string(columns_[1]->label) == "K");
+      DIALS_ASSERT(std::string(columns_[2]->label) == "L");
+      DIALS_ASSERT(std::string(columns_[3]->label) == "M_ISYM");
+      ptr->refs_in_memory = 0;
+      ptr->fileout = CMtz::MtzOpenForWrite(filename.c_str());
+      DIALS_ASSERT(ptr->fileout != 0);
+      open_ = true;
+    }
+
+    /**
+     * Add a chunk of reflections. The original indices are mapped to the
+     * asymmetric unit with M_ISYM as done by
+     * replace_original_index_miller_indices.
+     * @param hkl The original Miller indices
+     * @param values The values of the columns after M_ISYM
+     * @param nthreads The number of threads to convert the rows
+     */
+    void add_rows(const af::const_ref<cctbx::miller::index<> > &hkl,
+                  const std::vector<af::const_ref<double> > &values,
+                  std::size_t nthreads) {
+      DIALS_ASSERT(open_);
+      if (hkl.size() == 0) {
+        return;
+      }
+      DIALS_ASSERT(values.size() + 4 == columns_.size());
+      for (std::size_t j = 0; j < values.size(); ++j) {
+        DIALS_ASSERT(values[j].size() == hkl.size());
+      }
+      cctbx::sgtbx::space_group space_group = mtz_.space_group();
+      cctbx::sgtbx::reciprocal_space::asu asu(space_group.type());
+      std::vector<float> rows(hkl.size() * columns_.size());
+      RowJob job = {&space_group, &asu, &hkl, &values, &rows[0], columns_.size()};
+      parallel_for(hkl.size(), nthreads, job);
+      CMtz::MTZ *ptr = mtz_.ptr();
+      for (std::size_t i = 0; i < hkl.size(); ++i) {
+        CMtz::ccp4_lwrefl(ptr,
+                          &rows[i * columns_.size()],
+                          &columns_[0],
+                          (int)columns_.size(),
+                          (int)(nref_ + i + 1));
+      }
+      nref_ += hkl.size();
+    }
+
+    /**
+     * Write the header and close the file
+     */
+    void finish() {
+      DIALS_ASSERT(open_);
+      CMtz::MTZ *ptr = mtz_.ptr();
+      ptr->nref = (int)nref_;
+      DIALS_ASSERT(CMtz::MtzPut(ptr, " "));
+      ptr->fileout = 0;
+      open_ = false;
+    }
+
+    /** @returns The number of reflections written */
+    std::size_t n_reflections() const {
+      return nref_;
+    }
+
+  private:
+    /**
+     * Convert a range of reflections to rows of floats
+     */
+    struct RowJob {
+      const cctbx::sgtbx::space_group *space_group;
+      const cctbx::sgtbx::reciprocal_space::asu *asu;
+      const af::const_ref<cctbx::miller::index<> > *hkl;
+      const std::vector<af::const_ref<double> > *values;
+      float *rows;
+      std::size_t ncol;
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t i = first; i < last; ++i) {
+          float *row = rows + i * ncol;
+          cctbx::miller::asym_index asym(*space_group, *asu, (*hkl)[i]);
+          cctbx::miller::index_table_layout_adaptor h = asym.one_column(false);
+          int isym = h.isym();
+          row[0] = (float)h.h()[0];
+          row[1] = (float)h.h()[1];
+          row[2] = (float)h.h()[2];
+          row[3] = (float)(isym >= 0 ? 2 * isym + 1 : -2 * isym);
+          for (std::size_t j = 0; j < values->size(); ++j) {
+            row[j + 4] = (float)(*values)[j][i];
+          }
+        }
+      }
+    };
+
+    iotbx::mtz::object mtz_;
+    std::vector<CMtz::MTZCOL *> columns_;
+    std::size_t nref_;
+    bool open_;
+  };
+
 }}  // namespace dials::util
 
 #endif
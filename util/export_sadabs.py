@@ -5,6 +5,8 @@
 
 from scitbx import matrix
 
+from dials.util.export_text import write_formatted_columns
+from dials.util.ext import ColumnFormatter
 from dials.util.filter_reflections import filter_reflection_table
 
 logger = logging.getLogger(__name__)
@@ -158,61 +160,82 @@ def export_sadabs(integrated_data, experiment_list, params):
     else:
         static = False
 
+    # the direction cosines, detector position and sin(theta)/lambda of each
+    # reflection, formatted below
+    cosines = [flex.double(nref) for _ in range(6)]
+    xyz = [flex.double(nref) for _ in range(3)]
+    istols = flex.int(nref)
+
+    for j in range(nref):
+
+        h, k, l = miller_index[j]
+
+        if params.sadabs.predict:
+            x_mm, y_mm, z_rad = integrated_data["xyzcal.mm"][j]
+        else:
+            x_mm, y_mm, z_rad = integrated_data["xyzobs.mm.value"][j]
+
+        z0 = integrated_data["xyzcal.px"][j][2]
+        istol = int(round(10000 * unit_cell.stol((h, k, l))))
+
+        if params.sadabs.predict or static:
+            # work from a scan static model & assume perfect goniometer
+            # FIXME maybe should work back in the option to predict spot positions
+            UB = matrix.sqr(experiment.crystal.get_A())
+            phi = phi_start + z0 * phi_range
+            R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
+            RUB = S * R * F * UB
+        else:
+            # properly compute RUB for every reflection
+            UB = matrix.sqr(experiment.crystal.get_A_at_scan_point(int(round(z0))))
+            phi = phi_start + z0 * phi_range
+            R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
+            RUB = S * R * F * UB
+
+        x = RUB * (h, k, l)
+        s = (s0 + x).normalize()
+
+        # can also compute s based on centre of mass of spot
+        # s = (origin + x_mm * fast_axis + y_mm * slow_axis).normalize()
+
+        astar = (RUB * (1, 0, 0)).normalize()
+        bstar = (RUB * (0, 1, 0)).normalize()
+        cstar = (RUB * (0, 0, 1)).normalize()
+
+        ix = beam.dot(astar)
+        iy = beam.dot(bstar)
+        iz = beam.dot(cstar)
+
+        dx = s.dot(astar)
+        dy = s.dot(bstar)
+        dz = s.dot(cstar)
+
+        x = x_mm * scl_x
+        y = y_mm * scl_y
+        z = (z_rad * 180 / math.pi - phi_start) / phi_range
+
+        for values, value in zip(cosines, (ix, dx, iy, dy, iz, dz)):
+            values[j] = value
+        for values, value in zip(xyz, (x, y, z)):
+            values[j] = value
+        istols[j] = istol
+
+    # format the records in C++ as with
+    # "%4d%4d%4d%8.2f%8.2f%4d%8.5f%8.5f%8.5f%8.5f%8.5f%8.5f%7.2f%7.2f%8.2f%7.2f%5d"
+    formatter = ColumnFormatter()
+    for hkl in miller_index.as_vec3_double().parts():
+        formatter.add_int_column(hkl.iround(), "%4d")
+    formatter.add_double_column(I, "%8.2f")
+    formatter.add_double_column(sigI, "%8.2f")
+    formatter.add_int_column(flex.int(nref, params.sadabs.run), "%4d")
+    for values in cosines:
+        formatter.add_double_column(values, "%8.5f")
+    formatter.add_double_column(xyz[0], "%7.2f")
+    formatter.add_double_column(xyz[1], "%7.2f")
+    formatter.add_double_column(xyz[2], "%8.2f")
+    formatter.add_double_column(flex.double(nref, detector2t), "%7.2f")
+    formatter.add_int_column(istols, "%5d")
     with open(params.sadabs.hklout, "w") as fout:
+        write_formatted_columns(fout, formatter, params.nproc)
 
-        for j in range(nref):
-
-            h, k, l = miller_index[j]
-
-            if params.sadabs.predict:
-                x_mm, y_mm, z_rad = integrated_data["xyzcal.mm"][j]
-            else:
-                x_mm, y_mm, z_rad = integrated_data["xyzobs.mm.value"][j]
-
-            z0 = integrated_data["xyzcal.px"][j][2]
-            istol = int(round(10000 * unit_cell.stol((h, k, l))))
-
-            if params.sadabs.predict or static:
-                # work from a scan static model & assume perfect goniometer
-                # FIXME maybe should work back in the option to predict spot positions
-                UB = matrix.sqr(experiment.crystal.get_A())
-                phi = phi_start + z0 * phi_range
-                R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
-                RUB = S * R * F * UB
-            else:
-                # properly compute RUB for every reflection
-                UB = matrix.sqr(experiment.crystal.get_A_at_scan_point(int(round(z0))))
-                phi = phi_start + z0 * phi_range
-                R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
-                RUB = S * R * F * UB
-
-            x = RUB * (h, k, l)
-            s = (s0 + x).normalize()
-
-            # can also compute s based on centre of mass of spot
-            # s = (origin + x_mm * fast_axis + y_mm * slow_axis).normalize()
-
-            astar = (RUB * (1, 0, 0)).normalize()
-            bstar = (RUB * (0, 1, 0)).normalize()
-            cstar = (RUB * (0, 0, 1)).normalize()
-
-            ix = beam.dot(astar)
-            iy = beam.dot(bstar)
-            iz = beam.dot(cstar)
-
-            dx = s.dot(astar)
-            dy = s.dot(bstar)
-            dz = s.dot(cstar)
-
-            x = x_mm * scl_x
-            y = y_mm * scl_y
-            z = (z_rad * 180 / math.pi - phi_start) / phi_range
-
-            fout.write(
-                "%4d%4d%4d%8.2f%8.2f%4d%8.5f%8.5f%8.5f%8.5f%8.5f%8.5f"
-                % (h, k, l, I[j], sigI[j], params.sadabs.run, ix, dx, iy, dy, iz, dz)
-            )
-            fout.write("%7.2f%7.2f%8.2f%7.2f%5d\n" % (x, y, z, detector2t, istol))
-
-    fout.close()
     logger.info("Output %d reflections to %s", nref, params.sadabs.hklout)
@@ -17,3 +17,24 @@ def export_text(integrated_data):
 
     for _h, _k, _l, _i, _v in zip(h, k, l, i, v):
         print("%4d %4d %4d %f %f" % (_h, _k, _l, _i, _v))
+
+
+def write_formatted_columns(fh, formatter, nproc=1, chunk_size=100000):
+    """
+    Write the rows of a ColumnFormatter to a file, formatting a chunk of rows
+    at a time on several threads.
+
+    :param fh: The open text file
+    :param formatter: The dials.util.ext.ColumnFormatter with the columns
+    :param nproc: The number of threads to format the rows
+    :param chunk_size: The number of rows to format and write at a time
+    """
+    from libtbx import Auto
+
+    from dials.util.mp import available_cores
+
+    if nproc is Auto:
+        nproc = available_cores()
+    n_rows = len(formatter)
+    for first in range(0, n_rows, chunk_size):
+        fh.write(formatter.format(first, min(first + chunk_size, n_rows), nproc))
@@ -10,6 +10,8 @@
 
 from dials.array_family import flex
 from dials.util import Sorry
+from dials.util.export_text import write_formatted_columns
+from dials.util.ext import ColumnFormatter
 from dials.util.filter_reflections import (
     FilteringReductionMethods,
     filter_reflection_table,
@@ -221,6 +223,7 @@ def _export_experiment(filename, integrated_data, experiment, params, var_model=
 
     s0 = Rd * matrix.col(experiment.beam.get_s0())
 
+    psi_values = flex.double(nref)
     for j in range(nref):
         x, y, z = integrated_data["xyzcal.px"][j]
         phi = phi_start + z * phi_range
@@ -245,24 +248,18 @@ def _export_experiment(filename, integrated_data, experiment, params, var_model=
         psi = q.angle(g, deg=True)
         if q.dot(e) < 0:
             psi *= -1
-
-        fout.write(
-            "%d %d %d %f %f %f %f %f %f %.1f %.1f %f\n"
-            % (
-                h,
-                k,
-                l,
-                I[j],
-                sigI[j],
-                x,
-                y,
-                z,
-                scl[j],
-                partiality[j],
-                prof_corr[j],
-                psi,
-            )
-        )
+        psi_values[j] = psi
+
+    # format the records in C++ as with "%d %d %d %f %f %f %f %f %f %.1f %.1f %f"
+    formatter = ColumnFormatter()
+    for i, hkl in enumerate(miller_index.as_vec3_double().parts()):
+        formatter.add_int_column(hkl.iround(), "%d" if i == 0 else " %d")
+    for values in [I, sigI] + list(integrated_data["xyzcal.px"].parts()) + [scl]:
+        formatter.add_double_column(values, " %f")
+    formatter.add_double_column(partiality, " %.1f")
+    formatter.add_double_column(prof_corr, " %.1f")
+    formatter.add_double_column(psi_values, " %f")
+    write_formatted_columns(fout, formatter, params.nproc)
 
     fout.write("!END_OF_DATA\n")
     fout.close()
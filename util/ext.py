@@ -1,10 +1,21 @@
 from dials_util_ext import *  # noqa: F403; lgtm
 
 __all__ = (  # noqa: F405
+    "ColumnFormatter",
+    "MtzStreamWriter",
+    "PointCloud",
+    "ResolutionMap",
     "ResolutionMaskGenerator",
     "add_dials_batches",
     "dials_u_to_mosflm",
     "ostream",
+    "profile_clear",
+    "profile_count",
+    "profile_enable",
+    "profile_enabled",
+    "profile_events",
+    "profile_record",
+    "profile_timestamp",
     "scale_down_array",
     "streambuf",
 )
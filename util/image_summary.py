@@ -0,0 +1,204 @@
+"""
+Compact per-image summaries of a reflection table.
+
+A summary has, for each image of each experiment, the number of strong,
+indexed and integrated reflections, the moments of their intensities and the
+mean background. dials.find_spots and dials.integrate can write the summaries
+next to their reflections, and then dials.detect_blanks and
+dials.spot_counts_per_image can make their per-image tables and plots from them
+without reading the reflections again.
+"""
+
+import json
+import logging
+
+import numpy as np
+
+logger = logging.getLogger(__name__)
+
+
+class ImageSummary:
+    """
+    The per-image summary of the reflections of one experiment. Each column
+    is a list with one value for each image.
+    """
+
+    def __init__(self, first_image, num_images, columns=None):
+        """
+        :param first_image: The array index of the first image
+        :param num_images: The number of images
+        :param columns: The columns of per-image values
+        """
+        self.first_image = first_image
+        self.num_images = num_images
+        self.columns = {}
+        for name, values in (columns or {}).items():
+            self[name] = values
+
+    def __contains__(self, name):
+        return name in self.columns
+
+    def __getitem__(self, name):
+        return self.columns[name]
+
+    def __setitem__(self, name, values):
+        values = list(values)
+        assert len(values) == self.num_images, f"Wrong length for column {name}"
+        self.columns[name] = values
+
+    def image_index(self, reflections):
+        """
+        :param reflections: The reflections
+        :returns: The index of the image holding each observed centroid, or -1
+        """
+        z = reflections["xyzobs.px.value"].parts()[2].as_numpy_array()
+        index = np.floor(z).astype(np.int64) - self.first_image
+        index[(index < 0) | (index >= self.num_images)] = -1
+        return index
+
+    def add_sums(self, name, index, values=None):
+        """
+        Add columns with the number of values on each image and, if values are
+        given, their sum and sum of squares.
+
+        :param name: The name of the count column; the sums are name_sum and
+                     name_sum_sq
+        :param index: The image index of each value
+        :param values: The values
+        """
+        inside = index >= 0
+        index = index[inside]
+        self[name] = np.bincount(index, minlength=self.num_images).tolist()
+        if values is not None:
+            values = np.asarray(values, dtype=np.float64)[inside]
+            self[name + "_sum"] = np.bincount(
+                index, weights=values, minlength=self.num_images
+            ).tolist()
+            self[name + "_sum_sq"] = np.bincount(
+                index, weights=values * values, minlength=self.num_images
+            ).tolist()
+
+    @classmethod
+    def from_reflections(cls, experiment, reflections, spot_statistics=False):
+        """
+        Summarise the reflections of an experiment.
+
+        :param experiment: The experiment
+        :param reflections: The reflections of the experiment
+        :param spot_statistics: Also add the per_image_analysis spot counts
+        :returns: The summary
+        """
+        try:
+            first_image, last_image = experiment.scan.get_array_range()
+        except AttributeError:
+            first_image, last_image = 0, 1
+        summary = cls(first_image, last_image - first_image)
+        if "xyzobs.px.value" not in reflections:
+            return summary
+        index = summary.image_index(reflections)
+
+        def flagged(flag):
+            return reflections.get_flags(flag).as_numpy_array()
+
+        flags = reflections.flags
+        strong = flagged(flags.strong)
+        intensity = None
+        if "intensity.sum.value" in reflections:
+            intensity = reflections["intensity.sum.value"].as_numpy_array()[strong]
+        summary.add_sums("n_strong", index[strong], intensity)
+        indexed = flagged(flags.indexed) & ~flagged(flags.centroid_outlier)
+        summary.add_sums("n_indexed", index[indexed])
+
+        # The I/sigma of the integrated reflections, as used by detect_blanks:
+        # the profile fitted intensities if there are any, otherwise the
+        # summation intensities
+        integrated = flagged(flags.integrated)
+        summary.add_sums("n_integrated", index[integrated])
+        prf = flagged(flags.integrated_prf)
+        if prf.any():
+            selection, kind = prf, "prf"
+        else:
+            selection, kind = flagged(flags.integrated_sum), "sum"
+        if selection.any():
+            intensities = reflections[f"intensity.{kind}.value"].as_numpy_array()
+            variances = reflections[f"intensity.{kind}.variance"].as_numpy_array()
+            i_sigi = intensities[selection] / np.sqrt(variances[selection])
+            summary.add_sums("i_sigi", index[selection], i_sigi)
+        if integrated.any() and "background.mean" in reflections:
+            background = reflections["background.mean"].as_numpy_array()
+            summary.add_sums("background", index[integrated], background[integrated])
+
+        if spot_statistics:
+            from dials.algorithms.spot_finding.per_image_analysis import (
+                per_image_statistics,
+            )
+
+            spots = reflections.select(reflections.get_flags(flags.strong))
+            statistics = per_image_statistics(experiment)
+            statistics.add_pixels(
+                spots["panel"],
+                spots["xyzobs.px.value"],
+                spots["intensity.sum.value"],
+            )
+            summary["n_spots_total"] = statistics.n_spots_total()
+            summary["n_spots_no_ice"] = statistics.n_spots_no_ice()
+            summary["n_spots_4A"] = statistics.n_spots_4A()
+            summary["total_intensity"] = statistics.total_intensity()
+        return summary
+
+    def mean(self, name):
+        """
+        :param name: The name of the count column
+        :returns: The mean value on each image, or 0 for images with none
+        """
+        counts = np.asarray(self[name], dtype=np.float64)
+        sums = np.asarray(self[name + "_sum"], dtype=np.float64)
+        return np.divide(sums, counts, out=np.zeros_like(sums), where=counts > 0)
+
+    def as_dict(self):
+        return {
+            "first_image": self.first_image,
+            "num_images": self.num_images,
+            "columns": self.columns,
+        }
+
+    @classmethod
+    def from_dict(cls, d):
+        return cls(d["first_image"], d["num_images"], d["columns"])
+
+
+def image_summaries(experiments, reflections, spot_statistics=False):
+    """
+    Summarise the reflections of each experiment.
+
+    :param experiments: The experiments
+    :param reflections: The reflections
+    :param spot_statistics: Also add the per_image_analysis spot counts
+    :returns: A list of summaries, one for each experiment
+    """
+    summaries = []
+    for i, experiment in enumerate(experiments):
+        selected = reflections.select(reflections["id"] == i)
+        summaries.append(
+            ImageSummary.from_reflections(experiment, selected, spot_statistics)
+        )
+    return summaries
+
+
+def write_image_summaries(summaries, filename):
+    """
+    :param summaries: The list of summaries
+    :param filename: The output JSON filename
+    """
+    logger.info("Saving the per-image summary to %s", filename)
+    with open(filename, "w") as outfile:
+        json.dump({"summaries": [s.as_dict() for s in summaries]}, outfile)
+
+
+def read_image_summaries(filename):
+    """
+    :param filename: The JSON file written by write_image_summaries
+    :returns: The list of summaries
+    """
+    with open(filename) as infile:
+        return [ImageSummary.from_dict(d) for d in json.load(infile)["summaries"]]
@@ -12,9 +12,15 @@
 #define DIALS_UTIL_MASKING_H
 
 #include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/array_family/tiny.h>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/panel.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/polygon/area.h>
+#include <dials/algorithms/polygon/clip/sutherland_hodgman.h>
+#include <dials/util/work_stealing_thread_pool.h>
 #include <dials/error.h>
 
 namespace dials { namespace util {
@@ -24,6 +30,96 @@ namespace dials { namespace util {
   using scitbx::vec2;
   using scitbx::vec3;
 
+  /**
+   * The resolution and the two theta angle at the centre of each pixel of a
+   * panel. These depend only on the beam and the panel, so they can be
+   * computed once and shared by everything which needs them, e.g. each of
+   * the resolution ranges masked by ResolutionMaskGenerator.
+   */
+  class ResolutionMap {
+  public:
+    /**
+     * Compute the maps, with the rows split between threads
+     * @param beam The beam model
+     * @param panel The panel model
+     * @param nthreads The number of threads to use
+     */
+    ResolutionMap(const BeamBase &beam, const Panel &panel, std::size_t nthreads = 1)
+        : resolution_(
+          af::c_grid<2>(panel.get_image_size()[1], panel.get_image_size()[0])),
+          two_theta_(resolution_.accessor()) {
+      DIALS_ASSERT(nthreads > 0);
+      parallel_for(resolution_.accessor()[0],
+                   nthreads,
+                   Job(beam, panel, resolution_.ref(), two_theta_.ref()));
+    }
+
+    /**
+     * Initialise from maps computed before
+     * @param resolution The resolution at each pixel
+     * @param two_theta The two theta angle at each pixel
+     */
+    ResolutionMap(const af::versa<double, af::c_grid<2> > &resolution,
+                  const af::versa<double, af::c_grid<2> > &two_theta)
+        : resolution_(resolution), two_theta_(two_theta) {
+      DIALS_ASSERT(resolution.accessor().all_eq(two_theta.accessor()));
+    }
+
+    /** @returns The resolution at each pixel */
+    af::versa<double, af::c_grid<2> > resolution() const {
+      return resolution_;
+    }
+
+    /** @returns The two theta angle at each pixel */
+    af::versa<double, af::c_grid<2> > two_theta() const {
+      return two_theta_;
+    }
+
+  private:
+    /**
+     * Compute the maps for a range of rows
+     */
+    class Job {
+    public:
+      Job(const BeamBase &beam,
+          const Panel &panel,
+          af::ref<double, af::c_grid<2> > resolution,
+          af::ref<double, af::c_grid<2> > two_theta)
+          : panel_(&panel),
+            s0_(beam.get_s0()),
+            unit_s0_(beam.get_s0().normalize()),
+            wavenumber_(1.0 / beam.get_wavelength()),
+            resolution_(resolution),
+            two_theta_(two_theta) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        for (std::size_t j = first; j < last; ++j) {
+          for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
+            vec2<double> px(i + 0.5, j + 0.5);
+            vec3<double> unit_s1 = panel_->get_pixel_lab_coord(px).normalize();
+            vec3<double> r = unit_s1 * wavenumber_ - s0_;
+            double length = r.length();
+            DIALS_ASSERT(length > 0);
+            double c = std::max(-1.0, std::min(1.0, unit_s1 * unit_s0_));
+            resolution_(j, i) = 1 / length;
+            two_theta_(j, i) = std::acos(c);
+          }
+        }
+      }
+
+    private:
+      const Panel *panel_;
+      vec3<double> s0_;
+      vec3<double> unit_s0_;
+      double wavenumber_;
+      af::ref<double, af::c_grid<2> > resolution_;
+      af::ref<double, af::c_grid<2> > two_theta_;
+    };
+
+    af::versa<double, af::c_grid<2> > resolution_;
+    af::versa<double, af::c_grid<2> > two_theta_;
+  };
+
   /**
    * A class to mask multiple resolution ranges
    */
@@ -35,21 +131,14 @@ namespace dials { namespace util {
      * @param panel The panel model
      */
     ResolutionMaskGenerator(const BeamBase &beam, const Panel &panel)
-        : resolution_(
-          af::c_grid<2>(panel.get_image_size()[1], panel.get_image_size()[0])) {
-      vec3<double> s0 = beam.get_s0();
-      double wavenumber = 1.0 / beam.get_wavelength();
-      for (std::size_t j = 0; j < resolution_.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
-          vec2<double> px(i + 0.5, j + 0.5);
-          vec3<double> s1 = panel.get_pixel_lab_coord(px).normalize() * wavenumber;
-          vec3<double> r = s1 - s0;
-          double length = r.length();
-          DIALS_ASSERT(length > 0);
-          resolution_(j, i) = 1 / length;
-        }
-      }
-    }
+        : resolution_(ResolutionMap(beam, panel).resolution()) {}
+
+    /**
+     * Initialise from the resolution map of the panel
+     * @param map The resolution map
+     */
+    ResolutionMaskGenerator(const ResolutionMap &map)
+        : resolution_(map.resolution()) {}
 
     /**
      * Apply the mask
@@ -61,13 +150,9 @@ namespace dials { namespace util {
       DIALS_ASSERT(d_min < d_max);
       DIALS_ASSERT(resolution_.accessor()[0] == mask.accessor()[0]);
       DIALS_ASSERT(resolution_.accessor()[1] == mask.accessor()[1]);
-      for (std::size_t j = 0; j < resolution_.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
-          double d = resolution_(j, i);
-          if (d_min <= d && d <= d_max) {
-            mask(j, i) = false;
-          }
-        }
+      for (std::size_t k = 0; k < resolution_.size(); ++k) {
+        double d = resolution_[k];
+        mask[k] = mask[k] && !(d_min <= d && d <= d_max);
       }
     }
 
@@ -75,6 +160,195 @@ namespace dials { namespace util {
     af::versa<double, af::c_grid<2> > resolution_;
   };
 
+  /**
+   * A class to mask the pixels covered by untrusted polygons.
+   *
+   * The polygons are given in pixel coordinates, with pixel (j, i) covering
+   * [i, i + 1] x [j, j + 1], and a pixel is masked if at least min_coverage
+   * of its area is inside one of them. The mask is rasterised row by row: the
+   * pixels crossed by the edges of a polygon in a row are found from the
+   * edges, and their coverage is the area of the polygon clipped to the row
+   * and then to the pixel. The pixels between the edges are inside or
+   * outside as a whole, so they are filled from the crossings of the edges
+   * with the centre line of the row. The rows are split between threads.
+   */
+  class PolygonMaskGenerator {
+  public:
+    /**
+     * @param min_coverage The fraction of a pixel inside a polygon to mask it
+     */
+    PolygonMaskGenerator(double min_coverage) : min_coverage_(min_coverage) {
+      DIALS_ASSERT(min_coverage >= 0 && min_coverage <= 1);
+    }
+
+    /**
+     * Add a polygon
+     * @param polygon The vertices of the polygon
+     */
+    void add(const af::const_ref<vec2<double> > &polygon) {
+      DIALS_ASSERT(polygon.size() >= 3);
+      polygons_.push_back(std::vector<vec2<double> >(polygon.begin(), polygon.end()));
+    }
+
+    /** @returns The number of polygons */
+    std::size_t size() const {
+      return polygons_.size();
+    }
+
+    /**
+     * Apply the mask
+     * @param mask The mask
+     * @param nthreads The number of threads to use
+     */
+    void apply(af::ref<bool, af::c_grid<2> > mask, std::size_t nthreads = 1) const {
+      DIALS_ASSERT(nthreads > 0);
+      parallel_for(mask.accessor()[0], nthreads, Job(*this, mask));
+    }
+
+  private:
+    typedef std::vector<vec2<double> > polygon_type;
+
+    /**
+     * Mask a range of rows
+     */
+    class Job {
+    public:
+      Job(const PolygonMaskGenerator &self, af::ref<bool, af::c_grid<2> > mask)
+          : self_(&self), mask_(mask) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        std::size_t width = mask_.accessor()[1];
+        std::vector<bool> edge(width, false);
+        std::vector<std::size_t> columns;
+        std::vector<double> crossings;
+        for (std::size_t p = 0; p < self_->polygons_.size(); ++p) {
+          const polygon_type &poly = self_->polygons_[p];
+          double ymin = poly[0][1];
+          double ymax = poly[0][1];
+          for (std::size_t k = 1; k < poly.size(); ++k) {
+            ymin = std::min(ymin, poly[k][1]);
+            ymax = std::max(ymax, poly[k][1]);
+          }
+          double j0 = std::max((double)first, std::floor(ymin));
+          double j1 = std::min((double)last, std::ceil(ymax));
+          for (std::size_t j = j0; j < j1; ++j) {
+            edge_columns(poly, j, edge, columns);
+            fill_interior(poly, j, edge, crossings);
+            mask_edges(poly, j, edge, columns);
+          }
+        }
+      }
+
+    private:
+      /**
+       * Find the columns of the pixels of a row crossed by the edges
+       */
+      void edge_columns(const polygon_type &poly,
+                        std::size_t j,
+                        std::vector<bool> &edge,
+                        std::vector<std::size_t> &columns) const {
+        int width = edge.size();
+        double y0 = j;
+        double y1 = j + 1;
+        columns.clear();
+        for (std::size_t k = 0, l = poly.size() - 1; k < poly.size(); l = k++) {
+          vec2<double> a = poly[l];
+          vec2<double> b = poly[k];
+          if (std::max(a[1], b[1]) < y0 || std::min(a[1], b[1]) > y1) {
+            continue;
+          }
+
+          // The range of x of the part of the edge within the row
+          double xa = a[0];
+          double xb = b[0];
+          if (a[1] != b[1]) {
+            double ya = std::max(y0, std::min(a[1], b[1]));
+            double yb = std::min(y1, std::max(a[1], b[1]));
+            xa = a[0] + (b[0] - a[0]) * (ya - a[1]) / (b[1] - a[1]);
+            xb = a[0] + (b[0] - a[0]) * (yb - a[1]) / (b[1] - a[1]);
+          }
+          int i0 = std::max(0.0, std::floor(std::min(xa, xb)));
+          int i1 = std::min(width - 1.0, std::floor(std::max(xa, xb)));
+          for (int i = i0; i <= i1; ++i) {
+            if (!edge[i]) {
+              edge[i] = true;
+              columns.push_back(i);
+            }
+          }
+        }
+      }
+
+      /**
+       * Mask the pixels of a row between the edges with their centres inside
+       * the polygon, from the crossings of the centre line of the row
+       */
+      void fill_interior(const polygon_type &poly,
+                         std::size_t j,
+                         const std::vector<bool> &edge,
+                         std::vector<double> &crossings) const {
+        double width = edge.size();
+        double y = j + 0.5;
+        crossings.clear();
+        for (std::size_t k = 0, l = poly.size() - 1; k < poly.size(); l = k++) {
+          vec2<double> a = poly[l];
+          vec2<double> b = poly[k];
+          if ((a[1] > y) != (b[1] > y)) {
+            crossings.push_back(a[0] + (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]));
+          }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (std::size_t k = 0; k + 1 < crossings.size(); k += 2) {
+          double i0 = std::max(0.0, std::ceil(crossings[k] - 0.5));
+          double i1 = std::min(width, std::ceil(crossings[k + 1] - 0.5));
+          for (std::size_t i = i0; i < i1; ++i) {
+            if (!edge[i]) {
+              mask_(j, i) = false;
+            }
+          }
+        }
+      }
+
+      /**
+       * Mask the pixels of a row crossed by the edges from the area of the
+       * polygon covering them, and reset the edge columns
+       */
+      void mask_edges(const polygon_type &poly,
+                      std::size_t j,
+                      std::vector<bool> &edge,
+                      const std::vector<std::size_t> &columns) const {
+        if (columns.empty()) {
+          return;
+        }
+        using dials::algorithms::polygon::simple_area;
+        using dials::algorithms::polygon::sutherland_hodgman_rect;
+        double xmin = *std::min_element(columns.begin(), columns.end());
+        double xmax = *std::max_element(columns.begin(), columns.end()) + 1;
+        polygon_type row = sutherland_hodgman_rect(
+          poly, rect(vec2<double>(xmin, j), vec2<double>(xmax, j + 1)));
+        for (std::size_t c = 0; c < columns.size(); ++c) {
+          std::size_t i = columns[c];
+          edge[i] = false;
+          polygon_type pixel = sutherland_hodgman_rect(
+            row, rect(vec2<double>(i, j), vec2<double>(i + 1, j + 1)));
+          double coverage = pixel.size() < 3 ? 0 : std::abs(simple_area(pixel));
+          if (coverage > 0 && coverage >= self_->min_coverage_) {
+            mask_(j, i) = false;
+          }
+        }
+      }
+
+      static scitbx::af::tiny<vec2<double>, 2> rect(vec2<double> a, vec2<double> b) {
+        return scitbx::af::tiny<vec2<double>, 2>(a, b);
+      }
+
+      const PolygonMaskGenerator *self_;
+      af::ref<bool, af::c_grid<2> > mask_;
+    };
+
+    double min_coverage_;
+    std::vector<polygon_type> polygons_;
+  };
+
 }}  // namespace dials::util
 
 #endif /* DIALS_UTIL_MASKING_H */
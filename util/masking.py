@@ -16,7 +16,8 @@
 from iotbx.phil import parse
 
 from dials.array_family import flex
-from dials.util.ext import ResolutionMaskGenerator
+from dials.util.ext import PolygonMaskGenerator, ResolutionMap, ResolutionMaskGenerator
+from dials.util.mp import available_cores
 
 logger = logging.getLogger(__name__)
 
@@ -47,6 +48,13 @@
     .type = floats(2)
     .help = "an untrusted resolution range"
 
+  polygon_coverage = None
+    .type = float(value_min=0, value_max=1)
+    .help = "If set, rasterise the untrusted polygons natively and mask each "
+            "pixel with at least this fraction of its area inside a polygon, "
+            "rather than with dxtbx.masking.mask_untrusted_polygon."
+    .expert_level = 1
+
   untrusted
     .multiple = True
   {
@@ -187,16 +195,20 @@ def generate_ice_ring_resolution_ranges(beam, panel, params):
 
 
 @lru_equality_cache(maxsize=3)
-def _get_resolution_masker(beam, panel):
+def get_resolution_map(beam, panel):
+    """
+    Get the resolution and two theta at each pixel of a panel. This is computed
+    once for each beam and panel and shared by everything that asks for it.
+    """
     t0 = time.perf_counter()
-    masker = ResolutionMaskGenerator(beam, panel)
+    resolution_map = ResolutionMap(beam, panel, nthreads=available_cores())
     t1 = time.perf_counter()
-    logger.debug(f"ResolutionMaskGenerator calculation took {t1 - t0:.4f} seconds")
-    return masker
+    logger.debug(f"ResolutionMap calculation took {t1 - t0:.4f} seconds")
+    return resolution_map
 
 
 def _apply_resolution_mask(mask, beam, panel, *args):
-    _get_resolution_masker(beam, panel).apply(mask, *args)
+    ResolutionMaskGenerator(get_resolution_map(beam, panel)).apply(mask, *args)
 
 
 def generate_mask(
@@ -232,6 +244,9 @@ def generate_mask(
             mask[:, -border:] = bordery
 
         # Apply the untrusted regions
+        polygons = None
+        if params.polygon_coverage is not None:
+            polygons = PolygonMaskGenerator(params.polygon_coverage)
         for region in params.untrusted:
             if region.panel is None:
                 region.panel = 0
@@ -277,9 +292,14 @@ def generate_mask(
                         f"Generating polygon mask:\n panel = {region.panel}\n"
                         + "\n".join(f" coord = {vertex}" for vertex in vertices)
                     )
-                    mask_untrusted_polygon(mask, polygon)
+                    if polygons is not None:
+                        polygons.add(polygon)
+                    else:
+                        mask_untrusted_polygon(mask, polygon)
                 if region.pixel is not None:
                     mask[region.pixel] = False
+        if polygons:
+            polygons.apply(mask, nthreads=available_cores())
 
         # PxMmStrategy to use for generating resolution masks
         if params.disable_parallax_correction:
@@ -249,6 +249,101 @@ def batch_multi_node_parallel_map(
     )
 
 
+def mpi_world():
+    """
+    Get the MPI world communicator. This needs mpi4py to be installed.
+    """
+    try:
+        from mpi4py import MPI
+    except ImportError:
+        raise RuntimeError("mp.method=mpi requires mpi4py to be installed")
+    return MPI.COMM_WORLD
+
+
+def mpi_worker_loop(comm=None):
+    """
+    Run tasks sent by rank 0 until told to stop. Each message is a function
+    and an item; the result of calling the function with the item, or the
+    exception it raised, is sent back to rank 0.
+    """
+    if comm is None:
+        comm = mpi_world()
+    assert comm.Get_rank() > 0, "The worker loop must not run on rank 0"
+    while True:
+        message = comm.recv(source=0)
+        if message is None:
+            break
+        func, item = message
+        try:
+            reply = (True, func(item))
+        except Exception as e:
+            reply = (False, e)
+        comm.send(reply, dest=0)
+
+
+def mpi_stop_workers(comm=None):
+    """
+    Tell the worker ranks to leave the worker loop.
+    """
+    if comm is None:
+        comm = mpi_world()
+    if comm.Get_rank() == 0:
+        for rank in range(1, comm.Get_size()):
+            comm.send(None, dest=rank)
+
+
+def mpi_parallel_map(func, iterable, callback=None, comm=None):
+    """
+    Call func for each item of the iterable on the MPI worker ranks, which
+    must be running mpi_worker_loop. This is called on rank 0 only. The items
+    are handed out one at a time to whichever worker is free, and the callback
+    is called with each result as soon as it arrives, so the results never
+    need to be held or sent all at once. The callback is called in the order
+    the items finish. With a single rank the items are processed in this
+    process.
+    """
+    if comm is None:
+        comm = mpi_world()
+    assert comm.Get_rank() == 0, "mpi_parallel_map must be called on rank 0"
+
+    # With no workers do everything here
+    if comm.Get_size() == 1:
+        for item in iterable:
+            result = func(item)
+            if callback is not None:
+                callback(result)
+        return
+
+    from mpi4py import MPI
+
+    # Give each worker its first item, then give the worker which sent a result
+    # the next one until there are none left
+    items = iter(iterable)
+    active = 0
+    for rank in range(1, comm.Get_size()):
+        item = next(items, None)
+        if item is None:
+            break
+        comm.send((func, item), dest=rank)
+        active += 1
+    error = None
+    status = MPI.Status()
+    while active > 0:
+        success, result = comm.recv(source=MPI.ANY_SOURCE, status=status)
+        active -= 1
+        if not success:
+            error = error or result
+        elif error is None and callback is not None:
+            callback(result)
+        if error is None:
+            item = next(items, None)
+            if item is not None:
+                comm.send((func, item), dest=status.Get_source())
+                active += 1
+    if error is not None:
+        raise error
+
+
 if __name__ == "__main__":
 
     def func(x):
@@ -0,0 +1,96 @@
+/*
+ * numa.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_NUMA_H
+#define DIALS_UTIL_NUMA_H
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace dials { namespace util {
+
+  /**
+   * Parse a list of processors in the kernel format, e.g. "0-3,8-11"
+   * @param text The list of processors
+   * @returns The processor numbers
+   */
+  inline std::vector<int> parse_cpu_list(const std::string &text) {
+    std::vector<int> result;
+    std::istringstream stream(text);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+      if (range.find_first_of("0123456789") == std::string::npos) {
+        continue;
+      }
+      std::size_t dash = range.find('-');
+      int first = std::atoi(range.substr(0, dash).c_str());
+      int last =
+        dash == std::string::npos ? first : std::atoi(range.substr(dash + 1).c_str());
+      for (int cpu = first; cpu <= last; ++cpu) {
+        result.push_back(cpu);
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Read the processors of each NUMA node from sysfs. There's no dependency
+   * on libnuma; memory is placed on a node by first touching it from a
+   * thread running on that node.
+   * @returns The processors of each node, or an empty list if not known
+   */
+  inline std::vector<std::vector<int> > numa_node_cpus() {
+    std::vector<std::vector<int> > result;
+#ifdef __linux__
+    for (std::size_t node = 0;; ++node) {
+      std::ostringstream filename;
+      filename << "/sys/devices/system/node/node" << node << "/cpulist";
+      std::ifstream infile(filename.str().c_str());
+      std::string text;
+      if (!infile || !std::getline(infile, text)) {
+        break;
+      }
+      std::vector<int> cpus = parse_cpu_list(text);
+      if (!cpus.empty()) {
+        result.push_back(cpus);
+      }
+    }
+#endif
+    return result;
+  }
+
+  /**
+   * Restrict the calling thread to run on a set of processors. Does nothing
+   * if the list is empty or the platform doesn't support it.
+   * @param cpus The processors
+   */
+  inline void pin_to_cpus(const std::vector<int> &cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
+      return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (std::size_t i = 0; i < cpus.size(); ++i) {
+      CPU_SET(cpus[i], &cpuset);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#endif
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_NUMA_H
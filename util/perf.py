@@ -0,0 +1,192 @@
+"""
+Record where the time goes in a run with the scoped timers and counters of
+dials/util/profile.h.
+
+The C++ code is instrumented with DIALS_PROFILE_SCOPE and DIALS_PROFILE_COUNT,
+e.g. the thread pool jobs, spot finding thresholds, integration of each image
+and the normal equations in refinement. Nothing is recorded until the profiler
+is enabled, after which each thread keeps its own list of events. Python code
+can add its own timers with scope(). The events can be summarised with
+report() or written with write_chrome_trace() in the trace event format read
+by chrome://tracing and Perfetto.
+
+Example::
+
+  from dials.util import perf
+
+  perf.enable()
+  with perf.scope("find_spots"):
+      reflections = find_spots(experiments)
+  perf.disable()
+  print(perf.report())
+  perf.write_chrome_trace("dials.trace.json")
+"""
+
+import collections
+import contextlib
+import json
+import os
+
+from dials.util import tabulate
+from dials.util.ext import (
+    profile_clear,
+    profile_count,
+    profile_enable,
+    profile_enabled,
+    profile_events,
+    profile_record,
+    profile_timestamp,
+)
+
+Event = collections.namedtuple(
+    "Event", ["name", "phase", "start", "duration", "value", "thread"]
+)
+
+
+def enable():
+    """Start recording events."""
+    profile_enable(True)
+
+
+def disable():
+    """Stop recording events. The events recorded so far are kept."""
+    profile_enable(False)
+
+
+def enabled():
+    """:returns: Are events being recorded"""
+    return profile_enabled()
+
+
+def clear():
+    """Discard the recorded events."""
+    profile_clear()
+
+
+@contextlib.contextmanager
+def scope(name):
+    """
+    Time a block of Python code, if the profiler is enabled. Can also be used
+    as a function decorator.
+
+    :param name: The name of the timer
+    """
+    if not profile_enabled():
+        yield
+        return
+    start = profile_timestamp()
+    try:
+        yield
+    finally:
+        profile_record(name, start, profile_timestamp() - start)
+
+
+def count(name, value=1):
+    """
+    Add to a counter, if the profiler is enabled.
+
+    :param name: The name of the counter
+    :param value: The value to add
+    """
+    profile_count(name, value)
+
+
+def events():
+    """:returns: The recorded events in order of their start time"""
+    return sorted((Event(*e) for e in profile_events()), key=lambda e: e.start)
+
+
+def summary(recorded=None):
+    """
+    Summarise the events by name.
+
+    :param recorded: The events, or None for the recorded events
+    :returns: A dictionary of the timers, with the number of calls and the
+              total, mean and maximum time in seconds, and a dictionary of
+              the totals of the counters
+    """
+    if recorded is None:
+        recorded = events()
+    timers = {}
+    counters = collections.Counter()
+    for e in recorded:
+        if e.phase == "C":
+            counters[e.name] += e.value
+            continue
+        timer = timers.setdefault(e.name, {"calls": 0, "total": 0.0, "max": 0.0})
+        timer["calls"] += 1
+        timer["total"] += e.duration
+        timer["max"] = max(timer["max"], e.duration)
+    for timer in timers.values():
+        timer["mean"] = timer["total"] / timer["calls"]
+    return {"timers": timers, "counters": dict(counters)}
+
+
+def report(recorded=None):
+    """
+    :param recorded: The events, or None for the recorded events
+    :returns: A table of the timers, most expensive first, and the counters
+    """
+    result = summary(recorded)
+    rows = [("Timer", "Calls", "Total (s)", "Mean (ms)", "Max (ms)")]
+    timers = sorted(result["timers"].items(), key=lambda t: -t[1]["total"])
+    for name, timer in timers:
+        rows.append(
+            (
+                name,
+                timer["calls"],
+                f"{timer['total']:.3f}",
+                f"{1000 * timer['mean']:.3f}",
+                f"{1000 * timer['max']:.3f}",
+            )
+        )
+    text = tabulate(rows, headers="firstrow")
+    if result["counters"]:
+        rows = [("Counter", "Total")]
+        rows.extend((n, f"{v:g}") for n, v in sorted(result["counters"].items()))
+        text += "\n\n" + tabulate(rows, headers="firstrow")
+    return text
+
+
+def chrome_trace(recorded=None):
+    """
+    Convert the events to the trace event format. The timers are complete
+    events on the thread that recorded them and the counters show the running
+    total of each counter over all threads.
+
+    :param recorded: The events, or None for the recorded events
+    :returns: The trace as a dictionary
+    """
+    if recorded is None:
+        recorded = events()
+    recorded = sorted(recorded, key=lambda e: e.start)
+    origin = recorded[0].start if recorded else 0
+    pid = os.getpid()
+    totals = collections.Counter()
+    trace = []
+    for e in recorded:
+        event = {
+            "name": e.name,
+            "ph": e.phase,
+            "ts": 1e6 * (e.start - origin),
+            "pid": pid,
+            "tid": e.thread,
+        }
+        if e.phase == "C":
+            totals[e.name] += e.value
+            event["args"] = {"value": totals[e.name]}
+        else:
+            event["dur"] = 1e6 * e.duration
+        trace.append(event)
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def write_chrome_trace(filename, recorded=None):
+    """
+    Write the events in the trace event format.
+
+    :param filename: The output file
+    :param recorded: The events, or None for the recorded events
+    """
+    with open(filename, "w") as outfile:
+        json.dump(chrome_trace(recorded), outfile)
@@ -0,0 +1,239 @@
+/*
+ * point_cloud.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_POINT_CLOUD_H
+#define DIALS_UTIL_POINT_CLOUD_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  using scitbx::vec3;
+
+  /**
+   * Build the vertex buffers for drawing a large cloud of points, e.g. the
+   * reciprocal lattice points of the reciprocal lattice viewer, as a cross at
+   * each point.
+   *
+   * The points are put in order of level of detail, so that any number of
+   * the first points gives a decimated view of the whole cloud. The bounding
+   * box of the points is divided into grids of 2, 4, 8, ... cells along each
+   * axis, and a point belongs to the coarsest level at which it is the first
+   * point of its cell. The points of each level keep their input order. This
+   * keeps the isolated points in the coarse levels while thinning out the
+   * dense regions, so a coarse view can be drawn while the view is moving and
+   * the full one once it stops. The levels are found in parallel, as are the
+   * vertices of the crosses.
+   */
+  class PointCloud {
+  public:
+    /**
+     * @param points The points
+     * @param colors The colour of each point
+     * @param nthreads The number of threads
+     */
+    PointCloud(const af::const_ref<vec3<double> > &points,
+               const af::const_ref<vec3<double> > &colors,
+               std::size_t nthreads = 1)
+        : points_(points.begin(), points.end()),
+          colors_(colors.begin(), colors.end()),
+          level_(points.size(), 0),
+          order_(points.size()) {
+      DIALS_ASSERT(colors.size() == points.size());
+      DIALS_ASSERT(nthreads > 0);
+      std::size_t n = points.size();
+      for (std::size_t i = 0; i < n; ++i) {
+        order_[i] = i;
+      }
+      if (n == 0) {
+        return;
+      }
+
+      // Use enough levels for the finest grid to have a cell per point
+      std::size_t num_levels = 1;
+      while (num_levels < 10 && ((std::size_t)1 << (3 * num_levels)) < n) {
+        num_levels++;
+      }
+
+      // Find the points which are first in their cell at each level
+      vec3<double> lower = points[0];
+      vec3<double> upper = points[0];
+      for (std::size_t i = 1; i < n; ++i) {
+        for (std::size_t k = 0; k < 3; ++k) {
+          lower[k] = std::min(lower[k], points[i][k]);
+          upper[k] = std::max(upper[k], points[i][k]);
+        }
+      }
+      std::vector<std::vector<bool> > first(num_levels);
+      dials::util::parallel_for(
+        num_levels, nthreads, LevelJob(points_, lower, upper, first));
+
+      // Put the points in order of level, keeping the input order
+      for (std::size_t i = 0; i < n; ++i) {
+        std::size_t level = num_levels;
+        for (std::size_t l = 0; l < num_levels; ++l) {
+          if (first[l][i]) {
+            level = l;
+            break;
+          }
+        }
+        level_[i] = level;
+      }
+      std::stable_sort(order_.begin(), order_.end(), LevelOrder(&level_[0]));
+    }
+
+    /** @returns The number of points */
+    std::size_t size() const {
+      return points_.size();
+    }
+
+    /** @returns The points in order of level of detail */
+    af::shared<std::size_t> order() const {
+      return af::shared<std::size_t>(order_.begin(), order_.end());
+    }
+
+    /**
+     * @returns The level of detail of each point, 0 being the coarsest, in
+     * the input order
+     */
+    af::shared<std::size_t> level() const {
+      return af::shared<std::size_t>(level_.begin(), level_.end());
+    }
+
+    /**
+     * Compute the vertices and colours of the lines of a cross at each of
+     * the first points in order of level of detail, as 6 vertices of 3
+     * floats per point, for drawing with GL_LINES.
+     * @param num_points The number of points
+     * @param size The half length of the arms of the crosses
+     * @param nthreads The number of threads
+     * @param vertices The vertices
+     * @param vertex_colors The colour of each vertex
+     */
+    void crosses(std::size_t num_points,
+                 double size,
+                 std::size_t nthreads,
+                 af::ref<float> vertices,
+                 af::ref<float> vertex_colors) const {
+      DIALS_ASSERT(num_points <= points_.size());
+      DIALS_ASSERT(vertices.size() == 18 * num_points);
+      DIALS_ASSERT(vertex_colors.size() == 18 * num_points);
+      DIALS_ASSERT(nthreads > 0);
+      dials::util::parallel_for(
+        num_points,
+        nthreads,
+        CrossJob(this, (float)size, vertices.begin(), vertex_colors.begin()));
+    }
+
+  private:
+    /**
+     * Order the points by level
+     */
+    struct LevelOrder {
+      const std::size_t *level;
+      LevelOrder(const std::size_t *level_) : level(level_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return level[a] < level[b];
+      }
+    };
+
+    /**
+     * Find the first point of each cell of a range of the levels
+     */
+    struct LevelJob {
+      const std::vector<vec3<double> > *points;
+      vec3<double> lower;
+      vec3<double> upper;
+      std::vector<std::vector<bool> > *first;
+
+      LevelJob(const std::vector<vec3<double> > &points_,
+               vec3<double> lower_,
+               vec3<double> upper_,
+               std::vector<std::vector<bool> > &first_)
+          : points(&points_), lower(lower_), upper(upper_), first(&first_) {}
+
+      void operator()(std::size_t begin, std::size_t end) const {
+        typedef std::pair<boost::uint64_t, std::size_t> cell_point;
+        std::size_t n = points->size();
+        std::vector<cell_point> cells(n);
+        for (std::size_t l = begin; l < end; ++l) {
+          boost::uint64_t num_cells = (boost::uint64_t)2 << l;
+          double scale[3];
+          for (std::size_t k = 0; k < 3; ++k) {
+            double extent = upper[k] - lower[k];
+            scale[k] = extent > 0 ? num_cells / extent : 0;
+          }
+          for (std::size_t i = 0; i < n; ++i) {
+            boost::uint64_t cell = 0;
+            for (std::size_t k = 0; k < 3; ++k) {
+              boost::uint64_t c =
+                (boost::uint64_t)(((*points)[i][k] - lower[k]) * scale[k]);
+              cell = cell * num_cells + std::min(c, num_cells - 1);
+            }
+            cells[i] = cell_point(cell, i);
+          }
+          std::sort(cells.begin(), cells.end());
+          std::vector<bool> &result = (*first)[l];
+          result.assign(n, false);
+          for (std::size_t j = 0; j < n; ++j) {
+            if (j == 0 || cells[j].first != cells[j - 1].first) {
+              result[cells[j].second] = true;
+            }
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the crosses of a range of the points
+     */
+    struct CrossJob {
+      const PointCloud *self;
+      float size;
+      float *vertices;
+      float *colors;
+
+      CrossJob(const PointCloud *self_, float size_, float *vertices_, float *colors_)
+          : self(self_), size(size_), vertices(vertices_), colors(colors_) {}
+
+      void operator()(std::size_t begin, std::size_t end) const {
+        for (std::size_t j = begin; j < end; ++j) {
+          std::size_t i = self->order_[j];
+          const vec3<double> &p = self->points_[i];
+          const vec3<double> &c = self->colors_[i];
+          float *v = vertices + 18 * j;
+          float *vc = colors + 18 * j;
+          for (std::size_t axis = 0; axis < 3; ++axis) {
+            for (std::size_t side = 0; side < 2; ++side) {
+              for (std::size_t k = 0; k < 3; ++k) {
+                float offset = (k == axis) ? (side == 0 ? -size : size) : 0.0f;
+                *v++ = (float)p[k] + offset;
+                *vc++ = (float)c[k];
+              }
+            }
+          }
+        }
+      }
+    };
+
+    std::vector<vec3<double> > points_;
+    std::vector<vec3<double> > colors_;
+    std::vector<std::size_t> level_;
+    std::vector<std::size_t> order_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_POINT_CLOUD_H
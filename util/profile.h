@@ -0,0 +1,224 @@
+/*
+ * profile.h
+ *
+ *  Copyright (C) 2021 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_PROFILE_H
+#define DIALS_UTIL_PROFILE_H
+
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <boost/atomic.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+/**
+ * Instrument a block of code. DIALS_PROFILE_SCOPE(name) times the rest of the
+ * enclosing scope and DIALS_PROFILE_COUNT(name, value) adds to a counter. The
+ * name must be a string literal. Nothing is recorded unless the profiler has
+ * been enabled at run time, and defining DIALS_PROFILE_DISABLE removes the
+ * instrumentation altogether.
+ */
+#ifdef DIALS_PROFILE_DISABLE
+#define DIALS_PROFILE_SCOPE(name)
+#define DIALS_PROFILE_COUNT(name, value)
+#else
+#define DIALS_PROFILE_JOIN2(a, b) a##b
+#define DIALS_PROFILE_JOIN(a, b) DIALS_PROFILE_JOIN2(a, b)
+#define DIALS_PROFILE_SCOPE(name) \
+  dials::util::profile::ScopedTimer DIALS_PROFILE_JOIN(dials_profile_, __LINE__)(name)
+#define DIALS_PROFILE_COUNT(name, value) dials::util::profile::count(name, value)
+#endif
+
+namespace dials { namespace util { namespace profile {
+
+  /**
+   * A monotonic wall clock timestamp in seconds, as used by the integration
+   * telemetry. Windows falls back to clock(), which measures wall clock time
+   * there.
+   */
+  inline double timestamp() {
+#ifdef _WIN32
+    return ((double)clock()) / ((double)CLOCKS_PER_SEC);
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+#endif
+  }
+
+  /**
+   * A recorded event. Timers have phase 'X' with a start and duration in
+   * seconds; counters have phase 'C' with the value added at the start time.
+   */
+  struct Event {
+    const char *name;
+    char phase;
+    double start;
+    double duration;
+    double value;
+    std::size_t thread;
+  };
+
+  /**
+   * The process wide store of events. Each thread appends to its own buffer,
+   * so recording only takes an uncontended lock; the buffers are kept after
+   * their threads exit so the events of a thread pool can be read once the
+   * pool has gone.
+   */
+  class Profiler : public boost::noncopyable {
+  public:
+    /**
+     * @returns The profiler
+     */
+    static Profiler &instance() {
+      static Profiler profiler;
+      return profiler;
+    }
+
+    /**
+     * @returns Is recording enabled
+     */
+    bool enabled() const {
+      return enabled_.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Enable or disable recording
+     * @param value Enable recording
+     */
+    void enable(bool value) {
+      enabled_.store(value, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Record an event on the calling thread
+     */
+    void record(const char *name,
+                char phase,
+                double start,
+                double duration,
+                double value) {
+      Buffer &buffer = local();
+      Event event = {name, phase, start, duration, value, buffer.thread};
+      boost::lock_guard<boost::mutex> lock(buffer.mutex);
+      buffer.events.push_back(event);
+    }
+
+    /**
+     * Keep a copy of a name which doesn't outlive the events, e.g. a string
+     * from Python.
+     * @param name The name
+     * @returns A pointer to the kept name
+     */
+    const char *intern(const std::string &name) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return names_.insert(name).first->c_str();
+    }
+
+    /**
+     * @returns The events recorded by all threads
+     */
+    std::vector<Event> events() {
+      std::vector<Event> result;
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        boost::lock_guard<boost::mutex> buffer_lock(buffers_[i]->mutex);
+        result.insert(
+          result.end(), buffers_[i]->events.begin(), buffers_[i]->events.end());
+      }
+      return result;
+    }
+
+    /**
+     * Discard the recorded events
+     */
+    void clear() {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        boost::lock_guard<boost::mutex> buffer_lock(buffers_[i]->mutex);
+        buffers_[i]->events.clear();
+      }
+    }
+
+  private:
+    struct Buffer {
+      boost::mutex mutex;
+      std::vector<Event> events;
+      std::size_t thread;
+    };
+
+    // The buffers are owned by the profiler, not the thread
+    static void release(Buffer *) {}
+
+    Profiler() : enabled_(false), local_(&Profiler::release) {}
+
+    Buffer &local() {
+      Buffer *buffer = local_.get();
+      if (buffer == NULL) {
+        boost::shared_ptr<Buffer> owned = boost::make_shared<Buffer>();
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        owned->thread = buffers_.size();
+        buffers_.push_back(owned);
+        buffer = owned.get();
+        local_.reset(buffer);
+      }
+      return *buffer;
+    }
+
+    boost::atomic<bool> enabled_;
+    boost::thread_specific_ptr<Buffer> local_;
+    boost::mutex mutex_;
+    std::vector<boost::shared_ptr<Buffer> > buffers_;
+    std::set<std::string> names_;
+  };
+
+  /**
+   * Time the lifetime of the object. Whether to record is decided when the
+   * timer is created, so enabling the profiler part way through a scope
+   * doesn't record a partial time.
+   */
+  class ScopedTimer : public boost::noncopyable {
+  public:
+    /**
+     * @param name The name of the timer
+     */
+    explicit ScopedTimer(const char *name)
+        : name_(name), start_(Profiler::instance().enabled() ? timestamp() : -1) {}
+
+    ~ScopedTimer() {
+      if (start_ >= 0) {
+        Profiler::instance().record(name_, 'X', start_, timestamp() - start_, 0);
+      }
+    }
+
+  private:
+    const char *name_;
+    double start_;
+  };
+
+  /**
+   * Add to a counter if the profiler is enabled
+   * @param name The name of the counter
+   * @param value The value to add
+   */
+  inline void count(const char *name, double value) {
+    Profiler &profiler = Profiler::instance();
+    if (profiler.enabled()) {
+      profiler.record(name, 'C', timestamp(), 0, value);
+    }
+  }
+
+}}}  // namespace dials::util::profile
+
+#endif  // DIALS_UTIL_PROFILE_H
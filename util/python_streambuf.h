@@ -4,6 +4,7 @@
 #include <boost/python/object.hpp>
 #include <boost/python/str.hpp>
 #include <boost/python/extract.hpp>
+#include <boost/python/import.hpp>
 
 #include <boost/optional.hpp>
 #include <boost/utility/typed_in_place_factory.hpp>
@@ -12,6 +13,14 @@
 
 #include <streambuf>
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace dials { namespace util {
 
@@ -87,6 +96,19 @@ namespace dials { namespace util {
 
           \c buffer_size is optional. See also: \c default_buffer_size
 
+      \b Fast paths
+
+        - If the Python object is a file opened only for writing with the
+          built-in \c open (i.e. an \c io.BufferedWriter or \c io.FileIO),
+          the data is written straight to its file descriptor rather than
+          through its \c write method, with a buffer of at least
+          \c fd_buffer_size bytes. The Python object is flushed first and its
+          \c seek and \c tell still work afterwards.
+
+        - If the Python object has no \c read method but supports the buffer
+          protocol (e.g. \c bytes, \c bytearray, \c memoryview or \c mmap)
+          it is read in place, without making a copy.
+
     Note: references are to the C++ standard (the numbers between parentheses
     at the end of references are margin markers).
   */
@@ -116,6 +138,9 @@ namespace dials { namespace util {
     */
     static std::size_t default_buffer_size;
 
+    /// The smallest write buffer used when writing to a file descriptor
+    enum { fd_buffer_size = 65536 };
+
     /// Construct from a Python file object
     /** if buffer_size is 0 the current default_buffer_size is used.
      */
@@ -128,7 +153,9 @@ namespace dials { namespace util {
           write_buffer(0),
           pos_of_read_buffer_end_in_py_file(0),
           pos_of_write_buffer_end_in_py_file(buffer_size),
-          farthest_pptr(0) {
+          farthest_pptr(0),
+          fd(-1),
+          has_view(false) {
       DIALS_ASSERT(buffer_size != 0);
       /* Some Python file objects (e.g. sys.stdout and sys.stdin)
          have non-functional seek and tell. If so, assign None to
@@ -147,11 +174,28 @@ namespace dials { namespace util {
         }
       }
 
+      if (py_write != bp::object() && is_write_only_file(python_file_obj)) {
+        bp::object py_flush = getattr(python_file_obj, "flush", bp::object());
+        if (py_flush != bp::object()) py_flush();
+        fd = bp::extract<int>(python_file_obj.attr("fileno")());
+      }
+
+      if (py_read == bp::object() && PyObject_CheckBuffer(python_file_obj.ptr())) {
+        if (PyObject_GetBuffer(python_file_obj.ptr(), &view, PyBUF_SIMPLE) != 0) {
+          bp::throw_error_already_set();
+        }
+        has_view = true;
+        char* data = static_cast<char*>(view.buf);
+        setg(data, data, data + view.len);
+      }
+
       if (py_write != bp::object()) {
+        std::size_t write_buffer_size =
+          fd >= 0 ? std::max(buffer_size, (std::size_t)fd_buffer_size) : buffer_size;
         // C-like string to make debugging easier
-        write_buffer = new char[buffer_size + 1];
-        write_buffer[buffer_size] = '\0';
-        setp(write_buffer, write_buffer + buffer_size);  // 27.5.2.4.5 (5)
+        write_buffer = new char[write_buffer_size + 1];
+        write_buffer[write_buffer_size] = '\0';
+        setp(write_buffer, write_buffer + write_buffer_size);  // 27.5.2.4.5 (5)
         farthest_pptr = pptr();
       } else {
         // The first attempt at output will result in a call to overflow
@@ -168,6 +212,7 @@ namespace dials { namespace util {
     /// Mundane destructor freeing the allocated resources
     virtual ~streambuf() {
       if (write_buffer) delete[] write_buffer;
+      if (has_view) PyBuffer_Release(&view);
     }
 
     /// C.f. C++ standard section 27.5.2.4.3
@@ -184,6 +229,11 @@ namespace dials { namespace util {
     /// C.f. C++ standard section 27.5.2.4.3
     virtual int_type underflow() {
       int_type const failure = traits_type::eof();
+      if (has_view) {
+        // The whole buffer is already in the get area
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        return failure;
+      }
       if (py_read == bp::object()) {
         throw std::invalid_argument("That Python file object has no 'read' attribute");
       }
@@ -212,14 +262,22 @@ namespace dials { namespace util {
       }
       farthest_pptr = std::max(farthest_pptr, pptr());
       off_type n_written = (off_type)(farthest_pptr - pbase());
-      boost::python::object data_bytes(
-        boost::python::handle<>(PyBytes_FromStringAndSize(pbase(), n_written)));
-      py_write(data_bytes);
+      if (fd >= 0) {
+        write_to_fd(pbase(), n_written);
+      } else {
+        boost::python::object data_bytes(
+          boost::python::handle<>(PyBytes_FromStringAndSize(pbase(), n_written)));
+        py_write(data_bytes);
+      }
       if (!traits_type::eq_int_type(c, traits_type::eof())) {
         char trait_char = traits_type::to_char_type(c);
-        boost::python::object char_bytes(
-          boost::python::handle<>(PyBytes_FromStringAndSize(&trait_char, 1)));
-        py_write(char_bytes);
+        if (fd >= 0) {
+          write_to_fd(&trait_char, 1);
+        } else {
+          boost::python::object char_bytes(
+            boost::python::handle<>(PyBytes_FromStringAndSize(&trait_char, 1)));
+          py_write(char_bytes);
+        }
         n_written++;
       }
       if (n_written) {
@@ -271,6 +329,28 @@ namespace dials { namespace util {
       */
       int const failure = off_type(-1);
 
+      if (has_view) {
+        // Seek directly within the buffer
+        if (which != std::ios_base::in) return failure;
+        off_type target;
+        switch (way) {
+        case std::ios_base::beg:
+          target = off;
+          break;
+        case std::ios_base::cur:
+          target = (gptr() - eback()) + off;
+          break;
+        case std::ios_base::end:
+          target = (egptr() - eback()) + off;
+          break;
+        default:
+          return failure;
+        }
+        if (target < 0 || target > egptr() - eback()) return failure;
+        setg(eback(), eback() + target, egptr());
+        return target;
+      }
+
       if (py_seek == bp::object()) {
         throw std::invalid_argument("That Python file object has no 'seek' attribute");
       }
@@ -346,6 +426,48 @@ namespace dials { namespace util {
     // the farthest place the buffer has been written into
     char* farthest_pptr;
 
+    // The file descriptor written to directly, or -1 to use py_write
+    int fd;
+
+    // The buffer of an object read in place
+    Py_buffer view;
+    bool has_view;
+
+    /// Is the object a file from open() which can only be written to
+    /** The exact type is checked so that wrappers of such files (e.g. mocks
+        or compressed files which have a fileno of the file underneath) go
+        through their write method.
+     */
+    static bool is_write_only_file(bp::object& obj) {
+#ifdef _WIN32
+      return false;
+#else
+      bp::object io = bp::import("io");
+      bp::object type(bp::handle<>(bp::borrowed((PyObject*)Py_TYPE(obj.ptr()))));
+      if (type != io.attr("BufferedWriter") && type != io.attr("FileIO")) {
+        return false;
+      }
+      return bp::extract<bool>(obj.attr("writable")())
+             && !bp::extract<bool>(obj.attr("readable")());
+#endif
+    }
+
+    /// Write all the data to the file descriptor
+    void write_to_fd(const char* data, off_type size) {
+#ifndef _WIN32
+      while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          throw std::runtime_error(std::string("Failed to write to file: ")
+                                   + std::strerror(errno));
+        }
+        data += n;
+        size -= n;
+      }
+#endif
+    }
+
     boost::optional<off_type> seekoff_without_calling_python(
       off_type off,
       std::ios_base::seekdir way,
@@ -57,6 +57,7 @@ def __init__(self, settings=None):
             self.settings = settings
         self.goniometer_orig = None
         self.viewer = None
+        self.mapped_settings = None
 
     def load_models(self, experiments, reflections):
         self.experiments = experiments
@@ -108,7 +109,18 @@ def load_models(self, experiments, reflections):
         self.map_points_to_reciprocal_space()
         self.set_points()
 
+    def mapping_settings(self):
+        """The settings which the reciprocal lattice points depend on."""
+        beam_centre = self.settings.beam_centre
+        return (
+            self.settings.reverse_phi,
+            self.settings.crystal_frame,
+            self.settings.beam_centre_panel,
+            tuple(beam_centre) if beam_centre is not None else None,
+        )
+
     def map_points_to_reciprocal_space(self):
+        self.mapped_settings = self.mapping_settings()
         # 155 handle data from predictions *only* if that is what we have
         calculated = "xyzobs.px.value" not in self.reflections_input
         self.reflections = copy.deepcopy(self.reflections_input)
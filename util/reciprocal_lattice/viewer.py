@@ -18,6 +18,8 @@
 )
 
 from dials.util import wx_viewer
+from dials.util.ext import PointCloud
+from dials.util.mp import available_cores
 from dials.util.reciprocal_lattice import Render3d
 
 phil_scope = libtbx.phil.parse(
@@ -34,6 +36,11 @@
   .type = bool
 marker_size = Auto
   .type = int(value_min=1)
+max_interactive_points = 100000
+  .type = int(value_min=1)
+  .help = "The maximum number of points to draw while the view is moving. The "
+          "points are decimated evenly over the lattice, and all of them are "
+          "drawn once the view stops."
 autospin = False
   .type = bool
 model_view_matrix = None
@@ -172,8 +179,13 @@ def set_points(self):
             )
 
     def update_settings(self, *args, **kwds):
-        self.set_beam_centre(self.settings.beam_centre_panel, self.settings.beam_centre)
-        self.map_points_to_reciprocal_space()
+        # Only map the points again if the settings they depend on have changed,
+        # so changing the filters doesn't redo it
+        if self.mapping_settings() != self.mapped_settings:
+            self.set_beam_centre(
+                self.settings.beam_centre_panel, self.settings.beam_centre
+            )
+            self.map_points_to_reciprocal_space()
         self.set_points()
         self.viewer.update_settings(*args, **kwds)
 
@@ -480,11 +492,50 @@ def OnChangeSettings(self, event):
             self.beam_slow_ctrl.SetValue(old_beam_centre[1])
 
 
+def _compile_lines(vertices, colors, n_vertices):
+    """Compile a display list drawing the first of the lines of a vertex buffer.
+
+    The vertices are uploaded with vertex arrays where the OpenGL bindings
+    allow, and one at a time otherwise.
+    """
+    display_list = gltbx.gl_managed.display_list()
+    display_list.compile()
+    gl.glLineWidth(1)
+    try:
+        gl.glEnableClientState(gl.GL_VERTEX_ARRAY)
+        gl.glEnableClientState(gl.GL_COLOR_ARRAY)
+        # The arrays are copied into the display list by glDrawArrays
+        vertex_bytes = vertices.copy_to_byte_str()
+        color_bytes = colors.copy_to_byte_str()
+        gl.glVertexPointer(3, gl.GL_FLOAT, 0, vertex_bytes)
+        gl.glColorPointer(3, gl.GL_FLOAT, 0, color_bytes)
+        gl.glDrawArrays(gl.GL_LINES, 0, n_vertices)
+    except (AttributeError, TypeError):
+        points = flex.vec3_double(vertices.as_double())
+        point_colors = flex.vec3_double(colors.as_double())
+        gl.glBegin(gl.GL_LINES)
+        color = None
+        for i in range(n_vertices):
+            if point_colors[i] != color:
+                color = point_colors[i]
+                gl.glColor3f(*color)
+            gl.glVertex3f(*points[i])
+        gl.glEnd()
+    finally:
+        if hasattr(gl, "glDisableClientState"):
+            gl.glDisableClientState(gl.GL_COLOR_ARRAY)
+            gl.glDisableClientState(gl.GL_VERTEX_ARRAY)
+    display_list.end()
+    return display_list
+
+
 class RLVWindow(wx_viewer.show_points_and_lines_mixin):
     def __init__(self, settings, *args, **kwds):
         super().__init__(*args, **kwds)
         self.settings = settings
         self.points = flex.vec3_double()
+        self.points_ann = None
+        self.coarse_points_display_list = None
         self.colors = None
         self.palette = None
         self.rotation_axis = None
@@ -503,6 +554,7 @@ def __init__(self, settings, *args, **kwds):
     def set_points(self, points):
         self.points = points
         self.points_display_list = None
+        self.points_ann = None
         if self.minimum_covering_sphere is None:
             self.update_minimum_covering_sphere()
 
@@ -527,15 +579,24 @@ def set_palette(self, palette):
 
     def draw_points(self):
         if self.points_display_list is None:
-            self.points_display_list = gltbx.gl_managed.display_list()
-            self.points_display_list.compile()
-            gl.glLineWidth(1)
             if self.colors is None:
                 self.colors = flex.vec3_double(len(self.points), (1, 1, 1))
-            for point, color in zip(self.points, self.colors):
-                self.draw_cross_at(point, color=color)
-            self.points_display_list.end()
-        self.points_display_list.call()
+            # The crosses are built in order of level of detail, so the first
+            # of them give a decimated view of all the points
+            nthreads = available_cores()
+            cloud = PointCloud(self.points, self.colors, nthreads=nthreads)
+            vertices, colors = cloud.crosses(
+                len(cloud), 0.01 * self.settings.marker_size, nthreads=nthreads
+            )
+            n_coarse = min(len(cloud), self.settings.max_interactive_points)
+            self.points_display_list = _compile_lines(vertices, colors, 6 * len(cloud))
+            self.coarse_points_display_list = _compile_lines(
+                vertices, colors, 6 * n_coarse
+            )
+        if self.was_dragged or self.autospin:
+            self.coarse_points_display_list.call()
+        else:
+            self.points_display_list.call()
 
     def set_rotation_axis(self, axis):
         self.rotation_axis = axis
@@ -669,7 +730,9 @@ def draw_cell(self, axes, color):
         gl.glDisable(gl.GL_LINE_STIPPLE)
 
     def label_nearest_point(self):
-        ann = AnnAdaptorSelfInclude(self.points.as_double(), 3)
+        if self.points_ann is None:
+            self.points_ann = AnnAdaptorSelfInclude(self.points.as_double(), 3)
+        ann = self.points_ann
         ann.query(self.rotation_center)
         i = ann.nn[0]
         gltbx.fonts.ucs_bitmap_8x13.setup_call_lists()
@@ -700,6 +763,8 @@ def rotate_view(self, x1, y1, x2, y2, shift_down=False, scale=0.1):
     def OnLeftUp(self, event):
         self.was_dragged = True
         super().OnLeftUp(event)
+        # Draw all the points now the view has stopped moving
+        self.OnRedraw()
 
     def initialize_modelview(self, eye_vector=None, angle=None):
         super().initialize_modelview(eye_vector=eye_vector, angle=angle)
@@ -0,0 +1,232 @@
+"""
+A store of read-only data shared between the processes of a local
+multiprocessing run.
+
+Sending a task to a worker process pickles everything it refers to, so when
+every task carries the same experiment list, executor and profile models,
+these are pickled again for each task. With thousands of experiments this
+can be hundreds of MB per task. A SharedStore instead writes each object once
+into a memory-mapped file in a temporary directory (in /dev/shm where it
+exists) and gives out small handles which are pickled in its place. A worker
+loads each object the first time it sees its handle and keeps it for the
+later tasks it runs.
+
+Reflection tables are written in msgpack format into a single file, one after
+the other, and their handles record the slice of the file holding each table.
+The worker maps the file read-only and decodes its slice, so the columns are
+copied once, straight out of the shared pages.
+
+The handles are only valid while the store is open, and only on the machine
+where it was created.
+"""
+
+import mmap
+import os
+import pickle
+import shutil
+import tempfile
+
+from dials.array_family import flex
+
+# The objects and mapped files a process has loaded from a store, by path
+_loaded_objects = {}
+_mapped_files = {}
+
+
+def _default_directory():
+    """
+    :return: /dev/shm if it exists and is writable, otherwise the temporary
+             directory
+    """
+    if os.path.isdir("/dev/shm") and os.access("/dev/shm", os.W_OK):
+        return "/dev/shm"
+    return tempfile.gettempdir()
+
+
+def _map_file(path, size):
+    """
+    Map a file read-only, keeping the map for later calls. The file is mapped
+    again if it has grown beyond the size of the existing map.
+
+    :param path: The file
+    :param size: The number of bytes that need to be mapped
+    :return: The mapped file
+    """
+    mapped = _mapped_files.get(path)
+    if mapped is None or len(mapped) < size:
+        if mapped is not None:
+            mapped.close()
+        with open(path, "rb") as infile:
+            mapped = mmap.mmap(infile.fileno(), 0, access=mmap.ACCESS_READ)
+        _mapped_files[path] = mapped
+    return mapped
+
+
+def release():
+    """
+    Forget the objects and close the files this process has loaded from any
+    store.
+    """
+    _loaded_objects.clear()
+    for mapped in _mapped_files.values():
+        mapped.close()
+    _mapped_files.clear()
+
+
+class _Pickler(pickle.Pickler):
+    """Pickle the objects already in the store as references to their handles."""
+
+    def __init__(self, outfile, references):
+        super().__init__(outfile, protocol=pickle.HIGHEST_PROTOCOL)
+        self._references = references
+
+    def persistent_id(self, obj):
+        return self._references.get(id(obj))
+
+
+class _Unpickler(pickle.Unpickler):
+    """Load the objects referred to by their handles."""
+
+    def persistent_load(self, pid):
+        return pid.load()
+
+
+class SharedObject:
+    """A handle to a pickled object in a shared store."""
+
+    def __init__(self, path, cached=True):
+        self.path = path
+        self.cached = cached
+
+    def load(self):
+        """
+        Unpickle the object. A cached object is only unpickled the first time
+        it is loaded in a process, and the same copy is returned after that.
+
+        :return: The object
+        """
+        if self.cached and self.path in _loaded_objects:
+            return _loaded_objects[self.path]
+        with open(self.path, "rb") as infile:
+            value = _Unpickler(infile).load()
+        if self.cached:
+            _loaded_objects[self.path] = value
+        return value
+
+
+class SharedReflections:
+    """A handle to a reflection table in a shared store."""
+
+    def __init__(self, path, offset, nbytes):
+        self.path = path
+        self.offset = offset
+        self.nbytes = nbytes
+
+    def load(self, columns=None):
+        """
+        Decode the reflection table from the mapped file.
+
+        :param columns: An optional list of the names of the columns to read
+        :return: A new reflection table
+        """
+        mapped = _map_file(self.path, self.offset + self.nbytes)
+        if columns is not None:
+            columns = list(columns)
+        with memoryview(mapped) as view:
+            return flex.reflection_table.from_msgpack(
+                view[self.offset : self.offset + self.nbytes], columns
+            )
+
+
+class SharedStore:
+    """
+    A temporary directory of shared data, removed when the store is closed.
+    """
+
+    def __init__(self, directory=None):
+        """
+        Create the store.
+
+        :param directory: The directory to create the store in, by default
+                          /dev/shm if available and otherwise the temporary
+                          directory
+        """
+        if directory is None:
+            directory = _default_directory()
+        self.directory = tempfile.mkdtemp(prefix="dials-shared-", dir=directory)
+        self._objects = {}
+        self._reflections_path = os.path.join(self.directory, "reflections")
+        self._reflections = open(self._reflections_path, "wb")
+        self._reflections_size = 0
+
+    def put(self, value, references=(), cached=True):
+        """
+        Pickle an object into the store. Putting the same object again gives
+        the same handle without pickling it again.
+
+        An object which is changed by the tasks that use it, such as an
+        executor which accumulates its results, should not be cached, so that
+        each task loads a fresh copy. The objects it refers to which are
+        read-only, such as the experiments, can be put in the store first and
+        given as references. These are then pickled as references to their
+        handles, and loaded (once per process, if cached) from those.
+
+        :param value: The object
+        :param references: Objects in the store that the object refers to
+        :param cached: Keep the object for later loads in the same process
+        :return: A SharedObject handle
+        """
+        if id(value) not in self._objects:
+            handles = {}
+            for reference in references:
+                assert id(reference) in self._objects, "Reference is not stored"
+                handles[id(reference)] = self._objects[id(reference)][1]
+            path = os.path.join(self.directory, "object-%d" % len(self._objects))
+            with open(path, "wb") as outfile:
+                _Pickler(outfile, handles).dump(value)
+            # Keep the object so that its id is not reused
+            self._objects[id(value)] = (value, SharedObject(path, cached))
+        return self._objects[id(value)][1]
+
+    def put_reflections(self, reflections):
+        """
+        Append a reflection table to the store.
+
+        :param reflections: The reflection table
+        :return: A SharedReflections handle
+        """
+        packed = reflections.as_msgpack()
+        self._reflections.write(packed)
+        self._reflections.flush()
+        handle = SharedReflections(
+            self._reflections_path, self._reflections_size, len(packed)
+        )
+        self._reflections_size += len(packed)
+        return handle
+
+    def nbytes(self):
+        """
+        :return: The total size of the data in the store
+        """
+        return sum(
+            os.path.getsize(os.path.join(self.directory, f))
+            for f in os.listdir(self.directory)
+        )
+
+    def close(self):
+        """
+        Remove the store. Processes which still have the files mapped keep
+        their pages until they release them.
+        """
+        if self._reflections is not None:
+            self._reflections.close()
+            self._reflections = None
+            self._objects = {}
+            release()
+            shutil.rmtree(self.directory, ignore_errors=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
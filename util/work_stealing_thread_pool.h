@@ -0,0 +1,401 @@
+/*
+ * work_stealing_thread_pool.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_WORK_STEALING_THREAD_POOL_H
+#define DIALS_UTIL_WORK_STEALING_THREAD_POOL_H
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dials/error.h>
+#include <dials/util/numa.h>
+#include <dials/util/profile.h>
+
+namespace dials { namespace util {
+
+  /**
+   * A thread pool where each worker has its own queue of jobs. Jobs are
+   * posted to the queues in turn. A worker takes jobs from the front of its
+   * own queue, so jobs run roughly in the order they were posted, and when
+   * its queue is empty it steals from the back of the other queues. Idle
+   * workers and the thread waiting for the jobs to finish sleep on condition
+   * variables rather than spinning.
+   *
+   * If a job throws, the message of the first exception is kept and wait()
+   * throws a dials::error with it.
+   *
+   * The workers can be split into groups, one per NUMA node, with each group
+   * kept on the processors of its node. Jobs can then be posted to a node so
+   * they run near the memory they read, and idle workers steal from the
+   * queues of their own node before those of other nodes.
+   *
+   * Jobs may be posted from several threads at once, so a pool can be shared
+   * by several integrators running together. Each of them should then wait
+   * with wait_until for its own jobs rather than with wait, which waits for
+   * the jobs of all of them.
+   */
+  class WorkStealingThreadPool : public boost::noncopyable {
+  public:
+    typedef boost::function<void()> Job;
+
+    /**
+     * Instantiate with the number of required threads
+     * @param N The number of threads
+     * @param pin_threads Pin each worker to a separate core
+     * @param numa_nodes The number of groups of workers, each on a NUMA
+     *   node, or 0 to not group the workers
+     */
+    WorkStealingThreadPool(std::size_t N,
+                           bool pin_threads = false,
+                           std::size_t numa_nodes = 0)
+        : queues_(N),
+          node_(N, 0),
+          node_workers_(std::max<std::size_t>(1, std::min(numa_nodes, N))),
+          node_next_(node_workers_.size(), 0),
+          next_(0),
+          queued_(0),
+          started_(0),
+          finished_(0),
+          has_error_(false),
+          stop_(false) {
+      DIALS_ASSERT(N > 0);
+      for (std::size_t i = 0; i < N; ++i) {
+        queues_[i] = boost::make_shared<Queue>();
+        node_[i] = (i * node_workers_.size()) / N;
+        node_workers_[node_[i]].push_back(i);
+      }
+      std::vector<std::vector<int> > node_cpus;
+      if (numa_nodes > 0) {
+        node_cpus = numa_node_cpus();
+      }
+      for (std::size_t i = 0; i < N; ++i) {
+        threads_.create_thread(boost::bind(&WorkStealingThreadPool::worker,
+                                           this,
+                                           i,
+                                           worker_cpus(i, pin_threads, node_cpus)));
+      }
+    }
+
+    /**
+     * Finish any outstanding jobs and join all threads
+     */
+    ~WorkStealingThreadPool() {
+      {
+        boost::lock_guard<boost::mutex> lock(work_mutex_);
+        stop_ = true;
+      }
+      work_cond_.notify_all();
+      try {
+        threads_.join_all();
+      } catch (const std::exception &) {
+        // pass
+      }
+    }
+
+    /**
+     * @returns The number of threads
+     */
+    std::size_t size() const {
+      return queues_.size();
+    }
+
+    /**
+     * @returns The number of groups of workers
+     */
+    std::size_t num_nodes() const {
+      return node_workers_.size();
+    }
+
+    /**
+     * Post a function to the thread pool
+     * @param function The function to call
+     */
+    template <typename Function>
+    void post(Function function) {
+      std::size_t index = 0;
+      {
+        boost::lock_guard<boost::mutex> lock(post_mutex_);
+        index = next_++ % queues_.size();
+      }
+      push(index, function);
+    }
+
+    /**
+     * Post a function to the workers of a node
+     * @param function The function to call
+     * @param node The node
+     */
+    template <typename Function>
+    void post(Function function, std::size_t node) {
+      node %= node_workers_.size();
+      const std::vector<std::size_t> &workers = node_workers_[node];
+      std::size_t index = 0;
+      {
+        boost::lock_guard<boost::mutex> lock(post_mutex_);
+        index = workers[node_next_[node]++ % workers.size()];
+      }
+      push(index, function);
+    }
+
+    /**
+     * Wait until all posted jobs have finished
+     */
+    void wait() {
+      {
+        boost::unique_lock<boost::mutex> lock(done_mutex_);
+        while (finished_ < started_) {
+          done_cond_.wait(lock);
+        }
+      }
+      rethrow();
+    }
+
+    /**
+     * Wait until the predicate is true. The predicate is checked each time a
+     * job finishes, so it should only depend on state changed by the jobs.
+     * @param predicate The condition to wait for
+     */
+    template <typename Predicate>
+    void wait_until(Predicate predicate) {
+      {
+        boost::unique_lock<boost::mutex> lock(done_mutex_);
+        while (!predicate() && finished_ < started_) {
+          done_cond_.wait(lock);
+        }
+      }
+      rethrow();
+    }
+
+  protected:
+    /**
+     * The job queue for a single worker
+     */
+    struct Queue {
+      boost::mutex mutex;
+      std::deque<Job> jobs;
+    };
+
+    /**
+     * Add a function to the queue of a worker
+     */
+    template <typename Function>
+    void push(std::size_t index, Function function) {
+      {
+        boost::lock_guard<boost::mutex> lock(done_mutex_);
+        started_++;
+      }
+      Queue &queue = *queues_[index];
+      {
+        boost::lock_guard<boost::mutex> lock(queue.mutex);
+        queue.jobs.push_back(Job(function));
+      }
+      {
+        boost::lock_guard<boost::mutex> lock(work_mutex_);
+        queued_++;
+      }
+      work_cond_.notify_one();
+    }
+
+    /**
+     * Take a job from the front of the worker's own queue
+     */
+    bool pop(std::size_t index, Job &job) {
+      Queue &queue = *queues_[index];
+      boost::lock_guard<boost::mutex> lock(queue.mutex);
+      if (queue.jobs.empty()) {
+        return false;
+      }
+      job.swap(queue.jobs.front());
+      queue.jobs.pop_front();
+      return true;
+    }
+
+    /**
+     * Take a job from the back of another worker's queue, trying the workers
+     * on the same node first
+     */
+    bool steal(std::size_t index, Job &job) {
+      std::size_t npasses = node_workers_.size() > 1 ? 2 : 1;
+      for (std::size_t pass = 0; pass < npasses; ++pass) {
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+          std::size_t other = (index + i) % queues_.size();
+          if ((node_[other] == node_[index]) != (pass == 0)) {
+            continue;
+          }
+          Queue &queue = *queues_[other];
+          boost::lock_guard<boost::mutex> lock(queue.mutex);
+          if (!queue.jobs.empty()) {
+            job.swap(queue.jobs.back());
+            queue.jobs.pop_back();
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Run a job and signal anyone waiting that it has finished
+     */
+    void run(Job &job) {
+      try {
+        DIALS_PROFILE_SCOPE("thread_pool.job");
+        job();
+      } catch (const std::exception &e) {
+        set_error(e.what());
+      } catch (...) {
+        set_error("Unknown error in thread pool job");
+      }
+      job.clear();
+      {
+        boost::lock_guard<boost::mutex> lock(done_mutex_);
+        finished_++;
+      }
+      done_cond_.notify_all();
+    }
+
+    /**
+     * Keep the message of the first exception thrown by a job
+     */
+    void set_error(const char *message) {
+      boost::lock_guard<boost::mutex> lock(done_mutex_);
+      if (!has_error_) {
+        has_error_ = true;
+        error_ = message;
+      }
+    }
+
+    /**
+     * Throw the first exception thrown by a job
+     */
+    void rethrow() {
+      std::string message;
+      {
+        boost::lock_guard<boost::mutex> lock(done_mutex_);
+        if (!has_error_) {
+          return;
+        }
+        has_error_ = false;
+        message.swap(error_);
+      }
+      throw dials::error(message);
+    }
+
+    /**
+     * Get the processors a worker may run on. Grouped workers run on the
+     * processors of their node, or on one of them if pinned; other pinned
+     * workers run on a core each.
+     * @returns The processors, or an empty list for any
+     */
+    std::vector<int> worker_cpus(
+      std::size_t index,
+      bool pin_threads,
+      const std::vector<std::vector<int> > &node_cpus) const {
+      std::vector<int> cpus;
+      if (!node_cpus.empty()) {
+        cpus = node_cpus[node_[index] % node_cpus.size()];
+        if (pin_threads) {
+          std::size_t rank = index - node_workers_[node_[index]][0];
+          cpus = std::vector<int>(1, cpus[rank % cpus.size()]);
+        }
+      } else if (pin_threads) {
+        std::size_t ncores = boost::thread::hardware_concurrency();
+        if (ncores > 0) {
+          cpus.push_back(index % ncores);
+        }
+      }
+      return cpus;
+    }
+
+    /**
+     * The worker loop. Run jobs while there are any, then sleep until more
+     * are posted or the pool is destroyed.
+     */
+    void worker(std::size_t index, std::vector<int> cpus) {
+      pin_to_cpus(cpus);
+      Job job;
+      for (;;) {
+        if (pop(index, job)) {
+          queued_--;
+          run(job);
+          continue;
+        }
+        if (steal(index, job)) {
+          DIALS_PROFILE_COUNT("thread_pool.steals", 1);
+          queued_--;
+          run(job);
+          continue;
+        }
+        boost::unique_lock<boost::mutex> lock(work_mutex_);
+        while (!stop_ && queued_ <= 0) {
+          work_cond_.wait(lock);
+        }
+        if (stop_ && queued_ <= 0) {
+          return;
+        }
+      }
+    }
+
+    std::vector<boost::shared_ptr<Queue> > queues_;
+    std::vector<std::size_t> node_;
+    std::vector<std::vector<std::size_t> > node_workers_;
+    std::vector<std::size_t> node_next_;
+    boost::thread_group threads_;
+    std::size_t next_;
+    boost::mutex post_mutex_;
+    boost::mutex work_mutex_;
+    boost::condition_variable work_cond_;
+    boost::atomic<long> queued_;
+    boost::mutex done_mutex_;
+    boost::condition_variable done_cond_;
+    std::size_t started_;
+    std::size_t finished_;
+    std::string error_;
+    bool has_error_;
+    bool stop_;
+  };
+
+  /**
+   * Split a range of items into contiguous chunks and call a function for
+   * each chunk on a pool of threads. The function is called with the first
+   * and last (exclusive) item of the chunk. There are a few chunks per thread
+   * to balance the work; with one thread the function is called once for the
+   * whole range on the calling thread.
+   * @param size The number of items
+   * @param nthreads The number of threads
+   * @param function The function to call
+   */
+  template <typename Function>
+  void parallel_for(std::size_t size, std::size_t nthreads, Function function) {
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_PROFILE_SCOPE("parallel_for");
+    std::size_t nchunks = std::min(4 * nthreads, size);
+    if (nthreads == 1 || nchunks <= 1) {
+      function(std::size_t(0), size);
+      return;
+    }
+    WorkStealingThreadPool pool(std::min(nthreads, nchunks));
+    for (std::size_t i = 0; i < nchunks; ++i) {
+      std::size_t first = (i * size) / nchunks;
+      std::size_t last = ((i + 1) * size) / nchunks;
+      pool.post(boost::bind<void>(function, first, last));
+    }
+    pool.wait();
+  }
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_WORK_STEALING_THREAD_POOL_H
@@ -24,7 +24,12 @@ namespace dials { namespace viewer { namespace boost_python {
 
       .def("gen_bmp",
            &rgb_img::gen_bmp,
-           (arg("data2d"), arg("mask2d"), arg("show_nums"), arg("palette_num")));
+           (arg("data2d"),
+            arg("mask2d"),
+            arg("show_nums"),
+            arg("palette_num"),
+            arg("nthreads") = 1,
+            arg("binning") = 1));
 
     // def("tst_ref_prod", &tst_ref_prod, arg("matr01"), arg("matr02"));
   }
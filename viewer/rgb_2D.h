@@ -14,11 +14,14 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <vector>
 #include <scitbx/array_family/flex_types.h>
 
 #include <dials/viewer/fonts_2D.h>
 #include <dials/viewer/mask_bmp_2D.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/util/work_stealing_thread_pool.h>
+#include <dials/error.h>
 
 namespace dials { namespace viewer { namespace boost_python {
   using scitbx::af::flex_double;
@@ -77,68 +80,289 @@ namespace dials { namespace viewer { namespace boost_python {
 
   */
 
-  class rgb_img {
-  private:
-    int hot_pal_red_byte[255 * 3 + 1];
-    int hot_pal_green_byte[255 * 3 + 1];
-    int hot_pal_blue_byte[255 * 3 + 1];
+  namespace detail {
+
+    /**
+     * The palettes, fonts and mask patterns used to render an image. These
+     * never change so they are built once and shared by every rgb_img.
+     */
+    struct rgb_tables {
+      // The (r, g, b) colour of each of the 766 intensity levels of each
+      // palette; indexed by palette_num - 1.
+      unsigned char palette[4][255 * 3 + 1][3];
+
+      int font_vol[14][7][16];
+      int mask_vol[85][85][4];
+
+      rgb_tables() {
+        int gray[255 * 3 + 1];
+        int red[255 * 3 + 1];
+        int green[255 * 3 + 1];
+        int blue[255 * 3 + 1];
+
+        // Generating grayscale palette
+        for (int i = 0; i < 255 * 3; i++) {
+          gray[i] = int(i / 3);
+        }
+        gray[765] = 255;
 
-    int gray_all_rgb_byte[255 * 3 + 1];
+        // Generating hot colour palette
+        for (int i = 0; i < 255 * 3; i++) {
+          red[i] = i < 255 ? i : 255;
+          green[i] = i < 255 ? 0 : (i < 255 * 2 ? i - 255 : 255);
+          blue[i] = i < 255 * 2 ? 0 : i - 255 * 2;
+        }
+        red[765] = 255;
+        green[765] = 255;
+        blue[765] = 255;
+
+        // The descending palettes are looked up with 765 - scaled_pixel
+        // directly so they share the ascending tables
+        for (int i = 0; i < 255 * 3 + 1; i++) {
+          for (int k = 0; k < 3; k++) {
+            palette[0][i][k] = palette[1][i][k] = (unsigned char)gray[i];
+          }
+          palette[2][i][0] = palette[3][i][0] = (unsigned char)red[i];
+          palette[2][i][1] = palette[3][i][1] = (unsigned char)green[i];
+          palette[2][i][2] = palette[3][i][2] = (unsigned char)blue[i];
+        }
 
-    double max, min;
-    int err_conv;
+        int err_conv = get_font_img_array(font_vol);
+        if (err_conv != 0) {
+          std::cout << "\n ERROR Building fonts internally \n error code =" << err_conv
+                    << "\n";
+        }
+        err_conv = get_mask_img_array(mask_vol);
+        if (err_conv != 0) {
+          std::cout << "\n ERROR Building mask internally \n error code =" << err_conv
+                    << "\n";
+        }
+      }
+    };
 
-    int font_vol[14][7][16];
-    int mask_vol[85][85][4];
+    /** @returns The shared rendering tables */
+    inline const rgb_tables &get_rgb_tables() {
+      static const rgb_tables tables;
+      return tables;
+    }
 
-  public:
-    rgb_img() {
-      // Generating grayscale palette
-      for (int i = 0; i < 255 * 3; i++) {
-        gray_all_rgb_byte[i] = int(i / 3);
+    /**
+     * Render a range of rows of an image. Each pixel is either one pixel of
+     * the bitmap or, for small images, a px_scale x px_scale block with the
+     * mask pattern and the pixel value painted into it.
+     */
+    class RgbRenderJob {
+    public:
+      RgbRenderJob(const double *data,
+                   const double *mask,
+                   int *bmp,
+                   int ncol,
+                   int px_scale,
+                   double min,
+                   double max,
+                   bool show_nums,
+                   int palette_num)
+          : tables_(&get_rgb_tables()),
+            data_(data),
+            mask_(mask),
+            bmp_(bmp),
+            ncol_(ncol),
+            px_scale_(px_scale),
+            min_(min),
+            max_(max),
+            dif_(max - min),
+            show_nums_(show_nums),
+            palette_num_(palette_num >= 1 && palette_num <= 4 ? palette_num : 4) {}
+
+      void operator()(std::size_t first, std::size_t last) const {
+        const unsigned char(*palette)[3] = tables_->palette[palette_num_ - 1];
+        bool reverse = palette_num_ == 2 || palette_num_ == 4;
+        for (std::size_t row = first; row < last; row++) {
+          const double *data_row = data_ + row * ncol_;
+          if (px_scale_ == 1) {
+            // Without any decoration a row is a plain table lookup
+            int *bmp_row = bmp_ + row * ncol_ * 3;
+            for (int col = 0; col < ncol_; col++) {
+              const unsigned char *rgb =
+                palette[index(scaled_pixel(data_row[col]), reverse)];
+              bmp_row[col * 3 + 0] = rgb[0];
+              bmp_row[col * 3 + 1] = rgb[1];
+              bmp_row[col * 3 + 2] = rgb[2];
+            }
+          } else {
+            const double *mask_row = mask_ + row * ncol_;
+            for (int col = 0; col < ncol_; col++) {
+              paint_cell(
+                row, col, data_row[col], int(mask_row[col]), palette, reverse);
+            }
+          }
+        }
       }
-      gray_all_rgb_byte[765] = 255;
 
-      // Generating hot colour palette
-      for (int i = 0; i < 255; i++) {
-        hot_pal_red_byte[i] = i;
-        hot_pal_green_byte[i + 255] = i;
-        hot_pal_blue_byte[i + 255 * 2] = i;
+    private:
+      /** @returns The value clamped and scaled to the range of the palette */
+      double scaled_pixel(double loc_cel) const {
+        if (loc_cel > max_) {
+          loc_cel = max_;
+        }
+        if (loc_cel < min_) {
+          loc_cel = min_;
+        }
+        return dif_ > 0 ? 255.0 * 3 * ((loc_cel - min_) / dif_) : 0.0;
       }
 
-      for (int i = 255; i < 255 * 3; i++) {
-        hot_pal_red_byte[i] = 255;
+      /** @returns The palette entry of a scaled value */
+      static int index(double scaled_pixel, bool reverse) {
+        return reverse ? int(765 - scaled_pixel) : int(scaled_pixel);
       }
 
-      for (int i = 0; i < 255; i++) {
-        hot_pal_green_byte[i] = 0;
+      /** Set a pixel of the bitmap */
+      void set(int pix_row, int pix_col, int r, int g, int b) const {
+        int *rgb = bmp_ + ((std::size_t)pix_row * ncol_ * px_scale_ + pix_col) * 3;
+        rgb[0] = r;
+        rgb[1] = g;
+        rgb[2] = b;
       }
 
-      for (int i = 255 * 2; i < 255 * 3; i++) {
-        hot_pal_green_byte[i] = 255;
+      void paint_cell(int row,
+                      int col,
+                      double value,
+                      int loc_cel_int,
+                      const unsigned char (*palette)[3],
+                      bool reverse) const {
+        double scaled = scaled_pixel(value);
+        const unsigned char *rgb = palette[index(scaled, reverse)];
+
+        // painting the scaled pixel with the selected palette
+        for (int pix_row = row * px_scale_; pix_row < (row + 1) * px_scale_;
+             pix_row++) {
+          for (int pix_col = col * px_scale_; pix_col < (col + 1) * px_scale_;
+               pix_col++) {
+            set(pix_row, pix_col, rgb[0], rgb[1], rgb[2]);
+          }
+        }
+
+        // Painting mask into the scaled pixel
+        bool layer[4] = {(loc_cel_int & Valid) == Valid,
+                         (loc_cel_int & Foreground) == Foreground,
+                         (loc_cel_int & BackgroundUsed) == BackgroundUsed,
+                         (loc_cel_int & Background) == Background};
+        if (layer[0] || layer[1] || layer[2] || layer[3]) {
+          bool gray = palette_num_ == 1 || palette_num_ == 2;
+          for (int mask_pix_row = 0; mask_pix_row < px_scale_; mask_pix_row++) {
+            for (int mask_pix_col = 0; mask_pix_col < px_scale_; mask_pix_col++) {
+              const int *pattern = tables_->mask_vol[mask_pix_row][mask_pix_col];
+              if ((layer[0] && pattern[0] == 1) || (layer[1] && pattern[1] == 1)
+                  || (layer[2] && pattern[2] == 1) || (layer[3] && pattern[3] == 1)) {
+                int pix_row = row * px_scale_ + mask_pix_row;
+                int pix_col = col * px_scale_ + mask_pix_col;
+                if (gray) {
+                  set(pix_row, pix_col, 250, 50, 50);
+                } else {
+                  set(pix_row, pix_col, 150, 150, 150);
+                }
+              }
+            }
+          }
+        }
+
+        // Painting intensity value into the scaled pixel
+        if (show_nums_) {
+          int digit_val[15];
+          if (get_digits(value, digit_val) == 0) {
+            // The colour of the digits contrasts with the colour of the pixel
+            int r = 0, g = 0, b = 255;
+            bool dark = scaled < 255;
+            bool light = scaled > 255 * 2;
+            if (dark || light) {
+              bool yellow = (palette_num_ == 1 || palette_num_ == 3) ? dark : light;
+              r = g = yellow ? 255 : 0;
+              b = 0;
+            }
+            for (int dg_num = 0; dg_num < 12 && digit_val[dg_num] != 15; dg_num++) {
+              for (int font_pix_col = 0; font_pix_col < 7; font_pix_col++) {
+                for (int font_pix_row = 0; font_pix_row < 14; font_pix_row++) {
+                  if (tables_->font_vol[font_pix_row][font_pix_col][digit_val[dg_num]]
+                      == 1) {
+                    set(row * px_scale_ + 14 + font_pix_row,
+                        col * px_scale_ + dg_num * 7 + font_pix_col,
+                        r,
+                        g,
+                        b);
+                  }
+                }
+              }
+            }
+          }
+        }
       }
 
-      for (int i = 0; i < 255 * 2; i++) {
-        hot_pal_blue_byte[i] = 0;
+      const rgb_tables *tables_;
+      const double *data_;
+      const double *mask_;
+      int *bmp_;
+      int ncol_;
+      int px_scale_;
+      double min_;
+      double max_;
+      double dif_;
+      bool show_nums_;
+      int palette_num_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * Reduce an image by taking the maximum of each binning x binning block of
+   * pixels, so that strong pixels stay visible in a zoomed out view. The mask
+   * codes of a block are combined with a bitwise or.
+   * @param data2d The image
+   * @param mask2d The mask codes
+   * @param binning The size of the blocks
+   * @param data_out The reduced image
+   * @param mask_out The reduced mask
+   */
+  inline void bin_image(const flex_double &data2d,
+                        const flex_double &mask2d,
+                        int binning,
+                        flex_double &data_out,
+                        flex_double &mask_out) {
+    DIALS_ASSERT(binning > 0);
+    int nrow = data2d.accessor().all()[0];
+    int ncol = data2d.accessor().all()[1];
+    int brow = (nrow + binning - 1) / binning;
+    int bcol = (ncol + binning - 1) / binning;
+    data_out = flex_double(flex_grid<>(brow, bcol), 0);
+    mask_out = flex_double(flex_grid<>(brow, bcol), 0);
+    std::vector<bool> first(brow * bcol, true);
+    std::vector<int> code(brow * bcol, 0);
+    for (int row = 0; row < nrow; row++) {
+      for (int col = 0; col < ncol; col++) {
+        int k = (row / binning) * bcol + col / binning;
+        double value = data2d[row * ncol + col];
+        if (first[k] || value > data_out[k]) {
+          data_out[k] = value;
+          first[k] = false;
+        }
+        code[k] |= int(mask2d[row * ncol + col]);
       }
+    }
+    for (std::size_t k = 0; k < code.size(); k++) {
+      mask_out[k] = code[k];
+    }
+  }
 
-      hot_pal_blue_byte[765] = 255;
-      hot_pal_green_byte[765] = 255;
-      hot_pal_red_byte[765] = 255;
+  class rgb_img {
+  private:
+    double max, min;
+
+  public:
+    rgb_img() {
+      // Build the shared tables up front rather than on the first render
+      detail::get_rgb_tables();
 
       max = -1;
       min = -1;
-
-      err_conv = get_font_img_array(font_vol);
-      if (err_conv != 0) {
-        std::cout << "\n ERROR Building fonts internally \n error code =" << err_conv
-                  << "\n";
-      }
-      err_conv = get_mask_img_array(mask_vol);
-      if (err_conv != 0) {
-        std::cout << "\n ERROR Building mask internally \n error code =" << err_conv
-                  << "\n";
-      }
     }
 
     int set_min_max(double new_min, double new_max) {
@@ -154,225 +378,68 @@ namespace dials { namespace viewer { namespace boost_python {
       return 0;
     }
 
-    flex_int gen_bmp(flex_double& data2d,
-                     flex_double& mask2d,
+    /**
+     * Render an image and its mask as an RGB bitmap
+     * @param data2d The image
+     * @param mask2d The mask codes
+     * @param show_nums Paint the pixel values into the magnified pixels
+     * @param palette_num 1 black2white, 2 white2black, 3 hot ascend, 4 hot descend
+     * @param nthreads The number of threads to render with
+     * @param binning Render the maximum of each binning x binning block
+     * @returns The bitmap (row, col, rgb)
+     */
+    flex_int gen_bmp(flex_double &data2d,
+                     flex_double &mask2d,
                      bool show_nums,
-                     int palette_num) {
-      // debugging palette number passed from Python
-      /*
-      std::cout << "\n show_nums =" << show_nums << "\n";
-      std::cout << "\n palette_num =" << palette_num << "\n";
-      */
-
-      // Python code that enumerates palette
-      /*
-          print "palette =", palette
-          if( palette == "black2white" ):
-            palette_num = 1
-          elif( palette == "white2black" ):
-            palette_num = 2
-          elif( palette == "hot ascend" ):
-            palette_num = 3
-          else: # assuming "hot descend"
-            palette_num = 4
-      */
+                     int palette_num,
+                     std::size_t nthreads = 1,
+                     int binning = 1) {
+      DIALS_ASSERT(data2d.accessor().nd() == 2);
+      DIALS_ASSERT(data2d.accessor().all_eq(mask2d.accessor()));
+      DIALS_ASSERT(binning > 0);
+      if (binning > 1) {
+        flex_double data_binned, mask_binned;
+        bin_image(data2d, mask2d, binning, data_binned, mask_binned);
+        return gen_bmp(data_binned, mask_binned, show_nums, palette_num, nthreads);
+      }
 
       int nrow = data2d.accessor().all()[0];
       int ncol = data2d.accessor().all()[1];
-      int col, row;
-      double loc_cel, dif = 0;
-      int loc_cel_int;
-
-      // flex_double scaled_array(flex_grid<>(nrow, ncol),0);
-
-      if (max == -1 && min == -1) {
-        for (row = 0; row < nrow; row++) {
-          for (col = 0; col < ncol; col++) {
-            loc_cel = data2d(row, col);
-            if (row == 0 && col == 0) {
-              max = loc_cel;
-              min = loc_cel;
-            } else {
-              if (loc_cel > max) {
-                max = loc_cel;
-              }
-              if (loc_cel < min) {
-                min = loc_cel;
-              }
-            }
+
+      if (max == -1 && min == -1 && data2d.size() > 0) {
+        const double *data = data2d.begin();
+        max = min = data[0];
+        for (std::size_t i = 1; i < data2d.size(); i++) {
+          if (data[i] > max) {
+            max = data[i];
+          }
+          if (data[i] < min) {
+            min = data[i];
           }
         }
       }
 
-      dif = max - min;
-
       int px_scale = 0;
 
       if (ncol < 200 && nrow < 200) {
         px_scale = 85;
-        // std::cout << "less than (200 * 200) pixels \n";
       } else {
         px_scale = 1;
       }
-      // std::cout << "\n px_scale = " << px_scale << "\n";
 
       flex_int bmp_dat(flex_grid<>(nrow * px_scale, ncol * px_scale, 3), 0);
 
-      int digit_val[15];
-      int pix_row, pix_col;
-
-      int mask_pix_col, mask_pix_row;
-      double scaled_pixel;
-
-      // std::cout << "\n ncol =" << ncol << " \n";
-      // std::cout << "\n nrow =" << nrow << " \n";
-      // std::cout << "\n palette_num =" << palette_num << "\n";
-
-      for (row = 0; row < nrow; row++) {
-        for (col = 0; col < ncol; col++) {
-          loc_cel = data2d(row, col);
-          if (loc_cel > max) {
-            loc_cel = max;
-          }
-          if (loc_cel < min) {
-            loc_cel = min;
-          }
-          scaled_pixel = 255.0 * 3 * ((loc_cel - min) / dif);
-
-          loc_cel_int = int(mask2d(row, col));
-
-          if (px_scale > 1) {
-            // painting the scaled pixel with the *hot* color convention
-            for (pix_col = col * px_scale; pix_col < col * px_scale + px_scale;
-                 pix_col++) {
-              for (pix_row = row * px_scale; pix_row < row * px_scale + px_scale;
-                   pix_row++) {
-                if (palette_num == 1) {
-                  bmp_dat(pix_row, pix_col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-                } else if (palette_num == 2) {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                } else if (palette_num == 3) {
-                  bmp_dat(pix_row, pix_col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-                } else {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    hot_pal_red_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    hot_pal_green_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    hot_pal_blue_byte[int(765 - scaled_pixel)];
-                }
-              }
-            }
-
-            // Painting mask into the scaled pixel
-            for (mask_pix_col = 0, pix_col = col * px_scale; mask_pix_col < px_scale;
-                 pix_col++, mask_pix_col++) {
-              for (mask_pix_row = 0, pix_row = row * px_scale; mask_pix_row < px_scale;
-                   pix_row++, mask_pix_row++) {
-                if ((mask_vol[mask_pix_row][mask_pix_col][0] == 1
-                     && ((loc_cel_int & Valid) == Valid))
-                    || (mask_vol[mask_pix_row][mask_pix_col][1] == 1
-                        && ((loc_cel_int & Foreground) == Foreground))
-
-                    || (mask_vol[mask_pix_row][mask_pix_col][2] == 1
-                        && ((loc_cel_int & BackgroundUsed) == BackgroundUsed))
-                    || (mask_vol[mask_pix_row][mask_pix_col][3] == 1
-                        && ((loc_cel_int & Background) == Background))) {
-                  if (palette_num == 1 || palette_num == 2) {
-                    bmp_dat(pix_row, pix_col, 0) = 250;
-                    bmp_dat(pix_row, pix_col, 1) = 50;
-                    bmp_dat(pix_row, pix_col, 2) = 50;
-                  } else {
-                    bmp_dat(pix_row, pix_col, 0) = 150;
-                    bmp_dat(pix_row, pix_col, 1) = 150;
-                    bmp_dat(pix_row, pix_col, 2) = 150;
-                  }
-                }
-              }
-            }
-
-            // Painting intensity value into the scaled pixel
-
-            if (show_nums == true) {
-              err_conv = get_digits(data2d(row, col), digit_val);
-              if (err_conv == 0) {
-                // std::cout << "data2d(row, col) = " << data2d(row, col) << "\n";
-                for (int dg_num = 0; dg_num < 12 && digit_val[dg_num] != 15; dg_num++) {
-                  for (int font_pix_col = 0, pix_col = col * px_scale + dg_num * 7;
-                       font_pix_col < 7;
-                       pix_col++, font_pix_col++) {
-                    for (int font_pix_row = 0, pix_row = row * px_scale + 14;
-                         font_pix_row < 14;
-                         pix_row++, font_pix_row++) {
-                      if (font_vol[font_pix_row][font_pix_col][digit_val[dg_num]]
-                          == 1) {
-                        if (palette_num == 1 || palette_num == 3) {
-                          if (scaled_pixel < 255) {
-                            bmp_dat(pix_row, pix_col, 0) = 255;
-                            bmp_dat(pix_row, pix_col, 1) = 255;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else if (scaled_pixel > 255 * 2) {
-                            bmp_dat(pix_row, pix_col, 0) = 0;
-                            bmp_dat(pix_row, pix_col, 1) = 0;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else {
-                            bmp_dat(pix_row, pix_col, 0) = 00;
-                            bmp_dat(pix_row, pix_col, 1) = 00;
-                            bmp_dat(pix_row, pix_col, 2) = 255;
-                          }
-                        } else {
-                          if (scaled_pixel < 255) {
-                            bmp_dat(pix_row, pix_col, 0) = 0;
-                            bmp_dat(pix_row, pix_col, 1) = 0;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else if (scaled_pixel > 255 * 2) {
-                            bmp_dat(pix_row, pix_col, 0) = 255;
-                            bmp_dat(pix_row, pix_col, 1) = 255;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else {
-                            bmp_dat(pix_row, pix_col, 0) = 00;
-                            bmp_dat(pix_row, pix_col, 1) = 00;
-                            bmp_dat(pix_row, pix_col, 2) = 255;
-                          }
-                        }
-                      }
-                    }
-                  }
-                }
-              }
-            }
-
-          } else {
-            if (palette_num == 1) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-            } else if (palette_num == 2) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-            } else if (palette_num == 3) {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-            } else {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(765 - scaled_pixel)];
-            }
-          }
-        }
-      }
-      // std::cout << "\n building BMP \n";
+      dials::util::parallel_for(nrow,
+                                nthreads,
+                                detail::RgbRenderJob(data2d.begin(),
+                                                     mask2d.begin(),
+                                                     bmp_dat.begin(),
+                                                     ncol,
+                                                     px_scale,
+                                                     min,
+                                                     max,
+                                                     show_nums,
+                                                     palette_num));
 
       return bmp_dat;
     }